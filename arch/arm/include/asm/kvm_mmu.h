@@ -177,6 +177,22 @@ static inline bool kvm_s2pte_readonly(pte_t *pte)
 	return (pte_val(*pte) & L_PTE_S2_RDWR) == L_PTE_S2_RDONLY;
 }
 
+/* No fast path for dirty logging write faults on 32bit */
+static inline void kvm_set_s2pte_log_wp(pte_t *pte)
+{
+	kvm_set_s2pte_readonly(pte);
+}
+
+static inline bool kvm_s2pte_log_wp(pte_t *pte)
+{
+	return false;
+}
+
+static inline pte_t kvm_s2pte_clear_log_wp(pte_t pte)
+{
+	return pte;
+}
+
 static inline bool kvm_s2pte_exec(pte_t *pte)
 {
 	return !(pte_val(*pte) & L_PTE_XN);
@@ -450,6 +450,7 @@ static inline bool kvm_arm_is_pvsched_enabled(struct kvm_vcpu_arch *vcpu_arch)
 
 void kvm_update_pvsched_preempted(struct kvm_vcpu *vcpu, u32 preempted);
 int kvm_hypercall_pvsched_features(struct kvm_vcpu *vcpu);
+int kvm_hypercall_pvsched_yield(struct kvm_vcpu *vcpu);
 
 void kvm_set_sei_esr(struct kvm_vcpu *vcpu, u64 syndrome);
 
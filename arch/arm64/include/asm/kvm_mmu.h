@@ -249,6 +249,37 @@ static inline bool kvm_s2pte_readonly(pte_t *ptep)
 	return (READ_ONCE(pte_val(*ptep)) & PTE_S2_RDWR) == PTE_S2_RDONLY;
 }
 
+/*
+ * Software bit for PTEs that are only read-only because dirty logging
+ * write-protected them: a write fault on such a PTE can give write access
+ * back without going through the host page tables again.
+ */
+#define PTE_S2_LOG_WP		(_AT(pteval_t, 1) << 55)
+
+static inline void kvm_set_s2pte_log_wp(pte_t *ptep)
+{
+	pteval_t old_pteval, pteval;
+
+	pteval = READ_ONCE(pte_val(*ptep));
+	do {
+		old_pteval = pteval;
+		pteval &= ~PTE_S2_RDWR;
+		pteval |= PTE_S2_RDONLY | PTE_S2_LOG_WP;
+		pteval = cmpxchg_relaxed(&pte_val(*ptep), old_pteval, pteval);
+	} while (pteval != old_pteval);
+}
+
+static inline bool kvm_s2pte_log_wp(pte_t *ptep)
+{
+	return READ_ONCE(pte_val(*ptep)) & PTE_S2_LOG_WP;
+}
+
+static inline pte_t kvm_s2pte_clear_log_wp(pte_t pte)
+{
+	pte_val(pte) &= ~PTE_S2_LOG_WP;
+	return pte;
+}
+
 static inline bool kvm_s2pte_exec(pte_t *ptep)
 {
 	return !(READ_ONCE(pte_val(*ptep)) & PTE_S2_XN);
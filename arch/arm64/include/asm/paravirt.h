@@ -3,6 +3,7 @@
 #define _ASM_ARM64_PARAVIRT_H
 
 #ifdef CONFIG_PARAVIRT
+struct cpumask;
 struct static_key;
 extern struct static_key paravirt_steal_enabled;
 extern struct static_key paravirt_steal_rq_enabled;
@@ -13,6 +14,7 @@ struct pv_time_ops {
 
 struct pv_sched_ops {
 	bool (*vcpu_is_preempted)(int cpu);
+	void (*yield_to_preempted)(const struct cpumask *mask);
 };
 
 struct paravirt_patch_template {
@@ -35,9 +37,16 @@ static inline bool pv_vcpu_is_preempted(int cpu)
 	return pv_ops.sched.vcpu_is_preempted(cpu);
 }
 
+void __native_yield_to_preempted(const struct cpumask *mask);
+static inline void pv_yield_to_preempted(const struct cpumask *mask)
+{
+	pv_ops.sched.yield_to_preempted(mask);
+}
+
 #else
 
 #define pv_sched_init() do {} while (0)
+#define pv_yield_to_preempted(mask) do {} while (0)
 
 #endif /* CONFIG_PARAVIRT */
 
@@ -0,0 +1,12 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __ASM_TLBBATCH_H
+#define __ASM_TLBBATCH_H
+
+struct arch_tlbflush_unmap_batch {
+	/*
+	 * TLBI broadcasts to every CPU in the inner shareable domain, so
+	 * there is no cpumask to track, only a DSB left to issue.
+	 */
+};
+
+#endif /* __ASM_TLBBATCH_H */
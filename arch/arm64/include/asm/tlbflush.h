@@ -23,6 +23,7 @@
 
 #include <linux/mm_types.h>
 #include <linux/sched.h>
+#include <asm/cpufeature.h>
 #include <asm/cputype.h>
 #include <asm/mmu.h>
 
@@ -70,6 +71,59 @@
 		__ta;						\
 	})
 
+/*
+ * ARMv8.4 TLBI range operations, emitted by their system instruction
+ * encoding so that assemblers without ARMv8.4 support can still build
+ * them. None of the CPUs with ARM64_WORKAROUND_REPEAT_TLBI implement them.
+ */
+#define __TLBI_RANGE_rvae1is	"sys #0, c8, c2, #1"
+#define __TLBI_RANGE_rvale1is	"sys #0, c8, c2, #5"
+
+#define __tlbi_range(op, arg)						\
+	asm (__TLBI_RANGE_##op ", %0" : : "r" (arg))
+
+#define __tlbi_range_user(op, arg) do {					\
+	if (arm64_kernel_unmapped_at_el0())				\
+		__tlbi_range(op, (arg) | USER_ASID_FLAG);		\
+} while (0)
+
+#if defined(CONFIG_ARM64_64K_PAGES)
+#define __TLBI_RANGE_TG		3UL
+#elif defined(CONFIG_ARM64_16K_PAGES)
+#define __TLBI_RANGE_TG		2UL
+#else
+#define __TLBI_RANGE_TG		1UL
+#endif
+
+/*
+ * Operand of the TLBI range operations, which invalidate
+ * (NUM + 1) * 2^(5 * SCALE + 1) pages starting at BADDR:
+ *
+ * |63  48|47 46|45   44|43 39|38 37|36    0|
+ * | ASID | TG  | SCALE | NUM | TTL | BADDR |
+ *
+ * BADDR is in units of the translation granule given by TG, TTL is left
+ * as 0 since the level of the entries is not known.
+ */
+#define __TLBI_VADDR_RANGE(addr, asid, scale, num)		\
+	({							\
+		unsigned long __ta = (addr) >> PAGE_SHIFT;	\
+		__ta &= GENMASK_ULL(36, 0);			\
+		__ta |= (unsigned long)(num) << 39;		\
+		__ta |= (unsigned long)(scale) << 44;		\
+		__ta |= __TLBI_RANGE_TG << 46;			\
+		__ta |= (unsigned long)(asid) << 48;		\
+		__ta;						\
+	})
+
+#define __TLBI_RANGE_PAGES(num, scale)				\
+	((unsigned long)((num) + 1) << (5 * (scale) + 1))
+#define MAX_TLBI_RANGE_PAGES	__TLBI_RANGE_PAGES(31, 3)
+
+/* The largest NUM for @pages at @scale, -1 if @pages is too small */
+#define __TLBI_RANGE_NUM(pages, scale)				\
+	((int)(((pages) >> (5 * (scale) + 1)) & 0x1f) - 1)
+
 /*
  *	TLB Invalidation
  *	================
@@ -161,11 +215,68 @@ static inline void flush_tlb_all(void)
  */
 #define MAX_TLBI_OPS	PTRS_PER_PTE
 
+static inline bool __flush_tlb_range_limit_excess(unsigned long start,
+						  unsigned long end,
+						  unsigned long stride)
+{
+	if (system_supports_tlb_range())
+		return ((end - start) >> PAGE_SHIFT) >= MAX_TLBI_RANGE_PAGES;
+
+	return (end - start) >= (MAX_TLBI_OPS * stride);
+}
+
+/*
+ * Broadcast the invalidation of [start, end) without waiting for it to
+ * complete, the caller provides the surrounding DSBs. When the CPUs have
+ * TLBI range operations, an odd page is invalidated on its own and the
+ * rest takes at most one range operation per SCALE, instead of one TLBI
+ * per page.
+ */
+static inline void __flush_tlb_range_op(unsigned long asid,
+					unsigned long start, unsigned long end,
+					unsigned long stride, bool last_level)
+{
+	unsigned long pages = (end - start) >> PAGE_SHIFT;
+	unsigned long addr;
+	int scale = 0;
+	int num;
+
+	while (pages > 0) {
+		if (!system_supports_tlb_range() || pages % 2 == 1) {
+			addr = __TLBI_VADDR(start, asid);
+			if (last_level) {
+				__tlbi(vale1is, addr);
+				__tlbi_user(vale1is, addr);
+			} else {
+				__tlbi(vae1is, addr);
+				__tlbi_user(vae1is, addr);
+			}
+			start += stride;
+			pages -= stride >> PAGE_SHIFT;
+			continue;
+		}
+
+		num = __TLBI_RANGE_NUM(pages, scale);
+		if (num >= 0) {
+			addr = __TLBI_VADDR_RANGE(start, asid, scale, num);
+			if (last_level) {
+				__tlbi_range(rvale1is, addr);
+				__tlbi_range_user(rvale1is, addr);
+			} else {
+				__tlbi_range(rvae1is, addr);
+				__tlbi_range_user(rvae1is, addr);
+			}
+			start += __TLBI_RANGE_PAGES(num, scale) << PAGE_SHIFT;
+			pages -= __TLBI_RANGE_PAGES(num, scale);
+		}
+		scale++;
+	}
+}
+
 #ifdef CONFIG_ARM64_TLBI_IPI
 
 void flush_tlb_mm(struct mm_struct *mm);
-void flush_tlb_page_nosync(struct vm_area_struct *vma,
-				unsigned long uaddr);
+void __flush_tlb_page_nosync(struct mm_struct *mm, unsigned long uaddr);
 void __flush_tlb_range(struct vm_area_struct *vma, unsigned long start,
 		unsigned long end, unsigned long stride, bool last_level);
 bool test_tlbi_ipi_switch(void);
@@ -192,10 +303,10 @@ static inline void flush_tlb_mm(struct mm_struct *mm)
 	dsb(ish);
 }
 
-static inline void flush_tlb_page_nosync(struct vm_area_struct *vma,
-					 unsigned long uaddr)
+static inline void __flush_tlb_page_nosync(struct mm_struct *mm,
+					   unsigned long uaddr)
 {
-	unsigned long addr = __TLBI_VADDR(uaddr, ASID(vma->vm_mm));
+	unsigned long addr = __TLBI_VADDR(uaddr, ASID(mm));
 
 	dsb(ishst);
 	__tlbi(vale1is, addr);
@@ -206,37 +317,26 @@ static inline void __flush_tlb_range(struct vm_area_struct *vma,
 				     unsigned long start, unsigned long end,
 				     unsigned long stride, bool last_level)
 {
-	unsigned long asid = ASID(vma->vm_mm);
-	unsigned long addr;
-
 	start = round_down(start, stride);
 	end = round_up(end, stride);
 
-	if ((end - start) >= (MAX_TLBI_OPS * stride)) {
+	if (__flush_tlb_range_limit_excess(start, end, stride)) {
 		flush_tlb_mm(vma->vm_mm);
 		return;
 	}
 
-	/* Convert the stride into units of 4k */
-	stride >>= 12;
-
-	start = __TLBI_VADDR(start, asid);
-	end = __TLBI_VADDR(end, asid);
-
 	dsb(ishst);
-	for (addr = start; addr < end; addr += stride) {
-		if (last_level) {
-			__tlbi(vale1is, addr);
-			__tlbi_user(vale1is, addr);
-		} else {
-			__tlbi(vae1is, addr);
-			__tlbi_user(vae1is, addr);
-		}
-	}
+	__flush_tlb_range_op(ASID(vma->vm_mm), start, end, stride, last_level);
 	dsb(ish);
 }
 #endif /* CONFIG_ARM64_TLBI_IPI */
 
+static inline void flush_tlb_page_nosync(struct vm_area_struct *vma,
+					 unsigned long uaddr)
+{
+	__flush_tlb_page_nosync(vma->vm_mm, uaddr);
+}
+
 static inline void flush_tlb_page(struct vm_area_struct *vma,
 				  unsigned long uaddr)
 {
@@ -286,6 +386,43 @@ static inline void __flush_tlb_kernel_pgtable(unsigned long kaddr)
 	dsb(ish);
 	isb();
 }
+
+#ifdef CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH
+static inline bool arch_tlbbatch_should_defer(struct mm_struct *mm)
+{
+	/*
+	 * With ARM64_WORKAROUND_REPEAT_TLBI every TLBI already carries its own
+	 * DSB, so there is nothing left to save by deferring the flush.
+	 */
+	return !cpus_have_const_cap(ARM64_WORKAROUND_REPEAT_TLBI);
+}
+
+/*
+ * The TLBI is broadcast as soon as the PTE is cleared, only the DSB
+ * waiting for its completion is deferred to arch_tlbbatch_flush(). A task
+ * migrating in between is covered by the DSB in __switch_to().
+ */
+static inline void arch_tlbbatch_add_pending(struct arch_tlbflush_unmap_batch *batch,
+					     struct mm_struct *mm,
+					     unsigned long uaddr)
+{
+	__flush_tlb_page_nosync(mm, uaddr);
+}
+
+/*
+ * A DSB only waits for the TLBIs issued by its own CPU, so a racing
+ * mprotect() or munmap() cannot rely on the reclaimer's pending ones.
+ */
+static inline void arch_flush_tlb_batched_pending(struct mm_struct *mm)
+{
+	flush_tlb_mm(mm);
+}
+
+static inline void arch_tlbbatch_flush(struct arch_tlbflush_unmap_batch *batch)
+{
+	dsb(ish);
+}
+#endif /* CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH */
 #endif
 
 #endif
@@ -131,6 +131,7 @@ cpufeature_pan_not_uao(const struct arm64_cpu_capabilities *entry, int __unused)
  * sync with the documentation of the CPU feature register ABI.
  */
 static const struct arm64_ftr_bits ftr_id_aa64isar0[] = {
+	ARM64_FTR_BITS(FTR_HIDDEN, FTR_STRICT, FTR_LOWER_SAFE, ID_AA64ISAR0_TLB_SHIFT, 4, 0),
 	ARM64_FTR_BITS(FTR_VISIBLE, FTR_STRICT, FTR_LOWER_SAFE, ID_AA64ISAR0_TS_SHIFT, 4, 0),
 	ARM64_FTR_BITS(FTR_VISIBLE, FTR_STRICT, FTR_LOWER_SAFE, ID_AA64ISAR0_FHM_SHIFT, 4, 0),
 	ARM64_FTR_BITS(FTR_VISIBLE, FTR_STRICT, FTR_LOWER_SAFE, ID_AA64ISAR0_DP_SHIFT, 4, 0),
@@ -1889,6 +1890,17 @@ static void verify_sve_features(void)
 	/* Add checks on other ZCR bits here if necessary */
 }
 
+static void verify_tlb_range(void)
+{
+	u64 isar0 = read_cpuid(ID_AA64ISAR0_EL1);
+
+	if (cpuid_feature_extract_unsigned_field(isar0, ID_AA64ISAR0_TLB_SHIFT) <
+	    ID_AA64ISAR0_TLB_RANGE) {
+		pr_crit("CPU%d: TLB range maintenance instructions missing\n",
+			smp_processor_id());
+		cpu_die_early();
+	}
+}
 
 /*
  * Run through the enabled system capabilities and enable() it on this CPU.
@@ -1915,6 +1927,9 @@ static void verify_local_cpu_capabilities(void)
 
 	if (system_supports_sve())
 		verify_sve_features();
+
+	if (system_supports_tlb_range())
+		verify_tlb_range();
 }
 
 void check_local_cpu_capabilities(void)
@@ -1948,6 +1963,25 @@ static void __init setup_boot_cpu_capabilities(void)
 DEFINE_STATIC_KEY_FALSE(arm64_const_caps_ready);
 EXPORT_SYMBOL(arm64_const_caps_ready);
 
+/*
+ * ARMv8.4 TLBI range operations. Tracked with a key of its own rather than
+ * a cpucap, late CPUs without them are parked by verify_tlb_range().
+ */
+DEFINE_STATIC_KEY_FALSE(arm64_tlbi_range);
+EXPORT_SYMBOL(arm64_tlbi_range);
+
+static void __init tlbi_range_setup(void)
+{
+	u64 isar0 = read_sanitised_ftr_reg(SYS_ID_AA64ISAR0_EL1);
+
+	if (cpuid_feature_extract_unsigned_field(isar0, ID_AA64ISAR0_TLB_SHIFT) <
+	    ID_AA64ISAR0_TLB_RANGE)
+		return;
+
+	static_branch_enable(&arm64_tlbi_range);
+	pr_info("TLB range maintenance instructions detected\n");
+}
+
 static void __init mark_const_caps_ready(void)
 {
 	static_branch_enable(&arm64_const_caps_ready);
@@ -1991,6 +2025,7 @@ void __init setup_cpu_features(void)
 
 	sve_setup();
 	minsigstksz_setup();
+	tlbi_range_setup();
 
 	/* Advertise that we have computed the system capabilities */
 	set_sys_caps_initialised();
@@ -11,3 +11,7 @@ __visible bool __native_vcpu_is_preempted(int cpu)
 {
 	return false;
 }
+
+void __native_yield_to_preempted(const struct cpumask *mask)
+{
+}
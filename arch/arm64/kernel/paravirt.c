@@ -17,6 +17,7 @@
 
 #include <linux/arm-smccc.h>
 #include <linux/cpuhotplug.h>
+#include <linux/cpumask.h>
 #include <linux/export.h>
 #include <linux/io.h>
 #include <linux/jump_label.h>
@@ -25,6 +26,7 @@
 #include <linux/types.h>
 #include <asm/paravirt.h>
 #include <asm/pvsched-abi.h>
+#include <asm/smp_plat.h>
 
 struct static_key paravirt_steal_enabled;
 struct static_key paravirt_steal_rq_enabled;
@@ -32,6 +34,7 @@ struct static_key paravirt_steal_rq_enabled;
 struct pv_time_ops pv_time_ops;
 struct paravirt_patch_template pv_ops = {
 	.sched.vcpu_is_preempted		= __native_vcpu_is_preempted,
+	.sched.yield_to_preempted		= __native_yield_to_preempted,
 };
 
 EXPORT_SYMBOL_GPL(pv_time_ops);
@@ -57,6 +60,25 @@ static bool kvm_vcpu_is_preempted(int cpu)
 	return !!preempted;
 }
 
+/*
+ * Called after sending IPIs to @mask: if one of the targets is preempted,
+ * the sender would just spin until the host runs it again, so hand it our
+ * time slice.
+ */
+static void kvm_yield_to_preempted(const struct cpumask *mask)
+{
+	struct arm_smccc_res res;
+	int cpu;
+
+	for_each_cpu(cpu, mask) {
+		if (kvm_vcpu_is_preempted(cpu)) {
+			arm_smccc_1_1_invoke(ARM_SMCCC_HV_PV_SCHED_YIELD,
+					     cpu_logical_map(cpu), &res);
+			break;
+		}
+	}
+}
+
 static int pvsched_vcpu_state_dying_cpu(unsigned int cpu)
 {
 	struct pvsched_vcpu_state *reg;
@@ -119,6 +141,16 @@ static bool has_kvm_pvsched(void)
 	return (res.a0 == SMCCC_RET_SUCCESS);
 }
 
+static bool has_kvm_pvsched_yield(void)
+{
+	struct arm_smccc_res res;
+
+	arm_smccc_1_1_invoke(ARM_SMCCC_HV_PV_SCHED_FEATURES,
+			     ARM_SMCCC_HV_PV_SCHED_YIELD, &res);
+
+	return (res.a0 == SMCCC_RET_SUCCESS);
+}
+
 int __init pv_sched_init(void)
 {
 	int ret;
@@ -138,6 +170,11 @@ int __init pv_sched_init(void)
 	pv_ops.sched.vcpu_is_preempted = kvm_vcpu_is_preempted;
 	pr_info("using PV sched preempted\n");
 
+	if (has_kvm_pvsched_yield()) {
+		pv_ops.sched.yield_to_preempted = kvm_yield_to_preempted;
+		pr_info("using PV sched yield\n");
+	}
+
 	return 0;
 }
 early_initcall(pv_sched_init);
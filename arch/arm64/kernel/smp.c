@@ -56,6 +56,7 @@
 #include <asm/mmu_context.h>
 #include <asm/numa.h>
 #include <asm/pgtable.h>
+#include <asm/paravirt.h>
 #include <asm/pgalloc.h>
 #include <asm/processor.h>
 #include <asm/smp_plat.h>
@@ -1048,6 +1049,7 @@ u64 smp_irq_stat_cpu(unsigned int cpu)
 void arch_send_call_function_ipi_mask(const struct cpumask *mask)
 {
 	smp_cross_call(mask, IPI_CALL_FUNC);
+	pv_yield_to_preempted(mask);
 }
 
 void arch_send_call_function_single_ipi(int cpu)
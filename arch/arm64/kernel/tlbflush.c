@@ -107,7 +107,7 @@ void flush_tlb_mm(struct mm_struct *mm)
 		__flush_tlb_mm(mm);
 }
 
-static inline void __flush_tlb_page_nosync(unsigned long addr)
+static inline void __flush_tlb_page_nosync_is(unsigned long addr)
 {
 	dsb(ishst);
 	__tlbi(vale1is, addr);
@@ -129,33 +129,15 @@ static inline void ipi_flush_tlb_page_nosync(void *arg)
 	__local_flush_tlb_page_nosync(addr);
 }
 
-void flush_tlb_page_nosync(struct vm_area_struct *vma, unsigned long uaddr)
+void __flush_tlb_page_nosync(struct mm_struct *mm, unsigned long uaddr)
 {
-	unsigned long addr = __TLBI_VADDR(uaddr, ASID(vma->vm_mm));
+	unsigned long addr = __TLBI_VADDR(uaddr, ASID(mm));
 
 	if (unlikely(test_tlbi_ipi_page()))
-		on_each_cpu_mask(mm_cpumask(vma->vm_mm),
+		on_each_cpu_mask(mm_cpumask(mm),
 				ipi_flush_tlb_page_nosync, &addr, true);
 	else
-		__flush_tlb_page_nosync(addr);
-}
-
-static inline void ___flush_tlb_range(unsigned long start, unsigned long end,
-				     unsigned long stride, bool last_level)
-{
-	unsigned long addr;
-
-	dsb(ishst);
-	for (addr = start; addr < end; addr += stride) {
-		if (last_level) {
-			__tlbi(vale1is, addr);
-			__tlbi_user(vale1is, addr);
-		} else {
-			__tlbi(vae1is, addr);
-			__tlbi_user(vae1is, addr);
-		}
-	}
-	dsb(ish);
+		__flush_tlb_page_nosync_is(addr);
 }
 
 static inline void __local_flush_tlb_range(unsigned long addr, bool last_level)
@@ -184,32 +166,35 @@ void __flush_tlb_range(struct vm_area_struct *vma, unsigned long start,
 		unsigned long end, unsigned long stride, bool last_level)
 {
 	unsigned long asid = ASID(vma->vm_mm);
+	struct tlb_args ta;
 
 	start = round_down(start, stride);
 	end = round_up(end, stride);
 
+	if (likely(!test_tlbi_ipi_range())) {
+		if (__flush_tlb_range_limit_excess(start, end, stride)) {
+			flush_tlb_mm(vma->vm_mm);
+			return;
+		}
+
+		dsb(ishst);
+		__flush_tlb_range_op(asid, start, end, stride, last_level);
+		dsb(ish);
+		return;
+	}
+
+	/* The IPI handler invalidates one page at a time */
 	if ((end - start) >= (MAX_TLBI_OPS * stride)) {
 		flush_tlb_mm(vma->vm_mm);
 		return;
 	}
 
-	/* Convert the stride into units of 4k */
-	stride >>= 12;
-
-	start = __TLBI_VADDR(start, asid);
-	end = __TLBI_VADDR(end, asid);
-
-
-	if (unlikely(test_tlbi_ipi_range())) {
-		struct tlb_args ta = {
-			.ta_start	= start,
-			.ta_end		= end,
-			.ta_stride	= stride,
-			.ta_last_level	= last_level,
-		};
+	/* TLBI operands and the stride are in units of 4k */
+	ta.ta_start = __TLBI_VADDR(start, asid);
+	ta.ta_end = __TLBI_VADDR(end, asid);
+	ta.ta_stride = stride >> 12;
+	ta.ta_last_level = last_level;
 
-		on_each_cpu_mask(mm_cpumask(vma->vm_mm), ipi_flush_tlb_range,
-					    &ta, true);
-	} else
-		___flush_tlb_range(start, end, stride, last_level);
+	on_each_cpu_mask(mm_cpumask(vma->vm_mm), ipi_flush_tlb_range,
+			 &ta, true);
 }
@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Threshold above which memcpy() and the uaccess copy routines switch to
+ * non-temporal stores, see .Lcpy_body_nt in copy_template.S.
+ *
+ * Copyright (C) 2021 Hisilicon Limited.
+ */
+
+#include <linux/cache.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/sizes.h>
+
+#include <asm/cputype.h>
+
+/* Read from assembly, a value of 0 disables the non-temporal path. */
+unsigned long __arch_copy_nt_threshold __read_mostly;
+
+static bool copy_nt_threshold_set __initdata;
+
+static int __init copy_nt_threshold_setup(char *str)
+{
+	if (!str)
+		return -EINVAL;
+
+	__arch_copy_nt_threshold = memparse(str, &str);
+	copy_nt_threshold_set = true;
+
+	return 0;
+}
+early_param("copy_nt_threshold", copy_nt_threshold_setup);
+
+/*
+ * Copies larger than the private L2 of these cores only evict the working
+ * set on their way to memory, so stream them past the cache instead.
+ */
+static const struct midr_range copy_nt_cpus[] = {
+	MIDR_ALL_VERSIONS(MIDR_HISI_TSV110),
+	{},
+};
+
+static int __init copy_nt_init(void)
+{
+	if (copy_nt_threshold_set)
+		return 0;
+
+	if (is_midr_in_range_list(read_cpuid_id(), copy_nt_cpus))
+		__arch_copy_nt_threshold = SZ_512K;
+
+	return 0;
+}
+early_initcall(copy_nt_init);
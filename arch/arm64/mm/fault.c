@@ -509,6 +509,19 @@ static int __kprobes do_page_fault(unsigned long addr, unsigned int esr,
 
 	perf_sw_event(PERF_COUNT_SW_PAGE_FAULTS, 1, regs, addr);
 
+	/*
+	 * Try a speculative fault first, without mmap_sem.  Only user mode
+	 * faults are tried, kernel mode faults need the exception table
+	 * checks below.
+	 */
+	if (user_mode(regs)) {
+		fault = handle_speculative_fault(mm, addr, mm_flags, vm_flags);
+		if (!(fault & VM_FAULT_RETRY)) {
+			major |= fault & VM_FAULT_MAJOR;
+			goto done;
+		}
+	}
+
 	/*
 	 * As per x86, we may deadlock here. However, since the kernel only
 	 * validly references user space from well defined areas of the code,
@@ -554,6 +567,7 @@ static int __kprobes do_page_fault(unsigned long addr, unsigned int esr,
 	}
 	up_read(&mm->mmap_sem);
 
+done:
 	/*
 	 * Handle the "normal" (no error) case first.
 	 */
@@ -107,6 +107,9 @@ static struct mm_struct tboot_mm = {
 	.mmap_sem       = __RWSEM_INITIALIZER(init_mm.mmap_sem),
 	.page_table_lock =  __SPIN_LOCK_UNLOCKED(init_mm.page_table_lock),
 	.mmlist         = LIST_HEAD_INIT(init_mm.mmlist),
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	.mm_rb_lock     = __RW_LOCK_UNLOCKED(tboot_mm.mm_rb_lock),
+#endif
 };
 
 static inline void switch_to_tboot_pt(void)
@@ -1322,6 +1322,23 @@ __do_page_fault(struct pt_regs *regs, unsigned long error_code,
 	if (error_code & X86_PF_INSTR)
 		flags |= FAULT_FLAG_INSTRUCTION;
 
+	/*
+	 * Try a speculative fault first, without mmap_sem.  Protection key
+	 * faults and read faults on present ptes are errors that are left
+	 * to access_error() below.  Kernel mode faults must go through the
+	 * exception table checks below, so only user mode faults are tried.
+	 */
+	if ((error_code & X86_PF_USER) && !(error_code & X86_PF_PK) &&
+	    (!(error_code & X86_PF_PROT) || (error_code & X86_PF_WRITE))) {
+		fault = handle_speculative_fault(mm, address, flags,
+				(flags & FAULT_FLAG_WRITE) ? VM_WRITE :
+				VM_READ | VM_EXEC | VM_WRITE);
+		if (!(fault & VM_FAULT_RETRY)) {
+			major |= fault & VM_FAULT_MAJOR;
+			goto done;
+		}
+	}
+
 	/*
 	 * When running in the kernel we expect faults to occur only to
 	 * addresses in user space.  All other faults represent errors in
@@ -1439,6 +1456,7 @@ __do_page_fault(struct pt_regs *regs, unsigned long error_code,
 		return;
 	}
 
+done:
 	/*
 	 * Major/minor page fault accounting. If any of the events
 	 * returned VM_FAULT_MAJOR, we account it as a major fault.
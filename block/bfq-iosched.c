@@ -138,6 +138,7 @@
 #include "blk-mq.h"
 #include "blk-mq-tag.h"
 #include "blk-mq-sched.h"
+#include "blk-stat.h"
 #include "bfq-iosched.h"
 #include "blk-wbt.h"
 
@@ -234,6 +235,12 @@ static struct kmem_cache *bfq_pool;
 #define BFQ_HW_QUEUE_THRESHOLD	4
 #define BFQ_HW_QUEUE_SAMPLES	32
 
+/*
+ * Fast mode: number of completion latency samples between two checks of
+ * whether the device is (still) fast enough.
+ */
+#define BFQ_FAST_LAT_SAMPLES	32
+
 #define BFQQ_SEEK_THR		(sector_t)(8 * 100)
 #define BFQQ_SECT_THR_NONROT	(sector_t)(2 * 32)
 #define BFQQ_CLOSE_THR		(sector_t)(8 * 1024)
@@ -432,6 +439,15 @@ void bfq_schedule_dispatch(struct bfq_data *bfqd)
  * We choose the request that is closesr to the head right now.  Distance
  * behind the head is penalized and only allowed to a certain extent.
  */
+/*
+ * Weight raising is pointless, and only adds overhead, when the device
+ * is fast enough for BFQ to be in fast mode.
+ */
+static bool bfq_wr_enabled(struct bfq_data *bfqd)
+{
+	return bfqd->low_latency && !bfqd->fast_mode;
+}
+
 static struct request *bfq_choose_req(struct bfq_data *bfqd,
 				      struct request *rq1,
 				      struct request *rq2,
@@ -1584,7 +1600,7 @@ static void bfq_bfqq_handle_idle_busy_switch(struct bfq_data *bfqd,
 		time_is_before_jiffies(bfqq->soft_rt_next_start) &&
 		bfqq->dispatched == 0;
 	*interactive = !in_burst && idle_for_long_time;
-	wr_or_deserves_wr = bfqd->low_latency &&
+	wr_or_deserves_wr = bfq_wr_enabled(bfqd) &&
 		(bfqq->wr_coeff > 1 ||
 		 (bfq_bfqq_sync(bfqq) &&
 		  bfqq->bic && (*interactive || soft_rt)));
@@ -1633,7 +1649,7 @@ static void bfq_bfqq_handle_idle_busy_switch(struct bfq_data *bfqd,
 			bfqq->requests_within_timer = 0;
 	}
 
-	if (bfqd->low_latency) {
+	if (bfq_wr_enabled(bfqd)) {
 		if (unlikely(time_is_after_jiffies(bfqq->split_time)))
 			/* wraparound */
 			bfqq->split_time =
@@ -1711,7 +1727,8 @@ static void bfq_add_request(struct request *rq)
 		bfq_bfqq_handle_idle_busy_switch(bfqd, bfqq, old_wr_coeff,
 						 rq, &interactive);
 	else {
-		if (bfqd->low_latency && old_wr_coeff == 1 && !rq_is_sync(rq) &&
+		if (bfq_wr_enabled(bfqd) && old_wr_coeff == 1 &&
+		    !rq_is_sync(rq) &&
 		    time_is_before_jiffies(
 				bfqq->last_wr_start_finish +
 				bfqd->bfq_wr_min_inter_arr_async)) {
@@ -1751,7 +1768,7 @@ static void bfq_add_request(struct request *rq)
 	 * this is already done in bfq_bfqq_handle_idle_busy_switch if
 	 * needed.
 	 */
-	if (bfqd->low_latency &&
+	if (bfq_wr_enabled(bfqd) &&
 		(old_wr_coeff == 1 || bfqq->wr_coeff == 1 || interactive))
 		bfqq->last_wr_start_finish = jiffies;
 }
@@ -2025,18 +2042,21 @@ void bfq_end_wr_async_queues(struct bfq_data *bfqd,
 		bfq_bfqq_end_wr(bfqg->async_idle_bfqq);
 }
 
-static void bfq_end_wr(struct bfq_data *bfqd)
+static void __bfq_end_wr(struct bfq_data *bfqd)
 {
 	struct bfq_queue *bfqq;
 
-	spin_lock_irq(&bfqd->lock);
-
 	list_for_each_entry(bfqq, &bfqd->active_list, bfqq_list)
 		bfq_bfqq_end_wr(bfqq);
 	list_for_each_entry(bfqq, &bfqd->idle_list, bfqq_list)
 		bfq_bfqq_end_wr(bfqq);
 	bfq_end_wr_async(bfqd);
+}
 
+static void bfq_end_wr(struct bfq_data *bfqd)
+{
+	spin_lock_irq(&bfqd->lock);
+	__bfq_end_wr(bfqd);
 	spin_unlock_irq(&bfqd->lock);
 }
 
@@ -2312,7 +2332,7 @@ static void bfq_bfqq_save_state(struct bfq_queue *bfqq)
 	bic->was_in_burst_list = !hlist_unhashed(&bfqq->burst_list_node);
 	if (unlikely(bfq_bfqq_just_created(bfqq) &&
 		     !bfq_bfqq_in_large_burst(bfqq) &&
-		     bfqq->bfqd->low_latency)) {
+		     bfq_wr_enabled(bfqq->bfqd))) {
 		/*
 		 * bfqq being merged right after being created: bfqq
 		 * would have deserved interactive weight raising, but
@@ -3317,10 +3337,10 @@ void bfq_bfqq_expire(struct bfq_data *bfqd,
 	    entity->service <= 2 * entity->budget / 10)
 		bfq_clear_bfqq_IO_bound(bfqq);
 
-	if (bfqd->low_latency && bfqq->wr_coeff == 1)
+	if (bfq_wr_enabled(bfqd) && bfqq->wr_coeff == 1)
 		bfqq->last_wr_start_finish = jiffies;
 
-	if (bfqd->low_latency && bfqd->bfq_wr_max_softrt_rate > 0 &&
+	if (bfq_wr_enabled(bfqd) && bfqd->bfq_wr_max_softrt_rate > 0 &&
 	    RB_EMPTY_ROOT(&bfqq->sort_list)) {
 		/*
 		 * If we get here, and there are no outstanding
@@ -3463,6 +3483,14 @@ static bool bfq_better_to_idle(struct bfq_queue *bfqq)
 	if (bfqd->strict_guarantees)
 		return true;
 
+	/*
+	 * On a device fast enough for fast mode, idling costs more
+	 * throughput than it can possibly buy in terms of service
+	 * guarantees.
+	 */
+	if (bfqd->fast_mode)
+		return false;
+
 	/*
 	 * Idling is performed only if slice_idle > 0. In addition, we
 	 * do not idle if
@@ -4599,8 +4627,11 @@ static void bfq_rq_enqueued(struct bfq_data *bfqd, struct bfq_queue *bfqq,
 	if (rq->cmd_flags & REQ_META)
 		bfqq->meta_pending++;
 
-	bfq_update_io_thinktime(bfqd, bfqq);
-	bfq_update_has_short_ttime(bfqd, bfqq, bic);
+	/* think time only matters for idling, which fast mode never does */
+	if (!bfqd->fast_mode) {
+		bfq_update_io_thinktime(bfqd, bfqq);
+		bfq_update_has_short_ttime(bfqd, bfqq, bic);
+	}
 	bfq_update_io_seektime(bfqd, bfqq, rq);
 
 	bfq_log_bfqq(bfqd, bfqq,
@@ -4831,6 +4862,62 @@ static void bfq_update_hw_tag(struct bfq_data *bfqd)
 	bfqd->hw_tag_samples = 0;
 }
 
+/*
+ * Account the completion latency of @rq and, every BFQ_FAST_LAT_SAMPLES
+ * completions, decide whether BFQ must be in fast mode. Some hysteresis
+ * keeps BFQ from flipping mode on a device whose latency sits right at
+ * the threshold.
+ */
+static void bfq_update_fast_mode(struct bfq_data *bfqd, struct request *rq)
+{
+	u64 lat_us, thresh;
+	bool fast;
+
+	if (!bfqd->bfq_fast_lat_us) {
+		if (bfqd->fast_mode)
+			bfqd->fast_mode = false;
+		return;
+	}
+
+	if (!(rq->rq_flags & RQF_STATS) || !rq->io_start_time_ns)
+		return;
+
+	lat_us = div_u64(ktime_get_ns() - rq->io_start_time_ns,
+			 NSEC_PER_USEC);
+	/* EWMA with weight 1/8, lat_avg_us8 being 8 times the average */
+	bfqd->lat_avg_us8 += lat_us - (bfqd->lat_avg_us8 >> 3);
+
+	if (++bfqd->lat_samples < BFQ_FAST_LAT_SAMPLES)
+		return;
+	bfqd->lat_samples = 0;
+
+	thresh = bfqd->bfq_fast_lat_us;
+	if (bfqd->fast_mode)
+		fast = bfqd->lat_avg_us8 >> 3 < thresh + thresh / 2;
+	else
+		fast = bfqd->lat_avg_us8 >> 3 < thresh;
+
+	if (fast == bfqd->fast_mode)
+		return;
+
+	bfqd->fast_mode = fast;
+	bfq_log(bfqd, "fast mode %s, avg lat %llu us",
+		fast ? "on" : "off", bfqd->lat_avg_us8 >> 3);
+
+	if (!fast)
+		return;
+
+	/* stop what is now overhead: weight raising and pending idling */
+	if (bfqd->low_latency)
+		__bfq_end_wr(bfqd);
+	if (bfqd->in_service_queue &&
+	    bfq_bfqq_wait_request(bfqd->in_service_queue)) {
+		bfq_clear_bfqq_wait_request(bfqd->in_service_queue);
+		hrtimer_try_to_cancel(&bfqd->idle_slice_timer);
+		bfq_schedule_dispatch(bfqd);
+	}
+}
+
 static void bfq_completed_request(struct bfq_queue *bfqq, struct bfq_data *bfqd)
 {
 	u64 now_ns;
@@ -4982,6 +5069,7 @@ static void bfq_finish_requeue_request(struct request *rq)
 
 	spin_lock_irqsave(&bfqd->lock, flags);
 	if (likely(rq->rq_flags & RQF_STARTED)) {
+		bfq_update_fast_mode(bfqd, rq);
 		bfq_completed_request(bfqq, bfqd);
 	}
 	bfq_finish_requeue_request_body(bfqq);
@@ -5630,6 +5718,13 @@ static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
 USEC_SHOW_FUNCTION(bfq_slice_idle_us_show, bfqd->bfq_slice_idle);
 #undef USEC_SHOW_FUNCTION
 
+static ssize_t bfq_fast_lat_us_show(struct elevator_queue *e, char *page)
+{
+	struct bfq_data *bfqd = e->elevator_data;
+
+	return bfq_var_show(bfqd->bfq_fast_lat_us, page);
+}
+
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
 static ssize_t								\
 __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
@@ -5757,6 +5852,34 @@ static ssize_t bfq_strict_guarantees_store(struct elevator_queue *e,
 	return count;
 }
 
+static ssize_t bfq_fast_lat_us_store(struct elevator_queue *e,
+				     const char *page, size_t count)
+{
+	struct bfq_data *bfqd = e->elevator_data;
+	unsigned long __data;
+	int ret;
+
+	ret = bfq_var_store(&__data, (page));
+	if (ret)
+		return ret;
+
+	if (__data > UINT_MAX)
+		__data = UINT_MAX;
+
+	/* completion latencies are sampled from the block layer stats */
+	if (__data)
+		blk_stat_enable_accounting(bfqd->queue);
+
+	spin_lock_irq(&bfqd->lock);
+	bfqd->bfq_fast_lat_us = __data;
+	if (!__data)
+		bfqd->fast_mode = false;
+	bfqd->lat_samples = 0;
+	spin_unlock_irq(&bfqd->lock);
+
+	return count;
+}
+
 static ssize_t bfq_low_latency_store(struct elevator_queue *e,
 				     const char *page, size_t count)
 {
@@ -5791,6 +5914,7 @@ static struct elv_fs_entry bfq_attrs[] = {
 	BFQ_ATTR(timeout_sync),
 	BFQ_ATTR(strict_guarantees),
 	BFQ_ATTR(low_latency),
+	BFQ_ATTR(fast_lat_us),
 	__ATTR_NULL
 };
 
@@ -661,6 +661,22 @@ struct bfq_data {
 
 	/* if set to true, low-latency heuristics are enabled */
 	bool low_latency;
+
+	/*
+	 * Completion latency, in usecs, below which the device is
+	 * deemed fast enough for BFQ to switch to fast mode (0 to
+	 * never switch). In fast mode, neither device idling nor
+	 * weight raising is performed: queues and groups are still
+	 * served in proportion to their weights, but the per-request
+	 * heuristics needed on slow devices are skipped.
+	 */
+	u32 bfq_fast_lat_us;
+	/* EWMA of the completion latency, in usecs, scaled by 8 */
+	u64 lat_avg_us8;
+	/* completions sampled since fast mode was last re-evaluated */
+	unsigned int lat_samples;
+	/* true if fast mode is active */
+	bool fast_mode;
 	/*
 	 * Maximum factor by which the weight of a weight-raised queue
 	 * is multiplied.
@@ -29,6 +29,7 @@
 #include <linux/blk-cgroup.h>
 #include <linux/tracehook.h>
 #include "blk.h"
+#include "blk-stat.h"
 
 #define MAX_KEY_LEN 100
 
@@ -81,6 +82,7 @@ static void blkg_free(struct blkcg_gq *blkg)
 
 	blkg_rwstat_exit(&blkg->stat_ios);
 	blkg_rwstat_exit(&blkg->stat_bytes);
+	blk_lat_hist_free(blkg->lat_hist);
 	kfree(blkg);
 }
 
@@ -107,6 +109,10 @@ static struct blkcg_gq *blkg_alloc(struct blkcg *blkcg, struct request_queue *q,
 	    blkg_rwstat_init(&blkg->stat_ios, gfp_mask))
 		goto err_free;
 
+	/* the histogram is optional, do without it if allocation fails */
+	if (READ_ONCE(q->lat_hist))
+		blkg->lat_hist = blk_lat_hist_alloc(gfp_mask);
+
 	blkg->q = q;
 	INIT_LIST_HEAD(&blkg->q_node);
 	blkg->blkcg = blkcg;
@@ -979,11 +985,69 @@ void blkg_conf_finish(struct blkg_conf_ctx *ctx)
 }
 EXPORT_SYMBOL_GPL(blkg_conf_finish);
 
+/**
+ * blkcg_lat_hist_enable - give all blkgs of @q a latency histogram
+ * @q: request_queue of interest
+ *
+ * Called when latency histograms get enabled on @q, blkgs created later
+ * get theirs from blkg_alloc().
+ */
+void blkcg_lat_hist_enable(struct request_queue *q)
+{
+	struct blkcg_gq *blkg;
+
+	spin_lock_irq(q->queue_lock);
+	list_for_each_entry(blkg, &q->blkg_list, q_node)
+		if (!blkg->lat_hist)
+			blkg->lat_hist = blk_lat_hist_alloc(GFP_NOWAIT);
+	spin_unlock_irq(q->queue_lock);
+}
+
+/*
+ * Print the p50, p99 and p99.9 completion latencies of @blkg and its
+ * descendants. Called under rcu and queue_lock, @sum is scratch space.
+ */
+static size_t blkg_print_lat_hist(struct blkcg_gq *blkg,
+				  struct blk_lat_hist *sum,
+				  char *buf, size_t size)
+{
+	static const char * const op_prefix[BLK_LAT_HIST_OPS] = {
+		[BLK_LAT_HIST_READ]	= "r",
+		[BLK_LAT_HIST_WRITE]	= "w",
+		[BLK_LAT_HIST_DISCARD]	= "d",
+	};
+	struct cgroup_subsys_state *pos_css;
+	struct blkcg_gq *pos_blkg;
+	size_t off = 0;
+	int op;
+
+	memset(sum, 0, sizeof(*sum));
+	blkg_for_each_descendant_pre(pos_blkg, pos_css, blkg) {
+		if (pos_blkg->online && pos_blkg->lat_hist)
+			blk_lat_hist_sum(sum, pos_blkg->lat_hist);
+	}
+
+	for (op = 0; op < BLK_LAT_HIST_OPS; op++) {
+		if (!blk_lat_hist_samples(sum, op))
+			continue;
+		off += scnprintf(buf+off, size-off,
+				 " %slat_p50=%llu %slat_p99=%llu %slat_p999=%llu",
+				 op_prefix[op], blk_lat_hist_percentile(sum, op, 500),
+				 op_prefix[op], blk_lat_hist_percentile(sum, op, 990),
+				 op_prefix[op], blk_lat_hist_percentile(sum, op, 999));
+	}
+
+	return off;
+}
+
 static int blkcg_print_stat(struct seq_file *sf, void *v)
 {
 	struct blkcg *blkcg = css_to_blkcg(seq_css(sf));
+	struct blk_lat_hist *lat_sum;
 	struct blkcg_gq *blkg;
 
+	lat_sum = kmalloc(sizeof(*lat_sum), GFP_KERNEL);
+
 	rcu_read_lock();
 
 	hlist_for_each_entry_rcu(blkg, &blkcg->blkg_list, blkcg_node) {
@@ -1032,6 +1096,16 @@ static int blkcg_print_stat(struct seq_file *sf, void *v)
 					 dbytes, dios);
 		}
 
+		if (lat_sum && blkg->lat_hist) {
+			size_t written;
+
+			written = blkg_print_lat_hist(blkg, lat_sum,
+						      buf+off, size-off);
+			if (written)
+				has_stats = true;
+			off += written;
+		}
+
 		if (!blkcg_debug_stats)
 			goto next;
 
@@ -1069,6 +1143,7 @@ static int blkcg_print_stat(struct seq_file *sf, void *v)
 	}
 
 	rcu_read_unlock();
+	kfree(lat_sum);
 	return 0;
 }
 
@@ -1292,6 +1367,14 @@ int blkcg_init_queue(struct request_queue *q)
 		return ret;
 	}
 
+	ret = blk_iocost_init(q);
+	if (ret) {
+		spin_lock_irq(q->queue_lock);
+		blkg_destroy_all(q);
+		spin_unlock_irq(q->queue_lock);
+		return ret;
+	}
+
 	ret = blk_throtl_init(q);
 	if (ret) {
 		spin_lock_irq(q->queue_lock);
@@ -43,6 +43,7 @@
 #include "blk-mq.h"
 #include "blk-mq-sched.h"
 #include "blk-rq-qos.h"
+#include "blk-ioprio.h"
 
 #ifdef CONFIG_DEBUG_FS
 struct dentry *blk_debugfs_root;
@@ -2613,6 +2614,12 @@ generic_make_request_checks(struct bio *bio)
 	 */
 	create_io_context(GFP_ATOMIC, q->node);
 
+	/*
+	 * Apply the cgroup I/O priority class before the bio gets a chance
+	 * to be merged, merging only happens between equal priorities.
+	 */
+	blkcg_set_ioprio(bio);
+
 	if (!blkcg_bio_issue_check(q, bio))
 		return false;
 
@@ -3406,6 +3413,9 @@ bool blk_update_request(struct request *req, blk_status_t error,
 
 	blk_account_io_completion(req, nr_bytes);
 
+	if (unlikely(READ_ONCE(req->q->lat_hist)) && nr_bytes >= blk_rq_bytes(req))
+		blk_stat_add_lat_hist(req);
+
 	total_bytes = 0;
 	while (req->bio) {
 		struct bio *bio = req->bio;
@@ -3907,6 +3917,23 @@ EXPORT_SYMBOL(kblockd_mod_delayed_work_on);
  *   this kind of deadlock.
  */
 void blk_start_plug(struct blk_plug *plug)
+{
+	blk_start_plug_nr_ios(plug, 1);
+}
+EXPORT_SYMBOL(blk_start_plug);
+
+/**
+ * blk_start_plug_nr_ios - initialize blk_plug for an expected batch of I/O
+ * @plug:	The &struct blk_plug that needs to be initialized
+ * @nr_ios:	Number of requests the caller expects to submit
+ *
+ * Description:
+ *   Like blk_start_plug(), but lets blk-mq allocate up to @nr_ios requests
+ *   with a single tag bitmap operation on the first allocation and hand them
+ *   out from the plug afterwards. Unused requests are freed when the plug is
+ *   flushed.
+ */
+void blk_start_plug_nr_ios(struct blk_plug *plug, unsigned short nr_ios)
 {
 	struct task_struct *tsk = current;
 
@@ -3919,13 +3946,15 @@ void blk_start_plug(struct blk_plug *plug)
 	INIT_LIST_HEAD(&plug->list);
 	INIT_LIST_HEAD(&plug->mq_list);
 	INIT_LIST_HEAD(&plug->cb_list);
+	INIT_LIST_HEAD(&plug->cached_rqs);
+	plug->nr_ios = min_t(unsigned short, nr_ios, BLK_MAX_REQUEST_COUNT * 2);
 	/*
 	 * Store ordering should not be needed here, since a potential
 	 * preempt will imply a full memory barrier
 	 */
 	tsk->plug = plug;
 }
-EXPORT_SYMBOL(blk_start_plug);
+EXPORT_SYMBOL(blk_start_plug_nr_ios);
 
 static int plug_rq_cmp(void *priv, struct list_head *a, struct list_head *b)
 {
@@ -4011,6 +4040,9 @@ void blk_flush_plug_list(struct blk_plug *plug, bool from_schedule)
 	if (!list_empty(&plug->mq_list))
 		blk_mq_flush_plug_list(plug, from_schedule);
 
+	if (unlikely(!list_empty(&plug->cached_rqs)))
+		blk_mq_free_plug_rqs(plug);
+
 	if (list_empty(&plug->list))
 		return;
 
@@ -0,0 +1,1293 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * IO cost model based controller
+ *
+ * Distributes the IO capacity of a device among cgroups according to their
+ * weights while keeping the device busy.  It works on top of rq-qos like
+ * blk-iolatency and is configured from the root cgroup.
+ *
+ * Cost model
+ *
+ * Every bio is assigned an absolute cost in nanoseconds of device time.  The
+ * cost is derived from a linear model of the device which is described by
+ * sequential and random IOPS and by bandwidth, separately for reads and
+ * writes:
+ *
+ *   cost = (seq ? seqio : randio) + nr_pages * page
+ *
+ * where page is the time to transfer one 4k page at the given bandwidth and
+ * seqio/randio are the per-IO overheads left after subtracting it.  An IO is
+ * random if it starts more than LCOEF_RANDIO_PAGES away from where the
+ * previous IO of the same cgroup ended.  Default models exist for rotational
+ * and non-rotational devices, and a measured one can be set through
+ * io.cost.model.
+ *
+ * Virtual time
+ *
+ * The device has a global vtime which advances at vrate times wall clock
+ * time.  Each active cgroup has its own vtime which is advanced by the cost
+ * of its IOs scaled by the inverse of its hierarchical weight share
+ * (hweight).  A bio is issued once its cgroup's vtime plus the cost doesn't
+ * run ahead of the device vtime, otherwise the submitter waits.  A cgroup
+ * which stayed idle can't bank more than a fraction of a period worth of
+ * vtime, and it stops counting towards its siblings' shares once it has been
+ * idle for a whole period, so its share is redistributed to those that are
+ * busy.
+ *
+ * vrate
+ *
+ * If the model were exact, vrate would stay at 100%.  Instead it is tuned
+ * every period from completion latencies: if more than the allowed fraction
+ * of reads or writes missed their latency target, the device is saturated and
+ * vrate goes down.  If groups are waiting for budget while latencies are
+ * met, vrate goes up.  io.cost.qos configures the targets and the range
+ * vrate is allowed to move in.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/timer.h>
+#include <linux/hrtimer.h>
+#include <linux/time64.h>
+#include <linux/parser.h>
+#include <linux/sched/signal.h>
+#include <linux/blk-cgroup.h>
+#include <asm/local.h>
+#include "blk-rq-qos.h"
+#include "blk.h"
+
+#define IOC_PPM_ONE		1000000
+
+/* fixed point vrate, VRATE_ONE means the device runs as fast as modeled */
+#define VRATE_SHIFT		16
+#define VRATE_ONE		(1U << VRATE_SHIFT)
+
+/* fixed point hierarchical weight share */
+#define WEIGHT_ONE		(1U << 16)
+
+#define IOC_MIN_PERIOD_NSEC	(1 * NSEC_PER_MSEC)
+#define IOC_MAX_PERIOD_NSEC	(1 * NSEC_PER_SEC)
+
+/* an idle group may bank at most this percentage of a period's vtime */
+#define IOC_MARGIN_PCT		25
+
+/* vrate is adjusted by busy_level / VRATE_ADJ_DIV per period */
+#define IOC_MAX_BUSY_LEVEL	8
+#define VRATE_ADJ_DOWN_DIV	32
+#define VRATE_ADJ_UP_DIV	64
+
+#define IOC_PAGE_SHIFT		12
+#define IOC_PAGE_SIZE		(1 << IOC_PAGE_SHIFT)
+#define IOC_SECT_TO_PAGE_SHIFT	(IOC_PAGE_SHIFT - 9)
+
+/* seeks longer than this are considered random */
+#define LCOEF_RANDIO_PAGES	4096
+
+enum {
+	QOS_RPPM,
+	QOS_RLAT,
+	QOS_WPPM,
+	QOS_WLAT,
+	QOS_MIN,
+	QOS_MAX,
+	NR_QOS_PARAMS,
+};
+
+enum {
+	I_LCOEF_RBPS,
+	I_LCOEF_RSEQIOPS,
+	I_LCOEF_RRANDIOPS,
+	I_LCOEF_WBPS,
+	I_LCOEF_WSEQIOPS,
+	I_LCOEF_WRANDIOPS,
+	NR_I_LCOEFS,
+};
+
+enum {
+	LCOEF_RPAGE,
+	LCOEF_RSEQIO,
+	LCOEF_RRANDIO,
+	LCOEF_WPAGE,
+	LCOEF_WSEQIO,
+	LCOEF_WRANDIO,
+	NR_LCOEFS,
+};
+
+enum {
+	AUTOP_HDD,
+	AUTOP_SSD,
+	NR_AUTOP,
+};
+
+struct ioc_params {
+	/* ppm of completions allowed to miss the target, targets in usecs */
+	u32				qos[NR_QOS_PARAMS];
+	u64				i_lcoefs[NR_I_LCOEFS];
+};
+
+static const struct ioc_params autop[NR_AUTOP] = {
+	[AUTOP_HDD] = {
+		.qos = {
+			[QOS_RPPM]	= 950000,
+			[QOS_RLAT]	= 250000,
+			[QOS_WPPM]	= 950000,
+			[QOS_WLAT]	= 250000,
+			[QOS_MIN]	= 250000,
+			[QOS_MAX]	= 4000000,
+		},
+		.i_lcoefs = {
+			[I_LCOEF_RBPS]		= 174019176,
+			[I_LCOEF_RSEQIOPS]	= 41708,
+			[I_LCOEF_RRANDIOPS]	= 370,
+			[I_LCOEF_WBPS]		= 178075866,
+			[I_LCOEF_WSEQIOPS]	= 42705,
+			[I_LCOEF_WRANDIOPS]	= 378,
+		},
+	},
+	[AUTOP_SSD] = {
+		.qos = {
+			[QOS_RPPM]	= 950000,
+			[QOS_RLAT]	= 10000,
+			[QOS_WPPM]	= 950000,
+			[QOS_WLAT]	= 10000,
+			[QOS_MIN]	= 250000,
+			[QOS_MAX]	= 4000000,
+		},
+		.i_lcoefs = {
+			[I_LCOEF_RBPS]		= 3102524156LLU,
+			[I_LCOEF_RSEQIOPS]	= 724816,
+			[I_LCOEF_RRANDIOPS]	= 778122,
+			[I_LCOEF_WBPS]		= 1742780862LLU,
+			[I_LCOEF_WSEQIOPS]	= 425702,
+			[I_LCOEF_WRANDIOPS]	= 443193,
+		},
+	},
+};
+
+struct ioc_pcpu_stat {
+	local_t				missed[2];
+	local_t				nr_done[2];
+};
+
+struct ioc {
+	struct rq_qos			rqos;
+
+	bool				enabled;
+	bool				user_qos_params;
+	bool				user_cost_model;
+
+	struct ioc_params		params;
+	/* derived from params, in nsecs of device time */
+	u64				lcoefs[NR_LCOEFS];
+	u64				period_ns;
+	u64				margin_ns;
+	u32				vrate_min;
+	u32				vrate_max;
+
+	spinlock_t			lock;
+	struct timer_list		timer;
+	struct list_head		active_iocgs;	/* parents first */
+	int				busy_level;
+
+	struct ioc_pcpu_stat __percpu	*pcpu_stat;
+	unsigned long			last_missed[2];
+	unsigned long			last_done[2];
+
+	/* device vtime is period_at_vtime + (now - period_at) * vrate */
+	seqcount_t			period_seqcount;
+	u64				period_at;
+	u64				period_at_vtime;
+	u32				vtime_rate;
+	atomic64_t			cur_period;
+
+	/* bumped whenever active weights change, see current_hweight() */
+	atomic_t			hweight_gen;
+};
+
+/* per cgroup, holds the default weight */
+struct ioc_cgrp {
+	struct blkg_policy_data		cpd;
+	unsigned int			dfl_weight;
+};
+
+/* per cgroup and device */
+struct ioc_gq {
+	struct blkg_policy_data		pd;
+	struct ioc			*ioc;
+
+	/* weight set for this device, 0 to follow the cgroup default */
+	u32				cfg_weight;
+	u32				weight;
+
+	/* protected by ioc->lock */
+	struct list_head		active_list;
+	bool				active;
+	u32				child_active_sum;
+
+	atomic64_t			active_period;
+	atomic64_t			vtime;
+	atomic64_t			abs_usage;
+	sector_t			cursor;
+
+	u32				hweight;
+	int				hweight_gen;
+
+	wait_queue_head_t		waitq;
+	struct hrtimer			waitq_timer;
+};
+
+struct ioc_now {
+	u64				now_ns;
+	u64				vnow;
+	u32				vrate;
+};
+
+static struct blkcg_policy blkcg_policy_iocost;
+
+static inline struct ioc *rqos_to_ioc(struct rq_qos *rqos)
+{
+	return container_of(rqos, struct ioc, rqos);
+}
+
+static inline struct ioc_gq *pd_to_iocg(struct blkg_policy_data *pd)
+{
+	return pd ? container_of(pd, struct ioc_gq, pd) : NULL;
+}
+
+static inline struct ioc_gq *blkg_to_iocg(struct blkcg_gq *blkg)
+{
+	return pd_to_iocg(blkg_to_pd(blkg, &blkcg_policy_iocost));
+}
+
+static inline struct blkcg_gq *iocg_to_blkg(struct ioc_gq *iocg)
+{
+	return pd_to_blkg(&iocg->pd);
+}
+
+static inline struct ioc_cgrp *blkcg_to_iocc(struct blkcg *blkcg)
+{
+	return container_of(blkcg_to_cpd(blkcg, &blkcg_policy_iocost),
+			    struct ioc_cgrp, cpd);
+}
+
+static void calc_lcoefs(u64 bps, u64 seqiops, u64 randiops,
+			u64 *page, u64 *seqio, u64 *randio)
+{
+	u64 v;
+
+	*page = *seqio = *randio = 0;
+
+	if (bps)
+		*page = div64_u64((u64)NSEC_PER_SEC * IOC_PAGE_SIZE, bps);
+
+	if (seqiops) {
+		v = div64_u64(NSEC_PER_SEC, seqiops);
+		if (v > *page)
+			*seqio = v - *page;
+	}
+
+	if (randiops) {
+		v = div64_u64(NSEC_PER_SEC, randiops);
+		if (v > *page)
+			*randio = v - *page;
+	}
+}
+
+/* Called with ioc->lock held or before the ioc is visible. */
+static void ioc_refresh_params(struct ioc *ioc)
+{
+	const struct ioc_params *p;
+	u64 *c = ioc->lcoefs;
+	u64 *i = ioc->params.i_lcoefs;
+	u32 *qos = ioc->params.qos;
+
+	p = &autop[blk_queue_nonrot(ioc->rqos.q) ? AUTOP_SSD : AUTOP_HDD];
+	if (!ioc->user_qos_params)
+		memcpy(ioc->params.qos, p->qos, sizeof(p->qos));
+	if (!ioc->user_cost_model)
+		memcpy(ioc->params.i_lcoefs, p->i_lcoefs, sizeof(p->i_lcoefs));
+
+	calc_lcoefs(i[I_LCOEF_RBPS], i[I_LCOEF_RSEQIOPS], i[I_LCOEF_RRANDIOPS],
+		    &c[LCOEF_RPAGE], &c[LCOEF_RSEQIO], &c[LCOEF_RRANDIO]);
+	calc_lcoefs(i[I_LCOEF_WBPS], i[I_LCOEF_WSEQIOPS], i[I_LCOEF_WRANDIOPS],
+		    &c[LCOEF_WPAGE], &c[LCOEF_WSEQIO], &c[LCOEF_WRANDIO]);
+
+	ioc->period_ns = clamp_t(u64, (u64)max(qos[QOS_RLAT], qos[QOS_WLAT]) *
+				 NSEC_PER_USEC * 2,
+				 IOC_MIN_PERIOD_NSEC, IOC_MAX_PERIOD_NSEC);
+	ioc->margin_ns = div_u64(ioc->period_ns * IOC_MARGIN_PCT, 100);
+
+	ioc->vrate_min = div_u64((u64)qos[QOS_MIN] * VRATE_ONE, IOC_PPM_ONE);
+	ioc->vrate_max = div_u64((u64)qos[QOS_MAX] * VRATE_ONE, IOC_PPM_ONE);
+	ioc->vtime_rate = clamp(ioc->vtime_rate, ioc->vrate_min,
+				ioc->vrate_max);
+}
+
+static void ioc_now(struct ioc *ioc, struct ioc_now *now)
+{
+	unsigned int seq;
+
+	do {
+		seq = read_seqcount_begin(&ioc->period_seqcount);
+		now->now_ns = ktime_get_ns();
+		now->vrate = READ_ONCE(ioc->vtime_rate);
+		now->vnow = ioc->period_at_vtime +
+			mul_u64_u32_shr(now->now_ns - ioc->period_at,
+					now->vrate, VRATE_SHIFT);
+	} while (read_seqcount_retry(&ioc->period_seqcount, seq));
+}
+
+/* Rebase the device vtime on @now, switch to @vrate and arm the timer. */
+static void ioc_start_period(struct ioc *ioc, struct ioc_now *now, u32 vrate)
+{
+	lockdep_assert_held(&ioc->lock);
+
+	write_seqcount_begin(&ioc->period_seqcount);
+	ioc->period_at = now->now_ns;
+	ioc->period_at_vtime = now->vnow;
+	WRITE_ONCE(ioc->vtime_rate, vrate);
+	write_seqcount_end(&ioc->period_seqcount);
+
+	atomic64_inc(&ioc->cur_period);
+	mod_timer(&ioc->timer, jiffies +
+		  max_t(unsigned long, nsecs_to_jiffies(ioc->period_ns), 1));
+}
+
+static struct ioc_gq *iocg_parent(struct ioc_gq *iocg)
+{
+	struct blkcg_gq *blkg = iocg_to_blkg(iocg);
+
+	return blkg->parent ? blkg_to_iocg(blkg->parent) : NULL;
+}
+
+static void iocg_activate_locked(struct ioc_gq *iocg)
+{
+	struct ioc *ioc = iocg->ioc;
+	struct ioc_gq *parent;
+
+	lockdep_assert_held(&ioc->lock);
+
+	if (iocg->active)
+		return;
+
+	parent = iocg_parent(iocg);
+	if (parent) {
+		iocg_activate_locked(parent);
+		parent->child_active_sum += iocg->weight;
+	}
+
+	iocg->active = true;
+	list_add_tail(&iocg->active_list, &ioc->active_iocgs);
+	atomic_inc(&ioc->hweight_gen);
+}
+
+static void iocg_deactivate_locked(struct ioc_gq *iocg)
+{
+	struct ioc *ioc = iocg->ioc;
+	struct ioc_gq *parent;
+
+	lockdep_assert_held(&ioc->lock);
+
+	if (!iocg->active)
+		return;
+
+	parent = iocg_parent(iocg);
+	if (parent)
+		parent->child_active_sum -= iocg->weight;
+
+	iocg->active = false;
+	list_del_init(&iocg->active_list);
+	atomic_inc(&ioc->hweight_gen);
+}
+
+/* Called with ioc->lock held. */
+static void weight_updated(struct ioc_gq *iocg)
+{
+	struct blkcg *blkcg = iocg_to_blkg(iocg)->blkcg;
+	struct ioc_cgrp *iocc = blkcg_to_iocc(blkcg);
+	u32 weight = iocg->cfg_weight ?: iocc->dfl_weight;
+	struct ioc_gq *parent;
+
+	lockdep_assert_held(&iocg->ioc->lock);
+
+	if (weight == iocg->weight)
+		return;
+
+	parent = iocg_parent(iocg);
+	if (iocg->active && parent)
+		parent->child_active_sum += weight - iocg->weight;
+
+	iocg->weight = weight;
+	atomic_inc(&iocg->ioc->hweight_gen);
+}
+
+/*
+ * The product of weight / sum of active sibling weights at each level, in
+ * WEIGHT_ONE units.  Cached until the active weights change.  The walk is
+ * done locklessly, a racing update only makes the result briefly stale.
+ */
+static u32 current_hweight(struct ioc_gq *iocg)
+{
+	int gen = atomic_read(&iocg->ioc->hweight_gen);
+	struct blkcg_gq *blkg;
+	u64 hw = WEIGHT_ONE;
+
+	if (likely(READ_ONCE(iocg->hweight_gen) == gen))
+		return READ_ONCE(iocg->hweight);
+
+	for (blkg = iocg_to_blkg(iocg); blkg->parent; blkg = blkg->parent) {
+		struct ioc_gq *child = blkg_to_iocg(blkg);
+		struct ioc_gq *parent = blkg_to_iocg(blkg->parent);
+		u32 weight, sum;
+
+		if (!child || !parent)
+			continue;
+		weight = READ_ONCE(child->weight);
+		sum = max(READ_ONCE(parent->child_active_sum), weight);
+		if (sum)
+			hw = div_u64(hw * weight, sum);
+	}
+
+	hw = max_t(u64, hw, 1);
+	WRITE_ONCE(iocg->hweight, hw);
+	smp_wmb();
+	WRITE_ONCE(iocg->hweight_gen, gen);
+	return hw;
+}
+
+static u64 calc_vtime_cost(struct bio *bio, struct ioc_gq *iocg)
+{
+	struct ioc *ioc = iocg->ioc;
+	u64 coef_seqio, coef_randio, coef_page;
+	u64 pages = max_t(u64, bio_sectors(bio) >> IOC_SECT_TO_PAGE_SHIFT, 1);
+	u64 seek_pages = 0;
+	u64 cost;
+
+	switch (bio_op(bio)) {
+	case REQ_OP_READ:
+		coef_seqio	= ioc->lcoefs[LCOEF_RSEQIO];
+		coef_randio	= ioc->lcoefs[LCOEF_RRANDIO];
+		coef_page	= ioc->lcoefs[LCOEF_RPAGE];
+		break;
+	case REQ_OP_WRITE:
+		coef_seqio	= ioc->lcoefs[LCOEF_WSEQIO];
+		coef_randio	= ioc->lcoefs[LCOEF_WRANDIO];
+		coef_page	= ioc->lcoefs[LCOEF_WPAGE];
+		break;
+	default:
+		return 0;
+	}
+
+	if (iocg->cursor) {
+		seek_pages = abs((s64)bio->bi_iter.bi_sector - (s64)iocg->cursor);
+		seek_pages >>= IOC_SECT_TO_PAGE_SHIFT;
+	}
+
+	if (seek_pages > LCOEF_RANDIO_PAGES)
+		cost = coef_randio;
+	else
+		cost = coef_seqio;
+
+	return cost + pages * coef_page;
+}
+
+static bool iocg_try_charge(struct ioc_gq *iocg, u64 cost, struct ioc_now *now)
+{
+	u64 vtime = atomic64_read(&iocg->vtime);
+
+	if (time_after64(vtime + cost, now->vnow))
+		return false;
+	atomic64_add(cost, &iocg->vtime);
+	return true;
+}
+
+static enum hrtimer_restart iocg_waitq_timer_fn(struct hrtimer *timer)
+{
+	struct ioc_gq *iocg = container_of(timer, struct ioc_gq, waitq_timer);
+
+	wake_up(&iocg->waitq);
+	return HRTIMER_NORESTART;
+}
+
+/* Wake up the first waiter when the device vtime has caught up. */
+static void iocg_arm_waitq_timer(struct ioc_gq *iocg, u64 cost,
+				 struct ioc_now *now)
+{
+	struct hrtimer *timer = &iocg->waitq_timer;
+	u64 vshortage = atomic64_read(&iocg->vtime) + cost - now->vnow;
+	ktime_t expires;
+
+	expires = ns_to_ktime(now->now_ns +
+			      div_u64(vshortage << VRATE_SHIFT, now->vrate));
+	if (!hrtimer_is_queued(timer) ||
+	    ktime_before(expires, hrtimer_get_expires(timer)))
+		hrtimer_start(timer, expires, HRTIMER_MODE_ABS);
+}
+
+static struct blkcg_gq *ioc_bio_blkg(struct request_queue *q, struct bio *bio,
+				     spinlock_t *lock)
+{
+	struct blkcg *blkcg;
+	struct blkcg_gq *blkg;
+
+	if (bio->bi_blkg)
+		return bio->bi_blkg;
+
+	rcu_read_lock();
+	blkcg = bio_blkcg(bio);
+	bio_associate_blkcg(bio, &blkcg->css);
+	blkg = blkg_lookup(blkcg, q);
+	if (unlikely(!blkg)) {
+		if (!lock)
+			spin_lock_irq(q->queue_lock);
+		blkg = blkg_lookup_create(blkcg, q);
+		if (IS_ERR(blkg))
+			blkg = NULL;
+		if (!lock)
+			spin_unlock_irq(q->queue_lock);
+	}
+	if (blkg)
+		bio_associate_blkg(bio, blkg);
+	rcu_read_unlock();
+
+	return bio->bi_blkg;
+}
+
+static void ioc_rqos_throttle(struct rq_qos *rqos, struct bio *bio,
+			      spinlock_t *lock)
+	__releases(lock)
+	__acquires(lock)
+{
+	struct ioc *ioc = rqos_to_ioc(rqos);
+	struct blkcg_gq *blkg;
+	struct ioc_gq *iocg;
+	struct ioc_now now;
+	DEFINE_WAIT(wait);
+	u64 abs_cost, cost, vtime, vmin;
+
+	if (!READ_ONCE(ioc->enabled))
+		return;
+
+	blkg = ioc_bio_blkg(rqos->q, bio, lock);
+	if (!blkg || !blkg->parent)
+		return;
+	iocg = blkg_to_iocg(blkg);
+	if (!iocg)
+		return;
+
+	abs_cost = calc_vtime_cost(bio, iocg);
+	if (!abs_cost)
+		return;
+	iocg->cursor = bio_end_sector(bio);
+
+	ioc_now(ioc, &now);
+
+	if (unlikely(!READ_ONCE(iocg->active))) {
+		unsigned long flags;
+
+		spin_lock_irqsave(&ioc->lock, flags);
+		iocg_activate_locked(iocg);
+		if (!timer_pending(&ioc->timer))
+			ioc_start_period(ioc, &now, ioc->vtime_rate);
+		spin_unlock_irqrestore(&ioc->lock, flags);
+	}
+	atomic64_set(&iocg->active_period, atomic64_read(&ioc->cur_period));
+	atomic64_add(abs_cost, &iocg->abs_usage);
+
+	/* don't let an idle group accumulate budget */
+	vmin = now.vnow - ioc->margin_ns;
+	vtime = atomic64_read(&iocg->vtime);
+	if (time_before64(vtime, vmin))
+		atomic64_cmpxchg(&iocg->vtime, vtime, vmin);
+
+	cost = div_u64(abs_cost * WEIGHT_ONE, current_hweight(iocg));
+
+	if (!waitqueue_active(&iocg->waitq) &&
+	    iocg_try_charge(iocg, cost, &now))
+		return;
+
+	/*
+	 * Charge but don't wait for IOs issued on behalf of the root and for
+	 * tasks which are being killed, see blk-iolatency.
+	 */
+	if (bio_issue_as_root_blkg(bio) || fatal_signal_pending(current)) {
+		atomic64_add(cost, &iocg->vtime);
+		return;
+	}
+
+	do {
+		prepare_to_wait_exclusive(&iocg->waitq, &wait,
+					  TASK_UNINTERRUPTIBLE);
+
+		ioc_now(ioc, &now);
+		if (iocg_try_charge(iocg, cost, &now) ||
+		    !READ_ONCE(ioc->enabled))
+			break;
+		iocg_arm_waitq_timer(iocg, cost, &now);
+
+		if (lock) {
+			spin_unlock_irq(lock);
+			io_schedule();
+			spin_lock_irq(lock);
+		} else {
+			io_schedule();
+		}
+	} while (1);
+
+	finish_wait(&iocg->waitq, &wait);
+
+	/* let the next waiter compute its own deadline */
+	if (waitqueue_active(&iocg->waitq))
+		wake_up(&iocg->waitq);
+}
+
+static void ioc_rqos_done(struct rq_qos *rqos, struct request *rq)
+{
+	struct ioc *ioc = rqos_to_ioc(rqos);
+	struct ioc_pcpu_stat *stat;
+	u64 on_q_ns;
+	u32 lat_us;
+	int rw;
+
+	if (!READ_ONCE(ioc->enabled) || !rq->start_time_ns)
+		return;
+
+	switch (req_op(rq)) {
+	case REQ_OP_READ:
+		rw = READ;
+		lat_us = ioc->params.qos[QOS_RLAT];
+		break;
+	case REQ_OP_WRITE:
+		rw = WRITE;
+		lat_us = ioc->params.qos[QOS_WLAT];
+		break;
+	default:
+		return;
+	}
+
+	on_q_ns = ktime_get_ns() - rq->start_time_ns;
+
+	stat = get_cpu_ptr(ioc->pcpu_stat);
+	if (on_q_ns > (u64)lat_us * NSEC_PER_USEC)
+		local_inc(&stat->missed[rw]);
+	local_inc(&stat->nr_done[rw]);
+	put_cpu_ptr(stat);
+}
+
+/* ppm of reads and writes which missed their target since the last call */
+static void ioc_lat_stat(struct ioc *ioc, u32 *missed_ppm)
+{
+	unsigned long missed[2] = { 0, 0 }, done[2] = { 0, 0 };
+	int cpu, rw;
+
+	for_each_possible_cpu(cpu) {
+		struct ioc_pcpu_stat *stat = per_cpu_ptr(ioc->pcpu_stat, cpu);
+
+		for (rw = READ; rw <= WRITE; rw++) {
+			missed[rw] += local_read(&stat->missed[rw]);
+			done[rw] += local_read(&stat->nr_done[rw]);
+		}
+	}
+
+	for (rw = READ; rw <= WRITE; rw++) {
+		unsigned long nr_missed = missed[rw] - ioc->last_missed[rw];
+		unsigned long nr_done = done[rw] - ioc->last_done[rw];
+
+		ioc->last_missed[rw] = missed[rw];
+		ioc->last_done[rw] = done[rw];
+		missed_ppm[rw] = nr_done ?
+			div64_u64((u64)nr_missed * IOC_PPM_ONE, nr_done) : 0;
+	}
+}
+
+static void ioc_timer_fn(struct timer_list *timer)
+{
+	struct ioc *ioc = container_of(timer, struct ioc, timer);
+	struct ioc_gq *iocg, *tiocg;
+	struct ioc_now now;
+	u32 missed_ppm[2];
+	u32 vrate;
+	u64 cur_period;
+	int nr_shortages = 0;
+
+	spin_lock_irq(&ioc->lock);
+
+	ioc_lat_stat(ioc, missed_ppm);
+	ioc_now(ioc, &now);
+	cur_period = atomic64_read(&ioc->cur_period);
+
+	/* children sit behind their parents, so walk backwards */
+	list_for_each_entry_safe_reverse(iocg, tiocg, &ioc->active_iocgs,
+					 active_list) {
+		if (waitqueue_active(&iocg->waitq)) {
+			nr_shortages++;
+			continue;
+		}
+		if (atomic64_read(&iocg->active_period) == cur_period ||
+		    iocg->child_active_sum)
+			continue;
+		iocg_deactivate_locked(iocg);
+	}
+
+	if (missed_ppm[READ] > ioc->params.qos[QOS_RPPM] ||
+	    missed_ppm[WRITE] > ioc->params.qos[QOS_WPPM])
+		ioc->busy_level = min(max(ioc->busy_level, 0) + 1,
+				      IOC_MAX_BUSY_LEVEL);
+	else if (nr_shortages)
+		ioc->busy_level = max(min(ioc->busy_level, 0) - 1,
+				      -IOC_MAX_BUSY_LEVEL);
+	else
+		ioc->busy_level = 0;
+
+	vrate = ioc->vtime_rate;
+	if (ioc->busy_level > 0) {
+		u32 adj = max_t(u32, vrate / VRATE_ADJ_DOWN_DIV, 1);
+
+		vrate -= min(vrate, adj * ioc->busy_level);
+	} else if (ioc->busy_level < 0) {
+		u32 adj = max_t(u32, vrate / VRATE_ADJ_UP_DIV, 1);
+
+		vrate += adj * -ioc->busy_level;
+	}
+	vrate = clamp(vrate, ioc->vrate_min, ioc->vrate_max);
+
+	if (!list_empty(&ioc->active_iocgs))
+		ioc_start_period(ioc, &now, vrate);
+
+	/* deadlines depend on vrate, let the waiters recompute them */
+	list_for_each_entry(iocg, &ioc->active_iocgs, active_list)
+		if (waitqueue_active(&iocg->waitq))
+			wake_up(&iocg->waitq);
+
+	spin_unlock_irq(&ioc->lock);
+}
+
+static void ioc_rqos_exit(struct rq_qos *rqos)
+{
+	struct ioc *ioc = rqos_to_ioc(rqos);
+
+	blkcg_deactivate_policy(rqos->q, &blkcg_policy_iocost);
+
+	spin_lock_irq(&ioc->lock);
+	ioc->enabled = false;
+	spin_unlock_irq(&ioc->lock);
+
+	del_timer_sync(&ioc->timer);
+	free_percpu(ioc->pcpu_stat);
+	kfree(ioc);
+}
+
+static struct rq_qos_ops ioc_rqos_ops = {
+	.throttle = ioc_rqos_throttle,
+	.done = ioc_rqos_done,
+	.exit = ioc_rqos_exit,
+};
+
+int blk_iocost_init(struct request_queue *q)
+{
+	struct ioc *ioc;
+	struct rq_qos *rqos;
+	int ret;
+
+	ioc = kzalloc(sizeof(*ioc), GFP_KERNEL);
+	if (!ioc)
+		return -ENOMEM;
+
+	ioc->pcpu_stat = alloc_percpu(struct ioc_pcpu_stat);
+	if (!ioc->pcpu_stat) {
+		kfree(ioc);
+		return -ENOMEM;
+	}
+
+	rqos = &ioc->rqos;
+	rqos->id = RQ_QOS_COST;
+	rqos->ops = &ioc_rqos_ops;
+	rqos->q = q;
+
+	spin_lock_init(&ioc->lock);
+	timer_setup(&ioc->timer, ioc_timer_fn, 0);
+	INIT_LIST_HEAD(&ioc->active_iocgs);
+	seqcount_init(&ioc->period_seqcount);
+	ioc->period_at = ktime_get_ns();
+	ioc->vtime_rate = VRATE_ONE;
+	atomic64_set(&ioc->cur_period, 0);
+	atomic_set(&ioc->hweight_gen, 0);
+	ioc_refresh_params(ioc);
+
+	rq_qos_add(q, rqos);
+
+	ret = blkcg_activate_policy(q, &blkcg_policy_iocost);
+	if (ret) {
+		rq_qos_del(q, rqos);
+		free_percpu(ioc->pcpu_stat);
+		kfree(ioc);
+		return ret;
+	}
+
+	return 0;
+}
+
+static struct blkcg_policy_data *ioc_cpd_alloc(gfp_t gfp)
+{
+	struct ioc_cgrp *iocc;
+
+	iocc = kzalloc(sizeof(struct ioc_cgrp), gfp);
+	if (!iocc)
+		return NULL;
+
+	iocc->dfl_weight = CGROUP_WEIGHT_DFL;
+	return &iocc->cpd;
+}
+
+static void ioc_cpd_free(struct blkcg_policy_data *cpd)
+{
+	kfree(container_of(cpd, struct ioc_cgrp, cpd));
+}
+
+static struct blkg_policy_data *ioc_pd_alloc(gfp_t gfp, int node)
+{
+	struct ioc_gq *iocg;
+
+	iocg = kzalloc_node(sizeof(*iocg), gfp, node);
+	if (!iocg)
+		return NULL;
+
+	return &iocg->pd;
+}
+
+static void ioc_pd_init(struct blkg_policy_data *pd)
+{
+	struct ioc_gq *iocg = pd_to_iocg(pd);
+	struct blkcg_gq *blkg = pd_to_blkg(&iocg->pd);
+	struct ioc *ioc = rqos_to_ioc(rq_qos_id(blkg->q, RQ_QOS_COST));
+	struct ioc_now now;
+	unsigned long flags;
+
+	ioc_now(ioc, &now);
+
+	iocg->ioc = ioc;
+	INIT_LIST_HEAD(&iocg->active_list);
+	atomic64_set(&iocg->vtime, now.vnow);
+	atomic64_set(&iocg->active_period, atomic64_read(&ioc->cur_period));
+	iocg->hweight = WEIGHT_ONE;
+	iocg->hweight_gen = atomic_read(&ioc->hweight_gen) - 1;
+
+	init_waitqueue_head(&iocg->waitq);
+	hrtimer_init(&iocg->waitq_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	iocg->waitq_timer.function = iocg_waitq_timer_fn;
+
+	spin_lock_irqsave(&ioc->lock, flags);
+	weight_updated(iocg);
+	spin_unlock_irqrestore(&ioc->lock, flags);
+}
+
+static void ioc_pd_offline(struct blkg_policy_data *pd)
+{
+	struct ioc_gq *iocg = pd_to_iocg(pd);
+	struct ioc *ioc = iocg->ioc;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ioc->lock, flags);
+	iocg_deactivate_locked(iocg);
+	spin_unlock_irqrestore(&ioc->lock, flags);
+}
+
+static void ioc_pd_free(struct blkg_policy_data *pd)
+{
+	struct ioc_gq *iocg = pd_to_iocg(pd);
+
+	hrtimer_cancel(&iocg->waitq_timer);
+	kfree(iocg);
+}
+
+static size_t ioc_pd_stat(struct blkg_policy_data *pd, char *buf, size_t size)
+{
+	struct ioc_gq *iocg = pd_to_iocg(pd);
+	struct ioc *ioc = iocg->ioc;
+	u32 hw;
+
+	if (!ioc->enabled)
+		return 0;
+
+	hw = current_hweight(iocg);
+	return scnprintf(buf, size,
+			 " cost.vrate=%u.%02u cost.hweight=%u.%02u cost.usage=%llu",
+			 ioc->vtime_rate * 100 / VRATE_ONE,
+			 (ioc->vtime_rate * 10000 / VRATE_ONE) % 100,
+			 hw * 100 / WEIGHT_ONE, (hw * 10000 / WEIGHT_ONE) % 100,
+			 div_u64(atomic64_read(&iocg->abs_usage), NSEC_PER_USEC));
+}
+
+static u64 ioc_weight_prfill(struct seq_file *sf, struct blkg_policy_data *pd,
+			     int off)
+{
+	const char *dname = blkg_dev_name(pd->blkg);
+	struct ioc_gq *iocg = pd_to_iocg(pd);
+
+	if (dname && iocg->cfg_weight)
+		seq_printf(sf, "%s %u\n", dname, iocg->cfg_weight);
+	return 0;
+}
+
+static int ioc_weight_show(struct seq_file *sf, void *v)
+{
+	struct blkcg *blkcg = css_to_blkcg(seq_css(sf));
+	struct ioc_cgrp *iocc = blkcg_to_iocc(blkcg);
+
+	seq_printf(sf, "default %u\n", iocc->dfl_weight);
+	blkcg_print_blkgs(sf, blkcg, ioc_weight_prfill,
+			  &blkcg_policy_iocost, seq_cft(sf)->private, false);
+	return 0;
+}
+
+static ssize_t ioc_weight_write(struct kernfs_open_file *of, char *buf,
+				size_t nbytes, loff_t off)
+{
+	struct blkcg *blkcg = css_to_blkcg(of_css(of));
+	struct ioc_cgrp *iocc = blkcg_to_iocc(blkcg);
+	struct blkg_conf_ctx ctx;
+	struct ioc_gq *iocg;
+	u32 v;
+	int ret;
+
+	if (!strchr(buf, ':')) {
+		struct blkcg_gq *blkg;
+
+		if (sscanf(buf, "default %u", &v) != 1 &&
+		    sscanf(buf, "%u", &v) != 1)
+			return -EINVAL;
+
+		if (v < CGROUP_WEIGHT_MIN || v > CGROUP_WEIGHT_MAX)
+			return -EINVAL;
+
+		spin_lock_irq(&blkcg->lock);
+		iocc->dfl_weight = v;
+		hlist_for_each_entry(blkg, &blkcg->blkg_list, blkcg_node) {
+			iocg = blkg_to_iocg(blkg);
+			if (iocg) {
+				spin_lock(&iocg->ioc->lock);
+				weight_updated(iocg);
+				spin_unlock(&iocg->ioc->lock);
+			}
+		}
+		spin_unlock_irq(&blkcg->lock);
+
+		return nbytes;
+	}
+
+	ret = blkg_conf_prep(blkcg, &blkcg_policy_iocost, buf, &ctx);
+	if (ret)
+		return ret;
+
+	iocg = blkg_to_iocg(ctx.blkg);
+
+	if (!strncmp(ctx.body, "default", 7)) {
+		v = 0;
+	} else {
+		if (sscanf(ctx.body, "%u", &v) != 1)
+			goto einval;
+		if (v < CGROUP_WEIGHT_MIN || v > CGROUP_WEIGHT_MAX)
+			goto einval;
+	}
+
+	spin_lock(&iocg->ioc->lock);
+	iocg->cfg_weight = v;
+	weight_updated(iocg);
+	spin_unlock(&iocg->ioc->lock);
+
+	blkg_conf_finish(&ctx);
+	return nbytes;
+
+einval:
+	blkg_conf_finish(&ctx);
+	return -EINVAL;
+}
+
+static u64 ioc_qos_prfill(struct seq_file *sf, struct blkg_policy_data *pd,
+			  int off)
+{
+	const char *dname = blkg_dev_name(pd->blkg);
+	struct ioc *ioc = pd_to_iocg(pd)->ioc;
+	u32 *qos = ioc->params.qos;
+
+	if (!dname)
+		return 0;
+
+	seq_printf(sf, "%s enable=%d ctrl=%s rpct=%u rlat=%u wpct=%u wlat=%u min=%u max=%u\n",
+		   dname, ioc->enabled, ioc->user_qos_params ? "user" : "auto",
+		   qos[QOS_RPPM] / 10000, qos[QOS_RLAT],
+		   qos[QOS_WPPM] / 10000, qos[QOS_WLAT],
+		   qos[QOS_MIN] / 10000, qos[QOS_MAX] / 10000);
+	return 0;
+}
+
+static int ioc_qos_show(struct seq_file *sf, void *v)
+{
+	struct blkcg *blkcg = css_to_blkcg(seq_css(sf));
+
+	blkcg_print_blkgs(sf, blkcg, ioc_qos_prfill,
+			  &blkcg_policy_iocost, seq_cft(sf)->private, false);
+	return 0;
+}
+
+static const match_table_t qos_ctrl_tokens = {
+	{ QOS_RPPM,		"rpct=%u"	},
+	{ QOS_RLAT,		"rlat=%u"	},
+	{ QOS_WPPM,		"wpct=%u"	},
+	{ QOS_WLAT,		"wlat=%u"	},
+	{ QOS_MIN,		"min=%u"	},
+	{ QOS_MAX,		"max=%u"	},
+	{ NR_QOS_PARAMS,	NULL		},
+};
+
+static ssize_t ioc_qos_write(struct kernfs_open_file *of, char *input,
+			     size_t nbytes, loff_t off)
+{
+	struct blkcg *blkcg = css_to_blkcg(of_css(of));
+	struct blkg_conf_ctx ctx;
+	struct ioc *ioc;
+	u32 qos[NR_QOS_PARAMS];
+	bool enable, user;
+	char *p;
+	int ret;
+
+	ret = blkg_conf_prep(blkcg, &blkcg_policy_iocost, input, &ctx);
+	if (ret)
+		return ret;
+
+	ioc = blkg_to_iocg(ctx.blkg)->ioc;
+
+	spin_lock(&ioc->lock);
+	memcpy(qos, ioc->params.qos, sizeof(qos));
+	enable = ioc->enabled;
+	user = ioc->user_qos_params;
+	spin_unlock(&ioc->lock);
+
+	while ((p = strsep(&ctx.body, " \t\n"))) {
+		substring_t args[MAX_OPT_ARGS];
+		char buf[32];
+		int tok;
+		u32 v;
+
+		if (!*p)
+			continue;
+
+		if (!strncmp(p, "enable=", 7)) {
+			if (kstrtou32(p + 7, 10, &v) || v > 1)
+				goto einval;
+			enable = v;
+			continue;
+		}
+
+		if (!strncmp(p, "ctrl=", 5)) {
+			if (!strcmp(p + 5, "auto"))
+				user = false;
+			else if (!strcmp(p + 5, "user"))
+				user = true;
+			else
+				goto einval;
+			continue;
+		}
+
+		tok = match_token(p, qos_ctrl_tokens, args);
+		if (tok == NR_QOS_PARAMS)
+			goto einval;
+		match_strlcpy(buf, &args[0], sizeof(buf));
+		if (kstrtou32(buf, 10, &v))
+			goto einval;
+
+		switch (tok) {
+		case QOS_RPPM:
+		case QOS_WPPM:
+			if (v > 100)
+				goto einval;
+			qos[tok] = v * 10000;
+			break;
+		case QOS_RLAT:
+		case QOS_WLAT:
+			qos[tok] = v;
+			break;
+		case QOS_MIN:
+		case QOS_MAX:
+			if (v < 1 || v > 10000)
+				goto einval;
+			qos[tok] = v * 10000;
+			break;
+		}
+		user = true;
+	}
+
+	if (qos[QOS_MIN] > qos[QOS_MAX])
+		goto einval;
+
+	spin_lock(&ioc->lock);
+	ioc->user_qos_params = user;
+	if (user)
+		memcpy(ioc->params.qos, qos, sizeof(qos));
+	ioc_refresh_params(ioc);
+	WRITE_ONCE(ioc->enabled, enable);
+	spin_unlock(&ioc->lock);
+
+	blkg_conf_finish(&ctx);
+	return nbytes;
+
+einval:
+	blkg_conf_finish(&ctx);
+	return -EINVAL;
+}
+
+static u64 ioc_cost_model_prfill(struct seq_file *sf,
+				 struct blkg_policy_data *pd, int off)
+{
+	const char *dname = blkg_dev_name(pd->blkg);
+	struct ioc *ioc = pd_to_iocg(pd)->ioc;
+	u64 *u = ioc->params.i_lcoefs;
+
+	if (!dname)
+		return 0;
+
+	seq_printf(sf, "%s ctrl=%s model=linear "
+		   "rbps=%llu rseqiops=%llu rrandiops=%llu "
+		   "wbps=%llu wseqiops=%llu wrandiops=%llu\n",
+		   dname, ioc->user_cost_model ? "user" : "auto",
+		   u[I_LCOEF_RBPS], u[I_LCOEF_RSEQIOPS], u[I_LCOEF_RRANDIOPS],
+		   u[I_LCOEF_WBPS], u[I_LCOEF_WSEQIOPS], u[I_LCOEF_WRANDIOPS]);
+	return 0;
+}
+
+static int ioc_cost_model_show(struct seq_file *sf, void *v)
+{
+	struct blkcg *blkcg = css_to_blkcg(seq_css(sf));
+
+	blkcg_print_blkgs(sf, blkcg, ioc_cost_model_prfill,
+			  &blkcg_policy_iocost, seq_cft(sf)->private, false);
+	return 0;
+}
+
+static const match_table_t i_lcoef_tokens = {
+	{ I_LCOEF_RBPS,		"rbps=%u"	},
+	{ I_LCOEF_RSEQIOPS,	"rseqiops=%u"	},
+	{ I_LCOEF_RRANDIOPS,	"rrandiops=%u"	},
+	{ I_LCOEF_WBPS,		"wbps=%u"	},
+	{ I_LCOEF_WSEQIOPS,	"wseqiops=%u"	},
+	{ I_LCOEF_WRANDIOPS,	"wrandiops=%u"	},
+	{ NR_I_LCOEFS,		NULL		},
+};
+
+static ssize_t ioc_cost_model_write(struct kernfs_open_file *of, char *input,
+				    size_t nbytes, loff_t off)
+{
+	struct blkcg *blkcg = css_to_blkcg(of_css(of));
+	struct blkg_conf_ctx ctx;
+	struct ioc *ioc;
+	u64 u[NR_I_LCOEFS];
+	bool user;
+	char *p;
+	int ret;
+
+	ret = blkg_conf_prep(blkcg, &blkcg_policy_iocost, input, &ctx);
+	if (ret)
+		return ret;
+
+	ioc = blkg_to_iocg(ctx.blkg)->ioc;
+
+	spin_lock(&ioc->lock);
+	memcpy(u, ioc->params.i_lcoefs, sizeof(u));
+	user = ioc->user_cost_model;
+	spin_unlock(&ioc->lock);
+
+	while ((p = strsep(&ctx.body, " \t\n"))) {
+		substring_t args[MAX_OPT_ARGS];
+		char buf[32];
+		int tok;
+		u64 v;
+
+		if (!*p)
+			continue;
+
+		if (!strncmp(p, "ctrl=", 5)) {
+			if (!strcmp(p + 5, "auto"))
+				user = false;
+			else if (!strcmp(p + 5, "user"))
+				user = true;
+			else
+				goto einval;
+			continue;
+		}
+
+		if (!strncmp(p, "model=", 6)) {
+			if (strcmp(p + 6, "linear"))
+				goto einval;
+			user = true;
+			continue;
+		}
+
+		tok = match_token(p, i_lcoef_tokens, args);
+		if (tok == NR_I_LCOEFS)
+			goto einval;
+		match_strlcpy(buf, &args[0], sizeof(buf));
+		if (kstrtou64(buf, 10, &v))
+			goto einval;
+		u[tok] = v;
+		user = true;
+	}
+
+	spin_lock(&ioc->lock);
+	ioc->user_cost_model = user;
+	if (user)
+		memcpy(ioc->params.i_lcoefs, u, sizeof(u));
+	ioc_refresh_params(ioc);
+	spin_unlock(&ioc->lock);
+
+	blkg_conf_finish(&ctx);
+	return nbytes;
+
+einval:
+	blkg_conf_finish(&ctx);
+	return -EINVAL;
+}
+
+static struct cftype ioc_files[] = {
+	{
+		.name = "cost.weight",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = ioc_weight_show,
+		.write = ioc_weight_write,
+	},
+	{
+		.name = "cost.qos",
+		.flags = CFTYPE_ONLY_ON_ROOT,
+		.seq_show = ioc_qos_show,
+		.write = ioc_qos_write,
+	},
+	{
+		.name = "cost.model",
+		.flags = CFTYPE_ONLY_ON_ROOT,
+		.seq_show = ioc_cost_model_show,
+		.write = ioc_cost_model_write,
+	},
+	{}
+};
+
+static struct blkcg_policy blkcg_policy_iocost = {
+	.dfl_cftypes	= ioc_files,
+	.cpd_alloc_fn	= ioc_cpd_alloc,
+	.cpd_free_fn	= ioc_cpd_free,
+	.pd_alloc_fn	= ioc_pd_alloc,
+	.pd_init_fn	= ioc_pd_init,
+	.pd_offline_fn	= ioc_pd_offline,
+	.pd_free_fn	= ioc_pd_free,
+	.pd_stat_fn	= ioc_pd_stat,
+};
+
+static int __init ioc_init(void)
+{
+	return blkcg_policy_register(&blkcg_policy_iocost);
+}
+
+static void __exit ioc_exit(void)
+{
+	return blkcg_policy_unregister(&blkcg_policy_iocost);
+}
+
+module_init(ioc_init);
+module_exit(ioc_exit);
@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Block cgroup policy for assigning an I/O priority class to requests.
+ *
+ * Using a cgroup policy for assigning an I/O priority class has two
+ * advantages over using the ioprio_set() system call:
+ *
+ * - This policy is cgroup based so it has all the advantages of cgroups.
+ * - While ioprio_set() does not affect page cache writeback I/O, this
+ *   policy affects page cache writeback I/O for filesystems that support
+ *   associating a cgroup with writeback I/O. See also
+ *   Documentation/admin-guide/cgroup-v2.rst.
+ *
+ * The class is applied when the bio enters the block layer, before any
+ * merging, so that an I/O scheduler which schedules by class (mq-deadline,
+ * bfq) sees the effective priority of every request.
+ *
+ * The per-cgroup state is a single word kept in struct blkcg itself rather
+ * than in a blkcg_policy_data, so this does not take one of the
+ * BLKCG_MAX_POLS policy slots. The cgroup files are registered directly.
+ */
+
+#include <linux/blk-cgroup.h>
+#include <linux/blkdev.h>
+#include <linux/init.h>
+#include <linux/ioprio.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include "blk-ioprio.h"
+
+/**
+ * enum prio_policy - I/O priority class policy.
+ * @POLICY_NO_CHANGE: (default) do not modify the I/O priority class.
+ * @POLICY_NONE_TO_RT: modify IOPRIO_CLASS_NONE into IOPRIO_CLASS_RT.
+ * @POLICY_RESTRICT_TO_BE: modify IOPRIO_CLASS_NONE and IOPRIO_CLASS_RT into
+ *		IOPRIO_CLASS_BE.
+ * @POLICY_ALL_TO_IDLE: change the I/O priority class into IOPRIO_CLASS_IDLE.
+ *
+ * See also <linux/ioprio.h>.
+ */
+enum prio_policy {
+	POLICY_NO_CHANGE	= 0,
+	POLICY_NONE_TO_RT	= 1,
+	POLICY_RESTRICT_TO_BE	= 2,
+	POLICY_ALL_TO_IDLE	= 3,
+};
+
+static const char *policy_name[] = {
+	[POLICY_NO_CHANGE]	= "no-change",
+	[POLICY_NONE_TO_RT]	= "none-to-rt",
+	[POLICY_RESTRICT_TO_BE]	= "restrict-to-be",
+	[POLICY_ALL_TO_IDLE]	= "idle",
+};
+
+static int ioprio_show_prio_policy(struct seq_file *sf, void *v)
+{
+	struct blkcg *blkcg = css_to_blkcg(seq_css(sf));
+
+	seq_printf(sf, "%s\n", policy_name[READ_ONCE(blkcg->prio_policy)]);
+	return 0;
+}
+
+static ssize_t ioprio_set_prio_policy(struct kernfs_open_file *of, char *buf,
+				      size_t nbytes, loff_t off)
+{
+	struct blkcg *blkcg = css_to_blkcg(of_css(of));
+	int ret;
+
+	if (off != 0)
+		return -EIO;
+	/* kernfs_fop_write() terminates 'buf' with '\0'. */
+	ret = sysfs_match_string(policy_name, buf);
+	if (ret < 0)
+		return ret;
+	WRITE_ONCE(blkcg->prio_policy, ret);
+	return nbytes;
+}
+
+#define IOPRIO_ATTRS						\
+	{							\
+		.name		= "prio.class",			\
+		.seq_show	= ioprio_show_prio_policy,	\
+		.write		= ioprio_set_prio_policy,	\
+	},							\
+	{ } /* sentinel */
+
+/* cgroup v2 attributes */
+static struct cftype ioprio_files[] = {
+	IOPRIO_ATTRS
+};
+
+/* cgroup v1 attributes */
+static struct cftype ioprio_legacy_files[] = {
+	IOPRIO_ATTRS
+};
+
+void blkcg_set_ioprio(struct bio *bio)
+{
+	unsigned int prio_policy;
+	unsigned short prio;
+
+	/* blkcg is zeroed on allocation, so a new cgroup starts as no-change */
+	rcu_read_lock();
+	prio_policy = READ_ONCE(bio_blkcg(bio)->prio_policy);
+	rcu_read_unlock();
+	if (prio_policy == POLICY_NO_CHANGE)
+		return;
+
+	/*
+	 * Except for IOPRIO_CLASS_NONE, higher I/O priority numbers
+	 * correspond to a lower priority. Hence, the max_t() below selects
+	 * the lower priority of bi_ioprio and the cgroup I/O priority class.
+	 * If the bio I/O priority equals IOPRIO_CLASS_NONE, the cgroup I/O
+	 * priority is assigned to the bio.
+	 */
+	prio = max_t(u16, bio->bi_ioprio, IOPRIO_PRIO_VALUE(prio_policy, 0));
+
+	if (prio > bio->bi_ioprio)
+		bio_set_prio(bio, prio);
+}
+
+static int __init ioprio_init(void)
+{
+	WARN_ON(cgroup_add_dfl_cftypes(&io_cgrp_subsys, ioprio_files));
+	WARN_ON(cgroup_add_legacy_cftypes(&io_cgrp_subsys,
+					  ioprio_legacy_files));
+	return 0;
+}
+module_init(ioprio_init);
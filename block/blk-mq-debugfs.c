@@ -784,6 +784,60 @@ static const struct file_operations blk_mq_debugfs_fops = {
 	.release	= blk_mq_debugfs_release,
 };
 
+/*
+ * One line per operation and request size class with any samples, giving
+ * the count of each log2 latency bucket, see blk-stat.h.
+ */
+static int hctx_lat_hist_show(void *data, struct seq_file *m)
+{
+	static const char * const op_name[BLK_LAT_HIST_OPS] = {
+		[BLK_LAT_HIST_READ]	= "read",
+		[BLK_LAT_HIST_WRITE]	= "write",
+		[BLK_LAT_HIST_DISCARD]	= "discard",
+	};
+	static const char * const size_name[BLK_LAT_HIST_SIZES] = {
+		"4k", "16k", "64k", "64k+",
+	};
+	struct blk_mq_hw_ctx *hctx = data;
+	struct blk_lat_hist *sum;
+	int op, size, bucket;
+
+	if (!hctx->lat_hist)
+		return 0;
+
+	sum = kzalloc(sizeof(*sum), GFP_KERNEL);
+	if (!sum)
+		return -ENOMEM;
+	blk_lat_hist_sum(sum, hctx->lat_hist);
+
+	for (op = 0; op < BLK_LAT_HIST_OPS; op++) {
+		for (size = 0; size < BLK_LAT_HIST_SIZES; size++) {
+			u64 *buckets = sum->buckets[op][size];
+
+			if (!memchr_inv(buckets, 0, sizeof(sum->buckets[op][size])))
+				continue;
+
+			seq_printf(m, "%s %s", op_name[op], size_name[size]);
+			for (bucket = 0; bucket < BLK_LAT_HIST_BUCKETS; bucket++)
+				seq_printf(m, " %llu", buckets[bucket]);
+			seq_putc(m, '\n');
+		}
+	}
+
+	kfree(sum);
+	return 0;
+}
+
+static ssize_t hctx_lat_hist_write(void *data, const char __user *buf,
+				   size_t count, loff_t *ppos)
+{
+	struct blk_mq_hw_ctx *hctx = data;
+
+	if (hctx->lat_hist)
+		blk_lat_hist_reset(hctx->lat_hist);
+	return count;
+}
+
 static const struct blk_mq_debugfs_attr blk_mq_debugfs_hctx_attrs[] = {
 	{"state", 0400, hctx_state_show},
 	{"flags", 0400, hctx_flags_show},
@@ -800,6 +854,7 @@ static const struct blk_mq_debugfs_attr blk_mq_debugfs_hctx_attrs[] = {
 	{"run", 0600, hctx_run_show, hctx_run_write},
 	{"active", 0400, hctx_active_show},
 	{"dispatch_busy", 0400, hctx_dispatch_busy_show},
+	{"lat_hist", 0600, hctx_lat_hist_show, hctx_lat_hist_write},
 	{},
 };
 
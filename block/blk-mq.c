@@ -393,6 +393,98 @@ static struct request *blk_mq_rq_ctx_init(struct blk_mq_alloc_data *data,
 	return rq;
 }
 
+/*
+ * Allocate up to @plug->nr_ios driver tags with a single bitmap operation.
+ * The first request is returned, the rest are parked on the plug for the
+ * following bios, each holding its own queue usage reference.
+ */
+static struct request *blk_mq_get_request_batch(struct blk_mq_alloc_data *data,
+		unsigned int op, struct blk_plug *plug)
+{
+	unsigned int nr_tags = min_t(unsigned int, plug->nr_ios,
+				     BITS_PER_LONG - 1);
+	struct request *rq = NULL;
+	unsigned long tag_mask;
+	unsigned int tag_offset;
+	int i;
+
+	/* only the first allocation of a plug is batched */
+	plug->nr_ios = 1;
+
+	tag_mask = blk_mq_get_tags(data, nr_tags, &tag_offset);
+	if (!tag_mask)
+		return NULL;
+
+	for (i = 0; tag_mask; i++) {
+		struct request *tmp;
+
+		if (!(tag_mask & (1UL << i)))
+			continue;
+		tag_mask &= ~(1UL << i);
+
+		tmp = blk_mq_rq_ctx_init(data, tag_offset + i, op);
+		tmp->elv.icq = NULL;
+		if (!rq) {
+			rq = tmp;
+			continue;
+		}
+		blk_queue_enter_live(data->q);
+		list_add_tail(&tmp->queuelist, &plug->cached_rqs);
+	}
+	return rq;
+}
+
+static struct request *blk_mq_get_cached_request(struct request_queue *q,
+		struct blk_plug *plug, unsigned int op,
+		struct blk_mq_alloc_data *data)
+{
+	struct request *rq;
+
+	if (list_empty(&plug->cached_rqs))
+		return NULL;
+	rq = list_first_entry(&plug->cached_rqs, struct request, queuelist);
+	if (rq->q != q)
+		return NULL;
+	list_del_init(&rq->queuelist);
+
+	/* pairs with blk_mq_put_ctx() in the caller */
+	preempt_disable();
+	data->q = q;
+	data->ctx = rq->mq_ctx;
+	data->hctx = blk_mq_map_queue(q, data->ctx->cpu);
+
+	rq->cmd_flags = op;
+	rq->start_time_ns = ktime_get_ns();
+	data->hctx->queued++;
+	return rq;
+}
+
+void blk_mq_free_plug_rqs(struct blk_plug *plug)
+{
+	int tags[BITS_PER_LONG];
+	struct request_queue *q = NULL;
+	struct blk_mq_hw_ctx *hctx = NULL;
+	struct request *rq, *next;
+	int nr_tags = 0;
+
+	/* all cached requests come from the same blk_mq_get_request_batch() */
+	list_for_each_entry_safe(rq, next, &plug->cached_rqs, queuelist) {
+		list_del_init(&rq->queuelist);
+		q = rq->q;
+		hctx = blk_mq_map_queue(q, rq->mq_ctx->cpu);
+		rq->mq_ctx->rq_completed[rq_is_sync(rq)]++;
+		WRITE_ONCE(rq->state, MQ_RQ_IDLE);
+		if (refcount_dec_and_test(&rq->ref))
+			tags[nr_tags++] = rq->tag;
+	}
+
+	if (!nr_tags)
+		return;
+	blk_mq_put_tags(hctx->tags, tags, nr_tags);
+	blk_mq_sched_restart(hctx);
+	percpu_ref_put_many(&q->q_usage_counter, nr_tags);
+}
+
 static struct request *blk_mq_get_request(struct request_queue *q,
 		struct bio *bio, unsigned int op,
 		struct blk_mq_alloc_data *data)
@@ -425,7 +517,15 @@ static struct request *blk_mq_get_request(struct request_queue *q,
 		    !(data->flags & BLK_MQ_REQ_RESERVED))
 			e->type->ops.mq.limit_depth(op, data);
 	} else {
+		struct blk_plug *plug = current->plug;
+
 		blk_mq_tag_busy(data->hctx);
+
+		if (bio && plug && plug->nr_ios > 1 && !op_is_flush(op)) {
+			rq = blk_mq_get_request_batch(data, op, plug);
+			if (rq)
+				goto out;
+		}
 	}
 
 	tag = blk_mq_get_tag(data);
@@ -449,6 +549,7 @@ static struct request *blk_mq_get_request(struct request_queue *q,
 			rq->rq_flags |= RQF_ELVPRIV;
 		}
 	}
+out:
 	data->hctx->queued++;
 	return rq;
 }
@@ -604,6 +705,117 @@ void blk_mq_end_request(struct request *rq, blk_status_t error)
 }
 EXPORT_SYMBOL(blk_mq_end_request);
 
+#define TAG_COMP_BATCH		32
+
+/**
+ * blk_mq_add_to_batch - queue a completed request for batched completion
+ * @rq:		the request that finished
+ * @iob:	the batch to add it to, may be NULL
+ * @ioerror:	non-zero if the request failed
+ * @complete:	driver handler that ends the batch
+ *
+ * Returns true if @rq has been taken care of, either by adding it to @iob or
+ * because it was already completed by the timeout handler.  Returns false if
+ * the request needs the normal blk_mq_complete_request() treatment.
+ */
+bool blk_mq_add_to_batch(struct request *rq, struct io_comp_batch *iob,
+			 int ioerror, void (*complete)(struct io_comp_batch *))
+{
+	if (!iob || ioerror || rq->end_io || rq->internal_tag != -1 ||
+	    (rq->rq_flags & RQF_ELVPRIV) || blk_bidi_rq(rq))
+		return false;
+	if (!iob->complete)
+		iob->complete = complete;
+	else if (iob->complete != complete)
+		return false;
+
+	if (unlikely(blk_should_fake_timeout(rq->q)))
+		return true;
+	if (!blk_mq_mark_complete(rq))
+		return true;
+
+	if (rq->rq_flags & (RQF_STATS | RQF_IO_STAT))
+		iob->need_ts = true;
+	list_add_tail(&rq->queuelist, &iob->req_list);
+	return true;
+}
+EXPORT_SYMBOL_GPL(blk_mq_add_to_batch);
+
+static void blk_mq_flush_tag_batch(struct blk_mq_hw_ctx *hctx, int *tag_array,
+				   int nr_tags)
+{
+	struct request_queue *q = hctx->queue;
+
+	blk_mq_put_tags(hctx->tags, tag_array, nr_tags);
+	blk_mq_sched_restart(hctx);
+	percpu_ref_put_many(&q->q_usage_counter, nr_tags);
+}
+
+/**
+ * blk_mq_end_request_batch - end all requests collected in @iob
+ * @iob:	batch filled by blk_mq_add_to_batch()
+ *
+ * Like blk_mq_end_request() with BLK_STS_OK for every request, but reads the
+ * clock once for the whole batch and frees the driver tags back to the tag
+ * map a word at a time.
+ */
+void blk_mq_end_request_batch(struct io_comp_batch *iob)
+{
+	int tags[TAG_COMP_BATCH], nr_tags = 0;
+	struct blk_mq_hw_ctx *cur_hctx = NULL;
+	struct request *rq, *next;
+	u64 now = 0;
+
+	if (iob->need_ts)
+		now = ktime_get_ns();
+
+	list_for_each_entry_safe(rq, next, &iob->req_list, queuelist) {
+		struct request_queue *q = rq->q;
+		struct blk_mq_ctx *ctx = rq->mq_ctx;
+		struct blk_mq_hw_ctx *hctx = blk_mq_map_queue(q, ctx->cpu);
+
+		list_del_init(&rq->queuelist);
+
+		if (blk_update_request(rq, BLK_STS_OK, blk_rq_bytes(rq)))
+			BUG();
+
+		if (rq->rq_flags & RQF_STATS) {
+			blk_mq_poll_stats_start(q);
+			blk_stat_add(rq, now);
+		}
+		blk_account_io_done(rq, now);
+
+		ctx->rq_completed[rq_is_sync(rq)]++;
+		if (rq->rq_flags & RQF_MQ_INFLIGHT)
+			atomic_dec(&hctx->nr_active);
+
+		if (unlikely(laptop_mode && !blk_rq_is_passthrough(rq)))
+			laptop_io_completion(q->backing_dev_info);
+
+		rq_qos_done(q, rq);
+
+		if (blk_rq_rl(rq))
+			blk_put_rl(blk_rq_rl(rq));
+
+		WRITE_ONCE(rq->state, MQ_RQ_IDLE);
+		if (!refcount_dec_and_test(&rq->ref))
+			continue;
+
+		if (nr_tags == TAG_COMP_BATCH ||
+		    (cur_hctx && cur_hctx != hctx)) {
+			blk_mq_flush_tag_batch(cur_hctx, tags, nr_tags);
+			nr_tags = 0;
+		}
+		cur_hctx = hctx;
+		tags[nr_tags++] = rq->tag;
+	}
+
+	if (nr_tags)
+		blk_mq_flush_tag_batch(cur_hctx, tags, nr_tags);
+	iob->need_ts = false;
+}
+EXPORT_SYMBOL_GPL(blk_mq_end_request_batch);
+
 static void __blk_mq_complete_request_remote(void *data)
 {
 	struct request *rq = data;
@@ -2003,7 +2215,12 @@ static blk_qc_t blk_mq_make_request(struct request_queue *q, struct bio *bio)
 
 	rq_qos_throttle(q, bio, NULL);
 
-	rq = blk_mq_get_request(q, bio, bio->bi_opf, &data);
+	plug = current->plug;
+	rq = NULL;
+	if (plug)
+		rq = blk_mq_get_cached_request(q, plug, bio->bi_opf, &data);
+	if (!rq)
+		rq = blk_mq_get_request(q, bio, bio->bi_opf, &data);
 	if (unlikely(!rq)) {
 		rq_qos_cleanup(q, bio);
 		if (bio->bi_opf & REQ_NOWAIT)
@@ -2017,7 +2234,6 @@ static blk_qc_t blk_mq_make_request(struct request_queue *q, struct bio *bio)
 
 	cookie = request_to_qc_t(data.hctx, rq);
 
-	plug = current->plug;
 	if (unlikely(is_flush_fua)) {
 		blk_mq_put_ctx(data.ctx);
 		blk_mq_bio_to_request(rq, bio);
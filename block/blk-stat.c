@@ -6,6 +6,9 @@
 #include <linux/kernel.h>
 #include <linux/rculist.h>
 #include <linux/blk-mq.h>
+#include <linux/blk-cgroup.h>
+#include <linux/percpu.h>
+#include <linux/sizes.h>
 
 #include "blk-stat.h"
 #include "blk-mq.h"
@@ -75,6 +78,172 @@ void blk_stat_add(struct request *rq, u64 now)
 	rcu_read_unlock();
 }
 
+static unsigned int blk_lat_hist_op(struct request *rq)
+{
+	if (op_is_discard(req_op(rq)))
+		return BLK_LAT_HIST_DISCARD;
+	if (op_is_write(req_op(rq)))
+		return BLK_LAT_HIST_WRITE;
+	return BLK_LAT_HIST_READ;
+}
+
+static unsigned int blk_lat_hist_size(unsigned int bytes)
+{
+	if (bytes <= SZ_4K)
+		return 0;
+	if (bytes <= SZ_16K)
+		return 1;
+	if (bytes <= SZ_64K)
+		return 2;
+	return 3;
+}
+
+/*
+ * Called on the final completion of @rq, while the bios it carries are still
+ * attached, and so is the cgroup they were issued from.
+ */
+void blk_stat_add_lat_hist(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	unsigned int op, size, bucket;
+	u64 now, lat_us;
+
+	if (!rq->io_start_time_ns)
+		return;
+
+	now = ktime_get_ns();
+	lat_us = now > rq->io_start_time_ns ?
+		div_u64(now - rq->io_start_time_ns, NSEC_PER_USEC) : 0;
+	bucket = lat_us > 1 ? min_t(unsigned int, ilog2(lat_us),
+				    BLK_LAT_HIST_BUCKETS - 1) : 0;
+	op = blk_lat_hist_op(rq);
+	size = blk_lat_hist_size(blk_rq_bytes(rq));
+
+	if (q->mq_ops) {
+		struct blk_mq_hw_ctx *hctx = blk_mq_map_queue(q, rq->mq_ctx->cpu);
+
+		if (hctx->lat_hist)
+			this_cpu_inc(hctx->lat_hist->buckets[op][size][bucket]);
+	}
+
+#ifdef CONFIG_BLK_CGROUP
+	if (rq->bio) {
+		struct bio *bio = rq->bio;
+		struct blkcg_gq *blkg;
+
+		rcu_read_lock();
+		blkg = blkg_lookup(bio->bi_css ? css_to_blkcg(bio->bi_css) :
+				   &blkcg_root, q);
+		if (blkg && blkg->lat_hist)
+			this_cpu_inc(blkg->lat_hist->buckets[op][size][bucket]);
+		rcu_read_unlock();
+	}
+#endif
+}
+
+void blk_lat_hist_sum(struct blk_lat_hist *dst,
+		      struct blk_lat_hist __percpu *hist)
+{
+	int cpu, op, size, bucket;
+
+	for_each_possible_cpu(cpu) {
+		struct blk_lat_hist *src = per_cpu_ptr(hist, cpu);
+
+		for (op = 0; op < BLK_LAT_HIST_OPS; op++)
+			for (size = 0; size < BLK_LAT_HIST_SIZES; size++)
+				for (bucket = 0; bucket < BLK_LAT_HIST_BUCKETS;
+				     bucket++)
+					dst->buckets[op][size][bucket] +=
+						src->buckets[op][size][bucket];
+	}
+}
+
+void blk_lat_hist_reset(struct blk_lat_hist __percpu *hist)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(hist, cpu), 0, sizeof(struct blk_lat_hist));
+}
+
+u64 blk_lat_hist_samples(struct blk_lat_hist *hist, int op)
+{
+	int size, bucket;
+	u64 nr = 0;
+
+	for (size = 0; size < BLK_LAT_HIST_SIZES; size++)
+		for (bucket = 0; bucket < BLK_LAT_HIST_BUCKETS; bucket++)
+			nr += hist->buckets[op][size][bucket];
+	return nr;
+}
+
+/*
+ * Returns the upper bound, in usecs, of the bucket holding the @permille'th
+ * per mille latency of @op across all request sizes, 0 if there is none.
+ */
+u64 blk_lat_hist_percentile(struct blk_lat_hist *hist, int op,
+			    unsigned int permille)
+{
+	u64 nr, target, seen = 0;
+	int size, bucket;
+
+	nr = blk_lat_hist_samples(hist, op);
+	if (!nr)
+		return 0;
+
+	target = div_u64(nr * permille + 999, 1000);
+	for (bucket = 0; bucket < BLK_LAT_HIST_BUCKETS; bucket++) {
+		for (size = 0; size < BLK_LAT_HIST_SIZES; size++)
+			seen += hist->buckets[op][size][bucket];
+		if (seen >= target)
+			break;
+	}
+
+	return 2ULL << min(bucket, BLK_LAT_HIST_BUCKETS - 1);
+}
+
+/**
+ * blk_queue_lat_hist_enable - turn latency histograms on or off
+ * @q: the request queue
+ * @enable: whether completions are to be accounted
+ *
+ * Histograms are allocated when first enabled and only freed along with
+ * their hardware queue or blkcg_gq, so that they can still be read once
+ * accounting is turned off again.
+ */
+int blk_queue_lat_hist_enable(struct request_queue *q, bool enable)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i, ret = 0;
+
+	if (!q->mq_ops)
+		return -EINVAL;
+
+	blk_mq_freeze_queue(q);
+
+	if (enable) {
+		queue_for_each_hw_ctx(q, hctx, i) {
+			if (hctx->lat_hist)
+				continue;
+			hctx->lat_hist = blk_lat_hist_alloc(GFP_KERNEL);
+			if (!hctx->lat_hist) {
+				ret = -ENOMEM;
+				goto out;
+			}
+		}
+	}
+
+	/* set first, so that blkgs created from now on get a histogram */
+	WRITE_ONCE(q->lat_hist, enable);
+	if (enable) {
+		blkcg_lat_hist_enable(q);
+		blk_stat_enable_accounting(q);
+	}
+out:
+	blk_mq_unfreeze_queue(q);
+	return ret;
+}
+
 static void blk_stat_timer_fn(struct timer_list *t)
 {
 	struct blk_stat_callback *cb = from_timer(cb, t, timer);
@@ -190,6 +359,7 @@ void blk_stat_enable_accounting(struct request_queue *q)
 	blk_queue_flag_set(QUEUE_FLAG_STATS, q);
 	spin_unlock(&q->stats->lock);
 }
+EXPORT_SYMBOL_GPL(blk_stat_enable_accounting);
 
 struct blk_queue_stats *blk_alloc_queue_stats(void)
 {
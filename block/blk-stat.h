@@ -5,6 +5,7 @@
 #include <linux/kernel.h>
 #include <linux/blkdev.h>
 #include <linux/ktime.h>
+#include <linux/percpu.h>
 #include <linux/rcupdate.h>
 #include <linux/timer.h>
 
@@ -168,4 +169,55 @@ void blk_rq_stat_add(struct blk_rq_stat *, u64);
 void blk_rq_stat_sum(struct blk_rq_stat *, struct blk_rq_stat *);
 void blk_rq_stat_init(struct blk_rq_stat *);
 
+/*
+ * Completion latency histograms, kept per hardware queue and per blkcg_gq
+ * once enabled through the queue's lat_hist attribute. Latencies are
+ * measured from issue to completion, and sorted by operation and request
+ * size class into log2 buckets of microseconds.
+ */
+enum {
+	BLK_LAT_HIST_READ,
+	BLK_LAT_HIST_WRITE,
+	BLK_LAT_HIST_DISCARD,
+	BLK_LAT_HIST_OPS,
+};
+
+/* request size classes: <= 4k, <= 16k, <= 64k and larger */
+#define BLK_LAT_HIST_SIZES	4
+
+/*
+ * Bucket 0 counts latencies below 2us, bucket i > 0 those in
+ * [2^i, 2^(i+1)) us. The last bucket also counts everything above.
+ */
+#define BLK_LAT_HIST_BUCKETS	24
+
+struct blk_lat_hist {
+	u64 buckets[BLK_LAT_HIST_OPS][BLK_LAT_HIST_SIZES][BLK_LAT_HIST_BUCKETS];
+};
+
+static inline struct blk_lat_hist __percpu *blk_lat_hist_alloc(gfp_t gfp)
+{
+	return alloc_percpu_gfp(struct blk_lat_hist, gfp);
+}
+
+static inline void blk_lat_hist_free(struct blk_lat_hist __percpu *hist)
+{
+	free_percpu(hist);
+}
+
+void blk_lat_hist_sum(struct blk_lat_hist *dst,
+		      struct blk_lat_hist __percpu *hist);
+void blk_lat_hist_reset(struct blk_lat_hist __percpu *hist);
+u64 blk_lat_hist_samples(struct blk_lat_hist *hist, int op);
+u64 blk_lat_hist_percentile(struct blk_lat_hist *hist, int op,
+			    unsigned int permille);
+void blk_stat_add_lat_hist(struct request *rq);
+int blk_queue_lat_hist_enable(struct request_queue *q, bool enable);
+
+#ifdef CONFIG_BLK_CGROUP
+void blkcg_lat_hist_enable(struct request_queue *q);
+#else
+static inline void blkcg_lat_hist_enable(struct request_queue *q) { }
+#endif
+
 #endif
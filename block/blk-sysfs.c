@@ -421,6 +421,32 @@ static ssize_t queue_poll_store(struct request_queue *q, const char *page,
 	return ret;
 }
 
+static ssize_t queue_lat_hist_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(READ_ONCE(q->lat_hist), page);
+}
+
+static ssize_t queue_lat_hist_store(struct request_queue *q, const char *page,
+				    size_t count)
+{
+	unsigned long enable;
+	ssize_t ret;
+	int err;
+
+	if (!q->mq_ops)
+		return -EINVAL;
+
+	ret = queue_var_store(&enable, page, count);
+	if (ret < 0)
+		return ret;
+
+	err = blk_queue_lat_hist_enable(q, enable);
+	if (err)
+		return err;
+
+	return ret;
+}
+
 static ssize_t queue_wb_lat_show(struct request_queue *q, char *page)
 {
 	if (!wbt_rq_qos(q))
@@ -690,6 +716,12 @@ static struct queue_sysfs_entry queue_dax_entry = {
 	.show = queue_dax_show,
 };
 
+static struct queue_sysfs_entry queue_lat_hist_entry = {
+	.attr = {.name = "lat_hist", .mode = 0644 },
+	.show = queue_lat_hist_show,
+	.store = queue_lat_hist_store,
+};
+
 static struct queue_sysfs_entry queue_wb_lat_entry = {
 	.attr = {.name = "wbt_lat_usec", .mode = 0644 },
 	.show = queue_wb_lat_show,
@@ -775,6 +807,7 @@ static struct attribute *default_attrs[] = {
 	&queue_fua_entry.attr,
 	&queue_dax_entry.attr,
 	&queue_wb_lat_entry.attr,
+	&queue_lat_hist_entry.attr,
 	&queue_poll_delay_entry.attr,
 #ifdef CONFIG_BLK_BIO_DISPATCH_ASYNC
 	&queue_dispatch_async_cpus_entry.attr,
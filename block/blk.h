@@ -471,6 +471,12 @@ extern int blk_iolatency_init(struct request_queue *q);
 static inline int blk_iolatency_init(struct request_queue *q) { return 0; }
 #endif
 
+#ifdef CONFIG_BLK_CGROUP_IOCOST
+extern int blk_iocost_init(struct request_queue *q);
+#else
+static inline int blk_iocost_init(struct request_queue *q) { return 0; }
+#endif
+
 #ifdef CONFIG_BLK_BIO_DISPATCH_ASYNC
 extern void blk_free_queue_dispatch_async(struct request_queue *q);
 #else
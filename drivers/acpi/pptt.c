@@ -852,6 +852,64 @@ int find_acpi_cpu_cache_topology(unsigned int cpu, int level)
 }
 
 
+/**
+ * find_acpi_cpu_topology_cluster() - Determine a unique cpu cluster value
+ * @cpu: Kernel logical cpu number
+ *
+ * Determine a topology unique cluster ID for the given cpu, the cluster
+ * being the parent node of the core (of the thread's core for threaded
+ * cpus) in the processor hierarchy.  Peers in the same cluster have
+ * matching ids.
+ *
+ * Return: -ENOENT if the PPTT doesn't exist, the cpu cannot be found or
+ * has no cluster level, otherwise a value which represents its cluster.
+ */
+int find_acpi_cpu_topology_cluster(unsigned int cpu)
+{
+	struct acpi_table_header *table;
+	struct acpi_pptt_processor *cpu_node, *cluster_node;
+	acpi_status status;
+	u32 acpi_cpu_id;
+	int retval;
+
+	status = acpi_get_table(ACPI_SIG_PPTT, 0, &table);
+	if (ACPI_FAILURE(status)) {
+		pr_warn_once("No PPTT table found, cpu topology may be inaccurate\n");
+		return -ENOENT;
+	}
+
+	acpi_cpu_id = get_acpi_id_for_cpu(cpu);
+	cpu_node = acpi_find_processor_node(table, acpi_cpu_id);
+	if (!cpu_node || !cpu_node->parent) {
+		retval = -ENOENT;
+		goto put_table;
+	}
+
+	cluster_node = fetch_pptt_node(table, cpu_node->parent);
+	if (cluster_node &&
+	    (cpu_node->flags & ACPI_PPTT_ACPI_PROCESSOR_IS_THREAD)) {
+		cluster_node = cluster_node->parent ?
+			fetch_pptt_node(table, cluster_node->parent) : NULL;
+	}
+
+	/* the package is not a cluster */
+	if (!cluster_node || !cluster_node->parent ||
+	    (cluster_node->flags & ACPI_PPTT_PHYSICAL_PACKAGE)) {
+		retval = -ENOENT;
+		goto put_table;
+	}
+
+	if (cluster_node->flags & ACPI_PPTT_ACPI_PROCESSOR_ID_VALID)
+		retval = cluster_node->acpi_processor_id;
+	else
+		retval = ACPI_PTR_DIFF(cluster_node, table);
+
+put_table:
+	acpi_put_table(table);
+
+	return retval;
+}
+
 /**
  * find_acpi_cpu_topology_package() - Determine a unique cpu package value
  * @cpu: Kernel logical cpu number
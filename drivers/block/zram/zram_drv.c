@@ -52,6 +52,10 @@ static unsigned int num_devices = 1;
 static size_t huge_class_size;
 
 static void zram_free_page(struct zram *zram, size_t index);
+static int __zram_bvec_read(struct zram *zram, struct page *page, u32 index,
+				struct bio *bio, bool partial_io);
+static int zram_read_from_zspool(struct zram *zram, struct page *page,
+				u32 index);
 
 static int zram_slot_trylock(struct zram *zram, u32 index)
 {
@@ -281,7 +285,37 @@ static ssize_t mem_used_max_store(struct device *dev,
 	return len;
 }
 
+#if defined(CONFIG_ZRAM_WRITEBACK) || defined(CONFIG_ZRAM_MULTI_COMP)
+#define ZRAM_SCAN_IDLE	BIT(0)
+#define ZRAM_SCAN_HUGE	BIT(1)
+
+/* "idle", "huge" or "huge_idle" select the slots writeback/recompress scan */
+static int zram_scan_mode(const char *buf)
+{
+	if (sysfs_streq(buf, "idle"))
+		return ZRAM_SCAN_IDLE;
+	if (sysfs_streq(buf, "huge"))
+		return ZRAM_SCAN_HUGE;
+	if (sysfs_streq(buf, "huge_idle"))
+		return ZRAM_SCAN_IDLE | ZRAM_SCAN_HUGE;
+	return -EINVAL;
+}
+
+/* caller should hold this table index entry's bit_spinlock */
+static bool zram_scan_match(struct zram *zram, u32 index, int mode)
+{
+	if ((mode & ZRAM_SCAN_IDLE) && !zram_test_flag(zram, index, ZRAM_IDLE))
+		return false;
+	if ((mode & ZRAM_SCAN_HUGE) && !zram_test_flag(zram, index, ZRAM_HUGE))
+		return false;
+	return true;
+}
+#endif
+
 #ifdef CONFIG_ZRAM_WRITEBACK
+/* Number of pages writeback_store() sends to the backing device per bio */
+#define ZRAM_WB_BATCH	32
+
 static bool zram_wb_enabled(struct zram *zram)
 {
 	return zram->backing_dev;
@@ -471,6 +505,44 @@ static void put_entry_bdev(struct zram *zram, unsigned long entry)
 	WARN_ON_ONCE(!was_set);
 }
 
+/*
+ * Reserve up to @nr contiguous blocks so that a writeback batch can go
+ * out as a single bio. Returns the number of blocks reserved, starting
+ * at *pentry, or 0 if the backing device is full.
+ */
+static unsigned int get_entries_bdev(struct zram *zram, unsigned int nr,
+				unsigned long *pentry)
+{
+	unsigned long blk_idx;
+	unsigned int i;
+
+	while (nr > 1) {
+		/* skip 0 bit to confuse zram.handle = 0 */
+		blk_idx = bitmap_find_next_zero_area(zram->bitmap,
+					zram->nr_pages, 1, nr, 0);
+		if (blk_idx + nr > zram->nr_pages) {
+			nr /= 2;
+			continue;
+		}
+
+		for (i = 0; i < nr; i++) {
+			if (test_and_set_bit(blk_idx + i, zram->bitmap))
+				break;
+		}
+		if (i == nr) {
+			*pentry = blk_idx;
+			return nr;
+		}
+
+		/* raced with write_to_bdev(), try another area */
+		while (i--)
+			clear_bit(blk_idx + i, zram->bitmap);
+	}
+
+	*pentry = get_entry_bdev(zram);
+	return *pentry ? 1 : 0;
+}
+
 static void zram_page_end_io(struct bio *bio)
 {
 	struct page *page = bio_first_page_all(bio);
@@ -606,6 +678,8 @@ static int write_to_bdev(struct zram *zram, struct bio_vec *bvec,
 
 	submit_bio(bio);
 	*pentry = entry;
+	atomic64_inc(&zram->stats.bd_count);
+	atomic64_inc(&zram->stats.bd_writes);
 
 	return 0;
 }
@@ -618,6 +692,156 @@ static void zram_wb_clear(struct zram *zram, u32 index)
 	entry = zram_get_element(zram, index);
 	zram_set_element(zram, index, 0);
 	put_entry_bdev(zram, entry);
+	atomic64_dec(&zram->stats.bd_count);
+}
+
+/*
+ * Write @nr pages to the contiguous blocks starting at @blk_idx with
+ * one bio and wait for it.
+ */
+static int write_to_bdev_batch(struct zram *zram, struct page **pages,
+				unsigned int nr, unsigned long blk_idx)
+{
+	struct bio *bio;
+	unsigned int i;
+	int ret;
+
+	if (!nr)
+		return 0;
+
+	bio = bio_alloc(GFP_KERNEL, nr);
+	bio->bi_iter.bi_sector = blk_idx * (PAGE_SIZE >> 9);
+	bio_set_dev(bio, zram->bdev);
+	bio->bi_opf = REQ_OP_WRITE | REQ_SYNC;
+	for (i = 0; i < nr; i++) {
+		if (!bio_add_page(bio, pages[i], PAGE_SIZE, 0)) {
+			bio_put(bio);
+			return -EIO;
+		}
+	}
+
+	ret = submit_bio_wait(bio);
+	bio_put(bio);
+	if (!ret)
+		atomic64_add(nr, &zram->stats.bd_writes);
+
+	return ret;
+}
+
+/*
+ * Switch the slot over to the block at @blk_idx if it was written out
+ * and the slot was neither rewritten nor freed meanwhile, otherwise
+ * release the block.
+ */
+static void zram_wb_finish(struct zram *zram, u32 index,
+				unsigned long blk_idx, bool written)
+{
+	zram_slot_lock(zram, index);
+	if (written && zram_test_flag(zram, index, ZRAM_IDLE)) {
+		zram_free_page(zram, index);
+		zram_set_flag(zram, index, ZRAM_WB);
+		zram_set_element(zram, index, blk_idx);
+		atomic64_inc(&zram->stats.pages_stored);
+		atomic64_inc(&zram->stats.bd_count);
+		blk_idx = 0;
+	}
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+	zram_slot_unlock(zram, index);
+
+	if (blk_idx)
+		put_entry_bdev(zram, blk_idx);
+}
+
+static ssize_t writeback_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct page *pages[ZRAM_WB_BATCH] = { NULL };
+	u32 slots[ZRAM_WB_BATCH];
+	unsigned long nr_pages, index = 0, blk_idx;
+	unsigned int nr_blks, nr, i;
+	ssize_t ret = len;
+	int mode, err;
+
+	mode = zram_scan_mode(buf);
+	if (mode < 0)
+		return mode;
+
+	for (i = 0; i < ZRAM_WB_BATCH; i++) {
+		pages[i] = alloc_page(GFP_KERNEL);
+		if (!pages[i]) {
+			ret = -ENOMEM;
+			goto free_pages;
+		}
+	}
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram)) {
+		ret = -EINVAL;
+		goto release_init_lock;
+	}
+
+	if (!zram_wb_enabled(zram)) {
+		ret = -ENODEV;
+		goto release_init_lock;
+	}
+
+	nr_pages = zram->disksize >> PAGE_SHIFT;
+	while (index < nr_pages) {
+		nr_blks = get_entries_bdev(zram, ZRAM_WB_BATCH, &blk_idx);
+		if (!nr_blks) {
+			ret = -ENOSPC;
+			break;
+		}
+
+		for (nr = 0; nr < nr_blks && index < nr_pages; index++) {
+			zram_slot_lock(zram, index);
+			if (!zram_allocated(zram, index) ||
+			    zram_test_flag(zram, index, ZRAM_WB) ||
+			    zram_test_flag(zram, index, ZRAM_UNDER_WB) ||
+			    zram_test_flag(zram, index, ZRAM_SAME) ||
+			    !zram_scan_match(zram, index, mode)) {
+				zram_slot_unlock(zram, index);
+				continue;
+			}
+			/*
+			 * A write, free or read of the slot clears ZRAM_IDLE,
+			 * which tells zram_wb_finish() the copy we write out
+			 * is stale.
+			 */
+			zram_set_flag(zram, index, ZRAM_UNDER_WB);
+			zram_set_flag(zram, index, ZRAM_IDLE);
+			zram_slot_unlock(zram, index);
+
+			if (__zram_bvec_read(zram, pages[nr], index,
+						NULL, false)) {
+				zram_wb_finish(zram, index, 0, false);
+				continue;
+			}
+			slots[nr++] = index;
+		}
+
+		err = write_to_bdev_batch(zram, pages, nr, blk_idx);
+		for (i = 0; i < nr; i++)
+			zram_wb_finish(zram, slots[i], blk_idx + i, !err);
+		for (; i < nr_blks; i++)
+			put_entry_bdev(zram, blk_idx + i);
+
+		if (err) {
+			ret = err;
+			break;
+		}
+		cond_resched();
+	}
+
+release_init_lock:
+	up_read(&zram->init_lock);
+free_pages:
+	for (i = 0; i < ZRAM_WB_BATCH && pages[i]; i++)
+		__free_page(pages[i]);
+
+	return ret;
 }
 
 #else
@@ -655,6 +879,7 @@ static void zram_debugfs_destroy(void)
 
 static void zram_accessed(struct zram *zram, u32 index)
 {
+	zram_clear_flag(zram, index, ZRAM_IDLE);
 	zram->table[index].ac_time = ktime_get_boottime();
 }
 
@@ -663,6 +888,11 @@ static void zram_reset_access(struct zram *zram, u32 index)
 	zram->table[index].ac_time = 0;
 }
 
+static bool zram_idle_since(struct zram *zram, u32 index, ktime_t cutoff)
+{
+	return !ktime_after(zram->table[index].ac_time, cutoff);
+}
+
 static ssize_t read_block_state(struct file *file, char __user *buf,
 				size_t count, loff_t *ppos)
 {
@@ -692,12 +922,17 @@ static ssize_t read_block_state(struct file *file, char __user *buf,
 
 		ts = ktime_to_timespec64(zram->table[index].ac_time);
 		copied = snprintf(kbuf + written, count,
-			"%12zd %12lld.%06lu %c%c%c\n",
+			"%12zd %12lld.%06lu %c%c%c%c%c%c\n",
 			index, (s64)ts.tv_sec,
 			ts.tv_nsec / NSEC_PER_USEC,
 			zram_test_flag(zram, index, ZRAM_SAME) ? 's' : '.',
 			zram_test_flag(zram, index, ZRAM_WB) ? 'w' : '.',
-			zram_test_flag(zram, index, ZRAM_HUGE) ? 'h' : '.');
+			zram_test_flag(zram, index, ZRAM_HUGE) ? 'h' : '.',
+			zram_test_flag(zram, index, ZRAM_IDLE) ? 'i' : '.',
+			zram_test_flag(zram, index, ZRAM_RECOMPRESSED) ?
+								'r' : '.',
+			zram_test_flag(zram, index, ZRAM_INCOMPRESSIBLE) ?
+								'n' : '.');
 
 		if (count <= copied) {
 			zram_slot_unlock(zram, index);
@@ -742,8 +977,15 @@ static void zram_debugfs_unregister(struct zram *zram)
 #else
 static void zram_debugfs_create(void) {};
 static void zram_debugfs_destroy(void) {};
-static void zram_accessed(struct zram *zram, u32 index) {};
+static void zram_accessed(struct zram *zram, u32 index)
+{
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+};
 static void zram_reset_access(struct zram *zram, u32 index) {};
+static bool zram_idle_since(struct zram *zram, u32 index, ktime_t cutoff)
+{
+	return true;
+}
 static void zram_debugfs_register(struct zram *zram) {};
 static void zram_debugfs_unregister(struct zram *zram) {};
 #endif
@@ -827,6 +1069,214 @@ static ssize_t compact_store(struct device *dev,
 	return len;
 }
 
+/*
+ * Mark stored pages idle, either "all" of them or, with access time
+ * tracking, those not accessed for the given number of seconds. Any
+ * access to a page clears the mark again.
+ */
+static ssize_t idle_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	ktime_t cutoff = KTIME_MAX;
+	unsigned long nr_pages, index;
+	u64 age_sec;
+
+	if (!sysfs_streq(buf, "all")) {
+		if (!IS_ENABLED(CONFIG_ZRAM_MEMORY_TRACKING) ||
+		    kstrtoull(buf, 10, &age_sec))
+			return -EINVAL;
+		cutoff = ktime_sub(ktime_get_boottime(),
+				   ns_to_ktime(age_sec * NSEC_PER_SEC));
+	}
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram)) {
+		up_read(&zram->init_lock);
+		return -EINVAL;
+	}
+
+	nr_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < nr_pages; index++) {
+		/*
+		 * A slot under writeback uses ZRAM_IDLE to notice it was
+		 * modified meanwhile, so leave it alone.
+		 */
+		zram_slot_lock(zram, index);
+		if (zram_allocated(zram, index) &&
+		    !zram_test_flag(zram, index, ZRAM_UNDER_WB) &&
+		    zram_idle_since(zram, index, cutoff))
+			zram_set_flag(zram, index, ZRAM_IDLE);
+		zram_slot_unlock(zram, index);
+		cond_resched();
+	}
+	up_read(&zram->init_lock);
+
+	return len;
+}
+
+#ifdef CONFIG_ZRAM_MULTI_COMP
+static ssize_t recomp_algorithm_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	size_t sz;
+	struct zram *zram = dev_to_zram(dev);
+
+	down_read(&zram->init_lock);
+	sz = zcomp_available_show(zram->recompressor, buf);
+	up_read(&zram->init_lock);
+
+	return sz;
+}
+
+static ssize_t recomp_algorithm_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	char compressor[ARRAY_SIZE(zram->recompressor)];
+	size_t sz;
+
+	strlcpy(compressor, buf, sizeof(compressor));
+	/* ignore trailing newline */
+	sz = strlen(compressor);
+	if (sz > 0 && compressor[sz - 1] == '\n')
+		compressor[sz - 1] = 0x00;
+
+	if (!zcomp_available_algorithm(compressor))
+		return -EINVAL;
+
+	down_write(&zram->init_lock);
+	if (init_done(zram)) {
+		up_write(&zram->init_lock);
+		pr_info("Can't change algorithm for initialized device\n");
+		return -EBUSY;
+	}
+
+	strcpy(zram->recompressor, compressor);
+	up_write(&zram->init_lock);
+	return len;
+}
+
+/*
+ * Recompress the object at @index with the secondary algorithm and keep
+ * the result only if it is smaller. @page is scratch space for the
+ * decompressed data. Caller should hold the slot lock.
+ */
+static int zram_recompress(struct zram *zram, u32 index, struct page *page)
+{
+	unsigned int comp_len_old = zram_get_obj_size(zram, index);
+	unsigned int comp_len_new;
+	struct zcomp_strm *zstrm;
+	unsigned long handle;
+	void *src, *dst;
+	bool idle;
+	int ret;
+
+	ret = zram_read_from_zspool(zram, page, index);
+	if (ret)
+		return ret;
+
+	zstrm = zcomp_stream_get(zram->recomp);
+	src = kmap_atomic(page);
+	ret = zcomp_compress(zstrm, src, &comp_len_new);
+	kunmap_atomic(src);
+	if (ret) {
+		zcomp_stream_put(zram->recomp);
+		return ret;
+	}
+
+	/* Not worth it, and don't try this slot again */
+	if (comp_len_new >= huge_class_size || comp_len_new >= comp_len_old) {
+		zcomp_stream_put(zram->recomp);
+		zram_set_flag(zram, index, ZRAM_INCOMPRESSIBLE);
+		return 0;
+	}
+
+	/* We hold the slot lock and a per-cpu stream, so we can't sleep */
+	handle = zs_malloc(zram->mem_pool, comp_len_new,
+			__GFP_KSWAPD_RECLAIM |
+			__GFP_NOWARN |
+			__GFP_HIGHMEM |
+			__GFP_MOVABLE);
+	if (!handle) {
+		zcomp_stream_put(zram->recomp);
+		return -ENOMEM;
+	}
+
+	dst = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
+	memcpy(dst, zstrm->buffer, comp_len_new);
+	zcomp_stream_put(zram->recomp);
+	zs_unmap_object(zram->mem_pool, handle);
+
+	/* Keep the idle mark so that a later idle writeback finds it */
+	idle = zram_test_flag(zram, index, ZRAM_IDLE);
+	zram_free_page(zram, index);
+	zram_set_handle(zram, index, handle);
+	zram_set_obj_size(zram, index, comp_len_new);
+	zram_set_flag(zram, index, ZRAM_RECOMPRESSED);
+	if (idle)
+		zram_set_flag(zram, index, ZRAM_IDLE);
+
+	atomic64_add(comp_len_new, &zram->stats.compr_data_size);
+	atomic64_inc(&zram->stats.pages_stored);
+	atomic64_inc(&zram->stats.recomp_pages);
+
+	return 0;
+}
+
+static ssize_t recompress_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	unsigned long nr_pages, index;
+	struct page *page;
+	ssize_t ret = len;
+	int mode, err = 0;
+
+	mode = zram_scan_mode(buf);
+	if (mode < 0)
+		return mode;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram) || !zram->recomp) {
+		ret = -EINVAL;
+		goto release_init_lock;
+	}
+
+	nr_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < nr_pages; index++) {
+		zram_slot_lock(zram, index);
+		if (!zram_get_handle(zram, index) ||
+		    zram_test_flag(zram, index, ZRAM_WB) ||
+		    zram_test_flag(zram, index, ZRAM_UNDER_WB) ||
+		    zram_test_flag(zram, index, ZRAM_SAME) ||
+		    zram_test_flag(zram, index, ZRAM_RECOMPRESSED) ||
+		    zram_test_flag(zram, index, ZRAM_INCOMPRESSIBLE) ||
+		    !zram_scan_match(zram, index, mode))
+			goto next;
+
+		err = zram_recompress(zram, index, page);
+next:
+		zram_slot_unlock(zram, index);
+		if (err) {
+			ret = err;
+			break;
+		}
+		cond_resched();
+	}
+
+release_init_lock:
+	up_read(&zram->init_lock);
+	__free_page(page);
+
+	return ret;
+}
+#endif
+
 static ssize_t io_stat_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
@@ -866,7 +1316,7 @@ static ssize_t mm_stat_show(struct device *dev,
 	max_used = atomic_long_read(&zram->stats.max_used_pages);
 
 	ret = scnprintf(buf, PAGE_SIZE,
-			"%8llu %8llu %8llu %8lu %8ld %8llu %8lu %8llu\n",
+			"%8llu %8llu %8llu %8lu %8ld %8llu %8lu %8llu %8llu\n",
 			orig_size << PAGE_SHIFT,
 			(u64)atomic64_read(&zram->stats.compr_data_size),
 			mem_used << PAGE_SHIFT,
@@ -874,11 +1324,30 @@ static ssize_t mm_stat_show(struct device *dev,
 			max_used << PAGE_SHIFT,
 			(u64)atomic64_read(&zram->stats.same_pages),
 			pool_stats.pages_compacted,
-			(u64)atomic64_read(&zram->stats.huge_pages));
+			(u64)atomic64_read(&zram->stats.huge_pages),
+			(u64)atomic64_read(&zram->stats.recomp_pages));
+	up_read(&zram->init_lock);
+
+	return ret;
+}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+static ssize_t bd_stat_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	ssize_t ret;
+
+	down_read(&zram->init_lock);
+	ret = scnprintf(buf, PAGE_SIZE,
+			"%8llu %8llu\n",
+			(u64)atomic64_read(&zram->stats.bd_count),
+			(u64)atomic64_read(&zram->stats.bd_writes));
 	up_read(&zram->init_lock);
 
 	return ret;
 }
+#endif
 
 static ssize_t debug_stat_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
@@ -901,6 +1370,9 @@ static ssize_t debug_stat_show(struct device *dev,
 static DEVICE_ATTR_RO(io_stat);
 static DEVICE_ATTR_RO(mm_stat);
 static DEVICE_ATTR_RO(debug_stat);
+#ifdef CONFIG_ZRAM_WRITEBACK
+static DEVICE_ATTR_RO(bd_stat);
+#endif
 
 static void zram_meta_free(struct zram *zram, u64 disksize)
 {
@@ -946,6 +1418,13 @@ static void zram_free_page(struct zram *zram, size_t index)
 
 	zram_reset_access(zram, index);
 
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+	zram_clear_flag(zram, index, ZRAM_INCOMPRESSIBLE);
+	if (zram_test_flag(zram, index, ZRAM_RECOMPRESSED)) {
+		zram_clear_flag(zram, index, ZRAM_RECOMPRESSED);
+		atomic64_dec(&zram->stats.recomp_pages);
+	}
+
 	if (zram_test_flag(zram, index, ZRAM_HUGE)) {
 		zram_clear_flag(zram, index, ZRAM_HUGE);
 		atomic64_dec(&zram->stats.huge_pages);
@@ -983,32 +1462,19 @@ static void zram_free_page(struct zram *zram, size_t index)
 	zram_set_obj_size(zram, index, 0);
 }
 
-static int __zram_bvec_read(struct zram *zram, struct page *page, u32 index,
-				struct bio *bio, bool partial_io)
+/*
+ * Decompress the object at @index into @page. Caller should hold the
+ * slot lock.
+ */
+static int zram_read_from_zspool(struct zram *zram, struct page *page,
+				u32 index)
 {
 	int ret;
 	unsigned long handle;
 	unsigned int size;
+	struct zcomp *comp;
 	void *src, *dst;
 
-	if (zram_wb_enabled(zram)) {
-		zram_slot_lock(zram, index);
-		if (zram_test_flag(zram, index, ZRAM_WB)) {
-			struct bio_vec bvec;
-
-			zram_slot_unlock(zram, index);
-
-			bvec.bv_page = page;
-			bvec.bv_len = PAGE_SIZE;
-			bvec.bv_offset = 0;
-			return read_from_bdev(zram, &bvec,
-					zram_get_element(zram, index),
-					bio, partial_io);
-		}
-		zram_slot_unlock(zram, index);
-	}
-
-	zram_slot_lock(zram, index);
 	handle = zram_get_handle(zram, index);
 	if (!handle || zram_test_flag(zram, index, ZRAM_SAME)) {
 		unsigned long value;
@@ -1018,7 +1484,6 @@ static int __zram_bvec_read(struct zram *zram, struct page *page, u32 index,
 		mem = kmap_atomic(page);
 		zram_fill_page(mem, PAGE_SIZE, value);
 		kunmap_atomic(mem);
-		zram_slot_unlock(zram, index);
 		return 0;
 	}
 
@@ -1031,14 +1496,45 @@ static int __zram_bvec_read(struct zram *zram, struct page *page, u32 index,
 		kunmap_atomic(dst);
 		ret = 0;
 	} else {
-		struct zcomp_strm *zstrm = zcomp_stream_get(zram->comp);
+		struct zcomp_strm *zstrm;
 
+		comp = zram_test_flag(zram, index, ZRAM_RECOMPRESSED) ?
+				zram->recomp : zram->comp;
+		zstrm = zcomp_stream_get(comp);
 		dst = kmap_atomic(page);
 		ret = zcomp_decompress(zstrm, src, size, dst);
 		kunmap_atomic(dst);
-		zcomp_stream_put(zram->comp);
+		zcomp_stream_put(comp);
 	}
 	zs_unmap_object(zram->mem_pool, handle);
+
+	return ret;
+}
+
+static int __zram_bvec_read(struct zram *zram, struct page *page, u32 index,
+				struct bio *bio, bool partial_io)
+{
+	int ret;
+
+	if (zram_wb_enabled(zram)) {
+		zram_slot_lock(zram, index);
+		if (zram_test_flag(zram, index, ZRAM_WB)) {
+			struct bio_vec bvec;
+
+			zram_slot_unlock(zram, index);
+
+			bvec.bv_page = page;
+			bvec.bv_len = PAGE_SIZE;
+			bvec.bv_offset = 0;
+			return read_from_bdev(zram, &bvec,
+					zram_get_element(zram, index),
+					bio, partial_io);
+		}
+		zram_slot_unlock(zram, index);
+	}
+
+	zram_slot_lock(zram, index);
+	ret = zram_read_from_zspool(zram, page, index);
 	zram_slot_unlock(zram, index);
 
 	/* Should NEVER happen. Return bio error if it does. */
@@ -1467,7 +1963,7 @@ static int zram_rw_page(struct block_device *bdev, sector_t sector,
 
 static void zram_reset_device(struct zram *zram)
 {
-	struct zcomp *comp;
+	struct zcomp *comp, *recomp;
 	u64 disksize;
 
 	down_write(&zram->init_lock);
@@ -1480,6 +1976,8 @@ static void zram_reset_device(struct zram *zram)
 	}
 
 	comp = zram->comp;
+	recomp = zram->recomp;
+	zram->recomp = NULL;
 	disksize = zram->disksize;
 	zram->disksize = 0;
 
@@ -1491,6 +1989,8 @@ static void zram_reset_device(struct zram *zram)
 	zram_meta_free(zram, disksize);
 	memset(&zram->stats, 0, sizeof(zram->stats));
 	zcomp_destroy(comp);
+	if (recomp)
+		zcomp_destroy(recomp);
 	reset_bdev(zram);
 }
 
@@ -1498,7 +1998,7 @@ static ssize_t disksize_store(struct device *dev,
 		struct device_attribute *attr, const char *buf, size_t len)
 {
 	u64 disksize;
-	struct zcomp *comp;
+	struct zcomp *comp, *recomp = NULL;
 	struct zram *zram = dev_to_zram(dev);
 	int err;
 
@@ -1527,7 +2027,18 @@ static ssize_t disksize_store(struct device *dev,
 		goto out_free_meta;
 	}
 
+	if (zram->recompressor[0]) {
+		recomp = zcomp_create(zram->recompressor);
+		if (IS_ERR(recomp)) {
+			pr_err("Cannot initialise %s recompressing backend\n",
+					zram->recompressor);
+			err = PTR_ERR(recomp);
+			goto out_free_comp;
+		}
+	}
+
 	zram->comp = comp;
+	zram->recomp = recomp;
 	zram->disksize = disksize;
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 
@@ -1536,6 +2047,8 @@ static ssize_t disksize_store(struct device *dev,
 
 	return len;
 
+out_free_comp:
+	zcomp_destroy(comp);
 out_free_meta:
 	zram_meta_free(zram, disksize);
 out_unlock:
@@ -1618,8 +2131,14 @@ static DEVICE_ATTR_WO(mem_limit);
 static DEVICE_ATTR_WO(mem_used_max);
 static DEVICE_ATTR_RW(max_comp_streams);
 static DEVICE_ATTR_RW(comp_algorithm);
+static DEVICE_ATTR_WO(idle);
 #ifdef CONFIG_ZRAM_WRITEBACK
 static DEVICE_ATTR_RW(backing_dev);
+static DEVICE_ATTR_WO(writeback);
+#endif
+#ifdef CONFIG_ZRAM_MULTI_COMP
+static DEVICE_ATTR_RW(recomp_algorithm);
+static DEVICE_ATTR_WO(recompress);
 #endif
 
 static struct attribute *zram_disk_attrs[] = {
@@ -1631,12 +2150,21 @@ static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_mem_used_max.attr,
 	&dev_attr_max_comp_streams.attr,
 	&dev_attr_comp_algorithm.attr,
+	&dev_attr_idle.attr,
 #ifdef CONFIG_ZRAM_WRITEBACK
 	&dev_attr_backing_dev.attr,
+	&dev_attr_writeback.attr,
+#endif
+#ifdef CONFIG_ZRAM_MULTI_COMP
+	&dev_attr_recomp_algorithm.attr,
+	&dev_attr_recompress.attr,
 #endif
 	&dev_attr_io_stat.attr,
 	&dev_attr_mm_stat.attr,
 	&dev_attr_debug_stat.attr,
+#ifdef CONFIG_ZRAM_WRITEBACK
+	&dev_attr_bd_stat.attr,
+#endif
 	NULL,
 };
 
@@ -20,6 +20,7 @@
 #include <uapi/asm/setup.h>
 #include <linux/pin_mem.h>
 #include <linux/sched/mm.h>
+#include <linux/sched/task.h>
 
 #define MAX_PIN_MEM_AREA_NUM  16
 struct _pin_mem_area {
@@ -67,28 +68,32 @@ static int set_pin_mem(struct pin_mem_area_set *pmas)
 		pr_warn("Get pid struct fail:%d.\n", pmas->pid);
 		return -EFAULT;
 	}
-	rcu_read_lock();
-	task = pid_task(pid_s, PIDTYPE_PID);
+	/* pin_mem_area() may sleep, hold a task reference instead of rcu */
+	task = get_pid_task(pid_s, PIDTYPE_PID);
 	if (!task) {
 		pr_warn("Get task struct fail:%d.\n", pmas->pid);
 		goto fail;
 	}
 	mm = get_task_mm(task);
+	if (!mm) {
+		put_task_struct(task);
+		goto fail;
+	}
 	for (i = 0; i < pmas->area_num; i++) {
 		pma = &(pmas->mem_area[i]);
 		ret = pin_mem_area(task, mm, pma->virt_start, pma->virt_end);
 		if (ret) {
 			mmput(mm);
+			put_task_struct(task);
 			goto fail;
 		}
 	}
 	mmput(mm);
-	rcu_read_unlock();
+	put_task_struct(task);
 	put_pid(pid_s);
 	return ret;
 
 fail:
-	rcu_read_unlock();
 	put_pid(pid_s);
 	return -EFAULT;
 }
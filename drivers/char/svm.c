@@ -52,6 +52,8 @@
 
 #define SVM_IOCTL_SP_ALLOC		0xfff2
 #define SVM_IOCTL_SP_FREE		0xfff1
+#define SVM_IOCTL_SP_ALLOC_BATCH	0xfff0
+#define SVM_IOCTL_SP_FREE_BATCH		0xffef
 #define SPG_DEFAULT_ID			0
 #define CORE_SID		0
 static int probe_index;
@@ -127,6 +129,13 @@ struct spalloc {
 	unsigned long flag;
 };
 
+struct spalloc_batch {
+	unsigned long nr;
+	unsigned long flag;
+	unsigned long sizes;	/* user pointer to nr sizes, unused when free */
+	unsigned long addrs;	/* user pointer to nr addrs */
+};
+
 struct addr_trans_args {
 	unsigned long vptr;
 	unsigned long *pptr;
@@ -1669,6 +1678,93 @@ static int svm_sp_free_mem(unsigned long __user *arg)
 	return 0;
 }
 
+static int svm_sp_alloc_mem_batch(unsigned long __user *arg)
+{
+	struct spalloc_batch info;
+	unsigned long *sizes, *addrs;
+	int ret;
+
+	if (copy_from_user(&info, (void __user *)arg, sizeof(info))) {
+		pr_err("failed to copy args from user space.\n");
+		return -EFAULT;
+	}
+
+	if (!info.nr || info.nr > SP_BATCH_MAX)
+		return -EINVAL;
+
+	sizes = kcalloc(info.nr, sizeof(unsigned long), GFP_KERNEL);
+	addrs = kcalloc(info.nr, sizeof(unsigned long), GFP_KERNEL);
+	if (!sizes || !addrs) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (copy_from_user(sizes, (void __user *)info.sizes,
+			   info.nr * sizeof(unsigned long))) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	ret = sp_alloc_batch(sizes, addrs, info.nr, info.flag, SPG_DEFAULT_ID);
+	if (ret) {
+		pr_err("svm: sp alloc batch failed with %d\n", ret);
+		goto out;
+	}
+
+	if (copy_to_user((void __user *)info.addrs, addrs,
+			 info.nr * sizeof(unsigned long))) {
+		sp_free_batch(addrs, info.nr, SPG_DEFAULT_ID);
+		ret = -EFAULT;
+	}
+
+out:
+	kfree(addrs);
+	kfree(sizes);
+	return ret;
+}
+
+static int svm_sp_free_mem_batch(unsigned long __user *arg)
+{
+	struct spalloc_batch info;
+	unsigned long *addrs;
+	unsigned long i;
+	int ret;
+
+	if (copy_from_user(&info, (void __user *)arg, sizeof(info))) {
+		pr_err("failed to copy args from user space.\n");
+		return -EFAULT;
+	}
+
+	if (!info.nr || info.nr > SP_BATCH_MAX)
+		return -EINVAL;
+
+	addrs = kcalloc(info.nr, sizeof(unsigned long), GFP_KERNEL);
+	if (!addrs)
+		return -ENOMEM;
+
+	if (copy_from_user(addrs, (void __user *)info.addrs,
+			   info.nr * sizeof(unsigned long))) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	for (i = 0; i < info.nr; i++) {
+		if (!is_sharepool_addr(addrs[i])) {
+			pr_err("svm: sp free batch failed because the addr is not from sp.\n");
+			ret = -EINVAL;
+			goto out;
+		}
+	}
+
+	ret = sp_free_batch(addrs, info.nr, SPG_DEFAULT_ID);
+	if (ret)
+		pr_err("svm: sp free batch failed with %d.\n", ret);
+
+out:
+	kfree(addrs);
+	return ret;
+}
+
 /*svm ioctl will include some case for HI1980 and HI1910*/
 static long svm_ioctl(struct file *file, unsigned int cmd,
 			 unsigned long arg)
@@ -1735,6 +1831,12 @@ static long svm_ioctl(struct file *file, unsigned int cmd,
 	case SVM_IOCTL_SP_FREE:
 		err = svm_sp_free_mem((unsigned long __user *)arg);
 		break;
+	case SVM_IOCTL_SP_ALLOC_BATCH:
+		err = svm_sp_alloc_mem_batch((unsigned long __user *)arg);
+		break;
+	case SVM_IOCTL_SP_FREE_BATCH:
+		err = svm_sp_free_mem_batch((unsigned long __user *)arg);
+		break;
 	default:
 		err = -EINVAL;
 	}
@@ -29,6 +29,7 @@ struct sec_cipher_req {
 	dma_addr_t c_ivin_dma;
 	struct skcipher_request *sk_req;
 	u32 c_len;
+	u32 gran_size;
 	bool encrypt;
 };
 
@@ -9,6 +9,8 @@
 #include <linux/crypto.h>
 #include <linux/dma-mapping.h>
 #include <linux/idr.h>
+#include <linux/log2.h>
+#include <asm/unaligned.h>
 
 #include "sec.h"
 #include "sec_crypto.h"
@@ -24,6 +26,7 @@
 #define SEC_CI_GEN_OFFSET	6
 #define SEC_CIPHER_OFFSET	4
 #define SEC_SCENE_OFFSET	3
+#define SEC_SCENE_MASK		0xF
 #define SEC_DST_SGL_OFFSET	2
 #define SEC_SRC_SGL_OFFSET	7
 #define SEC_CKEY_OFFSET		9
@@ -58,6 +61,11 @@
 #define SEC_TOTAL_PBUF_SZ	(PAGE_SIZE * SEC_PBUF_PAGE_NUM + \
 				SEC_PBUF_LEFT_SZ)
 
+#define SEC_LBA_SIZE		sizeof(u64)
+#define SEC_GRAN_MIN_SIZE	512
+#define SEC_GRAN_MAX_SIZE	4096
+#define SEC_GRAN_MAX_NUM	U16_MAX
+
 #define SEC_SQE_LEN_RATE	4
 #define SEC_SQE_CFLAG		2
 #define SEC_SQE_AEAD_FLAG	3
@@ -808,6 +816,41 @@ static int sec_skcipher_bd_fill(struct sec_ctx *ctx, struct sec_req *req)
 	return 0;
 }
 
+/*
+ * The IV of a multi-IV request is the 64-bit LBA of the first granule
+ * followed by the 32-bit granule size; the engine derives the IV of every
+ * granule from the LBA, so only the LBA is handed to the hardware.
+ */
+static void sec_skcipher_copy_lba(struct sec_ctx *ctx, struct sec_req *req)
+{
+	struct skcipher_request *sk_req = req->c_req.sk_req;
+	struct sec_cipher_req *c_req = &req->c_req;
+
+	memset(c_req->c_ivin, 0, ctx->c_ctx.ivsize);
+	memcpy(c_req->c_ivin, sk_req->iv, SEC_LBA_SIZE);
+}
+
+static int sec_skcipher_bd_fill_multi_iv(struct sec_ctx *ctx,
+					 struct sec_req *req)
+{
+	struct sec_cipher_req *c_req = &req->c_req;
+	struct sec_sqe *sec_sqe = &req->sec_sqe;
+	int ret;
+
+	ret = sec_skcipher_bd_fill(ctx, req);
+	if (unlikely(ret))
+		return ret;
+
+	sec_sqe->sds_sa_type &= ~(SEC_SCENE_MASK << SEC_SCENE_OFFSET);
+	sec_sqe->sds_sa_type |= SEC_SCENE_STORAGE << SEC_SCENE_OFFSET;
+	sec_sqe->huk_key_ci |= SEC_CI_GEN_BY_LBA << SEC_CI_GEN_OFFSET;
+
+	sec_sqe->type2.c_gran_size = cpu_to_le32(c_req->gran_size);
+	sec_sqe->type2.gran_num = cpu_to_le16(c_req->c_len / c_req->gran_size);
+
+	return 0;
+}
+
 static void sec_update_iv(struct sec_req *req, enum sec_alg_type alg_type)
 {
 	struct skcipher_request *sk_req = req->c_req.sk_req;
@@ -926,6 +969,16 @@ static const struct sec_req_op sec_skcipher_req_ops = {
 	.process	= sec_process,
 };
 
+static const struct sec_req_op sec_skcipher_multi_iv_req_ops = {
+	.buf_map	= sec_skcipher_sgl_map,
+	.buf_unmap	= sec_skcipher_sgl_unmap,
+	.do_transfer	= sec_skcipher_copy_lba,
+	.bd_fill	= sec_skcipher_bd_fill_multi_iv,
+	.bd_send	= sec_bd_send,
+	.callback	= sec_skcipher_callback,
+	.process	= sec_process,
+};
+
 static int sec_skcipher_ctx_init(struct crypto_skcipher *tfm)
 {
 	struct sec_ctx *ctx = crypto_skcipher_ctx(tfm);
@@ -935,6 +988,15 @@ static int sec_skcipher_ctx_init(struct crypto_skcipher *tfm)
 	return sec_skcipher_init(tfm);
 }
 
+static int sec_skcipher_multi_iv_ctx_init(struct crypto_skcipher *tfm)
+{
+	struct sec_ctx *ctx = crypto_skcipher_ctx(tfm);
+
+	ctx->req_op = &sec_skcipher_multi_iv_req_ops;
+
+	return sec_skcipher_init(tfm);
+}
+
 static void sec_skcipher_ctx_exit(struct crypto_skcipher *tfm)
 {
 	sec_skcipher_uninit(tfm);
@@ -952,6 +1014,20 @@ static int sec_skcipher_param_check(struct sec_ctx *ctx, struct sec_req *sreq)
 	}
 	sreq->c_req.c_len = sk_req->cryptlen;
 
+	if (ctx->req_op == &sec_skcipher_multi_iv_req_ops) {
+		u32 gran_size = get_unaligned_le32(sk_req->iv + SEC_LBA_SIZE);
+
+		if (unlikely(!is_power_of_2(gran_size) ||
+			     gran_size < SEC_GRAN_MIN_SIZE ||
+			     gran_size > SEC_GRAN_MAX_SIZE ||
+			     sk_req->cryptlen & (gran_size - 1) ||
+			     sk_req->cryptlen / gran_size > SEC_GRAN_MAX_NUM)) {
+			dev_err(dev, "skcipher multi iv granule error!\n");
+			return -EINVAL;
+		}
+		sreq->c_req.gran_size = gran_size;
+	}
+
 	if (ctx->pbuf_supported && sk_req->cryptlen <= SEC_PBUF_SZ)
 		sreq->use_pbuf = true;
 	else
@@ -1035,6 +1111,12 @@ static int sec_skcipher_decrypt(struct skcipher_request *sk_req)
 	SEC_SKCIPHER_GEN_ALG(name, key_func, min_key_size, max_key_size, \
 	sec_skcipher_ctx_init, sec_skcipher_ctx_exit, blk_size, iv_size)
 
+#define SEC_SKCIPHER_MULTI_IV_ALG(name, key_func, min_key_size, \
+	max_key_size, blk_size, iv_size) \
+	SEC_SKCIPHER_GEN_ALG(name, key_func, min_key_size, max_key_size, \
+	sec_skcipher_multi_iv_ctx_init, sec_skcipher_ctx_exit, blk_size, \
+	iv_size)
+
 static struct skcipher_alg sec_skciphers[] = {
 	SEC_SKCIPHER_ALG("ecb(aes)", sec_setkey_aes_ecb,
 			 AES_MIN_KEY_SIZE, AES_MAX_KEY_SIZE,
@@ -1064,6 +1146,15 @@ static struct skcipher_alg sec_skciphers[] = {
 			 AES_MIN_KEY_SIZE, AES_MIN_KEY_SIZE,
 			 AES_BLOCK_SIZE, AES_BLOCK_SIZE)
 
+	/* Multi-sector requests from dm-crypt, IVs generated from the LBA */
+	SEC_SKCIPHER_MULTI_IV_ALG("plain64(xts(aes))", sec_setkey_aes_xts,
+				  SEC_XTS_MIN_KEY_SIZE, SEC_XTS_MAX_KEY_SIZE,
+				  AES_BLOCK_SIZE, AES_BLOCK_SIZE)
+
+	SEC_SKCIPHER_MULTI_IV_ALG("plain64(xts(sm4))", sec_setkey_sm4_xts,
+				  SEC_XTS_MIN_KEY_SIZE, SEC_XTS_MIN_KEY_SIZE,
+				  AES_BLOCK_SIZE, AES_BLOCK_SIZE)
+
 };
 
 int sec_register_to_crypto(void)
@@ -124,12 +124,23 @@ struct sec_sqe_type2 {
 	__le16 cipher_src_offset;
 	__le16 cs_ip_header_offset;
 	__le16 cs_udp_header_offset;
-	__le16 pass_word_len;
-	__le16 dk_len;
-	__u8 salt3;
-	__u8 salt2;
-	__u8 salt1;
-	__u8 salt0;
+	union {
+		struct {
+			__le16 pass_word_len;
+			__le16 dk_len;
+			__u8 salt3;
+			__u8 salt2;
+			__u8 salt1;
+			__u8 salt0;
+		};
+
+		/* Storage scene: size and count of the cipher granules */
+		struct {
+			__le32 c_gran_size;
+			__le16 gran_num;
+			__le16 rsvd6;
+		};
+	};
 
 	__le16 tag;
 	__le16 rsvd5;
@@ -0,0 +1,657 @@
+// SPDX-License-Identifier: (GPL-2.0 OR BSD-2-Clause)
+/*
+ * Copyright (c) 2020 Hisilicon Limited.
+ *
+ * Dynamic context attachment (DCA): instead of pinning a private WQE buffer
+ * for every QP, userspace registers memory into a pool owned by its ucontext
+ * and a DCA QP borrows pages from that pool only while it has outstanding
+ * work. Idle QPs hold no buffer at all, which keeps the pinned footprint of
+ * applications with many mostly idle QPs proportional to their active ones.
+ */
+
+#include <linux/sched.h>
+#include <rdma/ib_umem.h>
+#include <rdma/uverbs_types.h>
+#include <rdma/hns-abi.h>
+#include "roce_k_compat.h"
+#include "hns_roce_device.h"
+#include "hns_roce_dca.h"
+
+#define UVERBS_MODULE_NAME hns_ib
+#include <rdma/uverbs_named_ioctl.h>
+
+/* The uobject was destroyed while pages were attached, free with ucontext */
+#define DCA_MEM_FLAGS_DEREGED		BIT(0)
+/* Handed back to userspace by SHRINK and waiting to be deregistered */
+#define DCA_MEM_FLAGS_SHRINKING		BIT(1)
+
+struct dca_mem {
+	struct list_head list; /* entry in hns_roce_dca_ctx->pool */
+	struct ib_umem *umem;
+	dma_addr_t *pages; /* DMA address of each HW page */
+	unsigned long *used; /* bitmap of pages attached to a QP */
+	u64 key; /* userspace cookie, reported back by SHRINK and QUERY */
+	u32 npages;
+	u32 free_pages;
+	u32 flags;
+};
+
+static inline u64 dca_pages_to_size(u32 npages)
+{
+	return (u64)npages << HNS_HW_PAGE_SHIFT;
+}
+
+bool hns_roce_dca_supported(struct hns_roce_dev *hr_dev)
+{
+	return (hr_dev->caps.flags & HNS_ROCE_CAP_FLAG_DCA_MODE) &&
+	       hr_dev->hw->set_dca_buf;
+}
+
+static struct dca_mem *alloc_dca_mem(struct hns_roce_dev *hr_dev,
+				     struct ib_ucontext *ibcontext,
+				     u64 addr, u32 size, u64 key)
+{
+	struct dca_mem *mem;
+	int npages;
+	int ret;
+
+	mem = kzalloc(sizeof(*mem), GFP_KERNEL);
+	if (!mem)
+		return ERR_PTR(-ENOMEM);
+
+	mem->umem = ib_umem_get(ibcontext, addr, size, IB_ACCESS_LOCAL_WRITE,
+				0);
+	if (IS_ERR_OR_NULL(mem->umem)) {
+		ret = mem->umem ? PTR_ERR(mem->umem) : -EINVAL;
+		goto err_mem;
+	}
+
+	mem->npages = size >> HNS_HW_PAGE_SHIFT;
+	mem->pages = kvcalloc(mem->npages, sizeof(dma_addr_t), GFP_KERNEL);
+	mem->used = kvcalloc(BITS_TO_LONGS(mem->npages), sizeof(unsigned long),
+			     GFP_KERNEL);
+	if (!mem->pages || !mem->used) {
+		ret = -ENOMEM;
+		goto err_umem;
+	}
+
+	npages = hns_roce_get_umem_bufs(hr_dev, mem->pages, mem->npages,
+					mem->umem, HNS_HW_PAGE_SHIFT);
+	if (npages != mem->npages) {
+		dev_err(hr_dev->dev, "failed to get DCA pages %d != %u.\n",
+			npages, mem->npages);
+		ret = -ENOBUFS;
+		goto err_umem;
+	}
+
+	mem->key = key;
+	mem->free_pages = mem->npages;
+	INIT_LIST_HEAD(&mem->list);
+
+	return mem;
+
+err_umem:
+	kvfree(mem->used);
+	kvfree(mem->pages);
+	ib_umem_release(mem->umem);
+err_mem:
+	kfree(mem);
+
+	return ERR_PTR(ret);
+}
+
+static void free_dca_mem(struct dca_mem *mem)
+{
+	kvfree(mem->used);
+	kvfree(mem->pages);
+	ib_umem_release(mem->umem);
+	kfree(mem);
+}
+
+void hns_roce_register_udca(struct hns_roce_dev *hr_dev,
+			    struct hns_roce_ucontext *uctx)
+{
+	struct hns_roce_dca_ctx *ctx = &uctx->dca_ctx;
+
+	INIT_LIST_HEAD(&ctx->pool);
+	spin_lock_init(&ctx->pool_lock);
+	ctx->pid = task_tgid_nr(current);
+
+	spin_lock(&hr_dev->dca_ctx_lock);
+	list_add_tail(&ctx->node, &hr_dev->dca_ctx_list);
+	spin_unlock(&hr_dev->dca_ctx_lock);
+}
+
+void hns_roce_unregister_udca(struct hns_roce_dev *hr_dev,
+			      struct hns_roce_ucontext *uctx)
+{
+	struct hns_roce_dca_ctx *ctx = &uctx->dca_ctx;
+	struct dca_mem *mem, *tmp;
+
+	spin_lock(&hr_dev->dca_ctx_lock);
+	list_del(&ctx->node);
+	spin_unlock(&hr_dev->dca_ctx_lock);
+
+	/* All QPs and DCA uobjects are gone, only dereged memory is left */
+	list_for_each_entry_safe(mem, tmp, &ctx->pool, list) {
+		list_del(&mem->list);
+		free_dca_mem(mem);
+	}
+}
+
+/* Must be called with pool_lock held */
+static void release_dca_pages(struct hns_roce_dca_ctx *ctx,
+			      struct hns_roce_dca_cfg *cfg, u32 count)
+{
+	struct dca_mem *mem;
+	u32 i;
+
+	for (i = 0; i < count; i++) {
+		mem = cfg->refs[i].mem;
+		__clear_bit(cfg->refs[i].index, mem->used);
+		mem->free_pages++;
+		if (!mem->flags)
+			ctx->free_size += HNS_HW_PAGE_SIZE;
+
+		cfg->refs[i].mem = NULL;
+	}
+}
+
+/* Must be called with pool_lock held */
+static int take_dca_pages(struct hns_roce_dca_ctx *ctx,
+			  struct hns_roce_dca_cfg *cfg, dma_addr_t *pages)
+{
+	struct dca_mem *mem;
+	u32 taken = 0;
+	u32 idx;
+
+	if (ctx->free_size < dca_pages_to_size(cfg->npages))
+		goto err_nomem;
+
+	list_for_each_entry(mem, &ctx->pool, list) {
+		if (mem->flags || !mem->free_pages)
+			continue;
+
+		for (idx = find_first_zero_bit(mem->used, mem->npages);
+		     idx < mem->npages && taken < cfg->npages;
+		     idx = find_next_zero_bit(mem->used, mem->npages, idx + 1)) {
+			__set_bit(idx, mem->used);
+			mem->free_pages--;
+			ctx->free_size -= HNS_HW_PAGE_SIZE;
+			cfg->refs[taken].mem = mem;
+			cfg->refs[taken].index = idx;
+			pages[taken++] = mem->pages[idx];
+		}
+
+		if (taken == cfg->npages)
+			return 0;
+	}
+
+	release_dca_pages(ctx, cfg, taken);
+
+err_nomem:
+	ctx->nomem_cnt++;
+
+	return -ENOMEM;
+}
+
+static int attach_dca_mem(struct hns_roce_dev *hr_dev,
+			  struct hns_roce_qp *hr_qp, u32 *alloc_flags)
+{
+	struct hns_roce_dca_cfg *cfg = &hr_qp->dca_cfg;
+	struct hns_roce_dca_ctx *ctx = cfg->ctx;
+	dma_addr_t *pages;
+	int ret;
+
+	*alloc_flags = 0;
+	if (cfg->attached)
+		return 0;
+
+	pages = kvcalloc(cfg->npages, sizeof(dma_addr_t), GFP_KERNEL);
+	if (!pages)
+		return -ENOMEM;
+
+	spin_lock(&ctx->pool_lock);
+	ret = take_dca_pages(ctx, cfg, pages);
+	spin_unlock(&ctx->pool_lock);
+	if (ret)
+		goto out;
+
+	ret = hns_roce_mtr_map(hr_dev, &hr_qp->mtr, pages, cfg->npages);
+	if (!ret)
+		ret = hr_dev->hw->set_dca_buf(hr_dev, hr_qp);
+
+	spin_lock(&ctx->pool_lock);
+	if (ret) {
+		release_dca_pages(ctx, cfg, cfg->npages);
+	} else {
+		ctx->attached_qps++;
+		ctx->attach_cnt++;
+	}
+	spin_unlock(&ctx->pool_lock);
+
+	if (!ret) {
+		cfg->attached = true;
+		*alloc_flags |= HNS_IB_ATTACH_FLAGS_NEW_BUFFER;
+	}
+
+out:
+	kvfree(pages);
+
+	return ret;
+}
+
+/*
+ * Userspace detaches a QP once it has seen the completion of every posted
+ * WQE, so the hardware no longer touches the buffer. The pages only ever
+ * move between QPs of the same ucontext, a lying process can only corrupt
+ * its own WQEs.
+ */
+static void detach_dca_mem(struct hns_roce_qp *hr_qp)
+{
+	struct hns_roce_dca_cfg *cfg = &hr_qp->dca_cfg;
+	struct hns_roce_dca_ctx *ctx = cfg->ctx;
+
+	if (!cfg->attached)
+		return;
+
+	spin_lock(&ctx->pool_lock);
+	release_dca_pages(ctx, cfg, cfg->npages);
+	ctx->attached_qps--;
+	spin_unlock(&ctx->pool_lock);
+
+	cfg->attached = false;
+}
+
+int hns_roce_enable_dca(struct hns_roce_dev *hr_dev, struct hns_roce_qp *hr_qp)
+{
+	struct hns_roce_dca_cfg *cfg = &hr_qp->dca_cfg;
+
+	cfg->npages = hr_qp->buff_size >> HNS_HW_PAGE_SHIFT;
+	cfg->refs = kvcalloc(cfg->npages, sizeof(*cfg->refs), GFP_KERNEL);
+	if (!cfg->refs)
+		return -ENOMEM;
+
+	cfg->attached = false;
+
+	return 0;
+}
+
+void hns_roce_disable_dca(struct hns_roce_dev *hr_dev,
+			  struct hns_roce_qp *hr_qp)
+{
+	struct hns_roce_dca_cfg *cfg = &hr_qp->dca_cfg;
+
+	if (!cfg->ctx)
+		return;
+
+	if (cfg->refs)
+		detach_dca_mem(hr_qp);
+
+	kvfree(cfg->refs);
+	cfg->refs = NULL;
+	cfg->ctx = NULL;
+}
+
+ssize_t hns_roce_dca_stats_show(struct hns_roce_dev *hr_dev, char *buf)
+{
+	struct hns_roce_dca_ctx *ctx;
+	ssize_t len;
+
+	len = scnprintf(buf, PAGE_SIZE, "%-8s %-12s %-12s %-6s %-6s %-10s %s\n",
+			"PID", "TOTAL", "FREE", "MEMS", "QPS", "ATTACH",
+			"NOMEM");
+
+	spin_lock(&hr_dev->dca_ctx_lock);
+	list_for_each_entry(ctx, &hr_dev->dca_ctx_list, node) {
+		spin_lock(&ctx->pool_lock);
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "%-8d %-12llu %-12llu %-6u %-6u %-10llu %llu\n",
+				 ctx->pid, ctx->total_size, ctx->free_size,
+				 ctx->total_mems, ctx->attached_qps,
+				 ctx->attach_cnt, ctx->nomem_cnt);
+		spin_unlock(&ctx->pool_lock);
+	}
+	spin_unlock(&hr_dev->dca_ctx_lock);
+
+	return len;
+}
+
+static struct hns_roce_qp *uverbs_attr_to_hr_qp(struct uverbs_attr_bundle *attrs,
+						u16 idx)
+{
+	struct ib_qp *ibqp = uverbs_attr_get_obj(attrs, idx);
+
+	if (IS_ERR(ibqp))
+		return ERR_CAST(ibqp);
+
+	if (!to_hr_qp(ibqp)->dca_cfg.ctx)
+		return ERR_PTR(-EINVAL);
+
+	return to_hr_qp(ibqp);
+}
+
+static int UVERBS_HANDLER(HNS_IB_METHOD_DCA_MEM_REG)(
+	struct ib_uverbs_file *file, struct uverbs_attr_bundle *attrs)
+{
+	struct ib_uobject *uobj =
+		uverbs_attr_get_uobject(attrs, HNS_IB_ATTR_DCA_MEM_REG_HANDLE);
+	struct hns_roce_dev *hr_dev = to_hr_dev(uobj->context->device);
+	struct hns_roce_dca_ctx *ctx = &to_hr_ucontext(uobj->context)->dca_ctx;
+	struct dca_mem *mem;
+	u64 max_size;
+	u64 addr;
+	u64 key;
+	u32 size;
+	int ret;
+
+	ret = uverbs_copy_from(&addr, attrs, HNS_IB_ATTR_DCA_MEM_REG_ADDR);
+	if (!ret)
+		ret = uverbs_copy_from(&size, attrs,
+				       HNS_IB_ATTR_DCA_MEM_REG_LEN);
+	if (!ret)
+		ret = uverbs_copy_from(&key, attrs,
+				       HNS_IB_ATTR_DCA_MEM_REG_KEY);
+	if (ret)
+		return ret;
+
+	if (!size || !PAGE_ALIGNED(addr) || !PAGE_ALIGNED(size))
+		return -EINVAL;
+
+	mem = alloc_dca_mem(hr_dev, uobj->context, addr, size, key);
+	if (IS_ERR(mem))
+		return PTR_ERR(mem);
+
+	max_size = READ_ONCE(hr_dev->dca_max_size);
+	spin_lock(&ctx->pool_lock);
+	if (max_size && ctx->total_size + size > max_size) {
+		spin_unlock(&ctx->pool_lock);
+		free_dca_mem(mem);
+		return -ENOSPC;
+	}
+
+	list_add_tail(&mem->list, &ctx->pool);
+	ctx->total_size += size;
+	ctx->free_size += size;
+	ctx->total_mems++;
+	spin_unlock(&ctx->pool_lock);
+
+	uobj->object = mem;
+
+	return 0;
+}
+
+static int dca_cleanup(struct ib_uobject *uobject, enum rdma_remove_reason why)
+{
+	struct hns_roce_dca_ctx *ctx = &to_hr_ucontext(uobject->context)->dca_ctx;
+	struct dca_mem *mem = uobject->object;
+	u64 size = dca_pages_to_size(mem->npages);
+
+	spin_lock(&ctx->pool_lock);
+	if (mem->free_pages != mem->npages) {
+		if (ib_is_destroy_retryable(-EBUSY, why, uobject)) {
+			spin_unlock(&ctx->pool_lock);
+			return -EBUSY;
+		}
+
+		/* Still used by a QP, keep it out of the pool until release */
+		if (!mem->flags)
+			ctx->free_size -= dca_pages_to_size(mem->free_pages);
+		mem->flags |= DCA_MEM_FLAGS_DEREGED;
+		spin_unlock(&ctx->pool_lock);
+		return 0;
+	}
+
+	list_del(&mem->list);
+	if (!mem->flags)
+		ctx->free_size -= size;
+	ctx->total_size -= size;
+	ctx->total_mems--;
+	spin_unlock(&ctx->pool_lock);
+
+	free_dca_mem(mem);
+
+	return 0;
+}
+
+static int UVERBS_HANDLER(HNS_IB_METHOD_DCA_MEM_SHRINK)(
+	struct ib_uverbs_file *file, struct uverbs_attr_bundle *attrs)
+{
+	struct ib_uobject *uobj =
+		uverbs_attr_get_uobject(attrs,
+					HNS_IB_ATTR_DCA_MEM_SHRINK_HANDLE);
+	struct hns_roce_dca_ctx *ctx = &to_hr_ucontext(uobj->context)->dca_ctx;
+	struct dca_mem *mem, *target = NULL;
+	u64 reserved_size;
+	u32 free_mems = 0;
+	u64 key = 0;
+	int ret;
+
+	ret = uverbs_copy_from(&reserved_size, attrs,
+			       HNS_IB_ATTR_DCA_MEM_SHRINK_RESERVED_SIZE);
+	if (ret)
+		return ret;
+
+	/*
+	 * Hand back at most one idle memory per call, keeping at least
+	 * reserved_size bytes free in the pool for the next attach.
+	 */
+	spin_lock(&ctx->pool_lock);
+	list_for_each_entry(mem, &ctx->pool, list) {
+		if (mem->flags || mem->free_pages != mem->npages)
+			continue;
+
+		free_mems++;
+		if (!target && ctx->free_size -
+		    dca_pages_to_size(mem->npages) >= reserved_size)
+			target = mem;
+	}
+
+	if (target) {
+		target->flags |= DCA_MEM_FLAGS_SHRINKING;
+		ctx->free_size -= dca_pages_to_size(target->npages);
+		key = target->key;
+	} else {
+		free_mems = 0;
+	}
+	spin_unlock(&ctx->pool_lock);
+
+	ret = uverbs_copy_to(attrs, HNS_IB_ATTR_DCA_MEM_SHRINK_OUT_FREE_KEY,
+			     &key, sizeof(key));
+	if (!ret)
+		ret = uverbs_copy_to(attrs,
+				     HNS_IB_ATTR_DCA_MEM_SHRINK_OUT_FREE_MEMS,
+				     &free_mems, sizeof(free_mems));
+
+	return ret;
+}
+
+static int UVERBS_HANDLER(HNS_IB_METHOD_DCA_MEM_ATTACH)(
+	struct ib_uverbs_file *file, struct uverbs_attr_bundle *attrs)
+{
+	struct hns_roce_qp *hr_qp;
+	u32 alloc_flags;
+	int ret;
+
+	hr_qp = uverbs_attr_to_hr_qp(attrs, HNS_IB_ATTR_DCA_MEM_ATTACH_HANDLE);
+	if (IS_ERR(hr_qp))
+		return PTR_ERR(hr_qp);
+
+	ret = attach_dca_mem(to_hr_dev(hr_qp->ibqp.device), hr_qp,
+			     &alloc_flags);
+	if (ret)
+		return ret;
+
+	ret = uverbs_copy_to(attrs, HNS_IB_ATTR_DCA_MEM_ATTACH_OUT_ALLOC_FLAGS,
+			     &alloc_flags, sizeof(alloc_flags));
+	if (!ret)
+		ret = uverbs_copy_to(attrs,
+				     HNS_IB_ATTR_DCA_MEM_ATTACH_OUT_ALLOC_PAGES,
+				     &hr_qp->dca_cfg.npages,
+				     sizeof(hr_qp->dca_cfg.npages));
+
+	return ret;
+}
+
+static int UVERBS_HANDLER(HNS_IB_METHOD_DCA_MEM_DETACH)(
+	struct ib_uverbs_file *file, struct uverbs_attr_bundle *attrs)
+{
+	struct hns_roce_qp *hr_qp;
+
+	hr_qp = uverbs_attr_to_hr_qp(attrs, HNS_IB_ATTR_DCA_MEM_DETACH_HANDLE);
+	if (IS_ERR(hr_qp))
+		return PTR_ERR(hr_qp);
+
+	detach_dca_mem(hr_qp);
+
+	return 0;
+}
+
+static int UVERBS_HANDLER(HNS_IB_METHOD_DCA_MEM_QUERY)(
+	struct ib_uverbs_file *file, struct uverbs_attr_bundle *attrs)
+{
+	struct hns_roce_dca_page_ref *refs;
+	struct hns_roce_dca_cfg *cfg;
+	struct hns_roce_qp *hr_qp;
+	u32 page_index;
+	u32 page_count;
+	u32 offset;
+	u64 key;
+	int ret;
+
+	hr_qp = uverbs_attr_to_hr_qp(attrs, HNS_IB_ATTR_DCA_MEM_QUERY_HANDLE);
+	if (IS_ERR(hr_qp))
+		return PTR_ERR(hr_qp);
+
+	ret = uverbs_copy_from(&page_index, attrs,
+			       HNS_IB_ATTR_DCA_MEM_QUERY_PAGE_INDEX);
+	if (ret)
+		return ret;
+
+	cfg = &hr_qp->dca_cfg;
+	if (!cfg->attached || page_index >= cfg->npages)
+		return -EINVAL;
+
+	/* Report the run of pages that is contiguous in the same memory */
+	refs = &cfg->refs[page_index];
+	for (page_count = 1; page_index + page_count < cfg->npages;
+	     page_count++)
+		if (refs[page_count].mem != refs[0].mem ||
+		    refs[page_count].index != refs[0].index + page_count)
+			break;
+
+	key = ((struct dca_mem *)refs[0].mem)->key;
+	offset = refs[0].index << HNS_HW_PAGE_SHIFT;
+
+	ret = uverbs_copy_to(attrs, HNS_IB_ATTR_DCA_MEM_QUERY_OUT_KEY,
+			     &key, sizeof(key));
+	if (!ret)
+		ret = uverbs_copy_to(attrs,
+				     HNS_IB_ATTR_DCA_MEM_QUERY_OUT_OFFSET,
+				     &offset, sizeof(offset));
+	if (!ret)
+		ret = uverbs_copy_to(attrs,
+				     HNS_IB_ATTR_DCA_MEM_QUERY_OUT_PAGE_COUNT,
+				     &page_count, sizeof(page_count));
+
+	return ret;
+}
+
+DECLARE_UVERBS_NAMED_METHOD(
+	HNS_IB_METHOD_DCA_MEM_REG,
+	UVERBS_ATTR_IDR(HNS_IB_ATTR_DCA_MEM_REG_HANDLE,
+			HNS_IB_OBJECT_DCA_MEM,
+			UVERBS_ACCESS_NEW,
+			UA_MANDATORY),
+	UVERBS_ATTR_PTR_IN(HNS_IB_ATTR_DCA_MEM_REG_LEN,
+			   UVERBS_ATTR_TYPE(u32),
+			   UA_MANDATORY),
+	UVERBS_ATTR_PTR_IN(HNS_IB_ATTR_DCA_MEM_REG_ADDR,
+			   UVERBS_ATTR_TYPE(u64),
+			   UA_MANDATORY),
+	UVERBS_ATTR_PTR_IN(HNS_IB_ATTR_DCA_MEM_REG_KEY,
+			   UVERBS_ATTR_TYPE(u64),
+			   UA_MANDATORY));
+
+DECLARE_UVERBS_NAMED_METHOD_DESTROY(
+	HNS_IB_METHOD_DCA_MEM_DEREG,
+	UVERBS_ATTR_IDR(HNS_IB_ATTR_DCA_MEM_DEREG_HANDLE,
+			HNS_IB_OBJECT_DCA_MEM,
+			UVERBS_ACCESS_DESTROY,
+			UA_MANDATORY));
+
+DECLARE_UVERBS_NAMED_METHOD(
+	HNS_IB_METHOD_DCA_MEM_SHRINK,
+	UVERBS_ATTR_IDR(HNS_IB_ATTR_DCA_MEM_SHRINK_HANDLE,
+			HNS_IB_OBJECT_DCA_MEM,
+			UVERBS_ACCESS_READ,
+			UA_MANDATORY),
+	UVERBS_ATTR_PTR_IN(HNS_IB_ATTR_DCA_MEM_SHRINK_RESERVED_SIZE,
+			   UVERBS_ATTR_TYPE(u64),
+			   UA_MANDATORY),
+	UVERBS_ATTR_PTR_OUT(HNS_IB_ATTR_DCA_MEM_SHRINK_OUT_FREE_KEY,
+			    UVERBS_ATTR_TYPE(u64),
+			    UA_MANDATORY),
+	UVERBS_ATTR_PTR_OUT(HNS_IB_ATTR_DCA_MEM_SHRINK_OUT_FREE_MEMS,
+			    UVERBS_ATTR_TYPE(u32),
+			    UA_MANDATORY));
+
+DECLARE_UVERBS_NAMED_METHOD(
+	HNS_IB_METHOD_DCA_MEM_ATTACH,
+	UVERBS_ATTR_IDR(HNS_IB_ATTR_DCA_MEM_ATTACH_HANDLE,
+			UVERBS_OBJECT_QP,
+			UVERBS_ACCESS_WRITE,
+			UA_MANDATORY),
+	UVERBS_ATTR_PTR_OUT(HNS_IB_ATTR_DCA_MEM_ATTACH_OUT_ALLOC_FLAGS,
+			    UVERBS_ATTR_TYPE(u32),
+			    UA_MANDATORY),
+	UVERBS_ATTR_PTR_OUT(HNS_IB_ATTR_DCA_MEM_ATTACH_OUT_ALLOC_PAGES,
+			    UVERBS_ATTR_TYPE(u32),
+			    UA_MANDATORY));
+
+DECLARE_UVERBS_NAMED_METHOD(
+	HNS_IB_METHOD_DCA_MEM_DETACH,
+	UVERBS_ATTR_IDR(HNS_IB_ATTR_DCA_MEM_DETACH_HANDLE,
+			UVERBS_OBJECT_QP,
+			UVERBS_ACCESS_WRITE,
+			UA_MANDATORY));
+
+DECLARE_UVERBS_NAMED_METHOD(
+	HNS_IB_METHOD_DCA_MEM_QUERY,
+	UVERBS_ATTR_IDR(HNS_IB_ATTR_DCA_MEM_QUERY_HANDLE,
+			UVERBS_OBJECT_QP,
+			UVERBS_ACCESS_READ,
+			UA_MANDATORY),
+	UVERBS_ATTR_PTR_IN(HNS_IB_ATTR_DCA_MEM_QUERY_PAGE_INDEX,
+			   UVERBS_ATTR_TYPE(u32),
+			   UA_MANDATORY),
+	UVERBS_ATTR_PTR_OUT(HNS_IB_ATTR_DCA_MEM_QUERY_OUT_KEY,
+			    UVERBS_ATTR_TYPE(u64),
+			    UA_MANDATORY),
+	UVERBS_ATTR_PTR_OUT(HNS_IB_ATTR_DCA_MEM_QUERY_OUT_OFFSET,
+			    UVERBS_ATTR_TYPE(u32),
+			    UA_MANDATORY),
+	UVERBS_ATTR_PTR_OUT(HNS_IB_ATTR_DCA_MEM_QUERY_OUT_PAGE_COUNT,
+			    UVERBS_ATTR_TYPE(u32),
+			    UA_MANDATORY));
+
+DECLARE_UVERBS_NAMED_OBJECT(HNS_IB_OBJECT_DCA_MEM,
+			    UVERBS_TYPE_ALLOC_IDR(dca_cleanup),
+			    &UVERBS_METHOD(HNS_IB_METHOD_DCA_MEM_REG),
+			    &UVERBS_METHOD(HNS_IB_METHOD_DCA_MEM_DEREG),
+			    &UVERBS_METHOD(HNS_IB_METHOD_DCA_MEM_SHRINK),
+			    &UVERBS_METHOD(HNS_IB_METHOD_DCA_MEM_ATTACH),
+			    &UVERBS_METHOD(HNS_IB_METHOD_DCA_MEM_DETACH),
+			    &UVERBS_METHOD(HNS_IB_METHOD_DCA_MEM_QUERY));
+
+DECLARE_UVERBS_OBJECT_TREE(hns_roce_dca_objects,
+			   &UVERBS_OBJECT(HNS_IB_OBJECT_DCA_MEM));
+
+int hns_roce_get_dca_trees(const struct uverbs_object_tree_def **root)
+{
+	int i = 0;
+
+	root[i++] = &hns_roce_dca_objects;
+
+	return i;
+}
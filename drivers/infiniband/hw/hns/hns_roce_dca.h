@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: (GPL-2.0 OR BSD-2-Clause) */
+/*
+ * Copyright (c) 2020 Hisilicon Limited.
+ */
+
+#ifndef __HNS_ROCE_DCA_H
+#define __HNS_ROCE_DCA_H
+
+#include <rdma/uverbs_ioctl.h>
+
+#define HNS_ROCE_DCA_TREE_NUM	1
+
+bool hns_roce_dca_supported(struct hns_roce_dev *hr_dev);
+int hns_roce_get_dca_trees(const struct uverbs_object_tree_def **root);
+
+void hns_roce_register_udca(struct hns_roce_dev *hr_dev,
+			    struct hns_roce_ucontext *uctx);
+void hns_roce_unregister_udca(struct hns_roce_dev *hr_dev,
+			      struct hns_roce_ucontext *uctx);
+
+int hns_roce_enable_dca(struct hns_roce_dev *hr_dev, struct hns_roce_qp *hr_qp);
+void hns_roce_disable_dca(struct hns_roce_dev *hr_dev,
+			  struct hns_roce_qp *hr_qp);
+
+ssize_t hns_roce_dca_stats_show(struct hns_roce_dev *hr_dev, char *buf);
+
+#endif
@@ -148,6 +148,7 @@
 enum {
 	HNS_ROCE_SUPPORT_RQ_RECORD_DB = 1 << 0,
 	HNS_ROCE_SUPPORT_SQ_RECORD_DB = 1 << 1,
+	HNS_ROCE_SUPPORT_DCA_MODE = 1 << 2,
 };
 
 enum {
@@ -236,6 +237,8 @@ enum {
 	HNS_ROCE_CAP_FLAG_FRMR			= BIT(8),
 	HNS_ROCE_CAP_FLAG_QP_FLOW_CTRL		= BIT(9),
 	HNS_ROCE_CAP_FLAG_ATOMIC		= BIT(10),
+	HNS_ROCE_CAP_FLAG_DCA_MODE		= BIT(11),
+	HNS_ROCE_CAP_FLAG_DIRECT_WQE		= BIT(12),
 };
 
 enum hns_roce_mtt_type {
@@ -322,6 +325,9 @@ static inline void hns_roce_inc_rdma_hw_stats(struct ib_device *dev, int stats)
 #define HNS_HW_PAGE_SHIFT			12
 #define HNS_HW_PAGE_SIZE			(1 << HNS_HW_PAGE_SHIFT)
 
+/* Each QP owns one direct WQE region in mem_base, indexed by QPN */
+#define HNS_ROCE_DWQE_SIZE			65536
+
 #define PAGE_ADDR_SHIFT				12
 
 #define HNS_ROCE_IS_RESETTING			1
@@ -338,6 +344,32 @@ struct hns_roce_vma_data {
 	struct mutex *vma_list_mutex;
 };
 
+/* Dynamic context attachment: WQE buffer pool shared by a ucontext's QPs */
+struct hns_roce_dca_ctx {
+	struct list_head	pool; /* list of all registered dca_mem */
+	spinlock_t		pool_lock; /* protect pool and sizes below */
+	u64			total_size; /* bytes registered */
+	u64			free_size; /* bytes not attached to any QP */
+	u32			total_mems;
+	u32			attached_qps;
+	u64			attach_cnt;
+	u64			nomem_cnt; /* attach failed for lack of pages */
+	struct list_head	node; /* entry in hr_dev->dca_ctx_list */
+	pid_t			pid;
+};
+
+struct hns_roce_dca_page_ref {
+	void			*mem; /* struct dca_mem owning the page */
+	u32			index; /* page index in that dca_mem */
+};
+
+struct hns_roce_dca_cfg {
+	struct hns_roce_dca_ctx	*ctx; /* NULL if the QP is not in DCA mode */
+	struct hns_roce_dca_page_ref *refs; /* one per WQE buffer page */
+	u32			npages;
+	bool			attached;
+};
+
 struct hns_roce_ucontext {
 	struct ib_ucontext	ibucontext;
 	struct hns_roce_uar	uar;
@@ -346,6 +378,7 @@ struct hns_roce_ucontext {
 	struct list_head	vma_list;
 	struct mutex		vma_list_mutex;
 	struct kref		uctx_ref;
+	struct hns_roce_dca_ctx	dca_ctx;
 };
 
 struct hns_roce_pd {
@@ -525,6 +558,7 @@ struct hns_roce_wq {
 	u32		head;
 	u32		tail;
 	void __iomem	*db_reg_l;
+	void __iomem	*dwqe_reg; /* direct WQE page, NULL if not used */
 };
 
 struct hns_roce_sge {
@@ -809,6 +843,7 @@ struct hns_roce_qp {
 
 	struct hns_roce_mtr	mtr;
 	u32			buff_size;
+	struct hns_roce_dca_cfg	dca_cfg;
 
 	struct mutex		mutex;
 	u16			xrcdn;
@@ -1205,6 +1240,8 @@ struct hns_roce_hw {
 	int (*post_srq_recv)(struct ib_srq *ibsrq, struct ib_recv_wr *wr,
 			     struct ib_recv_wr **bad_wr);
 #endif
+	int (*set_dca_buf)(struct hns_roce_dev *hr_dev,
+			   struct hns_roce_qp *hr_qp);
 };
 
 /* HW STATS cannot support EQ interrupt event,so add counter of dev for CI */
@@ -1236,6 +1273,7 @@ struct hns_roce_dev {
 	struct mutex            pgdir_mutex;
 	int			irq[HNS_ROCE_MAX_IRQ_NUM];
 	u8 __iomem		*reg_base;
+	void __iomem		*mem_base; /* direct WQE pages, WC mapped */
 	struct hns_roce_caps	caps;
 	struct radix_tree_root  qp_table_tree;
 
@@ -1275,6 +1313,10 @@ struct hns_roce_dev {
 	u32			func_num;
 	u32			mac_id;
 	u64			dfx_cnt[HNS_ROCE_DFX_TOTAL];
+
+	struct list_head	dca_ctx_list; /* DCA pools of all ucontexts */
+	spinlock_t		dca_ctx_lock; /* protect dca_ctx_list */
+	u64			dca_max_size; /* pool limit per ucontext */
 };
 
 static inline struct hns_roce_dev *to_hr_dev(struct ib_device *ib_dev)
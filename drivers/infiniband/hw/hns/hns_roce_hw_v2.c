@@ -337,6 +337,43 @@ static void hns_roce_dfx_record_post_send_wqe(struct hns_roce_qp *qp,
 		qp->dfx_cnt[HNS_ROCE_QP_DFX_SIGNAL_WQE]++;
 }
 
+/*
+ * A direct WQE pushes the whole WQE to the device together with the doorbell
+ * and saves the device a DMA read of the WQE. It is only worth it for a lone
+ * WR, a chain of WRs is announced by a single doorbell and the device fetches
+ * the chained WQEs in one burst.
+ */
+static bool check_dwqe(struct hns_roce_qp *qp, void *wqe, int nreq)
+{
+	struct hns_roce_v2_rc_send_wqe *rc_sq_wqe = wqe;
+
+	if (nreq != 1 || !qp->sq.dwqe_reg)
+		return false;
+
+	/* FRMR WQEs use the bits that carry the direct WQE index */
+	return roce_get_field(rc_sq_wqe->byte_4, V2_RC_SEND_WQE_BYTE_4_OPCODE_M,
+			      V2_RC_SEND_WQE_BYTE_4_OPCODE_S) !=
+	       HNS_ROCE_V2_WQE_OP_FAST_REG_PMR;
+}
+
+static void write_dwqe(struct hns_roce_dev *hr_dev, struct hns_roce_qp *qp,
+		       void *wqe)
+{
+	struct hns_roce_v2_rc_send_wqe *rc_sq_wqe = wqe;
+
+	/* What the doorbell would tell the device travels in the header */
+	roce_set_bit(rc_sq_wqe->byte_4, V2_RC_SEND_WQE_BYTE_4_FLAG_S, 1);
+	roce_set_field(rc_sq_wqe->byte_4, V2_RC_SEND_WQE_BYTE_4_DB_SL_L_M,
+		       V2_RC_SEND_WQE_BYTE_4_DB_SL_L_S, qp->sl);
+	roce_set_field(rc_sq_wqe->byte_4, V2_RC_SEND_WQE_BYTE_4_DB_SL_H_M,
+		       V2_RC_SEND_WQE_BYTE_4_DB_SL_H_S, qp->sl >> 2);
+	roce_set_field(rc_sq_wqe->byte_4, V2_RC_SEND_WQE_BYTE_4_WQE_INDEX_M,
+		       V2_RC_SEND_WQE_BYTE_4_WQE_INDEX_S,
+		       qp->sq.head & ((qp->sq.wqe_cnt << 1) - 1));
+
+	hns_roce_write512(hr_dev, wqe, qp->sq.dwqe_reg);
+}
+
 #ifdef CONFIG_KERNEL_419
 static int hns_roce_v2_post_send(struct ib_qp *ibqp,
 				 const struct ib_send_wr *wr,
@@ -728,10 +765,14 @@ static int hns_roce_v2_post_send(struct ib_qp *ibqp, struct ib_send_wr *wr,
 		roce_set_field(sq_db.parameter, V2_DB_PARAMETER_SL_M,
 			       V2_DB_PARAMETER_SL_S, qp->sl);
 
+		wqe = get_send_wqe(qp, (ind - 1) & (qp->sq.wqe_cnt - 1));
+
 		/* when qp is err, stop to write db */
 		if (qp->state == IB_QPS_ERR) {
 			if (qp_lock)
 				init_flush_work(hr_dev, qp);
+		} else if (check_dwqe(qp, wqe, nreq)) {
+			write_dwqe(hr_dev, qp, wqe);
 		} else {
 			hns_roce_write64(hr_dev, (__le32 *)&sq_db,
 					 qp->sq.db_reg_l);
@@ -1232,6 +1232,9 @@ struct hns_roce_v2_rc_send_wqe {
 #define	V2_RC_SEND_WQE_BYTE_4_OPCODE_S 0
 #define V2_RC_SEND_WQE_BYTE_4_OPCODE_M GENMASK(4, 0)
 
+#define V2_RC_SEND_WQE_BYTE_4_DB_SL_L_S 5
+#define V2_RC_SEND_WQE_BYTE_4_DB_SL_L_M GENMASK(6, 5)
+
 #define V2_RC_SEND_WQE_BYTE_4_OWNER_S 7
 
 #define V2_RC_SEND_WQE_BYTE_4_CQE_S 8
@@ -1244,6 +1247,15 @@ struct hns_roce_v2_rc_send_wqe {
 
 #define V2_RC_SEND_WQE_BYTE_4_INLINE_S 12
 
+/* Only valid in a direct WQE, which never carries an FRMR WQE */
+#define V2_RC_SEND_WQE_BYTE_4_DB_SL_H_S 13
+#define V2_RC_SEND_WQE_BYTE_4_DB_SL_H_M GENMASK(14, 13)
+
+#define V2_RC_SEND_WQE_BYTE_4_WQE_INDEX_S 15
+#define V2_RC_SEND_WQE_BYTE_4_WQE_INDEX_M GENMASK(30, 15)
+
+#define V2_RC_SEND_WQE_BYTE_4_FLAG_S 31
+
 #define V2_RC_FRMR_WQE_BYTE_4_BIND_EN_S 19
 
 #define V2_RC_FRMR_WQE_BYTE_4_ATOMIC_S 20
@@ -2186,4 +2198,17 @@ static inline void hns_roce_write64(struct hns_roce_dev *hr_dev, __le32 val[2],
 		hns_roce_write64_k(val, dest);
 }
 
+#define HNS_ROCE_V2_DWQE_SIZE	64
+
+static inline void hns_roce_write512(struct hns_roce_dev *hr_dev, u64 *val,
+				     void __iomem *dest)
+{
+	struct hns_roce_v2_priv *priv = (struct hns_roce_v2_priv *)hr_dev->priv;
+	struct hnae3_handle *handle = priv->handle;
+	const struct hnae3_ae_ops *ops = handle->ae_algo->ops;
+
+	if (!hr_dev->dis_db && !ops->get_hw_reset_stat(handle))
+		__iowrite64_copy(dest, val, HNS_ROCE_V2_DWQE_SIZE / sizeof(u64));
+}
+
 #endif
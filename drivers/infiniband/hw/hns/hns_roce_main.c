@@ -54,6 +54,7 @@
 #include "hns_roce_device.h"
 #include <rdma/hns-abi.h>
 #include "hns_roce_hem.h"
+#include "hns_roce_dca.h"
 
 /**
  * hns_get_gid_index - Get gid index.
@@ -523,6 +524,9 @@ static struct ib_ucontext *hns_roce_alloc_ucontext(struct ib_device *ib_dev,
 
 	kref_init(&context->uctx_ref);
 
+	if (hns_roce_dca_supported(hr_dev))
+		hns_roce_register_udca(hr_dev, context);
+
 	return &context->ibucontext;
 
 error_fail_copy_to_udata:
@@ -545,11 +549,14 @@ static inline void release_ucontext(struct kref *kref)
 static int hns_roce_dealloc_ucontext(struct ib_ucontext *ibcontext)
 {
 	struct hns_roce_ucontext *context = to_hr_ucontext(ibcontext);
+	struct hns_roce_dev *hr_dev = to_hr_dev(ibcontext->device);
+
+	rdfx_func_cnt(hr_dev, RDFX_FUNC_DEALLOC_UCONTEXT);
 
-	rdfx_func_cnt(to_hr_dev(ibcontext->device),
-				     RDFX_FUNC_DEALLOC_UCONTEXT);
+	if (hns_roce_dca_supported(hr_dev))
+		hns_roce_unregister_udca(hr_dev, context);
 
-	hns_roce_uar_free(to_hr_dev(ibcontext->device), &context->uar);
+	hns_roce_uar_free(hr_dev, &context->uar);
 
 	kref_put(&context->uctx_ref, release_ucontext);
 
@@ -873,6 +880,10 @@ static void hns_roce_unregister_device(struct hns_roce_dev *hr_dev)
 	ib_unregister_device(&hr_dev->ib_dev);
 }
 
+/* NULL terminated, the driver specific uverbs objects are the same for all */
+static const struct uverbs_object_tree_def
+	*hns_roce_driver_trees[HNS_ROCE_DCA_TREE_NUM + 1];
+
 static int hns_roce_register_device(struct hns_roce_dev *hr_dev)
 {
 	struct device *dev = hr_dev->dev;
@@ -1010,6 +1021,10 @@ static int hns_roce_register_device(struct hns_roce_dev *hr_dev)
 
 #ifdef CONFIG_NEW_KERNEL
 	ib_dev->driver_id = RDMA_DRIVER_HNS;
+	if (hns_roce_dca_supported(hr_dev)) {
+		hns_roce_get_dca_trees(hns_roce_driver_trees);
+		ib_dev->driver_specs = hns_roce_driver_trees;
+	}
 #endif
 	ret = ib_register_device(ib_dev, NULL);
 	if (ret) {
@@ -1476,6 +1491,8 @@ int hns_roce_init(struct hns_roce_dev *hr_dev)
 
 	INIT_LIST_HEAD(&hr_dev->qp_list);
 	spin_lock_init(&hr_dev->qp_lock);
+	INIT_LIST_HEAD(&hr_dev->dca_ctx_list);
+	spin_lock_init(&hr_dev->dca_ctx_lock);
 
 	ret = hns_roce_register_device(hr_dev);
 	if (ret)
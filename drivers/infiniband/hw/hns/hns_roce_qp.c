@@ -38,6 +38,7 @@
 #include "hns_roce_common.h"
 #include "hns_roce_device.h"
 #include "hns_roce_hem.h"
+#include "hns_roce_dca.h"
 #include <rdma/hns-abi.h>
 
 #define SQP_NUM				(2 * HNS_ROCE_MAX_PORTS)
@@ -658,6 +659,24 @@ static void hns_roce_free_recv_inline_buffer(struct hns_roce_qp *hr_qp)
 	kfree(hr_qp->rq_inl_buf.wqe_list);
 }
 
+static int set_dca_buf_attr(struct hns_roce_dev *hr_dev,
+			    struct hns_roce_qp *hr_qp,
+			    struct hns_roce_buf_attr *buf_attr)
+{
+	unsigned int i;
+
+	/* DCA pages are scattered, every region must be addressed by MTT */
+	for (i = 0; i < buf_attr->region_count; i++)
+		if (!to_hr_hem_hopnum(buf_attr->region[i].hopnum, 1))
+			return -EINVAL;
+
+	/* Only the MTT is allocated here, the pages come from the DCA pool */
+	buf_attr->mtt_only = true;
+	buf_attr->page_shift = HNS_HW_PAGE_SHIFT;
+
+	return hns_roce_enable_dca(hr_dev, hr_qp);
+}
+
 static int alloc_wqe_buf(struct hns_roce_dev *hr_dev, struct hns_roce_qp *hr_qp,
 			 struct hns_roce_buf_attr *buf_attr,
 			 struct ib_uobject *uobject, unsigned long addr)
@@ -665,11 +684,24 @@ static int alloc_wqe_buf(struct hns_roce_dev *hr_dev, struct hns_roce_qp *hr_qp,
 	struct device *dev = hr_dev->dev;
 	int ret;
 
+	if (hr_qp->dca_cfg.ctx) {
+		ret = set_dca_buf_attr(hr_dev, hr_qp, buf_attr);
+		if (ret) {
+			dev_err(dev, "failed to set DCA attr, ret = %d.\n", ret);
+			return ret;
+		}
+
+		uobject = NULL;
+		addr = 0;
+	}
+
 	ret = hns_roce_mtr_create(hr_dev, &hr_qp->mtr, buf_attr,
 				  PAGE_SHIFT + hr_dev->caps.mtt_ba_pg_sz,
 				  uobject ? uobject->context : NULL, addr);
-	if (ret)
+	if (ret) {
 		dev_err(dev, "failed to create WQE mtr, ret = %d.\n", ret);
+		hns_roce_disable_dca(hr_dev, hr_qp);
+	}
 
 	return ret;
 }
@@ -678,6 +710,7 @@ static void free_wqe_buf(struct hns_roce_dev *hr_dev, struct hns_roce_qp *hr_qp,
 			 struct ib_uobject *uobject)
 {
 	hns_roce_mtr_destroy(hr_dev, &hr_qp->mtr);
+	hns_roce_disable_dca(hr_dev, hr_qp);
 }
 
 static void hns_roce_add_cq_to_qp(struct hns_roce_dev *hr_dev,
@@ -826,6 +859,29 @@ static int set_qp_param(struct hns_roce_dev *hr_dev, struct hns_roce_qp *hr_qp,
 	return ret;
 }
 
+static int set_dca_mode(struct hns_roce_dev *hr_dev, struct hns_roce_qp *hr_qp,
+			struct ib_qp_init_attr *init_attr,
+			struct hns_roce_ucontext *uctx,
+			struct hns_roce_ib_create_qp *ucmd)
+{
+	if (!(ucmd->create_flags & HNS_ROCE_CREATE_QP_FLAGS_DCA_MODE))
+		return 0;
+
+	if (!hns_roce_dca_supported(hr_dev))
+		return -EOPNOTSUPP;
+
+	/*
+	 * RQ WQEs are posted ahead of time and consumed whenever a message
+	 * arrives, so only a QP without RQ can drop its buffer when idle.
+	 */
+	if (hns_roce_qp_has_rq(init_attr))
+		return -EINVAL;
+
+	hr_qp->dca_cfg.ctx = &uctx->dca_ctx;
+
+	return 0;
+}
+
 static int hns_roce_create_qp_common(struct hns_roce_dev *hr_dev,
 				     struct ib_pd *ib_pd,
 				     struct ib_qp_init_attr *init_attr,
@@ -852,6 +908,17 @@ static int hns_roce_create_qp_common(struct hns_roce_dev *hr_dev,
 	}
 
 	if (ib_pd->uobject) {
+		ret = set_dca_mode(hr_dev, hr_qp, init_attr,
+				   to_hr_ucontext(ib_pd->uobject->context),
+				   &ucmd);
+		if (ret) {
+			dev_err(dev, "failed to set DCA mode, ret = %d.\n", ret);
+			return ret;
+		}
+
+		if (hr_qp->dca_cfg.ctx)
+			resp.cap_flags |= HNS_ROCE_SUPPORT_DCA_MODE;
+
 		if ((hr_dev->caps.flags & HNS_ROCE_CAP_FLAG_SQ_RECORD_DB) &&
 		    (udata->inlen >= sizeof(ucmd)) &&
 		    (udata->outlen >= sizeof(resp)) &&
@@ -961,6 +1028,12 @@ static int hns_roce_create_qp_common(struct hns_roce_dev *hr_dev,
 	else
 		hr_qp->doorbell_qpn = (u32)(hr_qp->qpn);
 
+	if (!ib_pd->uobject && init_attr->qp_type == IB_QPT_RC &&
+	    (hr_dev->caps.flags & HNS_ROCE_CAP_FLAG_DIRECT_WQE) &&
+	    hr_dev->mem_base)
+		hr_qp->sq.dwqe_reg = hr_dev->mem_base +
+				     HNS_ROCE_DWQE_SIZE * hr_qp->qpn;
+
 	if (ib_pd->uobject) {
 		ret = ib_copy_to_udata(udata, &resp, min(udata->outlen, sizeof(resp)));
 		if (ret)
@@ -47,6 +47,7 @@
 #include "hns_roce_cmd.h"
 #include "hns_roce_hem.h"
 #include "hns_roce_hw_v2.h"
+#include "hns_roce_dca.h"
 
 
 
@@ -391,6 +392,45 @@ static ssize_t coalesce_period_store(struct device *dev,
 	return count;
 }
 
+static ssize_t dca_stats_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct hns_roce_dev *hr_dev =
+		container_of(dev, struct hns_roce_dev, ib_dev.dev);
+
+	return hns_roce_dca_stats_show(hr_dev, buf);
+}
+
+static ssize_t dca_max_size_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct hns_roce_dev *hr_dev =
+		container_of(dev, struct hns_roce_dev, ib_dev.dev);
+	u64 max_size;
+	int ret;
+
+	ret = kstrtou64(buf, 10, &max_size);
+	if (ret) {
+		dev_err(dev, "Input params format unmatch\n");
+		return -EINVAL;
+	}
+
+	WRITE_ONCE(hr_dev->dca_max_size, max_size);
+
+	return strnlen(buf, count);
+}
+
+static ssize_t dca_max_size_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct hns_roce_dev *hr_dev =
+		container_of(dev, struct hns_roce_dev, ib_dev.dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%llu\n",
+			 READ_ONCE(hr_dev->dca_max_size));
+}
+
 static DEVICE_ATTR_RW(aeqc);
 static DEVICE_ATTR_RW(qpc);
 static DEVICE_ATTR_RW(srqc);
@@ -401,6 +441,8 @@ static DEVICE_ATTR_RO(cmd);
 static DEVICE_ATTR_RW(cqc);
 static DEVICE_ATTR_RW(coalesce_maxcnt);
 static DEVICE_ATTR_RW(coalesce_period);
+static DEVICE_ATTR_RO(dca_stats);
+static DEVICE_ATTR_RW(dca_max_size);
 
 static struct device_attribute *hns_roce_hw_attrs_list[] = {
 	&dev_attr_cmd,
@@ -413,6 +455,8 @@ static struct device_attribute *hns_roce_hw_attrs_list[] = {
 	&dev_attr_srqc,
 	&dev_attr_coalesce_maxcnt,
 	&dev_attr_coalesce_period,
+	&dev_attr_dca_stats,
+	&dev_attr_dca_max_size,
 };
 
 int hns_roce_register_sysfs(struct hns_roce_dev *hr_dev)
@@ -572,6 +572,13 @@ struct arm_smmu_cmdq {
 	atomic_t			lock;
 };
 
+#define CMDQ_BATCH_ENTRIES		BITS_PER_LONG
+
+struct arm_smmu_cmdq_batch {
+	u64				cmds[CMDQ_BATCH_ENTRIES * CMDQ_ENT_DWORDS];
+	int				num;
+};
+
 struct arm_smmu_evtq {
 	struct arm_smmu_queue		q;
 	u32				max_stalls;
@@ -1522,6 +1529,49 @@ static int arm_smmu_cmdq_issue_sync(struct arm_smmu_device *smmu)
 	return arm_smmu_cmdq_issue_cmdlist(smmu, NULL, 0, true);
 }
 
+/*
+ * Commands added to a batch are claimed and written to the queue in one go
+ * when it fills up or is submitted, instead of one cmpxchg() on the shared
+ * prod pointer per command. Submitting also inserts a single CMD_SYNC.
+ */
+static void arm_smmu_cmdq_batch_add(struct arm_smmu_device *smmu,
+				    struct arm_smmu_cmdq_batch *cmds,
+				    struct arm_smmu_cmdq_ent *cmd)
+{
+	if (cmds->num == CMDQ_BATCH_ENTRIES) {
+		arm_smmu_cmdq_issue_cmdlist(smmu, cmds->cmds, cmds->num, false);
+		cmds->num = 0;
+	}
+
+	if (arm_smmu_cmdq_build_cmd(&cmds->cmds[cmds->num * CMDQ_ENT_DWORDS],
+				    cmd)) {
+		dev_warn(smmu->dev, "ignoring unknown CMDQ opcode 0x%x\n",
+			 cmd->opcode);
+		return;
+	}
+	cmds->num++;
+}
+
+static int arm_smmu_cmdq_batch_submit(struct arm_smmu_device *smmu,
+				      struct arm_smmu_cmdq_batch *cmds,
+				      bool sync)
+{
+	if (!cmds->num && !sync)
+		return 0;
+
+	return arm_smmu_cmdq_issue_cmdlist(smmu, cmds->cmds, cmds->num, sync);
+}
+
+/* Issue @ent and a CMD_SYNC with a single insertion */
+static int arm_smmu_cmdq_issue_cmd_with_sync(struct arm_smmu_device *smmu,
+					     struct arm_smmu_cmdq_ent *ent)
+{
+	struct arm_smmu_cmdq_batch cmds = {};
+
+	arm_smmu_cmdq_batch_add(smmu, &cmds, ent);
+	return arm_smmu_cmdq_batch_submit(smmu, &cmds, true);
+}
+
 static int arm_smmu_page_response(struct device *dev,
 				  struct page_response_msg *resp)
 {
@@ -1572,8 +1622,7 @@ static void arm_smmu_sync_ste_for_sid(struct arm_smmu_device *smmu, u32 sid)
 		},
 	};
 
-	arm_smmu_cmdq_issue_cmd(smmu, &cmd);
-	arm_smmu_cmdq_issue_sync(smmu);
+	arm_smmu_cmdq_issue_cmd_with_sync(smmu, &cmd);
 }
 
 static void arm_smmu_write_strtab_ent(struct arm_smmu_device *smmu, u32 sid,
@@ -2124,8 +2173,7 @@ static void arm_smmu_tlb_inv_context(void *cookie)
 	 * insertion to guarantee those are observed before the TLBI. Do be
 	 * careful, 007.
 	 */
-	arm_smmu_cmdq_issue_cmd(smmu, &cmd);
-	__arm_smmu_tlb_sync(smmu);
+	arm_smmu_cmdq_issue_cmd_with_sync(smmu, &cmd);
 }
 
 static void arm_smmu_tlb_inv_range_nosync(unsigned long iova, size_t size,
@@ -2133,6 +2181,7 @@ static void arm_smmu_tlb_inv_range_nosync(unsigned long iova, size_t size,
 {
 	struct arm_smmu_domain *smmu_domain = cookie;
 	struct arm_smmu_device *smmu = smmu_domain->smmu;
+	struct arm_smmu_cmdq_batch cmds = {};
 	struct arm_smmu_cmdq_ent cmd = {
 		.tlbi = {
 			.leaf	= leaf,
@@ -2151,10 +2200,12 @@ static void arm_smmu_tlb_inv_range_nosync(unsigned long iova, size_t size,
 		cmd.tlbi.vmid	= smmu_domain->s2_cfg.vmid;
 	}
 
+	/* The CMD_SYNC is left to ->tlb_sync(), once per unmap */
 	do {
-		arm_smmu_cmdq_issue_cmd(smmu, &cmd);
+		arm_smmu_cmdq_batch_add(smmu, &cmds, &cmd);
 		cmd.tlbi.addr += granule;
 	} while (size -= granule);
+	arm_smmu_cmdq_batch_submit(smmu, &cmds, false);
 }
 
 static const struct iommu_flush_ops arm_smmu_flush_ops = {
@@ -2170,6 +2221,7 @@ static void __arm_smmu_sync_cd(struct arm_smmu_domain *smmu_domain,
 	size_t i;
 	unsigned long flags;
 	struct arm_smmu_master_data *master;
+	struct arm_smmu_cmdq_batch cmds = {};
 	struct arm_smmu_device *smmu = smmu_domain->smmu;
 
 	spin_lock_irqsave(&smmu_domain->devices_lock, flags);
@@ -2178,12 +2230,12 @@ static void __arm_smmu_sync_cd(struct arm_smmu_domain *smmu_domain,
 
 		for (i = 0; i < fwspec->num_ids; i++) {
 			cmd->cfgi.sid = fwspec->ids[i];
-			arm_smmu_cmdq_issue_cmd(smmu, cmd);
+			arm_smmu_cmdq_batch_add(smmu, &cmds, cmd);
 		}
 	}
 	spin_unlock_irqrestore(&smmu_domain->devices_lock, flags);
 
-	__arm_smmu_tlb_sync(smmu);
+	arm_smmu_cmdq_batch_submit(smmu, &cmds, true);
 }
 
 static void arm_smmu_sync_cd(void *cookie, int ssid, bool leaf)
@@ -2219,8 +2271,7 @@ static void arm_smmu_tlb_inv_ssid(void *cookie, int ssid,
 		.tlbi.asid	= entry->tag,
 	};
 
-	arm_smmu_cmdq_issue_cmd(smmu, &cmd);
-	__arm_smmu_tlb_sync(smmu);
+	arm_smmu_cmdq_issue_cmd_with_sync(smmu, &cmd);
 }
 
 static struct iommu_pasid_sync_ops arm_smmu_ctx_sync = {
@@ -3022,6 +3073,18 @@ static int arm_smmu_domain_set_attr(struct iommu_domain *domain,
 	case IOMMU_DOMAIN_DMA:
 		switch(attr) {
 		case DOMAIN_ATTR_DMA_USE_FLUSH_QUEUE:
+			if (smmu_domain->pgtbl_ops) {
+				struct io_pgtable *iop;
+
+				/* In use: see iommu_dma_enable_fq() */
+				if (!*(int *)data) {
+					ret = -EBUSY;
+					break;
+				}
+				iop = io_pgtable_ops_to_pgtable(
+						smmu_domain->pgtbl_ops);
+				iop->cfg.quirks |= IO_PGTABLE_QUIRK_NON_STRICT;
+			}
 			smmu_domain->non_strict = *(int *)data;
 			break;
 		default:
@@ -4023,15 +4086,15 @@ static int arm_smmu_device_hw_probe(struct arm_smmu_device *smmu)
 	/* Queue sizes, capped to ensure natural alignment */
 	smmu->cmdq.q.llq.max_n_shift = min_t(u32, CMDQ_MAX_SZ_SHIFT,
 					     FIELD_GET(IDR1_CMDQS, reg));
-	if (smmu->cmdq.q.llq.max_n_shift < ilog2(BITS_PER_LONG)) {
+	if (smmu->cmdq.q.llq.max_n_shift <= ilog2(CMDQ_BATCH_ENTRIES)) {
 		/*
-		 * The cmdq valid_map relies on the total number of entries
-		 * being a multiple of BITS_PER_LONG. There's also no way
-		 * we can handle the weird alignment restrictions on the
-		 * base pointer for a unit-length queue.
+		 * We don't support splitting up batches, so one batch of
+		 * commands plus an extra sync needs to fit inside the command
+		 * queue. There's also no way we can handle the weird alignment
+		 * restrictions on the base pointer for a unit-length queue.
 		 */
-		dev_err(smmu->dev, "command queue size < %d entries not supported\n",
-			BITS_PER_LONG);
+		dev_err(smmu->dev, "command queue size <= %d entries not supported\n",
+			CMDQ_BATCH_ENTRIES);
 		return -ENXIO;
 	}
 
@@ -1578,6 +1578,18 @@ static int arm_smmu_domain_set_attr(struct iommu_domain *domain,
 	case IOMMU_DOMAIN_DMA:
 		switch (attr) {
 		case DOMAIN_ATTR_DMA_USE_FLUSH_QUEUE:
+			if (smmu_domain->pgtbl_ops) {
+				struct io_pgtable *iop;
+
+				/* In use: see iommu_dma_enable_fq() */
+				if (!*(int *)data) {
+					ret = -EBUSY;
+					break;
+				}
+				iop = io_pgtable_ops_to_pgtable(
+						smmu_domain->pgtbl_ops);
+				iop->cfg.quirks |= IO_PGTABLE_QUIRK_NON_STRICT;
+			}
 			smmu_domain->non_strict = *(int *)data;
 			break;
 		default:
@@ -342,6 +342,42 @@ int iommu_dma_init_domain(struct iommu_domain *domain, dma_addr_t base,
 }
 EXPORT_SYMBOL(iommu_dma_init_domain);
 
+/**
+ * iommu_dma_enable_fq - Switch a DMA domain in use to deferred invalidation
+ * @domain: IOMMU domain previously prepared by iommu_get_dma_cookie()
+ *
+ * From here on, unmapped IOVAs are held in the flush queue until the next
+ * flush_iotlb_all() instead of being synced on every unmap. Only then may
+ * the IOMMU driver be told to stop invalidating on unmap. A domain which
+ * isn't initialised yet picks the mode up from its attribute instead.
+ */
+int iommu_dma_enable_fq(struct iommu_domain *domain)
+{
+	struct iommu_dma_cookie *cookie = domain->iova_cookie;
+	struct iova_domain *iovad;
+	int ret;
+
+	if (!cookie || cookie->type != IOMMU_DMA_IOVA_COOKIE)
+		return -EINVAL;
+
+	iovad = &cookie->iovad;
+	if (cookie->fq_domain || !iovad->start_pfn)
+		return 0;
+
+	if (!domain->ops->flush_iotlb_all)
+		return -ENODEV;
+
+	ret = init_iova_flush_queue(iovad, iommu_dma_flush_iotlb_all, NULL);
+	if (ret)
+		return ret;
+
+	/* The queue and its timer must be set up before unmaps use them */
+	smp_wmb();
+	WRITE_ONCE(cookie->fq_domain, domain);
+	return 0;
+}
+EXPORT_SYMBOL(iommu_dma_enable_fq);
+
 /**
  * dma_info_to_prot - Translate DMA API directions and attributes to IOMMU API
  *                    page flags.
@@ -7,10 +7,15 @@
 
 #include <linux/iommu.h>
 #include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/moduleparam.h>
 #include <linux/sched/mm.h>
 #include <linux/slab.h>
+#include <linux/timekeeping.h>
 #include <linux/workqueue.h>
 
+#include <trace/events/iommu.h>
+
 /**
  * struct iopf_queue - IO Page Fault queue
  * @wq: the fault workqueue
@@ -46,10 +51,34 @@ struct iopf_group {
 	struct iopf_context		last_fault;
 	struct list_head		faults;
 	struct work_struct		work;
+	u64				queued_ns;
+};
+
+/*
+ * State carried across the faults of a group. Consecutive faults on the same
+ * PASID share the mm reference and mmap_sem, and faults inside the range that
+ * was last faulted in, with no more access than it was faulted in for, are
+ * answered without walking the page tables again.
+ */
+struct iopf_mm_ctx {
+	int				pasid;
+	struct mm_struct		*mm;
+	unsigned long			start;
+	unsigned long			end;
+	unsigned int			fault_flags;
 };
 
 int enable_iopf_hipri __read_mostly;
 
+/*
+ * Accelerator jobs stream through fresh buffers, so a page request is usually
+ * followed by requests for the next pages. Fault those in along with it.
+ */
+static unsigned int iopf_fault_around_pages = 16;
+module_param_named(fault_around_pages, iopf_fault_around_pages, uint, 0644);
+MODULE_PARM_DESC(fault_around_pages,
+		 "Pages after a device page fault to fault in with it (16)");
+
 static int iopf_complete(struct device *dev, struct iommu_fault_event *evt,
 			 enum page_response_code status)
 {
@@ -65,8 +94,69 @@ static int iopf_complete(struct device *dev, struct iommu_fault_event *evt,
 	return iommu_page_response(dev, &resp);
 }
 
+static void iopf_mm_ctx_put(struct iopf_mm_ctx *ctx)
+{
+	if (!ctx->mm)
+		return;
+
+	up_read(&ctx->mm->mmap_sem);
+
+	/*
+	 * If the process exits while we're handling the fault on its mm, we
+	 * can't do mmput(). exit_mmap() would release the MMU notifier, calling
+	 * iommu_notifier_release(), which has to flush the fault queue that
+	 * we're executing on... So mmput_async() moves the release of the mm to
+	 * another thread, if we're the last user.
+	 */
+	mmput_async(ctx->mm);
+	ctx->mm = NULL;
+}
+
+static struct mm_struct *iopf_mm_ctx_get(struct iopf_mm_ctx *ctx, int pasid)
+{
+	if (ctx->mm && ctx->pasid == pasid)
+		return ctx->mm;
+
+	iopf_mm_ctx_put(ctx);
+
+	ctx->mm = iommu_sva_find(pasid);
+	if (!ctx->mm)
+		return NULL;
+
+	ctx->pasid = pasid;
+	ctx->start = ctx->end = 0;
+	down_read(&ctx->mm->mmap_sem);
+
+	return ctx->mm;
+}
+
+/* Populate the pages following @addr in @vma, without pinning them */
+static unsigned long iopf_fault_around(struct mm_struct *mm,
+				       struct vm_area_struct *vma,
+				       unsigned long addr,
+				       unsigned int fault_flags)
+{
+	unsigned long start = (addr & PAGE_MASK) + PAGE_SIZE;
+	unsigned long nr = READ_ONCE(iopf_fault_around_pages);
+	unsigned int gup_flags = 0;
+	long ret;
+
+	if (!nr || start >= vma->vm_end ||
+	    vma->vm_flags & (VM_IO | VM_PFNMAP))
+		return start;
+
+	nr = min(nr, (vma->vm_end - start) >> PAGE_SHIFT);
+	if (fault_flags & FAULT_FLAG_WRITE)
+		gup_flags |= FOLL_WRITE;
+
+	ret = get_user_pages_remote(NULL, mm, start, nr, gup_flags, NULL,
+				    NULL, NULL);
+
+	return ret > 0 ? start + (ret << PAGE_SHIFT) : start;
+}
+
 static enum page_response_code
-iopf_handle_single(struct iopf_context *fault)
+iopf_handle_single(struct iopf_context *fault, struct iopf_mm_ctx *ctx)
 {
 	int ret;
 	struct mm_struct *mm;
@@ -79,17 +169,10 @@ iopf_handle_single(struct iopf_context *fault)
 	if (!evt->pasid_valid)
 		return status;
 
-	mm = iommu_sva_find(evt->pasid);
+	mm = iopf_mm_ctx_get(ctx, evt->pasid);
 	if (!mm)
 		return status;
 
-	down_read(&mm->mmap_sem);
-
-	vma = find_extend_vma(mm, evt->addr);
-	if (!vma)
-		/* Unmapped area */
-		goto out_put_mm;
-
 	if (evt->prot & IOMMU_FAULT_READ)
 		access_flags |= VM_READ;
 
@@ -106,34 +189,39 @@ iopf_handle_single(struct iopf_context *fault)
 	if (!(evt->prot & IOMMU_FAULT_PRIV))
 		fault_flags |= FAULT_FLAG_USER;
 
+	/* Faulted in already by this group */
+	if (evt->addr >= ctx->start && evt->addr < ctx->end &&
+	    !(fault_flags & ~ctx->fault_flags))
+		return IOMMU_PAGE_RESP_SUCCESS;
+
+	vma = find_extend_vma(mm, evt->addr);
+	if (!vma)
+		/* Unmapped area */
+		return status;
+
 	if (access_flags & ~vma->vm_flags)
 		/* Access fault */
-		goto out_put_mm;
+		return status;
 
 	ret = handle_mm_fault(vma, evt->addr, fault_flags);
-	status = ret & VM_FAULT_ERROR ? IOMMU_PAGE_RESP_INVALID :
-		IOMMU_PAGE_RESP_SUCCESS;
-
-out_put_mm:
-	up_read(&mm->mmap_sem);
+	if (ret & VM_FAULT_ERROR)
+		return status;
 
-	/*
-	 * If the process exits while we're handling the fault on its mm, we
-	 * can't do mmput(). exit_mmap() would release the MMU notifier, calling
-	 * iommu_notifier_release(), which has to flush the fault queue that
-	 * we're executing on... So mmput_async() moves the release of the mm to
-	 * another thread, if we're the last user.
-	 */
-	mmput_async(mm);
+	ctx->start = evt->addr & PAGE_MASK;
+	ctx->end = iopf_fault_around(mm, vma, evt->addr, fault_flags);
+	ctx->fault_flags = fault_flags;
 
-	return status;
+	return IOMMU_PAGE_RESP_SUCCESS;
 }
 
 static void iopf_handle_group(struct work_struct *work)
 {
 	struct iopf_group *group;
 	struct iopf_context *fault, *next;
+	struct iopf_mm_ctx ctx = {};
 	enum page_response_code status = IOMMU_PAGE_RESP_SUCCESS;
+	unsigned int nr_faults = 0;
+	u64 start_ns = ktime_get_ns();
 
 	group = container_of(work, struct iopf_group, work);
 
@@ -144,13 +232,18 @@ static void iopf_handle_group(struct work_struct *work)
 		 * group if there is an error.
 		 */
 		if (status == IOMMU_PAGE_RESP_SUCCESS)
-			status = iopf_handle_single(fault);
+			status = iopf_handle_single(fault, &ctx);
 
+		nr_faults++;
 		if (!evt->last_req)
 			kfree(fault);
 	}
+	iopf_mm_ctx_put(&ctx);
 
 	iopf_complete(group->last_fault.dev, &group->last_fault.evt, status);
+	trace_iopf_group_handled(group->last_fault.dev, &group->last_fault.evt,
+				 nr_faults, start_ns - group->queued_ns,
+				 ktime_get_ns() - start_ns, status);
 	kfree(group);
 }
 
@@ -232,6 +325,7 @@ int iommu_queue_iopf(struct iommu_fault_event *evt, void *cookie)
 	INIT_LIST_HEAD(&group->faults);
 	list_add(&group->last_fault.head, &group->faults);
 	INIT_WORK(&group->work, iopf_handle_group);
+	group->queued_ns = ktime_get_ns();
 
 	/* See if we have partial faults for this group */
 	list_for_each_entry_safe(fault, next, &iopf_param->partial, head) {
@@ -247,6 +341,55 @@ int iommu_queue_iopf(struct iommu_fault_event *evt, void *cookie)
 }
 EXPORT_SYMBOL_GPL(iommu_queue_iopf);
 
+/**
+ * iopf_prefault - Fault in part of a bound address space ahead of DMA
+ * @pasid: PASID of the address space
+ * @addr: start of the range
+ * @size: size of the range
+ * @prot: IOMMU_FAULT_READ and/or IOMMU_FAULT_WRITE
+ *
+ * Device drivers that know which buffers a job is going to touch may call this
+ * before submitting it, instead of having the device fault on every page.
+ * Nothing is pinned: if pages are reclaimed again before the device gets to
+ * them, it faults on them as usual.
+ *
+ * Return 0 if the whole range is faulted in, an error otherwise.
+ */
+int iopf_prefault(int pasid, unsigned long addr, size_t size,
+		  unsigned int prot)
+{
+	struct mm_struct *mm;
+	unsigned long start = addr & PAGE_MASK;
+	unsigned int gup_flags = 0;
+	unsigned long nr;
+	long ret;
+
+	if (!size || addr + size < addr)
+		return -EINVAL;
+
+	nr = (PAGE_ALIGN(addr + size) - start) >> PAGE_SHIFT;
+	if (prot & IOMMU_FAULT_WRITE)
+		gup_flags |= FOLL_WRITE;
+
+	mm = iommu_sva_find(pasid);
+	if (!mm)
+		return -ESRCH;
+
+	down_read(&mm->mmap_sem);
+	ret = get_user_pages_remote(NULL, mm, start, nr, gup_flags, NULL,
+				    NULL, NULL);
+	up_read(&mm->mmap_sem);
+
+	/* See iopf_mm_ctx_put() */
+	mmput_async(mm);
+
+	if (ret < 0)
+		return ret;
+
+	return ret == nr ? 0 : -EFAULT;
+}
+EXPORT_SYMBOL_GPL(iopf_prefault);
+
 /**
  * iopf_queue_flush_dev - Ensure that all queued faults have been processed
  * @dev: the endpoint whose faults need to be flushed.
@@ -19,6 +19,7 @@
 #define pr_fmt(fmt)    "iommu: " fmt
 
 #include <linux/device.h>
+#include <linux/dma-iommu.h>
 #include <linux/kernel.h>
 #include <linux/bug.h>
 #include <linux/types.h>
@@ -312,6 +313,14 @@ static ssize_t iommu_group_show_resv_regions(struct iommu_group *group,
 	return (str - buf);
 }
 
+static bool iommu_domain_uses_fq(struct iommu_domain *domain)
+{
+	int attr;
+
+	return !iommu_domain_get_attr(domain, DOMAIN_ATTR_DMA_USE_FLUSH_QUEUE,
+				      &attr) && attr;
+}
+
 static ssize_t iommu_group_show_type(struct iommu_group *group,
 				     char *buf)
 {
@@ -329,7 +338,10 @@ static ssize_t iommu_group_show_type(struct iommu_group *group,
 			type = "unmanaged\n";
 			break;
 		case IOMMU_DOMAIN_DMA:
-			type = "DMA\n";
+			if (iommu_domain_uses_fq(group->default_domain))
+				type = "DMA-FQ\n";
+			else
+				type = "DMA\n";
 			break;
 		}
 	}
@@ -338,12 +350,51 @@ static ssize_t iommu_group_show_type(struct iommu_group *group,
 	return strlen(type);
 }
 
+/*
+ * Writing "DMA-FQ" switches a strict DMA default domain to deferred TLB
+ * invalidation through the flush queue, as iommu.strict=0 does at boot for
+ * every group. Going back to strict with drivers bound isn't supported.
+ */
+static ssize_t iommu_group_store_type(struct iommu_group *group,
+				      const char *buf, size_t count)
+{
+	struct iommu_domain *dom;
+	int attr, ret = -EINVAL;
+
+	if (!sysfs_streq(buf, "DMA-FQ"))
+		return -EINVAL;
+
+	mutex_lock(&group->mutex);
+	dom = group->default_domain;
+	if (!dom || dom->type != IOMMU_DOMAIN_DMA)
+		goto out_unlock;
+
+	/* Not supported by the driver, or lazy already */
+	ret = iommu_domain_get_attr(dom, DOMAIN_ATTR_DMA_USE_FLUSH_QUEUE,
+				    &attr);
+	if (ret || attr)
+		goto out_unlock;
+
+	/* dma-iommu must defer IOVA reuse before the driver stops syncing */
+	ret = iommu_dma_enable_fq(dom);
+	if (ret)
+		goto out_unlock;
+
+	attr = 1;
+	ret = iommu_domain_set_attr(dom, DOMAIN_ATTR_DMA_USE_FLUSH_QUEUE,
+				    &attr);
+out_unlock:
+	mutex_unlock(&group->mutex);
+	return ret ?: count;
+}
+
 static IOMMU_GROUP_ATTR(name, S_IRUGO, iommu_group_show_name, NULL);
 
 static IOMMU_GROUP_ATTR(reserved_regions, 0444,
 			iommu_group_show_resv_regions, NULL);
 
-static IOMMU_GROUP_ATTR(type, 0444, iommu_group_show_type, NULL);
+static IOMMU_GROUP_ATTR(type, 0644, iommu_group_show_type,
+			iommu_group_store_type);
 
 static void iommu_group_release(struct kobject *kobj)
 {
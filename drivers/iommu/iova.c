@@ -23,6 +23,8 @@
 #include <linux/smp.h>
 #include <linux/bitops.h>
 #include <linux/cpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 /* The anchor node sits above the top of the usable address space */
 #define IOVA_ANCHOR	~0UL
@@ -35,6 +37,7 @@ static unsigned long iova_rcache_get(struct iova_domain *iovad,
 				     unsigned long limit_pfn);
 static void init_iova_rcaches(struct iova_domain *iovad);
 static void free_iova_rcaches(struct iova_domain *iovad);
+static void free_global_cached_iovas(struct iova_domain *iovad);
 static void fq_destroy_all_entries(struct iova_domain *iovad);
 static void fq_flush_timeout(struct timer_list *t);
 
@@ -462,6 +465,7 @@ alloc_iova_fast(struct iova_domain *iovad, unsigned long size,
 		flush_rcache = false;
 		for_each_online_cpu(cpu)
 			free_cpu_cached_iovas(cpu, iovad);
+		free_global_cached_iovas(iovad);
 		goto retry;
 	}
 
@@ -792,15 +796,28 @@ split_and_remove_iova(struct iova_domain *iovad, struct iova *iova,
  * Magazine caches for IOVA ranges.  For an introduction to magazines,
  * see the USENIX 2001 paper "Magazines and Vmem: Extending the Slab
  * Allocator to Many CPUs and Arbitrary Resources" by Bonwick and Adams.
- * For simplicity, we use a static magazine size and don't implement the
- * dynamic size tuning described in the paper.
+ * Magazine sizes are fixed per bin rather than tuned at runtime as in the
+ * paper, but the depot does grow: when it overflows after having run dry,
+ * CPUs are trading magazines faster than it can hold them, so it doubles
+ * (up to IOVA_DEPOT_MAX_PER_CPU magazines per possible CPU) instead of
+ * freeing the overflowing magazine back to the rbtree.
  */
 
 #define IOVA_MAG_SIZE 128
 
+/*
+ * Single and two page ranges make up the bulk of streaming DMA mappings, so
+ * their bins get magazines filling a 4KiB allocation.
+ */
+#define IOVA_MAG_SIZE_HOT 510
+#define IOVA_MAG_HOT_ORDERS 2
+
+#define IOVA_DEPOT_MAX_PER_CPU 4
+
 struct iova_magazine {
 	unsigned long size;
-	unsigned long pfns[IOVA_MAG_SIZE];
+	struct iova_magazine *next;	/* in the depot */
+	unsigned long pfns[];
 };
 
 struct iova_cpu_rcache {
@@ -809,9 +826,24 @@ struct iova_cpu_rcache {
 	struct iova_magazine *prev;
 };
 
-static struct iova_magazine *iova_magazine_alloc(gfp_t flags)
+/* Per-bin rcache use and rbtree fallbacks, see iova/rcache_stats in debugfs */
+struct iova_rcache_stats {
+	unsigned long alloc;
+	unsigned long alloc_miss;
+	unsigned long free;
+	unsigned long free_miss;
+	unsigned long depot_grow;
+};
+
+static DEFINE_PER_CPU(struct iova_rcache_stats [IOVA_RANGE_CACHE_MAX_SIZE],
+		      iova_rcache_stat);
+
+static struct iova_magazine *iova_magazine_alloc(struct iova_rcache *rcache,
+						 gfp_t flags)
 {
-	return kzalloc(sizeof(struct iova_magazine), flags);
+	struct iova_magazine *mag;
+
+	return kzalloc(struct_size(mag, pfns, rcache->mag_size), flags);
 }
 
 static void iova_magazine_free(struct iova_magazine *mag)
@@ -844,9 +876,10 @@ iova_magazine_free_pfns(struct iova_magazine *mag, struct iova_domain *iovad)
 	mag->size = 0;
 }
 
-static bool iova_magazine_full(struct iova_magazine *mag)
+static bool iova_magazine_full(struct iova_rcache *rcache,
+			       struct iova_magazine *mag)
 {
-	return (mag && mag->size == IOVA_MAG_SIZE);
+	return (mag && mag->size == rcache->mag_size);
 }
 
 static bool iova_magazine_empty(struct iova_magazine *mag)
@@ -874,13 +907,49 @@ static unsigned long iova_magazine_pop(struct iova_magazine *mag,
 	return pfn;
 }
 
-static void iova_magazine_push(struct iova_magazine *mag, unsigned long pfn)
+static void iova_magazine_push(struct iova_rcache *rcache,
+			       struct iova_magazine *mag, unsigned long pfn)
 {
-	BUG_ON(iova_magazine_full(mag));
+	BUG_ON(iova_magazine_full(rcache, mag));
 
 	mag->pfns[mag->size++] = pfn;
 }
 
+static struct iova_magazine *iova_depot_pop(struct iova_rcache *rcache)
+{
+	struct iova_magazine *mag = rcache->depot;
+
+	rcache->depot = mag->next;
+	mag->next = NULL;
+	rcache->depot_size--;
+	return mag;
+}
+
+static void iova_depot_push(struct iova_rcache *rcache,
+			    struct iova_magazine *mag)
+{
+	mag->next = rcache->depot;
+	rcache->depot = mag;
+	rcache->depot_size++;
+}
+
+/*
+ * Called with rcache->lock held when the depot is full.  Grow it if it ran
+ * dry since the last time it grew, returning true if there is room now.
+ */
+static bool iova_depot_grow(struct iova_rcache *rcache)
+{
+	unsigned long limit = max_t(unsigned long, MAX_GLOBAL_MAGS,
+			IOVA_DEPOT_MAX_PER_CPU * num_possible_cpus());
+
+	if (!rcache->depot_starved || rcache->depot_max >= limit)
+		return false;
+
+	rcache->depot_max = min(rcache->depot_max * 2, limit);
+	rcache->depot_starved = false;
+	return true;
+}
+
 static void init_iova_rcaches(struct iova_domain *iovad)
 {
 	struct iova_cpu_rcache *cpu_rcache;
@@ -892,14 +961,21 @@ static void init_iova_rcaches(struct iova_domain *iovad)
 		rcache = &iovad->rcaches[i];
 		spin_lock_init(&rcache->lock);
 		rcache->depot_size = 0;
+		rcache->depot_max = MAX_GLOBAL_MAGS;
+		rcache->depot_starved = false;
+		rcache->mag_size = i < IOVA_MAG_HOT_ORDERS ?
+				   IOVA_MAG_SIZE_HOT : IOVA_MAG_SIZE;
+		rcache->depot = NULL;
 		rcache->cpu_rcaches = __alloc_percpu(sizeof(*cpu_rcache), cache_line_size());
 		if (WARN_ON(!rcache->cpu_rcaches))
 			continue;
 		for_each_possible_cpu(cpu) {
 			cpu_rcache = per_cpu_ptr(rcache->cpu_rcaches, cpu);
 			spin_lock_init(&cpu_rcache->lock);
-			cpu_rcache->loaded = iova_magazine_alloc(GFP_KERNEL);
-			cpu_rcache->prev = iova_magazine_alloc(GFP_KERNEL);
+			cpu_rcache->loaded = iova_magazine_alloc(rcache,
+								 GFP_KERNEL);
+			cpu_rcache->prev = iova_magazine_alloc(rcache,
+							       GFP_KERNEL);
 		}
 	}
 }
@@ -922,19 +998,23 @@ static bool __iova_rcache_insert(struct iova_domain *iovad,
 	cpu_rcache = raw_cpu_ptr(rcache->cpu_rcaches);
 	spin_lock_irqsave(&cpu_rcache->lock, flags);
 
-	if (!iova_magazine_full(cpu_rcache->loaded)) {
+	if (!iova_magazine_full(rcache, cpu_rcache->loaded)) {
 		can_insert = true;
-	} else if (!iova_magazine_full(cpu_rcache->prev)) {
+	} else if (!iova_magazine_full(rcache, cpu_rcache->prev)) {
 		swap(cpu_rcache->prev, cpu_rcache->loaded);
 		can_insert = true;
 	} else {
-		struct iova_magazine *new_mag = iova_magazine_alloc(GFP_ATOMIC);
+		struct iova_magazine *new_mag = iova_magazine_alloc(rcache,
+								GFP_ATOMIC);
 
 		if (new_mag) {
 			spin_lock(&rcache->lock);
-			if (rcache->depot_size < MAX_GLOBAL_MAGS) {
-				rcache->depot[rcache->depot_size++] =
-						cpu_rcache->loaded;
+			if (rcache->depot_size < rcache->depot_max) {
+				iova_depot_push(rcache, cpu_rcache->loaded);
+			} else if (iova_depot_grow(rcache)) {
+				iova_depot_push(rcache, cpu_rcache->loaded);
+				this_cpu_inc(iova_rcache_stat[rcache -
+						iovad->rcaches].depot_grow);
 			} else {
 				mag_to_free = cpu_rcache->loaded;
 			}
@@ -946,7 +1026,7 @@ static bool __iova_rcache_insert(struct iova_domain *iovad,
 	}
 
 	if (can_insert)
-		iova_magazine_push(cpu_rcache->loaded, iova_pfn);
+		iova_magazine_push(rcache, cpu_rcache->loaded, iova_pfn);
 
 	spin_unlock_irqrestore(&cpu_rcache->lock, flags);
 
@@ -962,11 +1042,17 @@ static bool iova_rcache_insert(struct iova_domain *iovad, unsigned long pfn,
 			       unsigned long size)
 {
 	unsigned int log_size = order_base_2(size);
+	bool ret;
 
 	if (log_size >= IOVA_RANGE_CACHE_MAX_SIZE)
 		return false;
 
-	return __iova_rcache_insert(iovad, &iovad->rcaches[log_size], pfn);
+	ret = __iova_rcache_insert(iovad, &iovad->rcaches[log_size], pfn);
+	this_cpu_inc(iova_rcache_stat[log_size].free);
+	if (!ret)
+		this_cpu_inc(iova_rcache_stat[log_size].free_miss);
+
+	return ret;
 }
 
 /*
@@ -994,8 +1080,10 @@ static unsigned long __iova_rcache_get(struct iova_rcache *rcache,
 		spin_lock(&rcache->lock);
 		if (rcache->depot_size > 0) {
 			iova_magazine_free(cpu_rcache->loaded);
-			cpu_rcache->loaded = rcache->depot[--rcache->depot_size];
+			cpu_rcache->loaded = iova_depot_pop(rcache);
 			has_pfn = true;
+		} else {
+			rcache->depot_starved = true;
 		}
 		spin_unlock(&rcache->lock);
 	}
@@ -1018,11 +1106,17 @@ static unsigned long iova_rcache_get(struct iova_domain *iovad,
 				     unsigned long limit_pfn)
 {
 	unsigned int log_size = order_base_2(size);
+	unsigned long pfn;
 
 	if (log_size >= IOVA_RANGE_CACHE_MAX_SIZE)
 		return 0;
 
-	return __iova_rcache_get(&iovad->rcaches[log_size], limit_pfn - size);
+	pfn = __iova_rcache_get(&iovad->rcaches[log_size], limit_pfn - size);
+	this_cpu_inc(iova_rcache_stat[log_size].alloc);
+	if (!pfn)
+		this_cpu_inc(iova_rcache_stat[log_size].alloc_miss);
+
+	return pfn;
 }
 
 /*
@@ -1033,7 +1127,7 @@ static void free_iova_rcaches(struct iova_domain *iovad)
 	struct iova_rcache *rcache;
 	struct iova_cpu_rcache *cpu_rcache;
 	unsigned int cpu;
-	int i, j;
+	int i;
 
 	for (i = 0; i < IOVA_RANGE_CACHE_MAX_SIZE; ++i) {
 		rcache = &iovad->rcaches[i];
@@ -1043,8 +1137,8 @@ static void free_iova_rcaches(struct iova_domain *iovad)
 			iova_magazine_free(cpu_rcache->prev);
 		}
 		free_percpu(rcache->cpu_rcaches);
-		for (j = 0; j < rcache->depot_size; ++j)
-			iova_magazine_free(rcache->depot[j]);
+		while (rcache->depot_size)
+			iova_magazine_free(iova_depot_pop(rcache));
 	}
 }
 
@@ -1068,5 +1162,72 @@ void free_cpu_cached_iovas(unsigned int cpu, struct iova_domain *iovad)
 	}
 }
 
+/*
+ * free all the IOVA ranges held in the depots, which can be large after
+ * they have grown
+ */
+static void free_global_cached_iovas(struct iova_domain *iovad)
+{
+	struct iova_magazine *mag;
+	struct iova_rcache *rcache;
+	unsigned long flags;
+	int i;
+
+	for (i = 0; i < IOVA_RANGE_CACHE_MAX_SIZE; ++i) {
+		rcache = &iovad->rcaches[i];
+		spin_lock_irqsave(&rcache->lock, flags);
+		while (rcache->depot_size) {
+			mag = iova_depot_pop(rcache);
+			iova_magazine_free_pfns(mag, iovad);
+			iova_magazine_free(mag);
+		}
+		spin_unlock_irqrestore(&rcache->lock, flags);
+	}
+}
+
+static int iova_rcache_stats_show(struct seq_file *m, void *v)
+{
+	struct iova_rcache_stats *s, sum;
+	unsigned int cpu;
+	int i;
+
+	seq_puts(m, "pages alloc alloc_miss free free_miss depot_grow\n");
+	for (i = 0; i < IOVA_RANGE_CACHE_MAX_SIZE; ++i) {
+		memset(&sum, 0, sizeof(sum));
+		for_each_possible_cpu(cpu) {
+			s = &per_cpu(iova_rcache_stat, cpu)[i];
+			sum.alloc += s->alloc;
+			sum.alloc_miss += s->alloc_miss;
+			sum.free += s->free;
+			sum.free_miss += s->free_miss;
+			sum.depot_grow += s->depot_grow;
+		}
+		seq_printf(m, "%5u %lu %lu %lu %lu %lu\n", 1U << i,
+			   sum.alloc, sum.alloc_miss, sum.free, sum.free_miss,
+			   sum.depot_grow);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(iova_rcache_stats);
+
+static struct dentry *iova_debugfs_dir;
+
+static int __init iova_debugfs_init(void)
+{
+	iova_debugfs_dir = debugfs_create_dir("iova", NULL);
+	debugfs_create_file("rcache_stats", 0444, iova_debugfs_dir, NULL,
+			    &iova_rcache_stats_fops);
+	return 0;
+}
+
+static void __exit iova_debugfs_exit(void)
+{
+	debugfs_remove_recursive(iova_debugfs_dir);
+}
+
+module_init(iova_debugfs_init);
+module_exit(iova_debugfs_exit);
+
 MODULE_AUTHOR("Anil S Keshavamurthy <anil.s.keshavamurthy@intel.com>");
 MODULE_LICENSE("GPL");
@@ -13,6 +13,8 @@
 #include <linux/jiffies.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/seqlock.h>
 #include <linux/vmalloc.h>
 #include <linux/math64.h>
 
@@ -35,10 +37,15 @@ static unsigned safe_mod(unsigned n, unsigned d)
 
 /*----------------------------------------------------------------*/
 
+/*
+ * The indexes are full words: the bitfields they replace made struct entry
+ * no smaller, but capped the entry space at 2^28 entries.  hash_next is
+ * also read locklessly, which needs it to be a whole word.
+ */
 struct entry {
-	unsigned hash_next:28;
-	unsigned prev:28;
-	unsigned next:28;
+	unsigned hash_next;
+	unsigned prev;
+	unsigned next;
 	unsigned level:6;
 	bool dirty:1;
 	bool allocated:1;
@@ -50,7 +57,7 @@ struct entry {
 
 /*----------------------------------------------------------------*/
 
-#define INDEXER_NULL ((1u << 28u) - 1u)
+#define INDEXER_NULL UINT_MAX
 
 /*
  * An entry_space manages a set of entries that we use for the queues.
@@ -574,6 +581,9 @@ struct smq_hash_table {
 	struct entry_space *es;
 	unsigned long long hash_bits;
 	unsigned *buckets;
+
+	/* lets h_lookup_lockless() detect concurrent changes to the chains */
+	seqcount_t seq;
 };
 
 /*
@@ -585,6 +595,7 @@ static int h_init(struct smq_hash_table *ht, struct entry_space *es, unsigned nr
 	unsigned i, nr_buckets;
 
 	ht->es = es;
+	seqcount_init(&ht->seq);
 	nr_buckets = roundup_pow_of_two(max(nr_entries / 4u, 16u));
 	ht->hash_bits = __ffs(nr_buckets);
 
@@ -615,14 +626,17 @@ static struct entry *h_next(struct smq_hash_table *ht, struct entry *e)
 
 static void __h_insert(struct smq_hash_table *ht, unsigned bucket, struct entry *e)
 {
-	e->hash_next = ht->buckets[bucket];
-	ht->buckets[bucket] = to_index(ht->es, e);
+	WRITE_ONCE(e->hash_next, ht->buckets[bucket]);
+	WRITE_ONCE(ht->buckets[bucket], to_index(ht->es, e));
 }
 
 static void h_insert(struct smq_hash_table *ht, struct entry *e)
 {
 	unsigned h = hash_64(from_oblock(e->oblock), ht->hash_bits);
+
+	write_seqcount_begin(&ht->seq);
 	__h_insert(ht, h, e);
+	write_seqcount_end(&ht->seq);
 }
 
 static struct entry *__h_lookup(struct smq_hash_table *ht, unsigned h, dm_oblock_t oblock,
@@ -645,9 +659,9 @@ static void __h_unlink(struct smq_hash_table *ht, unsigned h,
 		       struct entry *e, struct entry *prev)
 {
 	if (prev)
-		prev->hash_next = e->hash_next;
+		WRITE_ONCE(prev->hash_next, e->hash_next);
 	else
-		ht->buckets[h] = e->hash_next;
+		WRITE_ONCE(ht->buckets[h], e->hash_next);
 }
 
 /*
@@ -664,10 +678,40 @@ static struct entry *h_lookup(struct smq_hash_table *ht, dm_oblock_t oblock)
 		 * Move to the front because this entry is likely
 		 * to be hit again.
 		 */
+		write_seqcount_begin(&ht->seq);
 		__h_unlink(ht, h, e, prev);
 		__h_insert(ht, h, e);
+		write_seqcount_end(&ht->seq);
+	}
+
+	return e;
+}
+
+/*
+ * Lookup without the policy lock.  Entries live in a static array, so a
+ * walk racing with an update can't fault; it may however see a chain in
+ * transition, which the sequence count catches.  Doesn't move the entry to
+ * the front of its bucket.
+ */
+static struct entry *h_lookup_lockless(struct smq_hash_table *ht, dm_oblock_t oblock)
+{
+	unsigned h = hash_64(from_oblock(oblock), ht->hash_bits);
+	struct entry *e;
+	unsigned seq;
+
+retry:
+	seq = read_seqcount_begin(&ht->seq);
+	for (e = to_entry(ht->es, READ_ONCE(ht->buckets[h])); e;
+	     e = to_entry(ht->es, READ_ONCE(e->hash_next))) {
+		if (read_seqcount_retry(&ht->seq, seq))
+			goto retry;
+		if (e->oblock == oblock)
+			break;
 	}
 
+	if (read_seqcount_retry(&ht->seq, seq))
+		goto retry;
+
 	return e;
 }
 
@@ -681,8 +725,11 @@ static void h_remove(struct smq_hash_table *ht, struct entry *e)
 	 * iterate the bucket to remove an item.
 	 */
 	e = __h_lookup(ht, h, e->oblock, &prev);
-	if (e)
+	if (e) {
+		write_seqcount_begin(&ht->seq);
 		__h_unlink(ht, h, e, prev);
+		write_seqcount_end(&ht->seq);
+	}
 }
 
 /*----------------------------------------------------------------*/
@@ -791,6 +838,24 @@ static struct entry *get_entry(struct entry_alloc *ea, unsigned index)
 #define HOTSPOT_UPDATE_PERIOD (HZ)
 #define CACHE_UPDATE_PERIOD (60ul * HZ)
 
+/*
+ * Cache hits are served without taking the policy lock.  The requeueing a
+ * hit implies is recorded in a per-cpu batch and replayed under the lock
+ * once the batch fills up or a tick has passed.
+ */
+#define HIT_BATCH_SIZE 32
+
+struct smq_hit {
+	unsigned cblock;
+	dm_oblock_t oblock;
+};
+
+struct smq_hit_batch {
+	unsigned tick;
+	unsigned nr;
+	struct smq_hit hits[HIT_BATCH_SIZE];
+};
+
 struct smq_policy {
 	struct dm_cache_policy policy;
 
@@ -855,6 +920,8 @@ struct smq_policy {
 	struct background_tracker *bg_work;
 
 	bool migrations_allowed;
+
+	struct smq_hit_batch __percpu *hit_batch;
 };
 
 /*----------------------------------------------------------------*/
@@ -1351,6 +1418,7 @@ static void smq_destroy(struct dm_cache_policy *p)
 {
 	struct smq_policy *mq = to_smq_policy(p);
 
+	free_percpu(mq->hit_batch);
 	btracker_destroy(mq->bg_work);
 	h_exit(&mq->hotspot_table);
 	h_exit(&mq->table);
@@ -1397,6 +1465,63 @@ static int __lookup(struct smq_policy *mq, dm_oblock_t oblock, dm_cblock_t *cblo
 	}
 }
 
+static void __flush_hits(struct smq_policy *mq, struct smq_hit_batch *b)
+{
+	unsigned i;
+	struct entry *e;
+
+	for (i = 0; i < b->nr; i++) {
+		e = get_entry(&mq->cache_alloc, b->hits[i].cblock);
+
+		/* the entry may have been demoted since */
+		if (!e->allocated || e->oblock != b->hits[i].oblock)
+			continue;
+
+		stats_level_accessed(&mq->cache_stats, e->level);
+		requeue(mq, e);
+	}
+	b->nr = 0;
+}
+
+static void record_hit(struct smq_policy *mq, struct entry *e, dm_oblock_t oblock)
+{
+	unsigned long flags;
+	struct smq_hit_batch *b;
+	unsigned tick = READ_ONCE(mq->tick);
+
+	local_irq_save(flags);
+	b = this_cpu_ptr(mq->hit_batch);
+	if (b->nr && b->tick != tick) {
+		spin_lock(&mq->lock);
+		__flush_hits(mq, b);
+		spin_unlock(&mq->lock);
+	}
+
+	if (!b->nr)
+		b->tick = tick;
+	b->hits[b->nr].cblock = from_cblock(infer_cblock(mq, e));
+	b->hits[b->nr].oblock = oblock;
+	if (++b->nr == HIT_BATCH_SIZE) {
+		spin_lock(&mq->lock);
+		__flush_hits(mq, b);
+		spin_unlock(&mq->lock);
+	}
+	local_irq_restore(flags);
+}
+
+static bool lookup_hit_lockless(struct smq_policy *mq, dm_oblock_t oblock,
+				dm_cblock_t *cblock)
+{
+	struct entry *e = h_lookup_lockless(&mq->table, oblock);
+
+	if (!e)
+		return false;
+
+	*cblock = infer_cblock(mq, e);
+	record_hit(mq, e, oblock);
+	return true;
+}
+
 static int smq_lookup(struct dm_cache_policy *p, dm_oblock_t oblock, dm_cblock_t *cblock,
 		      int data_dir, bool fast_copy,
 		      bool *background_work)
@@ -1405,6 +1530,11 @@ static int smq_lookup(struct dm_cache_policy *p, dm_oblock_t oblock, dm_cblock_t
 	unsigned long flags;
 	struct smq_policy *mq = to_smq_policy(p);
 
+	if (lookup_hit_lockless(mq, oblock, cblock)) {
+		*background_work = false;
+		return 0;
+	}
+
 	spin_lock_irqsave(&mq->lock, flags);
 	r = __lookup(mq, oblock, cblock,
 		     data_dir, fast_copy,
@@ -1424,6 +1554,9 @@ static int smq_lookup_with_work(struct dm_cache_policy *p,
 	unsigned long flags;
 	struct smq_policy *mq = to_smq_policy(p);
 
+	if (lookup_hit_lockless(mq, oblock, cblock))
+		return 0;
+
 	spin_lock_irqsave(&mq->lock, flags);
 	r = __lookup(mq, oblock, cblock, data_dir, fast_copy, work, &background_queued);
 	spin_unlock_irqrestore(&mq->lock, flags);
@@ -1739,6 +1872,11 @@ static struct dm_cache_policy *__smq_create(dm_cblock_t cache_size,
 
 	mq->cache_blocks_per_hotspot_block = div64_u64(mq->hotspot_block_size, mq->cache_block_size);
 	mq->hotspot_level_jump = 1u;
+	if ((u64)total_sentinels + mq->nr_hotspot_blocks + from_cblock(cache_size) >=
+	    INDEXER_NULL) {
+		DMERR("too many cache blocks");
+		goto bad_pool_init;
+	}
 	if (space_init(&mq->es, total_sentinels + mq->nr_hotspot_blocks + from_cblock(cache_size))) {
 		DMERR("couldn't initialize entry space");
 		goto bad_pool_init;
@@ -1806,10 +1944,16 @@ static struct dm_cache_policy *__smq_create(dm_cblock_t cache_size,
 	if (!mq->bg_work)
 		goto bad_btracker;
 
+	mq->hit_batch = alloc_percpu(struct smq_hit_batch);
+	if (!mq->hit_batch)
+		goto bad_hit_batch;
+
 	mq->migrations_allowed = migrations_allowed;
 
 	return &mq->policy;
 
+bad_hit_batch:
+	btracker_destroy(mq->bg_work);
 bad_btracker:
 	h_exit(&mq->hotspot_table);
 bad_alloc_hotspot_table:
@@ -125,11 +125,13 @@ struct iv_tcw_private {
  * and encrypts / decrypts at the same time.
  */
 enum flags { DM_CRYPT_SUSPENDED, DM_CRYPT_KEY_VALID,
-	     DM_CRYPT_SAME_CPU, DM_CRYPT_NO_OFFLOAD };
+	     DM_CRYPT_SAME_CPU, DM_CRYPT_NO_OFFLOAD,
+	     DM_CRYPT_MULTI_SECTOR };
 
 enum cipher_flags {
 	CRYPT_MODE_INTEGRITY_AEAD,	/* Use authenticated mode for cihper */
 	CRYPT_IV_LARGE_SECTORS,		/* Calculate IV from sector_size, not 512B sectors */
+	CRYPT_MULTI_SECTOR_TFM,		/* Cipher generates per-sector IVs itself */
 };
 
 /*
@@ -221,6 +223,12 @@ struct crypt_config {
 #define MAX_TAG_SIZE	480
 #define POOL_ENTRY_SIZE	512
 
+/*
+ * Scatterlist entries per direction of a multi-sector request; with
+ * page sized bio_vecs this bounds one request to 128KiB on 4KiB pages.
+ */
+#define MULTI_SECTOR_SG	32
+
 static DEFINE_SPINLOCK(dm_crypt_clients_lock);
 static unsigned dm_crypt_clients_n = 0;
 static volatile unsigned long dm_crypt_pages_per_client;
@@ -1056,6 +1064,14 @@ static unsigned int *org_tag_of_dmreq(struct crypt_config *cc,
 	return (unsigned int*)ptr;
 }
 
+static struct scatterlist *multi_sg_of_dmreq(struct crypt_config *cc,
+					    struct dm_crypt_request *dmreq)
+{
+	u8 *ptr = (u8 *)(org_tag_of_dmreq(cc, dmreq) + 1);
+	return (struct scatterlist *)ALIGN((unsigned long)ptr,
+					   __alignof__(struct scatterlist));
+}
+
 static void *tag_from_dmreq(struct crypt_config *cc,
 				struct dm_crypt_request *dmreq)
 {
@@ -1240,6 +1256,114 @@ static int crypt_convert_block_skcipher(struct crypt_config *cc,
 	return r;
 }
 
+static bool crypt_sg_contiguous(struct scatterlist *sg, unsigned int nents,
+				struct bio_vec *bv)
+{
+	struct scatterlist *last;
+
+	if (!nents)
+		return false;
+
+	last = &sg[nents - 1];
+	return sg_page(last) == bv->bv_page &&
+	       last->offset + last->length == bv->bv_offset;
+}
+
+static void crypt_sg_add(struct scatterlist *sg, unsigned int *nents,
+			 struct bio_vec *bv, unsigned int len)
+{
+	if (crypt_sg_contiguous(sg, *nents, bv))
+		sg[*nents - 1].length += len;
+	else
+		sg_set_page(&sg[(*nents)++], bv->bv_page, len, bv->bv_offset);
+}
+
+/*
+ * Encrypt / decrypt as many sectors as fit into one request when the cipher
+ * derives the IV of every sector from the IV of the first one.  The IV is the
+ * plain64 IV of the first sector followed by the little endian data unit size,
+ * see crypt_ctr_multi_sector().
+ */
+static int crypt_convert_blocks_skcipher(struct crypt_config *cc,
+					 struct convert_context *ctx,
+					 struct skcipher_request *req,
+					 unsigned int *sector_step)
+{
+	struct scatterlist *sg_in, *sg_out;
+	struct dm_crypt_request *dmreq;
+	unsigned int nents_in = 0, nents_out = 0, len = 0;
+	bool in_place = ctx->bio_in == ctx->bio_out;
+	u8 *iv, *org_iv;
+	uint64_t *sector;
+	int r;
+
+	dmreq = dmreq_of_req(cc, req);
+	dmreq->iv_sector = ctx->cc_sector;
+	if (test_bit(CRYPT_IV_LARGE_SECTORS, &cc->cipher_flags))
+		dmreq->iv_sector >>= cc->sector_shift;
+	dmreq->ctx = ctx;
+
+	*org_tag_of_dmreq(cc, dmreq) = 0;
+
+	sector = org_sector_of_dmreq(cc, dmreq);
+	*sector = cpu_to_le64(ctx->cc_sector - cc->iv_offset);
+
+	sg_in = multi_sg_of_dmreq(cc, dmreq);
+	sg_out = sg_in + MULTI_SECTOR_SG;
+	sg_init_table(sg_in, MULTI_SECTOR_SG);
+	sg_init_table(sg_out, MULTI_SECTOR_SG);
+
+	while (ctx->iter_in.bi_size && ctx->iter_out.bi_size) {
+		struct bio_vec bv_in = bio_iter_iovec(ctx->bio_in, ctx->iter_in);
+		struct bio_vec bv_out = bio_iter_iovec(ctx->bio_out, ctx->iter_out);
+		unsigned int n = min(bv_in.bv_len, bv_out.bv_len);
+
+		/* Reject unexpected unaligned bio, after submitting the rest. */
+		if (unlikely((bv_in.bv_len | bv_out.bv_len) & (cc->sector_size - 1)))
+			break;
+
+		if ((nents_in == MULTI_SECTOR_SG &&
+		     !crypt_sg_contiguous(sg_in, nents_in, &bv_in)) ||
+		    (nents_out == MULTI_SECTOR_SG &&
+		     !crypt_sg_contiguous(sg_out, nents_out, &bv_out)))
+			break;
+
+		crypt_sg_add(sg_in, &nents_in, &bv_in, n);
+		if (!in_place)
+			crypt_sg_add(sg_out, &nents_out, &bv_out, n);
+
+		bio_advance_iter(ctx->bio_in, &ctx->iter_in, n);
+		bio_advance_iter(ctx->bio_out, &ctx->iter_out, n);
+		len += n;
+	}
+
+	if (unlikely(!len))
+		return -EIO;
+
+	sg_mark_end(&sg_in[nents_in - 1]);
+	if (in_place)
+		sg_out = sg_in;
+	else
+		sg_mark_end(&sg_out[nents_out - 1]);
+
+	iv = iv_of_dmreq(cc, dmreq);
+	org_iv = org_iv_of_dmreq(cc, dmreq);
+
+	r = cc->iv_gen_ops->generator(cc, org_iv, dmreq);
+	if (r < 0)
+		return r;
+	put_unaligned_le32(cc->sector_size, org_iv + sizeof(u64));
+	memcpy(iv, org_iv, cc->iv_size);
+
+	skcipher_request_set_crypt(req, sg_in, sg_out, len, iv);
+	*sector_step = len >> SECTOR_SHIFT;
+
+	if (bio_data_dir(ctx->bio_in) == WRITE)
+		return crypto_skcipher_encrypt(req);
+	else
+		return crypto_skcipher_decrypt(req);
+}
+
 static void kcryptd_async_done(struct crypto_async_request *async_req,
 			       int error);
 
@@ -1333,6 +1457,9 @@ static blk_status_t crypt_convert(struct crypt_config *cc,
 
 		if (crypt_integrity_aead(cc))
 			r = crypt_convert_block_aead(cc, ctx, ctx->r.req_aead, tag_offset);
+		else if (test_bit(CRYPT_MULTI_SECTOR_TFM, &cc->cipher_flags))
+			r = crypt_convert_blocks_skcipher(cc, ctx, ctx->r.req,
+							  &sector_step);
 		else
 			r = crypt_convert_block_skcipher(cc, ctx, ctx->r.req, tag_offset);
 
@@ -2545,6 +2672,50 @@ static int crypt_ctr_cipher_old(struct dm_target *ti, char *cipher_in, char *key
 	return -ENOMEM;
 }
 
+/*
+ * Replace the cipher by "plain64(<cipher>)" if a driver provides it.  Such a
+ * cipher takes a run of data units in one request: the IV carries the 64-bit
+ * little endian number of the first data unit followed by the 32-bit little
+ * endian data unit size, and the IV of each following unit is the previous
+ * one plus one.  This matches plain64 only if IVs count in data units.
+ */
+static int crypt_ctr_multi_sector(struct dm_target *ti)
+{
+	struct crypt_config *cc = ti->private;
+	struct crypto_skcipher *tfm;
+	char name[CRYPTO_MAX_ALG_NAME];
+
+	if (cc->iv_gen_ops != &crypt_iv_plain64_ops || cc->on_disk_tag_size ||
+	    cc->tfms_count != 1 || cc->iv_size < sizeof(u64) + sizeof(u32) ||
+	    (cc->sector_size != (1 << SECTOR_SHIFT) &&
+	     !test_bit(CRYPT_IV_LARGE_SECTORS, &cc->cipher_flags))) {
+		ti->error = "multi_sector requires plain64 IVs counted in sectors of sector_size";
+		return -EINVAL;
+	}
+
+	if (snprintf(name, sizeof(name), "plain64(%s)",
+		     crypto_tfm_alg_name(crypto_skcipher_tfm(any_tfm(cc)))) >=
+	    sizeof(name))
+		return 0;
+
+	tfm = crypto_alloc_skcipher(name, 0, 0);
+	if (IS_ERR(tfm)) {
+		DMINFO("%s not available, using per-sector requests", name);
+		return 0;
+	}
+
+	if (crypto_skcipher_ivsize(tfm) != crypto_skcipher_ivsize(any_tfm(cc))) {
+		crypto_free_skcipher(tfm);
+		return 0;
+	}
+
+	crypto_free_skcipher(cc->cipher_tfm.tfms[0]);
+	cc->cipher_tfm.tfms[0] = tfm;
+	set_bit(CRYPT_MULTI_SECTOR_TFM, &cc->cipher_flags);
+
+	return 0;
+}
+
 static int crypt_ctr_cipher(struct dm_target *ti, char *cipher_in, char *key)
 {
 	struct crypt_config *cc = ti->private;
@@ -2569,6 +2740,12 @@ static int crypt_ctr_cipher(struct dm_target *ti, char *cipher_in, char *key)
 	if (ret < 0)
 		return ret;
 
+	if (test_bit(DM_CRYPT_MULTI_SECTOR, &cc->flags)) {
+		ret = crypt_ctr_multi_sector(ti);
+		if (ret < 0)
+			return ret;
+	}
+
 	/* Initialize and set key */
 	ret = crypt_set_key(cc, key);
 	if (ret < 0) {
@@ -2606,7 +2783,7 @@ static int crypt_ctr_optional(struct dm_target *ti, unsigned int argc, char **ar
 	struct crypt_config *cc = ti->private;
 	struct dm_arg_set as;
 	static const struct dm_arg _args[] = {
-		{0, 6, "Invalid number of feature args"},
+		{0, 7, "Invalid number of feature args"},
 	};
 	unsigned int opt_params, val;
 	const char *opt_string, *sval;
@@ -2667,6 +2844,8 @@ static int crypt_ctr_optional(struct dm_target *ti, unsigned int argc, char **ar
 			cc->sector_shift = __ffs(cc->sector_size) - SECTOR_SHIFT;
 		} else if (!strcasecmp(opt_string, "iv_large_sectors"))
 			set_bit(CRYPT_IV_LARGE_SECTORS, &cc->cipher_flags);
+		else if (!strcasecmp(opt_string, "multi_sector"))
+			set_bit(DM_CRYPT_MULTI_SECTOR, &cc->flags);
 		else {
 			ti->error = "Invalid feature arguments";
 			return -EINVAL;
@@ -2763,6 +2942,11 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		sizeof(uint64_t) +
 		sizeof(unsigned int);
 
+	/*  ...| padding | sg_in[MULTI_SECTOR_SG] | sg_out[MULTI_SECTOR_SG] | */
+	if (test_bit(CRYPT_MULTI_SECTOR_TFM, &cc->cipher_flags))
+		additional_req_size += __alignof__(struct scatterlist) - 1 +
+			2 * MULTI_SECTOR_SG * sizeof(struct scatterlist);
+
 	ret = mempool_init_kmalloc_pool(&cc->req_pool, MIN_IOS, cc->dmreq_start + additional_req_size);
 	if (ret) {
 		ti->error = "Cannot allocate crypt request mempool";
@@ -2964,6 +3148,7 @@ static void crypt_status(struct dm_target *ti, status_type_t type,
 		num_feature_args += test_bit(DM_CRYPT_NO_OFFLOAD, &cc->flags);
 		num_feature_args += cc->sector_size != (1 << SECTOR_SHIFT);
 		num_feature_args += test_bit(CRYPT_IV_LARGE_SECTORS, &cc->cipher_flags);
+		num_feature_args += test_bit(DM_CRYPT_MULTI_SECTOR, &cc->flags);
 		if (cc->on_disk_tag_size)
 			num_feature_args++;
 		if (num_feature_args) {
@@ -2980,6 +3165,8 @@ static void crypt_status(struct dm_target *ti, status_type_t type,
 				DMEMIT(" sector_size:%d", cc->sector_size);
 			if (test_bit(CRYPT_IV_LARGE_SECTORS, &cc->cipher_flags))
 				DMEMIT(" iv_large_sectors");
+			if (test_bit(DM_CRYPT_MULTI_SECTOR, &cc->flags))
+				DMEMIT(" multi_sector");
 		}
 
 		break;
@@ -3092,7 +3279,7 @@ static void crypt_io_hints(struct dm_target *ti, struct queue_limits *limits)
 
 static struct target_type crypt_target = {
 	.name   = "crypt",
-	.version = {1, 18, 1},
+	.version = {1, 19, 0},
 	.module = THIS_MODULE,
 	.ctr    = crypt_ctr,
 	.dtr    = crypt_dtr,
@@ -15,6 +15,7 @@
 #include <linux/dax.h>
 #include <linux/pfn_t.h>
 #include <linux/libnvdimm.h>
+#include <linux/list_sort.h>
 
 #define DM_MSG_PREFIX "writecache"
 
@@ -23,6 +24,8 @@
 #define MAX_WRITEBACK_JOBS		0
 #define ENDIO_LATENCY			16
 #define WRITEBACK_LATENCY		64
+#define WRITEBACK_THREADS_MAX		16
+#define WRITEBACK_SPLIT_MIN		64
 #define AUTOCOMMIT_BLOCKS_SSD		65536
 #define AUTOCOMMIT_BLOCKS_PMEM		64
 #define AUTOCOMMIT_MSEC			1000
@@ -103,6 +106,21 @@ struct wc_entry {
 #endif
 #define WC_MODE_SORT_FREELIST(wc)		(!WC_MODE_PMEM(wc))
 
+struct writecache_stats {
+	unsigned long long reads;
+	unsigned long long read_hits;
+	unsigned long long writes;
+	unsigned long long write_hits_uncommitted;
+	unsigned long long write_hits_committed;
+	unsigned long long writes_allocate;
+	unsigned long long writes_blocked_on_freelist;
+	unsigned long long flushes;
+	unsigned long long discards;
+	unsigned long long writeback_blocks;
+};
+
+struct writeback_batch;
+
 struct dm_writecache {
 	struct mutex lock;
 	struct list_head lru;
@@ -123,6 +141,7 @@ struct dm_writecache {
 	unsigned uncommitted_blocks;
 	unsigned autocommit_blocks;
 	unsigned max_writeback_jobs;
+	unsigned writeback_threads;
 
 	int error;
 
@@ -158,6 +177,7 @@ struct dm_writecache {
 	bool high_wm_percent_set:1;
 	bool low_wm_percent_set:1;
 	bool max_writeback_jobs_set:1;
+	bool writeback_threads_set:1;
 	bool autocommit_blocks_set:1;
 	bool autocommit_time_set:1;
 	bool writeback_fua_set:1;
@@ -172,6 +192,9 @@ struct dm_writecache {
 	struct work_struct writeback_work;
 	struct work_struct flush_work;
 
+	struct workqueue_struct *writeback_batch_wq;
+	struct writeback_batch *wb_batches;
+
 	struct dm_io_client *dm_io;
 
 	raw_spinlock_t endio_list_lock;
@@ -187,6 +210,8 @@ struct dm_writecache {
 
 	struct bio_set bio_set;
 	mempool_t copy_pool;
+
+	struct writecache_stats stats;
 };
 
 #define WB_LIST_INLINE		16
@@ -1073,6 +1098,18 @@ static int process_flush_on_suspend_mesg(unsigned argc, char **argv, struct dm_w
 	return 0;
 }
 
+static int process_clear_stats_mesg(unsigned argc, char **argv, struct dm_writecache *wc)
+{
+	if (argc != 1)
+		return -EINVAL;
+
+	wc_lock(wc);
+	memset(&wc->stats, 0, sizeof wc->stats);
+	wc_unlock(wc);
+
+	return 0;
+}
+
 static int writecache_message(struct dm_target *ti, unsigned argc, char **argv,
 			      char *result, unsigned maxlen)
 {
@@ -1083,6 +1120,8 @@ static int writecache_message(struct dm_target *ti, unsigned argc, char **argv,
 		r = process_flush_mesg(argc, argv, wc);
 	else if (!strcasecmp(argv[0], "flush_on_suspend"))
 		r = process_flush_on_suspend_mesg(argc, argv, wc);
+	else if (!strcasecmp(argv[0], "clear_stats"))
+		r = process_clear_stats_mesg(argc, argv, wc);
 	else
 		DMERR("unrecognised message received: %s", argv[0]);
 
@@ -1182,6 +1221,7 @@ static int writecache_map(struct dm_target *ti, struct bio *bio)
 	wc_lock(wc);
 
 	if (unlikely(bio->bi_opf & REQ_PREFLUSH)) {
+		wc->stats.flushes++;
 		if (writecache_has_error(wc))
 			goto unlock_error;
 		if (WC_MODE_PMEM(wc)) {
@@ -1206,6 +1246,7 @@ static int writecache_map(struct dm_target *ti, struct bio *bio)
 	}
 
 	if (unlikely(bio_op(bio) == REQ_OP_DISCARD)) {
+		wc->stats.discards++;
 		if (writecache_has_error(wc))
 			goto unlock_error;
 		if (WC_MODE_PMEM(wc)) {
@@ -1221,6 +1262,8 @@ static int writecache_map(struct dm_target *ti, struct bio *bio)
 read_next_block:
 		e = writecache_find_entry(wc, bio->bi_iter.bi_sector, WFE_RETURN_FOLLOWING);
 		if (e && read_original_sector(wc, e) == bio->bi_iter.bi_sector) {
+			wc->stats.reads++;
+			wc->stats.read_hits++;
 			if (WC_MODE_PMEM(wc)) {
 				bio_copy_block(wc, bio, memory_data(wc, e));
 				if (bio->bi_iter.bi_size)
@@ -1242,6 +1285,7 @@ static int writecache_map(struct dm_target *ti, struct bio *bio)
 					dm_accept_partial_bio(bio, next_boundary);
 				}
 			}
+			wc->stats.reads += bio->bi_iter.bi_size >> wc->block_size_bits;
 			goto unlock_remap_origin;
 		}
 	} else {
@@ -1250,22 +1294,28 @@ static int writecache_map(struct dm_target *ti, struct bio *bio)
 				goto unlock_error;
 			e = writecache_find_entry(wc, bio->bi_iter.bi_sector, 0);
 			if (e) {
-				if (!writecache_entry_is_committed(wc, e))
+				if (!writecache_entry_is_committed(wc, e)) {
+					wc->stats.write_hits_uncommitted++;
 					goto bio_copy;
+				}
 				if (!WC_MODE_PMEM(wc) && !e->write_in_progress) {
+					wc->stats.write_hits_committed++;
 					wc->overwrote_committed = true;
 					goto bio_copy;
 				}
 			}
 			e = writecache_pop_from_freelist(wc);
 			if (unlikely(!e)) {
+				wc->stats.writes_blocked_on_freelist++;
 				writecache_wait_on_freelist(wc);
 				continue;
 			}
 			write_original_sector_seq_count(wc, e, bio->bi_iter.bi_sector, wc->seq_count);
 			writecache_insert_entry(wc, e);
 			wc->uncommitted_blocks++;
+			wc->stats.writes_allocate++;
 bio_copy:
+			wc->stats.writes++;
 			if (WC_MODE_PMEM(wc)) {
 				bio_copy_block(wc, bio, memory_data(wc, e));
 			} else {
@@ -1404,6 +1454,7 @@ static void __writecache_endio_pmem(struct dm_writecache *wc, struct list_head *
 				writecache_free_entry(wc, e);
 			BUG_ON(!wc->writeback_size);
 			wc->writeback_size--;
+			wc->stats.writeback_blocks++;
 			n_walked++;
 			if (unlikely(n_walked >= ENDIO_LATENCY)) {
 				writecache_commit_flushed(wc, false);
@@ -1441,6 +1492,7 @@ static void __writecache_endio_ssd(struct dm_writecache *wc, struct list_head *l
 
 			BUG_ON(!wc->writeback_size);
 			wc->writeback_size--;
+			wc->stats.writeback_blocks++;
 			e++;
 		} while (--c->n_entries);
 		mempool_free(c, &wc->copy_pool);
@@ -1515,6 +1567,12 @@ struct writeback_list {
 	size_t size;
 };
 
+struct writeback_batch {
+	struct work_struct work;
+	struct dm_writecache *wc;
+	struct writeback_list wbl;
+};
+
 static void __writeback_throttle(struct dm_writecache *wc, struct writeback_list *wbl)
 {
 	if (unlikely(wc->max_writeback_jobs)) {
@@ -1638,10 +1696,78 @@ static void __writecache_writeback_ssd(struct dm_writecache *wc, struct writebac
 	}
 }
 
+static void __writecache_writeback_list(struct dm_writecache *wc, struct writeback_list *wbl)
+{
+	struct blk_plug plug;
+
+	blk_start_plug(&plug);
+
+	if (WC_MODE_PMEM(wc))
+		__writecache_writeback_pmem(wc, wbl);
+	else
+		__writecache_writeback_ssd(wc, wbl);
+
+	blk_finish_plug(&plug);
+}
+
+static void writecache_writeback_batch(struct work_struct *work)
+{
+	struct writeback_batch *b = container_of(work, struct writeback_batch, work);
+
+	__writecache_writeback_list(b->wc, &b->wbl);
+}
+
+/*
+ * The writeback list is consumed from its tail, so sorting it in descending
+ * order of origin sector makes the writes to the origin ascend.  Origin
+ * sectors are unique within one writeback list and the entries of a run
+ * have consecutive origin sectors, so runs stay together.
+ */
+static int writecache_writeback_cmp(void *priv, struct list_head *a, struct list_head *b)
+{
+	struct dm_writecache *wc = priv;
+	sector_t sec_a = read_original_sector(wc, container_of(a, struct wc_entry, lru));
+	sector_t sec_b = read_original_sector(wc, container_of(b, struct wc_entry, lru));
+
+	if (sec_a > sec_b)
+		return -1;
+	return sec_a < sec_b;
+}
+
+/*
+ * Cut the sorted writeback list into origin regions of roughly equal size,
+ * one per writeback thread.  A run handed to the SSD copy path must not be
+ * split, so cut only at run boundaries.
+ */
+static unsigned writecache_split_writeback(struct dm_writecache *wc, struct writeback_list *wbl)
+{
+	size_t per_batch = DIV_ROUND_UP(wbl->size, wc->writeback_threads);
+	unsigned i;
+
+	for (i = 0; i < wc->writeback_threads && wbl->size; i++) {
+		struct writeback_list *bl = &wc->wb_batches[i].wbl;
+
+		INIT_LIST_HEAD(&bl->list);
+		bl->size = 0;
+		while (wbl->size && (bl->size < per_batch || i == wc->writeback_threads - 1)) {
+			struct wc_entry *e = container_of(wbl->list.prev, struct wc_entry, lru);
+			unsigned run = WC_MODE_PMEM(wc) ? 1 : e->wc_list_contiguous;
+
+			while (run--) {
+				e = container_of(wbl->list.prev, struct wc_entry, lru);
+				list_move(&e->lru, &bl->list);
+				wbl->size--;
+				bl->size++;
+			}
+		}
+	}
+
+	return i;
+}
+
 static void writecache_writeback(struct work_struct *work)
 {
 	struct dm_writecache *wc = container_of(work, struct dm_writecache, writeback_work);
-	struct blk_plug plug;
 	struct wc_entry *e, *f, *g;
 	struct rb_node *node, *next_node;
 	struct list_head skipped;
@@ -1758,14 +1884,19 @@ static void writecache_writeback(struct work_struct *work)
 
 	wc_unlock(wc);
 
-	blk_start_plug(&plug);
-
-	if (WC_MODE_PMEM(wc))
-		__writecache_writeback_pmem(wc, &wbl);
-	else
-		__writecache_writeback_ssd(wc, &wbl);
+	if (wc->writeback_threads > 1 && wbl.size >= WRITEBACK_SPLIT_MIN) {
+		unsigned i, n;
 
-	blk_finish_plug(&plug);
+		list_sort(wc, &wbl.list, writecache_writeback_cmp);
+		n = writecache_split_writeback(wc, &wbl);
+		for (i = 1; i < n; i++)
+			queue_work(wc->writeback_batch_wq, &wc->wb_batches[i].work);
+		__writecache_writeback_list(wc, &wc->wb_batches[0].wbl);
+		for (i = 1; i < n; i++)
+			flush_work(&wc->wb_batches[i].work);
+	} else {
+		__writecache_writeback_list(wc, &wbl);
+	}
 
 	if (unlikely(wc->writeback_all)) {
 		wc_lock(wc);
@@ -1863,6 +1994,11 @@ static void writecache_dtr(struct dm_target *ti)
 	if (wc->writeback_wq)
 		destroy_workqueue(wc->writeback_wq);
 
+	if (wc->writeback_batch_wq)
+		destroy_workqueue(wc->writeback_batch_wq);
+
+	kfree(wc->wb_batches);
+
 	if (wc->dev)
 		dm_put_device(ti, wc->dev);
 
@@ -1906,7 +2042,7 @@ static int writecache_ctr(struct dm_target *ti, unsigned argc, char **argv)
 	struct wc_memory_superblock s;
 
 	static struct dm_arg _args[] = {
-		{0, 10, "Invalid number of feature args"},
+		{0, 12, "Invalid number of feature args"},
 	};
 
 	as.argc = argc;
@@ -2050,6 +2186,7 @@ static int writecache_ctr(struct dm_target *ti, unsigned argc, char **argv)
 	wc->block_size_bits = __ffs(wc->block_size);
 
 	wc->max_writeback_jobs = MAX_WRITEBACK_JOBS;
+	wc->writeback_threads = 1;
 	wc->autocommit_blocks = !WC_MODE_PMEM(wc) ? AUTOCOMMIT_BLOCKS_SSD : AUTOCOMMIT_BLOCKS_PMEM;
 	wc->autocommit_jiffies = msecs_to_jiffies(AUTOCOMMIT_MSEC);
 
@@ -2093,6 +2230,14 @@ static int writecache_ctr(struct dm_target *ti, unsigned argc, char **argv)
 			if (sscanf(string, "%u%c", &wc->max_writeback_jobs, &dummy) != 1)
 				goto invalid_optional;
 			wc->max_writeback_jobs_set = true;
+		} else if (!strcasecmp(string, "writeback_threads") && opt_params >= 1) {
+			string = dm_shift_arg(&as), opt_params--;
+			if (sscanf(string, "%u%c", &wc->writeback_threads, &dummy) != 1)
+				goto invalid_optional;
+			if (wc->writeback_threads < 1 ||
+			    wc->writeback_threads > WRITEBACK_THREADS_MAX)
+				goto invalid_optional;
+			wc->writeback_threads_set = true;
 		} else if (!strcasecmp(string, "autocommit_blocks") && opt_params >= 1) {
 			string = dm_shift_arg(&as), opt_params--;
 			if (sscanf(string, "%u%c", &wc->autocommit_blocks, &dummy) != 1)
@@ -2132,6 +2277,24 @@ static int writecache_ctr(struct dm_target *ti, unsigned argc, char **argv)
 		goto bad;
 	}
 
+	if (wc->writeback_threads > 1) {
+		unsigned i;
+
+		wc->writeback_batch_wq = alloc_workqueue("writecache-batch",
+							 WQ_MEM_RECLAIM | WQ_UNBOUND, 0);
+		wc->wb_batches = kcalloc(wc->writeback_threads, sizeof(struct writeback_batch),
+					 GFP_KERNEL);
+		if (!wc->writeback_batch_wq || !wc->wb_batches) {
+			r = -ENOMEM;
+			ti->error = "Could not allocate writeback threads";
+			goto bad;
+		}
+		for (i = 0; i < wc->writeback_threads; i++) {
+			INIT_WORK(&wc->wb_batches[i].work, writecache_writeback_batch);
+			wc->wb_batches[i].wc = wc;
+		}
+	}
+
 	if (WC_MODE_PMEM(wc)) {
 		r = persistent_memory_claim(wc);
 		if (r) {
@@ -2308,6 +2471,13 @@ static void writecache_status(struct dm_target *ti, status_type_t type,
 		DMEMIT("%ld %llu %llu %llu", writecache_has_error(wc),
 		       (unsigned long long)wc->n_blocks, (unsigned long long)wc->freelist_size,
 		       (unsigned long long)wc->writeback_size);
+		DMEMIT(" %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu",
+		       wc->stats.reads, wc->stats.read_hits,
+		       wc->stats.writes, wc->stats.write_hits_uncommitted,
+		       wc->stats.write_hits_committed, wc->stats.writes_allocate,
+		       wc->stats.writes_blocked_on_freelist,
+		       wc->stats.flushes, wc->stats.discards,
+		       wc->stats.writeback_blocks);
 		break;
 	case STATUSTYPE_TABLE:
 		DMEMIT("%c %s %s %u ", WC_MODE_PMEM(wc) ? 'p' : 's',
@@ -2321,6 +2491,8 @@ static void writecache_status(struct dm_target *ti, status_type_t type,
 			extra_args += 2;
 		if (wc->max_writeback_jobs_set)
 			extra_args += 2;
+		if (wc->writeback_threads_set)
+			extra_args += 2;
 		if (wc->autocommit_blocks_set)
 			extra_args += 2;
 		if (wc->autocommit_time_set)
@@ -2337,6 +2509,8 @@ static void writecache_status(struct dm_target *ti, status_type_t type,
 			DMEMIT(" low_watermark %u", wc->low_wm_percent_value);
 		if (wc->max_writeback_jobs_set)
 			DMEMIT(" writeback_jobs %u", wc->max_writeback_jobs);
+		if (wc->writeback_threads_set)
+			DMEMIT(" writeback_threads %u", wc->writeback_threads);
 		if (wc->autocommit_blocks_set)
 			DMEMIT(" autocommit_blocks %u", wc->autocommit_blocks);
 		if (wc->autocommit_time_set)
@@ -2349,7 +2523,7 @@ static void writecache_status(struct dm_target *ti, status_type_t type,
 
 static struct target_type writecache_target = {
 	.name			= "writecache",
-	.version		= {1, 1, 1},
+	.version		= {1, 2, 0},
 	.module			= THIS_MODULE,
 	.ctr			= writecache_ctr,
 	.dtr			= writecache_dtr,
@@ -437,17 +437,36 @@ static inline void insert_hash(struct r5conf *conf, struct stripe_head *sh)
 	hlist_add_head(&sh->hash, hp);
 }
 
+/*
+ * How many idle stripes get_free_stripe() looks at for one whose pages
+ * are on the local memory node before it settles for the oldest one.
+ */
+#define FREE_STRIPE_NODE_SCAN	8
+
 /* find an idle stripe, make sure it is unhashed, and return it. */
 static struct stripe_head *get_free_stripe(struct r5conf *conf, int hash)
 {
+	struct list_head *head = conf->inactive_list + hash;
 	struct stripe_head *sh = NULL;
-	struct list_head *first;
 
-	if (list_empty(conf->inactive_list + hash))
+	if (list_empty(head))
 		goto out;
-	first = (conf->inactive_list + hash)->next;
-	sh = list_entry(first, struct stripe_head, lru);
-	list_del_init(first);
+	sh = list_first_entry(head, struct stripe_head, lru);
+	if (nr_online_nodes > 1 && sh->node != numa_node_id()) {
+		struct stripe_head *tmp;
+		int node = numa_node_id();
+		int scan = FREE_STRIPE_NODE_SCAN;
+
+		list_for_each_entry(tmp, head, lru) {
+			if (tmp->node == node) {
+				sh = tmp;
+				break;
+			}
+			if (!--scan)
+				break;
+		}
+	}
+	list_del_init(&sh->lru);
 	remove_hash(sh);
 	atomic_inc(&conf->active_stripes);
 	BUG_ON(hash != sh->hash_lock_index);
@@ -481,7 +500,7 @@ static int grow_buffers(struct stripe_head *sh, gfp_t gfp)
 	for (i = 0; i < num; i++) {
 		struct page *page;
 
-		if (!(page = alloc_page(gfp))) {
+		if (!(page = alloc_pages_node(sh->node, gfp, 0))) {
 			return 1;
 		}
 		sh->dev[i].page = page;
@@ -2139,14 +2158,28 @@ static void free_stripe(struct kmem_cache *sc, struct stripe_head *sh)
 	kmem_cache_free(sc, sh);
 }
 
+/*
+ * Spread the stripe cache round-robin over the memory nodes, so that every
+ * node has idle stripes whose pages are local to its workers.
+ */
+static int raid5_next_stripe_node(struct r5conf *conf)
+{
+	int node = READ_ONCE(conf->next_stripe_node);
+
+	WRITE_ONCE(conf->next_stripe_node,
+		   next_node_in(node, node_states[N_MEMORY]));
+	return node;
+}
+
 static struct stripe_head *alloc_stripe(struct kmem_cache *sc, gfp_t gfp,
-	int disks, struct r5conf *conf)
+	int disks, struct r5conf *conf, int node)
 {
 	struct stripe_head *sh;
 	int i;
 
-	sh = kmem_cache_zalloc(sc, gfp);
+	sh = kmem_cache_alloc_node(sc, gfp | __GFP_ZERO, node);
 	if (sh) {
+		sh->node = node;
 		spin_lock_init(&sh->stripe_lock);
 		spin_lock_init(&sh->batch_lock);
 		INIT_LIST_HEAD(&sh->batch_list);
@@ -2164,7 +2197,7 @@ static struct stripe_head *alloc_stripe(struct kmem_cache *sc, gfp_t gfp,
 		}
 
 		if (raid5_has_ppl(conf)) {
-			sh->ppl_page = alloc_page(gfp);
+			sh->ppl_page = alloc_pages_node(node, gfp, 0);
 			if (!sh->ppl_page) {
 				free_stripe(sc, sh);
 				sh = NULL;
@@ -2177,7 +2210,8 @@ static int grow_one_stripe(struct r5conf *conf, gfp_t gfp)
 {
 	struct stripe_head *sh;
 
-	sh = alloc_stripe(conf->slab_cache, gfp, conf->pool_size, conf);
+	sh = alloc_stripe(conf->slab_cache, gfp, conf->pool_size, conf,
+			  raid5_next_stripe_node(conf));
 	if (!sh)
 		return 0;
 
@@ -2342,7 +2376,8 @@ static int resize_stripes(struct r5conf *conf, int newsize)
 	mutex_lock(&conf->cache_size_mutex);
 
 	for (i = conf->max_nr_stripes; i; i--) {
-		nsh = alloc_stripe(sc, GFP_KERNEL, newsize, conf);
+		nsh = alloc_stripe(sc, GFP_KERNEL, newsize, conf,
+				   raid5_next_stripe_node(conf));
 		if (!nsh)
 			break;
 
@@ -2378,6 +2413,7 @@ static int resize_stripes(struct r5conf *conf, int newsize)
 			nsh->dev[i].page = osh->dev[i].page;
 			nsh->dev[i].orig_page = osh->dev[i].page;
 		}
+		nsh->node = osh->node;
 		nsh->hash_lock_index = hash;
 		free_stripe(conf->slab_cache, osh);
 		cnt++;
@@ -2429,7 +2465,8 @@ static int resize_stripes(struct r5conf *conf, int newsize)
 
 		for (i=conf->raid_disks; i < newsize; i++)
 			if (nsh->dev[i].page == NULL) {
-				struct page *p = alloc_page(GFP_NOIO);
+				struct page *p = alloc_pages_node(nsh->node,
+								  GFP_NOIO, 0);
 				nsh->dev[i].page = p;
 				nsh->dev[i].orig_page = p;
 				if (!p)
@@ -6998,6 +7035,7 @@ static struct r5conf *setup_conf(struct mddev *mddev)
 
 	for (i = 0; i < NR_STRIPE_HASH_LOCKS; i++)
 		INIT_LIST_HEAD(conf->inactive_list + i);
+	conf->next_stripe_node = first_memory_node;
 
 	for (i = 0; i < NR_STRIPE_HASH_LOCKS; i++)
 		INIT_LIST_HEAD(conf->temp_inactive_list + i);
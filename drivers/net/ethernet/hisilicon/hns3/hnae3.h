@@ -93,6 +93,9 @@ enum hns_desc_type {
 	DESC_TYPE_SKB,
 	DESC_TYPE_FRAGLIST_SKB,
 	DESC_TYPE_PAGE,
+	DESC_TYPE_XDP,		/* xdp_frame sent by XDP_TX or ndo_xdp_xmit */
+	DESC_TYPE_XSK,		/* AF_XDP zero-copy umem buffer */
+	DESC_TYPE_BOUNCE,	/* small skb copied to the TX bounce area */
 };
 
 struct hnae3_handle;
@@ -12,6 +12,8 @@
 #include <linux/module.h>
 #include <linux/pci.h>
 #include <linux/aer.h>
+#include <linux/bpf_trace.h>
+#include <linux/filter.h>
 #include <linux/skbuff.h>
 #include <linux/sctp.h>
 #include <linux/vermagic.h>
@@ -21,6 +23,8 @@
 #include <net/tcp.h>
 #include <net/vxlan.h>
 #include <net/geneve.h>
+#include <net/page_pool.h>
+#include <net/xdp_sock.h>
 
 #include "kcompat.h"
 #include "hnae3.h"
@@ -54,6 +58,11 @@ static int debug = -1;
 module_param(debug, int, 0);
 MODULE_PARM_DESC(debug, " Network interface message level setting");
 
+static bool rx_zerocopy;
+module_param(rx_zerocopy, bool, 0444);
+MODULE_PARM_DESC(rx_zerocopy,
+		 "Receive into one page per buffer so TCP_ZEROCOPY_RECEIVE can map the payload (needs PAGE_SIZE RX buffers)");
+
 #define DEFAULT_MSG_LEVEL (NETIF_MSG_PROBE | NETIF_MSG_LINK | \
 			   NETIF_MSG_IFDOWN | NETIF_MSG_IFUP)
 
@@ -63,6 +72,19 @@ MODULE_PARM_DESC(debug, " Network interface message level setting");
 #define HNS3_MIN_TX_LEN		33U
 #define HNS3_MIN_TUN_PKT_LEN	65U
 
+/* Frames up to this size are copied into the ring's bounce area */
+#define HNS3_TX_BOUNCE_LEN	128U
+
+/* hns3_handle_rx_bd() result for a frame XDP did not pass to the stack */
+#define HNS3_RX_XDP_DONE	1
+
+/* ring->xdp_status bits, what is left to flush at the end of RX clean */
+#define HNS3_XDP_TX		BIT(0)
+#define HNS3_XDP_REDIR		BIT(1)
+
+/* XDP only runs on frames that fit in one RX buffer */
+#define HNS3_XDP_FRAME_SIZE(mtu)	((mtu) + ETH_HLEN + 2 * VLAN_HLEN)
+
 /* hns3_pci_tbl - PCI Device ID Table
  *
  * Last entry must be all 0s
@@ -95,6 +117,7 @@ static irqreturn_t hns3_irq_handle(int irq, void *vector)
 {
 	struct hns3_enet_tqp_vector *tqp_vector = vector;
 
+	tqp_vector->event_cnt++;
 	napi_schedule_irqoff(&tqp_vector->napi);
 
 	return IRQ_HANDLED;
@@ -199,6 +222,9 @@ static void hns3_vector_disable(struct hns3_enet_tqp_vector *tqp_vector)
 
 	disable_irq(tqp_vector->vector_irq);
 	napi_disable(&tqp_vector->napi);
+
+	cancel_work_sync(&tqp_vector->rx_group.dim.work);
+	cancel_work_sync(&tqp_vector->tx_group.dim.work);
 }
 
 void hns3_set_vector_coalesce_rl(struct hns3_enet_tqp_vector *tqp_vector,
@@ -252,8 +278,10 @@ static void hns3_vector_gl_rl_init(struct hns3_enet_tqp_vector *tqp_vector,
 	tqp_vector->tx_group.coal.int_gl = HNS3_INT_GL_50K;
 	tqp_vector->rx_group.coal.int_gl = HNS3_INT_GL_50K;
 
-	tqp_vector->rx_group.coal.flow_level = HNS3_FLOW_LOW;
-	tqp_vector->tx_group.coal.flow_level = HNS3_FLOW_LOW;
+	tqp_vector->rx_group.dim.mode = NET_DIM_CQ_PERIOD_MODE_START_FROM_EQE;
+	tqp_vector->rx_group.dim.profile_ix = NET_DIM_DEF_PROFILE_EQE;
+	tqp_vector->tx_group.dim.mode = NET_DIM_CQ_PERIOD_MODE_START_FROM_EQE;
+	tqp_vector->tx_group.dim.profile_ix = NET_DIM_DEF_PROFILE_EQE;
 }
 
 static void hns3_vector_gl_rl_init_hw(struct hns3_enet_tqp_vector *tqp_vector,
@@ -672,12 +700,19 @@ static int hns3_set_tso(struct sk_buff *skb, u32 *paylen,
 
 	/* normal or tunnel packet */
 	l4_offset = l4.hdr - skb->data;
-	hdr_len = (l4.tcp->doff << 2) + l4_offset;
 
 	/* remove payload length from inner pseudo checksum when tso */
 	l4_paylen = skb->len - l4_offset;
-	csum_replace_by_diff(&l4.tcp->check,
-			     (__force __wsum)htonl(l4_paylen));
+
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4) {
+		hdr_len = sizeof(*l4.udp) + l4_offset;
+		csum_replace_by_diff(&l4.udp->check,
+				     (__force __wsum)htonl(l4_paylen));
+	} else {
+		hdr_len = (l4.tcp->doff << 2) + l4_offset;
+		csum_replace_by_diff(&l4.tcp->check,
+				     (__force __wsum)htonl(l4_paylen));
+	}
 
 	*send_bytes = (skb_shinfo(skb)->gso_segs - 1) * hdr_len + skb->len;
 
@@ -1372,7 +1407,9 @@ static void hns3_clear_desc(struct hns3_enet_ring *ring, int next_to_use_orig)
 					 ring->desc_cb[ring->next_to_use].dma,
 					ring->desc_cb[ring->next_to_use].length,
 					DMA_TO_DEVICE);
-		else if (ring->desc_cb[ring->next_to_use].length)
+		else if (ring->desc_cb[ring->next_to_use].length &&
+			 ring->desc_cb[ring->next_to_use].type !=
+			 DESC_TYPE_BOUNCE)
 			dma_unmap_page(dev,
 				       ring->desc_cb[ring->next_to_use].dma,
 				       ring->desc_cb[ring->next_to_use].length,
@@ -1425,6 +1462,44 @@ static int hns3_fill_skb_to_desc(struct hns3_enet_ring *ring,
 	return bd_num;
 }
 
+/* Copy a small frame, frags included, into the slot of the bounce area
+ * that belongs to next_to_use and send it from there with a single BD,
+ * which saves mapping and unmapping every fragment of it.
+ */
+static int hns3_fill_bounce_desc(struct hns3_enet_ring *ring,
+				 struct sk_buff *skb)
+{
+	struct hns3_desc_cb *desc_cb = &ring->desc_cb[ring->next_to_use];
+	struct hns3_desc *desc = &ring->desc[ring->next_to_use];
+	u32 offset = ring->next_to_use * HNS3_TX_BOUNCE_LEN;
+
+	if (unlikely(skb_copy_bits(skb, 0, ring->tx_bounce + offset,
+				   skb->len))) {
+		u64_stats_update_begin(&ring->syncp);
+		ring->stats.sw_err_cnt++;
+		u64_stats_update_end(&ring->syncp);
+		return -ENOMEM;
+	}
+
+	desc_cb->priv = skb;
+	desc_cb->length = skb->len;
+	desc_cb->dma = ring->tx_bounce_dma + offset;
+	desc_cb->type = DESC_TYPE_BOUNCE;
+
+	desc->addr = cpu_to_le64(desc_cb->dma);
+	desc->tx.send_size = cpu_to_le16(skb->len);
+	desc->tx.bdtp_fe_sc_vld_ra_ri = cpu_to_le16(BIT(HNS3_TXD_VLD_B));
+
+	trace_hns3_tx_desc(ring);
+	ring_ptr_move_fw(ring, next_to_use);
+
+	u64_stats_update_begin(&ring->syncp);
+	ring->stats.tx_bounce++;
+	u64_stats_update_end(&ring->syncp);
+
+	return 1;
+}
+
 static void hns3_tx_doorbell(struct hns3_enet_ring *ring, int num,
 			     bool doorbell)
 {
@@ -1495,7 +1570,11 @@ netdev_tx_t hns3_nic_net_xmit(struct sk_buff *skb, struct net_device *netdev)
 	 * zero, which is unlikely, and 'ret > 0' means how many tx desc
 	 * need to be notified to the hw.
 	 */
-	ret = hns3_fill_skb_to_desc(ring, skb, DESC_TYPE_SKB);
+	if (skb->len <= HNS3_TX_BOUNCE_LEN && ring->tx_bounce &&
+	    !skb_is_gso(skb))
+		ret = hns3_fill_bounce_desc(ring, skb);
+	else
+		ret = hns3_fill_skb_to_desc(ring, skb, DESC_TYPE_SKB);
 	if (unlikely(ret <= 0))
 		goto fill_err;
 
@@ -1506,13 +1585,9 @@ netdev_tx_t hns3_nic_net_xmit(struct sk_buff *skb, struct net_device *netdev)
 
 	/* Complete translate all packets */
 	dev_queue = netdev_get_tx_queue(netdev, ring->queue_index);
-	if (!netdev_xmit_more()) {
-		netdev_tx_sent_queue(dev_queue, desc_cb->send_bytes);
-		hns3_tx_doorbell(ring, ret, true);
-	} else {
-		dql_queued(&dev_queue->dql, desc_cb->send_bytes);
-		hns3_tx_doorbell(ring, ret, netif_tx_queue_stopped(dev_queue));
-	}
+	hns3_tx_doorbell(ring, ret,
+			 __netdev_tx_sent_queue(dev_queue, desc_cb->send_bytes,
+						netdev_xmit_more()));
 
 	return NETDEV_TX_OK;
 
@@ -1525,6 +1600,167 @@ netdev_tx_t hns3_nic_net_xmit(struct sk_buff *skb, struct net_device *netdev)
 	return NETDEV_TX_OK;
 }
 
+/* Fill one BD frame without any offload, for XDP and AF_XDP transmit */
+static void hns3_fill_xdp_desc(struct hns3_enet_ring *ring, void *priv,
+			       dma_addr_t dma, u32 len,
+			       enum hns_desc_type type)
+{
+	struct hns3_desc_cb *desc_cb = &ring->desc_cb[ring->next_to_use];
+	struct hns3_desc *desc = &ring->desc[ring->next_to_use];
+
+	desc_cb->priv = priv;
+	desc_cb->length = len;
+	desc_cb->send_bytes = len;
+	desc_cb->dma = dma;
+	desc_cb->type = type;
+
+	desc->addr = cpu_to_le64(dma);
+	desc->tx.vlan_tag = 0;
+	desc->tx.send_size = cpu_to_le16(len);
+	desc->tx.type_cs_vlan_tso_len = 0;
+	desc->tx.outer_vlan_tag = 0;
+	desc->tx.ol_type_vlan_len_msec = 0;
+	desc->tx.paylen = cpu_to_le32(len);
+	desc->tx.mss = 0;
+	desc->tx.bdtp_fe_sc_vld_ra_ri =
+		cpu_to_le16(BIT(HNS3_TXD_VLD_B) | BIT(HNS3_TXD_FE_B));
+
+	trace_hns3_tx_desc(ring);
+	ring_ptr_move_fw(ring, next_to_use);
+}
+
+/* XDP frames share the TX ring with the stack, the caller must hold the
+ * queue's xmit lock and ring the doorbell.
+ */
+static int hns3_xmit_xdp_frame(struct hns3_enet_ring *ring,
+			       struct xdp_frame *xdpf)
+{
+	struct device *dev = ring_to_dev(ring);
+	dma_addr_t dma;
+
+	/* Hardware can only handle short frames above 32 bytes */
+	if (unlikely(xdpf->len < HNS3_MIN_TX_LEN))
+		return -EINVAL;
+
+	if (unlikely(ring_space(ring) < 1)) {
+		u64_stats_update_begin(&ring->syncp);
+		ring->stats.tx_busy++;
+		u64_stats_update_end(&ring->syncp);
+		return -EBUSY;
+	}
+
+	dma = dma_map_single(dev, xdpf->data, xdpf->len, DMA_TO_DEVICE);
+	if (unlikely(dma_mapping_error(dev, dma))) {
+		u64_stats_update_begin(&ring->syncp);
+		ring->stats.sw_err_cnt++;
+		u64_stats_update_end(&ring->syncp);
+		return -ENOMEM;
+	}
+
+	hns3_fill_xdp_desc(ring, xdpf, dma, xdpf->len, DESC_TYPE_XDP);
+
+	return 0;
+}
+
+static int hns3_nic_xdp_xmit(struct net_device *netdev, int n,
+			     struct xdp_frame **frames, u32 flags)
+{
+	struct hns3_nic_priv *priv = netdev_priv(netdev);
+	struct hnae3_handle *h = priv->ae_handle;
+	struct hns3_enet_ring *ring;
+	struct netdev_queue *txq;
+	int cpu = smp_processor_id();
+	int i, sent = 0;
+
+	if (unlikely(flags & ~XDP_XMIT_FLAGS_MASK))
+		return -EINVAL;
+
+	if (unlikely(test_bit(HNS3_NIC_STATE_DOWN, &priv->state)))
+		return -ENETDOWN;
+
+	ring = &priv->ring[cpu % h->kinfo.num_tqps];
+	txq = netdev_get_tx_queue(netdev, ring->queue_index);
+
+	__netif_tx_lock(txq, cpu);
+	for (i = 0; i < n; i++) {
+		if (unlikely(hns3_xmit_xdp_frame(ring, frames[i]))) {
+			xdp_return_frame_rx_napi(frames[i]);
+			continue;
+		}
+		sent++;
+	}
+
+	if (sent || (flags & XDP_XMIT_FLUSH))
+		hns3_tx_doorbell(ring, sent, flags & XDP_XMIT_FLUSH);
+	if (sent)
+		txq_trans_update(txq);
+	__netif_tx_unlock(txq);
+
+	return sent;
+}
+
+/* Move frames from the AF_XDP TX queue of the umem to the TX ring, called
+ * from NAPI.  Returns true when the TX queue was emptied within @budget.
+ */
+static bool hns3_xsk_xmit(struct hns3_enet_ring *ring, int budget)
+{
+	struct net_device *netdev = ring_to_netdev(ring);
+	struct xdp_umem *umem = ring->xsk_umem;
+	struct netdev_queue *txq;
+	int sent = 0;
+	dma_addr_t dma;
+	u32 len;
+
+	txq = netdev_get_tx_queue(netdev, ring->queue_index);
+
+	__netif_tx_lock(txq, smp_processor_id());
+	while (sent < budget && ring_space(ring) > 0) {
+		if (!xsk_umem_consume_tx(umem, &dma, &len))
+			break;
+
+		/* The descriptor is taken, pad short frames rather than
+		 * drop them, the rest of the chunk is the socket's memory.
+		 */
+		len = max_t(u32, len, HNS3_MIN_TX_LEN);
+		dma_sync_single_for_device(ring_to_dev(ring), dma, len,
+					   DMA_BIDIRECTIONAL);
+		hns3_fill_xdp_desc(ring, NULL, dma, len, DESC_TYPE_XSK);
+		sent++;
+	}
+
+	if (sent) {
+		hns3_tx_doorbell(ring, sent, true);
+		txq_trans_update(txq);
+		xsk_umem_consume_tx_done(umem);
+	}
+	__netif_tx_unlock(txq);
+
+	return sent < budget;
+}
+
+static int hns3_xsk_async_xmit(struct net_device *netdev, u32 queue_id)
+{
+	struct hns3_nic_priv *priv = netdev_priv(netdev);
+	struct hns3_enet_ring *ring;
+
+	if (test_bit(HNS3_NIC_STATE_DOWN, &priv->state))
+		return -ENETDOWN;
+
+	if (queue_id >= priv->ae_handle->kinfo.num_tqps)
+		return -ENXIO;
+
+	ring = &priv->ring[queue_id];
+	if (!ring->xsk_umem)
+		return -ENXIO;
+
+	/* AF_XDP frames are sent from NAPI, see hns3_nic_common_poll() */
+	local_bh_disable();
+	napi_schedule(&ring->tqp_vector->napi);
+	local_bh_enable();
+
+	return 0;
+}
+
 static int hns3_nic_net_set_mac_address(struct net_device *netdev, void *p)
 {
 	char format_mac_addr_perm[HNAE3_FORMAT_MAC_ADDR_LEN];
@@ -1883,8 +2119,351 @@ static int hns3_set_vf_trust(struct net_device *netdev, int vf, bool enable)
 	return handle->ae_algo->ops->set_vf_trust(handle, vf, enable);
 }
 
+/* A zero-copy buffer that the stack copied out is recycled in place */
+static void hns3_zca_free(struct zero_copy_allocator *zca,
+			  unsigned long handle)
+{
+	struct hns3_enet_ring *ring;
+
+	ring = container_of(zca, struct hns3_enet_ring, zca);
+	ring->desc_cb[ring->next_to_clean].reuse_flag = 1;
+}
+
+static struct xdp_umem *hns3_xsk_umem(struct hns3_nic_priv *priv, u16 qid)
+{
+	if (!priv->xsk_umems || qid >= priv->netdev->num_rx_queues)
+		return NULL;
+
+	return priv->xsk_umems[qid];
+}
+
+/* RX buffer size for a umem, 0 if its chunks are too small for any */
+static u32 hns3_xsk_buf_size(struct xdp_umem *umem)
+{
+	u32 room;
+
+	if (umem->chunk_size_nohr < XDP_PACKET_HEADROOM + 512)
+		return 0;
+
+	room = umem->chunk_size_nohr - XDP_PACKET_HEADROOM;
+
+	return min_t(u32, rounddown_pow_of_two(room), 4096);
+}
+
+static bool hns3_xdp_active(struct hns3_nic_priv *priv)
+{
+	return priv->xdp_prog || priv->num_xsk_umems;
+}
+
+/* Apply the XDP and AF_XDP setup in priv to @ring, it takes effect the
+ * next time the ring memory is set up.
+ */
+static void hns3_ring_xdp_cfg(struct hns3_nic_priv *priv,
+			      struct hns3_enet_ring *ring)
+{
+	struct xdp_umem *umem = hns3_xsk_umem(priv, ring->queue_index);
+
+	ring->xsk_umem = umem;
+	if (HNAE3_IS_TX_RING(ring))
+		return;
+
+	WRITE_ONCE(ring->xdp_prog, priv->xdp_prog);
+	ring->buf_size = umem ? hns3_xsk_buf_size(umem) : ring->tqp->buf_size;
+	hnae3_set_bit(ring->flag, HNS3_RING_RX_XDP_B,
+		      priv->xdp_prog || umem);
+	hnae3_set_bit(ring->flag, HNS3_RING_RX_DISCARD_B, 0);
+}
+
+static int hns3_xdp_rxq_reg(struct hns3_nic_priv *priv,
+			    struct hns3_enet_ring *ring)
+{
+	int ret;
+
+	ret = xdp_rxq_info_reg(&ring->xdp_rxq, priv->netdev,
+			       ring->queue_index);
+	if (ret)
+		return ret;
+
+	if (ring->xsk_umem) {
+		ring->zca.free = hns3_zca_free;
+		ret = xdp_rxq_info_reg_mem_model(&ring->xdp_rxq,
+						 MEM_TYPE_ZERO_COPY,
+						 &ring->zca);
+	} else {
+		ret = xdp_rxq_info_reg_mem_model(&ring->xdp_rxq,
+						 MEM_TYPE_PAGE_SHARED, NULL);
+	}
+	if (ret)
+		xdp_rxq_info_unreg(&ring->xdp_rxq);
+
+	return ret;
+}
+
+/* Check that a frame of @mtu fits in one buffer of every XDP RX ring */
+static bool hns3_xdp_mtu_ok(struct hns3_nic_priv *priv, int mtu)
+{
+	u16 num = priv->ae_handle->kinfo.num_tqps;
+	struct hns3_enet_ring *ring;
+	u32 buf_size;
+	int i;
+
+	for (i = 0; i < num; i++) {
+		ring = &priv->ring[i + num];
+		buf_size = ring->xsk_umem ? hns3_xsk_buf_size(ring->xsk_umem) :
+					    ring->tqp->buf_size;
+		if (HNS3_XDP_FRAME_SIZE(mtu) > buf_size)
+			return false;
+	}
+
+	return true;
+}
+
+/* Restart all rings with the XDP and AF_XDP setup now in priv.  If this
+ * fails the rings are left freed and the caller should restore the old
+ * setup and call it again.
+ */
+static int hns3_xdp_reinit_rings(struct net_device *netdev)
+{
+	struct hns3_nic_priv *priv = netdev_priv(netdev);
+	u16 num = priv->ae_handle->kinfo.num_tqps;
+	bool if_running = netif_running(netdev);
+	struct hns3_enet_ring *ring;
+	int ret, i;
+
+	if (if_running)
+		netdev->netdev_ops->ndo_stop(netdev);
+
+	/* Either all rings have their memory or, after a failure here,
+	 * none has.
+	 */
+	if (priv->ring[0].desc_cb)
+		hns3_uninit_all_ring(priv);
+
+	for (i = 0; i < num * 2; i++) {
+		ring = &priv->ring[i];
+		hns3_ring_xdp_cfg(priv, ring);
+		if (HNAE3_IS_TX_RING(ring))
+			continue;
+
+		xdp_rxq_info_unreg(&ring->xdp_rxq);
+		ret = hns3_xdp_rxq_reg(priv, ring);
+		if (ret) {
+			netdev_err(netdev, "failed to register XDP rxq %d\n",
+				   ret);
+			return ret;
+		}
+	}
+
+	ret = hns3_init_all_ring(priv);
+	if (ret) {
+		netdev_err(netdev, "failed to init rings for XDP %d\n", ret);
+		return ret;
+	}
+
+	if (if_running)
+		ret = netdev->netdev_ops->ndo_open(netdev);
+
+	return ret;
+}
+
+static int hns3_xdp_setup(struct net_device *netdev, struct bpf_prog *prog,
+			  struct netlink_ext_ack *extack)
+{
+	struct hns3_nic_priv *priv = netdev_priv(netdev);
+	u16 num = priv->ae_handle->kinfo.num_tqps;
+	struct hns3_enet_ring *ring;
+	struct bpf_prog *old_prog;
+	int ret, i;
+
+	if (hns3_nic_resetting(netdev))
+		return -EBUSY;
+
+	if (prog) {
+		ring = &priv->ring[num];
+		if (XDP_PACKET_HEADROOM + ring->tqp->buf_size +
+		    SKB_DATA_ALIGN(sizeof(struct skb_shared_info)) >
+		    PAGE_SIZE) {
+			NL_SET_ERR_MSG_MOD(extack,
+					   "RX buffer too large for XDP");
+			return -EOPNOTSUPP;
+		}
+
+		if (!hns3_xdp_mtu_ok(priv, netdev->mtu)) {
+			NL_SET_ERR_MSG_MOD(extack, "MTU too large for XDP");
+			return -EINVAL;
+		}
+	}
+
+	old_prog = priv->xdp_prog;
+	priv->xdp_prog = prog;
+
+	/* Swapping programs keeps the ring layout, no need to restart */
+	if (!old_prog == !prog) {
+		for (i = 0; i < num; i++)
+			WRITE_ONCE(priv->ring[i + num].xdp_prog, prog);
+		goto out;
+	}
+
+	netdev_update_features(netdev);
+	ret = hns3_xdp_reinit_rings(netdev);
+	if (ret) {
+		NL_SET_ERR_MSG_MOD(extack, "failed to restart rings for XDP");
+		priv->xdp_prog = old_prog;
+		netdev_update_features(netdev);
+		if (hns3_xdp_reinit_rings(netdev))
+			netdev_err(netdev, "failed to restore rings\n");
+		return ret;
+	}
+
+out:
+	if (old_prog)
+		bpf_prog_put(old_prog);
+
+	return 0;
+}
+
+static void hns3_xsk_umem_dma_unmap(struct hns3_nic_priv *priv,
+				    struct xdp_umem *umem, u32 npgs)
+{
+	u32 i;
+
+	for (i = 0; i < npgs; i++) {
+		dma_unmap_page_attrs(priv->dev, umem->pages[i].dma, PAGE_SIZE,
+				     DMA_BIDIRECTIONAL, DMA_ATTR_SKIP_CPU_SYNC);
+		umem->pages[i].dma = 0;
+	}
+}
+
+static int hns3_xsk_umem_dma_map(struct hns3_nic_priv *priv,
+				 struct xdp_umem *umem)
+{
+	dma_addr_t dma;
+	u32 i;
+
+	for (i = 0; i < umem->npgs; i++) {
+		dma = dma_map_page_attrs(priv->dev, umem->pgs[i], 0, PAGE_SIZE,
+					 DMA_BIDIRECTIONAL,
+					 DMA_ATTR_SKIP_CPU_SYNC);
+		if (dma_mapping_error(priv->dev, dma)) {
+			hns3_xsk_umem_dma_unmap(priv, umem, i);
+			return -ENOMEM;
+		}
+
+		umem->pages[i].dma = dma;
+	}
+
+	return 0;
+}
+
+static int hns3_xsk_umem_enable(struct net_device *netdev,
+				struct xdp_umem *umem, u16 qid)
+{
+	struct hns3_nic_priv *priv = netdev_priv(netdev);
+	u32 buf_size = hns3_xsk_buf_size(umem);
+	int ret;
+
+	if (hns3_nic_resetting(netdev) || hns3_xsk_umem(priv, qid))
+		return -EBUSY;
+
+	if (!buf_size || HNS3_XDP_FRAME_SIZE(netdev->mtu) > buf_size) {
+		netdev_err(netdev, "umem chunk too small for MTU %u\n",
+			   netdev->mtu);
+		return -EINVAL;
+	}
+
+	if (!priv->xsk_umems) {
+		priv->xsk_umems = kcalloc(netdev->num_rx_queues,
+					  sizeof(*priv->xsk_umems),
+					  GFP_KERNEL);
+		if (!priv->xsk_umems)
+			return -ENOMEM;
+	}
+
+	ret = hns3_xsk_umem_dma_map(priv, umem);
+	if (ret)
+		return ret;
+
+	priv->xsk_umems[qid] = umem;
+	priv->num_xsk_umems++;
+	netdev_update_features(netdev);
+
+	ret = hns3_xdp_reinit_rings(netdev);
+	if (ret) {
+		priv->xsk_umems[qid] = NULL;
+		priv->num_xsk_umems--;
+		netdev_update_features(netdev);
+		if (hns3_xdp_reinit_rings(netdev))
+			netdev_err(netdev, "failed to restore rings\n");
+		hns3_xsk_umem_dma_unmap(priv, umem, umem->npgs);
+	}
+
+	return ret;
+}
+
+static int hns3_xsk_umem_disable(struct net_device *netdev, u16 qid)
+{
+	struct hns3_nic_priv *priv = netdev_priv(netdev);
+	struct xdp_umem *umem = hns3_xsk_umem(priv, qid);
+	int ret;
+
+	if (!umem)
+		return -EINVAL;
+
+	/* The umem is going away, so there is no going back to it even if
+	 * the rings fail to restart.
+	 */
+	priv->xsk_umems[qid] = NULL;
+	priv->num_xsk_umems--;
+	netdev_update_features(netdev);
+
+	ret = hns3_xdp_reinit_rings(netdev);
+	hns3_xsk_umem_dma_unmap(priv, umem, umem->npgs);
+
+	return ret;
+}
+
+static int hns3_nic_bpf(struct net_device *netdev, struct netdev_bpf *bpf)
+{
+	struct hns3_nic_priv *priv = netdev_priv(netdev);
+	u16 qid = bpf->xsk.queue_id;
+
+	switch (bpf->command) {
+	case XDP_SETUP_PROG:
+		return hns3_xdp_setup(netdev, bpf->prog, bpf->extack);
+	case XDP_QUERY_PROG:
+		bpf->prog_id = priv->xdp_prog ? priv->xdp_prog->aux->id : 0;
+		return 0;
+	case XDP_SETUP_XSK_UMEM:
+		if (bpf->xsk.queue_id >= priv->ae_handle->kinfo.num_tqps)
+			return -EINVAL;
+		return bpf->xsk.umem ?
+		       hns3_xsk_umem_enable(netdev, bpf->xsk.umem, qid) :
+		       hns3_xsk_umem_disable(netdev, qid);
+	case XDP_QUERY_XSK_UMEM:
+		if (bpf->xsk.queue_id >= priv->ae_handle->kinfo.num_tqps)
+			return -EINVAL;
+		bpf->xsk.umem = hns3_xsk_umem(priv, qid);
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+#ifdef NETIF_F_GRO_HW
+static netdev_features_t hns3_fix_features(struct net_device *netdev,
+					   netdev_features_t features)
+{
+	/* HW GRO builds frames over several BDs, which XDP can't run on */
+	if (hns3_xdp_active(netdev_priv(netdev)))
+		features &= ~NETIF_F_GRO_HW;
+
+	return features;
+}
+#endif
+
 static int hns3_nic_change_mtu(struct net_device *netdev, int new_mtu)
 {
+	struct hns3_nic_priv *priv = netdev_priv(netdev);
 	struct hnae3_handle *h = hns3_get_handle(netdev);
 	int ret;
 
@@ -1894,6 +2473,11 @@ static int hns3_nic_change_mtu(struct net_device *netdev, int new_mtu)
 	if (!h->ae_algo->ops->set_mtu)
 		return -EOPNOTSUPP;
 
+	if (hns3_xdp_active(priv) && !hns3_xdp_mtu_ok(priv, new_mtu)) {
+		netdev_err(netdev, "MTU %d too large for XDP\n", new_mtu);
+		return -EINVAL;
+	}
+
 	if (netif_msg_ifdown(h))
 		netdev_info(netdev, "change mtu from %u to %d\n",
 			    netdev->mtu, new_mtu);
@@ -2131,6 +2715,12 @@ struct net_device_ops hns3_nic_netdev_ops = {
 	.ndo_set_vf_link_state	= hns3_nic_set_vf_link_state,
 	.ndo_set_vf_rate	= hns3_nic_set_vf_rate,
 	.ndo_set_vf_mac		= hns3_nic_set_vf_mac,
+	.ndo_bpf		= hns3_nic_bpf,
+	.ndo_xdp_xmit		= hns3_nic_xdp_xmit,
+	.ndo_xsk_async_xmit	= hns3_xsk_async_xmit,
+#ifdef NETIF_F_GRO_HW
+	.ndo_fix_features	= hns3_fix_features,
+#endif
 };
 
 bool hns3_is_phys_func(struct pci_dev *pdev)
@@ -2435,6 +3025,9 @@ static void hns3_set_default_feature(struct net_device *netdev)
 		NETIF_F_FRAGLIST;
 
 	if (pdev->revision > HNAE3_REVISION_ID_20) {
+		netdev->features |= NETIF_F_GSO_UDP_L4;
+		netdev->hw_features |= NETIF_F_GSO_UDP_L4;
+		netdev->vlan_features |= NETIF_F_GSO_UDP_L4;
 #ifdef NETIF_F_GRO_HW
 		netdev->features |= NETIF_F_GRO_HW;
 		netdev->hw_features |= NETIF_F_GRO_HW;
@@ -2449,24 +3042,60 @@ static void hns3_set_default_feature(struct net_device *netdev)
 		netdev->hw_features |= NETIF_F_HW_VLAN_CTAG_FILTER;
 }
 
+/* Take back the oldest parked RX page if the stack is done with it */
+static struct page *hns3_rx_cache_get(struct hns3_enet_ring *ring, u16 *bias)
+{
+	struct hns3_rx_page_cache *cache = ring->page_cache;
+	struct page *page;
+	u32 i;
+
+	if (cache->head == cache->tail)
+		return NULL;
+
+	i = cache->head & cache->mask;
+	page = cache->entry[i].page;
+	if (page_count(page) != cache->entry[i].pagecnt_bias)
+		return NULL;
+
+	*bias = cache->entry[i].pagecnt_bias;
+	cache->head++;
+
+	return page;
+}
+
+/* Drop the @bias references the driver holds on an RX page.  The pool
+ * keeps the page, still mapped, only if nobody else holds it.
+ */
+static void hns3_rx_page_put(struct hns3_enet_ring *ring, struct page *page,
+			     u16 bias)
+{
+	page_ref_sub(page, bias - 1);
+	page_pool_put_page(ring->page_pool, page, true);
+}
+
 static int hns3_alloc_buffer(struct hns3_enet_ring *ring,
 			     struct hns3_desc_cb *cb)
 {
-	unsigned int order = hns3_page_order(ring);
 	struct page *p;
+	u16 bias;
 
-	p = dev_alloc_pages(order);
-	if (!p)
-		return -ENOMEM;
+	p = hns3_rx_cache_get(ring, &bias);
+	if (!p) {
+		p = page_pool_dev_alloc_pages(ring->page_pool);
+		if (!p)
+			return -ENOMEM;
+
+		page_ref_add(p, USHRT_MAX - 1);
+		bias = USHRT_MAX;
+	}
 
 	cb->priv = p;
-	cb->page_offset = 0;
+	cb->page_offset = hns3_ring_rx_xdp(ring) ? XDP_PACKET_HEADROOM : 0;
 	cb->reuse_flag = 0;
 	cb->buf  = page_address(p);
 	cb->length = hns3_page_size(ring);
 	cb->type = DESC_TYPE_PAGE;
-	page_ref_add(p, USHRT_MAX - 1);
-	cb->pagecnt_bias = USHRT_MAX;
+	cb->pagecnt_bias = bias;
 
 	return 0;
 }
@@ -2474,31 +3103,36 @@ static int hns3_alloc_buffer(struct hns3_enet_ring *ring,
 static void hns3_free_buffer(struct hns3_enet_ring *ring,
 			     struct hns3_desc_cb *cb, int budget)
 {
-	if (cb->type == DESC_TYPE_SKB)
+	if (cb->type == DESC_TYPE_SKB || cb->type == DESC_TYPE_BOUNCE)
 		napi_consume_skb(cb->priv, budget);
+	else if (cb->type == DESC_TYPE_XDP)
+		xdp_return_frame(cb->priv);
 	else if (!HNAE3_IS_TX_RING(ring) && cb->pagecnt_bias)
-		__page_frag_cache_drain(cb->priv, cb->pagecnt_bias);
+		hns3_rx_page_put(ring, cb->priv, cb->pagecnt_bias);
 	memset(cb, 0, sizeof(*cb));
 }
 
-static int hns3_map_buffer(struct hns3_enet_ring *ring, struct hns3_desc_cb *cb)
+/* The page pool maps RX pages once and keeps them mapped while they are
+ * recycled, only hand the buffer back to the device here.
+ */
+static void hns3_map_buffer(struct hns3_enet_ring *ring,
+			    struct hns3_desc_cb *cb)
 {
-	cb->dma = dma_map_page(ring_to_dev(ring), cb->priv, 0,
-			       cb->length, ring_to_dma_dir(ring));
-
-	if (unlikely(dma_mapping_error(ring_to_dev(ring), cb->dma)))
-		return -EIO;
-
-	return 0;
+	cb->dma = page_private(cb->priv);
+	dma_sync_single_for_device(ring_to_dev(ring),
+				   cb->dma + cb->page_offset,
+				   hns3_buf_size(ring), DMA_FROM_DEVICE);
 }
 
 static void hns3_unmap_buffer(struct hns3_enet_ring *ring,
 			      struct hns3_desc_cb *cb)
 {
-	if (cb->type == DESC_TYPE_SKB || cb->type == DESC_TYPE_FRAGLIST_SKB)
+	if (cb->type == DESC_TYPE_SKB || cb->type == DESC_TYPE_FRAGLIST_SKB ||
+	    cb->type == DESC_TYPE_XDP)
 		dma_unmap_single(ring_to_dev(ring), cb->dma, cb->length,
 				 ring_to_dma_dir(ring));
-	else if (cb->length)
+	else if (cb->length && cb->type != DESC_TYPE_XSK &&
+		 cb->type != DESC_TYPE_BOUNCE && HNAE3_IS_TX_RING(ring))
 		dma_unmap_page(ring_to_dev(ring), cb->dma, cb->length,
 			       ring_to_dma_dir(ring));
 }
@@ -2555,25 +3189,49 @@ static int hns3_alloc_desc(struct hns3_enet_ring *ring)
 	return 0;
 }
 
+/* Take the next buffer the AF_XDP socket put on the umem fill queue */
+static int hns3_alloc_xsk_buffer(struct hns3_enet_ring *ring,
+				 struct hns3_desc_cb *cb)
+{
+	struct xdp_umem *umem = ring->xsk_umem;
+	u32 hr = umem->headroom + XDP_PACKET_HEADROOM;
+	u64 handle;
+
+	if (!xsk_umem_peek_addr(umem, &handle))
+		return -ENOBUFS;
+
+	cb->handle = handle;
+	cb->dma = xdp_umem_get_dma(umem, handle) + hr;
+	cb->buf = xdp_umem_get_data(umem, handle) + hr;
+	cb->page_offset = 0;
+	cb->length = 0;
+	cb->reuse_flag = 0;
+	cb->type = DESC_TYPE_XSK;
+	cb->pagecnt_bias = 0;
+
+	xsk_umem_discard_addr(umem);
+
+	dma_sync_single_for_device(ring_to_dev(ring), cb->dma,
+				   hns3_buf_size(ring), DMA_BIDIRECTIONAL);
+
+	return 0;
+}
+
 static int hns3_alloc_and_map_buffer(struct hns3_enet_ring *ring,
 				     struct hns3_desc_cb *cb)
 {
 	int ret;
 
+	if (ring->xsk_umem)
+		return hns3_alloc_xsk_buffer(ring, cb);
+
 	ret = hns3_alloc_buffer(ring, cb);
 	if (ret)
-		goto out;
+		return ret;
 
-	ret = hns3_map_buffer(ring, cb);
-	if (ret)
-		goto out_with_buf;
+	hns3_map_buffer(ring, cb);
 
 	return 0;
-
-out_with_buf:
-	hns3_free_buffer(ring, cb, 0);
-out:
-	return ret;
 }
 
 static int hns3_alloc_and_attach_buffer(struct hns3_enet_ring *ring, int i)
@@ -2583,7 +3241,8 @@ static int hns3_alloc_and_attach_buffer(struct hns3_enet_ring *ring, int i)
 	if (ret)
 		return ret;
 
-	ring->desc[i].addr = cpu_to_le64(ring->desc_cb[i].dma);
+	ring->desc[i].addr = cpu_to_le64(ring->desc_cb[i].dma +
+					 ring->desc_cb[i].page_offset);
 
 	return 0;
 }
@@ -2613,7 +3272,8 @@ static void hns3_replace_buffer(struct hns3_enet_ring *ring, int i,
 {
 	hns3_unmap_buffer(ring, &ring->desc_cb[i]);
 	ring->desc_cb[i] = *res_cb;
-	ring->desc[i].addr = cpu_to_le64(ring->desc_cb[i].dma);
+	ring->desc[i].addr = cpu_to_le64(ring->desc_cb[i].dma +
+					 ring->desc_cb[i].page_offset);
 	ring->desc[i].rx.bd_base_info = 0;
 }
 
@@ -2627,7 +3287,7 @@ static void hns3_reuse_buffer(struct hns3_enet_ring *ring, int i)
 	dma_sync_single_for_device(ring_to_dev(ring),
 			ring->desc_cb[i].dma + ring->desc_cb[i].page_offset,
 			hns3_buf_size(ring),
-			DMA_FROM_DEVICE);
+			hns3_rx_sync_dir(ring));
 }
 
 static bool hns3_nic_reclaim_desc(struct hns3_enet_ring *ring,
@@ -2638,9 +3298,11 @@ static bool hns3_nic_reclaim_desc(struct hns3_enet_ring *ring,
 	 */
 	int ltu = smp_load_acquire(&ring->last_to_use);
 	int ntc = ring->next_to_clean;
+	u32 xdp_pkts = 0, xdp_bytes = 0;
 	struct hns3_desc_cb *desc_cb;
 	bool reclaimed = false;
 	struct hns3_desc *desc;
+	u32 xsk_frames = 0;
 
 	while (ltu != ntc) {
 		desc = &ring->desc[ntc];
@@ -2651,9 +3313,17 @@ static bool hns3_nic_reclaim_desc(struct hns3_enet_ring *ring,
 
 		desc_cb = &ring->desc_cb[ntc];
 
-		if (desc_cb->type == DESC_TYPE_SKB) {
+		if (desc_cb->type == DESC_TYPE_SKB ||
+		    desc_cb->type == DESC_TYPE_BOUNCE) {
 			(*pkts)++;
 			(*bytes) += desc_cb->send_bytes;
+		} else if (desc_cb->type == DESC_TYPE_XDP ||
+			   desc_cb->type == DESC_TYPE_XSK) {
+			/* not accounted to BQL, they never went through it */
+			xdp_pkts++;
+			xdp_bytes += desc_cb->send_bytes;
+			if (desc_cb->type == DESC_TYPE_XSK)
+				xsk_frames++;
 		}
 
 		/* desc_cb will be cleaned, after hnae3_free_buffer_detach */
@@ -2670,6 +3340,17 @@ static bool hns3_nic_reclaim_desc(struct hns3_enet_ring *ring,
 	if (unlikely(!reclaimed))
 		return false;
 
+	if (xsk_frames)
+		xsk_umem_complete_tx(ring->xsk_umem, xsk_frames);
+
+	if (xdp_pkts) {
+		u64_stats_update_begin(&ring->syncp);
+		ring->stats.tx_pkts += xdp_pkts;
+		ring->stats.tx_bytes += xdp_bytes;
+		ring->stats.tx_xdp += xdp_pkts;
+		u64_stats_update_end(&ring->syncp);
+	}
+
 	/* This smp_store_release() pairs with smp_load_acquire() in
 	 * ring_space called by hns3_nic_net_xmit.
 	 */
@@ -2740,6 +3421,9 @@ static void hns3_nic_alloc_rx_buffers(struct hns3_enet_ring *ring,
 			hns3_reuse_buffer(ring, ring->next_to_use);
 		} else {
 			ret = hns3_alloc_and_map_buffer(ring, &res_cbs);
+			/* AF_XDP fill queue empty, retried on next poll */
+			if (ret == -ENOBUFS)
+				break;
 			if (ret) {
 				u64_stats_update_begin(&ring->syncp);
 				ring->stats.sw_err_cnt++;
@@ -2769,6 +3453,28 @@ static bool hns3_page_is_reusable(struct page *page)
 		!page_is_pfmemalloc(page);
 }
 
+/* Let go of an RX page the driver can not flip and reuse now.  A local
+ * page is parked in ring->page_cache, still DMA mapped, and goes back on
+ * the ring from there once the stack has freed it.  Without the cache the
+ * page would be unmapped here and a new one allocated and mapped.
+ */
+static void hns3_rx_page_release(struct hns3_enet_ring *ring,
+				 struct hns3_desc_cb *cb)
+{
+	struct hns3_rx_page_cache *cache = ring->page_cache;
+	u32 i;
+
+	if (likely(hns3_page_is_reusable(cb->priv)) &&
+	    cache->tail - cache->head <= cache->mask) {
+		i = cache->tail++ & cache->mask;
+		cache->entry[i].page = cb->priv;
+		cache->entry[i].pagecnt_bias = cb->pagecnt_bias;
+		return;
+	}
+
+	hns3_rx_page_put(ring, cb->priv, cb->pagecnt_bias);
+}
+
 static bool hns3_can_reuse_page(struct hns3_desc_cb *cb)
 {
 	return (page_count(cb->priv) - cb->pagecnt_bias) == 1;
@@ -2786,12 +3492,20 @@ static void hns3_nic_reuse_page(struct sk_buff *skb, int i,
 	skb_add_rx_frag(skb, i, desc_cb->priv, desc_cb->page_offset + pull_len,
 			size - pull_len, truesize);
 
+	/* The page may end up mapped into user space by TCP receive
+	 * zerocopy, never hand it back to the hardware while in use.
+	 */
+	if (hns3_ring_rx_page(ring)) {
+		hns3_rx_page_release(ring, desc_cb);
+		return;
+	}
+
 	/* Avoid re-using remote pages, or the stack is still using the page
 	 * when page_offset rollback to zero, flag default unreuse
 	 */
 	if (unlikely(!hns3_page_is_reusable(desc_cb->priv)) ||
 	    (!desc_cb->page_offset && !hns3_can_reuse_page(desc_cb))) {
-		__page_frag_cache_drain(desc_cb->priv, desc_cb->pagecnt_bias);
+		hns3_rx_page_release(ring, desc_cb);
 		return;
 	}
 
@@ -2804,7 +3518,7 @@ static void hns3_nic_reuse_page(struct sk_buff *skb, int i,
 		desc_cb->reuse_flag = 1;
 		desc_cb->page_offset = 0;
 	} else if (desc_cb->pagecnt_bias) {
-		__page_frag_cache_drain(desc_cb->priv, desc_cb->pagecnt_bias);
+		hns3_rx_page_release(ring, desc_cb);
 		return;
 	}
 
@@ -2836,7 +3550,10 @@ static int hns3_gro_complete(struct sk_buff *skb, u32 l234info)
 	if (type == htons(ETH_P_IP)) {
 		const struct iphdr *iph = ip_hdr(skb);
 
-		depth += sizeof(struct iphdr);
+		/* the transport header must be right for the stack to
+		 * resegment the frame when it is forwarded
+		 */
+		depth += iph->ihl * 4;
 		skb_set_transport_header(skb, depth);
 		th = tcp_hdr(skb);
 		th->check = ~tcp_v4_check(skb->len - depth, iph->saddr,
@@ -3028,8 +3745,8 @@ static int hns3_alloc_skb(struct hns3_enet_ring *ring, unsigned int length,
 		if (likely(hns3_page_is_reusable(desc_cb->priv)))
 			desc_cb->reuse_flag = 1;
 		else /* This page cannot be reused so discard it */
-			__page_frag_cache_drain(desc_cb->priv,
-						desc_cb->pagecnt_bias);
+			hns3_rx_page_put(ring, desc_cb->priv,
+					 desc_cb->pagecnt_bias);
 
 		hns3_rx_ring_move_fw(ring);
 		return 0;
@@ -3237,6 +3954,204 @@ static int hns3_handle_bdinfo(struct hns3_enet_ring *ring, struct sk_buff *skb)
 	return 0;
 }
 
+static int hns3_xdp_xmit_back(struct hns3_enet_ring *rx_ring,
+			      struct xdp_buff *xdp)
+{
+	struct net_device *netdev = ring_to_netdev(rx_ring);
+	struct hns3_nic_priv *priv = netdev_priv(netdev);
+	struct hns3_enet_ring *ring = &priv->ring[rx_ring->queue_index];
+	struct xdp_frame *xdpf = convert_to_xdp_frame(xdp);
+	struct netdev_queue *txq;
+	int ret;
+
+	if (unlikely(!xdpf))
+		return -EOVERFLOW;
+
+	txq = netdev_get_tx_queue(netdev, ring->queue_index);
+
+	__netif_tx_lock(txq, smp_processor_id());
+	ret = hns3_xmit_xdp_frame(ring, xdpf);
+	if (!ret) {
+		/* doorbell is rung once per poll by hns3_xdp_finalize() */
+		hns3_tx_doorbell(ring, 1, false);
+		txq_trans_update(txq);
+	}
+	__netif_tx_unlock(txq);
+
+	return ret;
+}
+
+/* Flush what XDP queued up while cleaning @ring */
+static void hns3_xdp_finalize(struct hns3_enet_ring *ring)
+{
+	struct net_device *netdev = ring_to_netdev(ring);
+	struct hns3_nic_priv *priv = netdev_priv(netdev);
+	struct hns3_enet_ring *tx_ring;
+	struct netdev_queue *txq;
+
+	if (ring->xdp_status & HNS3_XDP_REDIR)
+		xdp_do_flush_map();
+
+	if (ring->xdp_status & HNS3_XDP_TX) {
+		tx_ring = &priv->ring[ring->queue_index];
+		txq = netdev_get_tx_queue(netdev, tx_ring->queue_index);
+
+		__netif_tx_lock(txq, smp_processor_id());
+		hns3_tx_doorbell(tx_ring, 0, true);
+		__netif_tx_unlock(txq);
+	}
+
+	ring->xdp_status = 0;
+}
+
+static struct sk_buff *hns3_xdp_build_skb(struct hns3_enet_ring *ring,
+					  struct hns3_desc_cb *desc_cb,
+					  struct xdp_buff *xdp)
+{
+	unsigned int len = xdp->data_end - xdp->data;
+	struct sk_buff *skb;
+
+	/* The umem buffer is the socket's, copy the frame out of it */
+	if (ring->xsk_umem) {
+		skb = napi_alloc_skb(&ring->tqp_vector->napi, len);
+		if (likely(skb)) {
+			skb_put_data(skb, xdp->data, len);
+			desc_cb->reuse_flag = 1;
+		}
+		return skb;
+	}
+
+	skb = build_skb(xdp->data_hard_start, PAGE_SIZE);
+	if (unlikely(!skb))
+		return NULL;
+
+	skb_reserve(skb, xdp->data - xdp->data_hard_start);
+	__skb_put(skb, len);
+
+	/* The page goes with the skb, give up the references we hold */
+	desc_cb->pagecnt_bias--;
+	hns3_rx_page_release(ring, desc_cb);
+
+	return skb;
+}
+
+/* Run XDP on the frame at next_to_clean of an XDP ring.  Returns 0 with
+ * ring->skb set if the frame goes on to the stack, or HNS3_RX_XDP_DONE if
+ * XDP took or dropped it.
+ */
+static int hns3_handle_xdp_bd(struct hns3_enet_ring *ring, u32 bd_base_info,
+			      unsigned int length)
+{
+	struct hns3_desc_cb *desc_cb = &ring->desc_cb[ring->next_to_clean];
+	struct bpf_prog *prog = READ_ONCE(ring->xdp_prog);
+	struct net_device *netdev = ring_to_netdev(ring);
+	bool zc = !!ring->xsk_umem;
+	bool consumed = false;
+	struct xdp_buff xdp;
+	u32 act = XDP_PASS;
+
+	trace_hns3_rx_desc(ring);
+	ring->pending_buf = 1;
+
+	/* Frames over one buffer can not be run through XDP, drop all of
+	 * their BDs.  MTU and HW GRO are limited so that this is rare.
+	 */
+	if (unlikely(!(bd_base_info & BIT(HNS3_RXD_FE_B)) ||
+		     hnae3_get_bit(ring->flag, HNS3_RING_RX_DISCARD_B))) {
+		if (!hnae3_get_bit(ring->flag, HNS3_RING_RX_DISCARD_B)) {
+			u64_stats_update_begin(&ring->syncp);
+			ring->stats.err_bd_num++;
+			u64_stats_update_end(&ring->syncp);
+		}
+		hnae3_set_bit(ring->flag, HNS3_RING_RX_DISCARD_B,
+			      !(bd_base_info & BIT(HNS3_RXD_FE_B)));
+		desc_cb->reuse_flag = 1;
+		hns3_rx_ring_move_fw(ring);
+		return HNS3_RX_XDP_DONE;
+	}
+
+	xdp.data = ring->va;
+	xdp.data_hard_start = xdp.data - XDP_PACKET_HEADROOM;
+	xdp.data_end = xdp.data + length;
+	xdp_set_data_meta_invalid(&xdp);
+	xdp.rxq = &ring->xdp_rxq;
+	if (zc)
+		xdp.handle = desc_cb->handle + ring->xsk_umem->headroom;
+
+	if (prog)
+		act = bpf_prog_run_xdp(prog, &xdp);
+
+	switch (act) {
+	case XDP_PASS:
+		ring->skb = hns3_xdp_build_skb(ring, desc_cb, &xdp);
+		if (likely(ring->skb)) {
+			hns3_rx_ring_move_fw(ring);
+			return 0;
+		}
+
+		hns3_rl_err(netdev, "alloc rx skb fail\n");
+		u64_stats_update_begin(&ring->syncp);
+		ring->stats.sw_err_cnt++;
+		u64_stats_update_end(&ring->syncp);
+		break;
+	case XDP_TX:
+		/* Hand one page reference over to the frame */
+		if (!zc)
+			desc_cb->pagecnt_bias--;
+		consumed = !hns3_xdp_xmit_back(ring, &xdp);
+		break;
+	case XDP_REDIRECT:
+		if (zc)
+			xdp.handle += xdp.data - xdp.data_hard_start;
+		else
+			desc_cb->pagecnt_bias--;
+		consumed = !xdp_do_redirect(netdev, &xdp, prog);
+		break;
+	default:
+		bpf_warn_invalid_xdp_action(act);
+		/* fall through */
+	case XDP_ABORTED:
+		trace_xdp_exception(netdev, prog, act);
+		/* fall through */
+	case XDP_DROP:
+		break;
+	}
+
+	if (act == XDP_TX || act == XDP_REDIRECT) {
+		if (consumed) {
+			ring->xdp_status |= act == XDP_TX ? HNS3_XDP_TX :
+							    HNS3_XDP_REDIR;
+			/* The frame owns the page now, drop our references */
+			if (!zc)
+				hns3_rx_page_release(ring, desc_cb);
+		} else {
+			if (!zc)
+				desc_cb->pagecnt_bias++;
+			trace_xdp_exception(netdev, prog, act);
+		}
+	}
+
+	/* Give a dropped frame's buffer straight back to the hardware */
+	if (!consumed)
+		desc_cb->reuse_flag = 1;
+
+	u64_stats_update_begin(&ring->syncp);
+	ring->stats.rx_pkts++;
+	ring->stats.rx_bytes += length;
+	if (!consumed)
+		ring->stats.xdp_drop++;
+	else if (act == XDP_TX)
+		ring->stats.xdp_tx++;
+	else
+		ring->stats.xdp_redirect++;
+	u64_stats_update_end(&ring->syncp);
+
+	ring->tqp_vector->rx_group.total_bytes += length;
+	hns3_rx_ring_move_fw(ring);
+
+	return HNS3_RX_XDP_DONE;
+}
+
 static int hns3_handle_rx_bd(struct hns3_enet_ring *ring)
 {
 	struct sk_buff *skb = ring->skb;
@@ -3266,7 +4181,7 @@ static int hns3_handle_rx_bd(struct hns3_enet_ring *ring)
 		dma_sync_single_for_cpu(ring_to_dev(ring),
 				desc_cb->dma + desc_cb->page_offset,
 				hns3_buf_size(ring),
-				DMA_FROM_DEVICE);
+				hns3_rx_sync_dir(ring));
 
 		/* Prefetch first cache line of first page.
 		 * Idea is to cache few bytes of the header of the packet.
@@ -3280,6 +4195,9 @@ static int hns3_handle_rx_bd(struct hns3_enet_ring *ring)
 		prefetch(ring->va + L1_CACHE_BYTES);
 #endif
 
+		if (hns3_ring_rx_xdp(ring))
+			return hns3_handle_xdp_bd(ring, bd_base_info, length);
+
 		ret = hns3_alloc_skb(ring, length, ring->va);
 		skb = ring->skb;
 
@@ -3333,8 +4251,10 @@ int hns3_clean_rx_ring(struct hns3_enet_ring *ring, int budget,
 
 		/* Poll one pkt */
 		err = hns3_handle_rx_bd(ring);
-		/* Do not get FE for the packet or failed to alloc skb */
-		if (unlikely(!ring->skb || err == -ENXIO)) {
+		if (err == HNS3_RX_XDP_DONE) {
+			recv_pkts++;
+		} else if (unlikely(!ring->skb || err == -ENXIO)) {
+			/* Do not get FE for the packet or failed to alloc skb */
 			goto out;
 		} else if (likely(!err)) {
 			rx_fn(ring, ring->skb);
@@ -3347,146 +4267,73 @@ int hns3_clean_rx_ring(struct hns3_enet_ring *ring, int budget,
 	}
 
 out:
+	if (ring->xdp_status)
+		hns3_xdp_finalize(ring);
+
 	/* Make all data has been write before submit */
 	if (unused_count > 0)
 		hns3_nic_alloc_rx_buffers(ring, unused_count);
 
+	/* Keep polling until the AF_XDP fill queue can refill the ring,
+	 * no interrupt comes while the hardware has no buffer to use.
+	 */
+	if (ring->xsk_umem && hns3_desc_unused(ring) - ring->pending_buf > 0)
+		return budget;
+
 	return recv_pkts;
 }
 
-static bool hns3_get_new_flow_lvl(struct hns3_enet_ring_group *ring_group)
+static void hns3_rx_dim_work(struct work_struct *work)
 {
-#define HNS3_RX_LOW_BYTE_RATE 10000
-#define HNS3_RX_MID_BYTE_RATE 20000
-#define HNS3_RX_ULTRA_PACKET_RATE 40
-
-	enum hns3_flow_level_range new_flow_level;
-	struct hns3_enet_tqp_vector *tqp_vector;
-	int packets_per_msecs, bytes_per_msecs;
-	u32 time_passed_ms;
+	struct net_dim *dim = container_of(work, struct net_dim, work);
+	struct hns3_enet_ring_group *group =
+		container_of(dim, struct hns3_enet_ring_group, dim);
+	struct net_dim_cq_moder moder;
 
-	tqp_vector = ring_group->ring->tqp_vector;
-	time_passed_ms =
-		jiffies_to_msecs(jiffies - tqp_vector->last_jiffies);
-	if (!time_passed_ms)
-		return false;
-
-	do_div(ring_group->total_packets, time_passed_ms);
-	packets_per_msecs = ring_group->total_packets;
-
-	do_div(ring_group->total_bytes, time_passed_ms);
-	bytes_per_msecs = ring_group->total_bytes;
-
-	new_flow_level = ring_group->coal.flow_level;
+	moder = net_dim_get_rx_moderation(dim->mode, dim->profile_ix);
 
-	/* Simple throttlerate management
-	 * 0-10MB/s   lower     (50000 ints/s)
-	 * 10-20MB/s   middle    (20000 ints/s)
-	 * 20-1249MB/s high      (18000 ints/s)
-	 * > 40000pps  ultra     (8000 ints/s)
-	 */
-	switch (new_flow_level) {
-	case HNS3_FLOW_LOW:
-		if (bytes_per_msecs > HNS3_RX_LOW_BYTE_RATE)
-			new_flow_level = HNS3_FLOW_MID;
-		break;
-	case HNS3_FLOW_MID:
-		if (bytes_per_msecs > HNS3_RX_MID_BYTE_RATE)
-			new_flow_level = HNS3_FLOW_HIGH;
-		else if (bytes_per_msecs <= HNS3_RX_LOW_BYTE_RATE)
-			new_flow_level = HNS3_FLOW_LOW;
-		break;
-	case HNS3_FLOW_HIGH:
-	case HNS3_FLOW_ULTRA:
-	default:
-		if (bytes_per_msecs <= HNS3_RX_MID_BYTE_RATE)
-			new_flow_level = HNS3_FLOW_MID;
-		break;
+	/* ethtool may have turned adaptive moderation off meanwhile */
+	if (group->coal.gl_adapt_enable) {
+		group->coal.int_gl = hns3_gl_round_down(moder.usec);
+		hns3_set_vector_coalesce_rx_gl(group->ring->tqp_vector,
+					       group->coal.int_gl);
 	}
 
-	if (packets_per_msecs > HNS3_RX_ULTRA_PACKET_RATE &&
-	    &tqp_vector->rx_group == ring_group)
-		new_flow_level = HNS3_FLOW_ULTRA;
-
-	ring_group->total_bytes = 0;
-	ring_group->total_packets = 0;
-	ring_group->coal.flow_level = new_flow_level;
-
-	return true;
+	dim->state = NET_DIM_START_MEASURE;
 }
 
-static bool hns3_get_new_int_gl(struct hns3_enet_ring_group *ring_group)
+static void hns3_tx_dim_work(struct work_struct *work)
 {
-	struct hns3_enet_tqp_vector *tqp_vector;
-	u16 new_int_gl;
-
-	if (!ring_group->ring)
-		return false;
-
-	tqp_vector = ring_group->ring->tqp_vector;
-	if (!tqp_vector->last_jiffies)
-		return false;
-
-	if (ring_group->total_packets == 0) {
-		ring_group->coal.int_gl = HNS3_INT_GL_50K;
-		ring_group->coal.flow_level = HNS3_FLOW_LOW;
-		return true;
-	}
+	struct net_dim *dim = container_of(work, struct net_dim, work);
+	struct hns3_enet_ring_group *group =
+		container_of(dim, struct hns3_enet_ring_group, dim);
+	struct net_dim_cq_moder moder;
 
-	if (!hns3_get_new_flow_lvl(ring_group))
-		return false;
+	moder = net_dim_get_tx_moderation(dim->mode, dim->profile_ix);
 
-	new_int_gl = ring_group->coal.int_gl;
-	switch (ring_group->coal.flow_level) {
-	case HNS3_FLOW_LOW:
-		new_int_gl = HNS3_INT_GL_50K;
-		break;
-	case HNS3_FLOW_MID:
-		new_int_gl = HNS3_INT_GL_20K;
-		break;
-	case HNS3_FLOW_HIGH:
-		new_int_gl = HNS3_INT_GL_18K;
-		break;
-	case HNS3_FLOW_ULTRA:
-		new_int_gl = HNS3_INT_GL_8K;
-		break;
-	default:
-		break;
+	if (group->coal.gl_adapt_enable) {
+		group->coal.int_gl = hns3_gl_round_down(moder.usec);
+		hns3_set_vector_coalesce_tx_gl(group->ring->tqp_vector,
+					       group->coal.int_gl);
 	}
 
-	if (new_int_gl != ring_group->coal.int_gl) {
-		ring_group->coal.int_gl = new_int_gl;
-		return true;
-	}
-	return false;
+	dim->state = NET_DIM_START_MEASURE;
 }
 
-static void hns3_update_new_int_gl(struct hns3_enet_tqp_vector *tqp_vector)
+/* Feed the interrupt, packet and byte counts of a ring group to net_dim,
+ * which picks the GL for it once it has seen enough interrupts.
+ */
+static void hns3_update_int_coalesce(struct hns3_enet_tqp_vector *tqp_vector,
+				     struct hns3_enet_ring_group *group)
 {
-	struct hns3_enet_ring_group *rx_group = &tqp_vector->rx_group;
-	struct hns3_enet_ring_group *tx_group = &tqp_vector->tx_group;
-	bool rx_update, tx_update;
+	struct net_dim_sample sample;
 
-	/* update param every 1000ms */
-	if (time_before(jiffies,
-			tqp_vector->last_jiffies + msecs_to_jiffies(1000)))
+	if (!group->ring || !group->coal.gl_adapt_enable)
 		return;
 
-	if (rx_group->coal.gl_adapt_enable) {
-		rx_update = hns3_get_new_int_gl(rx_group);
-		if (rx_update)
-			hns3_set_vector_coalesce_rx_gl(tqp_vector,
-						       rx_group->coal.int_gl);
-	}
-
-	if (tx_group->coal.gl_adapt_enable) {
-		tx_update = hns3_get_new_int_gl(tx_group);
-		if (tx_update)
-			hns3_set_vector_coalesce_tx_gl(tqp_vector,
-						       tx_group->coal.int_gl);
-	}
-
-	tqp_vector->last_jiffies = jiffies;
+	net_dim_sample(tqp_vector->event_cnt, group->total_packets,
+		       group->total_bytes, &sample);
+	net_dim(&group->dim, sample);
 }
 
 static int hns3_nic_common_poll(struct napi_struct *napi, int budget)
@@ -3508,9 +4355,13 @@ static int hns3_nic_common_poll(struct napi_struct *napi, int budget)
 	/* Since the actual Tx work is minimal, we can give the Tx a larger
 	 * budget and be more aggressive about cleaning up the Tx descriptors.
 	 */
-	hns3_for_each_ring(ring, tqp_vector->tx_group)
+	hns3_for_each_ring(ring, tqp_vector->tx_group) {
 		hns3_clean_tx_ring(ring, budget);
 
+		if (ring->xsk_umem && !hns3_xsk_xmit(ring, budget))
+			clean_complete = false;
+	}
+
 	/* make sure rx ring budget not smaller than 1 */
 	if (tqp_vector->num_tqps > 1)
 		rx_budget = max(budget / tqp_vector->num_tqps, 1);
@@ -3532,7 +4383,8 @@ static int hns3_nic_common_poll(struct napi_struct *napi, int budget)
 
 	if (napi_complete(napi) &&
 	    likely(!test_bit(HNS3_NIC_STATE_DOWN, &priv->state))) {
-		hns3_update_new_int_gl(tqp_vector);
+		hns3_update_int_coalesce(tqp_vector, &tqp_vector->rx_group);
+		hns3_update_int_coalesce(tqp_vector, &tqp_vector->tx_group);
 		hns3_mask_vector_irq(tqp_vector, 1);
 	}
 
@@ -3772,6 +4624,8 @@ static int hns3_nic_alloc_vector_data(struct hns3_nic_priv *priv)
 		tqp_vector->mask_addr = vector[i].io_addr;
 		tqp_vector->vector_irq = vector[i].vector;
 		hns3_vector_gl_rl_init(tqp_vector, priv);
+		INIT_WORK(&tqp_vector->rx_group.dim.work, hns3_rx_dim_work);
+		INIT_WORK(&tqp_vector->tx_group.dim.work, hns3_tx_dim_work);
 	}
 
 out:
@@ -3861,10 +4715,25 @@ static void hns3_ring_get_cfg(struct hnae3_queue *q, struct hns3_nic_priv *priv,
 	ring->dev = priv->dev;
 	ring->desc_dma_addr = 0;
 	ring->buf_size = q->buf_size;
+	if (ring_type == HNAE3_RING_TYPE_RX && rx_zerocopy) {
+		/*
+		 * There is no header split in hardware: headers are copied
+		 * out of the first buffer, and every following buffer of a
+		 * packet carries page-aligned payload only if it is a page.
+		 */
+		if (ring->buf_size == PAGE_SIZE)
+			hnae3_set_bit(ring->flag, HNS3_RING_RX_PAGE_B, 1);
+		else
+			dev_warn_once(priv->dev,
+				      "rx_zerocopy ignored, RX buffer %u != PAGE_SIZE\n",
+				      ring->buf_size);
+	}
 	ring->desc_num = desc_num;
 	ring->next_to_use = 0;
 	ring->next_to_clean = 0;
 	ring->last_to_use = 0;
+
+	hns3_ring_xdp_cfg(priv, ring);
 }
 
 static void hns3_queue_to_ring(struct hnae3_queue *tqp,
@@ -3878,7 +4747,7 @@ static int hns3_get_ring_config(struct hns3_nic_priv *priv)
 {
 	struct hnae3_handle *h = priv->ae_handle;
 	struct pci_dev *pdev = h->pdev;
-	int i;
+	int ret, i;
 
 	priv->ring = devm_kzalloc(&pdev->dev,
 				  array3_size(h->kinfo.num_tqps,
@@ -3890,18 +4759,117 @@ static int hns3_get_ring_config(struct hns3_nic_priv *priv)
 	for (i = 0; i < h->kinfo.num_tqps; i++)
 		hns3_queue_to_ring(h->kinfo.tqp[i], priv);
 
+	for (i = 0; i < h->kinfo.num_tqps; i++) {
+		ret = hns3_xdp_rxq_reg(priv,
+				       &priv->ring[i + h->kinfo.num_tqps]);
+		if (ret)
+			goto out_rxq_unreg;
+	}
+
 	return 0;
+
+out_rxq_unreg:
+	while (i--)
+		xdp_rxq_info_unreg(&priv->ring[i + h->kinfo.num_tqps].xdp_rxq);
+
+	devm_kfree(&pdev->dev, priv->ring);
+	priv->ring = NULL;
+	return ret;
 }
 
 static void hns3_put_ring_config(struct hns3_nic_priv *priv)
 {
+	u16 num = priv->ae_handle->kinfo.num_tqps;
+	int i;
+
 	if (!priv->ring)
 		return;
 
+	for (i = 0; i < num; i++)
+		xdp_rxq_info_unreg(&priv->ring[i + num].xdp_rxq);
+
 	devm_kfree(priv->dev, priv->ring);
 	priv->ring = NULL;
 }
 
+static int hns3_alloc_page_pool(struct hns3_enet_ring *ring)
+{
+	struct page_pool_params pp_params = {
+		.flags = PP_FLAG_DMA_MAP,
+		.order = hns3_page_order(ring),
+		.pool_size = ring->desc_num,
+		.nid = NUMA_NO_NODE,
+		.dev = ring_to_dev(ring),
+		.dma_dir = DMA_FROM_DEVICE,
+	};
+	u32 size;
+	int ret;
+
+	/* Park at most as many pages as it takes to fill the ring */
+	size = DIV_ROUND_UP(ring->desc_num * hns3_buf_size(ring),
+			    hns3_page_size(ring));
+	size = roundup_pow_of_two(size);
+	ring->page_cache = kzalloc(struct_size(ring->page_cache, entry, size),
+				   GFP_KERNEL);
+	if (!ring->page_cache)
+		return -ENOMEM;
+
+	ring->page_cache->mask = size - 1;
+
+	ring->page_pool = page_pool_create(&pp_params);
+	if (IS_ERR(ring->page_pool)) {
+		ret = PTR_ERR(ring->page_pool);
+		ring->page_pool = NULL;
+		kfree(ring->page_cache);
+		ring->page_cache = NULL;
+		return ret;
+	}
+
+	return 0;
+}
+
+static void hns3_free_page_pool(struct hns3_enet_ring *ring)
+{
+	struct hns3_rx_page_cache *cache = ring->page_cache;
+	u32 i;
+
+	if (!ring->page_pool)
+		return;
+
+	for (; cache->head != cache->tail; cache->head++) {
+		i = cache->head & cache->mask;
+		hns3_rx_page_put(ring, cache->entry[i].page,
+				 cache->entry[i].pagecnt_bias);
+	}
+
+	kfree(cache);
+	ring->page_cache = NULL;
+	page_pool_destroy(ring->page_pool);
+	ring->page_pool = NULL;
+}
+
+/* Without the bounce area every frame is mapped, so failing to get it is
+ * not fatal.
+ */
+static void hns3_alloc_tx_bounce(struct hns3_enet_ring *ring)
+{
+	ring->tx_bounce = dma_alloc_coherent(ring_to_dev(ring),
+					     ring->desc_num * HNS3_TX_BOUNCE_LEN,
+					     &ring->tx_bounce_dma,
+					     GFP_KERNEL | __GFP_NOWARN);
+}
+
+static void hns3_free_tx_bounce(struct hns3_enet_ring *ring)
+{
+	if (!ring->tx_bounce)
+		return;
+
+	dma_free_coherent(ring_to_dev(ring),
+			  ring->desc_num * HNS3_TX_BOUNCE_LEN,
+			  ring->tx_bounce, ring->tx_bounce_dma);
+	ring->tx_bounce = NULL;
+}
+
 static int hns3_alloc_ring_memory(struct hns3_enet_ring *ring)
 {
 	int ret;
@@ -3920,14 +4888,25 @@ static int hns3_alloc_ring_memory(struct hns3_enet_ring *ring)
 	if (ret)
 		goto out_with_desc_cb;
 
+	if (HNAE3_IS_TX_RING(ring))
+		hns3_alloc_tx_bounce(ring);
+
 	if (!HNAE3_IS_TX_RING(ring)) {
+		if (!ring->xsk_umem) {
+			ret = hns3_alloc_page_pool(ring);
+			if (ret)
+				goto out_with_desc;
+		}
+
 		ret = hns3_alloc_ring_buffers(ring);
 		if (ret)
-			goto out_with_desc;
+			goto out_with_page_pool;
 	}
 
 	return 0;
 
+out_with_page_pool:
+	hns3_free_page_pool(ring);
 out_with_desc:
 	hns3_free_desc(ring);
 out_with_desc_cb:
@@ -3940,6 +4919,8 @@ static int hns3_alloc_ring_memory(struct hns3_enet_ring *ring)
 void hns3_fini_ring(struct hns3_enet_ring *ring)
 {
 	hns3_free_desc(ring);
+	hns3_free_page_pool(ring);
+	hns3_free_tx_bounce(ring);
 	devm_kfree(ring_to_dev(ring), ring->desc_cb);
 	ring->desc_cb = NULL;
 	ring->next_to_clean = 0;
@@ -4331,6 +5312,7 @@ static void hns3_client_uninit(struct hnae3_handle *handle, bool reset)
 
 out_netdev_free:
 	hns3_dbg_uninit(handle);
+	kfree(priv->xsk_umems);
 	free_netdev(netdev);
 }
 
@@ -4356,12 +5338,20 @@ static void hns3_link_status_change(struct hnae3_handle *handle, bool linkup)
 
 static void hns3_clear_tx_ring(struct hns3_enet_ring *ring)
 {
+	u32 xsk_frames = 0;
+
 	while (ring->next_to_clean != ring->next_to_use) {
+		if (ring->desc_cb[ring->next_to_clean].type == DESC_TYPE_XSK)
+			xsk_frames++;
 		ring->desc[ring->next_to_clean].tx.bdtp_fe_sc_vld_ra_ri = 0;
 		hns3_free_buffer_detach(ring, ring->next_to_clean, 0);
 		ring_ptr_move_fw(ring, next_to_clean);
 	}
 
+	/* Frames taken from the AF_XDP TX queue must show up as completed */
+	if (xsk_frames)
+		xsk_umem_complete_tx(ring->xsk_umem, xsk_frames);
+
 	ring->pending_buf = 0;
 }
 
@@ -4704,6 +5694,7 @@ static int hns3_change_channels(struct hnae3_handle *handle, u32 new_tqp_num,
 int hns3_set_channels(struct net_device *netdev,
 		      struct ethtool_channels *ch)
 {
+	struct hns3_nic_priv *priv = netdev_priv(netdev);
 	struct hnae3_handle *h = hns3_get_handle(netdev);
 	struct hnae3_knic_private_info *kinfo = &h->kinfo;
 	bool rxfh_configured = netif_is_rxfh_configured(netdev);
@@ -4723,6 +5714,12 @@ int hns3_set_channels(struct net_device *netdev,
 		return -EINVAL;
 	}
 
+	if (priv->num_xsk_umems) {
+		netdev_err(netdev,
+			   "can't change channels with AF_XDP sockets bound\n");
+		return -EBUSY;
+	}
+
 	if (new_tqp_num > hns3_get_max_available_channels(h) ||
 	    new_tqp_num < 1) {
 		dev_err(&netdev->dev,
@@ -5,6 +5,8 @@
 #define __HNS3_ENET_H
 
 #include <linux/if_vlan.h>
+#include <linux/net_dim.h>
+#include <net/xdp.h>
 
 #include "hnae3.h"
 
@@ -305,7 +307,10 @@ struct hns3_desc_cb {
 	void *buf;      /* cpu addr for a desc */
 
 	/* priv data for the desc, e.g. skb when use with ip stack */
-	void *priv;
+	union {
+		void *priv;
+		u64 handle;	/* umem address of an AF_XDP RX buffer */
+	};
 
 	union {
 		u32 page_offset;	/* for rx */
@@ -391,6 +396,8 @@ struct ring_stats {
 			u64 tx_tso_err;
 			u64 over_max_recursion;
 			u64 hw_limitation;
+			u64 tx_xdp;
+			u64 tx_bounce;
 		};
 		struct {
 			u64 rx_pkts;
@@ -403,10 +410,26 @@ struct ring_stats {
 			u64 l3l4_csum_err;
 			u64 rx_multicast;
 			u64 non_reuse_pg;
+			u64 xdp_drop;
+			u64 xdp_tx;
+			u64 xdp_redirect;
 		};
 	};
 };
 
+/* RX pages the driver is done with but the stack still holds, parked with
+ * their DMA mapping until the stack lets go, see hns3_rx_page_release()
+ */
+struct hns3_rx_page_cache {
+	u32 head;
+	u32 tail;
+	u32 mask;
+	struct {
+		struct page *page;
+		u16 pagecnt_bias;
+	} entry[0];
+};
+
 struct hns3_enet_ring {
 	u8 __iomem *io_base; /* base io address for the ring */
 	struct hns3_desc *desc; /* dma map address space */
@@ -442,28 +465,29 @@ struct hns3_enet_ring {
 	int pending_buf;
 	struct sk_buff *skb;
 	struct sk_buff *tail_skb;
-} ____cacheline_internodealigned_in_smp;
 
-enum hns3_flow_level_range {
-	HNS3_FLOW_LOW = 0,
-	HNS3_FLOW_MID = 1,
-	HNS3_FLOW_HIGH = 2,
-	HNS3_FLOW_ULTRA = 3,
-};
+	struct bpf_prog *xdp_prog;
+	struct xdp_umem *xsk_umem;	/* AF_XDP zero-copy on this queue */
+	u32 xdp_status;			/* XDP_TX/REDIRECT done in this poll */
+	struct zero_copy_allocator zca;
+	struct xdp_rxq_info xdp_rxq;
+
+	struct page_pool *page_pool;		/* RX pages, kept DMA mapped */
+	struct hns3_rx_page_cache *page_cache;
+
+	void *tx_bounce;		/* HNS3_TX_BOUNCE_LEN bytes per desc */
+	dma_addr_t tx_bounce_dma;
+} ____cacheline_internodealigned_in_smp;
 
 #define HNS3_INT_GL_MAX			0x1FE0
 #define HNS3_INT_GL_50K			0x0014
-#define HNS3_INT_GL_20K			0x0032
-#define HNS3_INT_GL_18K			0x0036
-#define HNS3_INT_GL_8K			0x007C
 
 #define HNS3_INT_RL_MAX			0x00EC
 #define HNS3_INT_RL_ENABLE_MASK		0x40
 
 struct hns3_enet_coalesce {
 	u16 int_gl;
-	u8 gl_adapt_enable;
-	enum hns3_flow_level_range flow_level;
+	u8 gl_adapt_enable;	/* GL is tuned by net_dim */
 };
 
 struct hns3_enet_ring_group {
@@ -473,6 +497,7 @@ struct hns3_enet_ring_group {
 	u64 total_packets;	/* total packets processed this group */
 	u16 count;
 	struct hns3_enet_coalesce coal;
+	struct net_dim dim;
 };
 
 struct hns3_enet_tqp_vector {
@@ -494,7 +519,7 @@ struct hns3_enet_tqp_vector {
 
 	char name[HNAE3_INT_NAME_LEN];
 
-	unsigned long last_jiffies;
+	u16 event_cnt;		/* interrupts taken, sampled by net_dim */
 } ____cacheline_internodealigned_in_smp;
 
 enum hns3_udp_tnl_type {
@@ -538,6 +563,11 @@ struct hns3_nic_priv {
 	struct hns3_udp_tunnel udp_tnl[HNS3_UDP_TNL_MAX];
 	struct hns3_enet_coalesce tx_coal;
 	struct hns3_enet_coalesce rx_coal;
+
+	struct bpf_prog *xdp_prog;
+	/* AF_XDP zero-copy umems by queue id, see hns3_xsk_umem_enable() */
+	struct xdp_umem **xsk_umems;
+	u16 num_xsk_umems;
 };
 
 union l3_hdr_info {
@@ -604,15 +634,39 @@ static inline bool hns3_nic_resetting(struct net_device *netdev)
 
 #define hns3_buf_size(_ring) ((_ring)->buf_size)
 
+/* RX ring whose buffers are each a whole order-0 page, see rx_zerocopy */
+#define HNS3_RING_RX_PAGE_B 1
+/* RX ring running XDP: one order-0 page per buffer, XDP headroom in front,
+ * or AF_XDP zero-copy umem buffers when xsk_umem is set
+ */
+#define HNS3_RING_RX_XDP_B 2
+/* RX ring is dropping the remaining BDs of a frame XDP can not take */
+#define HNS3_RING_RX_DISCARD_B 3
+
+static inline bool hns3_ring_rx_page(struct hns3_enet_ring *ring)
+{
+	return hnae3_get_bit(ring->flag, HNS3_RING_RX_PAGE_B);
+}
+
+static inline bool hns3_ring_rx_xdp(struct hns3_enet_ring *ring)
+{
+	return hnae3_get_bit(ring->flag, HNS3_RING_RX_XDP_B);
+}
+
 static inline unsigned int hns3_page_order(struct hns3_enet_ring *ring)
 {
 #if (PAGE_SIZE < 8192)
-	if (ring->buf_size > (PAGE_SIZE / 2))
+	if (ring->buf_size > (PAGE_SIZE / 2) && !hns3_ring_rx_page(ring) &&
+	    !hns3_ring_rx_xdp(ring))
 		return 1;
 #endif
 	return 0;
 }
 
+/* umem pages are mapped both ways, they are used for RX and TX */
+#define hns3_rx_sync_dir(_ring) \
+	((_ring)->xsk_umem ? DMA_BIDIRECTIONAL : DMA_FROM_DEVICE)
+
 #define hns3_page_size(_ring) (PAGE_SIZE << hns3_page_order(_ring))
 
 /* iterator for handling rings in ring group */
@@ -44,6 +44,7 @@ struct pcpu_vstats {
 
 struct veth_rq {
 	struct napi_struct	xdp_napi;
+	struct napi_struct __rcu *napi; /* xdp_napi, once it can be used */
 	struct net_device	*dev;
 	struct bpf_prog __rcu	*xdp_prog;
 	struct xdp_mem_info	xdp_mem;
@@ -114,6 +115,59 @@ static void veth_get_ethtool_stats(struct net_device *dev,
 	data[0] = peer ? peer->ifindex : 0;
 }
 
+static void veth_get_channels(struct net_device *dev,
+			      struct ethtool_channels *channels)
+{
+	channels->tx_count = dev->real_num_tx_queues;
+	channels->rx_count = dev->real_num_rx_queues;
+	channels->max_tx = dev->num_tx_queues;
+	channels->max_rx = dev->num_rx_queues;
+}
+
+static int veth_open(struct net_device *dev);
+static int veth_close(struct net_device *dev);
+
+static int veth_set_channels(struct net_device *dev,
+			     struct ethtool_channels *ch)
+{
+	struct veth_priv *peer_priv, *priv = netdev_priv(dev);
+	bool running = netif_running(dev);
+	struct net_device *peer;
+	int err;
+
+	if (!ch->rx_count || !ch->tx_count)
+		return -EINVAL;
+
+	/* XDP on either side needs an rx queue for each tx queue of the
+	 * other side, as checked in veth_xdp_set()
+	 */
+	peer = rtnl_dereference(priv->peer);
+	if (peer) {
+		peer_priv = netdev_priv(peer);
+		if (priv->_xdp_prog && ch->rx_count < peer->real_num_tx_queues)
+			return -EINVAL;
+		if (peer_priv->_xdp_prog &&
+		    ch->tx_count > peer->real_num_rx_queues)
+			return -EINVAL;
+	}
+
+	/* The NAPI instances and XDP rxqs are set up per real rx queue */
+	if (running)
+		veth_close(dev);
+
+	err = netif_set_real_num_rx_queues(dev, ch->rx_count);
+	if (!err)
+		err = netif_set_real_num_tx_queues(dev, ch->tx_count);
+
+	if (running) {
+		int open_err = veth_open(dev);
+
+		err = err ?: open_err;
+	}
+
+	return err;
+}
+
 static const struct ethtool_ops veth_ethtool_ops = {
 	.get_drvinfo		= veth_get_drvinfo,
 	.get_link		= ethtool_op_get_link,
@@ -121,6 +175,8 @@ static const struct ethtool_ops veth_ethtool_ops = {
 	.get_sset_count		= veth_get_sset_count,
 	.get_ethtool_stats	= veth_get_ethtool_stats,
 	.get_link_ksettings	= veth_get_link_ksettings,
+	.get_channels		= veth_get_channels,
+	.set_channels		= veth_set_channels,
 };
 
 /* general routines */
@@ -170,9 +226,9 @@ static int veth_xdp_rx(struct veth_rq *rq, struct sk_buff *skb)
 }
 
 static int veth_forward_skb(struct net_device *dev, struct sk_buff *skb,
-			    struct veth_rq *rq, bool xdp)
+			    struct veth_rq *rq, bool napi)
 {
-	return __dev_forward_skb(dev, skb) ?: xdp ?
+	return __dev_forward_skb(dev, skb) ?: napi ?
 		veth_xdp_rx(rq, skb) :
 		netif_rx(skb);
 }
@@ -183,7 +239,7 @@ static netdev_tx_t veth_xmit(struct sk_buff *skb, struct net_device *dev)
 	struct veth_rq *rq = NULL;
 	struct net_device *rcv;
 	int length = skb->len;
-	bool rcv_xdp = false;
+	bool use_napi = false;
 	int rxq;
 
 	rcu_read_lock();
@@ -197,10 +253,13 @@ static netdev_tx_t veth_xmit(struct sk_buff *skb, struct net_device *dev)
 	rxq = skb_get_queue_mapping(skb);
 	if (rxq < rcv->real_num_rx_queues) {
 		rq = &rcv_priv->rq[rxq];
-		rcv_xdp = rcu_access_pointer(rq->xdp_prog);
+		/* Hand the skb to the peer's NAPI on this queue when it has
+		 * XDP or GRO, so each queue is received on its own CPU
+		 */
+		use_napi = rcu_access_pointer(rq->napi);
 	}
 
-	if (likely(veth_forward_skb(rcv, skb, rq, rcv_xdp) == NET_RX_SUCCESS)) {
+	if (likely(veth_forward_skb(rcv, skb, rq, use_napi) == NET_RX_SUCCESS)) {
 		struct pcpu_vstats *stats = this_cpu_ptr(dev->vstats);
 
 		u64_stats_update_begin(&stats->syncp);
@@ -212,7 +271,7 @@ static netdev_tx_t veth_xmit(struct sk_buff *skb, struct net_device *dev)
 		atomic64_inc(&priv->dropped);
 	}
 
-	if (rcv_xdp)
+	if (use_napi)
 		__veth_xdp_flush(rq);
 
 	rcu_read_unlock();
@@ -311,11 +370,11 @@ static int veth_xdp_xmit(struct net_device *dev, int n,
 
 	rcv_priv = netdev_priv(rcv);
 	rq = &rcv_priv->rq[veth_select_rxq(rcv)];
-	/* Non-NULL xdp_prog ensures that xdp_ring is initialized on receive
-	 * side. This means an XDP program is loaded on the peer and the peer
-	 * device is up.
+	/* Non-NULL napi ensures that xdp_ring is initialized on receive
+	 * side. This means the peer device is up and has either an XDP
+	 * program or GRO enabled, frames are turned into skbs without one.
 	 */
-	if (!rcu_access_pointer(rq->xdp_prog))
+	if (!rcu_access_pointer(rq->napi))
 		return -ENXIO;
 
 	max_len = rcv->mtu + rcv->hard_header_len + VLAN_HLEN;
@@ -353,7 +412,7 @@ static void veth_xdp_flush(struct net_device *dev)
 	rcv_priv = netdev_priv(rcv);
 	rq = &rcv_priv->rq[veth_select_rxq(rcv)];
 	/* xdp_ring is initialized on receive side? */
-	if (unlikely(!rcu_access_pointer(rq->xdp_prog)))
+	if (unlikely(!rcu_access_pointer(rq->napi)))
 		goto out;
 
 	__veth_xdp_flush(rq);
@@ -658,6 +717,7 @@ static int veth_napi_add(struct net_device *dev)
 
 		netif_napi_add(dev, &rq->xdp_napi, veth_poll, NAPI_POLL_WEIGHT);
 		napi_enable(&rq->xdp_napi);
+		rcu_assign_pointer(rq->napi, &rq->xdp_napi);
 	}
 
 	return 0;
@@ -676,6 +736,7 @@ static void veth_napi_del(struct net_device *dev)
 	for (i = 0; i < dev->real_num_rx_queues; i++) {
 		struct veth_rq *rq = &priv->rq[i];
 
+		RCU_INIT_POINTER(rq->napi, NULL);
 		napi_disable(&rq->xdp_napi);
 		napi_hash_del(&rq->xdp_napi);
 	}
@@ -690,6 +751,13 @@ static void veth_napi_del(struct net_device *dev)
 	}
 }
 
+static bool veth_napi_enabled(struct net_device *dev)
+{
+	struct veth_priv *priv = netdev_priv(dev);
+
+	return rcu_access_pointer(priv->rq[0].napi);
+}
+
 static int veth_enable_xdp(struct net_device *dev)
 {
 	struct veth_priv *priv = netdev_priv(dev);
@@ -713,9 +781,12 @@ static int veth_enable_xdp(struct net_device *dev)
 			rq->xdp_mem = rq->xdp_rxq.mem;
 		}
 
-		err = veth_napi_add(dev);
-		if (err)
-			goto err_rxq_reg;
+		/* NAPI may be running already for GRO */
+		if (!veth_napi_enabled(dev)) {
+			err = veth_napi_add(dev);
+			if (err)
+				goto err_rxq_reg;
+		}
 	}
 
 	for (i = 0; i < dev->real_num_rx_queues; i++)
@@ -760,6 +831,10 @@ static int veth_open(struct net_device *dev)
 		err = veth_enable_xdp(dev);
 		if (err)
 			return err;
+	} else if (dev->features & NETIF_F_GRO) {
+		err = veth_napi_add(dev);
+		if (err)
+			return err;
 	}
 
 	if (peer->flags & IFF_UP) {
@@ -781,6 +856,8 @@ static int veth_close(struct net_device *dev)
 
 	if (priv->_xdp_prog)
 		veth_disable_xdp(dev);
+	else if (veth_napi_enabled(dev))
+		veth_napi_del(dev);
 
 	return 0;
 }
@@ -881,6 +958,24 @@ static netdev_features_t veth_fix_features(struct net_device *dev,
 	return features;
 }
 
+/* Without XDP, GRO is what puts the device in NAPI mode */
+static int veth_set_features(struct net_device *dev,
+			     netdev_features_t features)
+{
+	struct veth_priv *priv = netdev_priv(dev);
+	bool gro = features & NETIF_F_GRO;
+
+	if (!netif_running(dev) || priv->_xdp_prog ||
+	    gro == veth_napi_enabled(dev))
+		return 0;
+
+	if (gro)
+		return veth_napi_add(dev);
+
+	veth_napi_del(dev);
+	return 0;
+}
+
 static void veth_set_rx_headroom(struct net_device *dev, int new_hr)
 {
 	struct veth_priv *peer_priv, *priv = netdev_priv(dev);
@@ -950,13 +1045,31 @@ static int veth_xdp_set(struct net_device *dev, struct bpf_prog *prog,
 		if (!old_prog) {
 			peer->hw_features &= ~NETIF_F_GSO_SOFTWARE;
 			peer->max_mtu = max_mtu;
+
+			/* XDP always received through GRO, keep doing so
+			 * even when it was not asked for
+			 */
+			if (!(dev->wanted_features & NETIF_F_GRO)) {
+				dev->features |= NETIF_F_GRO;
+				netdev_features_change(dev);
+			}
 		}
 	}
 
 	if (old_prog) {
 		if (!prog) {
-			if (dev->flags & IFF_UP)
+			if (!(dev->wanted_features & NETIF_F_GRO)) {
+				dev->features &= ~NETIF_F_GRO;
+				netdev_features_change(dev);
+			}
+
+			if (dev->flags & IFF_UP) {
 				veth_disable_xdp(dev);
+				/* GRO keeps the device in NAPI mode */
+				if ((dev->features & NETIF_F_GRO) &&
+				    veth_napi_add(dev))
+					netdev_warn(dev, "Failed to keep NAPI for GRO\n");
+			}
 
 			if (peer) {
 				peer->hw_features |= NETIF_F_GSO_SOFTWARE;
@@ -1014,6 +1127,7 @@ static const struct net_device_ops veth_netdev_ops = {
 #endif
 	.ndo_get_iflink		= veth_get_iflink,
 	.ndo_fix_features	= veth_fix_features,
+	.ndo_set_features	= veth_set_features,
 	.ndo_features_check	= passthru_features_check,
 	.ndo_set_rx_headroom	= veth_set_rx_headroom,
 	.ndo_bpf		= veth_xdp,
@@ -1057,6 +1171,16 @@ static void veth_setup(struct net_device *dev)
  * netlink interface
  */
 
+/* GRO used to be a no-op on veth, keep it off until asked for since it
+ * changes how the device receives
+ */
+static void veth_disable_gro(struct net_device *dev)
+{
+	dev->features &= ~NETIF_F_GRO;
+	dev->wanted_features &= ~NETIF_F_GRO;
+	netdev_update_features(dev);
+}
+
 static int veth_validate(struct nlattr *tb[], struct nlattr *data[],
 			 struct netlink_ext_ack *extack)
 {
@@ -1148,6 +1272,7 @@ static int veth_newlink(struct net *src_net, struct net_device *dev,
 		goto err_register_peer;
 
 	netif_carrier_off(peer);
+	veth_disable_gro(peer);
 
 	err = rtnl_configure_link(peer, ifmp);
 	if (err < 0)
@@ -1173,6 +1298,7 @@ static int veth_newlink(struct net *src_net, struct net_device *dev,
 		goto err_register_dev;
 
 	netif_carrier_off(dev);
+	veth_disable_gro(dev);
 
 	/*
 	 * tie the deviced together
@@ -20,6 +20,43 @@ module_param(multipath, bool, 0444);
 MODULE_PARM_DESC(multipath,
 	"turn on native support for multiple controllers per subsystem");
 
+static const char *nvme_iopolicy_names[] = {
+	[NVME_IOPOLICY_FAILOVER]	= "failover",
+	[NVME_IOPOLICY_RR]		= "round-robin",
+	[NVME_IOPOLICY_QD]		= "queue-depth",
+	[NVME_IOPOLICY_ST]		= "service-time",
+};
+
+static int iopolicy = NVME_IOPOLICY_FAILOVER;
+
+static int nvme_set_iopolicy(const char *val, const struct kernel_param *kp)
+{
+	int ret;
+
+	if (!val)
+		return -EINVAL;
+	ret = sysfs_match_string(nvme_iopolicy_names, val);
+	if (ret < 0)
+		return ret;
+	iopolicy = ret;
+	return 0;
+}
+
+static int nvme_get_iopolicy(char *buf, const struct kernel_param *kp)
+{
+	return sprintf(buf, "%s\n", nvme_iopolicy_names[iopolicy]);
+}
+
+module_param_call(iopolicy, nvme_set_iopolicy, nvme_get_iopolicy,
+	&iopolicy, 0644);
+MODULE_PARM_DESC(iopolicy,
+	"Default multipath I/O policy; 'failover' (default), 'round-robin', 'queue-depth' or 'service-time'");
+
+void nvme_mpath_default_iopolicy(struct nvme_subsystem *subsys)
+{
+	subsys->iopolicy = iopolicy;
+}
+
 void nvme_mpath_unfreeze(struct nvme_subsystem *subsys)
 {
 	struct nvme_ns_head *h;
@@ -178,21 +215,194 @@ static struct nvme_ns *__nvme_find_path(struct nvme_ns_head *head)
 	return fallback;
 }
 
+static inline bool nvme_path_is_disabled(struct nvme_ns *ns)
+{
+	return ns->ctrl->state != NVME_CTRL_LIVE ||
+		test_bit(NVME_NS_ANA_PENDING, &ns->flags);
+}
+
 static inline bool nvme_path_is_optimized(struct nvme_ns *ns)
 {
 	return ns->ctrl->state == NVME_CTRL_LIVE &&
 		ns->ana_state == NVME_ANA_OPTIMIZED;
 }
 
+static struct nvme_ns *nvme_next_ns(struct nvme_ns_head *head,
+		struct nvme_ns *ns)
+{
+	ns = list_next_or_null_rcu(&head->list, &ns->siblings, struct nvme_ns,
+			siblings);
+	if (ns)
+		return ns;
+	return list_first_or_null_rcu(&head->list, struct nvme_ns, siblings);
+}
+
+/*
+ * Rotate through the usable paths, starting after the last one used.
+ * Optimized paths are preferred, non-optimized ones are only used when no
+ * optimized path is left.
+ */
+static struct nvme_ns *nvme_round_robin_path(struct nvme_ns_head *head,
+		struct nvme_ns *old)
+{
+	struct nvme_ns *ns, *found = NULL;
+
+	if (list_is_singular(&head->list)) {
+		if (nvme_path_is_disabled(old))
+			return NULL;
+		return old;
+	}
+
+	for (ns = nvme_next_ns(head, old);
+	     ns && ns != old;
+	     ns = nvme_next_ns(head, ns)) {
+		if (nvme_path_is_disabled(ns))
+			continue;
+
+		if (ns->ana_state == NVME_ANA_OPTIMIZED) {
+			found = ns;
+			goto out;
+		}
+		if (ns->ana_state == NVME_ANA_NONOPTIMIZED)
+			found = ns;
+	}
+
+	/*
+	 * The loop above skips the current path; check it last so that a lone
+	 * optimized path (or a lone usable path) keeps being used.
+	 */
+	if (!nvme_path_is_disabled(old) &&
+	    (old->ana_state == NVME_ANA_OPTIMIZED ||
+	     (!found && old->ana_state == NVME_ANA_NONOPTIMIZED)))
+		return old;
+
+	if (!found)
+		return NULL;
+out:
+	rcu_assign_pointer(head->current_path, found);
+	return found;
+}
+
+/*
+ * Cost of queueing one more command on a path: for the queue-depth policy
+ * this is the number of commands outstanding on the controller, for the
+ * service-time policy the outstanding commands are weighted by the average
+ * completion latency seen on that controller.
+ */
+static inline u64 nvme_path_cost(struct nvme_ns *ns, int policy)
+{
+	struct nvme_ctrl *ctrl = ns->ctrl;
+	u64 depth = atomic_read(&ctrl->nr_active);
+
+	if (policy == NVME_IOPOLICY_QD)
+		return depth;
+	return (depth + 1) * max_t(u64, READ_ONCE(ctrl->lat_avg_ns), 1);
+}
+
+static struct nvme_ns *nvme_least_cost_path(struct nvme_ns_head *head,
+		int policy)
+{
+	struct nvme_ns *ns, *best_opt = NULL, *best_nonopt = NULL;
+	u64 min_opt = U64_MAX, min_nonopt = U64_MAX;
+	u64 cost;
+
+	list_for_each_entry_rcu(ns, &head->list, siblings) {
+		if (nvme_path_is_disabled(ns))
+			continue;
+
+		cost = nvme_path_cost(ns, policy);
+		switch (ns->ana_state) {
+		case NVME_ANA_OPTIMIZED:
+			if (cost < min_opt) {
+				min_opt = cost;
+				best_opt = ns;
+			}
+			break;
+		case NVME_ANA_NONOPTIMIZED:
+			if (cost < min_nonopt) {
+				min_nonopt = cost;
+				best_nonopt = ns;
+			}
+			break;
+		default:
+			break;
+		}
+
+		/* an idle optimized path can't be beaten */
+		if (min_opt == 0)
+			break;
+	}
+
+	return best_opt ? best_opt : best_nonopt;
+}
+
 inline struct nvme_ns *nvme_find_path(struct nvme_ns_head *head)
 {
-	struct nvme_ns *ns = srcu_dereference(head->current_path, &head->srcu);
+	int policy = READ_ONCE(head->subsys->iopolicy);
+	struct nvme_ns *ns;
 
+	if (policy == NVME_IOPOLICY_QD || policy == NVME_IOPOLICY_ST)
+		return nvme_least_cost_path(head, policy);
+
+	ns = srcu_dereference(head->current_path, &head->srcu);
+	if (policy == NVME_IOPOLICY_RR && ns)
+		return nvme_round_robin_path(head, ns);
 	if (unlikely(!ns || !nvme_path_is_optimized(ns)))
 		ns = __nvme_find_path(head);
 	return ns;
 }
 
+/*
+ * Account a command issued through the multipath node to its controller.
+ * Only done for the policies that look at the counters, and at most once
+ * per command: the flag makes the accounting robust against requeues and
+ * against both the cleanup and the completion path ending it.
+ */
+void nvme_mpath_start_request(struct request *rq)
+{
+	struct nvme_ns *ns = rq->q->queuedata;
+	int policy = READ_ONCE(ns->head->subsys->iopolicy);
+
+	if (policy != NVME_IOPOLICY_QD && policy != NVME_IOPOLICY_ST)
+		return;
+	if (nvme_req(rq)->flags & NVME_MPATH_CNT_ACTIVE)
+		return;
+
+	atomic_inc(&ns->ctrl->nr_active);
+	nvme_req(rq)->flags |= NVME_MPATH_CNT_ACTIVE;
+	if (policy == NVME_IOPOLICY_ST)
+		nvme_req(rq)->start_time = ktime_get_ns();
+	else
+		nvme_req(rq)->start_time = 0;
+}
+
+void nvme_mpath_end_request(struct request *rq)
+{
+	struct nvme_ctrl *ctrl = nvme_req(rq)->ctrl;
+	u64 start = nvme_req(rq)->start_time;
+	u64 lat, avg;
+
+	if (!(nvme_req(rq)->flags & NVME_MPATH_CNT_ACTIVE))
+		return;
+	nvme_req(rq)->flags &= ~NVME_MPATH_CNT_ACTIVE;
+	atomic_dec(&ctrl->nr_active);
+
+	/* commands that never made it to the controller say nothing */
+	if (!start || !blk_mq_request_started(rq))
+		return;
+
+	/*
+	 * Racy exponentially weighted average with a weight of 1/8 for the
+	 * new sample; the occasional lost update doesn't matter for picking
+	 * a path.
+	 */
+	lat = ktime_get_ns() - start;
+	avg = READ_ONCE(ctrl->lat_avg_ns);
+	if (avg)
+		lat = avg - (avg >> 3) + (lat >> 3);
+	WRITE_ONCE(ctrl->lat_avg_ns, lat);
+}
+
 static bool nvme_available_path(struct nvme_ns_head *head)
 {
 	struct nvme_ns *ns;
@@ -533,6 +743,32 @@ static ssize_t ana_state_show(struct device *dev, struct device_attribute *attr,
 }
 DEVICE_ATTR_RO(ana_state);
 
+static ssize_t nvme_subsys_iopolicy_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct nvme_subsystem *subsys =
+		container_of(dev, struct nvme_subsystem, dev);
+
+	return sprintf(buf, "%s\n",
+			nvme_iopolicy_names[READ_ONCE(subsys->iopolicy)]);
+}
+
+static ssize_t nvme_subsys_iopolicy_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct nvme_subsystem *subsys =
+		container_of(dev, struct nvme_subsystem, dev);
+	int ret;
+
+	ret = sysfs_match_string(nvme_iopolicy_names, buf);
+	if (ret < 0)
+		return ret;
+	WRITE_ONCE(subsys->iopolicy, ret);
+	return count;
+}
+SUBSYS_ATTR_RW(iopolicy, S_IRUGO | S_IWUSR,
+		nvme_subsys_iopolicy_show, nvme_subsys_iopolicy_store);
+
 static int nvme_lookup_ana_group_desc(struct nvme_ctrl *ctrl,
 		struct nvme_ana_group_desc *desc, void *data)
 {
@@ -594,6 +830,8 @@ void nvme_mpath_init_ctrl(struct nvme_ctrl *ctrl)
 	mutex_init(&ctrl->ana_lock);
 	timer_setup(&ctrl->anatt_timer, nvme_anatt_timeout, 0);
 	INIT_WORK(&ctrl->ana_work, nvme_ana_work);
+	atomic_set(&ctrl->nr_active, 0);
+	ctrl->lat_avg_ns = 0;
 }
 
 int nvme_mpath_init_identify(struct nvme_ctrl *ctrl, struct nvme_id_ctrl *id)
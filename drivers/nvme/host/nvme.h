@@ -110,6 +110,9 @@ struct nvme_request {
 	u8			flags;
 	u16			status;
 	struct nvme_ctrl	*ctrl;
+#ifdef CONFIG_NVME_MULTIPATH
+	u64			start_time;
+#endif
 };
 
 /*
@@ -120,6 +123,7 @@ struct nvme_request {
 enum {
 	NVME_REQ_CANCELLED		= (1 << 0),
 	NVME_REQ_USERCMD		= (1 << 1),
+	NVME_MPATH_CNT_ACTIVE		= (1 << 2),
 };
 
 static inline struct nvme_request *nvme_req(struct request *req)
@@ -226,6 +230,9 @@ struct nvme_ctrl {
 	size_t ana_log_size;
 	struct timer_list anatt_timer;
 	struct work_struct ana_work;
+	/* path selection state for the queue-depth and service-time policies */
+	atomic_t nr_active;
+	u64 lat_avg_ns;
 #endif
 
 	/* Power saving configuration */
@@ -262,6 +269,13 @@ struct nvme_ctrl_plus {
 		container_of(t, struct nvme_ctrl_plus, ctrl)
 
 
+enum nvme_iopolicy {
+	NVME_IOPOLICY_FAILOVER,
+	NVME_IOPOLICY_RR,
+	NVME_IOPOLICY_QD,
+	NVME_IOPOLICY_ST,
+};
+
 struct nvme_subsystem {
 	int			instance;
 	struct device		dev;
@@ -281,6 +295,9 @@ struct nvme_subsystem {
 	u8			cmic;
 	u16			vendor_id;
 	struct ida		ns_ida;
+#ifdef CONFIG_NVME_MULTIPATH
+	enum nvme_iopolicy	iopolicy;
+#endif
 };
 
 /*
@@ -432,6 +449,7 @@ static inline void nvme_put_ctrl(struct nvme_ctrl *ctrl)
 }
 
 void nvme_complete_rq(struct request *req);
+void nvme_complete_batch_req(struct request *req);
 void nvme_cancel_request(struct request *req, void *data, bool reserved);
 bool nvme_change_ctrl_state(struct nvme_ctrl *ctrl,
 		enum nvme_ctrl_state new_state);
@@ -521,6 +539,15 @@ static inline bool nvme_mpath_clear_current_path(struct nvme_ns *ns)
 }
 void nvme_mpath_clear_ctrl_paths(struct nvme_ctrl *ctrl);
 struct nvme_ns *nvme_find_path(struct nvme_ns_head *head);
+void nvme_mpath_default_iopolicy(struct nvme_subsystem *subsys);
+void nvme_mpath_start_request(struct request *rq);
+void nvme_mpath_end_request(struct request *rq);
+
+#define SUBSYS_ATTR_RW(_name, _mode, _show, _store)		\
+	struct device_attribute subsys_attr_##_name =		\
+		__ATTR(_name, _mode, _show, _store)
+
+extern struct device_attribute subsys_attr_iopolicy;
 
 static inline void nvme_mpath_check_last_path(struct nvme_ns *ns)
 {
@@ -616,6 +643,15 @@ static inline void nvme_mpath_start_freeze(struct nvme_subsystem *subsys)
 static inline void nvme_mpath_update_disk_size(struct gendisk *disk)
 {
 }
+static inline void nvme_mpath_default_iopolicy(struct nvme_subsystem *subsys)
+{
+}
+static inline void nvme_mpath_start_request(struct request *rq)
+{
+}
+static inline void nvme_mpath_end_request(struct request *rq)
+{
+}
 #endif /* CONFIG_NVME_MULTIPATH */
 
 #ifdef CONFIG_NVM
@@ -79,6 +79,18 @@ struct nvme_queue;
 static void nvme_dev_disable(struct nvme_dev *dev, bool shutdown);
 static void nvme_disable_io_queues(struct nvme_dev *dev);
 
+/*
+ * Small per-CPU caches of PRP/SGL list pages in front of the dma pools, so
+ * that the pool lock is only taken once a cache runs empty or full.
+ */
+#define NVME_PRP_CACHE_SIZE	8
+
+struct nvme_prp_cache {
+	unsigned int nr;
+	void *vaddr[NVME_PRP_CACHE_SIZE];
+	dma_addr_t dma[NVME_PRP_CACHE_SIZE];
+};
+
 /*
  * Represents an NVM Express device.  Each nvme_dev is a PCI function.
  */
@@ -90,6 +102,8 @@ struct nvme_dev {
 	struct device *dev;
 	struct dma_pool *prp_page_pool;
 	struct dma_pool *prp_small_pool;
+	struct nvme_prp_cache __percpu *prp_page_cache;
+	struct nvme_prp_cache __percpu *prp_small_cache;
 	unsigned online_queues;
 	unsigned max_qid;
 	unsigned int num_vecs;
@@ -199,6 +213,7 @@ struct nvme_iod {
 	int npages;		/* In the PRP list. 0 means small pool in use */
 	int nents;		/* Used in scatterlist */
 	int length;		/* Of data, in bytes */
+	unsigned int dma_len;	/* length of single DMA segment mapping */
 	dma_addr_t first_dma;
 	struct scatterlist meta_sg; /* metadata requires single contiguous buffer */
 	struct scatterlist *sg;
@@ -528,11 +543,55 @@ static blk_status_t nvme_init_iod(struct request *rq, struct nvme_dev *dev)
 	iod->aborted = 0;
 	iod->npages = -1;
 	iod->nents = 0;
+	iod->dma_len = 0;
 	iod->length = size;
 
 	return BLK_STS_OK;
 }
 
+static void *nvme_prp_alloc(struct nvme_dev *dev, bool small,
+		dma_addr_t *dma)
+{
+	struct nvme_prp_cache *cache;
+	unsigned long flags;
+	void *vaddr = NULL;
+
+	local_irq_save(flags);
+	cache = this_cpu_ptr(small ? dev->prp_small_cache : dev->prp_page_cache);
+	if (cache->nr) {
+		cache->nr--;
+		vaddr = cache->vaddr[cache->nr];
+		*dma = cache->dma[cache->nr];
+	}
+	local_irq_restore(flags);
+
+	if (vaddr)
+		return vaddr;
+	return dma_pool_alloc(small ? dev->prp_small_pool : dev->prp_page_pool,
+			GFP_ATOMIC, dma);
+}
+
+static void nvme_prp_free(struct nvme_dev *dev, bool small, void *vaddr,
+		dma_addr_t dma)
+{
+	struct nvme_prp_cache *cache;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	cache = this_cpu_ptr(small ? dev->prp_small_cache : dev->prp_page_cache);
+	if (cache->nr < NVME_PRP_CACHE_SIZE) {
+		cache->vaddr[cache->nr] = vaddr;
+		cache->dma[cache->nr] = dma;
+		cache->nr++;
+		vaddr = NULL;
+	}
+	local_irq_restore(flags);
+
+	if (vaddr)
+		dma_pool_free(small ? dev->prp_small_pool : dev->prp_page_pool,
+				vaddr, dma);
+}
+
 static void nvme_free_iod(struct nvme_dev *dev, struct request *req)
 {
 	struct nvme_iod *iod = blk_mq_rq_to_pdu(req);
@@ -542,8 +601,7 @@ static void nvme_free_iod(struct nvme_dev *dev, struct request *req)
 	int i;
 
 	if (iod->npages == 0)
-		dma_pool_free(dev->prp_small_pool, nvme_pci_iod_list(req)[0],
-			dma_addr);
+		nvme_prp_free(dev, true, nvme_pci_iod_list(req)[0], dma_addr);
 
 	for (i = 0; i < iod->npages; i++) {
 		void *addr = nvme_pci_iod_list(req)[i];
@@ -559,7 +617,7 @@ static void nvme_free_iod(struct nvme_dev *dev, struct request *req)
 			next_dma_addr = le64_to_cpu(prp_list[last_prp]);
 		}
 
-		dma_pool_free(dev->prp_page_pool, addr, dma_addr);
+		nvme_prp_free(dev, false, addr, dma_addr);
 		dma_addr = next_dma_addr;
 	}
 
@@ -585,7 +643,7 @@ static blk_status_t nvme_pci_setup_prps(struct nvme_dev *dev,
 		struct request *req, struct nvme_rw_command *cmnd)
 {
 	struct nvme_iod *iod = blk_mq_rq_to_pdu(req);
-	struct dma_pool *pool;
+	bool small;
 	int length = blk_rq_payload_bytes(req);
 	struct scatterlist *sg = iod->sg;
 	int dma_len = sg_dma_len(sg);
@@ -619,14 +677,14 @@ static blk_status_t nvme_pci_setup_prps(struct nvme_dev *dev,
 
 	nprps = DIV_ROUND_UP(length, page_size);
 	if (nprps <= (256 / 8)) {
-		pool = dev->prp_small_pool;
+		small = true;
 		iod->npages = 0;
 	} else {
-		pool = dev->prp_page_pool;
+		small = false;
 		iod->npages = 1;
 	}
 
-	prp_list = dma_pool_alloc(pool, GFP_ATOMIC, &prp_dma);
+	prp_list = nvme_prp_alloc(dev, small, &prp_dma);
 	if (!prp_list) {
 		iod->first_dma = dma_addr;
 		iod->npages = -1;
@@ -638,7 +696,7 @@ static blk_status_t nvme_pci_setup_prps(struct nvme_dev *dev,
 	for (;;) {
 		if (i == page_size >> 3) {
 			__le64 *old_prp_list = prp_list;
-			prp_list = dma_pool_alloc(pool, GFP_ATOMIC, &prp_dma);
+			prp_list = nvme_prp_alloc(dev, small, &prp_dma);
 			if (!prp_list)
 				return BLK_STS_RESOURCE;
 			list[iod->npages++] = prp_list;
@@ -699,7 +757,7 @@ static blk_status_t nvme_pci_setup_sgls(struct nvme_dev *dev,
 		struct request *req, struct nvme_rw_command *cmd, int entries)
 {
 	struct nvme_iod *iod = blk_mq_rq_to_pdu(req);
-	struct dma_pool *pool;
+	bool small;
 	struct nvme_sgl_desc *sg_list;
 	struct scatterlist *sg = iod->sg;
 	dma_addr_t sgl_dma;
@@ -714,14 +772,14 @@ static blk_status_t nvme_pci_setup_sgls(struct nvme_dev *dev,
 	}
 
 	if (entries <= (256 / sizeof(struct nvme_sgl_desc))) {
-		pool = dev->prp_small_pool;
+		small = true;
 		iod->npages = 0;
 	} else {
-		pool = dev->prp_page_pool;
+		small = false;
 		iod->npages = 1;
 	}
 
-	sg_list = dma_pool_alloc(pool, GFP_ATOMIC, &sgl_dma);
+	sg_list = nvme_prp_alloc(dev, small, &sgl_dma);
 	if (!sg_list) {
 		iod->npages = -1;
 		return BLK_STS_RESOURCE;
@@ -737,7 +795,7 @@ static blk_status_t nvme_pci_setup_sgls(struct nvme_dev *dev,
 			struct nvme_sgl_desc *old_sg_desc = sg_list;
 			struct nvme_sgl_desc *link = &old_sg_desc[i - 1];
 
-			sg_list = dma_pool_alloc(pool, GFP_ATOMIC, &sgl_dma);
+			sg_list = nvme_prp_alloc(dev, small, &sgl_dma);
 			if (!sg_list)
 				return BLK_STS_RESOURCE;
 
@@ -754,6 +812,45 @@ static blk_status_t nvme_pci_setup_sgls(struct nvme_dev *dev,
 	return BLK_STS_OK;
 }
 
+static blk_status_t nvme_setup_prp_simple(struct nvme_dev *dev,
+		struct request *req, struct nvme_rw_command *cmnd,
+		struct bio_vec *bv, enum dma_data_direction dma_dir)
+{
+	struct nvme_iod *iod = blk_mq_rq_to_pdu(req);
+	unsigned int offset = bv->bv_offset & (dev->ctrl.page_size - 1);
+	unsigned int first_prp_len = dev->ctrl.page_size - offset;
+
+	iod->first_dma = dma_map_page(dev->dev, bv->bv_page, bv->bv_offset,
+			bv->bv_len, dma_dir);
+	if (dma_mapping_error(dev->dev, iod->first_dma))
+		return BLK_STS_RESOURCE;
+	iod->dma_len = bv->bv_len;
+
+	cmnd->dptr.prp1 = cpu_to_le64(iod->first_dma);
+	if (bv->bv_len > first_prp_len)
+		cmnd->dptr.prp2 = cpu_to_le64(iod->first_dma + first_prp_len);
+	return BLK_STS_OK;
+}
+
+static blk_status_t nvme_setup_sgl_simple(struct nvme_dev *dev,
+		struct request *req, struct nvme_rw_command *cmnd,
+		struct bio_vec *bv, enum dma_data_direction dma_dir)
+{
+	struct nvme_iod *iod = blk_mq_rq_to_pdu(req);
+
+	iod->first_dma = dma_map_page(dev->dev, bv->bv_page, bv->bv_offset,
+			bv->bv_len, dma_dir);
+	if (dma_mapping_error(dev->dev, iod->first_dma))
+		return BLK_STS_RESOURCE;
+	iod->dma_len = bv->bv_len;
+
+	cmnd->flags = NVME_CMD_SGL_METABUF;
+	cmnd->dptr.sgl.addr = cpu_to_le64(iod->first_dma);
+	cmnd->dptr.sgl.length = cpu_to_le32(iod->dma_len);
+	cmnd->dptr.sgl.type = NVME_SGL_FMT_DATA_DESC << 4;
+	return BLK_STS_OK;
+}
+
 static blk_status_t nvme_map_data(struct nvme_dev *dev, struct request *req,
 		struct nvme_command *cmnd)
 {
@@ -764,6 +861,27 @@ static blk_status_t nvme_map_data(struct nvme_dev *dev, struct request *req,
 	blk_status_t ret = BLK_STS_IOERR;
 	int nr_mapped;
 
+	/*
+	 * A single segment covered by the two PRP entries in the command (or
+	 * by one inline SGL descriptor) needs neither a scatterlist nor a
+	 * PRP/SGL list page, map it directly.  Physically merged segments may
+	 * still span several bvecs, so only take this path if the first bvec
+	 * covers the whole payload.
+	 */
+	if (blk_rq_nr_phys_segments(req) == 1 && !blk_integrity_rq(req)) {
+		struct bio_vec bv = (req->rq_flags & RQF_SPECIAL_PAYLOAD) ?
+				req->special_vec : bio_iovec(req->bio);
+
+		if (bv.bv_len == blk_rq_payload_bytes(req)) {
+			if (iod->use_sgl)
+				return nvme_setup_sgl_simple(dev, req,
+						&cmnd->rw, &bv, dma_dir);
+			if (bv.bv_offset + bv.bv_len <= dev->ctrl.page_size * 2)
+				return nvme_setup_prp_simple(dev, req,
+						&cmnd->rw, &bv, dma_dir);
+		}
+	}
+
 	sg_init_table(iod->sg, blk_rq_nr_phys_segments(req));
 	iod->nents = blk_rq_map_sg(q, req, iod->sg);
 	if (!iod->nents)
@@ -812,7 +930,9 @@ static void nvme_unmap_data(struct nvme_dev *dev, struct request *req)
 	enum dma_data_direction dma_dir = rq_data_dir(req) ?
 			DMA_TO_DEVICE : DMA_FROM_DEVICE;
 
-	if (iod->nents) {
+	if (iod->dma_len) {
+		dma_unmap_page(dev->dev, iod->first_dma, iod->dma_len, dma_dir);
+	} else if (iod->nents) {
 		dma_unmap_sg(dev->dev, iod->sg, iod->nents, dma_dir);
 		if (blk_integrity_rq(req))
 			dma_unmap_sg(dev->dev, &iod->meta_sg, 1, dma_dir);
@@ -874,6 +994,19 @@ static void nvme_pci_complete_rq(struct request *req)
 	nvme_complete_rq(req);
 }
 
+static void nvme_pci_complete_batch(struct io_comp_batch *iob)
+{
+	struct request *req;
+
+	list_for_each_entry(req, &iob->req_list, queuelist) {
+		struct nvme_iod *iod = blk_mq_rq_to_pdu(req);
+
+		nvme_unmap_data(iod->nvmeq->dev, req);
+		nvme_complete_batch_req(req);
+	}
+	blk_mq_end_request_batch(iob);
+}
+
 /* We read the CQE phase first to check if the rest of the entry is valid */
 static inline bool nvme_cqe_pending(struct nvme_queue *nvmeq)
 {
@@ -890,7 +1023,8 @@ static inline void nvme_ring_cq_doorbell(struct nvme_queue *nvmeq)
 		writel(head, nvmeq->q_db + nvmeq->dev->db_stride);
 }
 
-static inline void nvme_handle_cqe(struct nvme_queue *nvmeq, u16 idx)
+static inline void nvme_handle_cqe(struct nvme_queue *nvmeq, u16 idx,
+				   struct io_comp_batch *iob)
 {
 	volatile struct nvme_completion *cqe = &nvmeq->cqes[idx];
 	struct request *req;
@@ -916,16 +1050,27 @@ static inline void nvme_handle_cqe(struct nvme_queue *nvmeq, u16 idx)
 		return;
 	}
 
+	if (iob && !(le16_to_cpu(cqe->status) >> 1)) {
+		nvme_req(req)->status = 0;
+		nvme_req(req)->result = cqe->result;
+		if (blk_mq_add_to_batch(req, iob, 0, nvme_pci_complete_batch))
+			return;
+	}
+
 	nvme_end_request(req, cqe->status, cqe->result);
 }
 
-static void nvme_complete_cqes(struct nvme_queue *nvmeq, u16 start, u16 end)
+static void nvme_complete_cqes(struct nvme_queue *nvmeq, u16 start, u16 end,
+			       struct io_comp_batch *iob)
 {
 	while (start != end) {
-		nvme_handle_cqe(nvmeq, start);
+		nvme_handle_cqe(nvmeq, start, iob);
 		if (++start == nvmeq->q_depth)
 			start = 0;
 	}
+
+	if (iob && !list_empty(&iob->req_list))
+		iob->complete(iob);
 }
 
 static inline void nvme_update_cq_head(struct nvme_queue *nvmeq)
@@ -938,13 +1083,18 @@ static inline void nvme_update_cq_head(struct nvme_queue *nvmeq)
 	}
 }
 
+/*
+ * Reap every pending CQE rather than stopping at @tag, so that a single
+ * poll completes all the requests that finished since the last one with
+ * one doorbell write.
+ */
 static inline bool nvme_process_cq(struct nvme_queue *nvmeq, u16 *start,
 		u16 *end, int tag)
 {
 	bool found = false;
 
 	*start = nvmeq->cq_head;
-	while (!found && nvme_cqe_pending(nvmeq)) {
+	while (nvme_cqe_pending(nvmeq)) {
 		if (nvmeq->cqes[nvmeq->cq_head].command_id == tag)
 			found = true;
 		nvme_update_cq_head(nvmeq);
@@ -970,7 +1120,7 @@ static irqreturn_t nvme_irq(int irq, void *data)
 	spin_unlock(&nvmeq->cq_lock);
 
 	if (start != end) {
-		nvme_complete_cqes(nvmeq, start, end);
+		nvme_complete_cqes(nvmeq, start, end, NULL);
 		return IRQ_HANDLED;
 	}
 
@@ -987,6 +1137,7 @@ static irqreturn_t nvme_irq_check(int irq, void *data)
 
 static int __nvme_poll(struct nvme_queue *nvmeq, unsigned int tag)
 {
+	DEFINE_IO_COMP_BATCH(iob);
 	u16 start, end;
 	bool found;
 
@@ -997,7 +1148,7 @@ static int __nvme_poll(struct nvme_queue *nvmeq, unsigned int tag)
 	found = nvme_process_cq(nvmeq, &start, &end, tag);
 	spin_unlock_irq(&nvmeq->cq_lock);
 
-	nvme_complete_cqes(nvmeq, start, end);
+	nvme_complete_cqes(nvmeq, start, end, &iob);
 	return found;
 }
 
@@ -1315,7 +1466,7 @@ static void nvme_disable_admin_queue(struct nvme_dev *dev, bool shutdown)
 	nvme_process_cq(nvmeq, &start, &end, -1);
 	spin_unlock_irq(&nvmeq->cq_lock);
 
-	nvme_complete_cqes(nvmeq, start, end);
+	nvme_complete_cqes(nvmeq, start, end, NULL);
 }
 
 static int nvme_cmb_qdepth(struct nvme_dev *dev, int nr_io_queues,
@@ -1999,7 +2150,7 @@ static void nvme_del_cq_end(struct request *req, blk_status_t error)
 		nvme_process_cq(nvmeq, &start, &end, -1);
 		spin_unlock_irqrestore(&nvmeq->cq_lock, flags);
 
-		nvme_complete_cqes(nvmeq, start, end);
+		nvme_complete_cqes(nvmeq, start, end, NULL);
 	}
 
 	nvme_del_queue_end(req, error);
@@ -2240,15 +2391,47 @@ static int nvme_setup_prp_pools(struct nvme_dev *dev)
 	/* Optimisation for I/Os between 4k and 128k */
 	dev->prp_small_pool = dma_pool_create("prp list 256", dev->dev,
 						256, 256, 0);
-	if (!dev->prp_small_pool) {
-		dma_pool_destroy(dev->prp_page_pool);
-		return -ENOMEM;
-	}
+	if (!dev->prp_small_pool)
+		goto out_destroy_page_pool;
+
+	dev->prp_page_cache = alloc_percpu(struct nvme_prp_cache);
+	if (!dev->prp_page_cache)
+		goto out_destroy_small_pool;
+	dev->prp_small_cache = alloc_percpu(struct nvme_prp_cache);
+	if (!dev->prp_small_cache)
+		goto out_free_page_cache;
 	return 0;
+
+out_free_page_cache:
+	free_percpu(dev->prp_page_cache);
+out_destroy_small_pool:
+	dma_pool_destroy(dev->prp_small_pool);
+out_destroy_page_pool:
+	dma_pool_destroy(dev->prp_page_pool);
+	return -ENOMEM;
+}
+
+static void nvme_drain_prp_cache(struct nvme_prp_cache __percpu *pcache,
+		struct dma_pool *pool)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct nvme_prp_cache *cache = per_cpu_ptr(pcache, cpu);
+
+		while (cache->nr) {
+			cache->nr--;
+			dma_pool_free(pool, cache->vaddr[cache->nr],
+					cache->dma[cache->nr]);
+		}
+	}
+	free_percpu(pcache);
 }
 
 static void nvme_release_prp_pools(struct nvme_dev *dev)
 {
+	nvme_drain_prp_cache(dev->prp_page_cache, dev->prp_page_pool);
+	nvme_drain_prp_cache(dev->prp_small_cache, dev->prp_small_pool);
 	dma_pool_destroy(dev->prp_page_pool);
 	dma_pool_destroy(dev->prp_small_pool);
 }
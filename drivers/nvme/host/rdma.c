@@ -40,7 +40,9 @@
 
 #define NVME_RDMA_MAX_SEGMENTS		256
 
-#define NVME_RDMA_MAX_INLINE_SEGMENTS	4
+#define NVME_RDMA_MAX_INLINE_SEGMENTS	8
+
+struct nvme_rdma_qe;
 
 struct nvme_rdma_device {
 	struct ib_device	*dev;
@@ -48,6 +50,10 @@ struct nvme_rdma_device {
 	struct kref		ref;
 	struct list_head	entry;
 	unsigned int		num_inline_segments;
+	/* receive buffers shared by the I/O queues of all controllers */
+	struct ib_srq		*srq;
+	struct nvme_rdma_qe	*srq_ring;
+	int			srq_size;
 };
 
 struct nvme_rdma_qe {
@@ -88,6 +94,7 @@ struct nvme_rdma_queue {
 	struct nvme_rdma_device	*device;
 	struct ib_cq		*ib_cq;
 	struct ib_qp		*qp;
+	struct ib_srq		*srq;
 
 	unsigned long		flags;
 	struct rdma_cm_id	*cm_id;
@@ -150,6 +157,16 @@ module_param(enable_inline_data, bool, 0644);
 MODULE_PARM_DESC(enable_inline_data,
 	"global switch for inline data when use rdma transport");
 
+static unsigned int inline_segments = 4;
+module_param(inline_segments, uint, 0444);
+MODULE_PARM_DESC(inline_segments,
+	"max number of scatter/gather segments sent inline with a write (1-8, default 4)");
+
+static int srq_size;
+module_param(srq_size, int, 0444);
+MODULE_PARM_DESC(srq_size,
+	"size of the per-device shared receive queue used by I/O queues (0 = disabled)");
+
 static int nvme_rdma_cm_handler(struct rdma_cm_id *cm_id,
 		struct rdma_cm_event *event);
 static void nvme_rdma_recv_done(struct ib_cq *cq, struct ib_wc *wc);
@@ -238,6 +255,86 @@ static struct nvme_rdma_qe *nvme_rdma_alloc_ring(struct ib_device *ibdev,
 	return NULL;
 }
 
+static int nvme_rdma_post_srq_recv(struct nvme_rdma_device *ndev,
+		struct nvme_rdma_qe *qe)
+{
+	struct ib_recv_wr wr;
+	struct ib_sge list;
+
+	list.addr   = qe->dma;
+	list.length = sizeof(struct nvme_completion);
+	list.lkey   = ndev->pd->local_dma_lkey;
+
+	qe->cqe.done = nvme_rdma_recv_done;
+
+	wr.next     = NULL;
+	wr.wr_cqe   = &qe->cqe;
+	wr.sg_list  = &list;
+	wr.num_sge  = 1;
+
+	return ib_post_srq_recv(ndev->srq, &wr, NULL);
+}
+
+static void nvme_rdma_destroy_srq(struct nvme_rdma_device *ndev)
+{
+	if (!ndev->srq)
+		return;
+
+	ib_destroy_srq(ndev->srq);
+	nvme_rdma_free_ring(ndev->dev, ndev->srq_ring, ndev->srq_size,
+			sizeof(struct nvme_completion), DMA_FROM_DEVICE);
+	ndev->srq = NULL;
+}
+
+/*
+ * With many controllers per host a receive ring per I/O queue adds up.
+ * Instead let all I/O queues on a device share one receive queue; the
+ * requirement is only that enough buffers are posted for the responses in
+ * flight, which is bounded by srq_size rather than by the sum of all queue
+ * depths.  Failing to set one up is not fatal, we just fall back to per
+ * queue receive rings.
+ */
+static void nvme_rdma_init_srq(struct nvme_rdma_device *ndev)
+{
+	struct ib_srq_init_attr srq_attr = { NULL };
+	struct ib_srq *srq;
+	int size, i, ret;
+
+	size = min(srq_size, ndev->dev->attrs.max_srq_wr);
+
+	srq_attr.attr.max_wr = size;
+	srq_attr.attr.max_sge = 1;
+	srq_attr.srq_type = IB_SRQT_BASIC;
+
+	srq = ib_create_srq(ndev->pd, &srq_attr);
+	if (IS_ERR(srq)) {
+		dev_warn(&ndev->dev->dev,
+			"failed to create SRQ (%ld), using per queue receive rings\n",
+			PTR_ERR(srq));
+		return;
+	}
+
+	ndev->srq_ring = nvme_rdma_alloc_ring(ndev->dev, size,
+			sizeof(struct nvme_completion), DMA_FROM_DEVICE);
+	if (!ndev->srq_ring) {
+		ib_destroy_srq(srq);
+		return;
+	}
+
+	ndev->srq = srq;
+	ndev->srq_size = size;
+
+	for (i = 0; i < size; i++) {
+		ret = nvme_rdma_post_srq_recv(ndev, &ndev->srq_ring[i]);
+		if (ret) {
+			dev_warn(&ndev->dev->dev,
+				"failed to post SRQ buffers (%d)\n", ret);
+			nvme_rdma_destroy_srq(ndev);
+			return;
+		}
+	}
+}
+
 static void nvme_rdma_qp_event(struct ib_event *event, void *context)
 {
 	pr_debug("QP event %s (%d)\n",
@@ -262,9 +359,13 @@ static int nvme_rdma_create_qp(struct nvme_rdma_queue *queue, const int factor)
 	init_attr.event_handler = nvme_rdma_qp_event;
 	/* +1 for drain */
 	init_attr.cap.max_send_wr = factor * queue->queue_size + 1;
-	/* +1 for drain */
-	init_attr.cap.max_recv_wr = queue->queue_size + 1;
-	init_attr.cap.max_recv_sge = 1;
+	if (queue->srq) {
+		init_attr.srq = queue->srq;
+	} else {
+		/* +1 for drain */
+		init_attr.cap.max_recv_wr = queue->queue_size + 1;
+		init_attr.cap.max_recv_sge = 1;
+	}
 	init_attr.cap.max_send_sge = 1 + dev->num_inline_segments;
 	init_attr.sq_sig_type = IB_SIGNAL_REQ_WR;
 	init_attr.qp_type = IB_QPT_RC;
@@ -336,6 +437,7 @@ static void nvme_rdma_free_dev(struct kref *ref)
 	list_del(&ndev->entry);
 	mutex_unlock(&device_list_mutex);
 
+	nvme_rdma_destroy_srq(ndev);
 	ib_dealloc_pd(ndev->pd);
 	kfree(ndev);
 }
@@ -381,8 +483,11 @@ nvme_rdma_find_get_device(struct rdma_cm_id *cm_id)
 		goto out_free_pd;
 	}
 
-	ndev->num_inline_segments = min(NVME_RDMA_MAX_INLINE_SEGMENTS,
-					ndev->dev->attrs.max_send_sge - 1);
+	ndev->num_inline_segments = min3(NVME_RDMA_MAX_INLINE_SEGMENTS,
+			clamp(inline_segments, 1U, NVME_RDMA_MAX_INLINE_SEGMENTS),
+			(unsigned int)ndev->dev->attrs.max_send_sge - 1);
+	if (srq_size > 0 && ndev->dev->attrs.max_srq)
+		nvme_rdma_init_srq(ndev);
 	list_add(&ndev->entry, &device_list);
 out_unlock:
 	mutex_unlock(&device_list_mutex);
@@ -418,8 +523,10 @@ static void nvme_rdma_destroy_queue_ib(struct nvme_rdma_queue *queue)
 	ib_destroy_qp(queue->qp);
 	ib_free_cq(queue->ib_cq);
 
-	nvme_rdma_free_ring(ibdev, queue->rsp_ring, queue->queue_size,
-			sizeof(struct nvme_completion), DMA_FROM_DEVICE);
+	if (queue->rsp_ring)
+		nvme_rdma_free_ring(ibdev, queue->rsp_ring, queue->queue_size,
+				sizeof(struct nvme_completion), DMA_FROM_DEVICE);
+	queue->rsp_ring = NULL;
 
 	nvme_rdma_dev_put(dev);
 }
@@ -452,6 +559,9 @@ static int nvme_rdma_create_queue_ib(struct nvme_rdma_queue *queue)
 	 */
 	comp_vector = idx == 0 ? idx : idx - 1;
 
+	/* the admin queue keeps its own ring, AENs must never starve */
+	queue->srq = idx ? queue->device->srq : NULL;
+
 	/* +1 for ib_stop_cq */
 	queue->ib_cq = ib_alloc_cq(ibdev, queue,
 				cq_factor * queue->queue_size + 1,
@@ -465,11 +575,13 @@ static int nvme_rdma_create_queue_ib(struct nvme_rdma_queue *queue)
 	if (ret)
 		goto out_destroy_ib_cq;
 
-	queue->rsp_ring = nvme_rdma_alloc_ring(ibdev, queue->queue_size,
-			sizeof(struct nvme_completion), DMA_FROM_DEVICE);
-	if (!queue->rsp_ring) {
-		ret = -ENOMEM;
-		goto out_destroy_qp;
+	if (!queue->srq) {
+		queue->rsp_ring = nvme_rdma_alloc_ring(ibdev, queue->queue_size,
+				sizeof(struct nvme_completion), DMA_FROM_DEVICE);
+		if (!queue->rsp_ring) {
+			ret = -ENOMEM;
+			goto out_destroy_qp;
+		}
 	}
 
 	ret = ib_mr_pool_init(queue->qp, &queue->qp->rdma_mrs,
@@ -488,8 +600,11 @@ static int nvme_rdma_create_queue_ib(struct nvme_rdma_queue *queue)
 	return 0;
 
 out_destroy_ring:
-	nvme_rdma_free_ring(ibdev, queue->rsp_ring, queue->queue_size,
-			    sizeof(struct nvme_completion), DMA_FROM_DEVICE);
+	if (queue->rsp_ring)
+		nvme_rdma_free_ring(ibdev, queue->rsp_ring, queue->queue_size,
+				    sizeof(struct nvme_completion),
+				    DMA_FROM_DEVICE);
+	queue->rsp_ring = NULL;
 out_destroy_qp:
 	rdma_destroy_qp(queue->cm_id);
 out_destroy_ib_cq:
@@ -1354,6 +1469,9 @@ static int nvme_rdma_post_recv(struct nvme_rdma_queue *queue,
 	struct ib_sge list;
 	int ret;
 
+	if (queue->srq)
+		return nvme_rdma_post_srq_recv(queue->device, qe);
+
 	list.addr   = qe->dma;
 	list.length = sizeof(struct nvme_completion);
 	list.lkey   = queue->device->pd->local_dma_lkey;
@@ -1476,6 +1594,13 @@ static int __nvme_rdma_recv_done(struct ib_cq *cq, struct ib_wc *wc, int tag)
 
 	if (unlikely(wc->status != IB_WC_SUCCESS)) {
 		nvme_rdma_wr_error(cq, wc, "RECV");
+		/*
+		 * A buffer consumed by a QP that went into error belongs to
+		 * the shared receive queue, hand it back so the other queues
+		 * don't run dry across reconnects.
+		 */
+		if (queue->srq)
+			nvme_rdma_post_srq_recv(queue->device, qe);
 		return 0;
 	}
 
@@ -1507,6 +1632,10 @@ static int nvme_rdma_conn_established(struct nvme_rdma_queue *queue)
 {
 	int ret, i;
 
+	/* receive buffers were posted to the SRQ when it was created */
+	if (queue->srq)
+		return 0;
+
 	for (i = 0; i < queue->queue_size; i++) {
 		ret = nvme_rdma_post_recv(queue, &queue->rsp_ring[i]);
 		if (ret)
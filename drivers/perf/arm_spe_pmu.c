@@ -30,10 +30,12 @@
 #include <linux/cpumask.h>
 #include <linux/device.h>
 #include <linux/errno.h>
+#include <linux/hash.h>
 #include <linux/interrupt.h>
 #include <linux/irq.h>
 #include <linux/kernel.h>
 #include <linux/list.h>
+#include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/of_address.h>
 #include <linux/of_device.h>
@@ -49,13 +51,32 @@
 #include <asm/cpufeature.h>
 #include <asm/mmu.h>
 #include <asm/sysreg.h>
+#include <asm/unaligned.h>
+
+#include <uapi/linux/arm_spe_agg.h>
 
 #define ARM_SPE_BUF_PAD_BYTE			0
 
+/*
+ * In aggregate mode, samples are folded into a small open-addressed
+ * table of pages. A page that finds no free slot within
+ * ARM_SPE_AGG_PROBES of its hash is accounted to its node instead.
+ */
+#define ARM_SPE_AGG_PAGES_SHIFT			10
+#define ARM_SPE_AGG_PAGES			(1 << ARM_SPE_AGG_PAGES_SHIFT)
+#define ARM_SPE_AGG_PROBES			8
+
+struct arm_spe_pmu_agg {
+	struct arm_spe_agg_record		pages[ARM_SPE_AGG_PAGES];
+	/* One per node, plus one for addresses without a struct page */
+	struct arm_spe_agg_record		*nodes;
+};
+
 struct arm_spe_pmu_buf {
 	int					nr_pages;
 	bool					snapshot;
 	void					*base;
+	struct arm_spe_pmu_agg			*agg;
 };
 
 struct arm_spe_pmu {
@@ -184,6 +205,9 @@ static struct attribute_group arm_spe_pmu_cap_group = {
 #define ATTR_CFG_FLD_store_filter_CFG		config	/* PMSFCR_EL1.ST */
 #define ATTR_CFG_FLD_store_filter_LO		34
 #define ATTR_CFG_FLD_store_filter_HI		34
+#define ATTR_CFG_FLD_aggregate_CFG		config	/* Driver only */
+#define ATTR_CFG_FLD_aggregate_LO		63
+#define ATTR_CFG_FLD_aggregate_HI		63
 
 #define ATTR_CFG_FLD_event_filter_CFG		config1	/* PMSEVFR_EL1 */
 #define ATTR_CFG_FLD_event_filter_LO		0
@@ -222,6 +246,7 @@ GEN_PMU_FORMAT_ATTR(jitter);
 GEN_PMU_FORMAT_ATTR(branch_filter);
 GEN_PMU_FORMAT_ATTR(load_filter);
 GEN_PMU_FORMAT_ATTR(store_filter);
+GEN_PMU_FORMAT_ATTR(aggregate);
 GEN_PMU_FORMAT_ATTR(event_filter);
 GEN_PMU_FORMAT_ATTR(min_latency);
 
@@ -233,6 +258,7 @@ static struct attribute *arm_spe_pmu_formats_attr[] = {
 	&format_attr_branch_filter.attr,
 	&format_attr_load_filter.attr,
 	&format_attr_store_filter.attr,
+	&format_attr_aggregate.attr,
 	&format_attr_event_filter.attr,
 	&format_attr_min_latency.attr,
 	NULL,
@@ -483,6 +509,245 @@ static u64 arm_spe_pmu_next_off(struct perf_output_handle *handle)
 	return limit;
 }
 
+/* Aggregate mode */
+#define SPE_AGG_HDR_PAD				0x00
+#define SPE_AGG_HDR_END				0x01
+#define SPE_AGG_HDR_EXT_MASK			0xe0
+#define SPE_AGG_HDR_EXT				0x20
+#define SPE_AGG_HDR_ALIGN			0x00	/* Second header byte */
+#define SPE_AGG_HDR_TIMESTAMP			0x71
+#define SPE_AGG_HDR_EVENTS_MASK			0xcf
+#define SPE_AGG_HDR_EVENTS			0x42
+#define SPE_AGG_HDR_OP_TYPE_LDST		0x49
+#define SPE_AGG_HDR_IDX_MASK			0xf8
+#define SPE_AGG_HDR_ADDR			0xb0
+#define SPE_AGG_HDR_COUNTER			0x98
+
+#define SPE_AGG_ADDR_IDX_PA			3
+#define SPE_AGG_ADDR_PA_MASK			GENMASK_ULL(55, 0)
+#define SPE_AGG_COUNTER_IDX_TOTAL		0
+#define SPE_AGG_OP_LDST_ST			BIT(0)
+#define SPE_AGG_EV_REMOTE			BIT(10)
+
+struct arm_spe_pmu_agg_sample {
+	u64	pa;
+	u16	lat;
+	bool	has_pa;
+	bool	ldst;
+	bool	store;
+	bool	remote;
+};
+
+static void arm_spe_pmu_agg_reset_rec(struct arm_spe_agg_record *rec)
+{
+	rec->loads = 0;
+	rec->stores = 0;
+	rec->remote = 0;
+	rec->total_lat = 0;
+}
+
+static struct arm_spe_pmu_agg *arm_spe_pmu_agg_alloc(int node)
+{
+	struct arm_spe_pmu_agg *agg;
+	int i;
+
+	agg = kvzalloc_node(sizeof(*agg), GFP_KERNEL, node);
+	if (!agg)
+		return NULL;
+
+	agg->nodes = kcalloc_node(nr_node_ids + 1, sizeof(*agg->nodes),
+				  GFP_KERNEL, node);
+	if (!agg->nodes) {
+		kvfree(agg);
+		return NULL;
+	}
+
+	for (i = 0; i < ARM_SPE_AGG_PAGES; i++)
+		agg->pages[i].pfn = ARM_SPE_AGG_PFN_NONE;
+
+	for (i = 0; i <= nr_node_ids; i++) {
+		agg->nodes[i].pfn = ARM_SPE_AGG_PFN_NONE;
+		agg->nodes[i].node = i < nr_node_ids ? i : ARM_SPE_AGG_NODE_NONE;
+	}
+
+	return agg;
+}
+
+static void arm_spe_pmu_agg_free(struct arm_spe_pmu_agg *agg)
+{
+	kfree(agg->nodes);
+	kvfree(agg);
+}
+
+static void arm_spe_pmu_agg_add(struct arm_spe_pmu_agg *agg,
+				const struct arm_spe_pmu_agg_sample *s)
+{
+	struct arm_spe_agg_record *rec, *empty = NULL;
+	unsigned long pfn;
+	u32 node = ARM_SPE_AGG_NODE_NONE;
+	u32 hash;
+	int i;
+
+	if (!s->has_pa || !s->ldst)
+		return;
+
+	pfn = PHYS_PFN(s->pa);
+	if (pfn_valid(pfn))
+		node = page_to_nid(pfn_to_page(pfn));
+
+	hash = hash_64(pfn, ARM_SPE_AGG_PAGES_SHIFT);
+	for (i = 0; i < ARM_SPE_AGG_PROBES; i++) {
+		rec = &agg->pages[(hash + i) & (ARM_SPE_AGG_PAGES - 1)];
+		if (rec->pfn == pfn)
+			goto found;
+		if (!empty && rec->pfn == ARM_SPE_AGG_PFN_NONE)
+			empty = rec;
+	}
+
+	if (empty) {
+		rec = empty;
+		rec->pfn = pfn;
+		rec->node = node;
+	} else {
+		rec = &agg->nodes[node == ARM_SPE_AGG_NODE_NONE ?
+				  nr_node_ids : node];
+	}
+
+found:
+	if (s->store)
+		rec->stores++;
+	else
+		rec->loads++;
+	if (s->remote)
+		rec->remote++;
+	rec->total_lat += s->lat;
+}
+
+/*
+ * Walk the SPE records in [start, end) of the buffer and account the
+ * load and store samples carrying a physical address. Only the packets
+ * needed for that are interpreted, everything else is skipped by size.
+ */
+static void arm_spe_pmu_agg_decode(struct arm_spe_pmu_agg *agg,
+				   const u8 *base, u64 start, u64 end)
+{
+	struct arm_spe_pmu_agg_sample s = { };
+	u64 off = start;
+
+	while (off < end) {
+		const u8 *p = base + off;
+		u8 hdr = p[0];
+		int ext = 0, idx, sz;
+		u64 payload;
+
+		if (hdr == SPE_AGG_HDR_PAD) {
+			off++;
+			continue;
+		}
+
+		if (hdr == SPE_AGG_HDR_END) {
+			arm_spe_pmu_agg_add(agg, &s);
+			memset(&s, 0, sizeof(s));
+			off++;
+			continue;
+		}
+
+		if ((hdr & SPE_AGG_HDR_EXT_MASK) == SPE_AGG_HDR_EXT) {
+			if (end - off < 2)
+				break;
+
+			ext = 1;
+			hdr = p[1];
+			if (hdr == SPE_AGG_HDR_ALIGN) {
+				off = ALIGN(off + 1, 2 << (p[0] & 0xf));
+				continue;
+			}
+		}
+
+		/* Payload size is encoded in bits [5:4] of the last header byte */
+		sz = 1 << ((hdr >> 4) & 0x3);
+		if (end - off < 1 + ext + sz)
+			break;
+
+		switch (sz) {
+		case 1:
+			payload = p[1 + ext];
+			break;
+		case 2:
+			payload = get_unaligned_le16(p + 1 + ext);
+			break;
+		case 4:
+			payload = get_unaligned_le32(p + 1 + ext);
+			break;
+		default:
+			payload = get_unaligned_le64(p + 1 + ext);
+			break;
+		}
+
+		idx = hdr & 0x7;
+		if (ext)
+			idx |= (p[0] & 0x3) << 3;
+
+		if ((hdr & SPE_AGG_HDR_IDX_MASK) == SPE_AGG_HDR_ADDR) {
+			if (idx == SPE_AGG_ADDR_IDX_PA) {
+				s.pa = payload & SPE_AGG_ADDR_PA_MASK;
+				s.has_pa = true;
+			}
+		} else if ((hdr & SPE_AGG_HDR_IDX_MASK) == SPE_AGG_HDR_COUNTER) {
+			if (idx == SPE_AGG_COUNTER_IDX_TOTAL)
+				s.lat = payload;
+		} else if (!ext) {
+			if (hdr == SPE_AGG_HDR_TIMESTAMP) {
+				/* A timestamp also terminates the record */
+				arm_spe_pmu_agg_add(agg, &s);
+				memset(&s, 0, sizeof(s));
+			} else if ((hdr & SPE_AGG_HDR_EVENTS_MASK) ==
+				   SPE_AGG_HDR_EVENTS) {
+				s.remote = !!(payload & SPE_AGG_EV_REMOTE);
+			} else if (hdr == SPE_AGG_HDR_OP_TYPE_LDST) {
+				s.ldst = true;
+				s.store = !!(payload & SPE_AGG_OP_LDST_ST);
+			}
+		}
+
+		off += 1 + ext + sz;
+	}
+}
+
+/*
+ * Fold the raw records the hardware wrote at @start into the aggregation
+ * table, then overwrite them with as many aggregated records as fit.
+ * Whatever does not fit stays in the table for the next update. Returns
+ * the number of bytes to hand to userspace.
+ */
+static u64 arm_spe_pmu_agg_update(struct arm_spe_pmu_buf *buf, u64 start,
+				  u64 size)
+{
+	struct arm_spe_pmu_agg *agg = buf->agg;
+	struct arm_spe_agg_record *rec;
+	u64 nr = size / sizeof(*rec), n = 0;
+	int i;
+
+	arm_spe_pmu_agg_decode(agg, buf->base, start, start + size);
+
+	for (i = 0; i < ARM_SPE_AGG_PAGES + nr_node_ids + 1 && n < nr; i++) {
+		if (i < ARM_SPE_AGG_PAGES)
+			rec = &agg->pages[i];
+		else
+			rec = &agg->nodes[i - ARM_SPE_AGG_PAGES];
+
+		if (!rec->loads && !rec->stores)
+			continue;
+
+		memcpy(buf->base + start + n++ * sizeof(*rec), rec, sizeof(*rec));
+		arm_spe_pmu_agg_reset_rec(rec);
+		if (i < ARM_SPE_AGG_PAGES)
+			rec->pfn = ARM_SPE_AGG_PFN_NONE;
+	}
+
+	return n * sizeof(*rec);
+}
+
 static void arm_spe_perf_aux_output_begin(struct perf_output_handle *handle,
 					  struct perf_event *event)
 {
@@ -524,6 +789,9 @@ static void arm_spe_perf_aux_output_end(struct perf_output_handle *handle)
 
 	if (buf->snapshot)
 		handle->head = offset;
+	else if (buf->agg)
+		size = arm_spe_pmu_agg_update(buf, PERF_IDX2OFF(handle->head, buf),
+					      size);
 
 	perf_aux_output_end(handle, size);
 }
@@ -697,6 +965,11 @@ static int arm_spe_pmu_event_init(struct perf_event *event)
 	if (attr->freq)
 		return -EINVAL;
 
+	/* Samples are aggregated by page, so we need the physical address */
+	if (ATTR_CFG_GET_FLD(attr, aggregate) &&
+	    !ATTR_CFG_GET_FLD(attr, pa_enable))
+		return -EINVAL;
+
 	reg = arm_spe_event_to_pmsfcr(event);
 	if ((reg & BIT(SYS_PMSFCR_EL1_FE_SHIFT)) &&
 	    !(spe_pmu->features & SPE_PMU_FEAT_FILT_EVT))
@@ -845,6 +1118,10 @@ static void *arm_spe_pmu_setup_aux(struct perf_event *event, void **pages,
 	if (!nr_pages || (snapshot && (nr_pages & 1)))
 		return NULL;
 
+	/* Aggregated records can't be overwritten in place like raw ones */
+	if (snapshot && ATTR_CFG_GET_FLD(&event->attr, aggregate))
+		return NULL;
+
 	if (cpu == -1)
 		cpu = raw_smp_processor_id();
 
@@ -863,12 +1140,20 @@ static void *arm_spe_pmu_setup_aux(struct perf_event *event, void **pages,
 	if (!buf->base)
 		goto out_free_pglist;
 
+	if (ATTR_CFG_GET_FLD(&event->attr, aggregate)) {
+		buf->agg = arm_spe_pmu_agg_alloc(cpu_to_node(cpu));
+		if (!buf->agg)
+			goto out_vunmap;
+	}
+
 	buf->nr_pages	= nr_pages;
 	buf->snapshot	= snapshot;
 
 	kfree(pglist);
 	return buf;
 
+out_vunmap:
+	vunmap(buf->base);
 out_free_pglist:
 	kfree(pglist);
 out_free_buf:
@@ -880,6 +1165,8 @@ static void arm_spe_pmu_free_aux(void *aux)
 {
 	struct arm_spe_pmu_buf *buf = aux;
 
+	if (buf->agg)
+		arm_spe_pmu_agg_free(buf->agg);
 	vunmap(buf->base);
 	kfree(buf);
 }
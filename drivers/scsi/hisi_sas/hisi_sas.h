@@ -17,6 +17,7 @@
 #include <linux/debugfs.h>
 #include <linux/dmapool.h>
 #include <linux/iopoll.h>
+#include <linux/irq_poll.h>
 #include <linux/lcm.h>
 #include <linux/libata.h>
 #include <linux/mfd/syscon.h>
@@ -193,6 +194,7 @@ struct hisi_sas_port {
 struct hisi_sas_cq {
 	struct hisi_hba *hisi_hba;
 	struct tasklet_struct tasklet;
+	struct irq_poll iopoll;
 	int	rd_point;
 	int	id;
 };
@@ -335,6 +337,7 @@ struct hisi_sas_hw {
 	void (*snapshot_restore)(struct hisi_hba *hisi_hba);
 	const struct cpumask *(*get_managed_irq_aff)(struct hisi_hba
 			*hisi_hba, int queue);
+	void (*sync_cq)(struct hisi_sas_cq *cq);
 	void (*debugfs_work_handler)(struct work_struct *work);
 	int max_command_entries;
 	int complete_hdr_size;
@@ -437,6 +440,7 @@ struct hisi_hba {
 	unsigned int dq_idx[NR_CPUS];
 	int nvecs;
 	unsigned int dq_num_per_node;
+	unsigned int *reply_map;	/* cpu -> dq/cq, NULL if unmanaged */
 };
 
 /* Generic HW DMA host memory structures */
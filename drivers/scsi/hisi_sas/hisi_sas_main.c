@@ -473,6 +473,10 @@ static int hisi_sas_task_prep(struct sas_task *task,
 
 	if (hisi_hba->user_ctl_irq)
 		*dq_pointer = dq = sas_dev->dq;
+	else if (hisi_hba->reply_map)
+		/* complete on the queue whose irq is affine to this cpu */
+		*dq_pointer = dq =
+			&hisi_hba->dq[hisi_hba->reply_map[raw_smp_processor_id()]];
 	else
 		*dq_pointer = dq = &hisi_hba->dq[dq_index];
 
@@ -1205,6 +1209,18 @@ static void hisi_sas_tmf_timedout(struct timer_list *t)
 #define TASK_TIMEOUT 20
 #define TASK_RETRY 3
 #define INTERNAL_ABORT_TIMEOUT 6
+/*
+ * Wait for completion processing already scheduled on @cq. v3 hw polls
+ * its completion queues with irq_poll, older hw uses a tasklet per queue.
+ */
+static void hisi_sas_sync_cq(struct hisi_hba *hisi_hba, struct hisi_sas_cq *cq)
+{
+	if (hisi_hba->hw->sync_cq)
+		hisi_hba->hw->sync_cq(cq);
+	else
+		tasklet_kill(&cq->tasklet);
+}
+
 static int hisi_sas_exec_internal_tmf_task(struct domain_device *device,
 					   void *parameter, u32 para_len,
 					   struct hisi_sas_tmf_task *tmf)
@@ -1256,10 +1272,10 @@ static int hisi_sas_exec_internal_tmf_task(struct domain_device *device,
 					struct hisi_sas_cq *cq =
 						&hisi_hba->cq[slot->dlvry_queue];
 					/*
-					 * flush tasklet to avoid free'ing task
+					 * flush CQ to avoid free'ing task
 					 * before using task in IO completion
 					 */
-					tasklet_kill(&cq->tasklet);
+					hisi_sas_sync_cq(hisi_hba, cq);
 					slot->task = NULL;
 				}
 
@@ -1668,11 +1684,11 @@ static int hisi_sas_abort_task(struct sas_task *task)
 
 		if (slot) {
 			/*
-			 * flush tasklet to avoid free'ing task
+			 * flush CQ to avoid free'ing task
 			 * before using task in IO completion
 			 */
 			cq = &hisi_hba->cq[slot->dlvry_queue];
-			tasklet_kill(&cq->tasklet);
+			hisi_sas_sync_cq(hisi_hba, cq);
 		}
 		spin_unlock_irqrestore(&task->task_state_lock, flags);
 		rc = TMF_RESP_FUNC_COMPLETE;
@@ -1746,10 +1762,10 @@ static int hisi_sas_abort_task(struct sas_task *task)
 		if (((rc < 0) || (rc == TMF_RESP_FUNC_FAILED)) &&
 					task->lldd_task) {
 			/*
-			 * flush tasklet to avoid free'ing task
+			 * flush CQ to avoid free'ing task
 			 * before using task in IO completion
 			 */
-			tasklet_kill(&cq->tasklet);
+			hisi_sas_sync_cq(hisi_hba, cq);
 			slot->task = NULL;
 		}
 	}
@@ -2130,10 +2146,10 @@ _hisi_sas_internal_task_abort(struct hisi_hba *hisi_hba,
 				struct hisi_sas_cq *cq =
 					&hisi_hba->cq[slot->dlvry_queue];
 				/*
-				 * flush tasklet to avoid free'ing task
+				 * flush CQ to avoid free'ing task
 				 * before using task in IO completion
 				 */
-				tasklet_kill(&cq->tasklet);
+				hisi_sas_sync_cq(hisi_hba, cq);
 				slot->task = NULL;
 			}
 			dev_err(dev, "internal task abort: timeout and not done.\n");
@@ -2296,7 +2312,7 @@ void hisi_sas_kill_tasklets(struct hisi_hba *hisi_hba)
 	for (i = 0; i < hisi_hba->nvecs; i++) {
 		struct hisi_sas_cq *cq = &hisi_hba->cq[i];
 
-		tasklet_kill(&cq->tasklet);
+		hisi_sas_sync_cq(hisi_hba, cq);
 	}
 }
 EXPORT_SYMBOL_GPL(hisi_sas_kill_tasklets);
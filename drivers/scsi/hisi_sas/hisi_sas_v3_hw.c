@@ -557,6 +557,10 @@ module_param(user_ctl_irq, bool, 0444);
 MODULE_PARM_DESC(user_ctl_irq, "Enable user control irq affinity:\n"
 			       "default is auto-control irq affinity");
 
+static int cq_poll_weight = 64;
+module_param(cq_poll_weight, int, 0444);
+MODULE_PARM_DESC(cq_poll_weight, "Max completions handled per CQ poll (def=64)");
+
 static u32 hisi_sas_read32(struct hisi_hba *hisi_hba, u32 off)
 {
 	void __iomem *regs = hisi_hba->regs + off;
@@ -2643,21 +2647,22 @@ static void hisi_sas_disk_err_handler(struct hisi_hba *hisi_hba,
 	hisi_sas_ata_device_link_abort(device);
 }
 
-static void cq_tasklet_v3_hw(unsigned long val)
+static int cq_iopoll_v3_hw(struct irq_poll *iop, int budget)
 {
-	struct hisi_sas_cq *cq = (struct hisi_sas_cq *)val;
+	struct hisi_sas_cq *cq = container_of(iop, struct hisi_sas_cq, iopoll);
 	struct hisi_hba *hisi_hba = cq->hisi_hba;
 	struct hisi_sas_slot *slot;
 	struct hisi_sas_complete_v3_hdr *complete_queue;
 	u32 rd_point = cq->rd_point, wr_point;
 	int queue = cq->id;
+	int done = 0;
 
 	complete_queue = hisi_hba->complete_hdr[queue];
 
 	wr_point = hisi_sas_read32(hisi_hba, COMPL_Q_0_WR_PTR +
 				   (NEXT_DQCQ_REG_OFF * queue));
 
-	while (rd_point != wr_point) {
+	while (rd_point != wr_point && done < budget) {
 		struct hisi_sas_complete_v3_hdr *complete_hdr;
 		struct device *dev = hisi_hba->dev;
 		u32 dw0, dw1, dw3;
@@ -2682,6 +2687,7 @@ static void cq_tasklet_v3_hw(unsigned long val)
 
 		if (++rd_point >= HISI_SAS_QUEUE_SLOTS)
 			rd_point = 0;
+		done++;
 	}
 
 	/* update rd_point */
@@ -2689,6 +2695,18 @@ static void cq_tasklet_v3_hw(unsigned long val)
 	hisi_sas_write32(hisi_hba,
 			 COMPL_Q_0_RD_PTR + (NEXT_DQCQ_REG_OFF * queue),
 			 rd_point);
+
+	/*
+	 * Budget exhausted: stay scheduled and leave the CQ interrupt masked.
+	 * Otherwise unmask it; entries that arrived since wr_point was read
+	 * have latched OQ_INT_SRC and raise a fresh interrupt.
+	 */
+	if (done < budget) {
+		irq_poll_complete(iop);
+		hisi_sas_write32(hisi_hba, OQ0_INT_SRC_MSK + 0x4 * queue, 0);
+	}
+
+	return done;
 }
 
 static irqreturn_t cq_interrupt_v3_hw(int irq_no, void *p)
@@ -2697,13 +2715,45 @@ static irqreturn_t cq_interrupt_v3_hw(int irq_no, void *p)
 	struct hisi_hba *hisi_hba = cq->hisi_hba;
 	int queue = cq->id;
 
+	hisi_sas_write32(hisi_hba, OQ0_INT_SRC_MSK + 0x4 * queue, 0x1);
 	hisi_sas_write32(hisi_hba, OQ_INT_SRC, 1 << queue);
 
-	tasklet_schedule(&cq->tasklet);
+	irq_poll_sched(&cq->iopoll);
 
 	return IRQ_HANDLED;
 }
 
+static void sync_cq_v3_hw(struct hisi_sas_cq *cq)
+{
+	/* like tasklet_kill(): wait for a scheduled poll to have run */
+	while (test_bit(IRQ_POLL_F_SCHED, &cq->iopoll.state))
+		yield();
+}
+
+/*
+ * Map each cpu to the CQ whose managed irq is affine to it, so that an IO
+ * is delivered on, and completes on, the cpu that issued it.
+ */
+static void setup_reply_map_v3_hw(struct hisi_hba *hisi_hba, int nr_queues)
+{
+	const struct cpumask *mask;
+	unsigned int cpu;
+	int queue;
+
+	for_each_possible_cpu(cpu)
+		hisi_hba->reply_map[cpu] = cpu % nr_queues;
+
+	for (queue = 0; queue < nr_queues; queue++) {
+		mask = pci_irq_get_affinity(hisi_hba->pci_dev, queue +
+					    HISI_SAS_CQ_INT_BASE_VECTORS_V3_HW);
+		if (!mask)
+			continue;
+
+		for_each_cpu(cpu, mask)
+			hisi_hba->reply_map[cpu] = queue;
+	}
+}
+
 static int interrupt_init_v3_hw(struct hisi_hba *hisi_hba)
 {
 	struct device *dev = hisi_hba->dev;
@@ -2743,6 +2793,14 @@ static int interrupt_init_v3_hw(struct hisi_hba *hisi_hba)
 		hisi_hba->dq_num_per_node = max_dq_num / online_numa_num;
 	else
 		hisi_hba->dq_num_per_node = 1;
+
+	if (!user_ctl_irq && !hisi_sas_intr_conv) {
+		hisi_hba->reply_map = devm_kcalloc(dev, nr_cpu_ids,
+						   sizeof(unsigned int),
+						   GFP_KERNEL);
+		if (hisi_hba->reply_map)
+			setup_reply_map_v3_hw(hisi_hba, max_dq_num);
+	}
 	rc = devm_request_irq(dev, pci_irq_vector(pdev, PCI_IRQ_PHY),
 			      int_phy_up_down_bcast_v3_hw, 0,
 			      DRV_NAME " phy", hisi_hba);
@@ -2770,10 +2828,12 @@ static int interrupt_init_v3_hw(struct hisi_hba *hisi_hba)
 		goto free_chnl_interrupt;
 	}
 
-	/* Init tasklets for cq only */
+	if (cq_poll_weight <= 0)
+		cq_poll_weight = 64;
+
+	/* Init irq_poll for cq only */
 	for (i = 0; i < hisi_hba->nvecs; i++) {
 		struct hisi_sas_cq *cq = &hisi_hba->cq[i];
-		struct tasklet_struct *t = &cq->tasklet;
 		int nr = hisi_sas_intr_conv ? PCI_IRQ_CQ_BASE :
 					      PCI_IRQ_CQ_BASE + i;
 		unsigned long irqflags = hisi_sas_intr_conv ? IRQF_SHARED : 0;
@@ -2789,7 +2849,7 @@ static int interrupt_init_v3_hw(struct hisi_hba *hisi_hba)
 			goto free_cq_irqs;
 		}
 
-		tasklet_init(t, cq_tasklet_v3_hw, (uintptr_t)cq);
+		irq_poll_init(&cq->iopoll, cq_poll_weight, cq_iopoll_v3_hw);
 	}
 
 	return 0;
@@ -2848,8 +2908,13 @@ static void interrupt_disable_v3_hw(struct hisi_hba *hisi_hba)
 	synchronize_irq(pci_irq_vector(pdev, PCI_IRQ_CHANNEL));
 	synchronize_irq(pci_irq_vector(pdev, PCI_IRQ_AXI_FATAL));
 	for (i = 0; i < hisi_hba->nvecs; i++) {
+		struct hisi_sas_cq *cq = &hisi_hba->cq[i];
+
+		/* keep a running poll from unmasking the CQ behind our back */
+		irq_poll_disable(&cq->iopoll);
 		hisi_sas_write32(hisi_hba, OQ0_INT_SRC_MSK + 0x4 * i, 0x1);
 		synchronize_irq(pci_irq_vector(pdev, i + PCI_IRQ_CQ_BASE));
+		irq_poll_enable(&cq->iopoll);
 	}
 
 	hisi_sas_write32(hisi_hba, ENT_INT_SRC_MSK1, 0xffffffff);
@@ -3455,6 +3520,7 @@ static const struct hisi_sas_hw hisi_sas_v3_hw = {
 	.snapshot_restore = debugfs_snapshot_restore_v3_hw,
 	.set_bist = debugfs_set_bist_v3_hw,
 	.get_managed_irq_aff = get_managed_irq_aff_v3_hw,
+	.sync_cq = sync_cq_v3_hw,
 	.debugfs_work_handler = hisi_sas_debugfs_work_handler,
 };
 
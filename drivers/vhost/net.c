@@ -41,6 +41,11 @@ module_param(experimental_zcopytx, int, 0444);
 MODULE_PARM_DESC(experimental_zcopytx, "Enable Zero Copy TX;"
 		                       " 1 -Enable; 0 - Disable");
 
+static bool busyloop_adaptive = true;
+module_param(busyloop_adaptive, bool, 0644);
+MODULE_PARM_DESC(busyloop_adaptive, "Shorten the busy loop of idle virtqueues;"
+		                    " 1 -Enable; 0 - Disable");
+
 /* Max number of bytes transferred before requeueing the job.
  * Using this limit prevents one virtqueue from starving others. */
 #define VHOST_NET_WEIGHT 0x80000
@@ -55,6 +60,11 @@ MODULE_PARM_DESC(experimental_zcopytx, "Enable Zero Copy TX;"
 #define VHOST_MAX_PEND 128
 #define VHOST_GOODCOPY_LEN 256
 
+/* Busy loops that find nothing halve the next one, down to this shift of
+ * the busyloop_timeout set by userspace.
+ */
+#define VHOST_NET_BUSYLOOP_MAX_SHIFT 4
+
 /*
  * For transmit, used buffer len is unused; we override it to track buffer
  * status internally; used for zerocopy tx only.
@@ -78,7 +88,8 @@ enum {
 };
 
 enum {
-	VHOST_NET_BACKEND_FEATURES = (1ULL << VHOST_BACKEND_F_IOTLB_MSG_V2)
+	VHOST_NET_BACKEND_FEATURES = (1ULL << VHOST_BACKEND_F_IOTLB_MSG_V2) |
+				     (1ULL << VHOST_BACKEND_F_IOTLB_BATCH)
 };
 
 enum {
@@ -123,6 +134,8 @@ struct vhost_net_virtqueue {
 	struct vhost_net_ubuf_ref *ubufs;
 	struct ptr_ring *rx_ring;
 	struct vhost_net_buf rxq;
+	/* Shift applied to the busy loop timeout, protected by vq mutex */
+	unsigned int busyloop_shift;
 };
 
 struct vhost_net {
@@ -406,6 +419,29 @@ static bool vhost_can_busy_poll(unsigned long endtime)
 		      !signal_pending(current));
 }
 
+static unsigned long vhost_net_busy_poll_end(struct vhost_net_virtqueue *nvq,
+					     u32 timeout)
+{
+	return busy_clock() + (timeout >> nvq->busyloop_shift);
+}
+
+/* Keep spinning the full timeout on busy virtqueues only */
+static void vhost_net_busy_poll_update(struct vhost_net_virtqueue *nvq,
+				       bool found)
+{
+	if (found || !busyloop_adaptive)
+		nvq->busyloop_shift = 0;
+	else if (nvq->busyloop_shift < VHOST_NET_BUSYLOOP_MAX_SHIFT)
+		nvq->busyloop_shift++;
+}
+
+/* TX and RX run on one worker, which can then busy poll both of them */
+static bool vhost_net_shared_worker(struct vhost_net *net)
+{
+	return rcu_access_pointer(net->vqs[VHOST_NET_VQ_TX].vq.worker) ==
+	       rcu_access_pointer(net->vqs[VHOST_NET_VQ_RX].vq.worker);
+}
+
 static void vhost_net_disable_vq(struct vhost_net *n,
 				 struct vhost_virtqueue *vq)
 {
@@ -455,20 +491,26 @@ static int vhost_net_tx_get_vq_desc(struct vhost_net *net,
 				  out_num, in_num, NULL, NULL);
 
 	if (r == vq->num && vq->busyloop_timeout) {
+		bool found = false;
+
 		if (!vhost_sock_zcopy(vq->private_data))
 			vhost_net_signal_used(nvq);
 		preempt_disable();
-		endtime = busy_clock() + vq->busyloop_timeout;
+		endtime = vhost_net_busy_poll_end(nvq, vq->busyloop_timeout);
 		while (vhost_can_busy_poll(endtime)) {
-			if (vhost_has_work(vq->dev)) {
+			if (vhost_vq_has_work(vq)) {
 				*busyloop_intr = true;
 				break;
 			}
-			if (!vhost_vq_avail_empty(vq->dev, vq))
+			if (!vhost_vq_avail_empty(vq->dev, vq)) {
+				found = true;
 				break;
+			}
 			cpu_relax();
 		}
 		preempt_enable();
+		if (!*busyloop_intr)
+			vhost_net_busy_poll_update(nvq, found);
 		r = vhost_get_vq_desc(vq, vq->iov, ARRAY_SIZE(vq->iov),
 				      out_num, in_num, NULL, NULL);
 	}
@@ -766,37 +808,51 @@ static int vhost_net_rx_peek_head_len(struct vhost_net *net, struct sock *sk,
 	int len = peek_head_len(rnvq, sk);
 
 	if (!len && tvq->busyloop_timeout) {
+		/* TX has its own worker to busy poll it otherwise */
+		bool poll_tx = vhost_net_shared_worker(net);
+		bool found = false;
+
 		/* Flush batched heads first */
 		vhost_net_signal_used(rnvq);
 		/* Both tx vq and rx socket were polled here */
-		mutex_lock_nested(&tvq->mutex, 1);
-		vhost_disable_notify(&net->dev, tvq);
+		if (poll_tx) {
+			mutex_lock_nested(&tvq->mutex, 1);
+			vhost_disable_notify(&net->dev, tvq);
+		}
 
 		preempt_disable();
-		endtime = busy_clock() + tvq->busyloop_timeout;
+		endtime = vhost_net_busy_poll_end(rnvq, tvq->busyloop_timeout);
 
 		while (vhost_can_busy_poll(endtime)) {
-			if (vhost_has_work(&net->dev)) {
+			if (vhost_vq_has_work(rvq)) {
 				*busyloop_intr = true;
 				break;
 			}
 			if ((sk_has_rx_data(sk) &&
 			     !vhost_vq_avail_empty(&net->dev, rvq)) ||
-			    !vhost_vq_avail_empty(&net->dev, tvq))
+			    (poll_tx && !vhost_vq_avail_empty(&net->dev, tvq))) {
+				found = true;
 				break;
+			}
 			cpu_relax();
 		}
 
 		preempt_enable();
 
-		if (!vhost_vq_avail_empty(&net->dev, tvq)) {
-			vhost_poll_queue(&tvq->poll);
-		} else if (unlikely(vhost_enable_notify(&net->dev, tvq))) {
-			vhost_disable_notify(&net->dev, tvq);
-			vhost_poll_queue(&tvq->poll);
-		}
+		if (!*busyloop_intr)
+			vhost_net_busy_poll_update(rnvq, found);
+
+		if (poll_tx) {
+			if (!vhost_vq_avail_empty(&net->dev, tvq)) {
+				vhost_poll_queue(&tvq->poll);
+			} else if (unlikely(vhost_enable_notify(&net->dev,
+								tvq))) {
+				vhost_disable_notify(&net->dev, tvq);
+				vhost_poll_queue(&tvq->poll);
+			}
 
-		mutex_unlock(&tvq->mutex);
+			mutex_unlock(&tvq->mutex);
+		}
 
 		len = peek_head_len(rnvq, sk);
 	}
@@ -1100,14 +1156,17 @@ static int vhost_net_open(struct inode *inode, struct file *f)
 		n->vqs[i].vhost_hlen = 0;
 		n->vqs[i].sock_hlen = 0;
 		n->vqs[i].rx_ring = NULL;
+		n->vqs[i].busyloop_shift = 0;
 		vhost_net_buf_init(&n->vqs[i].rxq);
 	}
 	vhost_dev_init(dev, vqs, VHOST_NET_VQ_MAX,
 		       UIO_MAXIOV + VHOST_NET_BATCH,
 		       VHOST_NET_PKT_WEIGHT, VHOST_NET_WEIGHT);
 
-	vhost_poll_init(n->poll + VHOST_NET_VQ_TX, handle_tx_net, EPOLLOUT, dev);
-	vhost_poll_init(n->poll + VHOST_NET_VQ_RX, handle_rx_net, EPOLLIN, dev);
+	vhost_poll_init(n->poll + VHOST_NET_VQ_TX, handle_tx_net, EPOLLOUT, dev,
+			vqs[VHOST_NET_VQ_TX]);
+	vhost_poll_init(n->poll + VHOST_NET_VQ_RX, handle_rx_net, EPOLLIN, dev,
+			vqs[VHOST_NET_VQ_RX]);
 
 	f->private_data = n;
 
@@ -189,6 +189,8 @@ struct vhost_scsi_virtqueue {
 	 * Writers must also take dev mutex and flush under it.
 	 */
 	int inflight_idx;
+	/* Completed heads batched in vq->heads, only used by completion work */
+	int done_idx;
 };
 
 struct vhost_scsi {
@@ -512,6 +514,17 @@ static void vhost_scsi_evt_work(struct vhost_work *work)
  * This is scheduled in the vhost work queue so we are called with the owner
  * process mm and can access the vring.
  */
+/* Publish the heads batched by vhost_scsi_complete_cmd_work at once */
+static void vhost_scsi_add_used(struct vhost_scsi_virtqueue *q)
+{
+	struct vhost_virtqueue *vq = &q->vq;
+
+	mutex_lock(&vq->mutex);
+	vhost_add_used_n(vq, vq->heads, q->done_idx);
+	mutex_unlock(&vq->mutex);
+	q->done_idx = 0;
+}
+
 static void vhost_scsi_complete_cmd_work(struct vhost_work *work)
 {
 	struct vhost_scsi *vs = container_of(work, struct vhost_scsi,
@@ -546,8 +559,14 @@ static void vhost_scsi_complete_cmd_work(struct vhost_work *work)
 		ret = copy_to_iter(&v_rsp, sizeof(v_rsp), &iov_iter);
 		if (likely(ret == sizeof(v_rsp))) {
 			struct vhost_scsi_virtqueue *q;
-			vhost_add_used(cmd->tvc_vq, cmd->tvc_vq_desc, 0);
+			struct vring_used_elem *head;
+
 			q = container_of(cmd->tvc_vq, struct vhost_scsi_virtqueue, vq);
+			head = &q->vq.heads[q->done_idx++];
+			head->id = cpu_to_vhost32(&q->vq, cmd->tvc_vq_desc);
+			head->len = 0;
+			if (q->done_idx == vs->dev.iov_limit)
+				vhost_scsi_add_used(q);
 			vq = q - vs->vqs;
 			__set_bit(vq, signal);
 		} else
@@ -558,8 +577,11 @@ static void vhost_scsi_complete_cmd_work(struct vhost_work *work)
 
 	vq = -1;
 	while ((vq = find_next_bit(signal, VHOST_SCSI_MAX_VQ, vq + 1))
-		< VHOST_SCSI_MAX_VQ)
+		< VHOST_SCSI_MAX_VQ) {
+		if (vs->vqs[vq].done_idx)
+			vhost_scsi_add_used(&vs->vqs[vq]);
 		vhost_signal(&vs->dev, &vs->vqs[vq].vq);
+	}
 }
 
 static struct vhost_scsi_cmd *
@@ -185,14 +185,16 @@ void vhost_work_init(struct vhost_work *work, vhost_work_fn_t fn)
 }
 EXPORT_SYMBOL_GPL(vhost_work_init);
 
-/* Init poll structure */
+/* Init poll structure, its work runs on the worker of @vq if given */
 void vhost_poll_init(struct vhost_poll *poll, vhost_work_fn_t fn,
-		     __poll_t mask, struct vhost_dev *dev)
+		     __poll_t mask, struct vhost_dev *dev,
+		     struct vhost_virtqueue *vq)
 {
 	init_waitqueue_func_entry(&poll->wait, vhost_poll_wakeup);
 	init_poll_funcptr(&poll->table, vhost_poll_func);
 	poll->mask = mask;
 	poll->dev = dev;
+	poll->vq = vq;
 	poll->wqh = NULL;
 
 	vhost_work_init(&poll->work, fn);
@@ -232,17 +234,42 @@ void vhost_poll_stop(struct vhost_poll *poll)
 }
 EXPORT_SYMBOL_GPL(vhost_poll_stop);
 
-void vhost_work_flush(struct vhost_dev *dev, struct vhost_work *work)
+static void vhost_worker_queue(struct vhost_worker *worker,
+			       struct vhost_work *work)
+{
+	if (!test_and_set_bit(VHOST_WORK_QUEUED, &work->flags)) {
+		/* We can only add the work to the list after we're
+		 * sure it was not in the list.
+		 * test_and_set_bit() implies a memory barrier.
+		 */
+		llist_add(&work->node, &worker->work_list);
+		wake_up_process(worker->task);
+	}
+}
+
+static void vhost_worker_flush(struct vhost_worker *worker)
 {
 	struct vhost_flush_struct flush;
 
-	if (dev->worker) {
-		init_completion(&flush.wait_event);
-		vhost_work_init(&flush.work, vhost_flush_work);
+	init_completion(&flush.wait_event);
+	vhost_work_init(&flush.work, vhost_flush_work);
 
-		vhost_work_queue(dev, &flush.work);
-		wait_for_completion(&flush.wait_event);
-	}
+	vhost_worker_queue(worker, &flush.work);
+	wait_for_completion(&flush.wait_event);
+}
+
+/* Workers of a vq only change under dev->mutex, which is held by the
+ * callers or, on release, not needed any more.
+ */
+static struct vhost_worker *vhost_vq_worker(struct vhost_virtqueue *vq)
+{
+	return rcu_dereference_protected(vq->worker, true) ?: vq->dev->worker;
+}
+
+void vhost_work_flush(struct vhost_dev *dev, struct vhost_work *work)
+{
+	if (dev->worker)
+		vhost_worker_flush(dev->worker);
 }
 EXPORT_SYMBOL_GPL(vhost_work_flush);
 
@@ -250,7 +277,16 @@ EXPORT_SYMBOL_GPL(vhost_work_flush);
  * locks that are also used by the callback. */
 void vhost_poll_flush(struct vhost_poll *poll)
 {
-	vhost_work_flush(poll->dev, &poll->work);
+	struct vhost_worker *worker;
+
+	if (!poll->vq) {
+		vhost_work_flush(poll->dev, &poll->work);
+		return;
+	}
+
+	worker = vhost_vq_worker(poll->vq);
+	if (worker)
+		vhost_worker_flush(worker);
 }
 EXPORT_SYMBOL_GPL(vhost_poll_flush);
 
@@ -259,27 +295,48 @@ void vhost_work_queue(struct vhost_dev *dev, struct vhost_work *work)
 	if (!dev->worker)
 		return;
 
-	if (!test_and_set_bit(VHOST_WORK_QUEUED, &work->flags)) {
-		/* We can only add the work to the list after we're
-		 * sure it was not in the list.
-		 * test_and_set_bit() implies a memory barrier.
-		 */
-		llist_add(&work->node, &dev->work_list);
-		wake_up_process(dev->worker);
-	}
+	vhost_worker_queue(dev->worker, work);
 }
 EXPORT_SYMBOL_GPL(vhost_work_queue);
 
 /* A lockless hint for busy polling code to exit the loop */
 bool vhost_has_work(struct vhost_dev *dev)
 {
-	return !llist_empty(&dev->work_list);
+	return dev->worker && !llist_empty(&dev->worker->work_list);
 }
 EXPORT_SYMBOL_GPL(vhost_has_work);
 
+/* Same, for the worker the vq runs on */
+bool vhost_vq_has_work(struct vhost_virtqueue *vq)
+{
+	struct vhost_worker *worker;
+	bool has_work = false;
+
+	rcu_read_lock();
+	worker = rcu_dereference(vq->worker) ?: vq->dev->worker;
+	if (worker)
+		has_work = !llist_empty(&worker->work_list);
+	rcu_read_unlock();
+
+	return has_work;
+}
+EXPORT_SYMBOL_GPL(vhost_vq_has_work);
+
 void vhost_poll_queue(struct vhost_poll *poll)
 {
-	vhost_work_queue(poll->dev, &poll->work);
+	struct vhost_worker *worker;
+
+	if (!poll->vq) {
+		vhost_work_queue(poll->dev, &poll->work);
+		return;
+	}
+
+	/* May be called from a wakeup while the vq moves to another worker */
+	rcu_read_lock();
+	worker = rcu_dereference(poll->vq->worker) ?: poll->dev->worker;
+	if (worker)
+		vhost_worker_queue(worker, &poll->work);
+	rcu_read_unlock();
 }
 EXPORT_SYMBOL_GPL(vhost_poll_queue);
 
@@ -289,6 +346,9 @@ static void __vhost_vq_meta_reset(struct vhost_virtqueue *vq)
 
 	for (j = 0; j < VHOST_NUM_ADDRS; j++)
 		vq->meta_iotlb[j] = NULL;
+	for (j = 0; j < VHOST_IOTLB_CACHE_SIZE; j++)
+		vq->iotlb_cache[j] = NULL;
+	vq->iotlb_cache_next = 0;
 }
 
 static void vhost_vq_meta_reset(struct vhost_dev *d)
@@ -325,6 +385,7 @@ static void vhost_vq_reset(struct vhost_dev *dev,
 	vhost_disable_cross_endian(vq);
 	vhost_reset_is_le(vq);
 	vq->busyloop_timeout = 0;
+	RCU_INIT_POINTER(vq->worker, NULL);
 	vq->umem = NULL;
 	vq->iotlb = NULL;
 	__vhost_vq_meta_reset(vq);
@@ -332,7 +393,8 @@ static void vhost_vq_reset(struct vhost_dev *dev,
 
 static int vhost_worker(void *data)
 {
-	struct vhost_dev *dev = data;
+	struct vhost_worker *worker = data;
+	struct vhost_dev *dev = worker->dev;
 	struct vhost_work *work, *work_next;
 	struct llist_node *node;
 	mm_segment_t oldfs = get_fs();
@@ -349,7 +411,7 @@ static int vhost_worker(void *data)
 			break;
 		}
 
-		node = llist_del_all(&dev->work_list);
+		node = llist_del_all(&worker->work_list);
 		if (!node)
 			schedule();
 
@@ -443,10 +505,10 @@ void vhost_dev_init(struct vhost_dev *dev,
 	dev->iotlb = NULL;
 	dev->mm = NULL;
 	dev->worker = NULL;
+	idr_init(&dev->worker_idr);
 	dev->iov_limit = iov_limit;
 	dev->weight = weight;
 	dev->byte_weight = byte_weight;
-	init_llist_head(&dev->work_list);
 	init_waitqueue_head(&dev->wait);
 	INIT_LIST_HEAD(&dev->read_list);
 	INIT_LIST_HEAD(&dev->pending_list);
@@ -463,7 +525,7 @@ void vhost_dev_init(struct vhost_dev *dev,
 		vhost_vq_reset(dev, vq);
 		if (vq->handle_kick)
 			vhost_poll_init(&vq->poll, vq->handle_kick,
-					EPOLLIN, dev);
+					EPOLLIN, dev, vq);
 	}
 }
 EXPORT_SYMBOL_GPL(vhost_dev_init);
@@ -490,17 +552,70 @@ static void vhost_attach_cgroups_work(struct vhost_work *work)
 	s->ret = cgroup_attach_task_all(s->owner, current);
 }
 
-static int vhost_attach_cgroups(struct vhost_dev *dev)
+static int vhost_attach_cgroups(struct vhost_worker *worker)
 {
 	struct vhost_attach_cgroups_struct attach;
 
 	attach.owner = current;
 	vhost_work_init(&attach.work, vhost_attach_cgroups_work);
-	vhost_work_queue(dev, &attach.work);
-	vhost_work_flush(dev, &attach.work);
+	vhost_worker_queue(worker, &attach.work);
+	vhost_worker_flush(worker);
 	return attach.ret;
 }
 
+/* Caller should have device mutex */
+static struct vhost_worker *vhost_worker_create(struct vhost_dev *dev)
+{
+	struct vhost_worker *worker;
+	struct task_struct *task;
+	int id, err;
+
+	worker = kzalloc(sizeof(*worker), GFP_KERNEL);
+	if (!worker)
+		return ERR_PTR(-ENOMEM);
+
+	worker->dev = dev;
+	init_llist_head(&worker->work_list);
+
+	id = idr_alloc(&dev->worker_idr, worker, 0, 0, GFP_KERNEL);
+	if (id < 0) {
+		err = id;
+		goto err_idr;
+	}
+	worker->id = id;
+
+	task = kthread_create(vhost_worker, worker, "vhost-%d", current->pid);
+	if (IS_ERR(task)) {
+		err = PTR_ERR(task);
+		goto err_task;
+	}
+
+	worker->task = task;
+	wake_up_process(task);	/* avoid contributing to loadavg */
+
+	err = vhost_attach_cgroups(worker);
+	if (err)
+		goto err_cgroup;
+
+	return worker;
+err_cgroup:
+	kthread_stop(task);
+err_task:
+	idr_remove(&dev->worker_idr, id);
+err_idr:
+	kfree(worker);
+	return ERR_PTR(err);
+}
+
+static void vhost_worker_destroy(struct vhost_dev *dev,
+				 struct vhost_worker *worker)
+{
+	WARN_ON(!llist_empty(&worker->work_list));
+	idr_remove(&dev->worker_idr, worker->id);
+	kthread_stop(worker->task);
+	kfree(worker);
+}
+
 /* Caller should have device mutex */
 bool vhost_dev_has_owner(struct vhost_dev *dev)
 {
@@ -511,7 +626,7 @@ EXPORT_SYMBOL_GPL(vhost_dev_has_owner);
 /* Caller should have device mutex */
 long vhost_dev_set_owner(struct vhost_dev *dev)
 {
-	struct task_struct *worker;
+	struct vhost_worker *worker;
 	int err;
 
 	/* Is there an owner already? */
@@ -522,26 +637,21 @@ long vhost_dev_set_owner(struct vhost_dev *dev)
 
 	/* No owner, become one */
 	dev->mm = get_task_mm(current);
-	worker = kthread_create(vhost_worker, dev, "vhost-%d", current->pid);
+	worker = vhost_worker_create(dev);
 	if (IS_ERR(worker)) {
 		err = PTR_ERR(worker);
 		goto err_worker;
 	}
 
 	dev->worker = worker;
-	wake_up_process(worker);	/* avoid contributing to loadavg */
-
-	err = vhost_attach_cgroups(dev);
-	if (err)
-		goto err_cgroup;
 
 	err = vhost_dev_alloc_iovecs(dev);
 	if (err)
-		goto err_cgroup;
+		goto err_iovecs;
 
 	return 0;
-err_cgroup:
-	kthread_stop(worker);
+err_iovecs:
+	vhost_worker_destroy(dev, worker);
 	dev->worker = NULL;
 err_worker:
 	if (dev->mm)
@@ -632,6 +742,7 @@ static void vhost_clear_msg(struct vhost_dev *dev)
 
 void vhost_dev_cleanup(struct vhost_dev *dev)
 {
+	struct vhost_worker *worker;
 	int i;
 
 	for (i = 0; i < dev->nvqs; ++i) {
@@ -654,11 +765,11 @@ void vhost_dev_cleanup(struct vhost_dev *dev)
 	dev->iotlb = NULL;
 	vhost_clear_msg(dev);
 	wake_up_interruptible_poll(&dev->wait, EPOLLIN | EPOLLRDNORM);
-	WARN_ON(!llist_empty(&dev->work_list));
-	if (dev->worker) {
-		kthread_stop(dev->worker);
-		dev->worker = NULL;
-	}
+	/* vhost_vq_reset() above detached the vqs from their workers */
+	idr_for_each_entry(&dev->worker_idr, worker, i)
+		vhost_worker_destroy(dev, worker);
+	idr_destroy(&dev->worker_idr);
+	dev->worker = NULL;
 	if (dev->mm)
 		mmput(dev->mm);
 	dev->mm = NULL;
@@ -1004,13 +1115,12 @@ static bool umem_access_ok(u64 uaddr, u64 size, int access)
 	return true;
 }
 
+/* Caller must have device mutex and all vq mutexes */
 static int vhost_process_iotlb_msg(struct vhost_dev *dev,
 				   struct vhost_iotlb_msg *msg)
 {
 	int ret = 0;
 
-	mutex_lock(&dev->mutex);
-	vhost_dev_lock_vqs(dev);
 	switch (msg->type) {
 	case VHOST_IOTLB_UPDATE:
 		if (!dev->iotlb) {
@@ -1044,23 +1154,19 @@ static int vhost_process_iotlb_msg(struct vhost_dev *dev,
 		break;
 	}
 
-	vhost_dev_unlock_vqs(dev);
-	mutex_unlock(&dev->mutex);
-
 	return ret;
 }
-ssize_t vhost_chr_write_iter(struct vhost_dev *dev,
-			     struct iov_iter *from)
+
+static ssize_t vhost_chr_write_msg(struct vhost_dev *dev,
+				   struct iov_iter *from)
 {
 	struct vhost_iotlb_msg msg;
-	size_t offset;
+	size_t offset, len;
 	int type, ret;
 
 	ret = copy_from_iter(&type, sizeof(type), from);
-	if (ret != sizeof(type)) {
-		ret = -EINVAL;
-		goto done;
-	}
+	if (ret != sizeof(type))
+		return -EINVAL;
 
 	switch (type) {
 	case VHOST_IOTLB_MSG:
@@ -1068,30 +1174,55 @@ ssize_t vhost_chr_write_iter(struct vhost_dev *dev,
 		 * so skip it here.
 		 */
 		offset = offsetof(struct vhost_msg, iotlb) - sizeof(int);
+		len = sizeof(struct vhost_msg);
 		break;
 	case VHOST_IOTLB_MSG_V2:
 		offset = sizeof(__u32);
+		len = sizeof(struct vhost_msg_v2);
 		break;
 	default:
-		ret = -EINVAL;
-		goto done;
+		return -EINVAL;
 	}
 
 	iov_iter_advance(from, offset);
 	ret = copy_from_iter(&msg, sizeof(msg), from);
-	if (ret != sizeof(msg)) {
-		ret = -EINVAL;
-		goto done;
-	}
-	if (vhost_process_iotlb_msg(dev, &msg)) {
-		ret = -EFAULT;
-		goto done;
-	}
+	if (ret != sizeof(msg))
+		return -EINVAL;
+	if (vhost_process_iotlb_msg(dev, &msg))
+		return -EFAULT;
 
-	ret = (type == VHOST_IOTLB_MSG) ? sizeof(struct vhost_msg) :
-	      sizeof(struct vhost_msg_v2);
-done:
-	return ret;
+	/* Step over the padding up to the next message */
+	iov_iter_advance(from, len - sizeof(type) - offset - sizeof(msg));
+
+	return len;
+}
+
+/* With VHOST_BACKEND_F_IOTLB_BATCH, userspace may pack a whole series of
+ * updates and invalidations into one write.  They are applied under a
+ * single hold of the device and vq locks, and the write returns the size
+ * of the messages processed before the first failing one.
+ */
+ssize_t vhost_chr_write_iter(struct vhost_dev *dev,
+			     struct iov_iter *from)
+{
+	ssize_t ret, done = 0;
+	bool batch;
+
+	mutex_lock(&dev->mutex);
+	vhost_dev_lock_vqs(dev);
+	batch = dev->nvqs &&
+		vhost_backend_has_feature(dev->vqs[0],
+					  VHOST_BACKEND_F_IOTLB_BATCH);
+	do {
+		ret = vhost_chr_write_msg(dev, from);
+		if (ret < 0)
+			break;
+		done += ret;
+	} while (batch && iov_iter_count(from));
+	vhost_dev_unlock_vqs(dev);
+	mutex_unlock(&dev->mutex);
+
+	return done ? done : ret;
 }
 EXPORT_SYMBOL(vhost_chr_write_iter);
 
@@ -1406,6 +1537,49 @@ static long vhost_set_memory(struct vhost_dev *d, struct vhost_memory __user *m)
 	return -EFAULT;
 }
 
+/* Caller should have device mutex but not the vq one, the old worker is
+ * flushed and may be running the handlers of the vq.
+ */
+static long vhost_vq_worker_ioctl(struct vhost_virtqueue *vq,
+				  unsigned int ioctl, void __user *argp)
+{
+	struct vhost_dev *dev = vq->dev;
+	struct vhost_worker *worker, *old;
+	struct vhost_vring_worker w;
+
+	if (copy_from_user(&w, argp, sizeof(w)))
+		return -EFAULT;
+
+	old = vhost_vq_worker(vq);
+	if (!old)
+		return -ENODEV;
+
+	if (ioctl == VHOST_GET_VRING_WORKER) {
+		w.worker_id = old->id;
+		return copy_to_user(argp, &w, sizeof(w)) ? -EFAULT : 0;
+	}
+
+	worker = idr_find(&dev->worker_idr, w.worker_id);
+	if (!worker)
+		return -ENODEV;
+	if (worker == old)
+		return 0;
+
+	if (worker != dev->worker)
+		worker->attachment_cnt++;
+	if (old != dev->worker)
+		old->attachment_cnt--;
+	rcu_assign_pointer(vq->worker, worker == dev->worker ? NULL : worker);
+
+	/* Once nobody can queue to the old worker any more, let it finish
+	 * what was queued for the vq before the new one takes over.
+	 */
+	synchronize_rcu();
+	vhost_worker_flush(old);
+
+	return 0;
+}
+
 long vhost_vring_ioctl(struct vhost_dev *d, unsigned int ioctl, void __user *argp)
 {
 	struct file *eventfp, *filep = NULL;
@@ -1428,6 +1602,10 @@ long vhost_vring_ioctl(struct vhost_dev *d, unsigned int ioctl, void __user *arg
 	idx = array_index_nospec(idx, d->nvqs);
 	vq = d->vqs[idx];
 
+	if (ioctl == VHOST_ATTACH_VRING_WORKER ||
+	    ioctl == VHOST_GET_VRING_WORKER)
+		return vhost_vq_worker_ioctl(vq, ioctl, argp);
+
 	mutex_lock(&vq->mutex);
 
 	switch (ioctl) {
@@ -1639,6 +1817,65 @@ int vhost_init_device_iotlb(struct vhost_dev *d, bool enabled)
 EXPORT_SYMBOL_GPL(vhost_init_device_iotlb);
 
 /* Caller must have device mutex */
+static long vhost_new_worker(struct vhost_dev *dev, void __user *argp)
+{
+	struct vhost_worker_state state;
+	struct vhost_worker *worker;
+
+	worker = vhost_worker_create(dev);
+	if (IS_ERR(worker))
+		return PTR_ERR(worker);
+
+	state.worker_id = worker->id;
+	if (copy_to_user(argp, &state, sizeof(state))) {
+		vhost_worker_destroy(dev, worker);
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+static long vhost_free_worker(struct vhost_dev *dev, void __user *argp)
+{
+	struct vhost_worker_state state;
+	struct vhost_worker *worker;
+
+	if (copy_from_user(&state, argp, sizeof(state)))
+		return -EFAULT;
+
+	worker = idr_find(&dev->worker_idr, state.worker_id);
+	if (!worker)
+		return -ENODEV;
+	if (worker == dev->worker || worker->attachment_cnt)
+		return -EBUSY;
+
+	vhost_worker_destroy(dev, worker);
+	return 0;
+}
+
+static long vhost_set_worker_affinity(struct vhost_dev *dev,
+				      void __user *argp)
+{
+	const struct cpumask *allowed = &current->cpus_allowed;
+	struct vhost_worker_affinity aff;
+	struct vhost_worker *worker;
+
+	if (copy_from_user(&aff, argp, sizeof(aff)))
+		return -EFAULT;
+
+	worker = idr_find(&dev->worker_idr, aff.worker_id);
+	if (!worker)
+		return -ENODEV;
+
+	/* Workers may only go where their owner may run */
+	if (aff.cpu == VHOST_WORKER_CPU_ANY)
+		return set_cpus_allowed_ptr(worker->task, allowed);
+	if (aff.cpu >= nr_cpu_ids || !cpumask_test_cpu(aff.cpu, allowed))
+		return -EINVAL;
+
+	return set_cpus_allowed_ptr(worker->task, cpumask_of(aff.cpu));
+}
+
 long vhost_dev_ioctl(struct vhost_dev *d, unsigned int ioctl, void __user *argp)
 {
 	struct eventfd_ctx *ctx;
@@ -1701,6 +1938,15 @@ long vhost_dev_ioctl(struct vhost_dev *d, unsigned int ioctl, void __user *argp)
 		if (ctx)
 			eventfd_ctx_put(ctx);
 		break;
+	case VHOST_NEW_WORKER:
+		r = vhost_new_worker(d, argp);
+		break;
+	case VHOST_FREE_WORKER:
+		r = vhost_free_worker(d, argp);
+		break;
+	case VHOST_SET_WORKER_AFFINITY:
+		r = vhost_set_worker_affinity(d, argp);
+		break;
 	default:
 		r = -ENOIOCTLCMD;
 		break;
@@ -1932,6 +2178,34 @@ int vhost_vq_init_access(struct vhost_virtqueue *vq)
 }
 EXPORT_SYMBOL_GPL(vhost_vq_init_access);
 
+/* Descriptors of a ring mostly point into a few guest buffers, so a handful
+ * of recently hit IOTLB entries spares most of the interval tree walks.
+ * The cache is dropped with the meta cache whenever the IOTLB changes.
+ */
+static const struct vhost_umem_node *
+vhost_iotlb_lookup(struct vhost_virtqueue *vq, struct vhost_umem *umem,
+		   u64 addr, u64 last)
+{
+	const struct vhost_umem_node *node;
+	int i;
+
+	for (i = 0; i < VHOST_IOTLB_CACHE_SIZE; i++) {
+		node = vq->iotlb_cache[i];
+		if (node && node->start <= addr && addr <= node->last)
+			return node;
+	}
+
+	node = vhost_umem_interval_tree_iter_first(&umem->umem_tree,
+						   addr, last);
+	if (node && node->start <= addr) {
+		vq->iotlb_cache[vq->iotlb_cache_next] = node;
+		vq->iotlb_cache_next = (vq->iotlb_cache_next + 1) %
+				       VHOST_IOTLB_CACHE_SIZE;
+	}
+
+	return node;
+}
+
 static int translate_desc(struct vhost_virtqueue *vq, u64 addr, u32 len,
 			  struct iovec iov[], int iov_size, int access)
 {
@@ -1949,8 +2223,12 @@ static int translate_desc(struct vhost_virtqueue *vq, u64 addr, u32 len,
 			break;
 		}
 
-		node = vhost_umem_interval_tree_iter_first(&umem->umem_tree,
-							addr, addr + len - 1);
+		if (umem == dev->iotlb)
+			node = vhost_iotlb_lookup(vq, umem, addr,
+						  addr + len - 1);
+		else
+			node = vhost_umem_interval_tree_iter_first(
+					&umem->umem_tree, addr, addr + len - 1);
 		if (node == NULL || node->start > addr) {
 			if (umem != dev->iotlb) {
 				ret = -EFAULT;
@@ -2074,7 +2074,7 @@ SYSCALL_DEFINE3(io_submit, aio_context_t, ctx_id, long, nr,
 	if (nr > ctx->nr_events)
 		nr = ctx->nr_events;
 
-	blk_start_plug(&plug);
+	blk_start_plug_nr_ios(&plug, min_t(long, nr, USHRT_MAX));
 	for (i = 0; i < nr; i++) {
 		struct iocb __user *user_iocb;
 
@@ -2114,7 +2114,7 @@ COMPAT_SYSCALL_DEFINE3(io_submit, compat_aio_context_t, ctx_id,
 	if (nr > ctx->nr_events)
 		nr = ctx->nr_events;
 
-	blk_start_plug(&plug);
+	blk_start_plug_nr_ios(&plug, min_t(long, nr, USHRT_MAX));
 	for (i = 0; i < nr; i++) {
 		compat_uptr_t user_iocb;
 
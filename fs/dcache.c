@@ -117,6 +117,9 @@ struct dentry_stat_t dentry_stat = {
 	.age_limit = 45,
 };
 
+/* Max negative dentries per super block, 0 for no limit */
+unsigned long sysctl_negative_dentry_limit;
+
 static DEFINE_PER_CPU(long, nr_dentry);
 static DEFINE_PER_CPU(long, nr_dentry_unused);
 
@@ -322,6 +325,7 @@ static inline void __d_set_inode_and_type(struct dentry *dentry,
 	if ((dentry->d_flags & DCACHE_NEGATIVE_ACCOUNT) && parent) {
 		WARN_ON(!inode);
 		atomic_dec(&parent->d_neg_dnum);
+		atomic_long_dec(&dentry->d_sb->s_nr_negative_dentry);
 	}
 
 	dentry->d_inode = inode;
@@ -574,6 +578,7 @@ static void __dentry_kill(struct dentry *dentry)
 	if (parent) {
 		if (dentry->d_flags & DCACHE_NEGATIVE_ACCOUNT) {
 			atomic_dec(&parent->d_neg_dnum);
+			atomic_long_dec(&dentry->d_sb->s_nr_negative_dentry);
 			dentry->d_flags &= ~DCACHE_NEGATIVE_ACCOUNT;
 		}
 
@@ -636,6 +641,22 @@ static inline struct dentry *lock_parent(struct dentry *dentry)
 	return __lock_parent(dentry);
 }
 
+/*
+ * Past the per super block limit, new negative dentries are not retained and
+ * the oldest ones are trimmed in the background to make room again.
+ */
+static bool sb_negative_dentry_over_limit(struct super_block *sb)
+{
+	unsigned long limit = READ_ONCE(sysctl_negative_dentry_limit);
+
+	if (!limit ||
+	    atomic_long_read(&sb->s_nr_negative_dentry) < (long)limit)
+		return false;
+
+	schedule_work(&sb->s_negative_dentry_trim);
+	return true;
+}
+
 /*
  * Return true if dentry is negative and exceed negative dentry limit.
  */
@@ -659,10 +680,13 @@ static inline bool limit_negative_dentry(struct dentry *dentry)
 			flags |= DCACHE_NEGATIVE_ACCOUNT;
 			WRITE_ONCE(dentry->d_flags, flags);
 			atomic_inc(&parent->d_neg_dnum);
+			atomic_long_inc(&dentry->d_sb->s_nr_negative_dentry);
 		}
 
 		if (atomic_read(&parent->d_neg_dnum) >= NEG_DENTRY_LIMIT)
 			return true;
+		if (sb_negative_dentry_over_limit(dentry->d_sb))
+			return true;
 	}
 
 	return false;
@@ -1285,6 +1309,69 @@ void shrink_dcache_sb(struct super_block *sb)
 }
 EXPORT_SYMBOL(shrink_dcache_sb);
 
+static enum lru_status dentry_lru_isolate_negative(struct list_head *item,
+		struct list_lru_one *lru, spinlock_t *lru_lock, void *arg)
+{
+	struct list_head *freeable = arg;
+	struct dentry	*dentry = container_of(item, struct dentry, d_lru);
+
+	if (!spin_trylock(&dentry->d_lock))
+		return LRU_SKIP;
+
+	if (dentry->d_lockref.count) {
+		d_lru_isolate(lru, dentry);
+		spin_unlock(&dentry->d_lock);
+		return LRU_REMOVED;
+	}
+
+	/*
+	 * Positive dentries are left to the shrinker.  Rotate them rather
+	 * than skip them, so that the next batch makes progress instead of
+	 * scanning the same head of the list again.
+	 */
+	if (dentry->d_inode || (dentry->d_flags & DCACHE_REFERENCED)) {
+		dentry->d_flags &= ~DCACHE_REFERENCED;
+		spin_unlock(&dentry->d_lock);
+		return LRU_ROTATE;
+	}
+
+	d_lru_shrink_move(lru, dentry, freeable);
+	spin_unlock(&dentry->d_lock);
+
+	return LRU_REMOVED;
+}
+
+/*
+ * Trim the negative dentries of a super block to 7/8 of the limit, oldest
+ * first, in batches so neither the LRU lock nor the CPU is held for long.
+ */
+void trim_negative_dentries_workfn(struct work_struct *work)
+{
+	struct super_block *sb = container_of(work, struct super_block,
+					      s_negative_dentry_trim);
+	unsigned long limit = READ_ONCE(sysctl_negative_dentry_limit);
+	unsigned long nr_to_scan;
+	long target;
+
+	if (!limit || !trylock_super(sb))
+		return;
+
+	target = limit - (limit >> 3);
+	nr_to_scan = list_lru_count(&sb->s_dentry_lru);
+	while (nr_to_scan &&
+	       atomic_long_read(&sb->s_nr_negative_dentry) > target) {
+		unsigned long nr = min_t(unsigned long, nr_to_scan, 1024);
+		LIST_HEAD(dispose);
+
+		nr_to_scan -= nr;
+		list_lru_walk(&sb->s_dentry_lru, dentry_lru_isolate_negative,
+			      &dispose, nr);
+		shrink_dentry_list(&dispose);
+		cond_resched();
+	}
+	up_read(&sb->s_umount);
+}
+
 /**
  * enum d_walk_ret - action to talke during tree walk
  * @D_WALK_CONTINUE:	contrinue walk
@@ -42,6 +42,7 @@
 #include <linux/seq_file.h>
 #include <linux/compat.h>
 #include <linux/rculist.h>
+#include <linux/llist.h>
 #include <net/busy_poll.h>
 
 /*
@@ -57,7 +58,10 @@
  * from inside the poll callback, that might be triggered from
  * a wake_up() that in turn might be called from IRQ context.
  * So we can't sleep inside the poll callback and hence we need
- * a spinlock. During the event transfer loop (from kernel to
+ * a spinlock. The poll callback itself does not take it to queue an
+ * item: it pushes the item onto the lockless ep->rdllist_lockless,
+ * which is moved onto ep->rdllist by whoever next looks at the ready
+ * list with ep->wq.lock held. During the event transfer loop (from kernel to
  * user space) we could end up sleeping due a copy_to_user(), so
  * we need a lock that will allow us to sleep. This lock is a
  * mutex (ep->mtx). It is acquired during the event transfer loop,
@@ -105,8 +109,6 @@
 
 #define EP_MAX_EVENTS (INT_MAX / sizeof(struct epoll_event))
 
-#define EP_UNACTIVE_PTR ((void *) -1L)
-
 #define EP_ITEM_COST (sizeof(struct epitem) + sizeof(struct eppoll_entry))
 
 struct epoll_filefd {
@@ -150,11 +152,8 @@ struct epitem {
 	/* List header used to link this structure to the eventpoll ready list */
 	struct list_head rdllink;
 
-	/*
-	 * Works together "struct eventpoll"->ovflist in keeping the
-	 * single linked chain of items.
-	 */
-	struct epitem *next;
+	/* Links this item on "struct eventpoll"->rdllist_lockless */
+	struct llist_node rdllnode;
 
 	/* The file descriptor information this item refers to */
 	struct epoll_filefd ffd;
@@ -162,6 +161,9 @@ struct epitem {
 	/* Number of active wait queue attached to poll operations */
 	int nwait;
 
+	/* Set while the item sits on ep->rdllist_lockless */
+	unsigned int rdlqueued;
+
 	/* List containing poll wait queues */
 	struct list_head pwqlist;
 
@@ -207,11 +209,10 @@ struct eventpoll {
 	struct rb_root_cached rbr;
 
 	/*
-	 * This is a single linked list that chains all the "struct epitem" that
-	 * happened while transferring ready events to userspace w/out
-	 * holding ->wq.lock.
+	 * Items the poll callback found ready, pushed without ->wq.lock and
+	 * moved onto rdllist by ep_rdllist_drain().
 	 */
-	struct epitem *ovflist;
+	struct llist_head rdllist_lockless;
 
 	/* wakeup_source used when ep_scan_ready_list is running */
 	struct wakeup_source *ws;
@@ -227,6 +228,12 @@ struct eventpoll {
 #ifdef CONFIG_NET_RX_BUSY_POLL
 	/* used to track busy poll napi_id */
 	unsigned int napi_id;
+	/* busy poll timeout, 0 to follow net.core.busy_poll */
+	u32 busy_poll_usecs;
+	/* busy poll packet budget */
+	u16 busy_poll_budget;
+	/* keep napi_id when a busy poll found nothing */
+	bool prefer_busy_poll;
 #endif
 };
 
@@ -373,19 +380,34 @@ static void ep_nested_calls_init(struct nested_calls *ncalls)
  */
 static inline int ep_events_available(struct eventpoll *ep)
 {
-	return !list_empty(&ep->rdllist) || ep->ovflist != EP_UNACTIVE_PTR;
+	return !list_empty(&ep->rdllist) ||
+	       !llist_empty(&ep->rdllist_lockless);
 }
 
 #ifdef CONFIG_NET_RX_BUSY_POLL
+/*
+ * Busy polling is on for this epoll if it was enabled with EPIOCSPARAMS, or
+ * globally through net.core.busy_poll.
+ */
+static bool ep_busy_loop_on(struct eventpoll *ep)
+{
+	return READ_ONCE(ep->busy_poll_usecs) || net_busy_loop_on();
+}
+
 static bool ep_busy_loop_end(void *p, unsigned long start_time)
 {
 	struct eventpoll *ep = p;
+	unsigned long bp_usec = READ_ONCE(ep->busy_poll_usecs);
 
-	return ep_events_available(ep) || busy_loop_timeout(start_time);
+	if (ep_events_available(ep))
+		return true;
+	if (!bp_usec)
+		return busy_loop_timeout(start_time);
+	return time_after(busy_loop_current_time(), start_time + bp_usec);
 }
 
 /*
- * Busy poll if globally on and supporting sockets found && no events,
+ * Busy poll if enabled and supporting sockets found && no events,
  * busy loop will return if need_resched or ep_events_available.
  *
  * we must do our busy polling with irqs enabled
@@ -393,14 +415,16 @@ static bool ep_busy_loop_end(void *p, unsigned long start_time)
 static void ep_busy_loop(struct eventpoll *ep, int nonblock)
 {
 	unsigned int napi_id = READ_ONCE(ep->napi_id);
+	u16 budget = READ_ONCE(ep->busy_poll_budget);
 
-	if ((napi_id >= MIN_NAPI_ID) && net_busy_loop_on())
-		napi_busy_loop(napi_id, nonblock ? NULL : ep_busy_loop_end, ep);
+	if ((napi_id >= MIN_NAPI_ID) && ep_busy_loop_on(ep))
+		napi_busy_loop(napi_id, nonblock ? NULL : ep_busy_loop_end, ep,
+			       budget ? budget : BUSY_POLL_BUDGET);
 }
 
 static inline void ep_reset_busy_poll_napi_id(struct eventpoll *ep)
 {
-	if (ep->napi_id)
+	if (ep->napi_id && !READ_ONCE(ep->prefer_busy_poll))
 		ep->napi_id = 0;
 }
 
@@ -415,7 +439,7 @@ static inline void ep_set_busy_poll_napi_id(struct epitem *epi)
 	struct sock *sk;
 	int err;
 
-	if (!net_busy_loop_on())
+	if (!ep_busy_loop_on(epi->ep))
 		return;
 
 	sock = sock_from_file(epi->ffd.file, &err);
@@ -456,6 +480,58 @@ static inline void ep_set_busy_poll_napi_id(struct epitem *epi)
 
 #endif /* CONFIG_NET_RX_BUSY_POLL */
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+static long ep_eventpoll_ioctl(struct file *file, unsigned int cmd,
+			       unsigned long arg)
+{
+	struct eventpoll *ep = file->private_data;
+	void __user *uarg = (void __user *)arg;
+	struct epoll_params epoll_params;
+
+	switch (cmd) {
+	case EPIOCSPARAMS:
+		if (copy_from_user(&epoll_params, uarg, sizeof(epoll_params)))
+			return -EFAULT;
+
+		if (epoll_params.__pad)
+			return -EINVAL;
+
+		if (epoll_params.busy_poll_usecs > S32_MAX)
+			return -EINVAL;
+
+		if (epoll_params.prefer_busy_poll > 1)
+			return -EINVAL;
+
+		if (epoll_params.busy_poll_budget > NAPI_POLL_WEIGHT &&
+		    !capable(CAP_NET_ADMIN))
+			return -EPERM;
+
+		WRITE_ONCE(ep->busy_poll_usecs, epoll_params.busy_poll_usecs);
+		WRITE_ONCE(ep->busy_poll_budget, epoll_params.busy_poll_budget);
+		WRITE_ONCE(ep->prefer_busy_poll, epoll_params.prefer_busy_poll);
+		return 0;
+	case EPIOCGPARAMS:
+		memset(&epoll_params, 0, sizeof(epoll_params));
+		epoll_params.busy_poll_usecs = READ_ONCE(ep->busy_poll_usecs);
+		epoll_params.busy_poll_budget = READ_ONCE(ep->busy_poll_budget);
+		epoll_params.prefer_busy_poll = READ_ONCE(ep->prefer_busy_poll);
+		if (copy_to_user(uarg, &epoll_params, sizeof(epoll_params)))
+			return -EFAULT;
+		return 0;
+	default:
+		return -ENOIOCTLCMD;
+	}
+}
+
+#ifdef CONFIG_COMPAT
+static long ep_eventpoll_compat_ioctl(struct file *file, unsigned int cmd,
+				      unsigned long arg)
+{
+	return ep_eventpoll_ioctl(file, cmd, (unsigned long)compat_ptr(arg));
+}
+#endif
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+
 /**
  * ep_call_nested - Perform a bound (possibly) nested call, by checking
  *                  that the recursion limit is not exceeded, and that
@@ -648,6 +724,37 @@ static inline void ep_pm_stay_awake_rcu(struct epitem *epi)
 	rcu_read_unlock();
 }
 
+/*
+ * Move the items queued by ep_poll_callback() onto the ready list.  Items
+ * that are already linked there (or on a private "txlist" being scanned)
+ * are skipped.  Must be called with "ep->mtx" and "ep->wq.lock" held.
+ */
+static void ep_rdllist_drain(struct eventpoll *ep)
+{
+	struct llist_node *node;
+	struct epitem *epi, *nepi;
+
+	lockdep_assert_held(&ep->wq.lock);
+
+	node = llist_del_all(&ep->rdllist_lockless);
+	if (!node)
+		return;
+
+	/* Keep the order in which the callbacks fired */
+	node = llist_reverse_order(node);
+	llist_for_each_entry_safe(epi, nepi, node, rdllnode) {
+		/*
+		 * ->rdllnode is not touched after this point, so the item
+		 * may be queued again right away.
+		 */
+		smp_store_release(&epi->rdlqueued, 0);
+		if (!ep_is_linked(epi)) {
+			list_add_tail(&epi->rdllink, &ep->rdllist);
+			ep_pm_stay_awake(epi);
+		}
+	}
+}
+
 /**
  * ep_scan_ready_list - Scans the ready list in a way that makes possible for
  *                      the scan code, to call f_op->poll(). Also allows for
@@ -668,7 +775,6 @@ static __poll_t ep_scan_ready_list(struct eventpoll *ep,
 {
 	__poll_t res;
 	int pwake = 0;
-	struct epitem *epi, *nepi;
 	LIST_HEAD(txlist);
 
 	lockdep_assert_irqs_enabled();
@@ -683,15 +789,14 @@ static __poll_t ep_scan_ready_list(struct eventpoll *ep,
 
 	/*
 	 * Steal the ready list, and re-init the original one to the
-	 * empty list. Also, set ep->ovflist to NULL so that events
-	 * happening while looping w/out locks, are not lost. We cannot
-	 * have the poll callback to queue directly on ep->rdllist,
-	 * because we want the "sproc" callback to be able to do it
-	 * in a lockless way.
+	 * empty list. Events happening while looping w/out locks stay
+	 * on ep->rdllist_lockless until we are done, since we want the
+	 * "sproc" callback to be able to use ep->rdllist in a lockless
+	 * way.
 	 */
 	spin_lock_irq(&ep->wq.lock);
+	ep_rdllist_drain(ep);
 	list_splice_init(&ep->rdllist, &txlist);
-	ep->ovflist = NULL;
 	spin_unlock_irq(&ep->wq.lock);
 
 	/*
@@ -703,27 +808,11 @@ static __poll_t ep_scan_ready_list(struct eventpoll *ep,
 	/*
 	 * During the time we spent inside the "sproc" callback, some
 	 * other events might have been queued by the poll callback.
-	 * We re-insert them inside the main ready-list here.
+	 * We re-insert them inside the main ready-list here. Items that
+	 * the "txlist" still contains are skipped by ep_rdllist_drain(),
+	 * and the list_splice() below takes care of them.
 	 */
-	for (nepi = ep->ovflist; (epi = nepi) != NULL;
-	     nepi = epi->next, epi->next = EP_UNACTIVE_PTR) {
-		/*
-		 * We need to check if the item is already in the list.
-		 * During the "sproc" callback execution time, items are
-		 * queued into ->ovflist but the "txlist" might already
-		 * contain them, and the list_splice() below takes care of them.
-		 */
-		if (!ep_is_linked(epi)) {
-			list_add_tail(&epi->rdllink, &ep->rdllist);
-			ep_pm_stay_awake(epi);
-		}
-	}
-	/*
-	 * We need to set back ep->ovflist to EP_UNACTIVE_PTR, so that after
-	 * releasing the lock, events will be queued in the normal way inside
-	 * ep->rdllist.
-	 */
-	ep->ovflist = EP_UNACTIVE_PTR;
+	ep_rdllist_drain(ep);
 
 	/*
 	 * Quickly re-inject items left on "txlist".
@@ -781,7 +870,12 @@ static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 
 	rb_erase_cached(&epi->rbn, &ep->rbr);
 
+	/*
+	 * No callback can queue the item any more, but it may still sit on
+	 * ep->rdllist_lockless: drain that before unlinking.
+	 */
 	spin_lock_irq(&ep->wq.lock);
+	ep_rdllist_drain(ep);
 	if (ep_is_linked(epi))
 		list_del_init(&epi->rdllink);
 	spin_unlock_irq(&ep->wq.lock);
@@ -967,6 +1061,12 @@ static const struct file_operations eventpoll_fops = {
 	.release	= ep_eventpoll_release,
 	.poll		= ep_eventpoll_poll,
 	.llseek		= noop_llseek,
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	.unlocked_ioctl	= ep_eventpoll_ioctl,
+#ifdef CONFIG_COMPAT
+	.compat_ioctl	= ep_eventpoll_compat_ioctl,
+#endif
+#endif
 };
 
 /*
@@ -1019,7 +1119,7 @@ static int ep_alloc(struct eventpoll **pep)
 	init_waitqueue_head(&ep->poll_wait);
 	INIT_LIST_HEAD(&ep->rdllist);
 	ep->rbr = RB_ROOT_CACHED;
-	ep->ovflist = EP_UNACTIVE_PTR;
+	init_llist_head(&ep->rdllist_lockless);
 	ep->user = user;
 
 	*pep = ep;
@@ -1112,14 +1212,11 @@ struct file *get_epoll_tfile_raw_ptr(struct file *file, int tfd,
 static int ep_poll_callback(wait_queue_entry_t *wait, unsigned mode, int sync, void *key)
 {
 	int pwake = 0;
-	unsigned long flags;
 	struct epitem *epi = ep_item_from_wait(wait);
 	struct eventpoll *ep = epi->ep;
 	__poll_t pollflags = key_to_poll(key);
 	int ewake = 0;
 
-	spin_lock_irqsave(&ep->wq.lock, flags);
-
 	ep_set_busy_poll_napi_id(epi);
 
 	/*
@@ -1128,8 +1225,8 @@ static int ep_poll_callback(wait_queue_entry_t *wait, unsigned mode, int sync, v
 	 * EPOLLONESHOT bit that disables the descriptor when an event is received,
 	 * until the next EPOLL_CTL_MOD will be issued.
 	 */
-	if (!(epi->event.events & ~EP_PRIVATE_BITS))
-		goto out_unlock;
+	if (!(READ_ONCE(epi->event.events) & ~EP_PRIVATE_BITS))
+		goto out;
 
 	/*
 	 * Check the events coming with the callback. At this stage, not
@@ -1137,36 +1234,27 @@ static int ep_poll_callback(wait_queue_entry_t *wait, unsigned mode, int sync, v
 	 * callback. We need to be able to handle both cases here, hence the
 	 * test for "key" != NULL before the event match test.
 	 */
-	if (pollflags && !(pollflags & epi->event.events))
-		goto out_unlock;
+	if (pollflags && !(pollflags & READ_ONCE(epi->event.events)))
+		goto out;
 
 	/*
-	 * If we are transferring events to userspace, we can hold no locks
-	 * (because we're accessing user memory, and because of linux f_op->poll()
-	 * semantics). All the events that happen during that period of time are
-	 * chained in ep->ovflist and requeued later on.
+	 * Queue the item without taking ep->wq.lock, so that many sources
+	 * firing at once do not all serialize on it. If the item is already
+	 * queued and not yet drained, whoever queued it also did the wakeup.
+	 * This also covers the time we spend transferring events to
+	 * userspace: ep_scan_ready_list() only drains once it is done.
+	 * Both the xchg() and llist_add() imply a full barrier, which pairs
+	 * with the one in ep_poll() between queueing on ep->wq and
+	 * checking ep_events_available().
 	 */
-	if (ep->ovflist != EP_UNACTIVE_PTR) {
-		if (epi->next == EP_UNACTIVE_PTR) {
-			epi->next = ep->ovflist;
-			ep->ovflist = epi;
-			if (epi->ws) {
-				/*
-				 * Activate ep->ws since epi->ws may get
-				 * deactivated at any time.
-				 */
-				__pm_stay_awake(ep->ws);
-			}
-
-		}
-		goto out_unlock;
+	if (xchg(&epi->rdlqueued, 1)) {
+		/* An exclusive wakeup is still consumed by this epoll */
+		ewake = 1;
+		goto out;
 	}
 
-	/* If this file is already in the ready list we exit soon */
-	if (!ep_is_linked(epi)) {
-		list_add_tail(&epi->rdllink, &ep->rdllist);
-		ep_pm_stay_awake_rcu(epi);
-	}
+	ep_pm_stay_awake_rcu(epi);
+	llist_add(&epi->rdllnode, &ep->rdllist_lockless);
 
 	/*
 	 * Wake up ( if active ) both the eventpoll wait list and the ->poll()
@@ -1189,14 +1277,12 @@ static int ep_poll_callback(wait_queue_entry_t *wait, unsigned mode, int sync, v
 				break;
 			}
 		}
-		wake_up_locked(&ep->wq);
+		wake_up(&ep->wq);
 	}
 	if (waitqueue_active(&ep->poll_wait))
 		pwake++;
 
-out_unlock:
-	spin_unlock_irqrestore(&ep->wq.lock, flags);
-
+out:
 	/* We have to call this outside the lock */
 	if (pwake)
 		ep_poll_safewake(&ep->poll_wait);
@@ -1434,7 +1520,7 @@ static int ep_insert(struct eventpoll *ep, const struct epoll_event *event,
 	ep_set_ffd(&epi->ffd, tfile, fd);
 	epi->event = *event;
 	epi->nwait = 0;
-	epi->next = EP_UNACTIVE_PTR;
+	epi->rdlqueued = 0;
 	if (epi->event.events & EPOLLWAKEUP) {
 		error = ep_create_wakeup_source(epi);
 		if (error)
@@ -1520,11 +1606,10 @@ static int ep_insert(struct eventpoll *ep, const struct epoll_event *event,
 
 	/*
 	 * We need to do this because an event could have been arrived on some
-	 * allocated wait queue. Note that we don't care about the ep->ovflist
-	 * list, since that is used/cleaned only inside a section bound by "mtx".
-	 * And ep_insert() is called with "mtx" held.
+	 * allocated wait queue, and it may still be on ep->rdllist_lockless.
 	 */
 	spin_lock_irq(&ep->wq.lock);
+	ep_rdllist_drain(ep);
 	if (ep_is_linked(epi))
 		list_del_init(&epi->rdllink);
 	spin_unlock_irq(&ep->wq.lock);
@@ -1571,9 +1656,8 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi,
 	 * 1) Flush epi changes above to other CPUs.  This ensures
 	 *    we do not miss events from ep_poll_callback if an
 	 *    event occurs immediately after we call f_op->poll().
-	 *    We need this because we did not take ep->wq.lock while
-	 *    changing epi above (but ep_poll_callback does take
-	 *    ep->wq.lock).
+	 *    We need this because neither we nor ep_poll_callback
+	 *    take ep->wq.lock while looking at epi->event.
 	 *
 	 * 2) We also need to ensure we do not miss _past_ events
 	 *    when calling f_op->poll().  This barrier also
@@ -1685,7 +1769,8 @@ static __poll_t ep_send_events_proc(struct eventpoll *ep, struct list_head *head
 				 * into ep->rdllist besides us. The epoll_ctl()
 				 * callers are locked out by
 				 * ep_scan_ready_list() holding "mtx" and the
-				 * poll callback will queue them in ep->ovflist.
+				 * poll callback only queues on
+				 * ep->rdllist_lockless.
 				 */
 				list_add_tail(&epi->rdllink, &ep->rdllist);
 				ep_pm_stay_awake(epi);
@@ -62,6 +62,7 @@
 #include <linux/oom.h>
 #include <linux/compat.h>
 #include <linux/vmalloc.h>
+#include <linux/io_uring.h>
 
 #include <linux/uaccess.h>
 #include <asm/mmu_context.h>
@@ -1048,6 +1049,7 @@ static int exec_mmap(struct mm_struct *mm)
 		local_irq_enable();
 	tsk->mm->vmacache_seqnum = 0;
 	vmacache_flush(tsk);
+	lru_gen_add_mm(mm);
 	task_unlock(tsk);
 	if (old_mm) {
 		up_read(&old_mm->mmap_sem);
@@ -1311,8 +1313,10 @@ int flush_old_exec(struct linux_binprm * bprm)
 	 * We have to apply CLOEXEC before we change whether the process is
 	 * dumpable (in setup_new_exec) to avoid a race with a process in userspace
 	 * trying to access the should-be-closed file descriptors of a process
-	 * undergoing exec(2).
+	 * undergoing exec(2).  Registered io_uring rings don't survive exec
+	 * either.
 	 */
+	io_uring_unreg_ringfd();
 	do_close_on_exec(current->files);
 	return 0;
 
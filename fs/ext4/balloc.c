@@ -384,8 +384,13 @@ static int ext4_validate_block_bitmap(struct super_block *sb,
 				      struct buffer_head *bh)
 {
 	ext4_fsblk_t	blk;
-	struct ext4_group_info *grp = ext4_get_group_info(sb, block_group);
+	struct ext4_group_info *grp;
+
+	/* Fast commit replay runs before the group info is set up */
+	if (EXT4_SB(sb)->s_mount_state & EXT4_FC_REPLAY)
+		return 0;
 
+	grp = ext4_get_group_info(sb, block_group);
 	if (buffer_verified(bh))
 		return 0;
 	if (EXT4_MB_GRP_BBITMAP_CORRUPT(grp))
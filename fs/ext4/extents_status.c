@@ -118,7 +118,9 @@
  *   --	memory consumption
  *      Fragmented extent tree will make extent status tree cost too much
  *      memory.  Hence, we will reclaim written/unwritten/hole extents from
- *      the tree under a heavy memory pressure.
+ *      the tree under a heavy memory pressure.  Inodes whose tree was used
+ *      since the last shrinker pass are skipped first, and inodes left
+ *      alone for a whole pass have all their reclaimable extents dropped.
  *
  *
  * ==========================================================================
@@ -194,6 +196,18 @@ static void ext4_es_print_tree(struct inode *inode)
 #define ext4_es_print_tree(inode)
 #endif
 
+/*
+ * Per-inode aging for the shrinker: an inode whose extent status tree is
+ * used gets a second chance on the next shrinker pass, and inodes not
+ * used for a whole pass are reclaimed without looking at the referenced
+ * bit of each extent.
+ */
+static inline void ext4_es_mark_accessed(struct inode *inode)
+{
+	if (!ext4_test_inode_state(inode, EXT4_STATE_ES_ACCESSED))
+		ext4_set_inode_state(inode, EXT4_STATE_ES_ACCESSED);
+}
+
 static inline ext4_lblk_t ext4_es_end(struct extent_status *es)
 {
 	BUG_ON(es->es_lblk + es->es_len < es->es_lblk);
@@ -719,6 +733,7 @@ int ext4_es_insert_extent(struct inode *inode, ext4_lblk_t lblk,
 	ext4_es_insert_extent_check(inode, &newes);
 
 	write_lock(&EXT4_I(inode)->i_es_lock);
+	ext4_es_mark_accessed(inode);
 	err = __es_remove_extent(inode, lblk, end);
 	if (err != 0)
 		goto error;
@@ -825,6 +840,7 @@ int ext4_es_lookup_extent(struct inode *inode, ext4_lblk_t lblk,
 		es->es_pblk = es1->es_pblk;
 		if (!ext4_es_is_referenced(es1))
 			ext4_es_set_referenced(es1);
+		ext4_es_mark_accessed(inode);
 		stats->es_stats_cache_hits++;
 	} else {
 		stats->es_stats_cache_misses++;
@@ -987,6 +1003,11 @@ static int __es_shrink(struct ext4_sb_info *sbi, int nr_to_scan,
 	spin_lock(&sbi->s_es_lock);
 	nr_to_walk = sbi->s_es_nr_inode;
 	while (nr_to_walk-- > 0) {
+		/*
+		 * The list may hold millions of inodes; don't keep everyone
+		 * else off it while skipping over hot ones.
+		 */
+		cond_resched_lock(&sbi->s_es_lock);
 		if (list_empty(&sbi->s_es_list)) {
 			spin_unlock(&sbi->s_es_lock);
 			goto out;
@@ -1006,6 +1027,15 @@ static int __es_shrink(struct ext4_sb_info *sbi, int nr_to_scan,
 			continue;
 		}
 
+		/* Recently used inodes get a second chance */
+		if (!retried && ext4_test_inode_state(&ei->vfs_inode,
+						EXT4_STATE_ES_ACCESSED)) {
+			ext4_clear_inode_state(&ei->vfs_inode,
+					       EXT4_STATE_ES_ACCESSED);
+			nr_skipped++;
+			continue;
+		}
+
 		if (ei == locked_ei || !write_trylock(&ei->i_es_lock)) {
 			nr_skipped++;
 			continue;
@@ -1183,7 +1213,7 @@ void ext4_es_unregister_shrinker(struct ext4_sb_info *sbi)
  * ei->i_es_shrink_lblk to where we should continue scanning.
  */
 static int es_do_reclaim_extents(struct ext4_inode_info *ei, ext4_lblk_t end,
-				 int *nr_to_scan, int *nr_shrunk)
+				 bool cold, int *nr_to_scan, int *nr_shrunk)
 {
 	struct inode *inode = &ei->vfs_inode;
 	struct ext4_es_tree *tree = &ei->i_es_tree;
@@ -1208,7 +1238,7 @@ static int es_do_reclaim_extents(struct ext4_inode_info *ei, ext4_lblk_t end,
 		 */
 		if (ext4_es_is_delayed(es))
 			goto next;
-		if (ext4_es_is_referenced(es)) {
+		if (ext4_es_is_referenced(es) && !cold) {
 			ext4_es_clear_referenced(es);
 			goto next;
 		}
@@ -1233,6 +1263,7 @@ static int es_reclaim_extents(struct ext4_inode_info *ei, int *nr_to_scan)
 	struct inode *inode = &ei->vfs_inode;
 	int nr_shrunk = 0;
 	ext4_lblk_t start = ei->i_es_shrink_lblk;
+	bool cold;
 	static DEFINE_RATELIMIT_STATE(_rs, DEFAULT_RATELIMIT_INTERVAL,
 				      DEFAULT_RATELIMIT_BURST);
 
@@ -1243,9 +1274,14 @@ static int es_reclaim_extents(struct ext4_inode_info *ei, int *nr_to_scan)
 	    __ratelimit(&_rs))
 		ext4_warning(inode->i_sb, "forced shrink of precached extents");
 
-	if (!es_do_reclaim_extents(ei, EXT_MAX_BLOCKS, nr_to_scan, &nr_shrunk) &&
+	/* Not used for a whole shrinker pass: drop it all */
+	cold = !ext4_test_inode_state(inode, EXT4_STATE_ES_ACCESSED);
+
+	if (!es_do_reclaim_extents(ei, EXT_MAX_BLOCKS, cold, nr_to_scan,
+				   &nr_shrunk) &&
 	    start != 0)
-		es_do_reclaim_extents(ei, start - 1, nr_to_scan, &nr_shrunk);
+		es_do_reclaim_extents(ei, start - 1, cold, nr_to_scan,
+				      &nr_shrunk);
 
 	ei->i_es_tree.cache_es = NULL;
 	return nr_shrunk;
@@ -0,0 +1,994 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  fs/ext4/fast_commit.c
+ *
+ * Ext4 fast commits: make fsync() of a single regular file durable by
+ * logging the changes to that inode only, instead of committing the whole
+ * running transaction.
+ */
+
+#include <linux/seq_file.h>
+#include <linux/quotaops.h>
+#include "ext4.h"
+#include "ext4_jbd2.h"
+#include "ext4_extents.h"
+
+/*
+ * Design
+ * ------
+ *
+ * jbd2 reserves a fast commit area at the end of the journal.  Between two
+ * full commits, fsync() of a regular file can append a fast commit for the
+ * running transaction there: a few tag-length-value records describing the
+ * file's changed block ranges and its inode attributes, see fast_commit.h.
+ * On recovery, after the regular journal replay, the fast commits of the
+ * transaction that did not make it to the log are applied on top of the
+ * recovered file system.  The next full commit makes the area reusable.
+ *
+ * Tracking: ext4_map_blocks(), truncate and punch hole record the logical
+ * range they changed in the inode (i_fc_lblk_start, i_fc_lblk_len), tagged
+ * with the transaction that changed it.  At fast commit time the current
+ * mapping of that range is logged as ADD_RANGE (mapped) and DEL_RANGE
+ * (hole) records, followed by an INODE record with size, times, mode and
+ * owner.
+ *
+ * Ineligibility: a fast commit only describes one inode, so anything
+ * changing other metadata forces the transaction to be committed in full.
+ * That covers namespace operations (they dirty a directory), xattrs, inode
+ * flag changes, quota updates, and operations that move extents around
+ * (collapse/insert/zero range, move extents, migrate, resize).  Those mark
+ * the transaction with ext4_fc_mark_ineligible(), or keep every
+ * transaction they run in ineligible with ext4_fc_start_ineligible() and
+ * ext4_fc_stop_ineligible().
+ *
+ * Commit: jbd2_fc_begin_commit() locks out handle updates, so the inode
+ * and its extent tree are stable while the records are generated.  The
+ * blocks are written with REQ_SYNC and the last one with PREFLUSH | FUA,
+ * so fsync costs a single block write in the common case.  Any failure
+ * falls back to a full commit of the transaction.
+ *
+ * Replay: jbd2 hands the fast commit area to ext4_fc_replay() twice.  The
+ * scan pass checks the records (tid, checksum) and counts the ones up to
+ * the last valid TAIL.  The replay pass applies them without a journal:
+ * the on-disk bitmaps are updated directly, and blocks are allocated with
+ * a simple allocator that avoids every block a fast commit refers to.
+ */
+
+/* Fast commit writer state */
+struct ext4_fc_write {
+	struct super_block *sb;
+	journal_t *journal;
+	struct buffer_head *bh;	/* block being filled */
+	int off;		/* offset of the next record in bh */
+	u32 crc;		/* checksum of the records since HEAD */
+	int nblks;		/* blocks submitted */
+};
+
+static void ext4_fc_set_ineligible_tid(struct ext4_sb_info *sbi, tid_t tid)
+{
+	spin_lock(&sbi->s_fc_lock);
+	if (tid_gt(tid, sbi->s_fc_ineligible_tid))
+		sbi->s_fc_ineligible_tid = tid;
+	spin_unlock(&sbi->s_fc_lock);
+}
+
+static tid_t ext4_fc_current_tid(journal_t *journal)
+{
+	tid_t tid;
+
+	/*
+	 * The tid the next transaction will get: marking it ineligible
+	 * covers the running transaction as well.
+	 */
+	read_lock(&journal->j_state_lock);
+	tid = journal->j_transaction_sequence;
+	read_unlock(&journal->j_state_lock);
+	return tid;
+}
+
+static bool ext4_fc_is_ineligible(struct super_block *sb, tid_t tid)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	bool ret;
+
+	if (atomic_read(&sbi->s_fc_ineligible_updates))
+		return true;
+	spin_lock(&sbi->s_fc_lock);
+	ret = tid_geq(sbi->s_fc_ineligible_tid, tid);
+	spin_unlock(&sbi->s_fc_lock);
+	return ret;
+}
+
+/*
+ * Mark the transaction of @handle, or the running one if @handle is NULL,
+ * as one that can only be committed in full.
+ */
+void ext4_fc_mark_ineligible(struct super_block *sb, int reason,
+			     handle_t *handle)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	tid_t tid;
+
+	if (!test_opt2(sb, JOURNAL_FAST_COMMIT) || !sbi->s_journal)
+		return;
+	if (handle && !IS_ERR(handle) && ext4_handle_valid(handle))
+		tid = handle->h_transaction->t_tid;
+	else
+		tid = ext4_fc_current_tid(sbi->s_journal);
+
+	ext4_fc_set_ineligible_tid(sbi, tid);
+	spin_lock(&sbi->s_fc_lock);
+	sbi->s_fc_stats.fc_ineligible_reason_count[reason]++;
+	spin_unlock(&sbi->s_fc_lock);
+}
+
+/*
+ * Keep every transaction ineligible until ext4_fc_stop_ineligible(), for
+ * operations that span several handles.
+ */
+void ext4_fc_start_ineligible(struct super_block *sb, int reason)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+
+	if (!test_opt2(sb, JOURNAL_FAST_COMMIT) || !sbi->s_journal)
+		return;
+	atomic_inc(&sbi->s_fc_ineligible_updates);
+	spin_lock(&sbi->s_fc_lock);
+	sbi->s_fc_stats.fc_ineligible_reason_count[reason]++;
+	spin_unlock(&sbi->s_fc_lock);
+}
+
+void ext4_fc_stop_ineligible(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+
+	if (!test_opt2(sb, JOURNAL_FAST_COMMIT) || !sbi->s_journal)
+		return;
+	/* The transaction the operation ended in stays ineligible */
+	ext4_fc_set_ineligible_tid(sbi, ext4_fc_current_tid(sbi->s_journal));
+	smp_mb__before_atomic();
+	atomic_dec(&sbi->s_fc_ineligible_updates);
+}
+
+void ext4_fc_init_inode(struct inode *inode)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+
+	spin_lock_init(&ei->i_fc_lock);
+	ei->i_fc_tid = 0;
+	ei->i_fc_lblk_start = 0;
+	ei->i_fc_lblk_len = 0;
+}
+
+/* Forget the tracked range if it belongs to an older transaction */
+static void ext4_fc_reset_range(struct ext4_inode_info *ei, tid_t tid)
+{
+	if (ei->i_fc_tid != tid) {
+		ei->i_fc_tid = tid;
+		ei->i_fc_lblk_start = 0;
+		ei->i_fc_lblk_len = 0;
+	}
+}
+
+/*
+ * Record that logical blocks [start, end] of @inode changed in the
+ * transaction of @handle.  A fast commit of an older transaction must have
+ * waited for its full commit, so the range of older transactions is
+ * simply dropped.
+ */
+void ext4_fc_track_range(handle_t *handle, struct inode *inode,
+			 ext4_lblk_t start, ext4_lblk_t end)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	ext4_lblk_t old_end;
+
+	if (!test_opt2(inode->i_sb, JOURNAL_FAST_COMMIT) ||
+	    !ext4_handle_valid(handle) || end < start)
+		return;
+
+	spin_lock(&ei->i_fc_lock);
+	ext4_fc_reset_range(ei, handle->h_transaction->t_tid);
+	if (ei->i_fc_lblk_len) {
+		old_end = ei->i_fc_lblk_start + ei->i_fc_lblk_len - 1;
+		start = min(start, ei->i_fc_lblk_start);
+		end = max(end, old_end);
+	}
+	ei->i_fc_lblk_start = start;
+	ei->i_fc_lblk_len = end - start + 1;
+	spin_unlock(&ei->i_fc_lock);
+}
+
+/*
+ * Called whenever an inode is dirtied: only regular extent mapped files
+ * can be fast committed, anything else dirtied in the transaction (a
+ * directory, a quota file, ...) makes it ineligible.
+ */
+void ext4_fc_track_inode(handle_t *handle, struct inode *inode)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+
+	if (!test_opt2(inode->i_sb, JOURNAL_FAST_COMMIT) ||
+	    !ext4_handle_valid(handle))
+		return;
+
+	if (ext4_is_quota_file(inode)) {
+		ext4_fc_mark_ineligible(inode->i_sb, EXT4_FC_REASON_QUOTA,
+					handle);
+		return;
+	}
+	if (!S_ISREG(inode->i_mode) ||
+	    !ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS) ||
+	    ext4_has_inline_data(inode) || ext4_should_journal_data(inode)) {
+		ext4_fc_mark_ineligible(inode->i_sb, EXT4_FC_REASON_INODE_TYPE,
+					handle);
+		return;
+	}
+
+	spin_lock(&ei->i_fc_lock);
+	ext4_fc_reset_range(ei, handle->h_transaction->t_tid);
+	spin_unlock(&ei->i_fc_lock);
+}
+
+/* Write out the current block; the tail block also flushes the cache */
+static void ext4_fc_submit_bh(struct ext4_fc_write *wr, bool is_tail)
+{
+	struct buffer_head *bh = wr->bh;
+	int write_flags = REQ_SYNC;
+
+	if (is_tail && (wr->journal->j_flags & JBD2_BARRIER))
+		write_flags |= REQ_PREFLUSH | REQ_FUA;
+	set_buffer_uptodate(bh);
+	set_buffer_dirty(bh);
+	write_dirty_buffer(bh, write_flags);
+	wr->bh = NULL;
+	wr->nblks++;
+}
+
+/*
+ * Reserve room for a record with @len bytes of value.  Records never
+ * cross a block boundary: the rest of a block that can't hold the record
+ * is left zeroed, which ends the block.
+ */
+static u8 *ext4_fc_reserve_space(struct ext4_fc_write *wr, int len)
+{
+	int need = sizeof(struct ext4_fc_tl) + len;
+	u8 *dst;
+	int ret;
+
+	if (wr->bh && wr->off + need <= wr->journal->j_blocksize) {
+		dst = wr->bh->b_data + wr->off;
+		wr->off += need;
+		return dst;
+	}
+
+	if (wr->bh)
+		ext4_fc_submit_bh(wr, false);
+	ret = jbd2_fc_get_buf(wr->journal, &wr->bh);
+	if (ret)
+		return ERR_PTR(ret);
+	memset(wr->bh->b_data, 0, wr->journal->j_blocksize);
+	wr->off = need;
+	return wr->bh->b_data;
+}
+
+/* Add a record; the first @csum_len bytes of it go into the checksum */
+static int ext4_fc_add_tlv(struct ext4_fc_write *wr, u16 tag, u16 len,
+			   const void *val, int csum_len)
+{
+	struct ext4_fc_tl tl;
+	u8 *dst;
+
+	dst = ext4_fc_reserve_space(wr, len);
+	if (IS_ERR(dst))
+		return PTR_ERR(dst);
+
+	tl.fc_tag = cpu_to_le16(tag);
+	tl.fc_len = cpu_to_le16(len);
+	memcpy(dst, &tl, sizeof(tl));
+	memcpy(dst + sizeof(tl), val, len);
+	wr->crc = ext4_chksum(EXT4_SB(wr->sb), wr->crc, dst, csum_len);
+	return 0;
+}
+
+static int ext4_fc_write_head(struct ext4_fc_write *wr, tid_t tid)
+{
+	struct ext4_fc_head head;
+
+	/* Every fast commit starts on a fresh block */
+	if (wr->bh)
+		ext4_fc_submit_bh(wr, false);
+	wr->crc = 0;
+
+	head.fc_features = cpu_to_le32(EXT4_FC_SUPPORTED_FEATURES);
+	head.fc_tid = cpu_to_le32(tid);
+	return ext4_fc_add_tlv(wr, EXT4_FC_TAG_HEAD, sizeof(head), &head,
+			       sizeof(struct ext4_fc_tl) + sizeof(head));
+}
+
+static int ext4_fc_write_tail(struct ext4_fc_write *wr, tid_t tid)
+{
+	struct ext4_fc_tail tail;
+	struct ext4_fc_tl tl;
+	u8 *dst;
+
+	dst = ext4_fc_reserve_space(wr, sizeof(tail));
+	if (IS_ERR(dst))
+		return PTR_ERR(dst);
+
+	tl.fc_tag = cpu_to_le16(EXT4_FC_TAG_TAIL);
+	tl.fc_len = cpu_to_le16(sizeof(tail));
+	memcpy(dst, &tl, sizeof(tl));
+	tail.fc_tid = cpu_to_le32(tid);
+	memcpy(dst + sizeof(tl), &tail.fc_tid, sizeof(tail.fc_tid));
+	wr->crc = ext4_chksum(EXT4_SB(wr->sb), wr->crc, dst,
+			      sizeof(tl) + sizeof(tail.fc_tid));
+	tail.fc_crc = cpu_to_le32(wr->crc);
+	memcpy(dst + sizeof(tl) + offsetof(struct ext4_fc_tail, fc_crc),
+	       &tail.fc_crc, sizeof(tail.fc_crc));
+	return 0;
+}
+
+/* Log the current mapping of logical blocks [start, start + len) */
+static int ext4_fc_write_ranges(struct ext4_fc_write *wr,
+				struct inode *inode, ext4_lblk_t start,
+				ext4_lblk_t len)
+{
+	ext4_lblk_t cur = start, end = start + len - 1;
+	struct ext4_fc_add_range add;
+	struct ext4_fc_del_range del;
+	struct ext4_map_blocks map;
+	struct ext4_extent *ex;
+	unsigned int max;
+	int ret;
+
+	while (cur <= end) {
+		map.m_lblk = cur;
+		map.m_len = end - cur + 1;
+		ret = ext4_map_blocks(NULL, inode, &map, 0);
+		if (ret < 0)
+			return ret;
+		if (map.m_len == 0)
+			return -EFSCORRUPTED;
+
+		if (ret == 0) {
+			del.fc_ino = cpu_to_le32(inode->i_ino);
+			del.fc_lblk = cpu_to_le32(map.m_lblk);
+			del.fc_len = cpu_to_le32(map.m_len);
+			ret = ext4_fc_add_tlv(wr, EXT4_FC_TAG_DEL_RANGE,
+					      sizeof(del), &del,
+					      sizeof(struct ext4_fc_tl) +
+					      sizeof(del));
+		} else {
+			max = (map.m_flags & EXT4_MAP_UNWRITTEN) ?
+				EXT_UNWRITTEN_MAX_LEN : EXT_INIT_MAX_LEN;
+			map.m_len = min(map.m_len, max);
+
+			memset(&add, 0, sizeof(add));
+			add.fc_ino = cpu_to_le32(inode->i_ino);
+			ex = (struct ext4_extent *)add.fc_ex;
+			ex->ee_block = cpu_to_le32(map.m_lblk);
+			ex->ee_len = cpu_to_le16(map.m_len);
+			ext4_ext_store_pblock(ex, map.m_pblk);
+			if (map.m_flags & EXT4_MAP_UNWRITTEN)
+				ext4_ext_mark_unwritten(ex);
+			ret = ext4_fc_add_tlv(wr, EXT4_FC_TAG_ADD_RANGE,
+					      sizeof(add), &add,
+					      sizeof(struct ext4_fc_tl) +
+					      sizeof(add));
+		}
+		if (ret)
+			return ret;
+
+		/* The last block of the file system wraps cur around */
+		if (map.m_len > end - cur)
+			break;
+		cur += map.m_len;
+	}
+	return 0;
+}
+
+static int ext4_fc_write_inode(struct ext4_fc_write *wr, struct inode *inode)
+{
+	struct ext4_fc_inode fi;
+
+	memset(&fi, 0, sizeof(fi));
+	fi.fc_ino = cpu_to_le32(inode->i_ino);
+	fi.fc_mode = cpu_to_le16(inode->i_mode);
+	fi.fc_uid = cpu_to_le32(i_uid_read(inode));
+	fi.fc_gid = cpu_to_le32(i_gid_read(inode));
+	fi.fc_size = cpu_to_le64(EXT4_I(inode)->i_disksize);
+	fi.fc_atime = cpu_to_le64(inode->i_atime.tv_sec);
+	fi.fc_mtime = cpu_to_le64(inode->i_mtime.tv_sec);
+	fi.fc_ctime = cpu_to_le64(inode->i_ctime.tv_sec);
+	fi.fc_atime_nsec = cpu_to_le32(inode->i_atime.tv_nsec);
+	fi.fc_mtime_nsec = cpu_to_le32(inode->i_mtime.tv_nsec);
+	fi.fc_ctime_nsec = cpu_to_le32(inode->i_ctime.tv_nsec);
+	return ext4_fc_add_tlv(wr, EXT4_FC_TAG_INODE, sizeof(fi), &fi,
+			       sizeof(struct ext4_fc_tl) + sizeof(fi));
+}
+
+static int ext4_fc_perform_commit(struct inode *inode, tid_t tid, int *nblks)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	journal_t *journal = EXT4_SB(inode->i_sb)->s_journal;
+	struct ext4_fc_write wr = {
+		.sb = inode->i_sb,
+		.journal = journal,
+	};
+	ext4_lblk_t start = 0, len = 0;
+	int ret;
+
+	spin_lock(&ei->i_fc_lock);
+	if (ei->i_fc_tid == tid) {
+		start = ei->i_fc_lblk_start;
+		len = ei->i_fc_lblk_len;
+		ei->i_fc_lblk_len = 0;
+	}
+	spin_unlock(&ei->i_fc_lock);
+
+	/*
+	 * The commit block must not reach the disk before the data it
+	 * refers to.  With an internal journal the PREFLUSH of the tail
+	 * block takes care of that.
+	 */
+	if (journal->j_fs_dev != journal->j_dev &&
+	    (journal->j_flags & JBD2_BARRIER)) {
+		ret = blkdev_issue_flush(journal->j_fs_dev, GFP_NOFS, NULL);
+		if (ret)
+			return ret;
+	}
+
+	ret = ext4_fc_write_head(&wr, tid);
+	if (!ret && len)
+		ret = ext4_fc_write_ranges(&wr, inode, start, len);
+	if (!ret)
+		ret = ext4_fc_write_inode(&wr, inode);
+	if (!ret)
+		ret = ext4_fc_write_tail(&wr, tid);
+	if (ret) {
+		if (wr.bh)
+			ext4_fc_submit_bh(&wr, false);
+		return ret;
+	}
+
+	ret = jbd2_fc_wait_bufs(journal, wr.nblks);
+	ext4_fc_submit_bh(&wr, true);
+	if (!ret)
+		ret = jbd2_fc_wait_bufs(journal, 1);
+	*nblks = wr.nblks;
+	return ret;
+}
+
+/*
+ * Make the changes of transaction @commit_tid to @inode durable, with a
+ * fast commit if possible and a full commit otherwise.
+ */
+int ext4_fc_commit(struct inode *inode, tid_t commit_tid)
+{
+	struct super_block *sb = inode->i_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	journal_t *journal = sbi->s_journal;
+	struct ext4_fc_stats *stats = &sbi->s_fc_stats;
+	ktime_t start_time = ktime_get();
+	u64 commit_time;
+	int nblks = 0;
+	int ret;
+
+	if (!test_opt2(sb, JOURNAL_FAST_COMMIT))
+		return jbd2_complete_transaction(journal, commit_tid);
+
+	if (!S_ISREG(inode->i_mode) ||
+	    !ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS) ||
+	    ext4_has_inline_data(inode) ||
+	    ext4_fc_is_ineligible(sb, commit_tid))
+		goto ineligible;
+
+	ret = jbd2_fc_begin_commit(journal, commit_tid);
+	if (ret == -EALREADY) {
+		spin_lock(&sbi->s_fc_lock);
+		stats->fc_skipped_commits++;
+		spin_unlock(&sbi->s_fc_lock);
+		return jbd2_complete_transaction(journal, commit_tid);
+	}
+	if (ret)
+		goto ineligible;
+
+	/*
+	 * Updates are locked out now.  Data still in flight must be on disk
+	 * before the blocks are logged; unwritten extent conversion needs a
+	 * handle though, so leave inodes waiting for it to a full commit.
+	 */
+	if (ext4_fc_is_ineligible(sb, commit_tid) ||
+	    atomic_read(&EXT4_I(inode)->i_unwritten) ||
+	    filemap_fdatawait_keep_errors(inode->i_mapping)) {
+		jbd2_fc_end_commit_fallback(journal, commit_tid);
+		goto ineligible;
+	}
+
+	ret = ext4_fc_perform_commit(inode, commit_tid, &nblks);
+	if (ret) {
+		jbd2_fc_release_bufs(journal);
+		jbd2_fc_end_commit_fallback(journal, commit_tid);
+		spin_lock(&sbi->s_fc_lock);
+		stats->fc_failed_commits++;
+		spin_unlock(&sbi->s_fc_lock);
+		return jbd2_complete_transaction(journal, commit_tid);
+	}
+	jbd2_fc_end_commit(journal);
+
+	commit_time = ktime_to_ns(ktime_sub(ktime_get(), start_time));
+	spin_lock(&sbi->s_fc_lock);
+	stats->fc_num_commits++;
+	stats->fc_numblks += nblks;
+	if (likely(stats->fc_avg_commit_time))
+		stats->fc_avg_commit_time =
+			(commit_time + stats->fc_avg_commit_time * 3) / 4;
+	else
+		stats->fc_avg_commit_time = commit_time;
+	spin_unlock(&sbi->s_fc_lock);
+	return 0;
+
+ineligible:
+	spin_lock(&sbi->s_fc_lock);
+	stats->fc_ineligible_commits++;
+	spin_unlock(&sbi->s_fc_lock);
+	return jbd2_complete_transaction(journal, commit_tid);
+}
+
+/* Fast commit replay */
+
+/* Remember the physical blocks of an ADD_RANGE record seen by the scan */
+static int ext4_fc_record_region(struct ext4_fc_replay_state *state,
+				 ext4_fsblk_t pblk, int len)
+{
+	struct ext4_fc_alloc_region *region;
+
+	if (state->fc_regions_used == state->fc_regions_size) {
+		region = krealloc(state->fc_regions,
+				  sizeof(*region) * (state->fc_regions_size + 32),
+				  GFP_KERNEL);
+		if (!region)
+			return -ENOMEM;
+		state->fc_regions = region;
+		state->fc_regions_size += 32;
+	}
+	region = &state->fc_regions[state->fc_regions_used++];
+	region->pblk = pblk;
+	region->len = len;
+	return 0;
+}
+
+/* Is @block referred to by a fast commit being replayed? */
+int ext4_fc_replay_check_excluded(struct super_block *sb, ext4_fsblk_t block)
+{
+	struct ext4_fc_replay_state *state = &EXT4_SB(sb)->s_fc_replay_state;
+	int i;
+
+	for (i = 0; i < state->fc_regions_valid; i++)
+		if (block >= state->fc_regions[i].pblk &&
+		    block < state->fc_regions[i].pblk + state->fc_regions[i].len)
+			return 1;
+	return 0;
+}
+
+void ext4_fc_replay_cleanup(struct super_block *sb)
+{
+	struct ext4_fc_replay_state *state = &EXT4_SB(sb)->s_fc_replay_state;
+
+	kfree(state->fc_regions);
+	state->fc_regions = NULL;
+	state->fc_regions_size = 0;
+	state->fc_regions_used = 0;
+	state->fc_regions_valid = 0;
+}
+
+static int ext4_fc_value_len(u16 tag)
+{
+	switch (tag) {
+	case EXT4_FC_TAG_HEAD:
+		return sizeof(struct ext4_fc_head);
+	case EXT4_FC_TAG_ADD_RANGE:
+		return sizeof(struct ext4_fc_add_range);
+	case EXT4_FC_TAG_DEL_RANGE:
+		return sizeof(struct ext4_fc_del_range);
+	case EXT4_FC_TAG_INODE:
+		return sizeof(struct ext4_fc_inode);
+	case EXT4_FC_TAG_TAIL:
+		return sizeof(struct ext4_fc_tail);
+	}
+	return -1;
+}
+
+/*
+ * Scan pass: validate the records of one block, and count the records up
+ * to the last TAIL with the expected tid and a matching checksum.
+ */
+static int ext4_fc_replay_scan(journal_t *journal, struct buffer_head *bh,
+			       int off, tid_t expected_tid)
+{
+	struct super_block *sb = journal->j_private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_fc_replay_state *state = &sbi->s_fc_replay_state;
+	u8 *start = bh->b_data, *end = start + journal->j_blocksize, *cur;
+	struct ext4_fc_add_range add;
+	struct ext4_fc_head head;
+	struct ext4_fc_tail tail;
+	struct ext4_extent *ex;
+	struct ext4_fc_tl tl;
+	u16 tag, len;
+	int ret = JBD2_FC_REPLAY_CONTINUE;
+
+	if (off == 0) {
+		state->fc_replay_num_tags = 0;
+		state->fc_replay_expected_off = 0;
+		state->fc_cur_tag = 0;
+		state->fc_crc = 0;
+		ext4_fc_replay_cleanup(sb);
+	}
+	if (off != state->fc_replay_expected_off)
+		return JBD2_FC_REPLAY_STOP;
+	state->fc_replay_expected_off++;
+
+	for (cur = start; cur + sizeof(tl) <= end;
+	     cur += sizeof(tl) + len) {
+		memcpy(&tl, cur, sizeof(tl));
+		tag = le16_to_cpu(tl.fc_tag);
+		len = le16_to_cpu(tl.fc_len);
+
+		if (tag == 0) {
+			/* An empty block outside of a fast commit ends them */
+			if (cur == start && !state->fc_cur_tag)
+				ret = JBD2_FC_REPLAY_STOP;
+			break;
+		}
+		if (len != ext4_fc_value_len(tag) ||
+		    cur + sizeof(tl) + len > end ||
+		    (tag == EXT4_FC_TAG_HEAD) != !state->fc_cur_tag) {
+			ret = JBD2_FC_REPLAY_STOP;
+			break;
+		}
+
+		switch (tag) {
+		case EXT4_FC_TAG_HEAD:
+			memcpy(&head, cur + sizeof(tl), sizeof(head));
+			if (le32_to_cpu(head.fc_features) &
+			    ~EXT4_FC_SUPPORTED_FEATURES ||
+			    le32_to_cpu(head.fc_tid) != expected_tid) {
+				ret = JBD2_FC_REPLAY_STOP;
+				break;
+			}
+			state->fc_crc = ext4_chksum(sbi, 0, cur,
+						    sizeof(tl) + len);
+			state->fc_cur_tag = 1;
+			break;
+		case EXT4_FC_TAG_ADD_RANGE:
+			memcpy(&add, cur + sizeof(tl), sizeof(add));
+			ex = (struct ext4_extent *)add.fc_ex;
+			if (ext4_fc_record_region(state, ext4_ext_pblock(ex),
+					ext4_ext_get_actual_len(ex))) {
+				ret = -ENOMEM;
+				break;
+			}
+			/* fall through */
+		case EXT4_FC_TAG_DEL_RANGE:
+		case EXT4_FC_TAG_INODE:
+			state->fc_crc = ext4_chksum(sbi, state->fc_crc, cur,
+						    sizeof(tl) + len);
+			state->fc_cur_tag++;
+			break;
+		case EXT4_FC_TAG_TAIL:
+			memcpy(&tail, cur + sizeof(tl), sizeof(tail));
+			state->fc_crc = ext4_chksum(sbi, state->fc_crc, cur,
+					sizeof(tl) + sizeof(tail.fc_tid));
+			if (le32_to_cpu(tail.fc_tid) != expected_tid ||
+			    le32_to_cpu(tail.fc_crc) != state->fc_crc) {
+				ret = JBD2_FC_REPLAY_STOP;
+				break;
+			}
+			state->fc_replay_num_tags += state->fc_cur_tag + 1;
+			state->fc_regions_valid = state->fc_regions_used;
+			state->fc_cur_tag = 0;
+			break;
+		}
+		if (ret != JBD2_FC_REPLAY_CONTINUE)
+			break;
+	}
+
+	if (ret != JBD2_FC_REPLAY_CONTINUE) {
+		/* Forget the regions of an incomplete fast commit */
+		state->fc_regions_used = state->fc_regions_valid;
+		if (ret < 0)
+			ext4_fc_replay_cleanup(sb);
+	}
+	return ret;
+}
+
+/* Account blocks newly mapped by replay to the bitmaps and the inode */
+static int ext4_fc_replay_mark_used(struct inode *inode, ext4_fsblk_t pblk,
+				    int len, bool newly_mapped)
+{
+	int ret;
+
+	ret = ext4_mb_mark_bb(inode->i_sb, pblk, len, 1);
+	if (!ret && newly_mapped)
+		dquot_alloc_block_nofail(inode, len);
+	return ret;
+}
+
+static int ext4_fc_replay_remove(struct inode *inode, ext4_lblk_t lblk,
+				 ext4_lblk_t len)
+{
+	ext4_lblk_t end = min_t(u64, (u64)lblk + len - 1, EXT_MAX_BLOCKS - 1);
+	int ret;
+
+	down_write(&EXT4_I(inode)->i_data_sem);
+	ret = ext4_es_remove_extent(inode, lblk, end - lblk + 1);
+	if (!ret)
+		ret = ext4_ext_remove_space(inode, lblk, end);
+	up_write(&EXT4_I(inode)->i_data_sem);
+	return ret;
+}
+
+static int ext4_fc_replay_add_range(struct super_block *sb,
+				    struct ext4_fc_add_range *add)
+{
+	struct ext4_extent *ex = (struct ext4_extent *)add->fc_ex;
+	struct ext4_ext_path *path;
+	struct ext4_map_blocks map;
+	ext4_lblk_t start, cur, remaining;
+	ext4_fsblk_t start_pblk;
+	struct ext4_extent newex;
+	struct inode *inode;
+	bool unwritten;
+	int ret = 0;
+
+	inode = ext4_iget(sb, le32_to_cpu(add->fc_ino), EXT4_IGET_NORMAL);
+	if (IS_ERR(inode))
+		return 0;
+
+	start = le32_to_cpu(ex->ee_block);
+	start_pblk = ext4_ext_pblock(ex);
+	remaining = ext4_ext_get_actual_len(ex);
+	unwritten = ext4_ext_is_unwritten(ex);
+	cur = start;
+
+	while (remaining > 0) {
+		map.m_lblk = cur;
+		map.m_len = remaining;
+		ret = ext4_map_blocks(NULL, inode, &map, 0);
+		if (ret < 0)
+			goto out;
+
+		if (ret == 0) {
+			/* A hole: map the logged blocks */
+			memset(&newex, 0, sizeof(newex));
+			newex.ee_block = cpu_to_le32(cur);
+			newex.ee_len = cpu_to_le16(map.m_len);
+			ext4_ext_store_pblock(&newex,
+					      start_pblk + cur - start);
+			if (unwritten)
+				ext4_ext_mark_unwritten(&newex);
+
+			down_write(&EXT4_I(inode)->i_data_sem);
+			path = ext4_find_extent(inode, cur, NULL, 0);
+			if (IS_ERR(path)) {
+				up_write(&EXT4_I(inode)->i_data_sem);
+				ret = PTR_ERR(path);
+				goto out;
+			}
+			ret = ext4_ext_insert_extent(NULL, inode, &path,
+						     &newex, 0);
+			ext4_ext_drop_refs(path);
+			kfree(path);
+			if (!ret)
+				ret = ext4_es_remove_extent(inode, cur,
+							    map.m_len);
+			up_write(&EXT4_I(inode)->i_data_sem);
+			if (!ret)
+				ret = ext4_fc_replay_mark_used(inode,
+						start_pblk + cur - start,
+						map.m_len, true);
+			if (ret)
+				goto out;
+		} else if (map.m_pblk != start_pblk + cur - start) {
+			/* Mapped elsewhere: unmap, then map as a hole */
+			ret = ext4_fc_replay_remove(inode, cur, map.m_len);
+			if (ret)
+				goto out;
+			continue;
+		} else {
+			/* Same blocks, only the unwritten state may differ */
+			if (!unwritten && (map.m_flags & EXT4_MAP_UNWRITTEN)) {
+				ret = ext4_map_blocks(NULL, inode, &map,
+						EXT4_GET_BLOCKS_IO_CONVERT_EXT);
+				if (ret < 0)
+					goto out;
+			}
+			ret = ext4_fc_replay_mark_used(inode, map.m_pblk,
+						       map.m_len, false);
+			if (ret)
+				goto out;
+		}
+		cur += map.m_len;
+		remaining -= map.m_len;
+	}
+	ret = ext4_mark_inode_dirty(NULL, inode);
+out:
+	iput(inode);
+	return ret;
+}
+
+static int ext4_fc_replay_del_range(struct super_block *sb,
+				    struct ext4_fc_del_range *del)
+{
+	struct inode *inode;
+	int ret;
+
+	inode = ext4_iget(sb, le32_to_cpu(del->fc_ino), EXT4_IGET_NORMAL);
+	if (IS_ERR(inode))
+		return 0;
+
+	ret = ext4_fc_replay_remove(inode, le32_to_cpu(del->fc_lblk),
+				    le32_to_cpu(del->fc_len));
+	if (!ret)
+		ret = ext4_mark_inode_dirty(NULL, inode);
+	iput(inode);
+	return ret;
+}
+
+static int ext4_fc_replay_inode(struct super_block *sb,
+				struct ext4_fc_inode *fi)
+{
+	struct inode *inode;
+	loff_t size;
+	int ret;
+
+	inode = ext4_iget(sb, le32_to_cpu(fi->fc_ino), EXT4_IGET_NORMAL);
+	if (IS_ERR(inode))
+		return 0;
+
+	size = le64_to_cpu(fi->fc_size);
+	i_size_write(inode, size);
+	EXT4_I(inode)->i_disksize = size;
+	inode->i_mode = (inode->i_mode & S_IFMT) |
+			(le16_to_cpu(fi->fc_mode) & ~S_IFMT);
+	i_uid_write(inode, le32_to_cpu(fi->fc_uid));
+	i_gid_write(inode, le32_to_cpu(fi->fc_gid));
+	inode->i_atime.tv_sec = le64_to_cpu(fi->fc_atime);
+	inode->i_mtime.tv_sec = le64_to_cpu(fi->fc_mtime);
+	inode->i_ctime.tv_sec = le64_to_cpu(fi->fc_ctime);
+	inode->i_atime.tv_nsec = le32_to_cpu(fi->fc_atime_nsec);
+	inode->i_mtime.tv_nsec = le32_to_cpu(fi->fc_mtime_nsec);
+	inode->i_ctime.tv_nsec = le32_to_cpu(fi->fc_ctime_nsec);
+	ret = ext4_mark_inode_dirty(NULL, inode);
+	iput(inode);
+	return ret;
+}
+
+static void ext4_fc_replay_finish(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+
+	if (sbi->s_mount_state & EXT4_FC_REPLAY) {
+		sbi->s_mount_state &= ~EXT4_FC_REPLAY;
+		if (sbi->s_fc_replay_state.fc_replay_ro)
+			sb->s_flags |= SB_RDONLY;
+	}
+	ext4_fc_replay_cleanup(sb);
+}
+
+/* Replay pass: apply the records counted by the scan pass */
+static int ext4_fc_replay_apply(journal_t *journal, struct buffer_head *bh)
+{
+	struct super_block *sb = journal->j_private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_fc_replay_state *state = &sbi->s_fc_replay_state;
+	u8 *start = bh->b_data, *end = start + journal->j_blocksize, *cur;
+	struct ext4_fc_add_range add;
+	struct ext4_fc_del_range del;
+	struct ext4_fc_inode fi;
+	struct ext4_fc_tl tl;
+	u16 tag, len;
+	int ret = 0;
+
+	if (!(sbi->s_mount_state & EXT4_FC_REPLAY)) {
+		if (!state->fc_replay_num_tags) {
+			ext4_fc_replay_cleanup(sb);
+			return JBD2_FC_REPLAY_STOP;
+		}
+		ext4_msg(sb, KERN_INFO, "replaying %d fast commit records",
+			 state->fc_replay_num_tags);
+		/* Like orphan cleanup, replay writes to a read-only mount */
+		state->fc_replay_ro = sb_rdonly(sb);
+		sb->s_flags &= ~SB_RDONLY;
+		sbi->s_mount_state |= EXT4_FC_REPLAY;
+	}
+
+	for (cur = start; cur + sizeof(tl) <= end; cur += sizeof(tl) + len) {
+		memcpy(&tl, cur, sizeof(tl));
+		tag = le16_to_cpu(tl.fc_tag);
+		len = le16_to_cpu(tl.fc_len);
+		if (tag == 0)
+			break;
+
+		switch (tag) {
+		case EXT4_FC_TAG_ADD_RANGE:
+			memcpy(&add, cur + sizeof(tl), sizeof(add));
+			ret = ext4_fc_replay_add_range(sb, &add);
+			break;
+		case EXT4_FC_TAG_DEL_RANGE:
+			memcpy(&del, cur + sizeof(tl), sizeof(del));
+			ret = ext4_fc_replay_del_range(sb, &del);
+			break;
+		case EXT4_FC_TAG_INODE:
+			memcpy(&fi, cur + sizeof(tl), sizeof(fi));
+			ret = ext4_fc_replay_inode(sb, &fi);
+			break;
+		}
+		if (ret) {
+			ext4_msg(sb, KERN_ERR, "fast commit replay of record "
+				 "%u failed: %d", tag, ret);
+			ext4_fc_replay_finish(sb);
+			return ret;
+		}
+		if (--state->fc_replay_num_tags == 0) {
+			ext4_fc_replay_finish(sb);
+			return JBD2_FC_REPLAY_STOP;
+		}
+	}
+	return JBD2_FC_REPLAY_CONTINUE;
+}
+
+static int ext4_fc_replay(journal_t *journal, struct buffer_head *bh,
+			  enum passtype pass, int off, tid_t expected_tid)
+{
+	if (pass == PASS_SCAN)
+		return ext4_fc_replay_scan(journal, bh, off, expected_tid);
+	return ext4_fc_replay_apply(journal, bh);
+}
+
+void ext4_fc_init(struct super_block *sb, journal_t *journal)
+{
+	jbd2_journal_wrapper(journal)->j_fc_replay_callback = ext4_fc_replay;
+}
+
+static const char * const fc_ineligible_reasons[] = {
+	"Extended attributes changed",
+	"Inode type",
+	"Inode flags changed",
+	"Quota update",
+	"Swap boot",
+	"Move extents",
+	"Resize",
+	"Falloc range op",
+	"Migrate",
+};
+
+int ext4_fc_info_show(struct seq_file *seq, void *v)
+{
+	struct ext4_sb_info *sbi = EXT4_SB((struct super_block *)seq->private);
+	struct ext4_fc_stats stats;
+	int i;
+
+	if (v != SEQ_START_TOKEN)
+		return 0;
+
+	spin_lock(&sbi->s_fc_lock);
+	stats = sbi->s_fc_stats;
+	spin_unlock(&sbi->s_fc_lock);
+
+	seq_printf(seq, "fast commit: %s\n",
+		   test_opt2(sbi->s_sb, JOURNAL_FAST_COMMIT) ?
+		   "enabled" : "disabled");
+	seq_printf(seq, "%lu commits\n%lu ineligible\n%lu failed\n"
+		   "%lu skipped\n%lu numblks\n%lluus avg_commit_time\n",
+		   stats.fc_num_commits, stats.fc_ineligible_commits,
+		   stats.fc_failed_commits, stats.fc_skipped_commits,
+		   stats.fc_numblks, div_u64(stats.fc_avg_commit_time, 1000));
+	seq_puts(seq, "Ineligible reasons:\n");
+	for (i = 0; i < EXT4_FC_REASON_MAX; i++)
+		seq_printf(seq, "\"%s\":\t%d\n", fc_ineligible_reasons[i],
+			   stats.fc_ineligible_reason_count[i]);
+
+	return 0;
+}
@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#ifndef __FAST_COMMIT_H__
+#define __FAST_COMMIT_H__
+
+/*
+ * Fast commit on-disk format
+ *
+ * A fast commit is a sequence of tag-length-value records written to the
+ * fast commit area at the end of the journal.  It starts on a fresh block
+ * with a HEAD tag and ends with a TAIL tag carrying the checksum of every
+ * record since the HEAD.  Records never cross a block boundary; a zero tag
+ * ends the records of a block.
+ *
+ * This format is private and not the one of upstream fast commits, whose
+ * tags have the same names but other values.  It is only written behind
+ * the private EXT4_FEATURE_COMPAT_FAST_COMMIT and
+ * JBD2_FEATURE_INCOMPAT_FAST_COMMIT bits, which upstream doesn't know.
+ */
+#define EXT4_FC_TAG_ADD_RANGE		0x0001
+#define EXT4_FC_TAG_DEL_RANGE		0x0002
+#define EXT4_FC_TAG_INODE		0x0003
+#define EXT4_FC_TAG_TAIL		0x0004
+#define EXT4_FC_TAG_HEAD		0x0005
+
+#define EXT4_FC_SUPPORTED_FEATURES	0x0
+
+/* On disk fast commit tlv value structures */
+
+/* Fast commit on disk tag length structure */
+struct ext4_fc_tl {
+	__le16 fc_tag;
+	__le16 fc_len;
+};
+
+/* Value structure for tag EXT4_FC_TAG_HEAD. */
+struct ext4_fc_head {
+	__le32 fc_features;
+	__le32 fc_tid;
+};
+
+/* Value structure for EXT4_FC_TAG_ADD_RANGE. */
+struct ext4_fc_add_range {
+	__le32 fc_ino;
+	__u8 fc_ex[12];
+};
+
+/* Value structure for tag EXT4_FC_TAG_DEL_RANGE. */
+struct ext4_fc_del_range {
+	__le32 fc_ino;
+	__le32 fc_lblk;
+	__le32 fc_len;
+};
+
+/* Value structure for tag EXT4_FC_TAG_INODE. */
+struct ext4_fc_inode {
+	__le32 fc_ino;
+	__le16 fc_mode;
+	__le16 fc_pad;
+	__le32 fc_uid;
+	__le32 fc_gid;
+	__le64 fc_size;
+	__le64 fc_atime;
+	__le64 fc_mtime;
+	__le64 fc_ctime;
+	__le32 fc_atime_nsec;
+	__le32 fc_mtime_nsec;
+	__le32 fc_ctime_nsec;
+	__le32 fc_pad2;
+};
+
+/* Value structure for tag EXT4_FC_TAG_TAIL. */
+struct ext4_fc_tail {
+	__le32 fc_tid;
+	__le32 fc_crc;
+};
+
+/*
+ * Fast commit reason codes: why a transaction has to be committed in full
+ */
+enum {
+	EXT4_FC_REASON_XATTR = 0,
+	EXT4_FC_REASON_INODE_TYPE,
+	EXT4_FC_REASON_INODE_FLAGS,
+	EXT4_FC_REASON_QUOTA,
+	EXT4_FC_REASON_SWAP_BOOT,
+	EXT4_FC_REASON_MOVE_EXT,
+	EXT4_FC_REASON_RESIZE,
+	EXT4_FC_REASON_FALLOC_RANGE,
+	EXT4_FC_REASON_MIGRATE,
+	EXT4_FC_REASON_MAX
+};
+
+struct ext4_fc_stats {
+	unsigned int fc_ineligible_reason_count[EXT4_FC_REASON_MAX];
+	unsigned long fc_num_commits;
+	unsigned long fc_ineligible_commits;
+	unsigned long fc_failed_commits;
+	unsigned long fc_skipped_commits;
+	unsigned long fc_numblks;
+	u64 fc_avg_commit_time;
+};
+
+/* Physical blocks referenced by the fast commits being replayed */
+struct ext4_fc_alloc_region {
+	ext4_fsblk_t pblk;
+	int len;
+};
+
+/* Fast commit replay state */
+struct ext4_fc_replay_state {
+	int fc_replay_num_tags;		/* tags up to the last valid tail */
+	int fc_replay_expected_off;	/* next block the scan expects */
+	int fc_cur_tag;			/* tags of the open fast commit */
+	bool fc_replay_ro;		/* mount was read-only before replay */
+	u32 fc_crc;
+	struct ext4_fc_alloc_region *fc_regions;
+	int fc_regions_size, fc_regions_used, fc_regions_valid;
+};
+
+extern int ext4_fc_replay_check_excluded(struct super_block *sb,
+					 ext4_fsblk_t block);
+extern void ext4_fc_replay_cleanup(struct super_block *sb);
+
+#endif /* __FAST_COMMIT_H__ */
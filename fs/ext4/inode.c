@@ -714,6 +714,9 @@ int ext4_map_blocks(handle_t *handle, struct inode *inode,
 
 out_sem:
 	up_write((&EXT4_I(inode)->i_data_sem));
+	if (retval > 0)
+		ext4_fc_track_range(handle, inode, map->m_lblk,
+				    map->m_lblk + map->m_len - 1);
 	if (retval > 0 && map->m_flags & EXT4_MAP_MAPPED) {
 		ret = check_block_validity(inode, map);
 		if (ret != 0)
@@ -4418,6 +4421,8 @@ int ext4_punch_hole(struct inode *inode, loff_t offset, loff_t length)
 						    stop_block);
 
 		up_write(&EXT4_I(inode)->i_data_sem);
+		ext4_fc_track_range(handle, inode, first_block,
+				    stop_block - 1);
 	}
 	if (IS_SYNC(inode))
 		ext4_handle_sync(handle);
@@ -4566,6 +4571,10 @@ int ext4_truncate(struct inode *inode)
 		ext4_ind_truncate(handle, inode);
 
 	up_write(&ei->i_data_sem);
+	ext4_fc_track_range(handle, inode,
+			    (inode->i_size + inode->i_sb->s_blocksize - 1) >>
+			    inode->i_sb->s_blocksize_bits,
+			    EXT_MAX_BLOCKS - 1);
 	if (err)
 		goto out_stop;
 
@@ -6172,6 +6181,7 @@ int ext4_mark_inode_dirty(handle_t *handle, struct inode *inode)
 		ext4_try_to_expand_extra_isize(inode, sbi->s_want_extra_isize,
 					       iloc, handle);
 
+	ext4_fc_track_inode(handle, inode);
 	return ext4_mark_iloc_dirty(handle, inode, &iloc);
 }
 
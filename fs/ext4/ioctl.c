@@ -370,6 +370,8 @@ static int ext4_ioctl_setflags(struct inode *inode,
 		err = PTR_ERR(handle);
 		goto flags_out;
 	}
+	ext4_fc_mark_ineligible(inode->i_sb, EXT4_FC_REASON_INODE_FLAGS,
+				handle);
 	if (IS_SYNC(inode))
 		ext4_handle_sync(handle);
 	err = ext4_reserve_inode_write(handle, inode, &iloc);
@@ -479,6 +481,7 @@ static int ext4_ioctl_setproject(struct file *filp, __u32 projid)
 		EXT4_QUOTA_DEL_BLOCKS(sb) + 3);
 	if (IS_ERR(handle))
 		return PTR_ERR(handle);
+	ext4_fc_mark_ineligible(sb, EXT4_FC_REASON_INODE_FLAGS, handle);
 
 	err = ext4_reserve_inode_write(handle, inode, &iloc);
 	if (err)
@@ -712,7 +715,9 @@ static long ext4_ioctl_group_add(struct file *file,
 	if (err)
 		goto group_add_out;
 
+	ext4_fc_start_ineligible(sb, EXT4_FC_REASON_RESIZE);
 	err = ext4_group_add(sb, input);
+	ext4_fc_stop_ineligible(sb);
 	if (EXT4_SB(sb)->s_journal) {
 		jbd2_journal_lock_updates(EXT4_SB(sb)->s_journal);
 		err2 = jbd2_journal_flush(EXT4_SB(sb)->s_journal);
@@ -836,6 +841,8 @@ long ext4_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 			err = PTR_ERR(handle);
 			goto unlock_out;
 		}
+		ext4_fc_mark_ineligible(sb, EXT4_FC_REASON_INODE_FLAGS,
+					handle);
 		err = ext4_reserve_inode_write(handle, inode, &iloc);
 		if (err == 0) {
 			inode->i_ctime = current_time(inode);
@@ -874,7 +881,9 @@ long ext4_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		if (err)
 			goto group_extend_out;
 
+		ext4_fc_start_ineligible(sb, EXT4_FC_REASON_RESIZE);
 		err = ext4_group_extend(sb, EXT4_SB(sb)->s_es, n_blocks_count);
+		ext4_fc_stop_ineligible(sb);
 		if (EXT4_SB(sb)->s_journal) {
 			jbd2_journal_lock_updates(EXT4_SB(sb)->s_journal);
 			err2 = jbd2_journal_flush(EXT4_SB(sb)->s_journal);
@@ -927,8 +936,10 @@ long ext4_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		if (err)
 			goto mext_out;
 
+		ext4_fc_start_ineligible(sb, EXT4_FC_REASON_MOVE_EXT);
 		err = ext4_move_extents(filp, donor.file, me.orig_start,
 					me.donor_start, me.len, &me.moved_len);
+		ext4_fc_stop_ineligible(sb);
 		mnt_drop_write_file(filp);
 
 		if (copy_to_user((struct move_extent __user *)arg,
@@ -965,7 +976,9 @@ long ext4_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		 * inode format to prevent read.
 		 */
 		inode_lock((inode));
+		ext4_fc_start_ineligible(sb, EXT4_FC_REASON_MIGRATE);
 		err = ext4_ext_migrate(inode);
+		ext4_fc_stop_ineligible(sb);
 		inode_unlock((inode));
 		mnt_drop_write_file(filp);
 		return err;
@@ -993,7 +1006,9 @@ long ext4_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		err = mnt_want_write_file(filp);
 		if (err)
 			return err;
+		ext4_fc_start_ineligible(sb, EXT4_FC_REASON_SWAP_BOOT);
 		err = swap_inode_boot_loader(sb, inode);
+		ext4_fc_stop_ineligible(sb);
 		mnt_drop_write_file(filp);
 		return err;
 	}
@@ -1016,7 +1031,9 @@ long ext4_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		if (err)
 			goto resizefs_out;
 
+		ext4_fc_start_ineligible(sb, EXT4_FC_REASON_RESIZE);
 		err = ext4_resize_fs(sb, n_blocks_count);
+		ext4_fc_stop_ineligible(sb);
 		if (EXT4_SB(sb)->s_journal) {
 			jbd2_journal_lock_updates(EXT4_SB(sb)->s_journal);
 			err2 = jbd2_journal_flush(EXT4_SB(sb)->s_journal);
@@ -695,18 +695,40 @@ static void ext4_mb_mark_free_simple(struct super_block *sb,
 static void
 mb_set_largest_free_order(struct super_block *sb, struct ext4_group_info *grp)
 {
-	int i;
-	int bits;
-
-	grp->bb_largest_free_order = -1; /* uninit */
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int old = grp->bb_largest_free_order;
+	int i, new = -1;
 
-	bits = sb->s_blocksize_bits + 1;
-	for (i = bits; i >= 0; i--) {
+	for (i = MB_NUM_ORDERS(sb) - 1; i >= 0; i--) {
 		if (grp->bb_counters[i] > 0) {
-			grp->bb_largest_free_order = i;
+			new = i;
 			break;
 		}
 	}
+
+	if (new == old && !list_empty(&grp->bb_largest_free_order_node))
+		return;
+
+	/*
+	 * Keep the group on the list of its largest free order, so that
+	 * ext4_mb_scan_orders() can find it without a linear group scan.
+	 */
+	if (old >= 0 && !list_empty(&grp->bb_largest_free_order_node)) {
+		write_lock(&sbi->s_mb_largest_free_orders_locks[old]);
+		list_del_init(&grp->bb_largest_free_order_node);
+		sbi->s_mb_largest_free_orders_cnt[old]--;
+		write_unlock(&sbi->s_mb_largest_free_orders_locks[old]);
+	}
+
+	grp->bb_largest_free_order = new;
+
+	if (new >= 0) {
+		write_lock(&sbi->s_mb_largest_free_orders_locks[new]);
+		list_add_tail(&grp->bb_largest_free_order_node,
+			      &sbi->s_mb_largest_free_orders[new]);
+		sbi->s_mb_largest_free_orders_cnt[new]++;
+		write_unlock(&sbi->s_mb_largest_free_orders_locks[new]);
+	}
 }
 
 static noinline_for_stack
@@ -1668,10 +1690,10 @@ static void ext4_mb_use_best_found(struct ext4_allocation_context *ac,
 	get_page(ac->ac_buddy_page);
 	/* store last allocated for subsequent stream allocation */
 	if (ac->ac_flags & EXT4_MB_STREAM_ALLOC) {
-		spin_lock(&sbi->s_md_lock);
-		sbi->s_mb_last_group = ac->ac_f_ex.fe_group;
-		sbi->s_mb_last_start = ac->ac_f_ex.fe_start;
-		spin_unlock(&sbi->s_md_lock);
+		struct ext4_mb_stream_goal *goal = raw_cpu_ptr(sbi->s_mb_last);
+
+		WRITE_ONCE(goal->group, ac->ac_f_ex.fe_group);
+		WRITE_ONCE(goal->start, ac->ac_f_ex.fe_start);
 	}
 }
 
@@ -2110,6 +2132,132 @@ static int ext4_mb_good_group(struct ext4_allocation_context *ac,
 	return 0;
 }
 
+/*
+ * Try to allocate from @group with criteria @cr.  Returns an error only if
+ * the buddy could not be loaded; unsuitable groups are skipped, with the
+ * first error of ext4_mb_good_group() recorded in @first_err.
+ */
+static int ext4_mb_scan_group(struct ext4_allocation_context *ac,
+			      ext4_group_t group, int cr, int *first_err)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_buddy e4b;
+	int ret, err;
+
+	/* This now checks without needing the buddy page */
+	ret = ext4_mb_good_group(ac, group, cr);
+	if (ret <= 0) {
+		if (!*first_err)
+			*first_err = ret;
+		return 0;
+	}
+
+	err = ext4_mb_load_buddy(sb, group, &e4b);
+	if (err)
+		return err;
+
+	ext4_lock_group(sb, group);
+
+	/*
+	 * We need to check again after locking the
+	 * block group
+	 */
+	ret = ext4_mb_good_group(ac, group, cr);
+	if (ret <= 0) {
+		ext4_unlock_group(sb, group);
+		ext4_mb_unload_buddy(&e4b);
+		if (!*first_err)
+			*first_err = ret;
+		return 0;
+	}
+
+	ac->ac_groups_scanned++;
+	if (cr == 0)
+		ext4_mb_simple_scan_group(ac, &e4b);
+	else if (cr == 1 && sbi->s_stripe &&
+			!(ac->ac_g_ex.fe_len % sbi->s_stripe))
+		ext4_mb_scan_aligned(ac, &e4b);
+	else
+		ext4_mb_complex_scan_group(ac, &e4b);
+
+	ext4_unlock_group(sb, group);
+	ext4_mb_unload_buddy(&e4b);
+
+	return 0;
+}
+
+/*
+ * Pick up to MB_SCAN_BATCH groups from the list of groups whose largest
+ * free extent has @order.  Concurrent allocators start at different list
+ * positions so that they don't all contend on the lock of the first group.
+ */
+static int ext4_mb_collect_groups(struct super_block *sb, int order,
+				  ext4_group_t ngroups, ext4_group_t *groups)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct list_head *head = &sbi->s_mb_largest_free_orders[order];
+	struct ext4_group_info *grp;
+	unsigned int skip, cnt;
+	int n = 0;
+
+	if (list_empty_careful(head))
+		return 0;
+
+	read_lock(&sbi->s_mb_largest_free_orders_locks[order]);
+	cnt = min_t(unsigned int, sbi->s_mb_largest_free_orders_cnt[order],
+		    MB_SCAN_SHARDS);
+	skip = cnt ? raw_smp_processor_id() % cnt : 0;
+	list_for_each_entry(grp, head, bb_largest_free_order_node) {
+		if (skip) {
+			skip--;
+			continue;
+		}
+		if (grp->bb_group >= ngroups)
+			continue;
+		groups[n++] = grp->bb_group;
+		if (n == MB_SCAN_BATCH)
+			break;
+	}
+	read_unlock(&sbi->s_mb_largest_free_orders_locks[order]);
+
+	return n;
+}
+
+/*
+ * Criteria 0 and 1 need a free extent of at least a given order, so only
+ * groups on the largest free order lists of that order or above qualify.
+ * Groups whose buddy is not initialized yet are not on any list; they are
+ * picked up by the linear scan of the later criteria.
+ */
+static int ext4_mb_scan_orders(struct ext4_allocation_context *ac, int cr,
+			       ext4_group_t ngroups, int *first_err)
+{
+	struct super_block *sb = ac->ac_sb;
+	ext4_group_t groups[MB_SCAN_BATCH];
+	int order, n, i, err;
+
+	if (cr == 0)
+		order = ac->ac_2order;
+	else
+		order = min_t(int, order_base_2(ac->ac_g_ex.fe_len),
+			      MB_NUM_ORDERS(sb) - 1);
+
+	for (; order < MB_NUM_ORDERS(sb); order++) {
+		n = ext4_mb_collect_groups(sb, order, ngroups, groups);
+		for (i = 0; i < n; i++) {
+			cond_resched();
+			err = ext4_mb_scan_group(ac, groups[i], cr, first_err);
+			if (err)
+				return err;
+			if (ac->ac_status != AC_STATUS_CONTINUE)
+				return 0;
+		}
+	}
+
+	return 0;
+}
+
 static noinline_for_stack int
 ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 {
@@ -2162,11 +2310,10 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 
 	/* if stream allocation is enabled, use global goal */
 	if (ac->ac_flags & EXT4_MB_STREAM_ALLOC) {
-		/* TBD: may be hot point */
-		spin_lock(&sbi->s_md_lock);
-		ac->ac_g_ex.fe_group = sbi->s_mb_last_group;
-		ac->ac_g_ex.fe_start = sbi->s_mb_last_start;
-		spin_unlock(&sbi->s_md_lock);
+		struct ext4_mb_stream_goal *goal = raw_cpu_ptr(sbi->s_mb_last);
+
+		ac->ac_g_ex.fe_group = READ_ONCE(goal->group);
+		ac->ac_g_ex.fe_start = READ_ONCE(goal->start);
 	}
 
 	/* Let's just scan groups to find more-less suitable blocks */
@@ -2178,6 +2325,14 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 repeat:
 	for (; cr < 4 && ac->ac_status == AC_STATUS_CONTINUE; cr++) {
 		ac->ac_criteria = cr;
+
+		if (cr < 2 && READ_ONCE(sbi->s_mb_optimize_scan)) {
+			err = ext4_mb_scan_orders(ac, cr, ngroups, &first_err);
+			if (err)
+				goto out;
+			continue;
+		}
+
 		/*
 		 * searching for the right group start
 		 * from the goal value specified
@@ -2185,7 +2340,6 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 		group = ac->ac_g_ex.fe_group;
 
 		for (i = 0; i < ngroups; group++, i++) {
-			int ret = 0;
 			cond_resched();
 			/*
 			 * Artificially restricted ngroups for non-extent
@@ -2194,45 +2348,10 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 			if (group >= ngroups)
 				group = 0;
 
-			/* This now checks without needing the buddy page */
-			ret = ext4_mb_good_group(ac, group, cr);
-			if (ret <= 0) {
-				if (!first_err)
-					first_err = ret;
-				continue;
-			}
-
-			err = ext4_mb_load_buddy(sb, group, &e4b);
+			err = ext4_mb_scan_group(ac, group, cr, &first_err);
 			if (err)
 				goto out;
 
-			ext4_lock_group(sb, group);
-
-			/*
-			 * We need to check again after locking the
-			 * block group
-			 */
-			ret = ext4_mb_good_group(ac, group, cr);
-			if (ret <= 0) {
-				ext4_unlock_group(sb, group);
-				ext4_mb_unload_buddy(&e4b);
-				if (!first_err)
-					first_err = ret;
-				continue;
-			}
-
-			ac->ac_groups_scanned++;
-			if (cr == 0)
-				ext4_mb_simple_scan_group(ac, &e4b);
-			else if (cr == 1 && sbi->s_stripe &&
-					!(ac->ac_g_ex.fe_len % sbi->s_stripe))
-				ext4_mb_scan_aligned(ac, &e4b);
-			else
-				ext4_mb_complex_scan_group(ac, &e4b);
-
-			ext4_unlock_group(sb, group);
-			ext4_mb_unload_buddy(&e4b);
-
 			if (ac->ac_status != AC_STATUS_CONTINUE)
 				break;
 		}
@@ -2454,9 +2573,11 @@ int ext4_mb_add_groupinfo(struct super_block *sb, ext4_group_t group,
 	}
 
 	INIT_LIST_HEAD(&meta_group_info[i]->bb_prealloc_list);
+	INIT_LIST_HEAD(&meta_group_info[i]->bb_largest_free_order_node);
 	init_rwsem(&meta_group_info[i]->alloc_sem);
 	meta_group_info[i]->bb_free_root = RB_ROOT;
 	meta_group_info[i]->bb_largest_free_order = -1;  /* uninit */
+	meta_group_info[i]->bb_group = group;
 
 #ifdef DOUBLE_CHECK
 	{
@@ -2648,6 +2769,7 @@ int ext4_mb_init(struct super_block *sb)
 	sbi->s_mb_stats = MB_DEFAULT_STATS;
 	sbi->s_mb_stream_request = MB_DEFAULT_STREAM_THRESHOLD;
 	sbi->s_mb_order2_reqs = MB_DEFAULT_ORDER2_REQS;
+	sbi->s_mb_optimize_scan = MB_DEFAULT_OPTIMIZE_SCAN;
 	/*
 	 * The default group preallocation is 512, which for 4k block
 	 * sizes translates to 2 megabytes.  However for bigalloc file
@@ -2689,13 +2811,56 @@ int ext4_mb_init(struct super_block *sb)
 		spin_lock_init(&lg->lg_prealloc_lock);
 	}
 
+	/*
+	 * Start the stream allocations of every CPU in a different part of
+	 * the filesystem, so parallel streams don't contend on one group.
+	 */
+	sbi->s_mb_last = alloc_percpu(struct ext4_mb_stream_goal);
+	if (sbi->s_mb_last == NULL) {
+		ret = -ENOMEM;
+		goto out_free_locality_groups;
+	}
+	for_each_possible_cpu(i) {
+		struct ext4_mb_stream_goal *goal = per_cpu_ptr(sbi->s_mb_last, i);
+
+		goal->group = (u64)ext4_get_groups_count(sb) * i / nr_cpu_ids;
+		goal->start = 0;
+	}
+
+	i = MB_NUM_ORDERS(sb);
+	sbi->s_mb_largest_free_orders =
+		kmalloc_array(i, sizeof(struct list_head), GFP_KERNEL);
+	sbi->s_mb_largest_free_orders_locks =
+		kmalloc_array(i, sizeof(rwlock_t), GFP_KERNEL);
+	sbi->s_mb_largest_free_orders_cnt =
+		kcalloc(i, sizeof(unsigned int), GFP_KERNEL);
+	if (!sbi->s_mb_largest_free_orders ||
+	    !sbi->s_mb_largest_free_orders_locks ||
+	    !sbi->s_mb_largest_free_orders_cnt) {
+		ret = -ENOMEM;
+		goto out_free_orders;
+	}
+	for (i = 0; i < MB_NUM_ORDERS(sb); i++) {
+		INIT_LIST_HEAD(&sbi->s_mb_largest_free_orders[i]);
+		rwlock_init(&sbi->s_mb_largest_free_orders_locks[i]);
+	}
+
 	/* init file for buddy data */
 	ret = ext4_mb_init_backend(sb);
 	if (ret != 0)
-		goto out_free_locality_groups;
+		goto out_free_orders;
 
 	return 0;
 
+out_free_orders:
+	kfree(sbi->s_mb_largest_free_orders);
+	sbi->s_mb_largest_free_orders = NULL;
+	kfree(sbi->s_mb_largest_free_orders_locks);
+	sbi->s_mb_largest_free_orders_locks = NULL;
+	kfree(sbi->s_mb_largest_free_orders_cnt);
+	sbi->s_mb_largest_free_orders_cnt = NULL;
+	free_percpu(sbi->s_mb_last);
+	sbi->s_mb_last = NULL;
 out_free_locality_groups:
 	free_percpu(sbi->s_locality_groups);
 	sbi->s_locality_groups = NULL;
@@ -2758,6 +2923,9 @@ int ext4_mb_release(struct super_block *sb)
 	}
 	kfree(sbi->s_mb_offsets);
 	kfree(sbi->s_mb_maxs);
+	kfree(sbi->s_mb_largest_free_orders);
+	kfree(sbi->s_mb_largest_free_orders_locks);
+	kfree(sbi->s_mb_largest_free_orders_cnt);
 	iput(sbi->s_buddy_cache);
 	if (sbi->s_mb_stats) {
 		ext4_msg(sb, KERN_INFO,
@@ -2784,6 +2952,7 @@ int ext4_mb_release(struct super_block *sb)
 	}
 
 	free_percpu(sbi->s_locality_groups);
+	free_percpu(sbi->s_mb_last);
 
 	return 0;
 }
@@ -3067,6 +3236,144 @@ ext4_mb_mark_diskspace_used(struct ext4_allocation_context *ac,
 	return err;
 }
 
+/*
+ * Mark [block, block + len) used (state != 0) or free in the block bitmaps
+ * and group descriptors, outside of any transaction.  Only fast commit
+ * replay uses this: it runs while the journal is being loaded, before the
+ * buddy cache and the free cluster counters exist.  The counters are
+ * computed from the group descriptors once the mount goes on.
+ */
+int ext4_mb_mark_bb(struct super_block *sb, ext4_fsblk_t block,
+		    int len, int state)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct buffer_head *bitmap_bh, *gdp_bh;
+	struct ext4_group_desc *gdp;
+	ext4_group_t group;
+	ext4_grpblk_t blkoff;
+	int i, clen, thisgrp_len, already, free;
+	int err = 0;
+
+	while (len > 0) {
+		ext4_get_group_no_and_offset(sb, block, &group, &blkoff);
+		thisgrp_len = min_t(int, len, EXT4_BLOCKS_PER_GROUP(sb) -
+				    EXT4_C2B(sbi, blkoff));
+		clen = EXT4_NUM_B2C(sbi, thisgrp_len);
+
+		bitmap_bh = ext4_read_block_bitmap(sb, group);
+		if (IS_ERR(bitmap_bh))
+			return PTR_ERR(bitmap_bh);
+
+		gdp = ext4_get_group_desc(sb, group, &gdp_bh);
+		if (!gdp) {
+			brelse(bitmap_bh);
+			return -EIO;
+		}
+
+		ext4_lock_group(sb, group);
+		already = 0;
+		for (i = 0; i < clen; i++)
+			if (!mb_test_bit(blkoff + i, bitmap_bh->b_data) ==
+			    !state)
+				already++;
+		if (state)
+			ext4_set_bits(bitmap_bh->b_data, blkoff, clen);
+		else
+			mb_clear_bits(bitmap_bh->b_data, blkoff, clen);
+		if (ext4_has_group_desc_csum(sb) &&
+		    (gdp->bg_flags & cpu_to_le16(EXT4_BG_BLOCK_UNINIT))) {
+			gdp->bg_flags &= cpu_to_le16(~EXT4_BG_BLOCK_UNINIT);
+			ext4_free_group_clusters_set(sb, gdp,
+				ext4_free_clusters_after_init(sb, group, gdp));
+		}
+		free = ext4_free_group_clusters(sb, gdp);
+		if (state)
+			free -= clen - already;
+		else
+			free += clen - already;
+		ext4_free_group_clusters_set(sb, gdp, free);
+		ext4_block_bitmap_csum_set(sb, group, gdp, bitmap_bh);
+		ext4_group_desc_csum_set(sb, group, gdp);
+		ext4_unlock_group(sb, group);
+
+		err = ext4_handle_dirty_metadata(NULL, NULL, bitmap_bh);
+		if (!err)
+			err = ext4_handle_dirty_metadata(NULL, NULL, gdp_bh);
+		brelse(bitmap_bh);
+		if (err)
+			return err;
+
+		block += thisgrp_len;
+		len -= thisgrp_len;
+	}
+	return 0;
+}
+
+/*
+ * Single block allocator for fast commit replay: take the first free
+ * block at or after the goal that no fast commit being replayed refers to.
+ */
+static ext4_fsblk_t ext4_mb_new_blocks_simple(handle_t *handle,
+				struct ext4_allocation_request *ar, int *errp)
+{
+	struct super_block *sb = ar->inode->i_sb;
+	struct ext4_super_block *es = EXT4_SB(sb)->s_es;
+	ext4_grpblk_t max = EXT4_CLUSTERS_PER_GROUP(sb);
+	struct buffer_head *bitmap_bh;
+	ext4_group_t group, nr;
+	ext4_grpblk_t blkoff, i = max;
+	ext4_fsblk_t goal, block;
+
+	goal = ar->goal;
+	if (goal < le32_to_cpu(es->s_first_data_block) ||
+	    goal >= ext4_blocks_count(es))
+		goal = le32_to_cpu(es->s_first_data_block);
+
+	ar->len = 0;
+	ext4_get_group_no_and_offset(sb, goal, &group, NULL);
+	for (nr = ext4_get_groups_count(sb); nr > 0; nr--) {
+		bitmap_bh = ext4_read_block_bitmap(sb, group);
+		if (IS_ERR(bitmap_bh)) {
+			*errp = PTR_ERR(bitmap_bh);
+			return 0;
+		}
+
+		ext4_get_group_no_and_offset(sb,
+			max(ext4_group_first_block_no(sb, group), goal),
+			NULL, &blkoff);
+		while (1) {
+			i = mb_find_next_zero_bit(bitmap_bh->b_data, max,
+						  blkoff);
+			if (i >= max ||
+			    !ext4_fc_replay_check_excluded(sb,
+					ext4_group_first_block_no(sb, group) +
+					EXT4_C2B(EXT4_SB(sb), i)))
+				break;
+			blkoff = i + 1;
+		}
+		brelse(bitmap_bh);
+		if (i < max)
+			break;
+
+		if (++group >= ext4_get_groups_count(sb))
+			group = 0;
+	}
+
+	if (i >= max) {
+		*errp = -ENOSPC;
+		return 0;
+	}
+
+	block = ext4_group_first_block_no(sb, group) + EXT4_C2B(EXT4_SB(sb), i);
+	*errp = ext4_mb_mark_bb(sb, block, 1, 1);
+	if (*errp)
+		return 0;
+	dquot_alloc_block_nofail(ar->inode, 1);
+	ar->len = 1;
+
+	return block;
+}
+
 /*
  * here we normalize request for locality group
  * Group request are normalized to s_mb_group_prealloc, which goes to
@@ -4595,6 +4902,9 @@ ext4_fsblk_t ext4_mb_new_blocks(handle_t *handle,
 
 	trace_ext4_request_blocks(ar);
 
+	if (sbi->s_mount_state & EXT4_FC_REPLAY)
+		return ext4_mb_new_blocks_simple(handle, ar, errp);
+
 	/* Allow to use superuser reservation for quota file */
 	if (ext4_is_quota_file(ar->inode))
 		ar->flags |= EXT4_MB_USE_ROOT_BLOCKS;
@@ -4811,6 +5121,19 @@ ext4_mb_free_metadata(handle_t *handle, struct ext4_buddy *e4b,
 	return 0;
 }
 
+/*
+ * Free blocks during fast commit replay, see ext4_mb_mark_bb().  There is
+ * no transaction to defer the reuse of the blocks to.
+ */
+static void ext4_free_blocks_simple(struct inode *inode, ext4_fsblk_t block,
+				    unsigned long count, int flags)
+{
+	if (ext4_mb_mark_bb(inode->i_sb, block, count, 0))
+		return;
+	if (!(flags & EXT4_FREE_BLOCKS_NO_QUOT_UPDATE))
+		dquot_free_block(inode, count);
+}
+
 /**
  * ext4_free_blocks() -- Free given blocks and update quota
  * @handle:		handle for this transaction
@@ -4906,6 +5229,11 @@ void ext4_free_blocks(handle_t *handle, struct inode *inode,
 		}
 	}
 
+	if (sbi->s_mount_state & EXT4_FC_REPLAY) {
+		ext4_free_blocks_simple(inode, block, count, flags);
+		return;
+	}
+
 do_more:
 	overflow = 0;
 	ext4_get_group_no_and_offset(sb, block, &block_group, &bit);
@@ -77,6 +77,21 @@ do {									\
  */
 #define MB_DEFAULT_GROUP_PREALLOC	512
 
+/*
+ * use the largest free order lists instead of scanning all groups
+ * for the first two allocation criteria
+ */
+#define MB_DEFAULT_OPTIMIZE_SCAN	1
+
+/*
+ * number of groups picked from a largest free order list at once, and
+ * the number of list positions concurrent allocators are spread over
+ */
+#define MB_SCAN_BATCH			8
+#define MB_SCAN_SHARDS			64
+
+#define MB_NUM_ORDERS(sb)		((sb)->s_blocksize_bits + 2)
+
 
 struct ext4_free_data {
 	/* this links the free block information from sb_info */
@@ -145,6 +160,12 @@ struct ext4_locality_group {
 	spinlock_t		lg_prealloc_lock;
 };
 
+/* where the last stream allocation of a CPU was done */
+struct ext4_mb_stream_goal {
+	ext4_group_t		group;
+	ext4_grpblk_t		start;
+};
+
 struct ext4_allocation_context {
 	struct inode *ac_inode;
 	struct super_block *ac_sb;
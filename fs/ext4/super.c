@@ -1293,6 +1293,7 @@ static struct inode *ext4_alloc_inode(struct super_block *sb)
 	ei->i_sync_tid = 0;
 	ei->i_datasync_tid = 0;
 	atomic_set(&ei->i_unwritten, 0);
+	ext4_fc_init_inode(&ei->vfs_inode);
 	INIT_WORK(&ei->i_rsv_conversion_work, ext4_end_io_rsv_work);
 	return &ei->vfs_inode;
 }
@@ -4453,6 +4454,8 @@ static int ext4_fill_super(struct super_block *sb, void *data, int silent)
 	timer_setup(&sbi->s_err_report, print_daily_error_info, 0);
 	spin_lock_init(&sbi->s_error_lock);
 	INIT_WORK(&sbi->s_error_work, flush_stashed_error_work);
+	spin_lock_init(&sbi->s_fc_lock);
+	atomic_set(&sbi->s_fc_ineligible_updates, 0);
 
 	/* Register extent status tree shrinker */
 	if (ext4_es_register_shrinker(sbi))
@@ -4587,6 +4590,21 @@ static int ext4_fill_super(struct super_block *sb, void *data, int silent)
 		goto failed_mount_wq;
 	}
 
+	/*
+	 * Fast commits only log block mappings, so replay relies on ordered
+	 * data, and they don't know about clusters or quota.
+	 */
+	if (ext4_has_feature_fast_commit(sb) &&
+	    test_opt(sb, DATA_FLAGS) == EXT4_MOUNT_ORDERED_DATA &&
+	    !ext4_has_feature_bigalloc(sb) && !ext4_has_feature_quota(sb) &&
+	    !test_opt(sb, QUOTA) &&
+	    jbd2_journal_set_features(sbi->s_journal, 0, 0,
+				      JBD2_FEATURE_INCOMPAT_FAST_COMMIT)) {
+		set_opt2(sb, JOURNAL_FAST_COMMIT);
+		sbi->s_fc_ineligible_tid =
+			sbi->s_journal->j_transaction_sequence - 1;
+	}
+
 	set_task_ioprio(sbi->s_journal->j_task, journal_ioprio);
 
 no_journal:
@@ -5156,6 +5174,8 @@ static int ext4_load_journal(struct super_block *sb,
 	if (!(journal->j_flags & JBD2_BARRIER))
 		ext4_msg(sb, KERN_INFO, "barriers disabled");
 
+	ext4_fc_init(sb, journal);
+
 	if (!ext4_has_feature_journal_needs_recovery(sb))
 		err = jbd2_journal_wipe(journal, !really_read_only);
 	if (!err) {
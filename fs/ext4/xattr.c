@@ -2327,6 +2327,7 @@ ext4_xattr_set_handle(handle_t *handle, struct inode *inode, int name_index,
 	if (strlen(name) > 255)
 		return -ERANGE;
 
+	ext4_fc_mark_ineligible(inode->i_sb, EXT4_FC_REASON_XATTR, handle);
 	ext4_write_lock_xattr(inode, &no_expand);
 
 	/* Check journal credits under write lock. */
@@ -323,18 +323,61 @@ static unsigned len_args(unsigned numargs, struct fuse_arg *args)
 
 static u64 fuse_get_unique(struct fuse_iqueue *fiq)
 {
-	return ++fiq->reqctr;
+	fiq->reqctr += FUSE_IQ_UNIQUE_STEP;
+	return fiq->reqctr;
 }
 
 static void queue_request(struct fuse_iqueue *fiq, struct fuse_req *req)
 {
 	req->in.h.len = sizeof(struct fuse_in_header) +
 		len_args(req->in.numargs, (struct fuse_arg *) req->in.args);
+	req->iq = fiq;
 	list_add_tail(&req->list, &fiq->pending);
 	wake_up(&fiq->waitq);
 	kill_fasync(&fiq->fasync, SIGIO, POLL_IN);
 }
 
+/*
+ * Lock the input queue a new request goes to: the queue of the local CPU if
+ * a daemon thread has bound a device to it, fc->iq otherwise.
+ */
+static struct fuse_iqueue *fuse_lock_local_iq(struct fuse_conn *fc)
+{
+	struct fuse_iqueue __percpu *cpu_iqs = smp_load_acquire(&fc->cpu_iqs);
+	struct fuse_iqueue *fiq;
+
+	if (cpu_iqs) {
+		fiq = raw_cpu_ptr(cpu_iqs);
+		if (READ_ONCE(fiq->nr_readers)) {
+			spin_lock(&fiq->lock);
+			if (fiq->nr_readers)
+				return fiq;
+			spin_unlock(&fiq->lock);
+		}
+	}
+	fiq = &fc->iq;
+	spin_lock(&fiq->lock);
+	return fiq;
+}
+
+/*
+ * Lock the input queue a request was queued on.  req->iq only changes with
+ * both the old queue's and fc->iq's lock held, so recheck it once locked.
+ */
+static struct fuse_iqueue *fuse_lock_req_iq(struct fuse_conn *fc,
+					    struct fuse_req *req)
+{
+	struct fuse_iqueue *fiq;
+
+	for (;;) {
+		fiq = READ_ONCE(req->iq) ?: &fc->iq;
+		spin_lock(&fiq->lock);
+		if (fiq == (req->iq ?: &fc->iq))
+			return fiq;
+		spin_unlock(&fiq->lock);
+	}
+}
+
 void fuse_queue_forget(struct fuse_conn *fc, struct fuse_forget_link *forget,
 		       u64 nodeid, u64 nlookup)
 {
@@ -360,12 +403,12 @@ static void flush_bg_queue(struct fuse_conn *fc)
 	while (fc->active_background < fc->max_background &&
 	       !list_empty(&fc->bg_queue)) {
 		struct fuse_req *req;
-		struct fuse_iqueue *fiq = &fc->iq;
+		struct fuse_iqueue *fiq;
 
 		req = list_entry(fc->bg_queue.next, struct fuse_req, list);
 		list_del(&req->list);
 		fc->active_background++;
-		spin_lock(&fiq->lock);
+		fiq = fuse_lock_local_iq(fc);
 		req->in.h.unique = fuse_get_unique(fiq);
 		queue_request(fiq, req);
 		spin_unlock(&fiq->lock);
@@ -382,12 +425,12 @@ static void flush_bg_queue(struct fuse_conn *fc)
  */
 static void request_end(struct fuse_conn *fc, struct fuse_req *req)
 {
-	struct fuse_iqueue *fiq = &fc->iq;
+	struct fuse_iqueue *fiq;
 
 	if (test_and_set_bit(FR_FINISHED, &req->flags))
 		goto put_request;
 
-	spin_lock(&fiq->lock);
+	fiq = fuse_lock_req_iq(fc, req);
 	list_del_init(&req->intr_entry);
 	spin_unlock(&fiq->lock);
 	WARN_ON(test_bit(FR_PENDING, &req->flags));
@@ -425,13 +468,21 @@ static void request_end(struct fuse_conn *fc, struct fuse_req *req)
 	fuse_put_request(fc, req);
 }
 
-static void queue_interrupt(struct fuse_iqueue *fiq, struct fuse_req *req)
+static void queue_interrupt(struct fuse_conn *fc, struct fuse_req *req)
 {
-	spin_lock(&fiq->lock);
+	struct fuse_iqueue *fiq = fuse_lock_req_iq(fc, req);
+
 	if (test_bit(FR_FINISHED, &req->flags)) {
 		spin_unlock(&fiq->lock);
 		return;
 	}
+	if (fiq != &fc->iq && !fiq->nr_readers) {
+		/* Nobody reads the per-cpu queue any more */
+		spin_lock(&fc->iq.lock);
+		req->iq = &fc->iq;
+		spin_unlock(&fiq->lock);
+		fiq = &fc->iq;
+	}
 	if (list_empty(&req->intr_entry)) {
 		list_add_tail(&req->intr_entry, &fiq->interrupts);
 		wake_up(&fiq->waitq);
@@ -442,7 +493,7 @@ static void queue_interrupt(struct fuse_iqueue *fiq, struct fuse_req *req)
 
 static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
 {
-	struct fuse_iqueue *fiq = &fc->iq;
+	struct fuse_iqueue *fiq;
 	int err;
 
 	if (!fc->no_interrupt) {
@@ -456,7 +507,7 @@ static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
 		/* matches barrier in fuse_dev_do_read() */
 		smp_mb__after_atomic();
 		if (test_bit(FR_SENT, &req->flags))
-			queue_interrupt(fiq, req);
+			queue_interrupt(fc, req);
 	}
 
 	if (!test_bit(FR_FORCE, &req->flags)) {
@@ -466,7 +517,7 @@ static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
 		if (!err)
 			return;
 
-		spin_lock(&fiq->lock);
+		fiq = fuse_lock_req_iq(fc, req);
 		/* Request is not yet in userspace, bail out */
 		if (test_bit(FR_PENDING, &req->flags)) {
 			list_del(&req->list);
@@ -487,10 +538,10 @@ static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
 
 static void __fuse_request_send(struct fuse_conn *fc, struct fuse_req *req)
 {
-	struct fuse_iqueue *fiq = &fc->iq;
+	struct fuse_iqueue *fiq;
 
 	BUG_ON(test_bit(FR_BACKGROUND, &req->flags));
-	spin_lock(&fiq->lock);
+	fiq = fuse_lock_local_iq(fc);
 	if (!fiq->connected) {
 		spin_unlock(&fiq->lock);
 		req->out.h.error = -ENOTCONN;
@@ -1268,7 +1319,7 @@ static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
 {
 	ssize_t err;
 	struct fuse_conn *fc = fud->fc;
-	struct fuse_iqueue *fiq = &fc->iq;
+	struct fuse_iqueue *fiq = fud->iq ?: &fc->iq;
 	struct fuse_pqueue *fpq = &fud->pq;
 	struct fuse_req *req;
 	struct fuse_in *in;
@@ -1364,7 +1415,7 @@ static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
 	/* matches barrier in request_wait_answer() */
 	smp_mb__after_atomic();
 	if (test_bit(FR_INTERRUPTED, &req->flags))
-		queue_interrupt(fiq, req);
+		queue_interrupt(fc, req);
 	fuse_put_request(fc, req);
 
 	return reqsize;
@@ -1712,7 +1763,7 @@ static int fuse_retrieve(struct fuse_conn *fc, struct inode *inode,
 	unsigned int num;
 	unsigned int offset;
 	size_t total_len = 0;
-	int num_pages;
+	unsigned int num_pages;
 
 	offset = outarg->offset & ~PAGE_MASK;
 	file_size = i_size_read(inode);
@@ -1724,7 +1775,7 @@ static int fuse_retrieve(struct fuse_conn *fc, struct inode *inode,
 		num = file_size - outarg->offset;
 
 	num_pages = (num + offset + PAGE_SIZE - 1) >> PAGE_SHIFT;
-	num_pages = min(num_pages, FUSE_MAX_PAGES_PER_REQ);
+	num_pages = min(num_pages, fc->max_pages);
 
 	req = fuse_get_req(fc, num_pages);
 	if (IS_ERR(req))
@@ -1938,7 +1989,7 @@ static ssize_t fuse_dev_do_write(struct fuse_dev *fud,
 		if (oh.error == -ENOSYS)
 			fc->no_interrupt = 1;
 		else if (oh.error == -EAGAIN)
-			queue_interrupt(&fc->iq, req);
+			queue_interrupt(fc, req);
 		fuse_put_request(fc, req);
 
 		fuse_copy_finish(cs);
@@ -2091,7 +2142,7 @@ static __poll_t fuse_dev_poll(struct file *file, poll_table *wait)
 	if (!fud)
 		return EPOLLERR;
 
-	fiq = &fud->fc->iq;
+	fiq = fud->iq ?: &fud->fc->iq;
 	poll_wait(file, &fiq->waitq, wait);
 
 	spin_lock(&fiq->lock);
@@ -2200,6 +2251,20 @@ void fuse_abort_conn(struct fuse_conn *fc, bool is_abort)
 		wake_up_all(&fiq->waitq);
 		spin_unlock(&fiq->lock);
 		kill_fasync(&fiq->fasync, SIGIO, POLL_IN);
+		if (fc->cpu_iqs) {
+			int cpu;
+
+			for_each_possible_cpu(cpu) {
+				fiq = per_cpu_ptr(fc->cpu_iqs, cpu);
+				spin_lock(&fiq->lock);
+				fiq->connected = 0;
+				list_for_each_entry(req, &fiq->pending, list)
+					clear_bit(FR_PENDING, &req->flags);
+				list_splice_tail_init(&fiq->pending, &to_end);
+				wake_up_all(&fiq->waitq);
+				spin_unlock(&fiq->lock);
+			}
+		}
 		end_polls(fc);
 		wake_up_all(&fc->blocked_waitq);
 		spin_unlock(&fc->lock);
@@ -2218,6 +2283,42 @@ void fuse_wait_aborted(struct fuse_conn *fc)
 	wait_event(fc->blocked_waitq, atomic_read(&fc->num_waiting) == 0);
 }
 
+/*
+ * Drop the device's reader reference on its per-cpu queue.  Once the last
+ * reader is gone, new requests go to fc->iq and the queued ones are handed
+ * over to it.
+ */
+static void fuse_dev_unbind_queue(struct fuse_dev *fud)
+{
+	struct fuse_conn *fc = fud->fc;
+	struct fuse_iqueue *fiq = fud->iq;
+	struct fuse_req *req;
+	bool moved = false;
+
+	if (!fiq)
+		return;
+
+	spin_lock(&fiq->lock);
+	if (!--fiq->nr_readers &&
+	    (!list_empty(&fiq->pending) || !list_empty(&fiq->interrupts))) {
+		spin_lock(&fc->iq.lock);
+		list_for_each_entry(req, &fiq->pending, list)
+			req->iq = &fc->iq;
+		list_for_each_entry(req, &fiq->interrupts, intr_entry)
+			req->iq = &fc->iq;
+		list_splice_tail_init(&fiq->pending, &fc->iq.pending);
+		list_splice_tail_init(&fiq->interrupts, &fc->iq.interrupts);
+		wake_up_all(&fc->iq.waitq);
+		spin_unlock(&fc->iq.lock);
+		moved = true;
+	}
+	spin_unlock(&fiq->lock);
+	fud->iq = NULL;
+
+	if (moved)
+		kill_fasync(&fc->iq.fasync, SIGIO, POLL_IN);
+}
+
 int fuse_dev_release(struct inode *inode, struct file *file)
 {
 	struct fuse_dev *fud = fuse_get_dev(file);
@@ -2233,6 +2334,7 @@ int fuse_dev_release(struct inode *inode, struct file *file)
 		spin_unlock(&fpq->lock);
 
 		end_requests(fc, &to_end);
+		fuse_dev_unbind_queue(fud);
 
 		/* Are we the last open device? */
 		if (atomic_dec_and_test(&fc->dev_count)) {
@@ -2273,6 +2375,58 @@ static int fuse_device_clone(struct fuse_conn *fc, struct file *new)
 	return 0;
 }
 
+/*
+ * Bind the device to the input queue of @cpu, so that its readers get the
+ * requests issued on that CPU.  Requests are only queued per-cpu while the
+ * queue has readers; FORGETs, and requests from CPUs without a bound device,
+ * still go to the shared queue, so the daemon has to keep reading at least
+ * one unbound device.
+ */
+static int fuse_dev_bind_queue(struct fuse_dev *fud, unsigned int cpu)
+{
+	struct fuse_conn *fc = fud->fc;
+	struct fuse_iqueue __percpu *cpu_iqs = NULL;
+	struct fuse_iqueue *fiq;
+	int err = 0;
+	int i;
+
+	if (cpu >= nr_cpu_ids || !cpu_possible(cpu))
+		return -EINVAL;
+
+	if (!READ_ONCE(fc->cpu_iqs)) {
+		cpu_iqs = alloc_percpu(struct fuse_iqueue);
+		if (!cpu_iqs)
+			return -ENOMEM;
+		for_each_possible_cpu(i) {
+			fiq = per_cpu_ptr(cpu_iqs, i);
+			fuse_iqueue_init(fiq);
+			fiq->reqctr = i + 1;
+		}
+	}
+
+	spin_lock(&fc->lock);
+	if (!fc->connected) {
+		err = -ENODEV;
+	} else if (fud->iq) {
+		err = -EBUSY;
+	} else {
+		if (!fc->cpu_iqs) {
+			/* pairs with smp_load_acquire() in fuse_lock_local_iq() */
+			smp_store_release(&fc->cpu_iqs, cpu_iqs);
+			cpu_iqs = NULL;
+		}
+		fiq = per_cpu_ptr(fc->cpu_iqs, cpu);
+		spin_lock(&fiq->lock);
+		fiq->nr_readers++;
+		spin_unlock(&fiq->lock);
+		fud->iq = fiq;
+	}
+	spin_unlock(&fc->lock);
+
+	free_percpu(cpu_iqs);
+	return err;
+}
+
 static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
 			   unsigned long arg)
 {
@@ -2305,6 +2459,31 @@ static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
 				fput(old);
 			}
 		}
+	} else if (cmd == FUSE_DEV_IOC_BIND_QUEUE) {
+		struct fuse_dev *fud = fuse_get_dev(file);
+		__u32 cpu;
+
+		err = -EPERM;
+		if (fud) {
+			err = -EFAULT;
+			if (!get_user(cpu, (__u32 __user *) arg))
+				err = fuse_dev_bind_queue(fud, cpu);
+		}
+	} else if (cmd == FUSE_DEV_IOC_PASSTHROUGH_OPEN) {
+		struct fuse_dev *fud = fuse_get_dev(file);
+		struct fuse_passthrough_out pto;
+
+		err = -EPERM;
+		if (fud) {
+			err = -EFAULT;
+			if (!copy_from_user(&pto, (void __user *) arg,
+					    sizeof(pto))) {
+				err = -EINVAL;
+				if (!pto.flags)
+					err = fuse_passthrough_open(fud,
+								    pto.fd);
+			}
+		}
 	}
 	return err;
 }
@@ -28,8 +28,11 @@
 #include <linux/refcount.h>
 #include <linux/user_namespace.h>
 
-/** Max number of pages that can be used in a single read request */
-#define FUSE_MAX_PAGES_PER_REQ 32
+/** Default max number of pages that can be used in a single read request */
+#define FUSE_DEFAULT_MAX_PAGES_PER_REQ 32
+
+/** Maximum of max_pages received in init_out */
+#define FUSE_MAX_MAX_PAGES 256
 
 /** Bias for fi->writectr, meaning new writepages must not be sent */
 #define FUSE_NOWRITE INT_MIN
@@ -124,6 +127,12 @@ enum {
 
 struct fuse_conn;
 
+/** Backing file of a passthrough open */
+struct fuse_passthrough {
+	struct file *filp;
+	const struct cred *cred;
+};
+
 /** FUSE specific file data */
 struct fuse_file {
 	/** Fuse connection for this file */
@@ -158,6 +167,11 @@ struct fuse_file {
 
 	/** Has flock been performed on this file? */
 	bool flock:1;
+
+#ifndef __GENKSYMS__
+	/** Backing file for FOPEN_PASSTHROUGH opens */
+	struct fuse_passthrough passthrough;
+#endif
 };
 
 /** One input argument of a request */
@@ -389,6 +403,11 @@ struct fuse_req {
 
 	/** Request is stolen from fuse_file->reserved_req */
 	struct file *stolen_file;
+
+#ifndef __GENKSYMS__
+	/** Input queue the request was queued on, protected by its lock */
+	struct fuse_iqueue *iq;
+#endif
 };
 
 struct fuse_iqueue {
@@ -419,8 +438,20 @@ struct fuse_iqueue {
 
 	/** O_ASYNC requests */
 	struct fasync_struct *fasync;
+
+#ifndef __GENKSYMS__
+	/** Devices bound to this queue (per-cpu queues only) */
+	unsigned int nr_readers;
+#endif
 };
 
+/**
+ * Request ids are interleaved between the input queues of a connection:
+ * fc->iq hands out multiples of the step and the queue of CPU N ids that are
+ * N + 1 above a multiple, so ids stay unique without a shared counter.
+ */
+#define FUSE_IQ_UNIQUE_STEP	(nr_cpu_ids + 1)
+
 struct fuse_pqueue {
 	/** Connection established */
 	unsigned connected;
@@ -447,6 +478,11 @@ struct fuse_dev {
 
 	/** list entry on fc->devices */
 	struct list_head entry;
+
+#ifndef __GENKSYMS__
+	/** Per-cpu input queue this device reads, NULL for fc->iq */
+	struct fuse_iqueue *iq;
+#endif
 };
 
 /**
@@ -685,6 +721,23 @@ struct fuse_conn {
 
 	/** List of device instances belonging to this connection */
 	struct list_head devices;
+
+#ifndef __GENKSYMS__
+	/** Per-cpu input queues, allocated when a device first binds one */
+	struct fuse_iqueue __percpu *cpu_iqs;
+
+	/** Read/write/mmap may be passed through to a backing file */
+	unsigned passthrough:1;
+
+	/** Registered backing files not yet claimed by an open */
+	struct idr passthrough_req;
+
+	/** Protects passthrough_req */
+	spinlock_t passthrough_req_lock;
+
+	/** Maximum number of pages that can be used in a single request */
+	unsigned int max_pages;
+#endif
 };
 
 static inline struct fuse_conn *get_fuse_conn_super(struct super_block *sb)
@@ -764,6 +817,8 @@ int fuse_open_common(struct inode *inode, struct file *file, bool isdir);
 struct fuse_file *fuse_file_alloc(struct fuse_conn *fc);
 void fuse_file_free(struct fuse_file *ff);
 void fuse_finish_open(struct inode *inode, struct file *file);
+void fuse_file_setup_passthrough(struct fuse_conn *fc, struct fuse_file *ff,
+				 struct fuse_open_out *openarg);
 
 void fuse_sync_release(struct fuse_file *ff, int flags);
 
@@ -904,6 +959,11 @@ struct fuse_conn *fuse_conn_get(struct fuse_conn *fc);
  */
 void fuse_conn_init(struct fuse_conn *fc, struct user_namespace *user_ns);
 
+/**
+ * Initialize fuse_iqueue structure
+ */
+void fuse_iqueue_init(struct fuse_iqueue *fiq);
+
 /**
  * Release reference to fuse_conn
  */
@@ -1015,4 +1075,14 @@ struct posix_acl;
 struct posix_acl *fuse_get_acl(struct inode *inode, int type);
 int fuse_set_acl(struct inode *inode, struct posix_acl *acl, int type);
 
+/* passthrough.c */
+int fuse_passthrough_open(struct fuse_dev *fud, u32 fd);
+bool fuse_passthrough_setup(struct fuse_conn *fc, struct fuse_file *ff,
+			    struct fuse_open_out *openarg);
+void fuse_passthrough_release(struct fuse_passthrough *passthrough);
+void fuse_passthrough_free_all(struct fuse_conn *fc);
+ssize_t fuse_passthrough_read_iter(struct kiocb *iocb, struct iov_iter *iter);
+ssize_t fuse_passthrough_write_iter(struct kiocb *iocb, struct iov_iter *iter);
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma);
+
 #endif /* _FS_FUSE_I_H */
@@ -149,6 +149,7 @@ extern int invalidate_inodes(struct super_block *, bool);
 extern struct dentry *__d_alloc(struct super_block *, const struct qstr *);
 extern int d_set_mounted(struct dentry *dentry);
 extern long prune_dcache_sb(struct super_block *sb, struct shrink_control *sc);
+extern void trim_negative_dentries_workfn(struct work_struct *work);
 extern struct dentry *d_alloc_cursor(struct dentry *);
 
 /*
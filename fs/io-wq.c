@@ -63,6 +63,9 @@ struct io_worker {
 	const struct cred *saved_creds;
 	struct files_struct *restore_files;
 	struct fs_struct *restore_fs;
+
+	/* wqe->cpu_mask_seq when the affinity was last applied */
+	unsigned int cpu_mask_seq;
 };
 
 #if BITS_PER_LONG == 64
@@ -103,6 +106,10 @@ struct io_wqe {
 
 	struct io_wq *wq;
 	struct io_wq_work *hash_tail[IO_WQ_NR_HASH_BUCKETS];
+
+	/* worker affinity, protected by wq->affinity_lock */
+	cpumask_var_t cpu_mask;
+	unsigned int cpu_mask_seq;
 };
 
 /*
@@ -121,6 +128,8 @@ struct io_wq {
 	struct completion done;
 
 	refcount_t use_refs;
+
+	struct mutex affinity_lock;
 };
 
 static bool io_worker_get(struct io_worker *worker)
@@ -556,6 +565,20 @@ static void io_worker_handle_work(struct io_worker *worker)
 	} while (1);
 }
 
+/*
+ * Workers apply affinity changes themselves, new workers pick up the
+ * current mask on start as their cpu_mask_seq is always behind.
+ */
+static void io_worker_update_affinity(struct io_worker *worker)
+{
+	struct io_wqe *wqe = worker->wqe;
+
+	mutex_lock(&wqe->wq->affinity_lock);
+	worker->cpu_mask_seq = wqe->cpu_mask_seq;
+	set_cpus_allowed_ptr(current, wqe->cpu_mask);
+	mutex_unlock(&wqe->wq->affinity_lock);
+}
+
 static int io_wqe_worker(void *data)
 {
 	struct io_worker *worker = data;
@@ -565,6 +588,8 @@ static int io_wqe_worker(void *data)
 	io_worker_start(wqe, worker);
 
 	while (!test_bit(IO_WQ_BIT_EXIT, &wq->state)) {
+		if (unlikely(worker->cpu_mask_seq != READ_ONCE(wqe->cpu_mask_seq)))
+			io_worker_update_affinity(worker);
 		set_current_state(TASK_INTERRUPTIBLE);
 loop:
 		spin_lock_irq(&wqe->lock);
@@ -1046,6 +1071,13 @@ enum io_wq_cancel io_wq_cancel_work(struct io_wq *wq, struct io_wq_work *cwork)
 	return io_wq_cancel_cb(wq, io_wq_io_cb_cancel_data, (void *)cwork, false);
 }
 
+static const struct cpumask *io_wqe_node_mask(struct io_wqe *wqe)
+{
+	if (wqe->node == NUMA_NO_NODE)
+		return cpu_possible_mask;
+	return cpumask_of_node(wqe->node);
+}
+
 struct io_wq *io_wq_create(unsigned bounded, struct io_wq_data *data)
 {
 	int ret = -ENOMEM, node;
@@ -1071,6 +1103,7 @@ struct io_wq *io_wq_create(unsigned bounded, struct io_wq_data *data)
 
 	/* caller must already hold a reference to this */
 	wq->user = data->user;
+	mutex_init(&wq->affinity_lock);
 
 	for_each_node(node) {
 		struct io_wqe *wqe;
@@ -1083,6 +1116,10 @@ struct io_wq *io_wq_create(unsigned bounded, struct io_wq_data *data)
 			goto err;
 		wq->wqes[node] = wqe;
 		wqe->node = alloc_node;
+		if (!alloc_cpumask_var(&wqe->cpu_mask, GFP_KERNEL))
+			goto err;
+		cpumask_copy(wqe->cpu_mask, io_wqe_node_mask(wqe));
+		wqe->cpu_mask_seq = 1;
 		wqe->acct[IO_WQ_ACCT_BOUND].max_workers = bounded;
 		atomic_set(&wqe->acct[IO_WQ_ACCT_BOUND].nr_running, 0);
 		if (wq->user) {
@@ -1115,8 +1152,12 @@ struct io_wq *io_wq_create(unsigned bounded, struct io_wq_data *data)
 	ret = PTR_ERR(wq->manager);
 	complete(&wq->done);
 err:
-	for_each_node(node)
+	for_each_node(node) {
+		if (!wq->wqes[node])
+			continue;
+		free_cpumask_var(wq->wqes[node]->cpu_mask);
 		kfree(wq->wqes[node]);
+	}
 	kfree(wq->wqes);
 	kfree(wq);
 	return ERR_PTR(ret);
@@ -1145,8 +1186,10 @@ static void __io_wq_destroy(struct io_wq *wq)
 
 	wait_for_completion(&wq->done);
 
-	for_each_node(node)
+	for_each_node(node) {
+		free_cpumask_var(wq->wqes[node]->cpu_mask);
 		kfree(wq->wqes[node]);
+	}
 	kfree(wq->wqes);
 	kfree(wq);
 }
@@ -1161,3 +1204,67 @@ struct task_struct *io_wq_get_task(struct io_wq *wq)
 {
 	return wq->manager;
 }
+
+/*
+ * Restrict the workers (and the manager) of @wq to @mask, or reset them to
+ * their node's CPUs if @mask is NULL. Running workers migrate the next time
+ * they look for work.
+ */
+int io_wq_cpu_affinity(struct io_wq *wq, cpumask_var_t mask)
+{
+	int node;
+
+	mutex_lock(&wq->affinity_lock);
+	for_each_node(node) {
+		struct io_wqe *wqe = wq->wqes[node];
+
+		if (mask)
+			cpumask_copy(wqe->cpu_mask, mask);
+		else
+			cpumask_copy(wqe->cpu_mask, io_wqe_node_mask(wqe));
+		WRITE_ONCE(wqe->cpu_mask_seq, wqe->cpu_mask_seq + 1);
+	}
+	set_cpus_allowed_ptr(wq->manager, mask ? mask : cpu_possible_mask);
+	mutex_unlock(&wq->affinity_lock);
+
+	rcu_read_lock();
+	for_each_node(node)
+		io_wq_for_each_worker(wq->wqes[node], io_wq_worker_wake, NULL);
+	rcu_read_unlock();
+	return 0;
+}
+
+/*
+ * Set the max number of bounded and unbounded workers per node, a zero
+ * count leaves that limit alone. The previous limits are returned in
+ * @new_count. Workers above a lowered limit exit once they go idle.
+ */
+int io_wq_max_workers(struct io_wq *wq, unsigned int *new_count)
+{
+	unsigned int prev[2] = { 0, 0 };
+	int i, node;
+
+	BUILD_BUG_ON((int) IO_WQ_ACCT_BOUND   != 0);
+	BUILD_BUG_ON((int) IO_WQ_ACCT_UNBOUND != 1);
+
+	for (i = 0; i < 2; i++) {
+		if (new_count[i] > task_rlimit(current, RLIMIT_NPROC))
+			new_count[i] = task_rlimit(current, RLIMIT_NPROC);
+	}
+
+	for_each_node(node) {
+		struct io_wqe *wqe = wq->wqes[node];
+
+		spin_lock_irq(&wqe->lock);
+		for (i = 0; i < 2; i++) {
+			prev[i] = max(prev[i], wqe->acct[i].max_workers);
+			if (new_count[i])
+				wqe->acct[i].max_workers = new_count[i];
+		}
+		spin_unlock_irq(&wqe->lock);
+	}
+
+	for (i = 0; i < 2; i++)
+		new_count[i] = prev[i];
+	return 0;
+}
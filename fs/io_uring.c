@@ -79,6 +79,8 @@
 #include <linux/fs_struct.h>
 #include <linux/splice.h>
 #include <linux/task_work.h>
+#include <linux/pagemap.h>
+#include <linux/io_uring.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/io_uring.h>
@@ -220,6 +222,37 @@ struct io_buffer {
 	__u16 bid;
 };
 
+/* Rings a task can register with IORING_REGISTER_RING_FDS */
+#define IO_RINGFD_REG_MAX	16
+
+/* freed requests kept around per ring for the next submit/iopoll batch */
+#define IO_REQ_CACHE_SIZE	32
+
+struct io_uring_ringfd {
+	struct file		*file;
+	/* fd the ring was registered from */
+	int			fd;
+};
+
+/*
+ * The SQPOLL thread, shared by all the rings set up with
+ * IORING_SETUP_ATTACH_WQ to a ring that has one.
+ */
+struct io_sq_data {
+	refcount_t		refs;
+	/* serializes parking the thread */
+	struct mutex		lock;
+
+	/* rings served by the thread, only changed while it is parked */
+	struct list_head	ctx_list;
+	/* rings waiting for the thread to pick them up */
+	struct list_head	ctx_new_list;
+	struct mutex		ctx_lock;
+
+	struct task_struct	*thread;
+	struct wait_queue_head	wait;
+};
+
 struct io_ring_ctx {
 	struct {
 		struct percpu_ref	refs;
@@ -249,6 +282,9 @@ struct io_ring_ctx {
 		unsigned		sq_entries;
 		unsigned		sq_mask;
 		unsigned		sq_thread_idle;
+		/* jiffies until which the SQPOLL thread spins for this ring */
+		unsigned long		sq_idle_timeout;
+		bool			sq_busy;
 		unsigned		cached_sq_dropped;
 		atomic_t		cached_cq_overflow;
 		unsigned long		sq_check_overflow;
@@ -265,7 +301,9 @@ struct io_ring_ctx {
 
 	/* IO offload */
 	struct io_wq		*io_wq;
-	struct task_struct	*sqo_thread;	/* if using sq thread polling */
+	/* if using sq thread polling */
+	struct io_sq_data	*sq_data;
+	struct list_head	sqd_list;
 
 	/*
 	 * For SQPOLL usage - we hold a reference to the parent task, so we
@@ -276,8 +314,6 @@ struct io_ring_ctx {
 	/* Only used for accounting purposes */
 	struct mm_struct	*mm_account;
 
-	wait_queue_head_t	sqo_wait;
-
 	/*
 	 * If used, fixed file set. Writers must ensure that ->refs is dead,
 	 * readers must ensure that ->refs is alive as long as the file* is
@@ -325,6 +361,10 @@ struct io_ring_ctx {
 	struct {
 		struct mutex		uring_lock;
 		wait_queue_head_t	wait;
+
+		/* io_kiocb cache, protected by ->uring_lock */
+		unsigned int		nr_cached_reqs;
+		void			*cached_reqs[IO_REQ_CACHE_SIZE];
 	} ____cacheline_aligned_in_smp;
 
 	struct {
@@ -384,6 +424,7 @@ struct io_accept {
 	struct sockaddr __user		*addr;
 	int __user			*addr_len;
 	int				flags;
+	u32				file_slot;
 	unsigned long			nofile;
 };
 
@@ -431,7 +472,18 @@ struct io_sr_msg {
 	int				msg_flags;
 	int				bgid;
 	size_t				len;
+	/* length asked for by the sqe, for each multishot recv */
+	size_t				mshot_len;
 	struct io_buffer		*kbuf;
+	/* IORING_OP_SEND_ZC */
+	unsigned int			zc_flags;
+	struct io_kiocb			*notif;
+};
+
+/* "buffer released" CQE of IORING_OP_SEND_ZC, posted as its own request */
+struct io_notif {
+	struct file			*file;
+	struct ubuf_info_managed	ubuf;
 };
 
 struct io_open {
@@ -442,6 +494,7 @@ struct io_open {
 	};
 	struct filename			*filename;
 	int				flags;
+	u32				file_slot;
 	unsigned long			nofile;
 };
 
@@ -524,6 +577,7 @@ struct io_async_rw {
 	struct iovec			*iov;
 	ssize_t				nr_segs;
 	ssize_t				size;
+	struct wait_page_queue		wpq;
 };
 
 struct io_async_ctx {
@@ -557,6 +611,7 @@ enum {
 	REQ_F_NO_FILE_TABLE_BIT,
 	REQ_F_WORK_INITIALIZED_BIT,
 	REQ_F_TASK_PINNED_BIT,
+	REQ_F_APOLL_MULTISHOT_BIT,
 
 	/* not a real bit, just to check we're not overflowing the space */
 	__REQ_F_LAST_BIT,
@@ -604,6 +659,8 @@ enum {
 	REQ_F_WORK_INITIALIZED	= BIT(REQ_F_WORK_INITIALIZED_BIT),
 	/* req->task is refcounted */
 	REQ_F_TASK_PINNED	= BIT(REQ_F_TASK_PINNED_BIT),
+	/* posts a CQE per poll driven retry, IORING_*_MULTISHOT */
+	REQ_F_APOLL_MULTISHOT	= BIT(REQ_F_APOLL_MULTISHOT_BIT),
 };
 
 struct async_poll {
@@ -637,6 +694,7 @@ struct io_kiocb {
 		struct io_splice	splice;
 		struct io_provide_buf	pbuf;
 		struct io_statx		statx;
+		struct io_notif		notif;
 		/* use only after cleaning per-op data, see io_clean_op() */
 		struct io_completion	compl;
 	};
@@ -890,6 +948,12 @@ static const struct io_op_def io_op_defs[] = {
 		.hash_reg_file		= 1,
 		.unbound_nonreg_file	= 1,
 	},
+	[IORING_OP_SEND_ZC] = {
+		.needs_mm		= 1,
+		.needs_file		= 1,
+		.unbound_nonreg_file	= 1,
+		.pollout		= 1,
+	},
 };
 
 enum io_mem_account {
@@ -907,6 +971,8 @@ static void io_queue_linked_timeout(struct io_kiocb *req);
 static int __io_sqe_files_update(struct io_ring_ctx *ctx,
 				 struct io_uring_files_update *ip,
 				 unsigned nr_args);
+static int io_install_fixed_file(struct io_kiocb *req, struct file *file,
+				 u32 slot_index, bool needs_lock);
 static int io_prep_work_files(struct io_kiocb *req);
 static void io_complete_rw_common(struct kiocb *kiocb, long res,
 				  struct io_comp_state *cs);
@@ -1126,7 +1192,6 @@ static struct io_ring_ctx *io_ring_ctx_alloc(struct io_uring_params *p)
 		goto err;
 
 	ctx->flags = p->flags;
-	init_waitqueue_head(&ctx->sqo_wait);
 	init_waitqueue_head(&ctx->cq_wait);
 	INIT_LIST_HEAD(&ctx->cq_overflow_list);
 	init_completion(&ctx->ref_comp);
@@ -1408,8 +1473,8 @@ static void io_cqring_ev_posted(struct io_ring_ctx *ctx)
 {
 	if (waitqueue_active(&ctx->wait))
 		wake_up(&ctx->wait);
-	if (waitqueue_active(&ctx->sqo_wait))
-		wake_up(&ctx->sqo_wait);
+	if (ctx->sq_data && waitqueue_active(&ctx->sq_data->wait))
+		wake_up(&ctx->sq_data->wait);
 	if (io_should_trigger_evfd(ctx))
 		eventfd_signal(ctx->cq_ev_fd, 1);
 }
@@ -1532,6 +1597,45 @@ static void io_cqring_add_event(struct io_kiocb *req, long res, long cflags)
 	io_cqring_ev_posted(ctx);
 }
 
+/*
+ * Post a CQE flagged IORING_CQE_F_MORE for a multishot request that stays
+ * armed. Returns false if the CQ ring has no room left, the caller then
+ * completes the request, which ends the multishot.
+ */
+static bool io_fill_multishot_event(struct io_kiocb *req, long res,
+				    unsigned int cflags)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct io_uring_cqe *cqe = NULL;
+
+	spin_lock_irq(&ctx->completion_lock);
+	if (list_empty(&ctx->cq_overflow_list))
+		cqe = io_get_cqring(ctx);
+	if (cqe) {
+		trace_io_uring_complete(ctx, req->user_data, res);
+		WRITE_ONCE(cqe->user_data, req->user_data);
+		WRITE_ONCE(cqe->res, res);
+		WRITE_ONCE(cqe->flags, cflags | IORING_CQE_F_MORE);
+		io_commit_cqring(ctx);
+	}
+	spin_unlock_irq(&ctx->completion_lock);
+
+	if (!cqe)
+		return false;
+	io_cqring_ev_posted(ctx);
+	return true;
+}
+
+/*
+ * Wait for the next shot of a multishot request through the poll handler,
+ * which re-issues it on the next event.
+ */
+static int io_multishot_rearm(struct io_kiocb *req)
+{
+	req->flags &= ~REQ_F_POLLED;
+	return -EAGAIN;
+}
+
 static void io_submit_flush_completions(struct io_comp_state *cs)
 {
 	struct io_ring_ctx *ctx = cs->ctx;
@@ -1612,7 +1716,16 @@ static struct io_kiocb *io_alloc_req(struct io_ring_ctx *ctx,
 		int ret;
 
 		sz = min_t(size_t, state->ios_left, ARRAY_SIZE(state->reqs));
-		ret = kmem_cache_alloc_bulk(req_cachep, gfp, sz, state->reqs);
+		if (ctx->nr_cached_reqs) {
+			ret = min_t(unsigned int, sz, ctx->nr_cached_reqs);
+			ctx->nr_cached_reqs -= ret;
+			memcpy(state->reqs,
+			       &ctx->cached_reqs[ctx->nr_cached_reqs],
+			       ret * sizeof(void *));
+		} else {
+			ret = kmem_cache_alloc_bulk(req_cachep, gfp, sz,
+						    state->reqs);
+		}
 
 		/*
 		 * Bulk alloc is all-or-nothing. If we fail to get a batch,
@@ -1969,10 +2082,28 @@ static inline void io_init_req_batch(struct req_batch *rb)
 	rb->task = NULL;
 }
 
+/*
+ * Stash dismantled requests in the ring cache for the next submission and
+ * free what doesn't fit. Must be called with ->uring_lock held.
+ */
+static void io_req_cache_put(struct io_ring_ctx *ctx, void **reqs,
+			     unsigned int nr)
+{
+	unsigned int cached;
+
+	cached = min(nr, IO_REQ_CACHE_SIZE - ctx->nr_cached_reqs);
+	nr -= cached;
+	memcpy(&ctx->cached_reqs[ctx->nr_cached_reqs], &reqs[nr],
+	       cached * sizeof(void *));
+	ctx->nr_cached_reqs += cached;
+	if (nr)
+		kmem_cache_free_bulk(req_cachep, nr, reqs);
+}
+
 static void __io_req_free_batch_flush(struct io_ring_ctx *ctx,
 				      struct req_batch *rb)
 {
-	kmem_cache_free_bulk(req_cachep, rb->to_free, rb->reqs);
+	io_req_cache_put(ctx, rb->reqs, rb->to_free);
 	percpu_ref_put_many(&ctx->refs, rb->to_free);
 	rb->to_free = 0;
 }
@@ -2521,8 +2652,8 @@ static void io_iopoll_req_issued(struct io_kiocb *req)
 		list_add_tail(&req->inflight_entry, &ctx->iopoll_list);
 
 	if ((ctx->flags & IORING_SETUP_SQPOLL) &&
-	    wq_has_sleeper(&ctx->sqo_wait))
-		wake_up(&ctx->sqo_wait);
+	    wq_has_sleeper(&ctx->sq_data->wait))
+		wake_up(&ctx->sq_data->wait);
 }
 
 static void __io_state_file_put(struct io_submit_state *state)
@@ -2689,15 +2820,14 @@ static void kiocb_done(struct kiocb *kiocb, ssize_t ret,
 		io_rw_done(kiocb, ret);
 }
 
-static ssize_t io_import_fixed(struct io_kiocb *req, int rw,
-			       struct iov_iter *iter)
+static ssize_t __io_import_fixed(struct io_kiocb *req, int rw,
+				 struct iov_iter *iter, u64 buf_addr,
+				 size_t len)
 {
 	struct io_ring_ctx *ctx = req->ctx;
-	size_t len = req->rw.len;
 	struct io_mapped_ubuf *imu;
 	u16 index, buf_index;
 	size_t offset;
-	u64 buf_addr;
 
 	/* attempt to use fixed buffers without having provided iovecs */
 	if (unlikely(!ctx->user_bufs))
@@ -2709,7 +2839,6 @@ static ssize_t io_import_fixed(struct io_kiocb *req, int rw,
 
 	index = array_index_nospec(buf_index, ctx->nr_user_bufs);
 	imu = &ctx->user_bufs[index];
-	buf_addr = req->rw.addr;
 
 	/* overflow */
 	if (buf_addr + len < buf_addr)
@@ -2763,6 +2892,12 @@ static ssize_t io_import_fixed(struct io_kiocb *req, int rw,
 	return len;
 }
 
+static ssize_t io_import_fixed(struct io_kiocb *req, int rw,
+			       struct iov_iter *iter)
+{
+	return __io_import_fixed(req, rw, iter, req->rw.addr, req->rw.len);
+}
+
 static void io_ring_submit_unlock(struct io_ring_ctx *ctx, bool needs_lock)
 {
 	if (needs_lock)
@@ -3106,6 +3241,97 @@ static int io_read_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe,
 	return io_rw_prep_async(req, READ, force_nonblock);
 }
 
+static int io_async_buf_func(struct wait_queue_entry *wait, unsigned mode,
+			     int sync, void *arg)
+{
+	struct wait_page_queue *wpq;
+	struct io_kiocb *req = wait->private;
+	struct wait_page_key *key = arg;
+	int ret;
+
+	wpq = container_of(wait, struct wait_page_queue, wait);
+
+	if (!wake_page_match(wpq, key))
+		return 0;
+
+	req->rw.kiocb.ki_flags &= ~IOCB_WAITQ;
+	list_del_init(&wait->entry);
+
+	init_task_work(&req->task_work, io_req_task_submit);
+	percpu_ref_get(&req->ctx->refs);
+
+	/* submit ref gets dropped, acquire a new one */
+	refcount_inc(&req->refs);
+	ret = io_req_task_work_add(req, &req->task_work, true);
+	if (unlikely(ret)) {
+		struct task_struct *tsk;
+
+		/* queue just for cancelation */
+		init_task_work(&req->task_work, io_req_task_cancel);
+		tsk = io_wq_get_task(req->ctx->io_wq);
+		task_work_add(tsk, &req->task_work, 0);
+		wake_up_process(tsk);
+	}
+	return 1;
+}
+
+/*
+ * This controls whether a given IO request should be armed for async page
+ * based retry. If we return false here, the request is handed to the async
+ * worker threads for retry. If we're doing buffered reads on a regular file,
+ * we prepare a private wait_page_queue entry and retry the operation. This
+ * will either succeed because the page is now uptodate and unlocked, or it
+ * will register a callback when the page is unlocked at IO completion. Through
+ * that callback, io_uring uses task_work to setup a retry of the operation.
+ * That retry will attempt the buffered read again. The retry will generally
+ * succeed, or in rare cases where it fails, we then fall back to using the
+ * async worker threads for a blocking retry.
+ */
+static bool io_rw_should_retry(struct io_kiocb *req)
+{
+	struct kiocb *kiocb = &req->rw.kiocb;
+	struct wait_page_queue *wait;
+
+	/* never retry for NOWAIT, we just complete with -EAGAIN */
+	if (req->flags & REQ_F_NOWAIT)
+		return false;
+
+	/* Only for buffered IO */
+	if (kiocb->ki_flags & (IOCB_DIRECT | IOCB_HIPRI))
+		return false;
+
+	/*
+	 * just use poll if we can, and don't attempt if the fs doesn't
+	 * support callback based unlocks
+	 */
+	if (file_can_poll(req->file) || !(req->file->f_mode & FMODE_BUF_RASYNC))
+		return false;
+
+	/* non-vectored reads don't carry ->io otherwise, only for the waitq */
+	if (!req->io && __io_alloc_async_ctx(req))
+		return false;
+
+	wait = &req->io->rw.wpq;
+	wait->wait.func = io_async_buf_func;
+	wait->wait.private = req;
+	wait->wait.flags = 0;
+	INIT_LIST_HEAD(&wait->wait.entry);
+	kiocb->ki_flags |= IOCB_WAITQ;
+	kiocb->ki_flags &= ~IOCB_NOWAIT;
+	kiocb->ki_waitq = wait;
+	return true;
+}
+
+static ssize_t io_iter_do_read(struct io_kiocb *req, struct iov_iter *iter)
+{
+	if (req->file->f_op->read_iter)
+		return call_read_iter(req->file, &req->rw.kiocb, iter);
+	else if (req->file->f_op->read)
+		return loop_rw_iter(READ, req->file, &req->rw.kiocb, iter);
+	else
+		return -EINVAL;
+}
+
 static int io_read(struct io_kiocb *req, bool force_nonblock,
 		   struct io_comp_state *cs)
 {
@@ -3123,6 +3349,8 @@ static int io_read(struct io_kiocb *req, bool force_nonblock,
 	/* Ensure we clear previously set non-block flag */
 	if (!force_nonblock)
 		kiocb->ki_flags &= ~IOCB_NOWAIT;
+	else
+		kiocb->ki_flags |= IOCB_NOWAIT;
 
 	io_size = ret;
 	req->result = io_size;
@@ -3136,12 +3364,7 @@ static int io_read(struct io_kiocb *req, bool force_nonblock,
 		unsigned long nr_segs = iter.nr_segs;
 		ssize_t ret2;
 
-		if (req->file->f_op->read_iter)
-			ret2 = call_read_iter(req->file, kiocb, &iter);
-		else if (req->file->f_op->read)
-			ret2 = loop_rw_iter(READ, req->file, kiocb, &iter);
-		else
-			ret2 = -EINVAL;
+		ret2 = io_iter_do_read(req, &iter);
 
 		/* Catch -EAGAIN return for forced non-blocking submission */
 		if (!force_nonblock || ret2 != -EAGAIN) {
@@ -3160,6 +3383,17 @@ static int io_read(struct io_kiocb *req, bool force_nonblock,
 				goto out_free;
 			/* it's copied and will be cleaned with ->io */
 			iovec = NULL;
+			/* if we can retry, do so with the callbacks armed */
+			if (io_rw_should_retry(req)) {
+				ret2 = io_iter_do_read(req, &iter);
+				if (ret2 == -EIOCBQUEUED) {
+					goto out_free;
+				} else if (ret2 != -EAGAIN) {
+					kiocb_done(kiocb, ret2, cs);
+					goto out_free;
+				}
+			}
+			kiocb->ki_flags &= ~IOCB_WAITQ;
 			return -EAGAIN;
 		}
 	}
@@ -3481,6 +3715,11 @@ static int io_openat_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 	if (force_o_largefile())
 		req->open.flags |= O_LARGEFILE;
 
+	/* a registered file has no fd to close on exec */
+	req->open.file_slot = READ_ONCE(sqe->file_index);
+	if (req->open.file_slot && (req->open.flags & O_CLOEXEC))
+		return -EINVAL;
+
 	req->open.filename = getname(fname);
 	if (IS_ERR(req->open.filename)) {
 		ret = PTR_ERR(req->open.filename);
@@ -3495,6 +3734,7 @@ static int io_openat_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 
 static int io_openat(struct io_kiocb *req, bool force_nonblock)
 {
+	bool fixed = !!req->open.file_slot;
 	struct open_flags op;
 	struct file *file;
 	int ret;
@@ -3506,17 +3746,25 @@ static int io_openat(struct io_kiocb *req, bool force_nonblock)
 	if (ret)
 		goto err;
 
-	ret = __get_unused_fd_flags(req->open.flags, req->open.nofile);
-	if (ret < 0)
-		goto err;
+	if (!fixed) {
+		ret = __get_unused_fd_flags(req->open.flags, req->open.nofile);
+		if (ret < 0)
+			goto err;
+	}
 
 	file = do_filp_open(req->open.dfd, req->open.filename, &op);
 	if (IS_ERR(file)) {
-		put_unused_fd(ret);
+		if (!fixed)
+			put_unused_fd(ret);
 		ret = PTR_ERR(file);
 	} else {
 		fsnotify_open(file);
-		fd_install(ret, file);
+		if (fixed)
+			ret = io_install_fixed_file(req, file,
+						    req->open.file_slot - 1,
+						    !force_nonblock);
+		else
+			fd_install(ret, file);
 	}
 err:
 	putname(req->open.filename);
@@ -4087,6 +4335,7 @@ static int io_send(struct io_kiocb *req, bool force_nonblock,
 	msg.msg_control = NULL;
 	msg.msg_controllen = 0;
 	msg.msg_namelen = 0;
+	msg.msg_ubuf = NULL;
 
 	flags = req->sr_msg.msg_flags;
 	if (flags & MSG_DONTWAIT)
@@ -4107,6 +4356,166 @@ static int io_send(struct io_kiocb *req, bool force_nonblock,
 	return 0;
 }
 
+/*
+ * Called once the network stack dropped the last reference to the pages
+ * of a zerocopy send, from whatever context freed the skb.
+ */
+static void io_notif_complete(struct ubuf_info_managed *ubuf, bool success)
+{
+	struct io_kiocb *notif = container_of(ubuf, struct io_kiocb, notif.ubuf);
+
+	mm_unaccount_pinned_pages(&ubuf->uarg.mmp);
+	io_cqring_add_event(notif, 0, IORING_CQE_F_NOTIF);
+	io_put_req(notif);
+}
+
+static struct io_kiocb *io_alloc_notif(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct ubuf_info *uarg;
+	struct io_kiocb *notif;
+
+	notif = kmem_cache_alloc(req_cachep, GFP_KERNEL);
+	if (unlikely(!notif))
+		return NULL;
+
+	notif->opcode = req->opcode;
+	notif->user_data = req->user_data;
+	notif->io = NULL;
+	notif->ctx = ctx;
+	notif->flags = 0;
+	refcount_set(&notif->refs, 1);
+	notif->task = current;
+	notif->result = 0;
+	percpu_ref_get(&ctx->refs);
+
+	notif->notif.file = NULL;
+	notif->notif.ubuf.complete = io_notif_complete;
+	uarg = &notif->notif.ubuf.uarg;
+	memset(uarg, 0, sizeof(*uarg));
+	uarg->callback = sock_zerocopy_managed_callback;
+	uarg->zerocopy = 1;
+	refcount_set(&uarg->refcnt, 1);
+	return notif;
+}
+
+/* drop a notification the network stack never got to see */
+static void io_send_zc_cleanup(struct io_kiocb *req)
+{
+	struct io_kiocb *notif = req->sr_msg.notif;
+
+	req->sr_msg.notif = NULL;
+	mm_unaccount_pinned_pages(&notif->notif.ubuf.uarg.mmp);
+	io_put_req(notif);
+}
+
+static int io_send_zc_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
+{
+	struct io_sr_msg *sr = &req->sr_msg;
+
+	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+	if (unlikely(sqe->addr2))
+		return -EINVAL;
+
+	sr->zc_flags = READ_ONCE(sqe->ioprio);
+	if (sr->zc_flags & ~IORING_RECVSEND_FIXED_BUF)
+		return -EINVAL;
+	if (sr->zc_flags & IORING_RECVSEND_FIXED_BUF)
+		req->buf_index = READ_ONCE(sqe->buf_index);
+	else if (sqe->buf_index)
+		return -EINVAL;
+
+	sr->buf = u64_to_user_ptr(READ_ONCE(sqe->addr));
+	sr->len = READ_ONCE(sqe->len);
+	sr->msg_flags = READ_ONCE(sqe->msg_flags);
+	sr->notif = NULL;
+	return 0;
+}
+
+/*
+ * Like IORING_OP_SEND, but the pages are attached to the skbs instead of
+ * being copied. The send completes with IORING_CQE_F_MORE set, and a second
+ * CQE with IORING_CQE_F_NOTIF follows once the buffer may be reused.
+ */
+static int io_send_zc(struct io_kiocb *req, bool force_nonblock,
+		      struct io_comp_state *cs)
+{
+	struct io_sr_msg *sr = &req->sr_msg;
+	struct io_kiocb *notif;
+	struct msghdr msg;
+	struct iovec iov;
+	struct socket *sock;
+	unsigned flags;
+	int ret;
+
+	sock = sock_from_file(req->file, &ret);
+	if (unlikely(!sock))
+		return ret;
+	/* only TCP takes a caller provided msg_ubuf */
+	if (sock->sk->sk_type != SOCK_STREAM ||
+	    sock->sk->sk_protocol != IPPROTO_TCP)
+		return -EOPNOTSUPP;
+
+	if (sr->zc_flags & IORING_RECVSEND_FIXED_BUF) {
+		ret = __io_import_fixed(req, WRITE, &msg.msg_iter,
+					(u64)(uintptr_t)sr->buf, sr->len);
+		if (unlikely(ret < 0))
+			return ret;
+	} else {
+		ret = import_single_range(WRITE, sr->buf, sr->len, &iov,
+					  &msg.msg_iter);
+		if (unlikely(ret))
+			return ret;
+	}
+
+	if (!sr->notif) {
+		notif = io_alloc_notif(req);
+		if (unlikely(!notif))
+			return -ENOMEM;
+		sr->notif = notif;
+		req->flags |= REQ_F_NEED_CLEANUP;
+
+		/* registered buffers are accounted at registration time */
+		if (!(sr->zc_flags & IORING_RECVSEND_FIXED_BUF)) {
+			ret = mm_account_pinned_pages(&notif->notif.ubuf.uarg.mmp,
+						      sr->len);
+			if (unlikely(ret))
+				return ret;
+		}
+	}
+
+	msg.msg_name = NULL;
+	msg.msg_control = NULL;
+	msg.msg_controllen = 0;
+	msg.msg_namelen = 0;
+	msg.msg_ubuf = &sr->notif->notif.ubuf.uarg;
+
+	flags = sr->msg_flags | MSG_ZEROCOPY;
+	if (flags & MSG_DONTWAIT)
+		req->flags |= REQ_F_NOWAIT;
+	else if (force_nonblock)
+		flags |= MSG_DONTWAIT;
+
+	msg.msg_flags = flags;
+	ret = sock_sendmsg(sock, &msg);
+	if (force_nonblock && ret == -EAGAIN)
+		return -EAGAIN;
+	if (ret == -ERESTARTSYS)
+		ret = -EINTR;
+
+	if (ret < 0)
+		req_set_fail_links(req);
+
+	notif = sr->notif;
+	sr->notif = NULL;
+	req->flags &= ~REQ_F_NEED_CLEANUP;
+	/* post the result before the notification can be, skip batching */
+	__io_req_complete(req, ret, IORING_CQE_F_MORE, NULL);
+	sock_zerocopy_put(&notif->notif.ubuf.uarg);
+	return 0;
+}
+
 static int __io_recvmsg_copy_hdr(struct io_kiocb *req,
 				 struct io_async_msghdr *iomsg)
 {
@@ -4232,6 +4641,19 @@ static int io_recvmsg_prep(struct io_kiocb *req,
 	sr->len = READ_ONCE(sqe->len);
 	sr->bgid = READ_ONCE(sqe->buf_group);
 
+	if (req->opcode == IORING_OP_RECV &&
+	    (READ_ONCE(sqe->ioprio) & IORING_RECV_MULTISHOT)) {
+		/* every shot needs a buffer of its own */
+		if (!(req->flags & REQ_F_BUFFER_SELECT))
+			return -EINVAL;
+		if (req->flags & (REQ_F_LINK | REQ_F_HARDLINK))
+			return -EINVAL;
+		if (sr->msg_flags & MSG_WAITALL)
+			return -EINVAL;
+		req->flags |= REQ_F_APOLL_MULTISHOT;
+		sr->mshot_len = sr->len;
+	}
+
 #ifdef CONFIG_COMPAT
 	if (req->ctx->compat)
 		sr->msg_flags |= MSG_CMSG_COMPAT;
@@ -4325,7 +4747,11 @@ static int io_recv(struct io_kiocb *req, bool force_nonblock,
 	if (unlikely(!sock))
 		return ret;
 
+retry:
 	if (req->flags & REQ_F_BUFFER_SELECT) {
+		if (req->flags & REQ_F_APOLL_MULTISHOT &&
+		    !(req->flags & REQ_F_BUFFER_SELECTED))
+			sr->len = sr->mshot_len;
 		kbuf = io_recv_buffer_select(req, !force_nonblock);
 		if (IS_ERR(kbuf))
 			return PTR_ERR(kbuf);
@@ -4344,19 +4770,32 @@ static int io_recv(struct io_kiocb *req, bool force_nonblock,
 	msg.msg_flags = 0;
 
 	flags = req->sr_msg.msg_flags;
-	if (flags & MSG_DONTWAIT)
+	if (flags & MSG_DONTWAIT && !(req->flags & REQ_F_APOLL_MULTISHOT))
 		req->flags |= REQ_F_NOWAIT;
 	else if (force_nonblock)
 		flags |= MSG_DONTWAIT;
 
 	ret = sock_recvmsg(sock, &msg, flags);
-	if (force_nonblock && ret == -EAGAIN)
+	if (force_nonblock && ret == -EAGAIN) {
+		if (req->flags & REQ_F_APOLL_MULTISHOT)
+			return io_multishot_rearm(req);
 		return -EAGAIN;
+	}
 	if (ret == -ERESTARTSYS)
 		ret = -EINTR;
 out_free:
 	if (req->flags & REQ_F_BUFFER_SELECTED)
 		cflags = io_put_recv_kbuf(req);
+	/*
+	 * Multishot keeps going for as long as data comes in, EOF and errors
+	 * finish it. From io-wq it completes, there is no poll to drive it.
+	 */
+	if (ret > 0 && (req->flags & REQ_F_APOLL_MULTISHOT) &&
+	    force_nonblock && io_fill_multishot_event(req, ret, cflags)) {
+		buf = sr->buf;
+		cflags = 0;
+		goto retry;
+	}
 	if (ret < 0)
 		req_set_fail_links(req);
 	__io_req_complete(req, ret, cflags, cs);
@@ -4367,15 +4806,38 @@ static int io_accept_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 {
 	struct io_accept *accept = &req->accept;
 
+	unsigned int ioprio;
+
 	if (unlikely(req->ctx->flags & (IORING_SETUP_IOPOLL|IORING_SETUP_SQPOLL)))
 		return -EINVAL;
-	if (sqe->ioprio || sqe->len || sqe->buf_index)
+	if (sqe->len || sqe->buf_index)
+		return -EINVAL;
+
+	ioprio = READ_ONCE(sqe->ioprio);
+	if (ioprio & ~IORING_ACCEPT_MULTISHOT)
 		return -EINVAL;
+	if (ioprio & IORING_ACCEPT_MULTISHOT) {
+		if (req->flags & (REQ_F_LINK | REQ_F_HARDLINK))
+			return -EINVAL;
+		req->flags |= REQ_F_APOLL_MULTISHOT;
+	}
 
 	accept->addr = u64_to_user_ptr(READ_ONCE(sqe->addr));
 	accept->addr_len = u64_to_user_ptr(READ_ONCE(sqe->addr2));
 	accept->flags = READ_ONCE(sqe->accept_flags);
 	accept->nofile = rlimit(RLIMIT_NOFILE);
+
+	accept->file_slot = READ_ONCE(sqe->file_index);
+	if (accept->file_slot) {
+		/* every shot would replace the file in the same slot */
+		if (req->flags & REQ_F_APOLL_MULTISHOT)
+			return -EINVAL;
+		if (accept->flags & ~SOCK_NONBLOCK)
+			return -EINVAL;
+		if (SOCK_NONBLOCK != O_NONBLOCK &&
+		    (accept->flags & SOCK_NONBLOCK))
+			accept->flags = O_NONBLOCK;
+	}
 	return 0;
 }
 
@@ -4386,14 +4848,36 @@ static int io_accept(struct io_kiocb *req, bool force_nonblock,
 	unsigned int file_flags = force_nonblock ? O_NONBLOCK : 0;
 	int ret;
 
-	if (req->file->f_flags & O_NONBLOCK)
+	if (req->file->f_flags & O_NONBLOCK &&
+	    !(req->flags & REQ_F_APOLL_MULTISHOT))
 		req->flags |= REQ_F_NOWAIT;
 
-	ret = __sys_accept4_file(req->file, file_flags, accept->addr,
-					accept->addr_len, accept->flags,
-					accept->nofile);
-	if (ret == -EAGAIN && force_nonblock)
+retry:
+	if (accept->file_slot) {
+		struct file *file;
+
+		file = do_accept(req->file, file_flags, accept->addr,
+				 accept->addr_len, accept->flags);
+		if (IS_ERR(file))
+			ret = PTR_ERR(file);
+		else
+			ret = io_install_fixed_file(req, file,
+						    accept->file_slot - 1,
+						    !force_nonblock);
+	} else {
+		ret = __sys_accept4_file(req->file, file_flags, accept->addr,
+					 accept->addr_len, accept->flags,
+					 accept->nofile);
+	}
+	if (ret == -EAGAIN && force_nonblock) {
+		if (req->flags & REQ_F_APOLL_MULTISHOT)
+			return io_multishot_rearm(req);
 		return -EAGAIN;
+	}
+	/* from io-wq a multishot accept completes, like its errors do */
+	if (ret >= 0 && (req->flags & REQ_F_APOLL_MULTISHOT) &&
+	    force_nonblock && io_fill_multishot_event(req, ret, 0))
+		goto retry;
 	if (ret < 0) {
 		if (ret == -ERESTARTSYS)
 			ret = -EINTR;
@@ -4481,6 +4965,21 @@ static int io_send(struct io_kiocb *req, bool force_nonblock,
 	return -EOPNOTSUPP;
 }
 
+static void io_send_zc_cleanup(struct io_kiocb *req)
+{
+}
+
+static int io_send_zc_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
+{
+	return -EOPNOTSUPP;
+}
+
+static int io_send_zc(struct io_kiocb *req, bool force_nonblock,
+		      struct io_comp_state *cs)
+{
+	return -EOPNOTSUPP;
+}
+
 static int io_recvmsg_prep(struct io_kiocb *req,
 			   const struct io_uring_sqe *sqe)
 {
@@ -5504,6 +6003,9 @@ static int io_req_defer_prep(struct io_kiocb *req,
 	case IORING_OP_TEE:
 		ret = io_tee_prep(req, sqe);
 		break;
+	case IORING_OP_SEND_ZC:
+		ret = io_send_zc_prep(req, sqe);
+		break;
 	default:
 		printk_once(KERN_WARNING "io_uring: unhandled opcode %d\n",
 				req->opcode);
@@ -5615,6 +6117,10 @@ static void __io_clean_op(struct io_kiocb *req)
 			if (req->open.filename)
 				putname(req->open.filename);
 			break;
+		case IORING_OP_SEND_ZC:
+			if (req->sr_msg.notif)
+				io_send_zc_cleanup(req);
+			break;
 		}
 		req->flags &= ~REQ_F_NEED_CLEANUP;
 	}
@@ -5855,6 +6361,14 @@ static int io_issue_sqe(struct io_kiocb *req, const struct io_uring_sqe *sqe,
 		}
 		ret = io_tee(req, force_nonblock);
 		break;
+	case IORING_OP_SEND_ZC:
+		if (sqe) {
+			ret = io_send_zc_prep(req, sqe);
+			if (ret < 0)
+				break;
+		}
+		ret = io_send_zc(req, force_nonblock, cs);
+		break;
 	default:
 		ret = -EINVAL;
 		break;
@@ -6293,7 +6807,8 @@ static void io_submit_state_end(struct io_submit_state *state)
 	blk_finish_plug(&state->plug);
 	io_state_file_put(state);
 	if (state->free_reqs)
-		kmem_cache_free_bulk(req_cachep, state->free_reqs, state->reqs);
+		io_req_cache_put(state->comp.ctx, state->reqs,
+				 state->free_reqs);
 }
 
 /*
@@ -6302,7 +6817,7 @@ static void io_submit_state_end(struct io_submit_state *state)
 static void io_submit_state_start(struct io_submit_state *state,
 				  struct io_ring_ctx *ctx, unsigned int max_ios)
 {
-	blk_start_plug(&state->plug);
+	blk_start_plug_nr_ios(&state->plug, max_ios);
 	state->comp.nr = 0;
 	INIT_LIST_HEAD(&state->comp.list);
 	state->comp.ctx = ctx;
@@ -6505,136 +7020,206 @@ static inline void io_ring_clear_wakeup_flag(struct io_ring_ctx *ctx)
 	spin_unlock_irq(&ctx->completion_lock);
 }
 
-static int io_sq_thread(void *data)
+/* SQEs submitted per ring and pass when the thread serves several rings */
+#define IORING_SQPOLL_CAP_ENTRIES	8
+
+enum sq_ret {
+	SQT_IDLE	= 1,
+	SQT_SPIN	= 2,
+	SQT_DID_WORK	= 4,
+};
+
+static enum sq_ret __io_sq_thread(struct io_ring_ctx *ctx, bool cap_entries)
+{
+	unsigned int to_submit;
+	int ret = 0;
+
+	if (!list_empty(&ctx->iopoll_list)) {
+		unsigned nr_events = 0;
+
+		mutex_lock(&ctx->uring_lock);
+		if (!list_empty(&ctx->iopoll_list) && !need_resched())
+			io_do_iopoll(ctx, &nr_events, 0);
+		else
+			ctx->sq_idle_timeout = jiffies + ctx->sq_thread_idle;
+		mutex_unlock(&ctx->uring_lock);
+	}
+
+	to_submit = io_sqring_entries(ctx);
+	if (to_submit && !need_resched()) {
+		/* if we're handling multiple rings, cap submit size for fairness */
+		if (cap_entries && to_submit > IORING_SQPOLL_CAP_ENTRIES)
+			to_submit = IORING_SQPOLL_CAP_ENTRIES;
+
+		mutex_lock(&ctx->uring_lock);
+		if (likely(!percpu_ref_is_dying(&ctx->refs)))
+			ret = io_submit_sqes(ctx, to_submit, NULL, -1);
+		mutex_unlock(&ctx->uring_lock);
+
+		/*
+		 * If submit got -EBUSY, the application has to enter the
+		 * kernel to reap and flush events before we retry.
+		 */
+		ctx->sq_busy = ret == -EBUSY;
+		if (!ctx->sq_busy) {
+			ctx->sq_idle_timeout = jiffies + ctx->sq_thread_idle;
+			return SQT_DID_WORK;
+		}
+	}
+
+	/*
+	 * We're polling. If we're within the idle period of this ring, then
+	 * let us spin without work before going to sleep, unless we got
+	 * EBUSY doing more IO.
+	 */
+	if (!list_empty(&ctx->iopoll_list) || need_resched() ||
+	    (!time_after(jiffies, ctx->sq_idle_timeout) && !ctx->sq_busy &&
+	    !percpu_ref_is_dying(&ctx->refs)))
+		return SQT_SPIN;
+
+	return SQT_IDLE;
+}
+
+/* Can the thread sleep, called with the wakeup flag set on all the rings */
+static bool io_sqd_can_sleep(struct io_sq_data *sqd)
+{
+	struct io_ring_ctx *ctx;
+
+	list_for_each_entry(ctx, &sqd->ctx_list, sqd_list) {
+		/*
+		 * While doing polled IO, before going to sleep, we need
+		 * to check if there are new reqs added to iopoll_list,
+		 * it is because reqs may have been punted to io worker
+		 * and will be added to iopoll_list later, hence check
+		 * the iopoll_list again.
+		 */
+		if ((ctx->flags & IORING_SETUP_IOPOLL) &&
+		    !list_empty_careful(&ctx->iopoll_list))
+			return false;
+		if (io_sqring_entries(ctx) && !ctx->sq_busy &&
+		    !percpu_ref_is_dying(&ctx->refs))
+			return false;
+	}
+
+	return true;
+}
+
+static void io_sqd_init_new(struct io_sq_data *sqd)
+{
+	struct io_ring_ctx *ctx;
+
+	mutex_lock(&sqd->ctx_lock);
+	while (!list_empty(&sqd->ctx_new_list)) {
+		ctx = list_first_entry(&sqd->ctx_new_list, struct io_ring_ctx,
+				       sqd_list);
+		list_move_tail(&ctx->sqd_list, &sqd->ctx_list);
+		ctx->sq_idle_timeout = jiffies + ctx->sq_thread_idle;
+		complete(&ctx->sq_thread_comp);
+	}
+	mutex_unlock(&sqd->ctx_lock);
+}
+
+static int io_sq_thread(void *data)
 {
 	struct files_struct *old_files = current->files;
 	struct nsproxy *old_nsproxy = current->nsproxy;
-	struct io_ring_ctx *ctx = data;
-	const struct cred *old_cred;
+	struct io_sq_data *sqd = data;
+	const struct cred *old_cred = NULL;
+	struct io_ring_ctx *ctx;
 	mm_segment_t old_fs;
 	DEFINE_WAIT(wait);
-	unsigned long timeout;
-	int ret = 0;
 
 	task_lock(current);
 	current->files = NULL;
 	current->nsproxy = NULL;
 	task_unlock(current);
 
-	complete(&ctx->sq_thread_comp);
-
 	old_fs = get_fs();
 	set_fs(USER_DS);
-	old_cred = override_creds(ctx->creds);
 
-	timeout = jiffies + ctx->sq_thread_idle;
-	while (!kthread_should_park()) {
-		unsigned int to_submit;
+	while (!kthread_should_stop()) {
+		enum sq_ret ret = 0;
+		bool cap_entries;
+
+		/*
+		 * Any changes to the sqd lists are synchronized through the
+		 * kthread parking. This synchronizes the thread vs users,
+		 * the users are synchronized on the sqd->ctx_lock.
+		 */
+		if (kthread_should_park()) {
+			kthread_parkme();
+			/* io_put_sq_data() parks the thread before stopping it */
+			if (kthread_should_stop())
+				break;
+		}
+
+		if (unlikely(!list_empty(&sqd->ctx_new_list)))
+			io_sqd_init_new(sqd);
 
-		if (!list_empty(&ctx->iopoll_list)) {
-			unsigned nr_events = 0;
+		cap_entries = !list_is_singular(&sqd->ctx_list);
 
-			mutex_lock(&ctx->uring_lock);
-			if (!list_empty(&ctx->iopoll_list) && !need_resched())
-				io_do_iopoll(ctx, &nr_events, 0);
-			else
-				timeout = jiffies + ctx->sq_thread_idle;
-			mutex_unlock(&ctx->uring_lock);
+		list_for_each_entry(ctx, &sqd->ctx_list, sqd_list) {
+			if (current->cred != ctx->creds) {
+				if (old_cred)
+					revert_creds(old_cred);
+				old_cred = override_creds(ctx->creds);
+			}
+
+			ret |= __io_sq_thread(ctx, cap_entries);
+
+			/* the next ring may belong to another task */
+			if (cap_entries)
+				io_sq_thread_drop_mm_files();
 		}
 
-		to_submit = io_sqring_entries(ctx);
+		if ((ret & SQT_DID_WORK) && !(ret & SQT_SPIN))
+			continue;
 
 		/*
-		 * If submit got -EBUSY, flag us as needing the application
-		 * to enter the kernel to reap and flush events.
+		 * Drop cur_mm before scheduling, we can't hold it for long
+		 * periods (or over schedule()). Do this before adding
+		 * ourselves to the waitqueue, as the unuse/drop may sleep.
 		 */
-		if (!to_submit || ret == -EBUSY || need_resched()) {
-			/*
-			 * Drop cur_mm before scheduling, we can't hold it for
-			 * long periods (or over schedule()). Do this before
-			 * adding ourselves to the waitqueue, as the unuse/drop
-			 * may sleep.
-			 */
-			io_sq_thread_drop_mm_files();
-
-			/*
-			 * We're polling. If we're within the defined idle
-			 * period, then let us spin without work before going
-			 * to sleep. The exception is if we got EBUSY doing
-			 * more IO, we should wait for the application to
-			 * reap events and wake us up.
-			 */
-			if (!list_empty(&ctx->iopoll_list) || need_resched() ||
-			    (!time_after(jiffies, timeout) && ret != -EBUSY &&
-			    !percpu_ref_is_dying(&ctx->refs))) {
-				io_run_task_work();
-				cond_resched();
-				continue;
-			}
+		io_sq_thread_drop_mm_files();
 
-			prepare_to_wait(&ctx->sqo_wait, &wait,
-						TASK_INTERRUPTIBLE);
+		if (ret & SQT_SPIN) {
+			io_run_task_work();
+			cond_resched();
+			continue;
+		}
 
-			/*
-			 * While doing polled IO, before going to sleep, we need
-			 * to check if there are new reqs added to iopoll_list,
-			 * it is because reqs may have been punted to io worker
-			 * and will be added to iopoll_list later, hence check
-			 * the iopoll_list again.
-			 */
-			if ((ctx->flags & IORING_SETUP_IOPOLL) &&
-			    !list_empty_careful(&ctx->iopoll_list)) {
-				finish_wait(&ctx->sqo_wait, &wait);
-				continue;
-			}
+		prepare_to_wait(&sqd->wait, &wait, TASK_INTERRUPTIBLE);
 
+		list_for_each_entry(ctx, &sqd->ctx_list, sqd_list)
 			io_ring_set_wakeup_flag(ctx);
 
-			to_submit = io_sqring_entries(ctx);
-			if (!to_submit || ret == -EBUSY) {
-				if (kthread_should_park()) {
-					finish_wait(&ctx->sqo_wait, &wait);
-					break;
-				}
-				if (io_run_task_work()) {
-					finish_wait(&ctx->sqo_wait, &wait);
-					io_ring_clear_wakeup_flag(ctx);
-					continue;
-				}
-				if (signal_pending(current))
-					flush_signals(current);
-				schedule();
-				finish_wait(&ctx->sqo_wait, &wait);
+		if (io_sqd_can_sleep(sqd) && !kthread_should_park() &&
+		    !io_run_task_work()) {
+			if (signal_pending(current))
+				flush_signals(current);
+			schedule();
 
-				io_ring_clear_wakeup_flag(ctx);
-				ret = 0;
-				continue;
-			}
-			finish_wait(&ctx->sqo_wait, &wait);
-
-			io_ring_clear_wakeup_flag(ctx);
+			list_for_each_entry(ctx, &sqd->ctx_list, sqd_list)
+				ctx->sq_busy = false;
 		}
+		finish_wait(&sqd->wait, &wait);
 
-		mutex_lock(&ctx->uring_lock);
-		if (likely(!percpu_ref_is_dying(&ctx->refs)))
-			ret = io_submit_sqes(ctx, to_submit, NULL, -1);
-		mutex_unlock(&ctx->uring_lock);
-		timeout = jiffies + ctx->sq_thread_idle;
+		list_for_each_entry(ctx, &sqd->ctx_list, sqd_list)
+			io_ring_clear_wakeup_flag(ctx);
 	}
 
 	io_run_task_work();
 
 	set_fs(old_fs);
 	io_sq_thread_drop_mm_files();
-	revert_creds(old_cred);
+	if (old_cred)
+		revert_creds(old_cred);
 
 	task_lock(current);
 	current->files = old_files;
 	current->nsproxy = old_nsproxy;
 	task_unlock(current);
 
-	kthread_parkme();
-
 	return 0;
 }
 
@@ -6804,18 +7389,102 @@ static int io_sqe_files_unregister(struct io_ring_ctx *ctx)
 	return 0;
 }
 
-static void io_sq_thread_stop(struct io_ring_ctx *ctx)
+static void io_put_sq_data(struct io_sq_data *sqd)
 {
-	if (ctx->sqo_thread) {
-		wait_for_completion(&ctx->sq_thread_comp);
+	if (refcount_dec_and_test(&sqd->refs)) {
 		/*
 		 * The park is a bit of a work-around, without it we get
 		 * warning spews on shutdown with SQPOLL set and affinity
 		 * set to a single CPU.
 		 */
-		kthread_park(ctx->sqo_thread);
-		kthread_stop(ctx->sqo_thread);
-		ctx->sqo_thread = NULL;
+		if (sqd->thread) {
+			kthread_park(sqd->thread);
+			kthread_stop(sqd->thread);
+		}
+
+		kfree(sqd);
+	}
+}
+
+static struct io_sq_data *io_attach_sq_data(struct io_uring_params *p)
+{
+	struct io_ring_ctx *ctx_attach;
+	struct io_sq_data *sqd;
+	struct fd f;
+
+	f = fdget(p->wq_fd);
+	if (!f.file)
+		return ERR_PTR(-ENXIO);
+	if (f.file->f_op != &io_uring_fops) {
+		fdput(f);
+		return ERR_PTR(-EINVAL);
+	}
+
+	ctx_attach = f.file->private_data;
+	sqd = ctx_attach->sq_data;
+	if (!sqd) {
+		fdput(f);
+		return ERR_PTR(-EINVAL);
+	}
+
+	/* @sqd is protected by holding the fd */
+	refcount_inc(&sqd->refs);
+	fdput(f);
+	return sqd;
+}
+
+static struct io_sq_data *io_get_sq_data(struct io_uring_params *p)
+{
+	struct io_sq_data *sqd;
+
+	if (p->flags & IORING_SETUP_ATTACH_WQ)
+		return io_attach_sq_data(p);
+
+	sqd = kzalloc(sizeof(*sqd), GFP_KERNEL);
+	if (!sqd)
+		return ERR_PTR(-ENOMEM);
+
+	refcount_set(&sqd->refs, 1);
+	INIT_LIST_HEAD(&sqd->ctx_list);
+	INIT_LIST_HEAD(&sqd->ctx_new_list);
+	mutex_init(&sqd->ctx_lock);
+	mutex_init(&sqd->lock);
+	init_waitqueue_head(&sqd->wait);
+	return sqd;
+}
+
+static void io_sq_thread_park(struct io_sq_data *sqd)
+	__acquires(&sqd->lock)
+{
+	mutex_lock(&sqd->lock);
+	if (sqd->thread)
+		kthread_park(sqd->thread);
+}
+
+static void io_sq_thread_unpark(struct io_sq_data *sqd)
+	__releases(&sqd->lock)
+{
+	if (sqd->thread)
+		kthread_unpark(sqd->thread);
+	mutex_unlock(&sqd->lock);
+}
+
+static void io_sq_thread_stop(struct io_ring_ctx *ctx)
+{
+	struct io_sq_data *sqd = ctx->sq_data;
+
+	if (sqd) {
+		if (sqd->thread)
+			wait_for_completion(&ctx->sq_thread_comp);
+
+		io_sq_thread_park(sqd);
+		mutex_lock(&sqd->ctx_lock);
+		list_del(&ctx->sqd_list);
+		mutex_unlock(&sqd->ctx_lock);
+		io_sq_thread_unpark(sqd);
+
+		io_put_sq_data(sqd);
+		ctx->sq_data = NULL;
 	}
 }
 
@@ -7242,6 +7911,18 @@ static int io_queue_file_removal(struct fixed_file_data *data,
 	return 0;
 }
 
+/* Retire the current ref node, files queued for removal go with it */
+static void io_sqe_files_switch_node(struct fixed_file_data *data,
+				     struct fixed_file_ref_node *ref_node)
+{
+	percpu_ref_kill(&data->node->refs);
+	spin_lock_bh(&data->lock);
+	list_add_tail(&ref_node->node, &data->ref_list);
+	data->node = ref_node;
+	spin_unlock_bh(&data->lock);
+	percpu_ref_get(&data->refs);
+}
+
 static int __io_sqe_files_update(struct io_ring_ctx *ctx,
 				 struct io_uring_files_update *up,
 				 unsigned nr_args)
@@ -7311,19 +7992,71 @@ static int __io_sqe_files_update(struct io_ring_ctx *ctx,
 		up->offset++;
 	}
 
-	if (needs_switch) {
-		percpu_ref_kill(&data->node->refs);
-		spin_lock_bh(&data->lock);
-		list_add_tail(&ref_node->node, &data->ref_list);
-		data->node = ref_node;
-		spin_unlock_bh(&data->lock);
-		percpu_ref_get(&ctx->file_data->refs);
-	} else
+	if (needs_switch)
+		io_sqe_files_switch_node(data, ref_node);
+	else
 		destroy_fixed_file_ref_node(ref_node);
 
 	return done ? done : err;
 }
 
+/*
+ * Install @file in the registered file slot @slot_index in place of the fd
+ * table, for IORING_OP_OPENAT and IORING_OP_ACCEPT with sqe->file_index.
+ * A file already in the slot is dropped once the requests using it are
+ * done. The file reference is consumed, also on error.
+ */
+static int io_install_fixed_file(struct io_kiocb *req, struct file *file,
+				 u32 slot_index, bool needs_lock)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct fixed_file_ref_node *ref_node;
+	struct fixed_file_table *table;
+	struct fixed_file_data *data;
+	unsigned index;
+	int ret;
+
+	io_ring_submit_lock(ctx, needs_lock);
+
+	data = ctx->file_data;
+	ret = -ENXIO;
+	if (!data)
+		goto err;
+	ret = -EINVAL;
+	if (slot_index >= ctx->nr_user_files)
+		goto err;
+	/* see __io_sqe_files_update() */
+	ret = -EBADF;
+	if (file->f_op == &io_uring_fops)
+		goto err;
+
+	slot_index = array_index_nospec(slot_index, ctx->nr_user_files);
+	table = &data->table[slot_index >> IORING_FILE_TABLE_SHIFT];
+	index = slot_index & IORING_FILE_TABLE_MASK;
+	if (table->files[index]) {
+		ref_node = alloc_fixed_file_ref_node(ctx);
+		if (IS_ERR(ref_node)) {
+			ret = PTR_ERR(ref_node);
+			goto err;
+		}
+		ret = io_queue_file_removal(data, table->files[index]);
+		if (ret) {
+			destroy_fixed_file_ref_node(ref_node);
+			goto err;
+		}
+		table->files[index] = NULL;
+		io_sqe_files_switch_node(data, ref_node);
+	}
+	table->files[index] = file;
+
+	io_ring_submit_unlock(ctx, needs_lock);
+	return 0;
+err:
+	io_ring_submit_unlock(ctx, needs_lock);
+	fput(file);
+	return ret;
+}
+
 static int io_sqe_files_update(struct io_ring_ctx *ctx, void __user *arg,
 			       unsigned nr_args)
 {
@@ -7402,14 +8135,33 @@ static int io_sq_offload_start(struct io_ring_ctx *ctx,
 	int ret;
 
 	if (ctx->flags & IORING_SETUP_SQPOLL) {
+		struct io_sq_data *sqd;
+
 		ret = -EPERM;
 		if (!capable(CAP_SYS_ADMIN))
 			goto err;
 
+		sqd = io_get_sq_data(p);
+		if (IS_ERR(sqd)) {
+			ret = PTR_ERR(sqd);
+			goto err;
+		}
+
 		ctx->sq_thread_idle = msecs_to_jiffies(p->sq_thread_idle);
 		if (!ctx->sq_thread_idle)
 			ctx->sq_thread_idle = HZ;
 
+		ctx->sq_data = sqd;
+		io_sq_thread_park(sqd);
+		mutex_lock(&sqd->ctx_lock);
+		list_add(&ctx->sqd_list, &sqd->ctx_new_list);
+		mutex_unlock(&sqd->ctx_lock);
+		io_sq_thread_unpark(sqd);
+
+		/* an attached ring shares the thread, SQ_AFF is ignored */
+		if (sqd->thread)
+			goto done;
+
 		if (p->flags & IORING_SETUP_SQ_AFF) {
 			int cpu = p->sq_thread_cpu;
 
@@ -7419,25 +8171,25 @@ static int io_sq_offload_start(struct io_ring_ctx *ctx,
 			if (!cpu_online(cpu))
 				goto err;
 
-			ctx->sqo_thread = kthread_create_on_cpu(io_sq_thread,
-							ctx, cpu,
-							"io_uring-sq");
+			sqd->thread = kthread_create_on_cpu(io_sq_thread, sqd,
+							cpu, "io_uring-sq");
 		} else {
-			ctx->sqo_thread = kthread_create(io_sq_thread, ctx,
+			sqd->thread = kthread_create(io_sq_thread, sqd,
 							"io_uring-sq");
 		}
-		if (IS_ERR(ctx->sqo_thread)) {
-			ret = PTR_ERR(ctx->sqo_thread);
-			ctx->sqo_thread = NULL;
+		if (IS_ERR(sqd->thread)) {
+			ret = PTR_ERR(sqd->thread);
+			sqd->thread = NULL;
 			goto err;
 		}
-		wake_up_process(ctx->sqo_thread);
+		wake_up_process(sqd->thread);
 	} else if (p->flags & IORING_SETUP_SQ_AFF) {
 		/* Can't have SQ_AFF without SQPOLL */
 		ret = -EINVAL;
 		goto err;
 	}
 
+done:
 	ret = io_init_wq_offload(ctx, p);
 	if (ret)
 		goto err;
@@ -7835,6 +8587,7 @@ static void io_ring_ctx_free(struct io_ring_ctx *ctx)
 	put_cred(ctx->creds);
 	kfree(ctx->cancel_hash);
 	kmem_cache_free(req_cachep, ctx->fallback_req);
+	kmem_cache_free_bulk(req_cachep, ctx->nr_cached_reqs, ctx->cached_reqs);
 	kfree(ctx);
 }
 
@@ -8231,12 +8984,31 @@ SYSCALL_DEFINE6(io_uring_enter, unsigned int, fd, u32, to_submit,
 
 	io_run_task_work();
 
-	if (flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP))
+	if (flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP |
+		      IORING_ENTER_REGISTERED_RING))
 		return -EINVAL;
 
-	f = fdget(fd);
-	if (!f.file)
-		return -EBADF;
+	/*
+	 * A registered ring is pinned by the task, it can be used without
+	 * going through the file table. Keep the fd it was registered from
+	 * for the checks against the file table of the ring.
+	 */
+	if (flags & IORING_ENTER_REGISTERED_RING) {
+		struct io_uring_ringfd *rings = current->_resvd->io_uring_rings;
+
+		if (!rings || fd >= IO_RINGFD_REG_MAX)
+			return -EINVAL;
+		fd = array_index_nospec(fd, IO_RINGFD_REG_MAX);
+		f.file = rings[fd].file;
+		f.flags = 0;
+		if (unlikely(!f.file))
+			return -EBADF;
+		fd = rings[fd].fd;
+	} else {
+		f = fdget(fd);
+		if (!f.file)
+			return -EBADF;
+	}
 
 	ret = -EOPNOTSUPP;
 	if (f.file->f_op != &io_uring_fops)
@@ -8257,7 +9029,7 @@ SYSCALL_DEFINE6(io_uring_enter, unsigned int, fd, u32, to_submit,
 		if (!list_empty_careful(&ctx->cq_overflow_list))
 			io_cqring_overflow_flush(ctx, false);
 		if (flags & IORING_ENTER_SQ_WAKEUP)
-			wake_up(&ctx->sqo_wait);
+			wake_up(&ctx->sq_data->wait);
 		submitted = to_submit;
 	} else if (to_submit) {
 		mutex_lock(&ctx->uring_lock);
@@ -8724,6 +9496,74 @@ static int io_unregister_personality(struct io_ring_ctx *ctx, unsigned id)
 	return -EINVAL;
 }
 
+static int io_register_iowq_aff(struct io_ring_ctx *ctx, void __user *arg,
+				unsigned len)
+{
+	cpumask_var_t new_mask;
+	int ret;
+
+	if (!ctx->io_wq)
+		return -EINVAL;
+
+	if (!alloc_cpumask_var(&new_mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	cpumask_clear(new_mask);
+	if (len > cpumask_size())
+		len = cpumask_size();
+
+#ifdef CONFIG_COMPAT
+	if (in_compat_syscall()) {
+		ret = compat_get_bitmap(cpumask_bits(new_mask),
+					(const compat_ulong_t __user *)arg,
+					len * 8 /* CHAR_BIT */);
+	} else {
+		ret = copy_from_user(new_mask, arg, len);
+	}
+#else
+	ret = copy_from_user(new_mask, arg, len);
+#endif
+
+	if (ret) {
+		free_cpumask_var(new_mask);
+		return -EFAULT;
+	}
+
+	ret = -EINVAL;
+	if (cpumask_intersects(new_mask, cpu_online_mask))
+		ret = io_wq_cpu_affinity(ctx->io_wq, new_mask);
+	free_cpumask_var(new_mask);
+	return ret;
+}
+
+static int io_unregister_iowq_aff(struct io_ring_ctx *ctx)
+{
+	if (!ctx->io_wq)
+		return -EINVAL;
+
+	return io_wq_cpu_affinity(ctx->io_wq, NULL);
+}
+
+static int io_register_iowq_max_workers(struct io_ring_ctx *ctx,
+					void __user *arg)
+{
+	__u32 new_count[2];
+	int ret;
+
+	if (!ctx->io_wq)
+		return -EINVAL;
+	if (copy_from_user(new_count, arg, sizeof(new_count)))
+		return -EFAULT;
+
+	ret = io_wq_max_workers(ctx->io_wq, new_count);
+	if (ret)
+		return ret;
+
+	if (copy_to_user(arg, new_count, sizeof(new_count)))
+		return -EFAULT;
+	return 0;
+}
+
 static bool io_register_op_must_quiesce(int op)
 {
 	switch (op) {
@@ -8732,6 +9572,9 @@ static bool io_register_op_must_quiesce(int op)
 	case IORING_REGISTER_PROBE:
 	case IORING_REGISTER_PERSONALITY:
 	case IORING_UNREGISTER_PERSONALITY:
+	case IORING_REGISTER_IOWQ_AFF:
+	case IORING_UNREGISTER_IOWQ_AFF:
+	case IORING_REGISTER_IOWQ_MAX_WORKERS:
 		return false;
 	default:
 		return true;
@@ -8750,6 +9593,138 @@ static void io_refs_resurrect(struct percpu_ref *ref, struct completion *compl)
 		percpu_ref_put(ref);
 }
 
+void __io_uring_unreg_ringfd(void)
+{
+	struct io_uring_ringfd *rings = current->_resvd->io_uring_rings;
+	int i;
+
+	for (i = 0; i < IO_RINGFD_REG_MAX; i++) {
+		if (rings[i].file)
+			fput(rings[i].file);
+	}
+
+	current->_resvd->io_uring_rings = NULL;
+	kfree(rings);
+}
+
+/*
+ * Register io_uring fds with the calling task, so that io_uring_enter()
+ * can use them with IORING_ENTER_REGISTERED_RING without the fdget() and
+ * fdput() of the file table. An offset of -1U takes the first free slot,
+ * the slot used is copied back. Returns the number of fds registered.
+ */
+static int io_ringfd_register(void __user *__arg, unsigned nr_args)
+{
+	struct io_uring_rsrc_update __user *arg = __arg;
+	struct io_uring_ringfd *rings = current->_resvd->io_uring_rings;
+	struct io_uring_rsrc_update reg;
+	int ret = 0, i;
+
+	if (!nr_args || nr_args > IO_RINGFD_REG_MAX)
+		return -EINVAL;
+
+	if (!rings) {
+		rings = kcalloc(IO_RINGFD_REG_MAX, sizeof(*rings), GFP_KERNEL);
+		if (!rings)
+			return -ENOMEM;
+		current->_resvd->io_uring_rings = rings;
+	}
+
+	for (i = 0; i < nr_args; i++) {
+		struct file *file;
+		unsigned int start, end;
+
+		if (copy_from_user(&reg, &arg[i], sizeof(reg))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (reg.resv || reg.data > INT_MAX) {
+			ret = -EINVAL;
+			break;
+		}
+
+		if (reg.offset == -1U) {
+			start = 0;
+			end = IO_RINGFD_REG_MAX;
+		} else {
+			if (reg.offset >= IO_RINGFD_REG_MAX) {
+				ret = -EINVAL;
+				break;
+			}
+			start = reg.offset;
+			end = start + 1;
+		}
+
+		file = fget(reg.data);
+		if (!file) {
+			ret = -EBADF;
+			break;
+		}
+		if (file->f_op != &io_uring_fops) {
+			fput(file);
+			ret = -EOPNOTSUPP;
+			break;
+		}
+
+		ret = -EBUSY;
+		for (reg.offset = start; reg.offset < end; reg.offset++) {
+			if (!rings[reg.offset].file) {
+				rings[reg.offset].file = file;
+				rings[reg.offset].fd = reg.data;
+				ret = 0;
+				break;
+			}
+		}
+		if (ret) {
+			fput(file);
+			break;
+		}
+
+		if (copy_to_user(&arg[i], &reg, sizeof(reg))) {
+			rings[reg.offset].file = NULL;
+			fput(file);
+			ret = -EFAULT;
+			break;
+		}
+	}
+
+	return i ? i : ret;
+}
+
+static int io_ringfd_unregister(void __user *__arg, unsigned nr_args)
+{
+	struct io_uring_rsrc_update __user *arg = __arg;
+	struct io_uring_ringfd *rings = current->_resvd->io_uring_rings;
+	struct io_uring_rsrc_update reg;
+	int ret = 0, i;
+
+	if (!nr_args || nr_args > IO_RINGFD_REG_MAX)
+		return -EINVAL;
+	if (!rings)
+		return 0;
+
+	for (i = 0; i < nr_args; i++) {
+		unsigned int offset;
+
+		if (copy_from_user(&reg, &arg[i], sizeof(reg))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (reg.resv || reg.data || reg.offset >= IO_RINGFD_REG_MAX) {
+			ret = -EINVAL;
+			break;
+		}
+
+		offset = array_index_nospec(reg.offset, IO_RINGFD_REG_MAX);
+		if (rings[offset].file) {
+			fput(rings[offset].file);
+			rings[offset].file = NULL;
+		}
+	}
+
+	return i ? i : ret;
+}
+
 static int __io_uring_register(struct io_ring_ctx *ctx, unsigned opcode,
 			       void __user *arg, unsigned nr_args)
 	__releases(ctx->uring_lock)
@@ -8844,6 +9819,24 @@ static int __io_uring_register(struct io_ring_ctx *ctx, unsigned opcode,
 			break;
 		ret = io_unregister_personality(ctx, nr_args);
 		break;
+	case IORING_REGISTER_IOWQ_AFF:
+		ret = -EINVAL;
+		if (!arg || !nr_args)
+			break;
+		ret = io_register_iowq_aff(ctx, arg, nr_args);
+		break;
+	case IORING_UNREGISTER_IOWQ_AFF:
+		ret = -EINVAL;
+		if (arg || nr_args)
+			break;
+		ret = io_unregister_iowq_aff(ctx);
+		break;
+	case IORING_REGISTER_IOWQ_MAX_WORKERS:
+		ret = -EINVAL;
+		if (!arg || nr_args != 2)
+			break;
+		ret = io_register_iowq_max_workers(ctx, arg);
+		break;
 	default:
 		ret = -EINVAL;
 		break;
@@ -8872,6 +9865,15 @@ SYSCALL_DEFINE4(io_uring_register, unsigned int, fd, unsigned int, opcode,
 	if (f.file->f_op != &io_uring_fops)
 		goto out_fput;
 
+	/* these are per task and don't touch the ring they're issued on */
+	if (opcode == IORING_REGISTER_RING_FDS) {
+		ret = io_ringfd_register(arg, nr_args);
+		goto out_fput;
+	} else if (opcode == IORING_UNREGISTER_RING_FDS) {
+		ret = io_ringfd_unregister(arg, nr_args);
+		goto out_fput;
+	}
+
 	ctx = f.file->private_data;
 
 	mutex_lock(&ctx->uring_lock);
@@ -8922,6 +9924,7 @@ static int __init io_uring_init(void)
 	BUILD_BUG_SQE_ELEM(40, __u16,  buf_index);
 	BUILD_BUG_SQE_ELEM(42, __u16,  personality);
 	BUILD_BUG_SQE_ELEM(44, __s32,  splice_fd_in);
+	BUILD_BUG_SQE_ELEM(44, __u32,  file_index);
 
 	BUILD_BUG_ON(ARRAY_SIZE(io_op_defs) != IORING_OP_LAST);
 	BUILD_BUG_ON(__REQ_F_LAST_BIT >= 8 * sizeof(int));
@@ -20,8 +20,24 @@
 #include <linux/errno.h>
 #include <linux/slab.h>
 #include <linux/blkdev.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/moduleparam.h>
+#include <linux/sched/mm.h>
+#include <linux/sort.h>
 #include <trace/events/jbd2.h>
 
+/*
+ * Percentage of the log in use at which the checkpoint thread starts
+ * writing back old transactions; it stops at half of it.  0 leaves all
+ * checkpointing to the handles that run out of log space.
+ */
+static unsigned int jbd2_checkpoint_threshold __read_mostly = 50;
+module_param_named(checkpoint_threshold, jbd2_checkpoint_threshold, uint,
+		   0644);
+MODULE_PARM_DESC(checkpoint_threshold,
+		 "Log fill percentage that starts background checkpointing");
+
 /*
  * Unlink a buffer from a transaction checkpoint list.
  *
@@ -60,11 +76,15 @@ static inline bool __cp_buffer_busy(struct journal_head *jh)
  */
 void __jbd2_log_wait_for_space(journal_t *journal)
 {
+	journal_wrapper_t *journal_wrapper = jbd2_journal_wrapper(journal);
 	int nblocks, space_left;
+	ktime_t start_time = 0;
 	/* assert_spin_locked(&journal->j_state_lock); */
 
 	nblocks = journal->j_max_transaction_buffers;
 	while (jbd2_log_space_left(journal) < nblocks) {
+		if (!start_time)
+			start_time = ktime_get();
 		write_unlock(&journal->j_state_lock);
 		mutex_lock_io(&journal->j_checkpoint_mutex);
 
@@ -82,7 +102,7 @@ void __jbd2_log_wait_for_space(journal_t *journal)
 		write_lock(&journal->j_state_lock);
 		if (journal->j_flags & JBD2_ABORT) {
 			mutex_unlock(&journal->j_checkpoint_mutex);
-			return;
+			break;
 		}
 		spin_lock(&journal->j_list_lock);
 		space_left = jbd2_log_space_left(journal);
@@ -125,6 +145,22 @@ void __jbd2_log_wait_for_space(journal_t *journal)
 		}
 		mutex_unlock(&journal->j_checkpoint_mutex);
 	}
+
+	if (start_time) {
+		journal_wrapper->j_space_waits++;
+		journal_wrapper->j_space_wait_time +=
+			ktime_to_ns(ktime_sub(ktime_get(), start_time));
+	}
+}
+
+static int jbd2_chkpt_bh_cmp(const void *a, const void *b)
+{
+	const struct buffer_head *bh1 = *(const struct buffer_head **)a;
+	const struct buffer_head *bh2 = *(const struct buffer_head **)b;
+
+	if (bh1->b_blocknr < bh2->b_blocknr)
+		return -1;
+	return bh1->b_blocknr > bh2->b_blocknr;
 }
 
 static void
@@ -133,6 +169,9 @@ __flush_batch(journal_t *journal, int *batch_count)
 	int i;
 	struct blk_plug plug;
 
+	/* Checkpoint list order is commit order; submit in disk order */
+	sort(journal->j_chkpt_bhs, *batch_count, sizeof(struct buffer_head *),
+	     jbd2_chkpt_bh_cmp, NULL);
 	blk_start_plug(&plug);
 	for (i = 0; i < *batch_count; i++)
 		write_dirty_buffer(journal->j_chkpt_bhs[i], REQ_SYNC);
@@ -300,6 +339,76 @@ int jbd2_log_do_checkpoint(journal_t *journal)
 	return (result < 0) ? result : 0;
 }
 
+/* Is more than @pct percent of the log in use? */
+static bool jbd2_log_fill_over(journal_t *journal, unsigned int pct)
+{
+	unsigned long total = journal->j_last - journal->j_first;
+	bool ret;
+
+	read_lock(&journal->j_state_lock);
+	ret = (u64)(total - journal->j_free) * 100 > (u64)total * pct;
+	read_unlock(&journal->j_state_lock);
+	return ret;
+}
+
+/*
+ * Wake up the checkpoint thread if the log filled beyond the checkpoint
+ * threshold.  Called after each commit.
+ */
+void jbd2_log_kick_checkpoint(journal_t *journal)
+{
+	journal_wrapper_t *journal_wrapper = jbd2_journal_wrapper(journal);
+	unsigned int threshold = READ_ONCE(jbd2_checkpoint_threshold);
+
+	if (threshold && jbd2_log_fill_over(journal, threshold)) {
+		set_bit(JBD2_CHECKPOINT_KICKED, &journal_wrapper->j_atomic_flags);
+		wake_up(&journal_wrapper->j_wait_checkpoint);
+	}
+}
+
+/*
+ * The checkpoint thread writes back old transactions ahead of time, so
+ * that handles rarely have to checkpoint synchronously in
+ * __jbd2_log_wait_for_space() with the whole file system stalled behind
+ * them.  Once kicked beyond the threshold, it checkpoints one transaction
+ * at a time down to half of the threshold, dropping j_checkpoint_mutex in
+ * between so that handles out of log space aren't locked out for long.
+ */
+int jbd2_checkpoint_thread(void *arg)
+{
+	journal_t *journal = arg;
+	journal_wrapper_t *journal_wrapper = jbd2_journal_wrapper(journal);
+	unsigned int low;
+	bool more;
+
+	set_freezable();
+	/* Like kjournald2, never recurse into the file system */
+	memalloc_nofs_save();
+
+	while (!kthread_should_stop()) {
+		wait_event_freezable(journal_wrapper->j_wait_checkpoint,
+				     kthread_should_stop() ||
+				     test_and_clear_bit(JBD2_CHECKPOINT_KICKED,
+					&journal_wrapper->j_atomic_flags));
+
+		low = READ_ONCE(jbd2_checkpoint_threshold) / 2;
+		while (!kthread_should_stop() && !is_journal_aborted(journal) &&
+		       jbd2_log_fill_over(journal, low)) {
+			mutex_lock_io(&journal->j_checkpoint_mutex);
+			spin_lock(&journal->j_list_lock);
+			more = journal->j_checkpoint_transactions != NULL;
+			spin_unlock(&journal->j_list_lock);
+			if (more && jbd2_log_do_checkpoint(journal) < 0)
+				more = false;
+			mutex_unlock(&journal->j_checkpoint_mutex);
+			if (!more)
+				break;
+			cond_resched();
+		}
+	}
+	return 0;
+}
+
 /*
  * Check the list of checkpoint transactions for the journal to see if
  * we have already got rid of any since the last update of the log tail
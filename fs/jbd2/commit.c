@@ -383,10 +383,26 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	int csum_size = 0;
 	LIST_HEAD(io_bufs);
 	LIST_HEAD(log_bufs);
+	journal_wrapper_t *journal_wrapper = jbd2_journal_wrapper(journal);
 
 	if (jbd2_journal_has_csum_v2or3(journal))
 		csum_size = sizeof(struct jbd2_journal_block_tail);
 
+	/*
+	 * A fast commit in progress writes the current transaction's fast
+	 * commit area, which this commit is about to recycle: wait for it.
+	 */
+	write_lock(&journal->j_state_lock);
+	while (journal->j_flags & JBD2_FAST_COMMIT_ONGOING) {
+		write_unlock(&journal->j_state_lock);
+		wait_event(journal_wrapper->j_fc_wait,
+			   !(READ_ONCE(journal->j_flags) &
+			     JBD2_FAST_COMMIT_ONGOING));
+		write_lock(&journal->j_state_lock);
+	}
+	journal->j_flags |= JBD2_FULL_COMMIT_ONGOING;
+	write_unlock(&journal->j_state_lock);
+
 	/*
 	 * First job: lock down the current transaction and wait for
 	 * all outstanding updates to complete.
@@ -1099,6 +1115,10 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	journal->j_committing_transaction = NULL;
 	commit_time = ktime_to_ns(ktime_sub(ktime_get(), start_time));
 
+	/* Everything fast committed so far is in the log proper now */
+	journal_wrapper->j_fc_off = 0;
+	journal->j_flags &= ~JBD2_FULL_COMMIT_ONGOING;
+
 	/*
 	 * weight the commit time higher than the average time so we don't
 	 * react too strongly to vast changes in the commit time
@@ -1110,6 +1130,8 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 		journal->j_average_commit_time = commit_time;
 
 	write_unlock(&journal->j_state_lock);
+	wake_up(&journal_wrapper->j_fc_wait);
+	jbd2_log_kick_checkpoint(journal);
 
 	if (journal->j_commit_callback)
 		journal->j_commit_callback(journal, commit_transaction);
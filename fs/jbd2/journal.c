@@ -276,12 +276,22 @@ static int kjournald2(void *arg)
 
 static int jbd2_journal_start_thread(journal_t *journal)
 {
+	journal_wrapper_t *journal_wrapper = jbd2_journal_wrapper(journal);
 	struct task_struct *t;
 
-	t = kthread_run(kjournald2, journal, "jbd2/%s",
+	t = kthread_run(jbd2_checkpoint_thread, journal, "jbd2-ckpt/%s",
 			journal->j_devname);
 	if (IS_ERR(t))
 		return PTR_ERR(t);
+	journal_wrapper->j_checkpoint_task = t;
+
+	t = kthread_run(kjournald2, journal, "jbd2/%s",
+			journal->j_devname);
+	if (IS_ERR(t)) {
+		kthread_stop(journal_wrapper->j_checkpoint_task);
+		journal_wrapper->j_checkpoint_task = NULL;
+		return PTR_ERR(t);
+	}
 
 	wait_event(journal->j_wait_done_commit, journal->j_task != NULL);
 	return 0;
@@ -289,6 +299,13 @@ static int jbd2_journal_start_thread(journal_t *journal)
 
 static void journal_kill_thread(journal_t *journal)
 {
+	journal_wrapper_t *journal_wrapper = jbd2_journal_wrapper(journal);
+
+	if (journal_wrapper->j_checkpoint_task) {
+		kthread_stop(journal_wrapper->j_checkpoint_task);
+		journal_wrapper->j_checkpoint_task = NULL;
+	}
+
 	write_lock(&journal->j_state_lock);
 	journal->j_flags |= JBD2_UNMOUNT;
 
@@ -767,6 +784,164 @@ int jbd2_complete_transaction(journal_t *journal, tid_t tid)
 }
 EXPORT_SYMBOL(jbd2_complete_transaction);
 
+/*
+ * Fast commits write a compact, file-system specific log of a few inodes
+ * to a dedicated area at the end of the journal, instead of committing the
+ * whole running transaction.  The area is reused after every full commit.
+ *
+ * jbd2_fc_begin_commit() locks out updates for the duration of the fast
+ * commit, so the file system sees a quiescent state while logging it, and
+ * keeps the commit thread from starting a full commit underneath it.
+ * Returns -EALREADY if @tid is already committed, and -EINVAL if a fast
+ * commit is not possible right now and the caller has to fall back to a
+ * full commit.
+ */
+int jbd2_fc_begin_commit(journal_t *journal, tid_t tid)
+{
+	journal_wrapper_t *journal_wrapper = jbd2_journal_wrapper(journal);
+
+	if (unlikely(is_journal_aborted(journal)))
+		return -EIO;
+	if (!jbd2_has_feature_fast_commit(journal))
+		return -EINVAL;
+
+	write_lock(&journal->j_state_lock);
+	while (journal->j_flags &
+	       (JBD2_FAST_COMMIT_ONGOING | JBD2_FULL_COMMIT_ONGOING)) {
+		write_unlock(&journal->j_state_lock);
+		wait_event(journal_wrapper->j_fc_wait,
+			   !(READ_ONCE(journal->j_flags) &
+			     (JBD2_FAST_COMMIT_ONGOING |
+			      JBD2_FULL_COMMIT_ONGOING)));
+		write_lock(&journal->j_state_lock);
+	}
+	if (tid_geq(journal->j_commit_sequence, tid)) {
+		write_unlock(&journal->j_state_lock);
+		return -EALREADY;
+	}
+	if (!journal->j_running_transaction ||
+	    journal->j_running_transaction->t_tid != tid ||
+	    tid_geq(journal->j_commit_request, tid) ||
+	    (journal->j_flags & JBD2_FLUSHED) ||
+	    journal_wrapper->j_fc_first + journal_wrapper->j_fc_off >=
+	    journal_wrapper->j_fc_last) {
+		write_unlock(&journal->j_state_lock);
+		return -EINVAL;
+	}
+	journal->j_flags |= JBD2_FAST_COMMIT_ONGOING;
+	journal_wrapper->j_fc_done = journal_wrapper->j_fc_off;
+	write_unlock(&journal->j_state_lock);
+
+	jbd2_journal_lock_updates(journal);
+	return 0;
+}
+EXPORT_SYMBOL(jbd2_fc_begin_commit);
+
+static int __jbd2_fc_end_commit(journal_t *journal, bool fallback)
+{
+	journal_wrapper_t *journal_wrapper = jbd2_journal_wrapper(journal);
+
+	jbd2_journal_unlock_updates(journal);
+
+	write_lock(&journal->j_state_lock);
+	/*
+	 * Recovery stops at the first invalid fast commit block, so nothing
+	 * written after a failed fast commit could ever be replayed: leave
+	 * the rest of this transaction to the full commit.
+	 */
+	if (fallback)
+		journal_wrapper->j_fc_off = journal_wrapper->j_fc_last -
+					    journal_wrapper->j_fc_first;
+	journal->j_flags &= ~JBD2_FAST_COMMIT_ONGOING;
+	write_unlock(&journal->j_state_lock);
+	wake_up(&journal_wrapper->j_fc_wait);
+	return 0;
+}
+
+int jbd2_fc_end_commit(journal_t *journal)
+{
+	return __jbd2_fc_end_commit(journal, false);
+}
+EXPORT_SYMBOL(jbd2_fc_end_commit);
+
+/*
+ * Ends a failed fast commit and starts a full commit of @tid instead; the
+ * caller waits for it with jbd2_complete_transaction().
+ */
+int jbd2_fc_end_commit_fallback(journal_t *journal, tid_t tid)
+{
+	__jbd2_fc_end_commit(journal, true);
+	return jbd2_log_start_commit(journal, tid);
+}
+EXPORT_SYMBOL(jbd2_fc_end_commit_fallback);
+
+/*
+ * Get the next block of the fast commit area.  The returned buffer is
+ * owned by the journal and released by jbd2_fc_wait_bufs() or
+ * jbd2_fc_release_bufs().
+ */
+int jbd2_fc_get_buf(journal_t *journal, struct buffer_head **bh_out)
+{
+	journal_wrapper_t *journal_wrapper = jbd2_journal_wrapper(journal);
+	unsigned long long pblock;
+	unsigned long blocknr;
+	struct buffer_head *bh;
+	int ret;
+
+	*bh_out = NULL;
+	if (journal_wrapper->j_fc_first + journal_wrapper->j_fc_off >=
+	    journal_wrapper->j_fc_last)
+		return -ENOSPC;
+
+	blocknr = journal_wrapper->j_fc_first + journal_wrapper->j_fc_off;
+	ret = jbd2_journal_bmap(journal, blocknr, &pblock);
+	if (ret)
+		return ret;
+
+	bh = __getblk(journal->j_dev, pblock, journal->j_blocksize);
+	if (!bh)
+		return -ENOMEM;
+
+	journal_wrapper->j_fc_wbuf[journal_wrapper->j_fc_off++] = bh;
+	*bh_out = bh;
+	return 0;
+}
+EXPORT_SYMBOL(jbd2_fc_get_buf);
+
+/*
+ * Wait for the oldest @num_blks fast commit buffers not waited on yet and
+ * release them.
+ */
+int jbd2_fc_wait_bufs(journal_t *journal, int num_blks)
+{
+	journal_wrapper_t *journal_wrapper = jbd2_journal_wrapper(journal);
+	struct buffer_head *bh;
+	int i, ret = 0;
+
+	for (i = 0; i < num_blks; i++) {
+		if (journal_wrapper->j_fc_done >= journal_wrapper->j_fc_off)
+			break;
+		bh = journal_wrapper->j_fc_wbuf[journal_wrapper->j_fc_done];
+		journal_wrapper->j_fc_wbuf[journal_wrapper->j_fc_done++] = NULL;
+		wait_on_buffer(bh);
+		if (unlikely(!buffer_uptodate(bh)))
+			ret = -EIO;
+		put_bh(bh);
+	}
+	return ret;
+}
+EXPORT_SYMBOL(jbd2_fc_wait_bufs);
+
+/* Release all fast commit buffers of a failed fast commit. */
+void jbd2_fc_release_bufs(journal_t *journal)
+{
+	journal_wrapper_t *journal_wrapper = jbd2_journal_wrapper(journal);
+
+	jbd2_fc_wait_bufs(journal, journal_wrapper->j_fc_off -
+				   journal_wrapper->j_fc_done);
+}
+EXPORT_SYMBOL(jbd2_fc_release_bufs);
+
 /*
  * Log buffer allocation routines:
  */
@@ -975,6 +1150,8 @@ void jbd2_update_log_tail(journal_t *journal, tid_t tid, unsigned long block)
 struct jbd2_stats_proc_session {
 	journal_t *journal;
 	struct transaction_stats_s *stats;
+	unsigned long space_waits;
+	u64 space_wait_time;
 	int start;
 	int max;
 };
@@ -1000,6 +1177,8 @@ static int jbd2_seq_info_show(struct seq_file *seq, void *v)
 		   "each up to %u blocks\n",
 		   s->stats->ts_tid, s->stats->ts_requested,
 		   s->journal->j_max_transaction_buffers);
+	seq_printf(seq, "%lu waits for journal space, %llums total\n",
+		   s->space_waits, div_u64(s->space_wait_time, NSEC_PER_MSEC));
 	if (s->stats->ts_tid == 0)
 		return 0;
 	seq_printf(seq, "average: \n  %ums waiting for transaction\n",
@@ -1057,6 +1236,10 @@ static int jbd2_seq_info_open(struct inode *inode, struct file *file)
 	memcpy(s->stats, &journal->j_stats, size);
 	s->journal = journal;
 	spin_unlock(&journal->j_history_lock);
+	read_lock(&journal->j_state_lock);
+	s->space_waits = jbd2_journal_wrapper(journal)->j_space_waits;
+	s->space_wait_time = jbd2_journal_wrapper(journal)->j_space_wait_time;
+	read_unlock(&journal->j_state_lock);
 
 	rc = seq_open(file, &jbd2_seq_info_ops);
 	if (rc == 0) {
@@ -1239,6 +1422,9 @@ static journal_t *journal_init_common(struct block_device *bdev,
 	journal->j_sb_buffer = bh;
 	journal->j_superblock = (journal_superblock_t *)bh->b_data;
 
+	init_waitqueue_head(&journal_wrapper->j_fc_wait);
+	init_waitqueue_head(&journal_wrapper->j_wait_checkpoint);
+
 	journal_wrapper->j_shrink_transaction = NULL;
 	journal_wrapper->j_shrinker.scan_objects = jbd2_journal_shrink_scan;
 	journal_wrapper->j_shrinker.count_objects = jbd2_journal_shrink_count;
@@ -1368,6 +1554,8 @@ static int journal_reset(journal_t *journal)
 
 	first = be32_to_cpu(sb->s_first);
 	last = be32_to_cpu(sb->s_maxlen);
+	if (jbd2_has_feature_fast_commit(journal))
+		last = jbd2_journal_wrapper(journal)->j_fc_first;
 	if (first + JBD2_MIN_JOURNAL_BLOCKS > last + 1) {
 		printk(KERN_ERR "JBD2: Journal too short (blocks %llu-%llu).\n",
 		       first, last);
@@ -1714,6 +1902,82 @@ static int journal_get_superblock(journal_t *journal)
 	return err;
 }
 
+/*
+ * Carve the fast commit area out of the end of the journal.  The regular
+ * log then wraps at j_fc_first, which becomes the new j_last.
+ */
+static int jbd2_journal_init_fc(journal_t *journal)
+{
+	journal_wrapper_t *journal_wrapper = jbd2_journal_wrapper(journal);
+	journal_superblock_t *sb = journal->j_superblock;
+	unsigned long maxlen = be32_to_cpu(sb->s_maxlen);
+	int num_fc_blks = jbd2_journal_get_num_fc_blks(sb);
+
+	if (be32_to_cpu(sb->s_first) + JBD2_MIN_JOURNAL_BLOCKS +
+	    num_fc_blks > maxlen + 1) {
+		printk(KERN_ERR "JBD2: Journal too short for %d fast commit "
+		       "blocks.\n", num_fc_blks);
+		return -EINVAL;
+	}
+
+	if (!journal_wrapper->j_fc_wbuf) {
+		journal_wrapper->j_fc_wbuf = kcalloc(num_fc_blks,
+					sizeof(struct buffer_head *),
+					GFP_KERNEL);
+		if (!journal_wrapper->j_fc_wbuf)
+			return -ENOMEM;
+	}
+
+	journal->j_last = maxlen - num_fc_blks;
+	journal_wrapper->j_fc_first = journal->j_last;
+	journal_wrapper->j_fc_last = maxlen;
+	journal_wrapper->j_fc_off = 0;
+	journal_wrapper->j_fc_done = 0;
+	return 0;
+}
+
+/*
+ * Enable fast commits on a loaded journal.  Moving j_last is only safe
+ * while the log is empty, which is the case right after
+ * jbd2_journal_load() and before the first handle is started.
+ */
+static int jbd2_journal_enable_fc(journal_t *journal)
+{
+	journal_wrapper_t *journal_wrapper = jbd2_journal_wrapper(journal);
+	int err = -EBUSY;
+
+	/* Allocate outside of j_state_lock, jbd2_journal_init_fc() reuses it */
+	if (!journal_wrapper->j_fc_wbuf) {
+		journal_wrapper->j_fc_wbuf = kcalloc(
+				jbd2_journal_get_num_fc_blks(journal->j_superblock),
+				sizeof(struct buffer_head *), GFP_KERNEL);
+		if (!journal_wrapper->j_fc_wbuf)
+			return -ENOMEM;
+	}
+
+	write_lock(&journal->j_state_lock);
+	if (journal->j_running_transaction ||
+	    journal->j_committing_transaction ||
+	    journal->j_checkpoint_transactions ||
+	    journal->j_head != journal->j_tail)
+		goto out;
+	err = jbd2_journal_init_fc(journal);
+	if (err)
+		goto out;
+	journal->j_head = journal->j_first;
+	journal->j_tail = journal->j_first;
+	journal->j_free = journal->j_last - journal->j_first;
+	/*
+	 * The feature bit must be on disk before the first fast commit
+	 * block is: make the next commit rewrite the superblock, and
+	 * refuse fast commits until it did.
+	 */
+	journal->j_flags |= JBD2_FLUSHED;
+out:
+	write_unlock(&journal->j_state_lock);
+	return err;
+}
+
 /*
  * Load the on-disk journal superblock and read the key fields into the
  * journal_t.
@@ -1736,6 +2000,9 @@ static int load_superblock(journal_t *journal)
 	journal->j_last = be32_to_cpu(sb->s_maxlen);
 	journal->j_errno = be32_to_cpu(sb->s_errno);
 
+	if (jbd2_has_feature_fast_commit(journal))
+		return jbd2_journal_init_fc(journal);
+
 	return 0;
 }
 
@@ -1896,6 +2163,7 @@ int jbd2_journal_destroy(journal_t *journal)
 	if (journal->j_chksum_driver)
 		crypto_free_shash(journal->j_chksum_driver);
 	kfree(journal->j_wbuf);
+	kfree(journal_wrapper->j_fc_wbuf);
 	kfree(journal_wrapper);
 
 	return err;
@@ -2026,6 +2294,20 @@ int jbd2_journal_set_features (journal_t *journal, unsigned long compat,
 						   sizeof(sb->s_uuid));
 	}
 
+	if (INCOMPAT_FEATURE_ON(JBD2_FEATURE_INCOMPAT_FAST_COMMIT)) {
+		lock_buffer(journal->j_sb_buffer);
+		sb->s_feature_incompat |=
+			cpu_to_be32(JBD2_FEATURE_INCOMPAT_FAST_COMMIT);
+		unlock_buffer(journal->j_sb_buffer);
+		if (jbd2_journal_enable_fc(journal)) {
+			lock_buffer(journal->j_sb_buffer);
+			sb->s_feature_incompat &=
+				~cpu_to_be32(JBD2_FEATURE_INCOMPAT_FAST_COMMIT);
+			unlock_buffer(journal->j_sb_buffer);
+			return 0;
+		}
+	}
+
 	lock_buffer(journal->j_sb_buffer);
 
 	/* If enabling v3 checksums, update superblock */
@@ -35,7 +35,6 @@ struct recovery_info
 	int		nr_revoke_hits;
 };
 
-enum passtype {PASS_SCAN, PASS_REVOKE, PASS_REPLAY};
 static int do_one_pass(journal_t *journal,
 				struct recovery_info *info, enum passtype pass);
 static int scan_revoke_records(journal_t *, struct buffer_head *,
@@ -171,6 +170,50 @@ static int jread(struct buffer_head **bhp, journal_t *journal,
 	return 0;
 }
 
+/*
+ * Hand the fast commit area to the filesystem one block at a time.  The
+ * filesystem validates the blocks in the scan pass and applies them in the
+ * replay pass; it returns JBD2_FC_REPLAY_STOP once it has seen the end of
+ * the valid fast commits.
+ */
+static int fc_do_one_pass(journal_t *journal,
+			  struct recovery_info *info, enum passtype pass)
+{
+	journal_wrapper_t *journal_wrapper = jbd2_journal_wrapper(journal);
+	unsigned long next_fc_block;
+	struct buffer_head *bh;
+	int err = 0;
+
+	next_fc_block = journal_wrapper->j_fc_first;
+	if (!journal_wrapper->j_fc_replay_callback)
+		return 0;
+
+	while (next_fc_block < journal_wrapper->j_fc_last) {
+		jbd_debug(3, "Fast commit replay: next block %ld\n",
+			  next_fc_block);
+		err = jread(&bh, journal, next_fc_block);
+		if (err) {
+			jbd_debug(3, "Fast commit replay: read error\n");
+			break;
+		}
+
+		err = journal_wrapper->j_fc_replay_callback(journal, bh, pass,
+					next_fc_block -
+					journal_wrapper->j_fc_first,
+					info->end_transaction);
+		brelse(bh);
+		next_fc_block++;
+		if (err < 0 || err == JBD2_FC_REPLAY_STOP)
+			break;
+		err = 0;
+	}
+
+	if (err)
+		jbd_debug(3, "Fast commit replay failed, err = %d\n", err);
+
+	return err;
+}
+
 static int jbd2_descriptor_block_csum_verify(journal_t *j, void *buf)
 {
 	struct jbd2_journal_block_tail *tail;
@@ -274,6 +317,11 @@ int jbd2_journal_recover(journal_t *journal)
 		err = do_one_pass(journal, &info, PASS_REVOKE);
 	if (!err)
 		err = do_one_pass(journal, &info, PASS_REPLAY);
+	if (!err && jbd2_has_feature_fast_commit(journal)) {
+		err = fc_do_one_pass(journal, &info, PASS_SCAN);
+		if (!err)
+			err = fc_do_one_pass(journal, &info, PASS_REPLAY);
+	}
 
 	jbd_debug(1, "JBD2: recovery, exit status %d, "
 		  "recovered transactions %u to %u\n",
@@ -44,6 +44,8 @@
 #include "internal.h"
 #include "mount.h"
 
+#include <trace/events/fs.h>
+
 /* [Feb-1997 T. Schoebel-Theuer]
  * Fundamental changes in the pathname lookup mechanisms (namei)
  * were necessary because of omirr.  The reason is that omirr needs
@@ -665,12 +667,14 @@ static bool legitimize_links(struct nameidata *nd)
  * Nothing should touch nameidata between unlazy_walk() failure and
  * terminate_walk().
  */
-static int unlazy_walk(struct nameidata *nd)
+static noinline int unlazy_walk(struct nameidata *nd)
 {
 	struct dentry *parent = nd->path.dentry;
 
 	BUG_ON(!(nd->flags & LOOKUP_RCU));
 
+	trace_fs_unlazy_walk(nd->inode, _RET_IP_);
+
 	nd->flags &= ~LOOKUP_RCU;
 	if (unlikely(!legitimize_links(nd)))
 		goto out2;
@@ -708,10 +712,13 @@ static int unlazy_walk(struct nameidata *nd)
  * Nothing should touch nameidata between unlazy_child() failure and
  * terminate_walk().
  */
-static int unlazy_child(struct nameidata *nd, struct dentry *dentry, unsigned seq)
+static noinline int unlazy_child(struct nameidata *nd, struct dentry *dentry,
+				 unsigned seq)
 {
 	BUG_ON(!(nd->flags & LOOKUP_RCU));
 
+	trace_fs_unlazy_walk(nd->inode, _RET_IP_);
+
 	nd->flags &= ~LOOKUP_RCU;
 	if (unlikely(!legitimize_links(nd)))
 		goto out2;
@@ -81,6 +81,12 @@ struct nfs_clone_mount {
  */
 #define NFS_MAX_READDIR_PAGES 8
 
+/*
+ * Maximum number of transports an NFS client opens to one server
+ * with the "nconnect" mount option.
+ */
+#define NFS_MAX_CONNECTIONS 16
+
 struct nfs_client_initdata {
 	unsigned long init_flags;
 	const char *hostname;			/* Hostname of the server */
@@ -93,6 +99,7 @@ struct nfs_client_initdata {
 	u32 minorversion;
 	struct net *net;
 	const struct rpc_timeout *timeparms;
+	unsigned int nconnect;
 };
 
 /*
@@ -131,6 +138,7 @@ struct nfs_parsed_mount_data {
 		char			*export_path;
 		int			port;
 		unsigned short		protocol;
+		unsigned short		nconnect;
 	} nfs_server;
 
 	struct security_mnt_opts lsm_opts;
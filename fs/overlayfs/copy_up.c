@@ -895,6 +895,43 @@ int ovl_maybe_copy_up(struct dentry *dentry, int flags)
 	return err;
 }
 
+/*
+ * With lazy_copyup, opening a lower regular file for write copies up only
+ * its metadata.  The data is copied up when the file is first modified, so
+ * open latency doesn't depend on the size of the lower file.
+ */
+static bool ovl_open_lazy_copy_up(struct dentry *dentry, int flags)
+{
+	struct ovl_fs *ofs = dentry->d_sb->s_fs_info;
+
+	if (!ofs->config.lazy_copyup || !ofs->config.metacopy)
+		return false;
+
+	/* Truncated file has no data to copy up anyway */
+	if (!d_is_reg(dentry) || (flags & O_TRUNC))
+		return false;
+
+	return true;
+}
+
+int ovl_open_maybe_copy_up(struct dentry *dentry, int flags)
+{
+	int err = 0;
+
+	if (ovl_open_need_copy_up(dentry, flags)) {
+		err = ovl_want_write(dentry);
+		if (!err) {
+			if (ovl_open_lazy_copy_up(dentry, flags))
+				err = ovl_copy_up(dentry);
+			else
+				err = ovl_copy_up_flags(dentry, flags);
+			ovl_drop_write(dentry);
+		}
+	}
+
+	return err;
+}
+
 int ovl_copy_up_with_data(struct dentry *dentry)
 {
 	return ovl_copy_up_flags(dentry, O_WRONLY);
@@ -35,9 +35,14 @@ static struct file *ovl_open_realfile(const struct file *file,
 	struct file *realfile;
 	const struct cred *old_cred;
 	int flags = file->f_flags | OVL_OPEN_FLAGS;
-	int acc_mode = ACC_MODE(flags);
+	int acc_mode;
 	int err;
 
+	/* Data not copied up yet (lazy_copyup), lower is only ever read */
+	if (realinode != ovl_inode_upper(inode))
+		flags = (flags & ~O_ACCMODE) | O_RDONLY;
+
+	acc_mode = ACC_MODE(flags);
 	if (flags & O_APPEND)
 		acc_mode |= MAY_APPEND;
 
@@ -115,7 +120,8 @@ static int ovl_real_fdget_meta(const struct file *file, struct fd *real,
 	}
 
 	/* Did the flags change since open? */
-	if (unlikely((file->f_flags ^ real->file->f_flags) & ~OVL_OPEN_FLAGS))
+	if (unlikely((file->f_flags ^ real->file->f_flags) &
+		     ~(OVL_OPEN_FLAGS | O_ACCMODE)))
 		return ovl_change_flags(real->file, file->f_flags);
 
 	return 0;
@@ -131,7 +137,7 @@ static int ovl_open(struct inode *inode, struct file *file)
 	struct file *realfile;
 	int err;
 
-	err = ovl_maybe_copy_up(file_dentry(file), file->f_flags);
+	err = ovl_open_maybe_copy_up(file_dentry(file), file->f_flags);
 	if (err)
 		return err;
 
@@ -288,6 +294,11 @@ static ssize_t ovl_write_iter(struct kiocb *iocb, struct iov_iter *iter)
 	if (ret)
 		goto out_unlock;
 
+	/* Copy up data if open left it in lower (lazy_copyup) */
+	ret = ovl_maybe_copy_up(file_dentry(file), O_WRONLY);
+	if (ret)
+		goto out_unlock;
+
 	ret = ovl_real_fdget(file, &real);
 	if (ret)
 		goto out_unlock;
@@ -350,6 +361,18 @@ static int ovl_mmap(struct file *file, struct vm_area_struct *vma)
 	if (WARN_ON(file != vma->vm_file))
 		return -EIO;
 
+	/*
+	 * With lazy_copyup, a file opened for write may still be backed by
+	 * lower data, which must never be written through a shared mapping.
+	 * Data copy up cannot be done here with mmap_sem held.
+	 */
+	if (file_inode(realfile) != ovl_inode_upper(file_inode(file)) &&
+	    (file->f_mode & FMODE_WRITE) && (vma->vm_flags & VM_SHARED)) {
+		if (vma->vm_flags & VM_WRITE)
+			return -EACCES;
+		vma->vm_flags &= ~VM_MAYWRITE;
+	}
+
 	vma->vm_file = get_file(realfile);
 
 	old_cred = ovl_override_creds(file_inode(file)->i_sb);
@@ -376,6 +399,10 @@ static long ovl_fallocate(struct file *file, int mode, loff_t offset, loff_t len
 	const struct cred *old_cred;
 	int ret;
 
+	ret = ovl_maybe_copy_up(file_dentry(file), O_WRONLY);
+	if (ret)
+		return ret;
+
 	ret = ovl_real_fdget(file, &real);
 	if (ret)
 		return ret;
@@ -588,6 +615,12 @@ static ssize_t ovl_copyfile(struct file *file_in, loff_t pos_in,
 	const struct cred *old_cred;
 	ssize_t ret;
 
+	if (op != OVL_DEDUPE) {
+		ret = ovl_maybe_copy_up(file_dentry(file_out), O_WRONLY);
+		if (ret)
+			return ret;
+	}
+
 	ret = ovl_real_fdget(file_out, &real_out);
 	if (ret)
 		return ret;
@@ -649,7 +682,8 @@ static int ovl_dedupe_file_range(struct file *file_in, loff_t pos_in,
 	 * most of the time (data would be duplicated instead of deduplicated).
 	 */
 	if (!ovl_inode_upper(file_inode(file_in)) ||
-	    !ovl_inode_upper(file_inode(file_out)))
+	    !ovl_inode_upper(file_inode(file_out)) ||
+	    !ovl_has_upperdata(file_inode(file_out)))
 		return -EPERM;
 
 	return ovl_copyfile(file_in, pos_in, file_out, pos_out, len, 0,
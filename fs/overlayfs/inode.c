@@ -263,6 +263,7 @@ int ovl_getattr(const struct path *path, struct kstat *stat,
 
 int ovl_permission(struct inode *inode, int mask)
 {
+	struct ovl_fs *ofs = inode->i_sb->s_fs_info;
 	struct inode *upperinode = ovl_inode_upper(inode);
 	struct inode *realinode = upperinode ?: ovl_inode_lower(inode);
 	const struct cred *old_cred;
@@ -282,7 +283,11 @@ int ovl_permission(struct inode *inode, int mask)
 	if (err)
 		return err;
 
-	old_cred = ovl_override_creds(inode->i_sb);
+	/*
+	 * Called for every path component, don't bounce the refcount of the
+	 * mounter creds, which live as long as the super block.
+	 */
+	old_cred = override_creds_light(ofs->creator_cred);
 	if (!upperinode &&
 	    !special_file(realinode->i_mode) && mask & MAY_WRITE) {
 		mask &= ~(MAY_WRITE | MAY_APPEND);
@@ -290,7 +295,7 @@ int ovl_permission(struct inode *inode, int mask)
 		mask |= MAY_READ;
 	}
 	err = inode_permission(realinode, mask);
-	revert_creds(old_cred);
+	revert_creds_light(old_cred);
 
 	return err;
 }
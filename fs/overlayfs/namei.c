@@ -847,6 +847,10 @@ struct dentry *ovl_lookup(struct inode *dir, struct dentry *dentry,
 	if (dentry->d_name.len > ofs->namelen)
 		return ERR_PTR(-ENAMETOOLONG);
 
+	/* Don't probe every layer for a name that readdir didn't find */
+	if (ovl_dir_cache_negative(dentry->d_parent, &dentry->d_name))
+		return d_splice_alias(NULL, dentry);
+
 	old_cred = ovl_override_creds(dentry->d_sb);
 	upperdir = ovl_dentry_upper(dentry->d_parent);
 	if (upperdir) {
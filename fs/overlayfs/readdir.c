@@ -244,10 +244,11 @@ static void ovl_cache_put(struct ovl_dir_file *od, struct dentry *dentry)
 
 	WARN_ON(cache->refcount <= 0);
 	cache->refcount--;
-	if (!cache->refcount) {
-		if (ovl_dir_cache(d_inode(dentry)) == cache)
-			ovl_set_dir_cache(d_inode(dentry), NULL);
-
+	/*
+	 * Keep the current cache after last close, it is reused by the next
+	 * opendir and by lookup, and is freed on inode eviction.
+	 */
+	if (!cache->refcount && ovl_dir_cache(d_inode(dentry)) != cache) {
 		ovl_cache_free(&cache->entries);
 		kfree(cache);
 	}
@@ -412,11 +413,15 @@ static struct ovl_dir_cache *ovl_cache_get(struct dentry *dentry)
 
 	cache = ovl_dir_cache(d_inode(dentry));
 	if (cache && ovl_dentry_version_get(dentry) == cache->version) {
-		WARN_ON(!cache->refcount);
 		cache->refcount++;
 		return cache;
 	}
 	ovl_set_dir_cache(d_inode(dentry), NULL);
+	/* Stale cache that no open dir holds any more */
+	if (cache && !cache->refcount) {
+		ovl_cache_free(&cache->entries);
+		kfree(cache);
+	}
 
 	cache = kzalloc(sizeof(struct ovl_dir_cache), GFP_KERNEL);
 	if (!cache)
@@ -439,6 +444,26 @@ static struct ovl_dir_cache *ovl_cache_get(struct dentry *dentry)
 	return cache;
 }
 
+/*
+ * Called from ->lookup() with @dir locked.  Returns true if @dir has a
+ * current merged readdir cache without @name, so none of the layers can have
+ * it and lookup need not probe them.
+ */
+bool ovl_dir_cache_negative(struct dentry *dir, const struct qstr *name)
+{
+	struct ovl_dir_cache *cache;
+
+	/* Cache of a real dir only has impure entries */
+	if (ovl_dir_is_real(dir))
+		return false;
+
+	cache = ovl_dir_cache(d_inode(dir));
+	if (!cache || ovl_dentry_version_get(dir) != cache->version)
+		return false;
+
+	return !ovl_cache_entry_find(&cache->root, name->name, name->len);
+}
+
 /* Map inode number to lower fs unique range */
 static u64 ovl_remap_lower_ino(u64 ino, int xinobits, int fsid,
 			       const char *name, int namelen)
@@ -69,6 +69,11 @@ module_param_named(metacopy, ovl_metacopy_def, bool, 0644);
 MODULE_PARM_DESC(ovl_metacopy_def,
 		 "Default to on or off for the metadata only copy up feature");
 
+static bool ovl_lazy_copyup_def;
+module_param_named(lazy_copyup, ovl_lazy_copyup_def, bool, 0644);
+MODULE_PARM_DESC(ovl_lazy_copyup_def,
+		 "Default to on or off for deferring data copy up to first write");
+
 static void ovl_dentry_release(struct dentry *dentry)
 {
 	struct ovl_entry *oe = dentry->d_fsdata;
@@ -371,6 +376,9 @@ static int ovl_show_options(struct seq_file *m, struct dentry *dentry)
 	if (ofs->config.metacopy != ovl_metacopy_def)
 		seq_printf(m, ",metacopy=%s",
 			   ofs->config.metacopy ? "on" : "off");
+	if (ofs->config.lazy_copyup != ovl_lazy_copyup_def)
+		seq_printf(m, ",lazy_copyup=%s",
+			   ofs->config.lazy_copyup ? "on" : "off");
 	return 0;
 }
 
@@ -419,6 +427,8 @@ enum {
 	OPT_XINO_AUTO,
 	OPT_METACOPY_ON,
 	OPT_METACOPY_OFF,
+	OPT_LAZY_COPYUP_ON,
+	OPT_LAZY_COPYUP_OFF,
 	OPT_ERR,
 };
 
@@ -437,6 +447,8 @@ static const match_table_t ovl_tokens = {
 	{OPT_XINO_AUTO,			"xino=auto"},
 	{OPT_METACOPY_ON,		"metacopy=on"},
 	{OPT_METACOPY_OFF,		"metacopy=off"},
+	{OPT_LAZY_COPYUP_ON,		"lazy_copyup=on"},
+	{OPT_LAZY_COPYUP_OFF,		"lazy_copyup=off"},
 	{OPT_ERR,			NULL}
 };
 
@@ -491,6 +503,7 @@ static int ovl_parse_opt(char *opt, struct ovl_config *config)
 	char *p;
 	int err;
 	bool metacopy_opt = false, redirect_opt = false;
+	bool lazy_copyup_opt = false;
 
 	config->redirect_mode = kstrdup(ovl_redirect_mode_def(), GFP_KERNEL);
 	if (!config->redirect_mode)
@@ -575,6 +588,15 @@ static int ovl_parse_opt(char *opt, struct ovl_config *config)
 			config->metacopy = false;
 			break;
 
+		case OPT_LAZY_COPYUP_ON:
+			config->lazy_copyup = true;
+			lazy_copyup_opt = true;
+			break;
+
+		case OPT_LAZY_COPYUP_OFF:
+			config->lazy_copyup = false;
+			break;
+
 		default:
 			pr_err("overlayfs: unrecognized mount option \"%s\" or missing value\n", p);
 			return -EINVAL;
@@ -621,6 +643,13 @@ static int ovl_parse_opt(char *opt, struct ovl_config *config)
 		}
 	}
 
+	/* Lazy data copy up leaves metacopy inodes behind */
+	if (config->lazy_copyup && !config->metacopy) {
+		if (lazy_copyup_opt)
+			pr_info("overlayfs: disabling lazy_copyup due to metacopy=off\n");
+		config->lazy_copyup = false;
+	}
+
 	return 0;
 }
 
@@ -1677,6 +1706,7 @@ static int ovl_fill_super(struct super_block *sb, void *data, int silent)
 	ofs->config.nfs_export = ovl_nfs_export_def;
 	ofs->config.xino = ovl_xino_def();
 	ofs->config.metacopy = ovl_metacopy_def;
+	ofs->config.lazy_copyup = ovl_lazy_copyup_def;
 	err = ovl_parse_opt((char *) data, &ofs->config);
 	if (err)
 		goto out_err;
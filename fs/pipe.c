@@ -133,19 +133,45 @@ void pipe_wait(struct pipe_inode_info *pipe)
 	pipe_lock(pipe);
 }
 
+/*
+ * Released pages are cached on pipe->tmp_page, up to PIPE_TMP_PAGES of
+ * them, so that a steady stream through the pipe does not go back to the
+ * page allocator for every page.  The cache is protected by the pipe mutex.
+ */
+static bool pipe_put_tmp_page(struct pipe_inode_info *pipe, struct page *page)
+{
+	if (pipe->nr_tmp_pages >= PIPE_TMP_PAGES)
+		return false;
+
+	set_page_private(page, (unsigned long)pipe->tmp_page);
+	pipe->tmp_page = page;
+	pipe->nr_tmp_pages++;
+	return true;
+}
+
+static struct page *pipe_get_tmp_page(struct pipe_inode_info *pipe)
+{
+	struct page *page = pipe->tmp_page;
+
+	if (page) {
+		pipe->tmp_page = (struct page *)page_private(page);
+		set_page_private(page, 0);
+		pipe->nr_tmp_pages--;
+	}
+	return page;
+}
+
 static void anon_pipe_buf_release(struct pipe_inode_info *pipe,
 				  struct pipe_buffer *buf)
 {
 	struct page *page = buf->page;
 
 	/*
-	 * If nobody else uses this page, and we don't already have a
-	 * temporary page, let's keep track of it as a one-deep
-	 * allocation cache. (Otherwise just release our reference to it)
+	 * If nobody else uses this page, and the page cache of the pipe
+	 * is not full, keep it for the next write. (Otherwise just release
+	 * our reference to it)
 	 */
-	if (page_count(page) == 1 && !pipe->tmp_page)
-		pipe->tmp_page = page;
-	else
+	if (page_count(page) != 1 || !pipe_put_tmp_page(pipe, page))
 		put_page(page);
 }
 
@@ -437,7 +463,7 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 		if (bufs < pipe->buffers) {
 			int newbuf = (pipe->curbuf + bufs) & (pipe->buffers-1);
 			struct pipe_buffer *buf = pipe->bufs + newbuf;
-			struct page *page = pipe->tmp_page;
+			struct page *page = pipe_get_tmp_page(pipe);
 			int copied;
 
 			if (!page) {
@@ -446,7 +472,6 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 					ret = ret ? : -ENOMEM;
 					break;
 				}
-				pipe->tmp_page = page;
 			}
 			/* Always wake up, even if the copy fails. Otherwise
 			 * we lock up (O_NONBLOCK-)readers that sleep due to
@@ -456,6 +481,8 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 			do_wakeup = 1;
 			copied = copy_page_from_iter(page, 0, PAGE_SIZE, from);
 			if (unlikely(copied < PAGE_SIZE && iov_iter_count(from))) {
+				if (!pipe_put_tmp_page(pipe, page))
+					__free_page(page);
 				if (!ret)
 					ret = -EFAULT;
 				break;
@@ -473,7 +500,6 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 				buf->flags = PIPE_BUF_FLAG_PACKET;
 			}
 			pipe->nrbufs = ++bufs;
-			pipe->tmp_page = NULL;
 
 			if (!iov_iter_count(from))
 				break;
@@ -697,6 +723,7 @@ struct pipe_inode_info *alloc_pipe_info(void)
 
 void free_pipe_info(struct pipe_inode_info *pipe)
 {
+	struct page *page;
 	int i;
 
 	(void) account_pipe_buffers(pipe->user, pipe->buffers, 0);
@@ -706,8 +733,8 @@ void free_pipe_info(struct pipe_inode_info *pipe)
 		if (buf->ops)
 			pipe_buf_release(pipe, buf);
 	}
-	if (pipe->tmp_page)
-		__free_page(pipe->tmp_page);
+	while ((page = pipe_get_tmp_page(pipe)))
+		__free_page(page);
 	kfree(pipe->bufs);
 	kfree(pipe);
 }
@@ -14,6 +14,9 @@
 #include <linux/module.h>
 #include <linux/io.h>
 #include <linux/uaccess.h>
+#include <linux/hashtable.h>
+#include <linux/radix-tree.h>
+#include <linux/workqueue.h>
 #include <asm/cacheflush.h>
 #include <asm/page.h>
 #include <asm/pgalloc.h>
@@ -162,6 +165,265 @@ static void pic_report_addr(struct page_idle_ctrl *pic, unsigned long addr)
 	dump_pic(pic);
 }
 
+static DEFINE_HASHTABLE(page_scan_states, 6);
+static DEFINE_SPINLOCK(page_scan_states_lock);
+
+static struct page_scan_state *__page_scan_state_find(struct file *file)
+{
+	struct page_scan_state *state;
+
+	hash_for_each_possible(page_scan_states, state, node,
+			       (unsigned long)file) {
+		if (state->file == file)
+			return state;
+	}
+
+	return NULL;
+}
+
+static struct page_scan_state *page_scan_state_find(struct file *file)
+{
+	struct page_scan_state *state;
+
+	spin_lock(&page_scan_states_lock);
+	state = __page_scan_state_find(file);
+	spin_unlock(&page_scan_states_lock);
+
+	return state;
+}
+
+static struct page_scan_state *page_scan_state_get(struct file *file)
+{
+	struct page_scan_state *state, *new;
+
+	state = page_scan_state_find(file);
+	if (state)
+		return state;
+
+	new = kzalloc(sizeof(*new), GFP_KERNEL);
+	if (!new)
+		return NULL;
+
+	new->file = file;
+	mutex_init(&new->lock);
+	spin_lock_init(&new->tree_lock);
+	/* PMD state is allocated from the walkers with irqs disabled */
+	INIT_RADIX_TREE(&new->pmd_state, GFP_ATOMIC | __GFP_NOWARN);
+
+	spin_lock(&page_scan_states_lock);
+	state = __page_scan_state_find(file);
+	if (!state) {
+		hash_add(page_scan_states, &new->node, (unsigned long)file);
+		state = new;
+		new = NULL;
+	}
+	spin_unlock(&page_scan_states_lock);
+
+	kfree(new);
+	return state;
+}
+
+static void page_scan_state_free(struct file *file)
+{
+	struct page_scan_state *state;
+	struct radix_tree_iter iter;
+	void __rcu **slot;
+
+	spin_lock(&page_scan_states_lock);
+	state = __page_scan_state_find(file);
+	if (state)
+		hash_del(&state->node);
+	spin_unlock(&page_scan_states_lock);
+
+	if (!state)
+		return;
+
+	radix_tree_for_each_slot(slot, &state->pmd_state, &iter, 0) {
+		kfree(radix_tree_deref_slot(slot));
+		radix_tree_iter_delete(&state->pmd_state, &iter, slot);
+	}
+	kfree(state);
+}
+
+static void page_scan_begin(struct page_idle_ctrl *pic, struct file *file,
+			    unsigned long start)
+{
+	struct page_scan_state *state = page_scan_state_find(file);
+
+	if (!state)
+		return;
+
+	mutex_lock(&state->lock);
+	if (!start)
+		state->round++;
+	pic->state = state;
+	pic->extent = state->format == PAGE_SCAN_FORMAT_EXTENT;
+}
+
+static void page_scan_end(struct page_idle_ctrl *pic)
+{
+	if (pic->state)
+		mutex_unlock(&pic->state->lock);
+}
+
+static bool pic_idle_target_reached(struct page_idle_ctrl *pic)
+{
+	return pic->state && pic->state->idle_target &&
+	       pic->nr_idle >= pic->state->idle_target;
+}
+
+static u8 *pic_pmd_state(struct page_idle_ctrl *pic, unsigned long addr,
+			 bool create)
+{
+	struct page_scan_state *state = pic->state;
+	unsigned long index = addr >> PUD_SHIFT;
+	u8 *pmds;
+
+	if (!state || !state->rescan_interval)
+		return NULL;
+
+	pmds = radix_tree_lookup(&state->pmd_state, index);
+	if (!pmds && create) {
+		pmds = kzalloc(PTRS_PER_PMD, GFP_ATOMIC | __GFP_NOWARN);
+		if (!pmds)
+			return NULL;
+		spin_lock(&state->tree_lock);
+		if (radix_tree_insert(&state->pmd_state, index, pmds)) {
+			kfree(pmds);
+			/* lost the race against another worker? */
+			pmds = radix_tree_lookup(&state->pmd_state, index);
+		}
+		spin_unlock(&state->tree_lock);
+	}
+
+	return pmds ? pmds + pmd_index(addr) : NULL;
+}
+
+/*
+ * In incremental mode a PMD found idle in the last rounds is only rescanned
+ * every min(idle rounds, rescan_interval) + 1 rounds.  In between it is
+ * reported idle again without touching the accessed bits, so an access in
+ * the meantime is still caught by the next real scan of it.
+ *
+ * Returns the page type to report, or IDLE_PAGE_TYPE_MAX to scan the PMD.
+ */
+static enum ProcIdlePageType pic_skip_pmd(struct page_idle_ctrl *pic,
+					  unsigned long addr)
+{
+	unsigned int cold, interval;
+	u8 *st;
+
+	pic->range_accessed = false;
+	pic->range_idle = false;
+
+	st = pic_pmd_state(pic, addr, false);
+	if (!st)
+		return IDLE_PAGE_TYPE_MAX;
+
+	cold = *st & PMD_STATE_COLD_MASK;
+	if (!cold)
+		return IDLE_PAGE_TYPE_MAX;
+
+	/* spread the rescans of a cold region over the rounds */
+	interval = min(cold, pic->state->rescan_interval) + 1;
+	if (!((pic->state->round + (addr >> PMD_SHIFT)) % interval))
+		return IDLE_PAGE_TYPE_MAX;
+
+	return (*st & PMD_STATE_HUGE) ? PMD_IDLE : PMD_IDLE_PTES;
+}
+
+static void pic_record_pmd(struct page_idle_ctrl *pic, unsigned long addr,
+			   enum ProcIdlePageType page_type)
+{
+	unsigned int cold;
+	u8 *st;
+
+	if (page_type == PMD_HOLE)
+		return;
+
+	st = pic_pmd_state(pic, addr, true);
+	if (!st)
+		return;
+
+	if (pic->range_accessed || !pic->range_idle) {
+		*st = 0;
+		return;
+	}
+
+	cold = min((*st & PMD_STATE_COLD_MASK) + 1, PMD_STATE_COLD_MASK);
+	*st = cold;
+	if (page_type == PMD_IDLE)
+		*st |= PMD_STATE_HUGE;
+}
+
+static int pic_page_added(struct page_idle_ctrl *pic,
+			  enum ProcIdlePageType page_type,
+			  unsigned long page_size)
+{
+	switch (page_type) {
+	case PTE_IDLE:
+	case PMD_IDLE:
+	case PMD_IDLE_PTES:
+		pic->range_idle = true;
+		pic->nr_idle += page_size >> PAGE_SHIFT;
+		break;
+	case PTE_HOLE:
+	case PMD_HOLE:
+		break;
+	default:
+		pic->range_accessed = true;
+		break;
+	}
+
+	/* unwind the walk, the read returns what has been found so far */
+	if (pic_idle_target_reached(pic))
+		return PAGE_IDLE_KBUF_FULL;
+
+	return 0;
+}
+
+static int pic_add_extent(struct page_idle_ctrl *pic,
+			  unsigned long addr,
+			  unsigned long next,
+			  enum ProcIdlePageType page_type)
+{
+	unsigned long page_size = pagetype_size[page_type];
+	struct page_idle_extent *ext = NULL;
+
+	next = round_up(next, page_size);
+
+	if (page_type == PTE_HOLE || page_type == PMD_HOLE) {
+		set_restart_gpa(next, "EXTENT-HOLE");
+		return 0;
+	}
+
+	if (pic->pie_read)
+		ext = (void *)&pic->kpie[pic->pie_read - sizeof(*ext)];
+
+	if (ext && ext->type == page_type && ext->nr_pages < U32_MAX &&
+	    addr + pic->gpa_to_hva == pic->next_hva) {
+		ext->nr_pages++;
+	} else {
+		if (pic->pie_read + sizeof(*ext) > pic->pie_read_max) {
+			set_restart_gpa(addr, "PAGE_IDLE_KBUF_FULL");
+			return PAGE_IDLE_KBUF_FULL;
+		}
+
+		ext = (void *)&pic->kpie[pic->pie_read];
+		ext->start = round_down(addr, page_size) + pic->gpa_to_hva;
+		ext->nr_pages = 1;
+		ext->order = ilog2(page_size) - PAGE_SHIFT;
+		ext->type = page_type;
+		ext->reserved = 0;
+		pic->pie_read += sizeof(*ext);
+	}
+
+	set_next_hva(next + pic->gpa_to_hva, "EXTENT");
+	set_restart_gpa(next, "EXTENT");
+
+	return pic_page_added(pic, page_type, page_size);
+}
+
 static int pic_add_page(struct page_idle_ctrl *pic,
 			unsigned long addr,
 			unsigned long next,
@@ -169,6 +431,9 @@ static int pic_add_page(struct page_idle_ctrl *pic,
 {
 	unsigned long page_size = pagetype_size[page_type];
 
+	if (pic->extent)
+		return pic_add_extent(pic, addr, next, page_type);
+
 	dump_pic(pic);
 
 	/* align kernel/user vision of cursor position */
@@ -202,7 +467,7 @@ static int pic_add_page(struct page_idle_ctrl *pic,
 			set_restart_gpa(next, "IN-PLACE INC");
 			pic->kpie[pic->pie_read - 1]++;
 			WARN_ONCE(page_size < next-addr, "next-addr too large");
-			return 0;
+			return pic_page_added(pic, page_type, page_size);
 		}
 		if (pic->pie_read >= pic->pie_read_max) {
 			set_restart_gpa(addr, "PAGE_IDLE_KBUF_FULL");
@@ -215,7 +480,7 @@ static int pic_add_page(struct page_idle_ctrl *pic,
 	pic->kpie[pic->pie_read] = PIP_COMPOSE(page_type, 1);
 	pic->pie_read++;
 
-	return 0;
+	return pic_page_added(pic, page_type, page_size);
 }
 
 static int init_page_idle_ctrl_buffer(struct page_idle_ctrl *pic)
@@ -269,15 +534,18 @@ static int page_idle_copy_user(struct page_idle_ctrl *pic,
 
 	if (start >= end && start > pic->next_hva) {
 		set_next_hva(start, "TAIL-HOLE");
-		pic_report_addr(pic, start);
+		/* extents carry their own address, *ppos tells where we are */
+		if (!pic->extent)
+			pic_report_addr(pic, start);
 	}
 
 	bytes_read = pic->pie_read;
 	if (!bytes_read)
 		return 1;
 
-	ret = copy_to_user(pic->buf, pic->kpie, bytes_read);
-	if (ret)
+	if (pic->kbuf)
+		memcpy((void __force *)pic->buf, pic->kpie, bytes_read);
+	else if (copy_to_user(pic->buf, pic->kpie, bytes_read))
 		return -EFAULT;
 
 	pic->buf += bytes_read;
@@ -347,6 +615,14 @@ static int ept_pmd_range(struct page_idle_ctrl *pic,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		page_type = pic_skip_pmd(pic, addr);
+		if (page_type != IDLE_PAGE_TYPE_MAX) {
+			err = pic_add_page(pic, addr, next, page_type);
+			if (err)
+				break;
+			continue;
+		}
+
 		if (KVM_CHECK_INVALID_SPTE(pmd->pmd))
 			page_type = PMD_IDLE;
 		else if (!ept_pmd_present(*pmd))
@@ -370,6 +646,7 @@ static int ept_pmd_range(struct page_idle_ctrl *pic,
 			err = ept_pte_range(pic, pmd, addr, next);
 		if (err)
 			break;
+		pic_record_pmd(pic, addr, page_type);
 	} while (pmd++, addr = next, addr != end);
 
 	return err;
@@ -544,6 +821,14 @@ static int arm_pmd_range(struct page_idle_ctrl *pic,
 	pmd = stage2_pmd_offset(kvm, pud, addr);
 	do {
 		next = stage2_pmd_addr_end(kvm, addr, end);
+		page_type = pic_skip_pmd(pic, addr);
+		if (page_type != IDLE_PAGE_TYPE_MAX) {
+			err = pic_add_page(pic, addr, next, page_type);
+			if (err)
+				break;
+			continue;
+		}
+
 		if (!pmd_present(*pmd))
 			page_type = PMD_HOLE;
 		else if (!if_pmd_thp_or_huge(*pmd))
@@ -560,6 +845,7 @@ static int arm_pmd_range(struct page_idle_ctrl *pic,
 			err = arm_pte_range(pic, pmd, addr, next);
 		if (err)
 			break;
+		pic_record_pmd(pic, addr, page_type);
 	} while (pmd++, addr = next, addr != end);
 
 	return err;
@@ -721,7 +1007,7 @@ static int vm_idle_walk_hva_range(struct page_idle_ctrl *pic,
 
 		start = pic->restart_gpa + pic->gpa_to_hva;
 		ret = page_idle_copy_user(pic, start, va_end);
-		if (ret)
+		if (ret || pic_idle_target_reached(pic))
 			break;
 	}
 
@@ -746,7 +1032,9 @@ static ssize_t vm_idle_read(struct file *file, char *buf,
 	setup_page_idle_ctrl(pic, buf, count, file->f_flags);
 	pic->kvm = mm_kvm(mm);
 
+	page_scan_begin(pic, file, hva_start);
 	ret = vm_idle_walk_hva_range(pic, hva_start, hva_end);
+	page_scan_end(pic);
 	if (ret)
 		goto out_kvm;
 
@@ -809,6 +1097,8 @@ static int page_scan_release(struct inode *inode, struct file *file)
 	struct kvm *kvm;
 	int ret = 0;
 
+	page_scan_state_free(file);
+
 	if (!mm) {
 		ret = -EBADF;
 		goto out;
@@ -884,6 +1174,10 @@ static int mm_idle_pmd_entry(pmd_t *pmd, unsigned long addr,
 	}
 	pic->last_va = addr;
 
+	page_type = pic_skip_pmd(pic, addr);
+	if (page_type != IDLE_PAGE_TYPE_MAX)
+		return pic_add_page(pic, addr, next, page_type);
+
 	if (pic->flags & SCAN_HUGE_PAGE)
 		pte_page_type = PMD_IDLE_PTES;
 	else
@@ -903,6 +1197,8 @@ static int mm_idle_pmd_entry(pmd_t *pmd, unsigned long addr,
 		err = pic_add_page(pic, addr, next, page_type);
 	else
 		err = mm_idle_pte_range(pic, pmd, addr, next);
+	if (!err)
+		pic_record_pmd(pic, addr, page_type);
 
 	return err;
 }
@@ -967,7 +1263,7 @@ static int mm_idle_walk_range(struct page_idle_ctrl *pic,
 		WARN_ONCE(pic->gpa_to_hva, "non-zero gpa_to_hva");
 		start = pic->restart_gpa;
 		ret = page_idle_copy_user(pic, start, end);
-		if (ret)
+		if (ret || pic_idle_target_reached(pic))
 			break;
 	}
 
@@ -981,11 +1277,24 @@ static int mm_idle_walk_range(struct page_idle_ctrl *pic,
 	return ret;
 }
 
+static int mm_idle_scan(struct page_idle_ctrl *pic, struct mm_struct *mm,
+			unsigned long start, unsigned long end)
+{
+	struct mm_walk mm_walk = {
+		.mm = mm,
+		.pmd_entry = mm_idle_pmd_entry,
+		.pud_entry = mm_idle_pud_entry,
+		.test_walk = mm_idle_test_walk,
+		.private = pic,
+	};
+
+	return mm_idle_walk_range(pic, start, end, &mm_walk);
+}
+
 static ssize_t mm_idle_read(struct file *file, char *buf,
 				size_t count, loff_t *ppos)
 {
 	struct mm_struct *mm = file->private_data;
-	struct mm_walk mm_walk = {};
 	struct page_idle_ctrl *pic;
 	unsigned long va_start = *ppos;
 	unsigned long va_end = va_start + (count << (3 + PAGE_SHIFT));
@@ -1013,13 +1322,9 @@ static ssize_t mm_idle_read(struct file *file, char *buf,
 
 	setup_page_idle_ctrl(pic, buf, count, file->f_flags);
 
-	mm_walk.mm = mm;
-	mm_walk.pmd_entry = mm_idle_pmd_entry;
-	mm_walk.pud_entry = mm_idle_pud_entry;
-	mm_walk.test_walk = mm_idle_test_walk;
-	mm_walk.private = pic;
-
-	ret = mm_idle_walk_range(pic, va_start, va_end, &mm_walk);
+	page_scan_begin(pic, file, va_start);
+	ret = mm_idle_scan(pic, mm, va_start, va_end);
+	page_scan_end(pic);
 	if (ret)
 		goto out_free;
 
@@ -1030,23 +1335,187 @@ static ssize_t mm_idle_read(struct file *file, char *buf,
 	return ret;
 }
 
+struct page_scan_work {
+	struct work_struct work;
+	struct mm_struct *mm;
+	struct page_idle_ctrl *pic;
+	void *kbuf;
+	struct page_scan_range range;
+};
+
+static void page_scan_work_fn(struct work_struct *work)
+{
+	struct page_scan_work *psw = container_of(work, struct page_scan_work,
+						  work);
+	struct page_scan_range *range = &psw->range;
+	struct page_idle_ctrl *pic = psw->pic;
+	int ret;
+
+	if (mm_kvm(psw->mm)) {
+		pic->kvm = mm_kvm(psw->mm);
+		ret = vm_idle_walk_hva_range(pic, range->start, range->end);
+	} else {
+		ret = mm_idle_scan(pic, psw->mm, range->start, range->end);
+	}
+
+	range->error = ret;
+	range->bytes = ret ? 0 : pic->bytes_copied;
+	range->next = ret ? range->start : pic->next_hva;
+}
+
+static int page_scan_range_check(struct page_scan_range *range)
+{
+	if (range->start >= range->end || range->end > TASK_SIZE)
+		return -EINVAL;
+	if (range->start & (PAGE_SIZE - 1))
+		return -EINVAL;
+	if (range->buf_size < PAGE_IDLE_BUF_MIN)
+		return -EINVAL;
+
+	return 0;
+}
+
+/*
+ * Split one scan over up to PAGE_SCAN_MAX_WORKERS kernel workers.  Each
+ * worker fills a kernel buffer which is copied to its user buffer once all
+ * of them are done, so the workers never touch the caller's address space.
+ */
+static long page_scan_parallel(struct file *filp, void __user *argp)
+{
+	struct mm_struct *mm = filp->private_data;
+	struct page_scan_range __user *uranges;
+	struct page_scan_parallel par;
+	struct page_scan_state *state;
+	struct page_scan_work *works;
+	unsigned int i, nr;
+	long ret = 0;
+
+	if (copy_from_user(&par, argp, sizeof(par)))
+		return -EFAULT;
+
+	nr = par.nr_ranges;
+	if (!nr || nr > PAGE_SCAN_MAX_WORKERS)
+		return -EINVAL;
+	uranges = u64_to_user_ptr(par.ranges);
+
+	works = kcalloc(nr, sizeof(*works), GFP_KERNEL);
+	if (!works)
+		return -ENOMEM;
+
+	for (i = 0; i < nr; i++) {
+		struct page_scan_range *range = &works[i].range;
+
+		if (copy_from_user(range, &uranges[i], sizeof(*range))) {
+			ret = -EFAULT;
+			goto out_free;
+		}
+
+		ret = page_scan_range_check(range);
+		if (ret)
+			goto out_free;
+
+		range->buf_size = min_t(__u32, range->buf_size,
+					PAGE_SCAN_WORKER_BUF_MAX);
+		works[i].kbuf = kvmalloc(range->buf_size, GFP_KERNEL);
+		works[i].pic = kzalloc(sizeof(*works[i].pic), GFP_KERNEL);
+		if (!works[i].kbuf || !works[i].pic) {
+			ret = -ENOMEM;
+			goto out_free;
+		}
+
+		setup_page_idle_ctrl(works[i].pic,
+				     (void __force __user *)works[i].kbuf,
+				     range->buf_size, filp->f_flags);
+		works[i].pic->kbuf = true;
+		INIT_WORK(&works[i].work, page_scan_work_fn);
+	}
+
+	if (!mm || !mmget_not_zero(mm)) {
+		ret = -ESRCH;
+		goto out_free;
+	}
+
+	state = page_scan_state_find(filp);
+	if (state) {
+		mutex_lock(&state->lock);
+		state->round++;
+	}
+
+	for (i = 0; i < nr; i++) {
+		works[i].mm = mm;
+		works[i].pic->state = state;
+		works[i].pic->extent = state &&
+				       state->format == PAGE_SCAN_FORMAT_EXTENT;
+		queue_work(system_unbound_wq, &works[i].work);
+	}
+	for (i = 0; i < nr; i++)
+		flush_work(&works[i].work);
+
+	if (state)
+		mutex_unlock(&state->lock);
+	mmput(mm);
+
+	for (i = 0; i < nr; i++) {
+		struct page_scan_range *range = &works[i].range;
+
+		if (copy_to_user(u64_to_user_ptr(range->buf), works[i].kbuf,
+				 range->bytes) ||
+		    copy_to_user(&uranges[i], range, sizeof(*range))) {
+			ret = -EFAULT;
+			break;
+		}
+	}
+
+out_free:
+	for (i = 0; i < nr; i++) {
+		kvfree(works[i].kbuf);
+		kfree(works[i].pic);
+	}
+	kfree(works);
+
+	return ret;
+}
+
 static long page_scan_ioctl(struct file *filp, unsigned int cmd,
 	unsigned long arg)
 {
 	void __user *argp = (void __user *)arg;
+	struct page_scan_state *state;
 	unsigned int flags;
 
+	if (cmd == IDLE_SCAN_PARALLEL)
+		return page_scan_parallel(filp, argp);
+
 	if (get_user(flags, (unsigned int __user *)argp))
 		return -EFAULT;
 
-	flags &= ALL_SCAN_FLAGS;
-
 	switch (cmd) {
 	case VMA_SCAN_ADD_FLAGS:
-		filp->f_flags |= flags;
+		filp->f_flags |= flags & ALL_SCAN_FLAGS;
 		break;
 	case VMA_SCAN_REMOVE_FLAGS:
-		filp->f_flags &= ~flags;
+		filp->f_flags &= ~(flags & ALL_SCAN_FLAGS);
+		break;
+	case IDLE_SCAN_SET_RESCAN_INTERVAL:
+	case IDLE_SCAN_SET_IDLE_TARGET:
+	case IDLE_SCAN_SET_FORMAT:
+		if (cmd == IDLE_SCAN_SET_FORMAT &&
+		    flags > PAGE_SCAN_FORMAT_EXTENT)
+			return -EINVAL;
+
+		state = page_scan_state_get(filp);
+		if (!state)
+			return -ENOMEM;
+
+		mutex_lock(&state->lock);
+		if (cmd == IDLE_SCAN_SET_RESCAN_INTERVAL)
+			state->rescan_interval = min_t(unsigned int, flags,
+						       PMD_STATE_COLD_MASK);
+		else if (cmd == IDLE_SCAN_SET_IDLE_TARGET)
+			state->idle_target = flags;
+		else
+			state->format = flags;
+		mutex_unlock(&state->lock);
 		break;
 	default:
 		return -EOPNOTSUPP;
@@ -14,6 +14,52 @@
 #define IDLE_SCAN_MAGIC         0x66
 #define VMA_SCAN_ADD_FLAGS      _IOW(IDLE_SCAN_MAGIC, 0x2, unsigned int)
 #define VMA_SCAN_REMOVE_FLAGS   _IOW(IDLE_SCAN_MAGIC, 0x3, unsigned int)
+#define IDLE_SCAN_SET_RESCAN_INTERVAL	_IOW(IDLE_SCAN_MAGIC, 0x4, unsigned int)
+#define IDLE_SCAN_SET_IDLE_TARGET	_IOW(IDLE_SCAN_MAGIC, 0x5, unsigned int)
+#define IDLE_SCAN_PARALLEL	_IOWR(IDLE_SCAN_MAGIC, 0x6, struct page_scan_parallel)
+#define IDLE_SCAN_SET_FORMAT	_IOW(IDLE_SCAN_MAGIC, 0x7, unsigned int)
+
+/* output formats of IDLE_SCAN_SET_FORMAT */
+#define PAGE_SCAN_FORMAT_PIP	0	/* PIP_CMD_SET_HVA + PIP_COMPOSE bytes */
+#define PAGE_SCAN_FORMAT_EXTENT	1	/* struct page_idle_extent */
+
+/*
+ * One run of nr_pages pages of (PAGE_SIZE << order) bytes starting at HVA
+ * start, all of the same ProcIdlePageType.  Holes are not reported.  The
+ * fields are in native byte order.
+ */
+struct page_idle_extent {
+	__u64 start;
+	__u32 nr_pages;
+	__u8 order;
+	__u8 type;
+	__u16 reserved;
+};
+
+#define PAGE_SCAN_MAX_WORKERS	64
+#define PAGE_SCAN_WORKER_BUF_MAX	(16 << 20)
+
+/*
+ * One range of IDLE_SCAN_PARALLEL, scanned by its own kernel worker into
+ * its own buffer, in the same format as read().  start/end are HVA for a
+ * KVM process and VA otherwise.
+ */
+struct page_scan_range {
+	__u64 start;
+	__u64 end;
+	__u64 buf;
+	__u32 buf_size;
+	__u32 bytes;		/* out: bytes written to buf */
+	__u64 next;		/* out: where to continue, like *ppos */
+	__s32 error;		/* out: 0 or -errno of this range */
+	__u32 reserved;
+};
+
+struct page_scan_parallel {
+	__u32 nr_ranges;
+	__u32 reserved;
+	__u64 ranges;		/* struct page_scan_range[nr_ranges] */
+};
 
 enum ProcIdlePageType {
 	PTE_ACCESSED,	/* 4k page */
@@ -118,6 +164,33 @@ extern struct file_operations proc_page_scan_operations;
 
 #define PAGE_IDLE_KBUF_SIZE	8000
 
+/* per PMD state byte kept for incremental scans */
+#define PMD_STATE_COLD_MASK	0x0f	/* rounds the PMD was found idle */
+#define PMD_STATE_HUGE		0x10	/* the PMD maps a huge page */
+
+/*
+ * State of one idle_pages file kept across read() calls, allocated by the
+ * first IDLE_SCAN_SET_* ioctl.  A round starts with each read at offset 0.
+ */
+struct page_scan_state {
+	struct hlist_node node;
+	struct file *file;
+	struct mutex lock;
+
+	/*
+	 * PUD index => PTRS_PER_PMD bytes of PMD_STATE_*.  Parallel workers
+	 * look it up locklessly and insert under tree_lock, nothing is
+	 * deleted before the file is released.
+	 */
+	struct radix_tree_root pmd_state;
+	spinlock_t tree_lock;
+	unsigned long round;
+
+	unsigned int rescan_interval;	/* 0: scan every PMD every round */
+	unsigned int idle_target;	/* 0: no early stop */
+	unsigned int format;		/* PAGE_SCAN_FORMAT_* */
+};
+
 struct page_idle_ctrl {
 	struct mm_struct *mm;
 	struct kvm *kvm;
@@ -129,6 +202,7 @@ struct page_idle_ctrl {
 	void __user *buf;
 	int buf_size;
 	int bytes_copied;
+	bool kbuf;			/* buf is a kernel buffer */
 
 	unsigned long next_hva;		/* GPA for EPT; VA for PT */
 	unsigned long gpa_to_hva;
@@ -136,6 +210,12 @@ struct page_idle_ctrl {
 	unsigned long last_va;
 
 	unsigned int flags;
+
+	struct page_scan_state *state;
+	bool extent;			/* PAGE_SCAN_FORMAT_EXTENT output */
+	unsigned long nr_idle;		/* idle pages reported by this read */
+	bool range_accessed;		/* of the PMD being scanned */
+	bool range_idle;
 };
 
 #endif
@@ -6,6 +6,7 @@
 #include <linux/proc_fs.h>
 #include <linux/sched/mm.h>
 #include <linux/mm.h>
+#include <linux/slab.h>
 #include <linux/swap.h>
 #include <linux/mempolicy.h>
 #include <linux/uaccess.h>
@@ -19,6 +20,7 @@
 #define SET_SWAPCACHE_WMARK	_IOW(RECLAIM_SWAPCACHE_MAGIC, 0x02, unsigned int)
 #define RECLAIM_SWAPCACHE_ON	_IOW(RECLAIM_SWAPCACHE_MAGIC, 0x01, unsigned int)
 #define RECLAIM_SWAPCACHE_OFF	_IOW(RECLAIM_SWAPCACHE_MAGIC, 0x00, unsigned int)
+#define SET_MIGRATE_NODE	_IOW(RECLAIM_SWAPCACHE_MAGIC, 0x03, int)
 
 #define WATERMARK_MAX           100
 #define SWAP_SCAN_NUM_MAX       32
@@ -27,14 +29,62 @@ static struct task_struct *reclaim_swapcache_tk;
 static bool enable_swapcache_reclaim;
 static unsigned long swapcache_watermark[ETMEM_SWAPCACHE_NR_WMARK];
 
+struct swap_pages_private {
+	struct mm_struct *mm;
+	/*
+	 * NUMA_NO_NODE swaps the written addresses out.  Otherwise they
+	 * are migrated to this node: a slow memory node to demote cold
+	 * pages, or a normal one to promote them back.
+	 */
+	int migrate_node;
+};
+
 static DECLARE_WAIT_QUEUE_HEAD(reclaim_queue);
 
+#if defined(CONFIG_NUMA) && defined(CONFIG_MIGRATION)
+static void etmem_add_page_for_migrate(struct page *page, int nid,
+				       struct list_head *pagelist)
+{
+	add_page_for_migrate(page, nid, pagelist);
+}
+
+static void etmem_migrate_pages(struct list_head *pagelist, int nid)
+{
+	migrate_pages_to_node(pagelist, nid);
+}
+
+static int set_migrate_node(struct swap_pages_private *priv, int nid)
+{
+	if (nid != NUMA_NO_NODE &&
+	    (nid < 0 || nid >= MAX_NUMNODES || !node_online(nid)))
+		return -EINVAL;
+
+	WRITE_ONCE(priv->migrate_node, nid);
+	return 0;
+}
+#else
+static void etmem_add_page_for_migrate(struct page *page, int nid,
+				       struct list_head *pagelist)
+{
+	put_page(page);
+}
+
+static void etmem_migrate_pages(struct list_head *pagelist, int nid) {}
+
+static int set_migrate_node(struct swap_pages_private *priv, int nid)
+{
+	return nid == NUMA_NO_NODE ? 0 : -EOPNOTSUPP;
+}
+#endif
+
 static ssize_t swap_pages_write(struct file *file, const char __user *buf,
 				size_t count, loff_t *ppos)
 {
 	char *p, *data, *data_ptr_res;
 	unsigned long vaddr;
-	struct mm_struct *mm = file->private_data;
+	struct swap_pages_private *priv = file->private_data;
+	struct mm_struct *mm = priv->mm;
+	int nid = READ_ONCE(priv->migrate_node);
 	struct page *page;
 	LIST_HEAD(pagelist);
 	int ret = 0;
@@ -69,11 +119,18 @@ static ssize_t swap_pages_write(struct file *file, const char __user *buf,
 		if (!page)
 			continue;
 
-		add_page_for_swap(page, &pagelist);
+		if (nid == NUMA_NO_NODE)
+			add_page_for_swap(page, &pagelist);
+		else
+			etmem_add_page_for_migrate(page, nid, &pagelist);
 	}
 
-	if (!list_empty(&pagelist))
-		reclaim_pages(&pagelist);
+	if (!list_empty(&pagelist)) {
+		if (nid == NUMA_NO_NODE)
+			reclaim_pages(&pagelist);
+		else
+			etmem_migrate_pages(&pagelist, nid);
+	}
 
 	ret = count;
 	kfree(data_ptr_res);
@@ -85,14 +142,33 @@ static ssize_t swap_pages_write(struct file *file, const char __user *buf,
 
 static int swap_pages_open(struct inode *inode, struct file *file)
 {
+	struct swap_pages_private *priv;
+
 	if (!try_module_get(THIS_MODULE))
 		return -EBUSY;
 
+	priv = kzalloc(sizeof(*priv), GFP_KERNEL);
+	if (!priv) {
+		module_put(THIS_MODULE);
+		return -ENOMEM;
+	}
+
+	/* the mm reference stays owned by the proc file */
+	priv->mm = file->private_data;
+	priv->migrate_node = NUMA_NO_NODE;
+	file->private_data = priv;
+
 	return 0;
 }
 
 static int swap_pages_release(struct inode *inode, struct file *file)
 {
+	struct swap_pages_private *priv = file->private_data;
+
+	/* hand the mm back for the proc file to drop */
+	file->private_data = priv->mm;
+	kfree(priv);
+
 	module_put(THIS_MODULE);
 	return 0;
 }
@@ -220,6 +296,7 @@ static long swap_page_ioctl(struct file *filp, unsigned int cmd,
 {
 	void __user *argp = (void __user *)arg;
 	unsigned int ratio;
+	int nid;
 
 	switch (cmd) {
 	case RECLAIM_SWAPCACHE_ON:
@@ -237,6 +314,11 @@ static long swap_page_ioctl(struct file *filp, unsigned int cmd,
 		if (get_swapcache_watermark(ratio) != 0)
 			return -EFAULT;
 		break;
+	case SET_MIGRATE_NODE:
+		if (get_user(nid, (int __user *)argp))
+			return -EFAULT;
+
+		return set_migrate_node(filp->private_data, nid);
 	default:
 		return -EPERM;
 	}
@@ -78,6 +78,7 @@ void task_mem(struct seq_file *m, struct mm_struct *mm)
 	seq_puts(m, " kB\n");
 	hugetlb_report_usage(m, mm);
 	reliable_report_usage(m, mm);
+	spf_report_usage(m, mm);
 }
 #undef SEQ_PUT_DEC
 
@@ -1188,8 +1189,10 @@ static ssize_t clear_refs_write(struct file *file, const char __user *buf,
 					goto out_mm;
 				}
 				for (vma = mm->mmap; vma; vma = vma->vm_next) {
+					vm_write_begin(vma);
 					vma->vm_flags &= ~VM_SOFTDIRTY;
 					vma_set_page_prot(vma);
+					vm_write_end(vma);
 				}
 				downgrade_write(&mm->mmap_sem);
 				break;
@@ -1914,23 +1917,32 @@ static int mm_swap_open(struct inode *inode, struct file *file)
 
 	file->private_data = mm;
 
-	if (proc_swap_pages_operations.open)
-		return proc_swap_pages_operations.open(inode, file);
+	if (proc_swap_pages_operations.open) {
+		ret = proc_swap_pages_operations.open(inode, file);
+		if (ret) {
+			if (mm)
+				mmdrop(mm);
+			module_put(module);
+		}
+		return ret;
+	}
 
 	return 0;
 }
 
 static int mm_swap_release(struct inode *inode, struct file *file)
 {
-	struct mm_struct *mm = file->private_data;
+	struct mm_struct *mm;
 	int ret = 0;
 
-	if (mm)
-		mmdrop(mm);
-
+	/* the module may keep its own state in private_data until here */
 	if (proc_swap_pages_operations.release)
 		ret = proc_swap_pages_operations.release(inode, file);
 
+	mm = file->private_data;
+	if (mm)
+		mmdrop(mm);
+
 	if (proc_swap_pages_operations.owner)
 		module_put(proc_swap_pages_operations.owner);
 	return ret;
@@ -312,6 +312,16 @@ _xfs_buf_free_pages(
 	}
 }
 
+static void
+xfs_buf_free_callback(
+	struct rcu_head		*cb)
+{
+	struct xfs_buf		*bp = container_of(cb, struct xfs_buf, b_rcu);
+
+	xfs_buf_free_maps(bp);
+	kmem_zone_free(xfs_buf_zone, bp);
+}
+
 /*
  *	Releases the specified buffer.
  *
@@ -342,8 +352,9 @@ xfs_buf_free(
 	} else if (bp->b_flags & _XBF_KMEM)
 		kmem_free(bp->b_addr);
 	_xfs_buf_free_pages(bp);
-	xfs_buf_free_maps(bp);
-	kmem_zone_free(xfs_buf_zone, bp);
+
+	/* lockless lookups in xfs_buf_find() may still be looking at it */
+	call_rcu(&bp->b_rcu, xfs_buf_free_callback);
 }
 
 /*
@@ -608,11 +619,37 @@ xfs_buf_find(
 	pag = xfs_perag_get(btp->bt_mount,
 			    xfs_daddr_to_agno(btp->bt_mount, cmap.bm_bn));
 
+	/*
+	 * Cache hits don't need the pag_buf_lock. Buffers are freed via RCU,
+	 * so a buffer we find here stays valid until we drop the RCU read
+	 * lock, and we only take a reference if it hasn't already dropped to
+	 * zero. A zero hold count means xfs_buf_rele() is tearing the buffer
+	 * down or moving it to the LRU under the pag_buf_lock, so retry the
+	 * lookup under that lock to see how it ended up.
+	 */
+	rcu_read_lock();
+	bp = rhashtable_lookup(&pag->pag_buf_hash, &cmap, xfs_buf_hash_params);
+	if (bp && atomic_inc_not_zero(&bp->b_hold)) {
+		rcu_read_unlock();
+		xfs_perag_put(pag);
+		goto found;
+	}
+	rcu_read_unlock();
+
+	/* No match found, and nothing to insert */
+	if (!bp && !new_bp) {
+		XFS_STATS_INC(btp->bt_mount, xb_miss_locked);
+		xfs_perag_put(pag);
+		return -ENOENT;
+	}
+
 	spin_lock(&pag->pag_buf_lock);
 	bp = rhashtable_lookup_fast(&pag->pag_buf_hash, &cmap,
 				    xfs_buf_hash_params);
 	if (bp) {
 		atomic_inc(&bp->b_hold);
+		spin_unlock(&pag->pag_buf_lock);
+		xfs_perag_put(pag);
 		goto found;
 	}
 
@@ -633,8 +670,6 @@ xfs_buf_find(
 	return 0;
 
 found:
-	spin_unlock(&pag->pag_buf_lock);
-	xfs_perag_put(pag);
 
 	if (!xfs_buf_trylock(bp)) {
 		if (flags & XBF_TRYLOCK) {
@@ -2150,6 +2185,8 @@ xfs_buf_init(void)
 void
 xfs_buf_terminate(void)
 {
+	/* wait for RCU freed buffers before destroying the zone */
+	rcu_barrier();
 	kmem_zone_destroy(xfs_buf_zone);
 }
 
@@ -251,6 +251,98 @@ xfs_inode_clear_reclaim_tag(
 	xfs_perag_clear_reclaim_tag(pag);
 }
 
+/*
+ * Background inactivation.
+ *
+ * Freeing an unlinked inode - truncating it, tearing down its attribute
+ * fork and freeing it in the inobt - takes several transactions. Rather
+ * than making the task that dropped the last reference wait for all that,
+ * evicted unlinked inodes are queued on a per-AG list and inactivated by a
+ * per-AG work item on an unbound workqueue, so that a mass unlink returns
+ * quickly and the freeing work spreads over AGs and CPUs.  Queued inodes
+ * carry XFS_NEED_INACTIVE: lookups back off until they become reclaimable
+ * and inode reclaim never sees them as they aren't tagged yet.
+ *
+ * An AG with too large a backlog, or a filesystem short of free space,
+ * inactivates synchronously again so that neither memory nor the space held
+ * by deleted files can run away from the unlinking tasks.
+ */
+#define XFS_INODEGC_MAX_BACKLOG		(32 * 1024)
+
+static bool
+xfs_inodegc_throttled(
+	struct xfs_mount	*mp,
+	struct xfs_perag	*pag)
+{
+	if (atomic_read(&pag->pag_inodegc_count) >= XFS_INODEGC_MAX_BACKLOG)
+		return true;
+	return percpu_counter_compare(&mp->m_fdblocks,
+				      mp->m_low_space[XFS_LOWSP_5_PCNT]) < 0;
+}
+
+/*
+ * Queue an evicted inode for background inactivation.  Returns false if the
+ * caller has to inactivate it itself.
+ */
+bool
+xfs_inode_queue_inactive(
+	struct xfs_inode	*ip)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_perag	*pag;
+	bool			queued = false;
+
+	/* Only unlinked inodes need the expensive part of xfs_inactive */
+	if (VFS_I(ip)->i_mode == 0 || VFS_I(ip)->i_nlink != 0)
+		return false;
+	if ((mp->m_flags & XFS_MOUNT_RDONLY) || XFS_FORCED_SHUTDOWN(mp))
+		return false;
+
+	pag = xfs_perag_get(mp, XFS_INO_TO_AGNO(mp, ip->i_ino));
+	if (!xfs_inodegc_throttled(mp, pag)) {
+		xfs_iflags_set(ip, XFS_NEED_INACTIVE);
+		atomic_inc(&pag->pag_inodegc_count);
+		llist_add(&ip->i_gclist, &pag->pag_inodegc_list);
+		queue_work(mp->m_inodegc_workqueue, &pag->pag_inodegc_work);
+		queued = true;
+	}
+	xfs_perag_put(pag);
+	return queued;
+}
+
+void
+xfs_inodegc_worker(
+	struct work_struct	*work)
+{
+	struct xfs_perag	*pag = container_of(work, struct xfs_perag,
+						    pag_inodegc_work);
+	struct xfs_inode	*ip, *n;
+	struct llist_node	*node;
+
+	node = llist_del_all(&pag->pag_inodegc_list);
+	/* Process in eviction order, it tends to follow the directory order */
+	node = llist_reverse_order(node);
+	llist_for_each_entry_safe(ip, n, node, i_gclist) {
+		xfs_inactive(ip);
+		ASSERT(XFS_FORCED_SHUTDOWN(ip->i_mount) ||
+		       ip->i_delayed_blks == 0);
+		XFS_STATS_INC(ip->i_mount, vn_reclaim);
+
+		xfs_iflags_clear(ip, XFS_NEED_INACTIVE);
+		atomic_dec(&pag->pag_inodegc_count);
+		xfs_inode_set_reclaim_tag(ip);
+		cond_resched();
+	}
+}
+
+/* Wait for all queued inodes to be inactivated */
+void
+xfs_inodegc_flush(
+	struct xfs_mount	*mp)
+{
+	flush_workqueue(mp->m_inodegc_workqueue);
+}
+
 static void
 xfs_inew_wait(
 	struct xfs_inode	*ip)
@@ -382,7 +474,7 @@ xfs_iget_cache_hit(
 	 *	     wait_on_inode to wait for these flags to be cleared
 	 *	     instead of polling for it.
 	 */
-	if (ip->i_flags & (XFS_INEW|XFS_IRECLAIM)) {
+	if (ip->i_flags & (XFS_INEW|XFS_IRECLAIM|XFS_NEED_INACTIVE)) {
 		trace_xfs_iget_skip(ip);
 		XFS_STATS_INC(mp, xs_ig_frecycle);
 		error = -EAGAIN;
@@ -757,7 +849,8 @@ xfs_inode_ag_walk_grab(
 
 	/* avoid new or reclaimable inodes. Leave for reclaim code to flush */
 	if ((!newinos && __xfs_iflags_test(ip, XFS_INEW)) ||
-	    __xfs_iflags_test(ip, XFS_IRECLAIMABLE | XFS_IRECLAIM))
+	    __xfs_iflags_test(ip, XFS_IRECLAIMABLE | XFS_IRECLAIM |
+				  XFS_NEED_INACTIVE))
 		goto out_unlock_noent;
 	spin_unlock(&ip->i_flags_lock);
 
@@ -55,6 +55,9 @@ typedef struct xfs_inode {
 	xfs_extnum_t		i_cnextents;	/* # of extents in cow fork */
 	unsigned int		i_cformat;	/* format of cow fork */
 
+	/* Per-AG list of inodes waiting for background inactivation */
+	struct llist_node	i_gclist;
+
 	/* VFS inode */
 	struct inode		i_vnode;	/* embedded VFS inode */
 } xfs_inode_t;
@@ -229,6 +232,7 @@ static inline bool xfs_inode_has_cow_data(struct xfs_inode *ip)
  */
 #define XFS_IRECOVERY		(1 << 11)
 #define XFS_ICOWBLOCKS		(1 << 12)/* has the cowblocks tag set */
+#define XFS_NEED_INACTIVE	(1 << 13)/* queued for background inactivation */
 
 /*
  * Per-lifetime flags need to be reset when re-using a reclaimable inode during
@@ -58,6 +58,7 @@ typedef __u32			xfs_nlink_t;
 #include <linux/kthread.h>
 #include <linux/freezer.h>
 #include <linux/list_sort.h>
+#include <linux/llist.h>
 #include <linux/ratelimit.h>
 #include <linux/rhashtable.h>
 
@@ -384,6 +384,11 @@ xlog_cil_insert_format_items(
  * if the change requires additional log metadata. If it does, take that space
  * as well. Remove the amount of space we added to the checkpoint ticket from
  * the current transaction ticket so that the accounting works out correctly.
+ *
+ * Everything except the first commit into an empty CIL is accounted in the
+ * local CPU's xlog_cil_pcp structure, so concurrent commits only share the
+ * xc_ctx_lock read lock and the context order id. The push aggregates the
+ * per-cpu state into the context.
  */
 static void
 xlog_cil_insert_items(
@@ -392,11 +397,13 @@ xlog_cil_insert_items(
 {
 	struct xfs_cil		*cil = log->l_cilp;
 	struct xfs_cil_ctx	*ctx = cil->xc_ctx;
+	struct xlog_cil_pcp	*cilpcp;
 	struct xfs_log_item	*lip;
 	int			len = 0;
 	int			diff_iovecs = 0;
 	int			iclog_space;
 	int			iovhdr_res = 0, split_res = 0, ctx_res = 0;
+	uint32_t		order;
 
 	ASSERT(tp);
 
@@ -406,16 +413,9 @@ xlog_cil_insert_items(
 	 */
 	xlog_cil_insert_format_items(log, tp, &len, &diff_iovecs);
 
-	spin_lock(&cil->xc_cil_lock);
-
 	/* account for space used by new iovec headers  */
 	iovhdr_res = diff_iovecs * sizeof(xlog_op_header_t);
 	len += iovhdr_res;
-	ctx->nvecs += diff_iovecs;
-
-	/* attach the transaction to the CIL if it has any busy extents */
-	if (!list_empty(&tp->t_busy))
-		list_splice_init(&tp->t_busy, &ctx->busy_extents);
 
 	/*
 	 * Now transfer enough transaction reservation to the context ticket
@@ -423,27 +423,62 @@ xlog_cil_insert_items(
 	 * reservation has to grow as well as the current reservation as we
 	 * steal from tickets so we can correctly determine the space used
 	 * during the transaction commit.
+	 *
+	 * Only the commit that clears XLOG_CIL_EMPTY touches the context
+	 * ticket here. The bit is only set again with the xc_ctx_lock held
+	 * exclusively, so there is no other writer to the ticket while we
+	 * hold it shared. Test it first so the common case doesn't dirty the
+	 * cacheline.
 	 */
-	if (ctx->ticket->t_curr_res == 0) {
+	if (test_bit(XLOG_CIL_EMPTY, &cil->xc_flags) &&
+	    test_and_clear_bit(XLOG_CIL_EMPTY, &cil->xc_flags) &&
+	    ctx->ticket->t_curr_res == 0) {
 		ctx_res = ctx->ticket->t_unit_res;
 		ctx->ticket->t_curr_res = ctx_res;
 		tp->t_ticket->t_curr_res -= ctx_res;
 	}
 
-	/* do we need space for more log record headers? */
+	order = atomic_inc_return(&ctx->order_id);
+
+	cilpcp = get_cpu_ptr(cil->xc_pcp);
+
+	/* attach the transaction to the CIL if it has any busy extents */
+	if (!list_empty(&tp->t_busy))
+		list_splice_init(&tp->t_busy, &cilpcp->busy_extents);
+
+	/*
+	 * Do we need space for more log record headers? We can't see where
+	 * the other CPUs' commits will land in the checkpoint, so account the
+	 * space committed on each CPU as if it were written to log records of
+	 * its own. This can only over-reserve, and the excess is returned when
+	 * the checkpoint ticket is released. The unit reservation stolen above
+	 * already covers one record header.
+	 */
 	iclog_space = log->l_iclog_size - log->l_iclog_hsize;
-	if (len > 0 && (ctx->space_used / iclog_space !=
-				(ctx->space_used + len) / iclog_space)) {
-		split_res = (len + iclog_space - 1) / iclog_space;
+	if (ctx_res)
+		cilpcp->hdr_space += iclog_space;
+	if (len > cilpcp->hdr_space) {
+		split_res = (len - cilpcp->hdr_space + iclog_space - 1) /
+								iclog_space;
+		cilpcp->hdr_space += split_res * iclog_space;
 		/* need to take into account split region headers, too */
 		split_res *= log->l_iclog_hsize + sizeof(struct xlog_op_header);
-		ctx->ticket->t_unit_res += split_res;
-		ctx->ticket->t_curr_res += split_res;
+		cilpcp->space_reserved += split_res;
 		tp->t_ticket->t_curr_res -= split_res;
 		ASSERT(tp->t_ticket->t_curr_res >= len);
 	}
+	cilpcp->hdr_space -= len;
 	tp->t_ticket->t_curr_res -= len;
-	ctx->space_used += len;
+
+	/*
+	 * Fold the local space count into the context once it gets large
+	 * enough for the background push to care about it.
+	 */
+	cilpcp->space_used += len;
+	if (cilpcp->space_used > XLOG_CIL_PCP_SPACE(log)) {
+		atomic_add(cilpcp->space_used, &ctx->space_used);
+		cilpcp->space_used = 0;
+	}
 
 	/*
 	 * If we've overrun the reservation, dump the tx details before we move
@@ -461,9 +496,12 @@ xlog_cil_insert_items(
 	}
 
 	/*
-	 * Now (re-)position everything modified at the tail of the CIL.
-	 * We do this here so we only need to take the CIL lock once during
-	 * the transaction commit.
+	 * Now add everything modified to the local CPU's list. Items that are
+	 * already in the CIL stay on whichever per-cpu list they were first
+	 * added to; only the push removes items from those lists, and it
+	 * can't run until we drop the context lock. Stamping the order id
+	 * moves the item to the tail of the checkpoint when the push sorts
+	 * the aggregated list.
 	 */
 	list_for_each_entry(lip, &tp->t_items, li_trans) {
 
@@ -471,16 +509,12 @@ xlog_cil_insert_items(
 		if (!test_bit(XFS_LI_DIRTY, &lip->li_flags))
 			continue;
 
-		/*
-		 * Only move the item if it isn't already at the tail. This is
-		 * to prevent a transient list_empty() state when reinserting
-		 * an item that is already the only item in the CIL.
-		 */
-		if (!list_is_last(&lip->li_cil, &cil->xc_cil))
-			list_move_tail(&lip->li_cil, &cil->xc_cil);
+		lip->li_order_id = order;
+		if (list_empty(&lip->li_cil))
+			list_add_tail(&lip->li_cil, &cilpcp->log_items);
 	}
 
-	spin_unlock(&cil->xc_cil_lock);
+	put_cpu_ptr(cil->xc_pcp);
 
 	if (tp->t_ticket->t_curr_res < 0)
 		xfs_force_shutdown(log->l_mp, SHUTDOWN_LOG_IO_ERROR);
@@ -609,6 +643,52 @@ xlog_cil_committed(
 		kmem_free(ctx);
 }
 
+static int
+xlog_cil_order_cmp(
+	void			*priv,
+	struct list_head	*a,
+	struct list_head	*b)
+{
+	struct xfs_log_item	*l1 = container_of(a, struct xfs_log_item,
+						   li_cil);
+	struct xfs_log_item	*l2 = container_of(b, struct xfs_log_item,
+						   li_cil);
+
+	return l1->li_order_id > l2->li_order_id;
+}
+
+/*
+ * Gather the per-cpu CIL state into the current context. The caller holds
+ * the xc_ctx_lock exclusively, so no commit can be adding to the per-cpu
+ * structures. The item lists are spliced onto the CIL and sorted back into
+ * commit order, as related items (e.g. intents and their done items) must
+ * appear in the checkpoint in the order they were committed.
+ */
+static void
+xlog_cil_pcp_aggregate(
+	struct xfs_cil		*cil,
+	struct xfs_cil_ctx	*ctx)
+{
+	struct xlog_cil_pcp	*cilpcp;
+	int			cpu;
+
+	for_each_possible_cpu(cpu) {
+		cilpcp = per_cpu_ptr(cil->xc_pcp, cpu);
+
+		atomic_add(cilpcp->space_used, &ctx->space_used);
+		if (cilpcp->space_reserved) {
+			ctx->ticket->t_unit_res += cilpcp->space_reserved;
+			ctx->ticket->t_curr_res += cilpcp->space_reserved;
+		}
+		cilpcp->space_used = 0;
+		cilpcp->space_reserved = 0;
+		cilpcp->hdr_space = 0;
+		list_splice_init(&cilpcp->busy_extents, &ctx->busy_extents);
+		list_splice_tail_init(&cilpcp->log_items, &cil->xc_cil);
+	}
+	list_sort(NULL, &cil->xc_cil, xlog_cil_order_cmp);
+}
+
 /*
  * Push the Committed Item List to the log. If @push_seq flag is zero, then it
  * is a background flush and so we can chose to ignore it. Otherwise, if the
@@ -649,6 +729,7 @@ xlog_cil_push(
 
 	down_write(&cil->xc_ctx_lock);
 	ctx = cil->xc_ctx;
+	xlog_cil_pcp_aggregate(cil, ctx);
 
 	spin_lock(&cil->xc_push_lock);
 	push_seq = cil->xc_push_seq;
@@ -657,9 +738,12 @@ xlog_cil_push(
 	/*
 	 * Check if we've anything to push. If there is nothing, then we don't
 	 * move on to a new sequence number and so we have to be able to push
-	 * this sequence again later.
+	 * this sequence again later. Commits that dirtied no items still
+	 * cleared XLOG_CIL_EMPTY, so set it again to let log forces see there
+	 * is nothing to wait for.
 	 */
 	if (list_empty(&cil->xc_cil)) {
+		set_bit(XLOG_CIL_EMPTY, &cil->xc_flags);
 		cil->xc_push_seq = 0;
 		spin_unlock(&cil->xc_push_lock);
 		goto out_skip;
@@ -701,9 +785,9 @@ xlog_cil_push(
 
 	/*
 	 * pull all the log vectors off the items in the CIL, and
-	 * remove the items from the CIL. We don't need the CIL lock
-	 * here because it's only needed on the transaction commit
-	 * side which is currently locked out by the flush lock.
+	 * remove the items from the CIL. The per-cpu lists have already
+	 * been gathered into the CIL, and the transaction commit side is
+	 * locked out by the context lock.
 	 */
 	lv = NULL;
 	num_iovecs = 0;
@@ -733,6 +817,7 @@ xlog_cil_push(
 	new_ctx->sequence = ctx->sequence + 1;
 	new_ctx->cil = cil;
 	cil->xc_ctx = new_ctx;
+	set_bit(XLOG_CIL_EMPTY, &cil->xc_flags);
 
 	/*
 	 * The switch is now done, so we can drop the context lock and move out
@@ -889,13 +974,13 @@ xlog_cil_push_background(
 	 * The cil won't be empty because we are called while holding the
 	 * context lock so whatever we added to the CIL will still be there
 	 */
-	ASSERT(!list_empty(&cil->xc_cil));
+	ASSERT(!test_bit(XLOG_CIL_EMPTY, &cil->xc_flags));
 
 	/*
 	 * don't do a background push if we haven't used up all the
 	 * space available yet.
 	 */
-	if (cil->xc_ctx->space_used < XLOG_CIL_SPACE_LIMIT(log))
+	if (atomic_read(&cil->xc_ctx->space_used) < XLOG_CIL_SPACE_LIMIT(log))
 		return;
 
 	spin_lock(&cil->xc_push_lock);
@@ -933,7 +1018,8 @@ xlog_cil_push_now(
 	 * there's no work we need to do.
 	 */
 	spin_lock(&cil->xc_push_lock);
-	if (list_empty(&cil->xc_cil) || push_seq <= cil->xc_push_seq) {
+	if (test_bit(XLOG_CIL_EMPTY, &cil->xc_flags) ||
+	    push_seq <= cil->xc_push_seq) {
 		spin_unlock(&cil->xc_push_lock);
 		return;
 	}
@@ -951,7 +1037,7 @@ xlog_cil_empty(
 	bool		empty = false;
 
 	spin_lock(&cil->xc_push_lock);
-	if (list_empty(&cil->xc_cil))
+	if (test_bit(XLOG_CIL_EMPTY, &cil->xc_flags))
 		empty = true;
 	spin_unlock(&cil->xc_push_lock);
 	return empty;
@@ -1095,7 +1181,7 @@ xlog_cil_force_lsn(
 	 * we would have found the context on the committing list.
 	 */
 	if (sequence == cil->xc_current_sequence &&
-	    !list_empty(&cil->xc_cil)) {
+	    !test_bit(XLOG_CIL_EMPTY, &cil->xc_flags)) {
 		spin_unlock(&cil->xc_push_lock);
 		goto restart;
 	}
@@ -1154,21 +1240,31 @@ xlog_cil_init(
 {
 	struct xfs_cil	*cil;
 	struct xfs_cil_ctx *ctx;
+	struct xlog_cil_pcp *cilpcp;
+	int		cpu;
 
 	cil = kmem_zalloc(sizeof(*cil), KM_SLEEP|KM_MAYFAIL);
 	if (!cil)
 		return -ENOMEM;
 
 	ctx = kmem_zalloc(sizeof(*ctx), KM_SLEEP|KM_MAYFAIL);
-	if (!ctx) {
-		kmem_free(cil);
-		return -ENOMEM;
+	if (!ctx)
+		goto out_free_cil;
+
+	cil->xc_pcp = alloc_percpu(struct xlog_cil_pcp);
+	if (!cil->xc_pcp)
+		goto out_free_ctx;
+
+	for_each_possible_cpu(cpu) {
+		cilpcp = per_cpu_ptr(cil->xc_pcp, cpu);
+		INIT_LIST_HEAD(&cilpcp->busy_extents);
+		INIT_LIST_HEAD(&cilpcp->log_items);
 	}
 
 	INIT_WORK(&cil->xc_push_work, xlog_cil_push_work);
 	INIT_LIST_HEAD(&cil->xc_cil);
 	INIT_LIST_HEAD(&cil->xc_committing);
-	spin_lock_init(&cil->xc_cil_lock);
+	set_bit(XLOG_CIL_EMPTY, &cil->xc_flags);
 	spin_lock_init(&cil->xc_push_lock);
 	init_rwsem(&cil->xc_ctx_lock);
 	init_waitqueue_head(&cil->xc_commit_wait);
@@ -1183,12 +1279,20 @@ xlog_cil_init(
 	cil->xc_log = log;
 	log->l_cilp = cil;
 	return 0;
+
+out_free_ctx:
+	kmem_free(ctx);
+out_free_cil:
+	kmem_free(cil);
+	return -ENOMEM;
 }
 
 void
 xlog_cil_destroy(
 	struct xlog	*log)
 {
+	int		cpu;
+
 	if (log->l_cilp->xc_ctx) {
 		if (log->l_cilp->xc_ctx->ticket)
 			xfs_log_ticket_put(log->l_cilp->xc_ctx->ticket);
@@ -1196,6 +1300,14 @@ xlog_cil_destroy(
 	}
 
 	ASSERT(list_empty(&log->l_cilp->xc_cil));
+	for_each_possible_cpu(cpu) {
+		struct xlog_cil_pcp *cilpcp = per_cpu_ptr(log->l_cilp->xc_pcp,
+							  cpu);
+
+		ASSERT(list_empty(&cilpcp->log_items));
+		ASSERT(list_empty(&cilpcp->busy_extents));
+	}
+	free_percpu(log->l_cilp->xc_pcp);
 	kmem_free(log->l_cilp);
 }
 
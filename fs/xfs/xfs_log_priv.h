@@ -239,8 +239,8 @@ struct xfs_cil_ctx {
 	xfs_lsn_t		start_lsn;	/* first LSN of chkpt commit */
 	xfs_lsn_t		commit_lsn;	/* chkpt commit record lsn */
 	struct xlog_ticket	*ticket;	/* chkpt ticket */
-	int			nvecs;		/* number of regions */
-	int			space_used;	/* aggregate size of regions */
+	atomic_t		space_used;	/* aggregate size of regions */
+	atomic_t		order_id;	/* last commit order id */
 	struct list_head	busy_extents;	/* busy extents in chkpt */
 	struct xfs_log_vec	*lv_chain;	/* logvecs being pushed */
 	struct xfs_log_callback	log_cb;		/* completion callback hook. */
@@ -248,6 +248,24 @@ struct xfs_cil_ctx {
 	struct work_struct	discard_endio_work;
 };
 
+/*
+ * Per-cpu CIL tracking
+ *
+ * Transaction commits add their log items, busy extents and space to the
+ * structure of the CPU they run on while holding the xc_ctx_lock shared, so
+ * concurrent commits never touch the same cachelines.  The push gathers them
+ * into the checkpoint context with the xc_ctx_lock held exclusively.  Items
+ * carry the order id of the commit that last logged them so the push can
+ * restore commit order across the per-cpu lists.
+ */
+struct xlog_cil_pcp {
+	int			space_used;	/* space not yet in ctx */
+	int			space_reserved;	/* stolen split hdr space */
+	int			hdr_space;	/* space covered by split hdrs */
+	struct list_head	busy_extents;
+	struct list_head	log_items;
+};
+
 /*
  * Committed Item List structure
  *
@@ -267,7 +285,8 @@ struct xfs_cil_ctx {
 struct xfs_cil {
 	struct xlog		*xc_log;
 	struct list_head	xc_cil;
-	spinlock_t		xc_cil_lock;
+	unsigned long		xc_flags;
+	struct xlog_cil_pcp __percpu *xc_pcp;
 
 	struct rw_semaphore	xc_ctx_lock ____cacheline_aligned_in_smp;
 	struct xfs_cil_ctx	*xc_ctx;
@@ -280,6 +299,9 @@ struct xfs_cil {
 	struct work_struct	xc_push_work;
 } ____cacheline_aligned_in_smp;
 
+/* xc_flags bit values */
+#define	XLOG_CIL_EMPTY		0	/* no commits in the current ctx */
+
 /*
  * The amount of log space we allow the CIL to aggregate is difficult to size.
  * Whatever we choose, we have to make sure we can get a reservation for the
@@ -329,6 +351,14 @@ struct xfs_cil {
  */
 #define XLOG_CIL_SPACE_LIMIT(log)	(log->l_logsize >> 3)
 
+/*
+ * Space a CPU may accumulate before folding it into the context.  The
+ * background push check only sees folded space, so a checkpoint can overshoot
+ * the limit by up to one batch per CPU before a push is queued.
+ */
+#define XLOG_CIL_PCP_SPACE(log)	\
+	(XLOG_CIL_SPACE_LIMIT(log) / num_online_cpus())
+
 /*
  * ticket grant locks, queues and accounting have their own cachlines
  * as these are quite hot and can be operated on concurrently.
@@ -204,6 +204,8 @@ xfs_initialize_perag(
 		spin_lock_init(&pag->pag_ici_lock);
 		mutex_init(&pag->pag_ici_reclaim_lock);
 		INIT_RADIX_TREE(&pag->pag_ici_root, GFP_ATOMIC);
+		init_llist_head(&pag->pag_inodegc_list);
+		INIT_WORK(&pag->pag_inodegc_work, xfs_inodegc_worker);
 		if (xfs_buf_hash_init(pag))
 			goto out_free_pag;
 		init_waitqueue_head(&pag->pagb_wait);
@@ -1011,6 +1013,8 @@ xfs_mountfs(
 	xfs_rtunmount_inodes(mp);
  out_rele_rip:
 	xfs_irele(rip);
+	/* Inactivate the unlinked inodes released by log recovery. */
+	xfs_inodegc_flush(mp);
 	/* Clean out dquots that might be in memory after quotacheck. */
 	xfs_qm_unmount(mp);
 	/*
@@ -1062,6 +1066,8 @@ xfs_unmountfs(
 	uint64_t		resblks;
 	int			error;
 
+	/* Finish off the inodes evicted by the unmount */
+	xfs_inodegc_flush(mp);
 	xfs_icache_disable_reclaim(mp);
 	xfs_fs_unreserve_ag_blocks(mp);
 	xfs_qm_unmount_quotas(mp);
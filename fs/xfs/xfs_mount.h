@@ -170,6 +170,7 @@ typedef struct xfs_mount {
 	struct workqueue_struct	*m_reclaim_workqueue;
 	struct workqueue_struct	*m_log_workqueue;
 	struct workqueue_struct *m_eofblocks_workqueue;
+	struct workqueue_struct	*m_inodegc_workqueue;
 	struct workqueue_struct	*m_sync_workqueue;
 
 	/*
@@ -370,6 +371,11 @@ typedef struct xfs_perag {
 	struct mutex	pag_ici_reclaim_lock;	/* serialisation point */
 	unsigned long	pag_ici_reclaim_cursor;	/* reclaim restart point */
 
+	/* unlinked inodes waiting for background inactivation */
+	struct llist_head pag_inodegc_list;
+	atomic_t	pag_inodegc_count;	/* inodes on pag_inodegc_list */
+	struct work_struct pag_inodegc_work;	/* inactivates the list */
+
 	/* buffer cache index */
 	spinlock_t	pag_buf_lock;	/* lock for pag_buf_hash */
 	struct rhashtable pag_buf_hash;
@@ -874,8 +874,16 @@ xfs_init_mount_workqueues(
 	if (!mp->m_sync_workqueue)
 		goto out_destroy_eofb;
 
+	mp->m_inodegc_workqueue = alloc_workqueue("xfs-inodegc/%s",
+			WQ_MEM_RECLAIM|WQ_FREEZABLE|WQ_UNBOUND, 0,
+			mp->m_fsname);
+	if (!mp->m_inodegc_workqueue)
+		goto out_destroy_sync;
+
 	return 0;
 
+out_destroy_sync:
+	destroy_workqueue(mp->m_sync_workqueue);
 out_destroy_eofb:
 	destroy_workqueue(mp->m_eofblocks_workqueue);
 out_destroy_log:
@@ -898,6 +906,7 @@ STATIC void
 xfs_destroy_mount_workqueues(
 	struct xfs_mount	*mp)
 {
+	destroy_workqueue(mp->m_inodegc_workqueue);
 	destroy_workqueue(mp->m_sync_workqueue);
 	destroy_workqueue(mp->m_eofblocks_workqueue);
 	destroy_workqueue(mp->m_log_workqueue);
@@ -924,6 +933,9 @@ xfs_flush_inodes(
 		sync_inodes_sb(sb);
 		up_read(&sb->s_umount);
 	}
+
+	/* Return the space held by deleted files waiting for inactivation */
+	xfs_inodegc_flush(mp);
 }
 
 /* Catch misguided souls that try to use this interface on XFS */
@@ -951,6 +963,10 @@ xfs_fs_destroy_inode(
 	XFS_STATS_INC(ip->i_mount, vn_rele);
 	XFS_STATS_INC(ip->i_mount, vn_remove);
 
+	/* Unlinked inodes are freed in the background */
+	if (xfs_inode_queue_inactive(ip))
+		return;
+
 	xfs_inactive(ip);
 
 	ASSERT(XFS_FORCED_SHUTDOWN(ip->i_mount) || ip->i_delayed_blks == 0);
@@ -1071,6 +1087,13 @@ xfs_fs_sync_fs(
 	if (!wait)
 		return 0;
 
+	/*
+	 * Inactivation needs transactions, so it has to be done before a
+	 * freeze blocks them.
+	 */
+	if (sb->s_writers.frozen == SB_FREEZE_PAGEFAULT)
+		xfs_inodegc_flush(mp);
+
 	xfs_log_force(mp, XFS_LOG_SYNC);
 	if (laptop_mode) {
 		/*
@@ -1362,6 +1385,9 @@ xfs_fs_remount(
 		 */
 		xfs_icache_disable_reclaim(mp);
 
+		/* Inactivation of queued inodes isn't possible once read-only */
+		xfs_inodegc_flush(mp);
+
 		/* Get rid of any leftover CoW reservations... */
 		error = xfs_icache_free_cowblocks(mp, NULL);
 		if (error) {
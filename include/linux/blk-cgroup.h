@@ -42,6 +42,7 @@ enum blkg_rwstat_type {
 };
 
 struct blkcg_gq;
+struct blk_lat_hist;
 
 struct blkcg {
 	struct cgroup_subsys_state	css;
@@ -59,7 +60,15 @@ struct blkcg {
 	refcount_t			cgwb_refcnt;
 #endif
 
+#if IS_ENABLED(CONFIG_BLK_CGROUP_IOPRIO) && !defined(__GENKSYMS__)
+	/* blk-ioprio class policy, see block/blk-ioprio.c */
+	union {
+		unsigned int		prio_policy;
+		unsigned long		kabi_reserve1;
+	};
+#else
 	KABI_RESERVE(1)
+#endif
 	KABI_RESERVE(2)
 	KABI_RESERVE(3)
 	KABI_RESERVE(4)
@@ -139,6 +148,9 @@ struct blkcg_gq {
 	struct blkg_rwstat		stat_bytes;
 	struct blkg_rwstat		stat_ios;
 
+	/* completion latency histogram, if enabled on the queue */
+	struct blk_lat_hist __percpu	*lat_hist;
+
 	struct blkg_policy_data		*pd[BLKCG_MAX_POLS];
 
 	struct rcu_head			rcu_head;
@@ -8,6 +8,7 @@
 
 struct blk_mq_tags;
 struct blk_flush_queue;
+struct blk_lat_hist;
 
 /**
  * struct blk_mq_hw_ctx - State for a hardware queue facing the hardware block device
@@ -71,6 +72,10 @@ struct blk_mq_hw_ctx {
 #endif
 
 	struct list_head hctx_list;
+
+	/* completion latency histogram, allocated once enabled */
+	struct blk_lat_hist __percpu *lat_hist;
+
 	KABI_RESERVE(1)
 	KABI_RESERVE(2)
 	KABI_RESERVE(3)
@@ -247,6 +252,7 @@ int blk_mq_alloc_tag_set(struct blk_mq_tag_set *set);
 void blk_mq_free_tag_set(struct blk_mq_tag_set *set);
 
 void blk_mq_flush_plug_list(struct blk_plug *plug, bool from_schedule);
+void blk_mq_free_plug_rqs(struct blk_plug *plug);
 
 void blk_mq_free_request(struct request *rq);
 bool blk_mq_can_queue(struct blk_mq_hw_ctx *);
@@ -293,6 +299,26 @@ void blk_mq_start_request(struct request *rq);
 void blk_mq_end_request(struct request *rq, blk_status_t error);
 void __blk_mq_end_request(struct request *rq, blk_status_t error);
 
+/*
+ * Requests completed by a driver in one pass over its completion queue can be
+ * collected in an io_comp_batch with blk_mq_add_to_batch() and ended together
+ * by the driver's ->complete() handler through blk_mq_end_request_batch().
+ */
+struct io_comp_batch {
+	struct list_head req_list;
+	bool need_ts;
+	void (*complete)(struct io_comp_batch *);
+};
+
+#define DEFINE_IO_COMP_BATCH(name)					\
+	struct io_comp_batch name = {					\
+		.req_list = LIST_HEAD_INIT(name.req_list),		\
+	}
+
+bool blk_mq_add_to_batch(struct request *rq, struct io_comp_batch *iob,
+			 int ioerror, void (*complete)(struct io_comp_batch *));
+void blk_mq_end_request_batch(struct io_comp_batch *iob);
+
 void blk_mq_requeue_request(struct request *rq, bool kick_requeue_list);
 void blk_mq_add_to_requeue_list(struct request *rq, bool at_head,
 				bool kick_requeue_list);
@@ -20,6 +20,7 @@
 #include <linux/u64_stats_sync.h>
 #include <linux/workqueue.h>
 #include <linux/bpf-cgroup.h>
+#include <linux/psi_types.h>
 
 #ifdef CONFIG_CGROUPS
 
@@ -448,6 +449,11 @@ struct cgroup {
 	/* If there is block congestion on this cgroup. */
 	atomic_t congestion_count;
 
+#ifndef __GENKSYMS__
+	/* used to track pressure stalls, allocated by psi_cgroup_alloc() */
+	struct psi_group *psi;
+#endif
+
 	/* ids of the ancestors at each level including self */
 	int ancestor_ids[];
 };
@@ -535,6 +541,13 @@ struct cftype {
 	int (*open)(struct kernfs_open_file *of);
 	void (*release)(struct kernfs_open_file *of);
 
+	/*
+	 * poll() falls back to kernfs_generic_poll(), which reports the
+	 * changes signalled with cgroup_file_notify().
+	 */
+	__poll_t (*poll)(struct kernfs_open_file *of,
+			 struct poll_table_struct *pt);
+
 	/*
 	 * read_u64() is a shortcut for the common case of returning a
 	 * single integer. Use it in place of read()
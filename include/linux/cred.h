@@ -280,6 +280,40 @@ static inline void put_cred(const struct cred *_cred)
 	}
 }
 
+/**
+ * override_creds_light - Override subjective credentials without a reference
+ * @new: The credentials to be assigned
+ *
+ * Like override_creds(), but doesn't take a reference on @new, so it doesn't
+ * bounce the refcount of a widely shared cred in hot paths such as RCU path
+ * walk.  The caller must guarantee that @new outlives the override and must
+ * undo it with revert_creds_light().
+ */
+static inline const struct cred *override_creds_light(const struct cred *new)
+{
+#ifdef CONFIG_DEBUG_CREDENTIALS
+	return override_creds(new);
+#else
+	const struct cred *old = current->cred;
+
+	rcu_assign_pointer(current->cred, new);
+	return old;
+#endif
+}
+
+/**
+ * revert_creds_light - Revert an override_creds_light()
+ * @old: The credentials to be restored
+ */
+static inline void revert_creds_light(const struct cred *old)
+{
+#ifdef CONFIG_DEBUG_CREDENTIALS
+	revert_creds(old);
+#else
+	rcu_assign_pointer(current->cred, old);
+#endif
+}
+
 /**
  * current_cred - Access the current task's subjective credentials
  *
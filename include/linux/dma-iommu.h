@@ -35,6 +35,7 @@ void iommu_put_dma_cookie(struct iommu_domain *domain);
 /* Setup call for arch DMA mapping code */
 int iommu_dma_init_domain(struct iommu_domain *domain, dma_addr_t base,
 		u64 size, struct device *dev);
+int iommu_dma_enable_fq(struct iommu_domain *domain);
 
 /* General helpers for DMA-API <-> IOMMU-API interaction */
 int dma_info_to_prot(enum dma_data_direction dir, bool coherent,
@@ -100,6 +101,11 @@ static inline void iommu_put_dma_cookie(struct iommu_domain *domain)
 {
 }
 
+static inline int iommu_dma_enable_fq(struct iommu_domain *domain)
+{
+	return -ENODEV;
+}
+
 static inline void iommu_dma_map_msi_msg(int irq, struct msi_msg *msg)
 {
 }
@@ -53,6 +53,7 @@ struct export_operations;
 struct hd_geometry;
 struct iovec;
 struct kiocb;
+struct wait_page_queue;
 struct kobject;
 struct pipe_inode_info;
 struct poll_table_struct;
@@ -176,6 +177,9 @@ typedef int (dio_iodone_t)(struct kiocb *iocb, loff_t offset,
 /* File does not contribute to nr_files count */
 #define FMODE_NOACCOUNT	((__force fmode_t)0x20000000)
 
+/* File supports async buffered reads */
+#define FMODE_BUF_RASYNC	((__force fmode_t)0x40000000)
+
 /*
  * Flag for rw_copy_check_uvector and compat_rw_copy_check_uvector
  * that indicates that they should check the contents of the iovec are
@@ -315,6 +319,8 @@ enum rw_hint {
 #define IOCB_SYNC		(1 << 5)
 #define IOCB_WRITE		(1 << 6)
 #define IOCB_NOWAIT		(1 << 7)
+/* iocb->ki_waitq is valid */
+#define IOCB_WAITQ		(1 << 8)
 /* kiocb is a read or write operation submitted by fs/aio.c. */
 #define IOCB_AIO_RW		(1 << 23)
 
@@ -330,6 +336,13 @@ struct kiocb {
 	int			ki_flags;
 	u16			ki_hint;
 	u16			ki_ioprio; /* See linux/ioprio.h */
+#ifndef __GENKSYMS__
+	/*
+	 * Only read when IOCB_WAITQ is set, which modules built against the
+	 * old layout never do.
+	 */
+	struct wait_page_queue	*ki_waitq; /* for async buffered IO */
+#endif
 
 	randomized_struct_fields_end
 };
@@ -449,7 +462,15 @@ struct address_space {
 	void			*private_data;	/* ditto */
 	errseq_t		wb_err;
 
+#if IS_ENABLED(CONFIG_READ_ONLY_THP_FOR_FS) && !defined(__GENKSYMS__)
+	union {
+		/* number of THPs, only for non-shmem files */
+		atomic_t	nr_thps;
+		unsigned long	kabi_reserve1;
+	};
+#else
 	KABI_RESERVE(1)
+#endif
 	KABI_RESERVE(2)
 	KABI_RESERVE(3)
 	KABI_RESERVE(4)
@@ -1529,6 +1550,12 @@ struct super_block {
 
 	spinlock_t		s_inode_wblist_lock;
 	struct list_head	s_inodes_wb;	/* writeback inodes */
+
+#ifndef __GENKSYMS__
+	/* Negative dentries, capped by sysctl_negative_dentry_limit */
+	atomic_long_t		s_nr_negative_dentry;
+	struct work_struct	s_negative_dentry_trim;
+#endif
 } __randomize_layout;
 
 /* Helper functions so that in most cases filesystems will
@@ -2922,6 +2949,33 @@ static inline bool inode_is_open_for_write(const struct inode *inode)
 	return atomic_read(&inode->i_writecount) > 0;
 }
 
+static inline int filemap_nr_thps(struct address_space *mapping)
+{
+#ifdef CONFIG_READ_ONLY_THP_FOR_FS
+	return atomic_read(&mapping->nr_thps);
+#else
+	return 0;
+#endif
+}
+
+static inline void filemap_nr_thps_inc(struct address_space *mapping)
+{
+#ifdef CONFIG_READ_ONLY_THP_FOR_FS
+	atomic_inc(&mapping->nr_thps);
+#else
+	WARN_ON_ONCE(1);
+#endif
+}
+
+static inline void filemap_nr_thps_dec(struct address_space *mapping)
+{
+#ifdef CONFIG_READ_ONLY_THP_FOR_FS
+	atomic_dec(&mapping->nr_thps);
+#else
+	WARN_ON_ONCE(1);
+#endif
+}
+
 #ifdef CONFIG_IMA
 static inline void i_readcount_dec(struct inode *inode)
 {
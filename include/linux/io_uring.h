@@ -0,0 +1,22 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+#ifndef _LINUX_IO_URING_H
+#define _LINUX_IO_URING_H
+
+#include <linux/sched.h>
+
+#if defined(CONFIG_IO_URING)
+void __io_uring_unreg_ringfd(void);
+
+/* Drop the rings current registered with IORING_REGISTER_RING_FDS */
+static inline void io_uring_unreg_ringfd(void)
+{
+	if (current->_resvd->io_uring_rings)
+		__io_uring_unreg_ringfd();
+}
+#else
+static inline void io_uring_unreg_ringfd(void)
+{
+}
+#endif
+
+#endif
@@ -1085,6 +1085,8 @@ extern int iopf_queue_flush_dev(struct device *dev);
 extern struct iopf_queue *
 iopf_queue_alloc(const char *name, iopf_queue_flush_t flush, void *cookie);
 extern void iopf_queue_free(struct iopf_queue *queue);
+extern int iopf_prefault(int pasid, unsigned long addr, size_t size,
+			 unsigned int prot);
 #else /* CONFIG_IOMMU_PAGE_FAULT */
 static inline int iommu_queue_iopf(struct iommu_fault_event *evt, void *cookie)
 {
@@ -1116,6 +1118,12 @@ iopf_queue_alloc(const char *name, iopf_queue_flush_t flush, void *cookie)
 static inline void iopf_queue_free(struct iopf_queue *queue)
 {
 }
+
+static inline int iopf_prefault(int pasid, unsigned long addr, size_t size,
+				unsigned int prot)
+{
+	return -ENODEV;
+}
 #endif /* CONFIG_IOMMU_PAGE_FAULT */
 
 #ifdef CONFIG_IOMMU_DEBUGFS
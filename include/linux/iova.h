@@ -28,12 +28,15 @@ struct iova_magazine;
 struct iova_cpu_rcache;
 
 #define IOVA_RANGE_CACHE_MAX_SIZE 6	/* log of max cached IOVA range size (in pages) */
-#define MAX_GLOBAL_MAGS 32	/* magazines per bin */
+#define MAX_GLOBAL_MAGS 32	/* initial depot magazines per bin */
 
 struct iova_rcache {
 	spinlock_t lock;
 	unsigned long depot_size;
-	struct iova_magazine *depot[MAX_GLOBAL_MAGS];
+	unsigned long depot_max;	/* grows while CPUs starve */
+	bool depot_starved;		/* depot ran dry since it last grew */
+	unsigned int mag_size;		/* pfns per magazine in this bin */
+	struct iova_magazine *depot;
 	struct iova_cpu_rcache __percpu *cpu_rcaches;
 };
 
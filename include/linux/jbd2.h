@@ -70,6 +70,7 @@ extern void *jbd2_alloc(size_t size, gfp_t flags);
 extern void jbd2_free(void *ptr, size_t size);
 
 #define JBD2_MIN_JOURNAL_BLOCKS 1024
+#define JBD2_DEFAULT_FAST_COMMIT_BLOCKS 256
 
 #ifdef __KERNEL__
 
@@ -107,6 +108,12 @@ typedef struct jbd2_journal_handle handle_t;	/* Atomic operation type */
 typedef struct journal_s	journal_t;	/* Journal control structure */
 
 typedef struct journal_wrapper_s journal_wrapper_t;
+
+/* Recovery passes, also seen by fast commit replay callbacks */
+enum passtype {PASS_SCAN, PASS_REVOKE, PASS_REPLAY};
+
+#define JBD2_FC_REPLAY_STOP	0
+#define JBD2_FC_REPLAY_CONTINUE	1
 #endif
 
 /*
@@ -267,7 +274,11 @@ typedef struct journal_superblock_s
 /* 0x0050 */
 	__u8	s_checksum_type;	/* checksum type */
 	__u8	s_padding2[3];
-	__u32	s_padding[42];
+/* 0x0054 */
+	__u32	s_padding[41];
+/* 0x00F8 */
+	/* Number of fast commit blocks, not upstream's 0x0054 field */
+	__be32	s_num_fc_blks;
 	__be32	s_checksum;		/* crc32c(superblock) */
 
 /* 0x0100 */
@@ -293,6 +304,12 @@ typedef struct journal_superblock_s
 #define JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT	0x00000004
 #define JBD2_FEATURE_INCOMPAT_CSUM_V2		0x00000008
 #define JBD2_FEATURE_INCOMPAT_CSUM_V3		0x00000010
+/*
+ * Private fast commit area, replayed by ext4 with its own record format.
+ * Upstream's 0x00000020 fast commit is not compatible with it, so journals
+ * using this one are refused by upstream kernels and e2fsprogs.
+ */
+#define JBD2_FEATURE_INCOMPAT_FAST_COMMIT	0x80000000
 
 /* See "journal feature predicate functions" below */
 
@@ -303,7 +320,8 @@ typedef struct journal_superblock_s
 					JBD2_FEATURE_INCOMPAT_64BIT | \
 					JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT | \
 					JBD2_FEATURE_INCOMPAT_CSUM_V2 | \
-					JBD2_FEATURE_INCOMPAT_CSUM_V3)
+					JBD2_FEATURE_INCOMPAT_CSUM_V3 | \
+					JBD2_FEATURE_INCOMPAT_FAST_COMMIT)
 
 #ifdef __KERNEL__
 
@@ -1233,8 +1251,95 @@ struct journal_wrapper_s
 	 * [j_list_lock]
 	 */
 	transaction_t		*j_shrink_transaction;
+
+	/**
+	 * @j_fc_first:
+	 *
+	 * The block number of the first fast commit block in the journal.
+	 */
+	unsigned long		j_fc_first;
+
+	/**
+	 * @j_fc_last:
+	 *
+	 * The block number one beyond the last fast commit block in the
+	 * journal.
+	 */
+	unsigned long		j_fc_last;
+
+	/**
+	 * @j_fc_off:
+	 *
+	 * Number of fast commit blocks handed out since the last full
+	 * commit.  Only changed by the owner of JBD2_FAST_COMMIT_ONGOING.
+	 */
+	unsigned long		j_fc_off;
+
+	/**
+	 * @j_fc_done: Index of the first fast commit buffer not yet waited on.
+	 */
+	unsigned long		j_fc_done;
+
+	/**
+	 * @j_fc_wbuf: Array of fast commit bhs for the current fast commit.
+	 */
+	struct buffer_head	**j_fc_wbuf;
+
+	/**
+	 * @j_fc_wait:
+	 *
+	 * Wait queue for the JBD2_FAST_COMMIT_ONGOING and
+	 * JBD2_FULL_COMMIT_ONGOING flags to clear.
+	 */
+	wait_queue_head_t	j_fc_wait;
+
+	/**
+	 * @j_fc_replay_callback:
+	 *
+	 * File-system specific function that replays one fast commit block
+	 * during recovery.  Returns JBD2_FC_REPLAY_CONTINUE to get the next
+	 * block, JBD2_FC_REPLAY_STOP at the end of the valid area or a
+	 * negative errno.
+	 */
+	int			(*j_fc_replay_callback)(journal_t *journal,
+							struct buffer_head *bh,
+							enum passtype pass,
+							int off,
+							tid_t expected_tid);
+
+	/**
+	 * @j_checkpoint_task:
+	 *
+	 * Background checkpoint thread, checkpointing old transactions once
+	 * the log fills beyond the jbd2 checkpoint_threshold parameter.
+	 */
+	struct task_struct	*j_checkpoint_task;
+
+	/**
+	 * @j_wait_checkpoint: Wait queue to wake up the checkpoint thread.
+	 */
+	wait_queue_head_t	j_wait_checkpoint;
+
+	/**
+	 * @j_space_waits:
+	 *
+	 * Number of times a handle had to wait for log space. [j_state_lock]
+	 */
+	unsigned long		j_space_waits;
+
+	/**
+	 * @j_space_wait_time:
+	 *
+	 * Total time in ns handles spent waiting for log space. [j_state_lock]
+	 */
+	u64			j_space_wait_time;
 };
 
+static inline journal_wrapper_t *jbd2_journal_wrapper(journal_t *journal)
+{
+	return container_of(journal, journal_wrapper_t, jw_journal);
+}
+
 #define jbd2_might_wait_for_commit(j) \
 	do { \
 		rwsem_acquire(&j->j_trans_commit_map, 0, 0, _THIS_IP_); \
@@ -1303,6 +1408,7 @@ JBD2_FEATURE_INCOMPAT_FUNCS(64bit,		64BIT)
 JBD2_FEATURE_INCOMPAT_FUNCS(async_commit,	ASYNC_COMMIT)
 JBD2_FEATURE_INCOMPAT_FUNCS(csum2,		CSUM_V2)
 JBD2_FEATURE_INCOMPAT_FUNCS(csum3,		CSUM_V3)
+JBD2_FEATURE_INCOMPAT_FUNCS(fast_commit,	FAST_COMMIT)
 
 /*
  * Journal flag definitions
@@ -1316,12 +1422,15 @@ JBD2_FEATURE_INCOMPAT_FUNCS(csum3,		CSUM_V3)
 #define JBD2_ABORT_ON_SYNCDATA_ERR	0x040	/* Abort the journal on file
 						 * data write error in ordered
 						 * mode */
+#define JBD2_FAST_COMMIT_ONGOING	0x100	/* Fast commit is ongoing */
+#define JBD2_FULL_COMMIT_ONGOING	0x200	/* Full commit is ongoing */
 
 /*
  * Journal atomic flag definitions
  */
 #define JBD2_CHECKPOINT_IO_ERROR	0x001	/* Detect io error while writing
 						 * buffer back to disk */
+#define JBD2_CHECKPOINT_KICKED		0x002	/* Checkpoint thread has work */
 
 /*
  * Function declarations for the journaling transaction and buffer
@@ -1459,6 +1568,21 @@ extern int	 jbd2_journal_flush (journal_t *);
 extern void	 jbd2_journal_lock_updates (journal_t *);
 extern void	 jbd2_journal_unlock_updates (journal_t *);
 
+/* Fast commit related APIs */
+extern int	 jbd2_fc_begin_commit(journal_t *journal, tid_t tid);
+extern int	 jbd2_fc_end_commit(journal_t *journal);
+extern int	 jbd2_fc_end_commit_fallback(journal_t *journal, tid_t tid);
+extern int	 jbd2_fc_get_buf(journal_t *journal, struct buffer_head **bh_out);
+extern int	 jbd2_fc_wait_bufs(journal_t *journal, int num_blks);
+extern void	 jbd2_fc_release_bufs(journal_t *journal);
+
+static inline int jbd2_journal_get_num_fc_blks(journal_superblock_t *jsb)
+{
+	int num_fc_blocks = be32_to_cpu(jsb->s_num_fc_blks);
+
+	return num_fc_blocks ? num_fc_blocks : JBD2_DEFAULT_FAST_COMMIT_BLOCKS;
+}
+
 extern journal_t * jbd2_journal_init_dev(struct block_device *bdev,
 				struct block_device *fs_dev,
 				unsigned long long start, int len, int bsize);
@@ -1573,6 +1697,8 @@ int jbd2_log_wait_commit(journal_t *journal, tid_t tid);
 int jbd2_transaction_committed(journal_t *journal, tid_t tid);
 int jbd2_complete_transaction(journal_t *journal, tid_t tid);
 int jbd2_log_do_checkpoint(journal_t *journal);
+void jbd2_log_kick_checkpoint(journal_t *journal);
+int jbd2_checkpoint_thread(void *arg);
 int jbd2_trans_will_send_data_barrier(journal_t *journal, tid_t tid);
 
 void __jbd2_log_wait_for_space(journal_t *journal);
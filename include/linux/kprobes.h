@@ -166,6 +166,9 @@ struct kretprobe {
 	size_t data_size;
 	struct hlist_head free_instances;
 	raw_spinlock_t lock;
+#ifndef __GENKSYMS__
+	struct kretprobe_cache __percpu *cache;
+#endif
 };
 
 struct kretprobe_instance {
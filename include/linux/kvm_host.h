@@ -237,6 +237,18 @@ struct kvm_mmio_fragment {
 	unsigned len;
 };
 
+/*
+ * Recent halt durations for KVM_HALT_POLL_PREDICT: bucket 0 counts halts
+ * shorter than 1024ns, bucket i those shorter than 1024ns << i.
+ */
+#define KVM_HALT_POLL_HIST_BUCKETS	24
+#define KVM_HALT_POLL_HIST_DECAY	64
+
+struct kvm_halt_poll_hist {
+	u32 bucket[KVM_HALT_POLL_HIST_BUCKETS];
+	u32 samples;
+};
+
 struct kvm_vcpu {
 	struct kvm *kvm;
 #ifdef CONFIG_PREEMPT_NOTIFIERS
@@ -262,6 +274,7 @@ struct kvm_vcpu {
 	sigset_t sigset;
 	struct kvm_vcpu_stat stat;
 	unsigned int halt_poll_ns;
+	struct kvm_halt_poll_hist halt_poll_hist;
 	bool valid_wakeup;
 
 #ifdef CONFIG_HAS_IOMEM
@@ -477,6 +490,10 @@ struct kvm {
 	long tlbs_dirty;
 	struct list_head devices;
 	u64 manual_dirty_log_protect;
+	/* Set by KVM_CAP_HALT_POLL, override the halt_poll_ns parameter */
+	unsigned int max_halt_poll_ns;
+	bool override_halt_poll_ns;
+	bool halt_poll_predict;
 	struct dentry *debugfs_dentry;
 	struct kvm_stat_data **debugfs_stat_data;
 	struct srcu_struct srcu;
@@ -41,6 +41,8 @@ extern bool mem_reliable_status(void);
 extern void reliable_lru_add(enum lru_list lru, struct page *page,
 					int val);
 extern void page_cache_prepare_alloc(gfp_t *gfp);
+extern void page_cache_reliable_hint(struct address_space *mapping,
+				     void *shadow, gfp_t *gfp);
 extern void reliable_lru_add_batch(int zid, enum lru_list lru,
 					      int val);
 extern bool mem_reliable_counter_initialized(void);
@@ -167,6 +169,8 @@ static inline void reliable_lru_add(enum lru_list lru,
 					       struct page *page,
 					       int val) {}
 static inline void page_cache_prepare_alloc(gfp_t *gfp) {}
+static inline void page_cache_reliable_hint(struct address_space *mapping,
+					    void *shadow, gfp_t *gfp) {}
 static inline void reliable_lru_add_batch(int zid, enum lru_list lru,
 						     int val) {}
 
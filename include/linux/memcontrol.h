@@ -127,8 +127,9 @@ struct memcg_shrinker_map {
 struct mem_cgroup_per_node {
 	struct lruvec		lruvec;
 
-	/* Subtree VM stats (batched updates) */
+	/* Local VM stats, per-cpu, folded into lruvec_stat by rstat */
 	struct lruvec_stat __percpu *lruvec_stat_cpu;
+	/* Subtree VM stats as of the last rstat flush */
 	atomic_long_t		lruvec_stat[NR_VM_NODE_STAT_ITEMS];
 
 	unsigned long		lru_zone_size[MAX_NR_ZONES][NR_LRU_LISTS];
@@ -150,8 +151,10 @@ struct mem_cgroup_per_node {
 
 struct mem_cgroup_per_node_extension {
 	struct mem_cgroup_per_node	pn;
-	/* Legacy local VM stats */
-	struct lruvec_stat __percpu	*lruvec_stat_local;
+	/* lruvec_stat_cpu as of the last rstat flush */
+	struct lruvec_stat __percpu	*lruvec_stat_prev;
+	/* Deltas flushed by the children, not yet propagated upwards */
+	long				lruvec_stat_pending[NR_VM_NODE_STAT_ITEMS];
 };
 
 #define to_mgpn_ext(pn) container_of(pn, struct mem_cgroup_per_node_extension, pn)
@@ -188,6 +191,24 @@ enum memcg_kmem_state {
 	KMEM_ONLINE,
 };
 
+/*
+ * Slab objects are charged to an obj_cgroup rather than to the memcg
+ * directly.  When the memcg goes offline its obj_cgroups are reparented
+ * by switching ->memcg, so that the objects left over don't pin the dead
+ * cgroup.  Sub-page charges are kept in bytes, see obj_cgroup_charge().
+ */
+struct obj_cgroup {
+	struct percpu_ref refcnt;
+	struct mem_cgroup *memcg;
+	atomic_t nr_charged_bytes;
+	/* NR_SLAB_RECLAIMABLE and NR_SLAB_UNRECLAIMABLE, in bytes */
+	atomic_long_t nr_slab_bytes[2];
+	union {
+		struct list_head list;
+		struct rcu_head rcu;
+	};
+};
+
 #if defined(CONFIG_SMP)
 struct memcg_padding {
 	char x[0];
@@ -282,11 +303,12 @@ struct mem_cgroup {
 	atomic_t		moving_account;
 	struct task_struct	*move_lock_task;
 
-	/* Subtree VM stats and events (batched updates) */
+	/* Local VM stats and events, per-cpu, folded into stat/events by rstat */
 	struct mem_cgroup_stat_cpu __percpu *stat_cpu;
 
 	MEMCG_PADDING(_pad2_);
 
+	/* Subtree VM stats and events as of the last rstat flush */
 	atomic_long_t		stat[MEMCG_NR_STAT];
 	atomic_long_t		events[NR_VM_EVENT_ITEMS];
 
@@ -336,11 +358,48 @@ struct mem_cgroup_extension {
 	 */
 	int	memcg_priority;
 #endif
-	/* Legacy local VM stats and events */
-	struct mem_cgroup_stat_cpu __percpu *vmstats_local;
+	/* stat_cpu as of the last rstat flush */
+	struct mem_cgroup_stat_cpu __percpu *vmstats_prev;
+	/* Deltas flushed by the children, not yet propagated upwards */
+	long stat_pending[MEMCG_NR_STAT];
+	unsigned long events_pending[NR_VM_EVENT_ITEMS];
 	spinlock_t split_queue_lock;
 	struct list_head split_queue;
 	unsigned long split_queue_len;
+#ifdef CONFIG_MEMORY_RELIABLE
+	/* mirrored memory used by the pages charged to this memcg */
+	struct page_counter reliable;
+#endif
+	/*
+	 * Background reclaim: once usage goes above wmark_high, wmark_work
+	 * reclaims down to wmark_low.  Both are derived from memory.max
+	 * (percent, and 1/10000 of it for the gap) and kept up to date by
+	 * memcg_wmark_setup().
+	 */
+	unsigned int wmark_ratio;
+	unsigned int wmark_scale_factor;
+	unsigned long wmark_high;
+	unsigned long wmark_low;
+	/* wmark_high is set, counted in memcg_wmark_key */
+	bool wmark_active;
+	struct work_struct wmark_work;
+	/* CPU of the last charging task, wmark_work is queued there */
+	int wmark_cpu;
+	/* CPU time spent by wmark_work, in nanoseconds */
+	atomic64_t wmark_reclaim_time;
+#ifdef CONFIG_MEMCG_KMEM
+	/* obj_cgroup slab objects are charged to, and the reparented ones */
+	struct obj_cgroup __rcu *objcg;
+	struct list_head objcg_list;
+#endif
+#ifdef CONFIG_MEMCG_SWAP
+	/* Priority of the swap devices used, or SWAP_TIER_ALL */
+	int swap_tier;
+#endif
+#ifdef CONFIG_LRU_GEN
+	/* mms owned by tasks of this memcg, walked by the lru_gen aging */
+	struct lru_gen_mm_list lru_gen_mm_list;
+#endif
 	struct mem_cgroup memcg;
 };
 
@@ -439,6 +498,11 @@ static inline struct lruvec *mem_cgroup_lruvec(struct pglist_data *pgdat,
 
 struct lruvec *mem_cgroup_page_lruvec(struct page *, struct pglist_data *);
 
+struct lruvec *lock_page_lruvec(struct page *page);
+struct lruvec *lock_page_lruvec_irq(struct page *page);
+struct lruvec *lock_page_lruvec_irqsave(struct page *page,
+					unsigned long *flags);
+
 struct mem_cgroup *mem_cgroup_from_task(struct task_struct *p);
 
 struct mem_cgroup *get_mem_cgroup_from_mm(struct mm_struct *mm);
@@ -591,9 +655,13 @@ struct mem_cgroup *lock_page_memcg(struct page *page);
 void __unlock_page_memcg(struct mem_cgroup *memcg);
 void unlock_page_memcg(struct page *page);
 
+void mem_cgroup_flush_stats(void);
+
 /*
  * idx can be of type enum memcg_stat_item or node_stat_item.
- * Keep in sync with memcg_exact_page_state().
+ *
+ * The value is as of the last rstat flush; callers that want it to be
+ * recent should call mem_cgroup_flush_stats() first.
  */
 static inline unsigned long memcg_page_state(struct mem_cgroup *memcg, int idx)
 {
@@ -605,20 +673,15 @@ static inline unsigned long memcg_page_state(struct mem_cgroup *memcg, int idx)
 	return x;
 }
 
-/*
- * idx can be of type enum memcg_stat_item or node_stat_item.
- * Keep in sync with memcg_exact_page_state().
- */
+/* idx can be of type enum memcg_stat_item or node_stat_item */
 static inline unsigned long memcg_page_state_local(struct mem_cgroup *memcg,
 						   int idx)
 {
 	long x = 0;
 	int cpu;
-	struct mem_cgroup_extension *memcg_ext;
 
-	memcg_ext = to_memcg_ext(memcg);
 	for_each_possible_cpu(cpu)
-		x += per_cpu(memcg_ext->vmstats_local->count[idx], cpu);
+		x += per_cpu(memcg->stat_cpu->count[idx], cpu);
 #ifdef CONFIG_SMP
 	if (x < 0)
 		x = 0;
@@ -692,7 +755,6 @@ static inline unsigned long lruvec_page_state_local(struct lruvec *lruvec,
 						    enum node_stat_item idx)
 {
 	struct mem_cgroup_per_node *pn;
-	struct mem_cgroup_per_node_extension *pn_ext;
 	long x = 0;
 	int cpu;
 
@@ -700,9 +762,8 @@ static inline unsigned long lruvec_page_state_local(struct lruvec *lruvec,
 		return node_page_state(lruvec_pgdat(lruvec), idx);
 
 	pn = container_of(lruvec, struct mem_cgroup_per_node, lruvec);
-	pn_ext = to_mgpn_ext(pn);
 	for_each_possible_cpu(cpu)
-		x += per_cpu(pn_ext->lruvec_stat_local->count[idx], cpu);
+		x += per_cpu(pn->lruvec_stat_cpu->count[idx], cpu);
 #ifdef CONFIG_SMP
 	if (x < 0)
 		x = 0;
@@ -723,6 +784,18 @@ static inline void mod_lruvec_state(struct lruvec *lruvec,
 	local_irq_restore(flags);
 }
 
+/*
+ * Slab pages whose objects are charged one by one have no memcg of their
+ * own: page->mem_cgroup points to the obj_cgroup vector of the objects
+ * instead, tagged with MEMCG_DATA_OBJCGS.
+ */
+#define MEMCG_DATA_OBJCGS	1UL
+
+static inline bool page_has_obj_cgroups(struct page *page)
+{
+	return (unsigned long)READ_ONCE(page->mem_cgroup) & MEMCG_DATA_OBJCGS;
+}
+
 static inline void __mod_lruvec_page_state(struct page *page,
 					   enum node_stat_item idx, int val)
 {
@@ -730,7 +803,7 @@ static inline void __mod_lruvec_page_state(struct page *page,
 	struct lruvec *lruvec;
 
 	/* Untracked pages have no memcg, no lruvec. Update only the node */
-	if (!page->mem_cgroup) {
+	if (!page->mem_cgroup || page_has_obj_cgroups(page)) {
 		__mod_node_page_state(pgdat, idx, val);
 		return;
 	}
@@ -903,6 +976,31 @@ static inline struct lruvec *mem_cgroup_page_lruvec(struct page *page,
 	return &pgdat->lruvec;
 }
 
+static inline struct lruvec *lock_page_lruvec(struct page *page)
+{
+	struct lruvec *lruvec = node_lruvec(page_pgdat(page));
+
+	spin_lock(&lruvec->lru_lock);
+	return lruvec;
+}
+
+static inline struct lruvec *lock_page_lruvec_irq(struct page *page)
+{
+	struct lruvec *lruvec = node_lruvec(page_pgdat(page));
+
+	spin_lock_irq(&lruvec->lru_lock);
+	return lruvec;
+}
+
+static inline struct lruvec *lock_page_lruvec_irqsave(struct page *page,
+						      unsigned long *flags)
+{
+	struct lruvec *lruvec = node_lruvec(page_pgdat(page));
+
+	spin_lock_irqsave(&lruvec->lru_lock, *flags);
+	return lruvec;
+}
+
 static inline bool mm_match_cgroup(struct mm_struct *mm,
 		struct mem_cgroup *memcg)
 {
@@ -1031,6 +1129,10 @@ static inline void mem_cgroup_print_oom_group(struct mem_cgroup *memcg)
 {
 }
 
+static inline void mem_cgroup_flush_stats(void)
+{
+}
+
 static inline unsigned long memcg_page_state(struct mem_cgroup *memcg, int idx)
 {
 	return 0;
@@ -1142,6 +1244,96 @@ static inline void memcg_print_bad_task(struct oom_control *oc)
 
 #endif /* CONFIG_MEMCG */
 
+static inline void unlock_page_lruvec(struct lruvec *lruvec)
+{
+	spin_unlock(&lruvec->lru_lock);
+}
+
+static inline void unlock_page_lruvec_irq(struct lruvec *lruvec)
+{
+	spin_unlock_irq(&lruvec->lru_lock);
+}
+
+static inline void unlock_page_lruvec_irqrestore(struct lruvec *lruvec,
+						 unsigned long flags)
+{
+	spin_unlock_irqrestore(&lruvec->lru_lock, flags);
+}
+
+/*
+ * Only meaningful with the lru_lock of @lruvec held and PageLRU set: the
+ * memcg of a page on an LRU list cannot change without that lock.  Use
+ * page_lru_relock_irq() to test both together.
+ */
+static inline bool lruvec_holds_page_lru_lock(struct page *page,
+					      struct lruvec *lruvec)
+{
+	return lruvec == mem_cgroup_page_lruvec(page, page_pgdat(page));
+}
+
+/* Don't lock again iff page's lruvec is locked already */
+static inline struct lruvec *relock_page_lruvec_irq(struct page *page,
+						    struct lruvec *locked_lruvec)
+{
+	if (locked_lruvec) {
+		if (lruvec_holds_page_lru_lock(page, locked_lruvec))
+			return locked_lruvec;
+
+		unlock_page_lruvec_irq(locked_lruvec);
+	}
+
+	return lock_page_lruvec_irq(page);
+}
+
+/* Don't lock again iff page's lruvec is locked already */
+static inline struct lruvec *relock_page_lruvec_irqsave(struct page *page,
+		struct lruvec *locked_lruvec, unsigned long *flags)
+{
+	if (locked_lruvec) {
+		if (lruvec_holds_page_lru_lock(page, locked_lruvec))
+			return locked_lruvec;
+
+		unlock_page_lruvec_irqrestore(locked_lruvec, *flags);
+	}
+
+	return lock_page_lruvec_irqsave(page, flags);
+}
+
+/*
+ * Test PageLRU of @page with the lru_lock of *@lruvec held.  After the
+ * lruvec was looked up, the page may have been isolated, moved to another
+ * memcg and put back on the LRU of that memcg, so that PageLRU is now set
+ * under a lock we don't hold.  Switch to the right lruvec and test again
+ * in that case.  A page found on the LRU stays on *@lruvec until the lock
+ * is dropped.
+ */
+static inline bool page_lru_relock_irq(struct page *page,
+				       struct lruvec **lruvec)
+{
+	while (PageLRU(page)) {
+		/* page->mem_cgroup is set before the page goes back on an LRU */
+		smp_rmb();
+		if (lruvec_holds_page_lru_lock(page, *lruvec))
+			return true;
+		*lruvec = relock_page_lruvec_irq(page, *lruvec);
+	}
+
+	return false;
+}
+
+static inline bool page_lru_relock_irqsave(struct page *page,
+		struct lruvec **lruvec, unsigned long *flags)
+{
+	while (PageLRU(page)) {
+		smp_rmb();
+		if (lruvec_holds_page_lru_lock(page, *lruvec))
+			return true;
+		*lruvec = relock_page_lruvec_irqsave(page, *lruvec, flags);
+	}
+
+	return false;
+}
+
 /* idx can be of type enum memcg_stat_item or node_stat_item */
 static inline void __inc_memcg_state(struct mem_cgroup *memcg,
 				     int idx)
@@ -1317,7 +1509,35 @@ void __memcg_kmem_uncharge(struct page *page, int order);
 int __memcg_kmem_charge_memcg(struct page *page, gfp_t gfp, int order,
 			      struct mem_cgroup *memcg);
 
+struct obj_cgroup *get_obj_cgroup_from_current(void);
+int obj_cgroup_charge(struct obj_cgroup *objcg, gfp_t gfp, size_t size);
+void obj_cgroup_uncharge(struct obj_cgroup *objcg, size_t size);
+void obj_cgroup_mod_state(struct obj_cgroup *objcg, int idx, int nr_bytes);
+struct mem_cgroup *mem_cgroup_from_obj(void *p);
+
+static inline bool obj_cgroup_tryget(struct obj_cgroup *objcg)
+{
+	return percpu_ref_tryget(&objcg->refcnt);
+}
+
+static inline void obj_cgroup_get(struct obj_cgroup *objcg)
+{
+	percpu_ref_get(&objcg->refcnt);
+}
+
+static inline void obj_cgroup_put(struct obj_cgroup *objcg)
+{
+	percpu_ref_put(&objcg->refcnt);
+}
+
+/* Must be called under rcu_read_lock() or with css_set_lock held */
+static inline struct mem_cgroup *obj_cgroup_memcg(struct obj_cgroup *objcg)
+{
+	return READ_ONCE(objcg->memcg);
+}
+
 extern struct static_key_false memcg_kmem_enabled_key;
+extern bool cgroup_memory_kmemcache;
 extern struct workqueue_struct *memcg_kmem_cache_wq;
 
 extern int memcg_nr_cache_ids;
@@ -1337,6 +1557,16 @@ static inline bool memcg_kmem_enabled(void)
 	return static_branch_unlikely(&memcg_kmem_enabled_key);
 }
 
+/*
+ * Slab objects are charged one by one from shared slab pages, unless
+ * per-memcg copies of the caches were asked for with
+ * cgroup.memory=kmemcache.
+ */
+static inline bool memcg_kmem_objcg_enabled(void)
+{
+	return !cgroup_memory_kmemcache;
+}
+
 static inline int memcg_kmem_charge(struct page *page, gfp_t gfp, int order)
 {
 	if (memcg_kmem_enabled())
@@ -1387,6 +1617,11 @@ static inline void __memcg_kmem_uncharge(struct page *page, int order)
 {
 }
 
+static inline struct mem_cgroup *mem_cgroup_from_obj(void *p)
+{
+	return NULL;
+}
+
 #define for_each_memcg_cache_index(_idx)	\
 	for (; NULL; )
 
@@ -1410,6 +1645,15 @@ static inline void memcg_put_cache_ids(void)
 
 #endif /* CONFIG_MEMCG_KMEM */
 
+#if defined(CONFIG_MEMCG) && defined(CONFIG_MEMORY_RELIABLE)
+bool mem_cgroup_reliable_limit_check(unsigned long nr_pages);
+#else
+static inline bool mem_cgroup_reliable_limit_check(unsigned long nr_pages)
+{
+	return true;
+}
+#endif
+
 #ifdef CONFIG_DYNAMIC_HUGETLB
 struct dhugetlb_pool *get_dhugetlb_pool_from_memcg(struct mem_cgroup *memcg);
 struct page *alloc_page_from_dhugetlb_pool(gfp_t gfp_mask);
@@ -10,6 +10,7 @@
 #include <linux/spinlock.h>
 #include <linux/rbtree.h>
 #include <linux/rwsem.h>
+#include <linux/seqlock.h>
 #include <linux/completion.h>
 #include <linux/cpumask.h>
 #include <linux/uprobes.h>
@@ -82,7 +83,7 @@ struct page {
 		struct {	/* Page cache and anonymous pages */
 			/**
 			 * @lru: Pageout list, eg. active_list protected by
-			 * zone_lru_lock.  Sometimes used as a generic list
+			 * lruvec->lru_lock.  Sometimes used as a generic list
 			 * by the page owner.
 			 */
 			struct list_head lru;
@@ -332,12 +333,35 @@ struct vm_area_struct {
 #endif
 	struct vm_userfaultfd_ctx vm_userfaultfd_ctx;
 
+#if IS_ENABLED(CONFIG_SPECULATIVE_PAGE_FAULT) && !defined(__GENKSYMS__)
+	/*
+	 * Speculative faults run against a copy of the vma taken without
+	 * mmap_sem.  vm_sequence is odd while fields they use are being
+	 * changed, vm_ref_count keeps the vma around for them after it is
+	 * unlinked.
+	 */
+	union {
+		struct {
+			seqcount_t vm_sequence;
+			atomic_t vm_ref_count;
+		};
+		unsigned long kabi_reserve1;
+	};
+#else
 	KABI_RESERVE(1)
+#endif
 	KABI_RESERVE(2)
 	KABI_RESERVE(3)
 	KABI_RESERVE(4)
 } __randomize_layout;
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+struct mm_spf_stat {
+	unsigned long success;		/* faults handled without mmap_sem */
+	unsigned long fallback;		/* faults retried under mmap_sem */
+};
+#endif
+
 struct core_thread {
 	struct task_struct *task;
 	struct core_thread *next;
@@ -511,6 +535,19 @@ struct mm_struct {
 #if IS_ENABLED(CONFIG_HMM)
 		/* HMM needs to track a few things per mm */
 		struct hmm *hmm;
+#endif
+#if defined(CONFIG_FUTEX) && defined(CONFIG_NUMA) && !defined(__GENKSYMS__)
+		/* Node of the futex hash serving this mm's private futexes */
+		int futex_node;
+#endif
+#if defined(CONFIG_KSM) && !defined(__GENKSYMS__)
+		/*
+		 * Pages of this mm tracked by ksmd, pages merged into KSM
+		 * pages, and empty pages replaced by the zero page.
+		 */
+		unsigned long ksm_rmap_items;
+		unsigned long ksm_merging_pages;
+		atomic_long_t ksm_zero_pages;
 #endif
 	} __randomize_layout;
 
@@ -535,11 +572,27 @@ struct mm_struct {
 	KABI_RESERVE(3)
 #endif
 
+#if IS_ENABLED(CONFIG_SPECULATIVE_PAGE_FAULT) && !defined(__GENKSYMS__)
+	union {
+		rwlock_t mm_rb_lock;	/* Protects mm_rb against get_vma() */
+		unsigned long kabi_reserve4;
+	};
+	struct mm_spf_stat __percpu *spf_stat;
+#else
 	KABI_RESERVE(4)
 	KABI_RESERVE(5)
+#endif
+
+#if IS_ENABLED(CONFIG_LRU_GEN) && !defined(__GENKSYMS__)
+	/* On the list of mms whose page tables reclaim walks */
+	struct list_head lru_gen_list;
+	/* memcg of that list, pinned while the mm is on it, or NULL */
+	struct mem_cgroup *lru_gen_memcg;
+#else
 	KABI_RESERVE(6)
 	KABI_RESERVE(7)
 	KABI_RESERVE(8)
+#endif
 
 	/*
 	 * The mm_cpumask needs to be at the end of mm_struct, because it
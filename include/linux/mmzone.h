@@ -164,6 +164,8 @@ enum node_stat_item {
 	NR_ISOLATED_FILE,	/* Temporary isolated pages from file lru */
 	WORKINGSET_REFAULT,
 	WORKINGSET_ACTIVATE,
+	WORKINGSET_REFAULT_ANON,
+	WORKINGSET_ACTIVATE_ANON,
 	WORKINGSET_NODERECLAIM,
 	NR_ANON_MAPPED,	/* Mapped anonymous pages */
 	NR_FILE_MAPPED,	/* pagecache pages mapped into pagetables.
@@ -175,6 +177,8 @@ enum node_stat_item {
 	NR_SHMEM,		/* shmem pages (included tmpfs/GEM pages) */
 	NR_SHMEM_THPS,
 	NR_SHMEM_PMDMAPPED,
+	NR_FILE_THPS,
+	NR_FILE_PMDMAPPED,
 	NR_ANON_THPS,
 	NR_UNSTABLE_NFS,	/* NFS unstable pages */
 	NR_VMSCAN_WRITE,
@@ -239,16 +243,52 @@ struct zone_reclaim_stat {
 	unsigned long		recent_scanned[2];
 };
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * Each page table walk aging a lruvec opens a new generation, max_seq.
+ * min_seq catches up with it once the active lists have been swept
+ * through since, which asks for the next walk.
+ */
+struct lru_gen_struct {
+	unsigned long			max_seq;
+	unsigned long			min_seq;
+	/* active pages left to sweep in the current generation */
+	unsigned long			nr_to_sweep;
+	/* LRU_GEN_AGING is set while a walk is in progress */
+	unsigned long			flags;
+};
+
+#define LRU_GEN_AGING	0
+
+/*
+ * The mms whose page tables the aging walks, one list per memcg (and a
+ * global one without memcg), in walk order: walkers rotate the list, so
+ * concurrent walks may visit an mm twice or miss it once.
+ */
+struct lru_gen_mm_list {
+	struct list_head		head;
+	unsigned long			nr;
+	spinlock_t			lock;
+};
+#endif
+
 struct lruvec {
 	struct list_head		lists[NR_LRU_LISTS];
 	struct zone_reclaim_stat	reclaim_stat;
 	/* Evictions & activations on the inactive file list */
 	atomic_long_t			inactive_age;
-	/* Refaults at the time of last reclaim cycle */
-	unsigned long			refaults;
+	/* Anon and file refaults at the time of last reclaim cycle */
+	unsigned long			refaults[2];
+#ifdef CONFIG_LRU_GEN
+	struct lru_gen_struct		lrugen;
+#endif
 #ifdef CONFIG_MEMCG
 	struct pglist_data *pgdat;
 #endif
+#ifndef __GENKSYMS__
+	/* protects the lists and PageLRU/PageActive of the pages on them */
+	spinlock_t			lru_lock;
+#endif
 };
 
 /* Isolate unmapped file */
@@ -272,13 +312,25 @@ enum zone_watermarks {
 #define low_wmark_pages(z) (z->watermark[WMARK_LOW])
 #define high_wmark_pages(z) (z->watermark[WMARK_HIGH])
 
+/*
+ * The pcp-lists hold pages up to PAGE_ALLOC_COSTLY_ORDER, and with THP
+ * also pageblock_order pages, with one list per order and migrate type.
+ */
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+#define NR_PCP_THP 1
+#else
+#define NR_PCP_THP 0
+#endif
+#define NR_PCP_LISTS \
+	(MIGRATE_PCPTYPES * (PAGE_ALLOC_COSTLY_ORDER + 1 + NR_PCP_THP))
+
 struct per_cpu_pages {
 	int count;		/* number of pages in the list */
 	int high;		/* high watermark, emptying needed */
 	int batch;		/* chunk size for buddy add/remove */
 
-	/* Lists of pages, one per migrate type stored on the pcp-lists */
-	struct list_head lists[MIGRATE_PCPTYPES];
+	/* Lists of pages, one per order and migrate type */
+	struct list_head lists[NR_PCP_LISTS];
 };
 
 struct per_cpu_pageset {
@@ -697,6 +749,7 @@ typedef struct pglist_data {
 
 	/* Write-intensive fields used by page reclaim */
 	ZONE_PADDING(_pad1_)
+	/* unused, kept for the kABI: the LRUs use lruvec->lru_lock */
 	spinlock_t		lru_lock;
 
 #ifdef CONFIG_DEFERRED_STRUCT_PAGE_INIT
@@ -741,11 +794,6 @@ typedef struct pglist_data {
 
 #define node_start_pfn(nid)	(NODE_DATA(nid)->node_start_pfn)
 #define node_end_pfn(nid) pgdat_end_pfn(NODE_DATA(nid))
-static inline spinlock_t *zone_lru_lock(struct zone *zone)
-{
-	return &zone->zone_pgdat->lru_lock;
-}
-
 static inline struct lruvec *node_lruvec(struct pglist_data *pgdat)
 {
 	return &pgdat->lruvec;
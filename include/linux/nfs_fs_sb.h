@@ -123,6 +123,9 @@ struct nfs_client {
 
 	struct net		*cl_net;
 	struct list_head	pending_cb_stateids;
+#ifndef __GENKSYMS__
+	unsigned int		cl_nconnect;	/* Number of connections */
+#endif
 };
 
 /*
@@ -102,6 +102,7 @@ enum pageflags {
 	PG_idle,
 #endif
 	PG_percpu_ref,
+	PG_workingset,		/* Refaulted while part of the workingset */
 #ifdef CONFIG_DYNAMIC_HUGETLB
 	PG_pool,
 #endif
@@ -398,6 +399,7 @@ TESTCLEARFLAG(Young, young, PF_ANY)
 PAGEFLAG(Idle, idle, PF_ANY)
 #endif
 PAGEFLAG(PercpuRef, percpu_ref, PF_ANY)
+PAGEFLAG(Workingset, workingset, PF_HEAD)
 
 /*
  * On an anonymous page mapped into a user virtual memory area,
@@ -27,7 +27,8 @@
 #define PAGE_FLAGS_CHECK_RESERVED  (1UL << PG_reserved)
 #define SHA256_DIGEST_SIZE  32
 #define next_pme(pme)  ((unsigned long *)((pme) + 1) + (pme)->nr_pages)
-#define PIN_MEM_DUMP_MAGIC  0xfeab000000001acd
+/* change the magic whenever the layout of the dump info changes */
+#define PIN_MEM_DUMP_MAGIC  0xfeab000000001ace
 #define PM_PFRAME_BITS		55
 #define PM_PFRAME_MASK		GENMASK_ULL(PM_PFRAME_BITS - 1, 0)
 #define PM_PRESENT		BIT_ULL(63)
@@ -36,6 +37,11 @@
 #define NEXT_PIN_ADDR(next, end_addr) (((next) + HPAGE_PMD_SIZE) > (end_addr) ? \
 			(end_addr) : ((next) + HPAGE_PMD_SIZE))
 
+/* the size of the pages of a page map entry, stored in is_huge_page */
+#define PIN_MEM_NORMAL_PAGE  0
+#define PIN_MEM_PMD_PAGE  1
+#define PIN_MEM_PUD_PAGE  2
+
 struct page_map_entry {
 	unsigned long virt_addr;
 	unsigned int nr_pages;
@@ -50,6 +56,8 @@ struct page_map_info {
 	unsigned int entry_num;
 	int disable_free_page;
 	struct page_map_entry *pme;
+	/* digest of all the page map entries of this pid */
+	char sha_digest[SHA256_DIGEST_SIZE];
 };
 
 struct pin_mem_dump_info {
@@ -74,6 +82,8 @@ extern int pin_mem_area(struct task_struct *task, struct mm_struct *mm,
 		unsigned long start_addr, unsigned long end_addr);
 extern vm_fault_t do_anon_huge_page_remap(struct vm_area_struct *vma, unsigned long address,
 		pmd_t *pmd, struct page *page);
+extern vm_fault_t do_hugetlb_pud_page_remap(struct vm_area_struct *vma,
+		unsigned long address, struct page *page);
 extern int finish_pin_mem_dump(void);
 
 extern void *create_pagemap_walk(void);
@@ -4,6 +4,9 @@
 
 #define PIPE_DEF_BUFFERS	16
 
+/* Released pages a pipe keeps around for its next writes */
+#define PIPE_TMP_PAGES		(PIPE_DEF_BUFFERS / 2)
+
 #define PIPE_BUF_FLAG_LRU	0x01	/* page is on the LRU */
 #define PIPE_BUF_FLAG_ATOMIC	0x02	/* was atomically mapped */
 #define PIPE_BUF_FLAG_GIFT	0x04	/* page is a gift */
@@ -33,7 +36,7 @@ struct pipe_buffer {
  *	@nrbufs: the number of non-empty pipe buffers in this pipe
  *	@buffers: total number of buffers (should be a power of 2)
  *	@curbuf: the current pipe buffer entry
- *	@tmp_page: cached released page
+ *	@tmp_page: cache of released pages, chained through page_private()
  *	@readers: number of current readers of this pipe
  *	@writers: number of current writers of this pipe
  *	@files: number of struct file referring this pipe (protected by ->i_lock)
@@ -44,6 +47,7 @@ struct pipe_buffer {
  *	@fasync_writers: writer side fasync
  *	@bufs: the circular array of pipe buffers
  *	@user: the user who created this pipe
+ *	@nr_tmp_pages: number of pages cached on @tmp_page
  **/
 struct pipe_inode_info {
 	struct mutex mutex;
@@ -60,6 +64,9 @@ struct pipe_inode_info {
 	struct fasync_struct *fasync_writers;
 	struct pipe_buffer *bufs;
 	struct user_struct *user;
+#ifndef __GENKSYMS__
+	unsigned int nr_tmp_pages;
+#endif
 };
 
 /*
@@ -406,6 +406,22 @@ int __sbitmap_queue_get(struct sbitmap_queue *sbq);
 int __sbitmap_queue_get_shallow(struct sbitmap_queue *sbq,
 				unsigned int shallow_depth);
 
+/**
+ * __sbitmap_queue_get_batch() - Try to allocate a batch of free bits from a
+ * &struct sbitmap_queue with preemption already disabled.
+ * @sbq: Bitmap queue to allocate from.
+ * @nr_tags: Maximum number of bits to allocate.
+ * @offset: Output parameter; will contain the bit number of the first bit
+ *          in the returned mask.
+ *
+ * All bits are taken from a single word with one atomic operation.
+ *
+ * Return: Mask of the allocated bits, relative to @offset, or 0 if none could
+ * be allocated.
+ */
+unsigned long __sbitmap_queue_get_batch(struct sbitmap_queue *sbq, int nr_tags,
+					unsigned int *offset);
+
 /**
  * sbitmap_queue_get() - Try to allocate a free bit from a &struct
  * sbitmap_queue.
@@ -479,6 +495,19 @@ void sbitmap_queue_min_shallow_depth(struct sbitmap_queue *sbq,
 void sbitmap_queue_clear(struct sbitmap_queue *sbq, unsigned int nr,
 			 unsigned int cpu);
 
+/**
+ * sbitmap_queue_clear_batch() - Free a batch of allocated bits from a
+ * &struct sbitmap_queue.
+ * @sbq: Bitmap to free from.
+ * @offset: Value subtracted from each entry of @tags to get its bit number.
+ * @tags: Array of bits to free.
+ * @nr_tags: Number of entries in @tags.
+ *
+ * Adjacent bits in the same word are cleared with a single atomic operation.
+ */
+void sbitmap_queue_clear_batch(struct sbitmap_queue *sbq, int offset,
+			       int *tags, int nr_tags);
+
 static inline int sbq_index_inc(int index)
 {
 	return (index + 1) & (SBQ_WAIT_QUEUES - 1);
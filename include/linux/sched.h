@@ -39,6 +39,7 @@ struct cfs_rq;
 struct fs_struct;
 struct futex_pi_state;
 struct io_context;
+struct io_uring_ringfd;
 struct mempolicy;
 struct nameidata;
 struct nsproxy;
@@ -635,6 +636,14 @@ struct task_struct_resvd {
 #ifdef CONFIG_QOS_SCHED_SMART_GRID
 	struct sched_grid_qos	*grid_qos;
 #endif
+#ifdef CONFIG_IO_URING
+	/* rings registered with IORING_REGISTER_RING_FDS */
+	struct io_uring_ringfd	*io_uring_rings;
+#endif
+#ifdef CONFIG_PSI
+	/* Pressure stall state */
+	unsigned int		psi_flags;
+#endif
 };
 
 struct task_struct {
@@ -757,6 +766,9 @@ struct task_struct {
 	unsigned			sched_contributes_to_load:1;
 	unsigned			sched_migrated:1;
 	unsigned			sched_remote_wakeup:1;
+#if defined(CONFIG_PSI) && !defined(__GENKSYMS__)
+	unsigned			sched_psi_wake_requeue:1;
+#endif
 	/* Force alignment to the next boundary: */
 	unsigned			:0;
 
@@ -1495,6 +1507,7 @@ extern struct pid *cad_pid;
 #define PF_UCE_KERNEL_RECOVERY	0x02000000	/* Task in uce kernel recovery state */
 #define PF_NO_SETAFFINITY	0x04000000	/* Userland is not allowed to meddle with cpus_allowed */
 #define PF_MCE_EARLY		0x08000000      /* Early kill for mce process policy */
+#define PF_MEMSTALL		0x10000000	/* Stalled due to lack of memory */
 #define PF_IO_WORKER		0x20000000	/* Task is an IO worker */
 #define PF_FREEZER_SKIP		0x40000000	/* Freezer should not count it as freezable */
 #define PF_SUSPEND_TASK		0x80000000      /* This thread called freeze_processes() and should not be frozen */
@@ -63,6 +63,8 @@ struct sched_grid_qos_power {
 struct sched_grid_qos_affinity {
 	nodemask_t mem_preferred_node_mask;
 	const struct cpumask *prefer_cpus;
+	/* preferred node of the task's cpu cgroup, or NUMA_NO_NODE */
+	int preferred_nid;
 };
 
 struct task_struct;
@@ -79,11 +81,24 @@ static inline int sched_qos_affinity_set(struct task_struct *p)
 	return p->_resvd->grid_qos->affinity_set(p);
 }
 
+static inline int sched_grid_task_preferred_nid(struct task_struct *p)
+{
+	struct sched_grid_qos *qos = p->_resvd->grid_qos;
+
+	return qos ? READ_ONCE(qos->affinity.preferred_nid) : NUMA_NO_NODE;
+}
+
+void sched_grid_set_preferred_nid(struct task_struct *p, int nid);
 int sched_grid_qos_fork(struct task_struct *p, struct task_struct *orig);
 void sched_grid_qos_free(struct task_struct *p);
 
 int sched_grid_preferred_interleave_nid(struct mempolicy *policy);
 int sched_grid_preferred_nid(int preferred_nid, nodemask_t *nodemask);
+
+void sched_grid_zone_mark_hot(const struct cpumask *span, unsigned long expires);
+bool sched_grid_zone_hot(int cpu);
+unsigned long sched_grid_zone_util(int cpu, unsigned long util,
+				   unsigned long max);
 #else
 static inline int
 sched_grid_preferred_interleave_nid(struct mempolicy *policy)
@@ -100,5 +115,16 @@ static inline int sched_qos_affinity_set(struct task_struct *p)
 {
 	return 0;
 }
+
+static inline unsigned long sched_grid_zone_util(int cpu, unsigned long util,
+						 unsigned long max)
+{
+	return util;
+}
+
+static inline int sched_grid_task_preferred_nid(struct task_struct *p)
+{
+	return NUMA_NO_NODE;
+}
 #endif
 #endif
@@ -38,6 +38,8 @@ extern int sysctl_sched_util_low_pct;
 
 #ifdef CONFIG_QOS_SCHED_SMART_GRID
 extern int sysctl_affinity_adjust_delay_ms;
+extern int sysctl_sched_grid_hot_util_min_pct;
+extern int sysctl_sched_grid_warm_util_pct;
 #endif
 
 enum sched_tunable_scaling {
@@ -78,6 +80,7 @@ extern unsigned int sysctl_sched_cfs_bandwidth_slice;
 #ifdef CONFIG_QOS_SCHED
 extern unsigned int sysctl_overload_detect_period;
 extern unsigned int sysctl_offline_wait_interval;
+extern unsigned int sysctl_qos_online_pressure_threshold;
 #endif
 
 #ifdef CONFIG_SCHED_AUTOGROUP
@@ -32,6 +32,7 @@
 #define SD_PREFER_SIBLING	0x1000	/* Prefer to place tasks in a sibling domain */
 #define SD_OVERLAP		0x2000	/* sched_domains of this level overlap */
 #define SD_NUMA			0x4000	/* cross-node balancing */
+#define SD_CLUSTER		0x8000	/* Domain members share a CPU cluster */
 
 #ifdef CONFIG_SCHED_SMT
 static inline int cpu_smt_flags(void)
@@ -40,6 +41,13 @@ static inline int cpu_smt_flags(void)
 }
 #endif
 
+#ifdef CONFIG_SCHED_CLUSTER
+static inline int cpu_cluster_flags(void)
+{
+	return SD_CLUSTER | SD_SHARE_PKG_RESOURCES;
+}
+#endif
+
 #ifdef CONFIG_SCHED_MC
 static inline int cpu_core_flags(void)
 {
@@ -74,6 +82,7 @@ struct sched_domain_shared {
 	int		has_idle_cores;
 #if defined(CONFIG_SCHED_STEAL) && !defined(__GENKSYMS__)
 	struct sparsemask *cfs_overload_cpus;
+	struct sparsemask *cfs_idle_cores;
 #endif
 };
 
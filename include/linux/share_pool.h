@@ -18,6 +18,7 @@
 #define SP_HUGEPAGE_ONLY	(1 << 1)
 #define SP_DVPP			(1 << 2)
 #define SP_SPEC_NODE_ID		(1 << 3)
+#define SP_LAZY			(1 << 4)	/* only prefault the pages in the allocator */
 #define SP_PROT_RO		(1 << 16)
 
 #define DEVICE_ID_BITS		4UL
@@ -28,7 +29,7 @@
 #define NODE_ID_SHIFT		(DEVICE_ID_SHIFT + DEVICE_ID_BITS)
 
 #define SP_FLAG_MASK		(SP_HUGEPAGE | SP_HUGEPAGE_ONLY | SP_DVPP | \
-				 SP_SPEC_NODE_ID | SP_PROT_RO | \
+				 SP_SPEC_NODE_ID | SP_LAZY | SP_PROT_RO | \
 				(DEVICE_ID_MASK << DEVICE_ID_SHIFT) | \
 				(NODE_ID_MASK << NODE_ID_SHIFT))
 
@@ -50,6 +51,8 @@
 
 #define MAX_DEVID 8	/* the max num of Da-vinci devices */
 
+#define SP_BATCH_MAX	1024	/* the max num of areas in one batch call */
+
 extern int sysctl_share_pool_hugepage_enable;
 
 extern int sysctl_ac_mode;
@@ -67,6 +70,8 @@ extern int sysctl_sp_perf_alloc;
 
 extern int sysctl_sp_perf_k2u;
 
+extern int sysctl_sp_lock_stat;
+
 #ifdef CONFIG_HAVE_ARCH_HUGE_VMALLOC
 extern bool vmap_allow_huge;
 #endif
@@ -111,6 +116,12 @@ struct sp_proc_stat {
 	 */
 	atomic64_t alloc_size;
 	atomic64_t k2u_size;
+	/*
+	 * number and total size of the sp_alloc areas mapped into this
+	 * process without prefaulting because of SP_LAZY, never decreases.
+	 */
+	atomic64_t lazy_num;
+	atomic64_t lazy_size;
 };
 
 /*
@@ -121,12 +132,20 @@ struct sp_mapping {
 	atomic_t user;
 	unsigned long start[MAX_DEVID];
 	unsigned long end[MAX_DEVID];
+
+	/* protects area_root and the free area cache below */
+	spinlock_t lock;
 	struct rb_root area_root;
 
 	struct rb_node *free_area_cache;
 	unsigned long cached_hole_size;
 	unsigned long cached_vstart;
 
+	/* lock hold time statistics, sampled under sysctl_sp_lock_stat */
+	unsigned long lock_count;
+	u64 lock_hold_ns;
+	u64 lock_hold_max_ns;
+
 	/*
 	 * list head for all groups attached to this mapping,
 	 * dvpp mapping only
@@ -165,8 +184,10 @@ struct sp_group {
 	int		 proc_num;
 	/* list head of processes (sp_group_node, each represents a process) */
 	struct list_head procs;
-	/* list head of sp_area. it is protected by spin_lock sp_area_lock */
+	/* list head of sp_area. it is protected by spin_lock spa_lock */
 	struct list_head spa_list;
+	/* protects spa_list and the use_count drops of its spas */
+	spinlock_t	 spa_lock;
 	/* group statistics */
 	struct sp_spg_stat *stat;
 	/* we define the creator process of a sp_group as owner */
@@ -270,6 +291,10 @@ extern void *mg_sp_alloc(unsigned long size, unsigned long sp_flags, int spg_id)
 extern int sp_free(unsigned long addr, int id);
 extern int mg_sp_free(unsigned long addr, int id);
 
+extern int sp_alloc_batch(unsigned long *sizes, unsigned long *addrs, int nr,
+			  unsigned long sp_flags, int spg_id);
+extern int sp_free_batch(unsigned long *addrs, int nr, int id);
+
 extern void *sp_make_share_k2u(unsigned long kva, unsigned long size,
 			unsigned long sp_flags, int pid, int spg_id);
 extern void *mg_sp_make_share_k2u(unsigned long kva, unsigned long size,
@@ -503,6 +528,17 @@ static inline int mg_sp_free(unsigned long addr, int id)
 	return -EPERM;
 }
 
+static inline int sp_alloc_batch(unsigned long *sizes, unsigned long *addrs,
+				 int nr, unsigned long sp_flags, int spg_id)
+{
+	return -EPERM;
+}
+
+static inline int sp_free_batch(unsigned long *addrs, int nr, int id)
+{
+	return -EPERM;
+}
+
 static inline void *sp_make_share_k2u(unsigned long kva, unsigned long size,
 		      unsigned long sp_flags, int pid, int spg_id)
 {
@@ -28,7 +28,7 @@ struct shmem_sb_info {
 	unsigned long max_blocks;   /* How many blocks are allowed */
 	struct percpu_counter used_blocks;  /* How many are allocated */
 	unsigned long max_inodes;   /* How many inodes are allowed */
-	unsigned long free_inodes;  /* How many are left for allocation */
+	struct percpu_counter used_inodes;  /* How many are allocated */
 	spinlock_t stat_lock;	    /* Serialize shmem_sb_info changes */
 	umode_t mode;		    /* Mount mode for root directory */
 	unsigned char huge;	    /* Whether to try for hugepages */
@@ -132,11 +132,17 @@ extern int shmem_mfill_zeropage_pte(struct mm_struct *dst_mm,
 				    pmd_t *dst_pmd,
 				    struct vm_area_struct *dst_vma,
 				    unsigned long dst_addr);
+extern int shmem_mcontinue_atomic_pte(struct mm_struct *dst_mm,
+				      pmd_t *dst_pmd,
+				      struct vm_area_struct *dst_vma,
+				      unsigned long dst_addr);
 #else
 #define shmem_mcopy_atomic_pte(dst_mm, dst_pte, dst_vma, dst_addr, \
 			       src_addr, pagep)        ({ BUG(); 0; })
 #define shmem_mfill_zeropage_pte(dst_mm, dst_pmd, dst_vma, \
 				 dst_addr)      ({ BUG(); 0; })
+#define shmem_mcontinue_atomic_pte(dst_mm, dst_pmd, dst_vma, \
+				   dst_addr)    ({ BUG(); 0; })
 #endif
 
 #endif
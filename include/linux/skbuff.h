@@ -483,6 +483,25 @@ void sock_zerocopy_put_abort(struct ubuf_info *uarg);
 
 void sock_zerocopy_callback(struct ubuf_info *uarg, bool success);
 
+/*
+ * MSG_ZEROCOPY state provided by the caller through msghdr::msg_ubuf
+ * instead of being allocated per socket. It is refcounted per skb like
+ * the socket one, and ->complete is called once the last skb is gone.
+ */
+struct ubuf_info_managed {
+	struct ubuf_info uarg;
+	void (*complete)(struct ubuf_info_managed *, bool zerocopy_success);
+};
+
+void sock_zerocopy_managed_callback(struct ubuf_info *uarg, bool success);
+
+/* refcounted per skb, as opposed to the once per skb vhost callbacks */
+static inline bool skb_zcopy_refcounted(struct ubuf_info *uarg)
+{
+	return uarg->callback == sock_zerocopy_callback ||
+	       uarg->callback == sock_zerocopy_managed_callback;
+}
+
 int skb_zerocopy_iter_stream(struct sock *sk, struct sk_buff *skb,
 			     struct msghdr *msg, int len,
 			     struct ubuf_info *uarg);
@@ -1341,7 +1360,7 @@ static inline void skb_zcopy_clear(struct sk_buff *skb, bool zerocopy)
 	if (uarg) {
 		if (skb_zcopy_is_nouarg(skb)) {
 			/* no notification callback */
-		} else if (uarg->callback == sock_zerocopy_callback) {
+		} else if (skb_zcopy_refcounted(uarg)) {
 			uarg->zerocopy = uarg->zerocopy && zerocopy;
 			sock_zerocopy_put(uarg);
 		} else {
@@ -2638,7 +2657,7 @@ static inline int skb_orphan_frags(struct sk_buff *skb, gfp_t gfp_mask)
 	if (likely(!skb_zcopy(skb)))
 		return 0;
 	if (!skb_zcopy_is_nouarg(skb) &&
-	    skb_uarg(skb)->callback == sock_zerocopy_callback)
+	    skb_zcopy_refcounted(skb_uarg(skb)))
 		return 0;
 	return skb_copy_ubufs(skb, gfp_mask);
 }
@@ -36,6 +36,8 @@ enum stat_item {
 	CPU_PARTIAL_FREE,	/* Refill cpu partial on free */
 	CPU_PARTIAL_NODE,	/* Refill cpu partial from node partial */
 	CPU_PARTIAL_DRAIN,	/* Drain cpu partial to node partial */
+	FREE_REMOTE_QUEUE,	/* Free queued for a slab on another node */
+	FREE_REMOTE_FLUSH,	/* Queued remote frees handed to their slab */
 	NR_SLUB_STAT_ITEMS };
 
 struct kmem_cache_cpu {
@@ -45,6 +47,13 @@ struct kmem_cache_cpu {
 #ifdef CONFIG_SLUB_CPU_PARTIAL
 	struct page *partial;	/* Partially allocated frozen slabs */
 #endif
+#ifdef CONFIG_NUMA
+	/* Objects freed to a slab on another node, not yet handed back */
+	struct page *remote_page;
+	void *remote_head;	/* Linked through their free pointers */
+	void *remote_tail;
+	int remote_cnt;
+#endif
 #ifdef CONFIG_SLUB_STATS
 	unsigned stat[NR_SLUB_STAT_ITEMS];
 #endif
@@ -67,6 +76,12 @@ struct kmem_cache_cpu {
 #define slub_percpu_partial_read_once(c)	NULL
 #endif // CONFIG_SLUB_CPU_PARTIAL
 
+#ifdef CONFIG_NUMA
+#define slub_remote_page(c)		((c)->remote_page)
+#else
+#define slub_remote_page(c)		NULL
+#endif
+
 /*
  * Word size structure that can be atomically updated or read and that
  * contains both the order and the number of objects that a slab of the
@@ -182,4 +197,16 @@ static inline void *nearest_obj(struct kmem_cache *cache, struct page *page,
 	return result;
 }
 
+static inline unsigned int obj_to_index(const struct kmem_cache *cache,
+					const struct page *page, void *obj)
+{
+	return (obj - page_address(page)) / cache->size;
+}
+
+static inline unsigned int objs_per_slab_page(const struct kmem_cache *cache,
+					      const struct page *page)
+{
+	return page->objects;
+}
+
 #endif /* _LINUX_SLUB_DEF_H */
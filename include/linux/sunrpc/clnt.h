@@ -124,6 +124,9 @@ struct rpc_create_args {
 	unsigned long		flags;
 	char			*client_name;
 	struct svc_xprt		*bc_xprt;	/* NFSv4.1 backchannel */
+#ifndef __GENKSYMS__
+	unsigned int		nconnect;	/* number of transports */
+#endif
 };
 
 struct rpc_add_xprt_test {
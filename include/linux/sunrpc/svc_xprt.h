@@ -90,6 +90,10 @@ struct svc_xprt {
 	struct net		*xpt_net;
 	struct rpc_xprt		*xpt_bc_xprt;	/* NFSv4.1 backchannel */
 	struct rpc_xprt_switch	*xpt_bc_xps;	/* NFSv4.1 backchannel */
+#ifndef __GENKSYMS__
+	int			xpt_rx_cpu;	/* cpu data last arrived on,
+						 * or -1 if unknown */
+#endif
 };
 
 static inline void unregister_xpt_user(struct svc_xprt *xpt, struct svc_xpt_user *u)
@@ -400,6 +400,10 @@ struct tcp_sock {
 	 */
 	struct request_sock *fastopen_rsk;
 	u32	*saved_syn;
+#ifndef __GENKSYMS__
+	u64	tcp_clock_cache; /* last tcp_clock_ns(), see tcp_mstamp_refresh() */
+	u64	tcp_wstamp_ns;	/* departure time for next sent data packet */
+#endif
 };
 
 enum tsq_enum {
@@ -194,6 +194,9 @@ extern enum hrtimer_restart it_real_fn(struct hrtimer *);
 #if defined(CONFIG_SMP) && defined(CONFIG_NO_HZ_COMMON)
 struct ctl_table;
 
+/* timer_migration = 2: migrate timers, but not to other NUMA nodes */
+#define TIMER_MIGRATION_NODE	2
+
 extern unsigned int sysctl_timer_migration;
 int timer_migration_handler(struct ctl_table *table, int write,
 			    void __user *buffer, size_t *lenp,
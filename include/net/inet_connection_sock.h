@@ -297,9 +297,21 @@ void inet_csk_prepare_forced_close(struct sock *sk);
 /*
  * LISTEN is a special case for poll..
  */
+static inline bool inet_csk_accept_queue_empty(const struct sock *sk)
+{
+	const struct request_sock_queue *queue;
+
+	queue = &inet_csk(sk)->icsk_accept_queue;
+	/* Cheaper than looking at every CPU's queue */
+	if (queue->rskq_shards)
+		return !atomic_read(&sk->sk_ack_backlog_shared);
+
+	return reqsk_queue_empty(queue);
+}
+
 static inline __poll_t inet_csk_listen_poll(const struct sock *sk)
 {
-	return !reqsk_queue_empty(&inet_csk(sk)->icsk_accept_queue) ?
+	return !inet_csk_accept_queue_empty(sk) ?
 			(EPOLLIN | EPOLLRDNORM) : 0;
 }
 
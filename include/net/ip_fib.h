@@ -94,7 +94,7 @@ struct fib_nh {
 	__be32			nh_saddr;
 	int			nh_saddr_genid;
 	struct rtable __rcu * __percpu *nh_pcpu_rth_output;
-	struct rtable __rcu	*nh_rth_input;
+	struct rtable __rcu * __percpu *nh_pcpu_rth_input;
 	struct fnhe_hash_bucket	__rcu *nh_exceptions;
 	struct lwtunnel_state	*nh_lwtstate;
 };
@@ -233,6 +233,7 @@ int fib_table_dump(struct fib_table *table, struct sk_buff *skb,
 int fib_table_flush(struct net *net, struct fib_table *table, bool flush_all);
 struct fib_table *fib_trie_unmerge(struct fib_table *main_tb);
 void fib_table_flush_external(struct fib_table *table);
+void fib_table_dir_set(struct fib_table *tb, unsigned char bits);
 void fib_free_table(struct fib_table *tb);
 
 #ifndef CONFIG_IP_MULTIPLE_TABLES
@@ -158,8 +158,12 @@ struct neighbour {
 	struct rcu_head		rcu;
 	struct net_device	*dev;
 
+#ifndef __GENKSYMS__
+	struct list_head	gc_list;
+#else
 	KABI_RESERVE(1)
 	KABI_RESERVE(2)
+#endif
 	u8			primary_key[0];
 } __randomize_layout;
 
@@ -223,6 +227,11 @@ struct neigh_table {
 	struct neigh_statistics	__percpu *stats;
 	struct neigh_hash_table __rcu *nht;
 	struct pneigh_entry	**phash_buckets;
+#ifndef __GENKSYMS__
+	unsigned int		gc_scan_left;
+	atomic_t		gc_entries;
+	struct list_head	gc_list;
+#endif
 };
 
 enum {
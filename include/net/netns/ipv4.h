@@ -211,6 +211,7 @@ struct netns_ipv4 {
 	int sysctl_fib_multipath_use_neigh;
 	int sysctl_fib_multipath_hash_policy;
 #endif
+	int sysctl_fib_dir_bits;
 
 	struct fib_notifier_ops	*notifier_ops;
 	unsigned int	fib_seq;	/* protected by rtnl_mutex */
@@ -154,11 +154,24 @@ struct fastopen_queue {
 	struct tcp_fastopen_context __rcu *ctx; /* cipher context for cookie */
 };
 
+/*
+ * struct request_sock_shard - per-CPU accept queue of a sharded listener
+ *
+ * Children are queued on the CPU that completed their handshake, so
+ * handshakes on different CPUs do not contend on one lock.
+ */
+struct request_sock_shard {
+	spinlock_t		lock;
+	struct request_sock	*head;
+	struct request_sock	*tail;
+};
+
 /** struct request_sock_queue - queue of request_socks
  *
  * @rskq_accept_head - FIFO head of established children
  * @rskq_accept_tail - FIFO tail of established children
  * @rskq_defer_accept - User waits for some data after accept()
+ * @rskq_shards - per-CPU FIFOs used instead of rskq_accept_head if set
  *
  */
 struct request_sock_queue {
@@ -174,15 +187,26 @@ struct request_sock_queue {
 	struct fastopen_queue	fastopenq;  /* Check max_qlen != 0 to determine
 					     * if TFO is enabled.
 					     */
+#ifndef __GENKSYMS__
+	struct request_sock_shard __percpu *rskq_shards;
+#endif
 };
 
 void reqsk_queue_alloc(struct request_sock_queue *queue);
+int reqsk_queue_alloc_shards(struct request_sock_queue *queue);
+void reqsk_queue_free_shards(struct request_sock_queue *queue);
+bool reqsk_shards_empty(const struct request_sock_queue *queue);
+struct request_sock *reqsk_shards_remove(struct request_sock_queue *queue,
+					 struct sock *parent);
 
 void reqsk_fastopen_remove(struct sock *sk, struct request_sock *req,
 			   bool reset);
 
 static inline bool reqsk_queue_empty(const struct request_sock_queue *queue)
 {
+	if (queue->rskq_shards)
+		return reqsk_shards_empty(queue);
+
 	return READ_ONCE(queue->rskq_accept_head) == NULL;
 }
 
@@ -191,6 +215,9 @@ static inline struct request_sock *reqsk_queue_remove(struct request_sock_queue
 {
 	struct request_sock *req;
 
+	if (queue->rskq_shards)
+		return reqsk_shards_remove(queue, parent);
+
 	spin_lock_bh(&queue->rskq_lock);
 	req = queue->rskq_accept_head;
 	if (req) {
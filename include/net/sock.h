@@ -285,6 +285,7 @@ struct sock_common {
   *		      persistent failure not just 'timed out'
   *	@sk_drops: raw/udp drops counter
   *	@sk_ack_backlog: current listen backlog
+  *	@sk_ack_backlog_shared: same, for listeners updating it without a lock
   *	@sk_max_ack_backlog: listen backlog set in listen()
   *	@sk_uid: user id of owner
   *	@sk_priority: %SO_PRIORITY setting
@@ -470,7 +471,14 @@ struct sock {
 	rwlock_t		sk_callback_lock;
 	int			sk_err,
 				sk_err_soft;
+#ifndef __GENKSYMS__
+	union {
+		u32		sk_ack_backlog;
+		atomic_t	sk_ack_backlog_shared;
+	};
+#else
 	u32			sk_ack_backlog;
+#endif
 	u32			sk_max_ack_backlog;
 	kuid_t			sk_uid;
 #if defined(CONFIG_DEBUG_SPINLOCK) || defined(CONFIG_DEBUG_LOCK_ALLOC)
@@ -912,6 +920,17 @@ static inline void sk_acceptq_added(struct sock *sk)
 	sk->sk_ack_backlog++;
 }
 
+/* For accept queues whose adds and removes do not share one lock */
+static inline void sk_acceptq_removed_shared(struct sock *sk)
+{
+	atomic_dec(&sk->sk_ack_backlog_shared);
+}
+
+static inline void sk_acceptq_added_shared(struct sock *sk)
+{
+	atomic_inc(&sk->sk_ack_backlog_shared);
+}
+
 static inline bool sk_acceptq_is_full(const struct sock *sk)
 {
 	return sk->sk_ack_backlog > sk->sk_max_ack_backlog;
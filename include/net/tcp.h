@@ -251,6 +251,7 @@ void tcp_time_wait(struct sock *sk, int state, int timeo);
 /* sysctl variables for tcp */
 extern int sysctl_tcp_max_orphans;
 extern long sysctl_tcp_mem[3];
+extern int sysctl_tcp_accept_sharded;
 
 #define TCP_RACK_LOSS_DETECTION  0x1 /* Use RACK to detect losses */
 #define TCP_RACK_STATIC_REO_WND  0x2 /* Use static RACK reo wnd */
@@ -752,9 +753,12 @@ void tcp_send_window_probe(struct sock *sk);
  */
 #define TCP_TS_HZ	1000
 
+/* CLOCK_MONOTONIC, so that departure times stamped in skb->tstamp (EDT)
+ * share their time base with sch_fq and the pacing hrtimer.
+ */
 static inline u64 tcp_clock_ns(void)
 {
-	return local_clock();
+	return ktime_get_ns();
 }
 
 static inline u64 tcp_clock_us(void)
@@ -780,8 +784,10 @@ static inline u32 tcp_time_stamp_raw(void)
  */
 static inline void tcp_mstamp_refresh(struct tcp_sock *tp)
 {
-	u64 val = tcp_clock_us();
+	u64 val = tcp_clock_ns();
 
+	tp->tcp_clock_cache = val;
+	val = div_u64(val, NSEC_PER_USEC);
 	if (val > tp->tcp_mstamp)
 		tp->tcp_mstamp = val;
 }
@@ -1023,6 +1029,7 @@ struct rate_sample {
 	bool is_app_limited;	/* is sample from packet with bubble in pipe? */
 	bool is_retrans;	/* is sample from retransmission? */
 	bool is_ack_delayed;	/* is this (likely) a delayed ACK? */
+	u32  tx_in_flight;	/* packets in flight when acked skb was sent */
 };
 
 struct tcp_congestion_ops {
@@ -2244,6 +2251,8 @@ bool tcp_synack_comp_enabled(const struct sock *sk,
 void tcp_init_compression(struct sock *sk);
 void tcp_cleanup_compression(struct sock *sk);
 int tcp_comp_init(void);
+size_t tcp_comp_get_info_size(const struct sock *sk);
+int tcp_comp_get_info(struct sock *sk, struct sk_buff *skb);
 #else
 static inline bool tcp_syn_comp_enabled(const struct tcp_sock *tp)
 {
@@ -2268,6 +2277,16 @@ static inline int tcp_comp_init(void)
 {
 	return 0;
 }
+
+static inline size_t tcp_comp_get_info_size(const struct sock *sk)
+{
+	return 0;
+}
+
+static inline int tcp_comp_get_info(struct sock *sk, struct sk_buff *skb)
+{
+	return 0;
+}
 #endif
 
 #endif	/* _TCP_H */
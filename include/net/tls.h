@@ -118,6 +118,11 @@ struct tls_sw_context_tx {
 	struct scatterlist sg_aead_in[2];
 	/* AAD | sg_encrypted_data (data contain overhead for hdr&iv&tag) */
 	struct scatterlist sg_aead_out[2];
+
+#ifndef __GENKSYMS__
+	/* Reused for every record, records are encrypted one at a time */
+	struct aead_request *aead_req;
+#endif
 };
 
 struct tls_sw_context_rx {
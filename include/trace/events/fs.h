@@ -27,6 +27,31 @@ DECLARE_TRACE(fs_file_release,
 	TP_PROTO(struct inode *inode, struct file *filp),
 	TP_ARGS(inode, filp));
 
+/*
+ * Path walk dropped out of RCU mode in directory @dir.  @ip is the caller of
+ * unlazy_walk()/unlazy_child(), which tells why.
+ */
+TRACE_EVENT(fs_unlazy_walk,
+	TP_PROTO(struct inode *dir, unsigned long ip),
+	TP_ARGS(dir, ip),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, ino)
+		__field(unsigned long, ip)
+	),
+
+	TP_fast_assign(
+		__entry->dev = dir ? dir->i_sb->s_dev : 0;
+		__entry->ino = dir ? dir->i_ino : 0;
+		__entry->ip = ip;
+	),
+
+	TP_printk("dev %d:%d ino 0x%lx caller %pS",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->ino, (void *)__entry->ip)
+);
+
 #endif /* _TRACE_FS_H */
 
 /* This part must be outside protection */
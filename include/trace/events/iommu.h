@@ -272,6 +272,43 @@ TRACE_EVENT(sva_invalidate,
 	)
 );
 
+TRACE_EVENT(iopf_group_handled,
+
+	TP_PROTO(struct device *dev, struct iommu_fault_event *evt,
+		 unsigned int nr_faults, u64 queue_ns, u64 handle_ns, int code),
+
+	TP_ARGS(dev, evt, nr_faults, queue_ns, handle_ns, code),
+
+	TP_STRUCT__entry(
+		__string(device, dev_name(dev))
+		__field(u32, pasid)
+		__field(u32, pgid)
+		__field(unsigned int, nr_faults)
+		__field(u64, queue_ns)
+		__field(u64, handle_ns)
+		__field(int, code)
+	),
+
+	TP_fast_assign(
+		__assign_str(device, dev_name(dev));
+		__entry->pasid = evt->pasid;
+		__entry->pgid = evt->page_req_group_id;
+		__entry->nr_faults = nr_faults;
+		__entry->queue_ns = queue_ns;
+		__entry->handle_ns = handle_ns;
+		__entry->code = code;
+	),
+
+	TP_printk("IOMMU:%s pasid=%d group=%d faults=%u queued=%lluns handled=%lluns code=%d",
+		__get_str(device),
+		__entry->pasid,
+		__entry->pgid,
+		__entry->nr_faults,
+		__entry->queue_ns,
+		__entry->handle_ns,
+		__entry->code
+	)
+);
 
 #endif /* _TRACE_IOMMU_H */
 
@@ -112,7 +112,8 @@ IF_HAVE_PG_UNCACHED(PG_uncached,	"uncached"	)		\
 IF_HAVE_PG_HWPOISON(PG_hwpoison,	"hwpoison"	)		\
 IF_HAVE_PG_IDLE(PG_young,		"young"		)		\
 IF_HAVE_PG_IDLE(PG_idle,		"idle"),			\
-	{1UL << PG_percpu_ref,		"percpu_ref"	}
+	{1UL << PG_percpu_ref,		"percpu_ref"	},		\
+	{1UL << PG_workingset,		"workingset"	}
 
 #define show_page_flags(flags)						\
 	(flags) ? __print_flags(flags, "|",				\
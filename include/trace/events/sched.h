@@ -568,6 +568,39 @@ TRACE_EVENT(sched_swap_numa,
 			__entry->dst_cpu, __entry->dst_nid)
 );
 
+#ifdef CONFIG_QOS_SCHED_SMART_GRID
+/*
+ * Tracepoint for a smart grid group changing its preferred domain level:
+ */
+TRACE_EVENT(sched_auto_affinity_level,
+
+	TP_PROTO(unsigned long cgroup_ino, int prev_level, int level,
+		 unsigned long util, unsigned long capacity),
+
+	TP_ARGS(cgroup_ino, prev_level, level, util, capacity),
+
+	TP_STRUCT__entry(
+		__field( unsigned long,	cgroup_ino	)
+		__field( int,		prev_level	)
+		__field( int,		level		)
+		__field( unsigned long,	util		)
+		__field( unsigned long,	capacity	)
+	),
+
+	TP_fast_assign(
+		__entry->cgroup_ino	= cgroup_ino;
+		__entry->prev_level	= prev_level;
+		__entry->level		= level;
+		__entry->util		= util;
+		__entry->capacity	= capacity;
+	),
+
+	TP_printk("cgroup_ino=%lu prev_level=%d level=%d util=%lu capacity=%lu",
+		  __entry->cgroup_ino, __entry->prev_level, __entry->level,
+		  __entry->util, __entry->capacity)
+);
+#endif
+
 /*
  * Tracepoint for waking a polling cpu without an IPI.
  */
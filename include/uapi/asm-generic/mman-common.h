@@ -66,6 +66,8 @@
 #define MADV_WIPEONFORK 18		/* Zero memory on fork, child only */
 #define MADV_KEEPONFORK 19		/* Undo MADV_WIPEONFORK */
 
+#define MADV_COLLAPSE	25		/* Synchronous hugepage collapse */
+
 #define MADV_SWAPFLAG   203 /* memory swap flag, for memory to be swap out */
 #define MADV_SWAPFLAG_REMOVE 204
 
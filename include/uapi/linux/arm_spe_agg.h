@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+#ifndef _UAPI_ARM_SPE_AGG_H_
+#define _UAPI_ARM_SPE_AGG_H_
+
+#include <linux/types.h>
+
+/* @pfn of the record folding the samples of pages not tracked on their own */
+#define ARM_SPE_AGG_PFN_NONE	(~0ULL)
+/* @node of samples whose physical address is not backed by a struct page */
+#define ARM_SPE_AGG_NODE_NONE	(~0U)
+
+/**
+ * struct arm_spe_agg_record - Aggregated SPE samples for one page
+ * @pfn:	Physical frame number the samples hit, or ARM_SPE_AGG_PFN_NONE.
+ * @node:	NUMA node of @pfn, or ARM_SPE_AGG_NODE_NONE.
+ * @loads:	Number of sampled loads.
+ * @stores:	Number of sampled stores.
+ * @remote:	Number of samples with the REMOTE-ACCESS event set.
+ * @total_lat:	Sum of the total latency counters of the samples, in cycles.
+ *
+ * With the aggregate format bit set, an arm_spe event writes arrays of
+ * these records to its AUX area instead of raw SPE records. A page may
+ * show up in several records, even within one AUX update; consumers are
+ * expected to sum them.
+ */
+struct arm_spe_agg_record {
+	__u64	pfn;
+	__u32	node;
+	__u32	loads;
+	__u32	stores;
+	__u32	remote;
+	__u64	total_lat;
+};
+
+#endif /* _UAPI_ARM_SPE_AGG_H_ */
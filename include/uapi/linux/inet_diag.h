@@ -153,6 +153,7 @@ enum {
 	INET_DIAG_BBRINFO,	/* request as INET_DIAG_VEGASINFO */
 	INET_DIAG_CLASS_ID,	/* request as INET_DIAG_TCLASS */
 	INET_DIAG_MD5SIG,
+	INET_DIAG_COMPINFO,
 	__INET_DIAG_MAX,
 };
 
@@ -197,6 +198,16 @@ struct tcp_bbr_info {
 	__u32	bbr_cwnd_gain;		/* cwnd gain shifted left 8 bits */
 };
 
+/* INET_DIAG_COMPINFO */
+
+struct tcp_comp_info {
+	__u32	tcpcomp_level;		/* current level, 0 while bypassing */
+	__u32	tcpcomp_bypass;		/* records left to send uncompressed */
+	__u64	tcpcomp_bytes_in;	/* payload bytes handed to compression */
+	__u64	tcpcomp_bytes_out;	/* bytes queued to TCP after compression */
+	__u64	tcpcomp_bytes_stored;	/* payload bytes sent uncompressed */
+};
+
 union tcp_cc_info {
 	struct tcpvegas_info	vegas;
 	struct tcp_dctcp_info	dctcp;
@@ -55,7 +55,11 @@ struct io_uring_sqe {
 			} __attribute__((packed));
 			/* personality to use, if used */
 			__u16	personality;
-			__s32	splice_fd_in;
+			union {
+				__s32	splice_fd_in;
+				/* registered file slot + 1 for the new file */
+				__u32	file_index;
+			};
 		};
 		__u64	__pad2[3];
 	};
@@ -131,6 +135,7 @@ enum {
 	IORING_OP_PROVIDE_BUFFERS,
 	IORING_OP_REMOVE_BUFFERS,
 	IORING_OP_TEE,
+	IORING_OP_SEND_ZC,
 
 	/* this goes last, obviously */
 	IORING_OP_LAST,
@@ -161,12 +166,35 @@ struct io_uring_cqe {
 	__u32	flags;
 };
 
+/*
+ * accept flags stored in sqe->ioprio
+ */
+#define IORING_ACCEPT_MULTISHOT	(1U << 0)
+
+/*
+ * recv flags stored in sqe->ioprio
+ */
+#define IORING_RECV_MULTISHOT	(1U << 1)
+
+/*
+ * IORING_OP_SEND_ZC flags stored in sqe->ioprio
+ *
+ * IORING_RECVSEND_FIXED_BUF	Send from the registered buffer at
+ *				sqe->buf_index, sqe->addr points into it.
+ */
+#define IORING_RECVSEND_FIXED_BUF	(1U << 2)
+
 /*
  * cqe->flags
  *
  * IORING_CQE_F_BUFFER	If set, the upper 16 bits are the buffer ID
+ * IORING_CQE_F_MORE	If set, parent SQE will generate more CQE entries
+ * IORING_CQE_F_NOTIF	Notification CQE of IORING_OP_SEND_ZC, the buffer
+ *			may be reused
  */
 #define IORING_CQE_F_BUFFER		(1U << 0)
+#define IORING_CQE_F_MORE		(1U << 1)
+#define IORING_CQE_F_NOTIF		(1U << 3)
 
 enum {
 	IORING_CQE_BUFFER_SHIFT		= 16,
@@ -224,6 +252,7 @@ struct io_cqring_offsets {
  */
 #define IORING_ENTER_GETEVENTS	(1U << 0)
 #define IORING_ENTER_SQ_WAKEUP	(1U << 1)
+#define IORING_ENTER_REGISTERED_RING	(1U << 4)
 
 /*
  * Passed in for io_uring_setup(2). Copied back with updated info on success
@@ -268,12 +297,29 @@ struct io_uring_params {
 #define IORING_REGISTER_PERSONALITY	9
 #define IORING_UNREGISTER_PERSONALITY	10
 
+/* set/clear io-wq thread affinities */
+#define IORING_REGISTER_IOWQ_AFF	17
+#define IORING_UNREGISTER_IOWQ_AFF	18
+
+/* set/get max number of io-wq workers */
+#define IORING_REGISTER_IOWQ_MAX_WORKERS	19
+
+/* register/unregister io_uring fds with the ring, numbered as upstream */
+#define IORING_REGISTER_RING_FDS	20
+#define IORING_UNREGISTER_RING_FDS	21
+
 struct io_uring_files_update {
 	__u32 offset;
 	__u32 resv;
 	__aligned_u64 /* __s32 * */ fds;
 };
 
+struct io_uring_rsrc_update {
+	__u32 offset;
+	__u32 resv;
+	__aligned_u64 data;
+};
+
 #define IO_URING_OP_SUPPORTED	(1U << 0)
 
 struct io_uring_probe_op {
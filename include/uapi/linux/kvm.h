@@ -977,6 +977,7 @@ struct kvm_ppc_resize_hpt {
 #define KVM_CAP_MANUAL_DIRTY_LOG_PROTECT 166 /* Obsolete */
 #define KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2 168
 #define KVM_CAP_ARM_IRQ_LINE_LAYOUT_2 174
+#define KVM_CAP_HALT_POLL 182
 
 #define KVM_CAP_ARM_CPU_FEATURE 555
 
@@ -1592,4 +1593,7 @@ struct kvm_hyperv_eventfd {
 #define KVM_DIRTY_LOG_MANUAL_PROTECT_ENABLE    (1 << 0)
 #define KVM_DIRTY_LOG_INITIALLY_SET            (1 << 1)
 
+/* for KVM_CAP_HALT_POLL args[1] */
+#define KVM_HALT_POLL_PREDICT                  (1 << 0)
+
 #endif /* __LINUX_KVM_H */
@@ -8,6 +8,8 @@
 #define MFD_CLOEXEC		0x0001U
 #define MFD_ALLOW_SEALING	0x0002U
 #define MFD_HUGETLB		0x0004U
+/* back the memfd with transparent huge pages, see shmem_file_setup() */
+#define MFD_HUGEPAGE		0x0020U
 
 /*
  * Huge page size encoding when MFD_HUGETLB is specified, and a huge page
@@ -1086,4 +1086,22 @@ enum {
 	CAKE_ATM_MAX
 };
 
+/* EDTRL */
+enum {
+	TCA_EDTRL_UNSPEC,
+	TCA_EDTRL_PAD,
+	TCA_EDTRL_RATE64,	/* aggregate rate, in bytes per second */
+	TCA_EDTRL_BURST,	/* idle time that may be caught up, in bytes */
+	TCA_EDTRL_QUANTUM,	/* bytes a CPU reserves at a time */
+	TCA_EDTRL_LIMIT,	/* queue length, in packets */
+	__TCA_EDTRL_MAX,
+};
+
+#define TCA_EDTRL_MAX (__TCA_EDTRL_MAX - 1)
+
+struct tc_edtrl_xstats {
+	__u64	throttled;	/* dequeues held back by the watchdog */
+	__u64	refills;	/* slices reserved by the CPUs */
+};
+
 #endif
@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+#ifndef _UAPI_TRACE_MMAP_H_
+#define _UAPI_TRACE_MMAP_H_
+
+#include <linux/types.h>
+
+/**
+ * struct trace_buffer_meta - Ring-buffer Meta-page description
+ * @meta_page_size:	Size of this meta-page.
+ * @meta_struct_len:	Size of this structure.
+ * @subbuf_size:	Size of each sub-buffer.
+ * @nr_subbufs:		Number of sub-buffers, including the reader.
+ * @reader.lost_events:	Number of events lost before the current reader.
+ * @reader.id:		ID of the reader sub-buffer, in [0, @nr_subbufs).
+ * @reader.read:	Offset of the first event handed out on the reader.
+ * @reader.commit:	Offset past the last event handed out on the reader.
+ * @entries:		Number of entries in the ring-buffer.
+ * @overrun:		Number of entries lost in the ring-buffer.
+ * @read:		Number of entries that have been read.
+ *
+ * The meta-page is the first page of the mapping, followed by the
+ * @nr_subbufs sub-buffers in ID order. Each sub-buffer starts with the
+ * usual page header (time stamp and commit) used by trace_pipe_raw.
+ *
+ * TRACE_MMAP_IOCTL_GET_READER consumes the events previously handed out,
+ * swaps a new reader sub-buffer in if needed and updates the meta-page.
+ * The events between @reader.read and @reader.commit of sub-buffer
+ * @reader.id then belong to the caller until its next GET_READER. Unless
+ * the file is non-blocking, the ioctl waits for a full sub-buffer when
+ * the ring-buffer is empty.
+ */
+struct trace_buffer_meta {
+	__u32		meta_page_size;
+	__u32		meta_struct_len;
+
+	__u32		subbuf_size;
+	__u32		nr_subbufs;
+
+	struct {
+		__u64	lost_events;
+		__u32	id;
+		__u32	read;
+		__u32	commit;
+		__u32	__reserved;
+	} reader;
+
+	__u64	entries;
+	__u64	overrun;
+	__u64	read;
+};
+
+#define TRACE_MMAP_IOCTL_GET_READER		_IO('T', 0x1)
+
+#endif /* _UAPI_TRACE_MMAP_H_ */
@@ -100,6 +100,27 @@ struct vhost_memory {
 	struct vhost_memory_region regions[0];
 };
 
+struct vhost_worker_state {
+	/* Id of a worker thread.  The worker created by VHOST_SET_OWNER is
+	 * worker 0 and handles every virtqueue that is not attached to
+	 * another one.
+	 */
+	__u32 worker_id;
+};
+
+struct vhost_vring_worker {
+	unsigned int index;
+	__u32 worker_id;
+};
+
+/* Run the worker on a single cpu, or anywhere the owner may run */
+#define VHOST_WORKER_CPU_ANY (~0U)
+
+struct vhost_worker_affinity {
+	__u32 worker_id;
+	__u32 cpu;
+};
+
 /* ioctls */
 
 #define VHOST_VIRTIO 0xAF
@@ -129,6 +150,14 @@ struct vhost_memory {
 /* Specify an eventfd file descriptor to signal on log write. */
 #define VHOST_SET_LOG_FD _IOW(VHOST_VIRTIO, 0x07, int)
 
+/* Create a new worker thread, in the owner's cgroups, and return its id */
+#define VHOST_NEW_WORKER _IOR(VHOST_VIRTIO, 0x8, struct vhost_worker_state)
+/* Free a worker thread that no virtqueue is attached to */
+#define VHOST_FREE_WORKER _IOW(VHOST_VIRTIO, 0x9, struct vhost_worker_state)
+/* Pin a worker thread to a cpu, see VHOST_WORKER_CPU_ANY */
+#define VHOST_SET_WORKER_AFFINITY _IOW(VHOST_VIRTIO, 0xa,		\
+					struct vhost_worker_affinity)
+
 /* Ring setup. */
 /* Set number of descriptors in ring. This parameter can not
  * be modified while ring is running (bound to a device). */
@@ -153,6 +182,12 @@ struct vhost_memory {
 #define VHOST_VRING_BIG_ENDIAN 1
 #define VHOST_SET_VRING_ENDIAN _IOW(VHOST_VIRTIO, 0x13, struct vhost_vring_state)
 #define VHOST_GET_VRING_ENDIAN _IOW(VHOST_VIRTIO, 0x14, struct vhost_vring_state)
+/* Have a virtqueue handled by the given worker thread */
+#define VHOST_ATTACH_VRING_WORKER _IOW(VHOST_VIRTIO, 0x15,		\
+				       struct vhost_vring_worker)
+/* Return the id of the worker thread handling a virtqueue */
+#define VHOST_GET_VRING_WORKER _IOWR(VHOST_VIRTIO, 0x16,		\
+				     struct vhost_vring_worker)
 
 /* The following ioctls use eventfd file descriptors to signal and poll
  * for events. */
@@ -174,6 +209,8 @@ struct vhost_memory {
 
 /* Use message type V2 */
 #define VHOST_BACKEND_F_IOTLB_MSG_V2 0x1
+/* A single write may carry several IOTLB messages */
+#define VHOST_BACKEND_F_IOTLB_BATCH  0x2
 
 #define VHOST_SET_BACKEND_FEATURES _IOW(VHOST_VIRTIO, 0x25, __u64)
 #define VHOST_GET_BACKEND_FEATURES _IOR(VHOST_VIRTIO, 0x26, __u64)
@@ -1138,6 +1138,7 @@ static noinline void __init kernel_init_freeable(void)
 
 	smp_init();
 	sched_init_smp();
+	workqueue_init_topology();
 	ktask_init();
 
 	page_alloc_init_late();
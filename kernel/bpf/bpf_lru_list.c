@@ -5,6 +5,9 @@
  * License as published by the Free Software Foundation.
  */
 #include <linux/cpumask.h>
+#include <linux/jiffies.h>
+#include <linux/nodemask.h>
+#include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/percpu.h>
 
@@ -30,6 +33,19 @@ static int get_next_cpu(int cpu)
 	return cpu;
 }
 
+static int bpf_lru_cpu_node(int cpu)
+{
+	int nid = cpu_to_node(cpu);
+
+	return nid == NUMA_NO_NODE ? 0 : nid;
+}
+
+/* The common LRU list a node allocated on @cpu belongs to */
+static struct bpf_lru_list *common_lru_list(struct bpf_lru *lru, int cpu)
+{
+	return lru->common_lru.node_lru[bpf_lru_cpu_node(cpu)];
+}
+
 /* Local list helpers */
 static struct list_head *local_free_list(struct bpf_lru_locallist *loc_l)
 {
@@ -245,6 +261,21 @@ static void __bpf_lru_list_rotate(struct bpf_lru *lru, struct bpf_lru_list *l)
 	__bpf_lru_list_rotate_inactive(lru, l);
 }
 
+/* The common LRU lists are shared by all CPUs of a node, so rotate them
+ * at most once per tick, unless the inactive list holds too few nodes
+ * for the next shrink to find candidates.
+ */
+static void __bpf_lru_list_rotate_batched(struct bpf_lru *lru,
+					  struct bpf_lru_list *l)
+{
+	if (time_before(jiffies, l->next_rotation) &&
+	    l->counts[BPF_LRU_LIST_T_INACTIVE] >= lru->nr_scans)
+		return;
+
+	l->next_rotation = jiffies + 1;
+	__bpf_lru_list_rotate(lru, l);
+}
+
 /* Calls __bpf_lru_list_shrink_inactive() to shrink some
  * ref-bit-cleared nodes and move them to the designated
  * free list.
@@ -318,33 +349,90 @@ static void bpf_lru_list_push_free(struct bpf_lru_list *l,
 	raw_spin_unlock_irqrestore(&l->lock, flags);
 }
 
-static void bpf_lru_list_pop_free_to_local(struct bpf_lru *lru,
-					   struct bpf_lru_locallist *loc_l)
+/* Move up to nr nodes from the free list of l to the local free list */
+static unsigned int __bpf_lru_list_pop_free(struct bpf_lru_list *l,
+					    struct bpf_lru_locallist *loc_l,
+					    unsigned int nr)
 {
-	struct bpf_lru_list *l = &lru->common_lru.lru_list;
 	struct bpf_lru_node *node, *tmp_node;
 	unsigned int nfree = 0;
 
-	raw_spin_lock(&l->lock);
-
-	__local_list_flush(l, loc_l);
-
-	__bpf_lru_list_rotate(lru, l);
-
 	list_for_each_entry_safe(node, tmp_node, &l->lists[BPF_LRU_LIST_T_FREE],
 				 list) {
 		__bpf_lru_node_move_to_free(l, node, local_free_list(loc_l),
 					    BPF_LRU_LOCAL_LIST_T_FREE);
-		if (++nfree == LOCAL_FREE_TARGET)
+		if (++nfree == nr)
 			break;
 	}
 
-	if (nfree < LOCAL_FREE_TARGET)
-		__bpf_lru_list_shrink(lru, l, LOCAL_FREE_TARGET - nfree,
-				      local_free_list(loc_l),
-				      BPF_LRU_LOCAL_LIST_T_FREE);
+	return nfree;
+}
+
+/* Unlocked hint: does the list of any other node have free nodes? */
+static bool bpf_lru_remote_has_free(struct bpf_common_lru *clru, int nid)
+{
+	int i;
+
+	for (i = 0; i < nr_node_ids; i++) {
+		if (i != nid &&
+		    !list_empty(&clru->node_lru[i]->lists[BPF_LRU_LIST_T_FREE]))
+			return true;
+	}
+
+	return false;
+}
+
+static void bpf_lru_list_pop_free_to_local(struct bpf_lru *lru,
+					   struct bpf_lru_locallist *loc_l,
+					   int cpu)
+{
+	struct bpf_common_lru *clru = &lru->common_lru;
+	int nid = bpf_lru_cpu_node(cpu);
+	struct bpf_lru_list *l = clru->node_lru[nid];
+	bool remote_free = bpf_lru_remote_has_free(clru, nid);
+	unsigned int nfree;
+	int i;
+
+	raw_spin_lock(&l->lock);
+
+	__local_list_flush(l, loc_l);
+
+	__bpf_lru_list_rotate_batched(lru, l);
+
+	nfree = __bpf_lru_list_pop_free(l, loc_l, LOCAL_FREE_TARGET);
+
+	/* Don't evict while other nodes still have free nodes to give */
+	if (nfree < LOCAL_FREE_TARGET && !remote_free)
+		nfree += __bpf_lru_list_shrink(lru, l,
+					       LOCAL_FREE_TARGET - nfree,
+					       local_free_list(loc_l),
+					       BPF_LRU_LOCAL_LIST_T_FREE);
 
 	raw_spin_unlock(&l->lock);
+
+	if (nfree == LOCAL_FREE_TARGET || (nfree && !remote_free))
+		return;
+
+	/* Refill from the other nodes: take their free nodes if there are
+	 * any, otherwise evict from them, as this node had nothing left.
+	 * Only one list lock is held at a time.
+	 */
+	for (i = 0; i < nr_node_ids && nfree < LOCAL_FREE_TARGET; i++) {
+		if (i == nid)
+			continue;
+
+		l = clru->node_lru[i];
+		raw_spin_lock(&l->lock);
+		if (remote_free)
+			nfree += __bpf_lru_list_pop_free(l, loc_l,
+						LOCAL_FREE_TARGET - nfree);
+		else
+			nfree += __bpf_lru_list_shrink(lru, l,
+						LOCAL_FREE_TARGET - nfree,
+						local_free_list(loc_l),
+						BPF_LRU_LOCAL_LIST_T_FREE);
+		raw_spin_unlock(&l->lock);
+	}
 }
 
 static void __local_list_add_pending(struct bpf_lru *lru,
@@ -447,7 +535,7 @@ static struct bpf_lru_node *bpf_common_lru_pop_free(struct bpf_lru *lru,
 
 	node = __local_list_pop_free(loc_l);
 	if (!node) {
-		bpf_lru_list_pop_free_to_local(lru, loc_l);
+		bpf_lru_list_pop_free_to_local(lru, loc_l, cpu);
 		node = __local_list_pop_free(loc_l);
 	}
 
@@ -532,7 +620,7 @@ static void bpf_common_lru_push_free(struct bpf_lru *lru,
 	}
 
 check_lru_list:
-	bpf_lru_list_push_free(&lru->common_lru.lru_list, node);
+	bpf_lru_list_push_free(common_lru_list(lru, node->cpu), node);
 }
 
 static void bpf_percpu_lru_push_free(struct bpf_lru *lru,
@@ -562,17 +650,22 @@ static void bpf_common_lru_populate(struct bpf_lru *lru, void *buf,
 				    u32 node_offset, u32 elem_size,
 				    u32 nr_elems)
 {
-	struct bpf_lru_list *l = &lru->common_lru.lru_list;
+	int cpu = cpumask_first(cpu_possible_mask);
+	struct bpf_lru_list *l;
 	u32 i;
 
+	/* Spread the nodes over the node lists in proportion to the CPUs */
 	for (i = 0; i < nr_elems; i++) {
 		struct bpf_lru_node *node;
 
+		l = common_lru_list(lru, cpu);
 		node = (struct bpf_lru_node *)(buf + node_offset);
+		node->cpu = cpu;
 		node->type = BPF_LRU_LIST_T_FREE;
 		node->ref = 0;
 		list_add(&node->list, &l->lists[BPF_LRU_LIST_T_FREE]);
 		buf += elem_size;
+		cpu = get_next_cpu(cpu);
 	}
 }
 
@@ -641,14 +734,65 @@ static void bpf_lru_list_init(struct bpf_lru_list *l)
 		l->counts[i] = 0;
 
 	l->next_inactive_rotation = &l->lists[BPF_LRU_LIST_T_INACTIVE];
+	l->next_rotation = jiffies;
 
 	raw_spin_lock_init(&l->lock);
 }
 
+static void bpf_common_lru_destroy(struct bpf_common_lru *clru)
+{
+	int i;
+
+	if (clru->node_lru) {
+		for (i = 0; i < nr_node_ids; i++)
+			kfree(clru->node_lru[i]);
+		kfree(clru->node_lru);
+	}
+	free_percpu(clru->local_list);
+}
+
+static int bpf_common_lru_init(struct bpf_common_lru *clru)
+{
+	int cpu, i;
+
+	clru->local_list = alloc_percpu(struct bpf_lru_locallist);
+	if (!clru->local_list)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct bpf_lru_locallist *loc_l;
+
+		loc_l = per_cpu_ptr(clru->local_list, cpu);
+		bpf_lru_locallist_init(loc_l, cpu);
+	}
+
+	clru->node_lru = kcalloc(nr_node_ids, sizeof(*clru->node_lru),
+				 GFP_KERNEL);
+	if (!clru->node_lru)
+		goto err;
+
+	for (i = 0; i < nr_node_ids; i++) {
+		struct bpf_lru_list *l;
+
+		l = kmalloc_node(sizeof(*l), GFP_KERNEL,
+				 node_online(i) ? i : NUMA_NO_NODE);
+		if (!l)
+			goto err;
+		bpf_lru_list_init(l);
+		clru->node_lru[i] = l;
+	}
+
+	return 0;
+
+err:
+	bpf_common_lru_destroy(clru);
+	return -ENOMEM;
+}
+
 int bpf_lru_init(struct bpf_lru *lru, bool percpu, u32 hash_offset,
 		 del_from_htab_func del_from_htab, void *del_arg)
 {
-	int cpu;
+	int cpu, err;
 
 	if (percpu) {
 		lru->percpu_lru = alloc_percpu(struct bpf_lru_list);
@@ -663,20 +807,9 @@ int bpf_lru_init(struct bpf_lru *lru, bool percpu, u32 hash_offset,
 		}
 		lru->nr_scans = PERCPU_NR_SCANS;
 	} else {
-		struct bpf_common_lru *clru = &lru->common_lru;
-
-		clru->local_list = alloc_percpu(struct bpf_lru_locallist);
-		if (!clru->local_list)
-			return -ENOMEM;
-
-		for_each_possible_cpu(cpu) {
-			struct bpf_lru_locallist *loc_l;
-
-			loc_l = per_cpu_ptr(clru->local_list, cpu);
-			bpf_lru_locallist_init(loc_l, cpu);
-		}
-
-		bpf_lru_list_init(&clru->lru_list);
+		err = bpf_common_lru_init(&lru->common_lru);
+		if (err)
+			return err;
 		lru->nr_scans = LOCAL_NR_SCANS;
 	}
 
@@ -693,5 +826,5 @@ void bpf_lru_destroy(struct bpf_lru *lru)
 	if (lru->percpu)
 		free_percpu(lru->percpu_lru);
 	else
-		free_percpu(lru->common_lru.local_list);
+		bpf_common_lru_destroy(&lru->common_lru);
 }
@@ -35,6 +35,8 @@ struct bpf_lru_list {
 	unsigned int counts[NR_BPF_LRU_LIST_COUNT];
 	/* The next inacitve list rotation starts from here */
 	struct list_head *next_inactive_rotation;
+	/* Batched rotation: no rotation before this time (jiffies) */
+	unsigned long next_rotation;
 
 	raw_spinlock_t lock ____cacheline_aligned_in_smp;
 };
@@ -46,7 +48,8 @@ struct bpf_lru_locallist {
 };
 
 struct bpf_common_lru {
-	struct bpf_lru_list lru_list;
+	/* One LRU list per NUMA node, indexed by node id */
+	struct bpf_lru_list **node_lru;
 	struct bpf_lru_locallist __percpu *local_list;
 };
 
@@ -21,16 +21,32 @@ static const char * const func_id_str[] = {
 };
 #undef __BPF_FUNC_STR_FN
 
+#define __BPF_VENDOR_FUNC_STR_FN(x) \
+	[BPF_FUNC_ ## x - __BPF_FUNC_VENDOR_BASE] = __stringify(bpf_ ## x)
+static const char * const vendor_func_id_str[] = {
+	__BPF_VENDOR_FUNC_MAPPER(__BPF_VENDOR_FUNC_STR_FN)
+};
+#undef __BPF_VENDOR_FUNC_STR_FN
+
+static const char *__func_id_str(int id)
+{
+	if (id >= 0 && id < __BPF_FUNC_MAX_ID)
+		return func_id_str[id];
+	if (id >= __BPF_FUNC_VENDOR_BASE && id < __BPF_VENDOR_FUNC_MAX_ID)
+		return vendor_func_id_str[id - __BPF_FUNC_VENDOR_BASE];
+	return NULL;
+}
+
 static const char *__func_get_name(const struct bpf_insn_cbs *cbs,
 				   const struct bpf_insn *insn,
 				   char *buff, size_t len)
 {
 	BUILD_BUG_ON(ARRAY_SIZE(func_id_str) != __BPF_FUNC_MAX_ID);
+	BUILD_BUG_ON(ARRAY_SIZE(vendor_func_id_str) !=
+		     __BPF_VENDOR_FUNC_MAX_ID - __BPF_FUNC_VENDOR_BASE);
 
-	if (insn->src_reg != BPF_PSEUDO_CALL &&
-	    insn->imm >= 0 && insn->imm < __BPF_FUNC_MAX_ID &&
-	    func_id_str[insn->imm])
-		return func_id_str[insn->imm];
+	if (insn->src_reg != BPF_PSEUDO_CALL && __func_id_str(insn->imm))
+		return __func_id_str(insn->imm);
 
 	if (cbs && cbs->cb_call)
 		return cbs->cb_call(cbs->private_data, insn);
@@ -54,8 +70,8 @@ static const char *__func_imm_name(const struct bpf_insn_cbs *cbs,
 
 const char *func_id_name(int id)
 {
-	if (id >= 0 && id < __BPF_FUNC_MAX_ID && func_id_str[id])
-		return func_id_str[id];
+	if (__func_id_str(id))
+		return __func_id_str(id);
 	else
 		return "unknown";
 }
@@ -0,0 +1,483 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Resizable BPF hash map, backed by an rhashtable.
+ *
+ * The bucket array starts small and is grown (and shrunk) by the rhashtable
+ * worker as elements come and go, so max_entries only bounds the number of
+ * elements instead of fixing the table geometry at creation time.  Lookups
+ * are lock-free RCU walks; updates and deletes of the same key are
+ * serialized by a hashed lock, and the rhashtable bucket locks protect the
+ * chains themselves.
+ *
+ * Elements are preallocated into a per-cpu freelist unless
+ * BPF_F_NO_PREALLOC is given.  A removed element only goes back to the
+ * freelist after a grace period, because rhashtable readers cannot detect
+ * that the element they stand on moved to another chain.
+ *
+ * The rhashtable locks are taken with spin_lock_bh(), so the map can't be
+ * modified from hard interrupt context or with interrupts disabled; such
+ * updates fail with -EBUSY.  Lookups work from any context.
+ */
+#include <linux/bpf.h>
+#include <linux/btf.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/rhashtable.h>
+#include <linux/slab.h>
+#include <uapi/linux/btf.h>
+#include "percpu_freelist.h"
+
+#define RHTAB_CREATE_FLAG_MASK						\
+	(BPF_F_NO_PREALLOC | BPF_F_NUMA_NODE | BPF_F_RDONLY | BPF_F_WRONLY)
+
+struct bpf_rhtab {
+	struct bpf_map map;
+	struct rhashtable ht;
+	void *elems;
+	struct pcpu_freelist freelist;
+	spinlock_t *locks;	/* serialize updates of the same key */
+	unsigned int lock_mask;
+	atomic_t count;		/* number of elements in this hashtable */
+	u32 elem_size;		/* size of each element in bytes */
+	u32 hashrnd;
+};
+
+/* each rhtab element is struct rhtab_elem + key + value */
+struct rhtab_elem {
+	struct rhash_head node;
+	union {
+		struct pcpu_freelist_node fnode;
+		struct rcu_head rcu;
+	};
+	struct bpf_rhtab *rhtab;
+	char key[0] __aligned(8);
+};
+
+static bool rhtab_is_prealloc(const struct bpf_rhtab *rhtab)
+{
+	return !(rhtab->map.map_flags & BPF_F_NO_PREALLOC);
+}
+
+static inline void *rhtab_elem_value(struct rhtab_elem *l, u32 key_size)
+{
+	return l->key + round_up(key_size, 8);
+}
+
+static struct rhtab_elem *get_rhtab_elem(struct bpf_rhtab *rhtab, int i)
+{
+	return (struct rhtab_elem *) (rhtab->elems + i * rhtab->elem_size);
+}
+
+static int prealloc_init(struct bpf_rhtab *rhtab)
+{
+	/* Extra elements cover replacements in flight and elements that
+	 * wait for a grace period before going back to the freelist.
+	 */
+	u32 num_entries = rhtab->map.max_entries + num_possible_cpus();
+	int err, i;
+
+	rhtab->elems = bpf_map_area_alloc(rhtab->elem_size * num_entries,
+					  rhtab->map.numa_node);
+	if (!rhtab->elems)
+		return -ENOMEM;
+
+	err = pcpu_freelist_init(&rhtab->freelist);
+	if (err) {
+		bpf_map_area_free(rhtab->elems);
+		return err;
+	}
+
+	for (i = 0; i < num_entries; i++)
+		get_rhtab_elem(rhtab, i)->rhtab = rhtab;
+
+	pcpu_freelist_populate(&rhtab->freelist,
+			       rhtab->elems + offsetof(struct rhtab_elem, fnode),
+			       rhtab->elem_size, num_entries);
+	return 0;
+}
+
+static void prealloc_destroy(struct bpf_rhtab *rhtab)
+{
+	bpf_map_area_free(rhtab->elems);
+	pcpu_freelist_destroy(&rhtab->freelist);
+}
+
+/* Called from syscall */
+static int rhtab_map_alloc_check(union bpf_attr *attr)
+{
+	if (attr->map_flags & ~RHTAB_CREATE_FLAG_MASK)
+		/* reserved bits should not be used */
+		return -EINVAL;
+
+	if (attr->max_entries == 0 || attr->key_size == 0 ||
+	    attr->value_size == 0)
+		return -EINVAL;
+
+	if (attr->key_size > MAX_BPF_STACK)
+		/* eBPF programs initialize keys on stack, so they cannot be
+		 * larger than max stack size
+		 */
+		return -E2BIG;
+
+	if (attr->value_size >= KMALLOC_MAX_SIZE -
+	    MAX_BPF_STACK - sizeof(struct rhtab_elem))
+		/* keep elem_size kmalloc-able, as in htab */
+		return -E2BIG;
+
+	/* the rhashtable can't hold more than 2^31 elements */
+	if (attr->max_entries > 1UL << 31)
+		return -E2BIG;
+
+	return 0;
+}
+
+static struct bpf_map *rhtab_map_alloc(union bpf_attr *attr)
+{
+	struct rhashtable_params params = {
+		.key_offset = offsetof(struct rhtab_elem, key),
+		.head_offset = offsetof(struct rhtab_elem, node),
+		.key_len = attr->key_size,
+		.max_size = roundup_pow_of_two(attr->max_entries),
+		.automatic_shrinking = true,
+	};
+	struct bpf_rhtab *rhtab;
+	int err;
+	u64 cost;
+
+	rhtab = kzalloc(sizeof(*rhtab), GFP_USER);
+	if (!rhtab)
+		return ERR_PTR(-ENOMEM);
+
+	bpf_map_init_from_attr(&rhtab->map, attr);
+
+	rhtab->elem_size = sizeof(struct rhtab_elem) +
+			   round_up(rhtab->map.key_size, 8) +
+			   round_up(rhtab->map.value_size, 8);
+
+	/* charge for the largest bucket array the table may grow to */
+	cost = (u64) params.max_size * sizeof(struct rhash_head *) +
+	       (u64) rhtab->elem_size *
+	       (rhtab->map.max_entries + num_possible_cpus());
+
+	err = -E2BIG;
+	if (cost >= U32_MAX - PAGE_SIZE)
+		/* make sure page count doesn't overflow */
+		goto free_rhtab;
+
+	rhtab->map.pages = round_up(cost, PAGE_SIZE) >> PAGE_SHIFT;
+
+	/* if map size is larger than memlock limit, reject it early */
+	err = bpf_map_precharge_memlock(rhtab->map.pages);
+	if (err)
+		goto free_rhtab;
+
+	err = alloc_bucket_spinlocks(&rhtab->locks, &rhtab->lock_mask,
+				     params.max_size, 4, GFP_USER);
+	if (err)
+		goto free_rhtab;
+
+	err = rhashtable_init(&rhtab->ht, &params);
+	if (err)
+		goto free_locks;
+
+	if (rhtab_is_prealloc(rhtab)) {
+		err = prealloc_init(rhtab);
+		if (err)
+			goto free_ht;
+	}
+
+	rhtab->hashrnd = get_random_int();
+	return &rhtab->map;
+
+free_ht:
+	rhashtable_destroy(&rhtab->ht);
+free_locks:
+	free_bucket_spinlocks(rhtab->locks);
+free_rhtab:
+	kfree(rhtab);
+	return ERR_PTR(err);
+}
+
+static inline spinlock_t *rhtab_key_lock(struct bpf_rhtab *rhtab, void *key)
+{
+	u32 hash = jhash(key, rhtab->map.key_size, rhtab->hashrnd);
+
+	return &rhtab->locks[hash & rhtab->lock_mask];
+}
+
+static struct rhtab_elem *__rhtab_map_lookup_elem(struct bpf_rhtab *rhtab,
+						  void *key)
+{
+	return rhashtable_lookup(&rhtab->ht, key, rhtab->ht.p);
+}
+
+/* Called from syscall or from eBPF program */
+static void *rhtab_map_lookup_elem(struct bpf_map *map, void *key)
+{
+	struct bpf_rhtab *rhtab = container_of(map, struct bpf_rhtab, map);
+	struct rhtab_elem *l;
+
+	/* Must be called with rcu_read_lock. */
+	WARN_ON_ONCE(!rcu_read_lock_held());
+
+	l = __rhtab_map_lookup_elem(rhtab, key);
+	if (l)
+		return rhtab_elem_value(l, map->key_size);
+
+	return NULL;
+}
+
+/* Called from syscall */
+static int rhtab_map_get_next_key(struct bpf_map *map, void *key,
+				  void *next_key)
+{
+	struct bpf_rhtab *rhtab = container_of(map, struct bpf_rhtab, map);
+	struct rhashtable *ht = &rhtab->ht;
+	struct bucket_table *tbl;
+	struct rhash_head *he;
+	struct rhtab_elem *l;
+	unsigned int i = 0;
+
+	WARN_ON_ONCE(!rcu_read_lock_held());
+
+	/* The walk follows the current bucket array.  If the table is
+	 * resized meanwhile, elements may be skipped or returned twice,
+	 * just like when racing with updates in htab.
+	 */
+	tbl = rht_dereference_rcu(ht->tbl, ht);
+
+	if (!key)
+		goto find_first_elem;
+
+	l = __rhtab_map_lookup_elem(rhtab, key);
+	if (!l)
+		goto find_first_elem;
+
+	/* key was found, get next key in the same bucket */
+	he = rht_dereference_rcu(l->node.next, ht);
+	if (!rht_is_a_nulls(he))
+		goto found;
+
+	/* no more elements in this chain, go to the next bucket */
+	i = rht_head_hashfn(ht, tbl, &l->node, ht->p) + 1;
+
+find_first_elem:
+	for (; i < tbl->size; i++) {
+		rht_for_each_rcu(he, tbl, i)
+			goto found;
+	}
+
+	/* iterated over all buckets and all elements */
+	return -ENOENT;
+
+found:
+	l = container_of(he, struct rhtab_elem, node);
+	memcpy(next_key, l->key, map->key_size);
+	return 0;
+}
+
+static void rhtab_elem_free_rcu(struct rcu_head *head)
+{
+	struct rhtab_elem *l = container_of(head, struct rhtab_elem, rcu);
+	struct bpf_rhtab *rhtab = l->rhtab;
+
+	if (rhtab_is_prealloc(rhtab))
+		pcpu_freelist_push(&rhtab->freelist, &l->fnode);
+	else
+		kfree(l);
+}
+
+/* Give back an element that was never inserted */
+static void rhtab_elem_put(struct bpf_rhtab *rhtab, struct rhtab_elem *l)
+{
+	if (rhtab_is_prealloc(rhtab))
+		pcpu_freelist_push(&rhtab->freelist, &l->fnode);
+	else
+		kfree(l);
+}
+
+static struct rhtab_elem *alloc_rhtab_elem(struct bpf_rhtab *rhtab, void *key,
+					   void *value)
+{
+	u32 key_size = rhtab->map.key_size;
+	struct pcpu_freelist_node *n;
+	struct rhtab_elem *l_new;
+
+	if (rhtab_is_prealloc(rhtab)) {
+		n = pcpu_freelist_pop(&rhtab->freelist);
+		if (!n)
+			return ERR_PTR(-E2BIG);
+		l_new = container_of(n, struct rhtab_elem, fnode);
+	} else {
+		l_new = kmalloc_node(rhtab->elem_size,
+				     GFP_ATOMIC | __GFP_NOWARN,
+				     rhtab->map.numa_node);
+		if (!l_new)
+			return ERR_PTR(-ENOMEM);
+		l_new->rhtab = rhtab;
+	}
+
+	memcpy(l_new->key, key, key_size);
+	memcpy(rhtab_elem_value(l_new, key_size), value, rhtab->map.value_size);
+	return l_new;
+}
+
+/* Called from syscall or from eBPF program */
+static int rhtab_map_update_elem(struct bpf_map *map, void *key, void *value,
+				 u64 map_flags)
+{
+	struct bpf_rhtab *rhtab = container_of(map, struct bpf_rhtab, map);
+	struct rhtab_elem *l_new, *l_old;
+	spinlock_t *lock;
+	int ret;
+
+	if (unlikely(map_flags > BPF_EXIST))
+		/* unknown flags */
+		return -EINVAL;
+
+	if (unlikely(in_irq() || irqs_disabled()))
+		return -EBUSY;
+
+	WARN_ON_ONCE(!rcu_read_lock_held());
+
+	lock = rhtab_key_lock(rhtab, key);
+	spin_lock_bh(lock);
+
+	l_old = __rhtab_map_lookup_elem(rhtab, key);
+
+	ret = -EEXIST;
+	if (l_old && map_flags == BPF_NOEXIST)
+		goto err;
+
+	ret = -ENOENT;
+	if (!l_old && map_flags == BPF_EXIST)
+		goto err;
+
+	if (!l_old &&
+	    atomic_inc_return(&rhtab->count) > map->max_entries) {
+		atomic_dec(&rhtab->count);
+		ret = -E2BIG;
+		goto err;
+	}
+
+	l_new = alloc_rhtab_elem(rhtab, key, value);
+	if (IS_ERR(l_new)) {
+		ret = PTR_ERR(l_new);
+		goto dec_count;
+	}
+
+	/* The new element is linked after the old one, so a concurrent
+	 * lookup finds one of them at any time, and finds the new one
+	 * once the old one is unlinked.
+	 */
+	ret = rhashtable_insert_fast(&rhtab->ht, &l_new->node, rhtab->ht.p);
+	if (ret) {
+		rhtab_elem_put(rhtab, l_new);
+		goto dec_count;
+	}
+
+	if (l_old) {
+		rhashtable_remove_fast(&rhtab->ht, &l_old->node, rhtab->ht.p);
+		call_rcu(&l_old->rcu, rhtab_elem_free_rcu);
+	}
+	spin_unlock_bh(lock);
+	return 0;
+
+dec_count:
+	if (!l_old)
+		atomic_dec(&rhtab->count);
+err:
+	spin_unlock_bh(lock);
+	return ret;
+}
+
+/* Called from syscall or from eBPF program */
+static int rhtab_map_delete_elem(struct bpf_map *map, void *key)
+{
+	struct bpf_rhtab *rhtab = container_of(map, struct bpf_rhtab, map);
+	struct rhtab_elem *l;
+	spinlock_t *lock;
+	int ret = -ENOENT;
+
+	if (unlikely(in_irq() || irqs_disabled()))
+		return -EBUSY;
+
+	WARN_ON_ONCE(!rcu_read_lock_held());
+
+	lock = rhtab_key_lock(rhtab, key);
+	spin_lock_bh(lock);
+
+	l = __rhtab_map_lookup_elem(rhtab, key);
+	if (l && !rhashtable_remove_fast(&rhtab->ht, &l->node, rhtab->ht.p)) {
+		atomic_dec(&rhtab->count);
+		call_rcu(&l->rcu, rhtab_elem_free_rcu);
+		ret = 0;
+	}
+
+	spin_unlock_bh(lock);
+	return ret;
+}
+
+static void rhtab_free_elem(void *ptr, void *arg)
+{
+	kfree(ptr);
+}
+
+/* Called when map->refcnt goes to zero, either from workqueue or from syscall */
+static void rhtab_map_free(struct bpf_map *map)
+{
+	struct bpf_rhtab *rhtab = container_of(map, struct bpf_rhtab, map);
+
+	/* at this point bpf_prog->aux->refcnt == 0 and this map->refcnt == 0,
+	 * so the programs (can be more than one that used this map) were
+	 * disconnected from events. Wait for outstanding critical sections in
+	 * these programs to complete
+	 */
+	synchronize_rcu();
+
+	/* some of rhtab_elem_free_rcu() callbacks for elements of this map
+	 * may not have executed. Wait for them.
+	 */
+	rcu_barrier();
+	if (rhtab_is_prealloc(rhtab)) {
+		rhashtable_destroy(&rhtab->ht);
+		prealloc_destroy(rhtab);
+	} else {
+		rhashtable_free_and_destroy(&rhtab->ht, rhtab_free_elem, NULL);
+	}
+
+	free_bucket_spinlocks(rhtab->locks);
+	kfree(rhtab);
+}
+
+static void rhtab_map_seq_show_elem(struct bpf_map *map, void *key,
+				    struct seq_file *m)
+{
+	void *value;
+
+	rcu_read_lock();
+
+	value = rhtab_map_lookup_elem(map, key);
+	if (!value) {
+		rcu_read_unlock();
+		return;
+	}
+
+	btf_type_seq_show(map->btf, map->btf_key_type_id, key, m);
+	seq_puts(m, ": ");
+	btf_type_seq_show(map->btf, map->btf_value_type_id, value, m);
+	seq_puts(m, "\n");
+
+	rcu_read_unlock();
+}
+
+const struct bpf_map_ops rhtab_map_ops = {
+	.map_alloc_check = rhtab_map_alloc_check,
+	.map_alloc = rhtab_map_alloc,
+	.map_free = rhtab_map_free,
+	.map_get_next_key = rhtab_map_get_next_key,
+	.map_lookup_elem = rhtab_map_lookup_elem,
+	.map_update_elem = rhtab_map_update_elem,
+	.map_delete_elem = rhtab_map_delete_elem,
+	.map_seq_show_elem = rhtab_map_seq_show_elem,
+};
@@ -685,6 +685,34 @@ static unsigned int smap_do_tx_msg(struct sock *sk,
 	return _rc;
 }
 
+/* Redirecting to ingress only queues a message on the peer psock, so when
+ * no task owns the peer socket the spinlock is enough, the same way the
+ * TCP receive softirq queues data. This keeps proxies that redirect every
+ * message from paying a full lock_sock()/release_sock() per send.
+ */
+static bool bpf_tcp_ingress_lock(struct sock *sk)
+{
+	local_bh_disable();
+	bh_lock_sock(sk);
+	if (!sock_owned_by_user(sk))
+		return true;
+	bh_unlock_sock(sk);
+	local_bh_enable();
+
+	lock_sock(sk);
+	return false;
+}
+
+static void bpf_tcp_ingress_unlock(struct sock *sk, bool fast)
+{
+	if (fast) {
+		bh_unlock_sock(sk);
+		local_bh_enable();
+	} else {
+		release_sock(sk);
+	}
+}
+
 static int bpf_tcp_ingress(struct sock *sk, int apply_bytes,
 			   struct smap_psock *psock,
 			   struct sk_msg_buff *md, int flags)
@@ -693,12 +721,13 @@ static int bpf_tcp_ingress(struct sock *sk, int apply_bytes,
 	size_t size, copied = 0;
 	struct sk_msg_buff *r;
 	int err = 0, i;
+	bool fast;
 
 	r = kzalloc(sizeof(struct sk_msg_buff), __GFP_NOWARN | GFP_KERNEL);
 	if (unlikely(!r))
 		return -ENOMEM;
 
-	lock_sock(sk);
+	fast = bpf_tcp_ingress_lock(sk);
 	r->sg_start = md->sg_start;
 	i = md->sg_start;
 
@@ -746,7 +775,7 @@ static int bpf_tcp_ingress(struct sock *sk, int apply_bytes,
 		kfree(r);
 	}
 
-	release_sock(sk);
+	bpf_tcp_ingress_unlock(sk, fast);
 	return err;
 }
 
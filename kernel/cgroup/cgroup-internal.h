@@ -47,6 +47,10 @@ struct cgroup_file_ctx {
 	struct {
 		struct cgroup_pidlist	*pidlist;
 	} procs1;
+
+	struct {
+		void			*trigger;
+	} psi;
 };
 
 /*
@@ -349,6 +349,7 @@ struct vm_area_struct *vm_area_dup(struct vm_area_struct *orig)
 	if (new) {
 		*new = *orig;
 		INIT_LIST_HEAD(&new->anon_vma_chain);
+		vma_init_sequence(new);
 	}
 	return new;
 }
@@ -687,6 +688,9 @@ void __mmdrop(struct mm_struct *mm)
 	mmu_notifier_mm_destroy(mm);
 	check_mm(mm);
 	put_user_ns(mm->user_ns);
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	free_percpu(mm->spf_stat);
+#endif
 	free_mm(mm);
 }
 EXPORT_SYMBOL_GPL(__mmdrop);
@@ -1020,6 +1024,12 @@ static struct mm_struct *mm_init(struct mm_struct *mm, struct task_struct *p,
 	mm->mmap = NULL;
 	mm->mm_rb = RB_ROOT;
 	mm->vmacache_seqnum = 0;
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	rwlock_init(&mm->mm_rb_lock);
+	mm->spf_stat = alloc_percpu(struct mm_spf_stat);
+	if (!mm->spf_stat)
+		goto fail_nospf;
+#endif
 	atomic_set(&mm->mm_users, 1);
 	atomic_set(&mm->mm_count, 1);
 	init_rwsem(&mm->mmap_sem);
@@ -1045,6 +1055,14 @@ static struct mm_struct *mm_init(struct mm_struct *mm, struct task_struct *p,
 #endif
 	mm_init_uprobes_state(mm);
 	hugetlb_count_init(mm);
+#if defined(CONFIG_FUTEX) && defined(CONFIG_NUMA)
+	mm->futex_node = NUMA_NO_NODE;
+#endif
+#ifdef CONFIG_KSM
+	mm->ksm_rmap_items = 0;
+	mm->ksm_merging_pages = 0;
+	atomic_long_set(&mm->ksm_zero_pages, 0);
+#endif
 
 	if (current->mm) {
 		mm->flags = current->mm->flags & MMF_INIT_MASK;
@@ -1063,12 +1081,17 @@ static struct mm_struct *mm_init(struct mm_struct *mm, struct task_struct *p,
 	mm->user_ns = get_user_ns(user_ns);
 
 	sp_init_mm(mm);
+	lru_gen_init_mm(mm);
 
 	return mm;
 
 fail_nocontext:
 	mm_free_pgd(mm);
 fail_nopgd:
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	free_percpu(mm->spf_stat);
+fail_nospf:
+#endif
 	free_mm(mm);
 	return NULL;
 }
@@ -1096,6 +1119,7 @@ static inline void __mmput(struct mm_struct *mm)
 	exit_aio(mm);
 	ksm_exit(mm);
 	khugepaged_exit(mm); /* must run before exit_mmap */
+	lru_gen_del_mm(mm);
 	exit_mmap(mm);
 
 	sp_group_post_exit(mm);
@@ -2370,6 +2394,13 @@ long _do_fork(unsigned long clone_flags,
 		get_task_struct(p);
 	}
 
+	if (!(clone_flags & CLONE_VM) && p->mm) {
+		/* lock the task to synchronize with memcg migration */
+		task_lock(p);
+		lru_gen_add_mm(p->mm);
+		task_unlock(p);
+	}
+
 	wake_up_new_task(p);
 
 	/* forking complete and child started to run, tell ptracer */
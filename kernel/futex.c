@@ -66,7 +66,6 @@
 #include <linux/sched/mm.h>
 #include <linux/hugetlb.h>
 #include <linux/freezer.h>
-#include <linux/bootmem.h>
 #include <linux/fault-inject.h>
 
 #include <asm/futex.h>
@@ -269,12 +268,13 @@ struct futex_hash_bucket {
 } ____cacheline_aligned_in_smp;
 
 /*
- * The base of the bucket array and its size are always used together
- * (after initialization only in hash_futex()), so ensure that they
- * reside in the same cacheline.
+ * There is one bucket array per NUMA node, each allocated on its node.
+ * The base of the per-node arrays and their size are always used
+ * together (after initialization only in hash_futex()), so ensure that
+ * they reside in the same cacheline.
  */
 static struct {
-	struct futex_hash_bucket *queues;
+	struct futex_hash_bucket **queues;
 	unsigned long            hashsize;
 } __futex_data __read_mostly __aligned(2*sizeof(long));
 #define futex_queues   (__futex_data.queues)
@@ -392,19 +392,53 @@ static inline int hb_waiters_pending(struct futex_hash_bucket *hb)
 #endif
 }
 
+/*
+ * Pick the node whose bucket array serves @key. Futexes keyed by an mm
+ * (private ones, and shared ones in private anonymous memory) stay on
+ * the node the mm first used a futex on, so a process that is kept on
+ * one node only touches local buckets. The node is recorded once and
+ * never changes, which keeps waiters and wakers on the same array.
+ * Futexes keyed by an inode can be used from anywhere and are spread
+ * over all nodes.
+ */
+static int futex_key_node(union futex_key *key, u32 hash)
+{
+#ifdef CONFIG_NUMA
+	struct mm_struct *mm;
+	int node;
+
+	if (nr_node_ids == 1)
+		return 0;
+
+	if (key->both.offset & FUT_OFF_INODE)
+		return reciprocal_scale(hash, nr_node_ids);
+
+	mm = key->private.mm;
+	node = READ_ONCE(mm->futex_node);
+	if (unlikely(node == NUMA_NO_NODE)) {
+		cmpxchg(&mm->futex_node, NUMA_NO_NODE, numa_node_id());
+		node = READ_ONCE(mm->futex_node);
+	}
+	return node;
+#else
+	return 0;
+#endif
+}
+
 /**
  * hash_futex - Return the hash bucket in the global hash
  * @key:	Pointer to the futex key for which the hash is calculated
  *
  * We hash on the keys returned from get_futex_key (see below) and return the
- * corresponding hash bucket in the global hash.
+ * corresponding hash bucket in the bucket array of the key's node.
  */
 static struct futex_hash_bucket *hash_futex(union futex_key *key)
 {
 	u32 hash = jhash2((u32 *)key, offsetof(typeof(*key), both.offset) / 4,
 			  key->both.offset);
 
-	return &futex_queues[hash & (futex_hashsize - 1)];
+	return &futex_queues[futex_key_node(key, hash)]
+			    [hash & (futex_hashsize - 1)];
 }
 
 
@@ -2879,6 +2913,300 @@ static int futex_wait(u32 __user *uaddr, unsigned int flags, u32 val,
 }
 
 
+/* Flags accepted in struct futex_waitv */
+#define FUTEXV_WAITER_MASK (FUTEX_32 | FUTEX_PRIVATE_FLAG)
+
+/**
+ * struct futex_vector - Auxiliary struct for futex_waitv()
+ * @w: Userspace provided data
+ * @q: Kernel side data
+ */
+struct futex_vector {
+	struct futex_waitv w;
+	struct futex_q q;
+};
+
+/**
+ * unqueue_multiple - Remove various futexes from their hash bucket
+ * @v:	   The list of futexes to unqueue
+ * @count: Number of futexes in the list
+ *
+ * Helper to unqueue a list of futexes. This can't fail. Drops the key
+ * references taken when the futexes were queued.
+ *
+ * Return:
+ *  - >=0 - Index of the last futex that was awoken;
+ *  - -1  - No futex was awoken
+ */
+static int unqueue_multiple(struct futex_vector *v, int count)
+{
+	int ret = -1, i;
+
+	for (i = 0; i < count; i++) {
+		if (!unqueue_me(&v[i].q))
+			ret = i;
+	}
+
+	return ret;
+}
+
+/**
+ * futex_wait_multiple_setup - Prepare to wait and enqueue multiple futexes
+ * @vs:		The futex list to wait on
+ * @count:	The size of the list
+ * @woken:	Index of the last woken futex, if any. Used to notify the
+ *		caller that it can return this index to userspace (return
+ *		parameter)
+ *
+ * Prepare multiple futexes in a single step and enqueue them. This may
+ * fail if the futex list is invalid or if any futex was already awoken.
+ * On success the task is ready to interruptible sleep.
+ *
+ * Return:
+ *  -  1 - One of the futexes was woken by another thread
+ *  -  0 - Success
+ *  - <0 - -EFAULT, -EWOULDBLOCK or -EINVAL
+ */
+static int futex_wait_multiple_setup(struct futex_vector *vs, int count,
+				     int *woken)
+{
+	struct futex_hash_bucket *hb;
+	int ret, i, j;
+	u32 uval;
+
+retry:
+	for (i = 0; i < count; i++) {
+		vs[i].q = futex_q_init;
+		ret = get_futex_key(u64_to_user_ptr(vs[i].w.uaddr),
+				    !(vs[i].w.flags & FUTEX_PRIVATE_FLAG),
+				    &vs[i].q.key, FUTEX_READ);
+		if (unlikely(ret)) {
+			while (--i >= 0)
+				put_futex_key(&vs[i].q.key);
+			return ret;
+		}
+	}
+
+	set_current_state(TASK_INTERRUPTIBLE);
+
+	for (i = 0; i < count; i++) {
+		u32 __user *uaddr = u64_to_user_ptr(vs[i].w.uaddr);
+		struct futex_q *q = &vs[i].q;
+		u64 val = vs[i].w.val;
+
+		hb = queue_lock(q);
+		ret = get_futex_value_locked(&uval, uaddr);
+
+		if (!ret && uval == val) {
+			/*
+			 * The bucket lock can't be held while dealing with
+			 * the next futex. Queue each futex at this moment
+			 * to hold a wakeup. The key reference is dropped
+			 * by unqueue_me().
+			 */
+			queue_me(q, hb);
+			continue;
+		}
+
+		queue_unlock(hb);
+		__set_current_state(TASK_RUNNING);
+
+		/*
+		 * Even if something went wrong, if we find out that a
+		 * futex was woken, we don't return error and return this
+		 * index to userspace.
+		 */
+		*woken = unqueue_multiple(vs, i);
+		for (j = i; j < count; j++)
+			put_futex_key(&vs[j].q.key);
+		if (*woken >= 0)
+			return 1;
+
+		if (ret) {
+			/*
+			 * If we need to handle a page fault, we need to do
+			 * so without any lock and any enqueued futex
+			 * (otherwise we could lose some wakeup). So we do
+			 * it here, after undoing all the work done so far.
+			 * In success, we retry all the work.
+			 */
+			if (get_user(uval, uaddr))
+				return -EFAULT;
+
+			goto retry;
+		}
+
+		return -EWOULDBLOCK;
+	}
+
+	return 0;
+}
+
+/**
+ * futex_wait_multiple - Prepare to wait on and enqueue several futexes
+ * @vs:		The list of futexes to wait on
+ * @count:	The number of objects
+ * @to:		Timeout before giving up and returning to userspace
+ *
+ * Entry point for futex_waitv(), this function sleeps on a group of
+ * futexes and returns on the first futex that is woken, or after the
+ * timeout has elapsed.
+ *
+ * Return:
+ *  - >=0 - Hint to the futex that was awoken
+ *  - <0  - On error
+ */
+static int futex_wait_multiple(struct futex_vector *vs, unsigned int count,
+			       struct hrtimer_sleeper *to)
+{
+	int ret, hint = 0;
+	unsigned int i;
+
+	while (1) {
+		ret = futex_wait_multiple_setup(vs, count, &hint);
+		if (ret) {
+			if (ret > 0) {
+				/* A futex was woken during setup */
+				ret = hint;
+			}
+			return ret;
+		}
+
+		/*
+		 * If one of the futexes was woken, or the timer already
+		 * expired, current is already running again.
+		 */
+		for (i = 0; i < count; i++) {
+			if (!READ_ONCE(vs[i].q.lock_ptr))
+				break;
+		}
+		if (i == count && (!to || to->task))
+			freezable_schedule();
+		__set_current_state(TASK_RUNNING);
+
+		ret = unqueue_multiple(vs, count);
+		if (ret >= 0)
+			return ret;
+
+		if (to && !to->task)
+			return -ETIMEDOUT;
+		else if (signal_pending(current))
+			return -ERESTARTSYS;
+		/*
+		 * The final case is a spurious wakeup, for which just retry
+		 * again.
+		 */
+	}
+}
+
+/**
+ * futex_parse_waitv - Parse a waitv array from userspace
+ * @futexv:	Kernel side list of waiters to be filled
+ * @uwaitv:	Userspace list to be parsed
+ * @nr_futexes: Length of futexv
+ *
+ * Return: Error code on failure, 0 on success
+ */
+static int futex_parse_waitv(struct futex_vector *futexv,
+			     struct futex_waitv __user *uwaitv,
+			     unsigned int nr_futexes)
+{
+	struct futex_waitv aux;
+	unsigned int i;
+
+	for (i = 0; i < nr_futexes; i++) {
+		if (copy_from_user(&aux, &uwaitv[i], sizeof(aux)))
+			return -EFAULT;
+
+		if ((aux.flags & ~FUTEXV_WAITER_MASK) || aux.__reserved)
+			return -EINVAL;
+
+		if (!(aux.flags & FUTEX_32))
+			return -EINVAL;
+
+		futexv[i].w = aux;
+	}
+
+	return 0;
+}
+
+/**
+ * sys_futex_waitv - Wait on a list of futexes
+ * @waiters:    List of futexes to wait on
+ * @nr_futexes: Length of futexv
+ * @flags:      Flag for timeout (monotonic/realtime)
+ * @timeout:	Optional absolute timeout.
+ * @clockid:	Clock to be used for the timeout, realtime or monotonic.
+ *
+ * Given an array of `struct futex_waitv`, wait on each uaddr. The thread
+ * wakes if a futex_wake() is performed at any uaddr. The syscall returns
+ * immediately if any waiter has *uaddr != val. *timeout is an optional
+ * absolute timeout value for the operation. Each waiter has individual
+ * flags. The `flags` argument for the syscall should be used solely for
+ * specifying the timeout clock and is 0 for now.
+ *
+ * Returns the array index of one of the woken futexes. No further
+ * information is provided: any number of other futexes may also have
+ * been woken by the same event, and if more than one futex was woken,
+ * the returned index may refer to any one of them. (It is not necessarily
+ * the futex with the smallest index, nor the one most recently woken,
+ * nor...)
+ */
+SYSCALL_DEFINE5(futex_waitv, struct futex_waitv __user *, waiters,
+		unsigned int, nr_futexes, unsigned int, flags,
+		struct __kernel_timespec __user *, timeout, clockid_t, clockid)
+{
+	struct hrtimer_sleeper to;
+	struct futex_vector *futexv;
+	struct timespec64 ts;
+	int ret;
+
+	/* This syscall supports no flags for now */
+	if (flags)
+		return -EINVAL;
+
+	if (!nr_futexes || nr_futexes > FUTEX_WAITV_MAX || !waiters)
+		return -EINVAL;
+
+	if (timeout) {
+		if (clockid != CLOCK_REALTIME && clockid != CLOCK_MONOTONIC)
+			return -EINVAL;
+
+		if (get_timespec64(&ts, timeout))
+			return -EFAULT;
+
+		if (!timespec64_valid(&ts))
+			return -EINVAL;
+	}
+
+	futexv = kcalloc(nr_futexes, sizeof(*futexv), GFP_KERNEL);
+	if (!futexv)
+		return -ENOMEM;
+
+	ret = futex_parse_waitv(futexv, waiters, nr_futexes);
+	if (ret)
+		goto out;
+
+	if (timeout) {
+		hrtimer_init_on_stack(&to.timer, clockid, HRTIMER_MODE_ABS);
+		hrtimer_init_sleeper(&to, current);
+		hrtimer_set_expires_range_ns(&to.timer, timespec64_to_ktime(ts),
+					     current->timer_slack_ns);
+		hrtimer_start_expires(&to.timer, HRTIMER_MODE_ABS);
+	}
+
+	ret = futex_wait_multiple(futexv, nr_futexes, timeout ? &to : NULL);
+
+	if (timeout) {
+		hrtimer_cancel(&to.timer);
+		destroy_hrtimer_on_stack(&to.timer);
+	}
+
+out:
+	kfree(futexv);
+	return ret;
+}
+
 static long futex_wait_restart(struct restart_block *restart)
 {
 	u32 __user *uaddr = restart->futex.uaddr;
@@ -4164,29 +4492,39 @@ static void __init futex_detect_cmpxchg(void)
 
 static int __init futex_init(void)
 {
-	unsigned int futex_shift;
 	unsigned long i;
+	int node, nid;
 
 #if CONFIG_BASE_SMALL
 	futex_hashsize = 16;
 #else
-	futex_hashsize = roundup_pow_of_two(256 * num_possible_cpus());
+	futex_hashsize = roundup_pow_of_two(256 *
+			DIV_ROUND_UP(num_possible_cpus(), nr_node_ids));
 #endif
 
-	futex_queues = alloc_large_system_hash("futex", sizeof(*futex_queues),
-					       futex_hashsize, 0,
-					       futex_hashsize < 256 ? HASH_SMALL : 0,
-					       &futex_shift, NULL,
-					       futex_hashsize, futex_hashsize);
-	futex_hashsize = 1UL << futex_shift;
+	futex_queues = kcalloc(nr_node_ids, sizeof(*futex_queues), GFP_KERNEL);
+	if (!futex_queues)
+		panic("Failed to allocate futex hash table\n");
+
+	for (node = 0; node < nr_node_ids; node++) {
+		nid = node_state(node, N_MEMORY) ? node : NUMA_NO_NODE;
+		futex_queues[node] = kvmalloc_node(futex_hashsize *
+						   sizeof(**futex_queues),
+						   GFP_KERNEL, nid);
+		if (!futex_queues[node])
+			panic("Failed to allocate futex hash table\n");
+
+		for (i = 0; i < futex_hashsize; i++) {
+			atomic_set(&futex_queues[node][i].waiters, 0);
+			plist_head_init(&futex_queues[node][i].chain);
+			spin_lock_init(&futex_queues[node][i].lock);
+		}
+	}
 
-	futex_detect_cmpxchg();
+	pr_info("futex hash table entries: %lu per node, %u nodes\n",
+		futex_hashsize, nr_node_ids);
 
-	for (i = 0; i < futex_hashsize; i++) {
-		atomic_set(&futex_queues[i].waiters, 0);
-		plist_head_init(&futex_queues[i].chain);
-		spin_lock_init(&futex_queues[i].lock);
-	}
+	futex_detect_cmpxchg();
 
 	return 0;
 }
@@ -1173,6 +1173,112 @@ void kprobes_inc_nmissed_count(struct kprobe *p)
 }
 NOKPROBE_SYMBOL(kprobes_inc_nmissed_count);
 
+/*
+ * Free instances of a kretprobe live on rp->free_instances, fronted by
+ * small per-cpu caches so that a return probe hit on many CPUs at once
+ * doesn't serialize every entry and return on rp->lock.  A cache is
+ * refilled from and spills to the shared list in batches.  Caches are
+ * only used when maxactive leaves enough instances for every CPU to
+ * cache a batch and still have half of them shared.
+ */
+struct kretprobe_cache {
+	struct hlist_head head;
+	int count;
+};
+
+#define KRETPROBE_CACHE_BATCH	8
+
+static int kretprobe_cache_batch(struct kretprobe *rp)
+{
+	return min_t(int, KRETPROBE_CACHE_BATCH,
+		     rp->maxactive / (4 * num_possible_cpus()));
+}
+
+static struct kretprobe_instance *kretprobe_get_inst(struct kretprobe *rp)
+{
+	struct kretprobe_instance *ri = NULL;
+	struct kretprobe_cache *cache;
+	struct hlist_head *head;
+	unsigned long flags;
+	int i;
+
+	local_irq_save(flags);
+	if (!rp->cache) {
+		head = &rp->free_instances;
+		raw_spin_lock(&rp->lock);
+		goto pop;
+	}
+
+	cache = this_cpu_ptr(rp->cache);
+	head = &cache->head;
+	if (hlist_empty(head)) {
+		raw_spin_lock(&rp->lock);
+		for (i = kretprobe_cache_batch(rp); i > 0; i--) {
+			if (hlist_empty(&rp->free_instances))
+				break;
+			ri = hlist_entry(rp->free_instances.first,
+					 struct kretprobe_instance, hlist);
+			hlist_del(&ri->hlist);
+			hlist_add_head(&ri->hlist, head);
+			cache->count++;
+		}
+		raw_spin_unlock(&rp->lock);
+	}
+
+	ri = NULL;
+	if (!hlist_empty(head)) {
+		ri = hlist_entry(head->first, struct kretprobe_instance, hlist);
+		hlist_del(&ri->hlist);
+		cache->count--;
+	}
+	local_irq_restore(flags);
+	return ri;
+
+pop:
+	if (!hlist_empty(head)) {
+		ri = hlist_entry(head->first, struct kretprobe_instance, hlist);
+		hlist_del(&ri->hlist);
+	}
+	raw_spin_unlock(&rp->lock);
+	local_irq_restore(flags);
+	return ri;
+}
+NOKPROBE_SYMBOL(kretprobe_get_inst);
+
+static void kretprobe_put_inst(struct kretprobe *rp,
+			       struct kretprobe_instance *ri)
+{
+	struct kretprobe_cache *cache;
+	unsigned long flags;
+	int batch, i;
+
+	local_irq_save(flags);
+	if (!rp->cache) {
+		raw_spin_lock(&rp->lock);
+		hlist_add_head(&ri->hlist, &rp->free_instances);
+		raw_spin_unlock(&rp->lock);
+		local_irq_restore(flags);
+		return;
+	}
+
+	cache = this_cpu_ptr(rp->cache);
+	hlist_add_head(&ri->hlist, &cache->head);
+	batch = kretprobe_cache_batch(rp);
+	if (++cache->count > 2 * batch) {
+		raw_spin_lock(&rp->lock);
+		for (i = 0; i < batch; i++) {
+			ri = hlist_entry(cache->head.first,
+					 struct kretprobe_instance, hlist);
+			hlist_del(&ri->hlist);
+			hlist_add_head(&ri->hlist, &rp->free_instances);
+			cache->count--;
+		}
+		raw_spin_unlock(&rp->lock);
+	}
+	local_irq_restore(flags);
+}
+NOKPROBE_SYMBOL(kretprobe_put_inst);
+
 void recycle_rp_inst(struct kretprobe_instance *ri,
 		     struct hlist_head *head)
 {
@@ -1182,9 +1288,7 @@ void recycle_rp_inst(struct kretprobe_instance *ri,
 	hlist_del(&ri->hlist);
 	INIT_HLIST_NODE(&ri->hlist);
 	if (likely(rp)) {
-		raw_spin_lock(&rp->lock);
-		hlist_add_head(&ri->hlist, &rp->free_instances);
-		raw_spin_unlock(&rp->lock);
+		kretprobe_put_inst(rp, ri);
 	} else
 		/* Unregistering */
 		hlist_add_head(&ri->hlist, head);
@@ -1295,11 +1399,26 @@ static inline void free_rp_inst(struct kretprobe *rp)
 {
 	struct kretprobe_instance *ri;
 	struct hlist_node *next;
+	int cpu;
 
 	hlist_for_each_entry_safe(ri, next, &rp->free_instances, hlist) {
 		hlist_del(&ri->hlist);
 		kfree(ri);
 	}
+
+	if (!rp->cache)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct kretprobe_cache *cache = per_cpu_ptr(rp->cache, cpu);
+
+		hlist_for_each_entry_safe(ri, next, &cache->head, hlist) {
+			hlist_del(&ri->hlist);
+			kfree(ri);
+		}
+	}
+	free_percpu(rp->cache);
+	rp->cache = NULL;
 }
 
 static void cleanup_rp_inst(struct kretprobe *rp)
@@ -1885,20 +2004,13 @@ static int pre_handler_kretprobe(struct kprobe *p, struct pt_regs *regs)
 
 	/* TODO: consider to only swap the RA after the last pre_handler fired */
 	hash = hash_ptr(current, KPROBE_HASH_BITS);
-	raw_spin_lock_irqsave(&rp->lock, flags);
-	if (!hlist_empty(&rp->free_instances)) {
-		ri = hlist_entry(rp->free_instances.first,
-				struct kretprobe_instance, hlist);
-		hlist_del(&ri->hlist);
-		raw_spin_unlock_irqrestore(&rp->lock, flags);
-
+	ri = kretprobe_get_inst(rp);
+	if (ri) {
 		ri->rp = rp;
 		ri->task = current;
 
 		if (rp->entry_handler && rp->entry_handler(ri, regs)) {
-			raw_spin_lock_irqsave(&rp->lock, flags);
-			hlist_add_head(&ri->hlist, &rp->free_instances);
-			raw_spin_unlock_irqrestore(&rp->lock, flags);
+			kretprobe_put_inst(rp, ri);
 			return 0;
 		}
 
@@ -1911,7 +2023,6 @@ static int pre_handler_kretprobe(struct kprobe *p, struct pt_regs *regs)
 		kretprobe_table_unlock(hash, &flags);
 	} else {
 		rp->nmissed++;
-		raw_spin_unlock_irqrestore(&rp->lock, flags);
 	}
 	return 0;
 }
@@ -1994,6 +2105,12 @@ int register_kretprobe(struct kretprobe *rp)
 	}
 	raw_spin_lock_init(&rp->lock);
 	INIT_HLIST_HEAD(&rp->free_instances);
+	rp->cache = NULL;
+	if (kretprobe_cache_batch(rp) > 0) {
+		rp->cache = alloc_percpu(struct kretprobe_cache);
+		if (!rp->cache)
+			return -ENOMEM;
+	}
 	for (i = 0; i < rp->maxactive; i++) {
 		inst = kmalloc(sizeof(struct kretprobe_instance) +
 			       rp->data_size, GFP_KERNEL);
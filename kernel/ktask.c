@@ -22,7 +22,6 @@
 #include <linux/list_sort.h>
 #include <linux/mutex.h>
 #include <linux/printk.h>
-#include <linux/random.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
@@ -69,6 +68,7 @@ struct ktask_task {
 	struct ktask_ctl	kt_ctl;
 	size_t			kt_total_size;
 	size_t			kt_chunk_size;
+	size_t			kt_nr_works;
 	/* protects this struct and struct ktask_work's of a running task */
 	struct mutex		kt_mutex;
 	struct ktask_node	*kt_nodes;
@@ -169,6 +169,46 @@ static bool ktask_node_migrate(struct ktask_node *old_kn, struct ktask_node *kn,
 	return true;
 }
 
+/* Returns the index of the node with the most work left, under kt_mutex. */
+static size_t ktask_busiest_node(struct ktask_task *kt)
+{
+	size_t i, busiest = kt->kt_nr_nodes;
+	size_t max_size = 0;
+
+	for (i = 0; i < kt->kt_nr_nodes; ++i) {
+		if (kt->kt_nodes[i].kn_remaining_size > max_size) {
+			max_size = kt->kt_nodes[i].kn_remaining_size;
+			busiest = i;
+		}
+	}
+
+	return busiest;
+}
+
+/*
+ * Returns the size of the next chunk to take from @kn, under kt_mutex.
+ *
+ * Once what is left of the task no longer covers a full chunk per work,
+ * hand out each work's fair share of the remainder instead, so the works
+ * finish together rather than waiting on the last big chunk.
+ */
+static size_t ktask_next_chunk_size(struct ktask_task *kt,
+				    struct ktask_node *kn)
+{
+	size_t min_chunk_size = kt->kt_ctl.kc_min_chunk_size;
+	size_t size = kt->kt_chunk_size;
+	size_t share;
+
+	share = DIV_ROUND_UP(kt->kt_total_size, kt->kt_nr_works);
+	if (share < size) {
+		if (share > min_chunk_size)
+			share = rounddown(share, min_chunk_size);
+		size = max(share, min_chunk_size);
+	}
+
+	return min(size, kn->kn_remaining_size);
+}
+
 static void ktask_thread(struct work_struct *work)
 {
 	struct ktask_work  *kw = container_of(work, struct ktask_work, kw_work);
@@ -184,23 +224,16 @@ static void ktask_thread(struct work_struct *work)
 		int ret;
 
 		if (kn->kn_remaining_size == 0) {
-			/* The current node is out of work; pick a new one. */
-			size_t remaining_nodes_seen = 0;
-			size_t new_idx = prandom_u32_max(kt->kt_nr_nodes_left);
+			/*
+			 * The current node is out of work; steal from the
+			 * node with the most work left, so the nodes with
+			 * more memory don't set the completion time alone.
+			 */
 			struct ktask_node *old_kn;
 			size_t i;
 
 			WARN_ON(kt->kt_nr_nodes_left == 0);
-			WARN_ON(new_idx >= kt->kt_nr_nodes_left);
-			for (i = 0; i < kt->kt_nr_nodes; ++i) {
-				if (kt->kt_nodes[i].kn_remaining_size == 0)
-					continue;
-
-				if (remaining_nodes_seen >= new_idx)
-					break;
-
-				++remaining_nodes_seen;
-			}
+			i = ktask_busiest_node(kt);
 			/* We should have found work on another node. */
 			WARN_ON(i >= kt->kt_nr_nodes);
 
@@ -216,7 +249,7 @@ static void ktask_thread(struct work_struct *work)
 
 		position = kn->kn_position;
 		position_offset = kn->kn_task_size - kn->kn_remaining_size;
-		size = min(kt->kt_chunk_size, kn->kn_remaining_size);
+		size = ktask_next_chunk_size(kt, kn);
 		end = kc->kc_iter_func(position, size);
 		kn->kn_position = end;
 		kn->kn_remaining_size -= size;
@@ -493,6 +526,7 @@ int ktask_run_numa(struct ktask_node *nodes, size_t nr_nodes,
 	mutex_init(&kt.kt_mutex);
 
 	nr_works = ktask_init_works(nodes, nr_nodes, &kt, &unfinished_works);
+	kt.kt_nr_works = nr_works;
 	kt.kt_chunk_size = ktask_chunk_size(kt.kt_total_size,
 					    ctl->kc_min_chunk_size, nr_works);
 
@@ -35,6 +35,8 @@
 # include "mutex.h"
 #endif
 
+#include "numa_handoff.h"
+
 void
 __mutex_init(struct mutex *lock, const char *name, struct lock_class_key *key)
 {
@@ -1194,6 +1196,35 @@ EXPORT_SYMBOL_GPL(ww_mutex_lock_interruptible);
 /*
  * Release the lock, slowpath:
  */
+/*
+ * With NUMA hand-off enabled, wake a waiter whose task last ran on this node
+ * rather than the one at the head of the wait-list.  The woken waiter only
+ * competes for the lock, so this is not done for a HANDOFF, where the top
+ * waiter is given the lock, nor for ww_mutexes, whose wait-list is ordered
+ * by stamp.
+ */
+static struct mutex_waiter *
+mutex_numa_pick_waiter(struct mutex *lock, struct mutex_waiter *waiter)
+{
+	struct mutex_waiter *pos = waiter;
+	int node = numa_node_id();
+	int scan = NUMA_HANDOFF_SCAN_MAX;
+
+	if (!numa_handoff_enabled() || waiter->ww_ctx ||
+	    cpu_to_node(task_cpu(waiter->task)) == node ||
+	    !numa_handoff_probably())
+		return waiter;
+
+	list_for_each_entry_continue(pos, &lock->wait_list, list) {
+		if (pos->ww_ctx || !--scan)
+			break;
+		if (cpu_to_node(task_cpu(pos->task)) == node)
+			return pos;
+	}
+
+	return waiter;
+}
+
 static noinline void __sched __mutex_unlock_slowpath(struct mutex *lock, unsigned long ip)
 {
 	struct task_struct *next = NULL;
@@ -1241,6 +1272,8 @@ static noinline void __sched __mutex_unlock_slowpath(struct mutex *lock, unsigne
 			list_first_entry(&lock->wait_list,
 					 struct mutex_waiter, list);
 
+		if (!(owner & MUTEX_FLAG_HANDOFF))
+			waiter = mutex_numa_pick_waiter(lock, waiter);
 		next = waiter->task;
 
 		debug_mutex_wake_waiter(lock, waiter);
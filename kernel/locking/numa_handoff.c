@@ -0,0 +1,98 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * NUMA-aware hand-off for mutexes and rwsems, see numa_handoff.h.
+ */
+#include <linux/capability.h>
+#include <linux/init.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/random.h>
+#include <linux/sysctl.h>
+
+#include "numa_handoff.h"
+
+/*
+ * Controls the probability of keeping the lock on the current node; it goes
+ * to a remote task instead with probability 1/2^NUMA_HANDOFF_PROB_ARG.
+ * This is much lower than the CNA spinlock setting, as every hand-off of a
+ * sleeping lock is a full critical section plus a wakeup.
+ */
+#define NUMA_HANDOFF_PROB_ARG		8
+
+DEFINE_STATIC_KEY_FALSE(numa_lock_handoff);
+
+static DEFINE_PER_CPU(u32, numa_handoff_seed);
+
+/*
+ * Return false with probability 1/2^NUMA_HANDOFF_PROB_ARG, true otherwise.
+ * Same generator as probably() in qspinlock_cna.h.
+ */
+bool numa_handoff_probably(void)
+{
+	u32 s;
+
+	s = this_cpu_read(numa_handoff_seed);
+	s = next_pseudo_random32(s);
+	this_cpu_write(numa_handoff_seed, s);
+
+	return s & ((1 << NUMA_HANDOFF_PROB_ARG) - 1);
+}
+
+#ifdef CONFIG_SYSCTL
+static DEFINE_MUTEX(numa_handoff_sysctl_mutex);
+static int zero;
+static int one = 1;
+
+static int numa_handoff_sysctl(struct ctl_table *table, int write,
+			       void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	struct ctl_table t;
+	int state, err;
+
+	if (write && !capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	mutex_lock(&numa_handoff_sysctl_mutex);
+	state = static_branch_unlikely(&numa_lock_handoff);
+	t = *table;
+	t.data = &state;
+	err = proc_dointvec_minmax(&t, write, buffer, lenp, ppos);
+	if (!err && write) {
+		/* Nothing to prefer on a single node */
+		if (state && nr_node_ids > 1)
+			static_branch_enable(&numa_lock_handoff);
+		else
+			static_branch_disable(&numa_lock_handoff);
+	}
+	mutex_unlock(&numa_handoff_sysctl_mutex);
+
+	return err;
+}
+
+static struct ctl_table numa_handoff_table[] = {
+	{
+		.procname	= "numa_lock_handoff",
+		.data		= NULL,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= numa_handoff_sysctl,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
+	{ }
+};
+#endif
+
+static int __init numa_handoff_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		per_cpu(numa_handoff_seed, cpu) = cpu + 1;
+
+#ifdef CONFIG_SYSCTL
+	register_sysctl("kernel", numa_handoff_table);
+#endif
+	return 0;
+}
+late_initcall(numa_handoff_init);
@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * NUMA-aware hand-off for sleeping locks.
+ *
+ * The same policy as the CNA spinlock slow path (qspinlock_cna.h), applied
+ * to the places where mutexes and rwsems choose who runs next:
+ *
+ *  - a task about to join the OSQ spinner queue behind a spinner on another
+ *    node goes to sleep on the wait list instead, so the spinners, which get
+ *    the lock next, stay on one node; the wait list plays the part of the
+ *    CNA secondary queue;
+ *
+ *  - on unlock, a waiter on the unlocking CPU's node is woken in preference
+ *    to the head of the wait list.
+ *
+ * Both decisions are taken with high probability rather than always, for
+ * long-term fairness.  Enabled through the kernel.numa_lock_handoff sysctl.
+ */
+#ifndef __LOCKING_NUMA_HANDOFF_H
+#define __LOCKING_NUMA_HANDOFF_H
+
+#include <linux/jump_label.h>
+#include <linux/topology.h>
+
+/* How many waiters past the head of the wait list to look at */
+#define NUMA_HANDOFF_SCAN_MAX		16
+
+#ifdef CONFIG_NUMA
+DECLARE_STATIC_KEY_FALSE(numa_lock_handoff);
+
+extern bool numa_handoff_probably(void);
+
+static inline bool numa_handoff_enabled(void)
+{
+	return static_branch_unlikely(&numa_lock_handoff);
+}
+
+/*
+ * Should a task on this node stay out of a spinner queue whose tail spins
+ * on @cpu?  Called with preemption disabled.
+ */
+static inline bool numa_handoff_divert(int cpu)
+{
+	return numa_handoff_enabled() &&
+	       cpu_to_node(cpu) != numa_node_id() &&
+	       numa_handoff_probably();
+}
+#else
+static inline bool numa_handoff_enabled(void)
+{
+	return false;
+}
+
+static inline bool numa_handoff_probably(void)
+{
+	return false;
+}
+
+static inline bool numa_handoff_divert(int cpu)
+{
+	return false;
+}
+#endif
+
+#endif /* __LOCKING_NUMA_HANDOFF_H */
@@ -3,6 +3,8 @@
 #include <linux/sched.h>
 #include <linux/osq_lock.h>
 
+#include "numa_handoff.h"
+
 /*
  * An MCS like lock especially tailored for optimistic spinning for sleeping
  * lock implementations (mutex, rwsem, etc).
@@ -94,6 +96,17 @@ bool osq_lock(struct optimistic_spin_queue *lock)
 	int curr = encode_cpu(smp_processor_id());
 	int old;
 
+	/*
+	 * Keep the spinners, and so the next few lock holders, on one node:
+	 * rather than queueing up behind a spinner on another node, go and
+	 * sleep on the wait list.
+	 */
+	if (numa_handoff_enabled()) {
+		old = atomic_read(&lock->tail);
+		if (old != OSQ_UNLOCKED_VAL && numa_handoff_divert(old - 1))
+			return false;
+	}
+
 	node->locked = 0;
 	node->next = NULL;
 	node->cpu = curr;
@@ -20,6 +20,7 @@
 #include <linux/osq_lock.h>
 
 #include "rwsem.h"
+#include "numa_handoff.h"
 
 /*
  * Guide to the rw_semaphore's count field for common values.
@@ -111,6 +112,34 @@ enum rwsem_wake_type {
 	RWSEM_WAKE_READ_OWNED	/* Waker thread holds the read lock */
 };
 
+/*
+ * Pick the writer to wake instead of @waiter, the writer at the head of the
+ * queue: with NUMA hand-off enabled, prefer one of the writers queued right
+ * behind it whose task last ran on this node.  Any queued writer may take
+ * the lock once it is free, see rwsem_try_write_lock().
+ */
+static struct rwsem_waiter *rwsem_numa_pick_writer(struct rw_semaphore *sem,
+						   struct rwsem_waiter *waiter)
+{
+	struct rwsem_waiter *pos = waiter;
+	int node = numa_node_id();
+	int scan = NUMA_HANDOFF_SCAN_MAX;
+
+	if (!numa_handoff_enabled() ||
+	    cpu_to_node(task_cpu(waiter->task)) == node ||
+	    !numa_handoff_probably())
+		return waiter;
+
+	list_for_each_entry_continue(pos, &sem->wait_list, list) {
+		if (pos->type != RWSEM_WAITING_FOR_WRITE || !--scan)
+			break;
+		if (cpu_to_node(task_cpu(pos->task)) == node)
+			return pos;
+	}
+
+	return waiter;
+}
+
 /*
  * handle the lock release when processes blocked on it that can now run
  * - if we come here from up_xxxx(), then:
@@ -147,6 +176,7 @@ static void __rwsem_mark_wake(struct rw_semaphore *sem,
 			 * Readers, on the other hand, will block as they
 			 * will notice the queued writer.
 			 */
+			waiter = rwsem_numa_pick_writer(sem, waiter);
 			wake_q_add(wake_q, waiter->task);
 		}
 
@@ -61,6 +61,9 @@
 #include <linux/trace_events.h>
 #include <linux/suspend.h>
 #include <linux/ftrace.h>
+#include <linux/slab.h>
+#include <linux/gfp.h>
+#include <linux/workqueue.h>
 
 #include "tree.h"
 #include "rcu.h"
@@ -3086,15 +3089,142 @@ void call_rcu_bh(struct rcu_head *head, rcu_callback_t func)
 EXPORT_SYMBOL_GPL(call_rcu_bh);
 
 /*
- * Queue an RCU callback for lazy invocation after a grace period.
- * This will likely be later named something like "call_rcu_lazy()",
- * but this change will require some way of tagging the lazy RCU
- * callbacks in the list of pending callbacks. Until then, this
- * function may only be called from __kfree_rcu().
+ * kfree_rcu() batching. Instead of queueing one callback per object, the
+ * objects are collected in a per-CPU page-sized array, and the whole
+ * array is handed to a single callback that frees it with kfree_bulk().
+ * The array is submitted once it is full, or KFREE_DRAIN_JIFFIES after
+ * its first object was added. If no page can be had, the object falls
+ * back to being queued through its own rcu_head.
+ */
+#define KFREE_DRAIN_JIFFIES (HZ / 50)
+
+struct kfree_rcu_bulk_data {
+	struct rcu_head rcu;
+	unsigned long nr_records;
+	void *records[];
+};
+
+#define KFREE_BULK_MAX_ENTR \
+	((PAGE_SIZE - sizeof(struct kfree_rcu_bulk_data)) / sizeof(void *))
+
+struct kfree_rcu_cpu {
+	spinlock_t lock;
+	struct kfree_rcu_bulk_data *bhead;
+	struct delayed_work monitor_work;
+	bool monitor_todo;
+};
+
+static DEFINE_PER_CPU(struct kfree_rcu_cpu, krc);
+
+static void kfree_rcu_bulk_free(struct rcu_head *rhp)
+{
+	struct kfree_rcu_bulk_data *bnode =
+		container_of(rhp, struct kfree_rcu_bulk_data, rcu);
+
+	kfree_bulk(bnode->nr_records, bnode->records);
+	free_page((unsigned long)bnode);
+}
+
+/* Hand the current array to RCU.  Caller must hold krcp->lock. */
+static void kfree_rcu_submit_locked(struct kfree_rcu_cpu *krcp)
+{
+	struct kfree_rcu_bulk_data *bnode = krcp->bhead;
+
+	if (!bnode)
+		return;
+
+	krcp->bhead = NULL;
+	__call_rcu(&bnode->rcu, kfree_rcu_bulk_free, rcu_state_p, -1, 1);
+}
+
+static void kfree_rcu_monitor(struct work_struct *work)
+{
+	struct kfree_rcu_cpu *krcp = container_of(work, struct kfree_rcu_cpu,
+						  monitor_work.work);
+	unsigned long flags;
+
+	spin_lock_irqsave(&krcp->lock, flags);
+	kfree_rcu_submit_locked(krcp);
+	krcp->monitor_todo = false;
+	spin_unlock_irqrestore(&krcp->lock, flags);
+}
+
+/*
+ * Submit every CPU's partially filled array, so that a following
+ * rcu_barrier() waits for the objects in them as it did when each
+ * object had its own callback.
+ */
+static void kfree_rcu_drain(void)
+{
+	struct kfree_rcu_cpu *krcp;
+	unsigned long flags;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		krcp = per_cpu_ptr(&krc, cpu);
+		spin_lock_irqsave(&krcp->lock, flags);
+		kfree_rcu_submit_locked(krcp);
+		spin_unlock_irqrestore(&krcp->lock, flags);
+	}
+}
+
+static void __init kfree_rcu_batch_init(void)
+{
+	struct kfree_rcu_cpu *krcp;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		krcp = per_cpu_ptr(&krc, cpu);
+		spin_lock_init(&krcp->lock);
+		INIT_DELAYED_WORK(&krcp->monitor_work, kfree_rcu_monitor);
+	}
+}
+
+/*
+ * Queue an object for lazy freeing after a grace period.  This function
+ * may only be called from __kfree_rcu(), so @func is the offset of
+ * @head within the object.
  */
 void kfree_call_rcu(struct rcu_head *head,
 		    rcu_callback_t func)
 {
+	struct kfree_rcu_bulk_data *bnode;
+	struct kfree_rcu_cpu *krcp;
+	unsigned long flags;
+
+	/* The monitor needs workqueues. */
+	if (rcu_scheduler_active != RCU_SCHEDULER_RUNNING)
+		goto queue_head;
+
+	local_irq_save(flags);
+	krcp = this_cpu_ptr(&krc);
+	spin_lock(&krcp->lock);
+
+	bnode = krcp->bhead;
+	if (!bnode) {
+		bnode = (void *)__get_free_page(GFP_NOWAIT | __GFP_NOWARN);
+		if (!bnode) {
+			spin_unlock_irqrestore(&krcp->lock, flags);
+			goto queue_head;
+		}
+		bnode->nr_records = 0;
+		krcp->bhead = bnode;
+	}
+
+	bnode->records[bnode->nr_records++] =
+		(void *)head - (unsigned long)func;
+
+	if (bnode->nr_records == KFREE_BULK_MAX_ENTR) {
+		kfree_rcu_submit_locked(krcp);
+	} else if (!krcp->monitor_todo) {
+		krcp->monitor_todo = true;
+		schedule_delayed_work(&krcp->monitor_work, KFREE_DRAIN_JIFFIES);
+	}
+
+	spin_unlock_irqrestore(&krcp->lock, flags);
+	return;
+
+queue_head:
 	__call_rcu(head, func, rcu_state_p, -1, 1);
 }
 EXPORT_SYMBOL_GPL(kfree_call_rcu);
@@ -3438,6 +3568,10 @@ static void _rcu_barrier(struct rcu_state *rsp)
 		return;
 	}
 
+	/* Objects batched by kfree_rcu() have no callback queued yet. */
+	if (rsp == rcu_state_p)
+		kfree_rcu_drain();
+
 	/* Mark the start of the barrier operation. */
 	rcu_seq_start(&rsp->barrier_sequence);
 	_rcu_barrier_trace(rsp, TPS("Inc1"), -1, rsp->barrier_sequence);
@@ -4163,6 +4297,7 @@ void __init rcu_init(void)
 	if (dump_tree)
 		rcu_dump_rcu_node_tree(&rcu_sched_state);
 	__rcu_init_preempt();
+	kfree_rcu_batch_init();
 	open_softirq(RCU_SOFTIRQ, rcu_process_callbacks);
 
 	/*
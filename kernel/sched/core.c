@@ -10,6 +10,7 @@
 #include <linux/nospec.h>
 
 #include <linux/kcov.h>
+#include <linux/sched/grid_qos.h>
 
 #include <asm/switch_to.h>
 #include <asm/tlb.h>
@@ -748,8 +749,10 @@ static inline void enqueue_task(struct rq *rq, struct task_struct *p, int flags)
 	if (!(flags & ENQUEUE_NOCLOCK))
 		update_rq_clock(rq);
 
-	if (!(flags & ENQUEUE_RESTORE))
+	if (!(flags & ENQUEUE_RESTORE)) {
 		sched_info_queued(rq, p);
+		psi_enqueue(p, flags & ENQUEUE_WAKEUP);
+	}
 
 	p->sched_class->enqueue_task(rq, p, flags);
 }
@@ -759,8 +762,10 @@ static inline void dequeue_task(struct rq *rq, struct task_struct *p, int flags)
 	if (!(flags & DEQUEUE_NOCLOCK))
 		update_rq_clock(rq);
 
-	if (!(flags & DEQUEUE_SAVE))
+	if (!(flags & DEQUEUE_SAVE)) {
 		sched_info_dequeued(rq, p);
+		psi_dequeue(p, flags & DEQUEUE_SLEEP);
+	}
 
 	p->sched_class->dequeue_task(rq, p, flags);
 }
@@ -1777,6 +1782,9 @@ void scheduler_ipi(void)
 	 */
 	preempt_fold_need_resched();
 
+	/* a SMT sibling started or stopped running an online task */
+	qos_smt_check_need_resched();
+
 	if (llist_empty(&this_rq()->wake_list) && !got_nohz_idle_kick())
 		return;
 
@@ -2065,6 +2073,7 @@ try_to_wake_up(struct task_struct *p, unsigned int state, int wake_flags)
 	cpu = select_task_rq(p, p->wake_cpu, SD_BALANCE_WAKE, wake_flags);
 	if (task_cpu(p) != cpu) {
 		wake_flags |= WF_MIGRATED;
+		psi_ttwu_dequeue(p);
 		set_task_cpu(p, cpu);
 	}
 
@@ -2126,6 +2135,12 @@ static void __sched_fork(unsigned long clone_flags, struct task_struct *p)
 	p->se.vruntime			= 0;
 	INIT_LIST_HEAD(&p->se.group_node);
 
+#ifdef CONFIG_PSI
+	/* Not inherited, psi_enqueue() accounts the child from scratch */
+	p->_resvd->psi_flags		= 0;
+	p->sched_psi_wake_requeue	= 0;
+#endif
+
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	p->se.cfs_rq			= NULL;
 #endif
@@ -3073,6 +3088,7 @@ void scheduler_tick(void)
 	curr->sched_class->task_tick(rq, curr, 0);
 	cpu_load_update_active(rq);
 	calc_global_load_tick(rq);
+	psi_task_tick(rq);
 
 	rq_unlock(rq, &rf);
 
@@ -3496,6 +3512,7 @@ static void __sched notrace __schedule(bool preempt)
 	}
 
 	next = pick_next_task(rq, prev, &rf);
+	qos_smt_update_status(rq, next);
 	clear_tsk_need_resched(prev);
 	clear_preempt_need_resched();
 
@@ -4341,7 +4358,8 @@ static int __sched_setscheduler(struct task_struct *p,
 	 * other than SCHED_IDLE, the online task preemption will be invalid,
 	 * so return -EINVAL in this case.
 	 */
-	if (unlikely(task_group(p)->qos_level == -1 && !idle_policy(policy))) {
+	if (unlikely(qos_level_offline(task_group(p)->qos_level) &&
+		     !idle_policy(policy))) {
 		task_rq_unlock(rq, p, &rf);
 		return -EINVAL;
 	}
@@ -6191,6 +6209,8 @@ void __init sched_init(void)
 
 	init_schedstats();
 
+	psi_init();
+
 	if (use_sched_idle_time)
 		rq_cputime_init();
 
@@ -6391,7 +6411,7 @@ void sched_move_offline_task(struct task_struct *p)
 {
 	struct offline_args *args;
 
-	if (unlikely(task_group(p)->qos_level != -1))
+	if (unlikely(!qos_level_offline(task_group(p)->qos_level)))
 		return;
 
 	args = kmalloc(sizeof(struct offline_args), GFP_ATOMIC);
@@ -6509,7 +6529,7 @@ static void sched_change_group(struct task_struct *tsk, int type)
 			.sched_priority = 0,
 		};
 
-		if (tg->qos_level == -1) {
+		if (qos_level_offline(tg->qos_level)) {
 			attr.sched_policy = SCHED_IDLE;
 			attr.sched_nice = PRIO_TO_NICE(tsk->static_prio);
 			__setscheduler(rq, tsk, &attr, 0);
@@ -6659,13 +6679,22 @@ static int cpu_cgroup_can_attach(struct cgroup_taskset *tset)
 	return ret;
 }
 
+#ifdef CONFIG_QOS_SCHED_SMART_GRID
+static int tg_preferred_nid(struct task_group *tg);
+#endif
+
 static void cpu_cgroup_attach(struct cgroup_taskset *tset)
 {
 	struct task_struct *task;
 	struct cgroup_subsys_state *css;
 
-	cgroup_taskset_for_each(task, css, tset)
+	cgroup_taskset_for_each(task, css, tset) {
 		sched_move_task(task);
+#ifdef CONFIG_QOS_SCHED_SMART_GRID
+		sched_grid_set_preferred_nid(task,
+					     tg_preferred_nid(css_tg(css)));
+#endif
+	}
 }
 
 #ifdef CONFIG_FAIR_GROUP_SCHED
@@ -7081,6 +7110,64 @@ static u64 cpu_affinity_domain_mask_read_u64(struct cgroup_subsys_state *css,
 	return tg->auto_affinity->ad.domain_mask;
 }
 
+/* The closest ancestor with a preferred node set decides for the group */
+static int tg_preferred_nid(struct task_group *tg)
+{
+	for (; tg; tg = tg->parent) {
+		if (tg->auto_affinity &&
+		    tg->auto_affinity->preferred_nid != NUMA_NO_NODE)
+			return tg->auto_affinity->preferred_nid;
+	}
+
+	return NUMA_NO_NODE;
+}
+
+static int tg_update_preferred_nid(struct task_group *tg, void *data)
+{
+	struct css_task_iter it;
+	struct task_struct *tsk;
+	int nid = tg_preferred_nid(tg);
+
+	css_task_iter_start(&tg->css, 0, &it);
+	while ((tsk = css_task_iter_next(&it)))
+		sched_grid_set_preferred_nid(tsk, nid);
+	css_task_iter_end(&it);
+
+	return 0;
+}
+
+static int cpu_preferred_node_write_s64(struct cgroup_subsys_state *css,
+					struct cftype *cftype, s64 nid)
+{
+	struct task_group *tg = css_tg(css);
+
+	if (unlikely(!tg->auto_affinity))
+		return -EPERM;
+
+	if (nid != NUMA_NO_NODE &&
+	    (nid < 0 || nid >= nr_node_ids || !node_online(nid)))
+		return -EINVAL;
+
+	tg->auto_affinity->preferred_nid = nid;
+
+	rcu_read_lock();
+	walk_tg_tree_from(tg, tg_update_preferred_nid, tg_nop, NULL);
+	rcu_read_unlock();
+
+	return 0;
+}
+
+static s64 cpu_preferred_node_read_s64(struct cgroup_subsys_state *css,
+				       struct cftype *cft)
+{
+	struct task_group *tg = css_tg(css);
+
+	if (unlikely(!tg->auto_affinity))
+		return -EPERM;
+
+	return tg->auto_affinity->preferred_nid;
+}
+
 static int cpu_affinity_stat_show(struct seq_file *sf, void *v)
 {
 	struct task_group *tg = css_tg(seq_css(sf));
@@ -7096,6 +7183,7 @@ static int cpu_affinity_stat_show(struct seq_file *sf, void *v)
 	seq_printf(sf, "dcount %d\n", ad->dcount);
 	seq_printf(sf, "domain_mask 0x%x\n", ad->domain_mask);
 	seq_printf(sf, "curr_level %d\n", ad->curr_level);
+	seq_printf(sf, "util_avg %lu\n", ad->util_avg);
 	for (i = 0; i < ad->dcount; i++)
 		seq_printf(sf, "sd_level %d, cpu list %*pbl, stay_cnt %llu\n",
 			i, cpumask_pr_args(ad->domains[i]),
@@ -7116,7 +7204,7 @@ static int tg_change_scheduler(struct task_group *tg, void *data)
 	struct cgroup_subsys_state *css = &tg->css;
 
 	tg->qos_level = qos_level;
-	if (qos_level == -1)
+	if (qos_level_offline(qos_level))
 		policy = SCHED_IDLE;
 	else
 		policy = SCHED_NORMAL;
@@ -7138,21 +7226,21 @@ static int cpu_qos_write(struct cgroup_subsys_state *css,
 	if (!tg->se[0])
 		return -EINVAL;
 
-	if (qos_level != -1 && qos_level != 0)
+	if (qos_level < QOS_LEVEL_MIN || qos_level > QOS_LEVEL_MAX)
 		return -EINVAL;
 
 	if (tg->qos_level == qos_level)
 		goto done;
 
-	if (tg->qos_level == -1 && qos_level == 0)
+	/* offline groups can move between the offline tiers only */
+	if (qos_level_offline(tg->qos_level) && !qos_level_offline(qos_level))
 		return -EINVAL;
 
-	cpus_read_lock();
-	if (qos_level == -1)
+	if (!qos_level_offline(tg->qos_level) && qos_level_offline(qos_level)) {
+		cpus_read_lock();
 		cfs_bandwidth_usage_inc();
-	else
-		cfs_bandwidth_usage_dec();
-	cpus_read_unlock();
+		cpus_read_unlock();
+	}
 
 	rcu_read_lock();
 	walk_tg_tree_from(tg, tg_change_scheduler, tg_nop, (void *)(&qos_level));
@@ -7230,6 +7318,11 @@ static struct cftype cpu_legacy_files[] = {
 		.name = "affinity_stat",
 		.seq_show = cpu_affinity_stat_show,
 	},
+	{
+		.name = "preferred_node",
+		.read_s64 = cpu_preferred_node_read_s64,
+		.write_s64 = cpu_preferred_node_write_s64,
+	},
 #endif
 	{ }	/* Terminate */
 };
@@ -25,12 +25,36 @@ struct cpuacct_usage {
 	u64	usages[CPUACCT_STAT_NSTATS];
 };
 
+/*
+ * The charging paths only update the counters of the task's own group and
+ * put the group on the per-cpu updated tree of its ancestors, in the same
+ * way as cgroup_rstat does for the default hierarchy.  The hierarchical
+ * totals are collected when they are read, see cpuacct_flush().
+ */
+struct cpuacct_prop {
+	/* updated tree, protected by cpuacct_updated_lock */
+	struct cpuacct		*updated_children;
+	struct cpuacct		*updated_next;
+
+	/*
+	 * The rest is protected by cpuacct_flush_mutex.  ->stat folds the
+	 * cpustat fields shown in cpuacct.stat into user and system.
+	 */
+	struct cpuacct_usage	last_usage;
+	struct cpuacct_usage	last_stat;
+	struct cpuacct_usage	pending_usage;
+	struct cpuacct_usage	pending_stat;
+	struct cpuacct_usage	usage;
+	struct cpuacct_usage	stat;
+};
+
 /* track CPU usage of a group of tasks and its child groups */
 struct cpuacct {
 	struct cgroup_subsys_state	css;
-	/* cpuusage holds pointer to a u64-type object on every CPU */
+	/* cpuusage and cpustat only account the tasks of this group */
 	struct cpuacct_usage __percpu	*cpuusage;
 	struct kernel_cpustat __percpu	*cpustat;
+	struct cpuacct_prop __percpu	*prop;
 };
 
 static inline struct cpuacct *css_ca(struct cgroup_subsys_state *css)
@@ -49,17 +73,192 @@ static inline struct cpuacct *parent_ca(struct cpuacct *ca)
 	return css_ca(ca->css.parent);
 }
 
+static struct cpuacct root_cpuacct;
 static DEFINE_PER_CPU(struct cpuacct_usage, root_cpuacct_cpuusage);
+static DEFINE_PER_CPU(struct cpuacct_prop, root_cpuacct_prop) = {
+	.updated_children	= &root_cpuacct,
+};
 static struct cpuacct root_cpuacct = {
 	.cpustat	= &kernel_cpustat,
 	.cpuusage	= &root_cpuacct_cpuusage,
+	.prop		= &root_cpuacct_prop,
 };
 
+static DEFINE_MUTEX(cpuacct_flush_mutex);
+static DEFINE_PER_CPU(raw_spinlock_t, cpuacct_updated_lock) =
+	__RAW_SPIN_LOCK_UNLOCKED(cpuacct_updated_lock);
+
+static inline struct cpuacct_prop *cpuacct_prop(struct cpuacct *ca, int cpu)
+{
+	return per_cpu_ptr(ca->prop, cpu);
+}
+
+/*
+ * Put @ca and its ancestors on the updated tree of @cpu.  The root is
+ * flushed unconditionally and never goes on the tree.
+ */
+static void cpuacct_updated(struct cpuacct *ca, int cpu)
+{
+	raw_spinlock_t *cpu_lock = per_cpu_ptr(&cpuacct_updated_lock, cpu);
+	struct cpuacct *parent;
+	unsigned long flags;
+
+	if (!parent_ca(ca))
+		return;
+
+	/*
+	 * Speculative already-on-tree test, a race only delays the update
+	 * until the next charge.
+	 */
+	if (cpuacct_prop(ca, cpu)->updated_next)
+		return;
+
+	raw_spin_lock_irqsave(cpu_lock, flags);
+	for (parent = parent_ca(ca); parent;
+	     ca = parent, parent = parent_ca(ca)) {
+		struct cpuacct_prop *prop = cpuacct_prop(ca, cpu);
+		struct cpuacct_prop *pprop = cpuacct_prop(parent, cpu);
+
+		/* if @ca is already on the tree, all ancestors are */
+		if (prop->updated_next)
+			break;
+
+		prop->updated_next = pprop->updated_children;
+		pprop->updated_children = ca;
+	}
+	raw_spin_unlock_irqrestore(cpu_lock, flags);
+}
+
+/*
+ * Unlink and return the next group of @root's updated tree on @cpu,
+ * children before their parents.  See cgroup_rstat_cpu_pop_updated().
+ */
+static struct cpuacct *cpuacct_pop_updated(struct cpuacct *pos,
+					   struct cpuacct *root, int cpu)
+{
+	struct cpuacct_prop *prop;
+
+	if (pos == root)
+		return NULL;
+
+	pos = pos ? parent_ca(pos) : root;
+
+	/* walk down to the first leaf */
+	while (true) {
+		prop = cpuacct_prop(pos, cpu);
+		if (prop->updated_children == pos)
+			break;
+		pos = prop->updated_children;
+	}
+
+	if (prop->updated_next) {
+		struct cpuacct_prop *pprop = cpuacct_prop(parent_ca(pos), cpu);
+		struct cpuacct **nextp = &pprop->updated_children;
+
+		while (*nextp != pos)
+			nextp = &cpuacct_prop(*nextp, cpu)->updated_next;
+
+		*nextp = prop->updated_next;
+		prop->updated_next = NULL;
+
+		return pos;
+	}
+
+	/* only happens for @root */
+	return NULL;
+}
+
+static void cpuacct_fold_stat(struct cpuacct *ca, int cpu,
+			      struct cpuacct_usage *stat)
+{
+	u64 *cpustat = per_cpu_ptr(ca->cpustat, cpu)->cpustat;
+
+	stat->usages[CPUACCT_STAT_USER] = cpustat[CPUTIME_USER] +
+					  cpustat[CPUTIME_NICE];
+	stat->usages[CPUACCT_STAT_SYSTEM] = cpustat[CPUTIME_SYSTEM] +
+					    cpustat[CPUTIME_IRQ] +
+					    cpustat[CPUTIME_SOFTIRQ];
+}
+
+/* Add what @ca and its children gained on @cpu since the last flush */
+static void cpuacct_flush_one(struct cpuacct *ca, int cpu)
+{
+	struct cpuacct_usage *cpuusage = per_cpu_ptr(ca->cpuusage, cpu);
+	struct cpuacct_prop *prop = cpuacct_prop(ca, cpu);
+	struct cpuacct *parent = parent_ca(ca);
+	struct cpuacct_prop *pprop = NULL;
+	struct cpuacct_usage stat;
+	u64 delta;
+	int i;
+
+	cpuacct_fold_stat(ca, cpu, &stat);
+	if (parent)
+		pprop = cpuacct_prop(parent, cpu);
+
+	for (i = 0; i < CPUACCT_STAT_NSTATS; i++) {
+		delta = cpuusage->usages[i] - prop->last_usage.usages[i] +
+			prop->pending_usage.usages[i];
+		prop->last_usage.usages[i] = cpuusage->usages[i];
+		prop->pending_usage.usages[i] = 0;
+		prop->usage.usages[i] += delta;
+		if (pprop)
+			pprop->pending_usage.usages[i] += delta;
+
+		delta = stat.usages[i] - prop->last_stat.usages[i] +
+			prop->pending_stat.usages[i];
+		prop->last_stat.usages[i] = stat.usages[i];
+		prop->pending_stat.usages[i] = 0;
+		prop->stat.usages[i] += delta;
+		/* the root cpustat is kernel_cpustat, which has it all */
+		if (pprop && parent != &root_cpuacct)
+			pprop->pending_stat.usages[i] += delta;
+	}
+}
+
+/* Collect the hierarchical totals of @ca, the caller holds the mutex */
+static void cpuacct_flush(struct cpuacct *ca)
+{
+	int cpu;
+
+	lockdep_assert_held(&cpuacct_flush_mutex);
+
+	for_each_possible_cpu(cpu) {
+		raw_spinlock_t *cpu_lock = per_cpu_ptr(&cpuacct_updated_lock,
+						       cpu);
+		struct cpuacct *pos = NULL;
+
+#ifndef CONFIG_64BIT
+		/*
+		 * Take rq->lock to make 64-bit read of cpuusage safe on
+		 * 32-bit platforms.
+		 */
+		raw_spin_lock_irq(&cpu_rq(cpu)->lock);
+		raw_spin_lock(cpu_lock);
+#else
+		raw_spin_lock_irq(cpu_lock);
+#endif
+
+		while ((pos = cpuacct_pop_updated(pos, ca, cpu)))
+			cpuacct_flush_one(pos, cpu);
+		if (ca == &root_cpuacct)
+			cpuacct_flush_one(ca, cpu);
+
+#ifndef CONFIG_64BIT
+		raw_spin_unlock(cpu_lock);
+		raw_spin_unlock_irq(&cpu_rq(cpu)->lock);
+#else
+		raw_spin_unlock_irq(cpu_lock);
+#endif
+		cond_resched();
+	}
+}
+
 /* Create a new CPU accounting group */
 static struct cgroup_subsys_state *
 cpuacct_css_alloc(struct cgroup_subsys_state *parent_css)
 {
 	struct cpuacct *ca;
+	int cpu;
 
 	if (!parent_css)
 		return &root_cpuacct.css;
@@ -76,8 +275,17 @@ cpuacct_css_alloc(struct cgroup_subsys_state *parent_css)
 	if (!ca->cpustat)
 		goto out_free_cpuusage;
 
+	ca->prop = alloc_percpu(struct cpuacct_prop);
+	if (!ca->prop)
+		goto out_free_cpustat;
+
+	for_each_possible_cpu(cpu)
+		cpuacct_prop(ca, cpu)->updated_children = ca;
+
 	return &ca->css;
 
+out_free_cpustat:
+	free_percpu(ca->cpustat);
 out_free_cpuusage:
 	free_percpu(ca->cpuusage);
 out_free_ca:
@@ -91,15 +299,22 @@ static void cpuacct_css_free(struct cgroup_subsys_state *css)
 {
 	struct cpuacct *ca = css_ca(css);
 
+	/* hand the usage of @ca over to its parent before it goes away */
+	mutex_lock(&cpuacct_flush_mutex);
+	cpuacct_flush(ca);
+	mutex_unlock(&cpuacct_flush_mutex);
+
+	free_percpu(ca->prop);
 	free_percpu(ca->cpustat);
 	free_percpu(ca->cpuusage);
 	kfree(ca);
 }
 
+/* Called with cpuacct_flush_mutex held, after cpuacct_flush() */
 static u64 cpuacct_cpuusage_read(struct cpuacct *ca, int cpu,
 				 enum cpuacct_stat_index index)
 {
-	struct cpuacct_usage *cpuusage = per_cpu_ptr(ca->cpuusage, cpu);
+	struct cpuacct_usage *usage = &cpuacct_prop(ca, cpu)->usage;
 	u64 data;
 
 	/*
@@ -108,50 +323,19 @@ static u64 cpuacct_cpuusage_read(struct cpuacct *ca, int cpu,
 	 */
 	BUG_ON(index > CPUACCT_STAT_NSTATS);
 
-#ifndef CONFIG_64BIT
-	/*
-	 * Take rq->lock to make 64-bit read safe on 32-bit platforms.
-	 */
-	raw_spin_lock_irq(&cpu_rq(cpu)->lock);
-#endif
-
 	if (index == CPUACCT_STAT_NSTATS) {
 		int i = 0;
 
 		data = 0;
 		for (i = 0; i < CPUACCT_STAT_NSTATS; i++)
-			data += cpuusage->usages[i];
+			data += usage->usages[i];
 	} else {
-		data = cpuusage->usages[index];
+		data = usage->usages[index];
 	}
 
-#ifndef CONFIG_64BIT
-	raw_spin_unlock_irq(&cpu_rq(cpu)->lock);
-#endif
-
 	return data;
 }
 
-static void cpuacct_cpuusage_write(struct cpuacct *ca, int cpu, u64 val)
-{
-	struct cpuacct_usage *cpuusage = per_cpu_ptr(ca->cpuusage, cpu);
-	int i;
-
-#ifndef CONFIG_64BIT
-	/*
-	 * Take rq->lock to make 64-bit write safe on 32-bit platforms.
-	 */
-	raw_spin_lock_irq(&cpu_rq(cpu)->lock);
-#endif
-
-	for (i = 0; i < CPUACCT_STAT_NSTATS; i++)
-		cpuusage->usages[i] = val;
-
-#ifndef CONFIG_64BIT
-	raw_spin_unlock_irq(&cpu_rq(cpu)->lock);
-#endif
-}
-
 /* Return total CPU usage (in nanoseconds) of a group */
 static u64 __cpuusage_read(struct cgroup_subsys_state *css,
 			   enum cpuacct_stat_index index)
@@ -160,8 +344,11 @@ static u64 __cpuusage_read(struct cgroup_subsys_state *css,
 	u64 totalcpuusage = 0;
 	int i;
 
+	mutex_lock(&cpuacct_flush_mutex);
+	cpuacct_flush(ca);
 	for_each_possible_cpu(i)
 		totalcpuusage += cpuacct_cpuusage_read(ca, i, index);
+	mutex_unlock(&cpuacct_flush_mutex);
 
 	return totalcpuusage;
 }
@@ -195,8 +382,16 @@ static int cpuusage_write(struct cgroup_subsys_state *css, struct cftype *cft,
 	if (val)
 		return -EINVAL;
 
+	/*
+	 * Flush first so that usage the children have not propagated yet
+	 * doesn't show up after the reset.
+	 */
+	mutex_lock(&cpuacct_flush_mutex);
+	cpuacct_flush(ca);
 	for_each_possible_cpu(cpu)
-		cpuacct_cpuusage_write(ca, cpu, 0);
+		memset(&cpuacct_prop(ca, cpu)->usage, 0,
+		       sizeof(struct cpuacct_usage));
+	mutex_unlock(&cpuacct_flush_mutex);
 
 	return 0;
 }
@@ -208,10 +403,13 @@ static int __cpuacct_percpu_seq_show(struct seq_file *m,
 	u64 percpu;
 	int i;
 
+	mutex_lock(&cpuacct_flush_mutex);
+	cpuacct_flush(ca);
 	for_each_possible_cpu(i) {
 		percpu = cpuacct_cpuusage_read(ca, i, index);
 		seq_printf(m, "%llu ", (unsigned long long) percpu);
 	}
+	mutex_unlock(&cpuacct_flush_mutex);
 	seq_printf(m, "\n");
 	return 0;
 }
@@ -242,28 +440,17 @@ static int cpuacct_all_seq_show(struct seq_file *m, void *V)
 		seq_printf(m, " %s", cpuacct_stat_desc[index]);
 	seq_puts(m, "\n");
 
+	mutex_lock(&cpuacct_flush_mutex);
+	cpuacct_flush(ca);
 	for_each_possible_cpu(cpu) {
-		struct cpuacct_usage *cpuusage = per_cpu_ptr(ca->cpuusage, cpu);
-
 		seq_printf(m, "%d", cpu);
 
-		for (index = 0; index < CPUACCT_STAT_NSTATS; index++) {
-#ifndef CONFIG_64BIT
-			/*
-			 * Take rq->lock to make 64-bit read safe on 32-bit
-			 * platforms.
-			 */
-			raw_spin_lock_irq(&cpu_rq(cpu)->lock);
-#endif
-
-			seq_printf(m, " %llu", cpuusage->usages[index]);
-
-#ifndef CONFIG_64BIT
-			raw_spin_unlock_irq(&cpu_rq(cpu)->lock);
-#endif
-		}
+		for (index = 0; index < CPUACCT_STAT_NSTATS; index++)
+			seq_printf(m, " %llu",
+				   cpuacct_cpuusage_read(ca, cpu, index));
 		seq_puts(m, "\n");
 	}
+	mutex_unlock(&cpuacct_flush_mutex);
 	return 0;
 }
 
@@ -275,15 +462,15 @@ static int cpuacct_stats_show(struct seq_file *sf, void *v)
 	int stat;
 
 	memset(val, 0, sizeof(val));
+	mutex_lock(&cpuacct_flush_mutex);
+	cpuacct_flush(ca);
 	for_each_possible_cpu(cpu) {
-		u64 *cpustat = per_cpu_ptr(ca->cpustat, cpu)->cpustat;
+		struct cpuacct_usage *usage = &cpuacct_prop(ca, cpu)->stat;
 
-		val[CPUACCT_STAT_USER]   += cpustat[CPUTIME_USER];
-		val[CPUACCT_STAT_USER]   += cpustat[CPUTIME_NICE];
-		val[CPUACCT_STAT_SYSTEM] += cpustat[CPUTIME_SYSTEM];
-		val[CPUACCT_STAT_SYSTEM] += cpustat[CPUTIME_IRQ];
-		val[CPUACCT_STAT_SYSTEM] += cpustat[CPUTIME_SOFTIRQ];
+		for (stat = 0; stat < CPUACCT_STAT_NSTATS; stat++)
+			val[stat] += usage->usages[stat];
 	}
+	mutex_unlock(&cpuacct_flush_mutex);
 
 	for (stat = 0; stat < CPUACCT_STAT_NSTATS; stat++) {
 		seq_printf(sf, "%s %lld\n",
@@ -332,7 +519,8 @@ static struct cftype files[] = {
 };
 
 /*
- * charge this task's execution time to its accounting group.
+ * charge this task's execution time to its accounting group.  The
+ * ancestors pick it up on the next cpuacct_flush().
  *
  * called with rq->lock held.
  */
@@ -347,8 +535,9 @@ void cpuacct_charge(struct task_struct *tsk, u64 cputime)
 
 	rcu_read_lock();
 
-	for (ca = task_ca(tsk); ca; ca = parent_ca(ca))
-		this_cpu_ptr(ca->cpuusage)->usages[index] += cputime;
+	ca = task_ca(tsk);
+	this_cpu_ptr(ca->cpuusage)->usages[index] += cputime;
+	cpuacct_updated(ca, smp_processor_id());
 
 	rcu_read_unlock();
 }
@@ -363,8 +552,11 @@ void cpuacct_account_field(struct task_struct *tsk, int index, u64 val)
 	struct cpuacct *ca;
 
 	rcu_read_lock();
-	for (ca = task_ca(tsk); ca != &root_cpuacct; ca = parent_ca(ca))
+	ca = task_ca(tsk);
+	if (ca != &root_cpuacct) {
 		this_cpu_ptr(ca->cpustat)->cpustat[index] += val;
+		cpuacct_updated(ca, smp_processor_id());
+	}
 	rcu_read_unlock();
 }
 
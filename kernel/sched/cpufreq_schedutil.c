@@ -12,6 +12,7 @@
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 
 #include "sched.h"
+#include <linux/sched/grid_qos.h>
 
 #include <trace/events/power.h>
 
@@ -257,6 +258,9 @@ static unsigned long sugov_get_util(struct sugov_cpu *sg_cpu)
 	util = scale_irq_capacity(util, irq, max);
 	util += irq;
 
+	if (smart_grid_used())
+		util = min(max, sched_grid_zone_util(sg_cpu->cpu, util, max));
+
 	/*
 	 * Bandwidth required by DEADLINE must always be granted while, for
 	 * FAIR and RT, we use blocked utilization of IDLE CPUs as a mechanism
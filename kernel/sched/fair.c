@@ -111,11 +111,21 @@ int __weak arch_asym_cpu_priority(int cpu)
  */
 #define QOS_THROTTLED	2
 
-static DEFINE_PER_CPU_SHARED_ALIGNED(struct list_head, qos_throttled_cfs_rq);
+/* throttled offline cfs_rqs, one list per offline qos_level */
+static DEFINE_PER_CPU_SHARED_ALIGNED(struct list_head,
+				     qos_throttled_cfs_rq[QOS_OFFLINE_LEVELS]);
 static DEFINE_PER_CPU_SHARED_ALIGNED(struct hrtimer, qos_overload_timer);
 static DEFINE_PER_CPU(int, qos_cpu_overload);
+/* EWMA of the online tasks waiting on the runqueue, in 1/1024 of a tick */
+static DEFINE_PER_CPU(unsigned int, qos_online_pressure);
 unsigned int sysctl_overload_detect_period = 5000;  /* in ms */
 unsigned int sysctl_offline_wait_interval = 100;  /* in ms */
+/* throttle offline tasks only above this online pressure, in percent */
+unsigned int sysctl_qos_online_pressure_threshold;
+#ifdef CONFIG_QOS_SCHED_SMT_EXPELLER
+/* this CPU runs an online task, its SMT siblings must not run offline ones */
+static DEFINE_PER_CPU(bool, qos_smt_online);
+#endif
 static int __unthrottle_qos_cfs_rqs(int cpu);
 #endif
 
@@ -2211,7 +2221,7 @@ static int preferred_group_nid(struct task_struct *p, int nid)
 
 static void task_numa_placement(struct task_struct *p)
 {
-	int seq, nid, max_nid = -1;
+	int seq, nid, max_nid = -1, grid_nid;
 	unsigned long max_faults = 0;
 	unsigned long fault_types[2] = { 0, 0 };
 	unsigned long total_faults;
@@ -2310,7 +2320,12 @@ static void task_numa_placement(struct task_struct *p)
 		max_nid = preferred_group_nid(p, max_nid);
 	}
 
-	if (max_faults) {
+	/* The cpu cgroup placed the whole group on one node */
+	grid_nid = sched_grid_task_preferred_nid(p);
+	if (grid_nid != NUMA_NO_NODE) {
+		if (grid_nid != p->numa_preferred_nid)
+			sched_setnuma(p, grid_nid);
+	} else if (max_faults) {
 		/* Set the new preferred node */
 		if (max_nid != p->numa_preferred_nid)
 			sched_setnuma(p, max_nid);
@@ -3858,6 +3873,11 @@ static inline bool steal_enabled(void)
 	return sched_feat(STEAL) && allow;
 }
 
+static inline bool steal_first(void)
+{
+	return sched_feat(STEAL_FIRST) && steal_enabled();
+}
+
 static void overload_clear(struct rq *rq)
 {
 	struct sparsemask *overload_cpus;
@@ -3895,6 +3915,7 @@ static void overload_set(struct rq *rq)
 static int try_steal(struct rq *this_rq, struct rq_flags *rf);
 #else
 static inline int try_steal(struct rq *this_rq, struct rq_flags *rf) { return 0; }
+static inline bool steal_first(void) { return false; }
 static inline void overload_clear(struct rq *rq) {}
 static inline void overload_set(struct rq *rq) {}
 #endif
@@ -3925,6 +3946,7 @@ static inline int idle_balance(struct rq *rq, struct rq_flags *rf)
 static inline void rq_idle_stamp_update(struct rq *rq) {}
 static inline void rq_idle_stamp_clear(struct rq *rq) {}
 static inline int try_steal(struct rq *this_rq, struct rq_flags *rf) { return 0; }
+static inline bool steal_first(void) { return false; }
 static inline void overload_clear(struct rq *rq) {}
 static inline void overload_set(struct rq *rq) {}
 
@@ -5365,7 +5387,22 @@ static void affinity_domain_up(struct task_group *tg)
 	}
 }
 
-static void affinity_domain_down(struct task_group *tg)
+static unsigned long affinity_domain_capacity(struct cpumask *span)
+{
+	unsigned long capacity = 0;
+	int cpu;
+
+	for_each_cpu(cpu, span)
+		capacity += capacity_of(cpu);
+
+	return capacity;
+}
+
+/*
+ * Only shrink to a domain the averaged utilization fits in well below the
+ * expansion threshold, so that the group does not bounce straight back.
+ */
+static void affinity_domain_down(struct task_group *tg, unsigned long util)
 {
 	struct affinity_domain *ad = &tg->auto_affinity->ad;
 	u16 level = ad->curr_level;
@@ -5378,7 +5415,10 @@ static void affinity_domain_down(struct task_group *tg)
 			return;
 
 		if (IS_DOMAIN_SET(level - 1, ad->domain_mask)) {
-			ad->curr_level = level - 1;
+			if (util * 100 < affinity_domain_capacity(
+					ad->domains[level - 1]) *
+					sysctl_sched_util_low_pct / 2)
+				ad->curr_level = level - 1;
 			return;
 		}
 		level--;
@@ -5395,7 +5435,7 @@ static enum hrtimer_restart sched_auto_affi_period_timer(struct hrtimer *timer)
 	unsigned long util_avg_sum = 0;
 	unsigned long tg_capacity = 0;
 	unsigned long flags;
-	int cpu;
+	int cpu, prev_level;
 
 	for_each_cpu(cpu, span) {
 		util_avg_sum += cpu_util(cpu);
@@ -5409,13 +5449,32 @@ static enum hrtimer_restart sched_auto_affi_period_timer(struct hrtimer *timer)
 		return HRTIMER_NORESTART;
 	}
 
+	/*
+	 * Expand as soon as the domain gets busy, but shrink on the average
+	 * of the last periods only: a burst must not pull the group back
+	 * into a domain it just outgrew.
+	 */
+	if (!ad->util_avg)
+		ad->util_avg = util_avg_sum;
+	else
+		ad->util_avg = (ad->util_avg * 3 + util_avg_sum) / 4;
+	prev_level = ad->curr_level;
+
 	if (util_avg_sum * 100 >= tg_capacity * sysctl_sched_util_low_pct) {
 		affinity_domain_up(tg);
-	} else if (util_avg_sum * 100 < tg_capacity *
+	} else if (ad->util_avg * 100 < tg_capacity *
 		   sysctl_sched_util_low_pct / 2) {
-		affinity_domain_down(tg);
+		affinity_domain_down(tg, ad->util_avg);
 	}
 
+	if (ad->curr_level != prev_level)
+		trace_sched_auto_affinity_level(cgroup_ino(tg->css.cgroup),
+						prev_level, ad->curr_level,
+						ad->util_avg, tg_capacity);
+
+	sched_grid_zone_mark_hot(ad->domains[ad->curr_level], jiffies +
+			2 * nsecs_to_jiffies(ktime_to_ns(auto_affi->period)));
+
 	schedstat_inc(ad->stay_cnt[ad->curr_level]);
 	hrtimer_forward_now(timer, auto_affi->period);
 	raw_spin_unlock_irqrestore(&auto_affi->lock, flags);
@@ -5505,6 +5564,7 @@ void stop_auto_affinity(struct auto_affinity *auto_affi)
 	auto_affi->period_active = 0;
 	auto_affi->mode = 0;
 	ad->curr_level = ad->dcount > 0 ? ad->dcount - 1 : 0;
+	ad->util_avg = 0;
 	raw_spin_unlock_irq(&auto_affi->lock);
 
 	smart_grid_usage_dec();
@@ -5695,6 +5755,7 @@ int init_auto_affinity(struct task_group *tg)
 	auto_affi->mode = 0;
 	auto_affi->period_active = 0;
 	auto_affi->period = ms_to_ktime(AUTO_AFFINITY_DEFAULT_PERIOD_MS);
+	auto_affi->preferred_nid = NUMA_NO_NODE;
 	hrtimer_init(&auto_affi->period_timer, CLOCK_MONOTONIC,
 		HRTIMER_MODE_ABS_PINNED);
 	auto_affi->period_timer.function = sched_auto_affi_period_timer;
@@ -6749,6 +6810,43 @@ static inline bool test_idle_cores(int cpu, bool def)
 	return def;
 }
 
+#ifdef CONFIG_SCHED_STEAL
+/*
+ * LLC-wide sparse mask of the idle cores, indexed by the first CPU of each
+ * core.  Bits are set when a core goes idle and only cleared lazily, by
+ * select_idle_core() finding the core busy again.
+ */
+static inline struct sparsemask *llc_idle_cores(int cpu)
+{
+	struct sched_domain_shared *sds;
+
+	sds = rcu_dereference(per_cpu(sd_llc_shared, cpu));
+	return sds ? sds->cfs_idle_cores : NULL;
+}
+
+static inline void set_idle_core_elem(struct sparsemask *idle_cores, int core)
+{
+	sparsemask_set_elem(idle_cores, cpumask_first(cpu_smt_mask(core)));
+}
+
+static int select_idle_core_sparse(struct task_struct *p, struct sched_domain *sd,
+				   int target, struct sparsemask *idle_cores);
+#else
+static inline struct sparsemask *llc_idle_cores(int cpu)
+{
+	return NULL;
+}
+
+static inline void set_idle_core_elem(struct sparsemask *idle_cores, int core) {}
+
+static inline int select_idle_core_sparse(struct task_struct *p,
+					  struct sched_domain *sd, int target,
+					  struct sparsemask *idle_cores)
+{
+	return -1;
+}
+#endif
+
 /*
  * Scans the local SMT mask to see if the entire core is idle, and records this
  * information in sd_llc_shared->has_idle_cores.
@@ -6759,10 +6857,12 @@ static inline bool test_idle_cores(int cpu, bool def)
 void __update_idle_core(struct rq *rq)
 {
 	int core = cpu_of(rq);
+	struct sparsemask *idle_cores;
 	int cpu;
 
 	rcu_read_lock();
-	if (test_idle_cores(core, true))
+	idle_cores = llc_idle_cores(core);
+	if (!idle_cores && test_idle_cores(core, true))
 		goto unlock;
 
 	for_each_cpu(cpu, cpu_smt_mask(core)) {
@@ -6773,11 +6873,63 @@ void __update_idle_core(struct rq *rq)
 			goto unlock;
 	}
 
+	if (idle_cores)
+		set_idle_core_elem(idle_cores, core);
 	set_idle_cores(core, 1);
 unlock:
 	rcu_read_unlock();
 }
 
+#ifdef CONFIG_SCHED_STEAL
+/*
+ * Walk the idle core mask instead of the whole LLC span, the cost then
+ * depends on the number of idle cores rather than on the size of the LLC.
+ */
+static int select_idle_core_sparse(struct task_struct *p, struct sched_domain *sd,
+				   int target, struct sparsemask *idle_cores)
+{
+#ifdef CONFIG_QOS_SCHED_DYNAMIC_AFFINITY
+	struct cpumask *allowed = p->select_cpus;
+#else
+	struct cpumask *allowed = &p->cpus_allowed;
+#endif
+	bool found = false;
+	int core, cpu;
+
+	sparsemask_for_each(idle_cores, target, core) {
+		bool idle = cpumask_test_cpu(core, sched_domain_span(sd));
+		int idle_cpu = -1;
+
+		for_each_cpu(cpu, cpu_smt_mask(core)) {
+			if (!idle || !available_idle_cpu(cpu)) {
+				idle = false;
+				break;
+			}
+			if (idle_cpu < 0 && cpumask_test_cpu(cpu, allowed))
+				idle_cpu = cpu;
+		}
+
+		if (!idle) {
+			sparsemask_clear_elem(idle_cores, core);
+			continue;
+		}
+
+		if (idle_cpu >= 0)
+			return idle_cpu;
+		found = true;
+	}
+
+	/*
+	 * No idle core left, at least none this task cannot use; stop looking
+	 * for one.
+	 */
+	if (!found)
+		set_idle_cores(target, 0);
+
+	return -1;
+}
+#endif
+
 /*
  * Scan the entire LLC domain for idle cores; this dynamically switches off if
  * there are no idle cores left in the system; tracked through
@@ -6786,6 +6938,7 @@ void __update_idle_core(struct rq *rq)
 static int select_idle_core(struct task_struct *p, struct sched_domain *sd, int target)
 {
 	struct cpumask *cpus = this_cpu_cpumask_var_ptr(select_idle_mask);
+	struct sparsemask *idle_cores;
 	int core, cpu;
 
 	if (!static_branch_likely(&sched_smt_present))
@@ -6794,6 +6947,10 @@ static int select_idle_core(struct task_struct *p, struct sched_domain *sd, int
 	if (!test_idle_cores(target, false))
 		return -1;
 
+	idle_cores = llc_idle_cores(target);
+	if (idle_cores)
+		return select_idle_core_sparse(p, sd, target, idle_cores);
+
 #ifdef CONFIG_QOS_SCHED_DYNAMIC_AFFINITY
 	cpumask_and(cpus, sched_domain_span(sd), p->select_cpus);
 #else
@@ -6920,6 +7077,40 @@ static int select_idle_cpu(struct task_struct *p, struct sched_domain *sd, int t
 	return cpu;
 }
 
+#ifdef CONFIG_SCHED_CLUSTER
+/*
+ * Look for an idle CPU sharing the cluster cache tags with @target before
+ * scanning the rest of the LLC.  Clusters are a few cores wide, so scan
+ * them entirely.
+ */
+static int select_idle_cluster(struct task_struct *p, int target)
+{
+	struct sched_domain *sd = rcu_dereference(per_cpu(sd_cluster, target));
+	int cpu;
+
+	if (!sd)
+		return -1;
+
+	for_each_cpu_wrap(cpu, sched_domain_span(sd), target) {
+#ifdef CONFIG_QOS_SCHED_DYNAMIC_AFFINITY
+		if (!cpumask_test_cpu(cpu, p->select_cpus))
+#else
+		if (!cpumask_test_cpu(cpu, &p->cpus_allowed))
+#endif
+			continue;
+		if (available_idle_cpu(cpu) || sched_idle_cpu(cpu))
+			return cpu;
+	}
+
+	return -1;
+}
+#else
+static inline int select_idle_cluster(struct task_struct *p, int target)
+{
+	return -1;
+}
+#endif
+
 #ifdef CONFIG_SCHED_STEAL
 #define SET_STAT(STAT)							\
 	do {								\
@@ -6999,6 +7190,12 @@ static int select_idle_sibling(struct task_struct *p, int prev, int target)
 		return i;
 	}
 
+	i = select_idle_cluster(p, target);
+	if ((unsigned)i < nr_cpumask_bits) {
+		SET_STAT(found_idle_cpu);
+		return i;
+	}
+
 	i = select_idle_cpu(p, sd, target);
 	if ((unsigned)i < nr_cpumask_bits) {
 		SET_STAT(found_idle_cpu);
@@ -7581,6 +7778,15 @@ static void check_preempt_wakeup(struct rq *rq, struct task_struct *p, int wake_
 	if (test_tsk_need_resched(curr))
 		return;
 
+#ifdef CONFIG_QOS_SCHED
+	/* A higher qos_level preempts on wakeup, a lower one never does. */
+	if (unlikely(task_group(p)->qos_level != task_group(curr)->qos_level)) {
+		if (task_group(p)->qos_level > task_group(curr)->qos_level)
+			goto preempt;
+		return;
+	}
+#endif
+
 	/* Idle tasks are by definition preempted by non-idle tasks. */
 	if (unlikely(task_has_idle_policy(curr)) &&
 	    likely(!task_has_idle_policy(p)))
@@ -7629,6 +7835,23 @@ static void check_preempt_wakeup(struct rq *rq, struct task_struct *p, int wake_
 #ifdef CONFIG_QOS_SCHED
 static void start_qos_hrtimer(int cpu);
 
+static inline struct list_head *qos_throttled_list(int cpu, long qos_level)
+{
+	return &per_cpu(qos_throttled_cfs_rq, cpu)[qos_level - QOS_LEVEL_MIN];
+}
+
+static bool qos_throttled_empty(int cpu)
+{
+	long level;
+
+	for (level = QOS_LEVEL_MIN; level < QOS_LEVEL_ONLINE; level++) {
+		if (!list_empty(qos_throttled_list(cpu, level)))
+			return false;
+	}
+
+	return true;
+}
+
 static void throttle_qos_cfs_rq(struct cfs_rq *cfs_rq)
 {
 	struct rq *rq = rq_of(cfs_rq);
@@ -7666,13 +7889,13 @@ static void throttle_qos_cfs_rq(struct cfs_rq *cfs_rq)
 			overload_clear(rq);
 	}
 
-	if (list_empty(&per_cpu(qos_throttled_cfs_rq, cpu_of(rq))))
+	if (qos_throttled_empty(cpu_of(rq)))
 		start_qos_hrtimer(cpu_of(rq));
 
 	cfs_rq->throttled = QOS_THROTTLED;
 
 	list_add(&cfs_rq->qos_throttled_list,
-		 &per_cpu(qos_throttled_cfs_rq, cpu_of(rq)));
+		 qos_throttled_list(cpu_of(rq), cfs_rq->tg->qos_level));
 }
 
 static void unthrottle_qos_cfs_rq(struct cfs_rq *cfs_rq)
@@ -7735,12 +7958,12 @@ static void unthrottle_qos_cfs_rq(struct cfs_rq *cfs_rq)
 		resched_curr(rq);
 }
 
-static int __unthrottle_qos_cfs_rqs(int cpu)
+static int __unthrottle_qos_level(int cpu, long qos_level)
 {
 	struct cfs_rq *cfs_rq, *tmp_rq;
 	int res = 0;
 
-	list_for_each_entry_safe(cfs_rq, tmp_rq, &per_cpu(qos_throttled_cfs_rq, cpu),
+	list_for_each_entry_safe(cfs_rq, tmp_rq, qos_throttled_list(cpu, qos_level),
 				 qos_throttled_list) {
 		if (cfs_rq_throttled(cfs_rq)) {
 			unthrottle_qos_cfs_rq(cfs_rq);
@@ -7751,26 +7974,208 @@ static int __unthrottle_qos_cfs_rqs(int cpu)
 	return res;
 }
 
+static int __unthrottle_qos_cfs_rqs(int cpu)
+{
+	long level;
+	int res = 0;
+
+	for (level = QOS_LEVEL_MIN; level < QOS_LEVEL_ONLINE; level++)
+		res += __unthrottle_qos_level(cpu, level);
+
+	return res;
+}
+
+/*
+ * The CPU is about to go idle: let the highest throttled offline tier run,
+ * lower ones stay throttled until it has nothing left to run either.
+ */
 static int unthrottle_qos_cfs_rqs(int cpu)
 {
-	int res;
+	long level;
+	int res = 0;
+
+	for (level = QOS_LEVEL_ONLINE - 1; level >= QOS_LEVEL_MIN && !res; level--)
+		res = __unthrottle_qos_level(cpu, level);
 
-	res = __unthrottle_qos_cfs_rqs(cpu);
-	if (res)
+	if (res && qos_throttled_empty(cpu))
 		hrtimer_cancel(&(per_cpu(qos_overload_timer, cpu)));
 
 	return res;
 }
 
+#define QOS_PRESSURE_SHIFT	10
+#define QOS_PRESSURE_EWMA_SHIFT	3
+
+/*
+ * With no threshold set, offline tasks are throttled whenever online
+ * tasks are runnable.  Otherwise they are only throttled while the online
+ * tasks actually wait for the CPU, and left to CFS (and to the wakeup
+ * preemption of SCHED_IDLE) when they don't.
+ */
+static bool qos_online_pressure_high(void)
+{
+	unsigned int threshold = READ_ONCE(sysctl_qos_online_pressure_threshold);
+
+	if (!threshold)
+		return true;
+
+	return __this_cpu_read(qos_online_pressure) * 100 >=
+	       threshold << QOS_PRESSURE_SHIFT;
+}
+
+/*
+ * Sampled every tick: the share of ticks during which at least one online
+ * task was runnable but not running, decayed by 1/8 per tick.
+ */
+static void qos_update_online_pressure(struct rq *rq, struct task_struct *curr)
+{
+	unsigned int nr_online = rq->cfs.h_nr_running - rq->cfs.idle_h_nr_running;
+	unsigned int pressure = __this_cpu_read(qos_online_pressure);
+	unsigned int sample = 0;
+
+	if (curr->sched_class == &fair_sched_class && !task_has_idle_policy(curr))
+		nr_online--;
+	if ((int)nr_online > 0)
+		sample = 1 << QOS_PRESSURE_SHIFT;
+
+	pressure += ((int)sample - (int)pressure) >> QOS_PRESSURE_EWMA_SHIFT;
+	__this_cpu_write(qos_online_pressure, pressure);
+
+	/*
+	 * The online tasks stopped waiting for the CPU: no point in keeping
+	 * the offline ones out until the CPU goes idle.
+	 */
+	if (unlikely(__this_cpu_read(qos_cpu_overload)) &&
+	    !qos_online_pressure_high())
+		__this_cpu_write(qos_cpu_overload, 0);
+}
+
+#ifdef CONFIG_QOS_SCHED_SMT_EXPELLER
+static bool qos_smt_siblings_online(int this_cpu)
+{
+	int cpu;
+
+	if (!sched_smt_active())
+		return false;
+
+	for_each_cpu(cpu, cpu_smt_mask(this_cpu)) {
+		if (cpu != this_cpu && READ_ONCE(per_cpu(qos_smt_online, cpu)))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * An online task runs on a sibling of this CPU: offline tasks here are
+ * throttled like when online tasks are runnable locally, and the overload
+ * timer still lets them out if this lasts for a whole detect period.
+ */
+static bool qos_smt_expelled(int this_cpu)
+{
+	if (unlikely(per_cpu(qos_cpu_overload, this_cpu)))
+		return false;
+
+	return qos_smt_siblings_online(this_cpu);
+}
+
+static bool qos_smt_need_resched(struct task_struct *curr, int this_cpu)
+{
+	if (qos_smt_expelled(this_cpu))
+		return curr->sched_class == &fair_sched_class &&
+		       qos_level_offline(task_group(curr)->qos_level);
+
+	/* the siblings stopped running online tasks, pick the offline ones */
+	return is_idle_task(curr) && !qos_throttled_empty(this_cpu);
+}
+
+/*
+ * Called from the scheduler IPI sent by qos_smt_update_status() of a
+ * sibling, which cannot take our rq->lock.
+ */
+void qos_smt_check_need_resched(void)
+{
+	if (test_tsk_need_resched(current))
+		return;
+
+	if (qos_smt_need_resched(current, smp_processor_id())) {
+		set_tsk_need_resched(current);
+		set_preempt_need_resched();
+	}
+}
+
+/*
+ * Record whether @p, the task this CPU is about to run, is online and kick
+ * the siblings on a change: the ones running offline tasks have to throttle
+ * them, the idle ones holding throttled offline tasks may run them again.
+ * Called by __schedule() for whatever class @p was picked from, so that
+ * switching to an RT task or to idle is seen as well.
+ */
+void qos_smt_update_status(struct rq *rq, struct task_struct *p)
+{
+	int this_cpu = cpu_of(rq), cpu;
+	bool online = !is_idle_task(p) && !task_has_idle_policy(p) &&
+		      !qos_level_offline(task_group(p)->qos_level);
+
+	if (__this_cpu_read(qos_smt_online) == online)
+		return;
+
+	__this_cpu_write(qos_smt_online, online);
+
+	if (!sched_smt_active())
+		return;
+
+	for_each_cpu(cpu, cpu_smt_mask(this_cpu)) {
+		struct rq *srq = cpu_rq(cpu);
+
+		if (cpu == this_cpu)
+			continue;
+
+		if (online ? READ_ONCE(srq->cfs.idle_h_nr_running) :
+		    !qos_throttled_empty(cpu))
+			smp_send_reschedule(cpu);
+	}
+}
+#else
+static inline bool qos_smt_expelled(int this_cpu)
+{
+	return false;
+}
+
+static inline bool qos_smt_need_resched(struct task_struct *curr,
+					int this_cpu)
+{
+	return false;
+}
+#endif
+
+/*
+ * Best effort groups are throttled while online tasks are runnable and put
+ * enough pressure on the CPU, scavengers whenever online tasks are runnable.
+ */
+static bool qos_throttle_needed(struct cfs_rq *cfs_rq, int cpu)
+{
+	if (qos_smt_expelled(cpu))
+		return true;
+
+	if (sched_idle_cpu(cpu))
+		return false;
+
+	return cfs_rq->tg->qos_level == QOS_LEVEL_SCAVENGER ||
+	       qos_online_pressure_high();
+}
+
 static bool check_qos_cfs_rq(struct cfs_rq *cfs_rq)
 {
+	int cpu = smp_processor_id();
+
 	if (unlikely(__this_cpu_read(qos_cpu_overload))) {
 		return false;
 	}
 
-	if (unlikely(cfs_rq && cfs_rq->tg->qos_level < 0 &&
-		!sched_idle_cpu(smp_processor_id()) &&
-		cfs_rq->h_nr_running == cfs_rq->idle_h_nr_running)) {
+	if (unlikely(cfs_rq && qos_level_offline(cfs_rq->tg->qos_level) &&
+		cfs_rq->h_nr_running == cfs_rq->idle_h_nr_running &&
+		qos_throttle_needed(cfs_rq, cpu))) {
 
 		if (!rq_of(cfs_rq)->online)
 			return false;
@@ -7791,7 +8196,7 @@ void sched_qos_offline_wait(void)
 		rcu_read_lock();
 		qos_level = task_group(current)->qos_level;
 		rcu_read_unlock();
-		if (qos_level != -1 || fatal_signal_pending(current))
+		if (!qos_level_offline(qos_level) || fatal_signal_pending(current))
 			break;
 
 		wait_interval = msecs_to_jiffies(sysctl_offline_wait_interval);
@@ -7805,7 +8210,13 @@ static enum hrtimer_restart qos_overload_timer_handler(struct hrtimer *timer)
 	struct rq *rq = this_rq();
 
 	rq_lock_irqsave(rq, &rf);
-	if (__unthrottle_qos_cfs_rqs(smp_processor_id()))
+	/*
+	 * Offline tasks were kept out for a whole detect period.  Let them
+	 * leave the kernel, but only declare the CPU overloaded if online
+	 * tasks are still waiting for it.
+	 */
+	if (__unthrottle_qos_cfs_rqs(smp_processor_id()) &&
+	    qos_online_pressure_high())
 		__this_cpu_write(qos_cpu_overload, 1);
 	rq_unlock_irqrestore(rq, &rf);
 
@@ -7841,7 +8252,7 @@ static void qos_schedule_throttle(struct task_struct *p)
 		return;
 
 	if (unlikely(this_cpu_read(qos_cpu_overload))) {
-		if (task_group(p)->qos_level < 0)
+		if (qos_level_offline(task_group(p)->qos_level))
 			set_notify_resume(p);
 	}
 }
@@ -7909,7 +8320,8 @@ pick_next_task_fair(struct rq *rq, struct task_struct *prev, struct rq_flags *rf
 #ifdef CONFIG_QOS_SCHED
 		if (check_qos_cfs_rq(cfs_rq)) {
 			cfs_rq = &rq->cfs;
-			WARN(cfs_rq->nr_running == 0,
+			WARN(cfs_rq->nr_running == 0 &&
+			     !qos_smt_expelled(cpu_of(rq)),
 			     "rq->nr_running=%u, cfs_rq->idle_h_nr_running=%u\n",
 			     rq->nr_running, cfs_rq->idle_h_nr_running);
 			if (unlikely(!cfs_rq->nr_running))
@@ -7989,10 +8401,15 @@ done: __maybe_unused;
 	 */
 	rq_idle_stamp_update(rq);
 
-	new_tasks = idle_balance(rq, rf);
-
-	if (new_tasks == 0)
+	if (steal_first()) {
 		new_tasks = try_steal(rq, rf);
+		if (new_tasks == 0)
+			new_tasks = idle_balance(rq, rf);
+	} else {
+		new_tasks = idle_balance(rq, rf);
+		if (new_tasks == 0)
+			new_tasks = try_steal(rq, rf);
+	}
 	schedstat_end_time(rq, time);
 
 	if (new_tasks)
@@ -8010,7 +8427,9 @@ done: __maybe_unused;
 		goto again;
 
 #ifdef CONFIG_QOS_SCHED
-	if (unthrottle_qos_cfs_rqs(cpu_of(rq))) {
+	/* offline tasks expelled by a sibling stay throttled until it kicks us */
+	if (!qos_smt_expelled(cpu_of(rq)) &&
+	    unthrottle_qos_cfs_rqs(cpu_of(rq))) {
 		rq->idle_stamp = 0;
 		goto again;
 	}
@@ -11158,6 +11577,14 @@ static void task_tick_fair(struct rq *rq, struct task_struct *curr, int queued)
 
 	if (static_branch_unlikely(&sched_numa_balancing))
 		task_tick_numa(rq, curr);
+
+#ifdef CONFIG_QOS_SCHED
+	qos_update_online_pressure(rq, curr);
+
+	/* offline tasks that got here while a sibling runs online ones */
+	if (qos_smt_need_resched(curr, cpu_of(rq)))
+		resched_curr(rq);
+#endif
 }
 
 /*
@@ -11428,7 +11855,7 @@ static inline void unthrottle_qos_sched_group(struct cfs_rq *cfs_rq)
 	struct rq_flags rf;
 
 	rq_lock_irqsave(rq, &rf);
-	if (cfs_rq->tg->qos_level == -1 && cfs_rq_throttled(cfs_rq))
+	if (qos_level_offline(cfs_rq->tg->qos_level) && cfs_rq_throttled(cfs_rq))
 		unthrottle_qos_cfs_rq(cfs_rq);
 	rq_unlock_irqrestore(rq, &rf);
 }
@@ -11726,10 +12153,11 @@ void show_numa_stats(struct task_struct *p, struct seq_file *m)
 __init void init_sched_fair_class(void)
 {
 #ifdef CONFIG_QOS_SCHED
-	int i;
+	int i, j;
 
 	for_each_possible_cpu(i) {
-		INIT_LIST_HEAD(&per_cpu(qos_throttled_cfs_rq, i));
+		for (j = 0; j < QOS_OFFLINE_LEVELS; j++)
+			INIT_LIST_HEAD(&per_cpu(qos_throttled_cfs_rq, i)[j]);
 	}
 #endif
 
@@ -64,6 +64,12 @@ SCHED_FEAT(SIS_PROP, true)
  * Improves CPU utilization.
  */
 SCHED_FEAT(STEAL, false)
+
+/*
+ * Try the cheap steal before the idle_balance() domain walk, and skip the
+ * walk when it found a task.
+ */
+SCHED_FEAT(STEAL_FIRST, false)
 #endif
 
 /*
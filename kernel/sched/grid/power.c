@@ -16,12 +16,59 @@
  * more details.
  *
  */
+#include <linux/jiffies.h>
+#include <linux/percpu.h>
 #include <linux/sched/grid_qos.h>
+#include <linux/sched/sysctl.h>
 #include "internal.h"
 
+/* utilization floor of the hot zone CPUs, in percent of their capacity */
+int sysctl_sched_grid_hot_util_min_pct;
+/* utilization scale of the warm zone CPUs, in percent */
+int sysctl_sched_grid_warm_util_pct = 100;
+
+/*
+ * A CPU is in the hot zone while it belongs to the preferred domain of a
+ * smart grid group, the warm zone are the CPUs none of them currently use.
+ */
+static DEFINE_PER_CPU(unsigned long, grid_hot_expires);
+
 void qos_power_init(struct sched_grid_qos_power *power)
 {
 	power->cpufreq_sense_ratio = 0;
 	power->target_cpufreq = 0;
 	power->cstate_sense_ratio = 0;
 }
+
+/*
+ * Called by the auto affinity period timer of each group for its current
+ * domain.  The mark expires on its own, so CPUs leave the hot zone when no
+ * group renews it, e.g. after the groups shrank or stopped auto affinity.
+ */
+void sched_grid_zone_mark_hot(const struct cpumask *span, unsigned long expires)
+{
+	int cpu;
+
+	for_each_cpu(cpu, span) {
+		if (time_after(expires, READ_ONCE(per_cpu(grid_hot_expires, cpu))))
+			WRITE_ONCE(per_cpu(grid_hot_expires, cpu), expires);
+	}
+}
+
+bool sched_grid_zone_hot(int cpu)
+{
+	return time_before(jiffies, READ_ONCE(per_cpu(grid_hot_expires, cpu)));
+}
+
+/*
+ * Frequency hint for schedutil: boost the CPUs running the preferred
+ * domains, let the lightly loaded ones around them run slower.
+ */
+unsigned long sched_grid_zone_util(int cpu, unsigned long util,
+				   unsigned long max)
+{
+	if (sched_grid_zone_hot(cpu))
+		return max(util, max * sysctl_sched_grid_hot_util_min_pct / 100);
+
+	return util * sysctl_sched_grid_warm_util_pct / 100;
+}
@@ -58,6 +58,7 @@ int sched_grid_qos_fork(struct task_struct *p, struct task_struct *orig)
 	qos_stat_init(&qos->stat);
 
 	nodes_clear(qos->affinity.mem_preferred_node_mask);
+	qos->affinity.preferred_nid = NUMA_NO_NODE;
 	if (likely(orig->_resvd->grid_qos))
 		qos->affinity = orig->_resvd->grid_qos->affinity;
 	qos->affinity_set = qos_affinity_set;
@@ -66,6 +67,14 @@ int sched_grid_qos_fork(struct task_struct *p, struct task_struct *orig)
 	return 0;
 }
 
+void sched_grid_set_preferred_nid(struct task_struct *p, int nid)
+{
+	struct sched_grid_qos *qos = p->_resvd->grid_qos;
+
+	if (likely(qos))
+		WRITE_ONCE(qos->affinity.preferred_nid, nid);
+}
+
 void sched_grid_qos_free(struct task_struct *p)
 {
 	kfree(p->_resvd->grid_qos);
@@ -53,6 +53,7 @@
 #include <linux/mmu_context.h>
 #include <linux/nmi.h>
 #include <linux/proc_fs.h>
+#include <linux/psi.h>
 #include <linux/prefetch.h>
 #include <linux/profile.h>
 #include <linux/rcupdate_wait.h>
@@ -369,6 +370,8 @@ struct affinity_domain {
 	int			dcount;
 	int			curr_level;
 	u32			domain_mask;
+	/* utilization of the current domain, averaged over the periods */
+	unsigned long		util_avg;
 #ifdef CONFIG_SCHEDSTATS
 	u64			stay_cnt[AD_LEVEL_MAX];
 #endif
@@ -386,9 +389,34 @@ struct auto_affinity {
 	int			period_active;
 	struct affinity_domain	ad;
 	struct task_group	*tg;
+	/* node the tasks and memory of the group should live on */
+	int			preferred_nid;
 #endif
 };
 
+#ifdef CONFIG_QOS_SCHED
+/*
+ * cpu cgroup qos_level tiers.  The offline ones run as SCHED_IDLE and are
+ * throttled while the online ones are runnable, scavengers also yield to
+ * best effort tasks.  A waking task preempts the tasks of lower tiers.
+ */
+enum task_qos_level {
+	QOS_LEVEL_SCAVENGER = -2,
+	QOS_LEVEL_OFFLINE = -1,		/* best effort */
+	QOS_LEVEL_ONLINE = 0,
+	QOS_LEVEL_HIGH = 1,		/* latency critical */
+};
+
+#define QOS_LEVEL_MIN		QOS_LEVEL_SCAVENGER
+#define QOS_LEVEL_MAX		QOS_LEVEL_HIGH
+#define QOS_OFFLINE_LEVELS	(QOS_LEVEL_ONLINE - QOS_LEVEL_MIN)
+
+static inline bool qos_level_offline(long qos_level)
+{
+	return qos_level < QOS_LEVEL_ONLINE;
+}
+#endif
+
 /* Task group related information */
 struct task_group {
 	struct cgroup_subsys_state css;
@@ -1051,6 +1079,15 @@ static inline int cpu_of(struct rq *rq)
 void init_qos_hrtimer(int cpu);
 #endif
 
+#ifdef CONFIG_QOS_SCHED_SMT_EXPELLER
+void qos_smt_check_need_resched(void);
+void qos_smt_update_status(struct rq *rq, struct task_struct *p);
+#else
+static inline void qos_smt_check_need_resched(void) { }
+static inline void qos_smt_update_status(struct rq *rq,
+					 struct task_struct *p) { }
+#endif
+
 #ifdef CONFIG_SCHED_SMT
 extern void __update_idle_core(struct rq *rq);
 
@@ -1310,6 +1347,7 @@ DECLARE_PER_CPU(int, sd_llc_id);
 DECLARE_PER_CPU(struct sched_domain_shared *, sd_llc_shared);
 DECLARE_PER_CPU(struct sched_domain *, sd_numa);
 DECLARE_PER_CPU(struct sched_domain *, sd_asym);
+DECLARE_PER_CPU(struct sched_domain *, sd_cluster);
 
 struct sched_group_capacity {
 	atomic_t		ref;
@@ -1977,6 +2015,18 @@ rq_unlock_irq(struct rq *rq, struct rq_flags *rf)
 	raw_spin_unlock_irq(&rq->lock);
 }
 
+static inline struct rq *
+this_rq_lock_irq(struct rq_flags *rf)
+	__acquires(rq->lock)
+{
+	struct rq *rq;
+
+	local_irq_disable();
+	rq = this_rq();
+	rq_lock(rq, rf);
+	return rq;
+}
+
 static inline void
 rq_unlock(struct rq *rq, struct rq_flags *rf)
 	__releases(rq->lock)
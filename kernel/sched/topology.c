@@ -173,7 +173,8 @@ static int sd_degenerate(struct sched_domain *sd)
 			 SD_SHARE_CPUCAPACITY |
 			 SD_ASYM_CPUCAPACITY |
 			 SD_SHARE_PKG_RESOURCES |
-			 SD_SHARE_POWERDOMAIN)) {
+			 SD_SHARE_POWERDOMAIN |
+			 SD_CLUSTER)) {
 		if (sd->groups != sd->groups->next)
 			return 0;
 	}
@@ -206,7 +207,8 @@ sd_parent_degenerate(struct sched_domain *sd, struct sched_domain *parent)
 				SD_SHARE_CPUCAPACITY |
 				SD_SHARE_PKG_RESOURCES |
 				SD_PREFER_SIBLING |
-				SD_SHARE_POWERDOMAIN);
+				SD_SHARE_POWERDOMAIN |
+				SD_CLUSTER);
 		if (nr_node_ids == 1)
 			pflags &= ~SD_SERIALIZE;
 	}
@@ -415,6 +417,7 @@ DEFINE_PER_CPU(int, sd_llc_id);
 DEFINE_PER_CPU(struct sched_domain_shared *, sd_llc_shared);
 DEFINE_PER_CPU(struct sched_domain *, sd_numa);
 DEFINE_PER_CPU(struct sched_domain *, sd_asym);
+DEFINE_PER_CPU(struct sched_domain *, sd_cluster);
 
 static void update_top_cache_domain(int cpu)
 {
@@ -450,6 +453,9 @@ static void update_top_cache_domain(int cpu)
 
 	sd = highest_flag_domain(cpu, SD_ASYM_PACKING);
 	rcu_assign_pointer(per_cpu(sd_asym, cpu), sd);
+
+	sd = lowest_flag_domain(cpu, SD_CLUSTER);
+	rcu_assign_pointer(per_cpu(sd_cluster, cpu), sd);
 }
 
 /*
@@ -852,6 +858,7 @@ build_overlap_sched_groups(struct sched_domain *sd, int cpu)
  * topology features. By default (default_topology[]) these include:
  *
  *  - Simultaneous multithreading (SMT)
+ *  - Cluster of cores sharing L2 or L3 cache tags (CLS)
  *  - Multi-Core Cache (MC)
  *  - Package (DIE)
  *
@@ -1166,7 +1173,8 @@ static struct cpumask		***sched_domains_numa_masks;
 	 SD_NUMA		|	\
 	 SD_ASYM_PACKING	|	\
 	 SD_ASYM_CPUCAPACITY	|	\
-	 SD_SHARE_POWERDOMAIN)
+	 SD_SHARE_POWERDOMAIN	|	\
+	 SD_CLUSTER)
 
 static struct sched_domain *
 sd_init(struct sched_domain_topology_level *tl,
@@ -1298,6 +1306,9 @@ static struct sched_domain_topology_level default_topology[] = {
 #ifdef CONFIG_SCHED_SMT
 	{ cpu_smt_mask, cpu_smt_flags, SD_INIT_NAME(SMT) },
 #endif
+#ifdef CONFIG_SCHED_CLUSTER
+	{ cpu_clustergroup_mask, cpu_cluster_flags, SD_INIT_NAME(CLS) },
+#endif
 #ifdef CONFIG_SCHED_MC
 	{ cpu_coregroup_mask, cpu_core_flags, SD_INIT_NAME(MC) },
 #endif
@@ -1740,6 +1751,13 @@ static int sd_llc_alloc(struct sched_domain *sd)
 		sds->cfs_overload_cpus = mask;
 	}
 
+	if (!sds->cfs_idle_cores) {
+		mask = sparsemask_alloc_node(nr_cpu_ids, 3, flags, nid);
+		if (!mask)
+			return 1;
+		sds->cfs_idle_cores = mask;
+	}
+
 	return 0;
 }
 
@@ -1752,6 +1770,8 @@ static void sd_llc_free(struct sched_domain *sd)
 
 	sparsemask_free(sds->cfs_overload_cpus);
 	sds->cfs_overload_cpus = NULL;
+	sparsemask_free(sds->cfs_idle_cores);
+	sds->cfs_idle_cores = NULL;
 }
 
 static int sd_llc_alloc_all(const struct cpumask *cpu_map, struct s_data *d)
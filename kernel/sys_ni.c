@@ -139,6 +139,7 @@ COND_SYSCALL(capset);
 /* kernel/futex.c */
 COND_SYSCALL(futex);
 COND_SYSCALL_COMPAT(futex);
+COND_SYSCALL(futex_waitv);
 COND_SYSCALL(set_robust_list);
 COND_SYSCALL_COMPAT(set_robust_list);
 COND_SYSCALL(get_robust_list);
@@ -1265,7 +1265,7 @@ static struct ctl_table kern_table[] = {
 		.mode		= 0644,
 		.proc_handler	= timer_migration_handler,
 		.extra1		= &zero,
-		.extra2		= &one,
+		.extra2		= &two,
 	},
 #endif
 #ifdef CONFIG_BPF_SYSCALL
@@ -1330,6 +1330,15 @@ static struct ctl_table kern_table[] = {
 		.extra1		= &one_hundred,
 		.extra2		= &one_thousand,
 	},
+	{
+		.procname	= "qos_online_pressure_threshold",
+		.data		= &sysctl_qos_online_pressure_threshold,
+		.maxlen		= sizeof(unsigned int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one_hundred,
+	},
 #endif
 #ifdef CONFIG_QOS_SCHED_DYNAMIC_AFFINITY
 	{
@@ -1352,6 +1361,24 @@ static struct ctl_table kern_table[] = {
 		.extra1         = &zero,
 		.extra2		= &hundred_thousand,
 	},
+	{
+		.procname	= "sched_grid_hot_util_min_pct",
+		.data		= &sysctl_sched_grid_hot_util_min_pct,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one_hundred,
+	},
+	{
+		.procname	= "sched_grid_warm_util_pct",
+		.data		= &sysctl_sched_grid_warm_util_pct,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &one,
+		.extra2		= &one_hundred,
+	},
 #endif
 	{ }
 };
@@ -1638,6 +1665,15 @@ static struct ctl_table vm_table[] = {
 		.extra1		= &zero,
 		.extra2		= &one,
 	},
+	{
+		.procname	= "compaction_proactiveness",
+		.data		= &sysctl_compaction_proactiveness,
+		.maxlen		= sizeof(sysctl_compaction_proactiveness),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one_hundred,
+	},
 
 #endif /* CONFIG_COMPACTION */
 	{
@@ -1674,6 +1710,22 @@ static struct ctl_table vm_table[] = {
 		.proc_handler	= proc_dointvec_minmax,
 		.extra1		= &zero,
 	},
+#ifdef CONFIG_KTASK
+	{
+		.procname	= "exit_unmap_parallel_mb",
+		.data		= &sysctl_exit_unmap_parallel_mb,
+		.maxlen		= sizeof(sysctl_exit_unmap_parallel_mb),
+		.mode		= 0644,
+		.proc_handler	= proc_doulongvec_minmax,
+	},
+	{
+		.procname	= "fork_copy_parallel_mb",
+		.data		= &sysctl_fork_copy_parallel_mb,
+		.maxlen		= sizeof(sysctl_fork_copy_parallel_mb),
+		.mode		= 0644,
+		.proc_handler	= proc_doulongvec_minmax,
+	},
+#endif
 #else
 	{
 		.procname	= "nr_trim_pages",
@@ -1927,6 +1979,15 @@ static struct ctl_table vm_table[] = {
 		.extra1		= &zero,
 		.extra2		= &ten_thousand,
 	},
+	{
+		.procname	= "sharepool_lock_stat",
+		.data		= &sysctl_sp_lock_stat,
+		.maxlen		= sizeof(sysctl_sp_lock_stat),
+		.mode		= 0600,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
 #endif
 	{ }
 };
@@ -1978,6 +2039,13 @@ static struct ctl_table fs_table[] = {
 		.mode		= 0444,
 		.proc_handler	= proc_nr_dentry,
 	},
+	{
+		.procname	= "negative-dentry-limit",
+		.data		= &sysctl_negative_dentry_limit,
+		.maxlen		= sizeof(sysctl_negative_dentry_limit),
+		.mode		= 0644,
+		.proc_handler	= proc_doulongvec_minmax,
+	},
 	{
 		.procname	= "overflowuid",
 		.data		= &fs_overflowuid,
@@ -195,6 +195,16 @@ EXPORT_SYMBOL(jiffies_64);
 # define BASE_DEF	0
 #endif
 
+/*
+ * Expired timers are detached from the wheel in batches of up to
+ * EXPIRY_BATCH timers and their callbacks are invoked without dropping and
+ * retaking base->lock for each of them. A timer sitting in the batch is
+ * treated as running: del_timer_sync() waits for it and it is not
+ * migrated to another base until its callback has returned. See
+ * expire_timers().
+ */
+#define EXPIRY_BATCH	16
+
 struct timer_base {
 	raw_spinlock_t		lock;
 	struct timer_list	*running_timer;
@@ -203,6 +213,9 @@ struct timer_base {
 	unsigned int		cpu;
 	bool			is_idle;
 	bool			must_forward_clk;
+	unsigned int		nr_expiring;
+	unsigned int		cur_expiring;
+	struct timer_list	*expiring[EXPIRY_BATCH];
 	DECLARE_BITMAP(pending_map, WHEEL_SIZE);
 	struct hlist_head	vectors[WHEEL_SIZE];
 } ____cacheline_aligned;
@@ -829,13 +842,75 @@ static inline void detach_timer(struct timer_list *timer, bool clear_pending)
 	entry->next = LIST_POISON2;
 }
 
+/*
+ * Return the slot of @timer in the expiry batch of @base, -1 if it is
+ * neither waiting in the batch nor running. Called with base->lock held.
+ */
+static int timer_expiring_slot(struct timer_base *base,
+			       struct timer_list *timer)
+{
+	unsigned int i;
+
+	for (i = 0; i < base->nr_expiring; i++) {
+		if (smp_load_acquire(&base->expiring[i]) == timer)
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * The expiry batch of @base is run on this CPU and we are called either
+ * from a callback of the batch or from an interrupt which preempted it.
+ * Without batching, timers after the current one would still be pending,
+ * so they must behave that way here as well.
+ */
+static bool timer_batch_is_local(struct timer_base *base)
+{
+	return base->nr_expiring && base->cpu == smp_processor_id();
+}
+
+/*
+ * Whether the callback of @timer may be running, or will run without
+ * further notice. Called with base->lock held.
+ */
+static bool timer_is_running(struct timer_base *base, struct timer_list *timer)
+{
+	int slot = timer_expiring_slot(base, timer);
+
+	if (slot < 0)
+		return false;
+	return !timer_batch_is_local(base) || slot <= base->cur_expiring;
+}
+
+/*
+ * Cancel @timer if it waits in the expiry batch being run on this CPU.
+ * Called with base->lock held.
+ */
+static int cancel_expiring_timer(struct timer_list *timer,
+				 struct timer_base *base)
+{
+	int slot;
+
+	if (!timer_batch_is_local(base))
+		return 0;
+
+	slot = timer_expiring_slot(base, timer);
+	if (slot <= (int)base->cur_expiring)
+		return 0;
+
+	base->expiring[slot] = NULL;
+	return 1;
+}
+
 static int detach_if_pending(struct timer_list *timer, struct timer_base *base,
 			     bool clear_pending)
 {
 	unsigned idx = timer_get_idx(timer);
+	int ret;
 
+	ret = cancel_expiring_timer(timer, base);
 	if (!timer_pending(timer))
-		return 0;
+		return ret;
 
 	if (hlist_is_singular_node(&timer->entry, base->vectors + idx))
 		__clear_bit(idx, base->pending_map);
@@ -875,13 +950,58 @@ static inline struct timer_base *get_timer_base(u32 tflags)
 	return get_timer_cpu_base(tflags, tflags & TIMER_CPUMASK);
 }
 
+/*
+ * Lockless hint whether @timer may wait in an expiry batch run on this
+ * CPU. Only then del_timer() has to look at a timer which isn't pending.
+ */
+static inline bool timer_maybe_expiring(struct timer_list *timer)
+{
+	u32 tflags = READ_ONCE(timer->flags);
+	struct timer_base *base;
+
+	if ((tflags & TIMER_CPUMASK) != raw_smp_processor_id())
+		return false;
+	base = get_timer_base(tflags);
+	return READ_ONCE(base->nr_expiring);
+}
+
+#if defined(CONFIG_SMP) && defined(CONFIG_NO_HZ_COMMON)
+/*
+ * Pick the CPU to queue a timer expiring at @expires on. Moving a timer
+ * away from an idle CPU only pays off if it saves that CPU a wakeup. When
+ * the CPU is predicted to wake up before @expires anyway for the timers it
+ * already has queued, keep the new timer local. With timer_migration set
+ * to TIMER_MIGRATION_NODE the timer also stays local instead of moving to
+ * a CPU on another node.
+ */
+static int timer_migration_target(unsigned long expires)
+{
+	struct timer_base *base = this_cpu_ptr(&timer_bases[BASE_STD]);
+	int this_cpu = smp_processor_id();
+	int cpu;
+
+	if (READ_ONCE(base->is_idle) &&
+	    time_before_eq(READ_ONCE(base->next_expiry), expires))
+		return this_cpu;
+
+	cpu = get_nohz_timer_target();
+	if (READ_ONCE(sysctl_timer_migration) == TIMER_MIGRATION_NODE &&
+	    cpu_to_node(cpu) != cpu_to_node(this_cpu))
+		return this_cpu;
+
+	return cpu;
+}
+#endif
+
 static inline struct timer_base *
-get_target_base(struct timer_base *base, unsigned tflags)
+get_target_base(struct timer_base *base, unsigned tflags,
+		unsigned long expires)
 {
 #if defined(CONFIG_SMP) && defined(CONFIG_NO_HZ_COMMON)
 	if (static_branch_likely(&timers_migration_enabled) &&
 	    !(tflags & TIMER_PINNED))
-		return get_timer_cpu_base(tflags, get_nohz_timer_target());
+		return get_timer_cpu_base(tflags,
+					  timer_migration_target(expires));
 #endif
 	return get_timer_this_cpu_base(tflags);
 }
@@ -1028,17 +1148,18 @@ __mod_timer(struct timer_list *timer, unsigned long expires, unsigned int option
 	if (!ret && (options & MOD_TIMER_PENDING_ONLY))
 		goto out_unlock;
 
-	new_base = get_target_base(base, timer->flags);
+	new_base = get_target_base(base, timer->flags, expires);
 
 	if (base != new_base) {
 		/*
 		 * We are trying to schedule the timer on the new base.
-		 * However we can't change timer's base while it is running,
-		 * otherwise del_timer_sync() can't detect that the timer's
-		 * handler yet has not finished. This also guarantees that the
-		 * timer is serialized wrt itself.
+		 * However we can't change timer's base while it is running
+		 * or waiting in an expiry batch, otherwise del_timer_sync()
+		 * can't detect that the timer's handler yet has not finished.
+		 * This also guarantees that the timer is serialized wrt
+		 * itself.
 		 */
-		if (likely(base->running_timer != timer)) {
+		if (likely(!timer_is_running(base, timer))) {
 			/* See the comment in lock_timer_base() */
 			timer->flags |= TIMER_MIGRATING;
 
@@ -1210,7 +1331,7 @@ int del_timer(struct timer_list *timer)
 
 	debug_assert_init(timer);
 
-	if (timer_pending(timer)) {
+	if (timer_pending(timer) || timer_maybe_expiring(timer)) {
 		base = lock_timer_base(timer, &flags);
 		ret = detach_if_pending(timer, base, true);
 		raw_spin_unlock_irqrestore(&base->lock, flags);
@@ -1237,7 +1358,7 @@ int try_to_del_timer_sync(struct timer_list *timer)
 
 	base = lock_timer_base(timer, &flags);
 
-	if (base->running_timer != timer)
+	if (!timer_is_running(base, timer))
 		ret = detach_if_pending(timer, base, true);
 
 	raw_spin_unlock_irqrestore(&base->lock, flags);
@@ -1354,28 +1475,66 @@ static void call_timer_fn(struct timer_list *timer, void (*fn)(struct timer_list
 	}
 }
 
-static void expire_timers(struct timer_base *base, struct hlist_head *head)
+/*
+ * Run the callbacks of the current expiry batch. Called and returns with
+ * interrupts enabled and base->lock not held.
+ *
+ * A slot is only cleared once the callback has returned, which is what
+ * try_to_del_timer_sync() and __mod_timer() look at. Slots after the
+ * current one may be cleared by try_to_del_timer_sync() on this CPU,
+ * from a callback of the batch or an interrupt, so they are read with
+ * interrupts disabled.
+ */
+static void run_expiry_batch(struct timer_base *base)
 {
-	while (!hlist_empty(head)) {
-		struct timer_list *timer;
-		void (*fn)(struct timer_list *);
+	unsigned int i;
 
-		timer = hlist_entry(head->first, struct timer_list, entry);
-
-		base->running_timer = timer;
-		detach_timer(timer, true);
+	for (i = 0; i < base->nr_expiring; i++) {
+		struct timer_list *timer;
 
-		fn = timer->function;
+		local_irq_disable();
+		timer = base->expiring[i];
+		WRITE_ONCE(base->cur_expiring, i);
+		WRITE_ONCE(base->running_timer, timer);
+		if (!timer) {
+			local_irq_enable();
+			continue;
+		}
 
 		if (timer->flags & TIMER_IRQSAFE) {
-			raw_spin_unlock(&base->lock);
-			call_timer_fn(timer, fn);
-			raw_spin_lock(&base->lock);
+			call_timer_fn(timer, timer->function);
+			local_irq_enable();
 		} else {
-			raw_spin_unlock_irq(&base->lock);
-			call_timer_fn(timer, fn);
-			raw_spin_lock_irq(&base->lock);
+			local_irq_enable();
+			call_timer_fn(timer, timer->function);
+		}
+
+		smp_store_release(&base->expiring[i], NULL);
+	}
+}
+
+static void expire_timers(struct timer_base *base, struct hlist_head *head)
+{
+	while (!hlist_empty(head)) {
+		struct timer_list *timer;
+
+		/*
+		 * Detach a batch of timers under the lock. Until their slot
+		 * is cleared they are treated as running.
+		 */
+		base->nr_expiring = 0;
+		base->cur_expiring = 0;
+		while (!hlist_empty(head) && base->nr_expiring < EXPIRY_BATCH) {
+			timer = hlist_entry(head->first, struct timer_list, entry);
+			detach_timer(timer, true);
+			base->expiring[base->nr_expiring++] = timer;
 		}
+
+		raw_spin_unlock_irq(&base->lock);
+		run_expiry_batch(base);
+		raw_spin_lock_irq(&base->lock);
+
+		base->nr_expiring = 0;
 	}
 }
 
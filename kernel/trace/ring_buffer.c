@@ -24,9 +24,12 @@
 #include <linux/list.h>
 #include <linux/cpu.h>
 #include <linux/oom.h>
+#include <linux/mm.h>
 
 #include <asm/local.h>
 
+#include <uapi/linux/trace_mmap.h>
+
 static void update_pages_handler(struct work_struct *work);
 
 /*
@@ -330,6 +333,7 @@ struct buffer_page {
 	unsigned	 read;		/* index for next read */
 	local_t		 entries;	/* entries on this page */
 	unsigned long	 real_end;	/* real end of data */
+	unsigned	 id;		/* ID for external mapping */
 	struct buffer_data_page *page;	/* Actual data page */
 };
 
@@ -500,6 +504,12 @@ struct ring_buffer_per_cpu {
 	struct completion		update_done;
 
 	struct rb_irq_work		irq_work;
+
+	/* user space mapping, see ring_buffer_map() */
+	struct mutex			mapping_lock;
+	unsigned long			*subbuf_ids;	/* ID to data page */
+	struct trace_buffer_meta	*meta_page;
+	int				mapped;
 };
 
 struct ring_buffer {
@@ -1209,7 +1219,9 @@ static int __rb_allocate_pages(long nr_pages, struct list_head *pages, int cpu)
 
 		list_add(&bpage->list, pages);
 
-		page = alloc_pages_node(cpu_to_node(cpu), mflags, 0);
+		/* Zeroed, as the page may be mapped to user space */
+		page = alloc_pages_node(cpu_to_node(cpu),
+					mflags | __GFP_ZERO, 0);
 		if (!page)
 			goto free_pages;
 		bpage->page = page_address(page);
@@ -1276,6 +1288,7 @@ rb_allocate_cpu_buffer(struct ring_buffer *buffer, long nr_pages, int cpu)
 	cpu_buffer->buffer = buffer;
 	raw_spin_lock_init(&cpu_buffer->reader_lock);
 	lockdep_set_class(&cpu_buffer->reader_lock, buffer->reader_lock_key);
+	mutex_init(&cpu_buffer->mapping_lock);
 	cpu_buffer->lock = (arch_spinlock_t)__ARCH_SPIN_LOCK_UNLOCKED;
 	INIT_WORK(&cpu_buffer->update_pages_work, update_pages_handler);
 	init_completion(&cpu_buffer->update_done);
@@ -1291,7 +1304,7 @@ rb_allocate_cpu_buffer(struct ring_buffer *buffer, long nr_pages, int cpu)
 	rb_check_bpage(cpu_buffer, bpage);
 
 	cpu_buffer->reader_page = bpage;
-	page = alloc_pages_node(cpu_to_node(cpu), GFP_KERNEL, 0);
+	page = alloc_pages_node(cpu_to_node(cpu), GFP_KERNEL | __GFP_ZERO, 0);
 	if (!page)
 		goto fail_free_reader;
 	bpage->page = page_address(page);
@@ -1732,6 +1745,15 @@ int ring_buffer_resize(struct ring_buffer *buffer, unsigned long size,
 	/* prevent another thread from changing buffer sizes */
 	mutex_lock(&buffer->mutex);
 
+	/* The mapped page IDs must stay stable, see ring_buffer_map() */
+	for_each_buffer_cpu(buffer, cpu) {
+		if ((cpu_id == RING_BUFFER_ALL_CPUS || cpu_id == cpu) &&
+		    buffer->buffers[cpu]->mapped) {
+			mutex_unlock(&buffer->mutex);
+			return -EBUSY;
+		}
+	}
+
 	if (cpu_id == RING_BUFFER_ALL_CPUS) {
 		/* calculate the pages to update */
 		for_each_buffer_cpu(buffer, cpu) {
@@ -4457,6 +4479,24 @@ rb_reset_cpu(struct ring_buffer_per_cpu *cpu_buffer)
 	rb_head_page_activate(cpu_buffer);
 }
 
+/*
+ * Publish the reader state to a mapped buffer. The events from @read up
+ * to the reader page read offset belong to user space.
+ */
+static void
+rb_update_meta_page(struct ring_buffer_per_cpu *cpu_buffer, unsigned read)
+{
+	struct trace_buffer_meta *meta = cpu_buffer->meta_page;
+
+	meta->reader.id = cpu_buffer->reader_page->id;
+	meta->reader.read = read;
+	meta->reader.commit = cpu_buffer->reader_page->read;
+
+	meta->entries = local_read(&cpu_buffer->entries);
+	meta->overrun = local_read(&cpu_buffer->overrun);
+	meta->read = cpu_buffer->read;
+}
+
 /**
  * ring_buffer_reset_cpu - reset a ring buffer per CPU buffer
  * @buffer: The ring buffer to reset a per cpu buffer of
@@ -4489,6 +4529,9 @@ void ring_buffer_reset_cpu(struct ring_buffer *buffer, int cpu)
 
 	arch_spin_unlock(&cpu_buffer->lock);
 
+	if (cpu_buffer->mapped)
+		rb_update_meta_page(cpu_buffer, 0);
+
  out:
 	raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
 
@@ -4596,6 +4639,11 @@ int ring_buffer_swap_cpu(struct ring_buffer *buffer_a,
 	if (cpu_buffer_a->nr_pages != cpu_buffer_b->nr_pages)
 		goto out;
 
+	/* The mapped pages must stay with their buffer */
+	ret = -EBUSY;
+	if (cpu_buffer_a->mapped || cpu_buffer_b->mapped)
+		goto out;
+
 	ret = -EAGAIN;
 
 	if (atomic_read(&buffer_a->record_disabled))
@@ -4684,7 +4732,7 @@ void *ring_buffer_alloc_read_page(struct ring_buffer *buffer, int cpu)
 		goto out;
 
 	page = alloc_pages_node(cpu_to_node(cpu),
-				GFP_KERNEL | __GFP_NORETRY, 0);
+				GFP_KERNEL | __GFP_NORETRY | __GFP_ZERO, 0);
 	if (!page)
 		return ERR_PTR(-ENOMEM);
 
@@ -4800,6 +4848,12 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 
 	raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
 
+	/* A mapped buffer is consumed through ring_buffer_map_get_reader() */
+	if (cpu_buffer->mapped) {
+		ret = -EBUSY;
+		goto out_unlock;
+	}
+
 	reader = rb_get_reader_page(cpu_buffer);
 	if (!reader)
 		goto out_unlock;
@@ -4929,6 +4983,259 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 }
 EXPORT_SYMBOL_GPL(ring_buffer_read_page);
 
+/*
+ * Give every page of the buffer, the reader page first, an ID matching
+ * its position in the mapping after the meta page.
+ */
+static void rb_setup_ids_meta_page(struct ring_buffer_per_cpu *cpu_buffer)
+{
+	struct trace_buffer_meta *meta = cpu_buffer->meta_page;
+	unsigned long nr_subbufs = cpu_buffer->nr_pages + 1;
+	struct buffer_page *first, *bpage;
+	unsigned id = 0;
+
+	bpage = cpu_buffer->reader_page;
+	cpu_buffer->subbuf_ids[id] = (unsigned long)bpage->page;
+	bpage->id = id++;
+
+	first = bpage = rb_set_head_page(cpu_buffer);
+	do {
+		if (RB_WARN_ON(cpu_buffer, id >= nr_subbufs))
+			break;
+
+		cpu_buffer->subbuf_ids[id] = (unsigned long)bpage->page;
+		bpage->id = id++;
+		rb_inc_page(cpu_buffer, &bpage);
+	} while (bpage != first);
+
+	meta->meta_page_size = PAGE_SIZE;
+	meta->meta_struct_len = sizeof(*meta);
+	meta->subbuf_size = PAGE_SIZE;
+	meta->nr_subbufs = nr_subbufs;
+
+	rb_update_meta_page(cpu_buffer, cpu_buffer->reader_page->read);
+}
+
+static int rb_map_vma(struct ring_buffer_per_cpu *cpu_buffer,
+		      struct vm_area_struct *vma)
+{
+	unsigned long nr_subbufs = cpu_buffer->nr_pages + 1;
+	unsigned long nr_pages = vma_pages(vma);
+	unsigned long pgoff = vma->vm_pgoff;
+	unsigned long i;
+	struct page *page;
+	int err;
+
+	/* The meta page and one page per sub-buffer */
+	if (!nr_pages || pgoff + nr_pages > nr_subbufs + 1)
+		return -EINVAL;
+
+	for (i = 0; i < nr_pages; i++, pgoff++) {
+		if (!pgoff)
+			page = virt_to_page(cpu_buffer->meta_page);
+		else
+			page = virt_to_page(cpu_buffer->subbuf_ids[pgoff - 1]);
+
+		err = vm_insert_page(vma, vma->vm_start + i * PAGE_SIZE, page);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+/**
+ * ring_buffer_map - map a per CPU buffer into user space
+ * @buffer: the buffer the mapping is for
+ * @cpu: the CPU buffer to map
+ * @vma: the read-only user space mapping
+ *
+ * The mapping is a meta page (struct trace_buffer_meta) followed by the
+ * data pages in ID order, the reader page first. The pages are not copied
+ * or swapped while the buffer is mapped: user space reads the events in
+ * place on the reader page, and moves on to the next page with
+ * ring_buffer_map_get_reader(). Resizing, snapshot swaps and
+ * ring_buffer_read_page() are refused until the last unmap.
+ *
+ * Returns 0 on success, or a negative error code.
+ */
+int ring_buffer_map(struct ring_buffer *buffer, int cpu,
+		    struct vm_area_struct *vma)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	unsigned long flags;
+	int err = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_flags |= VM_DONTCOPY | VM_DONTEXPAND | VM_DONTDUMP;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	mutex_lock(&cpu_buffer->mapping_lock);
+
+	if (cpu_buffer->mapped) {
+		err = rb_map_vma(cpu_buffer, vma);
+		if (!err)
+			cpu_buffer->mapped++;
+		goto unlock;
+	}
+
+	/* prevent another thread from changing buffer sizes */
+	mutex_lock(&buffer->mutex);
+
+	cpu_buffer->subbuf_ids = kcalloc(cpu_buffer->nr_pages + 1,
+					 sizeof(*cpu_buffer->subbuf_ids),
+					 GFP_KERNEL);
+	cpu_buffer->meta_page = (void *)get_zeroed_page(GFP_KERNEL);
+	if (!cpu_buffer->subbuf_ids || !cpu_buffer->meta_page) {
+		err = -ENOMEM;
+		goto free;
+	}
+
+	raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+	rb_setup_ids_meta_page(cpu_buffer);
+	raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	err = rb_map_vma(cpu_buffer, vma);
+	if (err)
+		goto free;
+
+	raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+	cpu_buffer->mapped = 1;
+	raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	mutex_unlock(&buffer->mutex);
+	goto unlock;
+
+ free:
+	free_page((unsigned long)cpu_buffer->meta_page);
+	cpu_buffer->meta_page = NULL;
+	kfree(cpu_buffer->subbuf_ids);
+	cpu_buffer->subbuf_ids = NULL;
+	mutex_unlock(&buffer->mutex);
+ unlock:
+	mutex_unlock(&cpu_buffer->mapping_lock);
+
+	return err;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map);
+
+/**
+ * ring_buffer_unmap - drop a user space mapping of a per CPU buffer
+ * @buffer: the buffer the mapping is for
+ * @cpu: the CPU buffer that was mapped
+ *
+ * Undoes ring_buffer_map(). The last unmap frees the meta page and lets
+ * the buffer be resized and swapped again.
+ */
+int ring_buffer_unmap(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	unsigned long flags;
+	int err = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	mutex_lock(&cpu_buffer->mapping_lock);
+
+	if (!cpu_buffer->mapped) {
+		err = -ENODEV;
+		goto out;
+	}
+
+	if (cpu_buffer->mapped > 1) {
+		cpu_buffer->mapped--;
+		goto out;
+	}
+
+	mutex_lock(&buffer->mutex);
+
+	raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+	cpu_buffer->mapped = 0;
+	raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	free_page((unsigned long)cpu_buffer->meta_page);
+	cpu_buffer->meta_page = NULL;
+	kfree(cpu_buffer->subbuf_ids);
+	cpu_buffer->subbuf_ids = NULL;
+
+	mutex_unlock(&buffer->mutex);
+ out:
+	mutex_unlock(&cpu_buffer->mapping_lock);
+
+	return err;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_unmap);
+
+/**
+ * ring_buffer_map_get_reader - hand the next events to a mapped reader
+ * @buffer: the buffer the mapping is for
+ * @cpu: the CPU buffer that is mapped
+ *
+ * Consumes the events handed out by the previous call, swaps a new reader
+ * page in once the current one is exhausted, and publishes the events now
+ * available on the reader page in the meta page. The writer may keep
+ * appending to the reader page, but never overwrites it, so user space
+ * can read the published events in place until the next call.
+ *
+ * Returns 0 on success, or a negative error code.
+ */
+int ring_buffer_map_get_reader(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	struct buffer_page *reader;
+	unsigned long missed_events;
+	unsigned long flags;
+	unsigned read, size;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+
+	if (!cpu_buffer->mapped) {
+		raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+		return -ENODEV;
+	}
+
+	/*
+	 * rb_get_reader_page() keeps the current reader page while it has
+	 * unread events, and otherwise swaps in the head page.
+	 */
+	reader = rb_get_reader_page(cpu_buffer);
+	read = cpu_buffer->reader_page->read;
+
+	/* Check if any events were dropped */
+	missed_events = cpu_buffer->lost_events;
+	cpu_buffer->lost_events = 0;
+	cpu_buffer->meta_page->reader.lost_events = missed_events;
+
+	if (reader) {
+		/* User space is expected to read everything handed out */
+		size = rb_page_size(reader);
+		while (reader->read < size)
+			rb_advance_reader(cpu_buffer);
+	}
+
+	rb_update_meta_page(cpu_buffer, read);
+
+	raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map_get_reader);
+
 /*
  * We only allocate new buffers, never free them if the CPU goes down.
  * If we were to free the buffer, then the user would lose any trace that was in
@@ -45,6 +45,8 @@
 #include <linux/sched/clock.h>
 #include <linux/sched/rt.h>
 
+#include <uapi/linux/trace_mmap.h>
+
 #include "trace.h"
 #include "trace_output.h"
 
@@ -1379,6 +1381,10 @@ update_max_tr(struct trace_array *tr, struct task_struct *tsk, int cpu)
 		return;
 	}
 
+	/* A mapped buffer can't trade places with the snapshot */
+	if (READ_ONCE(tr->mapped))
+		return;
+
 	arch_spin_lock(&tr->max_lock);
 
 	/* Inherit the recordable setting from trace_buffer */
@@ -4722,7 +4728,9 @@ static const char readme_msg[] =
 	"\t    or fewer than the default 2048 entries for the hashtable size.\n"
 	"\t    If a hist trigger is given a name using the 'name' parameter,\n"
 	"\t    its histogram data will be shared with other triggers of the\n"
-	"\t    same name, and trigger hits will update this common data.\n\n"
+	"\t    same name, and trigger hits will update this common data.\n"
+	"\t    A hist keyed only on a .log2 or .buckets field also prints\n"
+	"\t    the p50, p90, p99 and p99.9 percentiles of its hits.\n\n"
 	"\t    Reading the 'hist' file for the event will dump the hash\n"
 	"\t    table in its entirety to stdout.  If there are multiple hist\n"
 	"\t    triggers attached to an event, there will be a table for each\n"
@@ -4737,6 +4745,7 @@ static const char readme_msg[] =
 	"\t            .execname   display a common_pid as a program name\n"
 	"\t            .syscall    display a syscall id as a syscall name\n"
 	"\t            .log2       display log2 value rather than raw number\n"
+	"\t            .buckets=size  display values in groups of size\n"
 	"\t            .usecs      display a common_timestamp in microseconds\n\n"
 	"\t    The 'pause' parameter can be used to pause an existing hist\n"
 	"\t    trigger or to start a hist trigger but not log any events\n"
@@ -6790,6 +6799,10 @@ tracing_buffers_read(struct file *filp, char __user *ubuf,
 	trace_access_unlock(iter->cpu_file);
 
 	if (ret < 0) {
+		/* The buffer is mapped and consumed in place */
+		if (ret == -EBUSY)
+			return ret;
+
 		if (trace_empty(iter)) {
 			if ((filp->f_flags & O_NONBLOCK))
 				return -EAGAIN;
@@ -6968,6 +6981,8 @@ tracing_buffers_splice_read(struct file *file, loff_t *ppos,
 			ring_buffer_free_read_page(ref->buffer, ref->cpu,
 						   ref->page);
 			kfree(ref);
+			if (r == -EBUSY)
+				ret = r;
 			break;
 		}
 
@@ -7009,12 +7024,95 @@ tracing_buffers_splice_read(struct file *file, loff_t *ppos,
 	return ret;
 }
 
+static long tracing_buffers_ioctl(struct file *file, unsigned int cmd,
+				  unsigned long arg)
+{
+	struct ftrace_buffer_info *info = file->private_data;
+	struct trace_iterator *iter = &info->iter;
+	int ret;
+
+	if (cmd != TRACE_MMAP_IOCTL_GET_READER)
+		return -ENOTTY;
+
+	/* Wait for the writer to fill a page, like splice does */
+	if (!(file->f_flags & O_NONBLOCK)) {
+		ret = wait_on_pipe(iter, true);
+		if (ret)
+			return ret;
+	}
+
+	trace_access_lock(iter->cpu_file);
+	ret = ring_buffer_map_get_reader(iter->trace_buffer->buffer,
+					 iter->cpu_file);
+	trace_access_unlock(iter->cpu_file);
+
+	return ret;
+}
+
+static void tracing_buffers_mmap_close(struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = vma->vm_file->private_data;
+	struct trace_iterator *iter = &info->iter;
+
+	WARN_ON(ring_buffer_unmap(vma->vm_private_data, iter->cpu_file));
+
+	mutex_lock(&trace_types_lock);
+	iter->tr->mapped--;
+	mutex_unlock(&trace_types_lock);
+}
+
+static int tracing_buffers_mmap_split(struct vm_area_struct *vma,
+				      unsigned long addr)
+{
+	/* The buffer is unmapped once per mmap() */
+	return -EINVAL;
+}
+
+static const struct vm_operations_struct tracing_buffers_vmops = {
+	.close		= tracing_buffers_mmap_close,
+	.split		= tracing_buffers_mmap_split,
+};
+
+static int tracing_buffers_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = filp->private_data;
+	struct trace_iterator *iter = &info->iter;
+	struct ring_buffer *buffer;
+	int ret;
+
+	if (iter->cpu_file == RING_BUFFER_ALL_CPUS)
+		return -EINVAL;
+
+	/* Counted first, so a snapshot can't swap the buffer under us */
+	mutex_lock(&trace_types_lock);
+	iter->tr->mapped++;
+	mutex_unlock(&trace_types_lock);
+	synchronize_sched();
+
+	buffer = iter->trace_buffer->buffer;
+	ret = ring_buffer_map(buffer, iter->cpu_file, vma);
+	if (ret) {
+		mutex_lock(&trace_types_lock);
+		iter->tr->mapped--;
+		mutex_unlock(&trace_types_lock);
+		return ret;
+	}
+
+	vma->vm_private_data = buffer;
+	vma->vm_ops = &tracing_buffers_vmops;
+
+	return 0;
+}
+
 static const struct file_operations tracing_buffers_fops = {
 	.open		= tracing_buffers_open,
 	.read		= tracing_buffers_read,
 	.poll		= tracing_buffers_poll,
 	.release	= tracing_buffers_release,
 	.splice_read	= tracing_buffers_splice_read,
+	.unlocked_ioctl	= tracing_buffers_ioctl,
+	.compat_ioctl	= tracing_buffers_ioctl,
+	.mmap		= tracing_buffers_mmap,
 	.llseek		= no_llseek,
 };
 
@@ -12,6 +12,7 @@
 #include <linux/stacktrace.h>
 #include <linux/rculist.h>
 #include <linux/tracefs.h>
+#include <linux/sort.h>
 
 #include "tracing_map.h"
 #include "trace.h"
@@ -63,6 +64,7 @@ struct hist_field {
 	unsigned int			var_idx;
 	unsigned int			var_ref_idx;
 	bool                            read_once;
+	unsigned long			buckets;
 };
 
 static u64 hist_field_none(struct hist_field *field,
@@ -125,6 +127,19 @@ static u64 hist_field_log2(struct hist_field *hist_field,
 	return (u64) ilog2(roundup_pow_of_two(val));
 }
 
+static u64 hist_field_bucket(struct hist_field *hist_field,
+			     struct tracing_map_elt *elt,
+			     struct ring_buffer_event *rbe,
+			     void *event)
+{
+	struct hist_field *operand = hist_field->operands[0];
+	unsigned long buckets = hist_field->buckets;
+
+	u64 val = operand->fn(operand, elt, rbe, event);
+
+	return div64_ul(val, buckets) * buckets;
+}
+
 static u64 hist_field_plus(struct hist_field *hist_field,
 			   struct tracing_map_elt *elt,
 			   struct ring_buffer_event *rbe,
@@ -220,6 +235,7 @@ enum hist_field_flags {
 	HIST_FIELD_FL_VAR_REF		= 1 << 14,
 	HIST_FIELD_FL_CPU		= 1 << 15,
 	HIST_FIELD_FL_ALIAS		= 1 << 16,
+	HIST_FIELD_FL_BUCKET		= 1 << 17,
 };
 
 struct var_defs {
@@ -1715,6 +1731,7 @@ static const char *hist_field_name(struct hist_field *field,
 	if (field->field)
 		field_name = field->field->name;
 	else if (field->flags & HIST_FIELD_FL_LOG2 ||
+		 field->flags & HIST_FIELD_FL_BUCKET ||
 		 field->flags & HIST_FIELD_FL_ALIAS)
 		field_name = hist_field_name(field->operands[0], ++level);
 	else if (field->flags & HIST_FIELD_FL_CPU)
@@ -2070,6 +2087,8 @@ static const char *get_hist_field_flags(struct hist_field *hist_field)
 		flags_str = "syscall";
 	else if (hist_field->flags & HIST_FIELD_FL_LOG2)
 		flags_str = "log2";
+	else if (hist_field->flags & HIST_FIELD_FL_BUCKET)
+		flags_str = "buckets";
 	else if (hist_field->flags & HIST_FIELD_FL_TIMESTAMP_USECS)
 		flags_str = "usecs";
 
@@ -2230,9 +2249,11 @@ static struct hist_field *create_hist_field(struct hist_trigger_data *hist_data,
 		goto out;
 	}
 
-	if (flags & HIST_FIELD_FL_LOG2) {
-		unsigned long fl = flags & ~HIST_FIELD_FL_LOG2;
-		hist_field->fn = hist_field_log2;
+	if (flags & (HIST_FIELD_FL_LOG2 | HIST_FIELD_FL_BUCKET)) {
+		unsigned long fl = flags &
+			~(HIST_FIELD_FL_LOG2 | HIST_FIELD_FL_BUCKET);
+		hist_field->fn = flags & HIST_FIELD_FL_LOG2 ?
+			hist_field_log2 : hist_field_bucket;
 		hist_field->operands[0] = create_hist_field(hist_data, field, fl, NULL);
 		hist_field->size = hist_field->operands[0]->size;
 		hist_field->type = kstrdup(hist_field->operands[0]->type, GFP_KERNEL);
@@ -2472,7 +2493,7 @@ static struct hist_field *parse_var_ref(struct hist_trigger_data *hist_data,
 
 static struct ftrace_event_field *
 parse_field(struct hist_trigger_data *hist_data, struct trace_event_file *file,
-	    char *field_str, unsigned long *flags)
+	    char *field_str, unsigned long *flags, unsigned long *buckets)
 {
 	struct ftrace_event_field *field = NULL;
 	char *field_name, *modifier, *str;
@@ -2496,6 +2517,9 @@ parse_field(struct hist_trigger_data *hist_data, struct trace_event_file *file,
 			*flags |= HIST_FIELD_FL_SYSCALL;
 		else if (strcmp(modifier, "log2") == 0)
 			*flags |= HIST_FIELD_FL_LOG2;
+		else if (strncmp(modifier, "buckets=", 8) == 0 &&
+			 !kstrtoul(modifier + 8, 0, buckets) && *buckets)
+			*flags |= HIST_FIELD_FL_BUCKET;
 		else if (strcmp(modifier, "usecs") == 0)
 			*flags |= HIST_FIELD_FL_TIMESTAMP_USECS;
 		else {
@@ -2566,6 +2590,7 @@ static struct hist_field *parse_atom(struct hist_trigger_data *hist_data,
 	char *s, *ref_system = NULL, *ref_event = NULL, *ref_var = str;
 	struct ftrace_event_field *field = NULL;
 	struct hist_field *hist_field = NULL;
+	unsigned long buckets = 0;
 	int ret = 0;
 
 	s = strchr(str, '.');
@@ -2604,7 +2629,7 @@ static struct hist_field *parse_atom(struct hist_trigger_data *hist_data,
 	} else
 		str = s;
 
-	field = parse_field(hist_data, file, str, flags);
+	field = parse_field(hist_data, file, str, flags, &buckets);
 	if (IS_ERR(field)) {
 		ret = PTR_ERR(field);
 		goto out;
@@ -2615,6 +2640,7 @@ static struct hist_field *parse_atom(struct hist_trigger_data *hist_data,
 		ret = -ENOMEM;
 		goto out;
 	}
+	hist_field->buckets = buckets;
 
 	return hist_field;
  out:
@@ -4835,6 +4861,10 @@ hist_trigger_entry_print(struct seq_file *m,
 		} else if (key_field->flags & HIST_FIELD_FL_LOG2) {
 			seq_printf(m, "%s: ~ 2^%-2llu", field_name,
 				   *(u64 *)(key + key_field->offset));
+		} else if (key_field->flags & HIST_FIELD_FL_BUCKET) {
+			uval = *(u64 *)(key + key_field->offset);
+			seq_printf(m, "%s: ~ %llu-%llu", field_name,
+				   uval, uval + key_field->buckets - 1);
 		} else if (key_field->flags & HIST_FIELD_FL_STRING) {
 			seq_printf(m, "%s: %-50s", field_name,
 				   (char *)(key + key_field->offset));
@@ -4873,6 +4903,84 @@ hist_trigger_entry_print(struct seq_file *m,
 	seq_puts(m, "\n");
 }
 
+static const struct {
+	unsigned int	permille;
+	const char	*name;
+} hist_percentiles[] = {
+	{ 500, "p50" },
+	{ 900, "p90" },
+	{ 990, "p99" },
+	{ 999, "p99.9" },
+};
+
+struct hist_bucket_hits {
+	u64	val;
+	u64	hits;
+};
+
+static int cmp_hist_bucket_hits(const void *a, const void *b)
+{
+	u64 val_a = ((const struct hist_bucket_hits *)a)->val;
+	u64 val_b = ((const struct hist_bucket_hits *)b)->val;
+
+	if (val_a < val_b)
+		return -1;
+	return val_a > val_b;
+}
+
+/*
+ * A histogram keyed only on a log2 or buckets field is a distribution of
+ * that field, so print the bucket holding each percentile of the hits,
+ * as the upper bound of the values that bucket covers.
+ */
+static void print_percentiles(struct seq_file *m,
+			      struct hist_trigger_data *hist_data,
+			      struct tracing_map_sort_entry **sort_entries,
+			      int n_entries)
+{
+	struct hist_field *key_field = hist_data->fields[hist_data->n_vals];
+	struct hist_bucket_hits *b;
+	u64 total = 0, sum = 0, max;
+	unsigned int p = 0;
+	int i;
+
+	if (hist_data->n_keys != 1 || !n_entries ||
+	    !(key_field->flags & (HIST_FIELD_FL_LOG2 | HIST_FIELD_FL_BUCKET)))
+		return;
+
+	b = kcalloc(n_entries, sizeof(*b), GFP_KERNEL);
+	if (!b)
+		return;
+
+	for (i = 0; i < n_entries; i++) {
+		b[i].val = *(u64 *)(sort_entries[i]->key + key_field->offset);
+		b[i].hits = tracing_map_read_sum(sort_entries[i]->elt,
+						 HITCOUNT_IDX);
+		total += b[i].hits;
+	}
+
+	sort(b, n_entries, sizeof(*b), cmp_hist_bucket_hits, NULL);
+
+	seq_printf(m, "\nPercentiles (%s):\n", hist_field_name(key_field, 0));
+
+	for (i = 0; i < n_entries; i++) {
+		sum += b[i].hits;
+		if (key_field->flags & HIST_FIELD_FL_LOG2)
+			max = b[i].val < 64 ? 1ULL << b[i].val : U64_MAX;
+		else
+			max = b[i].val + key_field->buckets - 1;
+
+		while (p < ARRAY_SIZE(hist_percentiles) &&
+		       sum * 1000 >= total * hist_percentiles[p].permille) {
+			seq_printf(m, "    %s: <= %llu\n",
+				   hist_percentiles[p].name, max);
+			p++;
+		}
+	}
+
+	kfree(b);
+}
+
 static int print_entries(struct seq_file *m,
 			 struct hist_trigger_data *hist_data)
 {
@@ -4891,6 +4999,8 @@ static int print_entries(struct seq_file *m,
 					 sort_entries[i]->key,
 					 sort_entries[i]->elt);
 
+	print_percentiles(m, hist_data, sort_entries, n_entries);
+
 	tracing_map_destroy_sort_entries(sort_entries, n_entries);
 
 	return n_entries;
@@ -4985,6 +5095,8 @@ static void hist_field_print(struct seq_file *m, struct hist_field *hist_field)
 
 			if (flags)
 				seq_printf(m, ".%s", flags);
+			if (hist_field->flags & HIST_FIELD_FL_BUCKET)
+				seq_printf(m, "=%lu", hist_field->buckets);
 		}
 	}
 }
@@ -5273,6 +5385,8 @@ static bool hist_trigger_match(struct event_trigger_data *data,
 			return false;
 		if (key_field->size != key_field_test->size)
 			return false;
+		if (key_field->buckets != key_field_test->buckets)
+			return false;
 		if (key_field->is_signed != key_field_test->is_signed)
 			return false;
 		if (!!key_field->var.name != !!key_field_test->var.name)
@@ -0,0 +1,527 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * CPU and NUMA node scaling benchmarks for contended kernel paths.
+ *
+ * Each test runs the same operation in a loop on a growing set of CPUs
+ * for a fixed time and reports the aggregate throughput, plus the
+ * slowest and fastest thread so that unfair lock hand-off shows up as
+ * well as poor scaling.
+ *
+ * CPUs are taken node by node, so a sweep first scales within one node
+ * and then across nodes.  The CPU counts used are the powers of two,
+ * every node boundary and all online CPUs, limited by max_cpus.
+ *
+ * Usage, from /sys/kernel/debug/scale_benchmark:
+ *
+ *   cat tests                  list the available tests
+ *   echo 500 > duration_ms     time per CPU count (default 200)
+ *   echo 16 > max_cpus         largest CPU count to try (0: all)
+ *   echo zone_lock > run       run one test, or "all"
+ *   cat results                one line per test and CPU count
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/cpu.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
+#include <linux/gfp.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/nodemask.h>
+#include <linux/overflow.h>
+#include <linux/rwsem.h>
+#include <linux/sched/mm.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+
+#define SCALE_BENCH_BATCH	256
+#define SCALE_BENCH_RESULTS	512
+
+struct scale_bench_thread {
+	struct task_struct *task;
+	struct scale_bench_run *run;
+	unsigned int cpu;
+	int node;
+	unsigned long seq;
+	u64 ops;
+	void *batch[SCALE_BENCH_BATCH];
+};
+
+struct scale_bench_test {
+	const char *name;
+	int (*init)(void);
+	void (*exit)(void);
+	/* returns the number of operations done */
+	unsigned int (*op)(struct scale_bench_thread *t);
+};
+
+struct scale_bench_run {
+	const struct scale_bench_test *test;
+	wait_queue_head_t wq;
+	bool start;
+	bool stop;
+};
+
+struct scale_bench_result {
+	const char *name;
+	unsigned int cpus;
+	unsigned int nodes;
+	u64 ops;
+	u64 ns;
+	u64 min_ops;
+	u64 max_ops;
+};
+
+static DEFINE_MUTEX(scale_bench_mutex);
+static struct dentry *scale_bench_dir;
+static u32 duration_ms = 200;
+static u32 max_cpus;
+
+static struct scale_bench_result results[SCALE_BENCH_RESULTS];
+static unsigned int nr_results;
+
+/*
+ * page_alloc: order-0 allocations in batches larger than the per-cpu
+ * lists, so that refill and drain reach the buddy allocator.
+ */
+static unsigned int bench_page_alloc(struct scale_bench_thread *t)
+{
+	unsigned int i, n;
+
+	for (n = 0; n < SCALE_BENCH_BATCH; n++) {
+		t->batch[n] = alloc_pages_node(t->node, GFP_KERNEL, 0);
+		if (!t->batch[n])
+			break;
+	}
+
+	for (i = 0; i < n; i++)
+		__free_pages(t->batch[i], 0);
+
+	return n;
+}
+
+/*
+ * zone_lock: higher order allocations skip the per-cpu lists and take
+ * zone->lock for every allocation and free.
+ */
+static unsigned int bench_zone_lock(struct scale_bench_thread *t)
+{
+	struct page *page;
+
+	page = alloc_pages_node(t->node, GFP_KERNEL | __GFP_NOWARN, 1);
+	if (!page)
+		return 0;
+
+	__free_pages(page, 1);
+	return 1;
+}
+
+/*
+ * slab: batches large enough to overflow the per-cpu slab and go
+ * through the node partial lists.
+ */
+static struct kmem_cache *bench_cache;
+
+static int bench_slab_init(void)
+{
+	bench_cache = kmem_cache_create("scale_benchmark", 256, 0, 0, NULL);
+	return bench_cache ? 0 : -ENOMEM;
+}
+
+static void bench_slab_exit(void)
+{
+	kmem_cache_destroy(bench_cache);
+}
+
+static unsigned int bench_slab(struct scale_bench_thread *t)
+{
+	unsigned int i, n;
+
+	for (n = 0; n < SCALE_BENCH_BATCH; n++) {
+		t->batch[n] = kmem_cache_alloc_node(bench_cache, GFP_KERNEL,
+						    t->node);
+		if (!t->batch[n])
+			break;
+	}
+
+	for (i = 0; i < n; i++)
+		kmem_cache_free(bench_cache, t->batch[i]);
+
+	return n;
+}
+
+/*
+ * mmap_sem: a read-mostly mix on the mmap_sem of the task that started
+ * the run, one writer in 16.
+ */
+static struct mm_struct *bench_mm;
+
+static int bench_mmap_sem_init(void)
+{
+	bench_mm = get_task_mm(current);
+	return bench_mm ? 0 : -EINVAL;
+}
+
+static void bench_mmap_sem_exit(void)
+{
+	mmput(bench_mm);
+}
+
+static unsigned int bench_mmap_sem(struct scale_bench_thread *t)
+{
+	if (++t->seq % 16) {
+		down_read(&bench_mm->mmap_sem);
+		cpu_relax();
+		up_read(&bench_mm->mmap_sem);
+	} else {
+		down_write(&bench_mm->mmap_sem);
+		cpu_relax();
+		up_write(&bench_mm->mmap_sem);
+	}
+
+	return 1;
+}
+
+/*
+ * qspinlock: one lock and the data it protects on another cache line,
+ * both shared by all CPUs.  Exercises CNA when it is enabled.
+ */
+static struct {
+	spinlock_t lock ____cacheline_aligned_in_smp;
+	u64 count ____cacheline_aligned_in_smp;
+} bench_spin = {
+	.lock = __SPIN_LOCK_UNLOCKED(bench_spin.lock),
+};
+
+static unsigned int bench_qspinlock(struct scale_bench_thread *t)
+{
+	spin_lock(&bench_spin.lock);
+	bench_spin.count++;
+	spin_unlock(&bench_spin.lock);
+
+	return 1;
+}
+
+static const struct scale_bench_test scale_bench_tests[] = {
+	{
+		.name	= "page_alloc",
+		.op	= bench_page_alloc,
+	},
+	{
+		.name	= "zone_lock",
+		.op	= bench_zone_lock,
+	},
+	{
+		.name	= "slab",
+		.init	= bench_slab_init,
+		.exit	= bench_slab_exit,
+		.op	= bench_slab,
+	},
+	{
+		.name	= "mmap_sem",
+		.init	= bench_mmap_sem_init,
+		.exit	= bench_mmap_sem_exit,
+		.op	= bench_mmap_sem,
+	},
+	{
+		.name	= "qspinlock",
+		.op	= bench_qspinlock,
+	},
+};
+
+static int scale_bench_threadfn(void *data)
+{
+	struct scale_bench_thread *t = data;
+	struct scale_bench_run *run = t->run;
+	u64 ops = 0;
+
+	wait_event(run->wq, READ_ONCE(run->start));
+
+	while (!READ_ONCE(run->stop)) {
+		ops += run->test->op(t);
+		cond_resched();
+	}
+
+	t->ops = ops;
+
+	/* stay around until the result has been collected */
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
+static int scale_bench_once(const struct scale_bench_test *test,
+			    struct scale_bench_thread *threads,
+			    const unsigned int *cpus, unsigned int nr_cpus)
+{
+	struct scale_bench_result *res;
+	struct scale_bench_run run;
+	nodemask_t nodes = NODE_MASK_NONE;
+	unsigned int i, started;
+	u64 start = 0, end = 0;
+	int ret = 0;
+
+	if (nr_results >= SCALE_BENCH_RESULTS)
+		return -ENOSPC;
+
+	init_waitqueue_head(&run.wq);
+	run.test = test;
+	run.start = false;
+	run.stop = false;
+
+	for (started = 0; started < nr_cpus; started++) {
+		struct scale_bench_thread *t = &threads[started];
+
+		t->run = &run;
+		t->cpu = cpus[started];
+		t->node = cpu_to_node(t->cpu);
+		t->seq = 0;
+		t->ops = 0;
+		t->task = kthread_create_on_node(scale_bench_threadfn, t,
+						 t->node, "scale_bench/%u",
+						 t->cpu);
+		if (IS_ERR(t->task)) {
+			ret = PTR_ERR(t->task);
+			break;
+		}
+
+		kthread_bind(t->task, t->cpu);
+		get_task_struct(t->task);
+		wake_up_process(t->task);
+		node_set(t->node, nodes);
+	}
+
+	if (!ret) {
+		start = ktime_get_ns();
+		WRITE_ONCE(run.start, true);
+		wake_up_all(&run.wq);
+
+		msleep(duration_ms);
+		WRITE_ONCE(run.stop, true);
+		end = ktime_get_ns();
+	} else {
+		/* let the threads that did start leave straight away */
+		WRITE_ONCE(run.stop, true);
+		WRITE_ONCE(run.start, true);
+		wake_up_all(&run.wq);
+	}
+
+	for (i = 0; i < started; i++) {
+		kthread_stop(threads[i].task);
+		put_task_struct(threads[i].task);
+	}
+
+	if (ret)
+		return ret;
+
+	res = &results[nr_results++];
+	res->name = test->name;
+	res->cpus = nr_cpus;
+	res->nodes = nodes_weight(nodes);
+	res->ns = end - start;
+	res->ops = 0;
+	res->min_ops = U64_MAX;
+	res->max_ops = 0;
+
+	for (i = 0; i < nr_cpus; i++) {
+		res->ops += threads[i].ops;
+		res->min_ops = min(res->min_ops, threads[i].ops);
+		res->max_ops = max(res->max_ops, threads[i].ops);
+	}
+
+	return 0;
+}
+
+static int scale_bench_test_run(const struct scale_bench_test *test)
+{
+	struct scale_bench_thread *threads;
+	unsigned int *cpus, nr = 0, next = 1, cpu, limit;
+	int nid, ret;
+
+	cpus = kcalloc(nr_cpu_ids, sizeof(*cpus), GFP_KERNEL);
+	threads = vzalloc(array_size(nr_cpu_ids, sizeof(*threads)));
+	if (!cpus || !threads) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+
+	if (test->init) {
+		ret = test->init();
+		if (ret)
+			goto out_free;
+	}
+
+	get_online_cpus();
+
+	/* node-major order: scale within a node before spanning nodes */
+	for_each_online_node(nid)
+		for_each_cpu_and(cpu, cpumask_of_node(nid), cpu_online_mask)
+			cpus[nr++] = cpu;
+
+	limit = max_cpus ? min_t(unsigned int, max_cpus, nr) : nr;
+	ret = 0;
+
+	for (nr = 1; nr <= limit && !ret; nr++) {
+		bool boundary = nr == limit ||
+				cpu_to_node(cpus[nr - 1]) != cpu_to_node(cpus[nr]);
+
+		if (nr != next && !boundary)
+			continue;
+		if (nr == next)
+			next <<= 1;
+
+		ret = scale_bench_once(test, threads, cpus, nr);
+
+		if (fatal_signal_pending(current))
+			ret = -EINTR;
+	}
+
+	put_online_cpus();
+
+	if (test->exit)
+		test->exit();
+out_free:
+	vfree(threads);
+	kfree(cpus);
+	return ret;
+}
+
+static ssize_t scale_bench_run_write(struct file *file,
+				     const char __user *ubuf,
+				     size_t count, loff_t *ppos)
+{
+	char name[32];
+	bool all;
+	int i, ret = -EINVAL;
+
+	if (count >= sizeof(name))
+		return -EINVAL;
+	if (copy_from_user(name, ubuf, count))
+		return -EFAULT;
+	name[count] = '\0';
+	strim(name);
+
+	all = !strcmp(name, "all");
+
+	mutex_lock(&scale_bench_mutex);
+	nr_results = 0;
+
+	for (i = 0; i < ARRAY_SIZE(scale_bench_tests); i++) {
+		if (!all && strcmp(name, scale_bench_tests[i].name))
+			continue;
+
+		ret = scale_bench_test_run(&scale_bench_tests[i]);
+		if (ret)
+			break;
+	}
+
+	mutex_unlock(&scale_bench_mutex);
+
+	return ret ? ret : count;
+}
+
+static const struct file_operations scale_bench_run_fops = {
+	.owner	= THIS_MODULE,
+	.open	= nonseekable_open,
+	.write	= scale_bench_run_write,
+	.llseek	= no_llseek,
+};
+
+static int scale_bench_tests_show(struct seq_file *m, void *v)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(scale_bench_tests); i++)
+		seq_printf(m, "%s\n", scale_bench_tests[i].name);
+
+	return 0;
+}
+
+static int scale_bench_tests_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, scale_bench_tests_show, NULL);
+}
+
+static const struct file_operations scale_bench_tests_fops = {
+	.owner		= THIS_MODULE,
+	.open		= scale_bench_tests_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int scale_bench_results_show(struct seq_file *m, void *v)
+{
+	unsigned int i;
+
+	mutex_lock(&scale_bench_mutex);
+
+	seq_puts(m, "# test cpus nodes ops ns ops_per_sec min_thread_ops max_thread_ops\n");
+	for (i = 0; i < nr_results; i++) {
+		struct scale_bench_result *res = &results[i];
+
+		seq_printf(m, "%s %u %u %llu %llu %llu %llu %llu\n",
+			   res->name, res->cpus, res->nodes, res->ops, res->ns,
+			   res->ns ? div64_u64(res->ops * NSEC_PER_SEC, res->ns) : 0,
+			   res->min_ops, res->max_ops);
+	}
+
+	mutex_unlock(&scale_bench_mutex);
+
+	return 0;
+}
+
+static int scale_bench_results_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, scale_bench_results_show, NULL);
+}
+
+static const struct file_operations scale_bench_results_fops = {
+	.owner		= THIS_MODULE,
+	.open		= scale_bench_results_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init scale_bench_init(void)
+{
+	scale_bench_dir = debugfs_create_dir("scale_benchmark", NULL);
+	if (!scale_bench_dir)
+		return -ENOMEM;
+
+	debugfs_create_u32("duration_ms", 0600, scale_bench_dir, &duration_ms);
+	debugfs_create_u32("max_cpus", 0600, scale_bench_dir, &max_cpus);
+	debugfs_create_file("tests", 0400, scale_bench_dir, NULL,
+			    &scale_bench_tests_fops);
+	debugfs_create_file("run", 0200, scale_bench_dir, NULL,
+			    &scale_bench_run_fops);
+	debugfs_create_file("results", 0400, scale_bench_dir, NULL,
+			    &scale_bench_results_fops);
+
+	return 0;
+}
+module_init(scale_bench_init);
+
+static void __exit scale_bench_exit(void)
+{
+	debugfs_remove_recursive(scale_bench_dir);
+}
+module_exit(scale_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("CPU and NUMA node scaling benchmarks");
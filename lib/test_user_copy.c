@@ -18,9 +18,12 @@
 
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include <linux/mman.h>
 #include <linux/module.h>
 #include <linux/sched.h>
+#include <linux/sizes.h>
 #include <linux/slab.h>
 #include <linux/uaccess.h>
 #include <linux/vmalloc.h>
@@ -39,6 +42,13 @@
 # define TEST_U64
 #endif
 
+static bool bench;
+module_param(bench, bool, 0444);
+MODULE_PARM_DESC(bench, "Report copy throughput for sizes from 4K to 1M");
+
+#define BENCH_MAX_SIZE	SZ_1M
+#define BENCH_BYTES	SZ_256M
+
 #define test(condition, msg)		\
 ({					\
 	int cond = (condition);		\
@@ -47,6 +57,94 @@
 	cond;				\
 })
 
+enum bench_op {
+	BENCH_MEMCPY,
+	BENCH_TO_USER,
+	BENCH_FROM_USER,
+};
+
+static const char * const bench_names[] = {
+	[BENCH_MEMCPY]		= "memcpy",
+	[BENCH_TO_USER]		= "copy_to_user",
+	[BENCH_FROM_USER]	= "copy_from_user",
+};
+
+static int bench_one(enum bench_op op, char *kmem, char __user *usermem,
+		     size_t size)
+{
+	unsigned long loops = BENCH_BYTES / size;
+	unsigned long i;
+	u64 ns;
+	ktime_t start;
+
+	start = ktime_get();
+	for (i = 0; i < loops; i++) {
+		switch (op) {
+		case BENCH_MEMCPY:
+			memcpy(kmem + BENCH_MAX_SIZE, kmem, size);
+			break;
+		case BENCH_TO_USER:
+			if (copy_to_user(usermem, kmem, size))
+				return -EFAULT;
+			break;
+		case BENCH_FROM_USER:
+			if (copy_from_user(kmem, usermem, size))
+				return -EFAULT;
+			break;
+		}
+		cond_resched();
+	}
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start)) ? : 1;
+
+	pr_info("%-14s %7zu bytes: %llu MB/s\n", bench_names[op], size,
+		div64_u64((u64)loops * size * NSEC_PER_SEC, ns) >> 20);
+
+	return 0;
+}
+
+/*
+ * Copy BENCH_BYTES in chunks of each size, so the large sizes show the
+ * effect of the size tiered copy paths while the small ones stay cache hot.
+ */
+static int user_copy_bench(void)
+{
+	unsigned long user_addr;
+	char *kmem;
+	size_t size;
+	int op;
+	int ret = 0;
+
+	kmem = vmalloc(BENCH_MAX_SIZE * 2);
+	if (!kmem)
+		return -ENOMEM;
+
+	user_addr = vm_mmap(NULL, 0, BENCH_MAX_SIZE, PROT_READ | PROT_WRITE,
+			    MAP_ANONYMOUS | MAP_PRIVATE, 0);
+	if (user_addr >= (unsigned long)(TASK_SIZE)) {
+		pr_warn("Failed to allocate user memory\n");
+		vfree(kmem);
+		return -ENOMEM;
+	}
+
+	memset(kmem, 0x5a, BENCH_MAX_SIZE * 2);
+	/* Fault the user buffer in before timing anything. */
+	if (copy_to_user((char __user *)user_addr, kmem, BENCH_MAX_SIZE)) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	for (op = BENCH_MEMCPY; op <= BENCH_FROM_USER && !ret; op++)
+		for (size = SZ_4K; size <= BENCH_MAX_SIZE && !ret; size <<= 1)
+			ret = bench_one(op, kmem, (char __user *)user_addr,
+					size);
+
+out:
+	vm_munmap(user_addr, BENCH_MAX_SIZE);
+	vfree(kmem);
+
+	return ret;
+}
+
 static int __init test_user_copy_init(void)
 {
 	int ret = 0;
@@ -175,6 +273,9 @@ static int __init test_user_copy_init(void)
 	vm_munmap(user_addr, PAGE_SIZE * 2);
 	kfree(kmem);
 
+	if (bench)
+		ret |= test(user_copy_bench(), "copy benchmark failed");
+
 	if (ret == 0) {
 		pr_info("tests passed.\n");
 		return 0;
@@ -13,8 +13,20 @@
 #include <linux/sched.h>
 #include <linux/atomic.h>
 #include <linux/nmi.h>
-#include <linux/sched/clock.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/cpumask.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/shrinker.h>
+#include <linux/mempolicy.h>
+#include <linux/cpuset.h>
+#include <linux/percpu.h>
+#include <uapi/linux/sched/types.h>
+
+#include "internal.h"
 
 #define CFP_DEFAULT_TIMEOUT 2000
 #define for_each_populated_zone_pgdat(pgdat, zone) \
@@ -25,18 +37,31 @@
 			; /* do nothing */      \
 		else
 
+/*
+ * Each node is cleared by several workers, worker @index of @nr takes the
+ * same slice of every zone of the node.
+ */
 struct pgdat_entry {
 	struct pglist_data *pgdat;
+	unsigned int index;
+	unsigned int nr;
 	struct work_struct work;
 };
 
 static DECLARE_WAIT_QUEUE_HEAD(clear_freelist_wait);
 static DEFINE_MUTEX(clear_freelist_lock);
 static atomic_t clear_freelist_workers;
-static atomic_t clear_pages_num;
+static atomic_long_t clear_pages_num;
 static ulong cfp_timeout_ms = CFP_DEFAULT_TIMEOUT;
+/* workers per node, 0 means half of the cpus of the node */
+static uint cfp_node_workers;
 static int one = 1;
 
+/* statistics of the current or the last run */
+static u64 cfp_start_ns;
+static u64 cfp_end_ns;
+static bool cfp_timed_out;
+
 /*
  * next_pgdat_zone - helper magic for for_each_populated_zone_pgdat()
  */
@@ -51,44 +76,77 @@ static struct zone *next_pgdat_zone(struct zone *zone)
 	return zone;
 }
 
-static void clear_pgdat_freelist_pages(struct work_struct *work)
+/*
+ * Clear the free pages in one MAX_ORDER block. Buddy pages never cross
+ * such a block, and they are stable while the zone lock is held.
+ */
+static void clear_zone_block_pages(struct zone *zone, unsigned long pfn)
 {
-	struct pgdat_entry *entry = container_of(work, struct pgdat_entry, work);
-	u64 cfp_timeout_ns = cfp_timeout_ms * NSEC_PER_MSEC;
-	struct pglist_data *pgdat = entry->pgdat;
-	unsigned long flags, order, t;
+	unsigned long end_pfn = pfn + MAX_ORDER_NR_PAGES;
+	unsigned long flags, order, cleared = 0;
 	struct page *page;
-	struct zone *zone;
-	u64 start, now;
 
-	start = sched_clock();
+	if (!pfn_valid(pfn))
+		return;
 
-	for_each_populated_zone_pgdat(pgdat, zone) {
-		spin_lock_irqsave(&zone->lock, flags);
-		for_each_migratetype_order(order, t) {
-			list_for_each_entry(page, &zone->free_area[order].free_list[t], lru) {
-				now = sched_clock();
-				if (unlikely(now - start > cfp_timeout_ns)) {
-					spin_unlock_irqrestore(&zone->lock, flags);
-					goto out;
-				}
+	spin_lock_irqsave(&zone->lock, flags);
+	while (pfn < end_pfn) {
+		if (!pfn_valid_within(pfn)) {
+			pfn++;
+			continue;
+		}
+		page = pfn_to_page(pfn);
+		if (!PageBuddy(page) || page_zone(page) != zone) {
+			pfn++;
+			continue;
+		}
 
+		order = page_order(page);
 #ifdef CONFIG_KMAP_LOCAL
-				int i;
+		{
+			int i;
 
-				/* Clear highmem by clear_highpage() */
-				for (i = 0; i < (1 << order); i++)
-					clear_highpage(page + i);
+			/* Clear highmem by clear_highpage() */
+			for (i = 0; i < (1 << order); i++)
+				clear_highpage(page + i);
+		}
 #else
-				memset(page_address(page), 0, (1 << order) * PAGE_SIZE);
+		memset(page_address(page), 0, (1 << order) * PAGE_SIZE);
 #endif
-				touch_nmi_watchdog();
-				atomic_add(1 << order, &clear_pages_num);
+		cleared += 1 << order;
+		pfn += 1 << order;
+	}
+	spin_unlock_irqrestore(&zone->lock, flags);
+
+	touch_nmi_watchdog();
+	atomic_long_add(cleared, &clear_pages_num);
+}
+
+static void clear_pgdat_freelist_pages(struct work_struct *work)
+{
+	struct pgdat_entry *entry = container_of(work, struct pgdat_entry, work);
+	u64 cfp_timeout_ns = cfp_timeout_ms * NSEC_PER_MSEC;
+	struct pglist_data *pgdat = entry->pgdat;
+	unsigned long start_pfn, end_pfn, nr_blocks, per_worker, pfn;
+	struct zone *zone;
+
+	for_each_populated_zone_pgdat(pgdat, zone) {
+		start_pfn = round_down(zone->zone_start_pfn, MAX_ORDER_NR_PAGES);
+		end_pfn = zone_end_pfn(zone);
+		nr_blocks = DIV_ROUND_UP(end_pfn - start_pfn, MAX_ORDER_NR_PAGES);
+		per_worker = DIV_ROUND_UP(nr_blocks, entry->nr);
+
+		pfn = start_pfn + entry->index * per_worker * MAX_ORDER_NR_PAGES;
+		end_pfn = min(end_pfn, pfn + per_worker * MAX_ORDER_NR_PAGES);
+		/* the zone lock is only held for one block at a time */
+		for (; pfn < end_pfn; pfn += MAX_ORDER_NR_PAGES) {
+			if (unlikely(ktime_get_ns() - cfp_start_ns > cfp_timeout_ns)) {
+				WRITE_ONCE(cfp_timed_out, true);
+				goto out;
 			}
+			clear_zone_block_pages(zone, pfn);
+			cond_resched();
 		}
-		spin_unlock_irqrestore(&zone->lock, flags);
-
-		cond_resched();
 	}
 
 out:
@@ -98,17 +156,33 @@ static void clear_pgdat_freelist_pages(struct work_struct *work)
 		wake_up(&clear_freelist_wait);
 }
 
-static void init_clear_freelist_work(struct pglist_data *pgdat)
+static unsigned int nr_node_workers(int nid)
 {
-	struct pgdat_entry *entry;
+	unsigned int nr = cfp_node_workers;
 
-	entry = kzalloc(sizeof(struct pgdat_entry), GFP_KERNEL);
-	if (!entry)
-		return;
+	if (!nr)
+		nr = cpumask_weight(cpumask_of_node(nid)) / 2;
+	return max(nr, 1U);
+}
 
-	entry->pgdat = pgdat;
-	INIT_WORK(&entry->work, clear_pgdat_freelist_pages);
-	queue_work_node(pgdat->node_id, system_unbound_wq, &entry->work);
+static void init_clear_freelist_work(struct pglist_data *pgdat)
+{
+	struct pgdat_entry *entry;
+	unsigned int i, nr;
+
+	nr = nr_node_workers(pgdat->node_id);
+	for (i = 0; i < nr; i++) {
+		entry = kzalloc(sizeof(struct pgdat_entry), GFP_KERNEL);
+		if (!entry)
+			return;
+
+		entry->pgdat = pgdat;
+		entry->index = i;
+		entry->nr = nr;
+		INIT_WORK(&entry->work, clear_pgdat_freelist_pages);
+		atomic_inc(&clear_freelist_workers);
+		queue_work_node(pgdat->node_id, system_unbound_wq, &entry->work);
+	}
 }
 
 static void clear_freelist_pages(void)
@@ -118,20 +192,298 @@ static void clear_freelist_pages(void)
 	mutex_lock(&clear_freelist_lock);
 	drain_all_pages(NULL);
 
-	for_each_online_pgdat(pgdat) {
-		atomic_inc(&clear_freelist_workers);
-		init_clear_freelist_work(pgdat);
-	}
+	atomic_long_set(&clear_pages_num, 0);
+	WRITE_ONCE(cfp_timed_out, false);
+	WRITE_ONCE(cfp_end_ns, 0);
+	WRITE_ONCE(cfp_start_ns, ktime_get_ns());
 
-	wait_event(clear_freelist_wait, atomic_read(&clear_freelist_workers) == 0);
+	/* hold a reference so that early workers can not wake us up too soon */
+	atomic_inc(&clear_freelist_workers);
+	for_each_online_pgdat(pgdat)
+		init_clear_freelist_work(pgdat);
+	if (!atomic_dec_and_test(&clear_freelist_workers))
+		wait_event(clear_freelist_wait,
+			   atomic_read(&clear_freelist_workers) == 0);
 
-	pr_debug("Cleared pages %d\nFree pages %lu\n", atomic_read(&clear_pages_num),
+	WRITE_ONCE(cfp_end_ns, ktime_get_ns());
+	pr_debug("Cleared pages %ld\nFree pages %lu\n",
+		atomic_long_read(&clear_pages_num),
 		global_zone_page_state(NR_FREE_PAGES));
-	atomic_set(&clear_pages_num, 0);
 
 	mutex_unlock(&clear_freelist_lock);
 }
 
+/*
+ * Pre-zeroed page pool: an idle priority kthread keeps prezero_pool_ratio
+ * percent of the free memory of each node allocated and zeroed, so that
+ * the anonymous fault path can skip clearing the page. The pool is given
+ * back under memory pressure through a shrinker.
+ */
+#define PREZERO_BATCH	32
+#define PREZERO_LOW	(4 * PREZERO_BATCH)
+
+struct prezero_pool {
+	spinlock_t lock;
+	struct list_head pages;
+	unsigned long nr;
+};
+
+DEFINE_STATIC_KEY_FALSE(prezero_pool_enabled);
+static struct prezero_pool *prezero_pools;
+static int prezero_pool_ratio;
+static int zero;
+static int hundred = 100;
+static DEFINE_MUTEX(prezero_ratio_lock);
+static DECLARE_WAIT_QUEUE_HEAD(prezero_wait);
+static DEFINE_PER_CPU(unsigned long, prezero_hits);
+static DEFINE_PER_CPU(unsigned long, prezero_misses);
+
+/* Return a pre-zeroed page of the local node, or NULL if there is none. */
+struct page *__alloc_prezeroed_page(struct vm_area_struct *vma)
+{
+	struct prezero_pool *pool;
+	struct page *page = NULL;
+	int nid = numa_node_id();
+
+	/* the pool neither knows about mempolicies nor about reliable memory */
+#ifdef CONFIG_NUMA
+	if (vma->vm_policy || current->mempolicy)
+		return NULL;
+#endif
+	if (mem_reliable_is_enabled())
+		return NULL;
+	if (!cpuset_node_allowed(nid, GFP_HIGHUSER_MOVABLE))
+		return NULL;
+
+	pool = &prezero_pools[nid];
+	spin_lock(&pool->lock);
+	if (pool->nr) {
+		page = list_first_entry(&pool->pages, struct page, lru);
+		list_del(&page->lru);
+		pool->nr--;
+	}
+	spin_unlock(&pool->lock);
+
+	if (page)
+		this_cpu_inc(prezero_hits);
+	else
+		this_cpu_inc(prezero_misses);
+	if (READ_ONCE(pool->nr) < PREZERO_LOW && waitqueue_active(&prezero_wait))
+		wake_up_interruptible(&prezero_wait);
+	return page;
+}
+
+static unsigned long prezero_drain_node(int nid, unsigned long nr_to_scan)
+{
+	struct prezero_pool *pool = &prezero_pools[nid];
+	struct page *page, *next;
+	unsigned long freed = 0;
+	LIST_HEAD(list);
+
+	spin_lock(&pool->lock);
+	list_for_each_entry_safe(page, next, &pool->pages, lru) {
+		if (freed >= nr_to_scan)
+			break;
+		list_move(&page->lru, &list);
+		freed++;
+	}
+	pool->nr -= freed;
+	spin_unlock(&pool->lock);
+
+	list_for_each_entry_safe(page, next, &list, lru) {
+		list_del(&page->lru);
+		__free_page(page);
+	}
+	return freed;
+}
+
+/* stop filling the pool well above the point where kswapd wakes up */
+static bool prezero_node_has_room(int nid)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+	unsigned long wmark = 0;
+	struct zone *zone;
+
+	for_each_populated_zone_pgdat(pgdat, zone)
+		wmark += high_wmark_pages(zone);
+	return sum_zone_node_page_state(nid, NR_FREE_PAGES) > 2 * wmark;
+}
+
+static unsigned long prezero_target(int nid)
+{
+	unsigned long free = sum_zone_node_page_state(nid, NR_FREE_PAGES);
+
+	return (free + READ_ONCE(prezero_pools[nid].nr)) *
+		READ_ONCE(prezero_pool_ratio) / 100;
+}
+
+static void prezero_fill_node(int nid)
+{
+	struct prezero_pool *pool = &prezero_pools[nid];
+	gfp_t gfp = (GFP_HIGHUSER_MOVABLE | __GFP_THISNODE | __GFP_NOWARN) &
+		~__GFP_RECLAIM;
+	struct page *page;
+	LIST_HEAD(batch);
+	int i;
+
+	while (READ_ONCE(pool->nr) < prezero_target(nid) &&
+	       prezero_node_has_room(nid) && !kthread_should_stop()) {
+		for (i = 0; i < PREZERO_BATCH; i++) {
+			page = alloc_pages_node(nid, gfp, 0);
+			if (!page)
+				break;
+			clear_highpage(page);
+			list_add(&page->lru, &batch);
+		}
+		if (!i)
+			return;
+
+		spin_lock(&pool->lock);
+		list_splice_init(&batch, &pool->pages);
+		pool->nr += i;
+		spin_unlock(&pool->lock);
+		cond_resched();
+	}
+}
+
+static int prezero_thread_fn(void *unused)
+{
+	struct sched_param param = { .sched_priority = 0 };
+	int nid;
+
+	sched_setscheduler_nocheck(current, SCHED_IDLE, &param);
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		if (static_branch_unlikely(&prezero_pool_enabled)) {
+			for_each_online_node(nid)
+				prezero_fill_node(nid);
+		}
+		wait_event_freezable_timeout(prezero_wait,
+					     kthread_should_stop(), HZ);
+	}
+	return 0;
+}
+
+static unsigned long prezero_shrink_count(struct shrinker *shrink,
+					  struct shrink_control *sc)
+{
+	return READ_ONCE(prezero_pools[sc->nid].nr);
+}
+
+static unsigned long prezero_shrink_scan(struct shrinker *shrink,
+					 struct shrink_control *sc)
+{
+	return prezero_drain_node(sc->nid, sc->nr_to_scan);
+}
+
+static struct shrinker prezero_shrinker = {
+	.count_objects = prezero_shrink_count,
+	.scan_objects = prezero_shrink_scan,
+	.seeks = 1,
+	.flags = SHRINKER_NUMA_AWARE,
+};
+
+static int sysctl_prezero_ratio_handler(struct ctl_table *table, int write,
+		void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	int ret, nid;
+
+	mutex_lock(&prezero_ratio_lock);
+	ret = proc_dointvec_minmax(table, write, buffer, lenp, ppos);
+	if (ret || !write)
+		goto out;
+
+	if (prezero_pool_ratio) {
+		/* prezero_pool_init() failed at boot */
+		if (!prezero_pools) {
+			prezero_pool_ratio = 0;
+			ret = -ENOMEM;
+			goto out;
+		}
+		if (!static_key_enabled(&prezero_pool_enabled))
+			static_branch_enable(&prezero_pool_enabled);
+		wake_up_interruptible(&prezero_wait);
+	} else if (static_key_enabled(&prezero_pool_enabled)) {
+		static_branch_disable(&prezero_pool_enabled);
+		for_each_node(nid)
+			prezero_drain_node(nid, ULONG_MAX);
+	}
+out:
+	mutex_unlock(&prezero_ratio_lock);
+	return ret;
+}
+
+static int __init prezero_pool_init(void)
+{
+	struct task_struct *thread;
+	int nid;
+
+	prezero_pools = kcalloc(nr_node_ids, sizeof(struct prezero_pool),
+				GFP_KERNEL);
+	if (!prezero_pools)
+		return -ENOMEM;
+	for_each_node(nid) {
+		spin_lock_init(&prezero_pools[nid].lock);
+		INIT_LIST_HEAD(&prezero_pools[nid].pages);
+	}
+
+	thread = kthread_run(prezero_thread_fn, NULL, "kprezerod");
+	if (IS_ERR(thread))
+		goto free;
+	if (register_shrinker(&prezero_shrinker)) {
+		kthread_stop(thread);
+		goto free;
+	}
+	return 0;
+
+free:
+	kfree(prezero_pools);
+	prezero_pools = NULL;
+	return -ENOMEM;
+}
+
+static int clear_freelist_stat_show(struct seq_file *m, void *v)
+{
+	u64 start = READ_ONCE(cfp_start_ns);
+	u64 end = READ_ONCE(cfp_end_ns);
+	long cleared = atomic_long_read(&clear_pages_num);
+	u64 elapsed, rate = 0;
+
+	if (prezero_pools) {
+		unsigned long pages = 0, hits = 0, misses = 0;
+		int nid, cpu;
+
+		for_each_node(nid)
+			pages += READ_ONCE(prezero_pools[nid].nr);
+		for_each_possible_cpu(cpu) {
+			hits += per_cpu(prezero_hits, cpu);
+			misses += per_cpu(prezero_misses, cpu);
+		}
+		seq_printf(m, "prezero_pages: %lu\n", pages);
+		seq_printf(m, "prezero_hits: %lu\n", hits);
+		seq_printf(m, "prezero_misses: %lu\n", misses);
+	}
+
+	if (!start) {
+		seq_puts(m, "state: idle\n");
+		return 0;
+	}
+
+	if (!end)
+		end = ktime_get_ns();
+	elapsed = end - start;
+	if (elapsed)
+		rate = div64_u64((u64)cleared * NSEC_PER_SEC, elapsed);
+
+	seq_printf(m, "state: %s\n", !READ_ONCE(cfp_end_ns) ? "running" :
+		   (READ_ONCE(cfp_timed_out) ? "timeout" : "done"));
+	seq_printf(m, "cleared_pages: %ld\n", cleared);
+	seq_printf(m, "elapsed_ms: %llu\n", div64_u64(elapsed, NSEC_PER_MSEC));
+	seq_printf(m, "pages_per_sec: %llu\n", rate);
+	return 0;
+}
+
 static int sysctl_clear_freelist_handler(struct ctl_table *table, int write,
 		void __user *buffer, size_t *lenp, loff_t *ppos)
 {
@@ -157,6 +509,15 @@ static struct ctl_table clear_freelist_table[] = {
 		.extra1     = &one,
 		.extra2     = &one,
 	},
+	{
+		.procname   = "prezero_pool_ratio",
+		.data       = &prezero_pool_ratio,
+		.maxlen     = sizeof(int),
+		.mode       = 0644,
+		.proc_handler   = &sysctl_prezero_ratio_handler,
+		.extra1     = &zero,
+		.extra2     = &hundred,
+	},
 	{ }
 };
 
@@ -179,10 +540,16 @@ __setup("clear_freelist", setup_clear_freelist);
 
 static int __init clear_freelist_init(void)
 {
-	if (clear_freelist_enabled)
+	if (clear_freelist_enabled) {
+		if (prezero_pool_init())
+			pr_warn("Pre-zeroed page pool is not available.\n");
 		register_sysctl_table(sys_ctl_table);
+		proc_create_single("clear_freelist_stat", 0444, NULL,
+				   clear_freelist_stat_show);
+	}
 
 	return 0;
 }
 module_init(clear_freelist_init);
 module_param(cfp_timeout_ms, ulong, 0644);
+module_param(cfp_node_workers, uint, 0644);
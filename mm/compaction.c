@@ -22,6 +22,7 @@
 #include <linux/kthread.h>
 #include <linux/freezer.h>
 #include <linux/page_owner.h>
+#include <linux/psi.h>
 #include "internal.h"
 
 #ifdef CONFIG_COMPACTION
@@ -133,6 +134,98 @@ EXPORT_SYMBOL(__ClearPageMovable);
 /* Do not skip compaction more than 64 times */
 #define COMPACT_MAX_DEFER_SHIFT 6
 
+/*
+ * Fragmentation score check interval for proactive compaction purposes.
+ */
+#define HPAGE_FRAG_CHECK_INTERVAL_MSEC	500
+
+/*
+ * Page order with-respect-to which proactive compaction calculates
+ * external fragmentation, which is used as the "fragmentation score"
+ * of a node/zone.
+ */
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+#define COMPACTION_HPAGE_ORDER	HPAGE_PMD_ORDER
+#else
+#define COMPACTION_HPAGE_ORDER	min_t(unsigned int, PMD_SHIFT - PAGE_SHIFT, \
+				      MAX_ORDER - 1)
+#endif
+
+/*
+ * A zone's fragmentation score is the external fragmentation wrt the
+ * COMPACTION_HPAGE_ORDER. It returns a value in the range [0, 100].
+ */
+static unsigned int fragmentation_score_zone(struct zone *zone)
+{
+	return extfrag_for_order(zone, COMPACTION_HPAGE_ORDER);
+}
+
+/*
+ * The weighted score is the zone's fragmentation score scaled by the
+ * zone's share of the node's present pages, so that small zones like
+ * ZONE_DMA don't dominate the node's score.
+ */
+static unsigned int fragmentation_score_zone_weighted(struct zone *zone)
+{
+	unsigned long score;
+
+	score = zone->present_pages * fragmentation_score_zone(zone);
+	return div64_ul(score, zone->zone_pgdat->node_present_pages + 1);
+}
+
+/*
+ * The per-node proactive (background) compaction process is started by
+ * its corresponding kcompactd thread when the node's fragmentation score
+ * exceeds the high threshold. The compaction process remains active till
+ * the node's score falls below the low threshold, or one of the back-off
+ * conditions is met.
+ */
+static unsigned int fragmentation_score_node(pg_data_t *pgdat)
+{
+	unsigned int score = 0;
+	int zoneid;
+
+	for (zoneid = 0; zoneid < MAX_NR_ZONES; zoneid++) {
+		struct zone *zone;
+
+		zone = &pgdat->node_zones[zoneid];
+		if (!populated_zone(zone))
+			continue;
+		score += fragmentation_score_zone_weighted(zone);
+	}
+
+	return score;
+}
+
+static unsigned int fragmentation_score_wmark(bool low)
+{
+	unsigned int wmark_low;
+
+	/*
+	 * Cap the low watermark to avoid excessive compaction activity
+	 * in case a user sets the proactiveness tunable close to 100.
+	 */
+	wmark_low = max(100U - sysctl_compaction_proactiveness, 5U);
+	return low ? wmark_low : min(wmark_low + 10, 100U);
+}
+
+/* Back off while kswapd is busy, it would only undo our work */
+static inline bool kswapd_is_running(pg_data_t *pgdat)
+{
+	return pgdat->kswapd && (pgdat->kswapd->state == TASK_RUNNING);
+}
+
+static bool should_proactive_compact_node(pg_data_t *pgdat)
+{
+	unsigned int wmark_high;
+
+	if (!sysctl_compaction_proactiveness || kswapd_is_running(pgdat))
+		return false;
+
+	wmark_high = fragmentation_score_wmark(false);
+	return fragmentation_score_node(pgdat) > wmark_high;
+}
+
 /*
  * Compaction is deferred when compaction fails to result in a page
  * allocation success. 1 << compact_defer_limit compactions are skipped up
@@ -377,14 +470,8 @@ static bool compact_trylock_irqsave(spinlock_t *lock, unsigned long *flags,
  * Returns false when compaction can continue (sync compaction might have
  *		scheduled)
  */
-static bool compact_unlock_should_abort(spinlock_t *lock,
-		unsigned long flags, bool *locked, struct compact_control *cc)
+static bool compact_check_abort(struct compact_control *cc)
 {
-	if (*locked) {
-		spin_unlock_irqrestore(lock, flags);
-		*locked = false;
-	}
-
 	if (fatal_signal_pending(current)) {
 		cc->contended = true;
 		return true;
@@ -401,6 +488,29 @@ static bool compact_unlock_should_abort(spinlock_t *lock,
 	return false;
 }
 
+static bool compact_unlock_should_abort(spinlock_t *lock,
+		unsigned long flags, bool *locked, struct compact_control *cc)
+{
+	if (*locked) {
+		spin_unlock_irqrestore(lock, flags);
+		*locked = false;
+	}
+
+	return compact_check_abort(cc);
+}
+
+/*
+ * isolate_migratepages_block() keeps the lru_lock of the lruvec of the
+ * pages it scans, together with an RCU read lock which keeps that lruvec
+ * from being freed with its memcg: the scanned pages hold no reference.
+ */
+static void compact_unlock_lruvec(struct lruvec **locked, unsigned long flags)
+{
+	spin_unlock_irqrestore(&(*locked)->lru_lock, flags);
+	rcu_read_unlock();
+	*locked = NULL;
+}
+
 /*
  * Aside from avoiding lock contention, compaction also periodically checks
  * need_resched() and either schedules in sync compaction or aborts async
@@ -695,8 +805,8 @@ isolate_migratepages_block(struct compact_control *cc, unsigned long low_pfn,
 	struct zone *zone = cc->zone;
 	unsigned long nr_scanned = 0, nr_isolated = 0;
 	struct lruvec *lruvec;
+	struct lruvec *locked = NULL;
 	unsigned long flags = 0;
-	bool locked = false;
 	struct page *page = NULL, *valid_page = NULL;
 	unsigned long start_pfn = low_pfn;
 	bool skip_on_failure = false;
@@ -757,11 +867,13 @@ isolate_migratepages_block(struct compact_control *cc, unsigned long low_pfn,
 		 * contention, to give chance to IRQs. Abort completely if
 		 * a fatal signal is pending.
 		 */
-		if (!(low_pfn % SWAP_CLUSTER_MAX)
-		    && compact_unlock_should_abort(zone_lru_lock(zone), flags,
-								&locked, cc)) {
-			low_pfn = 0;
-			goto fatal_pending;
+		if (!(low_pfn % SWAP_CLUSTER_MAX)) {
+			if (locked)
+				compact_unlock_lruvec(&locked, flags);
+			if (compact_check_abort(cc)) {
+				low_pfn = 0;
+				goto fatal_pending;
+			}
 		}
 
 		if (!pfn_valid_within(low_pfn))
@@ -819,11 +931,8 @@ isolate_migratepages_block(struct compact_control *cc, unsigned long low_pfn,
 			 */
 			if (unlikely(__PageMovable(page)) &&
 					!PageIsolated(page)) {
-				if (locked) {
-					spin_unlock_irqrestore(zone_lru_lock(zone),
-									flags);
-					locked = false;
-				}
+				if (locked)
+					compact_unlock_lruvec(&locked, flags);
 
 				if (!isolate_movable_page(page, isolate_mode))
 					goto isolate_success;
@@ -849,14 +958,23 @@ isolate_migratepages_block(struct compact_control *cc, unsigned long low_pfn,
 			goto isolate_fail;
 
 		/* If we already hold the lock, we can skip some rechecking */
-		if (!locked) {
-			locked = compact_trylock_irqsave(zone_lru_lock(zone),
-								&flags, cc);
-			if (!locked)
+		rcu_read_lock();
+		lruvec = mem_cgroup_page_lruvec(page, zone->zone_pgdat);
+		if (lruvec != locked) {
+			if (locked)
+				compact_unlock_lruvec(&locked, flags);
+
+			if (!compact_trylock_irqsave(&lruvec->lru_lock,
+						     &flags, cc)) {
+				rcu_read_unlock();
 				break;
+			}
+			/* the RCU read lock now goes with the lru_lock */
+			locked = lruvec;
 
-			/* Recheck PageLRU and PageCompound under lock */
-			if (!PageLRU(page))
+			/* Recheck PageLRU, memcg and PageCompound under lock */
+			if (!PageLRU(page) ||
+			    !lruvec_holds_page_lru_lock(page, lruvec))
 				goto isolate_fail;
 
 			/*
@@ -868,9 +986,14 @@ isolate_migratepages_block(struct compact_control *cc, unsigned long low_pfn,
 				low_pfn += (1UL << compound_order(page)) - 1;
 				goto isolate_fail;
 			}
-		}
+		} else {
+			rcu_read_unlock();
 
-		lruvec = mem_cgroup_page_lruvec(page, zone->zone_pgdat);
+			/* The page may have moved since the lookup above */
+			if (!PageLRU(page) ||
+			    !lruvec_holds_page_lru_lock(page, lruvec))
+				goto isolate_fail;
+		}
 
 		/* Try isolate the page */
 		if (__isolate_lru_page(page, isolate_mode) != 0)
@@ -914,10 +1037,8 @@ isolate_migratepages_block(struct compact_control *cc, unsigned long low_pfn,
 		 * page anyway.
 		 */
 		if (nr_isolated) {
-			if (locked) {
-				spin_unlock_irqrestore(zone_lru_lock(zone), flags);
-				locked = false;
-			}
+			if (locked)
+				compact_unlock_lruvec(&locked, flags);
 			putback_movable_pages(&cc->migratepages);
 			cc->nr_migratepages = 0;
 			cc->last_migrated_pfn = 0;
@@ -942,7 +1063,7 @@ isolate_migratepages_block(struct compact_control *cc, unsigned long low_pfn,
 		low_pfn = end_pfn;
 
 	if (locked)
-		spin_unlock_irqrestore(zone_lru_lock(zone), flags);
+		compact_unlock_lruvec(&locked, flags);
 
 	/*
 	 * Update the pageblock-skip information and cached scanner pfn,
@@ -1345,6 +1466,17 @@ static enum compact_result __compact_finished(struct zone *zone,
 			return COMPACT_PARTIAL_SKIPPED;
 	}
 
+	if (cc->proactive_compaction) {
+		if (kswapd_is_running(zone->zone_pgdat))
+			return COMPACT_PARTIAL_SKIPPED;
+
+		if (fragmentation_score_zone(zone) >
+		    fragmentation_score_wmark(true))
+			return COMPACT_CONTINUE;
+
+		return COMPACT_SUCCESS;
+	}
+
 	if (is_via_compact_memory(cc->order))
 		return COMPACT_CONTINUE;
 
@@ -1744,6 +1876,13 @@ static enum compact_result compact_zone_order(struct zone *zone, int order,
 
 int sysctl_extfrag_threshold = 500;
 
+/*
+ * Tunable for proactive compaction. It determines how aggressively the
+ * kernel should compact memory in the background. It takes values in
+ * the range [0, 100], 0 disables proactive compaction.
+ */
+unsigned int __read_mostly sysctl_compaction_proactiveness = 20;
+
 /**
  * try_to_compact_pages - Direct compact to satisfy a high-order allocation
  * @gfp_mask: The GFP mask of the current allocation
@@ -1853,6 +1992,45 @@ static void compact_node(int nid)
 	}
 }
 
+/*
+ * Compact a node in the background until its fragmentation score drops
+ * below the low watermark.
+ */
+static void proactive_compact_node(pg_data_t *pgdat)
+{
+	int zoneid;
+	struct zone *zone;
+	struct compact_control cc = {
+		.order = -1,
+		.mode = MIGRATE_SYNC_LIGHT,
+		.ignore_skip_hint = true,
+		.whole_zone = true,
+		.gfp_mask = GFP_KERNEL,
+		.proactive_compaction = true,
+	};
+
+	for (zoneid = 0; zoneid < MAX_NR_ZONES; zoneid++) {
+		zone = &pgdat->node_zones[zoneid];
+		if (!populated_zone(zone))
+			continue;
+
+		if (kthread_should_stop())
+			return;
+
+		cc.zone = zone;
+
+		compact_zone(zone, &cc);
+
+		count_compact_events(KCOMPACTD_MIGRATE_SCANNED,
+				     cc.total_migrate_scanned);
+		count_compact_events(KCOMPACTD_FREE_SCANNED,
+				     cc.total_free_scanned);
+
+		VM_BUG_ON(!list_empty(&cc.freepages));
+		VM_BUG_ON(!list_empty(&cc.migratepages));
+	}
+}
+
 /* Compact all nodes in the system */
 static void compact_nodes(void)
 {
@@ -2054,6 +2232,8 @@ static int kcompactd(void *p)
 {
 	pg_data_t *pgdat = (pg_data_t*)p;
 	struct task_struct *tsk = current;
+	unsigned int proactive_defer = 0;
+	unsigned long pflags;
 
 	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
 
@@ -2067,10 +2247,35 @@ static int kcompactd(void *p)
 
 	while (!kthread_should_stop()) {
 		trace_mm_compaction_kcompactd_sleep(pgdat->node_id);
-		wait_event_freezable(pgdat->kcompactd_wait,
-				kcompactd_work_requested(pgdat));
+		if (wait_event_freezable_timeout(pgdat->kcompactd_wait,
+			kcompactd_work_requested(pgdat),
+			msecs_to_jiffies(HPAGE_FRAG_CHECK_INTERVAL_MSEC))) {
 
-		kcompactd_do_work(pgdat);
+			psi_memstall_enter(&pflags);
+			kcompactd_do_work(pgdat);
+			psi_memstall_leave(&pflags);
+			continue;
+		}
+
+		/* kcompactd wait timeout */
+		if (should_proactive_compact_node(pgdat)) {
+			unsigned int prev_score, score;
+
+			if (proactive_defer) {
+				proactive_defer--;
+				continue;
+			}
+			prev_score = fragmentation_score_node(pgdat);
+			proactive_compact_node(pgdat);
+			score = fragmentation_score_node(pgdat);
+			/*
+			 * Defer proactive compaction if the fragmentation
+			 * score did not go down i.e. no progress made, the
+			 * migration cost bought us nothing.
+			 */
+			proactive_defer = score < prev_score ?
+					0 : 1 << COMPACT_MAX_DEFER_SHIFT;
+		}
 	}
 
 	return 0;
@@ -24,6 +24,7 @@ char *migrate_reason_names[MR_TYPES] = {
 	"mempolicy_mbind",
 	"numa_misplaced",
 	"cma",
+	"mem_reliable",
 };
 
 const struct trace_print_flags pageflag_names[] = {
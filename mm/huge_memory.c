@@ -2593,15 +2593,11 @@ static void __split_huge_page_tail(struct page *head, int tail,
 }
 
 static void __split_huge_page(struct page *page, struct list_head *list,
-		pgoff_t end, unsigned long flags)
+		pgoff_t end, struct lruvec *lruvec, unsigned long flags)
 {
 	struct page *head = compound_head(page);
-	struct zone *zone = page_zone(head);
-	struct lruvec *lruvec;
 	int i;
 
-	lruvec = mem_cgroup_page_lruvec(head, zone->zone_pgdat);
-
 	/* complete memcg works before add pages to LRU */
 	mem_cgroup_split_huge_fixup(head);
 
@@ -2634,7 +2630,7 @@ static void __split_huge_page(struct page *page, struct list_head *list,
 		xa_unlock(&head->mapping->i_pages);
 	}
 
-	spin_unlock_irqrestore(zone_lru_lock(page_zone(head)), flags);
+	unlock_page_lruvec_irqrestore(lruvec, flags);
 
 	remap_page(head);
 
@@ -2782,6 +2778,7 @@ int split_huge_page_to_list(struct page *page, struct list_head *list)
 	struct deferred_split ds_queue;
 	struct anon_vma *anon_vma = NULL;
 	struct address_space *mapping = NULL;
+	struct lruvec *lruvec;
 	int extra_pins, ret;
 	bool mlocked;
 	unsigned long flags;
@@ -2850,7 +2847,7 @@ int split_huge_page_to_list(struct page *page, struct list_head *list)
 		lru_add_drain();
 
 	/* prevent PageLRU to go away from under us, and freeze lru stats */
-	spin_lock_irqsave(zone_lru_lock(page_zone(head)), flags);
+	lruvec = lock_page_lruvec_irqsave(head, &flags);
 
 	if (mapping) {
 		void **pslot;
@@ -2875,17 +2872,23 @@ int split_huge_page_to_list(struct page *page, struct list_head *list)
 			(*ds_queue.split_queue_len)--;
 			list_del(page_deferred_list(head));
 		}
-		if (mapping)
-			__dec_node_page_state(page, NR_SHMEM_THPS);
+		if (mapping) {
+			if (PageSwapBacked(page))
+				__dec_node_page_state(page, NR_SHMEM_THPS);
+			else {
+				__dec_node_page_state(page, NR_FILE_THPS);
+				filemap_nr_thps_dec(mapping);
+			}
+		}
 		spin_unlock(ds_queue.split_queue_lock);
-		__split_huge_page(page, list, end, flags);
+		__split_huge_page(page, list, end, lruvec, flags);
 		ret = 0;
 	} else {
 		spin_unlock(ds_queue.split_queue_lock);
 fail:
 		if (mapping)
 			xa_unlock(&mapping->i_pages);
-		spin_unlock_irqrestore(zone_lru_lock(page_zone(head)), flags);
+		unlock_page_lruvec_irqrestore(lruvec, flags);
 		remap_page(head);
 		ret = -EBUSY;
 	}
@@ -3,6 +3,7 @@
  * (C) Nadia Yvette Chambers, April 2004
  */
 #include <linux/list.h>
+#include <linux/llist.h>
 #include <linux/init.h>
 #include <linux/mm.h>
 #include <linux/seq_file.h>
@@ -33,6 +34,9 @@
 #include <linux/delay.h>
 #include <linux/migrate.h>
 #include <linux/mm_inline.h>
+#include <linux/pin_mem.h>
+#include <linux/ktask.h>
+#include <linux/ktime.h>
 
 #include <asm/page.h>
 #include <asm/pgtable.h>
@@ -47,6 +51,7 @@
 #include <linux/share_pool.h>
 #include <linux/memblock.h>
 #include "internal.h"
+#include "hugetlb_vmemmap.h"
 
 #if (defined CONFIG_DYNAMIC_HUGETLB) && (!defined __GENKSYMS__)
 #define CREATE_TRACE_POINTS
@@ -1231,16 +1236,11 @@ static inline void destroy_compound_gigantic_page(struct page *page,
 						unsigned int order) { }
 #endif
 
-static void update_and_free_page(struct hstate *h, struct page *page)
+static void __update_and_free_page(struct hstate *h, struct page *page)
 {
 	int i;
 	struct page *subpage = page;
 
-	if (hstate_is_gigantic(h) && !gigantic_page_supported())
-		return;
-
-	h->nr_huge_pages--;
-	h->nr_huge_pages_node[page_to_nid(page)]--;
 	for (i = 0; i < pages_per_huge_page(h);
 	     i++, subpage = mem_map_next(subpage, page, i)) {
 		subpage->flags &= ~(1 << PG_locked | 1 << PG_error |
@@ -1277,6 +1277,76 @@ static void update_and_free_page(struct hstate *h, struct page *page)
 	}
 }
 
+/*
+ * Pages whose vmemmap was freed need it allocated again before they can go
+ * back to the buddy allocator, which may sleep.  update_and_free_page() is
+ * called with hugetlb_lock held, so such pages are queued here and freed
+ * from a workqueue.  page->mapping is free to hold the llist_node.
+ */
+static LLIST_HEAD(hpage_freelist);
+
+static void add_hugetlb_page_back(struct hstate *h, struct page *page)
+{
+	int nid = page_to_nid(page);
+
+	INIT_LIST_HEAD(&page->lru);
+	spin_lock(&hugetlb_lock);
+	h->nr_huge_pages++;
+	h->nr_huge_pages_node[nid]++;
+	h->max_huge_pages++;
+	enqueue_huge_page(h, page);
+	spin_unlock(&hugetlb_lock);
+}
+
+static void free_hpage_workfn(struct work_struct *work)
+{
+	struct llist_node *node;
+
+	node = llist_del_all(&hpage_freelist);
+
+	while (node) {
+		struct page *page;
+		struct hstate *h;
+
+		page = container_of((struct address_space **)node,
+				    struct page, mapping);
+		node = node->next;
+		page->mapping = NULL;
+		h = page_hstate(page);
+
+		/*
+		 * If the vmemmap cannot be restored, the page is not
+		 * freeable: keep it in the pool rather than leak it.
+		 */
+		if (alloc_huge_page_vmemmap(h, page)) {
+			add_hugetlb_page_back(h, page);
+			continue;
+		}
+		__update_and_free_page(h, page);
+		cond_resched();
+	}
+}
+static DECLARE_WORK(free_hpage_work, free_hpage_workfn);
+
+static void update_and_free_page(struct hstate *h, struct page *page)
+{
+	if (hstate_is_gigantic(h) && !gigantic_page_supported())
+		return;
+
+	h->nr_huge_pages--;
+	h->nr_huge_pages_node[page_to_nid(page)]--;
+
+	if (!PageHugeVmemmapOptimized(page)) {
+		__update_and_free_page(h, page);
+		return;
+	}
+
+	/* Must not look like a free pool page while it sits on the list. */
+	ClearPageHugeFreed(page);
+	if (llist_add((struct llist_node *)&page->mapping, &hpage_freelist))
+		schedule_work(&free_hpage_work);
+}
+
 struct hstate *size_to_hstate(unsigned long size)
 {
 	struct hstate *h;
@@ -1463,6 +1533,8 @@ void free_huge_page(struct page *page)
 
 static void prep_new_huge_page(struct hstate *h, struct page *page, int nid)
 {
+	ClearPageHugeVmemmapOptimized(page);
+	free_huge_page_vmemmap(h, page);
 	INIT_LIST_HEAD(&page->lru);
 	set_compound_page_dtor(page, HUGETLB_PAGE_DTOR);
 	spin_lock(&hugetlb_lock);
@@ -1804,6 +1876,35 @@ int dissolve_free_huge_page(struct page *page)
 			goto retry;
 		}
 
+		list_del(&head->lru);
+		h->free_huge_pages--;
+		h->free_huge_pages_node[nid]--;
+		h->max_huge_pages--;
+
+		if (PageHugeVmemmapOptimized(head)) {
+			/*
+			 * The vmemmap must be back before the page is
+			 * dissolved: callers such as soft offline expect the
+			 * raw pages in the buddy allocator on return.
+			 */
+			h->nr_huge_pages--;
+			h->nr_huge_pages_node[nid]--;
+			ClearPageHugeFreed(head);
+			spin_unlock(&hugetlb_lock);
+
+			rc = alloc_huge_page_vmemmap(h, head);
+			if (rc) {
+				add_hugetlb_page_back(h, head);
+				return rc;
+			}
+			if (PageHWPoison(head) && page != head) {
+				SetPageHWPoison(page);
+				ClearPageHWPoison(head);
+			}
+			__update_and_free_page(h, head);
+			return 0;
+		}
+
 		/*
 		 * Move PageHWPoison flag from head page to the raw error page,
 		 * which makes any subpages rather than the error page reusable.
@@ -1812,10 +1913,6 @@ int dissolve_free_huge_page(struct page *page)
 			SetPageHWPoison(page);
 			ClearPageHWPoison(head);
 		}
-		list_del(&head->lru);
-		h->free_huge_pages--;
-		h->free_huge_pages_node[nid]--;
-		h->max_huge_pages--;
 		update_and_free_page(h, head);
 		rc = 0;
 	}
@@ -1851,6 +1948,92 @@ int dissolve_free_huge_pages(unsigned long start_pfn, unsigned long end_pfn)
 	return rc;
 }
 
+/*
+ * Split a free huge page of @h into pages of its demote size, in place and
+ * without going through the buddy allocator, so a fragmented system can
+ * still turn e.g. reserved 1G pages into 2M pages.  Called with hugetlb_lock
+ * held, which is dropped while the page is reworked and taken again before
+ * returning.
+ */
+static int demote_free_huge_page(struct hstate *h, struct page *page)
+{
+	struct hstate *target = size_to_hstate(PAGE_SIZE << h->demote_order);
+	unsigned long nr_pages = pages_per_huge_page(h);
+	unsigned long step = pages_per_huge_page(target);
+	int nid = page_to_nid(page);
+	struct page *subpage;
+	unsigned long i;
+	int rc;
+
+	list_del(&page->lru);
+	h->free_huge_pages--;
+	h->free_huge_pages_node[nid]--;
+	h->nr_huge_pages--;
+	h->nr_huge_pages_node[nid]--;
+	h->max_huge_pages--;
+	ClearPageHugeFreed(page);
+	/* No longer PageHuge(), so dissolve and memory failure leave it be. */
+	set_compound_page_dtor(page, NULL_COMPOUND_DTOR);
+	spin_unlock(&hugetlb_lock);
+
+	/* The tail struct pages are about to be rewritten. */
+	rc = alloc_huge_page_vmemmap(h, page);
+	if (rc) {
+		set_compound_page_dtor(page, HUGETLB_PAGE_DTOR);
+		add_hugetlb_page_back(h, page);
+		spin_lock(&hugetlb_lock);
+		return rc;
+	}
+
+	/* Tear the compound page down, leaving every refcount at zero. */
+	atomic_set(compound_mapcount_ptr(page), 0);
+	for (i = 1, subpage = page + 1; i < nr_pages;
+	     i++, subpage = mem_map_next(subpage, page, i))
+		clear_compound_head(subpage);
+	set_compound_order(page, 0);
+	__ClearPageHead(page);
+
+	for (i = 0; i < nr_pages; i += step) {
+		subpage = mem_map_offset(page, i);
+		subpage->mapping = NULL;
+		set_page_private(subpage, 0);
+		if (hstate_is_gigantic(target))
+			prep_compound_gigantic_page(subpage, target->order);
+		else
+			prep_compound_page(subpage, target->order);
+		prep_new_huge_page(target, subpage, nid);
+
+		spin_lock(&hugetlb_lock);
+		enqueue_huge_page(target, subpage);
+		target->max_huge_pages++;
+		spin_unlock(&hugetlb_lock);
+		cond_resched();
+	}
+
+	spin_lock(&hugetlb_lock);
+	return 0;
+}
+
+/*
+ * Demote one free huge page from the next allowed node.
+ * Called with hugetlb_lock held.
+ */
+static int demote_pool_huge_page(struct hstate *h, nodemask_t *nodes_allowed)
+{
+	int nr_nodes, node;
+	struct page *page;
+
+	for_each_node_mask_to_free(h, nr_nodes, node, nodes_allowed) {
+		list_for_each_entry(page, &h->hugepage_freelists[node], lru) {
+			if (PageHWPoison(page))
+				continue;
+			return demote_free_huge_page(h, page);
+		}
+	}
+
+	return -EBUSY;
+}
+
 /*
  * Allocates a fresh surplus page from the page allocator.
  */
@@ -2579,6 +2762,106 @@ static void __init gather_bootmem_prealloc(void)
 		cond_resched();
 	}
 }
+struct hugetlb_alloc_args {
+	struct hstate *h;
+	/* each ktask node owns [i * stride, i * stride + count) */
+	unsigned long stride;
+	int *nids;
+	atomic_long_t *nr_allocated;
+	atomic64_t busy_ns;
+};
+
+static int __init hugetlb_alloc_chunk(unsigned long start, unsigned long end,
+				      struct hugetlb_alloc_args *args)
+{
+	unsigned long i = start / args->stride;
+	struct hstate *h = args->h;
+	gfp_t gfp_mask = htlb_alloc_mask(h) | __GFP_THISNODE;
+	u64 time = ktime_get_ns();
+
+	for (; start < end; start++) {
+		struct page *page;
+
+		page = alloc_fresh_huge_page(h, gfp_mask, args->nids[i],
+					     &node_states[N_MEMORY], NULL);
+		if (!page)
+			break;
+		put_page(page); /* free it into the hugepage allocator */
+		atomic_long_inc(&args->nr_allocated[i]);
+		cond_resched();
+	}
+
+	atomic64_add(ktime_get_ns() - time, &args->busy_ns);
+	return KTASK_RETURN_SUCCESS;
+}
+
+/*
+ * Allocate counts[nid] non-gigantic pages on each node, spreading the work
+ * over the ktask threads of the nodes.  counts[] is updated with what could
+ * actually be allocated.  Returns false if the setup failed and nothing was
+ * allocated.
+ */
+static bool __init hugetlb_alloc_pages_parallel(struct hstate *h,
+						unsigned int *counts)
+{
+	struct hugetlb_alloc_args args = { .h = h };
+	unsigned long total = 0, done = 0;
+	struct ktask_node *nodes;
+	int nid, i, nr_nodes = 0;
+	bool ret = false;
+	u64 time, busy;
+	char buf[32];
+	DEFINE_KTASK_CTL(ctl, hugetlb_alloc_chunk, &args,
+			 max(1UL, KTASK_MEM_CHUNK >> huge_page_shift(h)));
+
+	for_each_node_state(nid, N_MEMORY)
+		args.stride = max_t(unsigned long, args.stride, counts[nid]);
+	if (!args.stride)
+		return true;
+
+	nodes = kcalloc(nr_node_ids, sizeof(*nodes), GFP_KERNEL);
+	args.nids = kcalloc(nr_node_ids, sizeof(*args.nids), GFP_KERNEL);
+	args.nr_allocated = kcalloc(nr_node_ids, sizeof(*args.nr_allocated),
+				    GFP_KERNEL);
+	if (!nodes || !args.nids || !args.nr_allocated)
+		goto out;
+
+	for_each_node_state(nid, N_MEMORY) {
+		if (!counts[nid])
+			continue;
+		nodes[nr_nodes].kn_start = (void *)(nr_nodes * args.stride);
+		nodes[nr_nodes].kn_task_size = counts[nid];
+		nodes[nr_nodes].kn_nid = nid;
+		args.nids[nr_nodes] = nid;
+		total += counts[nid];
+		nr_nodes++;
+	}
+
+	ktask_ctl_set_max_threads(&ctl, DIV_ROUND_UP(num_online_cpus(), 4));
+	time = ktime_get_ns();
+	ktask_run_numa(nodes, nr_nodes, &ctl);
+	time = ktime_get_ns() - time;
+
+	for (i = 0; i < nr_nodes; i++) {
+		counts[args.nids[i]] = atomic_long_read(&args.nr_allocated[i]);
+		done += counts[args.nids[i]];
+	}
+
+	/* the time the threads spent over the elapsed time */
+	busy = atomic64_read(&args.busy_ns);
+	busy = div64_u64(busy * 100, max_t(u64, time, 1));
+	string_get_size(huge_page_size(h), 1, STRING_UNITS_2, buf, 32);
+	pr_info("HugeTLB: allocated %lu of %lu %s pages on %d nodes in %llu ms, %llu.%02llux speedup\n",
+		done, total, buf, nr_nodes, div_u64(time, NSEC_PER_MSEC),
+		div_u64(busy, 100), busy % 100);
+	ret = true;
+out:
+	kfree(args.nr_allocated);
+	kfree(args.nids);
+	kfree(nodes);
+	return ret;
+}
+
 static void __init hugetlb_hstate_alloc_pages_onenode(struct hstate *h, int nid)
 {
 	unsigned long i;
@@ -2610,6 +2893,64 @@ static void __init hugetlb_hstate_alloc_pages_onenode(struct hstate *h, int nid)
 	h->max_huge_pages_node[nid] = i;
 }
 
+/* Returns true if the node specific pages were all set up in parallel. */
+static bool __init hugetlb_hstate_alloc_nodes_parallel(struct hstate *h)
+{
+	unsigned int *counts;
+	char buf[32];
+	int nid;
+
+	counts = kmemdup(h->max_huge_pages_node,
+			 nr_node_ids * sizeof(*counts), GFP_KERNEL);
+	if (!counts || !hugetlb_alloc_pages_parallel(h, counts)) {
+		kfree(counts);
+		return false;
+	}
+
+	string_get_size(huge_page_size(h), 1, STRING_UNITS_2, buf, 32);
+	for_each_node_state(nid, N_MEMORY) {
+		if (counts[nid] == h->max_huge_pages_node[nid])
+			continue;
+
+		pr_warn("HugeTLB: allocating %u of page size %s failed node%d.  Only allocated %u hugepages.\n",
+			h->max_huge_pages_node[nid], buf, nid, counts[nid]);
+		h->max_huge_pages -= (h->max_huge_pages_node[nid] - counts[nid]);
+		h->max_huge_pages_node[nid] = counts[nid];
+	}
+
+	kfree(counts);
+	return true;
+}
+
+/*
+ * Allocate an even share of the pages on each node in parallel.  Returns the
+ * number of pages allocated, what is missing is left to the serial loop which
+ * balances it over the nodes that still have memory.
+ */
+static unsigned long __init hugetlb_hstate_alloc_balanced_parallel(struct hstate *h)
+{
+	unsigned long share, rem, done = 0;
+	unsigned int *counts;
+	int nid, i = 0;
+
+	counts = kcalloc(nr_node_ids, sizeof(*counts), GFP_KERNEL);
+	if (!counts)
+		return 0;
+
+	share = h->max_huge_pages / num_node_state(N_MEMORY);
+	rem = h->max_huge_pages % num_node_state(N_MEMORY);
+	for_each_node_state(nid, N_MEMORY)
+		counts[nid] = share + (i++ < rem);
+
+	if (hugetlb_alloc_pages_parallel(h, counts)) {
+		for_each_node_state(nid, N_MEMORY)
+			done += counts[nid];
+	}
+
+	kfree(counts);
+	return done;
+}
+
 static void __init hugetlb_hstate_alloc_pages(struct hstate *h)
 {
 	unsigned long i;
@@ -2619,13 +2960,22 @@ static void __init hugetlb_hstate_alloc_pages(struct hstate *h)
 	/* do node specific alloc */
 	for_each_online_node(i) {
 		if (h->max_huge_pages_node[i] > 0) {
-			hugetlb_hstate_alloc_pages_onenode(h, i);
 			node_specific_alloc = true;
+			break;
 		}
 	}
 
-	if (node_specific_alloc)
+	if (node_specific_alloc) {
+		if (!hstate_is_gigantic(h) &&
+		    hugetlb_hstate_alloc_nodes_parallel(h))
+			return;
+
+		for_each_online_node(i) {
+			if (h->max_huge_pages_node[i] > 0)
+				hugetlb_hstate_alloc_pages_onenode(h, i);
+		}
 		return;
+	}
 
 	/* below will do all node balanced alloc */
 	if (!hstate_is_gigantic(h)) {
@@ -2646,7 +2996,11 @@ static void __init hugetlb_hstate_alloc_pages(struct hstate *h)
 	if (node_alloc_noretry)
 		nodes_clear(*node_alloc_noretry);
 
-	for (i = 0; i < h->max_huge_pages; ++i) {
+	i = 0;
+	if (!hstate_is_gigantic(h))
+		i = hugetlb_hstate_alloc_balanced_parallel(h);
+
+	for (; i < h->max_huge_pages; ++i) {
 		if (hstate_is_gigantic(h)) {
 			if (!alloc_bootmem_huge_page(h, NUMA_NO_NODE))
 				break;
@@ -2670,7 +3024,7 @@ static void __init hugetlb_hstate_alloc_pages(struct hstate *h)
 
 static void __init hugetlb_init_hstates(void)
 {
-	struct hstate *h;
+	struct hstate *h, *h2;
 
 	for_each_hstate(h) {
 		if (minimum_order > huge_page_order(h))
@@ -2679,6 +3033,14 @@ static void __init hugetlb_init_hstates(void)
 		/* oversize hugepages were init'ed in early boot */
 		if (!hstate_is_gigantic(h))
 			hugetlb_hstate_alloc_pages(h);
+
+		/* Demote to the next smaller huge page size, if there is one. */
+		for_each_hstate(h2) {
+			if (h2 == h)
+				continue;
+			if (h2->order < h->order && h2->order > h->demote_order)
+				h->demote_order = h2->order;
+		}
 	}
 	VM_BUG_ON(minimum_order == UINT_MAX);
 }
@@ -3087,6 +3449,92 @@ static ssize_t surplus_hugepages_show(struct kobject *kobj,
 }
 HSTATE_ATTR_RO(surplus_hugepages);
 
+static ssize_t demote_store(struct kobject *kobj,
+	       struct kobj_attribute *attr, const char *buf, size_t len)
+{
+	unsigned long nr_demote;
+	unsigned long nr_available;
+	nodemask_t nodes_allowed, *n_mask;
+	struct hstate *h;
+	int err = 0;
+	int nid;
+
+	err = kstrtoul(buf, 10, &nr_demote);
+	if (err)
+		return err;
+	h = kobj_to_hstate(kobj, &nid);
+
+	if (nid != NUMA_NO_NODE) {
+		init_nodemask_of_node(&nodes_allowed, nid);
+		n_mask = &nodes_allowed;
+	} else {
+		n_mask = &node_states[N_MEMORY];
+	}
+
+	spin_lock(&hugetlb_lock);
+	while (nr_demote) {
+		/*
+		 * Check for available pages on every pass, demoting drops
+		 * hugetlb_lock.
+		 */
+		if (nid != NUMA_NO_NODE)
+			nr_available = h->free_huge_pages_node[nid];
+		else
+			nr_available = h->free_huge_pages;
+		if (nr_available <= h->resv_huge_pages)
+			break;
+
+		err = demote_pool_huge_page(h, n_mask);
+		if (err)
+			break;
+
+		nr_demote--;
+		cond_resched_lock(&hugetlb_lock);
+	}
+	spin_unlock(&hugetlb_lock);
+
+	if (err)
+		return err;
+	return len;
+}
+static struct kobj_attribute demote_attr = __ATTR_WO(demote);
+
+static ssize_t demote_size_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	struct hstate *h = kobj_to_hstate(kobj, NULL);
+	unsigned long demote_size = (PAGE_SIZE << h->demote_order) / 1024;
+
+	return sprintf(buf, "%lukB\n", demote_size);
+}
+
+static ssize_t demote_size_store(struct kobject *kobj,
+					struct kobj_attribute *attr,
+					const char *buf, size_t count)
+{
+	struct hstate *h, *demote_hstate;
+	unsigned long demote_size;
+	unsigned int demote_order;
+
+	demote_size = (unsigned long)memparse(buf, NULL);
+
+	demote_hstate = size_to_hstate(demote_size);
+	if (!demote_hstate)
+		return -EINVAL;
+	demote_order = demote_hstate->order;
+
+	h = kobj_to_hstate(kobj, NULL);
+	if (demote_order >= h->order)
+		return -EINVAL;
+
+	spin_lock(&hugetlb_lock);
+	h->demote_order = demote_order;
+	spin_unlock(&hugetlb_lock);
+
+	return count;
+}
+HSTATE_ATTR(demote_size);
+
 static struct attribute *hstate_attrs[] = {
 	&nr_hugepages_attr.attr,
 	&nr_overcommit_hugepages_attr.attr,
@@ -3103,6 +3551,16 @@ static const struct attribute_group hstate_attr_group = {
 	.attrs = hstate_attrs,
 };
 
+static struct attribute *hstate_demote_attrs[] = {
+	&demote_size_attr.attr,
+	&demote_attr.attr,
+	NULL,
+};
+
+static const struct attribute_group hstate_demote_attr_group = {
+	.attrs = hstate_demote_attrs,
+};
+
 static int hugetlb_sysfs_add_hstate(struct hstate *h, struct kobject *parent,
 				    struct kobject **hstate_kobjs,
 				    const struct attribute_group *hstate_attr_group)
@@ -3118,9 +3576,18 @@ static int hugetlb_sysfs_add_hstate(struct hstate *h, struct kobject *parent,
 	if (retval) {
 		kobject_put(hstate_kobjs[hi]);
 		hstate_kobjs[hi] = NULL;
+		return retval;
 	}
 
-	return retval;
+	if (h->demote_order) {
+		retval = sysfs_create_group(hstate_kobjs[hi],
+					    &hstate_demote_attr_group);
+		if (retval)
+			pr_warn("HugeTLB unable to create demote interfaces for %s\n",
+				h->name);
+	}
+
+	return 0;
 }
 
 static void __init hugetlb_sysfs_init(void)
@@ -3357,6 +3824,9 @@ int alloc_hugepage_from_hugetlb(struct dhugetlb_pool *hpool,
 	}
 
 	list_for_each_entry_safe(page, next, &h->hugepage_freelists[nid], lru) {
+		/* Dynamic hugetlb splits the page and writes its tail structs. */
+		if (PageHugeVmemmapOptimized(page))
+			continue;
 		idx = page_to_pfn(page) >> (PUD_SHIFT - PAGE_SHIFT);
 		ret = update_dhugetlb_pagelist(idx, hpool);
 		if (ret)
@@ -4322,6 +4792,7 @@ void __init hugetlb_add_hstate(unsigned int order)
 	h->next_nid_to_free = first_memory_node;
 	snprintf(h->name, HSTATE_NAME_LEN, "hugepages-%lukB",
 					huge_page_size(h)/1024);
+	hugetlb_vmemmap_init(h);
 
 	parsed_hstate = h;
 }
@@ -5329,6 +5800,41 @@ int huge_add_to_page_cache(struct page *page, struct address_space *mapping,
 	return 0;
 }
 
+static inline vm_fault_t hugetlb_handle_userfault(struct vm_area_struct *vma,
+						  struct address_space *mapping,
+						  pgoff_t idx,
+						  unsigned int flags,
+						  unsigned long haddr,
+						  unsigned long reason)
+{
+	vm_fault_t ret;
+	u32 hash;
+	struct vm_fault vmf = {
+		.vma = vma,
+		.address = haddr,
+		.flags = flags,
+
+		/*
+		 * Hard to debug if it ends up being
+		 * used by a callee that assumes
+		 * something about the other
+		 * uninitialized fields... same as in
+		 * memory.c
+		 */
+	};
+
+	/*
+	 * hugetlb_fault_mutex must be dropped before handling userfault.
+	 * Reacquire after handling fault to make calling code simpler.
+	 */
+	hash = hugetlb_fault_mutex_hash(hstate_vma(vma), mapping, idx);
+	mutex_unlock(&hugetlb_fault_mutex_table[hash]);
+	ret = handle_userfault(&vmf, reason);
+	mutex_lock(&hugetlb_fault_mutex_table[hash]);
+
+	return ret;
+}
+
 static vm_fault_t hugetlb_no_page(struct mm_struct *mm,
 			struct vm_area_struct *vma,
 			struct address_space *mapping, pgoff_t idx,
@@ -5366,33 +5872,11 @@ static vm_fault_t hugetlb_no_page(struct mm_struct *mm,
 		if (idx >= size)
 			goto out;
 
-		/*
-		 * Check for page in userfault range
-		 */
+		/* Check for page in userfault range */
 		if (userfaultfd_missing(vma)) {
-			u32 hash;
-			struct vm_fault vmf = {
-				.vma = vma,
-				.address = haddr,
-				.flags = flags,
-				/*
-				 * Hard to debug if it ends up being
-				 * used by a callee that assumes
-				 * something about the other
-				 * uninitialized fields... same as in
-				 * memory.c
-				 */
-			};
-
-			/*
-			 * hugetlb_fault_mutex must be dropped before
-			 * handling userfault.  Reacquire after handling
-			 * fault to make calling code simpler.
-			 */
-			hash = hugetlb_fault_mutex_hash(h, mapping, idx);
-			mutex_unlock(&hugetlb_fault_mutex_table[hash]);
-			ret = handle_userfault(&vmf, VM_UFFD_MISSING);
-			mutex_lock(&hugetlb_fault_mutex_table[hash]);
+			ret = hugetlb_handle_userfault(vma, mapping, idx,
+						       flags, haddr,
+						       VM_UFFD_MISSING);
 			goto out;
 		}
 
@@ -5451,6 +5935,16 @@ static vm_fault_t hugetlb_no_page(struct mm_struct *mm,
 				VM_FAULT_SET_HINDEX(hstate_index(h));
 			goto backout_unlocked;
 		}
+
+		/* Check for page in userfault range. */
+		if (userfaultfd_minor(vma)) {
+			unlock_page(page);
+			put_page(page);
+			ret = hugetlb_handle_userfault(vma, mapping, idx,
+						       flags, haddr,
+						       VM_UFFD_MINOR);
+			goto out;
+		}
 	}
 
 	/*
@@ -5695,8 +6189,10 @@ int hugetlb_mcopy_atomic_pte(struct mm_struct *dst_mm,
 			    struct vm_area_struct *dst_vma,
 			    unsigned long dst_addr,
 			    unsigned long src_addr,
+			    enum mcopy_atomic_mode mode,
 			    struct page **pagep)
 {
+	bool is_continue = (mode == MCOPY_ATOMIC_CONTINUE);
 	struct address_space *mapping;
 	pgoff_t idx;
 	unsigned long size;
@@ -5706,8 +6202,17 @@ int hugetlb_mcopy_atomic_pte(struct mm_struct *dst_mm,
 	spinlock_t *ptl;
 	int ret;
 	struct page *page;
+	int writable;
 
-	if (!*pagep) {
+	mapping = dst_vma->vm_file->f_mapping;
+	idx = vma_hugecache_offset(h, dst_vma, dst_addr);
+
+	if (is_continue) {
+		ret = -EFAULT;
+		page = find_lock_page(mapping, idx);
+		if (!page)
+			goto out;
+	} else if (!*pagep) {
 		/* If a page already exists, then it's UFFDIO_COPY for
 		 * a non-missing case. Return -EEXIST.
 		 */
@@ -5746,13 +6251,8 @@ int hugetlb_mcopy_atomic_pte(struct mm_struct *dst_mm,
 	 */
 	__SetPageUptodate(page);
 
-	mapping = dst_vma->vm_file->f_mapping;
-	idx = vma_hugecache_offset(h, dst_vma, dst_addr);
-
-	/*
-	 * If shared, add to page cache
-	 */
-	if (vm_shared) {
+	/* Add shared, newly allocated pages to the page cache. */
+	if (vm_shared && !is_continue) {
 		size = i_size_read(mapping->host) >> huge_page_shift(h);
 		ret = -EFAULT;
 		if (idx >= size)
@@ -5794,15 +6294,24 @@ int hugetlb_mcopy_atomic_pte(struct mm_struct *dst_mm,
 	if (!huge_pte_none(huge_ptep_get(dst_pte)))
 		goto out_release_unlock;
 
-	if (vm_shared) {
+	if (vm_shared || is_continue) {
 		page_dup_rmap(page, true);
 	} else {
 		ClearPagePrivate(page);
 		hugepage_add_new_anon_rmap(page, dst_vma, dst_addr);
 	}
 
-	_dst_pte = make_huge_pte(dst_vma, page, dst_vma->vm_flags & VM_WRITE);
-	if (dst_vma->vm_flags & VM_WRITE)
+	/*
+	 * A CONTINUE on a private mapping maps the page cache page
+	 * read-only; a later write fault does the COW as usual.
+	 */
+	if (is_continue && !vm_shared)
+		writable = 0;
+	else
+		writable = dst_vma->vm_flags & VM_WRITE;
+
+	_dst_pte = make_huge_pte(dst_vma, page, writable);
+	if (writable)
 		_dst_pte = huge_pte_mkdirty(_dst_pte);
 	_dst_pte = pte_mkyoung(_dst_pte);
 
@@ -5816,15 +6325,16 @@ int hugetlb_mcopy_atomic_pte(struct mm_struct *dst_mm,
 	update_mmu_cache(dst_vma, dst_addr, dst_pte);
 
 	spin_unlock(ptl);
-	set_page_huge_active(page);
-	if (vm_shared)
+	if (!is_continue)
+		set_page_huge_active(page);
+	if (vm_shared || is_continue)
 		unlock_page(page);
 	ret = 0;
 out:
 	return ret;
 out_release_unlock:
 	spin_unlock(ptl);
-	if (vm_shared)
+	if (vm_shared || is_continue)
 		unlock_page(page);
 out_release_nounlock:
 	put_page(page);
@@ -6811,3 +7321,59 @@ __setup("enable_charge_mighp", ascend_enable_charge_migrate_hugepages);
 
 #endif
 #endif
+
+#ifdef CONFIG_PIN_MEMORY
+/*
+ * Map a gigantic page which was pinned before the kexec into the private
+ * hugetlb vma again. The page is accounted as a surplus huge page, so it is
+ * handed back to the buddy allocator once the last user frees it. The page
+ * is consumed in any case.
+ */
+vm_fault_t do_hugetlb_pud_page_remap(struct vm_area_struct *vma,
+		unsigned long address, struct page *page)
+{
+	struct hstate *h = hstate_vma(vma);
+	struct mm_struct *mm = vma->vm_mm;
+	int nid = page_to_nid(page);
+	vm_fault_t ret = 0;
+	spinlock_t *ptl;
+	pte_t *ptep;
+
+	prep_compound_gigantic_page(page, huge_page_order(h));
+	set_page_private(page, 0);
+	prep_new_huge_page(h, page, nid);
+	spin_lock(&hugetlb_lock);
+	h->surplus_huge_pages++;
+	h->surplus_huge_pages_node[nid]++;
+	spin_unlock(&hugetlb_lock);
+
+	if (unlikely(anon_vma_prepare(vma))) {
+		ret = VM_FAULT_OOM;
+		goto out;
+	}
+	ptep = huge_pte_alloc(mm, address, huge_page_size(h));
+	if (!ptep) {
+		ret = VM_FAULT_OOM;
+		goto out;
+	}
+
+	__SetPageUptodate(page);
+	ptl = huge_pte_lock(h, mm, ptep);
+	if (!huge_pte_none(huge_ptep_get(ptep))) {
+		spin_unlock(ptl);
+		goto out;
+	}
+	ClearPagePrivate(page);
+	hugepage_add_new_anon_rmap(page, vma, address);
+	set_huge_pte_at(mm, address, ptep, make_huge_pte(vma, page,
+			!!(vma->vm_flags & VM_WRITE)));
+	hugetlb_count_add(pages_per_huge_page(h), mm);
+	spin_unlock(ptl);
+	set_page_huge_active(page);
+	return 0;
+
+out:
+	put_page(page);
+	return ret;
+}
+#endif
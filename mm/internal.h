@@ -223,6 +223,7 @@ struct compact_control {
 	bool whole_zone;		/* Whole zone should/has been scanned */
 	bool contended;			/* Signal lock or sched contention */
 	bool finishing_block;		/* Finishing current pageblock */
+	bool proactive_compaction;	/* kcompactd proactive compaction */
 };
 
 unsigned long
@@ -575,6 +576,12 @@ struct tlbflush_unmap_batch;
  */
 extern struct workqueue_struct *mm_percpu_wq;
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+extern struct vm_area_struct *get_vma(struct mm_struct *mm,
+				      unsigned long addr);
+extern void put_vma(struct vm_area_struct *vma);
+#endif
+
 #ifdef CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH
 void try_to_unmap_flush(void);
 void try_to_unmap_flush_dirty(void);
@@ -616,4 +623,21 @@ extern int is_get_user_kernel_recovery_enable(void);
 
 DECLARE_PER_CPU(struct per_cpu_nodestat, boot_nodestats);
 
+#ifdef CONFIG_CLEAR_FREELIST_PAGE
+DECLARE_STATIC_KEY_FALSE(prezero_pool_enabled);
+extern struct page *__alloc_prezeroed_page(struct vm_area_struct *vma);
+
+static inline struct page *alloc_prezeroed_page(struct vm_area_struct *vma)
+{
+	if (static_branch_unlikely(&prezero_pool_enabled))
+		return __alloc_prezeroed_page(vma);
+	return NULL;
+}
+#else
+static inline struct page *alloc_prezeroed_page(struct vm_area_struct *vma)
+{
+	return NULL;
+}
+#endif
+
 #endif	/* __MM_INTERNAL_H */
@@ -61,6 +61,7 @@ enum scan_result {
 	SCAN_CGROUP_CHARGE_FAIL,
 	SCAN_EXCEED_SWAP_PTE,
 	SCAN_TRUNCATED,
+	SCAN_PAGE_HAS_PRIVATE,
 };
 
 #define CREATE_TRACE_POINTS
@@ -122,6 +123,24 @@ static struct khugepaged_scan khugepaged_scan = {
 	.mm_head = LIST_HEAD_INIT(khugepaged_scan.mm_head),
 };
 
+/**
+ * struct collapse_control - state of one collapse context
+ * @is_khugepaged: collapsing from khugepaged, rather than MADV_COLLAPSE
+ * @node_load: number of pages scanned on each node, used to pick the
+ *	       node the huge page is allocated from
+ *
+ * khugepaged uses the single static instance below, MADV_COLLAPSE callers
+ * allocate their own so that they can run concurrently.
+ */
+struct collapse_control {
+	bool is_khugepaged;
+	int node_load[MAX_NUMNODES];
+};
+
+static struct collapse_control khugepaged_collapse_control = {
+	.is_khugepaged = true,
+};
+
 #ifdef CONFIG_SYSFS
 static ssize_t scan_sleep_millisecs_show(struct kobject *kobj,
 					 struct kobj_attribute *attr,
@@ -413,10 +432,15 @@ static inline int khugepaged_test_exit(struct mm_struct *mm)
 	return atomic_read(&mm->mm_users) == 0 || !mmget_still_valid(mm);
 }
 
+/*
+ * MADV_COLLAPSE is an explicit request for the range, so it doesn't need
+ * VM_HUGEPAGE or THP "always", it still honours VM_NOHUGEPAGE and prctl.
+ */
 static bool hugepage_vma_check(struct vm_area_struct *vma,
-			       unsigned long vm_flags)
+			       unsigned long vm_flags, bool enforce_sysfs)
 {
-	if ((!(vm_flags & VM_HUGEPAGE) && !khugepaged_always()) ||
+	if ((enforce_sysfs &&
+	     !(vm_flags & VM_HUGEPAGE) && !khugepaged_always()) ||
 	    (vm_flags & VM_NOHUGEPAGE) ||
 	    test_bit(MMF_DISABLE_THP, &vma->vm_mm->flags))
 		return false;
@@ -426,6 +450,16 @@ static bool hugepage_vma_check(struct vm_area_struct *vma,
 		return IS_ALIGNED((vma->vm_start >> PAGE_SHIFT) - vma->vm_pgoff,
 				HPAGE_PMD_NR);
 	}
+	if (IS_ENABLED(CONFIG_READ_ONLY_THP_FOR_FS) && vma->vm_file &&
+	    !vma_is_dax(vma)) {
+		struct inode *inode = file_inode(vma->vm_file);
+
+		/* Only files nobody has open for write, see do_dentry_open() */
+		if (!S_ISREG(inode->i_mode) || inode_is_open_for_write(inode))
+			return false;
+		return IS_ALIGNED((vma->vm_start >> PAGE_SHIFT) - vma->vm_pgoff,
+				HPAGE_PMD_NR);
+	}
 	if (!vma->anon_vma || vma->vm_ops)
 		return false;
 	if (is_vma_temporary_stack(vma))
@@ -472,10 +506,10 @@ int khugepaged_enter_vma_merge(struct vm_area_struct *vma,
 	unsigned long hstart, hend;
 
 	/*
-	 * khugepaged does not yet work on non-shmem files or special
+	 * khugepaged only works on read-only regular files, not on special
 	 * mappings. And file-private shmem THP is not supported.
 	 */
-	if (!hugepage_vma_check(vma, vm_flags))
+	if (!hugepage_vma_check(vma, vm_flags, true))
 		return 0;
 
 	hstart = (vma->vm_start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
@@ -535,20 +569,25 @@ static void release_pte_pages(pte_t *pte, pte_t *_pte)
 
 static int __collapse_huge_page_isolate(struct vm_area_struct *vma,
 					unsigned long address,
-					pte_t *pte)
+					pte_t *pte,
+					struct collapse_control *cc)
 {
 	struct page *page = NULL;
 	pte_t *_pte;
 	int none_or_zero = 0, result = 0, referenced = 0;
+	unsigned int max_ptes_none;
 	bool writable = false;
 
+	max_ptes_none = cc->is_khugepaged ? khugepaged_max_ptes_none :
+					    HPAGE_PMD_NR;
+
 	for (_pte = pte; _pte < pte+HPAGE_PMD_NR;
 	     _pte++, address += PAGE_SIZE) {
 		pte_t pteval = *_pte;
 		if (pte_none(pteval) || (pte_present(pteval) &&
 				is_zero_pfn(pte_pfn(pteval)))) {
 			if (!userfaultfd_armed(vma) &&
-			    ++none_or_zero <= khugepaged_max_ptes_none) {
+			    ++none_or_zero <= max_ptes_none) {
 				continue;
 			} else {
 				result = SCAN_EXCEED_NONE_PTE;
@@ -632,7 +671,7 @@ static int __collapse_huge_page_isolate(struct vm_area_struct *vma,
 
 	if (unlikely(!writable)) {
 		result = SCAN_PAGE_RO;
-	} else if (unlikely(!referenced)) {
+	} else if (unlikely(cc->is_khugepaged && !referenced)) {
 		result = SCAN_LACK_REFERENCED_PAGE;
 	} else {
 		result = SCAN_SUCCEED;
@@ -707,9 +746,7 @@ static void khugepaged_alloc_sleep(void)
 	remove_wait_queue(&khugepaged_wait, &wait);
 }
 
-static int khugepaged_node_load[MAX_NUMNODES];
-
-static bool khugepaged_scan_abort(int nid)
+static bool khugepaged_scan_abort(int nid, struct collapse_control *cc)
 {
 	int i;
 
@@ -721,11 +758,11 @@ static bool khugepaged_scan_abort(int nid)
 		return false;
 
 	/* If there is a count for this node already, it must be acceptable */
-	if (khugepaged_node_load[nid])
+	if (cc->node_load[nid])
 		return false;
 
 	for (i = 0; i < MAX_NUMNODES; i++) {
-		if (!khugepaged_node_load[i])
+		if (!cc->node_load[i])
 			continue;
 		if (node_distance(nid, i) > RECLAIM_DISTANCE)
 			return true;
@@ -739,16 +776,37 @@ static inline gfp_t alloc_hugepage_khugepaged_gfpmask(void)
 	return khugepaged_defrag() ? GFP_TRANSHUGE : GFP_TRANSHUGE_LIGHT;
 }
 
+/*
+ * Allocate the huge page on @node, on failure *hpage is left as
+ * ERR_PTR(-ENOMEM).
+ */
+static struct page *
+collapse_alloc_page(struct page **hpage, gfp_t gfp, int node)
+{
+	VM_BUG_ON_PAGE(*hpage, *hpage);
+
+	*hpage = __alloc_pages_node(node, gfp, HPAGE_PMD_ORDER);
+	if (unlikely(!*hpage)) {
+		count_vm_event(THP_COLLAPSE_ALLOC_FAILED);
+		*hpage = ERR_PTR(-ENOMEM);
+		return NULL;
+	}
+
+	prep_transhuge_page(*hpage);
+	count_vm_event(THP_COLLAPSE_ALLOC);
+	return *hpage;
+}
+
 #ifdef CONFIG_NUMA
-static int khugepaged_find_target_node(void)
+static int khugepaged_find_target_node(struct collapse_control *cc)
 {
 	static int last_khugepaged_target_node = NUMA_NO_NODE;
 	int nid, target_node = 0, max_value = 0;
 
 	/* find first node with max normal pages hit */
 	for (nid = 0; nid < MAX_NUMNODES; nid++)
-		if (khugepaged_node_load[nid] > max_value) {
-			max_value = khugepaged_node_load[nid];
+		if (cc->node_load[nid] > max_value) {
+			max_value = cc->node_load[nid];
 			target_node = nid;
 		}
 
@@ -756,7 +814,7 @@ static int khugepaged_find_target_node(void)
 	if (target_node <= last_khugepaged_target_node)
 		for (nid = last_khugepaged_target_node + 1; nid < MAX_NUMNODES;
 				nid++)
-			if (max_value == khugepaged_node_load[nid]) {
+			if (max_value == cc->node_load[nid]) {
 				target_node = nid;
 				break;
 			}
@@ -785,21 +843,10 @@ static bool khugepaged_prealloc_page(struct page **hpage, bool *wait)
 static struct page *
 khugepaged_alloc_page(struct page **hpage, gfp_t gfp, int node)
 {
-	VM_BUG_ON_PAGE(*hpage, *hpage);
-
-	*hpage = __alloc_pages_node(node, gfp, HPAGE_PMD_ORDER);
-	if (unlikely(!*hpage)) {
-		count_vm_event(THP_COLLAPSE_ALLOC_FAILED);
-		*hpage = ERR_PTR(-ENOMEM);
-		return NULL;
-	}
-
-	prep_transhuge_page(*hpage);
-	count_vm_event(THP_COLLAPSE_ALLOC);
-	return *hpage;
+	return collapse_alloc_page(hpage, gfp, node);
 }
 #else
-static int khugepaged_find_target_node(void)
+static int khugepaged_find_target_node(struct collapse_control *cc)
 {
 	return 0;
 }
@@ -875,7 +922,7 @@ khugepaged_alloc_page(struct page **hpage, gfp_t gfp, int node)
  */
 
 static int hugepage_vma_revalidate(struct mm_struct *mm, unsigned long address,
-		struct vm_area_struct **vmap)
+		struct vm_area_struct **vmap, struct collapse_control *cc)
 {
 	struct vm_area_struct *vma;
 	unsigned long hstart, hend;
@@ -891,7 +938,7 @@ static int hugepage_vma_revalidate(struct mm_struct *mm, unsigned long address,
 	hend = vma->vm_end & HPAGE_PMD_MASK;
 	if (address < hstart || address + HPAGE_PMD_SIZE > hend)
 		return SCAN_ADDRESS_RANGE;
-	if (!hugepage_vma_check(vma, vma->vm_flags))
+	if (!hugepage_vma_check(vma, vma->vm_flags, cc->is_khugepaged))
 		return SCAN_VMA_CHECK;
 	return 0;
 }
@@ -907,7 +954,8 @@ static int hugepage_vma_revalidate(struct mm_struct *mm, unsigned long address,
 static bool __collapse_huge_page_swapin(struct mm_struct *mm,
 					struct vm_area_struct *vma,
 					unsigned long address, pmd_t *pmd,
-					int referenced)
+					int referenced,
+					struct collapse_control *cc)
 {
 	int swapped_in = 0;
 	vm_fault_t ret = 0;
@@ -931,7 +979,8 @@ static bool __collapse_huge_page_swapin(struct mm_struct *mm,
 		/* do_swap_page returns VM_FAULT_RETRY with released mmap_sem */
 		if (ret & VM_FAULT_RETRY) {
 			down_read(&mm->mmap_sem);
-			if (hugepage_vma_revalidate(mm, address, &vmf.vma)) {
+			if (hugepage_vma_revalidate(mm, address, &vmf.vma,
+						    cc)) {
 				/* vma is no longer available, don't continue to swapin */
 				trace_mm_collapse_huge_page_swapin(mm, swapped_in, referenced, 0);
 				return false;
@@ -960,11 +1009,11 @@ static bool __collapse_huge_page_swapin(struct mm_struct *mm,
 	return true;
 }
 
-static void collapse_huge_page(struct mm_struct *mm,
-				   unsigned long address,
-				   struct page **hpage,
-				   int node, int referenced, int unmapped,
-				   bool reliable)
+static int collapse_huge_page(struct mm_struct *mm,
+			      unsigned long address,
+			      struct page **hpage,
+			      int node, int referenced, int unmapped,
+			      bool reliable, struct collapse_control *cc)
 {
 	pmd_t *pmd, _pmd;
 	pte_t *pte;
@@ -980,8 +1029,14 @@ static void collapse_huge_page(struct mm_struct *mm,
 
 	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
 
-	/* Only allocate from the target node */
-	gfp = alloc_hugepage_khugepaged_gfpmask() | __GFP_THISNODE;
+	/*
+	 * Only allocate from the target node.  MADV_COLLAPSE runs in the
+	 * caller's context, which asked for the huge page, so it may
+	 * always reclaim and compact for it.
+	 */
+	gfp = cc->is_khugepaged ? alloc_hugepage_khugepaged_gfpmask() :
+				  GFP_TRANSHUGE;
+	gfp |= __GFP_THISNODE;
 
 	if (reliable)
 		gfp |= ___GFP_RELIABILITY;
@@ -993,7 +1048,10 @@ static void collapse_huge_page(struct mm_struct *mm,
 	 * that. We will recheck the vma after taking it again in write mode.
 	 */
 	up_read(&mm->mmap_sem);
-	new_page = khugepaged_alloc_page(hpage, gfp, node);
+	if (cc->is_khugepaged)
+		new_page = khugepaged_alloc_page(hpage, gfp, node);
+	else
+		new_page = collapse_alloc_page(hpage, gfp, node);
 	if (!new_page) {
 		result = SCAN_ALLOC_HUGE_PAGE_FAIL;
 		goto out_nolock;
@@ -1005,7 +1063,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 	}
 
 	down_read(&mm->mmap_sem);
-	result = hugepage_vma_revalidate(mm, address, &vma);
+	result = hugepage_vma_revalidate(mm, address, &vma, cc);
 	if (result) {
 		mem_cgroup_cancel_charge(new_page, memcg, true);
 		up_read(&mm->mmap_sem);
@@ -1026,7 +1084,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 	 * Continuing to collapse causes inconsistency.
 	 */
 	if (unmapped && !__collapse_huge_page_swapin(mm, vma, address,
-						     pmd, referenced)) {
+						     pmd, referenced, cc)) {
 		mem_cgroup_cancel_charge(new_page, memcg, true);
 		up_read(&mm->mmap_sem);
 		goto out_nolock;
@@ -1039,13 +1097,14 @@ static void collapse_huge_page(struct mm_struct *mm,
 	 * handled by the anon_vma lock + PG_lock.
 	 */
 	down_write(&mm->mmap_sem);
-	result = hugepage_vma_revalidate(mm, address, &vma);
+	result = hugepage_vma_revalidate(mm, address, &vma, cc);
 	if (result)
 		goto out;
 	/* check if the pmd is still valid */
 	if (mm_find_pmd(mm, address) != pmd)
 		goto out;
 
+	vm_write_begin(vma);
 	anon_vma_lock_write(vma->anon_vma);
 
 	pte = pte_offset_map(pmd, address);
@@ -1069,7 +1128,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 	tlb_remove_table_sync_one();
 
 	spin_lock(pte_ptl);
-	isolated = __collapse_huge_page_isolate(vma, address, pte);
+	isolated = __collapse_huge_page_isolate(vma, address, pte, cc);
 	spin_unlock(pte_ptl);
 
 	if (unlikely(!isolated)) {
@@ -1084,6 +1143,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 		pmd_populate(mm, pmd, pmd_pgtable(_pmd));
 		spin_unlock(pmd_ptl);
 		anon_vma_unlock_write(vma->anon_vma);
+		vm_write_end(vma);
 		result = SCAN_FAIL;
 		goto out;
 	}
@@ -1119,25 +1179,32 @@ static void collapse_huge_page(struct mm_struct *mm,
 	set_pmd_at(mm, address, pmd, _pmd);
 	update_mmu_cache_pmd(vma, address, pmd);
 	spin_unlock(pmd_ptl);
+	vm_write_end(vma);
 
 	*hpage = NULL;
 
-	khugepaged_pages_collapsed++;
+	if (cc->is_khugepaged)
+		khugepaged_pages_collapsed++;
 	result = SCAN_SUCCEED;
 out_up_write:
 	up_write(&mm->mmap_sem);
 out_nolock:
 	trace_mm_collapse_huge_page(mm, isolated, result);
-	return;
+	return result;
 out:
 	mem_cgroup_cancel_charge(new_page, memcg, true);
 	goto out_up_write;
 }
 
+/*
+ * Scan the pte table at @address and collapse it if it qualifies.  Returns
+ * the SCAN_* result, *mmap_locked is cleared if mmap_sem was released.
+ */
 static int khugepaged_scan_pmd(struct mm_struct *mm,
 			       struct vm_area_struct *vma,
 			       unsigned long address,
-			       struct page **hpage)
+			       struct page **hpage, bool *mmap_locked,
+			       struct collapse_control *cc)
 {
 	pmd_t *pmd;
 	pte_t *pte, *_pte;
@@ -1146,24 +1213,31 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 	unsigned long _address;
 	spinlock_t *ptl;
 	int node = NUMA_NO_NODE, unmapped = 0;
+	unsigned int max_ptes_none, max_ptes_swap;
 	bool writable = false;
 	bool reliable = false;
 
 	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
 
+	/* MADV_COLLAPSE takes whatever is there, swapping the rest in */
+	max_ptes_none = cc->is_khugepaged ? khugepaged_max_ptes_none :
+					    HPAGE_PMD_NR;
+	max_ptes_swap = cc->is_khugepaged ? khugepaged_max_ptes_swap :
+					    HPAGE_PMD_NR;
+
 	pmd = mm_find_pmd(mm, address);
 	if (!pmd) {
 		result = SCAN_PMD_NULL;
 		goto out;
 	}
 
-	memset(khugepaged_node_load, 0, sizeof(khugepaged_node_load));
+	memset(cc->node_load, 0, sizeof(cc->node_load));
 	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
 	for (_address = address, _pte = pte; _pte < pte+HPAGE_PMD_NR;
 	     _pte++, _address += PAGE_SIZE) {
 		pte_t pteval = *_pte;
 		if (is_swap_pte(pteval)) {
-			if (++unmapped <= khugepaged_max_ptes_swap) {
+			if (++unmapped <= max_ptes_swap) {
 				continue;
 			} else {
 				result = SCAN_EXCEED_SWAP_PTE;
@@ -1172,7 +1246,7 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 		}
 		if (pte_none(pteval) || is_zero_pfn(pte_pfn(pteval))) {
 			if (!userfaultfd_armed(vma) &&
-			    ++none_or_zero <= khugepaged_max_ptes_none) {
+			    ++none_or_zero <= max_ptes_none) {
 				continue;
 			} else {
 				result = SCAN_EXCEED_NONE_PTE;
@@ -1200,16 +1274,16 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 
 		/*
 		 * Record which node the original page is from and save this
-		 * information to khugepaged_node_load[].
+		 * information to cc->node_load[].
 		 * Khupaged will allocate hugepage from the node has the max
 		 * hit record.
 		 */
 		node = page_to_nid(page);
-		if (khugepaged_scan_abort(node)) {
+		if (khugepaged_scan_abort(node, cc)) {
 			result = SCAN_SCAN_ABORT;
 			goto out_unmap;
 		}
-		khugepaged_node_load[node]++;
+		cc->node_load[node]++;
 		if (!PageLRU(page)) {
 			result = SCAN_PAGE_LRU;
 			goto out_unmap;
@@ -1242,7 +1316,9 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 	}
 	if (!writable) {
 		result = SCAN_PAGE_RO;
-	} else if (!referenced || (unmapped && referenced < HPAGE_PMD_NR/2)) {
+	} else if (cc->is_khugepaged &&
+		   (!referenced ||
+		    (unmapped && referenced < HPAGE_PMD_NR/2))) {
 		result = SCAN_LACK_REFERENCED_PAGE;
 	} else {
 		result = SCAN_SUCCEED;
@@ -1263,15 +1339,18 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 			}
 		}
 
-		node = khugepaged_find_target_node();
-		/* collapse_huge_page will return with the mmap_sem released */
-		collapse_huge_page(mm, address, hpage, node,
-				referenced, unmapped, reliable);
+		node = khugepaged_find_target_node(cc);
 	}
 out:
 	trace_mm_khugepaged_scan_pmd(mm, page, writable, referenced,
 				     none_or_zero, result, unmapped);
-	return ret;
+	if (ret) {
+		/* collapse_huge_page will return with the mmap_sem released */
+		*mmap_locked = false;
+		result = collapse_huge_page(mm, address, hpage, node,
+					    referenced, unmapped, reliable, cc);
+	}
+	return result;
 }
 
 static void collect_mm_slot(struct mm_slot *mm_slot)
@@ -1332,10 +1411,12 @@ static void retract_page_tables(struct address_space *mapping, pgoff_t pgoff)
 
 				mmu_notifier_invalidate_range_start(mm, addr,
 								    end);
+				vm_write_begin(vma);
 				ptl = pmd_lock(mm, pmd);
 				/* assume page table is clear */
 				_pmd = pmdp_collapse_flush(vma, addr, pmd);
 				spin_unlock(ptl);
+				vm_write_end(vma);
 				mm_dec_nr_ptes(mm);
 				tlb_remove_table_sync_one();
 				pte_free(mm, pmd_pgtable(_pmd));
@@ -1349,12 +1430,12 @@ static void retract_page_tables(struct address_space *mapping, pgoff_t pgoff)
 }
 
 /**
- * collapse_shmem - collapse small tmpfs/shmem pages into huge one.
+ * collapse_file - collapse filemap/tmpfs/shmem pages into huge one.
  *
  * Basic scheme is simple, details are more complex:
  *  - allocate and lock a new huge page;
  *  - scan over radix tree replacing old pages the new one
- *    + swap in pages if necessary;
+ *    + swap/gup in pages if necessary;
  *    + fill in gaps;
  *    + keep old pages around in case if rollback is required;
  *  - if replacing succeed:
@@ -1366,10 +1447,11 @@ static void retract_page_tables(struct address_space *mapping, pgoff_t pgoff)
  *    + restore gaps in the radix-tree;
  *    + unlock and free huge page;
  */
-static void collapse_shmem(struct mm_struct *mm,
+static void collapse_file(struct mm_struct *mm,
 		struct address_space *mapping, pgoff_t start,
 		struct page **hpage, int node, bool reliable)
 {
+	bool is_shmem = shmem_mapping(mapping);
 	gfp_t gfp;
 	struct page *page, *new_page, *tmp;
 	struct mem_cgroup *memcg;
@@ -1379,6 +1461,7 @@ static void collapse_shmem(struct mm_struct *mm,
 	void **slot;
 	int nr_none = 0, result = SCAN_SUCCEED;
 
+	VM_BUG_ON(!IS_ENABLED(CONFIG_READ_ONLY_THP_FOR_FS) && !is_shmem);
 	VM_BUG_ON(start & (HPAGE_PMD_NR - 1));
 
 	/* Only allocate from the target node */
@@ -1399,7 +1482,8 @@ static void collapse_shmem(struct mm_struct *mm,
 	}
 
 	__SetPageLocked(new_page);
-	__SetPageSwapBacked(new_page);
+	if (is_shmem)
+		__SetPageSwapBacked(new_page);
 	new_page->index = start;
 	new_page->mapping = mapping;
 
@@ -1427,7 +1511,12 @@ static void collapse_shmem(struct mm_struct *mm,
 		/*
 		 * Handle holes in the radix tree: charge it from shmem and
 		 * insert relevant subpage of new_page into the radix-tree.
+		 * A regular file has no backing to fill the holes from.
 		 */
+		if (n && !is_shmem) {
+			result = SCAN_FAIL;
+			goto tree_locked;
+		}
 		if (n && !shmem_charge(mapping->host, n)) {
 			result = SCAN_FAIL;
 			goto tree_locked;
@@ -1444,7 +1533,13 @@ static void collapse_shmem(struct mm_struct *mm,
 
 		page = radix_tree_deref_slot_protected(slot,
 				&mapping->i_pages.xa_lock);
-		if (radix_tree_exceptional_entry(page) || !PageUptodate(page)) {
+		if (!is_shmem && (radix_tree_exceptional_entry(page) ||
+				  !PageUptodate(page) || PageDirty(page))) {
+			/* Only clean, cached pages of a regular file */
+			result = SCAN_FAIL;
+			goto tree_locked;
+		} else if (radix_tree_exceptional_entry(page) ||
+			   !PageUptodate(page)) {
 			xa_unlock_irq(&mapping->i_pages);
 			/* swap in or instantiate fallocated page */
 			if (shmem_getpage(mapping->host, index, &page,
@@ -1481,11 +1576,28 @@ static void collapse_shmem(struct mm_struct *mm,
 			goto out_unlock;
 		}
 
+		if (!is_shmem && (PageDirty(page) || PageWriteback(page))) {
+			/*
+			 * khugepaged only works on read-only fd, so this
+			 * page is dirty because it hasn't been flushed
+			 * since first write.
+			 */
+			result = SCAN_FAIL;
+			goto out_unlock;
+		}
+
 		if (isolate_lru_page(page)) {
 			result = SCAN_DEL_PAGE_LRU;
 			goto out_unlock;
 		}
 
+		if (page_has_private(page) &&
+		    !try_to_release_page(page, GFP_KERNEL)) {
+			result = SCAN_PAGE_HAS_PRIVATE;
+			putback_lru_page(page);
+			goto out_unlock;
+		}
+
 		if (page_mapped(page))
 			unmap_mapping_pages(mapping, index, 1, false);
 
@@ -1541,7 +1653,7 @@ static void collapse_shmem(struct mm_struct *mm,
 			result = SCAN_TRUNCATED;
 			goto tree_locked;
 		}
-		if (!shmem_charge(mapping->host, n)) {
+		if (!is_shmem || !shmem_charge(mapping->host, n)) {
 			result = SCAN_FAIL;
 			goto tree_locked;
 		}
@@ -1552,7 +1664,25 @@ static void collapse_shmem(struct mm_struct *mm,
 		nr_none += n;
 	}
 
-	__inc_node_page_state(new_page, NR_SHMEM_THPS);
+	if (is_shmem) {
+		__inc_node_page_state(new_page, NR_SHMEM_THPS);
+	} else {
+		__inc_node_page_state(new_page, NR_FILE_THPS);
+		filemap_nr_thps_inc(mapping);
+		/*
+		 * Paired with smp_mb() in do_dentry_open() to ensure
+		 * i_writecount is up to date and the update to nr_thps is
+		 * visible. Ensures the page cache will be truncated if the
+		 * file is opened writable.
+		 */
+		smp_mb();
+		if (inode_is_open_for_write(mapping->host)) {
+			result = SCAN_FAIL;
+			__dec_node_page_state(new_page, NR_FILE_THPS);
+			filemap_nr_thps_dec(mapping);
+			goto tree_locked;
+		}
+	}
 	if (nr_none) {
 		struct zone *zone = page_zone(new_page);
 
@@ -1583,7 +1713,8 @@ static void collapse_shmem(struct mm_struct *mm,
 			ClearPageActive(page);
 			ClearPageUnevictable(page);
 			unlock_page(page);
-			shmem_reliable_page_counter(page, -1);
+			if (is_shmem)
+				shmem_reliable_page_counter(page, -1);
 			put_page(page);
 			index++;
 		}
@@ -1594,11 +1725,17 @@ static void collapse_shmem(struct mm_struct *mm,
 
 		SetPageUptodate(new_page);
 		page_ref_add(new_page, HPAGE_PMD_NR - 1);
-		set_page_dirty(new_page);
+		if (is_shmem)
+			set_page_dirty(new_page);
 		mem_cgroup_commit_charge(new_page, memcg, false, true);
 		count_memcg_events(memcg, THP_COLLAPSE_ALLOC, 1);
-		lru_cache_add_anon(new_page);
-		shmem_reliable_page_counter(new_page, 1 << HPAGE_PMD_ORDER);
+		if (is_shmem) {
+			lru_cache_add_anon(new_page);
+			shmem_reliable_page_counter(new_page,
+						    1 << HPAGE_PMD_ORDER);
+		} else {
+			lru_cache_add_file(new_page);
+		}
 
 		/*
 		 * Remove pte page tables, so we can re-fault the page as huge.
@@ -1611,7 +1748,8 @@ static void collapse_shmem(struct mm_struct *mm,
 		/* Something went wrong: rollback changes to the radix-tree */
 		xa_lock_irq(&mapping->i_pages);
 		mapping->nrpages -= nr_none;
-		shmem_uncharge(mapping->host, nr_none);
+		if (is_shmem)
+			shmem_uncharge(mapping->host, nr_none);
 
 		radix_tree_for_each_slot(slot, &mapping->i_pages, &iter, start) {
 			if (iter.index >= end)
@@ -1652,21 +1790,23 @@ static void collapse_shmem(struct mm_struct *mm,
 	/* TODO: tracepoints */
 }
 
-static void khugepaged_scan_shmem(struct mm_struct *mm,
+static void khugepaged_scan_file(struct mm_struct *mm,
 		struct address_space *mapping,
 		pgoff_t start, struct page **hpage)
 {
+	struct collapse_control *cc = &khugepaged_collapse_control;
 	struct page *page = NULL;
 	struct radix_tree_iter iter;
 	void **slot;
 	int present, swap;
 	int node = NUMA_NO_NODE;
 	int result = SCAN_SUCCEED;
+	bool is_shmem = shmem_mapping(mapping);
 	bool reliable = false;
 
 	present = 0;
 	swap = 0;
-	memset(khugepaged_node_load, 0, sizeof(khugepaged_node_load));
+	memset(cc->node_load, 0, sizeof(cc->node_load));
 	rcu_read_lock();
 	radix_tree_for_each_slot(slot, &mapping->i_pages, &iter, start) {
 		if (iter.index >= start + HPAGE_PMD_NR)
@@ -1679,7 +1819,8 @@ static void khugepaged_scan_shmem(struct mm_struct *mm,
 		}
 
 		if (radix_tree_exception(page)) {
-			if (++swap > khugepaged_max_ptes_swap) {
+			/* Only swap entries can be brought back for us */
+			if (!is_shmem || ++swap > khugepaged_max_ptes_swap) {
 				result = SCAN_EXCEED_SWAP_PTE;
 				break;
 			}
@@ -1692,18 +1833,19 @@ static void khugepaged_scan_shmem(struct mm_struct *mm,
 		}
 
 		node = page_to_nid(page);
-		if (khugepaged_scan_abort(node)) {
+		if (khugepaged_scan_abort(node, cc)) {
 			result = SCAN_SCAN_ABORT;
 			break;
 		}
-		khugepaged_node_load[node]++;
+		cc->node_load[node]++;
 
 		if (!PageLRU(page)) {
 			result = SCAN_PAGE_LRU;
 			break;
 		}
 
-		if (page_count(page) != 1 + page_mapcount(page)) {
+		if (page_count(page) !=
+		    1 + page_mapcount(page) + page_has_private(page)) {
 			result = SCAN_PAGE_COUNT;
 			break;
 		}
@@ -1738,12 +1880,14 @@ static void khugepaged_scan_shmem(struct mm_struct *mm,
 			}
 		}
 
-		if (present < HPAGE_PMD_NR - khugepaged_max_ptes_none) {
+		/* Holes can only be filled in for shmem */
+		if (present < HPAGE_PMD_NR -
+			      (is_shmem ? khugepaged_max_ptes_none : 0)) {
 			result = SCAN_EXCEED_NONE_PTE;
 		} else {
-			node = khugepaged_find_target_node();
-			collapse_shmem(mm, mapping, start, hpage, node,
-				       reliable);
+			node = khugepaged_find_target_node(cc);
+			collapse_file(mm, mapping, start, hpage, node,
+				      reliable);
 		}
 	}
 
@@ -1752,7 +1896,7 @@ static void khugepaged_scan_shmem(struct mm_struct *mm,
 	return;
 }
 #else
-static void khugepaged_scan_shmem(struct mm_struct *mm,
+static void khugepaged_scan_file(struct mm_struct *mm,
 		struct address_space *mapping,
 		pgoff_t start, struct page **hpage)
 {
@@ -1803,7 +1947,7 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 			progress++;
 			break;
 		}
-		if (!hugepage_vma_check(vma, vma->vm_flags)) {
+		if (!hugepage_vma_check(vma, vma->vm_flags, true)) {
 skip:
 			progress++;
 			continue;
@@ -1827,22 +1971,27 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 			VM_BUG_ON(khugepaged_scan.address < hstart ||
 				  khugepaged_scan.address + HPAGE_PMD_SIZE >
 				  hend);
-			if (shmem_file(vma->vm_file)) {
+			if (IS_ENABLED(CONFIG_SHMEM) && vma->vm_file) {
 				struct file *file;
 				pgoff_t pgoff = linear_page_index(vma,
 						khugepaged_scan.address);
-				if (!shmem_huge_enabled(vma))
+				if (shmem_file(vma->vm_file) &&
+				    !shmem_huge_enabled(vma))
 					goto skip;
 				file = get_file(vma->vm_file);
 				up_read(&mm->mmap_sem);
 				ret = 1;
-				khugepaged_scan_shmem(mm, file->f_mapping,
+				khugepaged_scan_file(mm, file->f_mapping,
 						pgoff, hpage);
 				fput(file);
 			} else {
-				ret = khugepaged_scan_pmd(mm, vma,
+				bool mmap_locked = true;
+
+				khugepaged_scan_pmd(mm, vma,
 						khugepaged_scan.address,
-						hpage);
+						hpage, &mmap_locked,
+						&khugepaged_collapse_control);
+				ret = !mmap_locked;
 			}
 			/* move to next address */
 			khugepaged_scan.address += HPAGE_PMD_SIZE;
@@ -2061,3 +2210,129 @@ void khugepaged_min_free_kbytes_update(void)
 		set_recommended_min_free_kbytes();
 	mutex_unlock(&khugepaged_mutex);
 }
+
+/* Is @address already mapped by a huge pmd? */
+static bool collapse_pmd_mapped(struct mm_struct *mm, unsigned long address)
+{
+	pgd_t *pgd;
+	p4d_t *p4d;
+	pud_t *pud;
+	pmd_t pmde;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return false;
+
+	p4d = p4d_offset(pgd, address);
+	if (!p4d_present(*p4d))
+		return false;
+
+	pud = pud_offset(p4d, address);
+	if (!pud_present(*pud))
+		return false;
+
+	pmde = READ_ONCE(*pmd_offset(pud, address));
+	return pmd_trans_huge(pmde);
+}
+
+static int madvise_collapse_errno(int result)
+{
+	switch (result) {
+	case SCAN_ALLOC_HUGE_PAGE_FAIL:
+		return -ENOMEM;
+	case SCAN_CGROUP_CHARGE_FAIL:
+		return -EBUSY;
+	/* Resource temporarily unavailable, trying again might succeed */
+	case SCAN_PAGE_COUNT:
+	case SCAN_PAGE_LOCK:
+	case SCAN_PAGE_LRU:
+	case SCAN_DEL_PAGE_LRU:
+		return -EAGAIN;
+	default:
+		return -EINVAL;
+	}
+}
+
+/*
+ * MADV_COLLAPSE: collapse the anonymous memory in [start, end) into huge
+ * pages synchronously, in the caller's context and regardless of the
+ * khugepaged tunables.  Called and returns with mmap_sem held for read,
+ * *prev is cleared if it was dropped on the way.
+ */
+int madvise_collapse(struct vm_area_struct *vma, struct vm_area_struct **prev,
+		     unsigned long start, unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct collapse_control *cc;
+	unsigned long hstart, hend, addr;
+	int thps = 0, last_fail = SCAN_FAIL;
+	bool mmap_locked = true;
+
+	*prev = vma;
+
+	/* Only anonymous memory can be collapsed this way */
+	if (vma->vm_file || vma->vm_ops)
+		return -EINVAL;
+	/* Nothing was ever faulted in */
+	if (!vma->anon_vma)
+		return 0;
+	if (!hugepage_vma_check(vma, vma->vm_flags, false))
+		return -EINVAL;
+
+	hstart = (start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
+	hend = end & HPAGE_PMD_MASK;
+	if (hstart >= hend)
+		return 0;
+
+	cc = kmalloc(sizeof(*cc), GFP_KERNEL);
+	if (!cc)
+		return -ENOMEM;
+	cc->is_khugepaged = false;
+
+	/* Pages still in the lru pagevecs hold an extra reference */
+	lru_add_drain_all();
+
+	for (addr = hstart; addr < hend; addr += HPAGE_PMD_SIZE) {
+		struct page *hpage = NULL;
+		int result;
+
+		cond_resched();
+
+		if (!mmap_locked) {
+			down_read(&mm->mmap_sem);
+			mmap_locked = true;
+			*prev = NULL;
+			result = hugepage_vma_revalidate(mm, addr, &vma, cc);
+			if (result) {
+				last_fail = result;
+				break;
+			}
+		}
+
+		if (collapse_pmd_mapped(mm, addr)) {
+			thps++;
+			continue;
+		}
+
+		result = khugepaged_scan_pmd(mm, vma, addr, &hpage,
+					     &mmap_locked, cc);
+		/* Drop a huge page left over from a failed collapse */
+		if (!IS_ERR_OR_NULL(hpage))
+			put_page(hpage);
+
+		if (result == SCAN_SUCCEED)
+			thps++;
+		else
+			last_fail = result;
+	}
+
+	if (!mmap_locked) {
+		down_read(&mm->mmap_sem);
+		*prev = NULL;
+	}
+	kfree(cc);
+
+	if (thps == (hend - hstart) >> HPAGE_PMD_SHIFT)
+		return 0;
+	return madvise_collapse_errno(last_fail);
+}
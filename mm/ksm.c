@@ -21,11 +21,13 @@
 #include <linux/sched.h>
 #include <linux/sched/mm.h>
 #include <linux/sched/coredump.h>
+#include <linux/sched/cputime.h>
 #include <linux/rwsem.h>
 #include <linux/pagemap.h>
 #include <linux/rmap.h>
 #include <linux/spinlock.h>
 #include <linux/xxhash.h>
+#include <linux/ktime.h>
 #include <linux/delay.h>
 #include <linux/kthread.h>
 #include <linux/wait.h>
@@ -269,7 +271,8 @@ static int ksm_stable_node_chains_prune_millisecs = 2000;
 static int ksm_max_page_sharing = 256;
 
 /* Number of pages ksmd should scan in one batch */
-static unsigned int ksm_thread_pages_to_scan = 100;
+#define DEFAULT_PAGES_TO_SCAN	100
+static unsigned int ksm_thread_pages_to_scan = DEFAULT_PAGES_TO_SCAN;
 
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 20;
@@ -280,6 +283,134 @@ static unsigned int zero_checksum __read_mostly;
 /* Whether to merge empty (zeroed) pages with actual zero pages */
 static bool ksm_use_zero_pages __read_mostly;
 
+/* The number of zero pages mapped by KSM in place of empty pages */
+atomic_long_t ksm_zero_pages = ATOMIC_LONG_INIT(0);
+
+/* The number of pages scanned by ksmd */
+static unsigned long ksm_pages_scanned;
+
+/*
+ * The scan time advisor retunes pages_to_scan after every full scan, so
+ * that a full scan takes about advisor_target_scan_time seconds while
+ * ksmd stays below advisor_max_cpu percent of a CPU.
+ */
+enum ksm_advisor_type {
+	KSM_ADVISOR_NONE,
+	KSM_ADVISOR_SCAN_TIME,
+};
+static enum ksm_advisor_type ksm_advisor;
+
+/* Maximum percentage of a CPU ksmd may use */
+static unsigned long ksm_advisor_max_cpu = 70;
+
+/* Target duration of a full scan, in seconds */
+static unsigned long ksm_advisor_target_scan_time = 200;
+
+/* Bounds for the pages_to_scan values the advisor picks */
+static unsigned long ksm_advisor_min_pages_to_scan = 500;
+static unsigned long ksm_advisor_max_pages_to_scan = 30000;
+
+/* Lower bound of the CPU share the advisor sizes a batch for */
+#define KSM_ADVISOR_MIN_CPU	10
+
+/* Weight of the newest sample in the scan time average, in percent */
+#define KSM_ADVISOR_EWMA_WEIGHT	30
+
+struct advisor_ctx {
+	ktime_t start_scan;
+	unsigned long scan_time;
+	unsigned long change;
+	unsigned long long cpu_time;
+};
+static struct advisor_ctx advisor_ctx;
+
+static unsigned long ewma(unsigned long prev, unsigned long curr)
+{
+	return ((100 - KSM_ADVISOR_EWMA_WEIGHT) * prev +
+		KSM_ADVISOR_EWMA_WEIGHT * curr) / 100;
+}
+
+/*
+ * Scale pages_to_scan by how far the last full scan was from the target
+ * scan time, smoothed against the previous scans, then clamp it to what
+ * ksmd can do within its CPU budget.  The per-page cost is derived from
+ * the CPU time ksmd consumed over the last full scan.
+ */
+static void scan_time_advisor(void)
+{
+	unsigned long scan_time, last_scan_time;
+	unsigned long long cpu_time;
+	unsigned long cpu_time_diff_ms;
+	unsigned long cpu_percent;
+	unsigned long per_page_cost;
+	unsigned long factor;
+	unsigned long change;
+	unsigned long pages;
+
+	scan_time = div_s64(ktime_ms_delta(ktime_get(), advisor_ctx.start_scan),
+			    MSEC_PER_SEC);
+	scan_time = scan_time ? scan_time : 1;
+
+	cpu_time = task_sched_runtime(current);
+	cpu_time_diff_ms = div64_u64(cpu_time - advisor_ctx.cpu_time,
+				     NSEC_PER_MSEC);
+	cpu_percent = cpu_time_diff_ms * 100 / (scan_time * MSEC_PER_SEC);
+	cpu_percent = cpu_percent ? cpu_percent : 1;
+
+	last_scan_time = advisor_ctx.scan_time ? advisor_ctx.scan_time :
+						 scan_time;
+
+	/* Scan time as a percentage of the target scan time */
+	factor = ksm_advisor_target_scan_time * 100 / scan_time;
+	factor = factor ? factor : 1;
+
+	/* Scan time as a percentage of the last scan time, smoothed */
+	change = scan_time * 100 / last_scan_time;
+	change = change ? change : 1;
+	change = advisor_ctx.change ? ewma(advisor_ctx.change, change) : change;
+
+	pages = (unsigned long)ksm_thread_pages_to_scan * 100 / factor;
+	pages = pages * change / 100;
+
+	per_page_cost = ksm_thread_pages_to_scan / cpu_percent;
+	per_page_cost = per_page_cost ? per_page_cost : 1;
+
+	pages = min(pages, per_page_cost * ksm_advisor_max_cpu);
+	pages = max(pages, per_page_cost * KSM_ADVISOR_MIN_CPU);
+	pages = clamp(pages, ksm_advisor_min_pages_to_scan,
+		      ksm_advisor_max_pages_to_scan);
+
+	advisor_ctx.change = change;
+	advisor_ctx.scan_time = scan_time;
+
+	ksm_thread_pages_to_scan = pages;
+}
+
+static void advisor_start_scan(void)
+{
+	if (ksm_advisor == KSM_ADVISOR_SCAN_TIME) {
+		advisor_ctx.start_scan = ktime_get();
+		advisor_ctx.cpu_time = task_sched_runtime(current);
+	}
+}
+
+static void advisor_stop_scan(void)
+{
+	/* Skip a full scan which was already running when the mode changed */
+	if (ksm_advisor == KSM_ADVISOR_SCAN_TIME && advisor_ctx.start_scan)
+		scan_time_advisor();
+}
+
+static void set_advisor_defaults(void)
+{
+	if (ksm_advisor == KSM_ADVISOR_NONE) {
+		ksm_thread_pages_to_scan = DEFAULT_PAGES_TO_SCAN;
+	} else if (ksm_advisor == KSM_ADVISOR_SCAN_TIME) {
+		memset(&advisor_ctx, 0, sizeof(advisor_ctx));
+		ksm_thread_pages_to_scan = ksm_advisor_min_pages_to_scan;
+	}
+}
+
 #ifdef CONFIG_NUMA
 /* Zeroed when merging across nodes is not allowed */
 static unsigned int ksm_merge_across_nodes = 1;
@@ -389,6 +520,7 @@ static inline struct rmap_item *alloc_rmap_item(void)
 static inline void free_rmap_item(struct rmap_item *rmap_item)
 {
 	ksm_rmap_items--;
+	rmap_item->mm->ksm_rmap_items--;
 	rmap_item->mm = NULL;	/* debug safety */
 	kmem_cache_free(rmap_item_cache, rmap_item);
 }
@@ -641,6 +773,7 @@ static void remove_node_from_stable_tree(struct stable_node *stable_node)
 			ksm_pages_sharing--;
 		else
 			ksm_pages_shared--;
+		rmap_item->mm->ksm_merging_pages--;
 		VM_BUG_ON(stable_node->rmap_hlist_len <= 0);
 		stable_node->rmap_hlist_len--;
 		put_anon_vma(rmap_item->anon_vma);
@@ -789,6 +922,7 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 			ksm_pages_sharing--;
 		else
 			ksm_pages_shared--;
+		rmap_item->mm->ksm_merging_pages--;
 		VM_BUG_ON(stable_node->rmap_hlist_len <= 0);
 		stable_node->rmap_hlist_len--;
 
@@ -1175,8 +1309,15 @@ static int replace_page(struct vm_area_struct *vma, struct page *page,
 		page_add_anon_rmap(kpage, vma, addr, false);
 		newpte = mk_pte(kpage, vma->vm_page_prot);
 	} else {
+		/*
+		 * The dirty bit tells a KSM-placed zero page from one faulted
+		 * in by a read, see is_ksm_zero_pte().
+		 */
 		newpte = pte_mkspecial(pfn_pte(page_to_pfn(kpage),
 					       vma->vm_page_prot));
+		newpte = pte_mkdirty(newpte);
+		atomic_long_inc(&ksm_zero_pages);
+		atomic_long_inc(&mm->ksm_zero_pages);
 		/*
 		 * We're replacing an anonymous page with a zero page, which is
 		 * not anonymous. We need to do proper accounting otherwise we
@@ -2042,6 +2183,29 @@ static void stable_tree_append(struct rmap_item *rmap_item,
 		ksm_pages_sharing++;
 	else
 		ksm_pages_shared++;
+	rmap_item->mm->ksm_merging_pages++;
+}
+
+/*
+ * try_to_merge_with_zero_page - map the shared zero page in place of an
+ * empty page.  Returns 0 if the page was replaced.
+ */
+static int try_to_merge_with_zero_page(struct rmap_item *rmap_item,
+				       struct page *page)
+{
+	struct mm_struct *mm = rmap_item->mm;
+	struct vm_area_struct *vma;
+	int err = 0;
+
+	down_read(&mm->mmap_sem);
+	vma = find_mergeable_vma(mm, rmap_item->address);
+	/* If the vma is out of date, we do not need to continue. */
+	if (vma)
+		err = try_to_merge_one_page(vma, page,
+				ZERO_PAGE(rmap_item->address));
+	up_read(&mm->mmap_sem);
+
+	return err;
 }
 
 /*
@@ -2055,12 +2219,12 @@ static void stable_tree_append(struct rmap_item *rmap_item,
  */
 static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 {
-	struct mm_struct *mm = rmap_item->mm;
 	struct rmap_item *tree_rmap_item;
 	struct page *tree_page = NULL;
 	struct stable_node *stable_node;
 	struct page *kpage;
-	unsigned int checksum;
+	unsigned int checksum = 0;
+	bool checksum_valid = false;
 	int err;
 	bool max_page_sharing_bypass = false;
 
@@ -2082,6 +2246,20 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 		 */
 		if (!is_page_sharing_candidate(stable_node))
 			max_page_sharing_bypass = true;
+	} else if (ksm_use_zero_pages) {
+		/*
+		 * Empty pages are merged with the zero page right away: there
+		 * is no point searching the stable tree for them.  Like all
+		 * other pages, they must have been stable for a full scan.
+		 */
+		checksum = calc_checksum(page);
+		checksum_valid = true;
+		if (checksum == zero_checksum &&
+		    rmap_item->oldchecksum == checksum) {
+			remove_rmap_item_from_tree(rmap_item);
+			if (!try_to_merge_with_zero_page(rmap_item, page))
+				return;
+		}
 	}
 
 	/* We first start with searching the page inside the stable tree */
@@ -2118,7 +2296,8 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	 * don't want to insert it in the unstable tree, and we don't want
 	 * to waste our time searching for something identical to it there.
 	 */
-	checksum = calc_checksum(page);
+	if (!checksum_valid)
+		checksum = calc_checksum(page);
 	if (rmap_item->oldchecksum != checksum) {
 		rmap_item->oldchecksum = checksum;
 		return;
@@ -2126,29 +2305,16 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 
 	/*
 	 * Same checksum as an empty page. We attempt to merge it with the
-	 * appropriate zero page if the user enabled this via sysfs.
+	 * appropriate zero page if the user enabled this via sysfs.  Pages
+	 * tried on the fast path above are not tried again.
 	 */
-	if (ksm_use_zero_pages && (checksum == zero_checksum)) {
-		struct vm_area_struct *vma;
-
-		down_read(&mm->mmap_sem);
-		vma = find_mergeable_vma(mm, rmap_item->address);
-		if (vma) {
-			err = try_to_merge_one_page(vma, page,
-					ZERO_PAGE(rmap_item->address));
-		} else {
-			/*
-			 * If the vma is out of date, we do not need to
-			 * continue.
-			 */
-			err = 0;
-		}
-		up_read(&mm->mmap_sem);
+	if (ksm_use_zero_pages && (checksum == zero_checksum) &&
+	    !checksum_valid) {
 		/*
 		 * In case of failure, the page was not really empty, so we
 		 * need to continue. Otherwise we're done.
 		 */
-		if (!err)
+		if (!try_to_merge_with_zero_page(rmap_item, page))
 			return;
 	}
 	tree_rmap_item =
@@ -2235,6 +2401,7 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	if (rmap_item) {
 		/* It has already been zeroed */
 		rmap_item->mm = mm_slot->mm;
+		rmap_item->mm->ksm_rmap_items++;
 		rmap_item->address = addr;
 		rmap_item->rmap_list = *rmap_list;
 		*rmap_list = rmap_item;
@@ -2255,6 +2422,8 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 
 	slot = ksm_scan.mm_slot;
 	if (slot == &ksm_mm_head) {
+		advisor_start_scan();
+
 		/*
 		 * A number of pages can hang around indefinitely on per-cpu
 		 * pagevecs, raised page count preventing write_protect_page
@@ -2398,6 +2567,7 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 		goto next_mm;
 
 	ksm_scan.seqnr++;
+	advisor_stop_scan();
 	return NULL;
 }
 
@@ -2417,6 +2587,7 @@ static void ksm_do_scan(unsigned int scan_npages)
 			return;
 		cmp_and_merge_page(page, rmap_item);
 		put_page(page);
+		ksm_pages_scanned++;
 	}
 }
 
@@ -2450,6 +2621,17 @@ static int ksm_scan_thread(void *nothing)
 	return 0;
 }
 
+/*
+ * Memory saved by merging this mm's pages, less what KSM spends tracking
+ * them.  Negative while KSM costs this mm more than it saves.
+ */
+long ksm_process_profit(struct mm_struct *mm)
+{
+	return (long)(mm->ksm_merging_pages +
+		      atomic_long_read(&mm->ksm_zero_pages)) * PAGE_SIZE -
+		mm->ksm_rmap_items * sizeof(struct rmap_item);
+}
+
 int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 		unsigned long end, int advice, unsigned long *vm_flags)
 {
@@ -2881,6 +3063,10 @@ static ssize_t pages_to_scan_store(struct kobject *kobj,
 	int err;
 	unsigned long nr_pages;
 
+	/* The advisor owns pages_to_scan while it is enabled */
+	if (ksm_advisor != KSM_ADVISOR_NONE)
+		return -EINVAL;
+
 	err = kstrtoul(buf, 10, &nr_pages);
 	if (err || nr_pages > UINT_MAX)
 		return -EINVAL;
@@ -3145,6 +3331,158 @@ static ssize_t full_scans_show(struct kobject *kobj,
 }
 KSM_ATTR_RO(full_scans);
 
+static ssize_t pages_scanned_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_scanned);
+}
+KSM_ATTR_RO(pages_scanned);
+
+static ssize_t ksm_zero_pages_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%ld\n", atomic_long_read(&ksm_zero_pages));
+}
+KSM_ATTR_RO(ksm_zero_pages);
+
+static ssize_t general_profit_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	long general_profit;
+
+	general_profit = (ksm_pages_sharing +
+			  atomic_long_read(&ksm_zero_pages)) * PAGE_SIZE -
+			 ksm_rmap_items * sizeof(struct rmap_item);
+
+	return sprintf(buf, "%ld\n", general_profit);
+}
+KSM_ATTR_RO(general_profit);
+
+static ssize_t advisor_mode_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	const char *output;
+
+	if (ksm_advisor == KSM_ADVISOR_NONE)
+		output = "[none] scan-time";
+	else
+		output = "none [scan-time]";
+
+	return sprintf(buf, "%s\n", output);
+}
+
+static ssize_t advisor_mode_store(struct kobject *kobj,
+				  struct kobj_attribute *attr, const char *buf,
+				  size_t count)
+{
+	enum ksm_advisor_type curr_advisor = ksm_advisor;
+
+	if (sysfs_streq("scan-time", buf))
+		ksm_advisor = KSM_ADVISOR_SCAN_TIME;
+	else if (sysfs_streq("none", buf))
+		ksm_advisor = KSM_ADVISOR_NONE;
+	else
+		return -EINVAL;
+
+	/* Set advisor default values */
+	if (curr_advisor != ksm_advisor) {
+		mutex_lock(&ksm_thread_mutex);
+		set_advisor_defaults();
+		mutex_unlock(&ksm_thread_mutex);
+	}
+
+	return count;
+}
+KSM_ATTR(advisor_mode);
+
+static ssize_t advisor_max_cpu_show(struct kobject *kobj,
+				    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_advisor_max_cpu);
+}
+
+static ssize_t advisor_max_cpu_store(struct kobject *kobj,
+				     struct kobj_attribute *attr,
+				     const char *buf, size_t count)
+{
+	int err;
+	unsigned long value;
+
+	err = kstrtoul(buf, 10, &value);
+	if (err || value < KSM_ADVISOR_MIN_CPU || value > 100)
+		return -EINVAL;
+
+	ksm_advisor_max_cpu = value;
+	return count;
+}
+KSM_ATTR(advisor_max_cpu);
+
+static ssize_t advisor_min_pages_to_scan_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_advisor_min_pages_to_scan);
+}
+
+static ssize_t advisor_min_pages_to_scan_store(struct kobject *kobj,
+					struct kobj_attribute *attr,
+					const char *buf, size_t count)
+{
+	int err;
+	unsigned long value;
+
+	err = kstrtoul(buf, 10, &value);
+	if (err || !value || value > ksm_advisor_max_pages_to_scan)
+		return -EINVAL;
+
+	ksm_advisor_min_pages_to_scan = value;
+	return count;
+}
+KSM_ATTR(advisor_min_pages_to_scan);
+
+static ssize_t advisor_max_pages_to_scan_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_advisor_max_pages_to_scan);
+}
+
+static ssize_t advisor_max_pages_to_scan_store(struct kobject *kobj,
+					struct kobj_attribute *attr,
+					const char *buf, size_t count)
+{
+	int err;
+	unsigned long value;
+
+	err = kstrtoul(buf, 10, &value);
+	if (err || value < ksm_advisor_min_pages_to_scan || value > UINT_MAX)
+		return -EINVAL;
+
+	ksm_advisor_max_pages_to_scan = value;
+	return count;
+}
+KSM_ATTR(advisor_max_pages_to_scan);
+
+static ssize_t advisor_target_scan_time_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_advisor_target_scan_time);
+}
+
+static ssize_t advisor_target_scan_time_store(struct kobject *kobj,
+					struct kobj_attribute *attr,
+					const char *buf, size_t count)
+{
+	int err;
+	unsigned long value;
+
+	err = kstrtoul(buf, 10, &value);
+	if (err || value < 2)
+		return -EINVAL;
+
+	ksm_advisor_target_scan_time = value;
+	return count;
+}
+KSM_ATTR(advisor_target_scan_time);
+
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
@@ -3162,6 +3500,14 @@ static struct attribute *ksm_attrs[] = {
 	&stable_node_dups_attr.attr,
 	&stable_node_chains_prune_millisecs_attr.attr,
 	&use_zero_pages_attr.attr,
+	&pages_scanned_attr.attr,
+	&ksm_zero_pages_attr.attr,
+	&general_profit_attr.attr,
+	&advisor_mode_attr.attr,
+	&advisor_max_cpu_attr.attr,
+	&advisor_min_pages_to_scan_attr.attr,
+	&advisor_max_pages_to_scan_attr.attr,
+	&advisor_target_scan_time_attr.attr,
 	NULL,
 };
 
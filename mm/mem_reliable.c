@@ -10,6 +10,13 @@
 #include <linux/mmzone.h>
 #include <linux/oom.h>
 #include <linux/crash_dump.h>
+#include <linux/migrate.h>
+#include <linux/mm_inline.h>
+#include <linux/pagemap.h>
+#include <linux/swap.h>
+#include <linux/workqueue.h>
+
+#include "internal.h"
 
 enum mem_reliable_types {
 	MEM_RELIABLE_ALL,
@@ -374,6 +381,207 @@ int reliable_pagecache_max_bytes_write(struct ctl_table *table, int write,
 	return ret;
 }
 
+/*
+ * RELIABLE_PAGECACHE_ALL puts every page cache page in mirrored memory
+ * as long as reliable_pagecache_max_bytes allows it.  RELIABLE_PAGECACHE_HOT
+ * only does so for filesystem metadata and for pages whose shadow entry
+ * says they were part of the workingset, cold pages are pushed out of the
+ * mirrored zones by reliable_demote_work.
+ */
+#define RELIABLE_PAGECACHE_ALL		0
+#define RELIABLE_PAGECACHE_HOT		1
+
+#define RELIABLE_DEMOTE_INTERVAL	HZ
+#define RELIABLE_DEMOTE_BATCH		SWAP_CLUSTER_MAX
+#define RELIABLE_DEMOTE_SCAN_MAX	(1UL << 16)
+
+static unsigned long reliable_pagecache_policy = RELIABLE_PAGECACHE_ALL;
+static unsigned long reliable_pagecache_policy_max = RELIABLE_PAGECACHE_HOT;
+/* free mirrored memory, in percent of the total, to start/stop demotion */
+static unsigned long reliable_pagecache_demote_low = 5;
+static unsigned long reliable_pagecache_demote_high = 10;
+static unsigned long one_hundred = 100;
+/* where the next demotion round resumes its pfn walk */
+static unsigned long reliable_demote_pfn;
+
+static void reliable_demote_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(reliable_demote_work, reliable_demote_fn);
+
+static inline bool reliable_pagecache_hot_only(void)
+{
+	return READ_ONCE(reliable_pagecache_policy) == RELIABLE_PAGECACHE_HOT;
+}
+
+static bool reliable_demote_candidate(struct page *page)
+{
+	return PageLRU(page) && page_is_file_cache(page) &&
+	       !PageActive(page) && !PageReferenced(page) &&
+	       !PageUnevictable(page) && !PageDirty(page) &&
+	       !PageWriteback(page) && !PageCompound(page);
+}
+
+static struct page *reliable_demote_alloc(struct page *page,
+					  unsigned long private)
+{
+	struct page *newpage;
+
+	newpage = alloc_pages_node(page_to_nid(page), GFP_HIGHUSER_MOVABLE |
+				   __GFP_NORETRY | __GFP_NOWARN, 0);
+	/* the movable zones are full, keep the page where it is */
+	if (newpage && page_reliable(newpage)) {
+		__free_page(newpage);
+		return NULL;
+	}
+
+	return newpage;
+}
+
+static void reliable_demote_pages(struct list_head *pages)
+{
+	if (list_empty(pages))
+		return;
+
+	if (migrate_pages(pages, reliable_demote_alloc, NULL, 0,
+			  MIGRATE_ASYNC, MR_MEM_RELIABLE))
+		putback_movable_pages(pages);
+}
+
+/*
+ * Walk at most RELIABLE_DEMOTE_SCAN_MAX pfns of the mirrored zones and
+ * move cold clean page cache pages to the movable zones until @target
+ * pages are free.  Returns false once the whole range has been walked.
+ */
+static bool reliable_demote_scan(long target)
+{
+	unsigned long scanned = 0, nr_isolated = 0;
+	unsigned long pfn, end_pfn;
+	struct page *page;
+	struct zone *zone;
+	LIST_HEAD(pages);
+
+	for_each_populated_zone(zone) {
+		if (!zone_reliable(zone))
+			continue;
+
+		end_pfn = zone_end_pfn(zone);
+		if (reliable_demote_pfn >= end_pfn)
+			continue;
+
+		pfn = max(reliable_demote_pfn, zone->zone_start_pfn);
+		for (; pfn < end_pfn; pfn++) {
+			if (++scanned > RELIABLE_DEMOTE_SCAN_MAX)
+				goto out;
+
+			if (!pfn_valid(pfn))
+				continue;
+
+			page = pfn_to_page(pfn);
+			if (page_zone(page) != zone ||
+			    !reliable_demote_candidate(page))
+				continue;
+
+			if (!get_page_unless_zero(page))
+				continue;
+
+			if (isolate_lru_page(page)) {
+				put_page(page);
+				continue;
+			}
+
+			list_add_tail(&page->lru, &pages);
+			inc_node_page_state(page, NR_ISOLATED_ANON +
+					    page_is_file_cache(page));
+			put_page(page);
+
+			if (++nr_isolated < RELIABLE_DEMOTE_BATCH)
+				continue;
+
+			reliable_demote_pages(&pages);
+			nr_isolated = 0;
+			if (free_reliable_pages() >= target) {
+				pfn++;
+				goto out;
+			}
+			cond_resched();
+		}
+
+		reliable_demote_pfn = end_pfn;
+	}
+
+	reliable_demote_pages(&pages);
+	reliable_demote_pfn = 0;
+
+	return false;
+
+out:
+	reliable_demote_pages(&pages);
+	reliable_demote_pfn = pfn;
+
+	return true;
+}
+
+static void reliable_demote_fn(struct work_struct *work)
+{
+	unsigned long total = total_reliable_mem_sz() >> PAGE_SHIFT;
+	unsigned long low, high;
+
+	if (!mem_reliable_is_enabled() || !pagecache_reliable_is_enabled() ||
+	    !reliable_pagecache_hot_only())
+		return;
+
+	low = total / 100 * READ_ONCE(reliable_pagecache_demote_low);
+	high = total / 100 * READ_ONCE(reliable_pagecache_demote_high);
+	high = max(low, high);
+
+	if (free_reliable_pages() < low) {
+		while (free_reliable_pages() < high &&
+		       reliable_demote_scan(high))
+			cond_resched();
+	}
+
+	queue_delayed_work(system_unbound_wq, &reliable_demote_work,
+			   RELIABLE_DEMOTE_INTERVAL);
+}
+
+static int reliable_pagecache_policy_handler(struct ctl_table *table,
+	int write, void __user *buffer, size_t *length, loff_t *ppos)
+{
+	int ret;
+
+	ret = proc_doulongvec_minmax(table, write, buffer, length, ppos);
+	if (!ret && write && reliable_pagecache_hot_only())
+		mod_delayed_work(system_unbound_wq, &reliable_demote_work, 0);
+
+	return ret;
+}
+
+/*
+ * Under RELIABLE_PAGECACHE_HOT, decide whether the page cache page about
+ * to be allocated for @mapping deserves mirrored memory.  @shadow is the
+ * entry found at its index, if any.
+ */
+void page_cache_reliable_hint(struct address_space *mapping, void *shadow,
+			      gfp_t *gfp)
+{
+	struct inode *host = mapping->host;
+
+	if (!mem_reliable_is_enabled() || !reliable_pagecache_hot_only())
+		return;
+
+	/* block device page cache holds the filesystem metadata */
+	if (host && S_ISBLK(host->i_mode))
+		goto reliable;
+
+	if (shadow && radix_tree_exceptional_entry(shadow) &&
+	    workingset_shadow_is_hot(shadow))
+		goto reliable;
+
+	return;
+
+reliable:
+	*gfp |= ___GFP_RELIABILITY;
+}
+
 static struct ctl_table reliable_ctl_table[] = {
 	{
 		.procname = "task_reliable_limit",
@@ -406,6 +614,33 @@ static struct ctl_table reliable_ctl_table[] = {
 		.proc_handler = reliable_pagecache_max_bytes_write,
 		.extra1 = &zero,
 	},
+	{
+		.procname = "reliable_pagecache_policy",
+		.data = &reliable_pagecache_policy,
+		.maxlen = sizeof(reliable_pagecache_policy),
+		.mode = 0644,
+		.proc_handler = reliable_pagecache_policy_handler,
+		.extra1 = &zero,
+		.extra2 = &reliable_pagecache_policy_max,
+	},
+	{
+		.procname = "reliable_pagecache_demote_low",
+		.data = &reliable_pagecache_demote_low,
+		.maxlen = sizeof(reliable_pagecache_demote_low),
+		.mode = 0644,
+		.proc_handler = proc_doulongvec_minmax,
+		.extra1 = &zero,
+		.extra2 = &one_hundred,
+	},
+	{
+		.procname = "reliable_pagecache_demote_high",
+		.data = &reliable_pagecache_demote_high,
+		.maxlen = sizeof(reliable_pagecache_demote_high),
+		.mode = 0644,
+		.proc_handler = proc_doulongvec_minmax,
+		.extra1 = &zero,
+		.extra2 = &one_hundred,
+	},
 	{}
 };
 
@@ -429,6 +664,9 @@ void page_cache_prepare_alloc(gfp_t *gfp)
 	if (!pagecache_reliable_is_enabled())
 		goto no_reliable;
 
+	if (reliable_pagecache_hot_only() && !(*gfp & ___GFP_RELIABILITY))
+		goto no_reliable;
+
 	nr_reliable = percpu_counter_read_positive(&pagecache_reliable_pages);
 
 	if (nr_reliable > reliable_pagecache_max_bytes >> PAGE_SHIFT)
@@ -89,6 +89,9 @@ static bool cgroup_memory_nosocket;
 /* Kernel memory accounting disabled */
 bool cgroup_memory_nokmem = true;
 
+/* Slab objects accounted by per-memcg copies of the caches */
+bool cgroup_memory_kmemcache __read_mostly;
+
 /* Whether the swap controller is active */
 #ifdef CONFIG_MEMCG_SWAP
 int do_swap_account __read_mostly;
@@ -490,7 +493,11 @@ ino_t page_cgroup_ino(struct page *page)
 	unsigned long ino = 0;
 
 	rcu_read_lock();
-	memcg = READ_ONCE(page->mem_cgroup);
+	/* Shared slab pages don't belong to any single memcg */
+	if (page_has_obj_cgroups(page))
+		memcg = NULL;
+	else
+		memcg = READ_ONCE(page->mem_cgroup);
 	while (memcg && !(memcg->css.flags & CSS_ONLINE))
 		memcg = parent_mem_cgroup(memcg);
 	if (memcg)
@@ -683,6 +690,64 @@ mem_cgroup_largest_soft_limit_node(struct mem_cgroup_tree_per_node *mctz)
 	return mz;
 }
 
+/*
+ * Stat updates only touch the per-cpu counters of the cgroup they are
+ * made against and mark it in the rstat updated tree.  The hierarchical
+ * counters (memcg->stat, memcg->events and pn->lruvec_stat) are brought
+ * up to date by mem_cgroup_css_rstat_flush(), which runs when readers
+ * ask for it, once about MEMCG_CHARGE_BATCH updates per online cpu
+ * have piled up, and every couple of seconds from stats_flush_dwork.
+ */
+static void flush_memcg_stats_dwork(struct work_struct *w);
+static DECLARE_DEFERRABLE_WORK(stats_flush_dwork, flush_memcg_stats_dwork);
+static DEFINE_SPINLOCK(stats_flush_lock);
+static DEFINE_PER_CPU(unsigned int, stats_updates);
+static atomic_t stats_flush_threshold = ATOMIC_INIT(0);
+
+static inline void memcg_rstat_updated(struct mem_cgroup *memcg, int val)
+{
+	unsigned int x;
+
+	cgroup_rstat_updated(memcg->css.cgroup, smp_processor_id());
+
+	x = __this_cpu_add_return(stats_updates, abs(val));
+	if (x > MEMCG_CHARGE_BATCH) {
+		atomic_add(x / MEMCG_CHARGE_BATCH, &stats_flush_threshold);
+		__this_cpu_write(stats_updates, 0);
+	}
+}
+
+static void __mem_cgroup_flush_stats(void)
+{
+	unsigned long flags;
+
+	if (!spin_trylock_irqsave(&stats_flush_lock, flags))
+		return;
+
+	cgroup_rstat_flush_irqsafe(root_mem_cgroup->css.cgroup);
+	atomic_set(&stats_flush_threshold, 0);
+	spin_unlock_irqrestore(&stats_flush_lock, flags);
+}
+
+/**
+ * mem_cgroup_flush_stats - bring the hierarchical memcg stats up to date
+ *
+ * Flushes the pending per-cpu updates if enough of them have piled up
+ * to make the hierarchical counters noticeably stale.  Can be called
+ * from any context.
+ */
+void mem_cgroup_flush_stats(void)
+{
+	if (atomic_read(&stats_flush_threshold) > num_online_cpus())
+		__mem_cgroup_flush_stats();
+}
+
+static void flush_memcg_stats_dwork(struct work_struct *w)
+{
+	__mem_cgroup_flush_stats();
+	queue_delayed_work(system_unbound_wq, &stats_flush_dwork, 2UL*HZ);
+}
+
 /**
  * __mod_memcg_state - update cgroup memory statistics
  * @memcg: the memory cgroup
@@ -691,39 +756,11 @@ mem_cgroup_largest_soft_limit_node(struct mem_cgroup_tree_per_node *mctz)
  */
 void __mod_memcg_state(struct mem_cgroup *memcg, int idx, int val)
 {
-	long x;
-
 	if (mem_cgroup_disabled())
 		return;
 
-	x = val + __this_cpu_read(memcg->stat_cpu->count[idx]);
-	if (unlikely(abs(x) > MEMCG_CHARGE_BATCH ||
-	    memcg->css.flags & CSS_DYING)) {
-		struct mem_cgroup *mi;
-		struct mem_cgroup_extension *memcg_ext;
-
-		/*
-		 * Batch local counters to keep them in sync with
-		 * the hierarchical ones.
-		 */
-		memcg_ext = to_memcg_ext(memcg);
-		__this_cpu_add(memcg_ext->vmstats_local->count[idx], x);
-		for (mi = memcg; mi; mi = parent_mem_cgroup(mi))
-			atomic_long_add(x, &mi->stat[idx]);
-		x = 0;
-	}
-	__this_cpu_write(memcg->stat_cpu->count[idx], x);
-}
-
-static struct mem_cgroup_per_node *
-parent_nodeinfo(struct mem_cgroup_per_node *pn, int nid)
-{
-	struct mem_cgroup *parent;
-
-	parent = parent_mem_cgroup(pn->memcg);
-	if (!parent)
-		return NULL;
-	return mem_cgroup_nodeinfo(parent, nid);
+	__this_cpu_add(memcg->stat_cpu->count[idx], val);
+	memcg_rstat_updated(memcg, val);
 }
 
 /**
@@ -741,9 +778,7 @@ void __mod_lruvec_state(struct lruvec *lruvec, enum node_stat_item idx,
 {
 	pg_data_t *pgdat = lruvec_pgdat(lruvec);
 	struct mem_cgroup_per_node *pn;
-	struct mem_cgroup_per_node_extension *pn_ext;
 	struct mem_cgroup *memcg;
-	long x;
 
 	/* Update node */
 	__mod_node_page_state(pgdat, idx, val);
@@ -754,22 +789,11 @@ void __mod_lruvec_state(struct lruvec *lruvec, enum node_stat_item idx,
 	pn = container_of(lruvec, struct mem_cgroup_per_node, lruvec);
 	memcg = pn->memcg;
 
-	/* Update memcg */
-	__mod_memcg_state(memcg, idx, val);
-
 	/* Update lruvec */
-	pn_ext = to_mgpn_ext(pn);
-	__this_cpu_add(pn_ext->lruvec_stat_local->count[idx], val);
-
-	x = val + __this_cpu_read(pn->lruvec_stat_cpu->count[idx]);
-	if (unlikely(abs(x) > MEMCG_CHARGE_BATCH)) {
-		struct mem_cgroup_per_node *pi;
+	__this_cpu_add(pn->lruvec_stat_cpu->count[idx], val);
 
-		for (pi = pn; pi; pi = parent_nodeinfo(pi, pgdat->node_id))
-			atomic_long_add(x, &pi->lruvec_stat[idx]);
-		x = 0;
-	}
-	__this_cpu_write(pn->lruvec_stat_cpu->count[idx], x);
+	/* Update memcg, this also marks the lruvec for the next flush */
+	__mod_memcg_state(memcg, idx, val);
 }
 
 /**
@@ -781,27 +805,11 @@ void __mod_lruvec_state(struct lruvec *lruvec, enum node_stat_item idx,
 void __count_memcg_events(struct mem_cgroup *memcg, enum vm_event_item idx,
 			  unsigned long count)
 {
-	unsigned long x;
-
 	if (mem_cgroup_disabled())
 		return;
 
-	x = count + __this_cpu_read(memcg->stat_cpu->events[idx]);
-	if (unlikely(x > MEMCG_CHARGE_BATCH)) {
-		struct mem_cgroup *mi;
-		struct mem_cgroup_extension *memcg_ext;
-
-		/*
-		 * Batch local counters to keep them in sync with
-		 * the hierarchical ones.
-		 */
-		memcg_ext = to_memcg_ext(memcg);
-		__this_cpu_add(memcg_ext->vmstats_local->events[idx], x);
-		for (mi = memcg; mi; mi = parent_mem_cgroup(mi))
-			atomic_long_add(x, &mi->events[idx]);
-		x = 0;
-	}
-	__this_cpu_write(memcg->stat_cpu->events[idx], x);
+	__this_cpu_add(memcg->stat_cpu->events[idx], count);
+	memcg_rstat_updated(memcg, count);
 }
 
 static unsigned long memcg_events(struct mem_cgroup *memcg, int event)
@@ -813,11 +821,9 @@ static unsigned long memcg_events_local(struct mem_cgroup *memcg, int event)
 {
 	long x = 0;
 	int cpu;
-	struct mem_cgroup_extension *memcg_ext;
 
-	memcg_ext = to_memcg_ext(memcg);
 	for_each_possible_cpu(cpu)
-		x += per_cpu(memcg_ext->vmstats_local->events[event], cpu);
+		x += per_cpu(memcg->stat_cpu->events[event], cpu);
 	return x;
 }
 
@@ -1290,6 +1296,72 @@ struct lruvec *mem_cgroup_page_lruvec(struct page *page, struct pglist_data *pgd
 	return lruvec;
 }
 
+/**
+ * lock_page_lruvec - lock the lruvec a page belongs to
+ * @page: the page
+ *
+ * The memcg of a page on an LRU list is only changed with the lru_lock
+ * of its current lruvec held, so look the lruvec up again once the lock
+ * is taken and retry if the page moved meanwhile.  The memcg, and with
+ * it the lruvec, cannot go away under us: it is freed after an RCU grace
+ * period.  Callers that go on to test PageLRU must do it with
+ * page_lru_relock_irq(), the page may be put back on another lruvec.
+ */
+struct lruvec *lock_page_lruvec(struct page *page)
+{
+	struct pglist_data *pgdat = page_pgdat(page);
+	struct lruvec *lruvec;
+
+	rcu_read_lock();
+again:
+	lruvec = mem_cgroup_page_lruvec(page, pgdat);
+	spin_lock(&lruvec->lru_lock);
+	if (unlikely(lruvec != mem_cgroup_page_lruvec(page, pgdat))) {
+		spin_unlock(&lruvec->lru_lock);
+		goto again;
+	}
+	rcu_read_unlock();
+
+	return lruvec;
+}
+
+struct lruvec *lock_page_lruvec_irq(struct page *page)
+{
+	struct pglist_data *pgdat = page_pgdat(page);
+	struct lruvec *lruvec;
+
+	rcu_read_lock();
+again:
+	lruvec = mem_cgroup_page_lruvec(page, pgdat);
+	spin_lock_irq(&lruvec->lru_lock);
+	if (unlikely(lruvec != mem_cgroup_page_lruvec(page, pgdat))) {
+		spin_unlock_irq(&lruvec->lru_lock);
+		goto again;
+	}
+	rcu_read_unlock();
+
+	return lruvec;
+}
+
+struct lruvec *lock_page_lruvec_irqsave(struct page *page,
+					unsigned long *flags)
+{
+	struct pglist_data *pgdat = page_pgdat(page);
+	struct lruvec *lruvec;
+
+	rcu_read_lock();
+again:
+	lruvec = mem_cgroup_page_lruvec(page, pgdat);
+	spin_lock_irqsave(&lruvec->lru_lock, *flags);
+	if (unlikely(lruvec != mem_cgroup_page_lruvec(page, pgdat))) {
+		spin_unlock_irqrestore(&lruvec->lru_lock, *flags);
+		goto again;
+	}
+	rcu_read_unlock();
+
+	return lruvec;
+}
+
 /**
  * mem_cgroup_update_lru_size - account for adding or removing an lru page
  * @lruvec: mem_cgroup per zone lru vector
@@ -2102,6 +2174,12 @@ EXPORT_SYMBOL(unlock_page_memcg);
 struct memcg_stock_pcp {
 	struct mem_cgroup *cached; /* this never be root cgroup */
 	unsigned int nr_pages;
+
+#ifdef CONFIG_MEMCG_KMEM
+	struct obj_cgroup *cached_objcg;
+	unsigned int nr_bytes;
+#endif
+
 	struct work_struct work;
 	unsigned long flags;
 #define FLUSHING_CACHED_CHARGE	0
@@ -2109,6 +2187,21 @@ struct memcg_stock_pcp {
 static DEFINE_PER_CPU(struct memcg_stock_pcp, memcg_stock);
 static DEFINE_MUTEX(percpu_charge_mutex);
 
+#ifdef CONFIG_MEMCG_KMEM
+static void drain_obj_stock(struct memcg_stock_pcp *stock);
+static bool obj_stock_flush_required(struct memcg_stock_pcp *stock,
+				     struct mem_cgroup *root_memcg);
+#else
+static inline void drain_obj_stock(struct memcg_stock_pcp *stock)
+{
+}
+static inline bool obj_stock_flush_required(struct memcg_stock_pcp *stock,
+					    struct mem_cgroup *root_memcg)
+{
+	return false;
+}
+#endif
+
 /**
  * consume_stock: Try to consume stocked charge on this cpu.
  * @memcg: memcg to consume from.
@@ -2176,6 +2269,7 @@ static void drain_local_stock(struct work_struct *dummy)
 	local_irq_save(flags);
 
 	stock = this_cpu_ptr(&memcg_stock);
+	drain_obj_stock(stock);
 	drain_stock(stock);
 	clear_bit(FLUSHING_CACHED_CHARGE, &stock->flags);
 
@@ -2235,6 +2329,8 @@ static void drain_all_stock(struct mem_cgroup *root_memcg)
 		if (memcg && stock->nr_pages &&
 		    mem_cgroup_is_descendant(memcg, root_memcg))
 			flush = true;
+		else if (obj_stock_flush_required(stock, root_memcg))
+			flush = true;
 		rcu_read_unlock();
 
 		if (flush &&
@@ -2252,55 +2348,11 @@ static void drain_all_stock(struct mem_cgroup *root_memcg)
 static int memcg_hotplug_cpu_dead(unsigned int cpu)
 {
 	struct memcg_stock_pcp *stock;
-	struct mem_cgroup *memcg;
 
 	stock = &per_cpu(memcg_stock, cpu);
+	drain_obj_stock(stock);
 	drain_stock(stock);
 
-	for_each_mem_cgroup(memcg) {
-		struct mem_cgroup_stat_cpu *statc;
-		int i;
-
-		statc = per_cpu_ptr(memcg->stat_cpu, cpu);
-
-		for (i = 0; i < MEMCG_NR_STAT; i++) {
-			int nid;
-
-			if (statc->count[i]) {
-				mod_memcg_state(memcg, i, statc->count[i]);
-				statc->count[i] = 0;
-			}
-
-			if (i >= NR_VM_NODE_STAT_ITEMS)
-				continue;
-
-			for_each_node(nid) {
-				struct lruvec_stat *lstatc;
-				struct mem_cgroup_per_node *pn;
-				long x;
-
-				pn = mem_cgroup_nodeinfo(memcg, nid);
-				lstatc = per_cpu_ptr(pn->lruvec_stat_cpu, cpu);
-
-				x = lstatc->count[i];
-				lstatc->count[i] = 0;
-
-				if (x) {
-					do {
-						atomic_long_add(x, &pn->lruvec_stat[i]);
-					} while ((pn = parent_nodeinfo(pn, nid)));
-				}
-			}
-		}
-
-		for (i = 0; i < NR_VM_EVENT_ITEMS; i++) {
-			if (statc->events[i]) {
-				count_memcg_events(memcg, i, statc->events[i]);
-				statc->events[i] = 0;
-			}
-		}
-	}
-
 	return 0;
 }
 
@@ -2342,6 +2394,86 @@ void mem_cgroup_handle_over_high(void)
 	current->memcg_nr_pages_over_high = 0;
 }
 
+/* pages reclaimed per try_to_free_mem_cgroup_pages() call by wmark_work */
+#define MEMCG_WMARK_RECLAIM_BATCH	(SWAP_CLUSTER_MAX * 32)
+#define MEMCG_WMARK_SCALE_FACTOR	50
+
+static struct workqueue_struct *memcg_wmark_wq;
+/* Enabled while at least one memcg has a high watermark set */
+static DEFINE_STATIC_KEY_FALSE(memcg_wmark_key);
+
+static void memcg_wmark_work_func(struct work_struct *work)
+{
+	struct mem_cgroup_extension *memcg_ext;
+	struct mem_cgroup *memcg;
+	int nr_retries = MEM_CGROUP_RECLAIM_RETRIES;
+	unsigned long usage, low;
+	u64 runtime;
+
+	memcg_ext = container_of(work, struct mem_cgroup_extension, wmark_work);
+	memcg = &memcg_ext->memcg;
+	runtime = current->se.sum_exec_runtime;
+
+	for (;;) {
+		low = READ_ONCE(memcg_ext->wmark_low);
+		usage = page_counter_read(&memcg->memory);
+		if (usage <= low)
+			break;
+
+		if (!try_to_free_mem_cgroup_pages(memcg,
+				min(usage - low, MEMCG_WMARK_RECLAIM_BATCH),
+				GFP_KERNEL, true) && !nr_retries--)
+			break;
+
+		cond_resched();
+	}
+
+	runtime = current->se.sum_exec_runtime - runtime;
+	atomic64_add(runtime, &memcg_ext->wmark_reclaim_time);
+}
+
+/*
+ * wmark_work runs on a per-cpu workqueue, on the CPU the charging task
+ * was running on.  That CPU belongs to the cpuset of a task of the memcg
+ * (or of one of its descendants), so background reclaim stays off the
+ * CPUs of the neighbours.  Charges from interrupts and kernel threads
+ * don't tell anything about the memcg, they reuse the last known CPU.
+ */
+static void memcg_wmark_queue(struct mem_cgroup_extension *memcg_ext,
+			      bool charging)
+{
+	int cpu;
+
+	if (charging && !in_interrupt() && !(current->flags & PF_KTHREAD))
+		WRITE_ONCE(memcg_ext->wmark_cpu, raw_smp_processor_id());
+
+	cpu = READ_ONCE(memcg_ext->wmark_cpu);
+	if (cpu < 0 || !cpu_online(cpu))
+		cpu = raw_smp_processor_id();
+
+	queue_work_on(cpu, memcg_wmark_wq, &memcg_ext->wmark_work);
+}
+
+/*
+ * Kick background reclaim for every memcg in the hierarchy that went
+ * over its high watermark, so that the charging tasks hopefully never
+ * get to direct reclaim.
+ */
+static void memcg_wmark_check(struct mem_cgroup *memcg)
+{
+	struct mem_cgroup_extension *memcg_ext;
+
+	if (!static_branch_unlikely(&memcg_wmark_key))
+		return;
+
+	do {
+		memcg_ext = to_memcg_ext(memcg);
+		if (page_counter_read(&memcg->memory) >
+		    READ_ONCE(memcg_ext->wmark_high))
+			memcg_wmark_queue(memcg_ext, true);
+	} while ((memcg = parent_mem_cgroup(memcg)));
+}
+
 static int try_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 		      unsigned int nr_pages)
 {
@@ -2497,6 +2629,8 @@ static int try_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 	if (batch > nr_pages)
 		refill_stock(memcg, batch - nr_pages);
 
+	memcg_wmark_check(memcg);
+
 	/*
 	 * If the hierarchy is above the normal consumption range, schedule
 	 * reclaim on returning to userland.  We can perform reclaim here
@@ -2534,40 +2668,94 @@ static void cancel_charge(struct mem_cgroup *memcg, unsigned int nr_pages)
 	css_put_many(&memcg->css, nr_pages);
 }
 
-static void lock_page_lru(struct page *page, int *isolated)
+static struct lruvec *lock_page_lru(struct page *page, int *isolated)
 {
-	struct zone *zone = page_zone(page);
-
-	spin_lock_irq(zone_lru_lock(zone));
-	if (PageLRU(page)) {
-		struct lruvec *lruvec;
+	struct lruvec *lruvec;
 
-		lruvec = mem_cgroup_page_lruvec(page, zone->zone_pgdat);
+	lruvec = lock_page_lruvec_irq(page);
+	if (page_lru_relock_irq(page, &lruvec)) {
 		ClearPageLRU(page);
 		del_page_from_lru_list(page, lruvec, page_lru(page));
 		*isolated = 1;
 	} else
 		*isolated = 0;
+
+	return lruvec;
 }
 
-static void unlock_page_lru(struct page *page, int isolated)
+/*
+ * page->mem_cgroup has changed under the lock of the old lruvec, which
+ * has to be swapped for the one of the new memcg before putting the page
+ * back.
+ */
+static void unlock_page_lru(struct page *page, struct lruvec *lruvec,
+			    int isolated)
 {
-	struct zone *zone = page_zone(page);
-
 	if (isolated) {
-		struct lruvec *lruvec;
-
-		lruvec = mem_cgroup_page_lruvec(page, zone->zone_pgdat);
+		lruvec = relock_page_lruvec_irq(page, lruvec);
 		VM_BUG_ON_PAGE(PageLRU(page), page);
 		SetPageLRU(page);
 		add_page_to_lru_list(page, lruvec, page_lru(page));
 	}
-	spin_unlock_irq(zone_lru_lock(zone));
+	unlock_page_lruvec_irq(lruvec);
 }
 
+#ifdef CONFIG_MEMORY_RELIABLE
+static void memcg_reliable_charge(struct mem_cgroup *memcg, struct page *page,
+				  long nr_pages)
+{
+	if (!page_reliable(page) || mem_cgroup_is_root(memcg))
+		return;
+
+	if (nr_pages > 0)
+		page_counter_charge(&to_memcg_ext(memcg)->reliable, nr_pages);
+	else
+		page_counter_uncharge(&to_memcg_ext(memcg)->reliable, -nr_pages);
+}
+
+/*
+ * Allocations from mirrored memory are checked against the reliable limit
+ * of the current task's memcg and its ancestors. The usage is charged when
+ * the page is committed to the memcg, so this is a soft limit which may be
+ * exceeded by concurrent allocations.
+ */
+bool mem_cgroup_reliable_limit_check(unsigned long nr_pages)
+{
+	struct page_counter *counter;
+	struct mem_cgroup *memcg;
+	bool ret = true;
+
+	if (mem_cgroup_disabled() || !in_task() || !current->mm)
+		return true;
+
+	rcu_read_lock();
+	memcg = mem_cgroup_from_task(current);
+	if (!memcg || mem_cgroup_is_root(memcg))
+		goto out;
+
+	for (counter = &to_memcg_ext(memcg)->reliable; counter;
+	     counter = counter->parent) {
+		if (page_counter_read(counter) + nr_pages > counter->max) {
+			counter->failcnt++;
+			ret = false;
+			break;
+		}
+	}
+out:
+	rcu_read_unlock();
+	return ret;
+}
+#else
+static inline void memcg_reliable_charge(struct mem_cgroup *memcg,
+					 struct page *page, long nr_pages)
+{
+}
+#endif
+
 static void commit_charge(struct page *page, struct mem_cgroup *memcg,
 			  bool lrucare)
 {
+	struct lruvec *lruvec;
 	int isolated;
 
 	VM_BUG_ON_PAGE(page->mem_cgroup, page);
@@ -2577,7 +2765,7 @@ static void commit_charge(struct page *page, struct mem_cgroup *memcg,
 	 * may already be on some other mem_cgroup's LRU.  Take care of it.
 	 */
 	if (lrucare)
-		lock_page_lru(page, &isolated);
+		lruvec = lock_page_lru(page, &isolated);
 
 	/*
 	 * Nobody should be changing or seriously looking at
@@ -2594,9 +2782,10 @@ static void commit_charge(struct page *page, struct mem_cgroup *memcg,
 	 *   have the page locked
 	 */
 	page->mem_cgroup = memcg;
+	memcg_reliable_charge(memcg, page, hpage_nr_pages(page));
 
 	if (lrucare)
-		unlock_page_lru(page, isolated);
+		unlock_page_lru(page, lruvec, isolated);
 }
 
 #ifdef CONFIG_MEMCG_KMEM
@@ -2783,19 +2972,13 @@ void memcg_kmem_put_cache(struct kmem_cache *cachep)
 		css_put(&cachep->memcg_params.memcg->css);
 }
 
-/**
- * __memcg_kmem_charge_memcg: charge a kmem page
- * @page: page to charge
- * @gfp: reclaim mode
- * @order: allocation order
- * @memcg: memory cgroup to charge
- *
- * Returns 0 on success, an error code on failure.
+/*
+ * Charge @nr_pages of kernel memory to @memcg, without a page to tie the
+ * charge to.
  */
-int __memcg_kmem_charge_memcg(struct page *page, gfp_t gfp, int order,
-			    struct mem_cgroup *memcg)
+static int memcg_kmem_charge_pages(struct mem_cgroup *memcg, gfp_t gfp,
+				   unsigned int nr_pages)
 {
-	unsigned int nr_pages = 1 << order;
 	struct page_counter *counter;
 	int ret;
 
@@ -2818,6 +3001,37 @@ int __memcg_kmem_charge_memcg(struct page *page, gfp_t gfp, int order,
 		cancel_charge(memcg, nr_pages);
 		return -ENOMEM;
 	}
+	return 0;
+}
+
+static void memcg_kmem_uncharge_pages(struct mem_cgroup *memcg,
+				      unsigned int nr_pages)
+{
+	if (!cgroup_subsys_on_dfl(memory_cgrp_subsys))
+		page_counter_uncharge(&memcg->kmem, nr_pages);
+
+	page_counter_uncharge(&memcg->memory, nr_pages);
+	if (do_memsw_account())
+		page_counter_uncharge(&memcg->memsw, nr_pages);
+}
+
+/**
+ * __memcg_kmem_charge_memcg: charge a kmem page
+ * @page: page to charge
+ * @gfp: reclaim mode
+ * @order: allocation order
+ * @memcg: memory cgroup to charge
+ *
+ * Returns 0 on success, an error code on failure.
+ */
+int __memcg_kmem_charge_memcg(struct page *page, gfp_t gfp, int order,
+			    struct mem_cgroup *memcg)
+{
+	int ret;
+
+	ret = memcg_kmem_charge_pages(memcg, gfp, 1 << order);
+	if (ret)
+		return ret;
 
 	page->mem_cgroup = memcg;
 
@@ -2869,28 +3083,345 @@ void __memcg_kmem_uncharge(struct page *page, int order)
 
 	VM_BUG_ON_PAGE(mem_cgroup_is_root(memcg), page);
 
-	if (!cgroup_subsys_on_dfl(memory_cgrp_subsys))
-		page_counter_uncharge(&memcg->kmem, nr_pages);
-
-	page_counter_uncharge(&memcg->memory, nr_pages);
-	if (do_memsw_account())
-		page_counter_uncharge(&memcg->memsw, nr_pages);
-
 	page->mem_cgroup = NULL;
 
 	/* slab pages do not have PageKmemcg flag set */
 	if (PageKmemcg(page))
 		__ClearPageKmemcg(page);
 
+	memcg_kmem_uncharge_pages(memcg, nr_pages);
 	css_put_many(&memcg->css, nr_pages);
 }
+
+static void obj_cgroup_release(struct percpu_ref *ref)
+{
+	struct obj_cgroup *objcg = container_of(ref, struct obj_cgroup, refcnt);
+	struct mem_cgroup *memcg;
+	unsigned int nr_bytes;
+	unsigned long flags;
+
+	/*
+	 * All the objects are freed by now, and every charge went through
+	 * the byte stock, which only ever gives back whole pages to the
+	 * memcg and parks the remainder in nr_charged_bytes.  What is left
+	 * here is therefore a whole number of pages.
+	 */
+	nr_bytes = atomic_read(&objcg->nr_charged_bytes);
+	WARN_ON_ONCE(nr_bytes & (PAGE_SIZE - 1));
+
+	spin_lock_irqsave(&css_set_lock, flags);
+	memcg = obj_cgroup_memcg(objcg);
+	if (nr_bytes >> PAGE_SHIFT)
+		memcg_kmem_uncharge_pages(memcg, nr_bytes >> PAGE_SHIFT);
+	list_del(&objcg->list);
+	mem_cgroup_put(memcg);
+	spin_unlock_irqrestore(&css_set_lock, flags);
+
+	percpu_ref_exit(ref);
+	kfree_rcu(objcg, rcu);
+}
+
+static struct obj_cgroup *obj_cgroup_alloc(void)
+{
+	struct obj_cgroup *objcg;
+
+	objcg = kzalloc(sizeof(*objcg), GFP_KERNEL);
+	if (!objcg)
+		return NULL;
+
+	if (percpu_ref_init(&objcg->refcnt, obj_cgroup_release, 0,
+			    GFP_KERNEL)) {
+		kfree(objcg);
+		return NULL;
+	}
+	INIT_LIST_HEAD(&objcg->list);
+	return objcg;
+}
+
+/*
+ * Hand the obj_cgroups of a dying @memcg over to @parent: the objects
+ * still charged to them are charged to @parent from now on.  Without
+ * use_hierarchy @parent never saw those charges, so the obj_cgroups
+ * keep @memcg alive until their objects are gone instead.
+ */
+static void memcg_reparent_objcgs(struct mem_cgroup *memcg,
+				  struct mem_cgroup *parent)
+{
+	struct mem_cgroup_extension *memcg_ext = to_memcg_ext(memcg);
+	struct mem_cgroup_extension *parent_ext = to_memcg_ext(parent);
+	struct obj_cgroup *objcg, *iter;
+
+	objcg = rcu_dereference_protected(memcg_ext->objcg, true);
+	RCU_INIT_POINTER(memcg_ext->objcg, NULL);
+
+	spin_lock_irq(&css_set_lock);
+
+	/* The active objcg didn't hold a reference while memcg was online */
+	if (!memcg->use_hierarchy) {
+		css_get(&memcg->css);
+		list_add(&objcg->list, &memcg_ext->objcg_list);
+		spin_unlock_irq(&css_set_lock);
+		percpu_ref_kill(&objcg->refcnt);
+		return;
+	}
+
+	css_get(&parent->css);
+	xchg(&objcg->memcg, parent);
+	list_add(&objcg->list, &parent_ext->objcg_list);
+
+	list_for_each_entry(iter, &memcg_ext->objcg_list, list) {
+		css_get(&parent->css);
+		xchg(&iter->memcg, parent);
+		css_put(&memcg->css);
+	}
+	list_splice_init(&memcg_ext->objcg_list, &parent_ext->objcg_list);
+
+	spin_unlock_irq(&css_set_lock);
+
+	percpu_ref_kill(&objcg->refcnt);
+}
+
+/**
+ * get_obj_cgroup_from_current: get the obj_cgroup to charge slab objects to
+ *
+ * Returns the obj_cgroup of the closest kmem-online memcg of the current
+ * task, with a reference held, or NULL if the allocation is not accounted.
+ */
+struct obj_cgroup *get_obj_cgroup_from_current(void)
+{
+	struct obj_cgroup *objcg = NULL;
+	struct mem_cgroup *memcg;
+
+	if (memcg_kmem_bypass())
+		return NULL;
+
+	rcu_read_lock();
+	if (unlikely(current->active_memcg))
+		memcg = current->active_memcg;
+	else
+		memcg = mem_cgroup_from_task(
+				rcu_dereference(current->mm->owner));
+
+	for (; memcg && memcg != root_mem_cgroup;
+	     memcg = parent_mem_cgroup(memcg)) {
+		objcg = rcu_dereference(to_memcg_ext(memcg)->objcg);
+		if (objcg && obj_cgroup_tryget(objcg))
+			break;
+		objcg = NULL;
+	}
+	rcu_read_unlock();
+
+	return objcg;
+}
+
+static bool consume_obj_stock(struct obj_cgroup *objcg, unsigned int nr_bytes)
+{
+	struct memcg_stock_pcp *stock;
+	unsigned long flags;
+	bool ret = false;
+
+	local_irq_save(flags);
+
+	stock = this_cpu_ptr(&memcg_stock);
+	if (objcg == stock->cached_objcg && stock->nr_bytes >= nr_bytes) {
+		stock->nr_bytes -= nr_bytes;
+		ret = true;
+	}
+
+	local_irq_restore(flags);
+
+	return ret;
+}
+
+static void drain_obj_stock(struct memcg_stock_pcp *stock)
+{
+	struct obj_cgroup *old = stock->cached_objcg;
+
+	if (!old)
+		return;
+
+	if (stock->nr_bytes) {
+		unsigned int nr_pages = stock->nr_bytes >> PAGE_SHIFT;
+		unsigned int nr_bytes = stock->nr_bytes & (PAGE_SIZE - 1);
+
+		if (nr_pages) {
+			rcu_read_lock();
+			memcg_kmem_uncharge_pages(obj_cgroup_memcg(old),
+						  nr_pages);
+			rcu_read_unlock();
+		}
+
+		/*
+		 * The sub-page remainder goes back to the obj_cgroup, the
+		 * next stock refill for it picks it up, maybe on another cpu.
+		 */
+		atomic_add(nr_bytes, &old->nr_charged_bytes);
+		stock->nr_bytes = 0;
+	}
+
+	obj_cgroup_put(old);
+	stock->cached_objcg = NULL;
+}
+
+static bool obj_stock_flush_required(struct memcg_stock_pcp *stock,
+				     struct mem_cgroup *root_memcg)
+{
+	struct mem_cgroup *memcg;
+
+	if (stock->cached_objcg) {
+		memcg = obj_cgroup_memcg(stock->cached_objcg);
+		if (memcg && mem_cgroup_is_descendant(memcg, root_memcg))
+			return true;
+	}
+
+	return false;
+}
+
+static void refill_obj_stock(struct obj_cgroup *objcg, unsigned int nr_bytes)
+{
+	struct memcg_stock_pcp *stock;
+	unsigned long flags;
+
+	local_irq_save(flags);
+
+	stock = this_cpu_ptr(&memcg_stock);
+	if (stock->cached_objcg != objcg) { /* reset if necessary */
+		drain_obj_stock(stock);
+		obj_cgroup_get(objcg);
+		stock->cached_objcg = objcg;
+		stock->nr_bytes = atomic_xchg(&objcg->nr_charged_bytes, 0);
+	}
+	stock->nr_bytes += nr_bytes;
+
+	if (stock->nr_bytes > PAGE_SIZE)
+		drain_obj_stock(stock);
+
+	local_irq_restore(flags);
+}
+
+/**
+ * obj_cgroup_charge: charge slab objects
+ * @objcg: obj_cgroup to charge
+ * @gfp: reclaim mode
+ * @size: number of bytes
+ *
+ * Whole pages are charged to the memcg, the rest of the last page is kept
+ * in the per-cpu byte stock for the following allocations.
+ *
+ * Returns 0 on success, an error code on failure.
+ */
+int obj_cgroup_charge(struct obj_cgroup *objcg, gfp_t gfp, size_t size)
+{
+	struct mem_cgroup *memcg;
+	unsigned int nr_pages, nr_bytes;
+	int ret;
+
+	if (consume_obj_stock(objcg, size))
+		return 0;
+
+	rcu_read_lock();
+	memcg = obj_cgroup_memcg(objcg);
+	css_get(&memcg->css);
+	rcu_read_unlock();
+
+	nr_pages = size >> PAGE_SHIFT;
+	nr_bytes = size & (PAGE_SIZE - 1);
+	if (nr_bytes)
+		nr_pages += 1;
+
+	ret = memcg_kmem_charge_pages(memcg, gfp, nr_pages);
+	if (!ret) {
+		/*
+		 * The charge may be given back to a parent after
+		 * reparenting, so the memcg is pinned by the obj_cgroup
+		 * rather than by css references per charged page.
+		 */
+		css_put_many(&memcg->css, nr_pages);
+		if (nr_bytes)
+			refill_obj_stock(objcg, PAGE_SIZE - nr_bytes);
+	}
+
+	css_put(&memcg->css);
+	return ret;
+}
+
+void obj_cgroup_uncharge(struct obj_cgroup *objcg, size_t size)
+{
+	refill_obj_stock(objcg, size);
+}
+
+/*
+ * Slab statistics of a memcg are kept in pages: bytes are summed up per
+ * obj_cgroup and the memcg sees a page whenever the sum crosses one.
+ */
+void obj_cgroup_mod_state(struct obj_cgroup *objcg, int idx, int nr_bytes)
+{
+	atomic_long_t *slab_bytes;
+	long bytes, pages;
+
+	slab_bytes = &objcg->nr_slab_bytes[idx != NR_SLAB_RECLAIMABLE];
+	bytes = atomic_long_add_return(nr_bytes, slab_bytes);
+	pages = (bytes >> PAGE_SHIFT) - ((bytes - nr_bytes) >> PAGE_SHIFT);
+	if (!pages)
+		return;
+
+	rcu_read_lock();
+	mod_memcg_state(obj_cgroup_memcg(objcg), idx, pages);
+	rcu_read_unlock();
+}
+
+int memcg_alloc_page_obj_cgroups(struct page *page, struct kmem_cache *s,
+				 gfp_t gfp)
+{
+	unsigned int objects = objs_per_slab_page(s, page);
+	unsigned long vec;
+
+	/* The vector itself is neither accounted nor taken from DMA zones */
+	gfp &= ~(__GFP_ACCOUNT | __GFP_DMA | __GFP_RECLAIMABLE);
+	vec = (unsigned long)kcalloc_node(objects, sizeof(struct obj_cgroup *),
+					  gfp, page_to_nid(page));
+	if (!vec)
+		return -ENOMEM;
+
+	/* Somebody allocating from the same page may have beaten us */
+	if (cmpxchg(&page->mem_cgroup, NULL,
+		    (struct mem_cgroup *)(vec | MEMCG_DATA_OBJCGS)))
+		kfree((void *)vec);
+
+	return 0;
+}
+
+/**
+ * mem_cgroup_from_obj: find the memcg a kernel object is charged to
+ * @p: object
+ *
+ * Slab objects allocated from shared pages are looked up one by one,
+ * other kernel memory is charged by the page.  The memcg is only stable
+ * under rcu_read_lock() or with the object pinned otherwise.
+ */
+struct mem_cgroup *mem_cgroup_from_obj(void *p)
+{
+	struct obj_cgroup *objcg;
+	struct page *page;
+
+	if (!memcg_kmem_enabled())
+		return NULL;
+
+	page = virt_to_head_page(p);
+	if (!page_has_obj_cgroups(page))
+		return page->mem_cgroup;
+
+	objcg = page_obj_cgroups(page)[obj_to_index(page->slab_cache, page, p)];
+	return objcg ? obj_cgroup_memcg(objcg) : NULL;
+}
 #endif /* CONFIG_MEMCG_KMEM */
 
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 
 /*
- * Because tail pages are not marked as "used", set it. We're under
- * zone_lru_lock and migration entries setup in all page mappings.
+ * Because tail pages are not marked as "used", set it. We're under the
+ * lru_lock of the head's lruvec and migration entries setup in all page
+ * mappings.
  */
 void mem_cgroup_split_huge_fixup(struct page *head)
 {
@@ -2929,22 +3460,111 @@ static int mem_cgroup_move_swap_account(swp_entry_t entry,
 	old_id = mem_cgroup_id(from);
 	new_id = mem_cgroup_id(to);
 
-	if (swap_cgroup_cmpxchg(entry, old_id, new_id) == old_id) {
-		mod_memcg_state(from, MEMCG_SWAP, -1);
-		mod_memcg_state(to, MEMCG_SWAP, 1);
-		return 0;
+	if (swap_cgroup_cmpxchg(entry, old_id, new_id) == old_id) {
+		mod_memcg_state(from, MEMCG_SWAP, -1);
+		mod_memcg_state(to, MEMCG_SWAP, 1);
+		return 0;
+	}
+	return -EINVAL;
+}
+#else
+static inline int mem_cgroup_move_swap_account(swp_entry_t entry,
+				struct mem_cgroup *from, struct mem_cgroup *to)
+{
+	return -EINVAL;
+}
+#endif
+
+static DEFINE_MUTEX(memcg_max_mutex);
+static DEFINE_MUTEX(memcg_wmark_mutex);
+
+/* Recompute the watermarks after memory.max or the wmark knobs changed */
+static void memcg_wmark_setup(struct mem_cgroup *memcg)
+{
+	struct mem_cgroup_extension *memcg_ext = to_memcg_ext(memcg);
+	unsigned long max, high, gap;
+	bool active;
+
+	mutex_lock(&memcg_wmark_mutex);
+	max = READ_ONCE(memcg->memory.max);
+	if (!memcg_ext->wmark_ratio || max == PAGE_COUNTER_MAX) {
+		WRITE_ONCE(memcg_ext->wmark_high, PAGE_COUNTER_MAX);
+		WRITE_ONCE(memcg_ext->wmark_low, PAGE_COUNTER_MAX);
+	} else {
+		high = mult_frac(max, memcg_ext->wmark_ratio, 100);
+		gap = mult_frac(max, memcg_ext->wmark_scale_factor, 10000);
+		/* low first, the worker must never chase a low above high */
+		WRITE_ONCE(memcg_ext->wmark_low, high - min(gap, high));
+		WRITE_ONCE(memcg_ext->wmark_high, high);
+	}
+	active = memcg_ext->wmark_high != PAGE_COUNTER_MAX;
+	if (active != memcg_ext->wmark_active) {
+		if (active)
+			static_branch_inc(&memcg_wmark_key);
+		else
+			static_branch_dec(&memcg_wmark_key);
+		memcg_ext->wmark_active = active;
+	}
+	mutex_unlock(&memcg_wmark_mutex);
+
+	if (page_counter_read(&memcg->memory) > READ_ONCE(memcg_ext->wmark_high))
+		memcg_wmark_queue(memcg_ext, false);
+}
+
+enum {
+	MEMCG_WMARK_RATIO,
+	MEMCG_WMARK_SCALE,
+	MEMCG_WMARK_HIGH,
+	MEMCG_WMARK_LOW,
+	MEMCG_WMARK_TIME,
+};
+
+static u64 memcg_wmark_read(struct cgroup_subsys_state *css,
+			    struct cftype *cft)
+{
+	struct mem_cgroup_extension *memcg_ext;
+
+	memcg_ext = to_memcg_ext(mem_cgroup_from_css(css));
+	switch (cft->private) {
+	case MEMCG_WMARK_RATIO:
+		return memcg_ext->wmark_ratio;
+	case MEMCG_WMARK_SCALE:
+		return memcg_ext->wmark_scale_factor;
+	case MEMCG_WMARK_HIGH:
+		return (u64)READ_ONCE(memcg_ext->wmark_high) * PAGE_SIZE;
+	case MEMCG_WMARK_LOW:
+		return (u64)READ_ONCE(memcg_ext->wmark_low) * PAGE_SIZE;
+	case MEMCG_WMARK_TIME:
+		return atomic64_read(&memcg_ext->wmark_reclaim_time);
+	default:
+		BUG();
 	}
-	return -EINVAL;
 }
-#else
-static inline int mem_cgroup_move_swap_account(swp_entry_t entry,
-				struct mem_cgroup *from, struct mem_cgroup *to)
+
+static int memcg_wmark_write(struct cgroup_subsys_state *css,
+			     struct cftype *cft, u64 val)
 {
-	return -EINVAL;
-}
-#endif
+	struct mem_cgroup *memcg = mem_cgroup_from_css(css);
+	struct mem_cgroup_extension *memcg_ext = to_memcg_ext(memcg);
 
-static DEFINE_MUTEX(memcg_max_mutex);
+	switch (cft->private) {
+	case MEMCG_WMARK_RATIO:
+		if (val > 100)
+			return -EINVAL;
+		memcg_ext->wmark_ratio = val;
+		break;
+	case MEMCG_WMARK_SCALE:
+		if (!val || val > 1000)
+			return -EINVAL;
+		memcg_ext->wmark_scale_factor = val;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	memcg_wmark_setup(memcg);
+	return 0;
+}
 
 static int mem_cgroup_resize_max(struct mem_cgroup *memcg,
 				 unsigned long max, bool memsw)
@@ -2997,6 +3617,9 @@ static int mem_cgroup_resize_max(struct mem_cgroup *memcg,
 	if (!ret && enlarge)
 		memcg_oom_recover(memcg);
 
+	if (!ret && !memsw)
+		memcg_wmark_setup(memcg);
+
 	return ret;
 }
 
@@ -3274,69 +3897,10 @@ static u64 mem_cgroup_read_u64(struct cgroup_subsys_state *css,
 	}
 }
 
-static void memcg_flush_percpu_vmstats(struct mem_cgroup *memcg)
-{
-	unsigned long stat[MEMCG_NR_STAT];
-	struct mem_cgroup *mi;
-	int node, cpu, i;
-
-	for (i = 0; i < MEMCG_NR_STAT; i++)
-		stat[i] = 0;
-
-	for_each_online_cpu(cpu)
-		for (i = 0; i < MEMCG_NR_STAT; i++) {
-			stat[i] += per_cpu(memcg->stat_cpu->count[i], cpu);
-			per_cpu(memcg->stat_cpu->count[i], cpu) = 0;
-		}
-
-	for (mi = memcg; mi; mi = parent_mem_cgroup(mi))
-		for (i = 0; i < MEMCG_NR_STAT; i++)
-			atomic_long_add(stat[i], &mi->stat[i]);
-
-	for_each_node(node) {
-		struct mem_cgroup_per_node *pn = memcg->nodeinfo[node];
-		struct mem_cgroup_per_node *pi;
-
-		for (i = 0; i < NR_VM_NODE_STAT_ITEMS; i++)
-			stat[i] = 0;
-
-		for_each_online_cpu(cpu)
-			for (i = 0; i < NR_VM_NODE_STAT_ITEMS; i++) {
-				stat[i] += per_cpu(
-					pn->lruvec_stat_cpu->count[i], cpu);
-				per_cpu(pn->lruvec_stat_cpu->count[i], cpu) = 0;
-			}
-
-		for (pi = pn; pi; pi = parent_nodeinfo(pi, node))
-			for (i = 0; i < NR_VM_NODE_STAT_ITEMS; i++)
-				atomic_long_add(stat[i], &pi->lruvec_stat[i]);
-	}
-}
-
-static void memcg_flush_percpu_vmevents(struct mem_cgroup *memcg)
-{
-	unsigned long events[NR_VM_EVENT_ITEMS];
-	struct mem_cgroup *mi;
-	int cpu, i;
-
-	for (i = 0; i < NR_VM_EVENT_ITEMS; i++)
-		events[i] = 0;
-
-	for_each_online_cpu(cpu)
-		for (i = 0; i < NR_VM_EVENT_ITEMS; i++) {
-			events[i] += per_cpu(memcg->stat_cpu->events[i],
-					     cpu);
-			per_cpu(memcg->stat_cpu->events[i], cpu) = 0;
-		}
-
-	for (mi = memcg; mi; mi = parent_mem_cgroup(mi))
-		for (i = 0; i < NR_VM_EVENT_ITEMS; i++)
-			atomic_long_add(events[i], &mi->events[i]);
-}
-
 #ifdef CONFIG_MEMCG_KMEM
 static int memcg_online_kmem(struct mem_cgroup *memcg)
 {
+	struct obj_cgroup *objcg;
 	int memcg_id;
 
 	if (cgroup_memory_nokmem)
@@ -3349,6 +3913,14 @@ static int memcg_online_kmem(struct mem_cgroup *memcg)
 	if (memcg_id < 0)
 		return memcg_id;
 
+	objcg = obj_cgroup_alloc();
+	if (!objcg) {
+		memcg_free_cache_id(memcg_id);
+		return -ENOMEM;
+	}
+	objcg->memcg = memcg;
+	rcu_assign_pointer(to_memcg_ext(memcg)->objcg, objcg);
+
 	static_branch_inc(&memcg_kmem_enabled_key);
 	/*
 	 * A memory cgroup is considered kmem-online as soon as it gets
@@ -3388,6 +3960,8 @@ static void memcg_offline_kmem(struct mem_cgroup *memcg)
 	if (!parent)
 		parent = root_mem_cgroup;
 
+	memcg_reparent_objcgs(memcg, parent);
+
 	/*
 	 * Change kmemcg_id of this cgroup and all its descendants to the
 	 * parent's id, and then move all entries from this cgroup's list_lrus
@@ -3420,7 +3994,9 @@ static void memcg_free_kmem(struct mem_cgroup *memcg)
 	if (memcg->kmem_state == KMEM_ALLOCATED) {
 		memcg_destroy_kmem_caches(memcg);
 		static_branch_dec(&memcg_kmem_enabled_key);
-		WARN_ON(page_counter_read(&memcg->kmem));
+		/* Reparented slab objects leave their charges behind here */
+		WARN_ON(!memcg_kmem_objcg_enabled() &&
+			page_counter_read(&memcg->kmem));
 	}
 }
 #else
@@ -3797,6 +4373,63 @@ void memcg_print_bad_task(struct oom_control *oc)
 
 #endif
 
+#ifdef CONFIG_MEMORY_RELIABLE
+static u64 memcg_reliable_read(struct cgroup_subsys_state *css,
+			       struct cftype *cft)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(css);
+	struct page_counter *counter = &to_memcg_ext(memcg)->reliable;
+
+	switch (cft->private) {
+	case RES_USAGE:
+		return (u64)page_counter_read(counter) * PAGE_SIZE;
+	case RES_LIMIT:
+		return (u64)counter->max * PAGE_SIZE;
+	case RES_MAX_USAGE:
+		return (u64)counter->watermark * PAGE_SIZE;
+	case RES_FAILCNT:
+		return counter->failcnt;
+	default:
+		BUG();
+	}
+}
+
+static ssize_t memcg_reliable_write(struct kernfs_open_file *of,
+				    char *buf, size_t nbytes, loff_t off)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(of_css(of));
+	struct page_counter *counter = &to_memcg_ext(memcg)->reliable;
+	unsigned long nr_pages;
+	int ret;
+
+	if (!mem_reliable_is_enabled())
+		return -EINVAL;
+
+	switch (of_cft(of)->private) {
+	case RES_LIMIT:
+		buf = strstrip(buf);
+		ret = page_counter_memparse(buf, "-1", &nr_pages);
+		if (ret)
+			return ret;
+		/*
+		 * Mirrored memory can not be reclaimed on purpose, a limit
+		 * below the usage only makes new allocations fall back.
+		 */
+		xchg(&counter->max, nr_pages);
+		break;
+	case RES_MAX_USAGE:
+		page_counter_reset_watermark(counter);
+		break;
+	case RES_FAILCNT:
+		counter->failcnt = 0;
+		break;
+	default:
+		BUG();
+	}
+	return nbytes;
+}
+#endif
+
 #ifdef CONFIG_NUMA
 
 #define LRU_ALL_FILE (BIT(LRU_INACTIVE_FILE) | BIT(LRU_ACTIVE_FILE))
@@ -3858,6 +4491,8 @@ static int memcg_numa_stat_show(struct seq_file *m, void *v)
 	int nid;
 	struct mem_cgroup *memcg = mem_cgroup_from_css(seq_css(m));
 
+	mem_cgroup_flush_stats();
+
 	for (stat = stats; stat < stats + ARRAY_SIZE(stats); stat++) {
 		seq_printf(m, "%s=%lu", stat->name,
 			   mem_cgroup_nr_lru_pages(memcg, stat->lru_mask,
@@ -3891,6 +4526,10 @@ static const unsigned int memcg1_events[] = {
 	PGPGOUT,
 	PGFAULT,
 	PGMAJFAULT,
+#ifdef CONFIG_SWAP
+	SWAP_RA,
+	SWAP_RA_HIT,
+#endif
 };
 
 static const char *const memcg1_event_names[] = {
@@ -3898,6 +4537,10 @@ static const char *const memcg1_event_names[] = {
 	"pgpgout",
 	"pgfault",
 	"pgmajfault",
+#ifdef CONFIG_SWAP
+	"swap_ra",
+	"swap_ra_hit",
+#endif
 };
 
 static int memcg_stat_show(struct seq_file *m, void *v)
@@ -3910,6 +4553,8 @@ static int memcg_stat_show(struct seq_file *m, void *v)
 	BUILD_BUG_ON(ARRAY_SIZE(memcg1_stat_names) != ARRAY_SIZE(memcg1_stats));
 	BUILD_BUG_ON(ARRAY_SIZE(mem_cgroup_lru_names) != NR_LRU_LISTS);
 
+	mem_cgroup_flush_stats();
+
 	for (i = 0; i < ARRAY_SIZE(memcg1_stats); i++) {
 		if (memcg1_stats[i] == MEMCG_SWAP && !do_memsw_account())
 			continue;
@@ -4388,22 +5033,6 @@ struct wb_domain *mem_cgroup_wb_domain(struct bdi_writeback *wb)
 	return &memcg->cgwb_domain;
 }
 
-/*
- * idx can be of type enum memcg_stat_item or node_stat_item.
- * Keep in sync with memcg_exact_page().
- */
-static unsigned long memcg_exact_page_state(struct mem_cgroup *memcg, int idx)
-{
-	long x = atomic_long_read(&memcg->stat[idx]);
-	int cpu;
-
-	for_each_online_cpu(cpu)
-		x += per_cpu_ptr(memcg->stat_cpu, cpu)->count[idx];
-	if (x < 0)
-		x = 0;
-	return x;
-}
-
 /**
  * mem_cgroup_wb_stats - retrieve writeback related stats from its memcg
  * @wb: bdi_writeback in question
@@ -4429,12 +5058,14 @@ void mem_cgroup_wb_stats(struct bdi_writeback *wb, unsigned long *pfilepages,
 	struct mem_cgroup *memcg = mem_cgroup_from_css(wb->memcg_css);
 	struct mem_cgroup *parent;
 
-	*pdirty = memcg_exact_page_state(memcg, NR_FILE_DIRTY);
+	mem_cgroup_flush_stats();
+
+	*pdirty = memcg_page_state(memcg, NR_FILE_DIRTY);
 
 	/* this should eventually include NR_UNSTABLE_NFS */
-	*pwriteback = memcg_exact_page_state(memcg, NR_WRITEBACK);
-	*pfilepages = memcg_exact_page_state(memcg, NR_INACTIVE_FILE) +
-			memcg_exact_page_state(memcg, NR_ACTIVE_FILE);
+	*pwriteback = memcg_page_state(memcg, NR_WRITEBACK);
+	*pfilepages = memcg_page_state(memcg, NR_INACTIVE_FILE) +
+			memcg_page_state(memcg, NR_ACTIVE_FILE);
 	*pheadroom = PAGE_COUNTER_MAX;
 
 	while ((parent = parent_mem_cgroup(memcg))) {
@@ -5084,6 +5715,38 @@ static struct cftype mem_cgroup_legacy_files[] = {
 	{
 		.name = "pressure_level",
 	},
+	{
+		.name = "wmark_ratio",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.private = MEMCG_WMARK_RATIO,
+		.read_u64 = memcg_wmark_read,
+		.write_u64 = memcg_wmark_write,
+	},
+	{
+		.name = "wmark_scale_factor",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.private = MEMCG_WMARK_SCALE,
+		.read_u64 = memcg_wmark_read,
+		.write_u64 = memcg_wmark_write,
+	},
+	{
+		.name = "wmark_high",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.private = MEMCG_WMARK_HIGH,
+		.read_u64 = memcg_wmark_read,
+	},
+	{
+		.name = "wmark_low",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.private = MEMCG_WMARK_LOW,
+		.read_u64 = memcg_wmark_read,
+	},
+	{
+		.name = "wmark_reclaim_time",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.private = MEMCG_WMARK_TIME,
+		.read_u64 = memcg_wmark_read,
+	},
 #ifdef CONFIG_MEMCG_QOS
 	{
 		.name = "qos_level",
@@ -5091,6 +5754,35 @@ static struct cftype mem_cgroup_legacy_files[] = {
 		.write_s64 = memcg_qos_write,
 	},
 #endif
+#ifdef CONFIG_MEMORY_RELIABLE
+	{
+		.name = "reliable_limit_in_bytes",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.private = RES_LIMIT,
+		.write = memcg_reliable_write,
+		.read_u64 = memcg_reliable_read,
+	},
+	{
+		.name = "reliable_usage_in_bytes",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.private = RES_USAGE,
+		.read_u64 = memcg_reliable_read,
+	},
+	{
+		.name = "reliable_max_usage_in_bytes",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.private = RES_MAX_USAGE,
+		.write = memcg_reliable_write,
+		.read_u64 = memcg_reliable_read,
+	},
+	{
+		.name = "reliable_failcnt",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.private = RES_FAILCNT,
+		.write = memcg_reliable_write,
+		.read_u64 = memcg_reliable_read,
+	},
+#endif
 #ifdef CONFIG_MEMCG_MEMFS_INFO
 	{
 		.name = "memfs_files_info",
@@ -5253,8 +5945,8 @@ static int alloc_mem_cgroup_per_node_info(struct mem_cgroup *memcg, int node)
 	if (!pn_ext)
 		return 1;
 
-	pn_ext->lruvec_stat_local = alloc_percpu(struct lruvec_stat);
-	if (!pn_ext->lruvec_stat_local) {
+	pn_ext->lruvec_stat_prev = alloc_percpu(struct lruvec_stat);
+	if (!pn_ext->lruvec_stat_prev) {
 		kfree(pn_ext);
 		return 1;
 	}
@@ -5262,7 +5954,7 @@ static int alloc_mem_cgroup_per_node_info(struct mem_cgroup *memcg, int node)
 	pn = &pn_ext->pn;
 	pn->lruvec_stat_cpu = alloc_percpu(struct lruvec_stat);
 	if (!pn->lruvec_stat_cpu) {
-		free_percpu(pn_ext->lruvec_stat_local);
+		free_percpu(pn_ext->lruvec_stat_prev);
 		kfree(pn_ext);
 		return 1;
 	}
@@ -5286,7 +5978,7 @@ static void free_mem_cgroup_per_node_info(struct mem_cgroup *memcg, int node)
 
 	pn_ext = to_mgpn_ext(pn);
 	free_percpu(pn->lruvec_stat_cpu);
-	free_percpu(pn_ext->lruvec_stat_local);
+	free_percpu(pn_ext->lruvec_stat_prev);
 	kfree(pn_ext);
 }
 
@@ -5299,7 +5991,7 @@ static void __mem_cgroup_free(struct mem_cgroup *memcg)
 	for_each_node(node)
 		free_mem_cgroup_per_node_info(memcg, node);
 	free_percpu(memcg->stat_cpu);
-	free_percpu(memcg_ext->vmstats_local);
+	free_percpu(memcg_ext->vmstats_prev);
 
 	kfree(memcg_ext);
 }
@@ -5307,12 +5999,6 @@ static void __mem_cgroup_free(struct mem_cgroup *memcg)
 static void mem_cgroup_free(struct mem_cgroup *memcg)
 {
 	memcg_wb_domain_exit(memcg);
-	/*
-	 * Flush percpu vmstats and vmevents to guarantee the value correctness
-	 * on parent's and all ancestor levels.
-	 */
-	memcg_flush_percpu_vmstats(memcg);
-	memcg_flush_percpu_vmevents(memcg);
 	__mem_cgroup_free(memcg);
 }
 
@@ -5339,8 +6025,8 @@ static struct mem_cgroup *mem_cgroup_alloc(void)
 		goto fail;
 	}
 
-	memcg_ext->vmstats_local = alloc_percpu(struct mem_cgroup_stat_cpu);
-	if (!memcg_ext->vmstats_local)
+	memcg_ext->vmstats_prev = alloc_percpu(struct mem_cgroup_stat_cpu);
+	if (!memcg_ext->vmstats_prev)
 		goto fail;
 
 	memcg->stat_cpu = alloc_percpu(struct mem_cgroup_stat_cpu);
@@ -5355,6 +6041,7 @@ static struct mem_cgroup *mem_cgroup_alloc(void)
 		goto fail;
 
 	INIT_WORK(&memcg->high_work, high_work_func);
+	INIT_WORK(&to_memcg_ext(memcg)->wmark_work, memcg_wmark_work_func);
 	memcg->last_scanned_node = MAX_NUMNODES;
 	INIT_LIST_HEAD(&memcg->oom_notify);
 	mutex_init(&memcg->thresholds_lock);
@@ -5365,7 +6052,9 @@ static struct mem_cgroup *mem_cgroup_alloc(void)
 	memcg->socket_pressure = jiffies;
 #ifdef CONFIG_MEMCG_KMEM
 	memcg->kmemcg_id = -1;
+	INIT_LIST_HEAD(&memcg_ext->objcg_list);
 #endif
+	lru_gen_init_memcg(memcg);
 #ifdef CONFIG_CGROUP_WRITEBACK
 	INIT_LIST_HEAD(&memcg->cgwb_list);
 #endif
@@ -5395,9 +6084,24 @@ mem_cgroup_css_alloc(struct cgroup_subsys_state *parent_css)
 
 	memcg->high = PAGE_COUNTER_MAX;
 	memcg->soft_limit = PAGE_COUNTER_MAX;
+	to_memcg_ext(memcg)->wmark_high = PAGE_COUNTER_MAX;
+	to_memcg_ext(memcg)->wmark_low = PAGE_COUNTER_MAX;
+	to_memcg_ext(memcg)->wmark_scale_factor = MEMCG_WMARK_SCALE_FACTOR;
+	to_memcg_ext(memcg)->wmark_cpu = -1;
+#ifdef CONFIG_MEMCG_SWAP
+	to_memcg_ext(memcg)->swap_tier = SWAP_TIER_ALL;
+#endif
 	if (parent) {
 		memcg->swappiness = mem_cgroup_swappiness(parent);
 		memcg->oom_kill_disable = parent->oom_kill_disable;
+		to_memcg_ext(memcg)->wmark_ratio =
+			to_memcg_ext(parent)->wmark_ratio;
+		to_memcg_ext(memcg)->wmark_scale_factor =
+			to_memcg_ext(parent)->wmark_scale_factor;
+#ifdef CONFIG_MEMCG_SWAP
+		to_memcg_ext(memcg)->swap_tier =
+			to_memcg_ext(parent)->swap_tier;
+#endif
 	}
 	if (parent && parent->use_hierarchy) {
 		memcg->use_hierarchy = true;
@@ -5406,12 +6110,19 @@ mem_cgroup_css_alloc(struct cgroup_subsys_state *parent_css)
 		page_counter_init(&memcg->memsw, &parent->memsw);
 		page_counter_init(&memcg->kmem, &parent->kmem);
 		page_counter_init(&memcg->tcpmem, &parent->tcpmem);
+#ifdef CONFIG_MEMORY_RELIABLE
+		page_counter_init(&to_memcg_ext(memcg)->reliable,
+				  &to_memcg_ext(parent)->reliable);
+#endif
 	} else {
 		page_counter_init(&memcg->memory, NULL);
 		page_counter_init(&memcg->swap, NULL);
 		page_counter_init(&memcg->memsw, NULL);
 		page_counter_init(&memcg->kmem, NULL);
 		page_counter_init(&memcg->tcpmem, NULL);
+#ifdef CONFIG_MEMORY_RELIABLE
+		page_counter_init(&to_memcg_ext(memcg)->reliable, NULL);
+#endif
 		/*
 		 * Deeper hierachy with use_hierarchy == false doesn't make
 		 * much sense so let cgroup subsystem know about this
@@ -5465,6 +6176,10 @@ static int mem_cgroup_css_online(struct cgroup_subsys_state *css)
 	/* Online state pins memcg ID, memcg ID pins CSS */
 	atomic_set(&memcg->id.ref, 1);
 	css_get(css);
+
+	if (unlikely(mem_cgroup_is_root(memcg)))
+		queue_delayed_work(system_unbound_wq, &stats_flush_dwork,
+				   2UL*HZ);
 	return 0;
 }
 
@@ -5491,9 +6206,6 @@ static void mem_cgroup_css_offline(struct cgroup_subsys_state *css)
 	memcg_offline_kmem(memcg);
 	wb_memcg_offline(memcg);
 
-	memcg_flush_percpu_vmstats(memcg);
-	memcg_flush_percpu_vmevents(memcg);
-
 	mem_cgroup_id_put(memcg);
 }
 
@@ -5516,6 +6228,9 @@ static void mem_cgroup_css_free(struct cgroup_subsys_state *css)
 
 	vmpressure_cleanup(&memcg->vmpressure);
 	cancel_work_sync(&memcg->high_work);
+	cancel_work_sync(&to_memcg_ext(memcg)->wmark_work);
+	if (to_memcg_ext(memcg)->wmark_active)
+		static_branch_dec(&memcg_wmark_key);
 	mem_cgroup_remove_from_trees(memcg);
 	memcg_free_shrinker_maps(memcg);
 	memcg_free_kmem(memcg);
@@ -5551,6 +6266,94 @@ static void mem_cgroup_css_reset(struct cgroup_subsys_state *css)
 	memcg_wb_domain_size_changed(memcg);
 }
 
+/*
+ * Fold what @cpu accumulated in @css since the last flush, together with
+ * what the children handed up, into the hierarchical counters and hand it
+ * further up to the parent.  rstat visits children before their parent
+ * and serializes all flushes under cgroup_rstat_lock, which protects the
+ * prev snapshots and the pending arrays.
+ */
+static void mem_cgroup_css_rstat_flush(struct cgroup_subsys_state *css, int cpu)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(css);
+	struct mem_cgroup *parent = parent_mem_cgroup(memcg);
+	struct mem_cgroup_extension *memcg_ext = to_memcg_ext(memcg);
+	struct mem_cgroup_extension *parent_ext = NULL;
+	struct mem_cgroup_stat_cpu *statc, *prevc;
+	long delta, v;
+	int i, nid;
+
+	if (parent)
+		parent_ext = to_memcg_ext(parent);
+
+	statc = per_cpu_ptr(memcg->stat_cpu, cpu);
+	prevc = per_cpu_ptr(memcg_ext->vmstats_prev, cpu);
+
+	for (i = 0; i < MEMCG_NR_STAT; i++) {
+		v = READ_ONCE(statc->count[i]);
+		delta = v - prevc->count[i];
+		prevc->count[i] = v;
+
+		if (memcg_ext->stat_pending[i]) {
+			delta += memcg_ext->stat_pending[i];
+			memcg_ext->stat_pending[i] = 0;
+		}
+		if (!delta)
+			continue;
+
+		atomic_long_add(delta, &memcg->stat[i]);
+		if (parent_ext)
+			parent_ext->stat_pending[i] += delta;
+	}
+
+	for (i = 0; i < NR_VM_EVENT_ITEMS; i++) {
+		v = READ_ONCE(statc->events[i]);
+		delta = v - prevc->events[i];
+		prevc->events[i] = v;
+
+		if (memcg_ext->events_pending[i]) {
+			delta += memcg_ext->events_pending[i];
+			memcg_ext->events_pending[i] = 0;
+		}
+		if (!delta)
+			continue;
+
+		atomic_long_add(delta, &memcg->events[i]);
+		if (parent_ext)
+			parent_ext->events_pending[i] += delta;
+	}
+
+	for_each_node(nid) {
+		struct mem_cgroup_per_node *pn = mem_cgroup_nodeinfo(memcg, nid);
+		struct mem_cgroup_per_node_extension *pn_ext = to_mgpn_ext(pn);
+		struct mem_cgroup_per_node_extension *ppn_ext = NULL;
+		struct lruvec_stat *lstatc, *lprevc;
+
+		if (parent)
+			ppn_ext = to_mgpn_ext(mem_cgroup_nodeinfo(parent, nid));
+
+		lstatc = per_cpu_ptr(pn->lruvec_stat_cpu, cpu);
+		lprevc = per_cpu_ptr(pn_ext->lruvec_stat_prev, cpu);
+
+		for (i = 0; i < NR_VM_NODE_STAT_ITEMS; i++) {
+			v = READ_ONCE(lstatc->count[i]);
+			delta = v - lprevc->count[i];
+			lprevc->count[i] = v;
+
+			if (pn_ext->lruvec_stat_pending[i]) {
+				delta += pn_ext->lruvec_stat_pending[i];
+				pn_ext->lruvec_stat_pending[i] = 0;
+			}
+			if (!delta)
+				continue;
+
+			atomic_long_add(delta, &pn->lruvec_stat[i]);
+			if (ppn_ext)
+				ppn_ext->lruvec_stat_pending[i] += delta;
+		}
+	}
+}
+
 #ifdef CONFIG_MMU
 /* Handlers for move charge at task migration. */
 static int mem_cgroup_do_precharge(unsigned long count)
@@ -5769,6 +6572,8 @@ static int mem_cgroup_move_account(struct page *page,
 
 	/* caller should have done css_get */
 	page->mem_cgroup = to;
+	memcg_reliable_charge(from, page, -nr_pages);
+	memcg_reliable_charge(to, page, nr_pages);
 
 	spin_unlock_irqrestore(&from->move_lock, flags);
 
@@ -6455,6 +7260,7 @@ static ssize_t memory_max_write(struct kernfs_open_file *of,
 			break;
 	}
 
+	memcg_wmark_setup(memcg);
 	memcg_wb_domain_size_changed(memcg);
 	return nbytes;
 }
@@ -6493,6 +7299,8 @@ static int memory_stat_show(struct seq_file *m, void *v)
 	 * Current memory state:
 	 */
 
+	mem_cgroup_flush_stats();
+
 	seq_printf(m, "anon %llu\n",
 		   (u64)memcg_page_state(memcg, MEMCG_RSS) * PAGE_SIZE);
 	seq_printf(m, "file %llu\n",
@@ -6545,6 +7353,10 @@ static int memory_stat_show(struct seq_file *m, void *v)
 		   memcg_page_state(memcg, WORKINGSET_REFAULT));
 	seq_printf(m, "workingset_activate %lu\n",
 		   memcg_page_state(memcg, WORKINGSET_ACTIVATE));
+	seq_printf(m, "workingset_refault_anon %lu\n",
+		   memcg_page_state(memcg, WORKINGSET_REFAULT_ANON));
+	seq_printf(m, "workingset_activate_anon %lu\n",
+		   memcg_page_state(memcg, WORKINGSET_ACTIVATE_ANON));
 	seq_printf(m, "workingset_nodereclaim %lu\n",
 		   memcg_page_state(memcg, WORKINGSET_NODERECLAIM));
 
@@ -6557,6 +7369,10 @@ static int memory_stat_show(struct seq_file *m, void *v)
 	seq_printf(m, "pgdeactivate %lu\n", memcg_events(memcg, PGDEACTIVATE));
 	seq_printf(m, "pglazyfree %lu\n", memcg_events(memcg, PGLAZYFREE));
 	seq_printf(m, "pglazyfreed %lu\n", memcg_events(memcg, PGLAZYFREED));
+#ifdef CONFIG_SWAP
+	seq_printf(m, "swap_ra %lu\n", memcg_events(memcg, SWAP_RA));
+	seq_printf(m, "swap_ra_hit %lu\n", memcg_events(memcg, SWAP_RA_HIT));
+#endif
 
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 	seq_printf(m, "thp_fault_alloc %lu\n",
@@ -6646,9 +7462,66 @@ static struct cftype memory_files[] = {
 		.seq_show = memory_oom_group_show,
 		.write = memory_oom_group_write,
 	},
+	{
+		.name = "wmark_ratio",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.private = MEMCG_WMARK_RATIO,
+		.read_u64 = memcg_wmark_read,
+		.write_u64 = memcg_wmark_write,
+	},
+	{
+		.name = "wmark_scale_factor",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.private = MEMCG_WMARK_SCALE,
+		.read_u64 = memcg_wmark_read,
+		.write_u64 = memcg_wmark_write,
+	},
+	{
+		.name = "wmark_high",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.private = MEMCG_WMARK_HIGH,
+		.read_u64 = memcg_wmark_read,
+	},
+	{
+		.name = "wmark_low",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.private = MEMCG_WMARK_LOW,
+		.read_u64 = memcg_wmark_read,
+	},
+	{
+		.name = "wmark_reclaim_time",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.private = MEMCG_WMARK_TIME,
+		.read_u64 = memcg_wmark_read,
+	},
 	{ }	/* terminate */
 };
 
+#ifdef CONFIG_LRU_GEN
+/* The lru_gen aging walks the mms of a memcg, follow the mm owners */
+static void mem_cgroup_attach(struct cgroup_taskset *tset)
+{
+	struct task_struct *task = NULL;
+	struct cgroup_subsys_state *css;
+
+	/* only a group leader can own an mm, find the first one */
+	cgroup_taskset_for_each_leader(task, css, tset)
+		break;
+
+	if (!task)
+		return;
+
+	task_lock(task);
+	if (task->mm && READ_ONCE(task->mm->owner) == task)
+		lru_gen_migrate_mm(task->mm);
+	task_unlock(task);
+}
+#else
+static void mem_cgroup_attach(struct cgroup_taskset *tset)
+{
+}
+#endif
+
 struct cgroup_subsys memory_cgrp_subsys = {
 	.css_alloc = mem_cgroup_css_alloc,
 	.css_online = mem_cgroup_css_online,
@@ -6656,8 +7529,10 @@ struct cgroup_subsys memory_cgrp_subsys = {
 	.css_released = mem_cgroup_css_released,
 	.css_free = mem_cgroup_css_free,
 	.css_reset = mem_cgroup_css_reset,
+	.css_rstat_flush = mem_cgroup_css_rstat_flush,
 	.can_attach = mem_cgroup_can_attach,
 	.cancel_attach = mem_cgroup_cancel_attach,
+	.attach = mem_cgroup_attach,
 	.post_attach = mem_cgroup_move_task,
 	.bind = mem_cgroup_bind,
 	.dfl_cftypes = memory_files,
@@ -6976,6 +7851,7 @@ struct uncharge_gather {
 	unsigned long nr_kmem;
 	unsigned long nr_huge;
 	unsigned long nr_shmem;
+	unsigned long nr_reliable;
 	struct page *dummy_page;
 };
 
@@ -6995,6 +7871,11 @@ static void uncharge_batch(const struct uncharge_gather *ug)
 			page_counter_uncharge(&ug->memcg->memsw, nr_pages);
 		if (!cgroup_subsys_on_dfl(memory_cgrp_subsys) && ug->nr_kmem)
 			page_counter_uncharge(&ug->memcg->kmem, ug->nr_kmem);
+#ifdef CONFIG_MEMORY_RELIABLE
+		if (ug->nr_reliable)
+			page_counter_uncharge(&to_memcg_ext(ug->memcg)->reliable,
+					      ug->nr_reliable);
+#endif
 		memcg_oom_recover(ug->memcg);
 	}
 
@@ -7049,6 +7930,8 @@ static void uncharge_page(struct page *page, struct uncharge_gather *ug)
 			if (PageSwapBacked(page))
 				ug->nr_shmem += nr_pages;
 		}
+		if (page_reliable(page))
+			ug->nr_reliable += nr_pages;
 		ug->pgpgout++;
 	} else {
 		ug->nr_kmem += 1 << compound_order(page);
@@ -7274,6 +8157,10 @@ static int __init cgroup_memory(char *s)
 			cgroup_memory_nokmem = true;
 		else if (!strcmp(token, "kmem"))
 			cgroup_memory_nokmem = false;
+		else if (!strcmp(token, "kmemcache")) {
+			cgroup_memory_nokmem = false;
+			cgroup_memory_kmemcache = true;
+		}
 	}
 	return 1;
 }
@@ -7302,6 +8189,11 @@ static int __init mem_cgroup_init(void)
 	BUG_ON(!memcg_kmem_cache_wq);
 #endif
 
+	memcg_wmark_wq = alloc_workqueue("memcg_wmark",
+					 WQ_MEM_RECLAIM | WQ_CPU_INTENSIVE |
+					 WQ_FREEZABLE, 0);
+	BUG_ON(!memcg_wmark_wq);
+
 	cpuhp_setup_state_nocalls(CPUHP_MM_MEMCQ_DEAD, "mm/memctrl:dead", NULL,
 				  memcg_hotplug_cpu_dead);
 
@@ -7387,6 +8279,7 @@ void mem_cgroup_swapout(struct page *page, swp_entry_t entry)
 	mod_memcg_state(swap_memcg, MEMCG_SWAP, nr_entries);
 
 	page->mem_cgroup = NULL;
+	memcg_reliable_charge(memcg, page, -nr_entries);
 
 	if (!mem_cgroup_is_root(memcg))
 		page_counter_uncharge(&memcg->memory, nr_entries);
@@ -7526,6 +8419,27 @@ bool mem_cgroup_swap_full(struct page *page)
 	return false;
 }
 
+/**
+ * mem_cgroup_swap_tier - swap tier to allocate @page's swap entry from
+ * @page: page being added to swap
+ *
+ * Returns the swap priority @page's memcg is bound to with memory.swap.tier,
+ * or SWAP_TIER_ALL if any swap device may be used.
+ */
+int mem_cgroup_swap_tier(struct page *page)
+{
+	struct mem_cgroup *memcg;
+
+	if (!do_swap_account)
+		return SWAP_TIER_ALL;
+
+	memcg = page->mem_cgroup;
+	if (!memcg || mem_cgroup_is_root(memcg))
+		return SWAP_TIER_ALL;
+
+	return READ_ONCE(to_memcg_ext(memcg)->swap_tier);
+}
+
 /* for remember boot option*/
 #ifdef CONFIG_MEMCG_SWAP_ENABLED
 static int really_do_swap_account __initdata = 1;
@@ -7593,6 +8507,47 @@ static int swap_events_show(struct seq_file *m, void *v)
 	return 0;
 }
 
+static int swap_tier_show(struct seq_file *m, void *v)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(seq_css(m));
+	int tier = READ_ONCE(to_memcg_ext(memcg)->swap_tier);
+
+	if (tier == SWAP_TIER_ALL)
+		seq_puts(m, "all\n");
+	else
+		seq_printf(m, "%d\n", tier);
+
+	return 0;
+}
+
+/*
+ * "all" lets the memcg swap to any device, a swap priority restricts it to
+ * the devices swapped on with that priority, e.g. zram for latency-sensitive
+ * groups and a swapfile for batch jobs.
+ */
+static ssize_t swap_tier_write(struct kernfs_open_file *of,
+			       char *buf, size_t nbytes, loff_t off)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(of_css(of));
+	int tier;
+	int err;
+
+	buf = strstrip(buf);
+	if (!strcmp(buf, "all")) {
+		tier = SWAP_TIER_ALL;
+	} else {
+		err = kstrtoint(buf, 0, &tier);
+		if (err)
+			return err;
+		if (tier < SHRT_MIN || tier > SHRT_MAX)
+			return -EINVAL;
+	}
+
+	WRITE_ONCE(to_memcg_ext(memcg)->swap_tier, tier);
+
+	return nbytes;
+}
+
 static struct cftype swap_files[] = {
 	{
 		.name = "swap.current",
@@ -7611,6 +8566,12 @@ static struct cftype swap_files[] = {
 		.file_offset = offsetof(struct mem_cgroup, swap_events_file),
 		.seq_show = swap_events_show,
 	},
+	{
+		.name = "swap.tier",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = swap_tier_show,
+		.write = swap_tier_write,
+	},
 	{ }	/* terminate */
 };
 
@@ -7638,6 +8599,12 @@ static struct cftype memsw_cgroup_files[] = {
 		.write = mem_cgroup_reset,
 		.read_u64 = mem_cgroup_read_u64,
 	},
+	{
+		.name = "swap.tier",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = swap_tier_show,
+		.write = swap_tier_write,
+	},
 	{ },	/* terminate */
 };
 
@@ -277,7 +277,8 @@ long memfd_fcntl(struct file *file, unsigned int cmd, unsigned long arg)
 #define MFD_NAME_PREFIX_LEN (sizeof(MFD_NAME_PREFIX) - 1)
 #define MFD_NAME_MAX_LEN (NAME_MAX - MFD_NAME_PREFIX_LEN)
 
-#define MFD_ALL_FLAGS (MFD_CLOEXEC | MFD_ALLOW_SEALING | MFD_HUGETLB)
+#define MFD_ALL_FLAGS (MFD_CLOEXEC | MFD_ALLOW_SEALING | MFD_HUGETLB | \
+		       MFD_HUGEPAGE)
 
 SYSCALL_DEFINE2(memfd_create,
 		const char __user *, uname,
@@ -299,6 +300,13 @@ SYSCALL_DEFINE2(memfd_create,
 			return -EINVAL;
 	}
 
+	/* MFD_HUGEPAGE asks for THP-backed shmem, not hugetlbfs */
+	if (flags & MFD_HUGEPAGE) {
+		if ((flags & MFD_HUGETLB) ||
+		    !IS_ENABLED(CONFIG_TRANSPARENT_HUGE_PAGECACHE))
+			return -EINVAL;
+	}
+
 	/* length includes terminating zero */
 	len = strnlen_user(uname, MFD_NAME_MAX_LEN + 1);
 	if (len <= 0)
@@ -336,7 +344,8 @@ SYSCALL_DEFINE2(memfd_create,
 					(flags >> MFD_HUGE_SHIFT) &
 					MFD_HUGE_MASK);
 	} else
-		file = shmem_file_setup(name, 0, VM_NORESERVE);
+		file = shmem_file_setup(name, 0, VM_NORESERVE |
+				((flags & MFD_HUGEPAGE) ? VM_HUGEPAGE : 0));
 	if (IS_ERR(file)) {
 		error = PTR_ERR(file);
 		goto err_fd;
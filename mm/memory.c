@@ -71,6 +71,7 @@
 #include <linux/oom.h>
 #include <linux/ktask.h>
 #include <linux/share_pool.h>
+#include <linux/seq_file.h>
 
 #include <asm/io.h>
 #include <asm/mmu_context.h>
@@ -799,9 +800,10 @@ copy_one_pte(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 
 	/*
 	 * If it's a shared mapping, mark it clean in
-	 * the child
+	 * the child.  A zero page placed by KSM is only accounted
+	 * to the mm KSM placed it in, so mark that clean too.
 	 */
-	if (vm_flags & VM_SHARED)
+	if ((vm_flags & VM_SHARED) || is_zero_pfn(pte_pfn(pte)))
 		pte = pte_mkclean(pte);
 	pte = pte_mkold(pte);
 
@@ -985,11 +987,93 @@ static inline int copy_p4d_range(struct mm_struct *dst_mm, struct mm_struct *src
 	return 0;
 }
 
-int copy_page_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
-		struct vm_area_struct *vma)
+static int __copy_page_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+			     struct vm_area_struct *vma, unsigned long addr,
+			     unsigned long end)
 {
 	pgd_t *src_pgd, *dst_pgd;
 	unsigned long next;
+
+	dst_pgd = pgd_offset(dst_mm, addr);
+	src_pgd = pgd_offset(src_mm, addr);
+	do {
+		next = pgd_addr_end(addr, end);
+		if (pgd_none_or_clear_bad(src_pgd))
+			continue;
+		if (unlikely(copy_p4d_range(dst_mm, src_mm, dst_pgd, src_pgd,
+					    vma, addr, next)))
+			return -ENOMEM;
+	} while (dst_pgd++, src_pgd++, addr = next, addr != end);
+
+	return 0;
+}
+
+#ifdef CONFIG_KTASK
+/* 0 disables it, see copy_page_range_parallel() */
+unsigned long sysctl_fork_copy_parallel_mb __read_mostly;
+
+struct fork_copy_args {
+	struct mm_struct *dst_mm;
+	struct mm_struct *src_mm;
+	struct vm_area_struct *vma;
+};
+
+static int fork_copy_chunk(unsigned long start, unsigned long end,
+			   struct fork_copy_args *args)
+{
+	return __copy_page_range(args->dst_mm, args->src_mm, args->vma,
+				 start, end);
+}
+
+/*
+ * Anonymous VMAs of at least sysctl_fork_copy_parallel_mb get their page
+ * tables copied by ktask threads, over PMD aligned chunks so that no
+ * page table or huge pmd is shared between two threads.  The unaligned
+ * ends are copied here.  Both mmap_sems are held by dup_mmap(), so the
+ * threads only race on page table allocation in @dst_mm, which the
+ * p*d_alloc() helpers already handle, and the rss counters are atomic.
+ */
+static int copy_page_range_parallel(struct mm_struct *dst_mm,
+				    struct mm_struct *src_mm,
+				    struct vm_area_struct *vma)
+{
+	unsigned long min_size = READ_ONCE(sysctl_fork_copy_parallel_mb) << 20;
+	struct fork_copy_args args = { dst_mm, src_mm, vma };
+	DEFINE_KTASK_CTL(ctl, fork_copy_chunk, &args,
+			 max_t(unsigned long, KTASK_MEM_CHUNK, PMD_SIZE));
+	unsigned long start, end;
+	int ret = 0;
+
+	start = round_up(vma->vm_start, PMD_SIZE);
+	end = round_down(vma->vm_end, PMD_SIZE);
+	if (!min_size || !vma_is_anonymous(vma) || end <= start ||
+	    end - start < min_size)
+		return __copy_page_range(dst_mm, src_mm, vma,
+					 vma->vm_start, vma->vm_end);
+
+	if (vma->vm_start != start)
+		ret = __copy_page_range(dst_mm, src_mm, vma,
+					vma->vm_start, start);
+	if (!ret)
+		ret = ktask_run((void *)start, end - start, &ctl);
+	if (!ret && end != vma->vm_end)
+		ret = __copy_page_range(dst_mm, src_mm, vma, end, vma->vm_end);
+
+	return ret;
+}
+#else
+static inline int copy_page_range_parallel(struct mm_struct *dst_mm,
+					   struct mm_struct *src_mm,
+					   struct vm_area_struct *vma)
+{
+	return __copy_page_range(dst_mm, src_mm, vma,
+				 vma->vm_start, vma->vm_end);
+}
+#endif
+
+int copy_page_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+		struct vm_area_struct *vma)
+{
 	unsigned long addr = vma->vm_start;
 	unsigned long end = vma->vm_end;
 	unsigned long mmun_start;	/* For mmu_notifiers */
@@ -1033,19 +1117,7 @@ int copy_page_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		mmu_notifier_invalidate_range_start(src_mm, mmun_start,
 						    mmun_end);
 
-	ret = 0;
-	dst_pgd = pgd_offset(dst_mm, addr);
-	src_pgd = pgd_offset(src_mm, addr);
-	do {
-		next = pgd_addr_end(addr, end);
-		if (pgd_none_or_clear_bad(src_pgd))
-			continue;
-		if (unlikely(copy_p4d_range(dst_mm, src_mm, dst_pgd, src_pgd,
-					    vma, addr, next))) {
-			ret = -ENOMEM;
-			break;
-		}
-	} while (dst_pgd++, src_pgd++, addr = next, addr != end);
+	ret = copy_page_range_parallel(dst_mm, src_mm, vma);
 
 	if (is_cow)
 		mmu_notifier_invalidate_range_end(src_mm, mmun_start, mmun_end);
@@ -1105,8 +1177,10 @@ static unsigned long zap_pte_range(struct mmu_gather *tlb,
 			ptent = ptep_get_and_clear_full(mm, addr, pte,
 							tlb->fullmm);
 			tlb_remove_tlb_entry(tlb, pte, addr);
-			if (unlikely(!page))
+			if (unlikely(!page)) {
+				ksm_might_unmap_zero_page(mm, ptent);
 				continue;
+			}
 
 			if (!PageAnon(page)) {
 				if (pte_dirty(ptent)) {
@@ -1386,6 +1460,64 @@ void unmap_vmas(struct mmu_gather *tlb,
 	mmu_notifier_invalidate_range_end(mm, start_addr, end_addr);
 }
 
+#ifdef CONFIG_KTASK
+/* 0 disables it, see exit_unmap_vmas_parallel() */
+unsigned long sysctl_exit_unmap_parallel_mb __read_mostly;
+
+struct exit_unmap_args {
+	struct vm_area_struct *vma;
+};
+
+static int exit_unmap_chunk(unsigned long start, unsigned long end,
+			    struct exit_unmap_args *args)
+{
+	struct vm_area_struct *vma = args->vma;
+	struct mmu_gather tlb;
+
+	tlb_gather_mmu(&tlb, vma->vm_mm, start, end);
+	unmap_page_range(&tlb, vma, start, end, NULL);
+	tlb_finish_mmu(&tlb, start, end);
+
+	return KTASK_RETURN_SUCCESS;
+}
+
+/**
+ * exit_unmap_vmas_parallel - zap the large anonymous VMAs of a dead mm
+ * @vma: the first VMA of the mm
+ *
+ * Called by exit_mmap() before unmap_vmas(), once the mm has no users and
+ * no mmu notifiers left.  Anonymous VMAs of at least
+ * sysctl_exit_unmap_parallel_mb are zapped by ktask threads, each with its
+ * own mmu_gather over PMD aligned chunks so no huge pmd gets split.  The
+ * unaligned ends and the page tables are left to unmap_vmas() and
+ * free_pgtables().
+ */
+void exit_unmap_vmas_parallel(struct vm_area_struct *vma)
+{
+	unsigned long min_size = READ_ONCE(sysctl_exit_unmap_parallel_mb) << 20;
+	unsigned long start, end;
+
+	if (!min_size)
+		return;
+
+	for (; vma; vma = vma->vm_next) {
+		struct exit_unmap_args args = { vma };
+		DEFINE_KTASK_CTL(ctl, exit_unmap_chunk, &args,
+				 max_t(unsigned long, KTASK_MEM_CHUNK, PMD_SIZE));
+
+		if (!vma_is_anonymous(vma))
+			continue;
+
+		start = round_up(vma->vm_start, PMD_SIZE);
+		end = round_down(vma->vm_end, PMD_SIZE);
+		if (end <= start || end - start < min_size)
+			continue;
+
+		ktask_run((void *)start, end - start, &ctl);
+	}
+}
+#endif
+
 /**
  * zap_page_range - remove user pages in a given range
  * @vma: vm_area_struct holding the applicable pages
@@ -2220,6 +2352,136 @@ static inline int pte_unmap_same(struct mm_struct *mm, pmd_t *pmd,
 	return same;
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Has the vma a speculative fault runs against been unlinked or changed
+ * since the fault copied it?
+ */
+static inline bool vma_has_changed(struct vm_fault *vmf)
+{
+	int ret = RB_EMPTY_NODE(&vmf->spf_vma->vm_rb);
+
+	return ret || read_seqcount_retry(&vmf->spf_vma->vm_sequence,
+					  vmf->sequence);
+}
+
+/*
+ * Take the pte lock for a speculative fault, or fail if the vma or the
+ * pmd changed under us.  Interrupts are disabled while the pmd is
+ * checked and its pte lock taken, which holds off the IPI or RCU-sched
+ * grace period the page table has to go through before being freed.
+ * The lock is only tried: the unmap path may hold it while waiting for
+ * this CPU to answer a TLB shootdown.
+ */
+static bool pte_spinlock(struct vm_fault *vmf)
+{
+	bool ret = false;
+	pmd_t pmdval;
+
+	if (!(vmf->flags & FAULT_FLAG_SPECULATIVE)) {
+		vmf->ptl = pte_lockptr(vmf->vma->vm_mm, vmf->pmd);
+		spin_lock(vmf->ptl);
+		return true;
+	}
+
+	local_irq_disable();
+	if (vma_has_changed(vmf))
+		goto out;
+
+	/* Catch a concurrent collapse into a huge pmd */
+	pmdval = READ_ONCE(*vmf->pmd);
+	if (!pmd_same(pmdval, vmf->orig_pmd))
+		goto out;
+
+	vmf->ptl = pte_lockptr(vmf->vma->vm_mm, &pmdval);
+	if (unlikely(!spin_trylock(vmf->ptl)))
+		goto out;
+
+	if (vma_has_changed(vmf)) {
+		spin_unlock(vmf->ptl);
+		goto out;
+	}
+
+	ret = true;
+out:
+	local_irq_enable();
+	return ret;
+}
+
+/* As pte_spinlock(), also (re)mapping vmf->pte */
+static bool pte_map_lock(struct vm_fault *vmf)
+{
+	bool ret = false;
+	spinlock_t *ptl;
+	pte_t *pte;
+	pmd_t pmdval;
+
+	if (!(vmf->flags & FAULT_FLAG_SPECULATIVE)) {
+		vmf->pte = pte_offset_map_lock(vmf->vma->vm_mm, vmf->pmd,
+					       vmf->address, &vmf->ptl);
+		return true;
+	}
+
+	local_irq_disable();
+	if (vma_has_changed(vmf))
+		goto out;
+
+	pmdval = READ_ONCE(*vmf->pmd);
+	if (!pmd_same(pmdval, vmf->orig_pmd))
+		goto out;
+
+	ptl = pte_lockptr(vmf->vma->vm_mm, &pmdval);
+	pte = pte_offset_map(&pmdval, vmf->address);
+	if (unlikely(!spin_trylock(ptl))) {
+		pte_unmap(pte);
+		goto out;
+	}
+
+	if (vma_has_changed(vmf)) {
+		pte_unmap_unlock(pte, ptl);
+		goto out;
+	}
+
+	vmf->pte = pte;
+	vmf->ptl = ptl;
+	ret = true;
+out:
+	local_irq_enable();
+	return ret;
+}
+#else
+static inline bool pte_spinlock(struct vm_fault *vmf)
+{
+	vmf->ptl = pte_lockptr(vmf->vma->vm_mm, vmf->pmd);
+	spin_lock(vmf->ptl);
+	return true;
+}
+
+static inline bool pte_map_lock(struct vm_fault *vmf)
+{
+	vmf->pte = pte_offset_map_lock(vmf->vma->vm_mm, vmf->pmd,
+				       vmf->address, &vmf->ptl);
+	return true;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
+/*
+ * anon_vma_prepare() for a fault.  A speculative fault works on a copy of
+ * the vma and cannot set up its anon_vma, so it has to be retried.
+ */
+static vm_fault_t vmf_anon_prepare(struct vm_fault *vmf)
+{
+	struct vm_area_struct *vma = vmf->vma;
+
+	if (likely(vma->anon_vma))
+		return 0;
+	if (vmf->flags & FAULT_FLAG_SPECULATIVE)
+		return VM_FAULT_RETRY;
+	if (unlikely(anon_vma_prepare(vma)))
+		return VM_FAULT_OOM;
+	return 0;
+}
+
 static inline bool cow_user_page(struct page *dst, struct page *src,
 				 struct vm_fault *vmf)
 {
@@ -2466,9 +2728,11 @@ static vm_fault_t wp_page_copy(struct vm_fault *vmf)
 	const unsigned long mmun_start = vmf->address & PAGE_MASK;
 	const unsigned long mmun_end = mmun_start + PAGE_SIZE;
 	struct mem_cgroup *memcg;
+	vm_fault_t ret;
 
-	if (unlikely(anon_vma_prepare(vma)))
-		goto oom;
+	ret = vmf_anon_prepare(vmf);
+	if (unlikely(ret))
+		goto out;
 
 	if (is_zero_pfn(pte_pfn(vmf->orig_pte))) {
 		new_page = alloc_zeroed_user_highpage_movable(vma,
@@ -2505,7 +2769,13 @@ static vm_fault_t wp_page_copy(struct vm_fault *vmf)
 	/*
 	 * Re-check the pte - we dropped the lock
 	 */
-	vmf->pte = pte_offset_map_lock(mm, vmf->pmd, vmf->address, &vmf->ptl);
+	if (!pte_map_lock(vmf)) {
+		mmu_notifier_invalidate_range_end(mm, mmun_start, mmun_end);
+		mem_cgroup_cancel_charge(new_page, memcg, false);
+		put_page(new_page);
+		ret = VM_FAULT_RETRY;
+		goto out;
+	}
 	if (likely(pte_same(*vmf->pte, vmf->orig_pte))) {
 		if (old_page) {
 			if (!PageAnon(old_page)) {
@@ -2516,6 +2786,7 @@ static vm_fault_t wp_page_copy(struct vm_fault *vmf)
 				reliable_page_counter(new_page, mm, 1);
 			}
 		} else {
+			ksm_might_unmap_zero_page(mm, vmf->orig_pte);
 			inc_mm_counter_fast(mm, MM_ANONPAGES);
 			reliable_page_counter(new_page, mm, 1);
 		}
@@ -2598,9 +2869,11 @@ static vm_fault_t wp_page_copy(struct vm_fault *vmf)
 oom_free_new:
 	put_page(new_page);
 oom:
+	ret = VM_FAULT_OOM;
+out:
 	if (old_page)
 		put_page(old_page);
-	return VM_FAULT_OOM;
+	return ret;
 }
 
 /**
@@ -2740,8 +3013,11 @@ static vm_fault_t do_wp_page(struct vm_fault *vmf)
 			get_page(vmf->page);
 			pte_unmap_unlock(vmf->pte, vmf->ptl);
 			lock_page(vmf->page);
-			vmf->pte = pte_offset_map_lock(vma->vm_mm, vmf->pmd,
-					vmf->address, &vmf->ptl);
+			if (!pte_map_lock(vmf)) {
+				unlock_page(vmf->page);
+				put_page(vmf->page);
+				return VM_FAULT_RETRY;
+			}
 			if (!pte_same(*vmf->pte, vmf->orig_pte)) {
 				unlock_page(vmf->page);
 				pte_unmap_unlock(vmf->pte, vmf->ptl);
@@ -2998,9 +3274,18 @@ vm_fault_t do_swap_page(struct vm_fault *vmf)
 			page = alloc_page_vma(GFP_HIGHUSER_MOVABLE, vma,
 							vmf->address);
 			if (page) {
+				void *shadow;
+
 				__SetPageLocked(page);
 				__SetPageSwapBacked(page);
 				set_page_private(page, entry.val);
+				shadow = get_shadow_from_swap_cache(entry);
+				if (shadow &&
+				    workingset_refault(shadow, false)) {
+					SetPageActive(page);
+					SetPageWorkingset(page);
+					workingset_activation(page);
+				}
 				lru_cache_add_anon(page);
 				swap_readpage(page, true);
 			}
@@ -3195,21 +3480,25 @@ static vm_fault_t do_anonymous_page(struct vm_fault *vmf)
 	 * parallel threads are excluded by other means.
 	 *
 	 * Here we only have down_read(mmap_sem).
+	 *
+	 * A speculative fault does not get here without a page table.
 	 */
-	if (pte_alloc(vma->vm_mm, vmf->pmd, vmf->address))
-		return VM_FAULT_OOM;
+	if (!(vmf->flags & FAULT_FLAG_SPECULATIVE)) {
+		if (pte_alloc(vma->vm_mm, vmf->pmd, vmf->address))
+			return VM_FAULT_OOM;
 
-	/* See the comment in pte_alloc_one_map() */
-	if (unlikely(pmd_trans_unstable(vmf->pmd)))
-		return 0;
+		/* See the comment in pte_alloc_one_map() */
+		if (unlikely(pmd_trans_unstable(vmf->pmd)))
+			return 0;
+	}
 
 	/* Use the zero-page for reads */
 	if (!(vmf->flags & FAULT_FLAG_WRITE) &&
 			!mm_forbids_zeropage(vma->vm_mm)) {
 		entry = pte_mkspecial(pfn_pte(my_zero_pfn(vmf->address),
 						vma->vm_page_prot));
-		vmf->pte = pte_offset_map_lock(vma->vm_mm, vmf->pmd,
-				vmf->address, &vmf->ptl);
+		if (!pte_map_lock(vmf))
+			return VM_FAULT_RETRY;
 		if (!pte_none(*vmf->pte))
 			goto unlock;
 		ret = check_stable_address_space(vma->vm_mm);
@@ -3224,9 +3513,12 @@ static vm_fault_t do_anonymous_page(struct vm_fault *vmf)
 	}
 
 	/* Allocate our own private page. */
-	if (unlikely(anon_vma_prepare(vma)))
-		goto oom;
-	page = alloc_zeroed_user_highpage_movable(vma, vmf->address);
+	ret = vmf_anon_prepare(vmf);
+	if (unlikely(ret))
+		return ret;
+	page = alloc_prezeroed_page(vma);
+	if (!page)
+		page = alloc_zeroed_user_highpage_movable(vma, vmf->address);
 	if (!page)
 		goto oom;
 
@@ -3245,8 +3537,11 @@ static vm_fault_t do_anonymous_page(struct vm_fault *vmf)
 	if (vma->vm_flags & VM_WRITE)
 		entry = pte_mkwrite(pte_mkdirty(entry));
 
-	vmf->pte = pte_offset_map_lock(vma->vm_mm, vmf->pmd, vmf->address,
-			&vmf->ptl);
+	if (!pte_map_lock(vmf)) {
+		mem_cgroup_cancel_charge(page, memcg, false);
+		put_page(page);
+		return VM_FAULT_RETRY;
+	}
 	if (!pte_none(*vmf->pte))
 		goto release;
 
@@ -3310,7 +3605,8 @@ static vm_fault_t __do_fault(struct vm_fault *vmf)
 	 *				unlock_page(B)
 	 *				# flush A, B to clear the writeback
 	 */
-	if (pmd_none(*vmf->pmd) && !vmf->prealloc_pte) {
+	if (!(vmf->flags & FAULT_FLAG_SPECULATIVE) &&
+	    pmd_none(*vmf->pmd) && !vmf->prealloc_pte) {
 		vmf->prealloc_pte = pte_alloc_one(vmf->vma->vm_mm,
 						  vmf->address);
 		if (!vmf->prealloc_pte)
@@ -3363,6 +3659,10 @@ static vm_fault_t pte_alloc_one_map(struct vm_fault *vmf)
 {
 	struct vm_area_struct *vma = vmf->vma;
 
+	/* The page table was there, and must still be, see pte_map_lock() */
+	if (vmf->flags & FAULT_FLAG_SPECULATIVE)
+		return pte_map_lock(vmf) ? 0 : VM_FAULT_RETRY;
+
 	if (!pmd_none(*vmf->pmd))
 		goto map_pte;
 	if (vmf->prealloc_pte) {
@@ -3522,7 +3822,8 @@ vm_fault_t alloc_set_pte(struct vm_fault *vmf, struct mem_cgroup *memcg,
 	pte_t entry;
 	vm_fault_t ret;
 
-	if (pmd_none(*vmf->pmd) && PageTransCompound(page) &&
+	if (!(vmf->flags & FAULT_FLAG_SPECULATIVE) &&
+	    pmd_none(*vmf->pmd) && PageTransCompound(page) &&
 			IS_ENABLED(CONFIG_TRANSPARENT_HUGE_PAGECACHE)) {
 		/* THP on COW? */
 		VM_BUG_ON_PAGE(memcg, page);
@@ -3735,7 +4036,8 @@ static vm_fault_t do_read_fault(struct vm_fault *vmf)
 	 * if page by the offset is not ready to be mapped (cold cache or
 	 * something).
 	 */
-	if (vma->vm_ops->map_pages && fault_around_bytes >> PAGE_SHIFT > 1) {
+	if (vma->vm_ops->map_pages && fault_around_bytes >> PAGE_SHIFT > 1 &&
+	    !(vmf->flags & FAULT_FLAG_SPECULATIVE)) {
 		ret = do_fault_around(vmf);
 		if (ret)
 			return ret;
@@ -3757,8 +4059,9 @@ static vm_fault_t do_cow_fault(struct vm_fault *vmf)
 	struct vm_area_struct *vma = vmf->vma;
 	vm_fault_t ret;
 
-	if (unlikely(anon_vma_prepare(vma)))
-		return VM_FAULT_OOM;
+	ret = vmf_anon_prepare(vmf);
+	if (unlikely(ret))
+		return ret;
 
 	vmf->cow_page = alloc_page_vma(GFP_HIGHUSER_MOVABLE, vma, vmf->address);
 	if (!vmf->cow_page)
@@ -4061,6 +4364,10 @@ static vm_fault_t handle_pte_fault(struct vm_fault *vmf)
 {
 	pte_t entry;
 
+	/* handle_speculative_fault() has already read the pte */
+	if (vmf->flags & FAULT_FLAG_SPECULATIVE)
+		goto skip_pmd_checks;
+
 	if (unlikely(pmd_none(*vmf->pmd))) {
 		/*
 		 * Leave __pte_alloc() until later: because vm_ops->fault may
@@ -4097,6 +4404,7 @@ static vm_fault_t handle_pte_fault(struct vm_fault *vmf)
 		}
 	}
 
+skip_pmd_checks:
 	if (!vmf->pte) {
 		if (vma_is_anonymous(vmf->vma))
 			return do_anonymous_page(vmf);
@@ -4104,14 +4412,20 @@ static vm_fault_t handle_pte_fault(struct vm_fault *vmf)
 			return do_fault(vmf);
 	}
 
-	if (!pte_present(vmf->orig_pte))
+	if (!pte_present(vmf->orig_pte)) {
+		if (vmf->flags & FAULT_FLAG_SPECULATIVE)
+			return VM_FAULT_RETRY;
 		return do_swap_page(vmf);
+	}
 
-	if (pte_protnone(vmf->orig_pte) && vma_is_accessible(vmf->vma))
+	if (pte_protnone(vmf->orig_pte) && vma_is_accessible(vmf->vma)) {
+		if (vmf->flags & FAULT_FLAG_SPECULATIVE)
+			return VM_FAULT_RETRY;
 		return do_numa_page(vmf);
+	}
 
-	vmf->ptl = pte_lockptr(vmf->vma->vm_mm, vmf->pmd);
-	spin_lock(vmf->ptl);
+	if (!pte_spinlock(vmf))
+		return VM_FAULT_RETRY;
 	entry = vmf->orig_pte;
 	if (unlikely(!pte_same(*vmf->pte, entry)))
 		goto unlock;
@@ -4280,6 +4594,162 @@ vm_fault_t handle_mm_fault(struct vm_area_struct *vma, unsigned long address,
 }
 EXPORT_SYMBOL_GPL(handle_mm_fault);
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Try to handle a page fault without taking mmap_sem.  The vma is looked up
+ * under mm_rb_lock and copied under its vm_sequence, then the fault is
+ * handled against the copy with FAULT_FLAG_SPECULATIVE.  Whenever the fault
+ * would need something only mmap_sem guarantees, or the vma or the pmd is
+ * found to have changed when the pte lock is taken, VM_FAULT_RETRY is
+ * returned and the caller handles the fault the usual way.
+ *
+ * Only faults on anonymous vmas and on plain page cache vmas are handled,
+ * and only when the page table is already there: page tables are never
+ * allocated here, as they could be instantiated after free_pgtables().
+ *
+ * @vm_flags is the set of vma flags, any of which allows the access.
+ */
+vm_fault_t handle_speculative_fault(struct mm_struct *mm,
+				    unsigned long address, unsigned int flags,
+				    unsigned long vm_flags)
+{
+	struct vm_fault vmf = {
+		.address = address & PAGE_MASK,
+	};
+	struct vm_area_struct *vma, vma_copy;
+	pgd_t *pgd, pgdval;
+	p4d_t *p4d, p4dval;
+	pud_t *pud, pudval;
+	vm_fault_t ret = VM_FAULT_RETRY;
+
+	/* Don't let the fault path drop a mmap_sem we don't hold */
+	flags &= ~(FAULT_FLAG_ALLOW_RETRY | FAULT_FLAG_KILLABLE);
+	flags |= FAULT_FLAG_SPECULATIVE;
+	vmf.flags = flags;
+
+	vma = get_vma(mm, address);
+	if (!vma)
+		goto out_fallback;
+
+	vmf.sequence = raw_read_seqcount(&vma->vm_sequence);
+	if (vmf.sequence & 1)
+		goto out_put;
+	vma_copy = *vma;
+	if (read_seqcount_retry(&vma->vm_sequence, vmf.sequence))
+		goto out_put;
+	vmf.vma = &vma_copy;
+	vmf.spf_vma = vma;
+
+	if (userfaultfd_armed(&vma_copy))
+		goto out_put;
+	/* Stack expansion needs mmap_sem */
+	if (vma_copy.vm_flags & (VM_GROWSDOWN | VM_GROWSUP))
+		goto out_put;
+	/* A vma policy may be replaced and freed under us */
+	if (vma_policy(&vma_copy))
+		goto out_put;
+	if (vma_copy.vm_ops && vma_copy.vm_ops->fault != filemap_fault)
+		goto out_put;
+	if ((flags & FAULT_FLAG_WRITE) && (vma_copy.vm_flags & VM_SHARED))
+		goto out_put;
+	if (!(vma_copy.vm_flags & vm_flags))
+		goto out_put;
+	if (!arch_vma_access_permitted(&vma_copy, flags & FAULT_FLAG_WRITE,
+				       flags & FAULT_FLAG_INSTRUCTION,
+				       flags & FAULT_FLAG_REMOTE))
+		goto out_put;
+
+	vmf.pgoff = linear_page_index(&vma_copy, address);
+	vmf.gfp_mask = __get_fault_gfp_mask(&vma_copy);
+
+	/*
+	 * Walk the page table with interrupts disabled, so that none of its
+	 * pages can be freed under us.  Only the values read here are walked
+	 * through, a level may be folded onto the one above.
+	 */
+	local_irq_disable();
+	pgd = pgd_offset(mm, address);
+	pgdval = READ_ONCE(*pgd);
+	if (pgd_none(pgdval) || unlikely(pgd_bad(pgdval)))
+		goto out_walk;
+
+	p4d = p4d_offset(&pgdval, address);
+	p4dval = READ_ONCE(*p4d);
+	if (p4d_none(p4dval) || unlikely(p4d_bad(p4dval)))
+		goto out_walk;
+
+	pud = pud_offset(&p4dval, address);
+	pudval = READ_ONCE(*pud);
+	if (pud_none(pudval) || unlikely(pud_bad(pudval)) ||
+	    pud_trans_huge(pudval) || pud_devmap(pudval))
+		goto out_walk;
+
+	vmf.pmd = pmd_offset(&pudval, address);
+	vmf.orig_pmd = READ_ONCE(*vmf.pmd);
+	if (pmd_none(vmf.orig_pmd) || is_swap_pmd(vmf.orig_pmd) ||
+	    pmd_trans_huge(vmf.orig_pmd) || pmd_devmap(vmf.orig_pmd))
+		goto out_walk;
+
+	vmf.pte = pte_offset_map(&vmf.orig_pmd, address);
+	vmf.orig_pte = READ_ONCE(*vmf.pte);
+	barrier(); /* See comment in handle_pte_fault() */
+	if (pte_none(vmf.orig_pte)) {
+		pte_unmap(vmf.pte);
+		vmf.pte = NULL;
+	}
+	local_irq_enable();
+
+	__set_current_state(TASK_RUNNING);
+	check_sync_rss_stat(current);
+
+	if (flags & FAULT_FLAG_USER)
+		mem_cgroup_enter_user_fault();
+
+	ret = handle_pte_fault(&vmf);
+
+	if (flags & FAULT_FLAG_USER) {
+		mem_cgroup_exit_user_fault();
+		if (task_in_memcg_oom(current) && !(ret & VM_FAULT_OOM))
+			mem_cgroup_oom_synchronize(false);
+	}
+
+	/* Errors are left to be reported by the regular path */
+	if (ret & VM_FAULT_ERROR)
+		ret = VM_FAULT_RETRY;
+	goto out_put;
+
+out_walk:
+	local_irq_enable();
+out_put:
+	put_vma(vma);
+	if (!(ret & VM_FAULT_RETRY)) {
+		count_vm_event(PGFAULT);
+		count_memcg_event_mm(mm, PGFAULT);
+		this_cpu_inc(mm->spf_stat->success);
+		return ret;
+	}
+out_fallback:
+	this_cpu_inc(mm->spf_stat->fallback);
+	return VM_FAULT_RETRY;
+}
+
+void spf_report_usage(struct seq_file *m, struct mm_struct *mm)
+{
+	unsigned long success = 0, fallback = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct mm_spf_stat *stat = per_cpu_ptr(mm->spf_stat, cpu);
+
+		success += stat->success;
+		fallback += stat->fallback;
+	}
+
+	seq_printf(m, "SpfSuccess:\t%lu\nSpfFallback:\t%lu\n",
+		   success, fallback);
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 #ifndef __PAGETABLE_P4D_FOLDED
 /*
  * Allocate p4d page table.
@@ -775,8 +775,10 @@ static int vma_replace_policy(struct vm_area_struct *vma,
 			goto err_out;
 	}
 
+	vm_write_begin(vma);
 	old = vma->vm_policy;
 	vma->vm_policy = new; /* protected by mmap_sem */
+	vm_write_end(vma);
 	mpol_put(old);
 
 	return 0;
@@ -2171,7 +2173,7 @@ alloc_pages_vma(gfp_t gfp, int order, struct vm_area_struct *vma,
 {
 	struct mempolicy *pol;
 	struct page *page;
-	int preferred_nid;
+	int preferred_nid, grid_nid;
 	nodemask_t *nmask;
 
 	pol = get_vma_policy(vma, addr);
@@ -2248,7 +2250,15 @@ alloc_pages_vma(gfp_t gfp, int order, struct vm_area_struct *vma,
 
 	nmask = policy_nodemask(gfp, pol);
 	preferred_nid = policy_node(gfp, pol, node);
-	if (smart_grid_used())
+	/*
+	 * The node set on the cpu cgroup only replaces the default, local
+	 * policy: an explicit task or vma policy wins over it.
+	 */
+	grid_nid = sched_grid_task_preferred_nid(current);
+	if (pol->mode == MPOL_PREFERRED && (pol->flags & MPOL_F_LOCAL) &&
+	    grid_nid != NUMA_NO_NODE && node_online(grid_nid))
+		preferred_nid = grid_nid;
+	else if (smart_grid_used())
 		preferred_nid = sched_grid_preferred_nid(preferred_nid, nmask);
 	page = __alloc_pages_nodemask(gfp, order, preferred_nid, nmask);
 	mark_vma_cdm(nmask, page, vma);
@@ -323,6 +323,8 @@ static unsigned long move_vma(struct vm_area_struct *vma,
 		arch_remap(mm, old_addr, old_addr + old_len,
 			   new_addr, new_addr + new_len);
 	}
+	/* Left open by copy_vma() while the page tables are moved */
+	vm_write_end(new_vma);
 
 	/* Conceal VM_ACCOUNT so old reservation is not undone */
 	if (vm_flags & VM_ACCOUNT) {
@@ -32,19 +32,18 @@
 static struct page *page_idle_get_page(unsigned long pfn)
 {
 	struct page *page = pfn_to_online_page(pfn);
-	struct zone *zone;
+	struct lruvec *lruvec;
 
 	if (!page || !PageLRU(page) ||
 	    !get_page_unless_zero(page))
 		return NULL;
 
-	zone = page_zone(page);
-	spin_lock_irq(zone_lru_lock(zone));
-	if (unlikely(!PageLRU(page))) {
+	lruvec = lock_page_lruvec_irq(page);
+	if (unlikely(!page_lru_relock_irq(page, &lruvec))) {
 		put_page(page);
 		page = NULL;
 	}
-	spin_unlock_irq(zone_lru_lock(zone));
+	unlock_page_lruvec_irq(lruvec);
 	return page;
 }
 
@@ -415,6 +415,95 @@ int swap_readpage(struct page *page, bool synchronous)
 	return ret;
 }
 
+static void end_swap_bio_read_batch(struct bio *bio)
+{
+	struct bio_vec *bvec;
+	int i;
+
+	if (bio->bi_status)
+		pr_alert("Read-error on swap-device (%u:%u:%llu)\n",
+			 MAJOR(bio_dev(bio)), MINOR(bio_dev(bio)),
+			 (unsigned long long)bio->bi_iter.bi_sector);
+
+	bio_for_each_segment_all(bvec, bio, i) {
+		struct page *page = bvec->bv_page;
+
+		if (bio->bi_status) {
+			SetPageError(page);
+			ClearPageUptodate(page);
+		} else {
+			SetPageUptodate(page);
+			swap_slot_free_notify(page);
+		}
+		unlock_page(page);
+	}
+	bio_put(bio);
+}
+
+/*
+ * Start reading @nr locked swap cache pages without waiting for them, as
+ * swap_readpage(page, false) would.  Pages whose slots are contiguous on a
+ * swap block device go out in one bio, rather than one bio per page left
+ * for the plug to merge.
+ */
+void swap_readpage_batch(struct page **pages, int nr)
+{
+	struct swap_info_struct *bio_sis = NULL;
+	struct bio *bio = NULL;
+	sector_t next = 0;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		struct page *page = pages[i];
+		struct swap_info_struct *sis = page_swap_info(page);
+		struct block_device *bdev;
+		sector_t sector;
+
+		VM_BUG_ON_PAGE(!PageSwapCache(page), page);
+		VM_BUG_ON_PAGE(!PageLocked(page), page);
+		VM_BUG_ON_PAGE(PageUptodate(page), page);
+
+		/* Devices with ->rw_page don't gain from batching */
+		if (PageTransHuge(page) || (sis->flags & SWP_FS) ||
+		    sis->bdev->bd_disk->fops->rw_page) {
+			swap_readpage(page, false);
+			continue;
+		}
+
+		if (frontswap_load(page) == 0) {
+			SetPageUptodate(page);
+			unlock_page(page);
+			continue;
+		}
+
+		sector = map_swap_page(page, &bdev);
+		if (bio && (sis != bio_sis || sector != next ||
+			    !bio_add_page(bio, page, PAGE_SIZE, 0))) {
+			submit_bio(bio);
+			bio = NULL;
+		}
+		if (!bio) {
+			bio = bio_alloc(GFP_KERNEL,
+					min_t(int, nr - i, BIO_MAX_PAGES));
+			if (!bio) {
+				swap_readpage(page, false);
+				continue;
+			}
+			bio->bi_iter.bi_sector = sector;
+			bio_set_dev(bio, bdev);
+			bio->bi_end_io = end_swap_bio_read_batch;
+			bio_set_op_attrs(bio, REQ_OP_READ, 0);
+			bio_add_page(bio, page, PAGE_SIZE, 0);
+			bio_sis = sis;
+		}
+		next = sector + (PAGE_SIZE >> 9);
+		count_vm_event(PSWPIN);
+	}
+
+	if (bio)
+		submit_bio(bio);
+}
+
 int swap_set_page_dirty(struct page *page)
 {
 	struct swap_info_struct *sis = page_swap_info(page);
@@ -1335,6 +1335,48 @@ static struct pcpu_chunk *pcpu_chunk_addr_search(void *addr)
 	return pcpu_get_page_chunk(pcpu_addr_to_page(addr));
 }
 
+/**
+ * pcpu_alloc_populated - allocate an area from already populated pages
+ * @chunkp: out param for the chunk the area was found in
+ * @size: size of area to allocate in bytes
+ * @bits: size of area in allocation units
+ * @bit_align: alignment of area in allocation units
+ *
+ * Search the normal chunks for a free area that needs no population, so
+ * that it can be handed out without pcpu_alloc_mutex.  The balance work
+ * keeps a few empty populated pages around for this.
+ *
+ * CONTEXT:
+ * pcpu_lock.
+ *
+ * RETURNS:
+ * Offset of the allocated area in *@chunkp on success, -1 on failure.
+ */
+static int pcpu_alloc_populated(struct pcpu_chunk **chunkp, size_t size,
+				size_t bits, size_t bit_align)
+{
+	struct pcpu_chunk *chunk;
+	int slot, off;
+
+	lockdep_assert_held(&pcpu_lock);
+
+	for (slot = pcpu_size_to_slot(size); slot < pcpu_nr_slots; slot++) {
+		list_for_each_entry(chunk, &pcpu_slot[slot], list) {
+			off = pcpu_find_block_fit(chunk, bits, bit_align, true);
+			if (off < 0)
+				continue;
+
+			off = pcpu_alloc_area(chunk, bits, bit_align, off);
+			if (off >= 0) {
+				*chunkp = chunk;
+				return off;
+			}
+		}
+	}
+
+	return -1;
+}
+
 /**
  * pcpu_alloc - the percpu allocator
  * @size: size of area to allocate in bytes
@@ -1385,6 +1427,22 @@ static void __percpu *pcpu_alloc(size_t size, size_t align, bool reserved,
 		return NULL;
 	}
 
+	/*
+	 * Most allocations fit in pages that are already populated.  Serve
+	 * those under pcpu_lock alone, so that tasks creating lots of percpu
+	 * counters (memcg, netns) don't all serialize on pcpu_alloc_mutex.
+	 */
+	if (!is_atomic && !reserved) {
+		spin_lock_irqsave(&pcpu_lock, flags);
+		off = pcpu_alloc_populated(&chunk, size, bits, bit_align);
+		if (off >= 0) {
+			pcpu_stats_area_alloc(chunk, size);
+			spin_unlock_irqrestore(&pcpu_lock, flags);
+			goto area_populated;
+		}
+		spin_unlock_irqrestore(&pcpu_lock, flags);
+	}
+
 	if (!is_atomic) {
 		/*
 		 * pcpu_balance_workfn() allocates memory under this mutex,
@@ -1490,6 +1548,7 @@ static void __percpu *pcpu_alloc(size_t size, size_t align, bool reserved,
 		mutex_unlock(&pcpu_alloc_mutex);
 	}
 
+area_populated:
 	if (pcpu_nr_empty_pop_pages < PCPU_EMPTY_POP_PAGES_LOW)
 		pcpu_schedule_balance_work();
 
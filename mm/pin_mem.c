@@ -17,6 +17,10 @@
 #include <linux/ctype.h>
 #include <linux/highmem.h>
 #include <linux/sha256.h>
+#include <linux/ktask.h>
+#include <linux/ktime.h>
+#include <linux/nodemask.h>
+#include <linux/hugetlb.h>
 
 #define MAX_PIN_PID_NUM  128
 #define DEFAULT_REDIRECT_SPACE_SIZE  0x100000
@@ -37,6 +41,13 @@ static unsigned long redirect_space_start;
 static void *pin_mem_pagewalk;
 static unsigned long *pagemap_buffer;
 static int reserve_user_map_pages_fail;
+/* running digest of the page map entries, one per page map info */
+static struct sha256_state *pmi_sha_state;
+/*
+ * Protects pmi_sha_state.  Entries are hashed outside page_map_entry_lock,
+ * so appending them and hashing them is serialized by this mutex instead.
+ */
+static DEFINE_MUTEX(pmi_digest_mutex);
 
 static int __init setup_max_pin_pid_num(char *str)
 {
@@ -89,6 +100,9 @@ static struct page_map_info *create_page_map_info(int pid)
 	new->entry_num = 0;
 	new->pid_reserved = false;
 	new->disable_free_page = false;
+	memset(new->sha_digest, 0, SHA256_DIGEST_SIZE);
+	if (pmi_sha_state)
+		sha256_init(&pmi_sha_state[pin_pid_num]);
 	(*pin_pid_num_addr)++;
 	pin_pid_num++;
 	return new;
@@ -106,6 +120,49 @@ struct page_map_info *create_page_map_info_by_pid(int pid)
 }
 EXPORT_SYMBOL_GPL(create_page_map_info_by_pid);
 
+/*
+ * redirect_start is filled in by reserve_user_space_map_pages() after the
+ * kexec, so it is not covered by the digest.
+ */
+static void pme_digest_update(struct sha256_state *sctx,
+			      struct page_map_entry *pme)
+{
+	sha256_update(sctx, (unsigned char *)pme,
+		      offsetof(struct page_map_entry, redirect_start));
+	sha256_update(sctx, (unsigned char *)pme->phy_addr_array,
+		      pme->nr_pages * sizeof(unsigned long));
+}
+
+/* the caller must hold pmi_digest_mutex */
+static void pmi_digest_update(struct page_map_info *pmi,
+			      struct page_map_entry *pme, unsigned int nr)
+{
+	unsigned int i;
+
+	if (!pmi_sha_state)
+		return;
+
+	for (i = 0; i < nr; i++) {
+		pme_digest_update(&pmi_sha_state[pmi - user_space_reserve_start],
+				  pme);
+		pme = (struct page_map_entry *)next_pme(pme);
+	}
+}
+
+static void calculate_pmi_digest(struct page_map_info *pmi, char *digest)
+{
+	unsigned int i;
+	struct page_map_entry *pme = pmi->pme;
+	struct sha256_state sctx;
+
+	sha256_init(&sctx);
+	for (i = 0; i < pmi->entry_num; i++) {
+		pme_digest_update(&sctx, pme);
+		pme = (struct page_map_entry *)next_pme(pme);
+	}
+	sha256_final(&sctx, digest);
+}
+
 static struct page_map_info *get_page_map_info(int pid)
 {
 	int i;
@@ -225,6 +282,42 @@ void reserve_page_from_buddy(unsigned long nr_pages, struct page *page)
 	}
 }
 
+#define PIN_MEM_PUD_ORDER	(PUD_SHIFT - PAGE_SHIFT)
+#define PIN_MEM_PUD_NR		(1UL << PIN_MEM_PUD_ORDER)
+
+static inline unsigned int pme_page_order(struct page_map_entry *pme)
+{
+	if (pme->is_huge_page == PIN_MEM_PUD_PAGE)
+		return PIN_MEM_PUD_ORDER;
+	return pme->is_huge_page ? HPAGE_PMD_ORDER : 0;
+}
+
+/* Gigantic pages are handed back to the buddy one MAX_ORDER block at a time. */
+static void free_pin_mem_pages(struct page *page, unsigned int order)
+{
+	unsigned long i;
+
+	if (order < MAX_ORDER) {
+		__free_pages(page, order);
+		return;
+	}
+	for (i = 0; i < (1UL << order); i += MAX_ORDER_NR_PAGES) {
+		if (i)
+			set_page_count(page + i, 1);
+		__free_pages(page + i, MAX_ORDER - 1);
+	}
+}
+
+static inline bool is_pud_hugetlb_vma(struct vm_area_struct *vma)
+{
+#ifdef CONFIG_HUGETLB_PAGE
+	return is_vm_hugetlb_page(vma) && !(vma->vm_flags & VM_MAYSHARE) &&
+		huge_page_size(hstate_vma(vma)) == PUD_SIZE;
+#else
+	return false;
+#endif
+}
+
 static inline void reserve_user_normal_pages(struct page *page)
 {
 	atomic_inc(&page->_refcount);
@@ -273,6 +366,32 @@ static inline void reserve_user_huge_pmd_pages(struct page *page)
 	init_huge_pmd_pages(page);
 }
 
+/*
+ * A gigantic page spans several MAX_ORDER buddy blocks, all of them must
+ * still be free in the new kernel.
+ */
+static bool huge_pud_pages_in_use(struct page *page)
+{
+	unsigned long i;
+
+	for (i = 0; i < PIN_MEM_PUD_NR; i += MAX_ORDER_NR_PAGES) {
+		if (atomic_read(&page[i]._refcount))
+			return true;
+	}
+	return false;
+}
+
+static void reserve_user_huge_pud_pages(struct page *page)
+{
+	unsigned long i, nr;
+
+	atomic_inc(&page->_refcount);
+	for (i = 0; i < PIN_MEM_PUD_NR; i += nr) {
+		nr = min_t(unsigned long, PIN_MEM_PUD_NR - i, MAX_ORDER_NR_PAGES);
+		reserve_page_from_buddy(nr, page + i);
+	}
+}
+
 void free_user_map_pages(unsigned int pid_index, unsigned int entry_index, unsigned int page_index)
 {
 	unsigned int i, j, index, order;
@@ -286,12 +405,12 @@ void free_user_map_pages(unsigned int pid_index, unsigned int entry_index, unsig
 		pme = pmi->pme;
 		for (i = 0; i < pmi->entry_num; i++) {
 			for (j = 0; j < pme->nr_pages; j++) {
-				order = pme->is_huge_page ? HPAGE_PMD_ORDER : 0;
+				order = pme_page_order(pme);
 				phy_addr = pme->phy_addr_array[j];
 				if (phy_addr) {
 					page = phys_to_page(phy_addr);
 					if (!(page->flags & PAGE_FLAGS_CHECK_RESERVED)) {
-						__free_pages(page, order);
+						free_pin_mem_pages(page, order);
 						pme->phy_addr_array[j] = 0;
 					}
 				}
@@ -304,12 +423,12 @@ void free_user_map_pages(unsigned int pid_index, unsigned int entry_index, unsig
 	pme = pmi->pme;
 	for (i = 0; i < entry_index; i++) {
 		for (j = 0; j < pme->nr_pages; j++) {
-			order = pme->is_huge_page ? HPAGE_PMD_ORDER : 0;
+			order = pme_page_order(pme);
 			phy_addr = pme->phy_addr_array[j];
 			if (phy_addr) {
 				page = phys_to_page(phy_addr);
 				if (!(page->flags & PAGE_FLAGS_CHECK_RESERVED)) {
-					__free_pages(page, order);
+					free_pin_mem_pages(page, order);
 					pme->phy_addr_array[j] = 0;
 				}
 			}
@@ -318,12 +437,12 @@ void free_user_map_pages(unsigned int pid_index, unsigned int entry_index, unsig
 	}
 
 	for (j = 0; j < page_index; j++) {
-		order = pme->is_huge_page ? HPAGE_PMD_ORDER : 0;
+		order = pme_page_order(pme);
 		phy_addr = pme->phy_addr_array[j];
 		if (phy_addr) {
 			page = phys_to_page(phy_addr);
 			if (!(page->flags & PAGE_FLAGS_CHECK_RESERVED)) {
-				__free_pages(page, order);
+				free_pin_mem_pages(page, order);
 				pme->phy_addr_array[j] = 0;
 			}
 		}
@@ -342,11 +461,24 @@ bool check_redirect_end_valid(struct redirect_info *redirect_start,
 	return true;
 }
 
+static int check_pmi_digest(struct page_map_info *pmi)
+{
+	char digest[SHA256_DIGEST_SIZE] = {0};
+
+	calculate_pmi_digest(pmi, digest);
+	if (memcmp(pmi->sha_digest, digest, SHA256_DIGEST_SIZE)) {
+		pr_warn("page map entries of pid %d sha256 digest match error!\n",
+			pmi->pid);
+		return -EFAULT;
+	}
+	return 0;
+}
+
 static void reserve_user_space_map_pages(void)
 {
 	struct page_map_info *pmi;
 	struct page_map_entry *pme;
-	unsigned int i, j, index;
+	unsigned int i, j, index, pid_index;
 	struct page *page;
 	unsigned long flags;
 	unsigned long phy_addr;
@@ -369,6 +501,17 @@ static void reserve_user_space_map_pages(void)
 				if (!phy_addr)
 					continue;
 				page = phys_to_page(phy_addr);
+				/* there is no room to redirect a gigantic page */
+				if (pme->is_huge_page == PIN_MEM_PUD_PAGE) {
+					if (!huge_pud_pages_in_use(page)) {
+						reserve_user_huge_pud_pages(page);
+						continue;
+					}
+					reserve_user_map_pages_fail = 1;
+					pr_warn("Huge pud page %pK is in use, no need reserve.\n",
+						page);
+					goto free_pages;
+				}
 				if (atomic_read(&page->_refcount)) {
 					if ((page->flags & PAGE_FLAGS_CHECK_RESERVED)
 						&& !pme->redirect_start)
@@ -406,8 +549,30 @@ static void reserve_user_space_map_pages(void)
 	return;
 
 free_pages:
+	/*
+	 * Freeing zeroes the entries of the freed pages, so the digests must
+	 * be rehashed afterwards. Verify them first, or corrupted entries
+	 * would get a valid digest: a mismatching digest is zeroed, which
+	 * never matches, and left alone below. This runs from mem_init()
+	 * before anything else can pin memory, so the entries don't change
+	 * while the lock is dropped for hashing.
+	 */
+	spin_unlock_irqrestore(&page_map_entry_lock, flags);
+	for (pid_index = 0; pid_index <= index; pid_index++) {
+		pmi = &(user_space_reserve_start[pid_index]);
+		if (check_pmi_digest(pmi))
+			memset(pmi->sha_digest, 0, SHA256_DIGEST_SIZE);
+	}
+
+	spin_lock_irqsave(&page_map_entry_lock, flags);
 	free_user_map_pages(index, i, j);
 	spin_unlock_irqrestore(&page_map_entry_lock, flags);
+
+	for (pid_index = 0; pid_index <= index; pid_index++) {
+		pmi = &(user_space_reserve_start[pid_index]);
+		if (memchr_inv(pmi->sha_digest, 0, SHA256_DIGEST_SIZE))
+			calculate_pmi_digest(pmi, pmi->sha_digest);
+	}
 }
 
 
@@ -485,10 +650,24 @@ static void init_page_map_info(struct pin_mem_dump_info *pmdi, unsigned long map
 
 int finish_pin_mem_dump(void)
 {
-	int ret;
+	int i, ret;
+	struct sha256_state sctx;
 
 	if (!pin_mem_dump_start)
 		return -EFAULT;
+
+	/*
+	 * The entries are hashed when they are collected, only finalize the
+	 * digest of each pid here. Work on a copy so that more areas may
+	 * still be pinned and the dump finished again.
+	 */
+	mutex_lock(&pmi_digest_mutex);
+	for (i = 0; pmi_sha_state && i < pin_pid_num; i++) {
+		sctx = pmi_sha_state[i];
+		sha256_final(&sctx, user_space_reserve_start[i].sha_digest);
+	}
+	mutex_unlock(&pmi_digest_mutex);
+
 	pin_mem_dump_start->magic = PIN_MEM_DUMP_MAGIC;
 	memset(pin_mem_dump_start->sha_digest, 0, SHA256_DIGEST_SIZE);
 	ret = calculate_pin_mem_digest(pin_mem_dump_start, NULL);
@@ -501,20 +680,21 @@ int finish_pin_mem_dump(void)
 EXPORT_SYMBOL_GPL(finish_pin_mem_dump);
 
 int collect_pmd_huge_pages(struct task_struct *task,
-	unsigned long start_addr, unsigned long end_addr, struct page_map_entry *pme)
+	unsigned long start_addr, unsigned long end_addr, struct page_map_entry *pme,
+	void *walk, unsigned long *buffer)
 {
 	int ret, i, res;
 	int index = 0;
 	unsigned long start = start_addr;
 	struct page *temp_page;
-	unsigned long *pte_entry = pagemap_buffer;
+	unsigned long *pte_entry = buffer;
 	unsigned int count;
 	struct mm_struct *mm = task->mm;
 
 	while (start < end_addr) {
 		temp_page = NULL;
 		count = 0;
-		ret = pagemap_get(mm, pin_mem_pagewalk,
+		ret = pagemap_get(mm, walk,
 			start, start + HPAGE_PMD_SIZE, pte_entry, &count);
 		if (ret || !count) {
 			pr_warn("Get huge page fail: %d.", ret);
@@ -563,8 +743,51 @@ int collect_pmd_huge_pages(struct task_struct *task,
 	return COLLECT_PAGES_FINISH;
 }
 
+/* The caller makes sure that [start_addr, end_addr) starts in a PUD hugetlb vma. */
+static int collect_pud_huge_pages(struct task_struct *task,
+	unsigned long start_addr, unsigned long end_addr, struct page_map_entry *pme,
+	void *walk, unsigned long *buffer, struct vm_area_struct *vma)
+{
+	int ret;
+	int index = 0;
+	unsigned long start = start_addr;
+	unsigned long end = min(end_addr, vma->vm_end);
+	struct page *temp_page;
+	unsigned long *pte_entry = buffer;
+	unsigned int count;
+	struct mm_struct *mm = task->mm;
+
+	while (start + PUD_SIZE <= end) {
+		count = 0;
+		/* the first pfn is enough to find the head page */
+		ret = pagemap_get(mm, walk, start, start + PAGE_SIZE,
+			pte_entry, &count);
+		if (ret || !count) {
+			pr_warn("Get huge pud page fail: %d.", ret);
+			return COLLECT_PAGES_FAIL;
+		}
+
+		pme->phy_addr_array[index] = 0;
+		if (IS_PTE_PRESENT(pte_entry[0])) {
+			temp_page = pfn_to_page(pte_entry[0] & PM_PFRAME_MASK);
+			if (!PageHead(temp_page)) {
+				pr_warn("Huge pud page %lx is not compound head.\n", start);
+				return COLLECT_PAGES_FAIL;
+			}
+			atomic_inc(&((temp_page)->_refcount));
+			pme->phy_addr_array[index] = page_to_phys(temp_page);
+		}
+		start += PUD_SIZE;
+		index++;
+	}
+	pme->nr_pages = index;
+	/* an unaligned tail of the area can not hold a huge pud page */
+	return end < end_addr ? COLLECT_PAGES_NEED_CONTINUE : COLLECT_PAGES_FINISH;
+}
+
 int collect_normal_pages(struct task_struct *task,
-	unsigned long start_addr, unsigned long end_addr, struct page_map_entry *pme)
+	unsigned long start_addr, unsigned long end_addr, struct page_map_entry *pme,
+	void *walk, unsigned long *buffer)
 {
 	int ret, res;
 	unsigned long next;
@@ -572,7 +795,7 @@ int collect_normal_pages(struct task_struct *task,
 	struct page *tmp_page;
 	unsigned long *phy_addr_array = pme->phy_addr_array;
 	unsigned int count;
-	unsigned long *pte_entry = pagemap_buffer;
+	unsigned long *pte_entry = buffer;
 	struct mm_struct *mm = task->mm;
 
 	next = (start_addr & HPAGE_PMD_MASK) + HPAGE_PMD_SIZE;
@@ -581,7 +804,7 @@ int collect_normal_pages(struct task_struct *task,
 	while (start_addr < next) {
 		count = 0;
 		nr_pages = (PAGE_ALIGN(next) - start_addr) / PAGE_SIZE;
-		ret = pagemap_get(mm, pin_mem_pagewalk,
+		ret = pagemap_get(mm, walk,
 			start_addr, next, pte_entry, &count);
 		if (ret || !count) {
 			pr_warn("Get user page fail: %d, count: %u.\n",
@@ -647,7 +870,7 @@ void free_pin_pages(struct page_map_entry *pme)
 
 int init_pagemap_read(void)
 {
-	int ret = -ENOMEM;
+	int i, ret = -ENOMEM;
 
 	if (pin_mem_pagewalk)
 		return 0;
@@ -660,11 +883,27 @@ int init_pagemap_read(void)
 		sizeof(unsigned long), GFP_KERNEL);
 	if (!pagemap_buffer)
 		goto free;
+	pmi_sha_state = kcalloc(max_pin_pid_num, sizeof(struct sha256_state),
+				GFP_KERNEL);
+	if (!pmi_sha_state)
+		goto free_buffer;
+	/* the pids recorded before are hashed again from scratch */
+	mutex_lock(&pmi_digest_mutex);
+	for (i = 0; i < pin_pid_num; i++) {
+		sha256_init(&pmi_sha_state[i]);
+		pmi_digest_update(&user_space_reserve_start[i],
+				  user_space_reserve_start[i].pme,
+				  user_space_reserve_start[i].entry_num);
+	}
+	mutex_unlock(&pmi_digest_mutex);
 
 	ret = 0;
 out:
 	mutex_unlock(&pin_mem_mutex);
 	return ret;
+free_buffer:
+	kfree(pagemap_buffer);
+	pagemap_buffer = NULL;
 free:
 	free_pagemap_walk(pin_mem_pagewalk);
 	pin_mem_pagewalk = NULL;
@@ -672,41 +911,47 @@ int init_pagemap_read(void)
 }
 EXPORT_SYMBOL_GPL(init_pagemap_read);
 
-/* Users make sure that the pin memory belongs to anonymous vma. */
-int pin_mem_area(struct task_struct *task, struct mm_struct *mm,
-		unsigned long start_addr, unsigned long end_addr)
+/*
+ * Collect the pages of one page map entry starting from start_addr, the
+ * caller must hold mm->mmap_sem for read. Return COLLECT_PAGES_FAIL,
+ * COLLECT_PAGES_FINISH, or COLLECT_PAGES_NEED_CONTINUE in which case the
+ * next entry starts from *next_addr.
+ */
+static int collect_pme_pages(struct task_struct *task, struct mm_struct *mm,
+		unsigned long start_addr, unsigned long end_addr,
+		struct page_map_entry *pme, void *walk, unsigned long *buffer,
+		unsigned long *next_addr)
 {
-	int pid, ret;
+	int ret;
 	int is_huge_page = false;
-	unsigned int page_size;
-	unsigned long nr_pages, flags;
-	struct page_map_entry *pme = NULL;
-	struct page_map_info *pmi;
+	unsigned long page_size;
+	unsigned long nr_pages;
 	struct vm_area_struct *vma;
 	unsigned long i;
 	struct page *tmp_page;
 
-	if (!page_map_entry_start
-		|| !task || !mm
-		|| start_addr >= end_addr || !pin_mem_pagewalk)
-		return -EFAULT;
-
-	pid = task->pid;
-	spin_lock_irqsave(&page_map_entry_lock, flags);
+	pme->nr_pages = 0;
 	nr_pages = ((end_addr - start_addr) / PAGE_SIZE);
-	if ((unsigned long)page_map_entry_start +
-		nr_pages * sizeof(unsigned long) +
-		sizeof(struct page_map_entry) >= page_map_entry_end) {
-		pr_warn("Page map entry use up!\n");
-		ret = -ENOMEM;
-		goto finish;
-	}
-
 	vma = find_extend_vma(mm, start_addr);
 	if (!vma) {
 		pr_warn("Find no match vma!\n");
-		ret = -EFAULT;
-		goto finish;
+		return COLLECT_PAGES_FAIL;
+	}
+	if (is_pud_hugetlb_vma(vma)) {
+		if (start_addr & ~PUD_MASK) {
+			pr_warn("Pin address %lx is not aligned to huge pud page!\n",
+				start_addr);
+			return COLLECT_PAGES_FAIL;
+		}
+		pme->virt_addr = start_addr;
+		pme->redirect_start = 0;
+		pme->is_huge_page = PIN_MEM_PUD_PAGE;
+		memset(pme->phy_addr_array, 0, nr_pages * sizeof(unsigned long));
+		ret = collect_pud_huge_pages(task, start_addr, end_addr, pme,
+					     walk, buffer, vma);
+		if (ret != COLLECT_PAGES_FAIL)
+			*next_addr = pme->virt_addr + pme->nr_pages * PUD_SIZE;
+		return ret;
 	}
 	if (start_addr == (start_addr & HPAGE_PMD_MASK) &&
 		transparent_hugepage_enabled(vma)) {
@@ -716,43 +961,36 @@ int pin_mem_area(struct task_struct *task, struct mm_struct *mm,
 		page_size = PAGE_SIZE;
 	}
 
-	pme = page_map_entry_start;
 	pme->virt_addr = start_addr;
 	pme->redirect_start = 0;
 	pme->is_huge_page = is_huge_page;
 	memset(pme->phy_addr_array, 0, nr_pages * sizeof(unsigned long));
 
-	down_read(&mm->mmap_sem);
 	if (!is_huge_page) {
-		ret = collect_normal_pages(task, start_addr, end_addr, pme);
+		ret = collect_normal_pages(task, start_addr, end_addr, pme,
+					   walk, buffer);
 		if (ret != COLLECT_PAGES_FAIL && !pme->nr_pages) {
-			if (ret == COLLECT_PAGES_FINISH) {
-				ret = 0;
-				up_read(&mm->mmap_sem);
-				goto finish;
-			}
+			if (ret == COLLECT_PAGES_FINISH)
+				return ret;
 			pme->is_huge_page = true;
 			page_size = HPAGE_PMD_SIZE;
-			ret = collect_pmd_huge_pages(task, pme->virt_addr, end_addr, pme);
+			ret = collect_pmd_huge_pages(task, pme->virt_addr,
+						     end_addr, pme, walk, buffer);
 		}
 	} else {
-		ret = collect_pmd_huge_pages(task, start_addr, end_addr, pme);
+		ret = collect_pmd_huge_pages(task, start_addr, end_addr, pme,
+					     walk, buffer);
 		if (ret != COLLECT_PAGES_FAIL && !pme->nr_pages) {
-			if (ret == COLLECT_PAGES_FINISH) {
-				ret = 0;
-				up_read(&mm->mmap_sem);
-				goto finish;
-			}
+			if (ret == COLLECT_PAGES_FINISH)
+				return ret;
 			pme->is_huge_page = false;
 			page_size = PAGE_SIZE;
-			ret = collect_normal_pages(task, pme->virt_addr, end_addr, pme);
+			ret = collect_normal_pages(task, pme->virt_addr,
+						   end_addr, pme, walk, buffer);
 		}
 	}
-	up_read(&mm->mmap_sem);
-	if (ret == COLLECT_PAGES_FAIL) {
-		ret = -EFAULT;
-		goto finish;
-	}
+	if (ret == COLLECT_PAGES_FAIL)
+		return ret;
 
 	/* check for zero pages */
 	for (i = 0; i < pme->nr_pages; i++) {
@@ -764,6 +1002,45 @@ int pin_mem_area(struct task_struct *task, struct mm_struct *mm,
 			pme->phy_addr_array[i] = 0;
 	}
 
+	*next_addr = pme->virt_addr + pme->nr_pages * page_size;
+	return ret;
+}
+
+static int pin_mem_area_serial(struct task_struct *task, struct mm_struct *mm,
+		unsigned long start_addr, unsigned long end_addr)
+{
+	int pid, ret;
+	unsigned long nr_pages, flags;
+	unsigned long next_addr = end_addr;
+	struct page_map_entry *pme = NULL;
+	struct page_map_info *pmi;
+
+	pid = task->pid;
+	mutex_lock(&pmi_digest_mutex);
+	spin_lock_irqsave(&page_map_entry_lock, flags);
+	nr_pages = ((end_addr - start_addr) / PAGE_SIZE);
+	if ((unsigned long)page_map_entry_start +
+		nr_pages * sizeof(unsigned long) +
+		sizeof(struct page_map_entry) >= page_map_entry_end) {
+		pr_warn("Page map entry use up!\n");
+		ret = -ENOMEM;
+		goto finish;
+	}
+
+	pme = page_map_entry_start;
+	down_read(&mm->mmap_sem);
+	ret = collect_pme_pages(task, mm, start_addr, end_addr, pme,
+				pin_mem_pagewalk, pagemap_buffer, &next_addr);
+	up_read(&mm->mmap_sem);
+	if (ret == COLLECT_PAGES_FAIL) {
+		ret = -EFAULT;
+		goto finish;
+	}
+	if (ret == COLLECT_PAGES_FINISH && !pme->nr_pages) {
+		ret = 0;
+		goto finish;
+	}
+
 	page_map_entry_start = (struct page_map_entry *)(next_pme(pme));
 	pmi = get_page_map_info(pid);
 	if (!pmi)
@@ -777,17 +1054,336 @@ int pin_mem_area(struct task_struct *task, struct mm_struct *mm,
 		pmi->pme = pme;
 	pmi->entry_num++;
 	spin_unlock_irqrestore(&page_map_entry_lock, flags);
+	pmi_digest_update(pmi, pme, 1);
+	mutex_unlock(&pmi_digest_mutex);
 
 	if (ret == COLLECT_PAGES_NEED_CONTINUE)
-		ret = pin_mem_area(task, mm, pme->virt_addr + pme->nr_pages * page_size, end_addr);
+		ret = pin_mem_area_serial(task, mm, next_addr, end_addr);
 	return ret;
 
 finish:
 	if (ret)
 		free_pin_pages(pme);
 	spin_unlock_irqrestore(&page_map_entry_lock, flags);
+	mutex_unlock(&pmi_digest_mutex);
 	return ret;
 }
+
+#ifdef CONFIG_KTASK
+/*
+ * Large areas are split into PIN_MEM_CHUNK_SIZE chunks which are collected
+ * by ktask threads into private buffers, the buffers are then copied into
+ * the reserved page map entry space in address order.  Chunk boundaries
+ * are PMD aligned so that a huge page is never split between two chunks.
+ */
+#define PIN_MEM_CHUNK_SIZE	round_up(KTASK_MEM_CHUNK, HPAGE_PMD_SIZE)
+#define PIN_MEM_PARALLEL_MIN	(4 * PIN_MEM_CHUNK_SIZE)
+
+struct pin_mem_chunk {
+	void *buf;
+	unsigned long size;	/* bytes of page map entries in buf */
+	unsigned int entry_num;
+};
+
+struct pin_mem_collect_args {
+	struct task_struct *task;
+	struct mm_struct *mm;
+	unsigned long start_addr;
+	unsigned long end_addr;
+	struct pin_mem_chunk *chunks;
+	unsigned long chunks_per_node;
+	atomic64_t *node_time_ns;
+};
+
+static void free_pin_chunk(struct pin_mem_chunk *chunk)
+{
+	struct page_map_entry *pme = chunk->buf;
+	unsigned int i;
+
+	for (i = 0; i < chunk->entry_num; i++) {
+		free_pin_pages(pme);
+		pme = (struct page_map_entry *)next_pme(pme);
+	}
+	kvfree(chunk->buf);
+	chunk->buf = NULL;
+	chunk->entry_num = 0;
+	chunk->size = 0;
+}
+
+/* [start, end) of chunk @idx, chunks are counted from the PMD below start */
+static void pin_chunk_range(struct pin_mem_collect_args *args,
+		unsigned long idx, unsigned long *start, unsigned long *end)
+{
+	unsigned long base = args->start_addr & HPAGE_PMD_MASK;
+
+	*start = max(base + idx * PIN_MEM_CHUNK_SIZE, args->start_addr);
+	*end = min(base + (idx + 1) * PIN_MEM_CHUNK_SIZE, args->end_addr);
+}
+
+static int collect_pin_chunk(struct pin_mem_collect_args *args,
+		struct pin_mem_chunk *chunk, unsigned long start,
+		unsigned long end, void *walk, unsigned long *buffer)
+{
+	struct page_map_entry *pme;
+	unsigned long nr_pages, next_addr, buf_end;
+	int ret = COLLECT_PAGES_FINISH;
+
+	/*
+	 * The buffer is sized for this chunk only.  The type of mapping can
+	 * only change on a PMD boundary, so there is at most one entry per
+	 * PMD plus the partial ones at both ends.
+	 */
+	nr_pages = (end - start) >> PAGE_SHIFT;
+	chunk->size = nr_pages * sizeof(unsigned long) +
+		(nr_pages / HPAGE_PMD_NR + 2) * sizeof(struct page_map_entry);
+	chunk->buf = kvzalloc(chunk->size, GFP_KERNEL);
+	if (!chunk->buf)
+		return -ENOMEM;
+	buf_end = (unsigned long)chunk->buf + chunk->size;
+
+	pme = chunk->buf;
+	down_read(&args->mm->mmap_sem);
+	while (start < end) {
+		if ((unsigned long)(pme + 1) + ((end - start) >> PAGE_SHIFT) *
+		    sizeof(unsigned long) > buf_end) {
+			ret = COLLECT_PAGES_FAIL;
+			break;
+		}
+
+		next_addr = end;
+		ret = collect_pme_pages(args->task, args->mm, start, end, pme,
+					walk, buffer, &next_addr);
+		if (ret == COLLECT_PAGES_FAIL)
+			break;
+		if (pme->nr_pages) {
+			chunk->entry_num++;
+			pme = (struct page_map_entry *)next_pme(pme);
+		}
+		if (ret == COLLECT_PAGES_FINISH)
+			break;
+		if (next_addr <= start) {
+			pr_warn("Collect pages makes no progress at %lx.\n", start);
+			ret = COLLECT_PAGES_FAIL;
+			break;
+		}
+		start = next_addr;
+	}
+	up_read(&args->mm->mmap_sem);
+
+	chunk->size = (unsigned long)pme - (unsigned long)chunk->buf;
+	if (ret == COLLECT_PAGES_FAIL) {
+		free_pin_chunk(chunk);
+		return -EFAULT;
+	}
+	return 0;
+}
+
+static int collect_pin_chunks(unsigned long start_idx, unsigned long end_idx,
+		struct pin_mem_collect_args *args)
+{
+	unsigned long idx, start, end;
+	unsigned long *buffer;
+	void *walk;
+	u64 time;
+	int ret = 0;
+
+	walk = create_pagemap_walk();
+	buffer = kmalloc(((PMD_SIZE >> PAGE_SHIFT) + 1) *
+			 sizeof(unsigned long), GFP_KERNEL);
+	if (!walk || !buffer) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (idx = start_idx; idx < end_idx; idx++) {
+		time = ktime_get_ns();
+		pin_chunk_range(args, idx, &start, &end);
+		ret = collect_pin_chunk(args, &args->chunks[idx], start, end,
+					walk, buffer);
+		atomic64_add(ktime_get_ns() - time,
+			     &args->node_time_ns[idx / args->chunks_per_node]);
+		if (ret)
+			break;
+		cond_resched();
+	}
+
+out:
+	kfree(buffer);
+	free_pagemap_walk(walk);
+	return ret;
+}
+
+static int pin_mem_commit_chunks(int pid, struct pin_mem_chunk *chunks,
+		unsigned long nr_chunks)
+{
+	struct page_map_info *pmi = NULL;
+	struct page_map_entry *first = NULL;
+	unsigned long i, total = 0;
+	unsigned long flags;
+	unsigned int entry_num = 0;
+	int ret = 0;
+
+	for (i = 0; i < nr_chunks; i++)
+		total += chunks[i].size;
+	if (!total)
+		return 0;
+
+	mutex_lock(&pmi_digest_mutex);
+	spin_lock_irqsave(&page_map_entry_lock, flags);
+	if ((unsigned long)page_map_entry_start + total >= page_map_entry_end) {
+		pr_warn("Page map entry use up!\n");
+		ret = -ENOMEM;
+		goto unlock;
+	}
+
+	pmi = get_page_map_info(pid);
+	if (!pmi)
+		pmi = create_page_map_info(pid);
+	if (!pmi) {
+		pr_warn("Create page map info fail for pid: %d!\n", pid);
+		ret = -EFAULT;
+		goto unlock;
+	}
+
+	/* the chunks are copied back to back, hash them in one go below */
+	first = page_map_entry_start;
+	for (i = 0; i < nr_chunks; i++) {
+		if (!chunks[i].entry_num)
+			continue;
+		memcpy(page_map_entry_start, chunks[i].buf, chunks[i].size);
+		if (!pmi->pme)
+			pmi->pme = page_map_entry_start;
+		pmi->entry_num += chunks[i].entry_num;
+		entry_num += chunks[i].entry_num;
+		page_map_entry_start = (struct page_map_entry *)
+			((unsigned long)page_map_entry_start + chunks[i].size);
+	}
+unlock:
+	spin_unlock_irqrestore(&page_map_entry_lock, flags);
+	if (!ret)
+		pmi_digest_update(pmi, first, entry_num);
+	mutex_unlock(&pmi_digest_mutex);
+	return ret;
+}
+
+static int pin_mem_area_parallel(struct task_struct *task, struct mm_struct *mm,
+		unsigned long start_addr, unsigned long end_addr)
+{
+	struct pin_mem_collect_args args;
+	struct ktask_node *nodes;
+	unsigned long nr_chunks, i;
+	int nid, nr_nodes = 0;
+	u64 time;
+	int ret = -ENOMEM;
+	DEFINE_KTASK_CTL(ctl, collect_pin_chunks, &args, 1);
+
+	nr_chunks = DIV_ROUND_UP(end_addr - (start_addr & HPAGE_PMD_MASK),
+				 PIN_MEM_CHUNK_SIZE);
+	args.task = task;
+	args.mm = mm;
+	args.start_addr = start_addr;
+	args.end_addr = end_addr;
+	args.chunks_per_node = DIV_ROUND_UP(nr_chunks, num_online_nodes());
+	args.chunks = kvcalloc(nr_chunks, sizeof(struct pin_mem_chunk),
+			       GFP_KERNEL);
+	args.node_time_ns = kcalloc(nr_node_ids, sizeof(atomic64_t), GFP_KERNEL);
+	nodes = kcalloc(nr_node_ids, sizeof(struct ktask_node), GFP_KERNEL);
+	if (!args.chunks || !args.node_time_ns || !nodes)
+		goto out;
+
+	/*
+	 * Which node backs a virtual range is unknown until it is walked, so
+	 * hand out an equal share of the chunks to the threads of each node.
+	 */
+	for_each_online_node(nid) {
+		i = nr_nodes * args.chunks_per_node;
+		if (i >= nr_chunks)
+			break;
+		nodes[nr_nodes].kn_start = (void *)i;
+		nodes[nr_nodes].kn_task_size = min(args.chunks_per_node,
+						   nr_chunks - i);
+		nodes[nr_nodes].kn_nid = nid;
+		nr_nodes++;
+	}
+
+	time = ktime_get_ns();
+	ret = ktask_run_numa(nodes, nr_nodes, &ctl);
+	time = ktime_get_ns() - time;
+	if (!ret)
+		ret = pin_mem_commit_chunks(task->pid, args.chunks, nr_chunks);
+
+	/* per node timings, enable them through dynamic debug */
+	for (i = 0; i < nr_nodes; i++)
+		pr_debug("pid %d node %d: collected %lu chunks in %lld us\n",
+			 task->pid, nodes[i].kn_nid, nodes[i].kn_task_size,
+			 atomic64_read(&args.node_time_ns[i]) / NSEC_PER_USEC);
+	pr_debug("pid %d: collected %lx-%lx in %llu us, ret %d\n", task->pid,
+		 start_addr, end_addr, time / NSEC_PER_USEC, ret);
+
+	/* the buffers have been copied, only unpin the pages on failure */
+	for (i = 0; i < nr_chunks; i++) {
+		if (ret)
+			free_pin_chunk(&args.chunks[i]);
+		else
+			kvfree(args.chunks[i].buf);
+	}
+out:
+	kfree(nodes);
+	kfree(args.node_time_ns);
+	kvfree(args.chunks);
+	return ret;
+}
+#else
+#define PIN_MEM_PARALLEL_MIN	ULONG_MAX
+
+static inline int pin_mem_area_parallel(struct task_struct *task,
+		struct mm_struct *mm, unsigned long start_addr,
+		unsigned long end_addr)
+{
+	return -EINVAL;
+}
+#endif
+
+static bool pin_mem_area_has_pud_pages(struct mm_struct *mm,
+		unsigned long start_addr, unsigned long end_addr)
+{
+	struct vm_area_struct *vma;
+	bool ret = false;
+
+	down_read(&mm->mmap_sem);
+	for (vma = find_vma(mm, start_addr); vma && vma->vm_start < end_addr;
+	     vma = vma->vm_next) {
+		if (is_pud_hugetlb_vma(vma)) {
+			ret = true;
+			break;
+		}
+	}
+	up_read(&mm->mmap_sem);
+	return ret;
+}
+
+/*
+ * Users make sure that the pin memory belongs to anonymous vma or private
+ * hugetlb vma with huge pud pages.
+ */
+int pin_mem_area(struct task_struct *task, struct mm_struct *mm,
+		unsigned long start_addr, unsigned long end_addr)
+{
+	if (!page_map_entry_start
+		|| !task || !mm
+		|| start_addr >= end_addr || !pin_mem_pagewalk)
+		return -EFAULT;
+
+	/*
+	 * The chunks of the parallel path are smaller than a huge pud page,
+	 * areas with such pages only take one entry per page anyway.
+	 */
+	if (end_addr - start_addr >= PIN_MEM_PARALLEL_MIN &&
+	    !pin_mem_area_has_pud_pages(mm, start_addr, end_addr))
+		return pin_mem_area_parallel(task, mm, start_addr, end_addr);
+
+	return pin_mem_area_serial(task, mm, start_addr, end_addr);
+}
 EXPORT_SYMBOL_GPL(pin_mem_area);
 
 vm_fault_t remap_normal_pages(struct mm_struct *mm, struct vm_area_struct *vma,
@@ -951,6 +1547,44 @@ vm_fault_t remap_huge_pmd_pages(struct mm_struct *mm, struct vm_area_struct *vma
 	return ret;
 }
 
+static vm_fault_t remap_huge_pud_pages(struct mm_struct *mm, struct vm_area_struct *vma,
+		struct page_map_entry *pme)
+{
+	vm_fault_t ret;
+	unsigned int j, i;
+	struct page *page;
+	unsigned long address;
+	unsigned long phy_addr;
+
+	for (j = 0; j < pme->nr_pages; j++) {
+		address = pme->virt_addr + j * PUD_SIZE;
+		phy_addr = pme->phy_addr_array[j];
+		if (!phy_addr)
+			continue;
+
+		pme->phy_addr_array[j] = 0;
+		/* the page is consumed even if the remap fails */
+		ret = do_hugetlb_pud_page_remap(vma, address,
+						phys_to_page(phy_addr));
+		if (ret)
+			goto free;
+	}
+	return 0;
+
+free:
+	for (i = j + 1; i < pme->nr_pages; i++) {
+		phy_addr = pme->phy_addr_array[i];
+		if (phy_addr) {
+			page = phys_to_page(phy_addr);
+			if (!(page->flags & PAGE_FLAGS_CHECK_RESERVED)) {
+				free_pin_mem_pages(page, PIN_MEM_PUD_ORDER);
+				pme->phy_addr_array[i] = 0;
+			}
+		}
+	}
+	return ret;
+}
+
 static void free_unmap_pages(struct page_map_info *pmi,
 			struct page_map_entry *pme,
 			unsigned int index)
@@ -966,9 +1600,9 @@ static void free_unmap_pages(struct page_map_info *pmi,
 			phy_addr = pme->phy_addr_array[i];
 			if (phy_addr) {
 				page = phys_to_page(phy_addr);
-				order = pme->is_huge_page ? HPAGE_PMD_ORDER : 0;
+				order = pme_page_order(pme);
 				if (!(page->flags & PAGE_FLAGS_CHECK_RESERVED)) {
-					__free_pages(page, order);
+					free_pin_mem_pages(page, order);
 					pme->phy_addr_array[i] = 0;
 				}
 			}
@@ -991,18 +1625,33 @@ vm_fault_t do_mem_remap(int pid, struct mm_struct *mm)
 
 	spin_lock_irqsave(&page_map_entry_lock, flags);
 	pmi = get_page_map_info(pid);
-	if (pmi)
-		pmi->disable_free_page = true;
 	spin_unlock_irqrestore(&page_map_entry_lock, flags);
 	if (!pmi)
 		return -EFAULT;
 
+	/* only verify the entries of the pid which is actually remapped */
+	if (check_pmi_digest(pmi))
+		return -EFAULT;
+
+	spin_lock_irqsave(&page_map_entry_lock, flags);
+	pmi->disable_free_page = true;
+	spin_unlock_irqrestore(&page_map_entry_lock, flags);
+
 	down_write(&mm->mmap_sem);
 	pme = pmi->pme;
 	vma = mm->mmap;
 	while ((i < pmi->entry_num) && (vma != NULL)) {
 		if (pme->virt_addr >= vma->vm_start && pme->virt_addr < vma->vm_end) {
 			i++;
+			if (pme->is_huge_page == PIN_MEM_PUD_PAGE) {
+				if (is_pud_hugetlb_vma(vma)) {
+					ret = remap_huge_pud_pages(mm, vma, pme);
+					if (ret)
+						goto free;
+				}
+				pme = (struct page_map_entry *)(next_pme(pme));
+				continue;
+			}
 			if (!vma_is_anonymous(vma)) {
 				pme = (struct page_map_entry *)(next_pme(pme));
 				continue;
@@ -1065,12 +1714,12 @@ static void free_all_reserved_pages(void)
 		pme = pmi->pme;
 		for (i = 0; i < pmi->entry_num; i++) {
 			for (j = 0; j < pme->nr_pages; j++) {
-				order = pme->is_huge_page ? HPAGE_PMD_ORDER : 0;
+				order = pme_page_order(pme);
 				phy_addr = pme->phy_addr_array[j];
 				if (phy_addr) {
 					page = phys_to_page(phy_addr);
 					if (!(page->flags & PAGE_FLAGS_CHECK_RESERVED)) {
-						__free_pages(page, order);
+						free_pin_mem_pages(page, order);
 						pme->phy_addr_array[j] = 0;
 					}
 				}
@@ -165,6 +165,7 @@ unsigned int __do_page_cache_readahead(struct address_space *mapping,
 	unsigned int nr_pages = 0;
 	loff_t isize = i_size_read(inode);
 	gfp_t gfp_mask = readahead_gfp_mask(mapping);
+	gfp_t page_gfp;
 
 	if (isize == 0)
 		goto out;
@@ -196,7 +197,9 @@ unsigned int __do_page_cache_readahead(struct address_space *mapping,
 			continue;
 		}
 
-		page = __page_cache_alloc(gfp_mask);
+		page_gfp = gfp_mask;
+		page_cache_reliable_hint(mapping, page, &page_gfp);
+		page = __page_cache_alloc(page_gfp);
 		if (!page)
 			break;
 		page->index = page_offset;
@@ -407,10 +410,14 @@ ondemand_readahead(struct address_space *mapping,
 
 	/*
 	 * It's the expected callback offset, assume sequential access.
-	 * Ramp up sizes, and push forward the readahead window.
+	 * Ramp up sizes, and push forward the readahead window.  Once a
+	 * stream has filled ra_pages, keep ramping up to the optimal
+	 * hardware IO size.
 	 */
 	if ((offset == (ra->start + ra->size - ra->async_size) ||
 	     offset == (ra->start + ra->size))) {
+		if (ra->size >= ra->ra_pages && bdi->io_pages > max_pages)
+			max_pages = bdi->io_pages;
 		ra->start += ra->size;
 		ra->size = get_next_ra_size(ra, max_pages);
 		ra->async_size = ra->size;
@@ -48,7 +48,9 @@
 #include <linux/swapops.h>
 #include <linux/mmzone.h>
 #include <linux/timekeeping.h>
+#include <linux/sched/clock.h>
 #include <linux/time64.h>
+#include <linux/percpu.h>
 
 /* access control mode macros  */
 #define AC_NONE			0
@@ -95,6 +97,9 @@ int sysctl_sp_perf_alloc;
 
 int sysctl_sp_perf_k2u;
 
+/* sample the hold time of the sp_mapping locks for spa_stat */
+int sysctl_sp_lock_stat;
+
 static int system_group_count;
 
 static unsigned int sp_device_number;
@@ -132,7 +137,23 @@ static struct sp_proc_stat kthread_stat;
 
 #define SP_MAPPING_DVPP		0x1
 #define SP_MAPPING_NORMAL	0x2
-static struct sp_mapping *sp_mapping_normal;
+
+/*
+ * The normal region is shared by all groups, and split into one mapping
+ * per node so that allocations on different nodes don't serialize on a
+ * single rbtree. spg->normal points to the mapping of node 0 and stands
+ * for the whole region, sp_mapping_normal_of() picks the actual one.
+ */
+static struct sp_mapping *sp_mapping_normal[MAX_NUMNODES];
+static unsigned long sp_mapping_normal_size;
+
+static struct sp_mapping *sp_mapping_normal_of(unsigned long addr)
+{
+	unsigned long nid;
+
+	nid = (addr - MMAP_SHARE_POOL_START) / sp_mapping_normal_size;
+	return sp_mapping_normal[min(nid, (unsigned long)nr_node_ids - 1)];
+}
 
 static void sp_mapping_range_init(struct sp_mapping *spm)
 {
@@ -167,12 +188,38 @@ static struct sp_mapping *sp_mapping_create(unsigned long flag)
 	spm->flag = flag;
 	sp_mapping_range_init(spm);
 	atomic_set(&spm->user, 0);
+	spin_lock_init(&spm->lock);
 	spm->area_root = RB_ROOT;
 	INIT_LIST_HEAD(&spm->group_head);
 
 	return spm;
 }
 
+/*
+ * The VA rbtree and the free area cache of a mapping are protected by
+ * spm->lock, so that hole searching in different mappings doesn't
+ * serialize. The lock order is spg->spa_lock -> spm->lock.
+ */
+static inline u64 sp_mapping_lock(struct sp_mapping *spm)
+{
+	spin_lock(&spm->lock);
+	return READ_ONCE(sysctl_sp_lock_stat) ? sched_clock() : 0;
+}
+
+static inline void sp_mapping_unlock(struct sp_mapping *spm, u64 start)
+{
+	u64 delta;
+
+	if (start) {
+		delta = sched_clock() - start;
+		spm->lock_count++;
+		spm->lock_hold_ns += delta;
+		if (delta > spm->lock_hold_max_ns)
+			spm->lock_hold_max_ns = delta;
+	}
+	spin_unlock(&spm->lock);
+}
+
 static void sp_mapping_destroy(struct sp_mapping *spm)
 {
 	kfree(spm);
@@ -274,7 +321,7 @@ static int sp_mapping_group_setup(struct mm_struct *mm, struct sp_group *spg)
 			/* the mapping of local group is always set */
 			sp_mapping_attach(spg, local->dvpp);
 		if (!spg->normal)
-			sp_mapping_attach(spg, sp_mapping_normal);
+			sp_mapping_attach(spg, sp_mapping_normal[0]);
 	}
 
 	return 0;
@@ -312,7 +359,7 @@ static int init_local_group(struct mm_struct *mm)
 		goto free_spg;
 	}
 	sp_mapping_attach(master->local, spm);
-	sp_mapping_attach(master->local, sp_mapping_normal);
+	sp_mapping_attach(master->local, sp_mapping_normal[0]);
 
 	ret = local_group_add_task(mm, spg);
 	if (ret < 0)
@@ -446,6 +493,8 @@ static struct sp_proc_stat *create_proc_stat(struct mm_struct *mm,
 	atomic_set(&stat->use_count, 1);
 	atomic64_set(&stat->alloc_size, 0);
 	atomic64_set(&stat->k2u_size, 0);
+	atomic64_set(&stat->lazy_num, 0);
+	atomic64_set(&stat->lazy_size, 0);
 	stat->tgid = tsk->tgid;
 	stat->mm = mm;
 	mutex_init(&stat->lock);
@@ -670,7 +719,7 @@ static void free_spg_stat(int spg_id)
 	kfree(stat);
 }
 
-/* statistics of all sp area, protected by sp_area_lock */
+/* statistics of all sp area, per cpu and summed up on show */
 struct sp_spa_stat {
 	unsigned int total_num;
 	unsigned int alloc_num;
@@ -684,7 +733,7 @@ struct sp_spa_stat {
 	unsigned long dvpp_va_size;
 };
 
-static struct sp_spa_stat spa_stat;
+static DEFINE_PER_CPU(struct sp_spa_stat, spa_stat);
 
 /* statistics of all sp group born from sp_alloc and k2u(spg) */
 struct sp_overall_stat {
@@ -728,7 +777,6 @@ struct sp_area {
 	int node_id;			/* memory node */
 	int device_id;
 };
-static DEFINE_SPINLOCK(sp_area_lock);
 
 static unsigned long spa_size(struct sp_area *spa)
 {
@@ -743,7 +791,6 @@ static struct file *spa_file(struct sp_area *spa)
 		return spa->spg->file;
 }
 
-/* the caller should hold sp_area_lock */
 static void spa_inc_usage(struct sp_area *spa)
 {
 	enum spa_type type = spa->type;
@@ -753,18 +800,18 @@ static void spa_inc_usage(struct sp_area *spa)
 
 	switch (type) {
 	case SPA_TYPE_ALLOC:
-		spa_stat.alloc_num += 1;
-		spa_stat.alloc_size += size;
+		this_cpu_add(spa_stat.alloc_num, 1);
+		this_cpu_add(spa_stat.alloc_size, size);
 		update_spg_stat_alloc(size, true, is_huge, spa->spg->stat);
 		break;
 	case SPA_TYPE_K2TASK:
-		spa_stat.k2u_task_num += 1;
-		spa_stat.k2u_task_size += size;
+		this_cpu_add(spa_stat.k2u_task_num, 1);
+		this_cpu_add(spa_stat.k2u_task_size, size);
 		update_spg_stat_k2u(size, true, spa->spg->stat);
 		break;
 	case SPA_TYPE_K2SPG:
-		spa_stat.k2u_spg_num += 1;
-		spa_stat.k2u_spg_size += size;
+		this_cpu_add(spa_stat.k2u_spg_num, 1);
+		this_cpu_add(spa_stat.k2u_spg_size, size);
 		update_spg_stat_k2u(size, true, spa->spg->stat);
 		break;
 	default:
@@ -772,16 +819,16 @@ static void spa_inc_usage(struct sp_area *spa)
 	}
 
 	if (is_dvpp) {
-		spa_stat.dvpp_size += size;
-		spa_stat.dvpp_va_size += PMD_ALIGN(size);
+		this_cpu_add(spa_stat.dvpp_size, size);
+		this_cpu_add(spa_stat.dvpp_va_size, PMD_ALIGN(size));
 	}
 
 	/*
 	 * all the calculations won't overflow due to system limitation and
 	 * parameter checking in sp_alloc_area()
 	 */
-	spa_stat.total_num += 1;
-	spa_stat.total_size += size;
+	this_cpu_add(spa_stat.total_num, 1);
+	this_cpu_add(spa_stat.total_size, size);
 
 	if (!is_local_group(spa->spg->id)) {
 		atomic_inc(&sp_overall_stat.spa_total_num);
@@ -789,7 +836,6 @@ static void spa_inc_usage(struct sp_area *spa)
 	}
 }
 
-/* the caller should hold sp_area_lock */
 static void spa_dec_usage(struct sp_area *spa)
 {
 	enum spa_type type = spa->type;
@@ -799,18 +845,18 @@ static void spa_dec_usage(struct sp_area *spa)
 
 	switch (type) {
 	case SPA_TYPE_ALLOC:
-		spa_stat.alloc_num -= 1;
-		spa_stat.alloc_size -= size;
+		this_cpu_sub(spa_stat.alloc_num, 1);
+		this_cpu_sub(spa_stat.alloc_size, size);
 		update_spg_stat_alloc(size, false, is_huge, spa->spg->stat);
 		break;
 	case SPA_TYPE_K2TASK:
-		spa_stat.k2u_task_num -= 1;
-		spa_stat.k2u_task_size -= size;
+		this_cpu_sub(spa_stat.k2u_task_num, 1);
+		this_cpu_sub(spa_stat.k2u_task_size, size);
 		update_spg_stat_k2u(size, false, spa->spg->stat);
 		break;
 	case SPA_TYPE_K2SPG:
-		spa_stat.k2u_spg_num -= 1;
-		spa_stat.k2u_spg_size -= size;
+		this_cpu_sub(spa_stat.k2u_spg_num, 1);
+		this_cpu_sub(spa_stat.k2u_spg_size, size);
 		update_spg_stat_k2u(size, false, spa->spg->stat);
 		break;
 	default:
@@ -818,12 +864,12 @@ static void spa_dec_usage(struct sp_area *spa)
 	}
 
 	if (is_dvpp) {
-		spa_stat.dvpp_size -= size;
-		spa_stat.dvpp_va_size -= PMD_ALIGN(size);
+		this_cpu_sub(spa_stat.dvpp_size, size);
+		this_cpu_sub(spa_stat.dvpp_va_size, PMD_ALIGN(size));
 	}
 
-	spa_stat.total_num -= 1;
-	spa_stat.total_size -= size;
+	this_cpu_sub(spa_stat.total_num, 1);
+	this_cpu_sub(spa_stat.total_size, size);
 
 	if (!is_local_group(spa->spg->id)) {
 		atomic_dec(&sp_overall_stat.spa_total_num);
@@ -1187,6 +1233,7 @@ static struct sp_group *create_spg(int spg_id, unsigned long flag)
 	atomic_set(&spg->use_count, 1);
 	INIT_LIST_HEAD(&spg->procs);
 	INIT_LIST_HEAD(&spg->spa_list);
+	spin_lock_init(&spg->spa_lock);
 	INIT_LIST_HEAD(&spg->mnode);
 	init_rwsem(&spg->rw_lock);
 
@@ -1259,7 +1306,7 @@ static void sp_munmap_task_areas(struct mm_struct *mm, struct sp_group *spg, str
 	int err;
 
 
-	spin_lock(&sp_area_lock);
+	spin_lock(&spg->spa_lock);
 	list_for_each_entry(spa, &spg->spa_list, link) {
 		if (&spa->link == stop)
 			break;
@@ -1268,7 +1315,7 @@ static void sp_munmap_task_areas(struct mm_struct *mm, struct sp_group *spg, str
 		prev = spa;
 
 		atomic_inc(&spa->use_count);
-		spin_unlock(&sp_area_lock);
+		spin_unlock(&spg->spa_lock);
 
 		err = do_munmap(mm, spa->va_start, spa_size(spa), NULL);
 		if (err) {
@@ -1277,11 +1324,11 @@ static void sp_munmap_task_areas(struct mm_struct *mm, struct sp_group *spg, str
 			       (void *)spa->va_start);
 		}
 
-		spin_lock(&sp_area_lock);
+		spin_lock(&spg->spa_lock);
 	}
 	__sp_area_drop_locked(prev);
 
-	spin_unlock(&sp_area_lock);
+	spin_unlock(&spg->spa_lock);
 }
 
 /* the caller must hold sp_group_sem */
@@ -1548,7 +1595,7 @@ int mg_sp_group_add_task(int pid, unsigned long prot, int spg_id)
 	 * create mappings of existing shared memory segments into this
 	 * new process' page table.
 	 */
-	spin_lock(&sp_area_lock);
+	spin_lock(&spg->spa_lock);
 
 	list_for_each_entry(spa, &spg->spa_list, link) {
 		unsigned long populate = 0;
@@ -1563,14 +1610,14 @@ int mg_sp_group_add_task(int pid, unsigned long prot, int spg_id)
 		if (spa->is_dead == true)
 			continue;
 
-		spin_unlock(&sp_area_lock);
+		spin_unlock(&spg->spa_lock);
 
 		if (spa->type == SPA_TYPE_K2SPG && spa->kva) {
 			addr = sp_remap_kva_to_vma(spa->kva, spa, mm, prot, NULL);
 			if (IS_ERR_VALUE(addr))
 				pr_warn("add group remap k2u failed %ld\n", addr);
 
-			spin_lock(&sp_area_lock);
+			spin_lock(&spg->spa_lock);
 			continue;
 		}
 
@@ -1580,7 +1627,7 @@ int mg_sp_group_add_task(int pid, unsigned long prot, int spg_id)
 			up_write(&mm->mmap_sem);
 			ret = -EBUSY;
 			pr_err("add group: encountered coredump, abort\n");
-			spin_lock(&sp_area_lock);
+			spin_lock(&spg->spa_lock);
 			break;
 		}
 
@@ -1590,7 +1637,7 @@ int mg_sp_group_add_task(int pid, unsigned long prot, int spg_id)
 			up_write(&mm->mmap_sem);
 			ret = addr;
 			pr_err("add group: sp mmap failed %d\n", ret);
-			spin_lock(&sp_area_lock);
+			spin_lock(&spg->spa_lock);
 			break;
 		}
 		up_write(&mm->mmap_sem);
@@ -1607,15 +1654,15 @@ int mg_sp_group_add_task(int pid, unsigned long prot, int spg_id)
 				down_write(&mm->mmap_sem);
 				sp_munmap_task_areas(mm, spg, spa->link.next);
 				up_write(&mm->mmap_sem);
-				spin_lock(&sp_area_lock);
+				spin_lock(&spg->spa_lock);
 				break;
 			}
 		}
 
-		spin_lock(&sp_area_lock);
+		spin_lock(&spg->spa_lock);
 	}
 	__sp_area_drop_locked(prev);
-	spin_unlock(&sp_area_lock);
+	spin_unlock(&spg->spa_lock);
 
 	if (unlikely(ret))
 		delete_spg_node(spg, node);
@@ -1818,7 +1865,7 @@ int mg_sp_id_of_current(void)
 }
 EXPORT_SYMBOL_GPL(mg_sp_id_of_current);
 
-/* the caller must hold sp_area_lock */
+/* the caller must hold spm->lock */
 static void __insert_sp_area(struct sp_mapping *spm, struct sp_area *spa)
 {
 	struct rb_node **p = &spm->area_root.rb_node;
@@ -1841,54 +1888,21 @@ static void __insert_sp_area(struct sp_mapping *spm, struct sp_area *spa)
 	rb_insert_color(&spa->rb_node, &spm->area_root);
 }
 
-/**
- * sp_alloc_area() - Allocate a region of VA from the share pool.
- * @size: the size of VA to allocate.
- * @flags: how to allocate the memory.
- * @spg: the share group that the memory is allocated to.
- * @type: the type of the region.
- * @applier: the pid of the task which allocates the region.
- *
- * Return: a valid pointer for success, NULL on failure.
+/*
+ * Find a hole of @size_align in [@vstart, @vend) of @mapping and insert
+ * @spa there. Return 0 on success.
  */
-static struct sp_area *sp_alloc_area(unsigned long size, unsigned long flags,
-				     struct sp_group *spg, enum spa_type type,
-				     pid_t applier)
+static int sp_mapping_alloc_area(struct sp_mapping *mapping,
+				 struct sp_area *spa, unsigned long size_align,
+				 unsigned long vstart, unsigned long vend)
 {
-	struct sp_area *spa, *first, *err;
+	struct sp_area *first;
 	struct rb_node *n;
-	unsigned long vstart;
-	unsigned long vend;
+	u64 lock_start;
 	unsigned long addr;
-	unsigned long size_align = PMD_ALIGN(size); /* va aligned to 2M */
-	int device_id, node_id;
-	struct sp_mapping *mapping;
+	int err = -EOVERFLOW;
 
-	device_id = sp_flags_device_id(flags);
-	node_id = flags & SP_SPEC_NODE_ID ? sp_flags_node_id(flags) : device_id;
-
-	if (!is_online_node_id(node_id)) {
-		pr_err_ratelimited("invalid numa node id %d\n", node_id);
-		return ERR_PTR(-EINVAL);
-	}
-
-	if (flags & SP_DVPP)
-		mapping = spg->dvpp;
-	else
-		mapping = spg->normal;
-
-	if (!mapping) {
-		pr_err_ratelimited("non DVPP spg, id %d\n", spg->id);
-		return ERR_PTR(-EINVAL);
-	}
-
-	vstart = mapping->start[device_id];
-	vend = mapping->end[device_id];
-	spa = __kmalloc_node(sizeof(struct sp_area), GFP_KERNEL, node_id);
-	if (unlikely(!spa))
-		return ERR_PTR(-ENOMEM);
-
-	spin_lock(&sp_area_lock);
+	lock_start = sp_mapping_lock(mapping);
 
 	/*
 	 * Invalidate cache if we have more permissive parameters.
@@ -1914,16 +1928,12 @@ static struct sp_area *sp_alloc_area(unsigned long size, unsigned long flags,
 		first = rb_entry(mapping->free_area_cache, struct sp_area,
 				 rb_node);
 		addr = first->va_end;
-		if (addr + size_align < addr) {
-			err = ERR_PTR(-EOVERFLOW);
-			goto error;
-		}
+		if (addr + size_align < addr)
+			goto out;
 	} else {
 		addr = vstart;
-		if (addr + size_align < addr) {
-			err = ERR_PTR(-EOVERFLOW);
-			goto error;
-		}
+		if (addr + size_align < addr)
+			goto out;
 
 		n = mapping->area_root.rb_node;
 		first = NULL;
@@ -1949,10 +1959,8 @@ static struct sp_area *sp_alloc_area(unsigned long size, unsigned long flags,
 		if (addr + mapping->cached_hole_size < first->va_start)
 			mapping->cached_hole_size = first->va_start - addr;
 		addr = first->va_end;
-		if (addr + size_align < addr) {
-			err = ERR_PTR(-EOVERFLOW);
-			goto error;
-		}
+		if (addr + size_align < addr)
+			goto out;
 
 		n = rb_next(&first->rb_node);
 		if (n)
@@ -1962,20 +1970,93 @@ static struct sp_area *sp_alloc_area(unsigned long size, unsigned long flags,
 	}
 
 found:
-	if (addr + size_align > vend) {
-		err = ERR_PTR(-EOVERFLOW);
-		goto error;
-	}
+	if (addr + size_align > vend)
+		goto out;
 
 	spa->va_start = addr;
 	spa->va_end = addr + size_align;
-	spa->real_size = size;
 	spa->region_vstart = vstart;
+
+	__insert_sp_area(mapping, spa);
+	mapping->free_area_cache = &spa->rb_node;
+	err = 0;
+out:
+	sp_mapping_unlock(mapping, lock_start);
+	return err;
+}
+
+/*
+ * Allocate from the normal mapping of @nid, and fall back to the other
+ * nodes when it is full.
+ */
+static int sp_normal_alloc_area(struct sp_area *spa, unsigned long size_align,
+				int nid)
+{
+	struct sp_mapping *spm;
+	int i, err = -EOVERFLOW;
+
+	for (i = 0; i < nr_node_ids && err == -EOVERFLOW; i++) {
+		spm = sp_mapping_normal[(nid + i) % nr_node_ids];
+		err = sp_mapping_alloc_area(spm, spa, size_align,
+					    spm->start[0], spm->end[0]);
+	}
+
+	return err;
+}
+
+/**
+ * sp_alloc_area() - Allocate a region of VA from the share pool.
+ * @size: the size of VA to allocate.
+ * @flags: how to allocate the memory.
+ * @spg: the share group that the memory is allocated to.
+ * @type: the type of the region.
+ * @applier: the pid of the task which allocates the region.
+ *
+ * Return: a valid pointer for success, NULL on failure.
+ */
+static struct sp_area *sp_alloc_area(unsigned long size, unsigned long flags,
+				     struct sp_group *spg, enum spa_type type,
+				     pid_t applier)
+{
+	struct sp_area *spa;
+	unsigned long size_align = PMD_ALIGN(size); /* va aligned to 2M */
+	int device_id, node_id;
+	struct sp_mapping *mapping;
+	int err;
+
+	device_id = sp_flags_device_id(flags);
+	node_id = flags & SP_SPEC_NODE_ID ? sp_flags_node_id(flags) : device_id;
+
+	if (!is_online_node_id(node_id)) {
+		pr_err_ratelimited("invalid numa node id %d\n", node_id);
+		return ERR_PTR(-EINVAL);
+	}
+
+	if (flags & SP_DVPP)
+		mapping = spg->dvpp;
+	else
+		mapping = spg->normal;
+
+	if (!mapping) {
+		pr_err_ratelimited("non DVPP spg, id %d\n", spg->id);
+		return ERR_PTR(-EINVAL);
+	}
+
+	spa = __kmalloc_node(sizeof(struct sp_area), GFP_KERNEL, node_id);
+	if (unlikely(!spa))
+		return ERR_PTR(-ENOMEM);
+
+	/*
+	 * The spa is visible in the rbtree once inserted, but lookups take
+	 * it with atomic_inc_not_zero() only, so it stays unused until it
+	 * is linked to the group below.
+	 */
+	spa->real_size = size;
 	spa->flags = flags;
 	spa->is_hugepage = (flags & SP_HUGEPAGE);
 	spa->is_dead = false;
 	spa->spg = spg;
-	atomic_set(&spa->use_count, 1);
+	atomic_set(&spa->use_count, 0);
 	spa->type = type;
 	spa->mm = NULL;
 	spa->kva = 0;   /* NULL pointer */
@@ -1983,57 +2064,67 @@ static struct sp_area *sp_alloc_area(unsigned long size, unsigned long flags,
 	spa->node_id = node_id;
 	spa->device_id = device_id;
 
+	if (flags & SP_DVPP)
+		err = sp_mapping_alloc_area(mapping, spa, size_align,
+					    mapping->start[device_id],
+					    mapping->end[device_id]);
+	else
+		/* without a node given, spread by the allocating cpu */
+		err = sp_normal_alloc_area(spa, size_align,
+					   flags & SP_SPEC_NODE_ID ?
+					   node_id : numa_node_id());
+	if (err) {
+		kfree(spa);
+		return ERR_PTR(err);
+	}
+
 	spa_inc_usage(spa);
-	__insert_sp_area(mapping, spa);
-	mapping->free_area_cache = &spa->rb_node;
+	spin_lock(&spg->spa_lock);
+	atomic_set(&spa->use_count, 1);
 	list_add_tail(&spa->link, &spg->spa_list);
-
-	spin_unlock(&sp_area_lock);
+	spin_unlock(&spg->spa_lock);
 
 	return spa;
-
-error:
-	spin_unlock(&sp_area_lock);
-	kfree(spa);
-	return err;
 }
 
-/* the caller should hold sp_area_lock */
-static struct sp_area *__find_sp_area_locked(struct sp_group *spg,
-		unsigned long addr)
+static struct sp_mapping *sp_mapping_of(struct sp_group *spg,
+					unsigned long addr)
 {
-	struct rb_node *n;
-
 	if (addr >= MMAP_SHARE_POOL_START && addr < MMAP_SHARE_POOL_16G_START)
-		n = spg->normal->area_root.rb_node;
+		return sp_mapping_normal_of(addr);
 	else
-		n = spg->dvpp->area_root.rb_node;
+		return spg->dvpp;
+}
 
-	while (n) {
-		struct sp_area *spa;
+/*
+ * Take a reference on the spa starting at @addr. A spa whose use_count
+ * already dropped to zero is being freed and isn't found.
+ */
+static struct sp_area *__find_sp_area(struct sp_group *spg, unsigned long addr)
+{
+	struct sp_mapping *spm = sp_mapping_of(spg, addr);
+	struct sp_area *spa = NULL;
+	struct rb_node *n;
+	u64 lock_start;
 
+	lock_start = sp_mapping_lock(spm);
+	n = spm->area_root.rb_node;
+	while (n) {
 		spa = rb_entry(n, struct sp_area, rb_node);
 		if (addr < spa->va_start) {
 			n = n->rb_left;
 		} else if (addr > spa->va_start) {
 			n = n->rb_right;
 		} else {
-			return spa;
+			break;
 		}
+		spa = NULL;
 	}
+	if (spa && !atomic_inc_not_zero(&spa->use_count))
+		spa = NULL;
+	sp_mapping_unlock(spm, lock_start);
 
-	return NULL;
-}
-
-static struct sp_area *__find_sp_area(struct sp_group *spg, unsigned long addr)
-{
-	struct sp_area *n;
-	spin_lock(&sp_area_lock);
-	n = __find_sp_area_locked(spg, addr);
-	if (n)
-		atomic_inc(&n->use_count);
-	spin_unlock(&sp_area_lock);
-	return n;
+	return spa;
 }
 
 static bool vmalloc_area_clr_flag(unsigned long kva, unsigned long flags)
@@ -2054,16 +2145,20 @@ static bool vmalloc_area_clr_flag(unsigned long kva, unsigned long flags)
  */
 static void sp_free_area(struct sp_area *spa)
 {
-	unsigned long addr = spa->va_start;
-	struct sp_mapping *spm;
+	struct sp_mapping *spm = sp_mapping_of(spa->spg, spa->va_start);
+	u64 lock_start;
 
-	lockdep_assert_held(&sp_area_lock);
+	lockdep_assert_held(&spa->spg->spa_lock);
 
-	if (addr >= MMAP_SHARE_POOL_START && addr < MMAP_SHARE_POOL_16G_START)
-		spm = spa->spg->normal;
-	else
-		spm = spa->spg->dvpp;
+	if (spa->kva) {
+		if (!vmalloc_area_clr_flag(spa->kva, VM_SHAREPOOL))
+			pr_debug("clear spa->kva %ld is not valid\n", spa->kva);
+	}
+
+	spa_dec_usage(spa);
+	list_del(&spa->link);
 
+	lock_start = sp_mapping_lock(spm);
 	if (spm->free_area_cache) {
 		struct sp_area *cache;
 		cache = rb_entry(spm->free_area_cache, struct sp_area, rb_node);
@@ -2085,19 +2180,13 @@ static void sp_free_area(struct sp_area *spa)
 		}
 	}
 
-	if (spa->kva) {
-		if (!vmalloc_area_clr_flag(spa->kva, VM_SHAREPOOL))
-			pr_debug("clear spa->kva %ld is not valid\n", spa->kva);
-	}
-
-	spa_dec_usage(spa);
-	list_del(&spa->link);
-
 	rb_erase(&spa->rb_node, &spm->area_root);
 	RB_CLEAR_NODE(&spa->rb_node);
+	sp_mapping_unlock(spm, lock_start);
 	kfree(spa);
 }
 
+/* the caller should hold spa->spg->spa_lock */
 static void __sp_area_drop_locked(struct sp_area *spa)
 {
 	/*
@@ -2115,9 +2204,15 @@ static void __sp_area_drop_locked(struct sp_area *spa)
 
 static void __sp_area_drop(struct sp_area *spa)
 {
-	spin_lock(&sp_area_lock);
+	struct sp_group *spg;
+
+	if (!spa)
+		return;
+
+	spg = spa->spg;
+	spin_lock(&spg->spa_lock);
 	__sp_area_drop_locked(spa);
-	spin_unlock(&sp_area_lock);
+	spin_unlock(&spg->spa_lock);
 }
 
 void sp_area_drop(struct vm_area_struct *vma)
@@ -2129,12 +2224,10 @@ void sp_area_drop(struct vm_area_struct *vma)
 	 * Considering a situation where task A and B are in the same spg.
 	 * A is exiting and calling remove_vma() -> ... -> sp_area_drop().
 	 * Concurrently, B is calling sp_free() to free the same spa.
-	 * __find_sp_area_locked() and __sp_area_drop_locked() should be
-	 * an atomic operation.
+	 * __find_sp_area() only takes a reference while use_count is not
+	 * zero, so it never revives a spa that is being dropped here.
 	 */
-	spin_lock(&sp_area_lock);
-	__sp_area_drop_locked(vma->vm_private_data);
-	spin_unlock(&sp_area_lock);
+	__sp_area_drop(vma->vm_private_data);
 }
 
 int sysctl_sp_compact_enable;
@@ -2394,6 +2487,105 @@ int mg_sp_free(unsigned long addr, int id)
 }
 EXPORT_SYMBOL_GPL(mg_sp_free);
 
+/* unmap areas of the same group with one mmap_sem acquisition per process */
+static void sp_free_batch_unmap_fallocate(struct sp_area **spas, int nr)
+{
+	struct sp_group *spg = spas[0]->spg;
+	struct sp_group_node *spg_node;
+	struct mm_struct *mm;
+	int i, err;
+
+	down_read(&spg->rw_lock);
+	list_for_each_entry(spg_node, &spg->procs, proc_node) {
+		mm = spg_node->master->mm;
+
+		down_write(&mm->mmap_sem);
+		if (unlikely(mm->core_state)) {
+			up_write(&mm->mmap_sem);
+			pr_info("munmap: encoutered coredump\n");
+			continue;
+		}
+
+		for (i = 0; i < nr; i++) {
+			err = do_munmap(mm, spas[i]->va_start,
+					spa_size(spas[i]), NULL);
+			/* we are not supposed to fail */
+			if (err)
+				pr_err("failed to unmap VA %pK when sp free batch\n",
+				       (void *)spas[i]->va_start);
+		}
+		up_write(&mm->mmap_sem);
+	}
+
+	for (i = 0; i < nr; i++)
+		sp_fallocate(spas[i]);
+	up_read(&spg->rw_lock);
+}
+
+/**
+ * sp_free_batch() - Free several areas allocated by sp_alloc() at once.
+ * @addrs: the starting VA of each area.
+ * @nr: the number of areas, no more than SP_BATCH_MAX.
+ * @id: Address space identifier, shared by all the areas.
+ *
+ * The mmap_sem of each group member is taken only once to unmap all the
+ * areas belonging to the group. If an address is invalid, the areas before
+ * it are still freed.
+ *
+ * Return: 0 on success, or the error of the first invalid address.
+ */
+int sp_free_batch(unsigned long *addrs, int nr, int id)
+{
+	struct sp_free_context fc;
+	struct sp_area **spas;
+	int i, j, n = 0, ret = 0;
+
+	check_interrupt_context();
+
+	if (current->flags & PF_KTHREAD)
+		return -EINVAL;
+
+	if (nr <= 0 || nr > SP_BATCH_MAX)
+		return -EINVAL;
+
+	spas = kcalloc(nr, sizeof(*spas), GFP_KERNEL);
+	if (!spas)
+		return -ENOMEM;
+
+	for (i = 0; i < nr; i++) {
+		fc.addr = addrs[i];
+		fc.spa = NULL;
+		fc.spg_id = id;
+		ret = sp_free_get_spa(&fc);
+		if (ret)
+			break;
+		if (fc.state != FREE_END)
+			spas[n++] = fc.spa;
+	}
+
+	/* areas found by the same id may still belong to different groups */
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && spas[j]->spg == spas[i]->spg; j++)
+			;
+		sp_free_batch_unmap_fallocate(&spas[i], j - i);
+	}
+
+	for (i = 0; i < n; i++) {
+		/* current->mm == NULL: allow kthread */
+		if (current->mm == NULL)
+			atomic64_sub(spas[i]->real_size, &kthread_stat.alloc_size);
+		else
+			sp_update_process_stat(current, false, spas[i]);
+		__sp_area_drop(spas[i]);  /* match __find_sp_area in sp_free_get_spa */
+	}
+	kfree(spas);
+
+	sp_dump_stack();
+	sp_try_to_compact();
+	return ret;
+}
+EXPORT_SYMBOL_GPL(sp_free_batch);
+
 /* wrapper of __do_mmap() and the caller must hold down_write(&mm->mmap_sem). */
 static unsigned long sp_mmap(struct mm_struct *mm, struct file *file,
 			     struct sp_area *spa, unsigned long *populate,
@@ -2569,15 +2761,44 @@ static void sp_alloc_unmap(struct mm_struct *mm, struct sp_area *spa,
 	__sp_free(spa->spg, spa->va_start, spa->real_size, mm);
 }
 
+/* the caller must hold down_write(&mm->mmap_sem) */
+static unsigned long sp_alloc_mmap_locked(struct mm_struct *mm,
+	struct sp_area *spa, struct sp_group_node *spg_node,
+	unsigned long sp_flags, unsigned long *populate)
+{
+	unsigned long mmap_addr;
+	/* pass through default permission */
+	unsigned long prot = PROT_READ | PROT_WRITE;
+	struct vm_area_struct *vma;
+
+	if (spg_node)
+		prot = spg_node->prot;
+
+	if (sp_flags & SP_PROT_RO)
+		prot = PROT_READ;
+
+	*populate = 0;
+	/* when success, mmap_addr == spa->va_start */
+	mmap_addr = sp_mmap(mm, spa_file(spa), spa, populate, prot, &vma);
+	if (IS_ERR_VALUE(mmap_addr))
+		return mmap_addr;
+
+	if (sp_flags & SP_PROT_RO)
+		vma->vm_flags &= ~VM_MAYWRITE;
+
+	/* clean PTE_RDONLY flags or trigger SMMU event */
+	if (prot & PROT_WRITE)
+		vma->vm_page_prot = __pgprot(((~PTE_RDONLY) & vma->vm_page_prot.pgprot) | PTE_DIRTY);
+
+	return mmap_addr;
+}
+
 static int sp_alloc_mmap(struct mm_struct *mm, struct sp_area *spa,
 	struct sp_group_node *spg_node, struct sp_alloc_context *ac)
 {
 	int ret = 0;
 	unsigned long mmap_addr;
-	/* pass through default permission */
-	unsigned long prot = PROT_READ | PROT_WRITE;
 	unsigned long populate = 0;
-	struct vm_area_struct *vma;
 
 	down_write(&mm->mmap_sem);
 	if (unlikely(mm->core_state)) {
@@ -2587,14 +2808,8 @@ static int sp_alloc_mmap(struct mm_struct *mm, struct sp_area *spa,
 		return -EFAULT;
 	}
 
-	if (spg_node)
-		prot = spg_node->prot;
-
-	if (ac->sp_flags & SP_PROT_RO)
-		prot = PROT_READ;
-
-	/* when success, mmap_addr == spa->va_start */
-	mmap_addr = sp_mmap(mm, spa_file(spa), spa, &populate, prot, &vma);
+	mmap_addr = sp_alloc_mmap_locked(mm, spa, spg_node, ac->sp_flags,
+					 &populate);
 	if (IS_ERR_VALUE(mmap_addr)) {
 		up_write(&mm->mmap_sem);
 		sp_alloc_unmap(mm, spa, spg_node);
@@ -2609,13 +2824,6 @@ static int sp_alloc_mmap(struct mm_struct *mm, struct sp_area *spa,
 		goto unmap;
 	}
 	ac->populate = populate;
-
-	if (ac->sp_flags & SP_PROT_RO)
-		vma->vm_flags &= ~VM_MAYWRITE;
-
-	/* clean PTE_RDONLY flags or trigger SMMU event */
-	if (prot & PROT_WRITE)
-		vma->vm_page_prot = __pgprot(((~PTE_RDONLY) & vma->vm_page_prot.pgprot) | PTE_DIRTY);
 	up_write(&mm->mmap_sem);
 
 	return ret;
@@ -2683,6 +2891,30 @@ static int sp_alloc_populate(struct mm_struct *mm, struct sp_area *spa,
 	return ret;
 }
 
+/*
+ * With SP_LAZY, the physical pages are only populated in the process which
+ * allocates the memory (and in the first process if the allocator isn't in
+ * the group). All the other processes fault the pages in from the backing
+ * file on first touch. MAP_LOCKED has to prefault, so it disables SP_LAZY.
+ */
+static bool sp_alloc_skip_populate(struct mm_struct *mm, struct sp_area *spa,
+				   struct sp_group_node *spg_node,
+				   unsigned long sp_flags, bool populated)
+{
+	struct sp_proc_stat *stat;
+
+	if (!(sp_flags & SP_LAZY) || !populated || mm == current->mm ||
+	    sysctl_share_pool_map_lock_enable)
+		return false;
+
+	stat = spg_node->master->stat;
+	if (stat) {
+		atomic64_inc(&stat->lazy_num);
+		atomic64_add(spa->real_size, &stat->lazy_size);
+	}
+	return true;
+}
+
 static long sp_mbind(struct mm_struct *mm, unsigned long start, unsigned long len, unsigned long node)
 {
 	nodemask_t nmask;
@@ -2718,6 +2950,10 @@ static int __sp_alloc_mmap_populate(struct mm_struct *mm, struct sp_area *spa,
 		ac->have_mbind = true;
 	}
 
+	if (sp_alloc_skip_populate(mm, spa, spg_node, ac->sp_flags,
+				   ac->need_fallocate))
+		return 0;
+
 	ret = sp_alloc_populate(mm, spa, ac);
 	if (ret) {
 err:
@@ -2835,6 +3071,182 @@ void *mg_sp_alloc(unsigned long size, unsigned long sp_flags, int spg_id)
 }
 EXPORT_SYMBOL_GPL(mg_sp_alloc);
 
+/* map all the areas into @mm with one mmap_sem acquisition */
+static int sp_alloc_batch_mmap(struct mm_struct *mm, struct sp_area **spas,
+	int nr, struct sp_group_node *spg_node, unsigned long sp_flags,
+	unsigned long *populate)
+{
+	unsigned long mmap_addr;
+	int i;
+
+	down_write(&mm->mmap_sem);
+	if (unlikely(mm->core_state)) {
+		up_write(&mm->mmap_sem);
+		pr_info("batch allocation encountered coredump\n");
+		return -EBUSY;
+	}
+
+	for (i = 0; i < nr; i++) {
+		mmap_addr = sp_alloc_mmap_locked(mm, spas[i], spg_node,
+						 sp_flags, &populate[i]);
+		if (IS_ERR_VALUE(mmap_addr)) {
+			up_write(&mm->mmap_sem);
+			pr_err("sp mmap in batch allocation failed %ld\n",
+			       mmap_addr);
+			return PTR_ERR((void *)mmap_addr);
+		}
+
+		if (unlikely(populate[i] == 0)) {
+			up_write(&mm->mmap_sem);
+			pr_err("batch allocation sp mmap populate failed\n");
+			return -EFAULT;
+		}
+	}
+	up_write(&mm->mmap_sem);
+
+	return 0;
+}
+
+/**
+ * sp_alloc_batch() - Allocate several shared memory areas at once.
+ * @sizes: the size of each area.
+ * @addrs: output, the starting address of each area.
+ * @nr: the number of areas, no more than SP_BATCH_MAX.
+ * @sp_flags: how to allocate the memory, shared by all the areas.
+ * @spg_id: the share group that the memory is allocated to.
+ *
+ * This works like calling sp_alloc() @nr times, except that the group is
+ * looked up and locked only once, and the mmap_sem of each group member
+ * is taken only once for all the areas. There is no hugepage fallback, if
+ * any of the areas fails, all of them are released.
+ *
+ * Return: 0 on success, -errno on failure.
+ */
+int sp_alloc_batch(unsigned long *sizes, unsigned long *addrs, int nr,
+		   unsigned long sp_flags, int spg_id)
+{
+	struct sp_alloc_context ac;
+	struct sp_group_node *spg_node;
+	struct sp_area **spas;
+	unsigned long *populate;
+	unsigned long size;
+	bool have_mbind = false;
+	int i, err, ret;
+
+	if (nr <= 0 || nr > SP_BATCH_MAX)
+		return -EINVAL;
+
+	ret = sp_alloc_prepare(sizes[0], sp_flags, spg_id, &ac);
+	if (ret)
+		return ret;
+
+	spas = kcalloc(nr, sizeof(*spas), GFP_KERNEL);
+	populate = kcalloc(nr, sizeof(*populate), GFP_KERNEL);
+	if (!spas || !populate) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < nr; i++) {
+		size = sizes[i];
+		if (unlikely(!size || (size >> PAGE_SHIFT) > totalram_pages)) {
+			pr_err_ratelimited("batch allocation failed, invalid size %lu\n",
+					   size);
+			ret = -EINVAL;
+			goto out;
+		}
+
+		if (ac.sp_flags & SP_HUGEPAGE)
+			size = ALIGN(size, PMD_SIZE);
+		else
+			size = ALIGN(size, PAGE_SIZE);
+
+		spas[i] = sp_alloc_area(size, ac.sp_flags, ac.spg, ac.type,
+					current->tgid);
+		if (IS_ERR(spas[i])) {
+			pr_err_ratelimited("alloc spa failed in batch allocation"
+				"(potential no enough virtual memory when -75): %ld\n",
+				PTR_ERR(spas[i]));
+			ret = PTR_ERR(spas[i]);
+			spas[i] = NULL;
+			goto out;
+		}
+	}
+
+	ret = -EINVAL;
+	/* create mappings of all the areas for each process in the group */
+	list_for_each_entry(spg_node, &ac.spg->procs, proc_node) {
+		struct mm_struct *mm = spg_node->master->mm;
+
+		err = sp_alloc_batch_mmap(mm, spas, nr, spg_node, ac.sp_flags,
+					  populate);
+		/* skip the process which is coredumping */
+		if (err == -EBUSY)
+			continue;
+		if (err)
+			goto out_err;
+
+		for (i = 0; i < nr; i++) {
+			if (!have_mbind) {
+				err = sp_mbind(mm, spas[i]->va_start,
+					       spas[i]->real_size,
+					       spas[i]->node_id);
+				if (err < 0) {
+					pr_err("cannot bind the memory range to specified node:%d, err:%d\n",
+					       spas[i]->node_id, err);
+					goto out_err;
+				}
+			}
+
+			if (sp_alloc_skip_populate(mm, spas[i], spg_node,
+						   ac.sp_flags, have_mbind))
+				continue;
+
+			ac.populate = populate[i];
+			err = sp_alloc_populate(mm, spas[i], &ac);
+			if (err) {
+				pr_warn_ratelimited("batch allocation failed due to mm populate failed(potential no enough memory when -12): %d\n",
+						    err);
+				goto out_err;
+			}
+		}
+		have_mbind = true;
+		ret = 0;
+	}
+
+	if (!ret) {
+		for (i = 0; i < nr; i++) {
+			sp_update_process_stat(current, true, spas[i]);
+			addrs[i] = spas[i]->va_start;
+		}
+	}
+	goto out;
+
+out_err:
+	ret = err;
+	for (i = 0; i < nr; i++) {
+		__sp_free(ac.spg, spas[i]->va_start, spas[i]->real_size, NULL);
+		sp_fallocate(spas[i]);
+	}
+out:
+	/* match sp_alloc_prepare */
+	up_read(&ac.spg->rw_lock);
+
+	/* this will free the spas if mmap failed */
+	if (spas) {
+		for (i = 0; i < nr && spas[i]; i++)
+			__sp_area_drop(spas[i]);
+	}
+	kfree(populate);
+	kfree(spas);
+
+	sp_group_drop(ac.spg);
+	sp_dump_stack();
+	sp_try_to_compact();
+	return ret;
+}
+EXPORT_SYMBOL_GPL(sp_alloc_batch);
+
 /**
  * is_vmap_hugepage() - Check if a kernel address belongs to vmalloc family.
  * @addr: the kernel space address to be checked.
@@ -4196,15 +4608,18 @@ static void spa_stat_of_mapping_show(struct seq_file *seq,
 {
 	struct rb_node *node;
 	struct sp_area *spa, *prev = NULL;
+	u64 lock_start;
 
-	spin_lock(&sp_area_lock);
+	lock_start = sp_mapping_lock(spm);
 	for (node = rb_first(&spm->area_root); node; node = rb_next(node)) {
-		__sp_area_drop_locked(prev);
-
 		spa = rb_entry(node, struct sp_area, rb_node);
+		/* skip the spa being freed, we hold no lock to drop it under */
+		if (!atomic_inc_not_zero(&spa->use_count))
+			continue;
+		sp_mapping_unlock(spm, lock_start);
+
+		__sp_area_drop(prev);
 		prev = spa;
-		atomic_inc(&spa->use_count);
-		spin_unlock(&sp_area_lock);
 
 		down_read(&spa->spg->rw_lock);
 		if (spg_valid(spa->spg))  /* k2u to group */
@@ -4241,15 +4656,62 @@ static void spa_stat_of_mapping_show(struct seq_file *seq,
 		seq_printf(seq, "%-8d ",  spa->applier);
 		seq_printf(seq, "%-8d\n", atomic_read(&spa->use_count));
 
-		spin_lock(&sp_area_lock);
+		lock_start = sp_mapping_lock(spm);
 	}
-	__sp_area_drop_locked(prev);
-	spin_unlock(&sp_area_lock);
+	sp_mapping_unlock(spm, lock_start);
+	__sp_area_drop(prev);
+}
+
+static void spa_mapping_lock_stat_show(struct seq_file *seq,
+				       struct sp_mapping *spm, const char *name)
+{
+	unsigned long count;
+	u64 hold_ns, max_ns;
+
+	spin_lock(&spm->lock);
+	count = spm->lock_count;
+	hold_ns = spm->lock_hold_ns;
+	max_ns = spm->lock_hold_max_ns;
+	spin_unlock(&spm->lock);
+
+	seq_printf(seq, "%-10s %2s%-14lx %-12lu %-16llu %-12llu\n", name,
+		   "0x", spm->start[0], count, NS2US(hold_ns), NS2US(max_ns));
+}
+
+static int idr_spg_lock_stat_show_cb(int id, void *p, void *data)
+{
+	struct sp_group *spg = p;
+	struct seq_file *seq = data;
+
+	/* the dvpp mapping of a local group may be shared with other groups */
+	if (spg->dvpp && (!is_local_group(spg->id) ||
+			  atomic_read(&spg->dvpp->user) == 1))
+		spa_mapping_lock_stat_show(seq, spg->dvpp, "DVPP");
+
+	return 0;
+}
+
+static void spa_lock_stat_show(struct seq_file *seq)
+{
+	int nid;
+
+	seq_printf(seq, "%-10s %-16s %-12s %-16s %-12s\n",
+		   "Mapping", "va_start", "Acquired", "Hold(us)", "MaxHold(us)");
+	for (nid = 0; nid < nr_node_ids; nid++)
+		spa_mapping_lock_stat_show(seq, sp_mapping_normal[nid], "NORMAL");
+
+	down_read(&sp_group_sem);
+	idr_for_each(&sp_group_idr, idr_spg_lock_stat_show_cb, seq);
+	up_read(&sp_group_sem);
+	seq_puts(seq, "\n");
 }
 
 static void spa_normal_stat_show(struct seq_file *seq)
 {
-	spa_stat_of_mapping_show(seq, sp_mapping_normal);
+	int nid;
+
+	for (nid = 0; nid < nr_node_ids; nid++)
+		spa_stat_of_mapping_show(seq, sp_mapping_normal[nid]);
 }
 
 static int idr_spg_dvpp_stat_show_cb(int id, void *p, void *data)
@@ -4276,22 +4738,36 @@ void spa_overview_show(struct seq_file *seq)
 	unsigned int total_num, alloc_num, k2u_task_num, k2u_spg_num;
 	unsigned long total_size, alloc_size, k2u_task_size, k2u_spg_size;
 	unsigned long dvpp_size, dvpp_va_size;
+	struct sp_spa_stat sum = {}, *stat;
+	int cpu;
 
 	if (!enable_ascend_share_pool)
 		return;
 
-	spin_lock(&sp_area_lock);
-	total_num     = spa_stat.total_num;
-	alloc_num     = spa_stat.alloc_num;
-	k2u_task_num  = spa_stat.k2u_task_num;
-	k2u_spg_num   = spa_stat.k2u_spg_num;
-	total_size    = spa_stat.total_size;
-	alloc_size    = spa_stat.alloc_size;
-	k2u_task_size = spa_stat.k2u_task_size;
-	k2u_spg_size  = spa_stat.k2u_spg_size;
-	dvpp_size     = spa_stat.dvpp_size;
-	dvpp_va_size  = spa_stat.dvpp_va_size;
-	spin_unlock(&sp_area_lock);
+	/* a spa may be freed on another cpu, only the sum is meaningful */
+	for_each_possible_cpu(cpu) {
+		stat = per_cpu_ptr(&spa_stat, cpu);
+		sum.total_num     += READ_ONCE(stat->total_num);
+		sum.alloc_num     += READ_ONCE(stat->alloc_num);
+		sum.k2u_task_num  += READ_ONCE(stat->k2u_task_num);
+		sum.k2u_spg_num   += READ_ONCE(stat->k2u_spg_num);
+		sum.total_size    += READ_ONCE(stat->total_size);
+		sum.alloc_size    += READ_ONCE(stat->alloc_size);
+		sum.k2u_task_size += READ_ONCE(stat->k2u_task_size);
+		sum.k2u_spg_size  += READ_ONCE(stat->k2u_spg_size);
+		sum.dvpp_size     += READ_ONCE(stat->dvpp_size);
+		sum.dvpp_va_size  += READ_ONCE(stat->dvpp_va_size);
+	}
+	total_num     = sum.total_num;
+	alloc_num     = sum.alloc_num;
+	k2u_task_num  = sum.k2u_task_num;
+	k2u_spg_num   = sum.k2u_spg_num;
+	total_size    = sum.total_size;
+	alloc_size    = sum.alloc_size;
+	k2u_task_size = sum.k2u_task_size;
+	k2u_spg_size  = sum.k2u_spg_size;
+	dvpp_size     = sum.dvpp_size;
+	dvpp_va_size  = sum.dvpp_va_size;
 
 	if (seq != NULL) {
 		seq_printf(seq, "Spa total num %u.\n", total_num);
@@ -4382,6 +4858,7 @@ static int spa_stat_show(struct seq_file *seq, void *offset)
 
 	spg_overview_show(seq);
 	spa_overview_show(seq);
+	spa_lock_stat_show(seq);
 	/* print the file header */
 	seq_printf(seq, "%-10s %-16s %-16s %-10s %-7s %-5s %-8s %-8s\n",
 		   "Group ID", "va_start", "va_end", "Size(KB)", "Type", "Huge", "PID", "Ref");
@@ -4481,12 +4958,14 @@ static int idr_proc_overview_cb(int id, void *p, void *data)
 	get_process_non_sp_res(total_rss, shmem, sp_res_nsize,
 			       &non_sp_res, &non_sp_shm);
 
-	seq_printf(seq, "%-8d %-16s %-9ld %-9ld %-9ld %-10ld %-10ld %-8ld\n",
+	seq_printf(seq, "%-8d %-16s %-9ld %-9ld %-9ld %-10ld %-10ld %-8ld %-8ld %-9ld\n",
 		   id, proc_stat->comm,
 		   get_proc_alloc(proc_stat),
 		   get_proc_k2u(proc_stat),
 		   sp_res, non_sp_res, non_sp_shm,
-		   page2kb(mm->total_vm));
+		   page2kb(mm->total_vm),
+		   atomic64_read(&proc_stat->lazy_num),
+		   byte2kb(atomic64_read(&proc_stat->lazy_size)));
 	return 0;
 }
 
@@ -4495,9 +4974,9 @@ static int proc_overview_show(struct seq_file *seq, void *offset)
 	if (!sp_is_enabled())
 		return 0;
 
-	seq_printf(seq, "%-8s %-16s %-9s %-9s %-9s %-10s %-10s %-8s\n",
+	seq_printf(seq, "%-8s %-16s %-9s %-9s %-9s %-10s %-10s %-8s %-8s %-9s\n",
 		   "PID", "COMM", "SP_ALLOC", "SP_K2U", "SP_RES", "Non-SP_RES",
-		   "Non-SP_Shm", "VIRT");
+		   "Non-SP_Shm", "VIRT", "LAZY_NUM", "SP_LAZY");
 
 	down_read(&sp_proc_stat_sem);
 	idr_for_each(&sp_proc_stat_idr, idr_proc_overview_cb, seq);
@@ -4827,6 +5306,36 @@ static void __init sp_device_number_detect(void)
 	}
 }
 
+static int __init sp_mapping_normal_init(void)
+{
+	struct sp_mapping *spm;
+	int nid, i;
+
+	sp_mapping_normal_size = ALIGN_DOWN(MMAP_SHARE_POOL_NORMAL_SIZE /
+					    nr_node_ids, PMD_SIZE);
+
+	for (nid = 0; nid < nr_node_ids; nid++) {
+		spm = sp_mapping_create(SP_MAPPING_NORMAL);
+		if (IS_ERR(spm))
+			goto fail;
+
+		for (i = 0; i < MAX_DEVID; i++) {
+			spm->start[i] = MMAP_SHARE_POOL_START +
+					nid * sp_mapping_normal_size;
+			spm->end[i] = spm->start[i] + sp_mapping_normal_size;
+		}
+		/* never destroyed */
+		atomic_inc(&spm->user);
+		sp_mapping_normal[nid] = spm;
+	}
+
+	return 0;
+fail:
+	while (nid--)
+		sp_mapping_destroy(sp_mapping_normal[nid]);
+	return -ENOMEM;
+}
+
 static int __init share_pool_init(void)
 {
 	if (!enable_ascend_share_pool)
@@ -4834,10 +5343,8 @@ static int __init share_pool_init(void)
 
 	sp_device_number_detect();
 
-	sp_mapping_normal = sp_mapping_create(SP_MAPPING_NORMAL);
-	if (IS_ERR(sp_mapping_normal))
+	if (sp_mapping_normal_init())
 		goto fail;
-	atomic_inc(&sp_mapping_normal->user);
 
 	return 0;
 fail:
@@ -285,15 +285,18 @@ static int shmem_reserve_inode(struct super_block *sb, ino_t *inop)
 	ino_t ino;
 
 	if (!(sb->s_flags & SB_KERNMOUNT)) {
-		spin_lock(&sbinfo->stat_lock);
-		if (sbinfo->max_inodes) {
-			if (!sbinfo->free_inodes) {
-				spin_unlock(&sbinfo->stat_lock);
-				return -ENOSPC;
-			}
-			sbinfo->free_inodes--;
-		}
+		/*
+		 * used_inodes is per-cpu so that create and unlink do not
+		 * bounce stat_lock; like used_blocks, the limit check may
+		 * overshoot by a few inodes under heavy concurrency.
+		 */
+		if (sbinfo->max_inodes &&
+		    percpu_counter_compare(&sbinfo->used_inodes,
+					   sbinfo->max_inodes) >= 0)
+			return -ENOSPC;
+		percpu_counter_inc(&sbinfo->used_inodes);
 		if (inop) {
+			spin_lock(&sbinfo->stat_lock);
 			ino = sbinfo->next_ino++;
 			if (unlikely(is_zero_ino(ino)))
 				ino = sbinfo->next_ino++;
@@ -310,8 +313,8 @@ static int shmem_reserve_inode(struct super_block *sb, ino_t *inop)
 				ino = sbinfo->next_ino++;
 			}
 			*inop = ino;
+			spin_unlock(&sbinfo->stat_lock);
 		}
-		spin_unlock(&sbinfo->stat_lock);
 	} else if (inop) {
 		/*
 		 * __shmem_file_setup, one of our callers, is lock-free: it
@@ -347,11 +350,8 @@ static int shmem_reserve_inode(struct super_block *sb, ino_t *inop)
 static void shmem_free_inode(struct super_block *sb)
 {
 	struct shmem_sb_info *sbinfo = SHMEM_SB(sb);
-	if (sbinfo->max_inodes) {
-		spin_lock(&sbinfo->stat_lock);
-		sbinfo->free_inodes++;
-		spin_unlock(&sbinfo->stat_lock);
-	}
+	if (!(sb->s_flags & SB_KERNMOUNT))
+		percpu_counter_dec(&sbinfo->used_inodes);
 }
 
 /**
@@ -671,10 +671,12 @@ static unsigned long shmem_unused_huge_shrink(struct shmem_sb_info *sbinfo,
 }
 #endif /* CONFIG_TRANSPARENT_HUGE_PAGECACHE */
 
-static inline bool is_huge_enabled(struct shmem_sb_info *sbinfo)
+static inline bool is_huge_enabled(struct shmem_sb_info *sbinfo,
+				   struct shmem_inode_info *info)
 {
 	if (IS_ENABLED(CONFIG_TRANSPARENT_HUGE_PAGECACHE) &&
-	    (shmem_huge == SHMEM_HUGE_FORCE || sbinfo->huge) &&
+	    (shmem_huge == SHMEM_HUGE_FORCE || sbinfo->huge ||
+	     (info->flags & VM_HUGEPAGE)) &&
 	    shmem_huge != SHMEM_HUGE_DENY)
 		return true;
 	return false;
@@ -1108,7 +1110,7 @@ static int shmem_getattr(const struct path *path, struct kstat *stat,
 	}
 	generic_fillattr(inode, stat);
 
-	if (is_huge_enabled(sb_info))
+	if (is_huge_enabled(sb_info, info))
 		stat->blksize = HPAGE_PMD_SIZE;
 
 	return 0;
@@ -1787,6 +1789,19 @@ static int shmem_getpage_gfp(struct inode *inode, pgoff_t index,
 	if (page && sgp == SGP_WRITE)
 		mark_page_accessed(page);
 
+	/*
+	 * The page is already in the page cache (or in swap): let a
+	 * minor-mode userfaultfd resolve the fault with UFFDIO_CONTINUE.
+	 */
+	if ((page || swap.val) && vma && userfaultfd_minor(vma)) {
+		if (page) {
+			unlock_page(page);
+			put_page(page);
+		}
+		*fault_type = handle_userfault(vmf, VM_UFFD_MINOR);
+		return 0;
+	}
+
 	/* fallocated page? */
 	if (page && !PageUptodate(page)) {
 		if (sgp != SGP_READ)
@@ -1897,6 +1912,9 @@ static int shmem_getpage_gfp(struct inode *inode, pgoff_t index,
 			goto alloc_nohuge;
 		if (shmem_huge == SHMEM_HUGE_FORCE)
 			goto alloc_huge;
+		/* memfd_create(MFD_HUGEPAGE) */
+		if (info->flags & VM_HUGEPAGE)
+			goto alloc_huge;
 		switch (sbinfo->huge) {
 			loff_t i_size;
 			pgoff_t off;
@@ -2222,7 +2240,8 @@ unsigned long shmem_get_unmapped_area(struct file *file,
 				return addr;
 			sb = shm_mnt->mnt_sb;
 		}
-		if (SHMEM_SB(sb)->huge == SHMEM_HUGE_NEVER)
+		if (SHMEM_SB(sb)->huge == SHMEM_HUGE_NEVER &&
+		    !(file && SHMEM_I(file_inode(file))->flags & VM_HUGEPAGE))
 			return addr;
 	}
 
@@ -2334,7 +2353,7 @@ static struct inode *shmem_get_inode(struct super_block *sb, const struct inode
 		memset(info, 0, (char *)inode - (char *)info);
 		spin_lock_init(&info->lock);
 		info->seals = F_SEAL_SEAL;
-		info->flags = flags & VM_NORESERVE;
+		info->flags = flags & (VM_NORESERVE | VM_HUGEPAGE);
 		INIT_LIST_HEAD(&info->shrinklist);
 		INIT_LIST_HEAD(&info->swaplist);
 		simple_xattrs_init(&info->xattrs);
@@ -2547,6 +2566,67 @@ int shmem_mfill_zeropage_pte(struct mm_struct *dst_mm,
 				      dst_addr, 0, true, &page);
 }
 
+int shmem_mcontinue_atomic_pte(struct mm_struct *dst_mm,
+			       pmd_t *dst_pmd,
+			       struct vm_area_struct *dst_vma,
+			       unsigned long dst_addr)
+{
+	struct inode *inode = file_inode(dst_vma->vm_file);
+	pgoff_t pgoff = linear_page_index(dst_vma, dst_addr);
+	struct page *page = NULL;
+	spinlock_t *ptl;
+	pte_t _dst_pte, *dst_pte;
+	pgoff_t max_off;
+	bool writable;
+	int ret;
+
+	ret = shmem_getpage(inode, pgoff, &page, SGP_READ);
+	if (ret)
+		goto out;
+	ret = -EFAULT;
+	if (!page)
+		goto out;
+
+	/*
+	 * The page is already in the page cache, so only a shared mapping
+	 * may map it writable; a private one has to COW on write.
+	 */
+	writable = (dst_vma->vm_flags & VM_WRITE) &&
+		   (dst_vma->vm_flags & VM_SHARED);
+	_dst_pte = mk_pte(page, dst_vma->vm_page_prot);
+	if (writable)
+		_dst_pte = pte_mkwrite(pte_mkdirty(_dst_pte));
+
+	dst_pte = pte_offset_map_lock(dst_mm, dst_pmd, dst_addr, &ptl);
+
+	ret = -EFAULT;
+	max_off = DIV_ROUND_UP(i_size_read(inode), PAGE_SIZE);
+	if (unlikely(pgoff >= max_off))
+		goto out_unlock;
+
+	ret = -EEXIST;
+	if (!pte_none(*dst_pte))
+		goto out_unlock;
+
+	inc_mm_counter(dst_mm, mm_counter_file(page));
+	reliable_page_counter(page, dst_mm, 1);
+	page_add_file_rmap(page, false);
+	set_pte_at(dst_mm, dst_addr, dst_pte, _dst_pte);
+
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(dst_vma, dst_addr, dst_pte);
+	pte_unmap_unlock(dst_pte, ptl);
+	unlock_page(page);
+	return 0;
+
+out_unlock:
+	pte_unmap_unlock(dst_pte, ptl);
+	unlock_page(page);
+	put_page(page);
+out:
+	return ret;
+}
+
 #ifdef CONFIG_TMPFS
 static const struct inode_operations shmem_symlink_inode_operations;
 static const struct inode_operations shmem_short_symlink_operations;
@@ -2963,7 +3043,8 @@ static int shmem_statfs(struct dentry *dentry, struct kstatfs *buf)
 	}
 	if (sbinfo->max_inodes) {
 		buf->f_files = sbinfo->max_inodes;
-		buf->f_ffree = sbinfo->free_inodes;
+		buf->f_ffree = sbinfo->max_inodes -
+				percpu_counter_sum(&sbinfo->used_inodes);
 	}
 	/* else leave those fields 0 like simple_statfs */
 	return 0;
@@ -3604,7 +3685,7 @@ static int shmem_remount_fs(struct super_block *sb, int *flags, char *data)
 		return error;
 
 	spin_lock(&sbinfo->stat_lock);
-	inodes = sbinfo->max_inodes - sbinfo->free_inodes;
+	inodes = percpu_counter_sum(&sbinfo->used_inodes);
 
 	if (percpu_counter_compare(&sbinfo->used_blocks, config.max_blocks) > 0)
 		goto out;
@@ -3631,7 +3712,6 @@ static int shmem_remount_fs(struct super_block *sb, int *flags, char *data)
 	sbinfo->full_inums = config.full_inums;
 	sbinfo->max_blocks  = config.max_blocks;
 	sbinfo->max_inodes  = config.max_inodes;
-	sbinfo->free_inodes = config.max_inodes - inodes;
 
 	/*
 	 * Preserve previous mempolicy unless mpol remount option was specified.
@@ -3702,6 +3782,7 @@ static void shmem_put_super(struct super_block *sb)
 
 	free_percpu(sbinfo->ino_batch);
 	percpu_counter_destroy(&sbinfo->used_blocks);
+	percpu_counter_destroy(&sbinfo->used_inodes);
 	mpol_put(sbinfo->mpol);
 	kfree(sbinfo);
 	sb->s_fs_info = NULL;
@@ -3755,7 +3836,8 @@ int shmem_fill_super(struct super_block *sb, void *data, int silent)
 	spin_lock_init(&sbinfo->stat_lock);
 	if (percpu_counter_init(&sbinfo->used_blocks, 0, GFP_KERNEL))
 		goto failed;
-	sbinfo->free_inodes = sbinfo->max_inodes;
+	if (percpu_counter_init(&sbinfo->used_inodes, 0, GFP_KERNEL))
+		goto failed;
 	spin_lock_init(&sbinfo->shrinklist_lock);
 	INIT_LIST_HEAD(&sbinfo->shrinklist);
 
@@ -4047,6 +4129,8 @@ bool shmem_huge_enabled(struct vm_area_struct *vma)
 		return true;
 	if (shmem_huge == SHMEM_HUGE_DENY)
 		return false;
+	if (SHMEM_I(inode)->flags & VM_HUGEPAGE)
+		return true;
 	switch (sbinfo->huge) {
 		case SHMEM_HUGE_NEVER:
 			return false;
@@ -4188,7 +4272,8 @@ struct file *shmem_kernel_file_setup(const char *name, loff_t size, unsigned lon
  * shmem_file_setup - get an unlinked file living in tmpfs
  * @name: name for dentry (to be seen in /proc/<pid>/maps
  * @size: size to be set for the file
- * @flags: VM_NORESERVE suppresses pre-accounting of the entire object size
+ * @flags: VM_NORESERVE suppresses pre-accounting of the entire object size,
+ *	VM_HUGEPAGE backs the file with huge pages regardless of the mount
  */
 struct file *shmem_file_setup(const char *name, loff_t size, unsigned long flags)
 {
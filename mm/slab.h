@@ -282,12 +282,159 @@ static __always_inline int memcg_charge_slab(struct page *page,
 	return memcg_kmem_charge_memcg(page, gfp, order, s->memcg_params.memcg);
 }
 
+static inline struct obj_cgroup **page_obj_cgroups(struct page *page)
+{
+	unsigned long memcg_data = (unsigned long)READ_ONCE(page->mem_cgroup);
+
+	if (!(memcg_data & MEMCG_DATA_OBJCGS))
+		return NULL;
+	return (struct obj_cgroup **)(memcg_data & ~MEMCG_DATA_OBJCGS);
+}
+
+int memcg_alloc_page_obj_cgroups(struct page *page, struct kmem_cache *s,
+				 gfp_t gfp);
+
+static inline void memcg_free_page_obj_cgroups(struct page *page)
+{
+	struct obj_cgroup **objcgs = page_obj_cgroups(page);
+
+	if (objcgs) {
+		kfree(objcgs);
+		page->mem_cgroup = NULL;
+	}
+}
+
 static __always_inline void memcg_uncharge_slab(struct page *page, int order,
 						struct kmem_cache *s)
 {
+	if (is_root_cache(s)) {
+		memcg_free_page_obj_cgroups(page);
+		return;
+	}
 	memcg_kmem_uncharge(page, order);
 }
 
+/*
+ * The obj_cgroup pointer kept for an accounted object is charged along
+ * with the object itself.
+ */
+static inline size_t obj_full_size(struct kmem_cache *s)
+{
+	return s->size + sizeof(struct obj_cgroup *);
+}
+
+static inline int cache_vmstat_idx(struct kmem_cache *s)
+{
+	return (s->flags & SLAB_RECLAIM_ACCOUNT) ?
+		NR_SLAB_RECLAIMABLE : NR_SLAB_UNRECLAIMABLE;
+}
+
+/*
+ * Charge @objects objects of @s to the current memcg up front.  With
+ * cgroup.memory=kmemcache the allocation is redirected to the per-memcg
+ * copy of @s instead.
+ */
+static inline struct kmem_cache *
+memcg_slab_pre_alloc_hook(struct kmem_cache *s, struct obj_cgroup **objcgp,
+			  size_t objects, gfp_t flags)
+{
+	struct obj_cgroup *objcg;
+
+	if (!memcg_kmem_objcg_enabled())
+		return memcg_kmem_get_cache(s);
+
+	objcg = get_obj_cgroup_from_current();
+	if (!objcg)
+		return s;
+
+	if (obj_cgroup_charge(objcg, flags, objects * obj_full_size(s))) {
+		obj_cgroup_put(objcg);
+		return NULL;
+	}
+
+	*objcgp = objcg;
+	return s;
+}
+
+static inline void memcg_slab_post_alloc_hook(struct kmem_cache *s,
+					      struct obj_cgroup *objcg,
+					      gfp_t flags, size_t size,
+					      void **p)
+{
+	struct page *page;
+	unsigned int off;
+	size_t i;
+
+	if (!objcg) {
+		memcg_kmem_put_cache(s);
+		return;
+	}
+
+	for (i = 0; i < size; i++) {
+		if (likely(p[i])) {
+			page = virt_to_head_page(p[i]);
+			if (!page_obj_cgroups(page) &&
+			    memcg_alloc_page_obj_cgroups(page, s, flags)) {
+				obj_cgroup_uncharge(objcg, obj_full_size(s));
+				continue;
+			}
+
+			off = obj_to_index(s, page, p[i]);
+			obj_cgroup_get(objcg);
+			page_obj_cgroups(page)[off] = objcg;
+			obj_cgroup_mod_state(objcg, cache_vmstat_idx(s),
+					     obj_full_size(s));
+		} else {
+			obj_cgroup_uncharge(objcg, obj_full_size(s));
+		}
+	}
+	obj_cgroup_put(objcg);
+}
+
+/* Give back the charge of @objects objects a bulk allocation didn't get */
+static inline void memcg_slab_alloc_cancel(struct kmem_cache *s,
+					   struct obj_cgroup *objcg,
+					   size_t objects)
+{
+	if (objcg && objects)
+		obj_cgroup_uncharge(objcg, objects * obj_full_size(s));
+}
+
+static inline void memcg_slab_free_hook(void **p, int objects)
+{
+	struct obj_cgroup **objcgs;
+	struct obj_cgroup *objcg;
+	struct kmem_cache *s;
+	struct page *page;
+	unsigned int off;
+	int i;
+
+	if (!memcg_kmem_enabled())
+		return;
+
+	for (i = 0; i < objects; i++) {
+		if (unlikely(!p[i]))
+			continue;
+
+		page = virt_to_head_page(p[i]);
+		objcgs = page_obj_cgroups(page);
+		if (!objcgs)
+			continue;
+
+		s = page->slab_cache;
+		off = obj_to_index(s, page, p[i]);
+		objcg = objcgs[off];
+		if (!objcg)
+			continue;
+
+		objcgs[off] = NULL;
+		obj_cgroup_uncharge(objcg, obj_full_size(s));
+		obj_cgroup_mod_state(objcg, cache_vmstat_idx(s),
+				     -obj_full_size(s));
+		obj_cgroup_put(objcg);
+	}
+}
+
 extern void slab_init_memcg_params(struct kmem_cache *);
 extern void memcg_link_cache(struct kmem_cache *s);
 extern void slab_deactivate_memcg_cache_rcu_sched(struct kmem_cache *s,
@@ -340,6 +487,30 @@ static inline void memcg_uncharge_slab(struct page *page, int order,
 {
 }
 
+static inline struct kmem_cache *
+memcg_slab_pre_alloc_hook(struct kmem_cache *s, struct obj_cgroup **objcgp,
+			  size_t objects, gfp_t flags)
+{
+	return s;
+}
+
+static inline void memcg_slab_post_alloc_hook(struct kmem_cache *s,
+					      struct obj_cgroup *objcg,
+					      gfp_t flags, size_t size,
+					      void **p)
+{
+}
+
+static inline void memcg_slab_alloc_cancel(struct kmem_cache *s,
+					   struct obj_cgroup *objcg,
+					   size_t objects)
+{
+}
+
+static inline void memcg_slab_free_hook(void **p, int objects)
+{
+}
+
 static inline void slab_init_memcg_params(struct kmem_cache *s)
 {
 }
@@ -408,7 +579,8 @@ static inline size_t slab_ksize(const struct kmem_cache *s)
 }
 
 static inline struct kmem_cache *slab_pre_alloc_hook(struct kmem_cache *s,
-						     gfp_t flags)
+						     struct obj_cgroup **objcgp,
+						     size_t size, gfp_t flags)
 {
 	flags &= gfp_allowed_mask;
 
@@ -422,12 +594,13 @@ static inline struct kmem_cache *slab_pre_alloc_hook(struct kmem_cache *s,
 
 	if (memcg_kmem_enabled() &&
 	    ((flags & __GFP_ACCOUNT) || (s->flags & SLAB_ACCOUNT)))
-		return memcg_kmem_get_cache(s);
+		return memcg_slab_pre_alloc_hook(s, objcgp, size, flags);
 
 	return s;
 }
 
-static inline void slab_post_alloc_hook(struct kmem_cache *s, gfp_t flags,
+static inline void slab_post_alloc_hook(struct kmem_cache *s,
+					struct obj_cgroup *objcg, gfp_t flags,
 					size_t size, void **p)
 {
 	size_t i;
@@ -442,7 +615,7 @@ static inline void slab_post_alloc_hook(struct kmem_cache *s, gfp_t flags,
 	}
 
 	if (memcg_kmem_enabled())
-		memcg_kmem_put_cache(s);
+		memcg_slab_post_alloc_hook(s, objcg, flags, size, p);
 }
 
 #ifndef CONFIG_SLOB
@@ -1813,6 +1813,7 @@ static inline void *acquire_slab(struct kmem_cache *s,
 }
 
 static void put_cpu_partial(struct kmem_cache *s, struct page *page, int drain);
+static void flush_remote_free(struct kmem_cache *s, struct kmem_cache_cpu *c);
 static inline bool pfmemalloc_match(struct page *page, gfp_t gfpflags);
 
 /*
@@ -2314,6 +2315,8 @@ static inline void __flush_cpu_slab(struct kmem_cache *s, int cpu)
 	struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
 
 	if (likely(c)) {
+		flush_remote_free(s, c);
+
 		if (c->page)
 			flush_slab(s, c);
 
@@ -2333,7 +2336,7 @@ static bool has_cpu_slab(int cpu, void *info)
 	struct kmem_cache *s = info;
 	struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
 
-	return c->page || slub_percpu_partial(c);
+	return c->page || slub_percpu_partial(c) || slub_remote_page(c);
 }
 
 static void flush_all(struct kmem_cache *s)
@@ -2677,8 +2680,9 @@ static __always_inline void *slab_alloc_node(struct kmem_cache *s,
 	struct kmem_cache_cpu *c;
 	struct page *page;
 	unsigned long tid;
+	struct obj_cgroup *objcg = NULL;
 
-	s = slab_pre_alloc_hook(s, gfpflags);
+	s = slab_pre_alloc_hook(s, &objcg, 1, gfpflags);
 	if (!s)
 		return NULL;
 redo:
@@ -2752,7 +2756,7 @@ static __always_inline void *slab_alloc_node(struct kmem_cache *s,
 	if (unlikely(gfpflags & __GFP_ZERO) && object)
 		memset(object, 0, s->object_size);
 
-	slab_post_alloc_hook(s, gfpflags, 1, &object);
+	slab_post_alloc_hook(s, objcg, gfpflags, 1, &object);
 
 	return object;
 }
@@ -2936,6 +2940,91 @@ static void __slab_free(struct kmem_cache *s, struct page *page,
 	discard_slab(s, page);
 }
 
+#ifdef CONFIG_NUMA
+/* Most objects queued per cpu for one remote slab */
+#define SLUB_REMOTE_FREE_BATCH	32
+
+/*
+ * Hand the remote frees queued on @c to their slab.  Called with interrupts
+ * disabled, on the cpu owning @c or for a dead cpu.
+ */
+static void flush_remote_free(struct kmem_cache *s, struct kmem_cache_cpu *c)
+{
+	struct page *page = c->remote_page;
+
+	if (!page)
+		return;
+
+	c->remote_page = NULL;
+	stat(s, FREE_REMOTE_FLUSH);
+	__slab_free(s, page, c->remote_head, c->remote_tail, c->remote_cnt,
+		    _RET_IP_);
+}
+
+/*
+ * Freeing to a slab on another node costs a cmpxchg_double on a remote
+ * cache line per object.  Instead, objects freed to a remote slab are
+ * queued on the cpu as long as they keep going to the same slab, and are
+ * handed back with a single __slab_free() when a remote free goes to
+ * another slab, the batch is full or the cpu slabs are flushed.  Frees of
+ * objects allocated on one node and consumed on another, like skbs
+ * received on the node of the NIC, tend to come in such runs.
+ */
+static bool slab_free_remote(struct kmem_cache *s, struct page *page,
+			     void *head, void *tail, int cnt)
+{
+	struct kmem_cache_cpu *c;
+	struct page *old_page;
+	void *old_head, *old_tail;
+	int old_cnt;
+	unsigned long flags;
+
+	if (kmem_cache_debug(s) || cnt >= SLUB_REMOTE_FREE_BATCH ||
+	    page_to_nid(page) == numa_mem_id())
+		return false;
+
+	stat(s, FREE_REMOTE_QUEUE);
+
+	local_irq_save(flags);
+	c = this_cpu_ptr(s->cpu_slab);
+	old_page = c->remote_page;
+	if (old_page == page &&
+	    c->remote_cnt + cnt <= SLUB_REMOTE_FREE_BATCH) {
+		set_freepointer(s, tail, c->remote_head);
+		c->remote_head = head;
+		c->remote_cnt += cnt;
+		local_irq_restore(flags);
+		return true;
+	}
+
+	old_head = c->remote_head;
+	old_tail = c->remote_tail;
+	old_cnt = c->remote_cnt;
+	c->remote_page = page;
+	c->remote_head = head;
+	c->remote_tail = tail;
+	c->remote_cnt = cnt;
+	local_irq_restore(flags);
+
+	if (old_page) {
+		stat(s, FREE_REMOTE_FLUSH);
+		__slab_free(s, old_page, old_head, old_tail, old_cnt, _RET_IP_);
+	}
+	return true;
+}
+#else
+static inline void flush_remote_free(struct kmem_cache *s,
+				     struct kmem_cache_cpu *c)
+{
+}
+
+static inline bool slab_free_remote(struct kmem_cache *s, struct page *page,
+				    void *head, void *tail, int cnt)
+{
+	return false;
+}
+#endif /* CONFIG_NUMA */
+
 /*
  * Fastpath with forced inlining to produce a kfree and kmem_cache_free that
  * can perform fastpath freeing without additional function calls.
@@ -2988,7 +3077,7 @@ static __always_inline void do_slab_free(struct kmem_cache *s,
 			goto redo;
 		}
 		stat(s, FREE_FASTPATH);
-	} else
+	} else if (!slab_free_remote(s, page, head, tail_obj, cnt))
 		__slab_free(s, page, head, tail_obj, cnt, addr);
 
 }
@@ -3017,6 +3106,7 @@ void kmem_cache_free(struct kmem_cache *s, void *x)
 	s = cache_from_obj(s, x);
 	if (!s)
 		return;
+	memcg_slab_free_hook(&x, 1);
 	slab_free(s, virt_to_head_page(x), x, NULL, 1, _RET_IP_);
 	trace_kmem_cache_free(_RET_IP_, x);
 }
@@ -3119,6 +3209,7 @@ void kmem_cache_free_bulk(struct kmem_cache *s, size_t size, void **p)
 	if (WARN_ON(!size))
 		return;
 
+	memcg_slab_free_hook(p, size);
 	do {
 		struct detached_freelist df;
 
@@ -3137,9 +3228,10 @@ int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
 {
 	struct kmem_cache_cpu *c;
 	int i;
+	struct obj_cgroup *objcg = NULL;
 
 	/* memcg and kmem_cache debug support */
-	s = slab_pre_alloc_hook(s, flags);
+	s = slab_pre_alloc_hook(s, &objcg, size, flags);
 	if (unlikely(!s))
 		return false;
 	/*
@@ -3190,11 +3282,12 @@ int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
 	}
 
 	/* memcg and kmem_cache debug support */
-	slab_post_alloc_hook(s, flags, size, p);
+	slab_post_alloc_hook(s, objcg, flags, size, p);
 	return i;
 error:
 	local_irq_enable();
-	slab_post_alloc_hook(s, flags, i, p);
+	memcg_slab_alloc_cancel(s, objcg, size - i);
+	slab_post_alloc_hook(s, objcg, flags, i, p);
 	__kmem_cache_free_bulk(s, i, p);
 	return 0;
 }
@@ -3962,6 +4055,7 @@ void kfree(const void *x)
 		__free_pages(page, compound_order(page));
 		return;
 	}
+	memcg_slab_free_hook(&object, 1);
 	slab_free(page->slab_cache, page, object, NULL, 1, _RET_IP_);
 }
 EXPORT_SYMBOL(kfree);
@@ -5443,6 +5537,8 @@ STAT_ATTR(CPU_PARTIAL_ALLOC, cpu_partial_alloc);
 STAT_ATTR(CPU_PARTIAL_FREE, cpu_partial_free);
 STAT_ATTR(CPU_PARTIAL_NODE, cpu_partial_node);
 STAT_ATTR(CPU_PARTIAL_DRAIN, cpu_partial_drain);
+STAT_ATTR(FREE_REMOTE_QUEUE, free_remote_queue);
+STAT_ATTR(FREE_REMOTE_FLUSH, free_remote_flush);
 #endif
 
 static struct attribute *slab_attrs[] = {
@@ -5509,6 +5605,8 @@ static struct attribute *slab_attrs[] = {
 	&cpu_partial_free_attr.attr,
 	&cpu_partial_node_attr.attr,
 	&cpu_partial_drain_attr.attr,
+	&free_remote_queue_attr.attr,
+	&free_remote_flush_attr.attr,
 #endif
 #ifdef CONFIG_FAILSLAB
 	&failslab_attr.attr,
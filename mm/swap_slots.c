@@ -270,7 +270,7 @@ static int refill_swap_slots_cache(struct swap_slots_cache *cache)
 	cache->cur = 0;
 	if (swap_slot_cache_active)
 		cache->nr = get_swap_pages(SWAP_SLOTS_CACHE_SIZE,
-					   cache->slots, 1);
+					   cache->slots, 1, SWAP_TIER_ALL);
 
 	return cache->nr;
 }
@@ -311,15 +311,23 @@ swp_entry_t get_swap_page(struct page *page)
 {
 	swp_entry_t entry, *pentry;
 	struct swap_slots_cache *cache;
+	int tier = mem_cgroup_swap_tier(page);
 
 	entry.val = 0;
 
 	if (PageTransHuge(page)) {
 		if (IS_ENABLED(CONFIG_THP_SWAP))
-			get_swap_pages(1, &entry, HPAGE_PMD_NR);
+			get_swap_pages(1, &entry, HPAGE_PMD_NR, tier);
 		goto out;
 	}
 
+	/*
+	 * The slots cache holds entries from any device, so pages of a
+	 * memcg bound to a swap tier go to the swap devices directly.
+	 */
+	if (tier != SWAP_TIER_ALL)
+		goto direct;
+
 	/*
 	 * Preemption is allowed here, because we may sleep
 	 * in refill_swap_slots_cache().  But it is safe, because
@@ -350,7 +358,8 @@ swp_entry_t get_swap_page(struct page *page)
 			goto out;
 	}
 
-	get_swap_pages(1, &entry, 1);
+direct:
+	get_swap_pages(1, &entry, 1, tier);
 out:
 	if (mem_cgroup_try_charge_swap(page, entry)) {
 		put_swap_page(page, entry);
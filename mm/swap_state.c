@@ -56,6 +56,9 @@ static bool enable_kernel_swap __read_mostly = true;
 	 (((win) << SWAP_RA_WIN_SHIFT) & SWAP_RA_WIN_MASK) |	\
 	 ((hits) & SWAP_RA_HITS_MASK))
 
+/* Pages handed to swap_readpage_batch() at once by readahead */
+#define SWAP_RA_BATCH		32
+
 /* Initial readahead hits is 4 to start up with a small window */
 #define GET_SWAP_RA_VAL(vma)					\
 	(atomic_long_read(&(vma)->swap_readahead_info) ? : 4)
@@ -99,6 +102,17 @@ EXPORT_SYMBOL_GPL(total_swapcache_pages);
 
 static atomic_t swapin_readahead_hits = ATOMIC_INIT(4);
 
+/* Readahead events are also counted for the memcg of the faulting mm */
+static void swap_ra_count_event(struct vm_area_struct *vma, struct page *page,
+				enum vm_event_item idx)
+{
+	count_vm_event(idx);
+	if (vma && vma->vm_mm)
+		count_memcg_event_mm(vma->vm_mm, idx);
+	else
+		count_memcg_page_event(page, idx);
+}
+
 void show_swap_cache_info(void)
 {
 	printk("%lu pages in swap cache\n", total_swapcache_pages());
@@ -110,15 +124,41 @@ void show_swap_cache_info(void)
 	printk("Total swap = %lukB\n", total_swap_pages << (PAGE_SHIFT - 10));
 }
 
+/*
+ * Replace the entry at @index with @item, which may be NULL, keeping the
+ * shadow node tracking of the workingset code up to date.  Returns the
+ * entry that was replaced.
+ */
+static void *swap_cache_replace(struct address_space *address_space,
+				pgoff_t index, void *item)
+{
+	struct radix_tree_node *node;
+	void **slot;
+	void *old;
+
+	if (!__radix_tree_lookup(&address_space->i_pages, index, &node, &slot))
+		return NULL;
+	old = radix_tree_deref_slot_protected(slot,
+					      &address_space->i_pages.xa_lock);
+	__radix_tree_replace(&address_space->i_pages, node, slot, item,
+			     workingset_lookup_update(address_space));
+	return old;
+}
+
 /*
  * __add_to_swap_cache resembles add_to_page_cache_locked on swapper_space,
  * but sets SwapCache flag and private instead of mapping and index.
+ * A shadow entry left by the last page swapped out to @entry is returned
+ * in @shadowp, if not NULL.
  */
-int __add_to_swap_cache(struct page *page, swp_entry_t entry)
+int __add_to_swap_cache(struct page *page, swp_entry_t entry, void **shadowp)
 {
 	int error, i, nr = hpage_nr_pages(page);
 	struct address_space *address_space;
 	pgoff_t idx = swp_offset(entry);
+	struct radix_tree_node *node;
+	void **slot;
+	void *old;
 
 	VM_BUG_ON_PAGE(!PageLocked(page), page);
 	VM_BUG_ON_PAGE(PageSwapCache(page), page);
@@ -131,10 +171,24 @@ int __add_to_swap_cache(struct page *page, swp_entry_t entry)
 	xa_lock_irq(&address_space->i_pages);
 	for (i = 0; i < nr; i++) {
 		set_page_private(page + i, entry.val + i);
-		error = radix_tree_insert(&address_space->i_pages,
-					  idx + i, page + i);
+		error = __radix_tree_create(&address_space->i_pages, idx + i,
+					    0, &node, &slot);
 		if (unlikely(error))
 			break;
+		old = radix_tree_deref_slot_protected(slot,
+					&address_space->i_pages.xa_lock);
+		if (old) {
+			if (unlikely(!radix_tree_exceptional_entry(old))) {
+				error = -EEXIST;
+				break;
+			}
+			address_space->nrexceptional--;
+			if (shadowp)
+				*shadowp = old;
+		}
+		__radix_tree_replace(&address_space->i_pages, node, slot,
+				     page + i,
+				     workingset_lookup_update(address_space));
 	}
 	if (likely(!error)) {
 		address_space->nrpages += nr;
@@ -149,7 +203,7 @@ int __add_to_swap_cache(struct page *page, swp_entry_t entry)
 		VM_BUG_ON(error == -EEXIST);
 		set_page_private(page + i, 0UL);
 		while (i--) {
-			radix_tree_delete(&address_space->i_pages, idx + i);
+			swap_cache_replace(address_space, idx + i, NULL);
 			set_page_private(page + i, 0UL);
 		}
 		ClearPageSwapCache(page);
@@ -167,7 +221,7 @@ int add_to_swap_cache(struct page *page, swp_entry_t entry, gfp_t gfp_mask)
 
 	error = radix_tree_maybe_preload_order(gfp_mask, compound_order(page));
 	if (!error) {
-		error = __add_to_swap_cache(page, entry);
+		error = __add_to_swap_cache(page, entry, NULL);
 		radix_tree_preload_end();
 	}
 	return error;
@@ -175,9 +229,10 @@ int add_to_swap_cache(struct page *page, swp_entry_t entry, gfp_t gfp_mask)
 
 /*
  * This must be called only on pages that have
- * been verified to be in the swap cache.
+ * been verified to be in the swap cache.  @shadow, if not NULL, is left
+ * in place of the page to detect its refault.
  */
-void __delete_from_swap_cache(struct page *page)
+void __delete_from_swap_cache(struct page *page, void *shadow)
 {
 	struct address_space *address_space;
 	int i, nr = hpage_nr_pages(page);
@@ -192,11 +247,13 @@ void __delete_from_swap_cache(struct page *page)
 	address_space = swap_address_space(entry);
 	idx = swp_offset(entry);
 	for (i = 0; i < nr; i++) {
-		radix_tree_delete(&address_space->i_pages, idx + i);
+		swap_cache_replace(address_space, idx + i, shadow);
 		set_page_private(page + i, 0);
 	}
 	ClearPageSwapCache(page);
 	address_space->nrpages -= nr;
+	if (shadow)
+		address_space->nrexceptional += nr;
 	__mod_node_page_state(page_pgdat(page), NR_FILE_PAGES, -nr);
 	ADD_CACHE_INFO(del_total, nr);
 }
@@ -274,13 +331,66 @@ void delete_from_swap_cache(struct page *page)
 
 	address_space = swap_address_space(entry);
 	xa_lock_irq(&address_space->i_pages);
-	__delete_from_swap_cache(page);
+	__delete_from_swap_cache(page, NULL);
 	xa_unlock_irq(&address_space->i_pages);
 
 	put_swap_page(page, entry);
 	page_ref_sub(page, hpage_nr_pages(page));
 }
 
+/*
+ * Return the shadow entry left in the swap cache by the last page swapped
+ * out to @entry, for swapins that don't go through the swap cache.
+ */
+void *get_shadow_from_swap_cache(swp_entry_t entry)
+{
+	struct address_space *address_space = swap_address_space(entry);
+	struct page *page;
+
+	page = find_get_entry(address_space, swp_offset(entry));
+	if (radix_tree_exceptional_entry(page))
+		return page;
+	if (page)
+		put_page(page);
+	return NULL;
+}
+
+/*
+ * Drop the shadow entries of the swap entries [begin, end] of swap device
+ * @type, which are being freed, so that they can't be mistaken for the
+ * eviction of whatever is swapped out to them next.
+ */
+void clear_shadow_from_swap_cache(int type, unsigned long begin,
+				  unsigned long end)
+{
+	unsigned long curr = begin;
+
+	for (;;) {
+		swp_entry_t entry = swp_entry(type, curr);
+		struct address_space *address_space = swap_address_space(entry);
+		unsigned long last;
+		void *old;
+
+		last = min(end, curr | (SWAP_ADDRESS_SPACE_PAGES - 1));
+		/* Racy, but a stale shadow only makes for a bogus refault */
+		if (READ_ONCE(address_space->nrexceptional)) {
+			xa_lock_irq(&address_space->i_pages);
+			for (; curr <= last; curr++) {
+				old = radix_tree_lookup(&address_space->i_pages,
+							curr);
+				if (!radix_tree_exceptional_entry(old))
+					continue;
+				swap_cache_replace(address_space, curr, NULL);
+				address_space->nrexceptional--;
+			}
+			xa_unlock_irq(&address_space->i_pages);
+		}
+		if (last == end)
+			break;
+		curr = last + 1;
+	}
+}
+
 /* 
  * If we are the only user, then try to free up the swap cache. 
  * 
@@ -379,7 +489,7 @@ struct page *lookup_swap_cache(swp_entry_t entry, struct vm_area_struct *vma,
 		}
 
 		if (readahead) {
-			count_vm_event(SWAP_RA_HIT);
+			swap_ra_count_event(vma, page, SWAP_RA_HIT);
 			if (!vma || !vma_ra)
 				atomic_inc(&swapin_readahead_hits);
 		}
@@ -394,6 +504,7 @@ struct page *__read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 {
 	struct page *found_page = NULL, *new_page = NULL;
 	struct swap_info_struct *si;
+	void *shadow;
 	int err;
 	*new_page_allocated = false;
 
@@ -461,9 +572,16 @@ struct page *__read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		/* May fail (-ENOMEM) if radix-tree node allocation failed. */
 		__SetPageLocked(new_page);
 		__SetPageSwapBacked(new_page);
-		err = __add_to_swap_cache(new_page, entry);
+		shadow = NULL;
+		err = __add_to_swap_cache(new_page, entry, &shadow);
 		if (likely(!err)) {
 			radix_tree_preload_end();
+			/* Activate it if it was swapped out only recently */
+			if (shadow && workingset_refault(shadow, false)) {
+				SetPageActive(new_page);
+				SetPageWorkingset(new_page);
+				workingset_activation(new_page);
+			}
 			/*
 			 * Initiate read into locked page and return.
 			 */
@@ -504,6 +622,15 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 	return retpage;
 }
 
+static void swap_ra_submit(struct page **pages, int nr)
+{
+	int i;
+
+	swap_readpage_batch(pages, nr);
+	for (i = 0; i < nr; i++)
+		put_page(pages[i]);
+}
+
 static unsigned int __swapin_nr_pages(unsigned long prev_offset,
 				      unsigned long offset,
 				      int hits,
@@ -596,6 +723,8 @@ struct page *swap_cluster_readahead(swp_entry_t entry, gfp_t gfp_mask,
 	bool do_poll = true, page_allocated;
 	struct vm_area_struct *vma = vmf->vma;
 	unsigned long addr = vmf->address;
+	struct page *pages[SWAP_RA_BATCH];
+	int nr = 0;
 
 	mask = swapin_nr_pages(offset) - 1;
 	if (!mask)
@@ -619,14 +748,20 @@ struct page *swap_cluster_readahead(swp_entry_t entry, gfp_t gfp_mask,
 		if (!page)
 			continue;
 		if (page_allocated) {
-			swap_readpage(page, false);
 			if (offset != entry_offset) {
 				SetPageReadahead(page);
-				count_vm_event(SWAP_RA);
+				swap_ra_count_event(vma, page, SWAP_RA);
+			}
+			pages[nr++] = page;
+			if (nr == SWAP_RA_BATCH) {
+				swap_ra_submit(pages, nr);
+				nr = 0;
 			}
+			continue;
 		}
 		put_page(page);
 	}
+	swap_ra_submit(pages, nr);
 	blk_finish_plug(&plug);
 
 	lru_add_drain();	/* Push any new pages onto the LRU now */
@@ -713,8 +848,13 @@ static void swap_ra_info(struct vm_fault *vmf,
 	hits = SWAP_RA_HITS(ra_val);
 	ra_info->win = win = __swapin_nr_pages(pfn, fpfn, hits,
 					       max_win, prev_win);
+	/*
+	 * This is a miss.  Halve the hits instead of forgetting them, so the
+	 * window follows the recent hit/miss history of the VMA rather than
+	 * the hits since its last miss only.
+	 */
 	atomic_long_set(&vma->swap_readahead_info,
-			SWAP_RA_VAL(faddr, win, 0));
+			SWAP_RA_VAL(faddr, win, hits / 2));
 
 	if (win == 1) {
 		pte_unmap(orig_pte);
@@ -756,6 +896,8 @@ static struct page *swap_vma_readahead(swp_entry_t fentry, gfp_t gfp_mask,
 	unsigned int i;
 	bool page_allocated;
 	struct vma_swap_readahead ra_info = {0,};
+	struct page *pages[SWAP_RA_BATCH];
+	int nr = 0;
 
 	swap_ra_info(vmf, &ra_info);
 	if (ra_info.win == 1)
@@ -777,14 +919,20 @@ static struct page *swap_vma_readahead(swp_entry_t fentry, gfp_t gfp_mask,
 		if (!page)
 			continue;
 		if (page_allocated) {
-			swap_readpage(page, false);
 			if (i != ra_info.offset) {
 				SetPageReadahead(page);
-				count_vm_event(SWAP_RA);
+				swap_ra_count_event(vma, page, SWAP_RA);
 			}
+			pages[nr++] = page;
+			if (nr == SWAP_RA_BATCH) {
+				swap_ra_submit(pages, nr);
+				nr = 0;
+			}
+			continue;
 		}
 		put_page(page);
 	}
+	swap_ra_submit(pages, nr);
 	blk_finish_plug(&plug);
 	lru_add_drain();
 skip:
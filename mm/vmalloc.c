@@ -670,6 +670,13 @@ static bool vmap_initialized __read_mostly;
  */
 static struct kmem_cache *vmap_area_cachep;
 
+/*
+ * The free tree and list have their own lock, so that carving out or
+ * returning free space does not hold up lookups in the busy tree.
+ * The two locks are never held at the same time.
+ */
+static DEFINE_SPINLOCK(free_vmap_area_lock);
+
 /*
  * This linked list is used in pair with free_vmap_area_root.
  * It gives O(1) access to prev/next to perform fast coalescing.
@@ -1380,21 +1387,23 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 	kmemleak_scan_area(&va->rb_node, SIZE_MAX, gfp_mask & GFP_RECLAIM_MASK);
 
 retry:
-	spin_lock(&vmap_area_lock);
+	spin_lock(&free_vmap_area_lock);
 
 	/*
 	 * If an allocation fails, the "vend" address is
 	 * returned. Therefore trigger the overflow path.
 	 */
 	addr = __alloc_vmap_area(size, align, vstart, vend, node);
+	spin_unlock(&free_vmap_area_lock);
 	if (unlikely(addr == vend))
 		goto overflow;
 
 	va->va_start = addr;
 	va->va_end = addr + size;
 	va->flags = 0;
-	insert_vmap_area(va, &vmap_area_root, &vmap_area_list);
 
+	spin_lock(&vmap_area_lock);
+	insert_vmap_area(va, &vmap_area_root, &vmap_area_list);
 	spin_unlock(&vmap_area_lock);
 
 	BUG_ON(!IS_ALIGNED(va->va_start, align));
@@ -1404,7 +1413,6 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 	return va;
 
 overflow:
-	spin_unlock(&vmap_area_lock);
 	if (!purged) {
 		purge_vmap_area_lazy();
 		purged = 1;
@@ -1440,30 +1448,27 @@ int unregister_vmap_purge_notifier(struct notifier_block *nb)
 }
 EXPORT_SYMBOL_GPL(unregister_vmap_purge_notifier);
 
-static void __free_vmap_area(struct vmap_area *va)
+/*
+ * Free a region of KVA allocated by alloc_vmap_area
+ */
+static void free_vmap_area(struct vmap_area *va)
 {
 	BUG_ON(RB_EMPTY_NODE(&va->rb_node));
 
 	/*
 	 * Remove from the busy tree/list.
 	 */
+	spin_lock(&vmap_area_lock);
 	unlink_va(va, &vmap_area_root);
+	spin_unlock(&vmap_area_lock);
 
 	/*
 	 * Merge VA with its neighbors, otherwise just add it.
 	 */
+	spin_lock(&free_vmap_area_lock);
 	merge_or_add_vmap_area(va,
 		&free_vmap_area_root, &free_vmap_area_list);
-}
-
-/*
- * Free a region of KVA allocated by alloc_vmap_area
- */
-static void free_vmap_area(struct vmap_area *va)
-{
-	spin_lock(&vmap_area_lock);
-	__free_vmap_area(va);
-	spin_unlock(&vmap_area_lock);
+	spin_unlock(&free_vmap_area_lock);
 }
 
 /*
@@ -1546,30 +1551,44 @@ static bool __purge_vmap_area_lazy(unsigned long start, unsigned long end)
 
 	flush_tlb_kernel_range(start, end);
 
+	/* Take the whole batch off the busy tree, then merge it back */
 	spin_lock(&vmap_area_lock);
+	llist_for_each_entry(va, valist, purge_list) {
+		BUG_ON(RB_EMPTY_NODE(&va->rb_node));
+		unlink_va(va, &vmap_area_root);
+		cond_resched_lock(&vmap_area_lock);
+	}
+	spin_unlock(&vmap_area_lock);
+
+	spin_lock(&free_vmap_area_lock);
 	llist_for_each_entry_safe(va, n_va, valist, purge_list) {
 		int nr = (va->va_end - va->va_start) >> PAGE_SHIFT;
 
-		__free_vmap_area(va);
+		merge_or_add_vmap_area(va,
+			&free_vmap_area_root, &free_vmap_area_list);
 		atomic_sub(nr, &vmap_lazy_nr);
-		cond_resched_lock(&vmap_area_lock);
+		cond_resched_lock(&free_vmap_area_lock);
 	}
-	spin_unlock(&vmap_area_lock);
+	spin_unlock(&free_vmap_area_lock);
 	return true;
 }
 
 /*
- * Kick off a purge of the outstanding lazy areas. Don't bother if somebody
- * is already purging.
+ * Purge the outstanding lazy areas from a worker, so that the CPUs freeing
+ * them only queue them up and the TLB flush is done once per batch.  Keep
+ * going while frees come in faster than they are purged.
  */
-static void try_purge_vmap_area_lazy(void)
+static void drain_vmap_area_work(struct work_struct *work)
 {
-	if (mutex_trylock(&vmap_purge_lock)) {
+	do {
+		mutex_lock(&vmap_purge_lock);
 		__purge_vmap_area_lazy(ULONG_MAX, 0);
 		mutex_unlock(&vmap_purge_lock);
-	}
+	} while (atomic_read(&vmap_lazy_nr) > lazy_max_pages());
 }
 
+static DECLARE_WORK(drain_vmap_work, drain_vmap_area_work);
+
 /*
  * Kick off a purge of the outstanding lazy areas.
  */
@@ -1597,7 +1616,7 @@ static void free_vmap_area_noflush(struct vmap_area *va)
 	llist_add(&va->purge_list, &vmap_purge_list);
 
 	if (unlikely(nr_lazy > lazy_max_pages()))
-		try_purge_vmap_area_lazy();
+		schedule_work(&drain_vmap_work);
 }
 
 /*
@@ -2610,7 +2629,30 @@ static void *__vmalloc_area_node(struct vm_struct *area, gfp_t gfp_mask,
 	area->pages = pages;
 	area->nr_pages = nr_pages;
 
-	for (i = 0; i < area->nr_pages; i += 1U << page_order) {
+	/*
+	 * Order-0 pages are taken from the pcp lists in batches, small
+	 * enough to keep the irq-off sections short.  Whatever the bulk
+	 * allocator can't provide is left to the loop below.
+	 */
+	i = 0;
+	if (!page_order && !sp_is_enabled()) {
+		while (i < area->nr_pages) {
+			unsigned int nr, batch;
+
+			batch = min(area->nr_pages - i, 100U);
+			nr = alloc_pages_bulk_array_node(
+					alloc_mask|highmem_mask, node,
+					batch, pages + i);
+			i += nr;
+			if (nr != batch)
+				break;
+
+			if (gfpflags_allow_blocking(gfp_mask|highmem_mask))
+				cond_resched();
+		}
+	}
+
+	for (; i < area->nr_pages; i += 1U << page_order) {
 		struct page *page;
 		int p;
 
@@ -3599,7 +3641,7 @@ struct vm_struct **pcpu_get_vm_areas(const unsigned long *offsets,
 			goto err_free;
 	}
 retry:
-	spin_lock(&vmap_area_lock);
+	spin_lock(&free_vmap_area_lock);
 
 	/* start scanning - we scan from the top, begin with the last area */
 	area = term_area = last_area;
@@ -3681,10 +3723,13 @@ struct vm_struct **pcpu_get_vm_areas(const unsigned long *offsets,
 		va = vas[area];
 		va->va_start = start;
 		va->va_end = start + size;
-
-		insert_vmap_area(va, &vmap_area_root, &vmap_area_list);
 	}
 
+	spin_unlock(&free_vmap_area_lock);
+
+	spin_lock(&vmap_area_lock);
+	for (area = 0; area < nr_vms; area++)
+		insert_vmap_area(vas[area], &vmap_area_root, &vmap_area_list);
 	spin_unlock(&vmap_area_lock);
 
 	/* insert all vm's */
@@ -3696,14 +3741,15 @@ struct vm_struct **pcpu_get_vm_areas(const unsigned long *offsets,
 	return vms;
 
 recovery:
-	/* Remove previously inserted areas. */
+	/* Return previously allocated areas to the free space. */
 	while (area--) {
-		__free_vmap_area(vas[area]);
+		merge_or_add_vmap_area(vas[area],
+			&free_vmap_area_root, &free_vmap_area_list);
 		vas[area] = NULL;
 	}
 
 overflow:
-	spin_unlock(&vmap_area_lock);
+	spin_unlock(&free_vmap_area_lock);
 	if (!purged) {
 		purge_vmap_area_lazy();
 		purged = true;
@@ -50,13 +50,17 @@
 #include <linux/prefetch.h>
 #include <linux/printk.h>
 #include <linux/dax.h>
+#include <linux/hugetlb.h>
+#include <linux/mmu_notifier.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
 
 #include <linux/swapops.h>
 #include <linux/balloon_compaction.h>
+#include <linux/migrate.h>
 #include <linux/mem_reliable.h>
+#include <linux/psi.h>
 
 #include "internal.h"
 
@@ -960,8 +964,13 @@ static int __remove_mapping(struct address_space *mapping, struct page *page,
 
 	if (PageSwapCache(page)) {
 		swp_entry_t swap = { .val = page_private(page) };
+		void *shadow = NULL;
+
+		/* Before mem_cgroup_swapout() takes the page's memcg */
+		if (reclaimed)
+			shadow = workingset_eviction(mapping, page);
 		mem_cgroup_swapout(page, swap);
-		__delete_from_swap_cache(page);
+		__delete_from_swap_cache(page, shadow);
 		xa_unlock_irqrestore(&mapping->i_pages, flags);
 		put_swap_page(page, swap);
 	} else {
@@ -1689,7 +1698,7 @@ static __always_inline void update_lru_sizes(struct lruvec *lruvec,
 }
 
 /*
- * zone_lru_lock is heavily contended.  Some of the functions that
+ * The lru_lock is heavily contended.  Some of the functions that
  * shrink the lists perform better by taking out a batch of pages
  * and working on them outside the LRU lock.
  *
@@ -1823,19 +1832,17 @@ int isolate_lru_page(struct page *page)
 	WARN_RATELIMIT(PageTail(page), "trying to isolate tail page");
 
 	if (PageLRU(page)) {
-		struct zone *zone = page_zone(page);
 		struct lruvec *lruvec;
 
-		spin_lock_irq(zone_lru_lock(zone));
-		lruvec = mem_cgroup_page_lruvec(page, zone->zone_pgdat);
-		if (PageLRU(page)) {
+		lruvec = lock_page_lruvec_irq(page);
+		if (page_lru_relock_irq(page, &lruvec)) {
 			int lru = page_lru(page);
 			get_page(page);
 			ClearPageLRU(page);
 			del_page_from_lru_list(page, lruvec, lru);
 			ret = 0;
 		}
-		spin_unlock_irq(zone_lru_lock(zone));
+		unlock_page_lruvec_irq(lruvec);
 	}
 	return ret;
 }
@@ -1877,11 +1884,15 @@ static int too_many_isolated(struct pglist_data *pgdat, int file,
 	return isolated > inactive;
 }
 
+/*
+ * Called with the lru_lock of @lruvec held, and returns with it held.
+ * The pages normally go back to @lruvec, but one may have been charged
+ * to another memcg in the meantime, so the lock is switched as needed.
+ */
 static noinline_for_stack void
 putback_inactive_pages(struct lruvec *lruvec, struct list_head *page_list)
 {
-	struct zone_reclaim_stat *reclaim_stat = &lruvec->reclaim_stat;
-	struct pglist_data *pgdat = lruvec_pgdat(lruvec);
+	struct lruvec *locked_lruvec = lruvec;
 	LIST_HEAD(pages_to_free);
 
 	/*
@@ -1894,37 +1905,44 @@ putback_inactive_pages(struct lruvec *lruvec, struct list_head *page_list)
 		VM_BUG_ON_PAGE(PageLRU(page), page);
 		list_del(&page->lru);
 		if (unlikely(!page_evictable(page))) {
-			spin_unlock_irq(&pgdat->lru_lock);
+			unlock_page_lruvec_irq(locked_lruvec);
 			putback_lru_page(page);
-			spin_lock_irq(&pgdat->lru_lock);
+			locked_lruvec = lruvec;
+			spin_lock_irq(&locked_lruvec->lru_lock);
 			continue;
 		}
 
-		lruvec = mem_cgroup_page_lruvec(page, pgdat);
+		locked_lruvec = relock_page_lruvec_irq(page, locked_lruvec);
 
 		SetPageLRU(page);
 		lru = page_lru(page);
-		add_page_to_lru_list(page, lruvec, lru);
+		add_page_to_lru_list(page, locked_lruvec, lru);
 
 		if (is_active_lru(lru)) {
 			int file = is_file_lru(lru);
 			int numpages = hpage_nr_pages(page);
-			reclaim_stat->recent_rotated[file] += numpages;
+			locked_lruvec->reclaim_stat.recent_rotated[file] +=
+				numpages;
 		}
 		if (put_page_testzero(page)) {
 			__ClearPageLRU(page);
 			__ClearPageActive(page);
-			del_page_from_lru_list(page, lruvec, lru);
+			del_page_from_lru_list(page, locked_lruvec, lru);
 
 			if (unlikely(PageCompound(page))) {
-				spin_unlock_irq(&pgdat->lru_lock);
+				unlock_page_lruvec_irq(locked_lruvec);
 				(*get_compound_page_dtor(page))(page);
-				spin_lock_irq(&pgdat->lru_lock);
+				spin_lock_irq(&locked_lruvec->lru_lock);
 			} else
 				list_add(&page->lru, &pages_to_free);
 		}
 	}
 
+	if (locked_lruvec != lruvec) {
+		unlock_page_lruvec_irq(locked_lruvec);
+		spin_lock_irq(&lruvec->lru_lock);
+	}
+
 	/*
 	 * To save our caller's stack, now use input list for pages to free.
 	 */
@@ -1981,7 +1999,7 @@ shrink_inactive_list(unsigned long nr_to_scan, struct lruvec *lruvec,
 	if (!sc->may_unmap)
 		isolate_mode |= ISOLATE_UNMAPPED;
 
-	spin_lock_irq(&pgdat->lru_lock);
+	spin_lock_irq(&lruvec->lru_lock);
 
 	nr_taken = isolate_lru_pages(nr_to_scan, lruvec, &page_list,
 				     &nr_scanned, sc, isolate_mode, lru);
@@ -2000,7 +2018,7 @@ shrink_inactive_list(unsigned long nr_to_scan, struct lruvec *lruvec,
 		count_memcg_events(lruvec_memcg(lruvec), PGSCAN_DIRECT,
 				   nr_scanned);
 	}
-	spin_unlock_irq(&pgdat->lru_lock);
+	spin_unlock_irq(&lruvec->lru_lock);
 
 	if (nr_taken == 0)
 		return 0;
@@ -2008,7 +2026,7 @@ shrink_inactive_list(unsigned long nr_to_scan, struct lruvec *lruvec,
 	nr_reclaimed = shrink_page_list(&page_list, pgdat, sc, 0,
 				&stat, false);
 
-	spin_lock_irq(&pgdat->lru_lock);
+	spin_lock_irq(&lruvec->lru_lock);
 
 	if (current_is_kswapd()) {
 		if (global_reclaim(sc))
@@ -2026,7 +2044,7 @@ shrink_inactive_list(unsigned long nr_to_scan, struct lruvec *lruvec,
 
 	__mod_node_page_state(pgdat, NR_ISOLATED_ANON + file, -nr_taken);
 
-	spin_unlock_irq(&pgdat->lru_lock);
+	spin_unlock_irq(&lruvec->lru_lock);
 
 	mem_cgroup_uncharge_list(&page_list);
 	free_unref_page_list(&page_list);
@@ -2059,6 +2077,338 @@ shrink_inactive_list(unsigned long nr_to_scan, struct lruvec *lruvec,
 	return nr_reclaimed;
 }
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * Multi-gen LRU: instead of asking rmap about every active page it wants
+ * to deactivate, reclaim walks the page tables of the processes of a
+ * memcg, a whole page table at a time, and moves the accessed bits it
+ * finds over to the pages.  Each such walk opens a new generation of the
+ * lruvec; the active pages not accessed since the last walk are then
+ * deactivated without any rmap walk.  Whether a deactivated page is still
+ * in use is checked as before when it reaches the end of the inactive list.
+ */
+#ifdef CONFIG_LRU_GEN_ENABLED
+static DEFINE_STATIC_KEY_TRUE(lru_gen_key);
+#define lru_gen_enabled()	static_branch_likely(&lru_gen_key)
+#else
+static DEFINE_STATIC_KEY_FALSE(lru_gen_key);
+#define lru_gen_enabled()	static_branch_unlikely(&lru_gen_key)
+#endif
+
+/* mms of the root memcg are on its own list, this one is for !memcg */
+static struct lru_gen_mm_list lru_gen_mm_list = {
+	.head	= LIST_HEAD_INIT(lru_gen_mm_list.head),
+	.lock	= __SPIN_LOCK_UNLOCKED(lru_gen_mm_list.lock),
+};
+
+static struct lru_gen_mm_list *get_mm_list(struct mem_cgroup *memcg)
+{
+#ifdef CONFIG_MEMCG
+	if (memcg)
+		return &to_memcg_ext(memcg)->lru_gen_mm_list;
+#endif
+	return &lru_gen_mm_list;
+}
+
+void lru_gen_init_mm(struct mm_struct *mm)
+{
+	INIT_LIST_HEAD(&mm->lru_gen_list);
+#ifdef CONFIG_MEMCG
+	mm->lru_gen_memcg = NULL;
+#endif
+}
+
+/*
+ * Called once the owner of a new mm is in its final memcg, with the owner
+ * locked against memcg migration.  The mms created while lru_gen is off
+ * are left out, so that fork and exit don't pay for it.
+ */
+void lru_gen_add_mm(struct mm_struct *mm)
+{
+	struct mem_cgroup *memcg = NULL;
+	struct lru_gen_mm_list *mm_list;
+
+	if (!lru_gen_enabled())
+		return;
+
+#ifdef CONFIG_MEMCG
+	memcg = get_mem_cgroup_from_mm(mm);
+	mm->lru_gen_memcg = memcg;
+#endif
+	mm_list = get_mm_list(memcg);
+
+	spin_lock(&mm_list->lock);
+	list_add_tail(&mm->lru_gen_list, &mm_list->head);
+	mm_list->nr++;
+	spin_unlock(&mm_list->lock);
+}
+
+void lru_gen_del_mm(struct mm_struct *mm)
+{
+	struct mem_cgroup *memcg = NULL;
+	struct lru_gen_mm_list *mm_list;
+
+	/* walkers only rotate the list, the entry never looks empty to us */
+	if (list_empty(&mm->lru_gen_list))
+		return;
+
+#ifdef CONFIG_MEMCG
+	memcg = mm->lru_gen_memcg;
+#endif
+	mm_list = get_mm_list(memcg);
+
+	spin_lock(&mm_list->lock);
+	list_del_init(&mm->lru_gen_list);
+	mm_list->nr--;
+	spin_unlock(&mm_list->lock);
+
+#ifdef CONFIG_MEMCG
+	if (memcg)
+		css_put(&memcg->css);
+	mm->lru_gen_memcg = NULL;
+#endif
+}
+
+#ifdef CONFIG_MEMCG
+void lru_gen_init_memcg(struct mem_cgroup *memcg)
+{
+	struct lru_gen_mm_list *mm_list = get_mm_list(memcg);
+
+	INIT_LIST_HEAD(&mm_list->head);
+	mm_list->nr = 0;
+	spin_lock_init(&mm_list->lock);
+}
+
+/*
+ * The owner of @mm moved to another memcg, or @mm got a new owner: move
+ * @mm to the list of that memcg.  The owner is locked by the caller.
+ */
+void lru_gen_migrate_mm(struct mm_struct *mm)
+{
+	struct mem_cgroup *memcg;
+
+	if (mem_cgroup_disabled() || !mm->lru_gen_memcg)
+		return;
+
+	rcu_read_lock();
+	memcg = mem_cgroup_from_task(rcu_dereference(mm->owner));
+	rcu_read_unlock();
+	if (memcg == mm->lru_gen_memcg)
+		return;
+
+	lru_gen_del_mm(mm);
+	lru_gen_add_mm(mm);
+}
+#endif
+
+/* Carry an accessed bit found in the page tables over to the page */
+static void lru_gen_mark_young(struct page *page)
+{
+	page = compound_head(page);
+	if (!PageLRU(page) || PageUnevictable(page))
+		return;
+
+	if (!PageActive(page))
+		activate_page(page);
+	else if (!PageReferenced(page))
+		SetPageReferenced(page);
+}
+
+static int lru_gen_test_walk(unsigned long start, unsigned long end,
+			     struct mm_walk *walk)
+{
+	struct vm_area_struct *vma = walk->vma;
+
+	/* Nothing there on the lru, or accesses rmap should not count */
+	if (vma->vm_flags & (VM_SPECIAL | VM_LOCKED | VM_SEQ_READ |
+			     VM_RAND_READ))
+		return 1;
+	if (is_vm_hugetlb_page(vma) || vma_is_dax(vma))
+		return 1;
+
+	return 0;
+}
+
+static int lru_gen_pmd_entry(pmd_t *pmd, unsigned long addr,
+			     unsigned long end, struct mm_walk *walk)
+{
+	struct vm_area_struct *vma = walk->vma;
+	struct pglist_data *pgdat = walk->private;
+	struct page *page;
+	pte_t *pte, *orig_pte;
+	spinlock_t *ptl;
+
+	ptl = pmd_trans_huge_lock(pmd, vma);
+	if (ptl) {
+		if (pmd_trans_huge(*pmd) && pmd_young(*pmd) &&
+		    !is_huge_zero_pmd(*pmd)) {
+			page = pmd_page(*pmd);
+			if (page_to_nid(page) == pgdat->node_id &&
+			    pmdp_clear_young_notify(vma, addr, pmd))
+				lru_gen_mark_young(page);
+		}
+		spin_unlock(ptl);
+		return 0;
+	}
+
+	if (pmd_trans_unstable(pmd))
+		return 0;
+
+	orig_pte = pte = pte_offset_map_lock(walk->mm, pmd, addr, &ptl);
+	for (; addr != end; pte++, addr += PAGE_SIZE) {
+		if (!pte_present(*pte) || !pte_young(*pte))
+			continue;
+
+		/* Leave the accessed bit to the walks of the other nodes */
+		page = vm_normal_page(vma, addr, *pte);
+		if (!page || page_to_nid(page) != pgdat->node_id)
+			continue;
+
+		if (ptep_clear_young_notify(vma, addr, pte))
+			lru_gen_mark_young(page);
+	}
+	pte_unmap_unlock(orig_pte, ptl);
+	cond_resched();
+
+	return 0;
+}
+
+/*
+ * Open a new generation of @lruvec if the last one has been swept, by
+ * walking the page tables of the mms owned by its memcg.
+ */
+static void lru_gen_age_lruvec(struct lruvec *lruvec)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	struct mem_cgroup *memcg = lruvec_memcg(lruvec);
+	struct mm_walk walk = {
+		.pmd_entry	= lru_gen_pmd_entry,
+		.test_walk	= lru_gen_test_walk,
+		.private	= lruvec_pgdat(lruvec),
+	};
+	struct lru_gen_mm_list *mm_list = get_mm_list(memcg);
+	struct list_head *head = &mm_list->head;
+	struct mm_struct *mm;
+	unsigned long nr;
+
+	if (READ_ONCE(lrugen->min_seq) != READ_ONCE(lrugen->max_seq))
+		return;
+
+	/* Somebody else is opening it */
+	if (test_and_set_bit_lock(LRU_GEN_AGING, &lrugen->flags))
+		return;
+
+	spin_lock(&mm_list->lock);
+	for (nr = mm_list->nr; nr && !list_empty(head); nr--) {
+		mm = list_first_entry(head, struct mm_struct, lru_gen_list);
+		list_move_tail(&mm->lru_gen_list, head);
+
+		if (!mmget_not_zero(mm))
+			continue;
+		spin_unlock(&mm_list->lock);
+
+		/* Don't wait for the mmap_sem, catch it on the next walk */
+		if (down_read_trylock(&mm->mmap_sem)) {
+			if (mm->highest_vm_end) {
+				walk.mm = mm;
+				walk_page_range(0, mm->highest_vm_end, &walk);
+			}
+			up_read(&mm->mmap_sem);
+		}
+		/* Don't tear the mm down from reclaim */
+		mmput_async(mm);
+
+		cond_resched();
+		spin_lock(&mm_list->lock);
+	}
+	spin_unlock(&mm_list->lock);
+
+	spin_lock_irq(&lruvec->lru_lock);
+	lrugen->nr_to_sweep =
+		lruvec_lru_size(lruvec, LRU_ACTIVE_ANON, MAX_NR_ZONES) +
+		lruvec_lru_size(lruvec, LRU_ACTIVE_FILE, MAX_NR_ZONES);
+	WRITE_ONCE(lrugen->max_seq, lrugen->max_seq + 1);
+	spin_unlock_irq(&lruvec->lru_lock);
+
+	clear_bit_unlock(LRU_GEN_AGING, &lrugen->flags);
+}
+
+/* Account @nr_taken active pages swept; called with the lru_lock held */
+static void lru_gen_sweep(struct lruvec *lruvec, unsigned long nr_taken)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+
+	if (lrugen->nr_to_sweep > nr_taken) {
+		lrugen->nr_to_sweep -= nr_taken;
+		return;
+	}
+
+	lrugen->nr_to_sweep = 0;
+	WRITE_ONCE(lrugen->min_seq, lrugen->max_seq);
+}
+
+#ifdef CONFIG_SYSFS
+static ssize_t lru_gen_enabled_show(struct kobject *kobj,
+				    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", lru_gen_enabled());
+}
+
+static ssize_t lru_gen_enabled_store(struct kobject *kobj,
+				     struct kobj_attribute *attr,
+				     const char *buf, size_t len)
+{
+	bool enable;
+
+	if (kstrtobool(buf, &enable))
+		return -EINVAL;
+
+	if (enable)
+		static_branch_enable(&lru_gen_key);
+	else
+		static_branch_disable(&lru_gen_key);
+
+	return len;
+}
+
+static struct kobj_attribute lru_gen_enabled_attr =
+	__ATTR(enabled, 0644, lru_gen_enabled_show, lru_gen_enabled_store);
+
+static struct attribute *lru_gen_attrs[] = {
+	&lru_gen_enabled_attr.attr,
+	NULL,
+};
+
+static const struct attribute_group lru_gen_attr_group = {
+	.name	= "lru_gen",
+	.attrs	= lru_gen_attrs,
+};
+
+static int __init lru_gen_init(void)
+{
+	if (sysfs_create_group(mm_kobj, &lru_gen_attr_group))
+		pr_err("lru_gen: failed to create sysfs group\n");
+
+	return 0;
+}
+late_initcall(lru_gen_init);
+#endif /* CONFIG_SYSFS */
+#else /* !CONFIG_LRU_GEN */
+static inline bool lru_gen_enabled(void)
+{
+	return false;
+}
+
+static inline void lru_gen_age_lruvec(struct lruvec *lruvec)
+{
+}
+
+static inline void lru_gen_sweep(struct lruvec *lruvec,
+				 unsigned long nr_taken)
+{
+}
+#endif /* CONFIG_LRU_GEN */
+
 /*
  * This moves pages from the active list to the inactive list.
  *
@@ -2066,9 +2416,9 @@ shrink_inactive_list(unsigned long nr_to_scan, struct lruvec *lruvec,
  * processes, from rmap.
  *
  * If the pages are mostly unmapped, the processing is fast and it is
- * appropriate to hold zone_lru_lock across the whole operation.  But if
+ * appropriate to hold lru_lock across the whole operation.  But if
  * the pages are mapped, the processing is slow (page_referenced()) so we
- * should drop zone_lru_lock around each page.  It's impossible to balance
+ * should drop lru_lock around each page.  It's impossible to balance
  * this, so instead we remove the pages from the LRU while processing them.
  * It is safe to rely on PG_active against the non-LRU pages in here because
  * nobody will play with that bit on a non-LRU page.
@@ -2084,32 +2434,33 @@ static unsigned move_active_pages_to_lru(struct lruvec *lruvec,
 				     struct list_head *pages_to_free,
 				     enum lru_list lru)
 {
-	struct pglist_data *pgdat = lruvec_pgdat(lruvec);
+	struct lruvec *locked_lruvec = lruvec;
 	struct page *page;
 	int nr_pages;
 	int nr_moved = 0;
 
 	while (!list_empty(list)) {
 		page = lru_to_page(list);
-		lruvec = mem_cgroup_page_lruvec(page, pgdat);
+		locked_lruvec = relock_page_lruvec_irq(page, locked_lruvec);
 
 		VM_BUG_ON_PAGE(PageLRU(page), page);
 		SetPageLRU(page);
 
 		nr_pages = hpage_nr_pages(page);
-		update_lru_size(lruvec, lru, page_zonenum(page), nr_pages);
+		update_lru_size(locked_lruvec, lru, page_zonenum(page),
+				nr_pages);
 		reliable_lru_add(lru, page, nr_pages);
-		list_move(&page->lru, &lruvec->lists[lru]);
+		list_move(&page->lru, &locked_lruvec->lists[lru]);
 
 		if (put_page_testzero(page)) {
 			__ClearPageLRU(page);
 			__ClearPageActive(page);
-			del_page_from_lru_list(page, lruvec, lru);
+			del_page_from_lru_list(page, locked_lruvec, lru);
 
 			if (unlikely(PageCompound(page))) {
-				spin_unlock_irq(&pgdat->lru_lock);
+				unlock_page_lruvec_irq(locked_lruvec);
 				(*get_compound_page_dtor(page))(page);
-				spin_lock_irq(&pgdat->lru_lock);
+				spin_lock_irq(&locked_lruvec->lru_lock);
 			} else
 				list_add(&page->lru, pages_to_free);
 		} else {
@@ -2117,6 +2468,12 @@ static unsigned move_active_pages_to_lru(struct lruvec *lruvec,
 		}
 	}
 
+	/* return with the lruvec of the caller locked */
+	if (locked_lruvec != lruvec) {
+		unlock_page_lruvec_irq(locked_lruvec);
+		spin_lock_irq(&lruvec->lru_lock);
+	}
+
 	return nr_moved;
 }
 
@@ -2139,15 +2496,20 @@ static void shrink_active_list(unsigned long nr_to_scan,
 	int file = is_file_lru(lru);
 	struct pglist_data *pgdat = lruvec_pgdat(lruvec);
 
+	if (lru_gen_enabled())
+		lru_gen_age_lruvec(lruvec);
+
 	lru_add_drain();
 
 	if (!sc->may_unmap)
 		isolate_mode |= ISOLATE_UNMAPPED;
 
-	spin_lock_irq(&pgdat->lru_lock);
+	spin_lock_irq(&lruvec->lru_lock);
 
 	nr_taken = isolate_lru_pages(nr_to_scan, lruvec, &l_hold,
 				     &nr_scanned, sc, isolate_mode, lru);
+	if (lru_gen_enabled())
+		lru_gen_sweep(lruvec, nr_taken);
 
 	__mod_node_page_state(pgdat, NR_ISOLATED_ANON + file, nr_taken);
 	reclaim_stat->recent_scanned[file] += nr_taken;
@@ -2155,7 +2517,7 @@ static void shrink_active_list(unsigned long nr_to_scan,
 	__count_vm_events(PGREFILL, nr_scanned);
 	count_memcg_events(lruvec_memcg(lruvec), PGREFILL, nr_scanned);
 
-	spin_unlock_irq(&pgdat->lru_lock);
+	spin_unlock_irq(&lruvec->lru_lock);
 
 	while (!list_empty(&l_hold)) {
 		cond_resched();
@@ -2175,8 +2537,15 @@ static void shrink_active_list(unsigned long nr_to_scan,
 			}
 		}
 
-		if (page_referenced(page, 0, sc->target_mem_cgroup,
-				    &vm_flags)) {
+		if (lru_gen_enabled()) {
+			/* Accessed since the last page table walk */
+			if (TestClearPageReferenced(page)) {
+				nr_rotated += hpage_nr_pages(page);
+				list_add(&page->lru, &l_active);
+				continue;
+			}
+		} else if (page_referenced(page, 0, sc->target_mem_cgroup,
+					   &vm_flags)) {
 			nr_rotated += hpage_nr_pages(page);
 			/*
 			 * Identify referenced, file-backed active pages and
@@ -2200,7 +2569,7 @@ static void shrink_active_list(unsigned long nr_to_scan,
 	/*
 	 * Move pages back to the lru list.
 	 */
-	spin_lock_irq(&pgdat->lru_lock);
+	spin_lock_irq(&lruvec->lru_lock);
 	/*
 	 * Count referenced pages from currently used mappings as rotated,
 	 * even though only some of them are actually re-activated.  This
@@ -2216,7 +2585,7 @@ static void shrink_active_list(unsigned long nr_to_scan,
 	__count_memcg_events(lruvec_memcg(lruvec), PGDEACTIVATE, nr_deactivate);
 
 	__mod_node_page_state(pgdat, NR_ISOLATED_ANON + file, -nr_taken);
-	spin_unlock_irq(&pgdat->lru_lock);
+	spin_unlock_irq(&lruvec->lru_lock);
 
 	mem_cgroup_uncharge_list(&l_hold);
 	free_unref_page_list(&l_hold);
@@ -2278,8 +2647,9 @@ static bool inactive_list_is_low(struct lruvec *lruvec, bool file,
 	 * is being established. Disable active list protection to get
 	 * rid of the stale workingset quickly.
 	 */
-	refaults = lruvec_page_state_local(lruvec, WORKINGSET_ACTIVATE);
-	if (file && lruvec->refaults != refaults) {
+	refaults = lruvec_page_state_local(lruvec, file ? WORKINGSET_ACTIVATE :
+						  WORKINGSET_ACTIVATE_ANON);
+	if (lruvec->refaults[file] != refaults) {
 		inactive_ratio = 0;
 	} else {
 		gb = (inactive + active) >> (30 - PAGE_SHIFT);
@@ -2452,7 +2822,7 @@ static void get_scan_count(struct lruvec *lruvec, struct mem_cgroup *memcg,
 	file  = lruvec_lru_size(lruvec, LRU_ACTIVE_FILE, MAX_NR_ZONES) +
 		lruvec_lru_size(lruvec, LRU_INACTIVE_FILE, MAX_NR_ZONES);
 
-	spin_lock_irq(&pgdat->lru_lock);
+	spin_lock_irq(&lruvec->lru_lock);
 	if (unlikely(reclaim_stat->recent_scanned[0] > anon / 4)) {
 		reclaim_stat->recent_scanned[0] /= 2;
 		reclaim_stat->recent_rotated[0] /= 2;
@@ -2473,7 +2843,7 @@ static void get_scan_count(struct lruvec *lruvec, struct mem_cgroup *memcg,
 
 	fp = file_prio * (reclaim_stat->recent_scanned[1] + 1);
 	fp /= reclaim_stat->recent_rotated[1] + 1;
-	spin_unlock_irq(&pgdat->lru_lock);
+	spin_unlock_irq(&lruvec->lru_lock);
 
 	fraction[0] = ap;
 	fraction[1] = fp;
@@ -3034,12 +3404,13 @@ static void snapshot_refaults(struct mem_cgroup *root_memcg, pg_data_t *pgdat)
 
 	memcg = mem_cgroup_iter(root_memcg, NULL, NULL);
 	do {
-		unsigned long refaults;
 		struct lruvec *lruvec;
 
 		lruvec = mem_cgroup_lruvec(pgdat, memcg);
-		refaults = lruvec_page_state_local(lruvec, WORKINGSET_ACTIVATE);
-		lruvec->refaults = refaults;
+		lruvec->refaults[0] = lruvec_page_state_local(lruvec,
+						WORKINGSET_ACTIVATE_ANON);
+		lruvec->refaults[1] = lruvec_page_state_local(lruvec,
+						WORKINGSET_ACTIVATE);
 	} while ((memcg = mem_cgroup_iter(root_memcg, memcg, NULL)));
 }
 
@@ -3359,6 +3730,7 @@ unsigned long try_to_free_mem_cgroup_pages(struct mem_cgroup *memcg,
 	unsigned long nr_reclaimed;
 	int nid;
 	unsigned int noreclaim_flag;
+	unsigned long pflags;
 	struct scan_control sc = {
 		.nr_to_reclaim = max(nr_pages, SWAP_CLUSTER_MAX),
 		.gfp_mask = (current_gfp_context(gfp_mask) & GFP_RECLAIM_MASK) |
@@ -3385,9 +3757,11 @@ unsigned long try_to_free_mem_cgroup_pages(struct mem_cgroup *memcg,
 					    sc.gfp_mask,
 					    sc.reclaim_idx);
 
+	psi_memstall_enter(&pflags);
 	noreclaim_flag = memalloc_noreclaim_save();
 	nr_reclaimed = do_try_to_free_pages(zonelist, &sc);
 	memalloc_noreclaim_restore(noreclaim_flag);
+	psi_memstall_leave(&pflags);
 
 	trace_mm_vmscan_memcg_reclaim_end(nr_reclaimed);
 
@@ -3552,6 +3926,7 @@ static int balance_pgdat(pg_data_t *pgdat, int order, int classzone_idx)
 	int i;
 	unsigned long nr_soft_reclaimed;
 	unsigned long nr_soft_scanned;
+	unsigned long pflags;
 	struct zone *zone;
 	struct scan_control sc = {
 		.gfp_mask = GFP_KERNEL,
@@ -3562,6 +3937,7 @@ static int balance_pgdat(pg_data_t *pgdat, int order, int classzone_idx)
 		.may_swap = 1,
 	};
 
+	psi_memstall_enter(&pflags);
 	__fs_reclaim_acquire();
 
 	count_vm_event(PAGEOUTRUN);
@@ -3671,6 +4047,7 @@ static int balance_pgdat(pg_data_t *pgdat, int order, int classzone_idx)
 out:
 	snapshot_refaults(NULL, pgdat);
 	__fs_reclaim_release();
+	psi_memstall_leave(&pflags);
 	/*
 	 * Return the order kswapd stopped reclaiming at as
 	 * prepare_kswapd_sleep() takes it into account. If another caller
@@ -4394,15 +4771,13 @@ int page_evictable(struct page *page)
  */
 void check_move_unevictable_pages(struct page **pages, int nr_pages)
 {
-	struct lruvec *lruvec;
-	struct pglist_data *pgdat = NULL;
+	struct lruvec *lruvec = NULL;
 	int pgscanned = 0;
 	int pgrescued = 0;
 	int i;
 
 	for (i = 0; i < nr_pages; i++) {
 		struct page *page = pages[i];
-		struct pglist_data *pagepgdat = page_pgdat(page);
 		int _nr_pages;
 
 		if (PageTransTail(page))
@@ -4411,15 +4786,10 @@ void check_move_unevictable_pages(struct page **pages, int nr_pages)
 		_nr_pages = hpage_nr_pages(page);
 		pgscanned += _nr_pages;
 
-		if (pagepgdat != pgdat) {
-			if (pgdat)
-				spin_unlock_irq(&pgdat->lru_lock);
-			pgdat = pagepgdat;
-			spin_lock_irq(&pgdat->lru_lock);
-		}
-		lruvec = mem_cgroup_page_lruvec(page, pgdat);
+		lruvec = relock_page_lruvec_irq(page, lruvec);
 
-		if (!PageLRU(page) || !PageUnevictable(page))
+		if (!page_lru_relock_irq(page, &lruvec) ||
+		    !PageUnevictable(page))
 			continue;
 
 		if (page_evictable(page)) {
@@ -4433,10 +4803,10 @@ void check_move_unevictable_pages(struct page **pages, int nr_pages)
 		}
 	}
 
-	if (pgdat) {
+	if (lruvec) {
 		__count_vm_events(UNEVICTABLE_PGRESCUED, pgrescued);
 		__count_vm_events(UNEVICTABLE_PGSCANNED, pgscanned);
-		spin_unlock_irq(&pgdat->lru_lock);
+		unlock_page_lruvec_irq(lruvec);
 	}
 }
 #endif /* CONFIG_SHMEM */
@@ -4526,6 +4896,53 @@ int add_page_for_swap(struct page *page, struct list_head *pagelist)
 	return err;
 }
 EXPORT_SYMBOL_GPL(add_page_for_swap);
+
+#if defined(CONFIG_NUMA) && defined(CONFIG_MIGRATION)
+/*
+ * Isolate @page, on which the caller holds a reference, to be moved to
+ * node @nid by migrate_pages_to_node().  Pages already on @nid are left
+ * alone.
+ */
+int add_page_for_migrate(struct page *page, int nid,
+			 struct list_head *pagelist)
+{
+	struct page *head = compound_head(page);
+	int err = 0;
+
+	if (page_to_nid(head) == nid)
+		goto out;
+
+	/* If the page is mapped by more than one process, do not move it */
+	err = -EACCES;
+	if (page_mapcount(page) > 1 || PageHuge(page))
+		goto out;
+
+	err = isolate_lru_page(head);
+	if (err)
+		goto out;
+
+	list_add_tail(&head->lru, pagelist);
+	mod_node_page_state(page_pgdat(head), NR_ISOLATED_ANON +
+			    page_is_file_cache(head), hpage_nr_pages(head));
+out:
+	put_page(page);
+	return err;
+}
+EXPORT_SYMBOL_GPL(add_page_for_migrate);
+
+int migrate_pages_to_node(struct list_head *pagelist, int nid)
+{
+	int err;
+
+	err = migrate_pages(pagelist, alloc_new_node_page, NULL, nid,
+			    MIGRATE_SYNC, MR_SYSCALL);
+	if (err)
+		putback_movable_pages(pagelist);
+
+	return err;
+}
+EXPORT_SYMBOL_GPL(migrate_pages_to_node);
+#endif
 struct page *get_page_from_vaddr(struct mm_struct *mm, unsigned long vaddr)
 {
 	struct page *page;
@@ -4741,7 +5158,7 @@ int do_swapcache_reclaim(unsigned long *swapcache_watermark,
 			pos = NULL;
 			lruvec = mem_cgroup_lruvec(pgdat, memcg);
 			src = &(lruvec->lists[LRU_INACTIVE_ANON]);
-			spin_lock_irq(&pgdat->lru_lock);
+			spin_lock_irq(&lruvec->lru_lock);
 			scan_count = 0;
 
 			/*
@@ -4751,23 +5168,24 @@ int do_swapcache_reclaim(unsigned long *swapcache_watermark,
 			 */
 
 			pos = list_last_entry(src, struct page, lru);
-			spin_unlock_irq(&pgdat->lru_lock);
+			spin_unlock_irq(&lruvec->lru_lock);
 do_scan:
 			cond_resched();
 			scan_count = 0;
-			spin_lock_irq(&pgdat->lru_lock);
+			spin_lock_irq(&lruvec->lru_lock);
 
 			/*
 			 * check if pos page is been released or not in LRU list, if true,
 			 * cancel the subsequent page scanning of the current node.
 			 */
 			if (!pos || &pos->lru == src) {
-				spin_unlock_irq(&pgdat->lru_lock);
+				spin_unlock_irq(&lruvec->lru_lock);
 				continue;
 			}
 
-			if (!PageLRU(pos) || page_lru(pos) != LRU_INACTIVE_ANON) {
-				spin_unlock_irq(&pgdat->lru_lock);
+			if (!PageLRU(pos) || page_lru(pos) != LRU_INACTIVE_ANON ||
+			    !lruvec_holds_page_lru_lock(pos, lruvec)) {
+				spin_unlock_irq(&lruvec->lru_lock);
 				continue;
 			}
 
@@ -4794,7 +5212,7 @@ int do_swapcache_reclaim(unsigned long *swapcache_watermark,
 				nr[nid_num]++;
 				swapcache_total_reclaimable++;
 			}
-			spin_unlock_irq(&pgdat->lru_lock);
+			spin_unlock_irq(&lruvec->lru_lock);
 
 			/*
 			 * Check whether the scanned pages meet
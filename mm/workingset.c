@@ -153,6 +153,20 @@
  *
  * On cache misses for which there are shadow entries, an eligible
  * refault distance will immediately activate the refaulting page.
+ *
+ *
+ *		Anonymous pages
+ *
+ * Swapped out anonymous and shmem pages leave their shadow entries in
+ * the swap cache, and are aged on the same clock: their evictions and
+ * activations advance inactive_age as well.  A swapin is checked against
+ * the shadow entry like a page cache refault, and activated pages count
+ * as rotated for the anon/file balance in get_scan_count().
+ *
+ * What the refault distance is compared to depends on what the page
+ * would have to displace to stay resident: the active file pages, the
+ * inactive file pages for an anonymous page, and with swap available,
+ * the active anonymous pages and the inactive ones for a file page.
  */
 
 #define EVICTION_SHIFT	(RADIX_TREE_EXCEPTIONAL_ENTRY + \
@@ -223,19 +237,10 @@ void *workingset_eviction(struct address_space *mapping, struct page *page)
 	return pack_shadow(memcgid, pgdat, eviction);
 }
 
-/**
- * workingset_refault - evaluate the refault of a previously evicted page
- * @shadow: shadow entry of the evicted page
- *
- * Calculates and evaluates the refault distance of the previously
- * evicted page in the context of the node it was allocated in.
- *
- * Returns %true if the page should be activated, %false otherwise.
- */
-bool workingset_refault(void *shadow)
+static bool __workingset_refault(void *shadow, bool file, bool account)
 {
 	unsigned long refault_distance;
-	unsigned long active_file;
+	unsigned long workingset_size;
 	struct mem_cgroup *memcg;
 	unsigned long eviction;
 	struct lruvec *lruvec;
@@ -269,7 +274,6 @@ bool workingset_refault(void *shadow)
 	}
 	lruvec = mem_cgroup_lruvec(pgdat, memcg);
 	refault = atomic_long_read(&lruvec->inactive_age);
-	active_file = lruvec_lru_size(lruvec, LRU_ACTIVE_FILE, MAX_NR_ZONES);
 
 	/*
 	 * The unsigned subtraction here gives an accurate distance
@@ -289,10 +293,34 @@ bool workingset_refault(void *shadow)
 	 */
 	refault_distance = (refault - eviction) & EVICTION_MASK;
 
-	inc_lruvec_state(lruvec, WORKINGSET_REFAULT);
+	if (account)
+		inc_lruvec_state(lruvec, file ? WORKINGSET_REFAULT :
+					       WORKINGSET_REFAULT_ANON);
 
-	if (refault_distance <= active_file) {
-		inc_lruvec_state(lruvec, WORKINGSET_ACTIVATE);
+	/*
+	 * Compare the distance to the part of the workingset the page
+	 * competes with.  Anon pages only compete with each other when
+	 * there is swap to reclaim them to.
+	 */
+	workingset_size = lruvec_lru_size(lruvec, LRU_ACTIVE_FILE,
+					  MAX_NR_ZONES);
+	if (!file)
+		workingset_size += lruvec_lru_size(lruvec, LRU_INACTIVE_FILE,
+						   MAX_NR_ZONES);
+	if (mem_cgroup_get_nr_swap_pages(memcg) > 0) {
+		workingset_size += lruvec_lru_size(lruvec, LRU_ACTIVE_ANON,
+						   MAX_NR_ZONES);
+		if (file)
+			workingset_size += lruvec_lru_size(lruvec,
+							   LRU_INACTIVE_ANON,
+							   MAX_NR_ZONES);
+	}
+
+	if (refault_distance <= workingset_size) {
+		if (account)
+			inc_lruvec_state(lruvec, file ?
+					 WORKINGSET_ACTIVATE :
+					 WORKINGSET_ACTIVATE_ANON);
 		rcu_read_unlock();
 		return true;
 	}
@@ -300,6 +328,36 @@ bool workingset_refault(void *shadow)
 	return false;
 }
 
+/**
+ * workingset_refault - evaluate the refault of a previously evicted page
+ * @shadow: shadow entry of the evicted page
+ * @file: whether the page is file cache, or anon/shmem coming from swap
+ *
+ * Calculates and evaluates the refault distance of the previously
+ * evicted page in the context of the node it was allocated in.
+ *
+ * Returns %true if the page should be activated, %false otherwise.
+ */
+bool workingset_refault(void *shadow, bool file)
+{
+	return __workingset_refault(shadow, file, true);
+}
+
+/**
+ * workingset_shadow_is_hot - check the refault distance of a shadow entry
+ * @shadow: shadow entry of the evicted page
+ *
+ * Same evaluation as workingset_refault() for page cache, but without
+ * accounting a refault, so it can be used to decide where to place the new page
+ * before it is actually faulted back in.
+ *
+ * Returns %true if the page would be activated on refault.
+ */
+bool workingset_shadow_is_hot(void *shadow)
+{
+	return __workingset_refault(shadow, true, false);
+}
+
 /**
  * workingset_activation - note a page activation
  * @page: page that is being activated
@@ -429,7 +487,8 @@ static enum lru_status shadow_lru_isolate(struct list_head *item,
 	 * Page cache insertions and deletions synchroneously maintain
 	 * the shadow node LRU under the i_pages lock and the
 	 * lru_lock.  Because the page cache tree is emptied before
-	 * the inode can be destroyed, holding the lru_lock pins any
+	 * the inode can be destroyed, and the swap cache trees before
+	 * swapoff frees them, holding the lru_lock pins any
 	 * address_space that has radix tree nodes on the LRU.
 	 *
 	 * We can then safely transition to the i_pages lock to
@@ -56,6 +56,8 @@
 #include <linux/wait.h>
 #include <linux/pagemap.h>
 #include <linux/fs.h>
+#include <linux/nodemask.h>
+#include <linux/percpu.h>
 
 #define ZSPAGE_MAGIC	0x58
 
@@ -198,6 +200,8 @@ static size_t huge_class_size;
 
 struct size_class {
 	spinlock_t lock;
+	/* node of the sub-pool this class belongs to */
+	int nid;
 	struct list_head fullness_list[NR_ZS_FULLNESS];
 	/*
 	 * Size of objects stored in this class. Must be multiple
@@ -248,10 +252,29 @@ struct link_free {
 	};
 };
 
+/*
+ * Objects that are already allocated, with a handle, kept per cpu and
+ * class so that zs_malloc() and zs_free() can mostly skip class->lock.
+ * The lock is only taken by a remote cpu draining the cache.
+ */
+#define ZS_PCP_BATCH	4
+
+struct zs_pcp_class {
+	unsigned int count;
+	unsigned long handle[ZS_PCP_BATCH];
+};
+
+struct zs_pcp {
+	spinlock_t lock;
+	struct zs_pcp_class class[ZS_SIZE_CLASSES];
+};
+
 struct zs_pool {
 	const char *name;
 
-	struct size_class *size_class[ZS_SIZE_CLASSES];
+	/* per node sub-pools: size_class[nid][class_idx] */
+	struct size_class *(*size_class)[ZS_SIZE_CLASSES];
+	struct zs_pcp __percpu *pcp;
 	struct kmem_cache *handle_cachep;
 	struct kmem_cache *zspage_cachep;
 
@@ -284,6 +307,7 @@ struct zspage {
 	};
 	unsigned int inuse;
 	unsigned int freeobj;
+	int nid;
 	struct page *first_page;
 	struct list_head list; /* fullness list */
 #ifdef CONFIG_COMPACTION
@@ -301,6 +325,8 @@ struct mapping_area {
 	enum zs_mapmode vm_mm; /* mapping mode */
 };
 
+static void __zs_free(struct zs_pool *pool, unsigned long handle);
+
 #ifdef CONFIG_COMPACTION
 static int zs_register_migration(struct zs_pool *pool);
 static void zs_unregister_migration(struct zs_pool *pool);
@@ -593,7 +619,7 @@ static unsigned long zs_can_compact(struct size_class *class);
 
 static int zs_stats_size_show(struct seq_file *s, void *v)
 {
-	int i;
+	int i, nid;
 	struct zs_pool *pool = s->private;
 	struct size_class *class;
 	int objs_per_zspage;
@@ -609,18 +635,27 @@ static int zs_stats_size_show(struct seq_file *s, void *v)
 			"pages_per_zspage", "freeable");
 
 	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
-		class = pool->size_class[i];
+		class = pool->size_class[first_node(node_possible_map)][i];
 
 		if (class->index != i)
 			continue;
 
-		spin_lock(&class->lock);
-		class_almost_full = zs_stat_get(class, CLASS_ALMOST_FULL);
-		class_almost_empty = zs_stat_get(class, CLASS_ALMOST_EMPTY);
-		obj_allocated = zs_stat_get(class, OBJ_ALLOCATED);
-		obj_used = zs_stat_get(class, OBJ_USED);
-		freeable = zs_can_compact(class);
-		spin_unlock(&class->lock);
+		/* sum up the class over all the per node sub-pools */
+		class_almost_full = class_almost_empty = 0;
+		obj_allocated = obj_used = freeable = 0;
+		for_each_node(nid) {
+			class = pool->size_class[nid][i];
+
+			spin_lock(&class->lock);
+			class_almost_full +=
+				zs_stat_get(class, CLASS_ALMOST_FULL);
+			class_almost_empty +=
+				zs_stat_get(class, CLASS_ALMOST_EMPTY);
+			obj_allocated += zs_stat_get(class, OBJ_ALLOCATED);
+			obj_used += zs_stat_get(class, OBJ_USED);
+			freeable += zs_can_compact(class);
+			spin_unlock(&class->lock);
+		}
 
 		objs_per_zspage = class->objs_per_zspage;
 		pages_used = obj_allocated / objs_per_zspage *
@@ -1091,12 +1126,13 @@ static struct zspage *alloc_zspage(struct zs_pool *pool,
 
 	memset(zspage, 0, sizeof(struct zspage));
 	zspage->magic = ZSPAGE_MAGIC;
+	zspage->nid = class->nid;
 	migrate_lock_init(zspage);
 
 	for (i = 0; i < class->pages_per_zspage; i++) {
 		struct page *page;
 
-		page = alloc_page(gfp);
+		page = alloc_pages_node(class->nid, gfp, 0);
 		if (!page) {
 			while (--i >= 0) {
 				dec_zone_page_state(pages[i], NR_ZSPAGES);
@@ -1341,7 +1377,7 @@ void *zs_map_object(struct zs_pool *pool, unsigned long handle,
 	migrate_read_lock(zspage);
 
 	get_zspage_mapping(zspage, &class_idx, &fg);
-	class = pool->size_class[class_idx];
+	class = pool->size_class[zspage->nid][class_idx];
 	off = (class->size * obj_idx) & ~PAGE_MASK;
 
 	area = &get_cpu_var(zs_map_area);
@@ -1383,7 +1419,7 @@ void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
 	obj_to_location(obj, &page, &obj_idx);
 	zspage = get_zspage(page);
 	get_zspage_mapping(zspage, &class_idx, &fg);
-	class = pool->size_class[class_idx];
+	class = pool->size_class[zspage->nid][class_idx];
 	off = (class->size * obj_idx) & ~PAGE_MASK;
 
 	area = this_cpu_ptr(&zs_map_area);
@@ -1465,6 +1501,109 @@ static unsigned long obj_malloc(struct size_class *class,
 	return obj;
 }
 
+static unsigned long zs_pcp_get(struct zs_pool *pool, unsigned int class_idx)
+{
+	struct zs_pcp *pcp;
+	struct zs_pcp_class *pc;
+	unsigned long handle = 0;
+
+	pcp = get_cpu_ptr(pool->pcp);
+	spin_lock(&pcp->lock);
+	pc = &pcp->class[class_idx];
+	if (pc->count)
+		handle = pc->handle[--pc->count];
+	spin_unlock(&pcp->lock);
+	put_cpu_ptr(pool->pcp);
+
+	return handle;
+}
+
+/*
+ * Stash up to @nr handles of sub-pool @nid in this cpu's cache. Only
+ * objects local to the cpu are kept. Returns the number stashed.
+ */
+static int zs_pcp_put(struct zs_pool *pool, int nid, unsigned int class_idx,
+			unsigned long *handles, int nr)
+{
+	struct zs_pcp *pcp;
+	struct zs_pcp_class *pc;
+	int i = 0;
+
+	pcp = get_cpu_ptr(pool->pcp);
+	if (nid != numa_mem_id())
+		goto out;
+
+	spin_lock(&pcp->lock);
+	pc = &pcp->class[class_idx];
+	for (; i < nr && pc->count < ZS_PCP_BATCH; i++)
+		pc->handle[pc->count++] = handles[i];
+	spin_unlock(&pcp->lock);
+out:
+	put_cpu_ptr(pool->pcp);
+
+	return i;
+}
+
+/*
+ * Hand the objects cached by the cpus of node @nid, or of all cpus for
+ * NUMA_NO_NODE, back to their zspages so that compaction can see them.
+ */
+static void zs_pcp_drain(struct zs_pool *pool, int nid)
+{
+	struct zs_pcp *pcp;
+	struct zs_pcp_class *pc;
+	unsigned long handle;
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		if (nid != NUMA_NO_NODE && cpu_to_mem(cpu) != nid)
+			continue;
+
+		pcp = per_cpu_ptr(pool->pcp, cpu);
+		for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+			pc = &pcp->class[i];
+			while (READ_ONCE(pc->count)) {
+				handle = 0;
+				spin_lock(&pcp->lock);
+				if (pc->count)
+					handle = pc->handle[--pc->count];
+				spin_unlock(&pcp->lock);
+				if (handle)
+					__zs_free(pool, handle);
+			}
+		}
+	}
+}
+
+/*
+ * Called with class->lock held after an allocation found the per cpu
+ * cache empty: take a few more objects from zspages that have room, so
+ * the next allocations on this cpu don't need the lock. No zspage is
+ * allocated for this.
+ */
+static int zs_pcp_fill(struct zs_pool *pool, struct size_class *class,
+			unsigned long *handles)
+{
+	struct zspage *zspage;
+	unsigned long handle;
+	int nr = 0;
+
+	while (nr < ZS_PCP_BATCH) {
+		zspage = find_get_zspage(class);
+		if (!zspage)
+			break;
+
+		handle = cache_alloc_handle(pool, GFP_NOWAIT | __GFP_NOWARN);
+		if (!handle)
+			break;
+
+		record_obj(handle, obj_malloc(class, zspage, handle));
+		fix_fullness_group(class, zspage);
+		handles[nr++] = handle;
+	}
+
+	return nr;
+}
 
 /**
  * zs_malloc - Allocate block of given size from pool.
@@ -1479,21 +1618,28 @@ static unsigned long obj_malloc(struct size_class *class,
 unsigned long zs_malloc(struct zs_pool *pool, size_t size, gfp_t gfp)
 {
 	unsigned long handle, obj;
+	unsigned long batch[ZS_PCP_BATCH];
 	struct size_class *class;
 	enum fullness_group newfg;
 	struct zspage *zspage;
+	int nid, nr, i;
 
 	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
 		return 0;
 
+	/* extra space in chunk to keep the handle */
+	size += ZS_HANDLE_SIZE;
+	nid = numa_mem_id();
+	class = pool->size_class[nid][get_size_class_index(size)];
+
+	handle = zs_pcp_get(pool, class->index);
+	if (handle)
+		return handle;
+
 	handle = cache_alloc_handle(pool, gfp);
 	if (!handle)
 		return 0;
 
-	/* extra space in chunk to keep the handle */
-	size += ZS_HANDLE_SIZE;
-	class = pool->size_class[get_size_class_index(size)];
-
 	spin_lock(&class->lock);
 	zspage = find_get_zspage(class);
 	if (likely(zspage)) {
@@ -1501,8 +1647,14 @@ unsigned long zs_malloc(struct zs_pool *pool, size_t size, gfp_t gfp)
 		/* Now move the zspage to another fullness group, if required */
 		fix_fullness_group(class, zspage);
 		record_obj(handle, obj);
+		nr = zs_pcp_fill(pool, class, batch);
 		spin_unlock(&class->lock);
 
+		/* we may have moved to another node's cpu meanwhile */
+		i = zs_pcp_put(pool, nid, class->index, batch, nr);
+		for (; i < nr; i++)
+			__zs_free(pool, batch[i]);
+
 		return handle;
 	}
 
@@ -1557,7 +1709,7 @@ static void obj_free(struct size_class *class, unsigned long obj)
 	zs_stat_dec(class, OBJ_USED, 1);
 }
 
-void zs_free(struct zs_pool *pool, unsigned long handle)
+static void __zs_free(struct zs_pool *pool, unsigned long handle)
 {
 	struct zspage *zspage;
 	struct page *f_page;
@@ -1568,9 +1720,6 @@ void zs_free(struct zs_pool *pool, unsigned long handle)
 	enum fullness_group fullness;
 	bool isolated;
 
-	if (unlikely(!handle))
-		return;
-
 	pin_tag(handle);
 	obj = handle_to_obj(handle);
 	obj_to_location(obj, &f_page, &f_objidx);
@@ -1579,7 +1728,7 @@ void zs_free(struct zs_pool *pool, unsigned long handle)
 	migrate_read_lock(zspage);
 
 	get_zspage_mapping(zspage, &class_idx, &fullness);
-	class = pool->size_class[class_idx];
+	class = pool->size_class[zspage->nid][class_idx];
 
 	spin_lock(&class->lock);
 	obj_free(class, obj);
@@ -1600,6 +1749,36 @@ void zs_free(struct zs_pool *pool, unsigned long handle)
 	unpin_tag(handle);
 	cache_free_handle(pool, handle);
 }
+
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	struct zspage *zspage;
+	struct page *f_page;
+	unsigned int f_objidx;
+	int class_idx, nid;
+	enum fullness_group fullness;
+
+	if (unlikely(!handle))
+		return;
+
+	/*
+	 * The object stays allocated, so its zspage can't go away once we
+	 * have looked up the class; migration just updates the handle.
+	 */
+	pin_tag(handle);
+	obj_to_location(handle_to_obj(handle), &f_page, &f_objidx);
+	zspage = get_zspage(f_page);
+	migrate_read_lock(zspage);
+	get_zspage_mapping(zspage, &class_idx, &fullness);
+	nid = zspage->nid;
+	migrate_read_unlock(zspage);
+	unpin_tag(handle);
+
+	if (zs_pcp_put(pool, nid, class_idx, &handle, 1))
+		return;
+
+	__zs_free(pool, handle);
+}
 EXPORT_SYMBOL_GPL(zs_free);
 
 static void zs_object_copy(struct size_class *class, unsigned long dst,
@@ -1993,7 +2172,7 @@ static bool zs_page_isolate(struct page *page, isolate_mode_t mode)
 	get_zspage_mapping(zspage, &class_idx, &fullness);
 	mapping = page_mapping(page);
 	pool = mapping->private_data;
-	class = pool->size_class[class_idx];
+	class = pool->size_class[zspage->nid][class_idx];
 
 	spin_lock(&class->lock);
 	if (get_zspage_inuse(zspage) == 0) {
@@ -2056,7 +2235,7 @@ static int zs_page_migrate(struct address_space *mapping, struct page *newpage,
 	migrate_write_lock(zspage);
 	get_zspage_mapping(zspage, &class_idx, &fullness);
 	pool = mapping->private_data;
-	class = pool->size_class[class_idx];
+	class = pool->size_class[zspage->nid][class_idx];
 	offset = get_first_obj_offset(page);
 
 	spin_lock(&class->lock);
@@ -2168,7 +2347,7 @@ static void zs_page_putback(struct page *page)
 	get_zspage_mapping(zspage, &class_idx, &fg);
 	mapping = page_mapping(page);
 	pool = mapping->private_data;
-	class = pool->size_class[class_idx];
+	class = pool->size_class[zspage->nid][class_idx];
 
 	spin_lock(&class->lock);
 	dec_zspage_isolation(zspage);
@@ -2242,7 +2421,7 @@ static void zs_unregister_migration(struct zs_pool *pool)
  */
 static void async_free_zspage(struct work_struct *work)
 {
-	int i;
+	int i, nid;
 	struct size_class *class;
 	unsigned int class_idx;
 	enum fullness_group fullness;
@@ -2251,14 +2430,17 @@ static void async_free_zspage(struct work_struct *work)
 	struct zs_pool *pool = container_of(work, struct zs_pool,
 					free_work);
 
-	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
-		class = pool->size_class[i];
-		if (class->index != i)
-			continue;
+	for_each_node(nid) {
+		for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+			class = pool->size_class[nid][i];
+			if (class->index != i)
+				continue;
 
-		spin_lock(&class->lock);
-		list_splice_init(&class->fullness_list[ZS_EMPTY], &free_pages);
-		spin_unlock(&class->lock);
+			spin_lock(&class->lock);
+			list_splice_init(&class->fullness_list[ZS_EMPTY],
+					 &free_pages);
+			spin_unlock(&class->lock);
+		}
 	}
 
 
@@ -2268,9 +2450,9 @@ static void async_free_zspage(struct work_struct *work)
 
 		get_zspage_mapping(zspage, &class_idx, &fullness);
 		VM_BUG_ON(fullness != ZS_EMPTY);
-		class = pool->size_class[class_idx];
+		class = pool->size_class[zspage->nid][class_idx];
 		spin_lock(&class->lock);
-		__free_zspage(pool, pool->size_class[class_idx], zspage);
+		__free_zspage(pool, class, zspage);
 		spin_unlock(&class->lock);
 	}
 };
@@ -2364,19 +2546,30 @@ static void __zs_compact(struct zs_pool *pool, struct size_class *class)
 	spin_unlock(&class->lock);
 }
 
-unsigned long zs_compact(struct zs_pool *pool)
+static void zs_compact_node(struct zs_pool *pool, int nid)
 {
 	int i;
 	struct size_class *class;
 
+	/* cached objects would keep their zspages from being freed */
+	zs_pcp_drain(pool, nid);
+
 	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--) {
-		class = pool->size_class[i];
+		class = pool->size_class[nid][i];
 		if (!class)
 			continue;
 		if (class->index != i)
 			continue;
 		__zs_compact(pool, class);
 	}
+}
+
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	int nid;
+
+	for_each_node(nid)
+		zs_compact_node(pool, nid);
 
 	return pool->stats.pages_compacted;
 }
@@ -2397,11 +2590,12 @@ static unsigned long zs_shrinker_scan(struct shrinker *shrinker,
 
 	pages_freed = pool->stats.pages_compacted;
 	/*
-	 * Compact classes and calculate compaction delta.
-	 * Can run concurrently with a manually triggered
-	 * (by user) compaction.
+	 * Compact the classes of the node under reclaim and calculate
+	 * compaction delta. Can run concurrently with a manually
+	 * triggered (by user) compaction.
 	 */
-	pages_freed = zs_compact(pool) - pages_freed;
+	zs_compact_node(pool, sc->nid);
+	pages_freed = pool->stats.pages_compacted - pages_freed;
 
 	return pages_freed ? pages_freed : SHRINK_STOP;
 }
@@ -2416,7 +2610,7 @@ static unsigned long zs_shrinker_count(struct shrinker *shrinker,
 			shrinker);
 
 	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--) {
-		class = pool->size_class[i];
+		class = pool->size_class[sc->nid][i];
 		if (!class)
 			continue;
 		if (class->index != i)
@@ -2439,43 +2633,16 @@ static int zs_register_shrinker(struct zs_pool *pool)
 	pool->shrinker.count_objects = zs_shrinker_count;
 	pool->shrinker.batch = 0;
 	pool->shrinker.seeks = DEFAULT_SEEKS;
+	pool->shrinker.flags = SHRINKER_NUMA_AWARE;
 
 	return register_shrinker(&pool->shrinker);
 }
 
-/**
- * zs_create_pool - Creates an allocation pool to work from.
- * @name: pool name to be created
- *
- * This function must be called before anything when using
- * the zsmalloc allocator.
- *
- * On success, a pointer to the newly created pool is returned,
- * otherwise NULL.
- */
-struct zs_pool *zs_create_pool(const char *name)
+static int zs_create_classes(struct zs_pool *pool, int nid)
 {
 	int i;
-	struct zs_pool *pool;
 	struct size_class *prev_class = NULL;
 
-	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
-	if (!pool)
-		return NULL;
-
-	init_deferred_free(pool);
-
-	pool->name = kstrdup(name, GFP_KERNEL);
-	if (!pool->name)
-		goto err;
-
-#ifdef CONFIG_COMPACTION
-	init_waitqueue_head(&pool->migration_wait);
-#endif
-
-	if (create_cache(pool))
-		goto err;
-
 	/*
 	 * Iterate reversely, because, size of size_class that we want to use
 	 * for merging should be larger or equal to current size.
@@ -2525,21 +2692,23 @@ struct zs_pool *zs_create_pool(const char *name)
 		 */
 		if (prev_class) {
 			if (can_merge(prev_class, pages_per_zspage, objs_per_zspage)) {
-				pool->size_class[i] = prev_class;
+				pool->size_class[nid][i] = prev_class;
 				continue;
 			}
 		}
 
-		class = kzalloc(sizeof(struct size_class), GFP_KERNEL);
+		class = kzalloc_node(sizeof(struct size_class), GFP_KERNEL,
+				     nid);
 		if (!class)
-			goto err;
+			return -ENOMEM;
 
 		class->size = size;
 		class->index = i;
+		class->nid = nid;
 		class->pages_per_zspage = pages_per_zspage;
 		class->objs_per_zspage = objs_per_zspage;
 		spin_lock_init(&class->lock);
-		pool->size_class[i] = class;
+		pool->size_class[nid][i] = class;
 		for (fullness = ZS_EMPTY; fullness < NR_ZS_FULLNESS;
 							fullness++)
 			INIT_LIST_HEAD(&class->fullness_list[fullness]);
@@ -2547,6 +2716,58 @@ struct zs_pool *zs_create_pool(const char *name)
 		prev_class = class;
 	}
 
+	return 0;
+}
+
+/**
+ * zs_create_pool - Creates an allocation pool to work from.
+ * @name: pool name to be created
+ *
+ * This function must be called before anything when using
+ * the zsmalloc allocator.
+ *
+ * On success, a pointer to the newly created pool is returned,
+ * otherwise NULL.
+ */
+struct zs_pool *zs_create_pool(const char *name)
+{
+	int cpu, nid;
+	struct zs_pool *pool;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	init_deferred_free(pool);
+
+	pool->name = kstrdup(name, GFP_KERNEL);
+	if (!pool->name)
+		goto err;
+
+#ifdef CONFIG_COMPACTION
+	init_waitqueue_head(&pool->migration_wait);
+#endif
+
+	if (create_cache(pool))
+		goto err;
+
+	pool->pcp = alloc_percpu(struct zs_pcp);
+	if (!pool->pcp)
+		goto err;
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu_ptr(pool->pcp, cpu)->lock);
+
+	/* one sub-pool per node, objects are allocated from the local one */
+	pool->size_class = kcalloc(nr_node_ids, sizeof(*pool->size_class),
+				   GFP_KERNEL);
+	if (!pool->size_class)
+		goto err;
+
+	for_each_node(nid) {
+		if (zs_create_classes(pool, nid))
+			goto err;
+	}
+
 	/* debug only, don't abort if it fails */
 	zs_pool_stat_create(pool, name);
 
@@ -2569,17 +2790,13 @@ struct zs_pool *zs_create_pool(const char *name)
 }
 EXPORT_SYMBOL_GPL(zs_create_pool);
 
-void zs_destroy_pool(struct zs_pool *pool)
+static void zs_destroy_classes(struct zs_pool *pool, int nid)
 {
 	int i;
 
-	zs_unregister_shrinker(pool);
-	zs_unregister_migration(pool);
-	zs_pool_stat_destroy(pool);
-
 	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
 		int fg;
-		struct size_class *class = pool->size_class[i];
+		struct size_class *class = pool->size_class[nid][i];
 
 		if (!class)
 			continue;
@@ -2595,6 +2812,24 @@ void zs_destroy_pool(struct zs_pool *pool)
 		}
 		kfree(class);
 	}
+}
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int nid;
+
+	zs_unregister_shrinker(pool);
+	zs_unregister_migration(pool);
+	zs_pool_stat_destroy(pool);
+
+	if (pool->size_class) {
+		if (pool->pcp)
+			zs_pcp_drain(pool, NUMA_NO_NODE);
+		for_each_node(nid)
+			zs_destroy_classes(pool, nid);
+		kfree(pool->size_class);
+	}
+	free_percpu(pool->pcp);
 
 	destroy_cache(pool);
 	kfree(pool->name);
@@ -121,6 +121,48 @@ unsigned long neigh_rand_reach_time(unsigned long base)
 EXPORT_SYMBOL(neigh_rand_reach_time);
 
 
+/* Entries that are never reclaimed by GC are kept off tbl->gc_list */
+static bool neigh_exempt_from_gc(const struct neighbour *n)
+{
+	return n->nud_state & NUD_PERMANENT || n->flags & NTF_EXT_LEARNED;
+}
+
+/* Called with tbl->lock held for writing. */
+static void neigh_mark_dead(struct neighbour *n)
+{
+	n->dead = 1;
+	if (!list_empty(&n->gc_list)) {
+		list_del_init(&n->gc_list);
+		atomic_dec(&n->tbl->gc_entries);
+	}
+}
+
+static void neigh_update_gc_list(struct neighbour *n)
+{
+	bool on_gc_list, exempt_from_gc;
+
+	write_lock_bh(&n->tbl->lock);
+	write_lock(&n->lock);
+
+	if (n->dead)
+		goto out;
+
+	exempt_from_gc = neigh_exempt_from_gc(n);
+	on_gc_list = !list_empty(&n->gc_list);
+
+	if (exempt_from_gc && on_gc_list) {
+		list_del_init(&n->gc_list);
+		atomic_dec(&n->tbl->gc_entries);
+	} else if (!exempt_from_gc && !on_gc_list) {
+		list_add_tail(&n->gc_list, &n->tbl->gc_list);
+		atomic_inc(&n->tbl->gc_entries);
+	}
+
+out:
+	write_unlock(&n->lock);
+	write_unlock_bh(&n->tbl->lock);
+}
+
 static bool neigh_del(struct neighbour *n, __u8 state, __u8 flags,
 		      struct neighbour __rcu **np, struct neigh_table *tbl)
 {
@@ -134,7 +176,7 @@ static bool neigh_del(struct neighbour *n, __u8 state, __u8 flags,
 		neigh = rcu_dereference_protected(n->next,
 						  lockdep_is_held(&tbl->lock));
 		rcu_assign_pointer(*np, neigh);
-		n->dead = 1;
+		neigh_mark_dead(n);
 		retval = true;
 	}
 	write_unlock(&n->lock);
@@ -166,34 +208,60 @@ bool neigh_remove_one(struct neighbour *ndel, struct neigh_table *tbl)
 	return false;
 }
 
+/* Forced GC runs from neigh_alloc() with BH disabled, so it only reclaims
+ * enough entries to get back under gc_thresh2 and gives up after
+ * NEIGH_FORCED_GC_BUDGET even if it could not.
+ */
+#define NEIGH_FORCED_GC_BUDGET	NSEC_PER_MSEC
+
 static int neigh_forced_gc(struct neigh_table *tbl)
 {
+	int max_clean = atomic_read(&tbl->gc_entries) - tbl->gc_thresh2;
+	int budget = atomic_read(&tbl->gc_entries);
+	u64 tmax = ktime_get_ns() + NEIGH_FORCED_GC_BUDGET;
+	unsigned long tref = jiffies - 5 * HZ;
+	struct neighbour *n, *tmp;
 	int shrunk = 0;
-	int i;
-	struct neigh_hash_table *nht;
+	int loop = 0;
 
 	NEIGH_CACHE_STAT_INC(tbl, forced_gc_runs);
 
 	write_lock_bh(&tbl->lock);
-	nht = rcu_dereference_protected(tbl->nht,
-					lockdep_is_held(&tbl->lock));
-	for (i = 0; i < (1 << nht->hash_shift); i++) {
-		struct neighbour *n;
-		struct neighbour __rcu **np;
 
-		np = &nht->hash_buckets[i];
-		while ((n = rcu_dereference_protected(*np,
-					lockdep_is_held(&tbl->lock))) != NULL) {
-			/* Neighbour record may be discarded if:
-			 * - nobody refers to it.
-			 * - it is not permanent
-			 */
-			if (neigh_del(n, NUD_PERMANENT, NTF_EXT_LEARNED, np,
-				      tbl)) {
-				shrunk = 1;
-				continue;
-			}
-			np = &n->next;
+	/* The list is kept roughly in least recently examined order:
+	 * entries that survive a scan are moved to the tail.
+	 */
+	list_for_each_entry_safe(n, tmp, &tbl->gc_list, gc_list) {
+		bool remove = false;
+
+		if (budget-- <= 0)
+			break;
+
+		/* Neighbour record may be discarded if:
+		 * - nobody refers to it.
+		 * - it failed, needs no resolution or was not updated
+		 *   recently.
+		 */
+		if (refcount_read(&n->refcnt) == 1) {
+			write_lock(&n->lock);
+			if (n->nud_state == NUD_FAILED ||
+			    n->nud_state == NUD_NOARP ||
+			    time_after(tref, n->updated))
+				remove = true;
+			write_unlock(&n->lock);
+		}
+
+		if (remove && neigh_remove_one(n, tbl)) {
+			if (++shrunk >= max_clean)
+				break;
+		} else {
+			list_move_tail(&n->gc_list, &tbl->gc_list);
+		}
+
+		if (++loop == 16) {
+			if (ktime_get_ns() > tmax)
+				break;
+			loop = 0;
 		}
 	}
 
@@ -272,7 +340,7 @@ static void neigh_flush_dev(struct neigh_table *tbl, struct net_device *dev)
 						lockdep_is_held(&tbl->lock)));
 			write_lock(&n->lock);
 			neigh_del_timer(n);
-			n->dead = 1;
+			neigh_mark_dead(n);
 
 			if (refcount_read(&n->refcnt) != 1) {
 				/* The most unpleasant situation.
@@ -325,7 +393,7 @@ static struct neighbour *neigh_alloc(struct neigh_table *tbl, struct net_device
 	unsigned long now = jiffies;
 	int entries;
 
-	entries = atomic_inc_return(&tbl->entries) - 1;
+	entries = atomic_inc_return(&tbl->gc_entries) - 1;
 	if (entries >= tbl->gc_thresh3 ||
 	    (entries >= tbl->gc_thresh2 &&
 	     time_after(now, tbl->last_flush + 5 * HZ))) {
@@ -342,6 +410,7 @@ static struct neighbour *neigh_alloc(struct neigh_table *tbl, struct net_device
 	if (!n)
 		goto out_entries;
 
+	atomic_inc(&tbl->entries);
 	__skb_queue_head_init(&n->arp_queue);
 	rwlock_init(&n->lock);
 	seqlock_init(&n->ha_lock);
@@ -356,11 +425,12 @@ static struct neighbour *neigh_alloc(struct neigh_table *tbl, struct net_device
 	n->tbl		  = tbl;
 	refcount_set(&n->refcnt, 1);
 	n->dead		  = 1;
+	INIT_LIST_HEAD(&n->gc_list);
 out:
 	return n;
 
 out_entries:
-	atomic_dec(&tbl->entries);
+	atomic_dec(&tbl->gc_entries);
 	goto out;
 }
 
@@ -576,6 +646,7 @@ struct neighbour *__neigh_create(struct neigh_table *tbl, const void *pkey,
 	}
 
 	n->dead = 0;
+	list_add_tail(&n->gc_list, &tbl->gc_list);
 	if (want_ref)
 		neigh_hold(n);
 	rcu_assign_pointer(n->next,
@@ -590,6 +661,7 @@ struct neighbour *__neigh_create(struct neigh_table *tbl, const void *pkey,
 out_tbl_unlock:
 	write_unlock_bh(&tbl->lock);
 out_neigh_release:
+	atomic_dec(&tbl->gc_entries);
 	neigh_release(n);
 	goto out;
 }
@@ -804,19 +876,55 @@ static void neigh_connect(struct neighbour *neigh)
 	neigh->output = neigh->ops->connected_output;
 }
 
+/* Called with tbl->lock held for writing.  Returns true if the entry
+ * was released, otherwise it is moved to the tail of tbl->gc_list.
+ */
+static bool neigh_periodic_gc_one(struct neigh_table *tbl,
+				  struct neighbour *n)
+{
+	unsigned int state;
+	bool remove = false;
+
+	write_lock(&n->lock);
+
+	state = n->nud_state;
+	if (!(state & NUD_IN_TIMER)) {
+		if (time_before(n->used, n->confirmed))
+			n->used = n->confirmed;
+
+		if (refcount_read(&n->refcnt) == 1 &&
+		    (state == NUD_FAILED ||
+		     time_after(jiffies, n->used + NEIGH_VAR(n->parms, GC_STALETIME))))
+			remove = true;
+	}
+
+	write_unlock(&n->lock);
+
+	if (remove && neigh_remove_one(n, tbl))
+		return true;
+
+	list_move_tail(&n->gc_list, &tbl->gc_list);
+	return false;
+}
+
+/* A pass of the periodic GC covers every entry that was on tbl->gc_list
+ * when it started.  Each run of the work scans at most
+ * NEIGH_GC_WORK_BUDGET worth of entries, dropping tbl->lock every
+ * NEIGH_GC_BATCH of them, and the rest of the pass is left to the
+ * next run.
+ */
+#define NEIGH_GC_BATCH		64
+#define NEIGH_GC_WORK_BUDGET	NSEC_PER_MSEC
+
 static void neigh_periodic_work(struct work_struct *work)
 {
 	struct neigh_table *tbl = container_of(work, struct neigh_table, gc_work.work);
-	struct neighbour *n;
-	struct neighbour __rcu **np;
-	unsigned int i;
-	struct neigh_hash_table *nht;
+	u64 tmax = ktime_get_ns() + NEIGH_GC_WORK_BUDGET;
+	unsigned long delay;
 
 	NEIGH_CACHE_STAT_INC(tbl, periodic_gc_runs);
 
 	write_lock_bh(&tbl->lock);
-	nht = rcu_dereference_protected(tbl->nht,
-					lockdep_is_held(&tbl->lock));
 
 	/*
 	 *	periodically recompute ReachableTime from random function
@@ -830,61 +938,47 @@ static void neigh_periodic_work(struct work_struct *work)
 				neigh_rand_reach_time(NEIGH_VAR(p, BASE_REACHABLE_TIME));
 	}
 
-	if (atomic_read(&tbl->entries) < tbl->gc_thresh1)
-		goto out;
-
-	for (i = 0 ; i < (1 << nht->hash_shift); i++) {
-		np = &nht->hash_buckets[i];
-
-		while ((n = rcu_dereference_protected(*np,
-				lockdep_is_held(&tbl->lock))) != NULL) {
-			unsigned int state;
-
-			write_lock(&n->lock);
-
-			state = n->nud_state;
-			if ((state & (NUD_PERMANENT | NUD_IN_TIMER)) ||
-			    (n->flags & NTF_EXT_LEARNED)) {
-				write_unlock(&n->lock);
-				goto next_elt;
-			}
+	if (!tbl->gc_scan_left) {
+		if (atomic_read(&tbl->gc_entries) < tbl->gc_thresh1)
+			goto out;
+		tbl->gc_scan_left = atomic_read(&tbl->gc_entries);
+	}
 
-			if (time_before(n->used, n->confirmed))
-				n->used = n->confirmed;
+	while (tbl->gc_scan_left && !list_empty(&tbl->gc_list)) {
+		struct neighbour *n;
+		int batch;
 
-			if (refcount_read(&n->refcnt) == 1 &&
-			    (state == NUD_FAILED ||
-			     time_after(jiffies, n->used + NEIGH_VAR(n->parms, GC_STALETIME)))) {
-				rcu_assign_pointer(*np,
-						rcu_dereference_protected(n->next,
-							lockdep_is_held(&tbl->lock)));
-				n->dead = 1;
-				write_unlock(&n->lock);
-				neigh_cleanup_and_release(n);
-				continue;
-			}
-			write_unlock(&n->lock);
+		for (batch = 0; batch < NEIGH_GC_BATCH; batch++) {
+			if (!tbl->gc_scan_left || list_empty(&tbl->gc_list))
+				break;
 
-next_elt:
-			np = &n->next;
+			n = list_first_entry(&tbl->gc_list, struct neighbour,
+					     gc_list);
+			neigh_periodic_gc_one(tbl, n);
+			tbl->gc_scan_left--;
 		}
-		/*
-		 * It's fine to release lock here, even if hash table
-		 * grows while we are preempted.
+
+		/* Entries only move within or leave the list while we
+		 * are preempted, so the pass simply resumes at its head.
 		 */
 		write_unlock_bh(&tbl->lock);
 		cond_resched();
 		write_lock_bh(&tbl->lock);
-		nht = rcu_dereference_protected(tbl->nht,
-						lockdep_is_held(&tbl->lock));
+
+		if (ktime_get_ns() > tmax)
+			break;
 	}
+
+	if (list_empty(&tbl->gc_list))
+		tbl->gc_scan_left = 0;
 out:
-	/* Cycle through all hash buckets every BASE_REACHABLE_TIME/2 ticks.
-	 * ARP entry timeouts range from 1/2 BASE_REACHABLE_TIME to 3/2
-	 * BASE_REACHABLE_TIME.
+	/* Cycle through all GC candidates every BASE_REACHABLE_TIME/2
+	 * ticks. ARP entry timeouts range from 1/2 BASE_REACHABLE_TIME to
+	 * 3/2 BASE_REACHABLE_TIME.
 	 */
-	queue_delayed_work(system_power_efficient_wq, &tbl->gc_work,
-			      NEIGH_VAR(&tbl->parms, BASE_REACHABLE_TIME) >> 1);
+	delay = tbl->gc_scan_left ? 1 :
+		NEIGH_VAR(&tbl->parms, BASE_REACHABLE_TIME) >> 1;
+	queue_delayed_work(system_power_efficient_wq, &tbl->gc_work, delay);
 	write_unlock_bh(&tbl->lock);
 }
 
@@ -1151,12 +1245,14 @@ int neigh_update(struct neighbour *neigh, const u8 *lladdr, u8 new,
 	int notify = 0;
 	struct net_device *dev;
 	int update_isrouter = 0;
+	bool exempt_from_gc, gc_update;
 
 	write_lock_bh(&neigh->lock);
 
 	dev    = neigh->dev;
 	old    = neigh->nud_state;
 	err    = -EPERM;
+	exempt_from_gc = neigh_exempt_from_gc(neigh);
 
 	if (!(flags & NEIGH_UPDATE_F_ADMIN) &&
 	    (old & (NUD_NOARP | NUD_PERMANENT)))
@@ -1309,8 +1405,12 @@ int neigh_update(struct neighbour *neigh, const u8 *lladdr, u8 new,
 			(neigh->flags | NTF_ROUTER) :
 			(neigh->flags & ~NTF_ROUTER);
 	}
+	gc_update = exempt_from_gc != neigh_exempt_from_gc(neigh);
 	write_unlock_bh(&neigh->lock);
 
+	if (gc_update)
+		neigh_update_gc_list(neigh);
+
 	if (notify)
 		neigh_update_notify(neigh, nlmsg_pid);
 
@@ -1610,6 +1710,7 @@ void neigh_table_init(int index, struct neigh_table *tbl)
 	else
 		WARN_ON(tbl->entry_size % NEIGH_PRIV_ALIGN);
 
+	INIT_LIST_HEAD(&tbl->gc_list);
 	rwlock_init(&tbl->lock);
 	INIT_DEFERRABLE_WORK(&tbl->gc_work, neigh_periodic_work);
 	queue_delayed_work(system_power_efficient_wq, &tbl->gc_work,
@@ -2535,7 +2636,7 @@ void __neigh_for_each_release(struct neigh_table *tbl,
 				rcu_assign_pointer(*np,
 					rcu_dereference_protected(n->next,
 						lockdep_is_held(&tbl->lock)));
-				n->dead = 1;
+				neigh_mark_dead(n);
 			} else
 				np = &n->next;
 			write_unlock(&n->lock);
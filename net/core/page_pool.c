@@ -71,10 +71,6 @@ static struct page *__page_pool_get_cached(struct page_pool *pool)
 	struct ptr_ring *r = &pool->ring;
 	struct page *page;
 
-	/* Quicker fallback, avoid locks when ring is empty */
-	if (__ptr_ring_empty(r))
-		return NULL;
-
 	/* Test for safe-context, caller should provide this guarantee */
 	if (likely(in_serving_softirq())) {
 		if (likely(pool->alloc.count)) {
@@ -82,6 +78,11 @@ static struct page *__page_pool_get_cached(struct page_pool *pool)
 			page = pool->alloc.cache[--pool->alloc.count];
 			return page;
 		}
+
+		/* Quicker fallback, avoid locks when ring is empty */
+		if (__ptr_ring_empty(r))
+			return NULL;
+
 		/* Slower-path: Alloc array empty, time to refill
 		 *
 		 * Open-coded bulk ptr_ring consumer.
@@ -106,49 +107,95 @@ static struct page *__page_pool_get_cached(struct page_pool *pool)
 	return page;
 }
 
-/* slow path */
-noinline
-static struct page *__page_pool_alloc_pages_slow(struct page_pool *pool,
-						 gfp_t _gfp)
+static bool page_pool_dma_map(struct page_pool *pool, struct page *page)
 {
-	struct page *page;
-	gfp_t gfp = _gfp;
 	dma_addr_t dma;
 
+	if (!(pool->p.flags & PP_FLAG_DMA_MAP))
+		return true;
+
+	/* Setup DMA mapping: use page->private for DMA-addr
+	 * This mapping is kept for lifetime of page, until leaving pool.
+	 */
+	dma = dma_map_page(pool->p.dev, page, 0,
+			   (PAGE_SIZE << pool->p.order),
+			   pool->p.dma_dir);
+	if (dma_mapping_error(pool->p.dev, dma))
+		return false;
+
+	set_page_private(page, dma); /* page->private = dma; */
+	return true;
+}
+
+static struct page *__page_pool_alloc_page_order(struct page_pool *pool,
+						 gfp_t gfp)
+{
+	struct page *page;
+
 	/* We could always set __GFP_COMP, and avoid this branch, as
 	 * prep_new_page() can handle order-0 with __GFP_COMP.
 	 */
 	if (pool->p.order)
 		gfp |= __GFP_COMP;
 
-	/* FUTURE development:
-	 *
-	 * Current slow-path essentially falls back to single page
-	 * allocations, which doesn't improve performance.  This code
-	 * need bulk allocation support from the page allocator code.
-	 */
-
-	/* Cache was empty, do real allocation */
 	page = alloc_pages_node(pool->p.nid, gfp, pool->p.order);
 	if (!page)
 		return NULL;
 
-	if (!(pool->p.flags & PP_FLAG_DMA_MAP))
-		goto skip_dma_map;
+	if (!page_pool_dma_map(pool, page)) {
+		put_page(page);
+		return NULL;
+	}
 
-	/* Setup DMA mapping: use page->private for DMA-addr
-	 * This mapping is kept for lifetime of page, until leaving pool.
+	/* When page just alloc'ed is should/must have refcnt 1. */
+	return page;
+}
+
+/* slow path */
+noinline
+static struct page *__page_pool_alloc_pages_slow(struct page_pool *pool,
+						 gfp_t gfp)
+{
+	const int bulk = PP_ALLOC_CACHE_REFILL;
+	struct page **cache = (struct page **)pool->alloc.cache;
+	struct page *page;
+	int i, nr_pages;
+
+	/* Bulk refill goes into the alloc cache, which is only safe to
+	 * touch from softirq.  High-order pages are not bulk allocated.
 	 */
-	dma = dma_map_page(pool->p.dev, page, 0,
-			   (PAGE_SIZE << pool->p.order),
-			   pool->p.dma_dir);
-	if (dma_mapping_error(pool->p.dev, dma)) {
-		put_page(page);
+	if (unlikely(pool->p.order) || !in_serving_softirq())
+		return __page_pool_alloc_page_order(pool, gfp);
+
+	/* The ring refill may have stopped short of returning a page */
+	if (unlikely(pool->alloc.count > 0))
+		return pool->alloc.cache[--pool->alloc.count];
+
+	/* Mark empty alloc.cache slots "empty" for alloc_pages_bulk_array */
+	memset(&pool->alloc.cache, 0, sizeof(void *) * bulk);
+
+	nr_pages = alloc_pages_bulk_array_node(gfp, pool->p.nid, bulk, cache);
+	if (unlikely(!nr_pages))
 		return NULL;
+
+	/* Pages have been filled into alloc.cache array, but count is zero
+	 * and page elements have not been (possibly) DMA mapped.
+	 */
+	for (i = 0; i < nr_pages; i++) {
+		page = pool->alloc.cache[i];
+		if (!page_pool_dma_map(pool, page)) {
+			put_page(page);
+			continue;
+		}
+		pool->alloc.cache[pool->alloc.count++] = page;
 	}
-	set_page_private(page, dma); /* page->private = dma; */
 
-skip_dma_map:
+	/* Return last page */
+	if (likely(pool->alloc.count > 0))
+		page = pool->alloc.cache[--pool->alloc.count];
+	else
+		page = NULL;
+
 	/* When page just alloc'ed is should/must have refcnt 1. */
 	return page;
 }
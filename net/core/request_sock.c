@@ -44,6 +44,83 @@ void reqsk_queue_alloc(struct request_sock_queue *queue)
 	queue->rskq_accept_head = NULL;
 }
 
+/*
+ * Give a listener per-CPU accept queues.  They stay allocated until the
+ * socket is destroyed, as handshakes completing under RCU may still be
+ * looking at them after the listener was stopped.
+ */
+int reqsk_queue_alloc_shards(struct request_sock_queue *queue)
+{
+	struct request_sock_shard *shard;
+	int cpu;
+
+	if (queue->rskq_shards)
+		return 0;
+
+	queue->rskq_shards = alloc_percpu(struct request_sock_shard);
+	if (!queue->rskq_shards)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		shard = per_cpu_ptr(queue->rskq_shards, cpu);
+		spin_lock_init(&shard->lock);
+		shard->head = NULL;
+		shard->tail = NULL;
+	}
+	return 0;
+}
+
+void reqsk_queue_free_shards(struct request_sock_queue *queue)
+{
+	free_percpu(queue->rskq_shards);
+	queue->rskq_shards = NULL;
+}
+
+bool reqsk_shards_empty(const struct request_sock_queue *queue)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		if (READ_ONCE(per_cpu_ptr(queue->rskq_shards, cpu)->head))
+			return false;
+	}
+	return true;
+}
+EXPORT_SYMBOL(reqsk_shards_empty);
+
+/* Take the oldest child of the local CPU's queue, then of the others */
+struct request_sock *reqsk_shards_remove(struct request_sock_queue *queue,
+					 struct sock *parent)
+{
+	struct request_sock_shard *shard;
+	struct request_sock *req = NULL;
+	int start, cpu;
+
+	start = cpu = raw_smp_processor_id();
+	do {
+		shard = per_cpu_ptr(queue->rskq_shards, cpu);
+		if (READ_ONCE(shard->head)) {
+			spin_lock_bh(&shard->lock);
+			req = shard->head;
+			if (req) {
+				sk_acceptq_removed_shared(parent);
+				WRITE_ONCE(shard->head, req->dl_next);
+				if (!shard->head)
+					shard->tail = NULL;
+			}
+			spin_unlock_bh(&shard->lock);
+			if (req)
+				break;
+		}
+		cpu = cpumask_next(cpu, cpu_possible_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_possible_mask);
+	} while (cpu != start);
+
+	return req;
+}
+EXPORT_SYMBOL(reqsk_shards_remove);
+
 /*
  * This function is called to set a Fast Open socket's "fastopen_rsk" field
  * to NULL when a TFO socket no longer needs to access the request_sock.
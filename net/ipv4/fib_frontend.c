@@ -98,6 +98,9 @@ struct fib_table *fib_new_table(struct net *net, u32 id)
 	if (!tb)
 		return NULL;
 
+	if (id == RT_TABLE_MAIN || id == RT_TABLE_LOCAL)
+		fib_table_dir_set(tb, net->ipv4.sysctl_fib_dir_bits);
+
 	switch (id) {
 	case RT_TABLE_MAIN:
 		rcu_assign_pointer(net->ipv4.fib_main, tb);
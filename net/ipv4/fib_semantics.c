@@ -216,7 +216,7 @@ static void free_fib_info_rcu(struct rcu_head *head)
 		lwtstate_put(nexthop_nh->nh_lwtstate);
 		free_nh_exceptions(nexthop_nh);
 		rt_fibinfo_free_cpus(nexthop_nh->nh_pcpu_rth_output);
-		rt_fibinfo_free(&nexthop_nh->nh_rth_input);
+		rt_fibinfo_free_cpus(nexthop_nh->nh_pcpu_rth_input);
 	} endfor_nexthops(fi);
 
 	m = fi->fib_metrics;
@@ -1108,6 +1108,9 @@ struct fib_info *fib_create_info(struct fib_config *cfg,
 		nexthop_nh->nh_pcpu_rth_output = alloc_percpu(struct rtable __rcu *);
 		if (!nexthop_nh->nh_pcpu_rth_output)
 			goto failure;
+		nexthop_nh->nh_pcpu_rth_input = alloc_percpu(struct rtable __rcu *);
+		if (!nexthop_nh->nh_pcpu_rth_input)
+			goto failure;
 	} endfor_nexthops(fi)
 
 	err = fib_convert_metrics(fi, cfg);
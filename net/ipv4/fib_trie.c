@@ -75,6 +75,8 @@
 #include <linux/export.h>
 #include <linux/vmalloc.h>
 #include <linux/notifier.h>
+#include <linux/rtnetlink.h>
+#include <linux/workqueue.h>
 #include <net/net_namespace.h>
 #include <net/ip.h>
 #include <net/protocol.h>
@@ -175,11 +177,34 @@ struct trie_stat {
 	unsigned int nodesizes[MAX_STAT_DEPTH];
 };
 
+/* Direct index of lookup start points.  Entry i records where the
+ * first descent of fib_table_lookup() ends up for every key whose top
+ * "bits" bits equal i, together with the deepest node it would have
+ * recorded for backtracking, so a lookup can skip the upper levels of
+ * the trie and still return exactly the same result.
+ */
+struct fib_dir_entry {
+	struct key_vector *n;
+	struct key_vector *pn;
+	t_key cindex;
+};
+
+struct fib_trie_dir {
+	struct rcu_head rcu;
+	unsigned char bits;
+	struct fib_dir_entry entries[0];
+};
+
+#define FIB_DIR_REBUILD_DELAY	HZ
+
 struct trie {
 	struct key_vector kv[1];
 #ifdef CONFIG_IP_FIB_TRIE_STATS
 	struct trie_use_stats __percpu *stats;
 #endif
+	struct fib_trie_dir __rcu *dir;
+	unsigned char dir_bits;
+	struct delayed_work dir_work;
 };
 
 static struct key_vector *resize(struct trie *t, struct key_vector *tn);
@@ -1015,6 +1040,125 @@ static void trie_rebalance(struct trie *t, struct key_vector *tn)
 		tn = resize(t, tn);
 }
 
+static struct fib_trie_dir *fib_dir_build(struct trie *t, unsigned char bits)
+{
+	unsigned long i, size = 1ul << bits;
+	struct fib_trie_dir *dir;
+
+	dir = vmalloc(struct_size(dir, entries, size));
+	if (!dir)
+		return NULL;
+
+	dir->bits = bits;
+
+	for (i = 0; i < size; i++) {
+		t_key key = (t_key)i << (KEYLENGTH - bits);
+		struct key_vector *n, *pn = t->kv;
+		t_key cindex = 0;
+
+		/* Replay step 1 of fib_table_lookup() for as long as the
+		 * child index only depends on the top bits of the key.
+		 */
+		n = get_child(pn, 0);
+		while (n && IS_TNODE(n) && n->pos >= KEYLENGTH - bits) {
+			unsigned long index = get_cindex(key, n);
+			struct key_vector *c;
+
+			if (index >= (1ul << n->bits))
+				break;
+
+			c = get_child(n, index);
+			if (!c)
+				break;
+
+			if (n->slen > n->pos) {
+				pn = n;
+				cindex = index;
+			}
+
+			n = c;
+		}
+
+		dir->entries[i].n = n;
+		dir->entries[i].pn = pn;
+		dir->entries[i].cindex = cindex;
+
+		if (!(i & 0xfff))
+			cond_resched();
+	}
+
+	return dir;
+}
+
+static void __fib_dir_free_rcu(struct rcu_head *head)
+{
+	vfree(container_of(head, struct fib_trie_dir, rcu));
+}
+
+/* Caller must hold RTNL */
+static void fib_dir_drop(struct trie *t)
+{
+	struct fib_trie_dir *dir = rtnl_dereference(t->dir);
+
+	if (dir) {
+		RCU_INIT_POINTER(t->dir, NULL);
+		call_rcu(&dir->rcu, __fib_dir_free_rcu);
+	}
+}
+
+/* Called before the shape of the trie or the suffix lengths change.
+ * Lookups fall back to a full walk until the rebuild has run; the
+ * rebuild is deferred so that a burst of route updates only pays for
+ * it once.  Caller must hold RTNL.
+ */
+static void fib_dir_flush(struct trie *t)
+{
+	if (!t->dir_bits)
+		return;
+
+	fib_dir_drop(t);
+	queue_delayed_work(system_wq, &t->dir_work, FIB_DIR_REBUILD_DELAY);
+}
+
+static void fib_dir_work(struct work_struct *work)
+{
+	struct trie *t = container_of(to_delayed_work(work), struct trie,
+				      dir_work);
+	struct fib_trie_dir *dir;
+
+	/* fib_free_table() cancels us with RTNL held, so we cannot block
+	 * on it here.  RTNL being busy usually means more route updates
+	 * are on the way, so try again after the usual rebuild delay.
+	 */
+	if (!rtnl_trylock()) {
+		queue_delayed_work(system_wq, &t->dir_work,
+				   FIB_DIR_REBUILD_DELAY);
+		return;
+	}
+
+	if (t->dir_bits && !rtnl_dereference(t->dir)) {
+		dir = fib_dir_build(t, t->dir_bits);
+		if (dir)
+			rcu_assign_pointer(t->dir, dir);
+	}
+
+	rtnl_unlock();
+}
+
+/* Caller must hold RTNL */
+void fib_table_dir_set(struct fib_table *tb, unsigned char bits)
+{
+	struct trie *t = (struct trie *)tb->tb_data;
+
+	if (t->dir_bits == bits)
+		return;
+
+	t->dir_bits = bits;
+	fib_dir_drop(t);
+	if (bits)
+		queue_delayed_work(system_wq, &t->dir_work, 0);
+}
+
 static int fib_insert_node(struct trie *t, struct key_vector *tp,
 			   struct fib_alias *new, t_key key)
 {
@@ -1072,6 +1216,8 @@ static int fib_insert_alias(struct trie *t, struct key_vector *tp,
 			    struct key_vector *l, struct fib_alias *new,
 			    struct fib_alias *fa, t_key key)
 {
+	fib_dir_flush(t);
+
 	if (!l)
 		return fib_insert_node(t, tp, new, key);
 
@@ -1322,14 +1468,25 @@ int fib_table_lookup(struct fib_table *tb, const struct flowi4 *flp,
 #endif
 	const t_key key = ntohl(flp->daddr);
 	struct key_vector *n, *pn;
+	struct fib_trie_dir *dir;
 	struct fib_alias *fa;
 	unsigned long index;
 	t_key cindex;
 
-	pn = t->kv;
-	cindex = 0;
+	dir = rcu_dereference_rtnl(t->dir);
+	if (dir) {
+		const struct fib_dir_entry *e;
+
+		e = &dir->entries[key >> (KEYLENGTH - dir->bits)];
+		n = e->n;
+		pn = e->pn;
+		cindex = e->cindex;
+	} else {
+		pn = t->kv;
+		cindex = 0;
+		n = get_child_rcu(pn, cindex);
+	}
 
-	n = get_child_rcu(pn, cindex);
 	if (!n) {
 		trace_fib_table_lookup(tb->tb_id, flp, NULL, -EAGAIN);
 		return -EAGAIN;
@@ -1517,6 +1674,8 @@ static void fib_remove_alias(struct trie *t, struct key_vector *tp,
 	struct hlist_node **pprev = old->fa_list.pprev;
 	struct fib_alias *fa = hlist_entry(pprev, typeof(*fa), fa_list.next);
 
+	fib_dir_flush(t);
+
 	/* remove the fib_alias from the list */
 	hlist_del_rcu(&old->fa_list);
 
@@ -1779,6 +1938,9 @@ struct fib_table *fib_trie_unmerge(struct fib_table *oldtb)
 			break;
 	}
 
+	/* the local routes keep the direct index they had in the merged trie */
+	fib_table_dir_set(local_tb, ot->dir_bits);
+
 	return local_tb;
 out:
 	fib_trie_free(local_tb);
@@ -1836,6 +1998,7 @@ void fib_table_flush_external(struct fib_table *tb)
 			 * need to remove the local copy from main
 			 */
 			if (tb->tb_id != fa->tb_id) {
+				fib_dir_flush(t);
 				hlist_del_rcu(&fa->fa_list);
 				alias_free_mem_rcu(fa);
 				continue;
@@ -1923,6 +2086,7 @@ int fib_table_flush(struct net *net, struct fib_table *tb, bool flush_all)
 						 n->key,
 						 KEYLENGTH - fa->fa_slen, fa,
 						 NULL);
+			fib_dir_flush(t);
 			hlist_del_rcu(&fa->fa_list);
 			fib_release_info(fa->fa_info);
 			alias_free_mem_rcu(fa);
@@ -1997,17 +2161,25 @@ void fib_notify(struct net *net, struct notifier_block *nb)
 static void __trie_free_rcu(struct rcu_head *head)
 {
 	struct fib_table *tb = container_of(head, struct fib_table, rcu);
-#ifdef CONFIG_IP_FIB_TRIE_STATS
 	struct trie *t = (struct trie *)tb->tb_data;
 
-	if (tb->tb_data == tb->__data)
+	if (tb->tb_data == tb->__data) {
+#ifdef CONFIG_IP_FIB_TRIE_STATS
 		free_percpu(t->stats);
 #endif /* CONFIG_IP_FIB_TRIE_STATS */
+		vfree(rcu_dereference_protected(t->dir, 1));
+	}
 	kfree(tb);
 }
 
 void fib_free_table(struct fib_table *tb)
 {
+	if (tb->tb_data == tb->__data) {
+		struct trie *t = (struct trie *)tb->tb_data;
+
+		cancel_delayed_work_sync(&t->dir_work);
+	}
+
 	call_rcu(&tb->rcu, __trie_free_rcu);
 }
 
@@ -2124,6 +2296,7 @@ struct fib_table *fib_trie_table(u32 id, struct fib_table *alias)
 	t = (struct trie *) tb->tb_data;
 	t->kv[0].pos = KEYLENGTH;
 	t->kv[0].slen = KEYLENGTH;
+	INIT_DELAYED_WORK(&t->dir_work, fib_dir_work);
 #ifdef CONFIG_IP_FIB_TRIE_STATS
 	t->stats = alloc_percpu(struct trie_use_stats);
 	if (!t->stats) {
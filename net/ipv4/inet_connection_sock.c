@@ -428,12 +428,12 @@ static int inet_csk_wait_for_connect(struct sock *sk, long timeo)
 		prepare_to_wait_exclusive(sk_sleep(sk), &wait,
 					  TASK_INTERRUPTIBLE);
 		release_sock(sk);
-		if (reqsk_queue_empty(&icsk->icsk_accept_queue))
+		if (inet_csk_accept_queue_empty(sk))
 			timeo = schedule_timeout(timeo);
 		sched_annotate_sleep();
 		lock_sock(sk);
 		err = 0;
-		if (!reqsk_queue_empty(&icsk->icsk_accept_queue))
+		if (!inet_csk_accept_queue_empty(sk))
 			break;
 		err = -EINVAL;
 		if (sk->sk_state != TCP_LISTEN)
@@ -470,7 +470,8 @@ struct sock *inet_csk_accept(struct sock *sk, int flags, int *err, bool kern)
 		goto out_err;
 
 	/* Find already established connection */
-	if (reqsk_queue_empty(queue)) {
+	while (inet_csk_accept_queue_empty(sk) ||
+	       !(req = reqsk_queue_remove(queue, sk))) {
 		long timeo = sock_rcvtimeo(sk, flags & O_NONBLOCK);
 
 		/* If this is a non blocking socket don't sleep */
@@ -482,7 +483,6 @@ struct sock *inet_csk_accept(struct sock *sk, int flags, int *err, bool kern)
 		if (error)
 			goto out_err;
 	}
-	req = reqsk_queue_remove(queue, sk);
 	newsk = req->sk;
 
 	if (sk->sk_protocol == IPPROTO_TCP &&
@@ -936,6 +936,11 @@ int inet_csk_listen_start(struct sock *sk, int backlog)
 		return err;
 
 	reqsk_queue_alloc(&icsk->icsk_accept_queue);
+	if (sk->sk_protocol == IPPROTO_TCP && sysctl_tcp_accept_sharded) {
+		err = reqsk_queue_alloc_shards(&icsk->icsk_accept_queue);
+		if (err)
+			return err;
+	}
 
 	sk->sk_max_ack_backlog = backlog;
 	sk->sk_ack_backlog = 0;
@@ -987,12 +992,41 @@ static void inet_child_forget(struct sock *sk, struct request_sock *req,
 	inet_csk_destroy_sock(child);
 }
 
+static struct sock *inet_csk_reqsk_shard_add(struct sock *sk,
+					     struct request_sock *req,
+					     struct sock *child)
+{
+	struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
+	struct request_sock_shard *shard;
+
+	shard = this_cpu_ptr(queue->rskq_shards);
+	spin_lock(&shard->lock);
+	if (unlikely(sk->sk_state != TCP_LISTEN)) {
+		inet_child_forget(sk, req, child);
+		child = NULL;
+	} else {
+		req->sk = child;
+		req->dl_next = NULL;
+		if (shard->head == NULL)
+			WRITE_ONCE(shard->head, req);
+		else
+			shard->tail->dl_next = req;
+		shard->tail = req;
+		sk_acceptq_added_shared(sk);
+	}
+	spin_unlock(&shard->lock);
+	return child;
+}
+
 struct sock *inet_csk_reqsk_queue_add(struct sock *sk,
 				      struct request_sock *req,
 				      struct sock *child)
 {
 	struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
 
+	if (queue->rskq_shards)
+		return inet_csk_reqsk_shard_add(sk, req, child);
+
 	spin_lock(&queue->rskq_lock);
 	if (unlikely(sk->sk_state != TCP_LISTEN)) {
 		inet_child_forget(sk, req, child);
@@ -725,12 +725,14 @@ static void update_or_create_fnhe(struct fib_nh *nh, __be32 daddr, __be32 gw,
 		 * stale, so anyone caching it rechecks if this exception
 		 * applies to them.
 		 */
-		rt = rcu_dereference(nh->nh_rth_input);
-		if (rt)
-			rt->dst.obsolete = DST_OBSOLETE_KILL;
-
 		for_each_possible_cpu(i) {
 			struct rtable __rcu **prt;
+
+			prt = per_cpu_ptr(nh->nh_pcpu_rth_input, i);
+			rt = rcu_dereference(*prt);
+			if (rt)
+				rt->dst.obsolete = DST_OBSOLETE_KILL;
+
 			prt = per_cpu_ptr(nh->nh_pcpu_rth_output, i);
 			rt = rcu_dereference(*prt);
 			if (rt)
@@ -1489,7 +1491,7 @@ static bool rt_cache_route(struct fib_nh *nh, struct rtable *rt)
 	bool ret = true;
 
 	if (rt_is_input_route(rt)) {
-		p = (struct rtable **)&nh->nh_rth_input;
+		p = (struct rtable **)raw_cpu_ptr(nh->nh_pcpu_rth_input);
 	} else {
 		p = (struct rtable **)raw_cpu_ptr(nh->nh_pcpu_rth_output);
 	}
@@ -1813,7 +1815,8 @@ static int __mkroute_input(struct sk_buff *skb,
 		if (fnhe)
 			rth = rcu_dereference(fnhe->fnhe_rth_input);
 		else
-			rth = rcu_dereference(FIB_RES_NH(*res).nh_rth_input);
+			rth = rcu_dereference(
+				*raw_cpu_ptr(FIB_RES_NH(*res).nh_pcpu_rth_input));
 		if (rt_cache_valid(rth)) {
 			skb_dst_set_noref(skb, &rth->dst);
 			goto out;
@@ -2105,7 +2108,9 @@ out:	return err;
 local_input:
 	do_cache &= res->fi && !itag;
 	if (do_cache) {
-		rth = rcu_dereference(FIB_RES_NH(*res).nh_rth_input);
+		struct fib_nh *nh = &FIB_RES_NH(*res);
+
+		rth = rcu_dereference(*raw_cpu_ptr(nh->nh_pcpu_rth_input));
 		if (rt_cache_valid(rth)) {
 			skb_dst_set_noref(skb, &rth->dst);
 			err = 0;
@@ -27,6 +27,7 @@
 #include <net/ping.h>
 #include <net/protocol.h>
 #include <net/netevent.h>
+#include <net/ip_fib.h>
 
 static int zero;
 static int one = 1;
@@ -53,6 +54,8 @@ static int ip_ping_group_range_max[] = { GID_T_MAX, GID_T_MAX };
 static int comp_sack_nr_max = 255;
 static u32 u32_max_div_HZ = UINT_MAX / HZ;
 static int one_day_secs = 24 * 3600;
+static int fib_dir_bits_min = 8;
+static int fib_dir_bits_max = 20;
 
 /* obsolete */
 static int sysctl_tcp_low_latency __read_mostly;
@@ -367,6 +370,48 @@ static int proc_tcp_available_ulp(struct ctl_table *ctl,
 	return ret;
 }
 
+static int proc_fib_dir_bits(struct ctl_table *table, int write,
+			     void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	struct net *net = container_of(table->data, struct net,
+	    ipv4.sysctl_fib_dir_bits);
+	struct fib_table *tb;
+	int ret;
+	int bits;
+	struct ctl_table tmp = {
+		.data = &bits,
+		.maxlen = sizeof(bits),
+		.mode = table->mode,
+		.extra1 = &zero,
+		.extra2 = &fib_dir_bits_max,
+	};
+
+	bits = net->ipv4.sysctl_fib_dir_bits;
+
+	ret = proc_dointvec_minmax(&tmp, write, buffer, lenp, ppos);
+
+	if (write && ret == 0) {
+		/* 0 disables the index, anything smaller than the
+		 * minimum would not get past the root node anyway.
+		 */
+		if (bits && bits < fib_dir_bits_min)
+			return -EINVAL;
+
+		rtnl_lock();
+		net->ipv4.sysctl_fib_dir_bits = bits;
+		/* the local table has its own trie once it is unmerged */
+		tb = fib_get_table(net, RT_TABLE_MAIN);
+		if (tb)
+			fib_table_dir_set(tb, bits);
+		tb = fib_get_table(net, RT_TABLE_LOCAL);
+		if (tb)
+			fib_table_dir_set(tb, bits);
+		rtnl_unlock();
+	}
+
+	return ret;
+}
+
 #ifdef CONFIG_IP_ROUTE_MULTIPATH
 static int proc_fib_multipath_hash_policy(struct ctl_table *table, int write,
 					  void __user *buffer, size_t *lenp,
@@ -444,6 +489,15 @@ static struct ctl_table ipv4_table[] = {
 		.mode		= 0644,
 		.proc_handler	= proc_doulongvec_minmax,
 	},
+	{
+		.procname	= "tcp_accept_sharded",
+		.data		= &sysctl_tcp_accept_sharded,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
 	{
 		.procname	= "tcp_low_latency",
 		.data		= &sysctl_tcp_low_latency,
@@ -962,6 +1016,13 @@ static struct ctl_table ipv4_net_table[] = {
 		.extra2		= &one,
 	},
 #endif
+	{
+		.procname	= "fib_dir_bits",
+		.data		= &init_net.ipv4.sysctl_fib_dir_bits,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_fib_dir_bits,
+	},
 	{
 		.procname	= "ip_unprivileged_port_start",
 		.maxlen		= sizeof(int),
@@ -289,6 +289,9 @@ EXPORT_SYMBOL_GPL(tcp_orphan_count);
 long sysctl_tcp_mem[3] __read_mostly;
 EXPORT_SYMBOL(sysctl_tcp_mem);
 
+/* Give new listeners per-CPU accept queues */
+int sysctl_tcp_accept_sharded __read_mostly;
+
 atomic_long_t tcp_memory_allocated;	/* Current allocated memory. */
 EXPORT_SYMBOL(tcp_memory_allocated);
 
@@ -1218,17 +1221,23 @@ int tcp_sendmsg_locked(struct sock *sk, struct msghdr *msg, size_t size)
 
 	flags = msg->msg_flags;
 
-	if (flags & MSG_ZEROCOPY && size && sock_flag(sk, SOCK_ZEROCOPY)) {
+	if (flags & MSG_ZEROCOPY && size &&
+	    (msg->msg_ubuf || sock_flag(sk, SOCK_ZEROCOPY))) {
 		if ((1 << sk->sk_state) & ~(TCPF_ESTABLISHED | TCPF_CLOSE_WAIT)) {
 			err = -EINVAL;
 			goto out_err;
 		}
 
-		skb = tcp_write_queue_tail(sk);
-		uarg = sock_zerocopy_realloc(sk, size, skb_zcopy(skb));
-		if (!uarg) {
-			err = -ENOBUFS;
-			goto out_err;
+		if (msg->msg_ubuf) {
+			uarg = msg->msg_ubuf;
+			sock_zerocopy_get(uarg);
+		} else {
+			skb = tcp_write_queue_tail(sk);
+			uarg = sock_zerocopy_realloc(sk, size, skb_zcopy(skb));
+			if (!uarg) {
+				err = -ENOBUFS;
+				goto out_err;
+			}
 		}
 
 		zc = sk->sk_route_caps & NETIF_F_SG;
@@ -1772,6 +1781,35 @@ int tcp_mmap(struct file *file, struct socket *sock,
 }
 EXPORT_SYMBOL(tcp_mmap);
 
+static bool tcp_zerocopy_frag_ok(const skb_frag_t *frag)
+{
+	struct page *page = skb_frag_page(frag);
+
+	return skb_frag_size(frag) == PAGE_SIZE && !frag->page_offset &&
+	       !PageCompound(page) && !page->mapping;
+}
+
+/*
+ * Bytes user space has to copy, from @offset into @frag, before the next
+ * frag of @skb that can be mapped.  NICs without header split leave the
+ * start of each packet's payload unaligned; do not make the caller copy
+ * the aligned pages that follow it.  @hint is the rest of the skb.
+ */
+static u32 tcp_zerocopy_skip_hint(const struct sk_buff *skb,
+				  const skb_frag_t *frag, u32 offset, u32 hint)
+{
+	const skb_frag_t *end = skb_shinfo(skb)->frags +
+				skb_shinfo(skb)->nr_frags;
+	u32 skip = skb_frag_size(frag) - offset;
+
+	for (frag++; frag < end; frag++) {
+		if (tcp_zerocopy_frag_ok(frag))
+			return min(skip, hint);
+		skip += skb_frag_size(frag);
+	}
+	return hint;
+}
+
 static int tcp_zerocopy_receive(struct sock *sk,
 				struct tcp_zerocopy_receive *zc)
 {
@@ -1810,10 +1848,11 @@ static int tcp_zerocopy_receive(struct sock *sk,
 	zc->recv_skip_hint = 0;
 	ret = 0;
 	while (length + PAGE_SIZE <= zc->length) {
-		struct page *page;
-
 		if (zc->recv_skip_hint < PAGE_SIZE) {
 			if (skb) {
+				/* Unaligned tail, user space copies it */
+				if (zc->recv_skip_hint > 0)
+					break;
 				skb = skb->next;
 				offset = seq - TCP_SKB_CB(skb)->seq;
 			} else {
@@ -1827,15 +1866,17 @@ static int tcp_zerocopy_receive(struct sock *sk,
 			frags = skb_shinfo(skb)->frags;
 			while (offset) {
 				if (frags->size > offset)
-					goto out;
+					goto skip;
 				offset -= frags->size;
 				frags++;
 			}
 		}
-		page = skb_frag_page(frags);
-		if (frags->size != PAGE_SIZE || frags->page_offset ||
-		    PageCompound(page) || page->mapping)
+		if (!tcp_zerocopy_frag_ok(frags)) {
+skip:
+			zc->recv_skip_hint = tcp_zerocopy_skip_hint(skb, frags,
+						offset, zc->recv_skip_hint);
 			break;
+		}
 		ret = vm_insert_page(vma, address + length,
 				     skb_frag_page(frags));
 		if (ret)
@@ -1845,7 +1886,6 @@ static int tcp_zerocopy_receive(struct sock *sk,
 		zc->recv_skip_hint -= PAGE_SIZE;
 		frags++;
 	}
-out:
 	up_read(&current->mm->mmap_sem);
 	if (length) {
 		WRITE_ONCE(tp->copied_seq, seq);
@@ -0,0 +1,1258 @@
+/* BBR v2 style congestion control: BBR with loss and ECN bounds on inflight
+ *
+ * This module keeps the BBR model of the path (bottleneck bandwidth and
+ * min_rtt, estimated from the delivery rate samples of tcp_rate.c) and the
+ * BBR pacing and state machine, and adds explicit bounds on the volume of
+ * data in flight that react to packet loss and ECN marks:
+ *
+ *   inflight_hi: the long-term maximum inflight the path has tolerated. It
+ *                is set when a round trip shows a loss rate above
+ *                bbr2_loss_thresh (2%) or an ECN mark rate above
+ *                bbr2_ecn_thresh (50%), and is raised slowly again while
+ *                probing for bandwidth.
+ *   inflight_lo,
+ *   bw_lo:       short-term lower bounds, cut multiplicatively by
+ *                bbr2_beta on every round trip with loss or ECN marks while
+ *                not probing, and reset at the start of each probe.
+ *
+ *   pacing_rate = pacing_gain * min(max_bw, bw_lo)
+ *   cwnd        = min(cwnd_gain * bdp, inflight_hi (with headroom),
+ *                     inflight_lo)
+ *
+ * Here is the PROBE_BW phase cycle:
+ *
+ *    +--> DOWN ---> CRUISE ---> REFILL ---> UP ---+
+ *    |                                            |
+ *    +--------------------------------------------+
+ *
+ * DOWN drains the queue left by the last probe, CRUISE paces at the
+ * estimated bw with some headroom below inflight_hi so that other flows can
+ * grab capacity, REFILL refills the pipe after the lower bounds are dropped,
+ * and UP probes for more bandwidth until loss or ECN says inflight is too
+ * high. Probes are spaced 2-3 seconds apart, or at most as many rounds as a
+ * Reno flow with the same BDP would need to grow its cwnd, whichever comes
+ * first, so that BBR2 shares a bottleneck with loss-based flows.
+ *
+ * ECN is only used if the connection negotiated it (see tcp_ecn sysctl)
+ * and the ecn_enable module parameter is set. The per-round mark rate is
+ * taken from tp->delivered_ce, which is coarse with RFC3168 receivers that
+ * echo ECE until CWR; it is exact with DCTCP-style receivers.
+ *
+ * The design follows BBR v2 as presented at IETF 104-106 (ICCRG) by
+ * Neal Cardwell et al.; see also tcp_bbr.c for BBR itself.
+ */
+#include <linux/module.h>
+#include <net/tcp.h>
+#include <linux/inet_diag.h>
+#include <linux/inet.h>
+#include <linux/random.h>
+
+/* Scale factor for rate in pkt/uSec unit to avoid truncation in bandwidth
+ * estimation. See tcp_bbr.c for the rationale.
+ */
+#define BW_SCALE 24
+#define BW_UNIT (1 << BW_SCALE)
+
+#define BBR_SCALE 8	/* scaling factor for fractions in BBR (e.g. gains) */
+#define BBR_UNIT (1 << BBR_SCALE)
+
+/* BBR2 has the following modes for deciding how fast to send: */
+enum bbr2_mode {
+	BBR2_STARTUP,	/* ramp up sending rate rapidly to fill pipe */
+	BBR2_DRAIN,	/* drain any queue created during startup */
+	BBR2_PROBE_BW,	/* discover, share bw: pace around estimated bw */
+	BBR2_PROBE_RTT,	/* cut inflight to min to probe min_rtt */
+};
+
+/* Phases of the PROBE_BW cycle: */
+enum bbr2_probe_bw_phase {
+	BBR2_BW_PROBE_UP,	/* push up inflight to probe for bw/vol */
+	BBR2_BW_PROBE_DOWN,	/* drain excess inflight from the queue */
+	BBR2_BW_PROBE_CRUISE,	/* use pipe, w/ headroom in queue/pipe */
+	BBR2_BW_PROBE_REFILL,	/* v2: refill the pipe again to 100% */
+};
+
+/* BBR2 congestion control block */
+struct bbr2 {
+	u32	min_rtt_us;	        /* min RTT in min_rtt_win_sec window */
+	u32	min_rtt_stamp;	        /* timestamp of min_rtt_us */
+	u32	probe_rtt_done_stamp;   /* end time for BBR2_PROBE_RTT mode */
+	u32     next_rtt_delivered; /* tp->delivered at end of round */
+	u32	round_delivered;     /* tp->delivered at start of loss round */
+	u32	round_lost;	     /* tp->lost at start of loss round */
+	u32	round_delivered_ce;  /* tp->delivered_ce at start of round */
+	u32     mode:2,		     /* current bbr2_mode in state machine */
+		prev_ca_state:3,     /* CA state on previous ACK */
+		packet_conservation:1,  /* use packet conservation? */
+		round_start:1,	     /* start of packet-timed tx->ack round? */
+		idle_restart:1,	     /* restarting after idle? */
+		probe_rtt_round_done:1,  /* a PROBE_RTT round at min cwnd? */
+		full_bw_reached:1,   /* reached full bw in Startup? */
+		full_bw_cnt:2,	     /* number of rounds without large bw gains */
+		full_ecn_cnt:2,	     /* rounds in Startup with high ECN marks */
+		cycle_idx:2,	     /* current bbr2_probe_bw_phase */
+		has_seen_rtt:1,	     /* have we seen an RTT sample yet? */
+		unused:15;
+	u32	pacing_gain:10,	/* current gain for setting pacing rate */
+		cwnd_gain:10,	/* current gain for setting cwnd */
+		rounds_since_probe:8,  /* packet-timed rounds since last probe */
+		bw_probe_up_rounds:4;  /* rounds of inflight_hi growth in UP */
+	u32	prior_cwnd;	/* prior cwnd upon entering loss recovery */
+	u32	full_bw;	/* recent bw, to estimate if pipe is full */
+
+	/* The model of the path, in pkts/uS << BW_SCALE and packets: */
+	u32	bw_hi[2];	/* max bw in current and previous probe cycle */
+	u32	bw_lo;		/* lower bound on bw, from loss/ECN */
+	u32	bw_latest;	/* max delivery rate in the last round */
+	u32	inflight_hi;	/* upper bound on inflight, from loss/ECN */
+	u32	inflight_lo;	/* lower bound on inflight, from loss/ECN */
+	u32	inflight_latest;  /* max delivered per ACK in the last round */
+	u32	ecn_alpha;	/* EWMA of the per-round CE mark fraction */
+	u32	bw_probe_up_cnt;  /* packets ACKed per inflight_hi increment */
+	u32	bw_probe_up_acks; /* packets ACKed towards the next increment */
+	u32	probe_wait_stamp; /* jiffies when the next bw probe is due */
+
+	/* For tracking ACK aggregation: */
+	u32	ack_epoch_stamp;	/* start of ACK sampling epoch, in uS */
+	u16	extra_acked[2];		/* max excess data ACKed in epoch */
+	u32	ack_epoch_acked:20,	/* packets (S)ACKed in sampling epoch */
+		extra_acked_win_rtts:5,	/* age of extra_acked, in round trips */
+		extra_acked_win_idx:1,	/* current index in extra_acked array */
+		unused_c:6;
+};
+
+/* Window length of min_rtt filter (in sec): */
+static const u32 bbr2_min_rtt_win_sec = 10;
+/* Minimum time (in ms) spent at the PROBE_RTT cwnd in BBR2_PROBE_RTT mode: */
+static const u32 bbr2_probe_rtt_mode_ms = 200;
+/* Skip TSO below the following bandwidth (bits/sec): */
+static const int bbr2_min_tso_rate = 1200000;
+
+/* Startup and drain gains are the same as in BBR: */
+static const int bbr2_high_gain  = BBR_UNIT * 2885 / 1000 + 1;
+static const int bbr2_drain_gain = BBR_UNIT * 1000 / 2885;
+/* The gain for deriving steady-state cwnd tolerates delayed/stretched ACKs: */
+static const int bbr2_cwnd_gain  = BBR_UNIT * 2;
+/* The pacing_gain values for the PROBE_BW phases: */
+static const int bbr2_pacing_gain[] = {
+	BBR_UNIT * 5 / 4,	/* UP: probe for more available bw */
+	BBR_UNIT * 3 / 4,	/* DOWN: drain queue and/or yield bw */
+	BBR_UNIT,		/* CRUISE: try to use pipe w/ some headroom */
+	BBR_UNIT,		/* REFILL: refill pipe to estimated 100% */
+};
+/* PROBE_RTT cuts cwnd to this fraction of the estimated BDP: */
+static const int bbr2_probe_rtt_cwnd_gain = BBR_UNIT / 2;
+
+/* Try to keep at least this many packets in flight, if things go smoothly. */
+static const u32 bbr2_cwnd_min_target = 4;
+
+/* To estimate if BBR2_STARTUP mode (i.e. high_gain) has filled pipe... */
+/* If bw has increased significantly (1.25x), there may be more bw available: */
+static const u32 bbr2_full_bw_thresh = BBR_UNIT * 5 / 4;
+/* But after 3 rounds w/o significant bw growth, estimate pipe is full: */
+static const u32 bbr2_full_bw_cnt = 3;
+/* Exit STARTUP on a lossy round with at least this many packets lost: */
+static const u32 bbr2_full_loss_cnt = 8;
+/* Exit STARTUP after this many consecutive rounds with high ECN marks: */
+static const u32 bbr2_full_ecn_cnt = 2;
+
+/* Loss rate (lost/(delivered+lost)) in a round above which inflight is
+ * deemed too high:
+ */
+static const u32 bbr2_loss_thresh = BBR_UNIT * 2 / 100;
+/* ECN mark rate in a round above which inflight is deemed too high: */
+static const u32 bbr2_ecn_thresh = BBR_UNIT / 2;
+/* Gain of the ecn_alpha EWMA, applied once per round: */
+static const u32 bbr2_ecn_alpha_gain = BBR_UNIT / 16;
+/* Fraction of ecn_alpha by which inflight_lo is cut per marked round: */
+static const u32 bbr2_ecn_factor = BBR_UNIT / 3;
+/* Multiplicative decrease of the lower bounds on loss: keep 70%. */
+static const u32 bbr2_beta = BBR_UNIT * 7 / 10;
+/* Leave this fraction of inflight_hi unused while cruising: */
+static const u32 bbr2_inflight_headroom = BBR_UNIT * 15 / 100;
+
+/* Wait 2-3 seconds between bandwidth probes... */
+static const u32 bbr2_bw_probe_base_ms = 2000;
+static const u32 bbr2_bw_probe_rand_ms = 1000;
+/* ...but no more round trips than Reno would need, capped at: */
+static const u32 bbr2_bw_probe_max_rounds = 63;
+
+/* Gain factor for adding extra_acked to target cwnd: */
+static const int bbr2_extra_acked_gain = BBR_UNIT;
+/* Window length of extra_acked window. */
+static const u32 bbr2_extra_acked_win_rtts = 5;
+/* Max allowed val for ack_epoch_acked, after which sampling epoch is reset */
+static const u32 bbr2_ack_epoch_acked_reset_thresh = 1U << 20;
+/* Time period for clamping cwnd increment due to ack aggregation */
+static const u32 bbr2_extra_acked_max_us = 100 * 1000;
+
+static bool bbr2_ecn_enable __read_mostly = true;
+module_param_named(ecn_enable, bbr2_ecn_enable, bool, 0644);
+MODULE_PARM_DESC(ecn_enable, "use ECN marks to bound inflight when negotiated");
+
+static void bbr2_check_probe_rtt_done(struct sock *sk);
+
+/* Do we estimate that STARTUP filled the pipe? */
+static bool bbr2_full_bw_reached(const struct sock *sk)
+{
+	const struct bbr2 *bbr = inet_csk_ca(sk);
+
+	return bbr->full_bw_reached;
+}
+
+/* Return the max bw seen in the last two probe cycles, in pkts/uS << 24. */
+static u32 bbr2_max_bw(const struct sock *sk)
+{
+	const struct bbr2 *bbr = inet_csk_ca(sk);
+
+	return max(bbr->bw_hi[0], bbr->bw_hi[1]);
+}
+
+/* Return the estimated bandwidth of the path, in pkts/uS << BW_SCALE. */
+static u32 bbr2_bw(const struct sock *sk)
+{
+	const struct bbr2 *bbr = inet_csk_ca(sk);
+
+	return min(bbr2_max_bw(sk), bbr->bw_lo);
+}
+
+/* Return maximum extra acked in past k-2k round trips,
+ * where k = bbr2_extra_acked_win_rtts.
+ */
+static u16 bbr2_extra_acked(const struct sock *sk)
+{
+	const struct bbr2 *bbr = inet_csk_ca(sk);
+
+	return max(bbr->extra_acked[0], bbr->extra_acked[1]);
+}
+
+/* Is ECN feedback usable as a congestion signal on this connection? */
+static bool bbr2_ecn_eligible(const struct sock *sk)
+{
+	return bbr2_ecn_enable && (tcp_sk(sk)->ecn_flags & TCP_ECN_OK);
+}
+
+/* Are we pushing inflight up on purpose (so loss/ECN is expected)? */
+static bool bbr2_is_probing_bandwidth(const struct sock *sk)
+{
+	const struct bbr2 *bbr = inet_csk_ca(sk);
+
+	return bbr->mode == BBR2_STARTUP ||
+	       (bbr->mode == BBR2_PROBE_BW &&
+		(bbr->cycle_idx == BBR2_BW_PROBE_REFILL ||
+		 bbr->cycle_idx == BBR2_BW_PROBE_UP));
+}
+
+/* Return rate in bytes per second, optionally with a gain.
+ * The order here is chosen carefully to avoid overflow of u64. This should
+ * work for input rates of up to 2.9Tbit/sec and gain of 2.89x.
+ */
+static u64 bbr2_rate_bytes_per_sec(struct sock *sk, u64 rate, int gain)
+{
+	unsigned int mss = tcp_sk(sk)->mss_cache;
+
+	if (!tcp_needs_internal_pacing(sk))
+		mss = tcp_mss_to_mtu(sk, mss);
+	rate *= mss;
+	rate *= gain;
+	rate >>= BBR_SCALE;
+	rate *= USEC_PER_SEC;
+	return rate >> BW_SCALE;
+}
+
+/* Convert a BBR2 bw and gain factor to a pacing rate in bytes per second. */
+static u32 bbr2_bw_to_pacing_rate(struct sock *sk, u32 bw, int gain)
+{
+	u64 rate = bw;
+
+	rate = bbr2_rate_bytes_per_sec(sk, rate, gain);
+	rate = min_t(u64, rate, sk->sk_max_pacing_rate);
+	return rate;
+}
+
+/* Initialize pacing rate to: high_gain * init_cwnd / RTT. */
+static void bbr2_init_pacing_rate_from_rtt(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr2 *bbr = inet_csk_ca(sk);
+	u64 bw;
+	u32 rtt_us;
+
+	if (tp->srtt_us) {		/* any RTT sample yet? */
+		rtt_us = max(tp->srtt_us >> 3, 1U);
+		bbr->has_seen_rtt = 1;
+	} else {			 /* no RTT sample yet */
+		rtt_us = USEC_PER_MSEC;	 /* use nominal default RTT */
+	}
+	bw = (u64)tp->snd_cwnd * BW_UNIT;
+	do_div(bw, rtt_us);
+	sk->sk_pacing_rate = bbr2_bw_to_pacing_rate(sk, bw, bbr2_high_gain);
+}
+
+/* Pace using current bw estimate and a gain factor. */
+static void bbr2_set_pacing_rate(struct sock *sk, u32 bw, int gain)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr2 *bbr = inet_csk_ca(sk);
+	u32 rate = bbr2_bw_to_pacing_rate(sk, bw, gain);
+
+	if (unlikely(!bbr->has_seen_rtt && tp->srtt_us))
+		bbr2_init_pacing_rate_from_rtt(sk);
+	if (bbr2_full_bw_reached(sk) || rate > sk->sk_pacing_rate)
+		sk->sk_pacing_rate = rate;
+}
+
+/* override sysctl_tcp_min_tso_segs */
+static u32 bbr2_min_tso_segs(struct sock *sk)
+{
+	return sk->sk_pacing_rate < (bbr2_min_tso_rate >> 3) ? 1 : 2;
+}
+
+static u32 bbr2_tso_segs_goal(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	u32 segs, bytes;
+
+	/* Sort of tcp_tso_autosize() but ignoring
+	 * driver provided sk_gso_max_size.
+	 */
+	bytes = min_t(u32, sk->sk_pacing_rate >> sk->sk_pacing_shift,
+		      GSO_MAX_SIZE - 1 - MAX_TCP_HEADER);
+	segs = max_t(u32, bytes / tp->mss_cache, bbr2_min_tso_segs(sk));
+
+	return min(segs, 0x7FU);
+}
+
+/* Save "last known good" cwnd so we can restore it after losses or PROBE_RTT */
+static void bbr2_save_cwnd(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr2 *bbr = inet_csk_ca(sk);
+
+	if (bbr->prev_ca_state < TCP_CA_Recovery &&
+	    bbr->mode != BBR2_PROBE_RTT)
+		bbr->prior_cwnd = tp->snd_cwnd;  /* this cwnd is good enough */
+	else  /* loss recovery or BBR2_PROBE_RTT have temporarily cut cwnd */
+		bbr->prior_cwnd = max(bbr->prior_cwnd, tp->snd_cwnd);
+}
+
+static void bbr2_cwnd_event(struct sock *sk, enum tcp_ca_event event)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr2 *bbr = inet_csk_ca(sk);
+
+	if (event == CA_EVENT_TX_START && tp->app_limited) {
+		bbr->idle_restart = 1;
+		bbr->ack_epoch_stamp = tp->tcp_mstamp;
+		bbr->ack_epoch_acked = 0;
+		/* Avoid pointless buffer overflows: pace at est. bw if we don't
+		 * need more speed (we're restarting from idle and app-limited).
+		 */
+		if (bbr->mode == BBR2_PROBE_BW)
+			bbr2_set_pacing_rate(sk, bbr2_bw(sk), BBR_UNIT);
+		else if (bbr->mode == BBR2_PROBE_RTT)
+			bbr2_check_probe_rtt_done(sk);
+	}
+}
+
+/* Calculate bdp based on min RTT and the estimated bottleneck bandwidth:
+ *
+ * bdp = bw * min_rtt * gain
+ */
+static u32 bbr2_bdp(struct sock *sk, u32 bw, int gain)
+{
+	struct bbr2 *bbr = inet_csk_ca(sk);
+	u64 w;
+
+	/* No valid RTT samples yet: cap at the default initial cwnd. */
+	if (unlikely(bbr->min_rtt_us == ~0U))
+		return TCP_INIT_CWND;
+
+	w = (u64)bw * bbr->min_rtt_us;
+
+	/* Apply a gain to the given value, then remove the BW_SCALE shift. */
+	return (((w * gain) >> BBR_SCALE) + BW_UNIT - 1) / BW_UNIT;
+}
+
+/* Budget enough cwnd to fit full-sized skbs in-flight on both end hosts;
+ * see bbr_quantization_budget() in tcp_bbr.c.
+ */
+static u32 bbr2_quantization_budget(struct sock *sk, u32 cwnd, int gain)
+{
+	struct bbr2 *bbr = inet_csk_ca(sk);
+
+	/* Allow enough full-sized skbs in flight to utilize end systems. */
+	cwnd += 3 * bbr2_tso_segs_goal(sk);
+
+	/* Reduce delayed ACKs by rounding up cwnd to the next even number. */
+	cwnd = (cwnd + 1) & ~1U;
+
+	/* Ensure gain cycling gets inflight above BDP even for small BDPs. */
+	if (bbr->mode == BBR2_PROBE_BW && gain > BBR_UNIT)
+		cwnd += 2;
+
+	return cwnd;
+}
+
+/* Find inflight based on min RTT and the estimated bottleneck bandwidth. */
+static u32 bbr2_inflight(struct sock *sk, u32 bw, int gain)
+{
+	u32 inflight;
+
+	inflight = bbr2_bdp(sk, bw, gain);
+	inflight = bbr2_quantization_budget(sk, inflight, gain);
+
+	return inflight;
+}
+
+/* The volume we aim to keep in flight: the BDP, or cwnd if that is less. */
+static u32 bbr2_target_inflight(struct sock *sk)
+{
+	u32 bdp = bbr2_inflight(sk, bbr2_bw(sk), BBR_UNIT);
+
+	return min(bdp, tcp_sk(sk)->snd_cwnd);
+}
+
+/* inflight_hi less the headroom we leave for other flows while cruising. */
+static u32 bbr2_inflight_with_headroom(const struct sock *sk)
+{
+	const struct bbr2 *bbr = inet_csk_ca(sk);
+	u32 headroom;
+
+	if (bbr->inflight_hi == ~0U)
+		return ~0U;
+
+	headroom = ((u64)bbr->inflight_hi * bbr2_inflight_headroom) >>
+		   BBR_SCALE;
+	headroom = max(headroom, 1U);
+
+	return max_t(s32, bbr->inflight_hi - headroom, bbr2_cwnd_min_target);
+}
+
+/* Find the cwnd increment based on estimate of ack aggregation */
+static u32 bbr2_ack_aggregation_cwnd(struct sock *sk)
+{
+	u32 max_aggr_cwnd, aggr_cwnd = 0;
+
+	if (bbr2_extra_acked_gain && bbr2_full_bw_reached(sk)) {
+		max_aggr_cwnd = ((u64)bbr2_bw(sk) * bbr2_extra_acked_max_us)
+				/ BW_UNIT;
+		aggr_cwnd = (bbr2_extra_acked_gain * bbr2_extra_acked(sk))
+			     >> BBR_SCALE;
+		aggr_cwnd = min(aggr_cwnd, max_aggr_cwnd);
+	}
+
+	return aggr_cwnd;
+}
+
+/* On the first round of recovery, we follow the packet conservation
+ * principle: send P packets per P packets acked. After that, we slow-start
+ * and send at most 2*P packets per P packets acked. After recovery finishes,
+ * or upon undo, we restore the cwnd we had when recovery started (capped by
+ * the target cwnd and the inflight bounds).
+ */
+static bool bbr2_set_cwnd_to_recover_or_restore(
+	struct sock *sk, const struct rate_sample *rs, u32 acked, u32 *new_cwnd)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr2 *bbr = inet_csk_ca(sk);
+	u8 prev_state = bbr->prev_ca_state, state = inet_csk(sk)->icsk_ca_state;
+	u32 cwnd = tp->snd_cwnd;
+
+	if (rs->losses > 0)
+		cwnd = max_t(s32, cwnd - rs->losses, 1);
+
+	if (state == TCP_CA_Recovery && prev_state != TCP_CA_Recovery) {
+		/* Starting 1st round of Recovery, so do packet conservation. */
+		bbr->packet_conservation = 1;
+		bbr->next_rtt_delivered = tp->delivered;  /* start round now */
+		/* Cut unused cwnd from app behavior, TSQ, or TSO deferral: */
+		cwnd = tcp_packets_in_flight(tp) + acked;
+	} else if (prev_state >= TCP_CA_Recovery && state < TCP_CA_Recovery) {
+		/* Exiting loss recovery; restore cwnd saved before recovery. */
+		cwnd = max(cwnd, bbr->prior_cwnd);
+		bbr->packet_conservation = 0;
+	}
+	bbr->prev_ca_state = state;
+
+	if (bbr->packet_conservation) {
+		*new_cwnd = max(cwnd, tcp_packets_in_flight(tp) + acked);
+		return true;	/* yes, using packet conservation */
+	}
+	*new_cwnd = cwnd;
+	return false;
+}
+
+/* Cap cwnd by the inflight bounds that loss and ECN have taught us. Probing
+ * phases may use all of inflight_hi; cruising and PROBE_RTT leave headroom.
+ */
+static u32 bbr2_bound_cwnd_for_inflight_model(struct sock *sk, u32 cwnd)
+{
+	struct bbr2 *bbr = inet_csk_ca(sk);
+	u32 cap = ~0U;
+
+	if (bbr->mode == BBR2_PROBE_BW &&
+	    bbr->cycle_idx != BBR2_BW_PROBE_CRUISE)
+		cap = bbr->inflight_hi;
+	else if (bbr->mode == BBR2_PROBE_RTT ||
+		 (bbr->mode == BBR2_PROBE_BW &&
+		  bbr->cycle_idx == BBR2_BW_PROBE_CRUISE))
+		cap = bbr2_inflight_with_headroom(sk);
+
+	cap = min(cap, bbr->inflight_lo);
+	cap = max(cap, bbr2_cwnd_min_target);
+
+	return min(cwnd, cap);
+}
+
+/* Slow-start up toward target cwnd (if bw estimate is growing, or packet loss
+ * has drawn us down below target), or snap down to target if we're above it.
+ */
+static void bbr2_set_cwnd(struct sock *sk, const struct rate_sample *rs,
+			  u32 acked, u32 bw, int gain)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr2 *bbr = inet_csk_ca(sk);
+	u32 cwnd = tp->snd_cwnd, target_cwnd = 0;
+
+	if (!acked)
+		goto done;  /* no packet fully ACKed; just apply caps */
+
+	if (bbr2_set_cwnd_to_recover_or_restore(sk, rs, acked, &cwnd))
+		goto done;
+
+	target_cwnd = bbr2_bdp(sk, bw, gain);
+	target_cwnd += bbr2_ack_aggregation_cwnd(sk);
+	target_cwnd = bbr2_quantization_budget(sk, target_cwnd, gain);
+
+	/* If we're below target cwnd, slow start cwnd toward target cwnd. */
+	if (bbr2_full_bw_reached(sk))  /* only cut cwnd if we filled the pipe */
+		cwnd = min(cwnd + acked, target_cwnd);
+	else if (cwnd < target_cwnd || tp->delivered < TCP_INIT_CWND)
+		cwnd = cwnd + acked;
+	cwnd = max(cwnd, bbr2_cwnd_min_target);
+
+done:
+	cwnd = bbr2_bound_cwnd_for_inflight_model(sk, cwnd);
+	tp->snd_cwnd = min(cwnd, tp->snd_cwnd_clamp);	/* apply global cap */
+	if (bbr->mode == BBR2_PROBE_RTT)  /* drain queue, refresh min_rtt */
+		tp->snd_cwnd = min(tp->snd_cwnd,
+				   max(bbr2_bdp(sk, bbr2_bw(sk),
+						bbr2_probe_rtt_cwnd_gain),
+				       bbr2_cwnd_min_target));
+}
+
+/* Drop the short-term bounds, e.g. before probing or after an undo. */
+static void bbr2_reset_lower_bounds(struct sock *sk)
+{
+	struct bbr2 *bbr = inet_csk_ca(sk);
+
+	bbr->bw_lo = ~0U;
+	bbr->inflight_lo = ~0U;
+}
+
+/* Start a new round for loss and ECN accounting. */
+static void bbr2_reset_congestion_signals(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr2 *bbr = inet_csk_ca(sk);
+
+	bbr->round_delivered = tp->delivered;
+	bbr->round_lost = tp->lost;
+	bbr->round_delivered_ce = tp->delivered_ce;
+	bbr->bw_latest = 0;
+	bbr->inflight_latest = 0;
+}
+
+/* Packets lost and CE-marked so far in this loss round. */
+static u32 bbr2_round_lost(const struct sock *sk)
+{
+	const struct bbr2 *bbr = inet_csk_ca(sk);
+
+	return tcp_sk(sk)->lost - bbr->round_lost;
+}
+
+static u32 bbr2_round_ce(const struct sock *sk)
+{
+	const struct bbr2 *bbr = inet_csk_ca(sk);
+
+	if (!bbr2_ecn_eligible(sk))
+		return 0;
+	return tcp_sk(sk)->delivered_ce - bbr->round_delivered_ce;
+}
+
+/* Does loss or ECN in this round say we are sending more than the path can
+ * hold? The loss rate is taken against the larger of what the round has
+ * resolved so far and the flight the latest ACKed packet was sent into, so
+ * that one early loss does not look like a high loss rate.
+ */
+static bool bbr2_is_inflight_too_high(struct sock *sk,
+				      const struct rate_sample *rs)
+{
+	struct bbr2 *bbr = inet_csk_ca(sk);
+	u32 delivered = tcp_sk(sk)->delivered - bbr->round_delivered;
+	u32 lost = bbr2_round_lost(sk), ce = bbr2_round_ce(sk);
+	u32 flight = max(delivered + lost, rs->tx_in_flight);
+
+	if (lost && (u64)lost * BBR_UNIT > (u64)flight * bbr2_loss_thresh)
+		return true;
+
+	if (ce && (u64)ce * BBR_UNIT > (u64)delivered * bbr2_ecn_thresh)
+		return true;
+
+	return false;
+}
+
+/* Pick how long to wait before the next bandwidth probe. */
+static void bbr2_pick_probe_wait(struct sock *sk)
+{
+	struct bbr2 *bbr = inet_csk_ca(sk);
+
+	bbr->rounds_since_probe = 0;
+	bbr->probe_wait_stamp = tcp_jiffies32 +
+		msecs_to_jiffies(bbr2_bw_probe_base_ms +
+				 prandom_u32_max(bbr2_bw_probe_rand_ms));
+}
+
+static void bbr2_set_cycle_idx(struct sock *sk, int cycle_idx)
+{
+	struct bbr2 *bbr = inet_csk_ca(sk);
+
+	bbr->cycle_idx = cycle_idx;
+	bbr->pacing_gain = bbr2_pacing_gain[cycle_idx];
+	bbr->cwnd_gain = bbr2_cwnd_gain;
+}
+
+static void bbr2_start_bw_probe_down(struct sock *sk)
+{
+	struct bbr2 *bbr = inet_csk_ca(sk);
+
+	/* A new probe cycle: age out the bw seen two cycles ago. */
+	bbr->bw_hi[0] = bbr->bw_hi[1];
+	bbr->bw_hi[1] = 0;
+	bbr2_pick_probe_wait(sk);
+	bbr2_set_cycle_idx(sk, BBR2_BW_PROBE_DOWN);
+}
+
+static void bbr2_start_bw_probe_cruise(struct sock *sk)
+{
+	bbr2_set_cycle_idx(sk, BBR2_BW_PROBE_CRUISE);
+}
+
+static void bbr2_start_bw_probe_refill(struct sock *sk)
+{
+	struct bbr2 *bbr = inet_csk_ca(sk);
+
+	bbr2_reset_lower_bounds(sk);
+	bbr->bw_probe_up_rounds = 0;
+	bbr->bw_probe_up_acks = 0;
+	bbr2_set_cycle_idx(sk, BBR2_BW_PROBE_REFILL);
+}
+
+/* Grow inflight_hi exponentially per round while probing: 1, 2, 4... packets
+ * per round, spread over the ACKs of the round.
+ */
+static void bbr2_raise_inflight_hi_slope(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr2 *bbr = inet_csk_ca(sk);
+	u32 growth_this_round;
+
+	growth_this_round = 1 << bbr->bw_probe_up_rounds;
+	bbr->bw_probe_up_rounds = min(bbr->bw_probe_up_rounds + 1, 15);
+	bbr->bw_probe_up_cnt = max(tp->snd_cwnd / growth_this_round, 1U);
+}
+
+static void bbr2_start_bw_probe_up(struct sock *sk)
+{
+	struct bbr2 *bbr = inet_csk_ca(sk);
+
+	bbr->bw_probe_up_acks = 0;
+	bbr->bw_probe_up_rounds = 0;
+	bbr2_raise_inflight_hi_slope(sk);
+	bbr2_set_cycle_idx(sk, BBR2_BW_PROBE_UP);
+}
+
+/* If we are using all of inflight_hi and still see no loss or ECN, the path
+ * may hold more: raise inflight_hi by the current slope.
+ */
+static void bbr2_probe_inflight_hi_upward(struct sock *sk,
+					  const struct rate_sample *rs)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr2 *bbr = inet_csk_ca(sk);
+	u32 delta;
+
+	if (bbr->round_start)
+		bbr2_raise_inflight_hi_slope(sk);
+
+	if (!tp->is_cwnd_limited || tp->snd_cwnd < bbr->inflight_hi)
+		return;
+
+	bbr->bw_probe_up_acks += rs->acked_sacked;
+	if (bbr->bw_probe_up_acks >= bbr->bw_probe_up_cnt) {
+		delta = bbr->bw_probe_up_acks / bbr->bw_probe_up_cnt;
+		bbr->bw_probe_up_acks -= delta * bbr->bw_probe_up_cnt;
+		bbr->inflight_hi += delta;
+	}
+}
+
+/* Loss or ECN while probing: remember the flight that caused it as the new
+ * inflight_hi (but cut at most by beta from our target) and stop probing.
+ */
+static void bbr2_handle_inflight_too_high(struct sock *sk,
+					  const struct rate_sample *rs)
+{
+	struct bbr2 *bbr = inet_csk_ca(sk);
+	u32 floor;
+
+	if (!rs->is_app_limited) {
+		floor = ((u64)bbr2_target_inflight(sk) * bbr2_beta) >>
+			BBR_SCALE;
+		bbr->inflight_hi = max(rs->tx_in_flight, floor);
+	}
+	if (bbr->mode == BBR2_PROBE_BW &&
+	    bbr->cycle_idx == BBR2_BW_PROBE_UP)
+		bbr2_start_bw_probe_down(sk);
+}
+
+/* Probe when the wall clock says so, or after as many rounds as a Reno flow
+ * with our BDP would need to recover from a loss, whichever comes first.
+ */
+static bool bbr2_check_time_to_probe_bw(struct sock *sk)
+{
+	struct bbr2 *bbr = inet_csk_ca(sk);
+	u32 rounds;
+
+	rounds = min(bbr2_bw_probe_max_rounds, bbr2_target_inflight(sk));
+	if (after(tcp_jiffies32, bbr->probe_wait_stamp) ||
+	    bbr->rounds_since_probe >= rounds) {
+		bbr2_start_bw_probe_refill(sk);
+		return true;
+	}
+	return false;
+}
+
+/* The PROBE_BW phase state machine. */
+static void bbr2_update_cycle_phase(struct sock *sk,
+				    const struct rate_sample *rs)
+{
+	struct bbr2 *bbr = inet_csk_ca(sk);
+	u32 inflight;
+
+	if (bbr->mode != BBR2_PROBE_BW)
+		return;
+
+	if (bbr->round_start && bbr->rounds_since_probe < 0xFF)
+		bbr->rounds_since_probe++;
+
+	inflight = tcp_packets_in_flight(tcp_sk(sk));
+
+	switch (bbr->cycle_idx) {
+	case BBR2_BW_PROBE_DOWN:
+		if (bbr2_check_time_to_probe_bw(sk))
+			return;
+		/* Queue drained and headroom made: cruise. */
+		if (inflight <= bbr2_inflight_with_headroom(sk) &&
+		    inflight <= bbr2_inflight(sk, bbr2_max_bw(sk), BBR_UNIT))
+			bbr2_start_bw_probe_cruise(sk);
+		break;
+	case BBR2_BW_PROBE_CRUISE:
+		bbr2_check_time_to_probe_bw(sk);
+		break;
+	case BBR2_BW_PROBE_REFILL:
+		/* After a round of refilling the pipe, probe for more. */
+		if (bbr->round_start)
+			bbr2_start_bw_probe_up(sk);
+		break;
+	case BBR2_BW_PROBE_UP:
+		if (bbr2_is_inflight_too_high(sk, rs)) {
+			bbr2_handle_inflight_too_high(sk, rs);
+			return;
+		}
+		bbr2_probe_inflight_hi_upward(sk, rs);
+		/* Probed for a round and built a 1.25x BDP queue: done. */
+		if (bbr->bw_probe_up_rounds > 1 &&
+		    inflight >= bbr2_inflight(sk, bbr2_max_bw(sk),
+					      bbr->pacing_gain))
+			bbr2_start_bw_probe_down(sk);
+		break;
+	}
+}
+
+static void bbr2_reset_startup_mode(struct sock *sk)
+{
+	struct bbr2 *bbr = inet_csk_ca(sk);
+
+	bbr->mode = BBR2_STARTUP;
+	bbr->pacing_gain = bbr2_high_gain;
+	bbr->cwnd_gain	 = bbr2_high_gain;
+}
+
+static void bbr2_reset_probe_bw_mode(struct sock *sk)
+{
+	struct bbr2 *bbr = inet_csk_ca(sk);
+
+	bbr->mode = BBR2_PROBE_BW;
+	bbr2_start_bw_probe_down(sk);
+}
+
+/* Adapt the short-term bounds to a round with loss or ECN marks. ECN cuts
+ * inflight_lo in proportion to the recent mark rate, loss cuts both bounds
+ * by beta, but never below what the last round actually delivered.
+ */
+static void bbr2_adapt_lower_bounds(struct sock *sk, u32 lost, u32 ce)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr2 *bbr = inet_csk_ca(sk);
+	u32 cut;
+
+	if (bbr2_is_probing_bandwidth(sk))
+		return;
+
+	if (bbr->bw_lo == ~0U)
+		bbr->bw_lo = bbr2_max_bw(sk);
+	if (bbr->inflight_lo == ~0U)
+		bbr->inflight_lo = tp->snd_cwnd;
+
+	if (ce) {
+		cut = (bbr->ecn_alpha * bbr2_ecn_factor) >> BBR_SCALE;
+		bbr->inflight_lo = ((u64)bbr->inflight_lo *
+				    (BBR_UNIT - cut)) >> BBR_SCALE;
+	}
+	if (lost) {
+		bbr->bw_lo = max_t(u32, bbr->bw_latest,
+				   ((u64)bbr->bw_lo * bbr2_beta) >> BBR_SCALE);
+		bbr->inflight_lo = max_t(u32, bbr->inflight_latest,
+					 ((u64)bbr->inflight_lo * bbr2_beta) >>
+					 BBR_SCALE);
+	}
+}
+
+/* In STARTUP, a round with high loss or two with high ECN marks mean the
+ * pipe is full; the flight we reached becomes the first inflight_hi.
+ */
+static void bbr2_check_startup_too_high(struct sock *sk, u32 delivered,
+					u32 lost, u32 ce)
+{
+	struct bbr2 *bbr = inet_csk_ca(sk);
+	bool too_high = false;
+
+	if (bbr->mode != BBR2_STARTUP || bbr2_full_bw_reached(sk))
+		return;
+
+	if (lost >= bbr2_full_loss_cnt &&
+	    (u64)lost * BBR_UNIT > (u64)(delivered + lost) * bbr2_loss_thresh)
+		too_high = true;
+
+	if (ce && (u64)ce * BBR_UNIT > (u64)delivered * bbr2_ecn_thresh) {
+		if (++bbr->full_ecn_cnt >= bbr2_full_ecn_cnt)
+			too_high = true;
+	} else {
+		bbr->full_ecn_cnt = 0;
+	}
+
+	if (too_high) {
+		bbr->full_bw_reached = 1;
+		bbr->inflight_hi = max(bbr2_inflight(sk, bbr2_max_bw(sk),
+						     BBR_UNIT),
+				       bbr->inflight_latest);
+	}
+}
+
+/* At the end of a round, fold its loss and ECN marks into the model. */
+static void bbr2_update_congestion_signals(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr2 *bbr = inet_csk_ca(sk);
+	u32 delivered, lost, ce, ce_ratio;
+
+	delivered = tp->delivered - bbr->round_delivered;
+	lost = bbr2_round_lost(sk);
+	ce = bbr2_round_ce(sk);
+
+	if (bbr2_ecn_eligible(sk) && delivered) {
+		ce_ratio = min_t(u32, ((u64)ce << BBR_SCALE) / delivered,
+				 BBR_UNIT);
+		bbr->ecn_alpha -= (bbr->ecn_alpha * bbr2_ecn_alpha_gain) >>
+				  BBR_SCALE;
+		bbr->ecn_alpha += (ce_ratio * bbr2_ecn_alpha_gain) >>
+				  BBR_SCALE;
+	}
+
+	bbr2_check_startup_too_high(sk, delivered, lost, ce);
+	if (lost || ce)
+		bbr2_adapt_lower_bounds(sk, lost, ce);
+
+	bbr2_reset_congestion_signals(sk);
+}
+
+/* Estimate the bandwidth based on how fast packets are delivered */
+static void bbr2_update_bw(struct sock *sk, const struct rate_sample *rs)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr2 *bbr = inet_csk_ca(sk);
+	u64 bw;
+
+	bbr->round_start = 0;
+	if (rs->delivered < 0 || rs->interval_us <= 0)
+		return; /* Not a valid observation */
+
+	/* See if we've reached the next RTT */
+	if (!before(rs->prior_delivered, bbr->next_rtt_delivered)) {
+		bbr->next_rtt_delivered = tp->delivered;
+		bbr->round_start = 1;
+		bbr->packet_conservation = 0;
+		bbr2_update_congestion_signals(sk);
+	}
+
+	bw = div64_long((u64)rs->delivered * BW_UNIT, rs->interval_us);
+
+	bbr->bw_latest = max_t(u32, bbr->bw_latest, bw);
+	bbr->inflight_latest = max_t(u32, bbr->inflight_latest,
+				     rs->delivered);
+
+	/* As in BBR, app-limited samples only count if they show more bw. */
+	if (!rs->is_app_limited || bw >= bbr2_max_bw(sk))
+		bbr->bw_hi[1] = max_t(u32, bbr->bw_hi[1], bw);
+}
+
+/* Estimates the windowed max degree of ack aggregation; see
+ * bbr_update_ack_aggregation() in tcp_bbr.c.
+ */
+static void bbr2_update_ack_aggregation(struct sock *sk,
+					const struct rate_sample *rs)
+{
+	u32 epoch_us, expected_acked, extra_acked;
+	struct bbr2 *bbr = inet_csk_ca(sk);
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	if (!bbr2_extra_acked_gain || rs->acked_sacked <= 0 ||
+	    rs->delivered < 0 || rs->interval_us <= 0)
+		return;
+
+	if (bbr->round_start) {
+		bbr->extra_acked_win_rtts = min(0x1F,
+						bbr->extra_acked_win_rtts + 1);
+		if (bbr->extra_acked_win_rtts >= bbr2_extra_acked_win_rtts) {
+			bbr->extra_acked_win_rtts = 0;
+			bbr->extra_acked_win_idx = bbr->extra_acked_win_idx ?
+						   0 : 1;
+			bbr->extra_acked[bbr->extra_acked_win_idx] = 0;
+		}
+	}
+
+	/* Compute how many packets we expected to be delivered over epoch. */
+	epoch_us = (u32)tp->delivered_mstamp - bbr->ack_epoch_stamp;
+	expected_acked = ((u64)bbr2_bw(sk) * epoch_us) / BW_UNIT;
+
+	/* Reset the aggregation epoch if ACK rate is below expected rate or
+	 * significantly large no. of ack received since epoch.
+	 */
+	if (bbr->ack_epoch_acked <= expected_acked ||
+	    (bbr->ack_epoch_acked + rs->acked_sacked >=
+	     bbr2_ack_epoch_acked_reset_thresh)) {
+		bbr->ack_epoch_acked = 0;
+		bbr->ack_epoch_stamp = tp->delivered_mstamp;
+		expected_acked = 0;
+	}
+
+	/* Compute excess data delivered, beyond what was expected. */
+	bbr->ack_epoch_acked = min_t(u32, 0xFFFFF,
+				     bbr->ack_epoch_acked + rs->acked_sacked);
+	extra_acked = bbr->ack_epoch_acked - expected_acked;
+	extra_acked = min(extra_acked, tp->snd_cwnd);
+	if (extra_acked > bbr->extra_acked[bbr->extra_acked_win_idx])
+		bbr->extra_acked[bbr->extra_acked_win_idx] = extra_acked;
+}
+
+/* Estimate when the pipe is full from the bw plateau, as BBR does. */
+static void bbr2_check_full_bw_reached(struct sock *sk,
+				       const struct rate_sample *rs)
+{
+	struct bbr2 *bbr = inet_csk_ca(sk);
+	u32 bw_thresh;
+
+	if (bbr2_full_bw_reached(sk) || !bbr->round_start ||
+	    rs->is_app_limited)
+		return;
+
+	bw_thresh = (u64)bbr->full_bw * bbr2_full_bw_thresh >> BBR_SCALE;
+	if (bbr2_max_bw(sk) >= bw_thresh) {
+		bbr->full_bw = bbr2_max_bw(sk);
+		bbr->full_bw_cnt = 0;
+		return;
+	}
+	++bbr->full_bw_cnt;
+	bbr->full_bw_reached = bbr->full_bw_cnt >= bbr2_full_bw_cnt;
+}
+
+/* If pipe is probably full, drain the queue and then enter steady-state. */
+static void bbr2_check_drain(struct sock *sk, const struct rate_sample *rs)
+{
+	struct bbr2 *bbr = inet_csk_ca(sk);
+
+	if (bbr->mode == BBR2_STARTUP && bbr2_full_bw_reached(sk)) {
+		bbr->mode = BBR2_DRAIN;	/* drain queue we created */
+		bbr->pacing_gain = bbr2_drain_gain;	/* pace slow to drain */
+		bbr->cwnd_gain = bbr2_high_gain;	/* maintain cwnd */
+		tcp_sk(sk)->snd_ssthresh =
+				bbr2_inflight(sk, bbr2_max_bw(sk), BBR_UNIT);
+	}	/* fall through to check if in-flight is already small: */
+	if (bbr->mode == BBR2_DRAIN &&
+	    tcp_packets_in_flight(tcp_sk(sk)) <=
+	    bbr2_inflight(sk, bbr2_max_bw(sk), BBR_UNIT))
+		bbr2_reset_probe_bw_mode(sk);  /* we estimate queue is drained */
+}
+
+static void bbr2_check_probe_rtt_done(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr2 *bbr = inet_csk_ca(sk);
+
+	if (!(bbr->probe_rtt_done_stamp &&
+	      after(tcp_jiffies32, bbr->probe_rtt_done_stamp)))
+		return;
+
+	bbr->min_rtt_stamp = tcp_jiffies32;  /* wait a while until PROBE_RTT */
+	tp->snd_cwnd = max(tp->snd_cwnd, bbr->prior_cwnd);
+	bbr2_reset_lower_bounds(sk);
+	if (!bbr2_full_bw_reached(sk)) {
+		bbr2_reset_startup_mode(sk);
+		return;
+	}
+	bbr2_reset_probe_bw_mode(sk);
+	bbr2_start_bw_probe_cruise(sk);
+}
+
+/* PROBE_RTT as in BBR, except that inflight is cut to half the BDP rather
+ * than to 4 packets, which costs much less throughput on large BDP paths.
+ */
+static void bbr2_update_min_rtt(struct sock *sk, const struct rate_sample *rs)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr2 *bbr = inet_csk_ca(sk);
+	bool filter_expired;
+	u32 probe_rtt_cwnd;
+
+	/* Track min RTT seen in the min_rtt_win_sec filter window: */
+	filter_expired = after(tcp_jiffies32,
+			       bbr->min_rtt_stamp + bbr2_min_rtt_win_sec * HZ);
+	if (rs->rtt_us >= 0 &&
+	    (rs->rtt_us < bbr->min_rtt_us ||
+	     (filter_expired && !rs->is_ack_delayed))) {
+		bbr->min_rtt_us = rs->rtt_us;
+		bbr->min_rtt_stamp = tcp_jiffies32;
+	}
+
+	if (bbr2_probe_rtt_mode_ms > 0 && filter_expired &&
+	    !bbr->idle_restart && bbr->mode != BBR2_PROBE_RTT) {
+		bbr->mode = BBR2_PROBE_RTT;  /* dip, drain queue */
+		bbr->pacing_gain = BBR_UNIT;
+		bbr->cwnd_gain = BBR_UNIT;
+		bbr2_save_cwnd(sk);  /* note cwnd so we can restore it */
+		bbr->probe_rtt_done_stamp = 0;
+	}
+
+	if (bbr->mode == BBR2_PROBE_RTT) {
+		/* Ignore low rate samples during this mode. */
+		tp->app_limited =
+			(tp->delivered + tcp_packets_in_flight(tp)) ? : 1;
+		probe_rtt_cwnd = max(bbr2_bdp(sk, bbr2_bw(sk),
+					      bbr2_probe_rtt_cwnd_gain),
+				     bbr2_cwnd_min_target);
+		/* Maintain low inflight for max(200 ms, 1 round). */
+		if (!bbr->probe_rtt_done_stamp &&
+		    tcp_packets_in_flight(tp) <= probe_rtt_cwnd) {
+			bbr->probe_rtt_done_stamp = tcp_jiffies32 +
+				msecs_to_jiffies(bbr2_probe_rtt_mode_ms);
+			bbr->probe_rtt_round_done = 0;
+			bbr->next_rtt_delivered = tp->delivered;
+		} else if (bbr->probe_rtt_done_stamp) {
+			if (bbr->round_start)
+				bbr->probe_rtt_round_done = 1;
+			if (bbr->probe_rtt_round_done)
+				bbr2_check_probe_rtt_done(sk);
+		}
+	}
+	/* Restart after idle ends only once we process a new S/ACK for data */
+	if (rs->delivered > 0)
+		bbr->idle_restart = 0;
+}
+
+static void bbr2_update_model(struct sock *sk, const struct rate_sample *rs)
+{
+	bbr2_update_bw(sk, rs);
+	bbr2_update_ack_aggregation(sk, rs);
+	bbr2_update_cycle_phase(sk, rs);
+	bbr2_check_full_bw_reached(sk, rs);
+	bbr2_check_drain(sk, rs);
+	bbr2_update_min_rtt(sk, rs);
+}
+
+static void bbr2_main(struct sock *sk, const struct rate_sample *rs)
+{
+	struct bbr2 *bbr = inet_csk_ca(sk);
+	u32 bw;
+
+	bbr2_update_model(sk, rs);
+
+	bw = bbr2_bw(sk);
+	bbr2_set_pacing_rate(sk, bw, bbr->pacing_gain);
+	bbr2_set_cwnd(sk, rs, rs->acked_sacked, bw, bbr->cwnd_gain);
+}
+
+static void bbr2_init(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr2 *bbr = inet_csk_ca(sk);
+
+	bbr->prior_cwnd = 0;
+	tp->snd_ssthresh = TCP_INFINITE_SSTHRESH;
+	bbr->next_rtt_delivered = tp->delivered;
+	bbr->prev_ca_state = TCP_CA_Open;
+	bbr->packet_conservation = 0;
+
+	bbr->probe_rtt_done_stamp = 0;
+	bbr->probe_rtt_round_done = 0;
+	bbr->min_rtt_us = tcp_min_rtt(tp);
+	bbr->min_rtt_stamp = tcp_jiffies32;
+
+	bbr->bw_hi[0] = 0;
+	bbr->bw_hi[1] = 0;
+	bbr->inflight_hi = ~0U;
+	bbr2_reset_lower_bounds(sk);
+	bbr2_reset_congestion_signals(sk);
+	bbr->ecn_alpha = 0;
+
+	bbr->has_seen_rtt = 0;
+	bbr2_init_pacing_rate_from_rtt(sk);
+
+	bbr->round_start = 0;
+	bbr->idle_restart = 0;
+	bbr->full_bw_reached = 0;
+	bbr->full_bw = 0;
+	bbr->full_bw_cnt = 0;
+	bbr->full_ecn_cnt = 0;
+	bbr->cycle_idx = BBR2_BW_PROBE_DOWN;
+	bbr->rounds_since_probe = 0;
+	bbr->bw_probe_up_rounds = 0;
+	bbr->bw_probe_up_cnt = ~0U;
+	bbr->bw_probe_up_acks = 0;
+	bbr->probe_wait_stamp = tcp_jiffies32;
+	bbr2_reset_startup_mode(sk);
+
+	bbr->ack_epoch_stamp = tp->tcp_mstamp;
+	bbr->ack_epoch_acked = 0;
+	bbr->extra_acked_win_rtts = 0;
+	bbr->extra_acked_win_idx = 0;
+	bbr->extra_acked[0] = 0;
+	bbr->extra_acked[1] = 0;
+
+	cmpxchg(&sk->sk_pacing_status, SK_PACING_NONE, SK_PACING_NEEDED);
+}
+
+static u32 bbr2_sndbuf_expand(struct sock *sk)
+{
+	/* Provision 3 * cwnd since BBR2 may slow-start even during recovery. */
+	return 3;
+}
+
+/* The loss was spurious: forget what it taught the lower bounds. */
+static u32 bbr2_undo_cwnd(struct sock *sk)
+{
+	struct bbr2 *bbr = inet_csk_ca(sk);
+
+	bbr->full_bw = 0;   /* spurious slow-down; reset full pipe detection */
+	bbr->full_bw_cnt = 0;
+	bbr2_reset_lower_bounds(sk);
+	return tcp_sk(sk)->snd_cwnd;
+}
+
+/* Entering loss recovery, so save cwnd for when we exit or undo recovery. */
+static u32 bbr2_ssthresh(struct sock *sk)
+{
+	bbr2_save_cwnd(sk);
+	return tcp_sk(sk)->snd_ssthresh;
+}
+
+static size_t bbr2_get_info(struct sock *sk, u32 ext, int *attr,
+			    union tcp_cc_info *info)
+{
+	if (ext & (1 << (INET_DIAG_BBRINFO - 1)) ||
+	    ext & (1 << (INET_DIAG_VEGASINFO - 1))) {
+		struct tcp_sock *tp = tcp_sk(sk);
+		struct bbr2 *bbr = inet_csk_ca(sk);
+		u64 bw = bbr2_bw(sk);
+
+		bw = bw * tp->mss_cache * USEC_PER_SEC >> BW_SCALE;
+		memset(&info->bbr, 0, sizeof(info->bbr));
+		info->bbr.bbr_bw_lo		= (u32)bw;
+		info->bbr.bbr_bw_hi		= (u32)(bw >> 32);
+		info->bbr.bbr_min_rtt		= bbr->min_rtt_us;
+		info->bbr.bbr_pacing_gain	= bbr->pacing_gain;
+		info->bbr.bbr_cwnd_gain		= bbr->cwnd_gain;
+		*attr = INET_DIAG_BBRINFO;
+		return sizeof(info->bbr);
+	}
+	return 0;
+}
+
+static void bbr2_set_state(struct sock *sk, u8 new_state)
+{
+	struct bbr2 *bbr = inet_csk_ca(sk);
+	u32 cwnd;
+
+	if (new_state == TCP_CA_Loss) {
+		bbr->prev_ca_state = TCP_CA_Loss;
+		bbr->full_bw = 0;
+		bbr->round_start = 1;	/* treat RTO like end of a round */
+
+		/* An RTO while probing means the probe overshot badly; at
+		 * other times, start the lower bound from the cwnd we had.
+		 */
+		cwnd = max(bbr->prior_cwnd, bbr2_cwnd_min_target);
+		if (bbr->mode == BBR2_PROBE_BW &&
+		    bbr->cycle_idx == BBR2_BW_PROBE_UP) {
+			bbr->inflight_hi = max_t(u32, bbr2_cwnd_min_target,
+						 ((u64)cwnd * bbr2_beta) >>
+						 BBR_SCALE);
+			bbr2_start_bw_probe_down(sk);
+		} else if (!bbr2_is_probing_bandwidth(sk) &&
+			   bbr->inflight_lo == ~0U) {
+			bbr->inflight_lo = cwnd;
+		}
+	}
+}
+
+static struct tcp_congestion_ops tcp_bbr2_cong_ops __read_mostly = {
+	.flags		= TCP_CONG_NON_RESTRICTED,
+	.name		= "bbr2",
+	.owner		= THIS_MODULE,
+	.init		= bbr2_init,
+	.cong_control	= bbr2_main,
+	.sndbuf_expand	= bbr2_sndbuf_expand,
+	.undo_cwnd	= bbr2_undo_cwnd,
+	.cwnd_event	= bbr2_cwnd_event,
+	.ssthresh	= bbr2_ssthresh,
+	.min_tso_segs	= bbr2_min_tso_segs,
+	.get_info	= bbr2_get_info,
+	.set_state	= bbr2_set_state,
+};
+
+static int __init bbr2_register(void)
+{
+	BUILD_BUG_ON(sizeof(struct bbr2) > ICSK_CA_PRIV_SIZE);
+	return tcp_register_congestion_control(&tcp_bbr2_cong_ops);
+}
+
+static void __exit bbr2_unregister(void)
+{
+	tcp_unregister_congestion_control(&tcp_bbr2_cong_ops);
+}
+
+module_init(bbr2_register);
+module_exit(bbr2_unregister);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("TCP BBR2 (BBR with loss and ECN bounds on inflight)");
@@ -7,17 +7,29 @@
 
 #include <net/tcp.h>
 #include <net/strparser.h>
+#include <linux/inet_diag.h>
 #include <linux/zstd.h>
+#include <asm/unaligned.h>
 
 #define TCP_COMP_MAX_PADDING	64
 #define TCP_COMP_SCRATCH_SIZE	65535
 #define TCP_COMP_MAX_CSIZE	(TCP_COMP_SCRATCH_SIZE + TCP_COMP_MAX_PADDING)
 #define TCP_COMP_ALLOC_ORDER	get_order(65536)
+#define TCP_COMP_PAGE_SIZE	(PAGE_SIZE << TCP_COMP_ALLOC_ORDER)
 #define TCP_COMP_MAX_WINDOWLOG 17
 #define TCP_COMP_MAX_INPUT (1 << TCP_COMP_MAX_WINDOWLOG)
 
 #define TCP_COMP_SEND_PENDING	1
-#define ZSTD_COMP_DEFAULT_LEVEL	1
+#define ZSTD_COMP_MIN_LEVEL	1
+#define ZSTD_COMP_MAX_LEVEL	3
+
+/* Revisit the compression level every this many records */
+#define TCP_COMP_LEVEL_INTERVAL	16
+/*
+ * A record that does not shrink by at least 1/8 is not worth the CPU: send
+ * this many records uncompressed before sampling the flow again.
+ */
+#define TCP_COMP_BYPASS_RECORDS	32
 
 static unsigned long tcp_compression_ports[65536 / 8];
 
@@ -27,8 +39,7 @@ int sysctl_tcp_compression_local __read_mostly;
 static struct proto tcp_prot_override;
 
 struct tcp_comp_context_tx {
-	ZSTD_CStream *cstream;
-	void *cworkspace;
+	void *cstate;
 	void *plaintext_data;
 	void *compressed_data;
 
@@ -38,12 +49,20 @@ struct tcp_comp_context_tx {
 
 	struct scatterlist *partially_send;
 	bool in_tcp_sendpages;
+
+	int level;
+	unsigned int bypass;
+	unsigned int records;
+	u64 bytes_in;
+	u64 bytes_out;
+	u64 bytes_stored;
 };
 
 struct tcp_comp_context_rx {
-	ZSTD_DStream *dstream;
-	void *dworkspace;
-	void *plaintext_data;
+	/* Only held while the peer's stream is in the middle of a frame */
+	void *dstate;
+	/* The decoder may still hold output with no input left to feed it */
+	bool flush_pending;
 
 	struct strparser strp;
 	void (*saved_data_ready)(struct sock *sk);
@@ -51,9 +70,50 @@ struct tcp_comp_context_rx {
 	struct sk_buff *dpkt;
 };
 
+/*
+ * A compression backend.  Each direction of a connection is a single
+ * stream: whatever the sender flushes at the end of a sendmsg() chunk, the
+ * receiver must be able to decode without any framing of its own.  The
+ * sender ends the backend's frame at every chunk, so a receiver that has
+ * decoded all it was sent keeps no state and can give its decompression
+ * state back to the per-CPU cache.
+ */
+struct tcp_comp_alg {
+	const char *name;
+	int min_level;
+	int max_level;
+
+	/* Allocate/free the per-connection compression state */
+	void *(*tx_init)(void);
+	void (*tx_free)(void *cstate);
+	/*
+	 * Compress and flush @slen bytes of @src into @dst of @dlen bytes at
+	 * @level, or store them uncompressed if @level is 0.  Either way the
+	 * peer decodes the result with ->decompress().  Returns the number of
+	 * bytes written to @dst, or -errno.
+	 */
+	int (*compress)(void *cstate, int level, const void *src, size_t slen,
+			void *dst, size_t dlen);
+
+	/* Allocate/free a decompression state */
+	void *(*rx_init)(void);
+	void (*rx_free)(void *dstate);
+	/*
+	 * Decompress from @src into @dst.  On return *@slen is the number
+	 * of bytes consumed and *@dlen the number of bytes produced.
+	 */
+	int (*decompress)(void *dstate, const void *src, size_t *slen,
+			  void *dst, size_t *dlen);
+	/* True if @dstate is between frames and may serve another socket */
+	bool (*rx_idle)(void *dstate);
+	/* One spare decompression state per CPU */
+	void * __percpu *rx_cache;
+};
+
 struct tcp_comp_context {
 	struct rcu_head rcu;
 
+	const struct tcp_comp_alg *alg;
 	struct proto *sk_proto;
 	void (*sk_write_space)(struct sock *sk);
 
@@ -103,31 +163,243 @@ bool tcp_synack_comp_enabled(const struct sock *sk,
 				ntohs(inet->inet_sport));
 }
 
-static struct tcp_comp_context *comp_get_ctx(const struct sock *sk)
-{
-	struct inet_connection_sock *icsk = inet_csk(sk);
+struct tcp_comp_zstd {
+	void *stream;
+	void *workspace;
+	size_t wsize;
+	int level;
+	bool in_frame;		/* rx: stopped in the middle of a frame */
+	bool need_reset;	/* tx: frame ended, reset before the next one */
+};
 
-	return (__force void *)icsk->icsk_ulp_data;
-}
+/*
+ * Uncompressed records go out as a single-segment frame holding one raw
+ * block: magic, frame header descriptor, 4 byte content size, block header.
+ */
+#define ZSTD_RAW_FRAME_FHD	0xa0
+#define ZSTD_RAW_FRAME_OVERHEAD	(4 + 1 + 4 + 3)
 
-static int tcp_comp_tx_context_init(struct tcp_comp_context *ctx)
+static void *tcp_comp_zstd_tx_init(void)
 {
+	struct tcp_comp_zstd *zstd;
 	ZSTD_parameters params;
 	int csize;
 
-	params = ZSTD_getParams(ZSTD_COMP_DEFAULT_LEVEL, PAGE_SIZE, 0);
+	/* Size the workspace for the highest level we may switch to */
+	params = ZSTD_getParams(ZSTD_COMP_MAX_LEVEL, PAGE_SIZE, 0);
 	csize = ZSTD_CStreamWorkspaceBound(params.cParams);
 	if (csize <= 0)
-		return -EINVAL;
+		return NULL;
 
-	ctx->tx.cworkspace = kmalloc(csize, GFP_KERNEL);
-	if (!ctx->tx.cworkspace)
-		return -ENOMEM;
+	zstd = kmalloc(sizeof(*zstd), GFP_KERNEL);
+	if (!zstd)
+		return NULL;
 
-	ctx->tx.cstream = ZSTD_initCStream(params, 0, ctx->tx.cworkspace,
-					   csize);
-	if (!ctx->tx.cstream)
-		goto err_cstream;
+	zstd->workspace = kmalloc(csize, GFP_KERNEL);
+	if (!zstd->workspace)
+		goto err_workspace;
+
+	params = ZSTD_getParams(ZSTD_COMP_MIN_LEVEL, PAGE_SIZE, 0);
+	zstd->stream = ZSTD_initCStream(params, 0, zstd->workspace, csize);
+	if (!zstd->stream)
+		goto err_stream;
+
+	zstd->wsize = csize;
+	zstd->level = ZSTD_COMP_MIN_LEVEL;
+	zstd->need_reset = false;
+
+	return zstd;
+
+err_stream:
+	kfree(zstd->workspace);
+err_workspace:
+	kfree(zstd);
+	return NULL;
+}
+
+static void *tcp_comp_zstd_rx_init(void)
+{
+	struct tcp_comp_zstd *zstd;
+	int dsize;
+
+	dsize = ZSTD_DStreamWorkspaceBound(TCP_COMP_MAX_INPUT);
+	if (dsize <= 0)
+		return NULL;
+
+	zstd = kmalloc(sizeof(*zstd), GFP_KERNEL);
+	if (!zstd)
+		return NULL;
+
+	zstd->workspace = kmalloc(dsize, GFP_KERNEL);
+	if (!zstd->workspace)
+		goto err_workspace;
+
+	zstd->stream = ZSTD_initDStream(TCP_COMP_MAX_INPUT, zstd->workspace,
+					dsize);
+	if (!zstd->stream)
+		goto err_stream;
+
+	zstd->in_frame = false;
+
+	return zstd;
+
+err_stream:
+	kfree(zstd->workspace);
+err_workspace:
+	kfree(zstd);
+	return NULL;
+}
+
+static void tcp_comp_zstd_free(void *state)
+{
+	struct tcp_comp_zstd *zstd = state;
+
+	if (!zstd)
+		return;
+
+	kfree(zstd->workspace);
+	kfree(zstd);
+}
+
+static int tcp_comp_zstd_store(const void *src, size_t slen,
+			       ZSTD_outBuffer *outbuf)
+{
+	u8 *p = (u8 *)outbuf->dst + outbuf->pos;
+	u32 bhdr;
+
+	if (outbuf->size - outbuf->pos < slen + ZSTD_RAW_FRAME_OVERHEAD)
+		return -EIO;
+
+	put_unaligned_le32(ZSTD_MAGICNUMBER, p);
+	p[4] = ZSTD_RAW_FRAME_FHD;
+	put_unaligned_le32(slen, p + 5);
+	/* last block, raw */
+	bhdr = (slen << 3) | 1;
+	p[9] = bhdr;
+	p[10] = bhdr >> 8;
+	p[11] = bhdr >> 16;
+	memcpy(p + ZSTD_RAW_FRAME_OVERHEAD, src, slen);
+
+	return outbuf->pos + ZSTD_RAW_FRAME_OVERHEAD + slen;
+}
+
+static int tcp_comp_zstd_compress(void *cstate, int level, const void *src,
+				  size_t slen, void *dst, size_t dlen)
+{
+	struct tcp_comp_zstd *zstd = cstate;
+	ZSTD_parameters params;
+	ZSTD_outBuffer outbuf;
+	ZSTD_inBuffer inbuf;
+	size_t ret;
+
+	inbuf.src = src;
+	inbuf.size = slen;
+	inbuf.pos = 0;
+	outbuf.dst = dst;
+	outbuf.size = dlen;
+	outbuf.pos = 0;
+
+	if (!level)
+		return tcp_comp_zstd_store(src, slen, &outbuf);
+
+	if (level != zstd->level) {
+		params = ZSTD_getParams(level, PAGE_SIZE, 0);
+		zstd->stream = ZSTD_initCStream(params, 0, zstd->workspace,
+						zstd->wsize);
+		if (!zstd->stream)
+			return -EIO;
+		zstd->level = level;
+		zstd->need_reset = false;
+	} else if (zstd->need_reset) {
+		ret = ZSTD_resetCStream(zstd->stream, 0);
+		if (ZSTD_isError(ret))
+			return -EIO;
+		zstd->need_reset = false;
+	}
+
+	ret = ZSTD_compressStream(zstd->stream, &outbuf, &inbuf);
+	if (ZSTD_isError(ret))
+		return -EIO;
+
+	/*
+	 * End the frame rather than just flushing it.  The window at these
+	 * levels is a few pages, so little history is lost across records,
+	 * and the receiver gets a point where it holds no decoder state.
+	 */
+	ret = ZSTD_endStream(zstd->stream, &outbuf);
+	zstd->need_reset = true;
+	if (ZSTD_isError(ret) || ret)
+		return -EIO;
+
+	if (inbuf.pos != inbuf.size)
+		return -EIO;
+
+	return outbuf.pos;
+}
+
+static int tcp_comp_zstd_decompress(void *dstate, const void *src,
+				    size_t *slen, void *dst, size_t *dlen)
+{
+	struct tcp_comp_zstd *zstd = dstate;
+	ZSTD_outBuffer outbuf;
+	ZSTD_inBuffer inbuf;
+	size_t ret;
+
+	inbuf.src = src;
+	inbuf.size = *slen;
+	inbuf.pos = 0;
+	outbuf.dst = dst;
+	outbuf.size = *dlen;
+	outbuf.pos = 0;
+
+	ret = ZSTD_decompressStream(zstd->stream, &outbuf, &inbuf);
+	if (ZSTD_isError(ret))
+		return -EIO;
+
+	/* 0 means a frame was completely decoded and flushed */
+	if (inbuf.pos || outbuf.pos)
+		zstd->in_frame = ret != 0;
+
+	*slen = inbuf.pos;
+	*dlen = outbuf.pos;
+	return 0;
+}
+
+static bool tcp_comp_zstd_rx_idle(void *dstate)
+{
+	struct tcp_comp_zstd *zstd = dstate;
+
+	return !zstd->in_frame;
+}
+
+static DEFINE_PER_CPU(void *, tcp_comp_zstd_rx_cache);
+
+static const struct tcp_comp_alg tcp_comp_zstd = {
+	.name		= "zstd",
+	.min_level	= ZSTD_COMP_MIN_LEVEL,
+	.max_level	= ZSTD_COMP_MAX_LEVEL,
+	.tx_init	= tcp_comp_zstd_tx_init,
+	.tx_free	= tcp_comp_zstd_free,
+	.compress	= tcp_comp_zstd_compress,
+	.rx_init	= tcp_comp_zstd_rx_init,
+	.rx_free	= tcp_comp_zstd_free,
+	.decompress	= tcp_comp_zstd_decompress,
+	.rx_idle	= tcp_comp_zstd_rx_idle,
+	.rx_cache	= &tcp_comp_zstd_rx_cache,
+};
+
+static struct tcp_comp_context *comp_get_ctx(const struct sock *sk)
+{
+	struct inet_connection_sock *icsk = inet_csk(sk);
+
+	return (__force void *)icsk->icsk_ulp_data;
+}
+
+static int tcp_comp_tx_context_init(struct tcp_comp_context *ctx)
+{
+	ctx->tx.cstate = ctx->alg->tx_init();
+	if (!ctx->tx.cstate)
+		return -ENOMEM;
 
 	ctx->tx.plaintext_data = kvmalloc(TCP_COMP_SCRATCH_SIZE, GFP_KERNEL);
 	if (!ctx->tx.plaintext_data)
@@ -143,8 +415,8 @@ static int tcp_comp_tx_context_init(struct tcp_comp_context *ctx)
 	kvfree(ctx->tx.plaintext_data);
 	ctx->tx.plaintext_data = NULL;
 err_cstream:
-	kfree(ctx->tx.cworkspace);
-	ctx->tx.cworkspace = NULL;
+	ctx->alg->tx_free(ctx->tx.cstate);
+	ctx->tx.cstate = NULL;
 
 	return -ENOMEM;
 }
@@ -243,35 +515,58 @@ static void trim_sg(struct sock *sk, int target_size)
 	sg_mark_end(ctx->tx.sg_data + ctx->tx.sg_num - 1);
 }
 
-static int tcp_comp_compress_to_sg(struct sock *sk, int bytes)
+/*
+ * Pick the level for the next record: 0 while bypassing an incompressible
+ * flow, otherwise raise the level while the send queue backs up (the link
+ * is the bottleneck, spend CPU to shrink it) and lower it again once the
+ * queue drains.
+ */
+static int tcp_comp_next_level(struct sock *sk, struct tcp_comp_context *ctx)
 {
-	struct tcp_comp_context *ctx = comp_get_ctx(sk);
-	ZSTD_outBuffer outbuf;
-	ZSTD_inBuffer inbuf;
-	size_t ret;
+	struct tcp_comp_context_tx *tx = &ctx->tx;
 
-	inbuf.src = ctx->tx.plaintext_data;
-	outbuf.dst = ctx->tx.compressed_data;
-	inbuf.size = bytes;
-	outbuf.size = TCP_COMP_MAX_CSIZE;
-	inbuf.pos = 0;
-	outbuf.pos = 0;
+	if (tx->bypass) {
+		tx->bypass--;
+		return 0;
+	}
 
-	ret = ZSTD_compressStream(ctx->tx.cstream, &outbuf, &inbuf);
-	if (ZSTD_isError(ret))
-		return -EIO;
+	if (++tx->records % TCP_COMP_LEVEL_INTERVAL)
+		return tx->level;
 
-	ret = ZSTD_flushStream(ctx->tx.cstream, &outbuf);
-	if (ZSTD_isError(ret))
-		return -EIO;
+	if (sk->sk_wmem_queued > sk->sk_sndbuf / 2) {
+		if (tx->level < ctx->alg->max_level)
+			tx->level++;
+	} else if (sk->sk_wmem_queued < sk->sk_sndbuf / 8) {
+		if (tx->level > ctx->alg->min_level)
+			tx->level--;
+	}
 
-	if (inbuf.pos != inbuf.size)
-		return -EIO;
+	return tx->level;
+}
 
-	if (memcopy_to_sg(sk, outbuf.pos))
+static int tcp_comp_compress_to_sg(struct sock *sk, int bytes)
+{
+	struct tcp_comp_context *ctx = comp_get_ctx(sk);
+	int level, clen;
+
+	level = tcp_comp_next_level(sk, ctx);
+	clen = ctx->alg->compress(ctx->tx.cstate, level,
+				  ctx->tx.plaintext_data, bytes,
+				  ctx->tx.compressed_data, TCP_COMP_MAX_CSIZE);
+	if (clen < 0)
+		return clen;
+
+	ctx->tx.bytes_in += bytes;
+	ctx->tx.bytes_out += clen;
+	if (!level)
+		ctx->tx.bytes_stored += bytes;
+	else if ((u64)clen * 8 > (u64)bytes * 7)
+		ctx->tx.bypass = TCP_COMP_BYPASS_RECORDS;
+
+	if (memcopy_to_sg(sk, clen))
 		return -EIO;
 
-	trim_sg(sk, outbuf.pos);
+	trim_sg(sk, clen);
 
 	return 0;
 }
@@ -549,146 +844,140 @@ static bool comp_advance_dskb(struct sock *sk, struct sk_buff *skb,
 	return true;
 }
 
-static int tcp_comp_rx_context_init(struct tcp_comp_context *ctx)
+static int tcp_comp_rx_get_state(struct tcp_comp_context *ctx)
 {
-	int dsize;
-
-	dsize = ZSTD_DStreamWorkspaceBound(TCP_COMP_MAX_INPUT);
-	if (dsize <= 0)
-		return -EINVAL;
-
-	ctx->rx.dworkspace = kmalloc(dsize, GFP_KERNEL);
-	if (!ctx->rx.dworkspace)
-		return -ENOMEM;
-
-	ctx->rx.dstream = ZSTD_initDStream(TCP_COMP_MAX_INPUT,
-					   ctx->rx.dworkspace, dsize);
-	if (!ctx->rx.dstream)
-		goto err_dstream;
-
-	ctx->rx.plaintext_data = kvmalloc(TCP_COMP_MAX_CSIZE * 32, GFP_KERNEL);
-	if (!ctx->rx.plaintext_data)
-		goto err_dstream;
-
-	return 0;
+	if (ctx->rx.dstate)
+		return 0;
 
-err_dstream:
-	kfree(ctx->rx.dworkspace);
-	ctx->rx.dworkspace = NULL;
+	ctx->rx.dstate = this_cpu_xchg(*ctx->alg->rx_cache, NULL);
+	if (!ctx->rx.dstate)
+		ctx->rx.dstate = ctx->alg->rx_init();
 
-	return -ENOMEM;
+	return ctx->rx.dstate ? 0 : -ENOMEM;
 }
 
-static void *tcp_comp_get_rx_stream(struct sock *sk)
+static void tcp_comp_rx_put_state(struct tcp_comp_context *ctx)
 {
-	struct tcp_comp_context *ctx = comp_get_ctx(sk);
-
-	if (!ctx->rx.plaintext_data)
-		tcp_comp_rx_context_init(ctx);
+	void *dstate = ctx->rx.dstate;
 
-	return ctx->rx.plaintext_data;
+	ctx->rx.dstate = NULL;
+	dstate = this_cpu_xchg(*ctx->alg->rx_cache, dstate);
+	if (dstate)
+		ctx->alg->rx_free(dstate);
 }
 
+/*
+ * Decompress the strparser record @skb, or just drain the decoder if @skb
+ * is NULL, into a new skb made of page frags.  The record is read in place
+ * and the output is written straight into the frags, so neither side goes
+ * through a bounce buffer and the output is not bounded by one.  Whatever
+ * does not fit in MAX_SKB_FRAGS is left for the next call.
+ */
 static int tcp_comp_decompress(struct sock *sk, struct sk_buff *skb, int flags)
 {
 	struct tcp_comp_context *ctx = comp_get_ctx(sk);
-	struct strp_msg *rxm = strp_msg(skb);
-	size_t ret, compressed_len = 0;
-	int nr_frags_over = 0;
-	ZSTD_outBuffer outbuf;
-	ZSTD_inBuffer inbuf;
+	struct strp_msg *rxm = skb ? strp_msg(skb) : NULL;
+	unsigned int full_len = rxm ? rxm->full_len : 0;
+	unsigned int consumed = 0, poff = 0;
+	struct page *page = NULL;
+	skb_frag_t *frag = NULL;
+	struct skb_seq_state st;
 	struct sk_buff *nskb;
-	int len, plen;
-	void *to;
-
-	to = tcp_comp_get_rx_stream(sk);
-	if (!to)
-		return -ENOSPC;
+	size_t inlen, outlen;
+	const u8 *data;
+	int ret;
 
-	if (skb_linearize_cow(skb))
-		return -ENOMEM;
+	ret = tcp_comp_rx_get_state(ctx);
+	if (ret)
+		return ret;
 
-	nskb = skb_copy(skb, GFP_KERNEL);
+	nskb = alloc_skb(0, GFP_KERNEL);
 	if (!nskb)
 		return -ENOMEM;
 
-	while (compressed_len < (skb->len - rxm->offset)) {
-		len = 0;
-		plen = skb->len - rxm->offset - compressed_len;
-		if (plen > TCP_COMP_MAX_CSIZE)
-			plen = TCP_COMP_MAX_CSIZE;
-
-		inbuf.src = (char *)skb->data + rxm->offset + compressed_len;
-		inbuf.pos = 0;
-		inbuf.size = plen;
-
-		outbuf.dst = ctx->rx.plaintext_data;
-		outbuf.pos = 0;
-		outbuf.size = TCP_COMP_MAX_CSIZE * 32;
+	while (consumed < full_len || ctx->rx.flush_pending) {
+		if (!page) {
+			if (skb_shinfo(nskb)->nr_frags >= MAX_SKB_FRAGS)
+				break;
 
-		ret = ZSTD_decompressStream(ctx->rx.dstream, &outbuf, &inbuf);
-		if (ZSTD_isError(ret)) {
-			kfree_skb(nskb);
-			return -EIO;
+			page = alloc_pages(GFP_KERNEL | __GFP_NOWARN |
+					   __GFP_COMP, TCP_COMP_ALLOC_ORDER);
+			if (!page) {
+				ret = -ENOMEM;
+				goto err;
+			}
+			poff = 0;
 		}
 
-		if (!compressed_len) {
-			len = outbuf.pos - skb->len;
-			if (len > skb_tailroom(nskb))
-				len = skb_tailroom(nskb);
-
-			__skb_put(nskb, len);
-
-			len += skb->len;
-			skb_copy_to_linear_data(nskb, to, len);
+		/* Map one chunk at a time, nothing may sleep while mapped */
+		inlen = 0;
+		data = NULL;
+		if (consumed < full_len) {
+			skb_prepare_seq_read(skb, rxm->offset + consumed,
+					     rxm->offset + full_len, &st);
+			inlen = skb_seq_read(0, &data, &st);
 		}
 
-		while ((to += len, outbuf.pos -= len) > 0) {
-			struct page *pages;
-			skb_frag_t *frag;
-
-			if (skb_shinfo(nskb)->nr_frags >= MAX_SKB_FRAGS) {
-				nr_frags_over = 1;
-				break;
-			}
-
-			frag = skb_shinfo(nskb)->frags +
-			       skb_shinfo(nskb)->nr_frags;
-			pages = alloc_pages(__GFP_NOWARN | GFP_KERNEL | __GFP_COMP,
-					    TCP_COMP_ALLOC_ORDER);
-			if (!pages) {
-				kfree_skb(nskb);
-				return -ENOMEM;
+		outlen = TCP_COMP_PAGE_SIZE - poff;
+		ret = ctx->alg->decompress(ctx->rx.dstate, data, &inlen,
+					   page_address(page) + poff, &outlen);
+		if (data)
+			skb_abort_seq_read(&st);
+		if (ret < 0)
+			goto err;
+
+		ctx->rx.flush_pending = outlen == TCP_COMP_PAGE_SIZE - poff;
+		if (!inlen && !outlen) {
+			if (consumed < full_len) {
+				ret = -EIO;
+				goto err;
 			}
+			break;
+		}
+		consumed += inlen;
 
-			__skb_frag_set_page(frag, pages);
-			len = PAGE_SIZE << TCP_COMP_ALLOC_ORDER;
-			if (outbuf.pos < len)
-				len = outbuf.pos;
+		if (!outlen)
+			continue;
 
+		if (!frag) {
+			frag = skb_shinfo(nskb)->frags +
+			       skb_shinfo(nskb)->nr_frags++;
+			__skb_frag_set_page(frag, page);
 			frag->page_offset = 0;
-			skb_frag_size_set(frag, len);
-			memcpy(skb_frag_address(frag), to, len);
-
-			nskb->truesize += len;
-			nskb->data_len += len;
-			nskb->len += len;
-			skb_shinfo(nskb)->nr_frags++;
+			skb_frag_size_set(frag, 0);
+			nskb->truesize += TCP_COMP_PAGE_SIZE;
+		}
+		skb_frag_size_add(frag, outlen);
+		nskb->data_len += outlen;
+		nskb->len += outlen;
+
+		poff += outlen;
+		if (poff == TCP_COMP_PAGE_SIZE) {
+			page = NULL;
+			frag = NULL;
 		}
+	}
 
-		if (nr_frags_over)
-			break;
+	if (page && !frag)
+		__free_pages(page, TCP_COMP_ALLOC_ORDER);
 
-		compressed_len += inbuf.pos;
-	}
+	if (!ctx->rx.flush_pending && ctx->alg->rx_idle(ctx->rx.dstate))
+		tcp_comp_rx_put_state(ctx);
 
 	ctx->rx.dpkt = nskb;
 	rxm = strp_msg(nskb);
 	rxm->full_len = nskb->len;
 	rxm->offset = 0;
-	comp_advance_skb(sk, skb, compressed_len);
+	if (skb)
+		comp_advance_skb(sk, skb, consumed);
 
 	return 0;
+
+err:
+	if (page && !frag)
+		__free_pages(page, TCP_COMP_ALLOC_ORDER);
+	kfree_skb(nskb);
+	return ret;
 }
 
 static int tcp_comp_recvmsg(struct sock *sk, struct msghdr *msg, size_t len,
@@ -715,9 +1004,12 @@ static int tcp_comp_recvmsg(struct sock *sk, struct msghdr *msg, size_t len,
 		int chunk = 0;
 
 		if (!ctx->rx.dpkt) {
-			skb = comp_wait_data(sk, flags, timeo, &err);
-			if (!skb)
-				goto recv_end;
+			skb = ctx->rx.pkt;
+			if (!skb && !ctx->rx.flush_pending) {
+				skb = comp_wait_data(sk, flags, timeo, &err);
+				if (!skb)
+					goto recv_end;
+			}
 
 			err = tcp_comp_decompress(sk, skb, flags);
 			if (err < 0) {
@@ -756,7 +1048,7 @@ bool comp_stream_read(const struct sock *sk)
 	if (!ctx)
 		return false;
 
-	if (ctx->rx.pkt || ctx->rx.dpkt)
+	if (ctx->rx.pkt || ctx->rx.dpkt || ctx->rx.flush_pending)
 		return true;
 
 	return false;
@@ -844,6 +1136,9 @@ void tcp_init_compression(struct sock *sk)
 
 	sg_init_table(ctx->tx.sg_data, ARRAY_SIZE(ctx->tx.sg_data));
 
+	ctx->alg = &tcp_comp_zstd;
+	ctx->tx.level = ctx->alg->min_level;
+
 	ctx->sk_write_space = sk->sk_write_space;
 	ctx->sk_proto = sk->sk_prot;
 	WRITE_ONCE(sk->sk_prot, &tcp_prot_override);
@@ -866,8 +1161,8 @@ static void free_sg(struct sock *sk, struct scatterlist *sg)
 
 static void tcp_comp_context_tx_free(struct tcp_comp_context *ctx)
 {
-	kfree(ctx->tx.cworkspace);
-	ctx->tx.cworkspace = NULL;
+	ctx->alg->tx_free(ctx->tx.cstate);
+	ctx->tx.cstate = NULL;
 
 	kvfree(ctx->tx.plaintext_data);
 	ctx->tx.plaintext_data = NULL;
@@ -878,11 +1173,8 @@ static void tcp_comp_context_tx_free(struct tcp_comp_context *ctx)
 
 static void tcp_comp_context_rx_free(struct tcp_comp_context *ctx)
 {
-	kfree(ctx->rx.dworkspace);
-	ctx->rx.dworkspace = NULL;
-
-	kvfree(ctx->rx.plaintext_data);
-	ctx->rx.plaintext_data = NULL;
+	ctx->alg->rx_free(ctx->rx.dstate);
+	ctx->rx.dstate = NULL;
 }
 
 static void tcp_comp_context_free(struct rcu_head *head)
@@ -925,6 +1217,48 @@ void tcp_cleanup_compression(struct sock *sk)
 	call_rcu(&ctx->rcu, tcp_comp_context_free);
 }
 
+size_t tcp_comp_get_info_size(const struct sock *sk)
+{
+	if (!sock_flag(sk, SOCK_COMP))
+		return 0;
+
+	return nla_total_size_64bit(sizeof(struct tcp_comp_info));
+}
+EXPORT_SYMBOL_GPL(tcp_comp_get_info_size);
+
+int tcp_comp_get_info(struct sock *sk, struct sk_buff *skb)
+{
+	struct tcp_comp_context *ctx;
+	struct tcp_comp_info *info;
+	struct nlattr *attr;
+	int err = 0;
+
+	rcu_read_lock();
+	ctx = rcu_dereference(inet_csk(sk)->icsk_ulp_data);
+	if (!ctx || !sock_flag(sk, SOCK_COMP))
+		goto out;
+
+	attr = nla_reserve_64bit(skb, INET_DIAG_COMPINFO, sizeof(*info),
+				 INET_DIAG_PAD);
+	if (!attr) {
+		err = -EMSGSIZE;
+		goto out;
+	}
+
+	/* Unlocked snapshot, the sender updates these under the socket lock */
+	info = nla_data(attr);
+	info->tcpcomp_bypass = READ_ONCE(ctx->tx.bypass);
+	info->tcpcomp_level = info->tcpcomp_bypass ? 0 :
+			      READ_ONCE(ctx->tx.level);
+	info->tcpcomp_bytes_in = READ_ONCE(ctx->tx.bytes_in);
+	info->tcpcomp_bytes_out = READ_ONCE(ctx->tx.bytes_out);
+	info->tcpcomp_bytes_stored = READ_ONCE(ctx->tx.bytes_stored);
+out:
+	rcu_read_unlock();
+	return err;
+}
+EXPORT_SYMBOL_GPL(tcp_comp_get_info);
+
 int tcp_comp_init(void)
 {
 	tcp_prot_override = tcp_prot;
@@ -104,7 +104,7 @@ static int tcp_diag_get_aux(struct sock *sk, bool net_admin,
 	}
 #endif
 
-	return 0;
+	return tcp_comp_get_info(sk, skb);
 }
 
 static size_t tcp_diag_get_aux_size(struct sock *sk, bool net_admin)
@@ -129,6 +129,9 @@ static size_t tcp_diag_get_aux_size(struct sock *sk, bool net_admin)
 	}
 #endif
 
+	if (sk_fullsock(sk))
+		size += tcp_comp_get_info_size(sk);
+
 	return size;
 }
 
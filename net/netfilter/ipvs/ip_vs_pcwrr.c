@@ -0,0 +1,267 @@
+/*
+ * IPVS:        Per-CPU Weighted Round-Robin Scheduling module
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * The pcwrr scheduler hands out destinations in the same interleaved order
+ * as wrr, but without svc->sched_lock: the whole WRR cycle is precomputed
+ * into a slot table whenever a destination is added, removed or changes
+ * weight, and each CPU walks that table with its own cursor.  Scheduling a
+ * new connection is then a per-CPU increment and one table load, so it
+ * scales with the number of CPUs taking new connections.
+ *
+ * Every CPU follows the full cycle, so the weight ratios hold per CPU; only
+ * the interleaving between CPUs is not the global sequence wrr would give.
+ * Overloaded and quiesced (weight 0) destinations are skipped at schedule
+ * time as with wrr.
+ */
+
+#define KMSG_COMPONENT "IPVS"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/percpu.h>
+#include <linux/gcd.h>
+
+#include <net/ip_vs.h>
+
+/* Longer cycles are scaled down to about this many slots */
+#define IP_VS_PCWRR_MAX_SLOTS	4096
+
+struct ip_vs_pcwrr_table {
+	struct rcu_head		rcu_head;
+	unsigned int		len;
+	struct ip_vs_dest	*slot[0];
+};
+
+struct ip_vs_pcwrr_data {
+	struct ip_vs_pcwrr_table __rcu	*table;
+	unsigned int __percpu		*cursor;
+	struct rcu_head			rcu_head;
+};
+
+
+static void ip_vs_pcwrr_free_table(struct rcu_head *head)
+{
+	kvfree(container_of(head, struct ip_vs_pcwrr_table, rcu_head));
+}
+
+/*
+ *    Build the slot table of one WRR cycle: pass cw = mw, mw - di, ..., di
+ *    over the destinations, in list order, taking those with weight >= cw.
+ */
+static struct ip_vs_pcwrr_table *
+ip_vs_pcwrr_build(struct ip_vs_service *svc)
+{
+	struct ip_vs_pcwrr_table *t;
+	struct ip_vs_dest *dest;
+	unsigned int len = 0, n, i;
+	int weight, mw = 0, di = 0;
+	int cw;
+
+	list_for_each_entry(dest, &svc->destinations, n_list) {
+		weight = atomic_read(&dest->weight);
+		if (weight <= 0)
+			continue;
+		di = di ? gcd(weight, di) : weight;
+		mw = max(mw, weight);
+	}
+	if (!mw)
+		return NULL;
+
+	list_for_each_entry(dest, &svc->destinations, n_list) {
+		weight = atomic_read(&dest->weight);
+		if (weight > 0)
+			len += weight / di;
+	}
+
+	/* Scale huge cycles down, keeping every destination in it */
+	n = len > IP_VS_PCWRR_MAX_SLOTS ?
+	    DIV_ROUND_UP(len, IP_VS_PCWRR_MAX_SLOTS) : 1;
+	mw = DIV_ROUND_UP(mw / di, n);
+	len = 0;
+	list_for_each_entry(dest, &svc->destinations, n_list) {
+		weight = atomic_read(&dest->weight);
+		if (weight > 0)
+			len += DIV_ROUND_UP(weight / di, n);
+	}
+
+	t = kvmalloc(sizeof(*t) + len * sizeof(t->slot[0]), GFP_KERNEL);
+	if (!t)
+		return ERR_PTR(-ENOMEM);
+
+	i = 0;
+	for (cw = mw; cw > 0; cw--) {
+		list_for_each_entry(dest, &svc->destinations, n_list) {
+			weight = atomic_read(&dest->weight);
+			if (weight <= 0 || DIV_ROUND_UP(weight / di, n) < cw)
+				continue;
+			if (i == len)
+				break;
+			t->slot[i++] = dest;
+		}
+	}
+	t->len = i;
+
+	return t;
+}
+
+
+static int ip_vs_pcwrr_dest_changed(struct ip_vs_service *svc,
+				    struct ip_vs_dest *dest)
+{
+	struct ip_vs_pcwrr_data *data = svc->sched_data;
+	struct ip_vs_pcwrr_table *t, *old;
+	int ret = 0;
+
+	t = ip_vs_pcwrr_build(svc);
+	if (IS_ERR(t)) {
+		/* Never keep a table pointing at an unlinked dest */
+		ret = PTR_ERR(t);
+		t = NULL;
+	}
+
+	old = rcu_dereference_protected(data->table, 1);
+	rcu_assign_pointer(data->table, t);
+	if (old)
+		call_rcu(&old->rcu_head, ip_vs_pcwrr_free_table);
+
+	return ret;
+}
+
+
+static int ip_vs_pcwrr_init_svc(struct ip_vs_service *svc)
+{
+	struct ip_vs_pcwrr_data *data;
+	int cpu;
+
+	data = kzalloc(sizeof(*data), GFP_KERNEL);
+	if (!data)
+		return -ENOMEM;
+
+	data->cursor = alloc_percpu(unsigned int);
+	if (!data->cursor) {
+		kfree(data);
+		return -ENOMEM;
+	}
+
+	/* Don't let all CPUs start the cycle at the same slot */
+	for_each_possible_cpu(cpu)
+		*per_cpu_ptr(data->cursor, cpu) = cpu;
+
+	svc->sched_data = data;
+	ip_vs_pcwrr_dest_changed(svc, NULL);
+
+	return 0;
+}
+
+
+static void ip_vs_pcwrr_free_data(struct rcu_head *head)
+{
+	struct ip_vs_pcwrr_data *data;
+
+	data = container_of(head, struct ip_vs_pcwrr_data, rcu_head);
+	kvfree(rcu_dereference_raw(data->table));
+	free_percpu(data->cursor);
+	kfree(data);
+}
+
+
+static void ip_vs_pcwrr_done_svc(struct ip_vs_service *svc)
+{
+	struct ip_vs_pcwrr_data *data = svc->sched_data;
+
+	call_rcu(&data->rcu_head, ip_vs_pcwrr_free_data);
+}
+
+
+static inline bool ip_vs_pcwrr_usable(const struct ip_vs_dest *dest)
+{
+	return !(dest->flags & IP_VS_DEST_F_OVERLOAD) &&
+	       atomic_read(&dest->weight) > 0;
+}
+
+/*
+ *    Per-CPU Weighted Round-Robin Scheduling
+ */
+static struct ip_vs_dest *
+ip_vs_pcwrr_schedule(struct ip_vs_service *svc, const struct sk_buff *skb,
+		     struct ip_vs_iphdr *iph)
+{
+	struct ip_vs_pcwrr_data *data = svc->sched_data;
+	struct ip_vs_pcwrr_table *t;
+	struct ip_vs_dest *dest;
+	unsigned int pos, i;
+
+	IP_VS_DBG(6, "%s(): Scheduling...\n", __func__);
+
+	t = rcu_dereference(data->table);
+	if (unlikely(!t)) {
+		/* No weighted dests, or the last rebuild failed */
+		list_for_each_entry_rcu(dest, &svc->destinations, n_list) {
+			if (ip_vs_pcwrr_usable(dest))
+				goto found;
+		}
+		goto err_noavail;
+	}
+
+	pos = this_cpu_inc_return(*data->cursor);
+	for (i = 0; i < t->len; i++) {
+		dest = t->slot[(pos + i) % t->len];
+		if (ip_vs_pcwrr_usable(dest)) {
+			/* Skipped slots count as used */
+			if (i)
+				this_cpu_add(*data->cursor, i);
+			goto found;
+		}
+	}
+
+err_noavail:
+	ip_vs_scheduler_err(svc, "no destination available");
+	return NULL;
+
+found:
+	IP_VS_DBG_BUF(6, "PCWRR: server %s:%u "
+		      "activeconns %d refcnt %d weight %d\n",
+		      IP_VS_DBG_ADDR(dest->af, &dest->addr), ntohs(dest->port),
+		      atomic_read(&dest->activeconns),
+		      refcount_read(&dest->refcnt),
+		      atomic_read(&dest->weight));
+
+	return dest;
+}
+
+
+static struct ip_vs_scheduler ip_vs_pcwrr_scheduler = {
+	.name =			"pcwrr",
+	.refcnt =		ATOMIC_INIT(0),
+	.module =		THIS_MODULE,
+	.n_list =		LIST_HEAD_INIT(ip_vs_pcwrr_scheduler.n_list),
+	.init_service =		ip_vs_pcwrr_init_svc,
+	.done_service =		ip_vs_pcwrr_done_svc,
+	.add_dest =		ip_vs_pcwrr_dest_changed,
+	.del_dest =		ip_vs_pcwrr_dest_changed,
+	.upd_dest =		ip_vs_pcwrr_dest_changed,
+	.schedule =		ip_vs_pcwrr_schedule,
+};
+
+static int __init ip_vs_pcwrr_init(void)
+{
+	return register_ip_vs_scheduler(&ip_vs_pcwrr_scheduler);
+}
+
+static void __exit ip_vs_pcwrr_cleanup(void)
+{
+	unregister_ip_vs_scheduler(&ip_vs_pcwrr_scheduler);
+	rcu_barrier();
+}
+
+module_init(ip_vs_pcwrr_init);
+module_exit(ip_vs_pcwrr_cleanup);
+MODULE_LICENSE("GPL");
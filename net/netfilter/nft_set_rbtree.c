@@ -13,16 +13,49 @@
 #include <linux/module.h>
 #include <linux/list.h>
 #include <linux/rbtree.h>
+#include <linux/mm.h>
 #include <linux/netlink.h>
 #include <linux/netfilter.h>
 #include <linux/netfilter/nf_tables.h>
 #include <net/netfilter/nf_tables.h>
 
+/*
+ * Large interval sets (blocklists with many thousands of prefixes) also get
+ * a read-only boundary table for the packet path: the interval boundaries
+ * that are active in the current generation, sorted and packed into a flat
+ * key array, plus a direct index on the bits that follow the prefix common
+ * to all boundaries.  A lookup is then an index load and a binary search
+ * over the handful of boundaries in one bucket, instead of a walk down the
+ * whole tree.
+ *
+ * The tree stays authoritative.  The table is rebuilt from a work item after
+ * the set changed and is only used while its tree sequence count and nft
+ * generation still match, otherwise lookups walk the tree as before.
+ */
+#define NFT_RBTREE_TABLE_MIN	64
+#define NFT_RBTREE_TABLE_BITS	16
+#define NFT_RBTREE_TABLE_DELAY	(HZ / 10)
+
+struct nft_rbtree_table {
+	unsigned int		seq;
+	unsigned int		base_seq;
+	u8			genmask;
+	u8			bits;
+	u16			shift;
+	u32			num;
+	const struct nft_set_ext **ext;	/* NULL for interval ends */
+	u32			*index;
+	u8			*keys;
+};
+
 struct nft_rbtree {
 	struct rb_root		root;
 	rwlock_t		lock;
 	seqcount_t		count;
 	struct delayed_work	gc_work;
+	struct nft_rbtree_table __rcu *table;
+	struct net		*net;
+	struct delayed_work	table_work;
 };
 
 struct nft_rbtree_elem {
@@ -105,13 +138,108 @@ static bool __nft_rbtree_lookup(const struct net *net, const struct nft_set *set
 	return false;
 }
 
+static const u8 *nft_rbtree_table_key(const struct nft_set *set,
+				      const struct nft_rbtree_table *t,
+				      unsigned int i)
+{
+	return t->keys + i * set->klen;
+}
+
+/* Bits [shift, shift + bits) of @key, with bits <= 16 */
+static u32 nft_rbtree_table_bucket(const struct nft_set *set,
+				   const struct nft_rbtree_table *t,
+				   const u8 *key)
+{
+	unsigned int byte = t->shift / 8, i;
+	u32 v = 0;
+
+	for (i = 0; i < 3; i++) {
+		v <<= 8;
+		if (byte + i < set->klen)
+			v |= key[byte + i];
+	}
+
+	return (v >> (24 - t->shift % 8 - t->bits)) & ((1U << t->bits) - 1);
+}
+
+static bool nft_rbtree_table_valid(const struct net *net,
+				   const struct nft_rbtree_table *t,
+				   unsigned int seq)
+{
+	return t->seq == seq &&
+	       t->base_seq == READ_ONCE(net->nft.base_seq) &&
+	       t->genmask == nft_genmask_cur(net);
+}
+
+static bool nft_rbtree_table_lookup(const struct nft_set *set,
+				    const struct nft_rbtree_table *t,
+				    const u8 *key,
+				    const struct nft_set_ext **ext)
+{
+	u32 bucket, lo, hi, mid;
+
+	if (memcmp(key, nft_rbtree_table_key(set, t, 0), set->klen) < 0)
+		return false;
+
+	if (memcmp(key, nft_rbtree_table_key(set, t, t->num - 1),
+		   set->klen) >= 0) {
+		lo = t->num;
+	} else {
+		/* key lies between the first and the last boundary, so it
+		 * shares their common prefix and its bucket is meaningful.
+		 */
+		bucket = nft_rbtree_table_bucket(set, t, key);
+		lo = t->index[bucket];
+		hi = t->index[bucket + 1];
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			if (memcmp(nft_rbtree_table_key(set, t, mid), key,
+				   set->klen) <= 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+	}
+
+	/* lo - 1 is the last boundary <= key */
+	*ext = t->ext[lo - 1];
+	return *ext != NULL;
+}
+
+static void nft_rbtree_table_update(const struct net *net,
+				    const struct nft_set *set)
+{
+	struct nft_rbtree *priv = nft_set_priv(set);
+
+	if (!(set->flags & NFT_SET_INTERVAL))
+		return;
+
+	WRITE_ONCE(priv->net, (struct net *)net);
+	queue_delayed_work(system_power_efficient_wq, &priv->table_work,
+			   NFT_RBTREE_TABLE_DELAY);
+}
+
 static bool nft_rbtree_lookup(const struct net *net, const struct nft_set *set,
 			      const u32 *key, const struct nft_set_ext **ext)
 {
 	struct nft_rbtree *priv = nft_set_priv(set);
 	unsigned int seq = read_seqcount_begin(&priv->count);
+	const struct nft_rbtree_table *t;
 	bool ret;
 
+	t = rcu_dereference_raw(priv->table);
+	if (t) {
+		if (nft_rbtree_table_valid(net, t, seq))
+			return nft_rbtree_table_lookup(set, t,
+						       (const u8 *)key, ext);
+
+		/* stale after a commit that didn't touch this set */
+		if (!delayed_work_pending(&priv->table_work))
+			queue_delayed_work(system_power_efficient_wq,
+					   &priv->table_work,
+					   NFT_RBTREE_TABLE_DELAY);
+	}
+
 	ret = __nft_rbtree_lookup(net, set, key, ext, seq);
 	if (ret || !read_seqcount_retry(&priv->count, seq))
 		return ret;
@@ -264,6 +392,9 @@ static int nft_rbtree_insert(const struct net *net, const struct nft_set *set,
 	write_seqcount_end(&priv->count);
 	write_unlock_bh(&priv->lock);
 
+	if (!err)
+		nft_rbtree_table_update(net, set);
+
 	return err;
 }
 
@@ -279,6 +410,8 @@ static void nft_rbtree_remove(const struct net *net,
 	rb_erase(&rbe->node, &priv->root);
 	write_seqcount_end(&priv->count);
 	write_unlock_bh(&priv->lock);
+
+	nft_rbtree_table_update(net, set);
 }
 
 static void nft_rbtree_activate(const struct net *net,
@@ -289,6 +422,8 @@ static void nft_rbtree_activate(const struct net *net,
 
 	nft_set_elem_change_active(net, set, &rbe->ext);
 	nft_set_elem_clear_busy(&rbe->ext);
+
+	nft_rbtree_table_update(net, set);
 }
 
 static bool nft_rbtree_flush(const struct net *net,
@@ -432,6 +567,165 @@ static void nft_rbtree_gc(struct work_struct *work)
 			   nft_set_gc_interval(set));
 }
 
+static struct nft_rbtree_table *
+nft_rbtree_table_alloc(const struct nft_set *set, unsigned int cap,
+		       unsigned int bits)
+{
+	unsigned int nbuckets = (1U << bits) + 1;
+	struct nft_rbtree_table *t;
+	size_t size;
+
+	size = sizeof(*t) + cap * sizeof(t->ext[0]) +
+	       nbuckets * sizeof(t->index[0]) + cap * set->klen;
+	t = kvzalloc(size, GFP_KERNEL);
+	if (!t)
+		return NULL;
+
+	t->ext = (const struct nft_set_ext **)(t + 1);
+	t->index = (u32 *)(t->ext + cap);
+	t->keys = (u8 *)(t->index + nbuckets);
+	return t;
+}
+
+/* Called with priv->lock held for reading */
+static bool nft_rbtree_table_fill(const struct nft_set *set,
+				  struct nft_rbtree *priv,
+				  struct nft_rbtree_table *t,
+				  unsigned int cap)
+{
+	struct nft_rbtree_elem *rbe;
+	struct rb_node *node;
+	const u8 *key;
+	u32 num = 0;
+
+	/* the tree is ordered from the highest key down */
+	for (node = rb_last(&priv->root); node != NULL; node = rb_prev(node)) {
+		rbe = rb_entry(node, struct nft_rbtree_elem, node);
+
+		if (!nft_set_elem_active(&rbe->ext, t->genmask))
+			continue;
+
+		key = (const u8 *)nft_set_ext_key(&rbe->ext);
+		if (num &&
+		    !memcmp(key, nft_rbtree_table_key(set, t, num - 1),
+			    set->klen)) {
+			/* end of one interval, start of the next one */
+			if (nft_rbtree_interval_start(rbe))
+				t->ext[num - 1] = &rbe->ext;
+			continue;
+		}
+
+		if (num == cap)
+			return false;
+
+		memcpy(t->keys + num * set->klen, key, set->klen);
+		t->ext[num] = nft_rbtree_interval_end(rbe) ? NULL : &rbe->ext;
+		num++;
+	}
+
+	t->num = num;
+	return true;
+}
+
+static void nft_rbtree_table_index(const struct nft_set *set,
+				   struct nft_rbtree_table *t,
+				   unsigned int bits)
+{
+	const u8 *first = nft_rbtree_table_key(set, t, 0);
+	const u8 *last = nft_rbtree_table_key(set, t, t->num - 1);
+	unsigned int i, b, nbuckets;
+
+	for (i = 0; i < set->klen && first[i] == last[i]; i++)
+		;
+	t->shift = i * 8;
+	if (i < set->klen)
+		t->shift += 8 - fls(first[i] ^ last[i]);
+	t->bits = min_t(unsigned int, bits, set->klen * 8 - t->shift);
+
+	/* index[b] is the first boundary whose bucket is >= b */
+	nbuckets = 1U << t->bits;
+	for (i = 0, b = 0; i < t->num; i++) {
+		u32 bucket;
+
+		bucket = nft_rbtree_table_bucket(set, t,
+						 nft_rbtree_table_key(set, t, i));
+		while (b <= bucket)
+			t->index[b++] = i;
+	}
+	while (b <= nbuckets)
+		t->index[b++] = t->num;
+}
+
+static void nft_rbtree_table_build(struct work_struct *work)
+{
+	struct nft_rbtree_table *t = NULL, *old;
+	struct nft_rbtree_elem *rbe;
+	struct nft_rbtree *priv;
+	unsigned int cap, bits;
+	struct rb_node *node;
+	struct nft_set *set;
+	struct net *net;
+	u8 genmask;
+
+	priv = container_of(work, struct nft_rbtree, table_work.work);
+	set  = nft_set_container_of(priv);
+	net  = READ_ONCE(priv->net);
+
+	/* Elements only change generation under the commit mutex.  Don't
+	 * wait for it, set destruction cancels this work with it held.
+	 */
+	if (!mutex_trylock(&net->nft.commit_mutex)) {
+		queue_delayed_work(system_power_efficient_wq,
+				   &priv->table_work, NFT_RBTREE_TABLE_DELAY);
+		return;
+	}
+
+	genmask = nft_genmask_cur(net);
+
+	cap = 0;
+	read_lock_bh(&priv->lock);
+	for (node = rb_first(&priv->root); node != NULL; node = rb_next(node)) {
+		rbe = rb_entry(node, struct nft_rbtree_elem, node);
+		if (nft_set_elem_active(&rbe->ext, genmask))
+			cap++;
+	}
+	read_unlock_bh(&priv->lock);
+
+	if (cap < NFT_RBTREE_TABLE_MIN)
+		goto publish;
+
+	bits = min_t(unsigned int, ilog2(cap), NFT_RBTREE_TABLE_BITS);
+	t = nft_rbtree_table_alloc(set, cap, bits);
+	if (!t)
+		goto publish;
+
+	t->genmask = genmask;
+	t->base_seq = net->nft.base_seq;
+
+	/* gc may have dropped elements meanwhile, nothing else can be added */
+	read_lock_bh(&priv->lock);
+	t->seq = raw_read_seqcount(&priv->count);
+	if (!nft_rbtree_table_fill(set, priv, t, cap) || !t->num) {
+		read_unlock_bh(&priv->lock);
+		kvfree(t);
+		t = NULL;
+		goto publish;
+	}
+	read_unlock_bh(&priv->lock);
+
+	nft_rbtree_table_index(set, t, bits);
+
+publish:
+	mutex_unlock(&net->nft.commit_mutex);
+
+	old = rcu_dereference_protected(priv->table, 1);
+	rcu_assign_pointer(priv->table, t);
+	if (old) {
+		synchronize_rcu();
+		kvfree(old);
+	}
+}
+
 static u64 nft_rbtree_privsize(const struct nlattr * const nla[],
 			       const struct nft_set_desc *desc)
 {
@@ -449,6 +743,7 @@ static int nft_rbtree_init(const struct nft_set *set,
 	priv->root = RB_ROOT;
 
 	INIT_DEFERRABLE_WORK(&priv->gc_work, nft_rbtree_gc);
+	INIT_DELAYED_WORK(&priv->table_work, nft_rbtree_table_build);
 	if (set->flags & NFT_SET_TIMEOUT)
 		queue_delayed_work(system_power_efficient_wq, &priv->gc_work,
 				   nft_set_gc_interval(set));
@@ -463,6 +758,8 @@ static void nft_rbtree_destroy(const struct nft_set *set)
 	struct rb_node *node;
 
 	cancel_delayed_work_sync(&priv->gc_work);
+	cancel_delayed_work_sync(&priv->table_work);
+	kvfree(rcu_dereference_protected(priv->table, 1));
 	rcu_barrier();
 	while ((node = priv->root.rb_node) != NULL) {
 		rb_erase(node, &priv->root);
@@ -11,7 +11,9 @@
 
 #include <linux/kernel.h>
 #include <linux/init.h>
+#include <linux/jhash.h>
 #include <linux/module.h>
+#include <linux/percpu.h>
 #include <linux/rhashtable.h>
 #include <linux/workqueue.h>
 
@@ -72,6 +74,7 @@ struct fl_flow_mask {
 	struct list_head filters;
 	struct rcu_work rwork;
 	struct list_head list;
+	unsigned int seq;
 };
 
 struct fl_flow_tmplt {
@@ -81,11 +84,42 @@ struct fl_flow_tmplt {
 	struct tcf_chain *chain;
 };
 
+/*
+ * Microflow cache: classifying a packet normally dissects it and probes
+ * the hash table once per mask. With many masks, the result is cached per
+ * CPU, keyed by the packet masked with the union of all the masks. Two
+ * packets that agree on every masked bit match the same filter, so a hit
+ * skips the mask scan. Cached results are tagged with head->mcache_gen,
+ * which any filter or mask change bumps.
+ */
+#define FL_MCACHE_SIZE		64
+#define FL_MCACHE_KEY_LEN	192
+#define FL_MCACHE_MIN_MASKS	2
+
+struct fl_mcache {
+	/* union of all masks, only key, range and dissector are used */
+	struct fl_flow_mask mask;
+	/* masks created after this one was built are not covered */
+	unsigned int seq;
+	struct rcu_head rcu;
+};
+
+struct fl_mcache_entry {
+	unsigned int gen;
+	u32 hash;
+	struct cls_fl_filter *f;
+	long key[FL_MCACHE_KEY_LEN / sizeof(long)];
+};
+
 struct cls_fl_head {
 	struct rhashtable ht;
 	struct list_head masks;
 	struct rcu_work rwork;
 	struct idr handle_idr;
+	unsigned int mask_seq;
+	unsigned int mcache_gen;
+	struct fl_mcache __rcu *mcache;
+	struct fl_mcache_entry __percpu *mcache_entries;
 };
 
 struct cls_fl_filter {
@@ -186,36 +220,112 @@ static struct cls_fl_filter *fl_lookup(struct fl_flow_mask *mask,
 				      mask->filter_ht_params);
 }
 
-static int fl_classify(struct sk_buff *skb, const struct tcf_proto *tp,
-		       struct tcf_result *res)
+static void fl_dissect(struct sk_buff *skb, struct fl_flow_mask *mask,
+		       struct fl_flow_key *skb_key)
+{
+	flow_dissector_init_keys(&skb_key->control, &skb_key->basic);
+	fl_clear_masked_range(skb_key, mask);
+
+	skb_key->indev_ifindex = skb->skb_iif;
+	/* skb_flow_dissect() does not set n_proto in case an unknown
+	 * protocol, so do it rather here.
+	 */
+	skb_key->basic.n_proto = skb_protocol(skb, false);
+	skb_flow_dissect_tunnel_info(skb, &mask->dissector, skb_key);
+	skb_flow_dissect(skb, &mask->dissector, skb_key, 0);
+}
+
+static noinline_for_stack struct cls_fl_filter *
+fl_classify_masks(struct sk_buff *skb, struct cls_fl_head *head)
 {
-	struct cls_fl_head *head = rcu_dereference_bh(tp->root);
 	struct cls_fl_filter *f;
 	struct fl_flow_mask *mask;
 	struct fl_flow_key skb_key;
 	struct fl_flow_key skb_mkey;
 
 	list_for_each_entry_rcu(mask, &head->masks, list) {
-		flow_dissector_init_keys(&skb_key.control, &skb_key.basic);
-		fl_clear_masked_range(&skb_key, mask);
-
-		skb_key.indev_ifindex = skb->skb_iif;
-		/* skb_flow_dissect() does not set n_proto in case an unknown
-		 * protocol, so do it rather here.
-		 */
-		skb_key.basic.n_proto = skb_protocol(skb, false);
-		skb_flow_dissect_tunnel_info(skb, &mask->dissector, &skb_key);
-		skb_flow_dissect(skb, &mask->dissector, &skb_key, 0);
-
+		fl_dissect(skb, mask, &skb_key);
 		fl_set_masked_key(&skb_mkey, &skb_key, mask);
 
 		f = fl_lookup(mask, &skb_mkey);
-		if (f && !tc_skip_sw(f->flags)) {
-			*res = f->res;
-			return tcf_exts_exec(skb, &f->exts, res);
+		if (f && !tc_skip_sw(f->flags))
+			return f;
+	}
+	return NULL;
+}
+
+/*
+ * Returns the matching filter or NULL, or ERR_PTR(-EAGAIN) when a mask
+ * newer than @mc is met and the packet has to take the slow path.
+ */
+static noinline_for_stack struct cls_fl_filter *
+fl_mcache_classify(struct sk_buff *skb, struct cls_fl_head *head,
+		   struct fl_mcache *mc)
+{
+	struct fl_flow_mask *umask = &mc->mask;
+	struct fl_mcache_entry *e;
+	struct cls_fl_filter *f = NULL;
+	struct fl_flow_mask *mask;
+	struct fl_flow_key skb_key;
+	struct fl_flow_key skb_mkey;
+	unsigned int gen;
+	void *key;
+	u32 hash;
+
+	gen = READ_ONCE(head->mcache_gen);
+	/* Pairs with smp_wmb() in fl_mcache_invalidate() */
+	smp_rmb();
+
+	/* The union dissector fills in the fields of every mask at once */
+	fl_dissect(skb, umask, &skb_key);
+	fl_set_masked_key(&skb_mkey, &skb_key, umask);
+	key = fl_key_get_start(&skb_mkey, umask);
+	hash = jhash2(key, fl_mask_range(umask) / sizeof(u32), 0);
+
+	e = this_cpu_ptr(head->mcache_entries) + (hash & (FL_MCACHE_SIZE - 1));
+	if (e->gen == gen && e->hash == hash &&
+	    !memcmp(e->key, key, fl_mask_range(umask)))
+		return e->f;
+
+	e->gen = 0;
+	e->hash = hash;
+	memcpy(e->key, key, fl_mask_range(umask));
+
+	list_for_each_entry_rcu(mask, &head->masks, list) {
+		struct cls_fl_filter *mf;
+
+		if (unlikely(mask->seq > mc->seq))
+			return ERR_PTR(-EAGAIN);
+
+		fl_set_masked_key(&skb_mkey, &skb_key, mask);
+		mf = fl_lookup(mask, &skb_mkey);
+		if (mf && !tc_skip_sw(mf->flags)) {
+			f = mf;
+			break;
 		}
 	}
-	return -1;
+
+	e->f = f;
+	e->gen = gen;
+	return f;
+}
+
+static int fl_classify(struct sk_buff *skb, const struct tcf_proto *tp,
+		       struct tcf_result *res)
+{
+	struct cls_fl_head *head = rcu_dereference_bh(tp->root);
+	struct fl_mcache *mc = rcu_dereference_bh(head->mcache);
+	struct cls_fl_filter *f = ERR_PTR(-EAGAIN);
+
+	if (mc)
+		f = fl_mcache_classify(skb, head, mc);
+	if (IS_ERR(f))
+		f = fl_classify_masks(skb, head);
+	if (!f)
+		return -1;
+
+	*res = f->res;
+	return tcf_exts_exec(skb, &f->exts, res);
 }
 
 static int fl_init(struct tcf_proto *tp)
@@ -227,6 +337,8 @@ static int fl_init(struct tcf_proto *tp)
 		return -ENOBUFS;
 
 	INIT_LIST_HEAD_RCU(&head->masks);
+	/* 0 marks unused microflow cache entries */
+	head->mcache_gen = 1;
 	rcu_assign_pointer(tp->root, head);
 	idr_init(&head->handle_idr);
 
@@ -247,6 +359,17 @@ static void fl_mask_free_work(struct work_struct *work)
 	fl_mask_free(mask);
 }
 
+static void fl_mcache_invalidate(struct cls_fl_head *head)
+{
+	unsigned int gen = head->mcache_gen + 1;
+
+	/* Make the change visible before the cached results go stale */
+	smp_wmb();
+	WRITE_ONCE(head->mcache_gen, gen ? : 1);
+}
+
+static void fl_mcache_rebuild(struct cls_fl_head *head);
+
 static bool fl_mask_put(struct cls_fl_head *head, struct fl_flow_mask *mask,
 			bool async)
 {
@@ -255,6 +378,7 @@ static bool fl_mask_put(struct cls_fl_head *head, struct fl_flow_mask *mask,
 
 	rhashtable_remove_fast(&head->ht, &mask->ht_node, mask_ht_params);
 	list_del_rcu(&mask->list);
+	fl_mcache_rebuild(head);
 	if (async)
 		tcf_queue_work(&mask->rwork, fl_mask_free_work);
 	else
@@ -353,6 +477,7 @@ static bool __fl_delete(struct tcf_proto *tp, struct cls_fl_filter *f,
 
 	idr_remove(&head->handle_idr, f->handle);
 	list_del_rcu(&f->list);
+	fl_mcache_invalidate(head);
 	last = fl_mask_put(head, f->mask, async);
 	if (!tc_skip_hw(f->flags))
 		fl_hw_destroy_filter(tp, f, extack);
@@ -372,6 +497,8 @@ static void fl_destroy_sleepable(struct work_struct *work)
 						rwork);
 
 	rhashtable_destroy(&head->ht);
+	kfree(rcu_dereference_protected(head->mcache, 1));
+	free_percpu(head->mcache_entries);
 	kfree(head);
 	module_put(THIS_MODULE);
 }
@@ -1079,6 +1206,67 @@ static void fl_init_dissector(struct flow_dissector *dissector,
 	skb_flow_dissector_init(dissector, keys, cnt);
 }
 
+static struct fl_mcache *fl_mcache_build(struct cls_fl_head *head)
+{
+	struct fl_flow_mask *mask;
+	struct fl_mcache *mc;
+	long *umask;
+	int i;
+
+	if (!head->mcache_entries) {
+		head->mcache_entries =
+			__alloc_percpu(sizeof(struct fl_mcache_entry) *
+				       FL_MCACHE_SIZE,
+				       __alignof__(struct fl_mcache_entry));
+		if (!head->mcache_entries)
+			return NULL;
+	}
+
+	mc = kzalloc(sizeof(*mc), GFP_KERNEL);
+	if (!mc)
+		return NULL;
+
+	umask = (long *)&mc->mask.key;
+	list_for_each_entry(mask, &head->masks, list) {
+		const long *lmask = (const long *)&mask->key;
+
+		for (i = 0; i < sizeof(mask->key) / sizeof(long); i++)
+			umask[i] |= lmask[i];
+	}
+
+	fl_mask_update_range(&mc->mask);
+	if (fl_mask_range(&mc->mask) > FL_MCACHE_KEY_LEN) {
+		kfree(mc);
+		return NULL;
+	}
+
+	fl_init_dissector(&mc->mask.dissector, &mc->mask.key);
+	mc->seq = head->mask_seq;
+
+	return mc;
+}
+
+/* Called under RTNL whenever a mask is added or removed */
+static void fl_mcache_rebuild(struct cls_fl_head *head)
+{
+	struct fl_mcache *old = rtnl_dereference(head->mcache);
+	struct fl_mcache *mc = NULL;
+	struct fl_flow_mask *mask;
+	unsigned int nmasks = 0;
+
+	list_for_each_entry(mask, &head->masks, list)
+		nmasks++;
+
+	/* Left disabled if the union of the masks is too wide to cache */
+	if (nmasks >= FL_MCACHE_MIN_MASKS)
+		mc = fl_mcache_build(head);
+
+	rcu_assign_pointer(head->mcache, mc);
+	fl_mcache_invalidate(head);
+	if (old)
+		kfree_rcu(old, rcu);
+}
+
 static struct fl_flow_mask *fl_create_new_mask(struct cls_fl_head *head,
 					       struct fl_flow_mask *mask)
 {
@@ -1104,7 +1292,9 @@ static struct fl_flow_mask *fl_create_new_mask(struct cls_fl_head *head,
 	if (err)
 		goto errout_destroy;
 
+	newmask->seq = ++head->mask_seq;
 	list_add_tail_rcu(&newmask->list, &head->masks);
+	fl_mcache_rebuild(head);
 
 	return newmask;
 
@@ -1290,6 +1480,7 @@ static int fl_change(struct net *net, struct sk_buff *in_skb,
 	} else {
 		list_add_tail_rcu(&fnew->list, &fnew->mask->filters);
 	}
+	fl_mcache_invalidate(head);
 
 	kfree(tb);
 	kfree(mask);
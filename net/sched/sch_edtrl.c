@@ -0,0 +1,373 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * net/sched/sch_edtrl.c  Lockless EDT based aggregate rate limiter.
+ *
+ * Copyright (C) 2021 Huawei Technologies Co., Ltd
+ */
+
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/percpu.h>
+#include <linux/skbuff.h>
+#include <linux/skb_array.h>
+#include <linux/slab.h>
+#include <net/netlink.h>
+#include <net/pkt_sched.h>
+#include <net/sch_generic.h>
+
+/*	EDT rate limiter
+ *	================
+ *
+ * A root qdisc for multiqueue devices that need one aggregate rate for all
+ * their TX queues. tbf or htb at the root serialize every transmitting CPU
+ * on the root lock, this one is TCQ_F_NOLOCK like pfifo_fast: packets are
+ * queued on a single skb_array and the enqueue path takes no qdisc lock.
+ *
+ * Each packet is given an earliest departure time at enqueue. The CPUs do
+ * not share a token bucket. Instead each one reserves a slice of the global
+ * transmit timeline (q->horizon) worth 'quantum' bytes with one cmpxchg,
+ * then stamps its packets from that slice without touching shared state.
+ * After an idle period the timeline may restart up to 'burst' bytes in the
+ * past. Time left in a slice when a CPU reserves a new one is lost, so the
+ * aggregate rate undershoots rather than overshoots.
+ *
+ * Dequeue holds the head of the queue until its departure time and arms a
+ * watchdog. Slices of different CPUs interleave, so a packet may wait up to
+ * one quantum behind a packet queued before it by another CPU.
+ */
+
+struct edtrl_skb_cb {
+	u64	time_to_send;
+};
+
+static inline struct edtrl_skb_cb *edtrl_skb_cb(struct sk_buff *skb)
+{
+	qdisc_cb_private_validate(skb, sizeof(struct edtrl_skb_cb));
+	return (struct edtrl_skb_cb *)qdisc_skb_cb(skb)->data;
+}
+
+/* Replaced as a whole on change, enqueue reads it under rcu_read_lock_bh() */
+struct edtrl_params {
+	struct psched_ratecfg	rate;
+	u32			burst;
+	u32			quantum;
+	u64			burst_ns;
+	u64			quantum_ns;
+	struct rcu_head		rcu;
+};
+
+struct edtrl_slice {
+	u64	next;		/* departure time of the next packet */
+	u64	end;		/* end of the reserved slice */
+	u64	refills;
+};
+
+struct edtrl_sched_data {
+	struct skb_array		ring;
+	struct edtrl_params __rcu	*params;
+	struct edtrl_slice __percpu	*slices;
+	u32				limit;
+
+	struct qdisc_watchdog		watchdog;
+	u64				throttled;
+
+	atomic64_t			horizon ____cacheline_aligned_in_smp;
+};
+
+static u64 edtrl_departure(struct edtrl_sched_data *q, unsigned int len,
+			   u64 now)
+{
+	struct edtrl_params *p = rcu_dereference_bh(q->params);
+	struct edtrl_slice *s = this_cpu_ptr(q->slices);
+	u64 delay = psched_l2t_ns(&p->rate, len);
+	u64 time_to_send;
+
+	/*
+	 * A slice that ended in the past is not reused: the timeline has
+	 * moved on and spending it would exceed the rate.
+	 */
+	if (s->next + delay > s->end || s->end < now) {
+		u64 span = max(p->quantum_ns, delay);
+		u64 floor = now > p->burst_ns ? now - p->burst_ns : 0;
+		s64 old = atomic64_read(&q->horizon);
+		u64 start;
+
+		do {
+			start = max_t(u64, old, floor);
+		} while (!atomic64_try_cmpxchg(&q->horizon, &old,
+					       start + span));
+
+		s->next = start;
+		s->end = start + span;
+		s->refills++;
+	}
+
+	time_to_send = s->next;
+	s->next += delay;
+
+	return time_to_send;
+}
+
+static int edtrl_enqueue(struct sk_buff *skb, struct Qdisc *sch,
+			 struct sk_buff **to_free)
+{
+	struct edtrl_sched_data *q = qdisc_priv(sch);
+	unsigned int pkt_len = qdisc_pkt_len(skb);
+
+	edtrl_skb_cb(skb)->time_to_send = edtrl_departure(q, pkt_len,
+							  ktime_get_ns());
+
+	if (unlikely(skb_array_produce(&q->ring, skb)))
+		return qdisc_drop_cpu(skb, sch, to_free);
+
+	qdisc_qstats_atomic_qlen_inc(sch);
+	/* skb can not be used after skb_array_produce() */
+	this_cpu_add(sch->cpu_qstats->backlog, pkt_len);
+	return NET_XMIT_SUCCESS;
+}
+
+/* Dequeue is serialized by qdisc_run_begin() */
+static struct sk_buff *edtrl_dequeue(struct Qdisc *sch)
+{
+	struct edtrl_sched_data *q = qdisc_priv(sch);
+	struct sk_buff *skb;
+	u64 time_to_send;
+
+	skb = __skb_array_peek(&q->ring);
+	if (!skb)
+		return NULL;
+
+	time_to_send = edtrl_skb_cb(skb)->time_to_send;
+	if (time_to_send > ktime_get_ns()) {
+		q->throttled++;
+		qdisc_watchdog_schedule_ns(&q->watchdog, time_to_send);
+		return NULL;
+	}
+
+	skb = __skb_array_consume(&q->ring);
+	qdisc_qstats_cpu_backlog_dec(sch, skb);
+	qdisc_bstats_cpu_update(sch, skb);
+	qdisc_qstats_atomic_qlen_dec(sch);
+
+	return skb;
+}
+
+static struct sk_buff *edtrl_peek(struct Qdisc *sch)
+{
+	struct edtrl_sched_data *q = qdisc_priv(sch);
+
+	return __skb_array_peek(&q->ring);
+}
+
+static void edtrl_reset(struct Qdisc *sch)
+{
+	struct edtrl_sched_data *q = qdisc_priv(sch);
+	struct sk_buff *skb;
+	int cpu;
+
+	/* NULL ring is possible if init failed before skb_array_init() */
+	if (q->ring.ring.queue) {
+		while ((skb = __skb_array_consume(&q->ring)) != NULL)
+			kfree_skb(skb);
+	}
+
+	for_each_possible_cpu(cpu)
+		per_cpu_ptr(sch->cpu_qstats, cpu)->backlog = 0;
+
+	qdisc_watchdog_cancel(&q->watchdog);
+}
+
+static const struct nla_policy edtrl_policy[TCA_EDTRL_MAX + 1] = {
+	[TCA_EDTRL_RATE64]	= { .type = NLA_U64 },
+	[TCA_EDTRL_BURST]	= { .type = NLA_U32 },
+	[TCA_EDTRL_QUANTUM]	= { .type = NLA_U32 },
+	[TCA_EDTRL_LIMIT]	= { .type = NLA_U32 },
+};
+
+static int edtrl_change(struct Qdisc *sch, struct nlattr *opt,
+			struct netlink_ext_ack *extack)
+{
+	struct edtrl_sched_data *q = qdisc_priv(sch);
+	struct nlattr *tb[TCA_EDTRL_MAX + 1];
+	struct edtrl_params *p, *old;
+	struct tc_ratespec conf = { .linklayer = TC_LINKLAYER_ETHERNET };
+	u64 rate64;
+	int err;
+
+	if (!opt)
+		return -EINVAL;
+
+	err = nla_parse_nested(tb, TCA_EDTRL_MAX, opt, edtrl_policy, extack);
+	if (err < 0)
+		return err;
+
+	old = rtnl_dereference(q->params);
+	if (!old && !tb[TCA_EDTRL_RATE64]) {
+		NL_SET_ERR_MSG(extack, "Rate must be specified");
+		return -EINVAL;
+	}
+
+	p = kzalloc(sizeof(*p), GFP_KERNEL);
+	if (!p)
+		return -ENOMEM;
+
+	if (old) {
+		rate64 = old->rate.rate_bytes_ps;
+		p->burst = old->burst;
+		p->quantum = old->quantum;
+	} else {
+		rate64 = 0;
+		p->quantum = 16 * psched_mtu(qdisc_dev(sch));
+		p->burst = p->quantum;
+	}
+
+	if (tb[TCA_EDTRL_RATE64])
+		rate64 = nla_get_u64(tb[TCA_EDTRL_RATE64]);
+	if (tb[TCA_EDTRL_BURST])
+		p->burst = nla_get_u32(tb[TCA_EDTRL_BURST]);
+	if (tb[TCA_EDTRL_QUANTUM])
+		p->quantum = nla_get_u32(tb[TCA_EDTRL_QUANTUM]);
+
+	if (!rate64 || !p->quantum) {
+		NL_SET_ERR_MSG(extack, "Rate and quantum must be positive");
+		err = -EINVAL;
+		goto free_params;
+	}
+
+	if (tb[TCA_EDTRL_LIMIT]) {
+		u32 limit = nla_get_u32(tb[TCA_EDTRL_LIMIT]);
+
+		if (!limit) {
+			err = -EINVAL;
+			goto free_params;
+		}
+
+		err = skb_array_resize(&q->ring, limit, GFP_KERNEL);
+		if (err)
+			goto free_params;
+		q->limit = limit;
+	}
+
+	psched_ratecfg_precompute(&p->rate, &conf, rate64);
+	p->burst_ns = psched_l2t_ns(&p->rate, p->burst);
+	p->quantum_ns = psched_l2t_ns(&p->rate, p->quantum);
+
+	rcu_assign_pointer(q->params, p);
+	if (old)
+		kfree_rcu(old, rcu);
+
+	return 0;
+
+free_params:
+	kfree(p);
+	return err;
+}
+
+static int edtrl_init(struct Qdisc *sch, struct nlattr *opt,
+		      struct netlink_ext_ack *extack)
+{
+	struct edtrl_sched_data *q = qdisc_priv(sch);
+	int err;
+
+	qdisc_watchdog_init(&q->watchdog, sch);
+
+	q->limit = qdisc_dev(sch)->tx_queue_len;
+	/* guard against zero length rings */
+	if (!q->limit)
+		q->limit = 1;
+
+	err = skb_array_init(&q->ring, q->limit, GFP_KERNEL);
+	if (err)
+		return err;
+
+	q->slices = alloc_percpu(struct edtrl_slice);
+	if (!q->slices)
+		return -ENOMEM;
+
+	atomic64_set(&q->horizon, 0);
+
+	return edtrl_change(sch, opt, extack);
+}
+
+static void edtrl_destroy(struct Qdisc *sch)
+{
+	struct edtrl_sched_data *q = qdisc_priv(sch);
+
+	qdisc_watchdog_cancel(&q->watchdog);
+	/* skbs were freed by edtrl_reset() already */
+	if (q->ring.ring.queue)
+		ptr_ring_cleanup(&q->ring.ring, NULL);
+	free_percpu(q->slices);
+	kfree(rcu_dereference_protected(q->params, true));
+}
+
+static int edtrl_dump(struct Qdisc *sch, struct sk_buff *skb)
+{
+	struct edtrl_sched_data *q = qdisc_priv(sch);
+	struct edtrl_params *p = rtnl_dereference(q->params);
+	struct nlattr *opts;
+
+	opts = nla_nest_start(skb, TCA_OPTIONS);
+	if (!opts)
+		goto nla_put_failure;
+
+	if (nla_put_u64_64bit(skb, TCA_EDTRL_RATE64, p->rate.rate_bytes_ps,
+			      TCA_EDTRL_PAD) ||
+	    nla_put_u32(skb, TCA_EDTRL_BURST, p->burst) ||
+	    nla_put_u32(skb, TCA_EDTRL_QUANTUM, p->quantum) ||
+	    nla_put_u32(skb, TCA_EDTRL_LIMIT, q->limit))
+		goto nla_put_failure;
+
+	return nla_nest_end(skb, opts);
+
+nla_put_failure:
+	nla_nest_cancel(skb, opts);
+	return -1;
+}
+
+static int edtrl_dump_stats(struct Qdisc *sch, struct gnet_dump *d)
+{
+	struct edtrl_sched_data *q = qdisc_priv(sch);
+	struct tc_edtrl_xstats st = {
+		.throttled	= q->throttled,
+	};
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		st.refills += per_cpu_ptr(q->slices, cpu)->refills;
+
+	return gnet_stats_copy_app(d, &st, sizeof(st));
+}
+
+static struct Qdisc_ops edtrl_qdisc_ops __read_mostly = {
+	.id		=	"edtrl",
+	.priv_size	=	sizeof(struct edtrl_sched_data),
+	.enqueue	=	edtrl_enqueue,
+	.dequeue	=	edtrl_dequeue,
+	.peek		=	edtrl_peek,
+	.init		=	edtrl_init,
+	.reset		=	edtrl_reset,
+	.destroy	=	edtrl_destroy,
+	.change		=	edtrl_change,
+	.dump		=	edtrl_dump,
+	.dump_stats	=	edtrl_dump_stats,
+	.owner		=	THIS_MODULE,
+	.static_flags	=	TCQ_F_NOLOCK | TCQ_F_CPUSTATS,
+};
+
+static int __init edtrl_module_init(void)
+{
+	return register_qdisc(&edtrl_qdisc_ops);
+}
+
+static void __exit edtrl_module_exit(void)
+{
+	unregister_qdisc(&edtrl_qdisc_ops);
+}
+
+module_init(edtrl_module_init);
+module_exit(edtrl_module_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Lockless EDT based aggregate rate limiter");
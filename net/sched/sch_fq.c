@@ -21,6 +21,11 @@
  *  Transport (eg TCP) can set in sk->sk_pacing_rate a rate, enqueue a
  *  bunch of packets, and this packet scheduler adds delay between
  *  packets to respect rate limitation.
+ *  Or transport can compute the departure time of each packet itself
+ *  (Earliest Departure Time model) and store it in skb->tstamp, in
+ *  CLOCK_MONOTONIC base; we then only hold the packet until that time.
+ *  Either way, throttled flows sit in one time ordered rb tree and a
+ *  single qdisc watchdog serves them all.
  *
  *  enqueue() :
  *   - lookup one RB tree (out of 1024 or more) to find the flow.
@@ -457,6 +462,15 @@ static void fq_check_throttled(struct fq_sched_data *q, u64 now)
 	}
 }
 
+/* Departure time requested by the sending socket, if any. Only trust
+ * skb->tstamp on locally generated packets : on forwarded ones it can be
+ * a receive timestamp in another clock base.
+ */
+static u64 fq_skb_edt(const struct sk_buff *skb)
+{
+	return skb->sk ? ktime_to_ns(skb->tstamp) : 0;
+}
+
 static struct sk_buff *fq_dequeue(struct Qdisc *sch)
 {
 	struct fq_sched_data *q = qdisc_priv(sch);
@@ -491,11 +505,16 @@ static struct sk_buff *fq_dequeue(struct Qdisc *sch)
 	}
 
 	skb = f->head;
-	if (unlikely(skb && now < f->time_next_packet &&
-		     !skb_is_tcp_pure_ack(skb))) {
-		head->first = f->next;
-		fq_flow_set_throttled(q, f);
-		goto begin;
+	if (skb && !skb_is_tcp_pure_ack(skb)) {
+		u64 time_next_packet = max_t(u64, fq_skb_edt(skb),
+					     f->time_next_packet);
+
+		if (now < time_next_packet) {
+			head->first = f->next;
+			f->time_next_packet = time_next_packet;
+			fq_flow_set_throttled(q, f);
+			goto begin;
+		}
 	}
 
 	skb = fq_dequeue_head(sch, f);
@@ -521,16 +540,23 @@ static struct sk_buff *fq_dequeue(struct Qdisc *sch)
 		goto out;
 
 	rate = q->flow_max_rate;
-	if (skb->sk)
-		rate = min(skb->sk->sk_pacing_rate, rate);
+	plen = qdisc_pkt_len(skb);
 
-	if (rate <= q->low_rate_threshold) {
-		f->credit = 0;
-		plen = qdisc_pkt_len(skb);
-	} else {
-		plen = max(qdisc_pkt_len(skb), q->quantum);
-		if (f->credit > 0)
-			goto out;
+	/* If EDT time was provided for this skb, the socket already paced
+	 * it; we only need to update f->time_next_packet if this qdisc
+	 * enforces a flow max rate.
+	 */
+	if (!fq_skb_edt(skb)) {
+		if (skb->sk)
+			rate = min(skb->sk->sk_pacing_rate, rate);
+
+		if (rate <= q->low_rate_threshold) {
+			f->credit = 0;
+		} else {
+			plen = max(plen, q->quantum);
+			if (f->credit > 0)
+				goto out;
+		}
 	}
 	if (rate != ~0U) {
 		u64 len = (u64)plen * NSEC_PER_SEC;
@@ -182,6 +182,7 @@ void svc_xprt_init(struct net *net, struct svc_xprt_class *xcl,
 	set_bit(XPT_BUSY, &xprt->xpt_flags);
 	rpc_init_wait_queue(&xprt->xpt_bc_pending, "xpt_bc_pending");
 	xprt->xpt_net = get_net(net);
+	xprt->xpt_rx_cpu = -1;
 	strcpy(xprt->xpt_remotebuf, "uninitialized");
 }
 EXPORT_SYMBOL_GPL(svc_xprt_init);
@@ -393,7 +394,7 @@ void svc_xprt_do_enqueue(struct svc_xprt *xprt)
 {
 	struct svc_pool *pool;
 	struct svc_rqst	*rqstp = NULL;
-	int cpu;
+	int cpu, rx_cpu;
 
 	if (!svc_xprt_has_something_to_do(xprt))
 		return;
@@ -406,8 +407,15 @@ void svc_xprt_do_enqueue(struct svc_xprt *xprt)
 	if (test_and_set_bit(XPT_BUSY, &xprt->xpt_flags))
 		return;
 
+	/*
+	 * Queue the transport to the pool of the cpu its data arrived on
+	 * rather than of whoever enqueues it, which is often a server
+	 * thread that has just finished with it.  With per-node pools
+	 * this keeps the request on the node where its pages are.
+	 */
 	cpu = get_cpu();
-	pool = svc_pool_for_cpu(xprt->xpt_server, cpu);
+	rx_cpu = READ_ONCE(xprt->xpt_rx_cpu);
+	pool = svc_pool_for_cpu(xprt->xpt_server, rx_cpu >= 0 ? rx_cpu : cpu);
 
 	atomic_long_inc(&pool->sp_stats.packets);
 
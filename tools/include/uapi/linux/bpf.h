@@ -127,6 +127,14 @@ enum bpf_map_type {
 	BPF_MAP_TYPE_SOCKHASH,
 	BPF_MAP_TYPE_CGROUP_STORAGE,
 	BPF_MAP_TYPE_REUSEPORT_SOCKARRAY,
+	/* Map types specific to this kernel are numbered from
+	 * __BPF_MAP_TYPE_VENDOR_BASE, clear of the upstream range, so that
+	 * tools built against upstream headers never confuse them with an
+	 * upstream map type.
+	 */
+	__BPF_MAP_TYPE_VENDOR_BASE = 64,
+	BPF_MAP_TYPE_RINGBUF = __BPF_MAP_TYPE_VENDOR_BASE,	/* 64 */
+	BPF_MAP_TYPE_RHASH = __BPF_MAP_TYPE_VENDOR_BASE + 1,	/* 65 */
 };
 
 enum bpf_prog_type {
@@ -2677,6 +2685,33 @@ union bpf_attr {
  * 	Return
  * 		On success, the strictly positive length of the string,	including
  * 		the trailing NUL character. On error, a negative value.
+ *
+ * int bpf_ringbuf_output(void *ringbuf, void *data, u64 size, u64 flags)
+ * 	Description
+ * 		Copy *size* bytes from *data* into a ring buffer *ringbuf*.
+ * 		If **BPF_RB_NO_WAKEUP** is specified in *flags*, no notification
+ * 		of new data availability is sent.
+ * 		If **BPF_RB_FORCE_WAKEUP** is specified in *flags*, notification
+ * 		of new data availability is sent unconditionally.
+ * 	Return
+ * 		0 on success, or a negative error in case of failure.
+ *
+ * u64 bpf_ringbuf_query(void *ringbuf, u64 flags)
+ * 	Description
+ * 		Query various characteristics of provided ring buffer. What
+ * 		exactly is queries is determined by *flags*:
+ *
+ * 		* **BPF_RB_AVAIL_DATA**: Amount of data not yet consumed.
+ * 		* **BPF_RB_RING_SIZE**: The size of ring buffer.
+ * 		* **BPF_RB_CONS_POS**: Consumer position (can wrap around).
+ * 		* **BPF_RB_PROD_POS**: Producer(s) position (can wrap around).
+ *
+ * 		Data returned is just a momentary snapshot of actual values
+ * 		and could be inaccurate, so this facility should be used to
+ * 		power heuristics and for reporting, not to make 100% correct
+ * 		calculation.
+ * 	Return
+ * 		Requested value, or 0, if *flags* are not recognized.
  */
 #define __BPF_FUNC_MAPPER(FN)		\
 	FN(unspec),			\
@@ -2797,6 +2832,15 @@ union bpf_attr {
 	FN(probe_read_kernel_str),
 	/* For BPF prog consistency, Don't add it casually */
 
+/* Helpers specific to this kernel are numbered from __BPF_FUNC_VENDOR_BASE,
+ * clear of the upstream range, so that programs built against upstream
+ * headers never call one of them by mistake, nor the other way around.
+ * Add them here, never to __BPF_FUNC_MAPPER.
+ */
+#define __BPF_VENDOR_FUNC_MAPPER(FN)	\
+	FN(ringbuf_output),		\
+	FN(ringbuf_query),
+
 /* integer value in 'imm' field of BPF_CALL instruction selects which helper
  * function eBPF program intends to call
  */
@@ -2804,6 +2848,9 @@ union bpf_attr {
 enum bpf_func_id {
 	__BPF_FUNC_MAPPER(__BPF_ENUM_FN)
 	__BPF_FUNC_MAX_ID,
+	__BPF_FUNC_VENDOR_BASE = 0x10000,
+	__BPF_VENDOR_FUNC_MAPPER(__BPF_ENUM_FN)
+	__BPF_VENDOR_FUNC_MAX_ID,
 };
 #undef __BPF_ENUM_FN
 
@@ -2851,6 +2898,21 @@ enum bpf_func_id {
 /* BPF_FUNC_perf_event_output for sk_buff input context. */
 #define BPF_F_CTXLEN_MASK		(0xfffffULL << 32)
 
+/* BPF_FUNC_ringbuf_output flags. */
+#define BPF_RB_NO_WAKEUP		(1ULL << 0)
+#define BPF_RB_FORCE_WAKEUP		(1ULL << 1)
+
+/* BPF_FUNC_ringbuf_query flags. */
+#define BPF_RB_AVAIL_DATA		0
+#define BPF_RB_RING_SIZE		1
+#define BPF_RB_CONS_POS			2
+#define BPF_RB_PROD_POS			3
+
+/* BPF ring buffer record header: u32 len, u32 page offset. */
+#define BPF_RINGBUF_BUSY_BIT		(1U << 31)
+#define BPF_RINGBUF_DISCARD_BIT		(1U << 30)
+#define BPF_RINGBUF_HDR_SZ		8
+
 /* Mode for BPF_FUNC_skb_adjust_room helper. */
 enum bpf_adj_room_mode {
 	BPF_ADJ_ROOM_NET,
@@ -768,7 +768,8 @@ static void update_vcpu_stat_time(struct kvm_vcpu_stat *vcpu_stat)
  */
 int kvm_arch_vcpu_ioctl_run(struct kvm_vcpu *vcpu, struct kvm_run *run)
 {
-	int ret;
+	int ret, exit_ret;
+	u64 exit_ns;
 
 	if (unlikely(!kvm_vcpu_initialized(vcpu)))
 		return -ENOEXEC;
@@ -933,12 +934,20 @@ int kvm_arch_vcpu_ioctl_run(struct kvm_vcpu *vcpu, struct kvm_run *run)
 		guest_exit();
 		trace_kvm_exit(ret, kvm_vcpu_trap_get_class(vcpu), *vcpu_pc(vcpu));
 
+		/* Only timed for kvm_exit_handled, e.g. hist triggers on it */
+		exit_ret = ret;
+		exit_ns = trace_kvm_exit_handled_enabled() ? ktime_get_ns() : 0;
+
 		/* Exit types that need handling before we can be preempted */
 		handle_exit_early(vcpu, run, ret);
 
 		preempt_enable();
 
 		ret = handle_exit(vcpu, run, ret);
+		if (exit_ns)
+			trace_kvm_exit_handled(exit_ret,
+					       kvm_vcpu_trap_get_class(vcpu),
+					       ktime_get_ns() - exit_ns);
 		update_vcpu_stat_time(&vcpu->stat);
 	}
 
@@ -60,6 +60,9 @@ int kvm_hvc_call_handler(struct kvm_vcpu *vcpu)
 		vcpu->arch.pvsched.base = GPA_INVALID;
 		val = SMCCC_RET_SUCCESS;
 		break;
+	case ARM_SMCCC_HV_PV_SCHED_YIELD:
+		val = kvm_hypercall_pvsched_yield(vcpu);
+		break;
 	default:
 		return kvm_psci_call(vcpu);
 	}
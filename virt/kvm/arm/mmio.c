@@ -169,6 +169,20 @@ int io_mem_abort(struct kvm_vcpu *vcpu, struct kvm_run *run,
 	int len;
 	u8 data_buf[8];
 
+	/*
+	 * Doorbell writes to an ioeventfd that matches any length (virtio
+	 * kicks) need neither the data nor the full MMIO bus: signal it
+	 * right away and resume the guest.
+	 */
+	if (kvm_vcpu_dabt_isvalid(vcpu) && kvm_vcpu_dabt_iswrite(vcpu) &&
+	    !kvm_vcpu_dabt_iss1tw(vcpu) &&
+	    !kvm_io_bus_write(vcpu, KVM_FAST_MMIO_BUS, fault_ipa, 0, NULL)) {
+		trace_kvm_fast_mmio(fault_ipa);
+		vcpu->stat.mmio_exit_kernel++;
+		kvm_skip_instr(vcpu, kvm_vcpu_trap_il_is32bit(vcpu));
+		return 1;
+	}
+
 	/*
 	 * Prepare MMIO operation. First decode the syndrome data we get
 	 * from the CPU. Then try if some in-kernel emulation feels
@@ -1460,7 +1460,7 @@ static void stage2_wp_ptes(pmd_t *pmd, phys_addr_t addr, phys_addr_t end)
 	do {
 		if (!pte_none(*pte)) {
 			if (!kvm_s2pte_readonly(pte))
-				kvm_set_s2pte_readonly(pte);
+				kvm_set_s2pte_log_wp(pte);
 		}
 	} while (pte++, addr += PAGE_SIZE, addr != end);
 }
@@ -1643,9 +1643,9 @@ static void kvm_send_hwpoison_signal(unsigned long address,
 	send_sig_info(SIGBUS, &info, current);
 }
 
-static bool fault_supports_stage2_huge_mapping(struct kvm_memory_slot *memslot,
-					       unsigned long hva,
-					       unsigned long map_size)
+static bool
+fault_supports_stage2_huge_mapping(const struct kvm_memory_slot *memslot,
+				   unsigned long hva, unsigned long map_size)
 {
 	gpa_t gpa_start, gpa_end;
 	hva_t uaddr_start, uaddr_end;
@@ -1701,6 +1701,36 @@ static bool fault_supports_stage2_huge_mapping(struct kvm_memory_slot *memslot,
 	       (hva & ~(map_size - 1)) + map_size <= uaddr_end;
 }
 
+/*
+ * Write fault on a page that dirty logging write-protected: the host
+ * mapping has not changed since (any change would have gone through the
+ * MMU notifiers and replaced the PTE), so just log the page and make the
+ * PTE writable again.  This keeps mmap_sem and get_user_pages out of the
+ * path every vCPU takes for each page it dirties during migration.
+ */
+static bool stage2_log_wp_fault(struct kvm *kvm, phys_addr_t fault_ipa)
+{
+	pud_t *pudp;
+	pmd_t *pmdp;
+	pte_t *ptep;
+	bool fixed = false;
+
+	spin_lock(&kvm->mmu_lock);
+	if (!stage2_get_leaf_entry(kvm, fault_ipa, &pudp, &pmdp, &ptep) ||
+	    !ptep || !kvm_s2pte_log_wp(ptep))
+		goto out;
+
+	kvm_set_pte(ptep, kvm_s2pte_mkwrite(kvm_s2pte_clear_log_wp(*ptep)));
+	/* Don't let a cached read-only entry fault again */
+	kvm_tlb_flush_vmid_ipa(kvm, fault_ipa);
+	kvm_set_pfn_dirty(pte_pfn(*ptep));
+	mark_page_dirty(kvm, fault_ipa >> PAGE_SHIFT);
+	fixed = true;
+out:
+	spin_unlock(&kvm->mmu_lock);
+	return fixed;
+}
+
 static int user_mem_abort(struct kvm_vcpu *vcpu, phys_addr_t fault_ipa,
 			  struct kvm_memory_slot *memslot, unsigned long hva,
 			  unsigned long fault_status)
@@ -1728,6 +1758,10 @@ static int user_mem_abort(struct kvm_vcpu *vcpu, phys_addr_t fault_ipa,
 		return -EFAULT;
 	}
 
+	if (fault_status == FSC_PERM && write_fault && logging_active &&
+	    stage2_log_wp_fault(kvm, fault_ipa))
+		return 0;
+
 	/* Let's check if we will get back a huge page backed by hugetlbfs */
 	down_read(&current->mm->mmap_sem);
 	vma = find_vma_intersection(current->mm, hva, hva + 1);
@@ -2293,6 +2327,65 @@ int kvm_mmu_init(void)
 	return err;
 }
 
+/* Is this PTE table mapping part of a huge page on the host side? */
+static bool stage2_ptes_collapsible(pmd_t *pmd, phys_addr_t addr)
+{
+	pte_t *pte = pte_offset_kernel(pmd, addr);
+	struct page *page;
+	int i;
+
+	for (i = 0; i < PTRS_PER_PTE; i++, pte++) {
+		if (pte_none(*pte))
+			continue;
+		if (!pfn_valid(pte_pfn(*pte)))
+			return false;
+		page = pfn_to_page(pte_pfn(*pte));
+		return PageHuge(page) || PageTransCompoundMap(page);
+	}
+
+	return false;
+}
+
+/**
+ * stage2_zap_collapsible() - drop PTE tables that could be block mappings
+ * @kvm:	The KVM pointer
+ * @memslot:	The memory slot that stopped dirty logging
+ *
+ * Dirty logging leaves the slot mapped with pages, and nothing faults
+ * them again to build the blocks back.  Unmap every PTE table backed by
+ * a host huge page, so that the next fault on it maps a PMD (or PUD)
+ * block as it would have before logging started.
+ */
+static void stage2_zap_collapsible(struct kvm *kvm,
+				   const struct kvm_memory_slot *memslot)
+{
+	phys_addr_t addr = memslot->base_gfn << PAGE_SHIFT;
+	phys_addr_t end = addr + (memslot->npages << PAGE_SHIFT);
+	unsigned long hva;
+	pmd_t *pmd;
+
+	spin_lock(&kvm->mmu_lock);
+	for (addr = ALIGN(addr, S2_PMD_SIZE); addr + S2_PMD_SIZE <= end;
+	     addr += S2_PMD_SIZE) {
+		cond_resched_lock(&kvm->mmu_lock);
+		if (!READ_ONCE(kvm->arch.pgd))
+			break;
+
+		hva = memslot->userspace_addr +
+		      (addr - (memslot->base_gfn << PAGE_SHIFT));
+		if (!fault_supports_stage2_huge_mapping(memslot, hva, PMD_SIZE))
+			continue;
+
+		pmd = stage2_get_pmd(kvm, NULL, addr);
+		if (!pmd || pmd_none(*pmd) || pmd_thp_or_huge(*pmd) ||
+		    !stage2_ptes_collapsible(pmd, addr))
+			continue;
+
+		unmap_stage2_range(kvm, addr, S2_PMD_SIZE);
+	}
+	spin_unlock(&kvm->mmu_lock);
+}
+
 void kvm_arch_commit_memory_region(struct kvm *kvm,
 				   const struct kvm_userspace_memory_region *mem,
 				   const struct kvm_memory_slot *old,
@@ -2314,6 +2407,11 @@ void kvm_arch_commit_memory_region(struct kvm *kvm,
 			kvm_mmu_wp_memory_region(kvm, mem->slot);
 		}
 	}
+
+	if (change == KVM_MR_FLAGS_ONLY &&
+	    (old->flags & KVM_MEM_LOG_DIRTY_PAGES) &&
+	    !(new->flags & KVM_MEM_LOG_DIRTY_PAGES))
+		stage2_zap_collapsible(kvm, new);
 }
 
 int kvm_arch_prepare_memory_region(struct kvm *kvm,
@@ -47,9 +47,29 @@ int kvm_hypercall_pvsched_features(struct kvm_vcpu *vcpu)
 	case ARM_SMCCC_HV_PV_SCHED_FEATURES:
 	case ARM_SMCCC_HV_PV_SCHED_IPA_INIT:
 	case ARM_SMCCC_HV_PV_SCHED_IPA_RELEASE:
+	case ARM_SMCCC_HV_PV_SCHED_YIELD:
 		val = SMCCC_RET_SUCCESS;
 		break;
 	}
 
 	return val;
 }
+
+/*
+ * The guest is waiting on the vCPU with MPIDR arg1, which it saw
+ * preempted: give it our time slice instead of spinning through ours.
+ */
+int kvm_hypercall_pvsched_yield(struct kvm_vcpu *vcpu)
+{
+	unsigned long mpidr = smccc_get_arg1(vcpu) & MPIDR_HWID_BITMASK;
+	struct kvm_vcpu *target;
+
+	target = kvm_mpidr_to_vcpu(vcpu->kvm, mpidr);
+	if (!target)
+		return SMCCC_RET_NOT_SUPPORTED;
+
+	if (target != vcpu && READ_ONCE(target->preempted))
+		kvm_vcpu_yield_to(target);
+
+	return SMCCC_RET_SUCCESS;
+}
@@ -49,6 +49,29 @@ TRACE_EVENT(kvm_exit,
 		  __entry->vcpu_pc)
 );
 
+TRACE_EVENT(kvm_exit_handled,
+	TP_PROTO(int ret, unsigned int esr_ec, u64 ns),
+	TP_ARGS(ret, esr_ec, ns),
+
+	TP_STRUCT__entry(
+		__field(	int,		ret		)
+		__field(	unsigned int,	esr_ec		)
+		__field(	u64,		ns		)
+	),
+
+	TP_fast_assign(
+		__entry->ret			= ARM_EXCEPTION_CODE(ret);
+		__entry->esr_ec	= ARM_EXCEPTION_IS_TRAP(ret) ? esr_ec : 0;
+		__entry->ns			= ns;
+	),
+
+	TP_printk("%s: HSR_EC: 0x%04x (%s), handled in %llu ns",
+		  __print_symbolic(__entry->ret, kvm_arm_exception_type),
+		  __entry->esr_ec,
+		  __print_symbolic(__entry->esr_ec, kvm_arm_exception_class),
+		  __entry->ns)
+);
+
 TRACE_EVENT(kvm_guest_fault,
 	TP_PROTO(unsigned long vcpu_pc, unsigned long hsr,
 		 unsigned long hxfar,
@@ -114,6 +137,21 @@ TRACE_EVENT(kvm_irq_line,
 		  __entry->type, __entry->vcpu_idx, __entry->irq_num, __entry->level)
 );
 
+TRACE_EVENT(kvm_fast_mmio,
+	TP_PROTO(phys_addr_t ipa),
+	TP_ARGS(ipa),
+
+	TP_STRUCT__entry(
+		__field(	phys_addr_t,	ipa		)
+	),
+
+	TP_fast_assign(
+		__entry->ipa			= ipa;
+	),
+
+	TP_printk("fast mmio at IPA 0x%llx", (unsigned long long)__entry->ipa)
+);
+
 TRACE_EVENT(kvm_mmio_emulate,
 	TP_PROTO(unsigned long vcpu_pc, unsigned long instr,
 		 unsigned long cpsr),
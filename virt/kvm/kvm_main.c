@@ -2257,9 +2257,17 @@ void kvm_sigset_deactivate(struct kvm_vcpu *vcpu)
 	sigemptyset(&current->real_blocked);
 }
 
+static unsigned int kvm_max_halt_poll_ns(struct kvm *kvm)
+{
+	if (kvm->override_halt_poll_ns)
+		return READ_ONCE(kvm->max_halt_poll_ns);
+
+	return READ_ONCE(halt_poll_ns);
+}
+
 static void grow_halt_poll_ns(struct kvm_vcpu *vcpu)
 {
-	unsigned int old, val, grow;
+	unsigned int old, val, grow, max = kvm_max_halt_poll_ns(vcpu->kvm);
 
 	old = val = vcpu->halt_poll_ns;
 	grow = READ_ONCE(halt_poll_ns_grow);
@@ -2269,8 +2277,8 @@ static void grow_halt_poll_ns(struct kvm_vcpu *vcpu)
 	else
 		val *= grow;
 
-	if (val > halt_poll_ns)
-		val = halt_poll_ns;
+	if (val > max)
+		val = max;
 
 	vcpu->halt_poll_ns = val;
 	trace_kvm_halt_poll_ns_grow(vcpu->vcpu_id, val, old);
@@ -2291,6 +2299,46 @@ static void shrink_halt_poll_ns(struct kvm_vcpu *vcpu)
 	trace_kvm_halt_poll_ns_shrink(vcpu->vcpu_id, val, old);
 }
 
+/*
+ * KVM_HALT_POLL_PREDICT: instead of growing and shrinking the window one
+ * halt at a time, poll just long enough to cover the median of the recent
+ * halts.  When that is beyond the VM's limit, most halts would burn the
+ * whole window and then sleep anyway, so don't poll at all.
+ */
+static void kvm_halt_poll_predict(struct kvm_vcpu *vcpu, u64 block_ns,
+				  unsigned int max)
+{
+	struct kvm_halt_poll_hist *hist = &vcpu->halt_poll_hist;
+	unsigned int old = vcpu->halt_poll_ns, val = 0;
+	u32 sum = 0;
+	int i;
+
+	i = min(fls64(block_ns >> 10), KVM_HALT_POLL_HIST_BUCKETS - 1);
+	hist->bucket[i]++;
+	if (++hist->samples >= KVM_HALT_POLL_HIST_DECAY) {
+		/* Let old behaviour fade out */
+		hist->samples = 0;
+		for (i = 0; i < KVM_HALT_POLL_HIST_BUCKETS; i++) {
+			hist->bucket[i] >>= 1;
+			hist->samples += hist->bucket[i];
+		}
+	}
+
+	for (i = 0; i < KVM_HALT_POLL_HIST_BUCKETS; i++) {
+		sum += hist->bucket[i];
+		if (sum * 2 >= hist->samples)
+			break;
+	}
+	if (i < KVM_HALT_POLL_HIST_BUCKETS && (1024ULL << i) <= max)
+		val = 1024U << i;
+
+	vcpu->halt_poll_ns = val;
+	if (val > old)
+		trace_kvm_halt_poll_ns_grow(vcpu->vcpu_id, val, old);
+	else if (val < old)
+		trace_kvm_halt_poll_ns_shrink(vcpu->vcpu_id, val, old);
+}
+
 static int kvm_vcpu_check_block(struct kvm_vcpu *vcpu)
 {
 	int ret = -EINTR;
@@ -2316,6 +2364,7 @@ static int kvm_vcpu_check_block(struct kvm_vcpu *vcpu)
  */
 void kvm_vcpu_block(struct kvm_vcpu *vcpu)
 {
+	unsigned int max = kvm_max_halt_poll_ns(vcpu->kvm);
 	ktime_t start, cur;
 	DECLARE_SWAITQUEUE(wait);
 	bool waited = false;
@@ -2362,15 +2411,16 @@ void kvm_vcpu_block(struct kvm_vcpu *vcpu)
 
 	if (!vcpu_valid_wakeup(vcpu))
 		shrink_halt_poll_ns(vcpu);
-	else if (halt_poll_ns) {
+	else if (max && vcpu->kvm->halt_poll_predict)
+		kvm_halt_poll_predict(vcpu, block_ns, max);
+	else if (max) {
 		if (block_ns <= vcpu->halt_poll_ns)
 			;
 		/* we had a long block, shrink polling */
-		else if (vcpu->halt_poll_ns && block_ns > halt_poll_ns)
+		else if (vcpu->halt_poll_ns && block_ns > max)
 			shrink_halt_poll_ns(vcpu);
 		/* we had a short halt and our poll time is too small */
-		else if (vcpu->halt_poll_ns < halt_poll_ns &&
-			block_ns < halt_poll_ns)
+		else if (vcpu->halt_poll_ns < max && block_ns < max)
 			grow_halt_poll_ns(vcpu);
 	} else
 		vcpu->halt_poll_ns = 0;
@@ -2614,15 +2664,32 @@ static int create_vcpu_fd(struct kvm_vcpu *vcpu)
 	return anon_inode_getfd(name, &kvm_vcpu_fops, vcpu, O_RDWR | O_CLOEXEC);
 }
 
+static int vcpu_halt_poll_hist_show(struct seq_file *m, void *v)
+{
+	struct kvm_vcpu *vcpu = m->private;
+	struct kvm_halt_poll_hist *hist = &vcpu->halt_poll_hist;
+	int i;
+
+	seq_printf(m, "halt_poll_ns %u\n", READ_ONCE(vcpu->halt_poll_ns));
+	seq_printf(m, "attempted_poll %llu\n",
+		   (u64)vcpu->stat.halt_attempted_poll);
+	seq_printf(m, "successful_poll %llu\n",
+		   (u64)vcpu->stat.halt_successful_poll);
+	seq_printf(m, "poll_invalid %llu\n", (u64)vcpu->stat.halt_poll_invalid);
+	for (i = 0; i < KVM_HALT_POLL_HIST_BUCKETS; i++)
+		seq_printf(m, "<%lluns %u\n", 1024ULL << i,
+			   READ_ONCE(hist->bucket[i]));
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(vcpu_halt_poll_hist);
+
 static int kvm_create_vcpu_debugfs(struct kvm_vcpu *vcpu)
 {
 	char dir_name[ITOA_MAX_LEN * 2];
 	int ret;
 
-	if (!kvm_arch_has_vcpu_debugfs())
-		return 0;
-
-	if (!debugfs_initialized())
+	if (!debugfs_initialized() || !vcpu->kvm->debugfs_dentry)
 		return 0;
 
 	snprintf(dir_name, sizeof(dir_name), "vcpu%d", vcpu->vcpu_id);
@@ -2631,6 +2698,12 @@ static int kvm_create_vcpu_debugfs(struct kvm_vcpu *vcpu)
 	if (!vcpu->debugfs_dentry)
 		return -ENOMEM;
 
+	debugfs_create_file("halt_poll", 0444, vcpu->debugfs_dentry, vcpu,
+			    &vcpu_halt_poll_hist_fops);
+
+	if (!kvm_arch_has_vcpu_debugfs())
+		return 0;
+
 	ret = kvm_arch_create_vcpu_debugfs(vcpu);
 	if (ret < 0) {
 		debugfs_remove_recursive(vcpu->debugfs_dentry);
@@ -3137,6 +3210,7 @@ static long kvm_vm_ioctl_check_extension_generic(struct kvm *kvm, long arg)
 	case KVM_CAP_IOEVENTFD_ANY_LENGTH:
 	case KVM_CAP_CHECK_EXTENSION_VM:
 	case KVM_CAP_ENABLE_CAP_VM:
+	case KVM_CAP_HALT_POLL:
 		return 1;
 #ifdef CONFIG_KVM_MMIO
 	case KVM_CAP_COALESCED_MMIO:
@@ -3183,6 +3257,16 @@ static int kvm_vm_ioctl_enable_cap_generic(struct kvm *kvm,
                 return 0;
         }
 #endif
+	case KVM_CAP_HALT_POLL: {
+		if (cap->flags || cap->args[0] != (unsigned int)cap->args[0] ||
+		    (cap->args[1] & ~KVM_HALT_POLL_PREDICT))
+			return -EINVAL;
+
+		kvm->max_halt_poll_ns = cap->args[0];
+		kvm->halt_poll_predict = cap->args[1] & KVM_HALT_POLL_PREDICT;
+		kvm->override_halt_poll_ns = true;
+		return 0;
+	}
 	default:
 		return kvm_vm_ioctl_enable_cap(kvm, cap);
 	}